@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2021  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -19,6 +19,7 @@ namespace app {
 
 ActiveSiteHandler::ActiveSiteHandler()
 {
+  setDocEvents(kDocLayerEvents | kDocFrameEvents);
 }
 
 ActiveSiteHandler::~ActiveSiteHandler()
@@ -15,6 +15,7 @@
 #include "app/check_update.h"
 #include "app/cli/app_options.h"
 #include "app/cli/cli_processor.h"
+#include "app/cli/cli_server.h"
 #include "app/cli/default_cli_delegate.h"
 #include "app/cli/preview_cli_delegate.h"
 #include "app/color_spaces.h"
@@ -39,6 +40,7 @@
 #include "app/resource_finder.h"
 #include "app/send_crash.h"
 #include "app/site.h"
+#include "app/task_scheduler.h"
 #include "app/tools/active_tool.h"
 #include "app/tools/tool_box.h"
 #include "app/ui/backup_indicator.h"
@@ -46,6 +48,7 @@
 #include "app/ui/doc_view.h"
 #include "app/ui/editor/editor.h"
 #include "app/ui/editor/editor_view.h"
+#include "app/ui/editor/rendered_frame_cache.h"
 #include "app/ui/input_chain.h"
 #include "app/ui/keyboard_shortcuts.h"
 #include "app/ui/main_window.h"
@@ -54,16 +57,19 @@
 #include "app/ui/workspace.h"
 #include "app/ui_context.h"
 #include "app/util/clipboard.h"
+#include "base/chrono.h"
 #include "base/exception.h"
 #include "base/fs.h"
 #include "base/scoped_lock.h"
 #include "base/split_string.h"
+#include "doc/rgbmap.h"
 #include "doc/sprite.h"
 #include "fmt/format.h"
 #include "os/error.h"
 #include "os/surface.h"
 #include "os/system.h"
 #include "os/window.h"
+#include "render/parallel.h"
 #include "render/render.h"
 #include "ui/intern.h"
 #include "ui/ui.h"
@@ -91,6 +97,23 @@ namespace app {
 
 using namespace ui;
 
+namespace {
+
+// Logs the time spent in one phase of the startup (visible with
+// --verbose)
+class StartupPhase {
+public:
+  StartupPhase(const char* name) : m_name(name) { }
+  ~StartupPhase() {
+    LOG(INFO, "APP: %s took %.2f ms\n", m_name, 1000.0*m_chrono.elapsed());
+  }
+private:
+  const char* m_name;
+  base::Chrono m_chrono;
+};
+
+} // anonymous namespace
+
 #ifdef ENABLE_SCRIPTING
 
 namespace {
@@ -220,6 +243,8 @@ App::App(AppMod* mod)
 #endif
 #ifdef ENABLE_SCRIPTING
   , m_engine(new script::Engine)
+  , m_pendingInitActions(false)
+  , m_initActionsExecuted(false)
 #endif
 {
   ASSERT(m_instance == NULL);
@@ -229,6 +254,7 @@ App::App(AppMod* mod)
 int App::initialize(const AppOptions& options)
 {
   os::System* system = os::instance();
+  base::Chrono startupChrono;
 
 #ifdef ENABLE_UI
   m_isGui = options.startUI() && !options.previewCLI();
@@ -236,6 +262,8 @@ int App::initialize(const AppOptions& options)
   m_isGui = false;
 #endif
   m_isShell = options.startShell();
+  if (options.startServer())
+    m_server.reset(new CliServer(options.exeName()));
   m_coreModules = new CoreModules;
 
 #if LAF_WINDOWS
@@ -286,14 +314,30 @@ int App::initialize(const AppOptions& options)
       break;
   }
 
-  initialize_color_spaces(preferences());
+  LOG(INFO, "APP: Configuration loaded in %.2f ms\n",
+      1000.0*startupChrono.elapsed());
+
+  {
+    StartupPhase phase("Color spaces");
+    initialize_color_spaces(preferences());
+    doc::RgbMap::setEagerGeneration(preferences().experimental.eagerRgbmaps());
+
+    // The multi-threaded render uses the app pool of threads
+    render::set_parallel_for(
+      [](const int n, const std::function<void(int)>& func){
+        TaskScheduler::instance()->parallelFor(n, func);
+      });
+  }
 
   // Load modules
-  m_modules = new Modules(createLogInDesktop, preferences());
-  m_legacy = new LegacyModules(isGui() ? REQUIRE_INTERFACE: 0);
+  {
+    StartupPhase phase("Modules");
+    m_modules = new Modules(createLogInDesktop, preferences());
+    m_legacy = new LegacyModules(isGui() ? REQUIRE_INTERFACE: 0);
 #ifdef ENABLE_UI
-  m_brushes.reset(new AppBrushes);
+    m_brushes.reset(new AppBrushes);
 #endif
+  }
 
   // Data recovery is enabled only in GUI mode
   if (isGui() && preferences().general.dataRecovery())
@@ -303,13 +347,18 @@ int App::initialize(const AppOptions& options)
     LOG("APP: Running in portable mode\n");
 
   // Load or create the default palette, or migrate the default
-  // palette from an old format palette to the new one, etc.
-  load_default_palette();
+  // palette from an old format palette to the new one, etc. In batch
+  // mode it's loaded the first time it's used.
+  if (isGui()) {
+    StartupPhase phase("Default palette");
+    load_default_palette();
+  }
 
 #ifdef ENABLE_UI
   // Initialize GUI interface
   if (isGui()) {
     LOG("APP: GUI mode\n");
+    StartupPhase phase("Main window");
 
     // Set the ClipboardDelegate impl to copy/paste text in the native
     // clipboard from the ui::Entry control.
@@ -358,11 +407,21 @@ int App::initialize(const AppOptions& options)
 #endif  // ENABLE_UI
 
 #ifdef ENABLE_SCRIPTING
-  // Call the init() function from all plugins
-  LOG("APP: Initializing scripts...\n");
-  extensions().executeInitActions();
+  // Call the init() function from all plugins. In batch mode this is
+  // done only if a script is executed (see scriptEngine()), so we
+  // don't need to load the extensions for simple conversions.
+  if (isGui()) {
+    LOG("APP: Initializing scripts...\n");
+    StartupPhase phase("Scripts initialization");
+    m_initActionsExecuted = true;
+    extensions().executeInitActions();
+  }
+  else
+    m_pendingInitActions = true;
 #endif
 
+  LOG(INFO, "APP: Startup took %.2f ms\n", 1000.0*startupChrono.elapsed());
+
   // Process options
   LOG("APP: Processing options...\n");
   int code;
@@ -373,6 +432,7 @@ int App::initialize(const AppOptions& options)
     else
       delegate.reset(new DefaultCliDelegate);
 
+    StartupPhase phase("Command line processing");
     CliProcessor cli(delegate.get(), options);
     code = cli.process(context());
   }
@@ -517,17 +577,27 @@ void App::run()
 #ifdef ENABLE_SCRIPTING
   // Start shell to execute scripts.
   if (m_isShell) {
-    m_engine->printLastResult(); // TODO is this needed?
+    script::Engine* engine = scriptEngine();
+    engine->printLastResult(); // TODO is this needed?
     Shell shell;
-    shell.run(*m_engine);
+    shell.run(*engine);
   }
 #endif  // ENABLE_SCRIPTING
 
+  // Execute the jobs received from stdin
+  if (m_server) {
+    m_server->run(context(), std::cin, std::cout);
+    m_server.reset();
+  }
+
   // ----------------------------------------------------------------------
 
 #ifdef ENABLE_SCRIPTING
-  // Call the exit() function from all plugins
-  extensions().executeExitActions();
+  // Call the exit() function from all plugins (only if their init()
+  // function was called)
+  m_pendingInitActions = false;
+  if (m_initActionsExecuted)
+    extensions().executeExitActions();
 #endif
 
 #ifdef ENABLE_UI
@@ -687,6 +757,21 @@ Preferences& App::preferences() const
   return m_coreModules->m_context.preferences();
 }
 
+#ifdef ENABLE_SCRIPTING
+script::Engine* App::scriptEngine()
+{
+  if (m_pendingInitActions) {
+    m_pendingInitActions = false;
+    m_initActionsExecuted = true;
+
+    LOG("APP: Initializing scripts...\n");
+    StartupPhase phase("Scripts initialization");
+    extensions().executeInitActions();
+  }
+  return m_engine.get();
+}
+#endif
+
 Extensions& App::extensions() const
 {
   return m_modules->m_extensions;
@@ -753,6 +838,10 @@ void app_refresh_screen()
   else
     set_current_palette(nullptr, false);
 
+  // Pixels modified without notifications (e.g. Image:drawPixel()
+  // from scripts) must be rendered again
+  RenderedFrameCache::instance()->clear();
+
   // Invalidate the whole screen.
   ui::Manager::getDefault()->invalidate();
 #endif // ENABLE_UI
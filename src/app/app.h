@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -40,6 +40,7 @@ namespace app {
   class AppMod;
   class AppOptions;
   class BackupIndicator;
+  class CliServer;
   class Context;
   class ContextBar;
   class Doc;
@@ -114,7 +115,9 @@ namespace app {
 #endif
 
 #ifdef ENABLE_SCRIPTING
-    script::Engine* scriptEngine() { return m_engine.get(); }
+    // In batch mode the init() functions of the plugins are called
+    // the first time the script engine is requested.
+    script::Engine* scriptEngine();
 #endif
 
     const std::string& memoryDumpFilename() const { return m_memoryDumpFilename; }
@@ -140,6 +143,7 @@ namespace app {
     LegacyModules* m_legacy;
     bool m_isGui;
     bool m_isShell;
+    std::unique_ptr<CliServer> m_server;
     std::unique_ptr<MainWindow> m_mainWindow;
     base::paths m_files;
 #ifdef ENABLE_UI
@@ -148,6 +152,8 @@ namespace app {
 #endif // ENABLE_UI
 #ifdef ENABLE_SCRIPTING
     std::unique_ptr<script::Engine> m_engine;
+    bool m_pendingInitActions;
+    bool m_initActionsExecuted;
 #endif
 
     // Set the memory dump filename to show in the Preferences dialog
@@ -0,0 +1,189 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/cache_manager.h"
+
+#include "app/pref/preferences.h"
+#include "base/debug.h"
+#include "base/log.h"
+#include "base/mem_utils.h"
+
+#include <algorithm>
+#include <limits>
+
+#ifdef _WIN32
+  #include <windows.h>
+#elif defined(__APPLE__)
+  #include <sys/sysctl.h>
+#else
+  #include <fstream>
+  #include <sstream>
+#endif
+
+namespace app {
+
+// static
+CacheManager* CacheManager::instance()
+{
+  static CacheManager singleton;
+  return &singleton;
+}
+
+void CacheManager::add(ManagedCache* cache)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  ASSERT(std::find(m_caches.begin(), m_caches.end(), cache) == m_caches.end());
+  m_caches.push_back(cache);
+}
+
+void CacheManager::remove(ManagedCache* cache)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = std::find(m_caches.begin(), m_caches.end(), cache);
+  ASSERT(it != m_caches.end());
+  if (it != m_caches.end())
+    m_caches.erase(it);
+}
+
+void CacheManager::collect()
+{
+  const int limit = Preferences::instance().cache.sizeLimit();
+  std::size_t budget = (limit > 0 ? std::size_t(limit) * 1024 * 1024:
+                                    std::numeric_limits<std::size_t>::max());
+  budget = std::min(
+    budget, m_requestedBudget.exchange(std::numeric_limits<std::size_t>::max()));
+
+  // Each time that the system is low on memory we remove the half of
+  // the cached data (up to all the cached data if the system is still
+  // low on memory in the next calls)
+  const std::size_t used = bytes();
+  if (used > 0 && isSystemMemoryLow()) {
+    budget = std::min(budget, used / 2);
+    LOG(VERBOSE, "CACHE: System low on memory, reducing caches from %s to %s\n",
+        base::get_pretty_memory_size(used).c_str(),
+        base::get_pretty_memory_size(budget).c_str());
+  }
+
+  if (used > budget)
+    evict(budget);
+}
+
+void CacheManager::requestBudget(const std::size_t maxBytes)
+{
+  std::size_t old = m_requestedBudget;
+  while (maxBytes < old &&
+         !m_requestedBudget.compare_exchange_weak(old, maxBytes)) {
+    // Try again with the new value of "old"
+  }
+}
+
+void CacheManager::evict(const std::size_t maxBytes)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::size_t total = 0;
+  for (const ManagedCache* cache : m_caches)
+    total += cache->cacheBytes();
+
+  while (total > maxBytes) {
+    // Find the cache with the least recently used entry
+    ManagedCache* oldest = nullptr;
+    base::tick_t oldestTick = 0;
+    for (ManagedCache* cache : m_caches) {
+      base::tick_t tick;
+      if (cache->cacheOldestUse(tick) &&
+          (!oldest || tick < oldestTick)) {
+        oldest = cache;
+        oldestTick = tick;
+      }
+    }
+    if (!oldest)
+      break;
+
+    const std::size_t before = oldest->cacheBytes();
+    oldest->evictOldestCacheEntry();
+    const std::size_t after = oldest->cacheBytes();
+    total = (total > before ? total - before: 0) + after;
+  }
+}
+
+std::size_t CacheManager::bytes() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::size_t total = 0;
+  for (const ManagedCache* cache : m_caches)
+    total += cache->cacheBytes();
+  return total;
+}
+
+std::vector<CacheManager::Usage> CacheManager::usage() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::vector<Usage> result;
+  for (const ManagedCache* cache : m_caches) {
+    // Caches with the same name (e.g. the playback cache of each
+    // editor) are reported together
+    auto it = std::find_if(result.begin(), result.end(),
+                           [cache](const Usage& u){
+                             return u.name == cache->cacheName();
+                           });
+    if (it == result.end()) {
+      result.push_back(Usage());
+      it = result.end()-1;
+      it->name = cache->cacheName();
+    }
+    it->bytes += cache->cacheBytes();
+  }
+  return result;
+}
+
+// static
+bool CacheManager::isSystemMemoryLow()
+{
+#ifdef _WIN32
+
+  static HANDLE handle = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+  BOOL state = FALSE;
+  return (handle &&
+          QueryMemoryResourceNotification(handle, &state) &&
+          state);
+
+#elif defined(__APPLE__)
+
+  // Same values as DISPATCH_MEMORYPRESSURE_NORMAL/WARN/CRITICAL
+  int level = 0;
+  size_t len = sizeof(level);
+  if (sysctlbyname("kern.memorystatus_vm_pressure_level",
+                   &level, &len, nullptr, 0) == 0)
+    return (level >= 2);
+  return false;
+
+#else
+
+  // Less than 5% of the physical memory is available
+  std::ifstream f("/proc/meminfo");
+  std::string line;
+  std::size_t total = 0, available = 0;
+  while (std::getline(f, line)) {
+    std::istringstream s(line);
+    std::string field;
+    std::size_t kb = 0;
+    s >> field >> kb;
+    if (field == "MemTotal:")
+      total = kb;
+    else if (field == "MemAvailable:")
+      available = kb;
+  }
+  return (total > 0 && available > 0 && available < total / 20);
+
+#endif
+}
+
+} // namespace app
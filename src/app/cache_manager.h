@@ -0,0 +1,90 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_CACHE_MANAGER_H_INCLUDED
+#define APP_CACHE_MANAGER_H_INCLUDED
+#pragma once
+
+#include "base/time.h"
+
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace app {
+
+  // A cache of objects that can be discarded at any time (because
+  // they can be created again). Each cache must add itself to the
+  // CacheManager when it's completely constructed, and remove itself
+  // before it's destroyed. The CacheManager calls these functions
+  // from the UI thread, so a cache used from several threads must
+  // lock its own mutex.
+  class ManagedCache {
+  public:
+    virtual ~ManagedCache() { }
+
+    virtual const char* cacheName() const = 0;
+    virtual std::size_t cacheBytes() const = 0;
+
+    // Returns false if the cache is empty, or true and the time
+    // (base::current_tick()) when the least recently used entry was
+    // used for the last time.
+    virtual bool cacheOldestUse(base::tick_t& tick) const = 0;
+
+    // Removes the least recently used entry.
+    virtual void evictOldestCacheEntry() = 0;
+  };
+
+  // Keeps the memory used by all caches (rendered frames, playback,
+  // thumbnails, decoded files, etc.) in the budget specified in the
+  // preferences (cache.size_limit), removing the least recently used
+  // entries of all caches first. When the system is low on memory
+  // the caches are reduced even more.
+  class CacheManager {
+  public:
+    struct Usage {
+      std::string name;
+      std::size_t bytes = 0;
+    };
+
+    static CacheManager* instance();
+
+    void add(ManagedCache* cache);
+    void remove(ManagedCache* cache);
+
+    // Removes entries until all caches fit in the budget, called
+    // periodically from the UI thread.
+    void collect();
+
+    // Reduces the budget of the next collect() call to the given
+    // size, it can be called from any thread (e.g. when documents
+    // use most of the total memory limit, see undo.total_size_limit).
+    void requestBudget(const std::size_t maxBytes);
+
+    // Removes the least recently used entries of all caches until the
+    // used memory is less than or equal to "maxBytes".
+    void evict(const std::size_t maxBytes);
+
+    std::size_t bytes() const;
+    std::vector<Usage> usage() const;
+
+    // Returns true if the system reports that it's low on memory.
+    static bool isSystemMemoryLow();
+
+  private:
+    CacheManager() : m_requestedBudget(std::numeric_limits<std::size_t>::max()) { }
+
+    mutable std::mutex m_mutex;
+    std::atomic<std::size_t> m_requestedBudget;
+    std::vector<ManagedCache*> m_caches;
+  };
+
+} // namespace app
+
+#endif
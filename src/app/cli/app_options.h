@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2019  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -36,6 +36,7 @@ public:
 
   bool startUI() const { return m_startUI; }
   bool startShell() const { return m_startShell; }
+  bool startServer() const { return m_startServer; }
   bool previewCLI() const { return m_previewCLI; }
   bool showHelp() const { return m_showHelp; }
   bool showVersion() const { return m_showVersion; }
@@ -58,6 +59,9 @@ public:
   const Option& sheet() const { return m_sheet; }
   const Option& sheetType() const { return m_sheetType; }
   const Option& sheetPack() const { return m_sheetPack; }
+  const Option& sheetPacking() const { return m_sheetPacking; }
+  const Option& sheetCache() const { return m_sheetCache; }
+  const Option& skipUnchanged() const { return m_skipUnchanged; }
   const Option& sheetWidth() const { return m_sheetWidth; }
   const Option& sheetHeight() const { return m_sheetHeight; }
   const Option& sheetColumns() const { return m_sheetColumns; }
@@ -84,13 +88,17 @@ public:
 #ifdef ENABLE_SCRIPTING
   const Option& script() const { return m_script; }
   const Option& scriptParam() const { return m_scriptParam; }
+  const Option& noUndo() const { return m_noUndo; }
+  const Option& scriptProfile() const { return m_scriptProfile; }
 #endif
   const Option& listLayers() const { return m_listLayers; }
   const Option& listTags() const { return m_listTags; }
   const Option& listSlices() const { return m_listSlices; }
   const Option& oneFrame() const { return m_oneFrame; }
+  const Option& jobs() const { return m_jobs; }
 
   bool hasExporterParams() const;
+  bool hasSkipUnchanged() const;
 #ifdef _WIN32
   bool disableWintab() const;
 #endif
@@ -102,6 +110,7 @@ private:
   base::ProgramOptions m_po;
   bool m_startUI;
   bool m_startShell;
+  bool m_startServer;
   bool m_previewCLI;
   bool m_showHelp;
   bool m_showVersion;
@@ -111,6 +120,7 @@ private:
   Option& m_shell;
 #endif
   Option& m_batch;
+  Option& m_server;
   Option& m_preview;
   Option& m_saveAs;
   Option& m_palette;
@@ -124,6 +134,9 @@ private:
   Option& m_sheet;
   Option& m_sheetType;
   Option& m_sheetPack;
+  Option& m_sheetPacking;
+  Option& m_sheetCache;
+  Option& m_skipUnchanged;
   Option& m_sheetWidth;
   Option& m_sheetHeight;
   Option& m_sheetColumns;
@@ -150,11 +163,14 @@ private:
 #ifdef ENABLE_SCRIPTING
   Option& m_script;
   Option& m_scriptParam;
+  Option& m_noUndo;
+  Option& m_scriptProfile;
 #endif
   Option& m_listLayers;
   Option& m_listTags;
   Option& m_listSlices;
   Option& m_oneFrame;
+  Option& m_jobs;
 
   Option& m_verbose;
   Option& m_debug;
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2019  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2016-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 namespace app {
 
@@ -30,11 +31,18 @@ namespace app {
     virtual void beforeOpenFile(const CliOpenFile& cof) { }
     virtual void afterOpenFile(const CliOpenFile& cof) { }
     virtual void saveFile(Context* ctx, const CliOpenFile& cof) { }
+    // Saves all the given files at the same time (each one with its
+    // own CliOpenFile::visibleLayers). Returns false if the files
+    // must be saved one by one with saveFile().
+    virtual bool saveFilesInParallel(Context* ctx, const std::vector<CliOpenFile>& cofs) {
+      return false;
+    }
     virtual void loadPalette(Context* ctx, const CliOpenFile& cof, const std::string& filename) { }
     virtual void exportFiles(Context* ctx, DocExporter& exporter) { }
 #ifdef ENABLE_SCRIPTING
     virtual int execScript(const std::string& filename,
-                           const Params& params) {
+                           const Params& params,
+                           const bool profile) {
       return 0;
     }
 #endif // ENABLE_SCRIPTING
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2016-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -36,6 +36,7 @@ CliOpenFile::CliOpenFile()
   trimByGrid = false;
   oneFrame = false;
   crop = gfx::Rect();
+  outputManifest = nullptr;
 }
 
 FileOpROI CliOpenFile::roi() const
@@ -46,11 +47,13 @@ FileOpROI CliOpenFile::roi() const
   if (hasFrameRange())
     selFrames.insert(fromFrame, toFrame);
 
-  return FileOpROI(document,
-                   slice,
-                   tag,
-                   selFrames,
-                   true);
+  FileOpROI roi(document,
+                slice,
+                tag,
+                selFrames,
+                true);
+  roi.setVisibleLayers(visibleLayers);
+  return roi;
 }
 
 } // namespace app
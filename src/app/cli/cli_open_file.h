@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2016-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -10,6 +10,7 @@
 #pragma once
 
 #include "doc/frame.h"
+#include "doc/selected_layers.h"
 #include "gfx/rect.h"
 
 #include <string>
@@ -19,6 +20,7 @@ namespace app {
 
   class Doc;
   class FileOpROI;
+  class OutputManifest;
 
   struct CliOpenFile {
     Doc* document;
@@ -42,6 +44,14 @@ namespace app {
     bool oneFrame;
     gfx::Rect crop;
 
+    // Layers to save instead of the visible ones (empty means that
+    // the visible layers are saved, see FileOpROI::visibleLayers()).
+    doc::SelectedLayers visibleLayers;
+
+    // Hashes of the previous export used to skip the unchanged
+    // output files (--skip-unchanged), or nullptr.
+    OutputManifest* outputManifest;
+
     CliOpenFile();
 
     bool hasTag() const {
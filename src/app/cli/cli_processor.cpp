@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -37,7 +37,11 @@
 #include "render/dithering_algorithm.h"
 
 #include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <queue>
+#include <thread>
 #include <vector>
 
 namespace app {
@@ -141,6 +145,161 @@ std::string convert_filter_to_layer_path_if_possible(
     return filter;
 }
 
+// One input file processed by a thread with --jobs. The document is
+// isolated from the context (it's only used from the thread that
+// loads/saves it, and then from the main thread to print the output).
+struct CliJob {
+  CliOpenFile cof;                  // Options to open the file
+  std::vector<CliOpenFile> saves;   // Each --save-as of this file
+  std::unique_ptr<Doc> doc;
+  std::string loadErrors;
+  std::string saveErrors;
+  bool done = false;
+};
+
+void save_cli_job_file(Doc* doc,
+                       const CliOpenFile& cof,
+                       const FileOpConfig& config,
+                       std::string& errors)
+{
+  // Same filenames that CliProcessor::saveFile() generates for a
+  // --save-as without layers/tags/slices templates
+  const std::string& fn = cof.filename;
+  std::string filenameFormat = cof.filenameFormat;
+  if (filenameFormat.empty()) { // Default format
+    filenameFormat = get_default_filename_format(
+      fn,
+      true,                             // With path
+      (cof.roi().frames() > 1),         // Has frames
+      false,                            // Has layer
+      false);                           // Has frame tag
+  }
+
+  SelectedLayers filteredLayers;
+  if (cof.hasLayersFilter())
+    CliProcessor::FilterLayers(doc->sprite(),
+                               cof.includeLayers,
+                               cof.excludeLayers,
+                               filteredLayers);
+
+  RestoreVisibleLayers layersVisibility;
+  if (!filteredLayers.empty())
+    layersVisibility.showSelectedLayers(doc->sprite(), filteredLayers);
+
+  FilenameInfo fnInfo;
+  fnInfo.filename(fn);
+
+  std::unique_ptr<FileOp> fop(
+    FileOp::createSaveDocumentOperation(
+      nullptr, cof.roi(),
+      filename_formatter(filenameFormat, fnInfo),
+      filename_formatter(filenameFormat, fnInfo, false),
+      cof.ignoreEmpty,
+      &config));
+  if (!fop)
+    return;
+
+  fop->setOutputManifest(cof.outputManifest);
+
+  if (!fop->hasError()) {
+    try {
+      fop->operate();
+    }
+    catch (const std::exception& e) {
+      fop->setError("Error saving file:\n%s", e.what());
+    }
+    fop->done();
+  }
+  errors += fop->error();
+}
+
+// Returns the parts of the input file that all the --save-as of the
+// job need, so we don't decode cels that are not going to be saved
+// (e.g. frames outside --frame-range or layers without --layer).
+FileOpLoadROI get_cli_job_load_roi(const CliJob& job)
+{
+  FileOpLoadROI roi;
+  if (job.saves.empty())
+    return roi;
+
+  SelectedFrames frames;
+  std::vector<std::string> layers;
+  bool allFrames = false;
+  bool allLayers = false;
+
+  for (const CliOpenFile& cof : job.saves) {
+    // Frame ranges with --tag are relative to the tag (which we
+    // don't know until the file is loaded)
+    if (cof.hasFrameRange() && !cof.hasTag())
+      frames.insert(cof.fromFrame, cof.toFrame);
+    else
+      allFrames = true;
+
+    // Formats with layers (e.g. .aseprite) save all layers anyway,
+    // the --layer filter only hides the other ones
+    if (!cof.includeLayers.empty() &&
+        is_static_image_format(cof.filename)) {
+      layers.insert(layers.end(),
+                    cof.includeLayers.begin(),
+                    cof.includeLayers.end());
+    }
+    else
+      allLayers = true;
+  }
+
+  if (!allFrames)
+    roi.setFrames(frames);
+  if (!allLayers)
+    roi.setLayers(layers);
+  return roi;
+}
+
+void run_cli_job(CliJob& job, const FileOpConfig& config)
+{
+  int flags =
+    FILE_LOAD_DATA_FILE |
+    FILE_LOAD_CREATE_PALETTE |
+    FILE_LOAD_SEQUENCE_NONE;
+  if (job.cof.oneFrame)
+    flags |= FILE_LOAD_ONE_FRAME;
+
+  std::unique_ptr<FileOp> fop(
+    FileOp::createLoadDocumentOperation(
+      nullptr, job.cof.filename, flags, &config));
+  if (!fop)
+    return;
+
+  fop->setLoadROI(get_cli_job_load_roi(job));
+
+  if (!fop->hasError()) {
+    try {
+      fop->operate();
+    }
+    catch (const std::exception& e) {
+      fop->setError("Error loading file:\n%s", e.what());
+    }
+    fop->done();
+    fop->postLoad();
+  }
+  if (fop->hasError() && !fop->isStop())
+    job.loadErrors = fop->error();
+
+  job.doc.reset(fop->releaseDocument());
+  if (!job.doc)
+    return;
+
+  // Show all layers
+  if (job.cof.allLayers) {
+    for (doc::Layer* layer : job.doc->sprite()->allLayers())
+      layer->setVisible(true);
+  }
+
+  for (CliOpenFile& cof : job.saves) {
+    cof.document = job.doc.get();
+    save_cli_job_file(job.doc.get(), cof, config, job.saveErrors);
+  }
+}
+
 } // anonymous namespace
 
 // static
@@ -177,8 +336,13 @@ CliProcessor::CliProcessor(CliDelegate* delegate,
   , m_options(options)
   , m_exporter(nullptr)
 {
-  if (options.hasExporterParams())
+  if (options.hasSkipUnchanged())
+    m_outputManifest.reset(new OutputManifest);
+
+  if (options.hasExporterParams()) {
     m_exporter.reset(new DocExporter);
+    m_exporter->setOutputManifest(m_outputManifest.get());
+  }
 }
 
 int CliProcessor::process(Context* ctx)
@@ -192,12 +356,16 @@ int CliProcessor::process(Context* ctx)
     m_delegate->showVersion();
   }
   // Process other options and file names
-  else if (!m_options.values().empty()) {
+  else if (!m_options.values().empty() &&
+           !processInParallel()) {
 #ifdef ENABLE_SCRIPTING
     Params scriptParams;
+    bool noUndo = false;
+    bool scriptProfile = false;
 #endif
     Console console;
     CliOpenFile cof;
+    cof.outputManifest = m_outputManifest.get();
     SpriteSheetType sheetType = SpriteSheetType::None;
     Doc* lastDoc = nullptr;
     render::DitheringAlgorithm ditheringAlgorithm = render::DitheringAlgorithm::None;
@@ -222,6 +390,8 @@ int CliProcessor::process(Context* ctx)
               format = SpriteSheetDataFormat::JsonHash;
             else if (value.value() == "json-array")
               format = SpriteSheetDataFormat::JsonArray;
+            else if (value.value() == "msgpack")
+              format = SpriteSheetDataFormat::MsgPack;
 
             m_exporter->setDataFormat(format);
           }
@@ -263,11 +433,32 @@ int CliProcessor::process(Context* ctx)
             sheetType = SpriteSheetType::Columns;
           else if (value.value() == "packed")
             sheetType = SpriteSheetType::Packed;
+          else if (value.value() == "maxrects")
+            sheetType = SpriteSheetType::MaxRects;
         }
         // --sheet-pack
         else if (opt == &m_options.sheetPack()) {
           sheetType = SpriteSheetType::Packed;
         }
+        // --sheet-packing <heuristic>
+        else if (opt == &m_options.sheetPacking()) {
+          SpriteSheetPacking packing = SpriteSheetPacking::Default;
+          if (value.value() == "best-short-side-fit")
+            packing = SpriteSheetPacking::BestShortSideFit;
+          else if (value.value() == "best-long-side-fit")
+            packing = SpriteSheetPacking::BestLongSideFit;
+          else if (value.value() == "best-area-fit")
+            packing = SpriteSheetPacking::BestAreaFit;
+          else if (value.value() == "bottom-left")
+            packing = SpriteSheetPacking::BottomLeft;
+          if (m_exporter)
+            m_exporter->setSpriteSheetPacking(packing);
+        }
+        // --sheet-cache
+        else if (opt == &m_options.sheetCache()) {
+          if (m_exporter)
+            m_exporter->setUseCache(true);
+        }
         // --split-layers
         else if (opt == &m_options.splitLayers()) {
           cof.splitLayers = true;
@@ -533,13 +724,17 @@ int CliProcessor::process(Context* ctx)
         else if (opt == &m_options.script()) {
           std::string filename = value.value();
           int code;
+          ctx->setUndoEnabled(!noUndo);
           try {
-            code = m_delegate->execScript(filename, scriptParams);
+            code = m_delegate->execScript(filename, scriptParams,
+                                          scriptProfile);
           }
           catch (const std::exception& ex) {
+            ctx->setUndoEnabled(true);
             Console::showException(ex);
             return -1;
           }
+          ctx->setUndoEnabled(true);
           if (code != 0)
             return code;
         }
@@ -553,6 +748,15 @@ int CliProcessor::process(Context* ctx)
           else
             scriptParams.set(v.c_str(), "1");
         }
+        // --no-undo
+        else if (opt == &m_options.noUndo()) {
+          // Nobody can undo the changes without UI
+          noUndo = !m_options.startUI();
+        }
+        // --script-profile
+        else if (opt == &m_options.scriptProfile()) {
+          scriptProfile = true;
+        }
 #endif
         // --list-layers
         else if (opt == &m_options.listLayers()) {
@@ -579,6 +783,9 @@ int CliProcessor::process(Context* ctx)
         else if (opt == &m_options.oneFrame()) {
           cof.oneFrame = true;
         }
+        // --jobs <N> is ignored if we cannot process the files in
+        // parallel (see processInParallel())
+        // --skip-unchanged is used for all files (see m_outputManifest)
       }
       // File names aren't associated to any option
       else {
@@ -606,6 +813,12 @@ int CliProcessor::process(Context* ctx)
     }
   }
 
+  // Save the hashes of the saved files for the next run
+  if (m_outputManifest && !m_outputManifest->save()) {
+    Console console;
+    console.printf("Error saving the manifest of the output files\n");
+  }
+
   // Running mode
   if (m_options.startUI()) {
     m_delegate->uiMode();
@@ -619,6 +832,169 @@ int CliProcessor::process(Context* ctx)
   return 0;
 }
 
+bool CliProcessor::processInParallel()
+{
+  if (m_options.startUI() ||
+      m_options.startShell() ||
+      m_options.previewCLI() ||
+      m_exporter)
+    return false;
+
+  // Split the command line in independent jobs (one for each input
+  // file). Options that are not related to just one file make the
+  // whole processing sequential.
+  std::vector<CliJob> jobs;
+  CliOpenFile cof;
+  cof.outputManifest = m_outputManifest.get();
+  int nthreads = 0;
+
+  for (const auto& value : m_options.values()) {
+    const AppOptions::Option* opt = value.option();
+
+    // File names aren't associated to any option
+    if (!opt) {
+      jobs.emplace_back();
+      cof.filename = base::normalize_path(value.value());
+      jobs.back().cof = cof;
+    }
+    // --jobs <N>
+    else if (opt == &m_options.jobs()) {
+      nthreads = strtol(value.value().c_str(), nullptr, 0);
+    }
+    // --save-as <filename>
+    else if (opt == &m_options.saveAs()) {
+      const std::string& fn = value.value();
+      if (jobs.empty() ||
+          is_layer_in_filename_format(fn) ||
+          is_group_in_filename_format(fn) ||
+          is_tag_in_filename_format(fn) ||
+          is_slice_in_filename_format(fn))
+        return false;
+
+      CliOpenFile saveCof = cof;
+      saveCof.filename = fn;
+      jobs.back().saves.push_back(saveCof);
+    }
+    else if (opt == &m_options.layer())
+      cof.includeLayers.push_back(value.value());
+    else if (opt == &m_options.ignoreLayer())
+      cof.excludeLayers.push_back(value.value());
+    else if (opt == &m_options.allLayers())
+      cof.allLayers = true;
+    else if (opt == &m_options.tag())
+      cof.tag = value.value();
+    else if (opt == &m_options.frameRange()) {
+      std::vector<std::string> splitRange;
+      base::split_string(value.value(), splitRange, ",");
+      if (splitRange.size() < 2)
+        return false;   // The sequential process shows the error
+
+      cof.fromFrame = base::convert_to<frame_t>(splitRange[0]);
+      cof.toFrame   = base::convert_to<frame_t>(splitRange[1]);
+    }
+    else if (opt == &m_options.ignoreEmpty())
+      cof.ignoreEmpty = true;
+    else if (opt == &m_options.slice())
+      cof.slice = value.value();
+    else if (opt == &m_options.filenameFormat())
+      cof.filenameFormat = value.value();
+    else if (opt == &m_options.listLayers())
+      cof.listLayers = true;
+    else if (opt == &m_options.listTags())
+      cof.listTags = true;
+    else if (opt == &m_options.listSlices())
+      cof.listSlices = true;
+    else if (opt == &m_options.oneFrame())
+      cof.oneFrame = true;
+    else if (opt == &m_options.skipUnchanged())
+      ;                         // Already in cof.outputManifest
+    else
+      return false;
+  }
+
+  nthreads = std::min(nthreads, int(jobs.size()));
+  if (nthreads < 2)
+    return false;
+
+  // Read the configuration from the preferences in this thread (the
+  // FileOp uses the default configuration in other threads)
+  FileOpConfig config;
+  config.fillFromPreferences();
+
+  // Threads don't start a job too far from the one that the main
+  // thread is printing, so we don't keep too many loaded documents
+  // in memory when one file takes too much time.
+  const std::size_t window = 2*nthreads;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::size_t nextJob = 0;
+  std::size_t printedJobs = 0;
+
+  std::vector<std::thread> threads;
+  for (int i=0; i<nthreads; ++i) {
+    threads.emplace_back(
+      [&]{
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+          cv.wait(lock, [&]{
+            return (nextJob >= jobs.size() ||
+                    nextJob < printedJobs + window);
+          });
+          if (nextJob >= jobs.size())
+            break;
+
+          CliJob& job = jobs[nextJob++];
+          lock.unlock();
+          try {
+            run_cli_job(job, config);
+          }
+          catch (const std::exception& e) {
+            job.saveErrors += e.what();
+          }
+          lock.lock();
+
+          job.done = true;
+          cv.notify_all();
+        }
+      });
+  }
+
+  // Print the output of each job in the same order of the command
+  // line (as the sequential process does)
+  Console console;
+  for (CliJob& job : jobs) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&job]{ return job.done; });
+    }
+
+    m_delegate->beforeOpenFile(job.cof);
+    os::instance()->markCliFileAsProcessed(job.cof.filename);
+
+    if (!job.loadErrors.empty())
+      console.printf(job.loadErrors.c_str());
+
+    job.cof.document = job.doc.get();
+    m_delegate->afterOpenFile(job.cof);
+
+    if (!job.saveErrors.empty())
+      console.printf(job.saveErrors.c_str());
+
+    job.cof.document = nullptr;
+    job.doc.reset();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++printedJobs;
+    }
+    cv.notify_all();
+  }
+
+  for (auto& thread : threads)
+    thread.join();
+
+  return true;
+}
+
 bool CliProcessor::openFile(Context* ctx, CliOpenFile& cof)
 {
   m_delegate->beforeOpenFile(cof);
@@ -780,11 +1156,17 @@ void CliProcessor::saveFile(Context* ctx, const CliOpenFile& cof)
   bool layerInFormat = is_layer_in_filename_format(fn);
   bool groupInFormat = is_group_in_filename_format(fn);
 
+  // Files that can be saved without changing the visibility of the
+  // layers, i.e. all of them when we don't trim the sprite (so they
+  // can be saved at the same time)
+  std::vector<CliOpenFile> itemCofs;
+
   for (doc::Slice* slice : slices) {
     for (doc::Tag* tag : tags) {
       // For each layer, hide other ones and save the sprite.
       for (doc::Layer* layer : layers) {
         RestoreVisibleLayers layersVisibility;
+        SelectedLayers visibleLayers;
 
         if (cof.splitLayers) {
           ASSERT(layer);
@@ -794,10 +1176,13 @@ void CliProcessor::saveFile(Context* ctx, const CliOpenFile& cof)
             continue;     // Just ignore this layer.
 
           // Make this layer ("show") the only one visible.
-          layersVisibility.showLayer(layer);
+          visibleLayers.insert(layer);
+          visibleLayers.propagateSelection();
+        }
+        else if (!filteredLayers.empty()) {
+          visibleLayers = filteredLayers;
+          visibleLayers.propagateSelection();
         }
-        else if (!filteredLayers.empty())
-          layersVisibility.showSelectedLayers(doc->sprite(), filteredLayers);
 
         if (layer) {
           if ((layerInFormat && layer->isGroup()) ||
@@ -812,6 +1197,10 @@ void CliProcessor::saveFile(Context* ctx, const CliOpenFile& cof)
         // individually (a process that can be done only in
         // FileOp::operate()).
         if (cof.trim) {
+          // The AutocropSprite command uses the visible layers
+          if (!visibleLayers.empty())
+            layersVisibility.showSelectedLayers(doc->sprite(), visibleLayers);
+
           Params params;
           if (cof.trimByGrid) {
             params.set("byGrid", "true");
@@ -845,17 +1234,28 @@ void CliProcessor::saveFile(Context* ctx, const CliOpenFile& cof)
         itemCof.filename = filename_formatter(filenameFormat, fnInfo);
         itemCof.filenameFormat = filename_formatter(filenameFormat, fnInfo, false);
 
-        // Call delegate
-        m_delegate->saveFile(ctx, itemCof);
-
         if (cof.trim) {
+          // Call delegate
+          m_delegate->saveFile(ctx, itemCof);
+
           ctx->executeCommand(undoCommand);
           clearUndo = true;
         }
+        else {
+          itemCof.visibleLayers = visibleLayers;
+          itemCofs.push_back(itemCof);
+        }
       }
     }
   }
 
+  if (!itemCofs.empty() &&
+      !m_delegate->saveFilesInParallel(ctx, itemCofs)) {
+    // The delegate shows the itemCof.visibleLayers if it's needed
+    for (const CliOpenFile& itemCof : itemCofs)
+      m_delegate->saveFile(ctx, itemCof);
+  }
+
   // Undo crop
   if (!cof.crop.isEmpty()) {
     ctx->executeCommand(undoCommand);
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2016-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -12,6 +12,7 @@
 #include "app/cli/cli_delegate.h"
 #include "app/cli/cli_open_file.h"
 #include "app/doc_exporter.h"
+#include "app/file/output_manifest.h"
 #include "app/util/open_batch.h"
 #include "doc/selected_layers.h"
 
@@ -44,6 +45,12 @@ namespace app {
                              doc::SelectedLayers& filteredLayers);
 
   private:
+    // Processes each input file (and its --save-as) in its own
+    // thread when --jobs is used. Returns false if the command line
+    // cannot be processed in parallel (e.g. it contains commands
+    // that modify all the documents like --scale or --script).
+    bool processInParallel();
+
     bool openFile(Context* ctx, CliOpenFile& cof);
     void saveFile(Context* ctx, const CliOpenFile& cof);
 
@@ -60,6 +67,7 @@ namespace app {
     CliDelegate* m_delegate;
     const AppOptions& m_options;
     std::unique_ptr<DocExporter> m_exporter;
+    std::unique_ptr<OutputManifest> m_outputManifest;
 
     // Files already used in the CLI processing (e.g. when used to
     // load a sequence of files) so we don't ask for them again.
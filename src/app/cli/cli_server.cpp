@@ -0,0 +1,127 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/cli/cli_server.h"
+
+#include "app/cli/app_options.h"
+#include "app/cli/cli_processor.h"
+#include "app/cli/default_cli_delegate.h"
+#include "app/cli/preview_cli_delegate.h"
+#include "app/context.h"
+#include "app/doc.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+
+namespace app {
+
+CliServer::CliServer(const std::string& exeName)
+  : m_exeName(exeName)
+{
+}
+
+void CliServer::run(Context* ctx, std::istream& is, std::ostream& os)
+{
+  std::string line;
+  while (std::getline(is, line)) {
+    std::vector<std::string> args = SplitCommandLine(line);
+    if (args.empty())
+      continue;
+
+    const int code = processJob(ctx, args);
+    os << "done " << code << std::endl;
+  }
+}
+
+int CliServer::processJob(Context* ctx, const std::vector<std::string>& args)
+{
+  // The job is always executed in batch mode
+  std::vector<const char*> argv;
+  argv.push_back(m_exeName.c_str());
+  argv.push_back("--batch");
+  for (const auto& arg : args)
+    argv.push_back(arg.c_str());
+
+  // Documents opened before this job (e.g. by the command line that
+  // started the server) are kept open.
+  const std::vector<Doc*> oldDocs(ctx->documents().begin(),
+                                  ctx->documents().end());
+
+  int code;
+  try {
+    AppOptions options(int(argv.size()), &argv[0]);
+
+    std::unique_ptr<CliDelegate> delegate;
+    if (options.previewCLI())
+      delegate.reset(new PreviewCliDelegate);
+    else
+      delegate.reset(new DefaultCliDelegate);
+
+    CliProcessor cli(delegate.get(), options);
+    code = cli.process(ctx);
+  }
+  catch (const std::exception& ex) {
+    std::cerr << ex.what() << '\n';
+    code = 1;
+  }
+
+  // Close the documents opened by this job
+  std::vector<Doc*> newDocs;
+  for (Doc* doc : ctx->documents()) {
+    if (std::find(oldDocs.begin(), oldDocs.end(), doc) == oldDocs.end())
+      newDocs.push_back(doc);
+  }
+  for (Doc* doc : newDocs) {
+    doc->close();
+    delete doc;
+  }
+  return code;
+}
+
+// static
+std::vector<std::string> CliServer::SplitCommandLine(const std::string& line)
+{
+  std::vector<std::string> args;
+  std::string arg;
+  bool inArg = false;
+  bool inQuotes = false;
+
+  for (std::size_t i=0; i<line.size(); ++i) {
+    const char chr = line[i];
+    // Backslashes are used only to escape quotes and backslashes
+    // (so Windows paths can be used as they are)
+    if (chr == '\\' && i+1 < line.size() &&
+        (line[i+1] == '"' || line[i+1] == '\\')) {
+      arg.push_back(line[++i]);
+      inArg = true;
+    }
+    else if (chr == '"') {
+      inQuotes = !inQuotes;
+      inArg = true;
+    }
+    else if ((chr == ' ' || chr == '\t' || chr == '\r') && !inQuotes) {
+      if (inArg) {
+        args.push_back(arg);
+        arg.clear();
+        inArg = false;
+      }
+    }
+    else {
+      arg.push_back(chr);
+      inArg = true;
+    }
+  }
+  if (inArg)
+    args.push_back(arg);
+  return args;
+}
+
+} // namespace app
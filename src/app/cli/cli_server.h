@@ -0,0 +1,41 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_CLI_CLI_SERVER_H_INCLUDED
+#define APP_CLI_CLI_SERVER_H_INCLUDED
+#pragma once
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace app {
+
+  class Context;
+
+  // Executes CLI jobs read from a stream (one command line per line)
+  // re-using the already initialized App/Context, so the full
+  // startup is paid only once for several jobs. After each job a
+  // "done <exit-code>" line is printed in the output stream.
+  class CliServer {
+  public:
+    CliServer(const std::string& exeName);
+
+    void run(Context* ctx, std::istream& is, std::ostream& os);
+
+    // Splits the given line in arguments (double quotes can be used
+    // to include spaces in one argument, and \" to include quotes).
+    static std::vector<std::string> SplitCommandLine(const std::string& line);
+
+  private:
+    int processJob(Context* ctx, const std::vector<std::string>& args);
+
+    std::string m_exeName;
+  };
+
+} // namespace app
+
+#endif
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2016-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -18,9 +18,15 @@
 #include "app/console.h"
 #include "app/doc.h"
 #include "app/doc_exporter.h"
+#include "app/file/file.h"
+#include "app/file/file_format.h"
+#include "app/file/file_formats_manager.h"
 #include "app/file/palette_file.h"
+#include "app/restore_visible_layers.h"
 #include "app/ui_context.h"
+#include "base/clamp.h"
 #include "base/convert_to.h"
+#include "dio/detect_format.h"
 #include "doc/layer.h"
 #include "doc/palette.h"
 #include "doc/slice.h"
@@ -33,8 +39,11 @@
   #include "app/script/engine.h"
 #endif
 
+#include <atomic>
 #include <iostream>
 #include <memory>
+#include <thread>
+#include <vector>
 
 namespace app {
 
@@ -78,8 +87,64 @@ void DefaultCliDelegate::afterOpenFile(const CliOpenFile& cof)
   }
 }
 
+// Returns true if the given file is saved as a sequence of images,
+// the only kind of formats that render the frames with
+// FileOpROI::visibleLayers() (e.g. .aseprite or .gif files use the
+// visibility of each layer)
+static bool saved_with_roi_layers(const std::string& filename)
+{
+  const FileFormat* format =
+    FileFormatsManager::instance()->getFileFormat(
+      dio::detect_format_by_file_extension(filename));
+  return (format && format->support(FILE_SUPPORT_SEQUENCES));
+}
+
 void DefaultCliDelegate::saveFile(Context* ctx, const CliOpenFile& cof)
 {
+  // In batch mode there is no need to execute the SaveFileCopyAs
+  // command (which notifies the document observers and saves the
+  // file in a background thread), we can save the file directly in
+  // this thread.
+  const bool headless = !ctx->isUIAvailable();
+
+  // The layers are shown/hidden only when the FileOp cannot render
+  // the frames with FileOpROI::visibleLayers()
+  RestoreVisibleLayers layersVisibility;
+  if (!cof.visibleLayers.empty() &&
+      (!headless || !saved_with_roi_layers(cof.filename))) {
+    layersVisibility.showSelectedLayers(cof.document->sprite(),
+                                        cof.visibleLayers);
+  }
+
+  if (headless) {
+    std::unique_ptr<FileOp> fop(
+      FileOp::createSaveDocumentOperation(
+        ctx, cof.roi(),
+        cof.filename,
+        cof.filenameFormat,
+        cof.ignoreEmpty));
+    if (!fop)
+      return;
+
+    fop->setOutputManifest(cof.outputManifest);
+
+    if (!fop->hasError()) {
+      try {
+        fop->operate();
+      }
+      catch (const std::exception& e) {
+        fop->setError("Error saving file:\n%s", e.what());
+      }
+      fop->done();
+    }
+
+    if (fop->hasError()) {
+      Console console;
+      console.printf(fop->error().c_str());
+    }
+    return;
+  }
+
   Command* saveAsCommand = Commands::instance()->byId(CommandId::SaveFileCopyAs());
   Params params;
   params.set("filename", cof.filename.c_str());
@@ -102,6 +167,66 @@ void DefaultCliDelegate::saveFile(Context* ctx, const CliOpenFile& cof)
   ctx->executeCommand(saveAsCommand, params);
 }
 
+bool DefaultCliDelegate::saveFilesInParallel(Context* ctx,
+                                             const std::vector<CliOpenFile>& cofs)
+{
+  if (cofs.size() < 2)
+    return false;
+
+  for (const CliOpenFile& cof : cofs) {
+    if (!saved_with_roi_layers(cof.filename))
+      return false;
+  }
+
+  // Create the file operations in this thread (as SaveFileCopyAs
+  // does), they don't modify the document so they can be executed at
+  // the same time.
+  std::vector<std::unique_ptr<FileOp>> fops;
+  for (const CliOpenFile& cof : cofs) {
+    fops.emplace_back(
+      FileOp::createSaveDocumentOperation(
+        ctx, cof.roi(),
+        cof.filename,
+        cof.filenameFormat,
+        cof.ignoreEmpty));
+    if (fops.back())
+      fops.back()->setOutputManifest(cof.outputManifest);
+  }
+
+  std::atomic<int> next(0);
+  const int nthreads =
+    base::clamp(int(std::thread::hardware_concurrency()), 1, int(fops.size()));
+  std::vector<std::thread> threads;
+  for (int i=0; i<nthreads; ++i) {
+    threads.emplace_back(
+      [&fops, &next]{
+        for (int j=next++; j<int(fops.size()); j=next++) {
+          FileOp* fop = fops[j].get();
+          if (!fop || fop->hasError())
+            continue;
+
+          try {
+            fop->operate();
+          }
+          catch (const std::exception& e) {
+            fop->setError("Error saving file:\n%s", e.what());
+          }
+          fop->done();
+        }
+      });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  // Show errors in the same order of the files
+  Console console;
+  for (const auto& fop : fops) {
+    if (fop && fop->hasError())
+      console.printf(fop->error().c_str());
+  }
+  return true;
+}
+
 void DefaultCliDelegate::loadPalette(Context* ctx,
                                      const CliOpenFile& cof,
                                      const std::string& filename)
@@ -135,10 +260,18 @@ void DefaultCliDelegate::exportFiles(Context* ctx, DocExporter& exporter)
 
 #ifdef ENABLE_SCRIPTING
 int DefaultCliDelegate::execScript(const std::string& filename,
-                                   const Params& params)
+                                   const Params& params,
+                                   const bool profile)
 {
   auto engine = App::instance()->scriptEngine();
-  if (!engine->evalFile(filename, params))
+  if (profile)
+    engine->startProfiler();
+
+  const bool ok = engine->evalFile(filename, params);
+
+  if (profile)
+    engine->consolePrint(engine->stopProfiler().c_str());
+  if (!ok)
     throw base::Exception("Error executing script %s", filename.c_str());
   return engine->returnCode();
 }
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2019  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2016-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -19,11 +19,13 @@ namespace app {
     void showVersion() override;
     void afterOpenFile(const CliOpenFile& cof) override;
     void saveFile(Context* ctx, const CliOpenFile& cof) override;
+    bool saveFilesInParallel(Context* ctx, const std::vector<CliOpenFile>& cofs) override;
     void loadPalette(Context* ctx, const CliOpenFile& cof, const std::string& filename) override;
     void exportFiles(Context* ctx, DocExporter& exporter) override;
 #ifdef ENABLE_SCRIPTING
     int execScript(const std::string& filename,
-                   const Params& params) override;
+                   const Params& params,
+                   const bool profile) override;
 #endif
   };
 
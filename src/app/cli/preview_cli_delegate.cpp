@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2016-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -187,6 +187,7 @@ void PreviewCliDelegate::exportFiles(Context* ctx, DocExporter& exporter)
     case SpriteSheetType::Rows:       type = "Rows";       break;
     case SpriteSheetType::Columns:    type = "Columns";    break;
     case SpriteSheetType::Packed:     type = "Packed";     break;
+    case SpriteSheetType::MaxRects:   type = "MaxRects";   break;
   }
 
   gfx::Size size = exporter.calculateSheetSize();
@@ -204,6 +205,7 @@ void PreviewCliDelegate::exportFiles(Context* ctx, DocExporter& exporter)
     switch (exporter.dataFormat()) {
       case SpriteSheetDataFormat::JsonHash: format = "JSON Hash"; break;
       case SpriteSheetDataFormat::JsonArray: format = "JSON Array"; break;
+      case SpriteSheetDataFormat::MsgPack: format = "MessagePack"; break;
     }
     std::cout << "  - Save data file: '" << exporter.dataFilename() << "'\n"
               << "  - Data format: " << format << "\n";
@@ -217,9 +219,11 @@ void PreviewCliDelegate::exportFiles(Context* ctx, DocExporter& exporter)
 
 #ifdef ENABLE_SCRIPTING
 int PreviewCliDelegate::execScript(const std::string& filename,
-                                   const Params& params)
+                                   const Params& params,
+                                   const bool profile)
 {
-  std::cout << "- Run script: '" << filename << "'\n";
+  std::cout << "- Run script: '" << filename << "'"
+            << (profile ? " (with profiler)": "") << "\n";
   if (!params.empty()) {
     std::cout << "  - With app.params = {\n";
     for (const auto& kv : params)
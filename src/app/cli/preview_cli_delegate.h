@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2019  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2016-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -35,7 +35,8 @@ namespace app {
     void exportFiles(Context* ctx, DocExporter& exporter) override;
 #ifdef ENABLE_SCRIPTING
     int execScript(const std::string& filename,
-                   const Params& params) override;
+                   const Params& params,
+                   const bool profile) override;
 #endif // ENABLE_SCRIPTING
 
   private:
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -89,6 +90,21 @@ size_t Cmd::memSize() const
   return onMemSize();
 }
 
+void Cmd::compressUndoData()
+{
+  onCompressUndoData();
+}
+
+void Cmd::spillUndoData()
+{
+  onSpillUndoData();
+}
+
+void Cmd::prepareUndoData(base::task_token& token)
+{
+  onPrepareUndoData(token);
+}
+
 void Cmd::onExecute()
 {
   // Do nothing
@@ -119,4 +135,19 @@ size_t Cmd::onMemSize() const {
   return sizeof(*this);
 }
 
+void Cmd::onCompressUndoData()
+{
+  // Do nothing
+}
+
+void Cmd::onSpillUndoData()
+{
+  // Do nothing
+}
+
+void Cmd::onPrepareUndoData(base::task_token& token)
+{
+  // Do nothing
+}
+
 } // namespace app
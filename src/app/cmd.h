@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -13,6 +14,10 @@
 
 #include <string>
 
+namespace base {
+  class task_token;
+}
+
 namespace app {
 
   class Context;
@@ -32,6 +37,19 @@ namespace app {
     std::string label() const;
     size_t memSize() const;
 
+    // Called when this command is not in the latest undo steps, so
+    // its undo data can be compressed in the background.
+    void compressUndoData();
+
+    // Called to move the undo data of old commands to disk when the
+    // undo history is too big.
+    void spillUndoData();
+
+    // Loads in memory the data needed to undo/redo this command (e.g.
+    // compressed or spilled buffers). It's called from a background
+    // thread, so it must not modify the document.
+    void prepareUndoData(base::task_token& token);
+
     Context* context() const { return m_ctx; }
 
   protected:
@@ -41,6 +59,9 @@ namespace app {
     virtual void onFireNotifications();
     virtual std::string onLabel() const;
     virtual size_t onMemSize() const;
+    virtual void onCompressUndoData();
+    virtual void onSpillUndoData();
+    virtual void onPrepareUndoData(base::task_token& token);
 
   private:
     Context* m_ctx;
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2020  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -21,6 +21,8 @@
 #include "doc/layer.h"
 #include "doc/subobjects_io.h"
 
+#include <sstream>
+
 namespace app {
 namespace cmd {
 
@@ -31,7 +33,11 @@ using namespace doc;
 AddCel::AddCel(Layer* layer, Cel* cel)
   : WithLayer(layer)
   , WithCel(cel)
-  , m_size(0)
+  , m_hasData(false)
+{
+}
+
+AddCel::~AddCel()
 {
 }
 
@@ -53,16 +59,9 @@ void AddCel::onUndo()
   ASSERT(cel);
 
   // Save the CelData only if the cel isn't linked
-  bool has_data = (cel->links() == 0);
-  write8(m_stream, has_data ? 1: 0);
-  if (has_data) {
-    write_image(m_stream, cel->image());
-    write_celdata(m_stream, cel->data());
-  }
-  write_cel(m_stream, cel);
-  m_size = size_t(m_stream.tellp());
-
-  removeCel(layer, cel);
+  m_hasData = (cel->links() == 0);
+  m_detachedCel.reset(removeCel(layer, cel));
+  m_detachedObjects.detachCel(m_detachedCel.get(), m_hasData);
 }
 
 void AddCel::onRedo()
@@ -70,23 +69,66 @@ void AddCel::onRedo()
   Layer* layer = this->layer();
   ASSERT(layer);
 
-  SubObjectsFromSprite io(layer->sprite());
-  bool has_data = (read8(m_stream) != 0);
-  if (has_data) {
-    ImageRef image(read_image(m_stream));
-    io.addImageRef(image);
-
-    CelDataRef celdata(read_celdata(m_stream, &io));
-    io.addCelDataRef(celdata);
+  Cel* cel;
+  if (m_detachedCel) {
+    m_detachedObjects.attach();
+    cel = m_detachedCel.release();
+  }
+  else {
+    const base::buffer& data = m_data.data();
+    std::stringstream stream(std::string(data.begin(), data.end()));
+
+    SubObjectsFromSprite io(layer->sprite());
+    bool has_data = (read8(stream) != 0);
+    if (has_data) {
+      ImageRef image(read_image(stream));
+      io.addImageRef(image);
+
+      CelDataRef celdata(read_celdata(stream, &io));
+      io.addCelDataRef(celdata);
+    }
+    cel = read_cel(stream, &io);
+    ASSERT(cel);
+
+    m_data.reset();
   }
-  Cel* cel = read_cel(m_stream, &io);
-  ASSERT(cel);
 
   addCel(layer, cel);
+}
 
-  m_stream.str(std::string());
-  m_stream.clear();
-  m_size = 0;
+size_t AddCel::onMemSize() const
+{
+  size_t size = sizeof(*this) + m_data.size();
+  if (m_detachedCel) {
+    size += (m_hasData ? m_detachedCel->getMemSize():
+                         sizeof(Cel));
+  }
+  return size;
+}
+
+void AddCel::onSpillUndoData()
+{
+  if (!m_detachedCel)
+    return;
+
+  // The original IDs are serialized with the cel
+  m_detachedObjects.attach();
+
+  std::stringstream stream;
+  write8(stream, m_hasData ? 1: 0);
+  if (m_hasData) {
+    // Store the image pixels without compression, the whole buffer
+    // is spilled to disk or deflated in a background thread.
+    write_image(stream, m_detachedCel->image(), nullptr, 0);
+    write_celdata(stream, m_detachedCel->data());
+  }
+  write_cel(stream, m_detachedCel.get());
+  m_detachedCel.reset();
+
+  const std::string str = stream.str();
+  m_data.reset(base::buffer(str.begin(), str.end()));
+  if (!m_data.spillToDisk())
+    m_data.compressInBackground();
 }
 
 void AddCel::addCel(Layer* layer, Cel* cel)
@@ -99,24 +141,23 @@ void AddCel::addCel(Layer* layer, Cel* cel)
   ev.sprite(layer->sprite());
   ev.layer(layer);
   ev.cel(cel);
-  doc->notify_observers<DocEvent&>(&DocObserver::onAddCel, ev);
+  doc->notify<&DocObserver::onAddCel>(ev);
 }
 
-void AddCel::removeCel(Layer* layer, Cel* cel)
+Cel* AddCel::removeCel(Layer* layer, Cel* cel)
 {
   Doc* doc = static_cast<Doc*>(cel->document());
   DocEvent ev(doc);
   ev.sprite(layer->sprite());
   ev.layer(layer);
   ev.cel(cel);
-  doc->notify_observers<DocEvent&>(&DocObserver::onBeforeRemoveCel, ev);
+  doc->notify<&DocObserver::onBeforeRemoveCel>(ev);
 
   static_cast<LayerImage*>(layer)->removeCel(cel);
   layer->incrementVersion();
 
-  doc->notify_observers<DocEvent&>(&DocObserver::onAfterRemoveCel, ev);
-
-  delete cel;
+  doc->notify<&DocObserver::onAfterRemoveCel>(ev);
+  return cel;
 }
 
 } // namespace cmd
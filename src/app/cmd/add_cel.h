@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -9,10 +10,12 @@
 #pragma once
 
 #include "app/cmd.h"
+#include "app/cmd/detached_objects.h"
 #include "app/cmd/with_cel.h"
 #include "app/cmd/with_layer.h"
+#include "app/util/compressed_buffer.h"
 
-#include <sstream>
+#include <memory>
 
 namespace doc {
   class Cel;
@@ -28,21 +31,32 @@ namespace cmd {
                , public WithCel {
   public:
     AddCel(Layer* layer, Cel* cel);
+    ~AddCel();
 
   protected:
     void onExecute() override;
     void onUndo() override;
     void onRedo() override;
-    size_t onMemSize() const override {
-      return sizeof(*this) + m_size;
+    size_t onMemSize() const override;
+    void onSpillUndoData() override;
+    void onPrepareUndoData(base::task_token& token) override {
+      if (!m_detachedCel)
+        m_data.data();
     }
 
   private:
     void addCel(Layer* layer, Cel* cel);
-    void removeCel(Layer* layer, Cel* cel);
+    Cel* removeCel(Layer* layer, Cel* cel);
 
-    size_t m_size;
-    std::stringstream m_stream;
+    // The removed cel is kept alive (detached from its layer) until
+    // the undo history needs to free memory, in that case it's
+    // serialized in m_data (with its image stored without
+    // compression, and compressed in a background thread or moved to
+    // disk). Its IDs are unregistered while it's detached.
+    std::unique_ptr<Cel> m_detachedCel;
+    DetachedObjects m_detachedObjects;
+    bool m_hasData;
+    CompressedBuffer m_data;
   };
 
 } // namespace cmd
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -56,7 +57,7 @@ void AddFrame::onExecute()
   DocEvent ev(doc);
   ev.sprite(sprite);
   ev.frame(m_newFrame);
-  doc->notify_observers<DocEvent&>(&DocObserver::onAddFrame, ev);
+  doc->notify<&DocObserver::onAddFrame>(ev);
 }
 
 void AddFrame::onUndo()
@@ -74,7 +75,7 @@ void AddFrame::onUndo()
   DocEvent ev(doc);
   ev.sprite(sprite);
   ev.frame(m_newFrame);
-  doc->notify_observers<DocEvent&>(&DocObserver::onRemoveFrame, ev);
+  doc->notify<&DocObserver::onRemoveFrame>(ev);
 }
 
 } // namespace cmd
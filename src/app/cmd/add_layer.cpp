@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -16,6 +17,8 @@
 #include "doc/layer_io.h"
 #include "doc/subobjects_io.h"
 
+#include <sstream>
+
 namespace app {
 namespace cmd {
 
@@ -25,7 +28,10 @@ AddLayer::AddLayer(Layer* group, Layer* newLayer, Layer* afterThis)
   : m_group(group)
   , m_newLayer(newLayer)
   , m_afterThis(afterThis)
-  , m_size(0)
+{
+}
+
+AddLayer::~AddLayer()
 {
 }
 
@@ -43,24 +49,55 @@ void AddLayer::onUndo()
   Layer* group = m_group.layer();
   Layer* layer = m_newLayer.layer();
 
-  write_layer(m_stream, layer);
-  m_size = size_t(m_stream.tellp());
-
-  removeLayer(group, layer);
+  m_detachedLayer.reset(removeLayer(group, layer));
+  m_detachedObjects.detachLayer(m_detachedLayer.get());
 }
 
 void AddLayer::onRedo()
 {
   Layer* group = m_group.layer();
-  SubObjectsFromSprite io(group->sprite());
-  Layer* newLayer = read_layer(m_stream, &io);
+  Layer* newLayer;
+  if (m_detachedLayer) {
+    m_detachedObjects.attach();
+    newLayer = m_detachedLayer.release();
+  }
+  else {
+    const base::buffer& data = m_data.data();
+    std::stringstream stream(std::string(data.begin(), data.end()));
+
+    SubObjectsFromSprite io(group->sprite());
+    newLayer = read_layer(stream, &io);
+
+    m_data.reset();
+  }
   Layer* afterThis = m_afterThis.layer();
 
   addLayer(group, newLayer, afterThis);
+}
+
+size_t AddLayer::onMemSize() const
+{
+  size_t size = sizeof(*this) + m_data.size();
+  if (m_detachedLayer)
+    size += m_detachedLayer->getMemSize();
+  return size;
+}
+
+void AddLayer::onSpillUndoData()
+{
+  if (!m_detachedLayer)
+    return;
 
-  m_stream.str(std::string());
-  m_stream.clear();
-  m_size = 0;
+  // The original IDs are serialized with the layer
+  m_detachedObjects.attach();
+
+  std::stringstream stream;
+  write_layer(stream, m_detachedLayer.get());
+  m_detachedLayer.reset();
+
+  const std::string str = stream.str();
+  m_data.reset(base::buffer(str.begin(), str.end()));
+  m_data.spillToDisk();
 }
 
 void AddLayer::addLayer(Layer* group, Layer* newLayer, Layer* afterThis)
@@ -73,24 +110,23 @@ void AddLayer::addLayer(Layer* group, Layer* newLayer, Layer* afterThis)
   DocEvent ev(doc);
   ev.sprite(group->sprite());
   ev.layer(newLayer);
-  doc->notify_observers<DocEvent&>(&DocObserver::onAddLayer, ev);
+  doc->notify<&DocObserver::onAddLayer>(ev);
 }
 
-void AddLayer::removeLayer(Layer* group, Layer* layer)
+Layer* AddLayer::removeLayer(Layer* group, Layer* layer)
 {
   Doc* doc = static_cast<Doc*>(group->sprite()->document());
   DocEvent ev(doc);
   ev.sprite(layer->sprite());
   ev.layer(layer);
-  doc->notify_observers<DocEvent&>(&DocObserver::onBeforeRemoveLayer, ev);
+  doc->notify<&DocObserver::onBeforeRemoveLayer>(ev);
 
   static_cast<LayerGroup*>(group)->removeLayer(layer);
   group->incrementVersion();
   group->sprite()->incrementVersion();
 
-  doc->notify_observers<DocEvent&>(&DocObserver::onAfterRemoveLayer, ev);
-
-  delete layer;
+  doc->notify<&DocObserver::onAfterRemoveLayer>(ev);
+  return layer;
 }
 
 } // namespace cmd
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -9,9 +10,11 @@
 #pragma once
 
 #include "app/cmd.h"
+#include "app/cmd/detached_objects.h"
 #include "app/cmd/with_layer.h"
+#include "app/util/compressed_buffer.h"
 
-#include <sstream>
+#include <memory>
 
 namespace doc {
   class Layer;
@@ -24,24 +27,34 @@ namespace cmd {
   class AddLayer : public Cmd {
   public:
     AddLayer(Layer* group, Layer* newLayer, Layer* afterThis);
+    ~AddLayer();
 
   protected:
     void onExecute() override;
     void onUndo() override;
     void onRedo() override;
-    size_t onMemSize() const override {
-      return sizeof(*this) + m_size;
+    size_t onMemSize() const override;
+    void onSpillUndoData() override;
+    void onPrepareUndoData(base::task_token& token) override {
+      if (!m_detachedLayer)
+        m_data.data();
     }
 
   private:
     void addLayer(Layer* group, Layer* newLayer, Layer* afterThis);
-    void removeLayer(Layer* group, Layer* layer);
+    Layer* removeLayer(Layer* group, Layer* layer);
 
     WithLayer m_group;
     WithLayer m_newLayer;
     WithLayer m_afterThis;
-    size_t m_size;
-    std::stringstream m_stream;
+
+    // The removed layer (with all its cels) is kept alive until the
+    // undo history needs to free memory, in that case it's serialized
+    // in m_data (and moved to disk if it's possible). Its IDs are
+    // unregistered while it's detached.
+    std::unique_ptr<Layer> m_detachedLayer;
+    DetachedObjects m_detachedObjects;
+    CompressedBuffer m_data;
   };
 
 } // namespace cmd
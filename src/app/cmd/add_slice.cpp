@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2017  David Capello
 //
 // This program is distributed under the terms of
@@ -68,7 +68,7 @@ void AddSlice::addSlice(Sprite* sprite, Slice* slice)
   DocEvent ev(doc);
   ev.sprite(sprite);
   ev.slice(slice);
-  doc->notify_observers<DocEvent&>(&DocObserver::onAddSlice, ev);
+  doc->notify<&DocObserver::onAddSlice>(ev);
 }
 
 void AddSlice::removeSlice(Sprite* sprite, Slice* slice)
@@ -77,7 +77,7 @@ void AddSlice::removeSlice(Sprite* sprite, Slice* slice)
   DocEvent ev(doc);
   ev.sprite(sprite);
   ev.slice(slice);
-  doc->notify_observers<DocEvent&>(&DocObserver::onRemoveSlice, ev);
+  doc->notify<&DocObserver::onRemoveSlice>(ev);
 
   sprite->slices().remove(slice);
   sprite->incrementVersion();
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -42,7 +42,7 @@ void AddTag::onExecute()
   DocEvent ev(doc);
   ev.sprite(sprite);
   ev.tag(tag);
-  doc->notify_observers<DocEvent&>(&DocObserver::onAddTag, ev);
+  doc->notify<&DocObserver::onAddTag>(ev);
 }
 
 void AddTag::onUndo()
@@ -58,7 +58,7 @@ void AddTag::onUndo()
     DocEvent ev(doc);
     ev.sprite(sprite);
     ev.tag(tag);
-    doc->notify_observers<DocEvent&>(&DocObserver::onRemoveTag, ev);
+    doc->notify<&DocObserver::onRemoveTag>(ev);
   }
 
   sprite->tags().remove(tag);
@@ -83,7 +83,7 @@ void AddTag::onRedo()
   DocEvent ev(doc);
   ev.sprite(sprite);
   ev.tag(tag);
-  doc->notify_observers<DocEvent&>(&DocObserver::onAddTag, ev);
+  doc->notify<&DocObserver::onAddTag>(ev);
 }
 
 } // namespace cmd
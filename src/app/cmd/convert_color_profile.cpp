@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -14,100 +14,204 @@
 #include "app/cmd/replace_image.h"
 #include "app/cmd/set_palette.h"
 #include "app/doc.h"
+#include "app/task_scheduler.h"
 #include "doc/cels_range.h"
 #include "doc/palette.h"
 #include "doc/sprite.h"
 #include "os/color_space.h"
 #include "os/system.h"
 
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
 namespace app {
 namespace cmd {
 
-static doc::ImageRef convert_image_color_space(const doc::Image* srcImage,
-                                               const gfx::ColorSpaceRef& newCS,
-                                               os::ColorSpaceConversion* conversion)
+namespace {
+
+// Number of pixels converted by each parallel job
+const int kPixelsPerJob = 64*1024;
+
+// Recently used conversions, creating a conversion (parsing the ICC
+// profiles, building the transform) is slower than converting a
+// small image, and several images/palettes are converted between
+// the same pair of profiles (e.g. when a file is loaded).
+struct CachedConversion {
+  gfx::ColorSpaceRef src, dst;
+  os::Ref<os::ColorSpaceConversion> conversion;
+};
+const std::size_t kMaxCachedConversions = 8;
+std::mutex g_conversionsMutex;
+std::vector<CachedConversion> g_conversions;
+
+os::Ref<os::ColorSpaceConversion> get_conversion(const gfx::ColorSpaceRef& srcCS,
+                                                 const gfx::ColorSpaceRef& dstCS)
 {
-  ImageSpec spec = srcImage->spec();
-  spec.setColorSpace(newCS);
-  ImageRef dstImage(Image::create(spec));
-
-  if (!conversion) {
-    dstImage->copy(srcImage, gfx::Clip(0, 0, srcImage->bounds()));
-    return dstImage;
+  std::lock_guard<std::mutex> lock(g_conversionsMutex);
+
+  for (auto it=g_conversions.begin(); it!=g_conversions.end(); ++it) {
+    if (it->src->nearlyEqual(*srcCS) &&
+        it->dst->nearlyEqual(*dstCS)) {
+      // Move to the front as the most recently used one
+      std::rotate(g_conversions.begin(), it, it+1);
+      return g_conversions.front().conversion;
+    }
   }
 
-  if (spec.colorMode() == doc::ColorMode::RGB) {
-    for (int y=0; y<spec.height(); ++y) {
+  os::System* system = os::instance();
+  auto srcOCS = system->makeColorSpace(srcCS);
+  auto dstOCS = system->makeColorSpace(dstCS);
+  ASSERT(srcOCS);
+  ASSERT(dstOCS);
+
+  CachedConversion item;
+  item.src = srcCS;
+  item.dst = dstCS;
+  item.conversion = system->convertBetweenColorSpace(srcOCS, dstOCS);
+
+  if (g_conversions.size() >= kMaxCachedConversions)
+    g_conversions.pop_back();
+  g_conversions.insert(g_conversions.begin(), item);
+  return item.conversion;
+}
+
+void convert_image_rows(const doc::Image* srcImage,
+                        doc::Image* dstImage,
+                        os::ColorSpaceConversion* conversion,
+                        const int y0, const int y1)
+{
+  const int w = srcImage->width();
+
+  if (srcImage->colorMode() == doc::ColorMode::RGB) {
+    for (int y=y0; y<y1; ++y) {
       conversion->convertRgba((uint32_t*)dstImage->getPixelAddress(0, y),
                               (const uint32_t*)srcImage->getPixelAddress(0, y),
-                              spec.width());
+                              w);
     }
   }
-  else if (spec.colorMode() == doc::ColorMode::GRAYSCALE) {
+  else if (srcImage->colorMode() == doc::ColorMode::GRAYSCALE) {
     // TODO create a set of functions to create pixel format
     // conversions (this should be available when we add new kind of
     // pixel formats).
-    std::vector<uint8_t> buf(spec.width()*spec.height());
+    std::vector<uint8_t> buf(w);
 
-    auto it = buf.begin();
-    for (int y=0; y<spec.height(); ++y) {
+    for (int y=y0; y<y1; ++y) {
       auto srcPtr = (const uint16_t*)srcImage->getPixelAddress(0, y);
-      for (int x=0; x<spec.width(); ++x, ++srcPtr, ++it)
-        *it = doc::graya_getv(*srcPtr);
-    }
+      for (int x=0; x<w; ++x)
+        buf[x] = doc::graya_getv(srcPtr[x]);
 
-    conversion->convertGray(&buf[0], &buf[0], spec.width()*spec.height());
+      conversion->convertGray(&buf[0], &buf[0], w);
 
-    it = buf.begin();
-    for (int y=0; y<spec.height(); ++y) {
-      auto srcPtr = (const uint16_t*)srcImage->getPixelAddress(0, y);
       auto dstPtr = (uint16_t*)dstImage->getPixelAddress(0, y);
-      for (int x=0; x<spec.width(); ++x, ++dstPtr, ++srcPtr, ++it)
-        *dstPtr = doc::graya(*it, doc::graya_geta(*srcPtr));
+      for (int x=0; x<w; ++x)
+        dstPtr[x] = doc::graya(buf[x], doc::graya_geta(srcPtr[x]));
+    }
+  }
+}
+
+// Converts all the given images to the new color space. Each image is
+// divided in bands of rows, and all bands of all images are converted
+// in parallel.
+std::vector<doc::ImageRef> convert_images_color_space(
+  const std::vector<const doc::Image*>& srcImages,
+  const gfx::ColorSpaceRef& newCS,
+  os::ColorSpaceConversion* conversion)
+{
+  struct Band {
+    int image, y0, y1;
+  };
+  std::vector<Band> bands;
+  std::vector<doc::ImageRef> dstImages;
+  dstImages.reserve(srcImages.size());
+
+  for (int i=0; i<int(srcImages.size()); ++i) {
+    const doc::Image* srcImage = srcImages[i];
+    ImageSpec spec = srcImage->spec();
+    spec.setColorSpace(newCS);
+    ImageRef dstImage(Image::create(spec));
+
+    if (!conversion ||
+        (spec.colorMode() != doc::ColorMode::RGB &&
+         spec.colorMode() != doc::ColorMode::GRAYSCALE)) {
+      dstImage->copy(srcImage, gfx::Clip(0, 0, srcImage->bounds()));
     }
+    else {
+      const int rows = std::max(1, kPixelsPerJob / std::max(1, spec.width()));
+      for (int y=0; y<spec.height(); y+=rows)
+        bands.push_back(Band{ i, y, std::min(y+rows, spec.height()) });
+    }
+    dstImages.push_back(dstImage);
   }
 
-  return dstImage;
+  TaskScheduler::instance()->parallelFor(
+    int(bands.size()),
+    [&](int i){
+      const Band& band = bands[i];
+      convert_image_rows(srcImages[band.image],
+                         dstImages[band.image].get(),
+                         conversion, band.y0, band.y1);
+    });
+
+  return dstImages;
+}
+
+// Converts all palette entries with one call to the conversion.
+void convert_palette_color_space(doc::Palette* palette,
+                                 os::ColorSpaceConversion* conversion)
+{
+  const int n = palette->size();
+  if (n == 0)
+    return;
+
+  std::vector<uint32_t> colors(n);
+  for (int i=0; i<n; ++i)
+    colors[i] = palette->entry(i);
+
+  conversion->convertRgba(&colors[0], &colors[0], n);
+
+  for (int i=0; i<n; ++i)
+    palette->setEntry(i, colors[i]);
 }
 
+std::vector<const doc::Image*> unique_cel_images(const doc::Sprite* sprite,
+                                                 std::vector<doc::ImageRef>& oldImages)
+{
+  std::vector<const doc::Image*> images;
+  for (Cel* cel : sprite->uniqueCels()) {
+    oldImages.push_back(cel->imageRef());
+    images.push_back(cel->image());
+  }
+  return images;
+}
+
+} // anonymous namespace
+
 void convert_color_profile(doc::Sprite* sprite,
                            const gfx::ColorSpaceRef& newCS)
 {
   ASSERT(sprite->colorSpace());
   ASSERT(newCS);
 
-  os::System* system = os::instance();
-  auto srcOCS = system->makeColorSpace(sprite->colorSpace());
-  auto dstOCS = system->makeColorSpace(newCS);
-  ASSERT(srcOCS);
-  ASSERT(dstOCS);
-
-  auto conversion = system->convertBetweenColorSpace(srcOCS, dstOCS);
+  auto conversion = get_conversion(sprite->colorSpace(), newCS);
 
   // Convert images
   if (sprite->pixelFormat() != doc::IMAGE_INDEXED) {
-    for (Cel* cel : sprite->uniqueCels()) {
-      ImageRef old_image = cel->imageRef();
-      ImageRef new_image = convert_image_color_space(
-        old_image.get(), newCS, conversion.get());
+    std::vector<ImageRef> oldImages;
+    std::vector<ImageRef> newImages =
+      convert_images_color_space(unique_cel_images(sprite, oldImages),
+                                 newCS, conversion.get());
 
-      sprite->replaceImage(old_image->id(), new_image);
-    }
+    for (int i=0; i<int(oldImages.size()); ++i)
+      sprite->replaceImage(oldImages[i]->id(), newImages[i]);
   }
 
   if (conversion) {
     // Convert palette
     if (sprite->pixelFormat() != doc::IMAGE_GRAYSCALE) {
       for (auto& pal : sprite->getPalettes()) {
-        Palette newPal(pal->frame(), pal->size());
-
-        for (int i=0; i<pal->size(); ++i) {
-          color_t oldCol = pal->entry(i);
-          color_t newCol = pal->entry(i);
-          conversion->convertRgba((uint32_t*)&newCol,
-                                  (const uint32_t*)&oldCol, 1);
-          newPal.setEntry(i, newCol);
-        }
+        Palette newPal(*pal);
+        convert_palette_color_space(&newPal, conversion.get());
 
         if (*pal != newPal)
           sprite->setPalette(&newPal, false);
@@ -129,34 +233,21 @@ void convert_color_profile(doc::Image* image,
   ASSERT(oldCS);
   ASSERT(newCS);
 
-  os::System* system = os::instance();
-  auto srcOCS = system->makeColorSpace(oldCS);
-  auto dstOCS = system->makeColorSpace(newCS);
-  ASSERT(srcOCS);
-  ASSERT(dstOCS);
-
-  auto conversion = system->convertBetweenColorSpace(srcOCS, dstOCS);
+  auto conversion = get_conversion(oldCS, newCS);
   if (conversion) {
     switch (image->pixelFormat()) {
       case doc::IMAGE_RGB:
       case doc::IMAGE_GRAYSCALE: {
-        ImageRef newImage = convert_image_color_space(
-          image, newCS, conversion.get());
+        ImageRef newImage = convert_images_color_space(
+          { image }, newCS, conversion.get()).front();
 
         image->copy(newImage.get(), gfx::Clip(image->bounds()));
         break;
       }
 
-      case doc::IMAGE_INDEXED: {
-        for (int i=0; i<palette->size(); ++i) {
-          color_t oldCol, newCol;
-          oldCol = newCol = palette->entry(i);
-          conversion->convertRgba((uint32_t*)&newCol,
-                                  (const uint32_t*)&oldCol, 1);
-          palette->setEntry(i, newCol);
-        }
+      case doc::IMAGE_INDEXED:
+        convert_palette_color_space(palette, conversion.get());
         break;
-      }
     }
   }
 }
@@ -164,43 +255,28 @@ void convert_color_profile(doc::Image* image,
 ConvertColorProfile::ConvertColorProfile(doc::Sprite* sprite, const gfx::ColorSpaceRef& newCS)
   : WithSprite(sprite)
 {
-  os::System* system = os::instance();
-
   ASSERT(sprite->colorSpace());
   ASSERT(newCS);
 
-  auto srcOCS = system->makeColorSpace(sprite->colorSpace());
-  auto dstOCS = system->makeColorSpace(newCS);
-
-  ASSERT(srcOCS);
-  ASSERT(dstOCS);
-
-  auto conversion = system->convertBetweenColorSpace(srcOCS, dstOCS);
+  auto conversion = get_conversion(sprite->colorSpace(), newCS);
 
   // Convert images
   if (sprite->pixelFormat() != doc::IMAGE_INDEXED) {
-    for (Cel* cel : sprite->uniqueCels()) {
-      ImageRef old_image = cel->imageRef();
-      ImageRef new_image = convert_image_color_space(
-        old_image.get(), newCS, conversion.get());
+    std::vector<ImageRef> oldImages;
+    std::vector<ImageRef> newImages =
+      convert_images_color_space(unique_cel_images(sprite, oldImages),
+                                 newCS, conversion.get());
 
-      m_seq.add(new cmd::ReplaceImage(sprite, old_image, new_image));
-    }
+    for (int i=0; i<int(oldImages.size()); ++i)
+      m_seq.add(new cmd::ReplaceImage(sprite, oldImages[i], newImages[i]));
   }
 
   if (conversion) {
     // Convert palette
     if (sprite->pixelFormat() != doc::IMAGE_GRAYSCALE) {
       for (auto& pal : sprite->getPalettes()) {
-        Palette newPal(pal->frame(), pal->size());
-
-        for (int i=0; i<pal->size(); ++i) {
-          color_t oldCol = pal->entry(i);
-          color_t newCol = pal->entry(i);
-          conversion->convertRgba((uint32_t*)&newCol,
-                                  (const uint32_t*)&oldCol, 1);
-          newPal.setEntry(i, newCol);
-        }
+        Palette newPal(*pal);
+        convert_palette_color_space(&newPal, conversion.get());
 
         if (*pal != newPal)
           m_seq.add(new cmd::SetPalette(sprite, pal->frame(), &newPal));
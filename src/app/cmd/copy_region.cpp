@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -11,12 +11,70 @@
 
 #include "app/cmd/copy_region.h"
 
+#include "app/crash/write_document.h"
 #include "app/util/buffer_region.h"
 #include "doc/image.h"
 
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
 namespace app {
 namespace cmd {
 
+// Size of the tiles compared to know which parts of the region were
+// modified.
+static constexpr int kTileSize = 16;
+
+// Returns the tiles of the region where the pixels of "dst" are
+// different from the "src" pixels (placed at "dstPos" in "dst").
+static gfx::Region get_modified_tiles(const gfx::Region& region,
+                                      const Image* dst,
+                                      const Image* src,
+                                      const gfx::Point& dstPos)
+{
+  ASSERT(dst->pixelFormat() == src->pixelFormat());
+  const size_t bytesPerPixel = dst->getRowStrideSize(1);
+
+  auto isModified = [=](const gfx::Rect& rc) {
+    const size_t rowBytes = bytesPerPixel*rc.w;
+    for (int y=rc.y; y<rc.y2(); ++y) {
+      if (std::memcmp(dst->getPixelAddress(rc.x, y),
+                      src->getPixelAddress(rc.x-dstPos.x, y-dstPos.y),
+                      rowBytes) != 0)
+        return true;
+    }
+    return false;
+  };
+
+  gfx::Region result;
+  for (const auto& rc : region) {
+    for (int ty=rc.y; ty<rc.y2(); ) {
+      const int th = std::min(kTileSize - (ty % kTileSize), rc.y2()-ty);
+
+      // Join consecutive modified tiles of the row in one rectangle
+      int runX = -1;
+      for (int tx=rc.x; tx<rc.x2(); ) {
+        const int tw = std::min(kTileSize - (tx % kTileSize), rc.x2()-tx);
+        if (isModified(gfx::Rect(tx, ty, tw, th))) {
+          if (runX < 0)
+            runX = tx;
+        }
+        else if (runX >= 0) {
+          result.createUnion(result, gfx::Region(gfx::Rect(runX, ty, tx-runX, th)));
+          runX = -1;
+        }
+        tx += tw;
+      }
+      if (runX >= 0)
+        result.createUnion(result, gfx::Region(gfx::Rect(runX, ty, rc.x2()-runX, th)));
+
+      ty += th;
+    }
+  }
+  return result;
+}
+
 CopyRegion::CopyRegion(Image* dst, const Image* src,
                        const gfx::Region& region,
                        const gfx::Point& dstPos,
@@ -39,13 +97,24 @@ CopyRegion::CopyRegion(Image* dst, const Image* src,
     m_region.createUnion(m_region, gfx::Region(clip.dstBounds()));
   }
 
-  save_image_region_in_buffer(m_region, src, dstPos, m_buffer);
+  // Save only the tiles with different pixels (e.g. a brush stroke
+  // that paints over an area with the same color doesn't need to
+  // save anything for that area).
+  m_region = get_modified_tiles(m_region, dst, src, dstPos);
+
+  base::buffer buffer;
+  save_image_region_in_buffer(m_region, src, dstPos, buffer);
+  m_buffer.reset(std::move(buffer));
 }
 
 void CopyRegion::onExecute()
 {
   if (!m_alreadyCopied)
     swap();
+  // The pixels were already modified, we only need to save them in
+  // the next backup
+  else if (Image* image = this->image())
+    crash::mark_image_region_as_modified(image, m_region, image->version());
 }
 
 void CopyRegion::onUndo()
@@ -63,8 +132,11 @@ void CopyRegion::swap()
   Image* image = this->image();
   ASSERT(image);
 
-  swap_image_region_with_buffer(m_region, image, m_buffer);
+  const ObjectVersion oldVersion = image->version();
+  swap_image_region_with_buffer(m_region, image, m_buffer.data());
   image->incrementVersion();
+
+  crash::mark_image_region_as_modified(image, m_region, oldVersion);
 }
 
 } // namespace cmd
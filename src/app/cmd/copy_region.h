@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -11,7 +11,7 @@
 
 #include "app/cmd.h"
 #include "app/cmd/with_image.h"
-#include "base/buffer.h"
+#include "app/util/compressed_buffer.h"
 #include "gfx/point.h"
 #include "gfx/region.h"
 
@@ -38,13 +38,22 @@ namespace cmd {
     size_t onMemSize() const override {
       return sizeof(*this) + m_buffer.size();
     }
+    void onCompressUndoData() override {
+      m_buffer.compressInBackground();
+    }
+    void onSpillUndoData() override {
+      m_buffer.spillToDisk();
+    }
+    void onPrepareUndoData(base::task_token& token) override {
+      m_buffer.data();
+    }
 
   private:
     void swap();
 
     bool m_alreadyCopied;
     gfx::Region m_region;
-    base::buffer m_buffer;
+    CompressedBuffer m_buffer;
   };
 
 } // namespace cmd
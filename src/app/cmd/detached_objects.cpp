@@ -0,0 +1,68 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/cmd/detached_objects.h"
+
+#include "doc/cel.h"
+#include "doc/cel_data.h"
+#include "doc/image.h"
+#include "doc/layer.h"
+
+#include <set>
+
+namespace app {
+namespace cmd {
+
+using namespace doc;
+
+void DetachedObjects::detachLayer(Layer* layer)
+{
+  if (layer->isGroup()) {
+    for (Layer* child : static_cast<LayerGroup*>(layer)->layers())
+      detachLayer(child);
+  }
+  else {
+    CelList cels;
+    layer->getCels(cels);
+
+    // Linked cels share the same cel data (we cannot ask for the ID
+    // of an object twice, because a new ID is generated when the
+    // object doesn't have one)
+    std::set<const CelData*> celsData;
+    for (Cel* cel : cels)
+      detachCel(cel, celsData.insert(cel->data()).second);
+  }
+  detachObject(layer);
+}
+
+void DetachedObjects::detachCel(Cel* cel, const bool withData)
+{
+  if (withData) {
+    detachObject(cel->image());
+    detachObject(cel->data());
+  }
+  detachObject(cel);
+}
+
+void DetachedObjects::attach()
+{
+  for (auto& item : m_objects)
+    item.first->setId(item.second);
+  m_objects.clear();
+}
+
+void DetachedObjects::detachObject(Object* obj)
+{
+  m_objects.push_back(std::make_pair(obj, obj->id()));
+  obj->setId(0);
+}
+
+} // namespace cmd
+} // namespace app
@@ -0,0 +1,55 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_CMD_DETACHED_OBJECTS_H_INCLUDED
+#define APP_CMD_DETACHED_OBJECTS_H_INCLUDED
+#pragma once
+
+#include "doc/object_id.h"
+
+#include <utility>
+#include <vector>
+
+namespace doc {
+  class Cel;
+  class Layer;
+  class Object;
+}
+
+namespace app {
+namespace cmd {
+  using namespace doc;
+
+  // IDs of the objects of a layer/cel that was removed from the
+  // sprite but is kept alive by an undo command. The IDs are
+  // unregistered while the objects are detached, so doc::get<>()
+  // (e.g. from scripts or other commands) cannot find them, as if
+  // they were deleted. The same IDs are registered again when the
+  // objects are inserted in the sprite again (or serialized).
+  class DetachedObjects {
+  public:
+    // Unregisters the IDs of the layer, its children, and its cels
+    // (with their images).
+    void detachLayer(Layer* layer);
+
+    // Unregisters the ID of the cel (and its image/cel data if
+    // withData is true, i.e. if they are not shared with other cels
+    // that are still in the sprite).
+    void detachCel(Cel* cel, const bool withData);
+
+    // Registers the original IDs of all objects again.
+    void attach();
+
+  private:
+    void detachObject(Object* obj);
+
+    std::vector<std::pair<Object*, ObjectId>> m_objects;
+  };
+
+} // namespace cmd
+} // namespace app
+
+#endif
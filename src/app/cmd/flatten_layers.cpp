@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020 Igara Studio S.A.
+// Copyright (C) 2019-2022 Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -28,6 +28,11 @@
 #include "doc/sprite.h"
 #include "render/render.h"
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
 namespace app {
 namespace cmd {
 
@@ -65,9 +70,6 @@ void FlattenLayers::onExecute()
   if (list.empty())
     return;                     // Do nothing
 
-  // Create a temporary image.
-  ImageRef image(Image::create(sprite->spec()));
-
   LayerImage* flatLayer;  // The layer onto which everything will be flattened.
   color_t     bgcolor;    // The background color to use for flatLayer.
 
@@ -90,9 +92,21 @@ void FlattenLayers::onExecute()
                                        list.front()));
   }
 
-  render::Render render;
-  render.setNewBlend(m_newBlendMethod);
-  render.setBgType(render::BgType::NONE);
+  // Rendered image of each frame, or the trimmed image (and its
+  // position) when the frame doesn't have a cel in flatLayer yet.
+  struct FlatFrame {
+    ImageRef image;
+    gfx::Point pos;
+  };
+
+  const frame_t nframes = sprite->totalFrames();
+  const int nthreads =
+    std::min<int>(nframes, std::max<int>(1, std::thread::hardware_concurrency()));
+
+  // Frames are rendered in batches so we don't keep the full image
+  // of all frames in memory at the same time.
+  const int batchSize = 4*nthreads;
+  std::vector<FlatFrame> flatFrames(batchSize);
 
   {
     // Show only the layers to be flattened so other layers are hidden
@@ -100,35 +114,74 @@ void FlattenLayers::onExecute()
     RestoreVisibleLayers restore;
     restore.showSelectedLayers(sprite, layers);
 
-    // Copy all frames to the background.
-    for (frame_t frame(0); frame<sprite->totalFrames(); ++frame) {
-      // Clear the image and render this frame.
-      clear_image(image.get(), bgcolor);
-      render.renderSprite(image.get(), sprite, frame);
-
-      // TODO Keep cel links when possible
-
-      ImageRef cel_image;
-      Cel* cel = flatLayer->cel(frame);
-      if (cel) {
-        if (cel->links())
-          executeAndAdd(new cmd::UnlinkCel(cel));
-
-        cel_image = cel->imageRef();
-        ASSERT(cel_image);
-
-        executeAndAdd(
-          new cmd::CopyRect(cel_image.get(), image.get(),
-                            gfx::Clip(0, 0, image->bounds())));
-      }
-      else {
-        gfx::Rect bounds(image->bounds());
-        if (doc::algorithm::shrink_bounds(
-              image.get(), bounds, image->maskColor())) {
-          cel_image.reset(
-            doc::crop_image(image.get(), bounds, image->maskColor()));
-          cel = new Cel(frame, cel_image);
-          cel->setPosition(bounds.origin());
+    for (frame_t batch(0); batch<nframes; batch+=batchSize) {
+      const frame_t batchEnd = std::min<frame_t>(nframes, batch+batchSize);
+
+      // Frames are independent, so each thread renders the next frame
+      // of the batch with its own Render. The sprite is not modified
+      // until all the frames of the batch are rendered.
+      std::atomic<frame_t> nextFrame(batch);
+      auto renderFrames = [&]() {
+        render::Render render;
+        render.setNewBlend(m_newBlendMethod);
+        render.setBgType(render::BgType::NONE);
+
+        for (frame_t frame=nextFrame++; frame<batchEnd; frame=nextFrame++) {
+          FlatFrame& flatFrame = flatFrames[frame-batch];
+
+          // Clear the image and render this frame.
+          ImageRef image(Image::create(sprite->spec()));
+          clear_image(image.get(), bgcolor);
+          render.renderSprite(image.get(), sprite, frame);
+
+          if (flatLayer->cel(frame)) {
+            flatFrame.image = image;
+          }
+          else {
+            gfx::Rect bounds(image->bounds());
+            if (doc::algorithm::shrink_bounds(
+                  image.get(), bounds, image->maskColor())) {
+              flatFrame.image.reset(
+                doc::crop_image(image.get(), bounds, image->maskColor()));
+              flatFrame.pos = bounds.origin();
+            }
+            else
+              flatFrame.image.reset();
+          }
+        }
+      };
+
+      std::vector<std::thread> threads;
+      for (int i=1; i<std::min<int>(nthreads, batchEnd-batch); ++i)
+        threads.emplace_back(renderFrames);
+      renderFrames();             // Use this thread too
+      for (auto& thread : threads)
+        thread.join();
+
+      // Copy all frames to the background (in order, from the main
+      // thread).
+      for (frame_t frame=batch; frame<batchEnd; ++frame) {
+        FlatFrame& flatFrame = flatFrames[frame-batch];
+        ImageRef image = std::move(flatFrame.image);
+
+        // TODO Keep cel links when possible
+
+        ImageRef cel_image;
+        Cel* cel = flatLayer->cel(frame);
+        if (cel) {
+          if (cel->links())
+            executeAndAdd(new cmd::UnlinkCel(cel));
+
+          cel_image = cel->imageRef();
+          ASSERT(cel_image);
+
+          executeAndAdd(
+            new cmd::CopyRect(cel_image.get(), image.get(),
+                              gfx::Clip(0, 0, image->bounds())));
+        }
+        else if (image) {
+          cel = new Cel(frame, image);
+          cel->setPosition(flatFrame.pos);
           flatLayer->addCel(cel);
         }
       }
@@ -0,0 +1,75 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/cmd/flip_images.h"
+
+#include "doc/algorithm/flip_image.h"
+#include "doc/image.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace app {
+namespace cmd {
+
+FlipImages::FlipImages(const std::vector<Image*>& images,
+                       doc::algorithm::FlipType flipType)
+  : m_flipType(flipType)
+{
+  m_imageIds.reserve(images.size());
+  for (Image* image : images)
+    m_imageIds.push_back(image->id());
+}
+
+void FlipImages::onExecute()
+{
+  swap();
+}
+
+void FlipImages::onUndo()
+{
+  swap();
+}
+
+void FlipImages::swap()
+{
+  // Get the images from this thread (each image is flipped from only
+  // one thread)
+  std::vector<Image*> images;
+  images.reserve(m_imageIds.size());
+  for (ObjectId id : m_imageIds)
+    images.push_back(get<Image>(id));
+
+  const int n = int(images.size());
+  const int nthreads =
+    std::min<int>(n, std::max<int>(1, std::thread::hardware_concurrency()));
+  std::atomic<int> nextImage(0);
+
+  auto flipImages = [&images, &nextImage, n, this]{
+    for (int i=nextImage++; i<n; i=nextImage++) {
+      Image* image = images[i];
+      doc::algorithm::flip_image(image, image->bounds(), m_flipType);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i=1; i<nthreads; ++i)
+    threads.emplace_back(flipImages);
+  flipImages();                 // Use this thread too
+  for (auto& thread : threads)
+    thread.join();
+
+  for (Image* image : images)
+    image->incrementVersion();
+}
+
+} // namespace cmd
+} // namespace app
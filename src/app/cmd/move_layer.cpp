@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -96,7 +97,7 @@ void MoveLayer::onFireNotifications()
   DocEvent ev(doc);
   ev.sprite(layer->sprite());
   ev.layer(layer);
-  doc->notify_observers<DocEvent&>(&DocObserver::onLayerRestacked, ev);
+  doc->notify<&DocObserver::onLayerRestacked>(ev);
 }
 
 } // namespace cmd
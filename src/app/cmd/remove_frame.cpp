@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -58,7 +59,7 @@ void RemoveFrame::onExecute()
   DocEvent ev(doc);
   ev.sprite(sprite);
   ev.frame(m_frame);
-  doc->notify_observers<DocEvent&>(&DocObserver::onRemoveFrame, ev);
+  doc->notify<&DocObserver::onRemoveFrame>(ev);
 }
 
 void RemoveFrame::onUndo()
@@ -76,7 +77,7 @@ void RemoveFrame::onUndo()
   DocEvent ev(doc);
   ev.sprite(sprite);
   ev.frame(m_frame);
-  doc->notify_observers<DocEvent&>(&DocObserver::onAddFrame, ev);
+  doc->notify<&DocObserver::onAddFrame>(ev);
 }
 
 } // namespace cmd
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -18,6 +19,8 @@
 #include "doc/sprite.h"
 #include "doc/subobjects_io.h"
 
+#include <sstream>
+
 namespace app {
 namespace cmd {
 
@@ -33,15 +36,12 @@ ReplaceImage::ReplaceImage(Sprite* sprite, const ImageRef& oldImage, const Image
 
 void ReplaceImage::onExecute()
 {
-  // Save old image in m_copy. We cannot keep an ImageRef to this
-  // image, because there are other undo branches that could try to
-  // modify/re-add this same image ID
   ImageRef oldImage = sprite()->getImageRef(m_oldImageId);
   ASSERT(oldImage);
-  m_copy.reset(Image::createCopy(oldImage.get()));
 
   replaceImage(m_oldImageId, m_newImage);
   m_newImage.reset();
+  keepImage(std::move(oldImage));
 }
 
 void ReplaceImage::onUndo()
@@ -49,10 +49,9 @@ void ReplaceImage::onUndo()
   ImageRef newImage = sprite()->getImageRef(m_newImageId);
   ASSERT(newImage);
   ASSERT(!sprite()->getImageRef(m_oldImageId));
-  m_copy->setId(m_oldImageId);
 
-  replaceImage(m_newImageId, m_copy);
-  m_copy.reset(Image::createCopy(newImage.get()));
+  replaceImage(m_newImageId, restoreImage(m_oldImageId));
+  keepImage(std::move(newImage));
 }
 
 void ReplaceImage::onRedo()
@@ -60,10 +59,26 @@ void ReplaceImage::onRedo()
   ImageRef oldImage = sprite()->getImageRef(m_oldImageId);
   ASSERT(oldImage);
   ASSERT(!sprite()->getImageRef(m_newImageId));
-  m_copy->setId(m_newImageId);
 
-  replaceImage(m_oldImageId, m_copy);
-  m_copy.reset(Image::createCopy(oldImage.get()));
+  replaceImage(m_oldImageId, restoreImage(m_newImageId));
+  keepImage(std::move(oldImage));
+}
+
+void ReplaceImage::onSpillUndoData()
+{
+  if (!m_copy)
+    return;
+
+  // Store the pixels without compression, the whole buffer is spilled
+  // to disk or deflated in a background thread.
+  std::stringstream stream;
+  write_image(stream, m_copy.get(), nullptr, 0);
+  m_copy.reset();
+
+  const std::string str = stream.str();
+  m_data.reset(base::buffer(str.begin(), str.end()));
+  if (!m_data.spillToDisk())
+    m_data.compressInBackground();
 }
 
 void ReplaceImage::replaceImage(ObjectId oldId, const ImageRef& newImage)
@@ -78,5 +93,37 @@ void ReplaceImage::replaceImage(ObjectId oldId, const ImageRef& newImage)
   spr->replaceImage(oldId, newImage);
 }
 
+void ReplaceImage::keepImage(ImageRef&& image)
+{
+  // If the sprite was the only owner of the replaced image, we can
+  // keep the same object (unregistered, so other undo branches can
+  // re-add an image with this same ID). In other case someone could
+  // modify it, so we have to save a copy.
+  if (image.use_count() == 1) {
+    image->setId(NullId);
+    m_copy = std::move(image);
+  }
+  else {
+    m_copy.reset(Image::createCopy(image.get()));
+  }
+}
+
+ImageRef ReplaceImage::restoreImage(ObjectId id)
+{
+  ImageRef image;
+  if (m_copy) {
+    image = std::move(m_copy);
+  }
+  else {
+    const base::buffer& data = m_data.data();
+    std::stringstream stream(std::string(data.begin(), data.end()));
+    image.reset(read_image(stream, false));
+    m_data.reset();
+  }
+  ASSERT(image);
+  image->setId(id);
+  return image;
+}
+
 } // namespace cmd
 } // namespace app
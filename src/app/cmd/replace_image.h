@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -10,6 +11,7 @@
 
 #include "app/cmd.h"
 #include "app/cmd/with_sprite.h"
+#include "app/util/compressed_buffer.h"
 #include "doc/image_ref.h"
 
 #include <sstream>
@@ -29,11 +31,19 @@ namespace cmd {
     void onRedo() override;
     size_t onMemSize() const override {
       return sizeof(*this) +
-        (m_copy ? m_copy->getMemSize(): 0);
+        (m_copy ? m_copy->getMemSize(): 0) +
+        m_data.size();
+    }
+    void onSpillUndoData() override;
+    void onPrepareUndoData(base::task_token& token) override {
+      if (!m_copy)
+        m_data.data();
     }
 
   private:
     void replaceImage(ObjectId oldId, const ImageRef& newImage);
+    void keepImage(ImageRef&& image);
+    ImageRef restoreImage(ObjectId id);
 
     ObjectId m_oldImageId;
     ObjectId m_newImageId;
@@ -42,7 +52,14 @@ namespace cmd {
     // ReplaceImage() ctor until the ReplaceImage::onExecute() call.
     // Then the reference is not used anymore.
     ImageRef m_newImage;
+
+    // Image that is not in the sprite (the old image after
+    // onExecute()/onRedo(), or the new one after onUndo()). It's the
+    // same replaced object (unregistered) when nobody else references
+    // it, or a copy in other case. When the undo history needs to free
+    // memory it's serialized in m_data.
     ImageRef m_copy;
+    CompressedBuffer m_data;
   };
 
 } // namespace cmd
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -51,7 +52,7 @@ void SetCelFrame::onFireNotifications()
   ev.layer(cel->layer());
   ev.cel(cel);
   ev.frame(cel->frame());
-  doc->notify_observers<DocEvent&>(&DocObserver::onCelFrameChanged, ev);
+  doc->notifyChange<&DocObserver::onCelFrameChanged>(ev);
 }
 
 } // namespace cmd
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -45,7 +46,7 @@ void SetCelOpacity::onFireNotifications()
   DocEvent ev(doc);
   ev.sprite(cel->sprite());
   ev.cel(cel);
-  doc->notify_observers<DocEvent&>(&DocObserver::onCelOpacityChange, ev);
+  doc->notifyChange<&DocObserver::onCelOpacityChange>(ev);
 }
 
 } // namespace cmd
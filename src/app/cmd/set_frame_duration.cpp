@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -44,7 +45,7 @@ void SetFrameDuration::onFireNotifications()
   DocEvent ev(doc);
   ev.sprite(sprite);
   ev.frame(m_frame);
-  doc->notify_observers<DocEvent&>(&DocObserver::onFrameDurationChanged, ev);
+  doc->notifyChange<&DocObserver::onFrameDurationChanged>(ev);
 }
 
 } // namespace cmd
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -56,7 +56,7 @@ void SetGridBounds::onFireNotifications()
   Doc* doc = static_cast<Doc*>(sprite->document());
   DocEvent ev(doc);
   ev.sprite(sprite);
-  doc->notify_observers<DocEvent&>(&DocObserver::onSpriteGridBoundsChanged, ev);
+  doc->notify<&DocObserver::onSpriteGridBoundsChanged>(ev);
 }
 
 } // namespace cmd
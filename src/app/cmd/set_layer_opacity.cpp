@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -44,7 +45,7 @@ void SetLayerOpacity::onFireNotifications()
   DocEvent ev(doc);
   ev.sprite(layer->sprite());
   ev.layer(layer);
-  doc->notify_observers<DocEvent&>(&DocObserver::onLayerOpacityChange, ev);
+  doc->notifyChange<&DocObserver::onLayerOpacityChange>(ev);
 }
 
 } // namespace cmd
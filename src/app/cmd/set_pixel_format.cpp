@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -22,10 +22,17 @@
 #include "doc/document.h"
 #include "doc/layer.h"
 #include "doc/palette.h"
+#include "doc/rgbmap.h"
 #include "doc/sprite.h"
 #include "render/quantization.h"
 #include "render/task_delegate.h"
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
 namespace app {
 namespace cmd {
 
@@ -33,25 +40,30 @@ using namespace doc;
 
 namespace {
 
+// Delegate shared by all threads that convert cels, only the thread
+// that created it uses the original delegate.
 class SuperDelegate : public render::TaskDelegate {
 public:
   SuperDelegate(int ncels, render::TaskDelegate* delegate)
     : m_ncels(ncels)
     , m_curCel(0)
-    , m_delegate(delegate) {
+    , m_stop(false)
+    , m_delegate(delegate)
+    , m_thread(std::this_thread::get_id()) {
   }
 
   void notifyTaskProgress(double progress) override {
-    if (m_delegate)
+    if (m_delegate && std::this_thread::get_id() == m_thread)
       m_delegate->notifyTaskProgress(
         (progress + m_curCel) / m_ncels);
   }
 
   bool continueTask() override {
-    if (m_delegate)
-      return m_delegate->continueTask();
-    else
-      return true;
+    if (m_delegate && std::this_thread::get_id() == m_thread &&
+        !m_delegate->continueTask()) {
+      m_stop = true;
+    }
+    return !m_stop;
   }
 
   void nextCel() {
@@ -60,8 +72,10 @@ public:
 
 private:
   int m_ncels;
-  int m_curCel;
+  std::atomic<int> m_curCel;
+  std::atomic<bool> m_stop;
   TaskDelegate* m_delegate;
+  std::thread::id m_thread;
 };
 
 } // anonymous namespace
@@ -78,25 +92,77 @@ SetPixelFormat::SetPixelFormat(Sprite* sprite,
   if (sprite->pixelFormat() == newFormat)
     return;
 
-  SuperDelegate superDel(sprite->uniqueCels().size(), delegate);
-
-  for (Cel* cel : sprite->uniqueCels()) {
-    ImageRef old_image = cel->imageRef();
-    ImageRef new_image(
-      render::convert_pixel_format
-      (old_image.get(), nullptr, newFormat,
-       dithering,
-       sprite->rgbMap(cel->frame()),
-       sprite->palette(cel->frame()),
-       cel->layer()->isBackground(),
-       old_image->maskColor(),
-       toGray,
-       &superDel));
-
-    m_seq.add(new cmd::ReplaceImage(sprite, old_image, new_image));
-    superDel.nextCel();
+  std::vector<Cel*> cels;
+  for (Cel* cel : sprite->uniqueCels())
+    cels.push_back(cel);
+
+  // Cels are grouped by palette, all cels of the same group are
+  // converted in parallel using the same RgbMap.
+  std::vector<std::pair<const Palette*, std::vector<int>>> groups;
+  for (int i=0; i<int(cels.size()); ++i) {
+    const Palette* palette = sprite->palette(cels[i]->frame());
+    auto it = std::find_if(groups.begin(), groups.end(),
+                           [palette](const auto& group){
+                             return group.first == palette;
+                           });
+    if (it != groups.end())
+      it->second.push_back(i);
+    else
+      groups.emplace_back(palette, std::vector<int>{ i });
   }
 
+  SuperDelegate superDel(int(cels.size()), delegate);
+  std::vector<ImageRef> newImages(cels.size());
+
+  for (const auto& group : groups) {
+    const Palette* palette = group.first;
+    const std::vector<int>& indexes = group.second;
+    const RgbMap* rgbmap = sprite->rgbMap(cels[indexes.front()]->frame());
+
+    const int nthreads =
+      std::min<int>(std::max<int>(1, std::thread::hardware_concurrency()),
+                    int(indexes.size()));
+
+    // Calculate all RgbMap entries, so the map isn't modified from
+    // several threads.
+    if (nthreads > 1 && newFormat == IMAGE_INDEXED)
+      rgbmap->generatePendingEntries();
+
+    std::atomic<int> next(0);
+    auto convertCels = [&]{
+      int i;
+      while ((i = next++) < int(indexes.size())) {
+        Cel* cel = cels[indexes[i]];
+        ImageRef old_image = cel->imageRef();
+        newImages[indexes[i]].reset(
+          render::convert_pixel_format
+          (old_image.get(), nullptr, newFormat,
+           dithering,
+           rgbmap,
+           palette,
+           cel->layer()->isBackground(),
+           old_image->maskColor(),
+           toGray,
+           &superDel,
+           // Use several threads for each image only if we've one
+           // image to convert
+           (nthreads > 1 ? 1: 0)));
+        superDel.nextCel();
+        superDel.notifyTaskProgress(0.0);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i=1; i<nthreads; ++i)
+      threads.emplace_back(convertCels);
+    convertCels();
+    for (std::thread& thread : threads)
+      thread.join();
+  }
+
+  for (int i=0; i<int(cels.size()); ++i)
+    m_seq.add(new cmd::ReplaceImage(sprite, cels[i]->imageRef(), newImages[i]));
+
   // Set all cels opacity to 100% if we are converting to indexed.
   // TODO remove this
   if (newFormat == IMAGE_INDEXED) {
@@ -154,7 +220,7 @@ void SetPixelFormat::setFormat(PixelFormat format)
   // Generate notification
   DocEvent ev(doc);
   ev.sprite(sprite);
-  doc->notify_observers<DocEvent&>(&DocObserver::onPixelFormatChanged, ev);
+  doc->notify<&DocObserver::onPixelFormatChanged>(ev);
 }
 
 } // namespace cmd
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2016-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -47,7 +48,7 @@ void SetPixelRatio::onFireNotifications()
   Doc* doc = static_cast<Doc*>(sprite->document());
   DocEvent ev(doc);
   ev.sprite(sprite);
-  doc->notify_observers<DocEvent&>(&DocObserver::onSpritePixelRatioChanged, ev);
+  doc->notify<&DocObserver::onSpritePixelRatioChanged>(ev);
 }
 
 } // namespace cmd
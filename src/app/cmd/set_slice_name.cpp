@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2017-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -49,7 +49,7 @@ void SetSliceName::onFireNotifications()
   DocEvent ev(doc);
   ev.sprite(sprite);
   ev.slice(slice);
-  doc->notify_observers<DocEvent&>(&DocObserver::onSliceNameChange, ev);
+  doc->notify<&DocObserver::onSliceNameChange>(ev);
 }
 
 } // namespace cmd
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -48,7 +49,7 @@ void SetSpriteSize::onFireNotifications()
   Doc* doc = static_cast<Doc*>(sprite->document());
   DocEvent ev(doc);
   ev.sprite(sprite);
-  doc->notify_observers<DocEvent&>(&DocObserver::onSpriteSizeChanged, ev);
+  doc->notify<&DocObserver::onSpriteSizeChanged>(ev);
 }
 
 } // namespace cmd
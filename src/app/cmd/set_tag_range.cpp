@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -49,7 +49,7 @@ void SetTagRange::onFireNotifications()
   DocEvent ev(doc);
   ev.sprite(sprite);
   ev.tag(tag);
-  doc->notify_observers<DocEvent&>(&DocObserver::onTagChange, ev);
+  doc->notify<&DocObserver::onTagChange>(ev);
 }
 
 } // namespace cmd
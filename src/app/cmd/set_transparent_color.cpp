@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -44,7 +45,7 @@ void SetTransparentColor::onFireNotifications()
   auto doc = static_cast<Doc*>(sprite->document());
   DocEvent ev(doc);
   ev.sprite(sprite);
-  doc->notify_observers<DocEvent&>(&DocObserver::onSpriteTransparentColorChanged, ev);
+  doc->notify<&DocObserver::onSpriteTransparentColorChanged>(ev);
 }
 
 } // namespace cmd
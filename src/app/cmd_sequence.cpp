@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -10,6 +11,8 @@
 
 #include "app/cmd_sequence.h"
 
+#include "base/task.h"
+
 namespace app {
 
 CmdSequence::CmdSequence()
@@ -55,6 +58,27 @@ size_t CmdSequence::onMemSize() const
   return size;
 }
 
+void CmdSequence::onCompressUndoData()
+{
+  for (Cmd* cmd : m_cmds)
+    cmd->compressUndoData();
+}
+
+void CmdSequence::onSpillUndoData()
+{
+  for (Cmd* cmd : m_cmds)
+    cmd->spillUndoData();
+}
+
+void CmdSequence::onPrepareUndoData(base::task_token& token)
+{
+  for (Cmd* cmd : m_cmds) {
+    if (token.canceled())
+      return;
+    cmd->prepareUndoData(token);
+  }
+}
+
 void CmdSequence::executeAndAdd(Cmd* cmd)
 {
   cmd->execute(context());
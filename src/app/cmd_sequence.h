@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -26,6 +27,11 @@ namespace app {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override;
+    void onCompressUndoData() override;
+    void onSpillUndoData() override;
+    void onPrepareUndoData(base::task_token& token) override;
+
+    const std::vector<Cmd*>& cmds() const { return m_cmds; }
 
     // Helper to create a CmdSequence in the same onExecute() member
     // function.
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -13,6 +13,9 @@
 
 #include "app/context.h"
 #include "app/site.h"
+#include "base/chrono.h"
+#include "base/log.h"
+#include "base/task.h"
 
 #ifdef ENABLE_UI
 #include "app/app.h"
@@ -28,6 +31,9 @@ CmdTransaction::CmdTransaction(const std::string& label,
   , m_label(label)
   , m_changeSavedState(changeSavedState)
   , m_savedCounter(savedCounter)
+  , m_executeTime(0.0)
+  , m_undoTime(0.0)
+  , m_redoTime(0.0)
 {
 }
 
@@ -38,6 +44,7 @@ CmdTransaction* CmdTransaction::moveToEmptyCopy()
                                             m_savedCounter);
   copy->m_spritePositionBefore = m_spritePositionBefore;
   copy->m_spritePositionAfter = m_spritePositionAfter;
+  copy->m_executeTime = m_executeTime;
   if (m_ranges) {
     copy->m_ranges.reset(new Ranges);
     copy->m_ranges->m_before = std::move(m_ranges->m_before);
@@ -106,7 +113,12 @@ void CmdTransaction::onExecute()
 
 void CmdTransaction::onUndo()
 {
+  base::Chrono chrono;
   CmdSequence::onUndo();
+  m_undoTime = chrono.elapsed();
+  if (m_undoTime > kSlowCmdTime)
+    LOG(VERBOSE, "UNDO: Slow undo of '%s' (%.3f s)\n",
+        m_label.c_str(), m_undoTime);
 
   if (m_changeSavedState)
     --(*m_savedCounter);
@@ -114,12 +126,30 @@ void CmdTransaction::onUndo()
 
 void CmdTransaction::onRedo()
 {
+  base::Chrono chrono;
   CmdSequence::onRedo();
+  m_redoTime = chrono.elapsed();
+  if (m_redoTime > kSlowCmdTime)
+    LOG(VERBOSE, "UNDO: Slow redo of '%s' (%.3f s)\n",
+        m_label.c_str(), m_redoTime);
 
   if (m_changeSavedState)
     ++(*m_savedCounter);
 }
 
+void CmdTransaction::onPrepareUndoData(base::task_token& token)
+{
+  // Same as CmdSequence::onPrepareUndoData() but reporting the
+  // progress of the whole transaction.
+  const auto& cmds = this->cmds();
+  for (size_t i=0; i<cmds.size(); ++i) {
+    if (token.canceled())
+      return;
+    cmds[i]->prepareUndoData(token);
+    token.set_progress(float(i+1) / float(cmds.size()));
+  }
+}
+
 std::string CmdTransaction::onLabel() const
 {
   return m_label;
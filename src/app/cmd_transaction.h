@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -39,12 +39,24 @@ namespace app {
     std::istream* documentRangeBeforeExecute() const;
     std::istream* documentRangeAfterExecute() const;
 
+    // Time (in seconds) used to execute all the commands of this
+    // transaction, and the last time used to undo/redo it.
+    double executeTime() const { return m_executeTime; }
+    double undoTime() const { return m_undoTime; }
+    double redoTime() const { return m_redoTime; }
+    void addExecuteTime(const double t) { m_executeTime += t; }
+
+    // Commands that take more than this time (in seconds) to be
+    // executed/undone/redone are reported in the log.
+    static constexpr double kSlowCmdTime = 0.1;
+
   protected:
     void onExecute() override;
     void onUndo() override;
     void onRedo() override;
     std::string onLabel() const override;
     size_t onMemSize() const override;
+    void onPrepareUndoData(base::task_token& token) override;
 
   private:
     SpritePosition calcSpritePosition() const;
@@ -62,6 +74,9 @@ namespace app {
     std::string m_label;
     bool m_changeSavedState;
     int* m_savedCounter;
+    double m_executeTime;
+    double m_undoTime;
+    double m_redoTime;
   };
 
 } // namespace app
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -94,9 +94,10 @@ void ColorPicker::pickColor(const Site& site,
                                  site.frame(), proj,
                                  Preferences::instance().experimental.newBlend()));
 
+      // We only need the top-most cel
       doc::CelList cels;
       sprite->pickCels(pos.x, pos.y, site.frame(), kOpacityThreshold,
-                       sprite->allVisibleLayers(), cels);
+                       sprite->allVisibleLayers(), cels, 1);
       if (!cels.empty())
         m_layer = cels.front()->layer();
       break;
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -17,6 +17,10 @@
 #include "os/system.h"
 #include "os/window.h"
 
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
 namespace app {
 
 // We use this variable to avoid accessing Preferences::instance()
@@ -68,13 +72,127 @@ gfx::ColorSpaceRef get_working_rgb_space_from_preferences()
 //////////////////////////////////////////////////////////////////////
 // Color conversion
 
+// 3D lookup table with the converted RGB values of a grid of
+// kLutSize^3 colors, the rest of the colors are interpolated
+// (trilinear interpolation) between the 8 nearest entries. The alpha
+// channel is not modified by the conversion.
+class ColorSpaceLut {
+public:
+  static constexpr int kLutSize = 33;
+
+  ColorSpaceLut(os::ColorSpaceConversion* conversion) {
+    m_table.resize(kLutSize*kLutSize*kLutSize);
+    int i = 0;
+    for (int b=0; b<kLutSize; ++b)
+      for (int g=0; g<kLutSize; ++g)
+        for (int r=0; r<kLutSize; ++r, ++i)
+          m_table[i] = gfx::rgba(node_value(r), node_value(g), node_value(b), 255);
+
+    // All the entries are converted with just one call
+    conversion->convertRgba(&m_table[0], &m_table[0], int(m_table.size()));
+
+    // Grid position and weight of each channel value
+    for (int v=0; v<256; ++v) {
+      const int pos = v * (kLutSize-1);
+      m_index[v] = pos / 255;
+      m_weight[v] = pos % 255;
+      if (m_index[v] == kLutSize-1) {
+        --m_index[v];
+        m_weight[v] = 255;
+      }
+    }
+  }
+
+  gfx::Color convert(const gfx::Color c) const {
+    const int r = gfx::getr(c);
+    const int g = gfx::getg(c);
+    const int b = gfx::getb(c);
+    const int wr = m_weight[r];
+    const int wg = m_weight[g];
+    const int wb = m_weight[b];
+    const gfx::Color* p = &m_table[(m_index[b]*kLutSize + m_index[g])*kLutSize + m_index[r]];
+
+    int out[3];
+    for (int j=0; j<3; ++j) {
+      const int shift = (j == 0 ? gfx::ColorRShift:
+                         j == 1 ? gfx::ColorGShift:
+                                  gfx::ColorBShift);
+      auto at = [p, shift](int i) -> int {
+        return (p[i] >> shift) & 0xff;
+      };
+      const int dy = kLutSize;
+      const int dz = kLutSize*kLutSize;
+      const int c00 = at(0)*(255-wr)     + at(1)*wr;
+      const int c10 = at(dy)*(255-wr)    + at(dy+1)*wr;
+      const int c01 = at(dz)*(255-wr)    + at(dz+1)*wr;
+      const int c11 = at(dz+dy)*(255-wr) + at(dz+dy+1)*wr;
+      const int c0 = c00*(255-wg) + c10*wg;
+      const int c1 = c01*(255-wg) + c11*wg;
+      // Divide by 255^3 with rounding
+      out[j] = int((int64_t(c0)*(255-wb) + int64_t(c1)*wb + 255*255*255/2) / (255*255*255));
+    }
+    return gfx::rgba(out[0], out[1], out[2], gfx::geta(c));
+  }
+
+private:
+  static int node_value(const int i) {
+    return 255 * i / (kLutSize-1);
+  }
+
+  std::vector<gfx::Color> m_table;
+  int m_index[256];
+  int m_weight[256];
+};
+
+// Recently used tables, the screen and documents color spaces don't
+// change frequently, so there are just a few of them.
+struct CachedLut {
+  gfx::ColorSpaceRef src, dst;
+  std::shared_ptr<const ColorSpaceLut> lut;
+};
+static const std::size_t kMaxCachedLuts = 4;
+static std::mutex g_lutsMutex;
+static std::vector<CachedLut> g_luts;
+
+static std::shared_ptr<const ColorSpaceLut> get_color_space_lut(
+  const os::ColorSpaceRef& srcCS,
+  const os::ColorSpaceRef& dstCS)
+{
+  if (!srcCS || !dstCS)
+    return nullptr;
+
+  const gfx::ColorSpaceRef src = srcCS->gfxColorSpace();
+  const gfx::ColorSpaceRef dst = dstCS->gfxColorSpace();
+
+  std::lock_guard<std::mutex> lock(g_lutsMutex);
+  for (auto it=g_luts.begin(); it!=g_luts.end(); ++it) {
+    if (it->src->nearlyEqual(*src) &&
+        it->dst->nearlyEqual(*dst)) {
+      std::rotate(g_luts.begin(), it, it+1);
+      return g_luts.front().lut;
+    }
+  }
+
+  CachedLut item;
+  item.src = src;
+  item.dst = dst;
+  // Without conversion (e.g. same color spaces) we cache a nullptr
+  auto conversion = os::instance()->convertBetweenColorSpace(srcCS, dstCS);
+  if (conversion)
+    item.lut = std::make_shared<ColorSpaceLut>(conversion.get());
+
+  if (g_luts.size() >= kMaxCachedLuts)
+    g_luts.pop_back();
+  g_luts.insert(g_luts.begin(), item);
+  return item.lut;
+}
+
 ConvertCS::ConvertCS()
 {
   if (g_manage) {
     auto srcCS = get_current_color_space();
     auto dstCS = get_screen_color_space();
-    if (srcCS && dstCS)
-      m_conversion = os::instance()->convertBetweenColorSpace(srcCS, dstCS);
+    m_lut = get_color_space_lut(srcCS, dstCS);
   }
 }
 
@@ -82,24 +200,35 @@ ConvertCS::ConvertCS(const os::ColorSpaceRef& srcCS,
                      const os::ColorSpaceRef& dstCS)
 {
   if (g_manage) {
-    m_conversion = os::instance()->convertBetweenColorSpace(srcCS, dstCS);
+    m_lut = get_color_space_lut(srcCS, dstCS);
   }
 }
 
 ConvertCS::ConvertCS(ConvertCS&& that)
-  : m_conversion(std::move(that.m_conversion))
+  : m_lut(std::move(that.m_lut))
+{
+}
+
+ConvertCS::~ConvertCS()
 {
 }
 
 gfx::Color ConvertCS::operator()(const gfx::Color c)
 {
-  if (m_conversion) {
-    gfx::Color out;
-    m_conversion->convertRgba((uint32_t*)&out, (const uint32_t*)&c, 1);
-    return out;
-  }
-  else {
+  if (m_lut)
+    return m_lut->convert(c);
+  else
     return c;
+}
+
+void ConvertCS::convertRgba(uint32_t* dst, const uint32_t* src, int n)
+{
+  if (m_lut) {
+    for (int i=0; i<n; ++i)
+      dst[i] = m_lut->convert(src[i]);
+  }
+  else if (dst != src) {
+    std::copy(src, src+n, dst);
   }
 }
 
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (c) 2018-2020  Igara Studio S.A.
+// Copyright (c) 2018-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -12,6 +12,9 @@
 #include "gfx/color_space.h"
 #include "os/color_space.h"
 
+#include <cstdint>
+#include <memory>
+
 namespace doc {
   class Sprite;
 }
@@ -28,16 +31,24 @@ namespace app {
 
   gfx::ColorSpaceRef get_working_rgb_space_from_preferences();
 
+  class ColorSpaceLut;
+
+  // Converts colors between two color spaces using a 3D lookup table
+  // (shared by all ConvertCS with the same pair of color spaces), so
+  // creating a ConvertCS and converting colors is cheap enough to be
+  // done in each paint.
   class ConvertCS {
   public:
     ConvertCS();
     ConvertCS(const os::ColorSpaceRef& srcCS,
               const os::ColorSpaceRef& dstCS);
     ConvertCS(ConvertCS&&);
+    ~ConvertCS();
     ConvertCS& operator=(const ConvertCS&) = delete;
     gfx::Color operator()(const gfx::Color c);
+    void convertRgba(uint32_t* dst, const uint32_t* src, int n);
   private:
-    os::Ref<os::ColorSpaceConversion> m_conversion;
+    std::shared_ptr<const ColorSpaceLut> m_lut;
   };
 
   ConvertCS convert_from_current_to_screen_color_space();
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2020  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -50,6 +50,7 @@ public:
     , m_cel(nullptr)
     , m_selfUpdate(false)
     , m_newUserData(false) {
+    setDocEvents(kDocCelEvents);
     opacity()->Change.connect([this]{ onStartTimer(); });
     userData()->Click.connect([this]{ onPopupUserData(); });
     m_timer.Tick.connect([this]{ onCommitChange(); });
@@ -236,7 +237,8 @@ private:
   }
 
   void onCelOpacityChange(DocEvent& ev) override {
-    if (m_cel == ev.cel())
+    // A null cel means that several cels were changed
+    if (!ev.cel() || m_cel == ev.cel())
       updateFromCel();
   }
 
@@ -499,6 +499,10 @@ void ChangePixelFormatCommand::onLoadParams(const Params& params)
     m_dithering.matrix(render::BayerMatrix(8));
   }
 
+  // Error diffusion without zig-zag can use several threads (but
+  // gives a different result)
+  m_dithering.zigZag(params.get("dithering-zigzag") != "false");
+
   std::string toGray = params.get("toGray");
   if (toGray == "luma")
     m_toGray = gen::ToGrayAlgorithm::LUMA;
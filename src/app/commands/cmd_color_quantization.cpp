@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020 Igara Studio S.A.
+// Copyright (C) 2019-2022 Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -36,6 +36,7 @@ struct ColorQuantizationParams : public NewParams {
   Param<bool> withAlpha { this, true, "withAlpha" };
   Param<int> maxColors { this, 256, "maxColors" };
   Param<bool> useRange { this, false, "useRange" };
+  Param<render::QuantizationAlgorithm> algorithm { this, render::QuantizationAlgorithm::MedianCut, "algorithm" };
 };
 
 class ColorQuantizationCommand : public CommandWithNewParams<ColorQuantizationParams> {
@@ -67,6 +68,7 @@ void ColorQuantizationCommand::onExecute(Context* ctx)
 
   bool withAlpha = params().withAlpha();
   int maxColors = params().maxColors();
+  render::QuantizationAlgorithm algorithm = params().algorithm();
   bool createPal;
 
   Site site = ctx->activeSite();
@@ -81,10 +83,14 @@ void ColorQuantizationCommand::onExecute(Context* ctx)
 
       if (!params().withAlpha.isSet())
         withAlpha = App::instance()->preferences().quantization.withAlpha();
+      if (!params().algorithm.isSet())
+        algorithm = (render::QuantizationAlgorithm)
+          App::instance()->preferences().quantization.algorithm();
 
       window.newPalette()->setSelected(true);
       window.alphaChannel()->setSelected(withAlpha);
       window.ncolors()->setTextf("%d", maxColors);
+      window.algorithm()->setSelectedItemIndex(int(algorithm));
 
       if (entries.picks() > 1) {
         window.currentRange()->setTextf(
@@ -109,6 +115,15 @@ void ColorQuantizationCommand::onExecute(Context* ctx)
     withAlpha = window.alphaChannel()->isSelected();
     App::instance()->preferences().quantization.withAlpha(withAlpha);
 
+    static_assert(
+      int(render::QuantizationAlgorithm::MedianCut) == int(gen::QuantizationAlgorithm::MEDIAN_CUT) &&
+      int(render::QuantizationAlgorithm::Octree) == int(gen::QuantizationAlgorithm::OCTREE) &&
+      int(render::QuantizationAlgorithm::OctreeKMeans) == int(gen::QuantizationAlgorithm::OCTREE_KMEANS),
+      "render::QuantizationAlgorithm and gen::QuantizationAlgorithm must match");
+    algorithm = (render::QuantizationAlgorithm)window.algorithm()->getSelectedItemIndex();
+    App::instance()->preferences().quantization.algorithm(
+      (gen::QuantizationAlgorithm)algorithm);
+
     if (window.newPalette()->isSelected()) {
       createPal = true;
     }
@@ -143,12 +158,13 @@ void ColorQuantizationCommand::onExecute(Context* ctx)
     SpriteJob job(reader, "Color Quantization");
     const bool newBlend = Preferences::instance().experimental.newBlend();
     job.startJobWithCallback(
-      [sprite, withAlpha, &tmpPalette, &job, newBlend]{
+      [sprite, withAlpha, &tmpPalette, &job, newBlend, algorithm]{
         render::create_palette_from_sprite(
           sprite, 0, sprite->lastFrame(),
           withAlpha, &tmpPalette,
-          &job,
-          newBlend);     // SpriteJob is a render::TaskDelegate
+          &job,          // SpriteJob is a render::TaskDelegate
+          newBlend,
+          algorithm);
       });
     job.waitJob();
     if (job.isCanceled())
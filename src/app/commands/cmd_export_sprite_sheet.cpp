@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -15,6 +15,7 @@
 #include "app/context_access.h"
 #include "app/doc.h"
 #include "app/doc_exporter.h"
+#include "app/doc_exporter_cache.h"
 #include "app/file/file.h"
 #include "app/file_selector.h"
 #include "app/filename_formatter.h"
@@ -58,6 +59,7 @@ struct ExportSpriteSheetParams : public NewParams {
   Param<bool> ui { this, true, "ui" };
   Param<bool> askOverwrite { this, true, { "askOverwrite", "ask-overwrite" } };
   Param<app::SpriteSheetType> type { this, app::SpriteSheetType::None, "type" };
+  Param<app::SpriteSheetPacking> packing { this, app::SpriteSheetPacking::Default, "packing" };
   Param<int> columns { this, 0, "columns" };
   Param<int> rows { this, 0, "rows" };
   Param<int> width { this, 0, "width" };
@@ -152,6 +154,7 @@ ConstraintType constraint_type_from_params(const ExportSpriteSheetParams& params
         return kConstraintType_Rows;
       break;
     case app::SpriteSheetType::Packed:
+    case app::SpriteSheetType::MaxRects:
       if (params.width() > 0 && params.height() > 0)
         return kConstraintType_Size;
       else if (params.width() > 0)
@@ -174,6 +177,7 @@ Doc* generate_sprite_sheet_from_params(
   base::task_token& token)
 {
   const app::SpriteSheetType type = params.type();
+  const app::SpriteSheetPacking packing = params.packing();
   const int columns = params.columns();
   const int rows = params.rows();
   const int width = params.width();
@@ -248,6 +252,7 @@ Doc* generate_sprite_sheet_from_params(
   exporter.setTextureColumns(columns);
   exporter.setTextureRows(rows);
   exporter.setSpriteSheetType(type);
+  exporter.setSpriteSheetPacking(packing);
   exporter.setBorderPadding(borderPadding);
   exporter.setShapePadding(shapePadding);
   exporter.setInnerPadding(innerPadding);
@@ -314,6 +319,7 @@ public:
     , m_dataFilenameAskOverwrite(true)
     , m_editor(nullptr)
     , m_genTimer(100, nullptr)
+    , m_previewTimer(250, nullptr)
     , m_executionID(0)
     , m_filenameFormat(params.filenameFormat())
   {
@@ -329,7 +335,8 @@ public:
       (int)app::SpriteSheetType::Vertical == 2 &&
       (int)app::SpriteSheetType::Rows == 3 &&
       (int)app::SpriteSheetType::Columns == 4 &&
-      (int)app::SpriteSheetType::Packed == 5,
+      (int)app::SpriteSheetType::Packed == 5 &&
+      (int)app::SpriteSheetType::MaxRects == 6,
       "SpriteSheetType enum changed");
 
     sheetType()->addItem(Strings::export_sprite_sheet_type_horz());
@@ -337,6 +344,7 @@ public:
     sheetType()->addItem(Strings::export_sprite_sheet_type_rows());
     sheetType()->addItem(Strings::export_sprite_sheet_type_cols());
     sheetType()->addItem(Strings::export_sprite_sheet_type_pack());
+    sheetType()->addItem(Strings::export_sprite_sheet_type_maxrects());
     {
       int i;
       if (params.type() != app::SpriteSheetType::None)
@@ -455,6 +463,10 @@ public:
     openGenerated()->Click.connect([this]{ onOpenGeneratedChange(); });
     preview()->Click.connect([this]{ generatePreview(); });
     m_genTimer.Tick.connect([this]{ onGenTimerTick(); });
+    m_previewTimer.Tick.connect([this]{ onPreviewTimerTick(); });
+
+    // Trimmed/rendered samples are re-used between previews
+    m_exporter.setMemoryCache(&m_previewCache);
 
     // Select tabs
     {
@@ -475,7 +487,7 @@ public:
     updateExportButton();
 
     preview()->setSelected(pref.spriteSheet.preview());
-    generatePreview();
+    startPreviewGeneration();
 
     remapWindow();
     centerWindow();
@@ -483,7 +495,9 @@ public:
   }
 
   ~ExportSpriteSheetWindow() {
+    m_previewTimer.stop();
     cancelGenTask();
+    m_exporter.setMemoryCache(nullptr);
     if (m_spriteSheet) {
       auto ctx = UIContext::instance();
       ctx->setActiveDocument(m_site.document());
@@ -615,7 +629,8 @@ private:
 
   int widthValue() const {
     if ((spriteSheetTypeValue() == app::SpriteSheetType::Rows ||
-         spriteSheetTypeValue() == app::SpriteSheetType::Packed) &&
+         spriteSheetTypeValue() == app::SpriteSheetType::Packed ||
+         spriteSheetTypeValue() == app::SpriteSheetType::MaxRects) &&
         (constraintType()->getSelectedItemIndex() == (int)kConstraintType_Width ||
          constraintType()->getSelectedItemIndex() == (int)kConstraintType_Size)) {
       return widthConstraint()->textInt();
@@ -626,7 +641,8 @@ private:
 
   int heightValue() const {
     if ((spriteSheetTypeValue() == app::SpriteSheetType::Columns ||
-         spriteSheetTypeValue() == app::SpriteSheetType::Packed) &&
+         spriteSheetTypeValue() == app::SpriteSheetType::Packed ||
+         spriteSheetTypeValue() == app::SpriteSheetType::MaxRects) &&
         (constraintType()->getSelectedItemIndex() == (int)kConstraintType_Height ||
          constraintType()->getSelectedItemIndex() == (int)kConstraintType_Size)) {
       return heightConstraint()->textInt();
@@ -777,6 +793,7 @@ private:
           constraintType()->setSelectedItemIndex(kConstraintType_None);
         break;
       case app::SpriteSheetType::Packed:
+      case app::SpriteSheetType::MaxRects:
         constraintType()->getItem(kConstraintType_Width)->setVisible(true);
         constraintType()->getItem(kConstraintType_Height)->setVisible(true);
         constraintType()->getItem(kConstraintType_Size)->setVisible(true);
@@ -857,7 +874,7 @@ private:
 
   void onDataFilename() {
     // TODO hardcoded "json" extension
-    base::paths exts = { "json" };
+    base::paths exts = { "json", "msgpack" };
     base::paths newFilename;
     if (!app::show_file_selector(
           "Save JSON Data", m_dataFilename, exts,
@@ -953,7 +970,28 @@ private:
         int(100.0f * m_genTask->progress())));
   }
 
+  // Called each time an option is changed, the new preview is
+  // generated when the user stops changing options for a moment (the
+  // last generated preview is visible until the new one is ready).
   void generatePreview() {
+    if (m_genTask)
+      m_genTask->cancel();
+
+    if (!preview()->isSelected()) {
+      m_previewTimer.stop();
+      startPreviewGeneration();
+      return;
+    }
+    m_previewTimer.start();
+  }
+
+  void onPreviewTimerTick() {
+    m_previewTimer.stop();
+    if (isVisible())
+      startPreviewGeneration();
+  }
+
+  void startPreviewGeneration() {
     cancelGenTask();
 
     if (!preview()->isSelected()) {
@@ -1121,6 +1159,8 @@ private:
   Editor* m_editor;
   std::unique_ptr<Task> m_genTask;
   ui::Timer m_genTimer;
+  ui::Timer m_previewTimer;
+  DocExporterCache m_previewCache;
   int m_executionID;
   std::string m_filenameFormat;
   std::string m_filenameFormatDefault;
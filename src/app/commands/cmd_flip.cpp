@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2021  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -12,6 +12,7 @@
 #include "app/commands/cmd_flip.h"
 
 #include "app/app.h"
+#include "app/cmd/flip_images.h"
 #include "app/cmd/flip_mask.h"
 #include "app/cmd/flip_masked_cel.h"
 #include "app/cmd/set_cel_bounds.h"
@@ -43,6 +44,7 @@
 #include "fmt/format.h"
 #include "gfx/size.h"
 
+#include <vector>
 
 namespace app {
 
@@ -185,6 +187,9 @@ void FlipCommand::onExecute(Context* ctx)
     }
   }
   else {
+    std::vector<Image*> images;
+    images.reserve(cels.size());
+
     for (Cel* cel : cels) {
       Image* image = cel->image();
 
@@ -210,8 +215,12 @@ void FlipCommand::onExecute(Context* ctx)
             cel->y()));
       }
 
-      api.flipImage(image, image->bounds(), m_flipType);
+      images.push_back(image);
     }
+
+    // Flip the images of all cels at the same time
+    if (!images.empty())
+      tx(new cmd::FlipImages(images, m_flipType));
   }
 
   // Flip the mask.
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2021  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -22,6 +22,7 @@
 #include "app/modules/gui.h"
 #include "app/modules/palettes.h"
 #include "app/pref/preferences.h"
+#include "app/task_scheduler.h"
 #include "app/tx.h"
 #include "app/ui/drop_down_button.h"
 #include "app/ui/editor/editor.h"
@@ -40,6 +41,9 @@
 
 #include "import_sprite_sheet.xml.h"
 
+#include <unordered_map>
+#include <vector>
+
 namespace app {
 
 using namespace ui;
@@ -440,7 +444,12 @@ void ImportSpriteSheetCommand::onExecute(Context* context)
   }
 
   // The list of frames imported from the sheet
-  std::vector<ImageRef> animation;
+  struct Tile {
+    ImageRef image;
+    uint32_t hash = 0;
+    bool empty = false;
+  };
+  std::vector<Tile> animation;
 
   try {
     Sprite* sprite = document->sprite();
@@ -489,19 +498,37 @@ void ImportSpriteSheetCommand::onExecute(Context* context)
         break;
     }
 
-    // As first step, we cut each tile and add them into "animation" list.
-    for (const auto& tileRect : tileRects) {
-      ImageRef resultImage(
-        Image::create(
-          sprite->pixelFormat(), tileRect.w, tileRect.h));
-
-      // Render the portion of sheet.
-      render.renderSprite(
-        resultImage.get(), sprite, currentFrame,
-        gfx::Clip(0, 0, tileRect));
-
-      animation.push_back(resultImage);
-    }
+    // The whole sheet is rendered just one time (the area outside the
+    // sprite is filled with the same color used by the render).
+    const color_t bgColor = (sprite->pixelFormat() == IMAGE_INDEXED ?
+                             sprite->transparentColor(): 0);
+    ImageRef sheetImage(
+      Image::create(sprite->pixelFormat(), sprite->width(), sprite->height()));
+    render.renderSprite(sheetImage.get(), sprite, currentFrame);
+
+    // As first step, we cut each tile (in parallel) and add them into
+    // "animation" list.
+    animation.resize(tileRects.size());
+    TaskScheduler::instance()->parallelFor(
+      int(tileRects.size()),
+      [&](int i){
+        const gfx::Rect& tileRect = tileRects[i];
+        Tile& tile = animation[i];
+        tile.image.reset(
+          Image::create(
+            sprite->pixelFormat(), tileRect.w, tileRect.h));
+
+        clear_image(tile.image.get(), bgColor);
+        copy_image(tile.image.get(), sheetImage.get(),
+                   -tileRect.x, -tileRect.y);
+
+        // Hash used to find duplicated tiles
+        tile.empty = is_plain_image(tile.image.get(), bgColor);
+        if (!tile.empty)
+          tile.hash = calculate_image_hash(tile.image.get(),
+                                           tile.image->bounds());
+      });
+    sheetImage.reset();
 
     if (animation.size() == 0) {
       Alert::show(Strings::alerts_empty_rect_importing_sprite_sheet());
@@ -517,13 +544,33 @@ void ImportSpriteSheetCommand::onExecute(Context* context)
     // Add the layer in the sprite.
     LayerImage* resultLayer = api.newLayer(sprite->root(), "Sprite Sheet");
 
-    // Add all frames+cels to the new layer
+    // Add all frames+cels to the new layer, empty tiles are skipped
+    // (empty frames), and duplicated tiles are linked to the first
+    // cel with the same image.
+    std::unordered_multimap<uint32_t, Cel*> cels;
     for (size_t i=0; i<animation.size(); ++i) {
+      const Tile& tile = animation[i];
+      if (tile.empty)
+        continue;
+
+      Cel* linkTo = nullptr;
+      auto range = cels.equal_range(tile.hash);
+      for (auto it=range.first; it!=range.second; ++it) {
+        if (is_same_image(it->second->image(), tile.image.get())) {
+          linkTo = it->second;
+          break;
+        }
+      }
+
       // Create the cel.
-      std::unique_ptr<Cel> resultCel(new Cel(frame_t(i), animation[i]));
+      std::unique_ptr<Cel> resultCel(
+        linkTo ? Cel::MakeLink(frame_t(i), linkTo):
+                 new Cel(frame_t(i), tile.image));
 
       // Add the cel in the layer.
       api.addCel(resultLayer, resultCel.get());
+      if (!linkTo)
+        cels.insert(std::make_pair(tile.hash, resultCel.get()));
       resultCel.release();
     }
 
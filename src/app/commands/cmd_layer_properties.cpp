@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2020  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -71,6 +71,7 @@ public:
     , m_document(nullptr)
     , m_layer(nullptr)
     , m_selfUpdate(false) {
+    setDocEvents(kDocLayerEvents);
     name()->setMinSize(gfx::Size(128, 0));
     name()->setExpansive(true);
 
@@ -278,17 +279,20 @@ private:
 
   // DocObserver impl
   void onLayerNameChange(DocEvent& ev) override {
-    if (m_layer == ev.layer())
+    // A null layer means that several layers were changed
+    if (!ev.layer() || m_layer == ev.layer())
       updateFromLayer();
   }
 
   void onLayerOpacityChange(DocEvent& ev) override {
-    if (m_layer == ev.layer())
+    // A null layer means that several layers were changed
+    if (!ev.layer() || m_layer == ev.layer())
       updateFromLayer();
   }
 
   void onLayerBlendModeChange(DocEvent& ev) override {
-    if (m_layer == ev.layer())
+    // A null layer means that several layers were changed
+    if (!ev.layer() || m_layer == ev.layer())
       updateFromLayer();
   }
 
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2020  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -29,6 +29,11 @@
 #include "render/render.h"
 #include "ui/ui.h"
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
 namespace app {
 
 class MergeDownLayerCommand : public Command {
@@ -76,79 +81,119 @@ void MergeDownLayerCommand::onExecute(Context* context)
   LayerImage* src_layer = static_cast<LayerImage*>(writer.layer());
   Layer* dst_layer = src_layer->getPrevious();
 
-  for (frame_t frpos = 0; frpos<sprite->totalFrames(); ++frpos) {
-    // Get frames
-    Cel* src_cel = src_layer->cel(frpos);
-    Cel* dst_cel = dst_layer->cel(frpos);
-
-    // Get images
-    Image* src_image;
-    if (src_cel != NULL)
-      src_image = src_cel->image();
-    else
-      src_image = NULL;
-
-    ImageRef dst_image;
-    if (dst_cel)
-      dst_image = dst_cel->imageRef();
-
-    // With source image?
-    if (src_image) {
-      int t;
-      int opacity;
-      opacity = MUL_UN8(src_cel->opacity(), src_layer->opacity(), t);
-
-      // No destination image
-      if (!dst_image) {  // Only a transparent layer can have a null cel
-        // Copy this cel to the destination layer...
-
-        // Creating a copy of the image
-        dst_image.reset(Image::createCopy(src_image));
-
-        // Creating a copy of the cell
-        dst_cel = new Cel(frpos, dst_image);
-        dst_cel->setPosition(src_cel->x(), src_cel->y());
-        dst_cel->setOpacity(opacity);
-
-        tx(new cmd::AddCel(dst_layer, dst_cel));
-      }
-      // With destination
-      else {
-        gfx::Rect bounds;
+  const doc::color_t bgcolor = app_get_color_to_clear_layer(dst_layer);
+
+  // Merged image (and its bounds) of each frame
+  struct MergedCel {
+    ImageRef image;
+    gfx::Rect bounds;
+  };
+
+  const frame_t nframes = sprite->totalFrames();
+  const int nthreads =
+    std::min<int>(nframes, std::max<int>(1, std::thread::hardware_concurrency()));
+
+  // Frames are merged in batches to limit the number of merged images
+  // in memory at the same time.
+  const int batchSize = 4*nthreads;
+  std::vector<MergedCel> mergedCels(batchSize);
+
+  for (frame_t batch = 0; batch<nframes; batch+=batchSize) {
+    const frame_t batchEnd = std::min<frame_t>(nframes, batch+batchSize);
+
+    // Each frame only reads the original images of both layers, so
+    // the images of several frames can be created at the same time
+    // (the sprite is modified later from this thread).
+    std::atomic<frame_t> nextFrame(batch);
+    auto mergeFrames = [&]() {
+      for (frame_t frpos=nextFrame++; frpos<batchEnd; frpos=nextFrame++) {
+        MergedCel& merged = mergedCels[frpos-batch];
+        merged.image.reset();
+
+        const Cel* src_cel = src_layer->cel(frpos);
+        const Cel* dst_cel = dst_layer->cel(frpos);
+        if (!src_cel)
+          continue;
+
+        const Image* src_image = src_cel->image();
+        ASSERT(src_image);
+
+        // No destination image
+        if (!dst_cel) {  // Only a transparent layer can have a null cel
+          // Creating a copy of the image
+          merged.image.reset(Image::createCopy(src_image));
+          merged.bounds = src_cel->bounds();
+          continue;
+        }
 
         // Merge down in the background layer
         if (dst_layer->isBackground()) {
-          bounds = sprite->bounds();
+          merged.bounds = sprite->bounds();
         }
         // Merge down in a transparent layer
         else {
-          bounds = src_cel->bounds().createUnion(dst_cel->bounds());
+          merged.bounds = src_cel->bounds().createUnion(dst_cel->bounds());
         }
 
-        doc::color_t bgcolor = app_get_color_to_clear_layer(dst_layer);
-
-        ImageRef new_image(doc::crop_image(
-            dst_image.get(),
+        const gfx::Rect& bounds = merged.bounds;
+        merged.image.reset(doc::crop_image(
+            dst_cel->image(),
             bounds.x-dst_cel->x(),
             bounds.y-dst_cel->y(),
             bounds.w, bounds.h, bgcolor));
 
+        int t;
+        const int opacity = MUL_UN8(src_cel->opacity(), src_layer->opacity(), t);
+
         // Merge src_image in new_image
         render::composite_image(
-          new_image.get(), src_image,
+          merged.image.get(), src_image,
           sprite->palette(src_cel->frame()),
           src_cel->x()-bounds.x,
           src_cel->y()-bounds.y,
           opacity,
           src_layer->blendMode());
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i=1; i<std::min<int>(nthreads, batchEnd-batch); ++i)
+      threads.emplace_back(mergeFrames);
+    mergeFrames();              // Use this thread too
+    for (auto& thread : threads)
+      thread.join();
+
+    for (frame_t frpos = batch; frpos<batchEnd; ++frpos) {
+      MergedCel& merged = mergedCels[frpos-batch];
+      if (!merged.image)
+        continue;
+
+      ImageRef new_image = std::move(merged.image);
+      Cel* src_cel = src_layer->cel(frpos);
+      Cel* dst_cel = dst_layer->cel(frpos);
+      ASSERT(src_cel);
+
+      // Copy this cel to the destination layer...
+      if (!dst_cel) {
+        int t;
+        const int opacity = MUL_UN8(src_cel->opacity(), src_layer->opacity(), t);
 
+        // Creating a copy of the cell
+        dst_cel = new Cel(frpos, new_image);
+        dst_cel->setPosition(src_cel->x(), src_cel->y());
+        dst_cel->setOpacity(opacity);
+
+        tx(new cmd::AddCel(dst_layer, dst_cel));
+      }
+      // With destination
+      else {
         // First unlink the dst_cel
         if (dst_cel->links())
           tx(new cmd::UnlinkCel(dst_cel));
 
         // Then modify the dst_cel
         tx(new cmd::SetCelPosition(dst_cel,
-            bounds.x, bounds.y));
+            merged.bounds.x, merged.bounds.y));
 
         tx(new cmd::ReplaceImage(sprite,
             dst_cel->imageRef(), new_image));
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2021  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -16,6 +16,7 @@
 #include "app/commands/params.h"
 #include "app/console.h"
 #include "app/doc.h"
+#include "app/doc_access.h"
 #include "app/file/file.h"
 #include "app/file_selector.h"
 #include "app/job.h"
@@ -23,14 +24,20 @@
 #include "app/modules/gui.h"
 #include "app/pref/preferences.h"
 #include "app/recent_files.h"
+#include "app/task.h"
 #include "app/ui/status_bar.h"
 #include "app/ui_context.h"
 #include "base/fs.h"
 #include "base/thread.h"
+#include "doc/layer.h"
+#include "doc/palette.h"
 #include "doc/sprite.h"
 #include "ui/ui.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <memory>
+#include <vector>
 
 namespace app {
 
@@ -74,6 +81,169 @@ private:
   FileOp* m_fop;
 };
 
+// Files (or sequences of files) of this size are displayed as soon
+// as their first frame is loaded, and the rest of frames are loaded
+// in the background.
+static const std::size_t kProgressiveOpenMinSize = 4*1024*1024;
+
+// Loads the frames of a document that weren't loaded by
+// OpenFileCommand (all frames after the first one) in a background
+// task, and moves their cels to the document from the UI thread when
+// they are ready. Cels created by the user in those frames meanwhile
+// are kept.
+class RemainingFramesLoader {
+public:
+  static void start(Doc* doc, std::unique_ptr<FileOp>&& fop) {
+    static bool exitConnected = false;
+    if (!exitConnected) {
+      App::instance()->Exit.connect([]{ loaders().clear(); });
+      exitConnected = true;
+    }
+    loaders().push_back(std::make_unique<RemainingFramesLoader>(doc, std::move(fop)));
+  }
+
+  RemainingFramesLoader(Doc* doc, std::unique_ptr<FileOp>&& fop)
+    : m_docId(doc->id())
+    , m_fop(std::move(fop))
+    , m_timer(100)
+    , m_done(false)
+  {
+    m_timer.Tick.connect([this]{ onTick(); });
+    m_task.run([this](base::task_token&){ loadFrames(); });
+    m_timer.start();
+  }
+
+  ~RemainingFramesLoader() {
+    m_timer.stop();
+    m_fop->stop();
+    m_task.wait();
+    delete m_fop->releaseDocument();
+  }
+
+private:
+  typedef std::vector<std::unique_ptr<RemainingFramesLoader>> Loaders;
+
+  static Loaders& loaders() {
+    static Loaders list;
+    return list;
+  }
+
+  static void removeDoneLoaders() {
+    auto& list = loaders();
+    list.erase(
+      std::remove_if(list.begin(), list.end(),
+                     [](const std::unique_ptr<RemainingFramesLoader>& loader){
+                       return loader->m_done;
+                     }),
+      list.end());
+  }
+
+  // Background thread
+  void loadFrames() {
+    try {
+      m_fop->operate(nullptr);
+    }
+    catch (const std::exception& e) {
+      m_fop->setError("Error loading file:\n%s", e.what());
+    }
+    m_fop->done();
+  }
+
+  void onTick() {
+    Doc* doc = doc::get<Doc>(m_docId);
+
+    // The document was closed
+    if (!doc)
+      m_fop->stop();
+    else if (!m_task.completed())
+      return;
+    else {
+      try {
+        DocWriter writer(doc, 100);
+        moveCels(doc);
+      }
+      catch (const LockedDocException&) {
+        // Try again in the next tick
+        return;
+      }
+    }
+
+    m_timer.stop();
+    m_done = true;
+    ui::execute_from_ui_thread([]{ removeDoneLoaders(); });
+  }
+
+  void moveCels(Doc* doc) {
+    const SelectedFrames frames = doc->loadingFrames();
+    doc->setLoadingFrames(SelectedFrames());
+
+    if (m_fop->hasError()) {
+      Console console;
+      console.printf(m_fop->error().c_str());
+    }
+
+    Doc* loaded = m_fop->document();
+    if (loaded) {
+      Sprite* sprite = doc->sprite();
+      Sprite* src = loaded->sprite();
+      const LayerList dstLayers = sprite->allLayers();
+      const LayerList srcLayers = src->allLayers();
+
+      // The user has added/removed layers or frames
+      if (dstLayers.size() != srcLayers.size() ||
+          sprite->totalFrames() != src->totalFrames()) {
+        Console console;
+        console.printf("Some frames of \"%s\" were not loaded because "
+                       "the sprite was modified while it was loading\n",
+                       doc->filename().c_str());
+      }
+      else {
+        for (std::size_t i=0; i<dstLayers.size(); ++i) {
+          Layer* dstLayer = dstLayers[i];
+          Layer* srcLayer = srcLayers[i];
+          if (!dstLayer->isImage() ||
+              dstLayer->type() != srcLayer->type())
+            continue;
+
+          for (frame_t frame : frames) {
+            Cel* cel = srcLayer->cel(frame);
+            if (!cel || dstLayer->cel(frame))
+              continue;
+
+            static_cast<LayerImage*>(srcLayer)->removeCel(cel);
+            static_cast<LayerImage*>(dstLayer)->addCel(cel);
+          }
+        }
+
+        for (const Palette* palette : src->getPalettes()) {
+          if (frames.contains(palette->frame()))
+            sprite->setPalette(palette, false);
+        }
+      }
+    }
+
+    doc->notifyGeneralUpdate();
+  }
+
+  doc::ObjectId m_docId;
+  std::unique_ptr<FileOp> m_fop;
+  ui::Timer m_timer;
+  Task m_task;
+  bool m_done;
+};
+
+static std::size_t get_files_size(const FileOp* fop)
+{
+  std::size_t size = 0;
+  if (fop->isSequence()) {
+    for (const auto& fn : fop->filenames())
+      size += base::file_size(fn);
+  }
+  else
+    size = base::file_size(fop->filename());
+  return size;
+}
+
 OpenFileCommand::OpenFileCommand()
   : Command(CommandId::OpenFile(), CmdRecordableFlag)
   , m_repeatCheckbox(false)
@@ -220,6 +390,36 @@ void OpenFileCommand::onExecute(Context* context)
         m_usedFiles.push_back(fn);
       }
 
+      // Big files are displayed as soon as the first frame is
+      // loaded, the rest of frames are loaded in the background.
+      std::unique_ptr<FileOp> framesFop;
+      if (context->isUIAvailable() &&
+          !m_oneFrame &&
+          Preferences::instance().openFile.progressive() &&
+          fop->supportsLoadFramesROI() &&
+          (!fop->isSequence() || fop->filenames().size() > 1) &&
+          get_files_size(fop.get()) >= kProgressiveOpenMinSize) {
+        framesFop.reset(
+          FileOp::createLoadDocumentOperation(
+            nullptr, filename,
+            (fop->isSequence() ? FILE_LOAD_SEQUENCE_YES:
+                                 FILE_LOAD_SEQUENCE_NONE)));
+
+        // The user could have excluded some files of the sequence
+        if (framesFop &&
+            !framesFop->hasError() &&
+            framesFop->filenames() == fop->filenames()) {
+          SelectedFrames firstFrame;
+          firstFrame.insert(0);
+
+          FileOpLoadROI roi;
+          roi.setFrames(firstFrame);
+          fop->setLoadROI(roi);
+        }
+        else
+          framesFop.reset();
+      }
+
       OpenFileJob task(fop.get());
       task.showProgressWindow();
 
@@ -250,7 +450,22 @@ void OpenFileCommand::onExecute(Context* context)
           }
         }
 
+        if (framesFop && doc->sprite()->totalFrames() > 1) {
+          SelectedFrames frames;
+          frames.insert(1, doc->sprite()->lastFrame());
+
+          FileOpLoadROI roi;
+          roi.setFrames(frames);
+          framesFop->setLoadROI(roi);
+          doc->setLoadingFrames(frames);
+        }
+        else
+          framesFop.reset();
+
         doc->setContext(context);
+
+        if (framesFop)
+          RemainingFramesLoader::start(doc, std::move(framesFop));
       }
       else if (!fop->isStop())
         unrecent = true;
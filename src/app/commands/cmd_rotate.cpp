@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2021  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -37,6 +37,11 @@
 #include "fmt/format.h"
 #include "ui/ui.h"
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
 namespace app {
 
 class RotateJob : public SpriteJob {
@@ -103,21 +108,56 @@ protected:
     }
 
     // 2) Rotate images
-    int i = 0;
-    for (Cel* cel : m_cels) {
-      Image* image = cel->image();
-      if (image) {
-        ImageRef new_image(Image::create(image->pixelFormat(),
-            m_angle == 180 ? image->width(): image->height(),
-            m_angle == 180 ? image->height(): image->width()));
-        new_image->setMaskColor(image->maskColor());
-
-        doc::rotate_image(image, new_image.get(), m_angle);
-        api.replaceImage(sprite(), cel->imageRef(), new_image);
+    //
+    // The rotated images of several cels are created at the same time
+    // (only the original images are read), and then they are
+    // replaced from this thread. Cels are processed in batches to
+    // report the progress and limit the memory used by new images.
+    const int ncels = int(m_cels.size());
+    const int nthreads =
+      std::min<int>(ncels, std::max<int>(1, std::thread::hardware_concurrency()));
+    const int batchSize = 4*nthreads;
+    std::vector<ImageRef> newImages(batchSize);
+
+    for (int batch=0; batch<ncels; batch+=batchSize) {
+      const int batchEnd = std::min(ncels, batch+batchSize);
+
+      std::atomic<int> nextCel(batch);
+      auto rotateImages = [&]() {
+        for (int i=nextCel++; i<batchEnd; i=nextCel++) {
+          ImageRef& new_image = newImages[i-batch];
+          new_image.reset();
+
+          const Image* image = m_cels[i]->image();
+          if (!image)
+            continue;
+
+          new_image.reset(Image::create(image->pixelFormat(),
+              m_angle == 180 ? image->width(): image->height(),
+              m_angle == 180 ? image->height(): image->width()));
+          new_image->setMaskColor(image->maskColor());
+
+          doc::rotate_image(image, new_image.get(), m_angle);
+        }
+      };
+
+      std::vector<std::thread> threads;
+      for (int i=1; i<nthreads; ++i)
+        threads.emplace_back(rotateImages);
+      rotateImages();           // Use this thread too
+      for (auto& thread : threads)
+        thread.join();
+
+      for (int i=batch; i<batchEnd; ++i) {
+        ImageRef& new_image = newImages[i-batch];
+        if (new_image) {
+          Cel* cel = m_cels[i];
+          api.replaceImage(sprite(), cel->imageRef(), new_image);
+          new_image.reset();
+        }
       }
 
-      jobProgress((float)i / m_cels.size());
-      ++i;
+      jobProgress((float)batchEnd / ncels);
 
       // cancel all the operation?
       if (isCanceled())
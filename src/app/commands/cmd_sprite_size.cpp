@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -28,7 +28,9 @@
 #include "doc/image.h"
 #include "doc/layer.h"
 #include "doc/mask.h"
+#include "doc/palette.h"
 #include "doc/primitives.h"
+#include "doc/rgbmap.h"
 #include "doc/slice.h"
 #include "doc/sprite.h"
 #include "ui/ui.h"
@@ -36,6 +38,9 @@
 #include "sprite_size.xml.h"
 
 #include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 #define PERC_FORMAT     "%.4g"
 
@@ -90,28 +95,75 @@ protected:
   void onJob() override {
     DocApi api = writer().document()->getApi(tx());
 
-    int cels_count = 0;
-    for (Cel* cel : sprite()->uniqueCels()) { // TODO add size() member function to CelsRange
-      (void)cel;
-      ++cels_count;
-    }
+    std::vector<Cel*> cels;
+    for (Cel* cel : sprite()->uniqueCels())
+      cels.push_back(cel);
+    const int cels_count = int(cels.size());
 
     const gfx::SizeF scale(
       double(m_new_width) / double(sprite()->width()),
       double(m_new_height) / double(sprite()->height()));
 
+    // Resize the images of all cels in parallel, then the commands
+    // to replace each image are added to the transaction in this
+    // thread. The sprite RgbMap is regenerated for each palette, so
+    // we can share it between threads only if there is one palette.
+    std::vector<ImageRef> newImages(cels.size());
+    const bool parallel =
+      (cels.size() > 1 &&
+       (sprite()->pixelFormat() != IMAGE_INDEXED ||
+        m_resize_method != doc::algorithm::RESIZE_METHOD_BILINEAR ||
+        sprite()->getPalettes().size() == 1));
+    if (parallel) {
+      const Palette* pal = sprite()->palette(0);
+      const RgbMap* rgbmap = sprite()->rgbMap(0);
+      if (sprite()->pixelFormat() == IMAGE_INDEXED &&
+          m_resize_method == doc::algorithm::RESIZE_METHOD_BILINEAR)
+        rgbmap->generatePendingEntries();
+
+      std::atomic<int> next(0);
+      std::atomic<int> done(0);
+      auto resizeImages = [&](const bool mainThread){
+        int i;
+        while (!isCanceled() &&
+               (i = next++) < cels_count) {
+          Cel* cel = cels[i];
+          if (cel->image() &&
+              !cel->link() &&
+              !cel->layer()->isReference()) {
+            newImages[i] = create_resized_cel_image(
+              cel, scale, m_resize_method, pal, rgbmap, 1);
+          }
+          ++done;
+          if (mainThread)
+            jobProgress(0.5f * done / cels_count);
+        }
+      };
+
+      const int nthreads =
+        std::min(cels_count, std::max<int>(1, std::thread::hardware_concurrency()));
+      std::vector<std::thread> threads;
+      for (int i=1; i<nthreads; ++i)
+        threads.emplace_back(resizeImages, false);
+      resizeImages(true);
+      for (std::thread& thread : threads)
+        thread.join();
+    }
+
     // For each cel...
-    int progress = 0;
-    for (Cel* cel : sprite()->uniqueCels()) {
+    for (int i=0; i<cels_count; ++i) {
+      Cel* cel = cels[i];
       resize_cel_image(
         tx(), cel, scale,
         m_resize_method,
         cel->layer()->isReference() ?
           -cel->boundsF().origin():
-          gfx::PointF(-cel->bounds().origin()));
+          gfx::PointF(-cel->bounds().origin()),
+        newImages[i]);
+      newImages[i].reset();
 
-      jobProgress((float)progress / cels_count);
-      ++progress;
+      jobProgress(parallel ? 0.5f + 0.5f * i / cels_count:
+                             float(i) / cels_count);
 
       // Cancel all the operation?
       if (isCanceled())
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2020  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -13,6 +13,7 @@
 #include "app/commands/command.h"
 #include "app/context_access.h"
 #include "app/doc_undo.h"
+#include "app/i18n/strings.h"
 #include "app/ini_file.h"
 #include "app/modules/editors.h"
 #include "app/modules/gui.h"
@@ -20,6 +21,7 @@
 #include "app/pref/preferences.h"
 #include "app/ui/editor/editor.h"
 #include "app/ui/status_bar.h"
+#include "base/task.h"
 #include "base/thread.h"
 #include "doc/sprite.h"
 #include "ui/manager.h"
@@ -27,10 +29,77 @@
 
 #ifdef ENABLE_UI
 #include "app/ui/timeline/timeline.h"
+#include "ui/alert.h"
+#include "ui/timer.h"
 #endif
 
+#include <chrono>
+#include <future>
+
 namespace app {
 
+#ifdef ENABLE_UI
+
+// Milliseconds to wait the preparation of the undo data before
+// showing a progress window.
+static const int kShowProgressTime = 250;
+
+// Loads the data needed to undo/redo the next state in a background
+// thread (e.g. to uncompress or read from disk big buffers), showing
+// a progress window that the user can use to cancel the operation
+// if it takes too much time. Returns false if it was canceled.
+static bool prepare_undo_data(DocUndo* undo, const bool isUndo)
+{
+  base::task_token token;
+  auto future = std::async(
+    std::launch::async,
+    [undo, isUndo, &token]{
+      try {
+        if (isUndo)
+          undo->prepareUndo(token);
+        else
+          undo->prepareRedo(token);
+      }
+      catch (const std::exception&) {
+        // Ignore errors, they will be reported by undo()/redo()
+        // when the data is loaded again.
+      }
+    });
+
+  auto isDone = [&future]{
+    return (future.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+  };
+
+  // Small commands are prepared before this timeout, so we don't
+  // need to show anything.
+  if (future.wait_for(std::chrono::milliseconds(kShowProgressTime)) ==
+      std::future_status::ready)
+    return true;
+
+  ui::AlertPtr alert(ui::Alert::create(Strings::alerts_preparing_undo()));
+  alert->addProgress();
+
+  ui::Timer timer(100);
+  timer.Tick.connect(
+    [&]{
+      alert->setProgress(token.progress());
+      if (isDone())
+        alert->closeWindow(nullptr);
+    });
+  timer.start();
+  alert->openWindowInForeground();
+  timer.stop();
+
+  // The window was closed by the user
+  if (!isDone())
+    token.cancel();
+
+  future.wait();
+  return !token.canceled();
+}
+
+#endif // ENABLE_UI
+
 class UndoCommand : public Command {
 public:
   enum Type { Undo, Redo };
@@ -108,6 +177,12 @@ void UndoCommand::onExecute(Context* context)
   else
     docRangeStream = undo->nextRedoDocRange();
 
+  // Prepare big undo/redo operations in background (the document is
+  // locked by the ContextWriter).
+  if (context->isUIAvailable() &&
+      !prepare_undo_data(undo, m_type == Undo))
+    return;
+
   StatusBar* statusbar = StatusBar::instance();
   if (statusbar) {
     std::string msg;
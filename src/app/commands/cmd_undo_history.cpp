@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2020  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 // Copyright (C) 2015-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -10,6 +10,7 @@
 #endif
 
 #include "app/cmd.h"
+#include "app/cmd_transaction.h"
 #include "app/commands/command.h"
 #include "app/console.h"
 #include "app/context.h"
@@ -23,6 +24,7 @@
 #include "app/modules/palettes.h"
 #include "app/site.h"
 #include "base/mem_utils.h"
+#include "fmt/format.h"
 #include "ui/listitem.h"
 #include "ui/message.h"
 #include "undo/undo_state.h"
@@ -41,15 +43,24 @@ public:
     Item(const undo::UndoState* state)
       : ui::ListItem(
           (state ?
-           static_cast<Cmd*>(state->cmd())->label()
-#if _DEBUG
-           + std::string(" ") + base::get_pretty_memory_size(static_cast<Cmd*>(state->cmd())->memSize())
-#endif
-           : std::string("Initial State"))),
+           itemText(static_cast<CmdTransaction*>(state->cmd())):
+           std::string("Initial State"))),
         m_state(state) {
     }
     const undo::UndoState* state() { return m_state; }
   private:
+    // Memory used by the state and the time used to execute it (to
+    // know which operations use more undo memory/time)
+    static std::string itemText(const CmdTransaction* cmd) {
+      std::string text =
+        fmt::format("{} ({}", cmd->label(),
+                    base::get_pretty_memory_size(cmd->memSize()));
+      const int ms = int(cmd->executeTime() * 1000.0);
+      if (ms > 0)
+        text += fmt::format(", {} ms", ms);
+      return text + ")";
+    }
+
     const undo::UndoState* m_state;
   };
 
@@ -15,15 +15,24 @@
 #include "app/commands/debugger.h"
 
 #include "app/app.h"
+#include "app/cache_manager.h"
 #include "app/context.h"
+#include "app/doc.h"
+#include "app/i18n/strings.h"
+#include "app/resource_finder.h"
 #include "app/script/engine.h"
+#include "app/session_recorder.h"
+#include "app/task_scheduler.h"
 #include "app/ui/skin/skin_theme.h"
+#include "app/ui_context.h"
 #include "base/clamp.h"
 #include "base/convert_to.h"
 #include "base/file_content.h"
 #include "base/fs.h"
+#include "base/mem_utils.h"
 #include "base/split_string.h"
 #include "base/trim_string.h"
+#include "doc/trace.h"
 #include "fmt/format.h"
 #include "ui/entry.h"
 #include "ui/listbox.h"
@@ -33,6 +42,7 @@
 #include "ui/message_loop.h"
 #include "ui/paint_event.h"
 #include "ui/size_hint_event.h"
+#include "ui/timer.h"
 
 #ifdef ENABLE_SCRIPTING
   #include "app/script/luacpp.h"
@@ -389,7 +399,8 @@ class Debugger : public gen::Debugger
 
 public:
 
-  Debugger() {
+  Debugger()
+    : m_frameStatsTimer(1000, this) {
     control()->ItemChange.connect([this] {
       auto button = (Button)control()->selectedItem();
       control()->deselectItems();
@@ -402,8 +413,29 @@ public:
       onControl(Button::Breakpoint);
     });
 
+    m_frameStatsTimer.Tick.connect([this]{ updateFrameStats(); });
+
+    perfView()->setVisible(false);
+    perfButton()->ItemChange.connect([this] {
+      perfButton()->deselectItems();
+      onTogglePerformance();
+    });
+
+    trace()->ItemChange.connect([this] {
+      trace()->deselectItems();
+      onToggleTrace();
+    });
+
+    session()->ItemChange.connect([this] {
+      session()->deselectItems();
+      onToggleSession();
+    });
+
     Close.connect([this]{
       m_state = State::Hidden;
+      m_frameStatsTimer.stop();
+      if (perfView()->isVisible())
+        doc::trace::stop_stats();
 
       auto app = App::instance();
       app->scriptEngine()->setDelegate(m_oldDelegate);
@@ -449,6 +481,11 @@ public:
     updateControls();
     openWindow();
 
+    Manager::resetFrameStats();
+    m_frameStatsTimer.start();
+    if (perfView()->isVisible())
+      doc::trace::start_stats();
+
     auto app = App::instance();
     m_oldDelegate = app->scriptEngine()->delegate();
     app->scriptEngine()->setDelegate(this);
@@ -690,6 +727,142 @@ public:
   }
 
 private:
+  // Shows/hides the panel with live performance counters (the stats
+  // of the DOC_TRACE_ZONE() zones are collected only when the panel
+  // is visible)
+  void onTogglePerformance() {
+    const bool visible = !perfView()->isVisible();
+    if (visible) {
+      doc::trace::start_stats();
+      updatePerformance(Manager::frameStats());
+    }
+    else
+      doc::trace::stop_stats();
+
+    perfView()->setVisible(visible);
+    layout();
+  }
+
+  void updatePerformance(const Manager::FrameStats& stats) {
+    std::string text =
+      fmt::format(Strings::debugger_perf_frames(),
+                  stats.frames,
+                  (stats.frames > 0 ? 1000.0 * stats.paintTime / stats.frames: 0.0),
+                  1000.0 * stats.maxPaintTime,
+                  stats.paintMessages,
+                  stats.deferredPaints);
+    text += "\n\n";
+
+    // Zones (render, tool loop, backups, etc.) since the last update
+    text += Strings::debugger_perf_zones();
+    text += "\n";
+    for (const auto& zone : doc::trace::zone_stats()) {
+      text += "  ";
+      text += fmt::format(Strings::debugger_perf_zone(),
+                          zone.name,
+                          zone.count,
+                          (zone.count > 0 ? 1000.0 * zone.totalTime / zone.count: 0.0),
+                          1000.0 * zone.maxTime);
+      text += "\n";
+    }
+    text += "\n";
+
+    auto scheduler = TaskScheduler::instance();
+    text += fmt::format(Strings::debugger_perf_queues(),
+                        scheduler->queuedJobs(TaskPriority::Interactive),
+                        scheduler->queuedJobs(TaskPriority::Background),
+                        scheduler->queuedJobs(TaskPriority::Idle),
+                        scheduler->threads());
+    text += "\n\n";
+
+    text += Strings::debugger_perf_memory();
+    text += "\n";
+    for (const Doc* doc : UIContext::instance()->documents()) {
+      const Doc::MemoryUsage usage = doc->memoryUsage();
+      text += "  ";
+      text += fmt::format(Strings::debugger_perf_doc_memory(),
+                          doc->name(),
+                          base::get_pretty_memory_size(usage.sprite),
+                          base::get_pretty_memory_size(usage.undo));
+      text += "\n";
+    }
+    for (const auto& cache : CacheManager::instance()->usage()) {
+      text += "  ";
+      text += fmt::format(Strings::debugger_perf_cache_memory(),
+                          cache.name,
+                          base::get_pretty_memory_size(cache.bytes));
+      text += "\n";
+    }
+
+    perf()->setText(text);
+    layout();
+  }
+
+  // Starts/stops recording the DOC_TRACE_ZONE() zones, when it's
+  // stopped the zones are saved in a JSON file for chrome://tracing
+  void onToggleTrace() {
+    if (!doc::trace::is_recording()) {
+      doc::trace::start_recording();
+      trace()->getItem(0)->setText(Strings::debugger_stop_trace());
+    }
+    else {
+      doc::trace::stop_recording();
+      trace()->getItem(0)->setText(Strings::debugger_start_trace());
+
+      ResourceFinder rf;
+      rf.includeUserDir("trace.json");
+      const std::string fn = rf.getFirstOrCreateDefault();
+      if (doc::trace::save_chrome_trace(fn))
+        onConsolePrint(fmt::format(Strings::debugger_trace_saved(),
+                                   doc::trace::recorded_events(), fn).c_str());
+      else
+        onConsolePrint(fmt::format(Strings::debugger_trace_error(), fn).c_str());
+    }
+    layout();
+  }
+
+  // Starts/stops recording the commands and strokes of the session,
+  // when it's stopped the session is saved as a Lua script that can
+  // be replayed to compare the latency of each event
+  void onToggleSession() {
+    SessionRecorder* recorder = SessionRecorder::instance();
+    if (!recorder->isRecording()) {
+      recorder->start(UIContext::instance());
+      session()->getItem(0)->setText(Strings::debugger_stop_session());
+    }
+    else {
+      const int events = recorder->recordedEvents();
+      ResourceFinder rf;
+      rf.includeUserDir("session.lua");
+      const std::string fn = rf.getFirstOrCreateDefault();
+      const bool saved = recorder->stop(fn);
+      session()->getItem(0)->setText(Strings::debugger_start_session());
+
+      if (saved)
+        onConsolePrint(fmt::format(Strings::debugger_session_saved(),
+                                   events, fn).c_str());
+      else
+        onConsolePrint(fmt::format(Strings::debugger_session_error(), fn).c_str());
+    }
+    layout();
+  }
+
+  // Shows the UI frames painted in the last second (see
+  // ui::Manager::dispatchMessages())
+  void updateFrameStats() {
+    const Manager::FrameStats& stats = Manager::frameStats();
+    if (perfView()->isVisible())
+      updatePerformance(stats);
+    frameStats()->setText(
+      fmt::format(Strings::debugger_frame_stats(),
+                  stats.frames,
+                  (stats.frames > 0 ? 1000.0 * stats.paintTime / stats.frames: 0.0),
+                  1000.0 * stats.maxPaintTime,
+                  stats.deferredPaints));
+    Manager::resetFrameStats();
+    layout();
+  }
+
   void waitNextCommand(lua_State* L) {
     m_state = State::WaitingNextCommand;
     m_stacktrace.update(L);
@@ -808,6 +981,7 @@ private:
   int m_commandStackLevel = 0;
   int m_stackLevel = 0;
   bool m_fileOk = true;
+  ui::Timer m_frameStatsTimer;
 };
 
 DebuggerCommand::DebuggerCommand()
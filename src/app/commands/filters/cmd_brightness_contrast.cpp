@@ -30,6 +30,8 @@
 #include "ui/widget.h"
 #include "ui/window.h"
 
+#include <memory>
+
 namespace app {
 
 struct BrightnessContrastParams : public NewParams {
@@ -104,7 +106,8 @@ void BrightnessContrastCommand::onExecute(Context* context)
   const bool ui = (params().ui() && context->isUIAvailable());
 #endif
 
-  BrightnessContrastFilter filter;
+  auto filterPtr = std::make_unique<BrightnessContrastFilter>();
+  BrightnessContrastFilter& filter = *filterPtr;
   FilterManagerImpl filterMgr(context, &filter);
   filterMgr.setTarget(TARGET_RED_CHANNEL |
                       TARGET_GREEN_CHANNEL |
@@ -124,7 +127,7 @@ void BrightnessContrastCommand::onExecute(Context* context)
   else
 #endif // ENABLE_UI
   {
-    start_filter_worker(&filterMgr);
+    start_filter_worker(&filterMgr, std::move(filterPtr));
   }
 }
 
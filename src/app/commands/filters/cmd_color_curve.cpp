@@ -23,6 +23,8 @@
 #include "filters/color_curve_filter.h"
 #include "ui/ui.h"
 
+#include <memory>
+
 namespace app {
 
 using namespace filters;
@@ -97,7 +99,8 @@ bool ColorCurveCommand::onEnabled(Context* context)
 void ColorCurveCommand::onExecute(Context* context)
 {
   const bool ui = (params().ui() && context->isUIAvailable());
-  ColorCurveFilter filter;
+  auto filterPtr = std::make_unique<ColorCurveFilter>();
+  ColorCurveFilter& filter = *filterPtr;
 
 #ifdef ENABLE_UI
   // Default curve
@@ -139,7 +142,7 @@ void ColorCurveCommand::onExecute(Context* context)
   else
 #endif // ENABLE_UI
   {
-    start_filter_worker(&filterMgr);
+    start_filter_worker(&filterMgr, std::move(filterPtr));
   }
 }
 
@@ -182,7 +182,9 @@ void ConvolutionMatrixCommand::onExecute(Context* context)
 #endif
 
   static ConvolutionMatrixStock stock; // Load stock
-  ConvolutionMatrixFilter filter; // Create the filter and setup initial settings
+  // Create the filter and setup initial settings
+  auto filterPtr = std::make_unique<ConvolutionMatrixFilter>();
+  ConvolutionMatrixFilter& filter = *filterPtr;
 
   std::shared_ptr<ConvolutionMatrix> matrix;
 #ifdef ENABLE_UI
@@ -213,7 +215,7 @@ void ConvolutionMatrixCommand::onExecute(Context* context)
   else
 #endif // ENABLE_UI
   {
-    start_filter_worker(&filterMgr);
+    start_filter_worker(&filterMgr, std::move(filterPtr));
   }
 }
 
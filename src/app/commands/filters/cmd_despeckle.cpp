@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -33,6 +33,7 @@
 
 #include "despeckle.xml.h"
 
+#include <memory>
 #include <stdio.h>
 
 namespace app {
@@ -84,7 +85,7 @@ private:
     // If we had a previous filter preview running in the background,
     // we explicitly request it be stopped. Otherwise, changing the
     // size of the filter would cause a race condition on
-    // MedianFilter::m_channel field.
+    // MedianFilter histograms.
     stopPreview();
 
     m_filter.setSize(newSize.w, newSize.h);
@@ -129,7 +130,8 @@ void DespeckleCommand::onExecute(Context* context)
   const bool ui = (params().ui() && context->isUIAvailable());
 #endif
 
-  MedianFilter filter;
+  auto filterPtr = std::make_unique<MedianFilter>();
+  MedianFilter& filter = *filterPtr;
   filter.setSize(3, 3);         // Default size
 
   FilterManagerImpl filterMgr(context, &filter);
@@ -164,7 +166,7 @@ void DespeckleCommand::onExecute(Context* context)
   else
 #endif // ENABLE_UI
   {
-    start_filter_worker(&filterMgr);
+    start_filter_worker(&filterMgr, std::move(filterPtr));
   }
 }
 
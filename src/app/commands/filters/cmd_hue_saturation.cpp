@@ -32,6 +32,8 @@
 #include "ui/widget.h"
 #include "ui/window.h"
 
+#include <memory>
+
 namespace app {
 
 using Mode = filters::HueSaturationFilter::Mode;
@@ -166,7 +168,8 @@ void HueSaturationCommand::onExecute(Context* ctx)
   const bool ui = (params().ui() && ctx->isUIAvailable());
 #endif
 
-  HueSaturationFilter filter;
+  auto filterPtr = std::make_unique<HueSaturationFilter>();
+  HueSaturationFilter& filter = *filterPtr;
   FilterManagerImpl filterMgr(ctx, &filter);
   if (params().mode.isSet()) filter.setMode(params().mode());
   if (params().hue.isSet()) filter.setHue(params().hue());
@@ -191,7 +194,7 @@ void HueSaturationCommand::onExecute(Context* ctx)
   else
 #endif // ENABLE_UI
   {
-    start_filter_worker(&filterMgr);
+    start_filter_worker(&filterMgr, std::move(filterPtr));
   }
 }
 
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -29,6 +29,8 @@
 #include "ui/widget.h"
 #include "ui/window.h"
 
+#include <memory>
+
 namespace app {
 
 struct InvertColorParams : public NewParams {
@@ -77,7 +79,8 @@ void InvertColorCommand::onExecute(Context* context)
   const bool ui = (params().ui() && context->isUIAvailable());
 #endif
 
-  InvertColorFilter filter;
+  auto filterPtr = std::make_unique<InvertColorFilter>();
+  InvertColorFilter& filter = *filterPtr;
   FilterManagerImpl filterMgr(context, &filter);
   filterMgr.setTarget(TARGET_RED_CHANNEL |
                       TARGET_GREEN_CHANNEL |
@@ -94,7 +97,7 @@ void InvertColorCommand::onExecute(Context* context)
   else
 #endif // ENABLE_UI
   {
-    start_filter_worker(&filterMgr);
+    start_filter_worker(&filterMgr, std::move(filterPtr));
   }
 }
 
@@ -34,6 +34,8 @@
 
 #include "outline.xml.h"
 
+#include <memory>
+
 namespace app {
 
 using namespace app::skin;
@@ -217,7 +219,8 @@ void OutlineCommand::onExecute(Context* context)
 
   Site site = context->activeSite();
 
-  OutlineFilterWrapper filter(site.layer());
+  auto filterPtr = std::make_unique<OutlineFilterWrapper>(site.layer());
+  OutlineFilterWrapper& filter = *filterPtr;
   if (site.layer() && site.layer()->isBackground() && site.image()) {
     // TODO configure default pixel (same as Autocrop/Trim refpixel)
     filter.bgColor(app::Color::fromImage(site.image()->pixelFormat(),
@@ -268,7 +271,7 @@ void OutlineCommand::onExecute(Context* context)
   else
 #endif // ENABLE_UI
   {
-    start_filter_worker(&filterMgr);
+    start_filter_worker(&filterMgr, std::move(filterPtr));
   }
 }
 
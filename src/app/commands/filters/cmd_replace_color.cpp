@@ -36,6 +36,8 @@
 #include "filters/replace_color_filter.h"
 #include "ui/ui.h"
 
+#include <memory>
+
 namespace app {
 
 struct ReplaceColorParams : public NewParams {
@@ -172,7 +174,8 @@ void ReplaceColorCommand::onExecute(Context* context)
 #endif
   Site site = context->activeSite();
 
-  ReplaceColorFilterWrapper filter(site.layer());
+  auto filterPtr = std::make_unique<ReplaceColorFilterWrapper>(site.layer());
+  ReplaceColorFilterWrapper& filter = *filterPtr;
   FilterManagerImpl filterMgr(context, &filter);
   filterMgr.setTarget(
     site.sprite()->pixelFormat() == IMAGE_INDEXED ?
@@ -204,7 +207,7 @@ void ReplaceColorCommand::onExecute(Context* context)
   else
 #endif // ENABLE_UI
   {
-    start_filter_worker(&filterMgr);
+    start_filter_worker(&filterMgr, std::move(filterPtr));
   }
 }
 
@@ -15,6 +15,7 @@
 #include "app/cmd/copy_region.h"
 #include "app/cmd/patch_cel.h"
 #include "app/cmd/set_palette.h"
+#include "app/cmd/trim_cel.h"
 #include "app/cmd/unlink_cel.h"
 #include "app/context_access.h"
 #include "app/doc.h"
@@ -34,21 +35,173 @@
 #include "doc/image.h"
 #include "doc/layer.h"
 #include "doc/mask.h"
+#include "doc/rgbmap.h"
 #include "doc/sprite.h"
+#include "filters/channels_lut.h"
 #include "filters/filter.h"
+#include "filters/point_filter_chain.h"
 #include "ui/manager.h"
 #include "ui/view.h"
 #include "ui/widget.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <set>
+#include <thread>
+#include <vector>
 
 namespace app {
 
 using namespace std;
 using namespace ui;
 
+namespace {
+
+// Number of rows filtered by each thread in each step (filters that
+// can be applied in bands)
+constexpr int kRowsPerBand = 16;
+
+// Min number of pixels to filter with an extra thread
+constexpr int kMinPixelsPerThread = 64*1024;
+
+// Locks the given row of the mask to iterate it with skipPixel().
+// Returns false if the row is outside the mask bounds.
+bool lock_mask_row(Mask* mask, const gfx::Rect& bounds, const int row,
+                   ImageBits<BitmapTraits>& maskBits,
+                   ImageBits<BitmapTraits>::iterator& maskIterator)
+{
+  if (mask && mask->bitmap()) {
+    int x = bounds.x - mask->bounds().x;
+    int y = bounds.y - mask->bounds().y + row;
+    if ((x >= bounds.w) ||
+        (y >= bounds.h))
+      return false;
+
+    maskBits = mask->bitmap()
+      ->lockBits<BitmapTraits>(Image::ReadLock,
+        gfx::Rect(x, y, bounds.w - x, bounds.h - y));
+
+    maskIterator = maskBits.begin();
+  }
+  return true;
+}
+
+// Copies the filtered pixel of each block of step x step pixels of
+// the given row to the rest of pixels of the block (used in
+// downscaled previews). Pixels outside the mask are not modified.
+template<typename ImageTraits>
+void replicate_preview_pixels(Image* dst, const Mask* mask,
+                              const gfx::Rect& bounds,
+                              const int row, const int step)
+{
+  const int y0 = bounds.y+row;
+  const int y1 = std::min(y0+step, bounds.y2());
+  auto srcRow = (typename ImageTraits::const_address_t)dst->getPixelAddress(0, y0);
+
+  for (int y=y0; y<y1; ++y) {
+    auto dstRow = (typename ImageTraits::address_t)dst->getPixelAddress(0, y);
+    for (int x=bounds.x; x<bounds.x2(); ++x) {
+      const int u = x - (x-bounds.x) % step;
+      if ((x == u && y == y0) ||
+          (mask && !mask->containsPoint(x, y)))
+        continue;
+
+      dstRow[x] = srcRow[u];
+    }
+  }
+}
+
+void apply_filter_to_row(Filter* filter,
+                         const PixelFormat pixelFormat,
+                         FilterManager* filterMgr)
+{
+  switch (pixelFormat) {
+    case IMAGE_RGB:       filter->applyToRgba(filterMgr); break;
+    case IMAGE_GRAYSCALE: filter->applyToGrayscale(filterMgr); break;
+    case IMAGE_INDEXED:   filter->applyToIndexed(filterMgr); break;
+  }
+}
+
+} // anonymous namespace
+
+class FilterManagerImpl::BandView : public FilterManager
+                                  , public FilterIndexedData {
+public:
+  // The "rgbmap" must be completely generated, so it can be used
+  // from several threads.
+  BandView(FilterManagerImpl* mgr, Filter* filter, const RgbMap* rgbmap,
+           const Image* src, Image* dst, const Target target)
+    : m_mgr(mgr)
+    , m_filter(filter)
+    , m_rgbmap(rgbmap)
+    , m_src(src)
+    , m_dst(dst)
+    , m_target(target)
+    , m_row(0) {
+  }
+
+  bool applyRow(const int row) {
+    m_row = row;
+    if (!lock_mask_row(m_mgr->m_mask, m_mgr->m_bounds, m_row,
+                       m_maskBits, m_maskIterator))
+      return false;
+
+    apply_filter_to_row(m_filter, m_mgr->pixelFormat(), this);
+    return true;
+  }
+
+  // FilterManager implementation
+  doc::PixelFormat pixelFormat() const override {
+    return m_mgr->pixelFormat();
+  }
+  const void* getSourceAddress() override {
+    return m_src->getPixelAddress(m_mgr->m_bounds.x,
+                                  m_mgr->m_bounds.y+m_row);
+  }
+  void* getDestinationAddress() override {
+    return m_dst->getPixelAddress(m_mgr->m_bounds.x,
+                                  m_mgr->m_bounds.y+m_row);
+  }
+  int getWidth() override { return m_mgr->m_bounds.w; }
+  Target getTarget() override { return m_target; }
+  FilterIndexedData* getIndexedData() override { return this; }
+  bool skipPixel() override {
+    bool skip = false;
+    if ((m_mgr->m_mask) && (m_mgr->m_mask->bitmap())) {
+      if (!*m_maskIterator)
+        skip = true;
+
+      ++m_maskIterator;
+    }
+    return skip;
+  }
+  const doc::Image* getSourceImage() override { return m_src; }
+  int x() const override { return m_mgr->m_bounds.x; }
+  int y() const override { return m_mgr->m_bounds.y+m_row; }
+  bool isFirstRow() const override { return m_row == 0; }
+  bool isMaskActive() const override { return m_mgr->isMaskActive(); }
+
+  // FilterIndexedData implementation
+  const doc::Palette* getPalette() const override { return m_mgr->getPalette(); }
+  const doc::RgbMap* getRgbMap() const override { return m_rgbmap; }
+  doc::Palette* getNewPalette() override { return m_mgr->getNewPalette(); }
+  doc::PalettePicks getPalettePicks() override { return m_mgr->getPalettePicks(); }
+
+private:
+  FilterManagerImpl* m_mgr;
+  Filter* m_filter;
+  const RgbMap* m_rgbmap;
+  const Image* m_src;
+  Image* m_dst;
+  Target m_target;
+  int m_row;
+  ImageBits<BitmapTraits> m_maskBits;
+  ImageBits<BitmapTraits>::iterator m_maskIterator;
+};
+
 FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   : m_reader(context)
   , m_site(*const_cast<Site*>(m_reader.site()))
@@ -57,6 +210,8 @@ FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   , m_src(nullptr)
   , m_dst(nullptr)
   , m_row(0)
+  , m_previewStep(1)
+  , m_previewCol(0)
   , m_mask(nullptr)
   , m_previewMask(nullptr)
   , m_targetOrig(TARGET_ALL_CHANNELS)
@@ -114,21 +269,41 @@ void FilterManagerImpl::setCelsTarget(CelsTarget celsTarget)
   m_celsTarget = celsTarget;
 }
 
+void FilterManagerImpl::addFilter(Filter* filter, Target target)
+{
+  ASSERT(filter);
+  m_filters.push_back(Pass{ filter, target });
+}
+
 void FilterManagerImpl::begin()
 {
   Doc* document = m_site.document();
 
   m_row = 0;
+  m_previewStep = 1;
   m_mask = (document->isMaskVisible() ? document->mask(): nullptr);
   updateBounds(m_mask);
 }
 
 #ifdef ENABLE_UI
 
-void FilterManagerImpl::beginForPreview()
+void FilterManagerImpl::beginForPreview(const bool downscaled)
 {
   Doc* document = m_site.document();
 
+  // Pixels that are not visible with the zoom level of the editors
+  // (the zoom of the editor with more zoom is used)
+  m_previewStep = 1;
+  if (downscaled) {
+    double scale = 0.0;
+    for (Editor* editor : UIContext::instance()->getAllEditorsIncludingPreview(document)) {
+      scale = std::max(scale, std::min(editor->projection().scaleX(),
+                                       editor->projection().scaleY()));
+    }
+    if (scale > 0.0 && scale < 1.0)
+      m_previewStep = int(1.0 / scale);
+  }
+
   if (document->isMaskVisible())
     m_previewMask.reset(new Mask(*document->mask()));
   else {
@@ -175,70 +350,152 @@ bool FilterManagerImpl::applyStep()
   if (m_row < 0 || m_row >= m_bounds.h)
     return false;
 
-  if (m_mask && m_mask->bitmap()) {
-    int x = m_bounds.x - m_mask->bounds().x;
-    int y = m_bounds.y - m_mask->bounds().y + m_row;
-    if ((x >= m_bounds.w) ||
-        (y >= m_bounds.h))
-      return false;
-
-    m_maskBits = m_mask->bitmap()
-      ->lockBits<BitmapTraits>(Image::ReadLock,
-        gfx::Rect(x, y, m_bounds.w - x, m_bounds.h - y));
-
-    m_maskIterator = m_maskBits.begin();
-  }
+  if (!lock_mask_row(m_mask, m_bounds, m_row, m_maskBits, m_maskIterator))
+    return false;
 
   if (m_row == 0) {
     applyToPaletteIfNeeded();
   }
 
-  switch (m_site.sprite()->pixelFormat()) {
-    case IMAGE_RGB:       m_filter->applyToRgba(this); break;
-    case IMAGE_GRAYSCALE: m_filter->applyToGrayscale(this); break;
-    case IMAGE_INDEXED:   m_filter->applyToIndexed(this); break;
+  m_previewCol = 0;
+  apply_filter_to_row(m_filter, m_site.sprite()->pixelFormat(), this);
+
+  if (m_previewStep > 1) {
+    const Mask* mask = (document()->isMaskVisible() ? m_mask: nullptr);
+    switch (m_site.sprite()->pixelFormat()) {
+      case IMAGE_RGB:
+        replicate_preview_pixels<RgbTraits>(m_dst.get(), mask, m_bounds, m_row, m_previewStep);
+        break;
+      case IMAGE_GRAYSCALE:
+        replicate_preview_pixels<GrayscaleTraits>(m_dst.get(), mask, m_bounds, m_row, m_previewStep);
+        break;
+      case IMAGE_INDEXED:
+        replicate_preview_pixels<IndexedTraits>(m_dst.get(), mask, m_bounds, m_row, m_previewStep);
+        break;
+    }
+    m_row = std::min(m_row+m_previewStep, m_bounds.h);
   }
-  ++m_row;
+  else
+    ++m_row;
 
   return true;
 }
 
+// Applies the filter to all rows using several threads (each thread
+// takes the next band of rows). Only the current thread reports the
+// progress. Returns true if the process was cancelled.
+bool FilterManagerImpl::applyInBands(Filter* filter,
+                                     const Target target,
+                                     const int nthreads)
+{
+  if (m_row < 0)
+    return false;
+
+  // Calculate all RgbMap entries, so the map isn't modified from
+  // several threads.
+  const RgbMap* rgbmap = nullptr;
+  if (pixelFormat() == IMAGE_INDEXED) {
+    rgbmap = getRgbMap();
+    rgbmap->generatePendingEntries();
+  }
+
+  const int h = m_bounds.h;
+  std::atomic<int> nextRow(0);
+  std::atomic<int> doneRows(0);
+  std::atomic<bool> cancelled(false);
+
+  auto applyBands = [&](const bool reportProgress) {
+    BandView view(this, filter, rgbmap, m_src.get(), m_dst.get(), target);
+    int y;
+    while (!cancelled && (y = (nextRow += kRowsPerBand) - kRowsPerBand) < h) {
+      const int yend = std::min(y+kRowsPerBand, h);
+      for (int row=y; row<yend; ++row) {
+        if (!view.applyRow(row))
+          break;
+      }
+      doneRows += yend-y;
+
+      if (reportProgress && m_progressDelegate) {
+        m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * doneRows / h);
+        if (m_progressDelegate->isCancelled())
+          cancelled = true;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i=1; i<nthreads; ++i)
+    threads.emplace_back(applyBands, false);
+  applyBands(true);
+  for (std::thread& thread : threads)
+    thread.join();
+
+  m_row = h;
+  return cancelled;
+}
+
 void FilterManagerImpl::apply()
 {
   CommandResult result;
   bool cancelled = false;
 
   begin();
-  while (!cancelled && applyStep()) {
-    if (m_progressDelegate) {
-      // Report progress.
-      m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * (m_row+1) / m_bounds.h);
+  if (m_passes.empty())
+    preparePasses();
+
+  // Filters that can be applied to independent rows use one thread
+  // for each band of rows
+  int nthreads = 1;
+  if (isBandSafe()) {
+    nthreads = std::max<int>(1, std::thread::hardware_concurrency());
+    nthreads = std::min(nthreads, (m_bounds.h+kRowsPerBand-1) / kRowsPerBand);
+    nthreads = std::min(nthreads, std::max(1, m_bounds.w*m_bounds.h / kMinPixelsPerThread));
+  }
+
+  if (m_filters.empty() && nthreads == 1) {
+    while (!cancelled && applyStep()) {
+      if (m_progressDelegate) {
+        // Report progress.
+        m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * (m_row+1) / m_bounds.h);
+
+        // Does the user cancelled the whole process?
+        cancelled = m_progressDelegate->isCancelled();
+      }
+    }
+  }
+  else {
+    // As applyStep() does in the first row
+    applyToPaletteIfNeeded();
 
-      // Does the user cancelled the whole process?
-      cancelled = m_progressDelegate->isCancelled();
+    // Each pass is applied to the result of the previous one
+    const ImageRef src = m_src;
+    const float progressBase = m_progressBase;
+    const float progressWidth = m_progressWidth;
+    m_progressWidth /= m_passes.size();
+
+    for (int i=0; i<int(m_passes.size()) && !cancelled; ++i) {
+      if (i > 0) {
+        m_src = m_dst;
+        m_dst.reset(Image::createCopy(m_src.get()));
+        m_row = 0;
+      }
+      const Pass& pass = m_passes[i];
+      cancelled = applyInBands(pass.filter,
+                               getCelTarget(m_cel, pass.target),
+                               nthreads);
+      m_progressBase += m_progressWidth;
     }
+
+    m_src = src;
+    m_progressBase = progressBase;
+    m_progressWidth = progressWidth;
   }
 
   if (!cancelled) {
     gfx::Rect output;
     if (algorithm::shrink_bounds2(m_src.get(), m_dst.get(),
                                   m_bounds, output)) {
-      if (m_cel->layer()->isBackground()) {
-        (*m_tx)(
-          new cmd::CopyRegion(
-            m_cel->image(),
-            m_dst.get(),
-            gfx::Region(output),
-            position()));
-      }
-      else {
-        // Patch "m_cel"
-        (*m_tx)(
-          new cmd::PatchCel(
-            m_cel, m_dst.get(),
-            gfx::Region(output),
-            position()));
-      }
+      patchCel(m_cel, m_dst.get(), output);
     }
 
     result = CommandResult(CommandResult::kOk);
@@ -251,9 +508,165 @@ void FilterManagerImpl::apply()
   m_reader.context()->setCommandResult(result);
 }
 
+// Applies the filter to several cels at the same time (each thread
+// filters a whole cel). Cels are processed in batches, and the
+// modified images of each batch are added to the transaction in the
+// same order of "cels" from the current thread, so the undo history
+// is the same as applying the filter to each cel sequentially.
+// Returns true if the process was cancelled.
+bool FilterManagerImpl::applyToCels(const CelList& cels, const int nthreads)
+{
+  begin();
+  if (m_bounds.isEmpty())
+    throw InvalidAreaException();
+
+  // As applyStep() does in the first row of each cel
+  applyToPaletteIfNeeded();
+  if (m_passes.empty())
+    preparePasses();
+
+  const RgbMap* rgbmap = nullptr;
+  if (pixelFormat() == IMAGE_INDEXED) {
+    rgbmap = getRgbMap();
+    rgbmap->generatePendingEntries();
+  }
+
+  // Filtered images of one cel
+  struct CelImages {
+    Cel* cel;
+    ImageRef dst;
+    gfx::Rect output;
+    bool modified;
+  };
+
+  const gfx::Rect spriteBounds = m_site.sprite()->bounds();
+  const int ncels = int(cels.size());
+  const int celsPerBatch =
+    nthreads * std::max(1, kMinPixelsPerThread / std::max(1, m_bounds.w*m_bounds.h));
+  std::vector<CelImages> batch;
+  std::atomic<bool> cancelled(false);
+  int doneCels = 0;
+
+  auto filterCel = [this, rgbmap, spriteBounds](CelImages& item) {
+    Cel* cel = item.cel;
+    ImageRef src(
+      crop_image(cel->image(),
+                 gfx::Rect(spriteBounds).offset(-cel->position()), 0));
+    item.dst.reset(Image::createCopy(src.get()));
+
+    // Each pass is applied to the result of the previous one
+    ImageRef passSrc = src;
+    for (int i=0; i<int(m_passes.size()); ++i) {
+      if (i > 0) {
+        passSrc = item.dst;
+        item.dst.reset(Image::createCopy(passSrc.get()));
+      }
+      const Pass& pass = m_passes[i];
+      BandView view(this, pass.filter, rgbmap, passSrc.get(), item.dst.get(),
+                    getCelTarget(cel, pass.target));
+      for (int row=0; row<m_bounds.h; ++row) {
+        if (!view.applyRow(row))
+          break;
+      }
+    }
+
+    item.modified =
+      algorithm::shrink_bounds2(src.get(), item.dst.get(),
+                                m_bounds, item.output);
+  };
+
+  auto it = cels.begin();
+  while (it != cels.end() && !cancelled) {
+    batch.clear();
+    for (; it != cels.end() && int(batch.size()) < celsPerBatch; ++it)
+      batch.push_back(CelImages{ *it, nullptr, gfx::Rect(), false });
+
+    std::atomic<int> next(0);
+    std::atomic<int> filtered(0);
+    auto filterCels = [&](const bool reportProgress) {
+      int i;
+      while (!cancelled && (i = next++) < int(batch.size())) {
+        filterCel(batch[i]);
+        ++filtered;
+
+        if (reportProgress && m_progressDelegate) {
+          m_progressDelegate->reportProgress(float(doneCels + filtered) / ncels);
+          if (m_progressDelegate->isCancelled())
+            cancelled = true;
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i=1; i<std::min(nthreads, int(batch.size())); ++i)
+      threads.emplace_back(filterCels, false);
+    filterCels(true);
+    for (std::thread& thread : threads)
+      thread.join();
+
+    if (cancelled)
+      break;
+
+    // Only this thread modifies the sprite
+    for (CelImages& item : batch) {
+      if (item.modified)
+        patchCel(item.cel, item.dst.get(), item.output);
+    }
+    doneCels += int(batch.size());
+
+    if (m_progressDelegate) {
+      m_progressDelegate->reportProgress(float(doneCels) / ncels);
+      if (m_progressDelegate->isCancelled())
+        cancelled = true;
+    }
+  }
+
+  ASSERT(m_reader.context());
+  m_reader.context()->setCommandResult(
+    CommandResult(cancelled ? CommandResult::kCanceled:
+                              CommandResult::kOk));
+  return cancelled;
+}
+
+void FilterManagerImpl::patchCel(Cel* cel, Image* dst, const gfx::Rect& output)
+{
+  // Without undo we can modify the cel image in place (if the cel
+  // doesn't need to be expanded), avoiding the copy of the original
+  // pixels that the cmds save for undo
+  if (!m_reader.context()->isUndoEnabled() &&
+      cel->bounds().contains(output)) {
+    cel->image()->copy(
+      dst, gfx::Clip(output.x - cel->x(), output.y - cel->y(), output));
+    cel->image()->incrementVersion();
+
+    // As cmd::PatchCel does
+    if (!cel->layer()->isBackground())
+      (*m_tx)(new cmd::TrimCel(cel));
+    return;
+  }
+
+  if (cel->layer()->isBackground()) {
+    (*m_tx)(
+      new cmd::CopyRegion(
+        cel->image(),
+        dst,
+        gfx::Region(output),
+        position()));
+  }
+  else {
+    // Patch "cel"
+    (*m_tx)(
+      new cmd::PatchCel(
+        cel, dst,
+        gfx::Region(output),
+        position()));
+  }
+}
+
 void FilterManagerImpl::applyToTarget()
 {
   applyToPaletteIfNeeded();
+  preparePasses();
 
   const bool paletteChange = paletteHasChanged();
   bool cancelled = false;
@@ -305,24 +718,47 @@ void FilterManagerImpl::applyToTarget()
                           m_site.frame(), &newPalette));
   }
 
-  // For each target image
-  for (auto it = cels.begin();
-       it != cels.end() && !cancelled;
-       ++it) {
-    Image* image = (*it)->image();
+  // Filters that can be applied to independent rows can be applied
+  // to different cels at the same time too
+  int nthreads = 1;
+  if (isBandSafe() && cels.size() > 1) {
+    const gfx::Rect bounds = m_site.sprite()->bounds();
+    const int celsPerThread =
+      std::max(1, kMinPixelsPerThread / std::max(1, bounds.w*bounds.h));
+    nthreads = std::max<int>(1, std::thread::hardware_concurrency());
+    nthreads = std::min<int>(nthreads, cels.size() / celsPerThread);
+    nthreads = std::max(1, nthreads);
+  }
 
+  if (nthreads > 1) {
     // Avoid applying the filter two times to the same image
-    if (visited.find(image->id()) == visited.end()) {
-      visited.insert(image->id());
-      applyToCel(*it);
+    CelList uniqueCels;
+    for (Cel* cel : cels) {
+      if (visited.insert(cel->image()->id()).second)
+        uniqueCels.push_back(cel);
     }
+    applyToCels(uniqueCels, nthreads);
+  }
+  else {
+    // For each target image
+    for (auto it = cels.begin();
+         it != cels.end() && !cancelled;
+         ++it) {
+      Image* image = (*it)->image();
+
+      // Avoid applying the filter two times to the same image
+      if (visited.find(image->id()) == visited.end()) {
+        visited.insert(image->id());
+        applyToCel(*it);
+      }
 
-    // Is there a delegate to know if the process was cancelled by the user?
-    if (m_progressDelegate)
-      cancelled = m_progressDelegate->isCancelled();
+      // Is there a delegate to know if the process was cancelled by the user?
+      if (m_progressDelegate)
+        cancelled = m_progressDelegate->isCancelled();
 
-    // Make progress
-    m_progressBase += m_progressWidth;
+      // Make progress
+      m_progressBase += m_progressWidth;
+    }
   }
 
   // Reset m_oldPalette to avoid restoring the color palette
@@ -334,7 +770,7 @@ void FilterManagerImpl::initTransaction()
   ASSERT(!m_tx);
   m_writer.reset(new ContextWriter(m_reader));
   m_tx.reset(new Tx(m_writer->context(),
-                    m_filter->getName(),
+                    (m_filters.empty() ? m_filter->getName(): "Filters"),
                     ModifyDocument));
 }
 
@@ -427,12 +863,21 @@ bool FilterManagerImpl::skipPixel()
     ++m_maskIterator;
   }
 
+  // Downscaled preview: only the first pixel of each block is filtered
+  if (m_previewStep > 1) {
+    if (m_previewCol % m_previewStep)
+      skip = true;
+    ++m_previewCol;
+  }
+
   return skip;
 }
 
 const Palette* FilterManagerImpl::getPalette() const
 {
-  if (m_oldPalette)
+  if (m_passPalette)
+    return m_passPalette.get();
+  else if (m_oldPalette)
     return m_oldPalette.get();
   else
     return m_site.sprite()->palette(m_site.frame());
@@ -471,14 +916,68 @@ void FilterManagerImpl::init(Cel* cel)
   m_dst.reset(Image::createCopy(m_src.get()));
 
   m_row = -1;
+  m_previewStep = 1;
   m_mask = nullptr;
   m_previewMask.reset(nullptr);
 
-  m_target = m_targetOrig;
+  m_target = getCelTarget(cel, m_targetOrig);
+}
 
+// Creates the list of passes to apply to each cel: the main filter
+// and the ones added with addFilter(). Consecutive filters with the
+// same target that can be represented with tables are fused in one
+// PointFilterChain, so the image is traversed only once for all of
+// them.
+void FilterManagerImpl::preparePasses()
+{
+  m_passes.clear();
+  m_chains.clear();
+
+  std::vector<Pass> filters;
+  filters.push_back(Pass{ m_filter, m_targetOrig });
+  filters.insert(filters.end(), m_filters.begin(), m_filters.end());
+
+  for (int i=0; i<int(filters.size()); ) {
+    ChannelsLut lut;
+    int j = i+1;
+    if (filters[i].filter->getChannelsLut(filters[i].target, lut)) {
+      while (j < int(filters.size()) &&
+             filters[j].target == filters[i].target &&
+             filters[j].filter->getChannelsLut(filters[j].target, lut))
+        ++j;
+    }
+
+    if (j-i > 1) {
+      auto chain = std::make_unique<PointFilterChain>();
+      for (int k=i; k<j; ++k)
+        chain->addFilter(filters[k].filter);
+      m_passes.push_back(Pass{ chain.get(), filters[i].target });
+      m_chains.push_back(std::move(chain));
+    }
+    else
+      m_passes.push_back(filters[i]);
+    i = j;
+  }
+}
+
+bool FilterManagerImpl::isBandSafe() const
+{
+  if (m_passes.empty())
+    return m_filter->isBandSafe();
+
+  for (const Pass& pass : m_passes) {
+    if (!pass.filter->isBandSafe())
+      return false;
+  }
+  return true;
+}
+
+Target FilterManagerImpl::getCelTarget(const Cel* cel, Target target) const
+{
   // The alpha channel of the background layer can't be modified
   if (cel->layer()->isBackground())
-    m_target &= ~TARGET_ALPHA_CHANNEL;
+    target &= ~TARGET_ALPHA_CHANNEL;
+  return target;
 }
 
 void FilterManagerImpl::applyToCel(Cel* cel)
@@ -518,6 +1017,15 @@ void FilterManagerImpl::restoreSpritePalette()
 void FilterManagerImpl::applyToPaletteIfNeeded()
 {
   m_filter->applyToPalette(this);
+
+  // Each added filter modifies the palette generated by the previous
+  // filters
+  for (const Pass& pass : m_filters) {
+    if (m_oldPalette)
+      m_passPalette.reset(new Palette(*m_site.sprite()->palette(m_site.frame())));
+    pass.filter->applyToPalette(this);
+    m_passPalette.reset();
+  }
 }
 
 #ifdef ENABLE_UI
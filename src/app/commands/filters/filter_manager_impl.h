@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -14,6 +14,7 @@
 #include "app/site.h"
 #include "app/tx.h"
 #include "base/exception.h"
+#include "doc/cel_list.h"
 #include "doc/image_impl.h"
 #include "doc/image_ref.h"
 #include "doc/pixel_format.h"
@@ -35,6 +36,7 @@ namespace doc {
 
 namespace filters {
   class Filter;
+  class PointFilterChain;
 }
 
 namespace app {
@@ -79,11 +81,22 @@ namespace app {
     void setProgressDelegate(IProgressDelegate* progressDelegate);
 
     void setTarget(Target target);
+    Target originalTarget() const { return m_targetOrig; }
     void setCelsTarget(CelsTarget celsTarget);
 
+    // Adds a filter to be applied in applyToTarget() to the result of
+    // the previous filters (with its own target). All filters are
+    // applied to each cel before patching it, with one transaction.
+    void addFilter(Filter* filter, Target target);
+
     void begin();
 #ifdef ENABLE_UI
-    void beginForPreview();
+    // Starts a preview of the filter in the visible area of the
+    // editors. If "downscaled" is true and the editors are zoomed
+    // out, only one pixel of each block of previewStep()xpreviewStep()
+    // pixels is filtered (a quick approximation of the result).
+    void beginForPreview(const bool downscaled = false);
+    int previewStep() const { return m_previewStep; }
 #endif
     void end();
     bool applyStep();
@@ -93,6 +106,7 @@ namespace app {
     bool isTransaction() const;
     void commitTransaction();
 
+    Context* context() { return m_reader.context(); }
     Doc* document();
     doc::Sprite* sprite() { return m_site.sprite(); }
     doc::Layer* layer() { return m_site.layer(); }
@@ -127,9 +141,28 @@ namespace app {
     doc::PalettePicks getPalettePicks() override;
 
   private:
+    // View of the FilterManagerImpl used to apply the filter to a
+    // band of rows from other thread (each thread has its own row and
+    // mask iterator).
+    class BandView;
+
+    // Filter to apply to all rows of a cel (the filters added with
+    // addFilter() are different passes, and consecutive point
+    // filters are fused in just one pass)
+    struct Pass {
+      Filter* filter;
+      Target target;
+    };
+
     void init(doc::Cel* cel);
+    void preparePasses();
+    bool isBandSafe() const;
+    Target getCelTarget(const doc::Cel* cel, Target target) const;
     void apply();
+    bool applyInBands(Filter* filter, const Target target, const int nthreads);
+    bool applyToCels(const doc::CelList& cels, const int nthreads);
     void applyToCel(doc::Cel* cel);
+    void patchCel(doc::Cel* cel, doc::Image* dst, const gfx::Rect& output);
     bool updateBounds(doc::Mask* mask);
 
     // Returns true if the palette was changed (true when the filter
@@ -153,6 +186,10 @@ namespace app {
 #ifdef ENABLE_UI
     int m_nextRowToFlush;
 #endif
+    // Size of the blocks of pixels filtered in a downscaled preview
+    // (1 to filter all pixels), and current column of the row
+    int m_previewStep;
+    int m_previewCol;
     gfx::Rect m_bounds;
     doc::Mask* m_mask;
     std::unique_ptr<doc::Mask> m_previewMask;
@@ -162,8 +199,15 @@ namespace app {
     Target m_target;              // Filtered targets
     CelsTarget m_celsTarget;
     std::unique_ptr<doc::Palette> m_oldPalette;
+    // Palette modified by the previous filters (used when several
+    // filters modify the palette)
+    std::unique_ptr<doc::Palette> m_passPalette;
     std::unique_ptr<Tx> m_tx;
 
+    std::vector<Pass> m_filters;  // Filters added with addFilter()
+    std::vector<Pass> m_passes;
+    std::vector<std::unique_ptr<filters::PointFilterChain>> m_chains;
+
     // Hooks
     float m_progressBase;
     float m_progressWidth;
@@ -0,0 +1,63 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/commands/filters/filter_pipeline.h"
+
+#include "app/commands/filters/filter_manager_impl.h"
+#include "app/commands/filters/filter_worker.h"
+#include "base/debug.h"
+#include "filters/filter.h"
+
+namespace app {
+
+static FilterPipeline* g_current = nullptr;
+
+FilterPipeline::FilterPipeline()
+  : m_prev(g_current)
+{
+  g_current = this;
+}
+
+FilterPipeline::~FilterPipeline()
+{
+  ASSERT(g_current == this);
+  g_current = m_prev;
+}
+
+// static
+FilterPipeline* FilterPipeline::current()
+{
+  return g_current;
+}
+
+void FilterPipeline::addFilter(std::unique_ptr<filters::Filter>&& filter,
+                               const filters::Target target)
+{
+  ASSERT(filter);
+  m_filters.push_back(Item{ std::move(filter), target });
+}
+
+void FilterPipeline::apply(Context* context)
+{
+  if (m_filters.empty())
+    return;
+
+  std::vector<Item> filters;
+  std::swap(filters, m_filters);
+
+  FilterManagerImpl filterMgr(context, filters[0].filter.get());
+  filterMgr.setTarget(filters[0].target);
+  for (int i=1; i<int(filters.size()); ++i)
+    filterMgr.addFilter(filters[i].filter.get(), filters[i].target);
+
+  start_filter_worker(&filterMgr);
+}
+
+} // namespace app
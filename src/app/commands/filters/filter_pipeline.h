@@ -0,0 +1,57 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_COMMANDS_FILTERS_FILTER_PIPELINE_H_INCLUDED
+#define APP_COMMANDS_FILTERS_FILTER_PIPELINE_H_INCLUDED
+#pragma once
+
+#include "filters/target.h"
+
+#include <memory>
+#include <vector>
+
+namespace filters {
+  class Filter;
+}
+
+namespace app {
+  class Context;
+
+  // Collects the filters executed by commands without UI (e.g. from
+  // a script) while the pipeline exists, so they are applied all
+  // together with apply(): each cel is read and patched just one
+  // time, using one transaction for all filters.
+  class FilterPipeline {
+  public:
+    FilterPipeline();
+    ~FilterPipeline();
+
+    // Returns the pipeline that is collecting filters, or nullptr if
+    // the filters must be applied immediately.
+    static FilterPipeline* current();
+
+    bool empty() const { return m_filters.empty(); }
+
+    void addFilter(std::unique_ptr<filters::Filter>&& filter,
+                   const filters::Target target);
+
+    // Applies all the collected filters to the active site of the
+    // given context.
+    void apply(Context* context);
+
+  private:
+    struct Item {
+      std::unique_ptr<filters::Filter> filter;
+      filters::Target target;
+    };
+
+    std::vector<Item> m_filters;
+    FilterPipeline* m_prev;
+  };
+
+} // namespace app
+
+#endif
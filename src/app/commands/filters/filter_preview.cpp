@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -26,10 +26,15 @@ namespace app {
 using namespace ui;
 using namespace filters;
 
+// Milliseconds without changes in the filter parameters to refine a
+// downscaled preview
+constexpr int kRefineDelayMsecs = 250;
+
 FilterPreview::FilterPreview(FilterManagerImpl* filterMgr)
   : Widget(kGenericWidget)
   , m_filterMgr(filterMgr)
   , m_timer(1, this)
+  , m_refineTimer(kRefineDelayMsecs, this)
   , m_filterThread(nullptr)
   , m_filterIsDone(false)
 {
@@ -67,6 +72,7 @@ void FilterPreview::stop()
   }
 
   m_timer.stop();
+  m_refineTimer.stop();
 
   if (m_filterThread) {
     m_filterThread->join();
@@ -75,16 +81,26 @@ void FilterPreview::stop()
 }
 
 void FilterPreview::restartPreview()
+{
+  startPreview(true);
+}
+
+void FilterPreview::startPreview(const bool downscaled)
 {
   stop();
 
   base::scoped_lock lock(m_filterMgrMutex);
 
-  m_filterMgr->beginForPreview();
+  m_filterMgr->beginForPreview(downscaled);
   m_filterIsDone = false;
   m_timer.start();
   m_filterThread.reset(
     new base::thread([this]{ onFilterThread(); }));
+
+  // Each restart delays the refinement, so the full resolution
+  // filter is applied only when the user stops changing parameters
+  if (m_filterMgr->previewStep() > 1)
+    m_refineTimer.start();
 }
 
 bool FilterPreview::onProcessMessage(Message* msg)
@@ -102,10 +118,17 @@ bool FilterPreview::onProcessMessage(Message* msg)
       {
         base::scoped_lock lock(m_filterMgrMutex);
         m_timer.stop();
+        m_refineTimer.stop();
       }
       break;
 
     case kTimerMessage: {
+      if (static_cast<TimerMessage*>(msg)->timer() == &m_refineTimer) {
+        m_refineTimer.stop();
+        startPreview(false);
+        break;
+      }
+
       base::scoped_lock lock(m_filterMgrMutex);
       if (m_filterMgr) {
         m_filterMgr->flush();
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -26,16 +27,22 @@ namespace app {
     void setEnablePreview(bool state);
 
     void stop();
+
+    // Restarts the preview with a downscaled version of the filter
+    // (if the editors are zoomed out), which is refined to the full
+    // resolution when the preview is not restarted for a while.
     void restartPreview();
 
   protected:
     bool onProcessMessage(ui::Message* msg) override;
 
   private:
+    void startPreview(const bool downscaled);
     void onFilterThread();
 
     FilterManagerImpl* m_filterMgr;
     ui::Timer m_timer;
+    ui::Timer m_refineTimer;
     base::mutex m_filterMgrMutex;
     std::unique_ptr<base::thread> m_filterThread;
     bool m_filterIsDone;
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -11,7 +11,9 @@
 
 #include "app/app.h"
 #include "app/commands/filters/filter_manager_impl.h"
+#include "app/commands/filters/filter_pipeline.h"
 #include "app/console.h"
+#include "app/context.h"
 #include "app/i18n/strings.h"
 #include "app/ini_file.h"
 #include "app/modules/editors.h"
@@ -249,4 +251,16 @@ void start_filter_worker(FilterManagerImpl* filterMgr)
   filterWorker.run();
 }
 
+void start_filter_worker(FilterManagerImpl* filterMgr,
+                         std::unique_ptr<filters::Filter>&& filter)
+{
+  if (FilterPipeline* pipeline = FilterPipeline::current()) {
+    pipeline->addFilter(std::move(filter), filterMgr->originalTarget());
+    filterMgr->context()->setCommandResult(
+      CommandResult(CommandResult::kOk));
+  }
+  else
+    start_filter_worker(filterMgr);
+}
+
 } // namespace app
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -8,12 +9,24 @@
 #define APP_COMMANDS_FILTERS_FILTER_BG_H_INCLUDED
 #pragma once
 
+#include <memory>
+
+namespace filters {
+  class Filter;
+}
+
 namespace app {
 
   class FilterManagerImpl;
 
   void start_filter_worker(FilterManagerImpl* filterMgr);
 
+  // Applies the filter (used by "filterMgr") or adds it to the
+  // current FilterPipeline (if there is one) to be applied later
+  // with other filters.
+  void start_filter_worker(FilterManagerImpl* filterMgr,
+                           std::unique_ptr<filters::Filter>&& filter);
+
 } // namespace app
 
 #endif
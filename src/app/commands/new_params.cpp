@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2021  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -12,6 +12,7 @@
 
 #include "app/color.h"
 #include "app/doc_exporter.h"
+#include "app/sprite_sheet_packing.h"
 #include "app/sprite_sheet_type.h"
 #include "app/tools/ink_type.h"
 #include "base/convert_to.h"
@@ -25,6 +26,7 @@
 #include "filters/tiled_mode.h"
 #include "gfx/rect.h"
 #include "gfx/size.h"
+#include "render/quantization_algorithm.h"
 
 #ifdef ENABLE_SCRIPTING
 #include "app/script/engine.h"
@@ -114,10 +116,32 @@ void Param<app::SpriteSheetType>::fromString(const std::string& value)
     setValue(app::SpriteSheetType::Columns);
   else if (value == "packed")
     setValue(app::SpriteSheetType::Packed);
+  else if (value == "maxrects")
+    setValue(app::SpriteSheetType::MaxRects);
   else
     setValue(app::SpriteSheetType::None);
 }
 
+template<>
+void Param<app::SpriteSheetPacking>::fromString(const std::string& value)
+{
+  // BestShortSideFit, best-short-side-fit, etc.
+  if (base::utf8_icmp(value, "BestShortSideFit") == 0 ||
+      base::utf8_icmp(value, "best-short-side-fit") == 0)
+    setValue(app::SpriteSheetPacking::BestShortSideFit);
+  else if (base::utf8_icmp(value, "BestLongSideFit") == 0 ||
+           base::utf8_icmp(value, "best-long-side-fit") == 0)
+    setValue(app::SpriteSheetPacking::BestLongSideFit);
+  else if (base::utf8_icmp(value, "BestAreaFit") == 0 ||
+           base::utf8_icmp(value, "best-area-fit") == 0)
+    setValue(app::SpriteSheetPacking::BestAreaFit);
+  else if (base::utf8_icmp(value, "BottomLeft") == 0 ||
+           base::utf8_icmp(value, "bottom-left") == 0)
+    setValue(app::SpriteSheetPacking::BottomLeft);
+  else
+    setValue(app::SpriteSheetPacking::Default);
+}
+
 template<>
 void Param<app::SpriteSheetDataFormat>::fromString(const std::string& value)
 {
@@ -126,6 +150,9 @@ void Param<app::SpriteSheetDataFormat>::fromString(const std::string& value)
       base::utf8_icmp(value, "json-array") == 0 ||
       base::utf8_icmp(value, "json_array") == 0)
     setValue(app::SpriteSheetDataFormat::JsonArray);
+  else if (base::utf8_icmp(value, "MsgPack") == 0 ||
+           base::utf8_icmp(value, "MessagePack") == 0)
+    setValue(app::SpriteSheetDataFormat::MsgPack);
   else
     setValue(app::SpriteSheetDataFormat::JsonHash);
 }
@@ -144,6 +171,17 @@ void Param<doc::ColorMode>::fromString(const std::string& value)
     setValue(doc::ColorMode::RGB);
 }
 
+template<>
+void Param<render::QuantizationAlgorithm>::fromString(const std::string& value)
+{
+  if (base::utf8_icmp(value, "octree") == 0)
+    setValue(render::QuantizationAlgorithm::Octree);
+  else if (base::utf8_icmp(value, "octree-kmeans") == 0)
+    setValue(render::QuantizationAlgorithm::OctreeKMeans);
+  else
+    setValue(render::QuantizationAlgorithm::MedianCut);
+}
+
 template<>
 void Param<app::Color>::fromString(const std::string& value)
 {
@@ -285,6 +323,15 @@ void Param<app::SpriteSheetType>::fromLua(lua_State* L, int index)
     setValue((app::SpriteSheetType)lua_tointeger(L, index));
 }
 
+template<>
+void Param<app::SpriteSheetPacking>::fromLua(lua_State* L, int index)
+{
+  if (lua_type(L, index) == LUA_TSTRING)
+    fromString(lua_tostring(L, index));
+  else
+    setValue((app::SpriteSheetPacking)lua_tointeger(L, index));
+}
+
 template<>
 void Param<app::SpriteSheetDataFormat>::fromLua(lua_State* L, int index)
 {
@@ -303,6 +350,15 @@ void Param<doc::ColorMode>::fromLua(lua_State* L, int index)
     setValue((doc::ColorMode)lua_tointeger(L, index));
 }
 
+template<>
+void Param<render::QuantizationAlgorithm>::fromLua(lua_State* L, int index)
+{
+  if (lua_type(L, index) == LUA_TSTRING)
+    fromString(lua_tostring(L, index));
+  else
+    setValue((render::QuantizationAlgorithm)lua_tointeger(L, index));
+}
+
 template<>
 void Param<app::Color>::fromLua(lua_State* L, int index)
 {
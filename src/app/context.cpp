@@ -32,6 +32,7 @@ Context::Context()
   : m_docs(this)
   , m_lastSelectedDoc(nullptr)
   , m_preferences(nullptr)
+  , m_undoEnabled(true)
 {
   m_docs.add_observer(this);
 }
@@ -158,7 +159,7 @@ void Context::executeCommand(Command* command, const Params& params)
 
     command->loadParams(params);
 
-    CommandExecutionEvent ev(command);
+    CommandExecutionEvent ev(command, params);
     BeforeCommandExecution(ev);
 
     if (ev.isCanceled()) {
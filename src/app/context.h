@@ -62,11 +62,12 @@ namespace app {
 
   class CommandExecutionEvent {
   public:
-    CommandExecutionEvent(Command* command)
-      : m_command(command), m_canceled(false) {
+    CommandExecutionEvent(Command* command, const Params& params)
+      : m_command(command), m_params(params), m_canceled(false) {
     }
 
     Command* command() const { return m_command; }
+    const Params& params() const { return m_params; }
 
     // True if the command was canceled or simulated by an
     // observer/signal slot.
@@ -77,6 +78,7 @@ namespace app {
 
   private:
     Command* m_command;
+    const Params& m_params;
     bool m_canceled;
   };
 
@@ -96,6 +98,12 @@ namespace app {
     virtual bool isExecutingMacro() const  { return false; }
     virtual bool isExecutingScript() const { return false; }
 
+    // When undo is disabled (e.g. scripts executed with --no-undo in
+    // batch mode) transactions modify documents without keeping undo
+    // information, so they cannot be undone/rolled back.
+    bool isUndoEnabled() const { return m_undoEnabled; }
+    void setUndoEnabled(const bool state) { m_undoEnabled = state; }
+
     bool checkFlags(uint32_t flags) const { return m_flags.check(flags); }
     void updateFlags() { m_flags.update(this); }
 
@@ -154,6 +162,8 @@ namespace app {
     // Result of the execution of a command.
     CommandResult m_result;
 
+    bool m_undoEnabled;
+
     DISABLE_COPYING(Context);
   };
 
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -25,11 +25,21 @@
 #include "app/doc.h"
 #include "app/doc_access.h"
 #include "app/doc_diff.h"
+#include "app/doc_undo.h"
+#include "app/file/file.h"
 #include "app/pref/preferences.h"
 #include "base/chrono.h"
+#include "base/fs.h"
 #include "base/remove_from_container.h"
+#include "base/string.h"
+#include "dio/detect_format.h"
+#include "doc/trace.h"
 #include "ui/system.h"
 
+#ifdef _WIN32
+  #include <windows.h>
+#endif
+
 namespace app {
 namespace crash {
 
@@ -143,8 +153,15 @@ void BackupObserver::backgroundThread()
     bool somethingLocked = false;
 
     for (Doc* doc : m_documents) {
+      uint64_t undoVersion = 0;
+      const bool autoSave =
+        (m_config->autoSaveFiles &&
+         canAutoSaveDocument(doc, &undoVersion));
+
       if (!saveDocData(doc))
         somethingLocked = true;
+      else if (autoSave)
+        autoSaveDocument(doc, undoVersion);
     }
 
     if (!m_closedDocs.empty()) {
@@ -175,6 +192,8 @@ void BackupObserver::backgroundThread()
 // Executed from the backgroundThread() (non-UI thread)
 bool BackupObserver::saveDocData(Doc* doc)
 {
+  DOC_TRACE_ZONE("BackupObserver::saveDocData");
+
   try {
     if (!doc->needsBackup())
       return true;
@@ -223,5 +242,125 @@ bool BackupObserver::saveDocData(Doc* doc)
   return false;
 }
 
+// Returns true if the document is a modified .aseprite file that can
+// be saved from its backup data, and the version of its current undo
+// state (to know if the backup contains the same changes). Executed
+// from the backgroundThread().
+bool BackupObserver::canAutoSaveDocument(Doc* doc,
+                                         uint64_t* undoVersion)
+{
+  try {
+    DocReader reader(doc, 250);
+    if (!doc->isModified() ||
+        !doc->isAssociatedToFile() ||
+        !doc->needsBackup() ||
+        doc->inhibitBackup() ||
+        doc->isLoadingFrames() ||
+        dio::detect_format_by_file_extension(doc->filename()) != dio::FileFormat::ASE_ANIMATION)
+      return false;
+
+    *undoVersion = doc->undoHistory()->stateVersion();
+    return true;
+  }
+  catch (const std::exception&) {
+    return false;
+  }
+}
+
+// Saves the real file of the document using the backup that was just
+// created as the snapshot of the document, so the document is not
+// locked while the file is encoded. The file is saved in a temporary
+// file that replaces the original one when it is completely saved.
+// Executed from the backgroundThread().
+void BackupObserver::autoSaveDocument(Doc* doc,
+                                      const uint64_t undoVersion)
+{
+  const doc::ObjectId docId = doc->id();
+  std::string filename;
+  try {
+    // If the document was modified while the backup was being saved
+    // we cannot know if the backup is the current state or not, so
+    // we wait the next backup
+    DocReader reader(doc, 250);
+    if (doc->undoHistory()->stateVersion() != undoVersion)
+      return;
+    filename = doc->filename();
+  }
+  catch (const std::exception&) {
+    return;
+  }
+
+  std::unique_ptr<Doc> copy(
+    m_session->restoreBackupDocById(docId, nullptr));
+  if (!copy)
+    return;
+
+  const std::string tmpFilename =
+    base::join_path(base::get_file_path(filename),
+                    "." + base::get_file_title(filename) + "-autosave." +
+                    base::get_file_extension(filename));
+
+  TRACE("RECO: Auto-saving document '%d' in '%s'...\n",
+        docId, filename.c_str());
+
+  try {
+    std::unique_ptr<FileOp> fop(
+      FileOp::createSaveDocumentOperation(
+        nullptr,
+        FileOpROI(copy.get(), std::string(), std::string(),
+                  doc::SelectedFrames(), false),
+        tmpFilename, std::string(), false,
+        &m_config->fileOpConfig));
+    if (!fop)
+      return;
+
+    if (!fop->hasError()) {
+      fop->operate(nullptr);
+      fop->done();
+    }
+    if (fop->hasError()) {
+      TRACE("RECO: Error auto-saving document '%d': %s\n",
+            docId, fop->error().c_str());
+      if (base::is_file(tmpFilename))
+        base::delete_file(tmpFilename);
+      return;
+    }
+
+#ifdef _WIN32
+    // base::move_file() cannot replace an existent file on Windows,
+    // MoveFileEx() replaces it in one step (so the original file is
+    // not lost if the process is interrupted)
+    if (!MoveFileExW(base::from_utf8(tmpFilename).c_str(),
+                     base::from_utf8(filename).c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+      TRACE("RECO: Error replacing '%s' with the auto-saved file (%d)\n",
+            filename.c_str(), int(GetLastError()));
+      base::delete_file(tmpFilename);
+      return;
+    }
+#else
+    base::move_file(tmpFilename, filename);
+#endif
+  }
+  catch (const std::exception& ex) {
+    TRACE("RECO: Exception auto-saving document '%d': %s\n",
+          docId, ex.what());
+    return;
+  }
+
+  ui::execute_from_ui_thread(
+    [docId, undoVersion, filename]{
+      // The document is marked as saved only if it wasn't closed,
+      // renamed, or modified after the backup was created
+      Doc* doc = doc::get<Doc>(docId);
+      if (doc &&
+          doc->filename() == filename &&
+          doc->undoHistory()->stateVersion() == undoVersion) {
+        doc->markAsSaved();
+        doc->incrementVersion();
+      }
+    });
+}
+
 } // namespace crash
 } // namespace app
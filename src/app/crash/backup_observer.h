@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -15,6 +15,7 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <cstdint>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -43,6 +44,8 @@ namespace crash {
   private:
     void backgroundThread();
     bool saveDocData(Doc* doc);
+    bool canAutoSaveDocument(Doc* doc, uint64_t* undoVersion);
+    void autoSaveDocument(Doc* doc, const uint64_t undoVersion);
 
     RecoveryConfig* m_config;
     Session* m_session;
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -13,8 +13,10 @@
 
 #include "app/crash/backup_observer.h"
 #include "app/crash/session.h"
+#include "app/crash/write_document.h"
 #include "app/pref/preferences.h"
 #include "app/resource_finder.h"
+#include "app/util/compressed_buffer.h"
 #include "base/fs.h"
 #include "base/time.h"
 #include "ui/system.h"
@@ -43,6 +45,8 @@ DataRecovery::DataRecovery(Context* ctx)
     m_config.keepEditedSpriteDataFor = pref.general.keepEditedSpriteDataFor();
   else
     m_config.keepEditedSpriteDataFor = 0;
+  m_config.autoSaveFiles = pref.general.autoSaveFiles();
+  m_config.fileOpConfig.fillFromPreferences();
 
   ResourceFinder rf;
   rf.includeUserDir(base::join_path("sessions", ".").c_str());
@@ -74,6 +78,12 @@ DataRecovery::DataRecovery(Context* ctx)
   m_inProgress->create(pid);
   RECO_TRACE("RECO: Session in progress '%s'\n", newSessionDir.c_str());
 
+  // Old undo states that don't fit in memory are saved in this session
+  CompressedBuffer::setSpillFile(m_inProgress->undoFilename());
+
+  // Save only the modified pixels of images in each backup
+  enable_modified_regions_tracking(true);
+
   m_backup = new BackupObserver(&m_config, m_inProgress.get(), ctx);
 
   g_stillAliveFlag = true;
@@ -90,6 +100,9 @@ DataRecovery::~DataRecovery()
   // We just close the session on progress.  The session is not
   // deleted just in case that the user want to recover some files
   // from this session in the future.
+  CompressedBuffer::setSpillFile(std::string());
+  enable_modified_regions_tracking(false);
+
   if (m_inProgress)
     m_inProgress->close();
 
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -19,6 +20,13 @@ namespace crash {
 
   const uint32_t MAGIC_NUMBER = 0x454E4946; // 'FINE' in ASCII
 
+  // Files where the objects of a document are appended. Each record
+  // is the prefix of the object (e.g. "img", "cel", etc.), its ID,
+  // version, data size, the data, and the MAGIC_NUMBER at the end (so
+  // we know that the record was completely written). When the file
+  // is compacted we write only the latest records in the other file.
+  const char* const kPackFilenames[2] = { "pack0", "pack1" };
+
   class ObjVersions {
   public:
     ObjVersions() {
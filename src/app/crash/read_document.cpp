@@ -14,6 +14,7 @@
 #include "app/console.h"
 #include "app/crash/internals.h"
 #include "app/doc.h"
+#include "app/util/buffer_region.h"
 #include "base/clamp.h"
 #include "base/convert_to.h"
 #include "base/exception.h"
@@ -39,9 +40,19 @@
 #include "doc/tag_io.h"
 #include "doc/user_data_io.h"
 #include "fixmath/fixmath.h"
+#include "gfx/region.h"
+#include "zlib.h"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <iterator>
 #include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 namespace app {
 namespace crash {
@@ -89,6 +100,9 @@ public:
         m_docVersions = &versions;
       }
     }
+
+    for (int i=0; i<2; ++i)
+      loadPackIndex(i);
   }
 
   Doc* loadDocument() {
@@ -107,8 +121,304 @@ public:
         == (Doc*)1;
   }
 
+  // Calls "f" for each image saved in the pack files
+  template<typename F>
+  void forEachPackedImage(F f) {
+    for (const auto& it : m_packRecords) {
+      if (it.second.prefix != "img")
+        continue;
+
+      std::istringstream s(readPackRecord(it.second));
+      ImageRef img(read_image(s, false));
+      if (img)
+        f(img);
+    }
+  }
+
 private:
 
+  // Location of the data of an object (a specific ID/version) in a
+  // pack file
+  struct PackRecord {
+    std::string prefix;
+    int file;
+    uint64_t offset;
+    uint32_t size;
+  };
+
+  // Reads all complete records of the given pack file
+  void loadPackIndex(const int i) {
+    const std::string fn = base::join_path(m_dir, kPackFilenames[i]);
+    if (!base::is_file(fn))
+      return;
+
+    std::ifstream& s = m_packs[i];
+    s.open(FSTREAM_PATH(fn), std::ifstream::binary);
+    while (s) {
+      PackRecord rec;
+      rec.prefix = read_string(s);
+      ObjectId id = read32(s);
+      ObjectVersion ver = read32(s);
+      rec.file = i;
+      rec.size = read32(s);
+      rec.offset = s.tellg();
+      s.seekg(rec.size, std::ios::cur);
+      if (!s || read32(s) != MAGIC_NUMBER || !s)
+        break;                  // Incomplete record, we cannot continue
+      if (!id || !ver)
+        continue;
+
+      m_objVersions[id].add(ver);
+      m_packRecords[std::make_pair(id, ver)] = rec;
+
+      if (rec.prefix == "doc") {
+        if (!m_docId)
+          m_docId = id;
+        m_docVersions = &m_objVersions[id];
+      }
+    }
+    s.clear();
+  }
+
+  std::string readPackRecord(const PackRecord& rec) {
+    std::ifstream& s = m_packs[rec.file];
+    std::string data(rec.size, 0);
+    s.clear();
+    s.seekg(std::streamoff(rec.offset));
+    if (rec.size > 0)
+      s.read(&data[0], rec.size);
+    return data;
+  }
+
+  // Loads the image if its latest version is a delta ("imgd" record)
+  // of a full version. Returns nullptr if the latest version is not
+  // a delta (or cannot be loaded), so it's loaded from a full version.
+  Image* loadPackedImageDelta(ObjectId id) {
+    const ObjVersions& versions = m_objVersions[id];
+    for (size_t i=0; i<versions.size(); ++i) {
+      ObjectVersion ver = versions[i];
+      if (!ver)
+        continue;
+
+      auto it = m_packRecords.find(std::make_pair(id, ver));
+      if (it == m_packRecords.end() ||
+          it->second.prefix != "imgd")
+        return nullptr;
+
+      TRACE("RECO: Restoring img #%d v%d from delta\n", id, ver);
+      try {
+        if (Image* img = readImageDelta(id, it->second))
+          return img;
+      }
+      catch (const std::exception& ex) {
+        TRACE("RECO: img #%d v%d delta error: %s\n", id, ver, ex.what());
+      }
+    }
+    return nullptr;
+  }
+
+  Image* readImageDelta(ObjectId id, const PackRecord& rec) {
+    std::string delta = readPackRecord(rec);
+    std::string base;
+    if (!readImageDeltaBase(id, delta, base))
+      return nullptr;
+    return decodeImageDelta(delta, base);
+  }
+
+  // Reads the data of the full image used as base of the given delta
+  bool readImageDeltaBase(ObjectId id, const std::string& delta, std::string& base) {
+    std::istringstream s(delta);
+    ObjectVersion baseVer = read32(s);
+    auto baseIt = m_packRecords.find(std::make_pair(id, baseVer));
+    if (!s ||
+        baseIt == m_packRecords.end() ||
+        baseIt->second.prefix != "img")
+      return false;
+
+    base = readPackRecord(baseIt->second);
+    return true;
+  }
+
+  // Creates the image from its base data and the delta (it doesn't
+  // use the Reader state, so it can be called from other threads)
+  static Image* decodeImageDelta(const std::string& delta,
+                                 const std::string& base) {
+    std::istringstream baseStream(base);
+    std::unique_ptr<Image> image(read_image(baseStream, false));
+    if (!image)
+      return nullptr;
+
+    std::istringstream s(delta);
+    read32(s);                  // Base version
+
+    gfx::Region region;
+    const int nrects = read32(s);
+    for (int i=0; i<nrects && s; ++i) {
+      gfx::Rect rc;
+      rc.x = read32(s);
+      rc.y = read32(s);
+      rc.w = read32(s);
+      rc.h = read32(s);
+      region.createUnion(region, gfx::Region(rc));
+    }
+
+    const uLongf rawSize = read32(s);
+    const uLong compressedSize = read32(s);
+    if (!s || !image->bounds().contains(region.bounds()))
+      return nullptr;
+
+    base::buffer pixels(rawSize);
+    if (rawSize > 0) {
+      base::buffer compressed(compressedSize);
+      if (compressedSize > 0)
+        s.read((char*)&compressed[0], compressedSize);
+      uLongf len = rawSize;
+      if (!s ||
+          ::uncompress((Bytef*)&pixels[0], &len,
+                       (const Bytef*)&compressed[0], compressedSize) != Z_OK ||
+          len != rawSize)
+        return nullptr;
+    }
+
+    // Check the size used by save_image_region_in_buffer()
+    size_t expectedSize = 0;
+    for (const auto& rc : region)
+      expectedSize += image->getRowStrideSize(1)*rc.w*rc.h;
+    if (expectedSize != pixels.size())
+      return nullptr;
+
+    swap_image_region_with_buffer(region, image.get(), pixels);
+    return image.release();
+  }
+
+  // Reads the data of the latest version of the given object
+  // (without checking if it can be loaded). Returns the prefix of
+  // the record (e.g. "imgd" for image deltas) or an empty string.
+  std::string readLatestRecord(const std::vector<const char*>& prefixes,
+                               ObjectId id, std::string& data) {
+    const ObjectVersion ver = m_objVersions[id][0];
+    if (!ver)
+      return std::string();
+
+    auto it = m_packRecords.find(std::make_pair(id, ver));
+    if (it != m_packRecords.end()) {
+      for (const char* prefix : prefixes) {
+        if (it->second.prefix == prefix) {
+          data = readPackRecord(it->second);
+          return prefix;
+        }
+      }
+      return std::string();
+    }
+
+    // Sessions of old versions use one file for each object
+    for (const char* prefix : prefixes) {
+      std::string fn = prefix;
+      fn.push_back('-');
+      fn += base::convert_to<std::string>(id);
+      fn.push_back('.');
+      fn += base::convert_to<std::string>(ver);
+
+      std::ifstream s(FSTREAM_PATH(base::join_path(m_dir, fn)), std::ifstream::binary);
+      if (s && read32(s) == MAGIC_NUMBER) {
+        data.assign(std::istreambuf_iterator<char>(s),
+                    std::istreambuf_iterator<char>());
+        return prefix;
+      }
+    }
+    return std::string();
+  }
+
+  // Reads the latest version of the images used by the cels to load
+  // and decodes them in several threads. The images that cannot be
+  // decoded are loaded later by getImageRef() (trying old versions).
+  void prefetchImages() {
+    struct Item {
+      ObjectId id;
+      std::string data;
+      std::string base;         // Base of the delta ("imgd" records)
+      ImageRef image;
+    };
+    std::vector<Item> items;
+    std::set<ObjectId> imageIds;
+
+    for (const auto& pair : m_celsToLoad) {
+      if (canceled())
+        return;
+
+      // Cel: ID, frame, and the cel data ID
+      std::string data;
+      if (readLatestRecord({ "cel" }, pair.second, data).empty())
+        continue;
+      std::istringstream celStream(data);
+      read32(celStream);
+      read16(celStream);
+      const ObjectId celdataId = read32(celStream);
+
+      // Cel data: ID, bounds, opacity, and the image ID
+      if (!celStream ||
+          readLatestRecord({ "celdata" }, celdataId, data).empty())
+        continue;
+      std::istringstream celdataStream(data);
+      for (int i=0; i<5; ++i)
+        read32(celdataStream);
+      read8(celdataStream);
+      const ObjectId imageId = read32(celdataStream);
+
+      if (!celdataStream ||
+          m_images.find(imageId) != m_images.end() ||
+          !imageIds.insert(imageId).second)
+        continue;
+
+      Item item;
+      item.id = imageId;
+      const std::string prefix =
+        readLatestRecord({ "img", "imgd" }, imageId, item.data);
+      if (prefix.empty() ||
+          (prefix == "imgd" &&
+           !readImageDeltaBase(imageId, item.data, item.base)))
+        continue;
+
+      items.push_back(std::move(item));
+    }
+
+    std::atomic<int> next(0);
+    auto decodeImages = [this, &items, &next]{
+      int i;
+      while (!canceled() &&
+             (i = next++) < int(items.size())) {
+        Item& item = items[i];
+        try {
+          if (!item.base.empty())
+            item.image.reset(decodeImageDelta(item.data, item.base));
+          else {
+            std::istringstream s(item.data);
+            item.image.reset(read_image(s, false));
+          }
+        }
+        catch (const std::exception&) {
+          // Ignore the error, the image is loaded again in getImageRef()
+        }
+        std::string().swap(item.data);
+        std::string().swap(item.base);
+      }
+    };
+
+    const int nthreads =
+      std::min<int>(items.size(), std::max<int>(1, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (int i=1; i<nthreads; ++i)
+      threads.emplace_back(decodeImages);
+    decodeImages();             // Use this thread too
+    for (auto& thread : threads)
+      thread.join();
+
+    for (Item& item : items) {
+      if (item.image)
+        m_images[item.id] = item.image;
+    }
+  }
+
   const ObjectVersion docId() const {
     return m_docId;
   }
@@ -125,7 +435,9 @@ private:
     if (m_images.find(imageId) != m_images.end())
       return m_images[imageId];
 
-    ImageRef image(loadObject<Image*>("img", imageId, &Reader::readImage));
+    ImageRef image(loadPackedImageDelta(imageId));
+    if (!image)
+      image.reset(loadObject<Image*>("img", imageId, &Reader::readImage));
     return m_images[imageId] = image;
   }
 
@@ -138,7 +450,7 @@ private:
   }
 
   template<typename T>
-  T loadObject(const char* prefix, ObjectId id, T (Reader::*readMember)(std::ifstream&)) {
+  T loadObject(const char* prefix, ObjectId id, T (Reader::*readMember)(std::istream&)) {
     const ObjVersions& versions = m_objVersions[id];
 
     for (size_t i=0; i<versions.size(); ++i) {
@@ -148,16 +460,27 @@ private:
 
       TRACE("RECO: Restoring %s #%d v%d\n", prefix, id, ver);
 
-      std::string fn = prefix;
-      fn.push_back('-');
-      fn += base::convert_to<std::string>(id);
-      fn.push_back('.');
-      fn += base::convert_to<std::string>(ver);
-
-      std::ifstream s(FSTREAM_PATH(base::join_path(m_dir, fn)), std::ifstream::binary);
       T obj = nullptr;
-      if (read32(s) == MAGIC_NUMBER)
+      auto it = m_packRecords.find(std::make_pair(id, ver));
+      if (it != m_packRecords.end()) {
+        if (it->second.prefix != prefix)
+          continue;
+
+        std::istringstream s(readPackRecord(it->second));
         obj = (this->*readMember)(s);
+      }
+      // Sessions of old versions use one file for each object
+      else {
+        std::string fn = prefix;
+        fn.push_back('-');
+        fn += base::convert_to<std::string>(id);
+        fn.push_back('.');
+        fn += base::convert_to<std::string>(ver);
+
+        std::ifstream s(FSTREAM_PATH(base::join_path(m_dir, fn)), std::ifstream::binary);
+        if (read32(s) == MAGIC_NUMBER)
+          obj = (this->*readMember)(s);
+      }
 
       if (obj) {
         TRACE("RECO: %s #%d v%d restored successfully\n", prefix, id, ver);
@@ -175,7 +498,7 @@ private:
     return nullptr;
   }
 
-  Doc* readDocument(std::ifstream& s) {
+  Doc* readDocument(std::istream& s) {
     ObjectId sprId = read32(s);
     std::string filename = read_string(s);
 
@@ -198,7 +521,7 @@ private:
     }
   }
 
-  Sprite* readSprite(std::ifstream& s) {
+  Sprite* readSprite(std::istream& s) {
     ColorMode mode = (ColorMode)read8(s);
     int w = read16(s);
     int h = read16(s);
@@ -274,6 +597,9 @@ private:
       Console().printf("Invalid number of layers #%d\n", nlayers);
     }
 
+    // Decode the images of all cels in parallel
+    prefetchImages();
+
     // Read all cels
     for (size_t i=0; i<m_celsToLoad.size(); ++i) {
       if (canceled())
@@ -360,7 +686,7 @@ private:
     return spr.release();
   }
 
-  gfx::ColorSpaceRef readColorSpace(std::ifstream& s) {
+  gfx::ColorSpaceRef readColorSpace(std::istream& s) {
     const gfx::ColorSpace::Type type = (gfx::ColorSpace::Type)read16(s);
     const gfx::ColorSpace::Flag flags = (gfx::ColorSpace::Flag)read16(s);
     const double gamma = fixmath::fixtof(read32(s));
@@ -382,7 +708,7 @@ private:
     return colorSpace;
   }
 
-  gfx::Rect readGridBounds(std::ifstream& s) {
+  gfx::Rect readGridBounds(std::istream& s) {
     gfx::Rect grid;
     grid.x = (int16_t)read16(s);
     grid.y = (int16_t)read16(s);
@@ -392,7 +718,7 @@ private:
   }
 
   // TODO could we use doc::read_layer() here?
-  Layer* readLayer(std::ifstream& s) {
+  Layer* readLayer(std::istream& s) {
     LayerFlags flags = (LayerFlags)read32(s);
     ObjectType type = (ObjectType)read16(s);
     ASSERT(type == ObjectType::LayerImage ||
@@ -445,27 +771,27 @@ private:
       return nullptr;
   }
 
-  Cel* readCel(std::ifstream& s) {
+  Cel* readCel(std::istream& s) {
     return read_cel(s, this, false);
   }
 
-  CelData* readCelData(std::ifstream& s) {
+  CelData* readCelData(std::istream& s) {
     return read_celdata(s, this, false);
   }
 
-  Image* readImage(std::ifstream& s) {
+  Image* readImage(std::istream& s) {
     return read_image(s, false);
   }
 
-  Palette* readPalette(std::ifstream& s) {
+  Palette* readPalette(std::istream& s) {
     return read_palette(s);
   }
 
-  Tag* readTag(std::ifstream& s) {
+  Tag* readTag(std::istream& s) {
     return read_tag(s, false);
   }
 
-  Slice* readSlice(std::ifstream& s) {
+  Slice* readSlice(std::istream& s) {
     return read_slice(s, false);
   }
 
@@ -508,6 +834,8 @@ private:
   std::vector<std::pair<ObjectId, ObjectId> > m_celsToLoad;
   std::map<ObjectId, ImageRef> m_images;
   std::map<ObjectId, CelDataRef> m_celdatas;
+  std::map<std::pair<ObjectId, ObjectVersion>, PackRecord> m_packRecords;
+  std::ifstream m_packs[2];
   base::task_token* m_taskToken;
 };
 
@@ -580,6 +908,19 @@ Doc* read_document_with_raw_images(const std::string& dir,
         break;
     }
   }
+  reader.forEachPackedImage(
+    [&](const ImageRef& img){
+      lay->addCel(new Cel(frame, img));
+      switch (as) {
+        case RawImagesAs::kFrames:
+          ++frame;
+          break;
+        case RawImagesAs::kLayers:
+          lay = new LayerImage(spr);
+          spr->root()->addLayer(lay);
+          break;
+      }
+    });
   if (as == RawImagesAs::kFrames) {
     if (frame > 1)
       spr->setTotalFrames(frame);
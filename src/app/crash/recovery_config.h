@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -8,6 +8,8 @@
 #define APP_CRASH_RECOVERY_CONFIG_H_INCLUDED
 #pragma once
 
+#include "app/file/file_op_config.h"
+
 namespace app {
 namespace crash {
 
@@ -16,6 +18,13 @@ namespace crash {
   struct RecoveryConfig {
     double dataRecoveryPeriod;
     int keepEditedSpriteDataFor;
+
+    // True if modified .aseprite files are saved (from their backup
+    // data) each time the data recovery backup is created.
+    bool autoSaveFiles;
+
+    // Used to save files from the backup thread.
+    FileOpConfig fileOpConfig;
   };
 
 } // namespace crash
@@ -13,6 +13,7 @@
 
 #include "app/console.h"
 #include "app/context.h"
+#include "app/crash/internals.h"
 #include "app/crash/read_document.h"
 #include "app/crash/recovery_config.h"
 #include "app/crash/write_document.h"
@@ -24,11 +25,14 @@
 #include "base/fs.h"
 #include "base/fstream_path.h"
 #include "base/process.h"
+#include "base/serialization.h"
 #include "base/split_string.h"
 #include "base/string.h"
 #include "base/thread.h"
 #include "base/time.h"
 #include "doc/cancel_io.h"
+#include "doc/sprite.h"
+#include "doc/string_io.h"
 #include "fmt/format.h"
 #include "ver/info.h"
 
@@ -37,13 +41,49 @@ namespace crash {
 
 static const char* kPidFilename = "pid";   // Process ID running the session (or non-existent if the PID was closed correctly)
 static const char* kVerFilename = "ver";   // File that indicates the Aseprite version used in the session
+static const char* kUndoFilename = "undo"; // Undo data moved to disk (it's deleted when the session is closed)
 static const char* kOpenFilename = "open"; // File that indicates if the document is/was open in the session (or non-existent if the document was closed correctly)
+static const char* kManifestFilename = "manifest"; // Information of all documents of the session (to avoid reading each document directory)
 
-Session::Backup::Backup(const std::string& dir)
+using namespace base::serialization;
+using namespace base::serialization::little_endian;
+
+static bool read_manifest(const std::string& fn,
+                          std::map<doc::ObjectId, DocumentInfo>& manifest)
+{
+  std::ifstream s(FSTREAM_PATH(fn), std::ifstream::binary);
+  if (!s)
+    return false;
+
+  const int n = read32(s);
+  for (int i=0; i<n && s; ++i) {
+    doc::ObjectId id = read32(s);
+    DocumentInfo info;
+    info.mode = (doc::ColorMode)read8(s);
+    info.width = read32(s);
+    info.height = read32(s);
+    info.frames = read32(s);
+    info.filename = doc::read_string(s);
+    manifest[id] = info;
+  }
+
+  // The magic number at the end indicates that the whole file was written
+  if (!s || read32(s) != MAGIC_NUMBER) {
+    manifest.clear();
+    return false;
+  }
+  return true;
+}
+
+Session::Backup::Backup(const std::string& dir,
+                        const DocumentInfo* manifestInfo)
   : m_dir(dir)
 {
   DocumentInfo info;
-  read_document_info(dir, info);
+  if (manifestInfo)
+    info = *manifestInfo;
+  else
+    read_document_info(dir, info);
 
   m_fn = info.filename;
   m_desc =
@@ -113,10 +153,16 @@ std::string Session::version()
 const Session::Backups& Session::backups()
 {
   if (m_backups.empty()) {
+    std::map<doc::ObjectId, DocumentInfo> manifest;
+    read_manifest(manifestFilename(), manifest);
+
     for (auto& item : base::list_files(m_path)) {
       std::string docDir = base::join_path(m_path, item);
       if (base::is_directory(docDir)) {
-        m_backups.push_back(std::make_shared<Backup>(docDir));
+        auto it = manifest.find(base::convert_to<int>(item));
+        m_backups.push_back(
+          std::make_shared<Backup>(
+            docDir, (it != manifest.end() ? &it->second: nullptr)));
       }
     }
   }
@@ -205,6 +251,13 @@ void Session::removeFromDisk()
     if (base::is_file(verFilename()))
       base::delete_file(verFilename());
 
+    if (base::is_file(manifestFilename()))
+      base::delete_file(manifestFilename());
+
+    // Undo data of a crashed session
+    if (base::is_file(undoFilename()))
+      base::delete_file(undoFilename());
+
     base::remove_directory(m_path);
   }
   catch (const std::exception& ex) {
@@ -221,6 +274,10 @@ public:
     : WeakDocReader(doc) {
   }
 
+  void unlock() {
+    weakUnlock();
+  }
+
   // CancelIO impl
   bool isCanceled() override {
     return !isLocked();
@@ -252,8 +309,30 @@ bool Session::saveDocumentChanges(Doc* doc)
     }
   }
 
-  // Save document information
-  return write_document(dir, doc, &reader);
+  DocumentInfo info;
+  info.mode = doc->sprite()->colorMode();
+  info.width = doc->sprite()->width();
+  info.height = doc->sprite()->height();
+  info.frames = doc->sprite()->totalFrames();
+  info.filename = doc->filename();
+
+  // Save document information (the document is unlocked as soon as
+  // the changed objects are copied)
+  if (!write_document(dir, doc, &reader,
+                      [&reader]{ reader.unlock(); }))
+    return false;
+
+  auto it = m_manifest.find(doc->id());
+  if (it == m_manifest.end() ||
+      it->second.mode != info.mode ||
+      it->second.width != info.width ||
+      it->second.height != info.height ||
+      it->second.frames != info.frames ||
+      it->second.filename != info.filename) {
+    m_manifest[doc->id()] = info;
+    saveManifest();
+  }
+  return true;
 }
 
 void Session::removeDocument(Doc* doc)
@@ -354,6 +433,11 @@ void Session::loadPid()
   }
 }
 
+std::string Session::undoFilename() const
+{
+  return base::join_path(m_path, kUndoFilename);
+}
+
 std::string Session::pidFilename() const
 {
   return base::join_path(m_path, kPidFilename);
@@ -364,6 +448,27 @@ std::string Session::verFilename() const
   return base::join_path(m_path, kVerFilename);
 }
 
+std::string Session::manifestFilename() const
+{
+  return base::join_path(m_path, kManifestFilename);
+}
+
+void Session::saveManifest()
+{
+  std::ofstream s(FSTREAM_PATH(manifestFilename()), std::ofstream::binary);
+  write32(s, m_manifest.size());
+  for (const auto& it : m_manifest) {
+    const DocumentInfo& info = it.second;
+    write32(s, it.first);
+    write8(s, int(info.mode));
+    write32(s, info.width);
+    write32(s, info.height);
+    write32(s, info.frames);
+    doc::write_string(s, info.filename);
+  }
+  write32(s, MAGIC_NUMBER);
+}
+
 void Session::markDocumentAsCorrectlyClosed(app::Doc* doc)
 {
   std::string dir = base::join_path(
@@ -10,12 +10,14 @@
 #pragma once
 
 #include "app/crash/raw_images_as.h"
+#include "app/crash/read_document.h"
 #include "base/disable_copying.h"
 #include "base/process.h"
 #include "base/task.h"
 #include "doc/object_id.h"
 
 #include <fstream>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -30,7 +32,10 @@ namespace crash {
   public:
     class Backup {
     public:
-      Backup(const std::string& dir);
+      // If "info" is nullptr, the information is read from the
+      // backup directory.
+      Backup(const std::string& dir,
+             const DocumentInfo* info = nullptr);
       const std::string& dir() const { return m_dir; }
       std::string description(const bool withFullPath) const;
     private:
@@ -46,6 +51,9 @@ namespace crash {
     ~Session();
 
     std::string name() const;
+
+    // File used to save the data of old undo states of this session
+    std::string undoFilename() const;
     std::string version();
     const Backups& backups();
 
@@ -75,6 +83,8 @@ namespace crash {
     void loadPid();
     std::string pidFilename() const;
     std::string verFilename() const;
+    std::string manifestFilename() const;
+    void saveManifest();
     void markDocumentAsCorrectlyClosed(Doc* doc);
     void deleteDirectory(const std::string& dir);
     void fixFilename(Doc* doc);
@@ -85,6 +95,11 @@ namespace crash {
     Backups m_backups;
     RecoveryConfig* m_config;
 
+    // Information of each backed up document (saved in the manifest
+    // file of the session, so the list of backups can be loaded
+    // without reading each document directory)
+    std::map<doc::ObjectId, DocumentInfo> m_manifest;
+
     DISABLE_COPYING(Session);
   };
 
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -13,7 +13,9 @@
 
 #include "app/crash/internals.h"
 #include "app/doc.h"
+#include "app/util/buffer_region.h"
 #include "base/convert_to.h"
+#include "base/exception.h"
 #include "base/fs.h"
 #include "base/fstream_path.h"
 #include "base/serialization.h"
@@ -25,6 +27,7 @@
 #include "doc/cels_range.h"
 #include "doc/frame.h"
 #include "doc/image_io.h"
+#include "doc/image_ref.h"
 #include "doc/layer.h"
 #include "doc/palette.h"
 #include "doc/palette_io.h"
@@ -36,9 +39,16 @@
 #include "doc/tag_io.h"
 #include "doc/user_data_io.h"
 #include "fixmath/fixmath.h"
+#include "gfx/region.h"
+#include "zlib.h"
 
 #include <fstream>
+#include <cstring>
 #include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <vector>
 
 namespace app {
 namespace crash {
@@ -49,8 +59,79 @@ using namespace doc;
 
 namespace {
 
+// Compact the pack file when it's bigger than this size and more
+// than the half of it are old versions or deleted objects.
+static const uint64_t kMinCompactSize = 16*1024*1024;
+
+// An image is saved as a delta of its last full version ("imgd"
+// record) while its modified area is smaller than this fraction of
+// the image area.
+static const int kMaxDeltaAreaDivisor = 4;
+
+// Location of the latest version of each object in the pack file
+struct PackRecord {
+  std::string prefix;
+  ObjectVersion version;
+  uint64_t offset;
+  uint64_t size;
+};
+
+// Last full version of an image, used as the base of its deltas
+struct PackImageBase {
+  PackRecord record;
+  gfx::Region modified;         // Modified region since this version
+};
+
+struct PackFile {
+  int current = 0;              // Index of kPackFilenames
+  uint64_t size = 0;            // Used bytes of the current file
+  std::map<ObjectId, PackRecord> records;
+  std::map<ObjectId, PackImageBase> bases;
+};
+
+// Modified region of an image from one version to other
+struct ModifiedRegion {
+  ObjectVersion from;
+  ObjectVersion to;
+  gfx::Region region;
+};
+
+// Object data (or the image copy) to be written in a file
+struct Entry {
+  const char* prefix;
+  ObjectId id;
+  ObjectVersion version;
+  std::string data;
+  ImageRef image;
+
+  // Delta of an image ("imgd" records)
+  ObjectVersion baseVersion = 0;
+  gfx::Region region;
+  base::buffer pixels;
+};
+
 static std::map<ObjectId, ObjVersionsMap> g_docVersions;
-static std::map<ObjectId, base::paths> g_deleteFiles;
+static std::map<ObjectId, PackFile> g_docPacks;
+
+// Objects copied by a snapshot that was canceled (e.g. the UI needed
+// to write the document in the middle of the copy). They are reused
+// by the next snapshot if they weren't modified, so only the changed
+// layers/cels are copied again.
+static std::map<ObjectId, std::map<ObjectId, Entry>> g_docPending;
+
+// Regions modified by CopyRegion (accessed from the UI and the
+// backup threads)
+static std::mutex g_modifiedMutex;
+static bool g_trackModified = false;
+static std::map<ObjectId, ModifiedRegion> g_modified;
+
+static int region_area(const gfx::Region& rgn)
+{
+  int area = 0;
+  for (const auto& rc : rgn)
+    area += rc.w*rc.h;
+  return area;
+}
 
 class Writer {
 public:
@@ -58,15 +139,35 @@ public:
     : m_dir(dir)
     , m_doc(doc)
     , m_objVersions(g_docVersions[doc->id()])
-    , m_deleteFiles(g_deleteFiles[doc->id()])
+    , m_pack(g_docPacks[doc->id()])
+    , m_pending(g_docPending[doc->id()])
     , m_cancel(cancel) {
   }
 
-  bool saveDocument() {
-    Sprite* spr = m_doc->sprite();
+  // Copies the changed objects in memory (the document must be
+  // locked). Images are copied without compression, so the lock is
+  // released as soon as possible and the slow part (deflate) is done
+  // in writeSnapshot().
+  bool takeSnapshot() {
+    if (!copyObjects()) {
+      // Keep the copies for the next snapshot
+      for (Entry& entry : m_entries) {
+        const ObjectId id = entry.id;
+        m_pending[id] = std::move(entry);
+      }
+      m_entries.clear();
+      return false;
+    }
+    // Pending copies that weren't reused are deleted objects
+    m_pending.clear();
+    return true;
+  }
 
-    // Save from objects without children (e.g. images), to aggregated
-    // objects (e.g. cels, layers, etc.)
+  // Copies the objects of the snapshot, from the ones without
+  // children (e.g. images), to aggregated objects (e.g. cels, layers,
+  // etc.)
+  bool copyObjects() {
+    Sprite* spr = m_doc->sprite();
 
     for (Palette* pal : spr->getPalettes())
       if (!saveObject("pal", pal, &Writer::writePalette))
@@ -92,7 +193,7 @@ public:
         if (cel->link())        // Skip link
           continue;
 
-        if (!saveObject("img", cel->image(), &Writer::writeImage))
+        if (!saveImage(cel->image()))
           return false;
 
         if (!saveObject("celdata", cel->data(), &Writer::writeCelData))
@@ -121,24 +222,75 @@ public:
     if (!saveObject("doc", m_doc, &Writer::writeDocumentFile))
       return false;
 
-    // Delete old files after all files are correctly saved.
-    deleteOldVersions();
     return true;
   }
 
+  // Appends the objects of the snapshot to the pack file (the
+  // document doesn't need to be locked).
+  void writeSnapshot() {
+    if (!m_entries.empty()) {
+      const std::string fn = packFilename(m_pack.current);
+      std::fstream s;
+      if (m_pack.size > 0)
+        s.open(FSTREAM_PATH(fn), std::ios::in | std::ios::out | std::ios::binary);
+      else
+        s.open(FSTREAM_PATH(fn), std::ios::out | std::ios::trunc | std::ios::binary);
+
+      // Overwrite any incomplete record of a previous failed write
+      s.seekp(std::streamoff(m_pack.size));
+
+      for (Entry& entry : m_entries) {
+        if (entry.image) {
+          std::ostringstream data;
+          write_image(data, entry.image.get(), nullptr, -1, entry.id);
+          entry.image.reset();
+          entry.data = data.str();
+        }
+        else if (entry.baseVersion)
+          writeImageDelta(entry);
+        writeRecord(s, entry);
+      }
+      m_entries.clear();
+    }
+
+    uint64_t liveSize = 0;
+    for (const auto& it : m_pack.records)
+      if (m_aliveIds.find(it.first) != m_aliveIds.end())
+        liveSize += it.second.size;
+    for (const auto& it : m_pack.bases)
+      if (m_aliveIds.find(it.first) != m_aliveIds.end() &&
+          m_pack.records.find(it.first)->second.offset != it.second.record.offset)
+        liveSize += it.second.record.size;
+
+    // Forget modified regions of deleted images
+    {
+      std::lock_guard<std::mutex> lock(g_modifiedMutex);
+      for (auto it=g_modified.begin(); it!=g_modified.end(); ) {
+        if (!get_object(it->first))
+          it = g_modified.erase(it);
+        else
+          ++it;
+      }
+    }
+
+    if (m_pack.size > kMinCompactSize &&
+        liveSize < m_pack.size/2)
+      compactPack();
+  }
+
 private:
 
   bool isCanceled() const {
     return (m_cancel && m_cancel->isCanceled());
   }
 
-  bool writeDocumentFile(std::ofstream& s, Doc* doc) {
+  bool writeDocumentFile(std::ostream& s, Doc* doc) {
     write32(s, doc->sprite()->id());
     write_string(s, doc->filename());
     return true;
   }
 
-  bool writeSprite(std::ofstream& s, Sprite* spr) {
+  bool writeSprite(std::ostream& s, Sprite* spr) {
     write8(s, int(spr->colorMode()));
     write16(s, spr->width());
     write16(s, spr->height());
@@ -177,7 +329,7 @@ private:
     return true;
   }
 
-  bool writeGridBounds(std::ofstream& s, const gfx::Rect& grid) {
+  bool writeGridBounds(std::ostream& s, const gfx::Rect& grid) {
     write16(s, (int16_t)grid.x);
     write16(s, (int16_t)grid.y);
     write16(s, grid.w);
@@ -185,7 +337,7 @@ private:
     return true;
   }
 
-  bool writeColorSpace(std::ofstream& s, const gfx::ColorSpaceRef& colorSpace) {
+  bool writeColorSpace(std::ostream& s, const gfx::ColorSpaceRef& colorSpace) {
     write16(s, colorSpace->type());
     write16(s, colorSpace->flags());
     write32(s, fixmath::ftofix(colorSpace->gamma()));
@@ -199,7 +351,7 @@ private:
     return true;
   }
 
-  void writeAllLayersID(std::ofstream& s, ObjectId parentId, const LayerGroup* group) {
+  void writeAllLayersID(std::ostream& s, ObjectId parentId, const LayerGroup* group) {
     for (const Layer* lay : group->layers()) {
       write32(s, lay->id());
       write32(s, parentId);
@@ -209,7 +361,7 @@ private:
     }
   }
 
-  bool writeLayerStructure(std::ofstream& s, Layer* lay) {
+  bool writeLayerStructure(std::ostream& s, Layer* lay) {
     write32(s, static_cast<int>(lay->flags())); // Flags
     write16(s, static_cast<int>(lay->type()));  // Type
     write_string(s, lay->name());
@@ -244,99 +396,260 @@ private:
     return true;
   }
 
-  bool writeCel(std::ofstream& s, Cel* cel) {
+  bool writeCel(std::ostream& s, Cel* cel) {
     write_cel(s, cel);
     return true;
   }
 
-  bool writeCelData(std::ofstream& s, CelData* celdata) {
+  bool writeCelData(std::ostream& s, CelData* celdata) {
     write_celdata(s, celdata);
     return true;
   }
 
-  bool writeImage(std::ofstream& s, Image* img) {
-    return write_image(s, img, m_cancel);
-  }
-
-  bool writePalette(std::ofstream& s, Palette* pal) {
+  bool writePalette(std::ostream& s, Palette* pal) {
     write_palette(s, pal);
     return true;
   }
 
-  bool writeFrameTag(std::ofstream& s, Tag* frameTag) {
+  bool writeFrameTag(std::ostream& s, Tag* frameTag) {
     write_tag(s, frameTag);
     return true;
   }
 
-  bool writeSlice(std::ofstream& s, Slice* slice) {
+  bool writeSlice(std::ostream& s, Slice* slice) {
     write_slice(s, slice);
     return true;
   }
 
   template<typename T>
-  bool saveObject(const char* prefix, T* obj, bool (Writer::*writeMember)(std::ofstream&, T*)) {
+  bool saveObject(const char* prefix, T* obj, bool (Writer::*writeMember)(std::ostream&, T*)) {
+    if (isCanceled())
+      return false;
+    if (!needsSave(obj) || reusePending(obj))
+      return true;
+
+    std::ostringstream s;
+    if (!(this->*writeMember)(s, obj)) // Write the object
+      return false;
+
+    m_entries.push_back({ prefix, obj->id(), obj->version(), s.str(), ImageRef() });
+    return true;
+  }
+
+  bool saveImage(Image* img) {
     if (isCanceled())
       return false;
+    if (!needsSave(img) || reusePending(img))
+      return true;
+
+    const ObjectId id = img->id();
+    ModifiedRegion modified;
+    bool tracked = false;
+    {
+      std::lock_guard<std::mutex> lock(g_modifiedMutex);
+      auto it = g_modified.find(id);
+      if (it != g_modified.end()) {
+        modified = std::move(it->second);
+        g_modified.erase(it);
+        tracked = true;
+      }
+    }
+
+    // Save only the pixels modified since the last full version if
+    // all the image modifications since the last backup are known.
+    auto base = m_pack.bases.find(id);
+    if (tracked &&
+        base != m_pack.bases.end() &&
+        modified.from == m_objVersions[id].newer() &&
+        modified.to == img->version()) {
+      gfx::Region region(base->second.modified);
+      region.createUnion(region, modified.region);
+      region.createIntersection(region, gfx::Region(img->bounds()));
+
+      if (region_area(region) <= img->width()*img->height() / kMaxDeltaAreaDivisor) {
+        Entry entry = { "imgd", id, img->version(), std::string(), ImageRef() };
+        entry.baseVersion = base->second.record.version;
+        entry.region = region;
+        save_image_region_in_buffer(region, img, gfx::Point(0, 0), entry.pixels);
+        m_entries.push_back(std::move(entry));
+        return true;
+      }
+    }
+
+    // The copy doesn't have an ID (it's never requested), the ID of
+    // the original image is saved in writeSnapshot()
+    m_entries.push_back({ "img", id, img->version(), std::string(),
+                          ImageRef(Image::createCopy(img)) });
+    return true;
+  }
+
+  // Delta data: base version, rectangles of the modified region, and
+  // the deflated pixels of the region
+  void writeImageDelta(Entry& entry) {
+    std::ostringstream s;
+    write32(s, entry.baseVersion);
+    write32(s, entry.region.size());
+    for (const auto& rc : entry.region) {
+      write32(s, rc.x);
+      write32(s, rc.y);
+      write32(s, rc.w);
+      write32(s, rc.h);
+    }
+
+    uLongf len = compressBound(uLong(entry.pixels.size()));
+    base::buffer compressed(len);
+    if (!entry.pixels.empty() &&
+        compress2((Bytef*)&compressed[0], &len,
+                  (const Bytef*)&entry.pixels[0], uLong(entry.pixels.size()),
+                  Z_DEFAULT_COMPRESSION) != Z_OK)
+      throw base::Exception("ZLib error compressing image delta.");
+    if (entry.pixels.empty())
+      len = 0;
+
+    write32(s, entry.pixels.size());
+    write32(s, len);
+    if (len > 0)
+      s.write((const char*)&compressed[0], len);
+
+    base::buffer().swap(entry.pixels);
+    entry.data = s.str();
+  }
 
+  bool needsSave(Object* obj) {
     if (!obj->version())
       obj->incrementVersion();
 
+    m_aliveIds.insert(obj->id());
+
     ObjVersions& versions = m_objVersions[obj->id()];
-    if (versions.newer() == obj->version())
-      return true;
+    return (versions.newer() != obj->version());
+  }
 
-    std::string fn = prefix;
-    fn.push_back('-');
-    fn += base::convert_to<std::string>(obj->id());
+  // Uses the copy of a canceled snapshot if the object wasn't
+  // modified after it.
+  bool reusePending(Object* obj) {
+    auto it = m_pending.find(obj->id());
+    if (it == m_pending.end())
+      return false;
 
-    std::string fullfn = base::join_path(m_dir, fn);
-    std::string oldfn = fullfn + "." + base::convert_to<std::string>(versions.older());
-    fullfn += "." + base::convert_to<std::string>(obj->version());
+    const bool reuse = (it->second.version == obj->version());
+    if (reuse)
+      m_entries.push_back(std::move(it->second));
+    m_pending.erase(it);
+    return reuse;
+  }
 
-    std::ofstream s(FSTREAM_PATH(fullfn), std::ofstream::binary);
-    write32(s, 0);                // Leave a room for the magic number
-    if (!(this->*writeMember)(s, obj)) // Write the object
-      return false;
+  std::string packFilename(const int i) const {
+    return base::join_path(m_dir, kPackFilenames[i]);
+  }
 
-    // Flush all data. In this way we ensure that the magic number is
-    // the last thing being written in the file.
-    s.flush();
+  void writeRecord(std::ostream& s, const Entry& entry) {
+    write_string(s, entry.prefix);
+    write32(s, entry.id);
+    write32(s, entry.version);
+    write32(s, entry.data.size());
+    s.write(entry.data.c_str(), entry.data.size()); // Write the object
 
-    // Write the magic number
-    s.seekp(0);
+    // The magic number is the last thing written in the record
     write32(s, MAGIC_NUMBER);
+    s.flush();
+    if (!s)
+      throw base::Exception("Error writing backup data in %s",
+                            m_dir.c_str());
+
+    const uint64_t size = 2 + std::strlen(entry.prefix) + 12
+                        + entry.data.size() + 4;
+    const PackRecord rec = { entry.prefix, entry.version, m_pack.size, size };
+    m_pack.records[entry.id] = rec;
+    m_pack.size += size;
 
-    // Remove the older version
-    if (versions.older() && base::is_file(oldfn))
-      m_deleteFiles.push_back(oldfn);
+    if (entry.baseVersion)
+      m_pack.bases[entry.id].modified = entry.region;
+    else if (std::strcmp(entry.prefix, "img") == 0)
+      m_pack.bases[entry.id] = { rec, gfx::Region() };
 
     // Rotate versions and add the latest one
-    versions.rotateRevisions(obj->version());
+    m_objVersions[entry.id].rotateRevisions(entry.version);
 
-    TRACE(" - Saved %s #%d v%d\n", prefix, obj->id(), obj->version());
-    return true;
+    TRACE(" - Saved %s #%d v%d\n", entry.prefix, entry.id, entry.version);
   }
 
-  void deleteOldVersions() {
-    while (!m_deleteFiles.empty() && !isCanceled()) {
-      std::string file = m_deleteFiles.back();
-      m_deleteFiles.erase(m_deleteFiles.end()-1);
-
-      try {
-        TRACE(" - Deleting <%s>\n", file.c_str());
-        base::delete_file(file);
-      }
-      catch (const std::exception&) {
-        TRACE(" - Cannot delete <%s>\n", file.c_str());
+  // Copies the latest version of all alive objects to the other
+  // pack file, and deletes the current one.
+  void compactPack() {
+    const int next = (m_pack.current+1) % 2;
+    std::ifstream in(FSTREAM_PATH(packFilename(m_pack.current)), std::ios::binary);
+    std::ofstream out(FSTREAM_PATH(packFilename(next)), std::ios::trunc | std::ios::binary);
+
+    std::map<ObjectId, PackRecord> records;
+    std::map<ObjectId, PackImageBase> bases;
+    std::vector<char> buf;
+    uint64_t size = 0;
+    auto copyRecord = [&](PackRecord& rec) {
+      buf.resize(rec.size);
+      in.seekg(std::streamoff(rec.offset));
+      in.read(&buf[0], rec.size);
+      out.write(&buf[0], rec.size);
+      rec.offset = size;
+      size += rec.size;
+    };
+    for (const auto& it : m_pack.records) {
+      if (m_aliveIds.find(it.first) == m_aliveIds.end())
+        continue;
+
+      PackRecord rec = it.second;
+      const uint64_t oldOffset = rec.offset;
+      copyRecord(rec);
+      records[it.first] = rec;
+
+      // Keep the base of the image deltas
+      auto base = m_pack.bases.find(it.first);
+      if (base != m_pack.bases.end()) {
+        PackImageBase newBase = base->second;
+        if (newBase.record.offset == oldOffset)
+          newBase.record = rec;
+        else
+          copyRecord(newBase.record);
+        bases[it.first] = newBase;
       }
     }
+    out.flush();
+    if (!in || !out) {
+      TRACE(" - Cannot compact <%s>\n", packFilename(m_pack.current).c_str());
+      return;
+    }
+    in.close();
+    out.close();
+
+    TRACE(" - Compacted pack from %d to %d bytes\n", int(m_pack.size), int(size));
+
+    // Forget deleted objects, so they are saved again if they are
+    // restored (e.g. undoing their deletion)
+    for (const auto& it : m_pack.records)
+      if (records.find(it.first) == records.end())
+        m_objVersions.erase(it.first);
+
+    try {
+      base::delete_file(packFilename(m_pack.current));
+    }
+    catch (const std::exception&) {
+      TRACE(" - Cannot delete <%s>\n", packFilename(m_pack.current).c_str());
+    }
+
+    m_pack.current = next;
+    m_pack.size = size;
+    m_pack.records = std::move(records);
+    m_pack.bases = std::move(bases);
   }
 
   std::string m_dir;
   Doc* m_doc;
   ObjVersionsMap& m_objVersions;
-  base::paths& m_deleteFiles;
+  PackFile& m_pack;
+  std::map<ObjectId, Entry>& m_pending;
   doc::CancelIO* m_cancel;
+  std::vector<Entry> m_entries;
+  std::set<ObjectId> m_aliveIds; // Objects found in takeSnapshot()
 };
 
 } // anonymous namespace
@@ -346,10 +659,47 @@ private:
 
 bool write_document(const std::string& dir,
                     Doc* doc,
-                    doc::CancelIO* cancel)
+                    doc::CancelIO* cancel,
+                    const std::function<void()>& unlock)
 {
   Writer writer(dir, doc, cancel);
-  return writer.saveDocument();
+  if (!writer.takeSnapshot())
+    return false;
+
+  if (unlock)
+    unlock();
+
+  writer.writeSnapshot();
+  return true;
+}
+
+void enable_modified_regions_tracking(const bool state)
+{
+  std::lock_guard<std::mutex> lock(g_modifiedMutex);
+  g_trackModified = state;
+  if (!state)
+    g_modified.clear();
+}
+
+void mark_image_region_as_modified(const Image* image,
+                                   const gfx::Region& region,
+                                   const ObjectVersion oldVersion)
+{
+  std::lock_guard<std::mutex> lock(g_modifiedMutex);
+  if (!g_trackModified)
+    return;
+
+  auto it = g_modified.find(image->id());
+  if (it != g_modified.end() &&
+      it->second.to == oldVersion) {
+    it->second.region.createUnion(it->second.region, region);
+    it->second.to = image->version();
+  }
+  // Start a new region (if the image was modified in other way after
+  // the previous region, the old region is useless)
+  else {
+    g_modified[image->id()] = { oldVersion, image->version(), region };
+  }
 }
 
 void delete_document_internals(Doc* doc)
@@ -364,9 +714,14 @@ void delete_document_internals(Doc* doc)
       g_docVersions.erase(it);
   }
   {
-    auto it = g_deleteFiles.find(doc->id());
-    if (it != g_deleteFiles.end())
-      g_deleteFiles.erase(it);
+    auto it = g_docPacks.find(doc->id());
+    if (it != g_docPacks.end())
+      g_docPacks.erase(it);
+  }
+  {
+    auto it = g_docPending.find(doc->id());
+    if (it != g_docPending.end())
+      g_docPending.erase(it);
   }
 }
 
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -8,10 +9,15 @@
 #define APP_CRASH_WRITE_DOCUMENT_H_INCLUDED
 #pragma once
 
+#include "doc/object_version.h"
+#include "gfx/fwd.h"
+
+#include <functional>
 #include <string>
 
 namespace doc {
   class CancelIO;
+  class Image;
 }
 
 namespace app {
@@ -19,9 +25,24 @@ namespace app {
 
   namespace crash {
 
-    bool write_document(const std::string& dir, Doc* doc, doc::CancelIO* cancel);
+    // Saves the changed objects of the document in the given
+    // directory. The changed objects are copied in memory with the
+    // document locked, then "unlock" is called (if it's specified) and
+    // finally the objects are compressed and written without the lock.
+    bool write_document(const std::string& dir, Doc* doc, doc::CancelIO* cancel,
+                        const std::function<void()>& unlock = nullptr);
     void delete_document_internals(Doc* doc);
 
+    // Keeps track of the modified regions of images between backups,
+    // so only the modified pixels are saved (instead of the whole
+    // image). The region must be marked after modifying the image
+    // and incrementing its version, "oldVersion" is its previous
+    // version. These functions can be called from any thread.
+    void enable_modified_regions_tracking(const bool state);
+    void mark_image_region_as_modified(const doc::Image* image,
+                                       const gfx::Region& region,
+                                       const doc::ObjectVersion oldVersion);
+
   } // namespace crash
 } // namespace app
 
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -25,6 +25,7 @@
 #include "app/pref/preferences.h"
 #include "app/util/create_cel_copy.h"
 #include "base/memory.h"
+#include "base/scoped_lock.h"
 #include "doc/cel.h"
 #include "doc/layer.h"
 #include "doc/mask.h"
@@ -37,6 +38,7 @@
 #include "os/window.h"
 #include "ui/system.h"
 
+#include <algorithm>
 #include <limits>
 #include <map>
 
@@ -50,13 +52,16 @@ using namespace doc;
 Doc::Doc(Sprite* sprite)
   : m_ctx(nullptr)
   , m_flags(kMaskVisible)
-  , m_undo(new DocUndo)
+  , m_undo(new DocUndo(this))
+  , m_spriteMemSize(0)
   , m_transaction(nullptr)
   // Information about the file format used to load/save this document
   , m_format_options(nullptr)
   // Mask
   , m_mask(new Mask())
   , m_lastDrawingPoint(Doc::NoLastDrawingPoint())
+  , m_deferNotifications(0)
+  , m_observedEvents(0)
 {
   setFilename("Sprite");
 
@@ -73,6 +78,28 @@ Doc::~Doc()
   removeFromContext();
 }
 
+void Doc::add_observer(DocObserver* observer)
+{
+  obs::observable<DocObserver>::add_observer(observer);
+
+  if (std::find(m_subscribers.begin(), m_subscribers.end(), observer) == m_subscribers.end())
+    m_subscribers.push_back(observer);
+  m_observedEvents |= observer->docEvents();
+}
+
+void Doc::remove_observer(DocObserver* observer)
+{
+  obs::observable<DocObserver>::remove_observer(observer);
+
+  auto it = std::find(m_subscribers.begin(), m_subscribers.end(), observer);
+  if (it != m_subscribers.end())
+    m_subscribers.erase(it);
+
+  m_observedEvents = 0;
+  for (const DocObserver* subscriber : m_subscribers)
+    m_observedEvents |= subscriber->docEvents();
+}
+
 void Doc::setContext(Context* ctx)
 {
   if (ctx == m_ctx)
@@ -90,6 +117,7 @@ void Doc::setContext(Context* ctx)
     if (m_flags & kFullyBackedUp)
       m_flags ^= kFullyBackedUp;
 
+    updateMemoryUsage();
     ctx->documents().add(this);
   }
 
@@ -175,13 +203,26 @@ color_t Doc::bgColor(Layer* layer) const
     return layer->sprite()->transparentColor();
 }
 
+Doc::MemoryUsage Doc::memoryUsage() const
+{
+  MemoryUsage usage;
+  usage.sprite = m_spriteMemSize;
+  usage.undo = m_undo->totalUndoSize();
+  return usage;
+}
+
+void Doc::updateMemoryUsage()
+{
+  m_spriteMemSize = (sprite() ? std::size_t(sprite()->getMemSize()): 0);
+}
+
 //////////////////////////////////////////////////////////////////////
 // Notifications
 
 void Doc::notifyGeneralUpdate()
 {
   DocEvent ev(this);
-  notify_observers<DocEvent&>(&DocObserver::onGeneralUpdate, ev);
+  notify<&DocObserver::onGeneralUpdate>(ev);
 }
 
 void Doc::notifyColorSpaceChanged()
@@ -190,14 +231,14 @@ void Doc::notifyColorSpaceChanged()
 
   DocEvent ev(this);
   ev.sprite(sprite());
-  notify_observers<DocEvent&>(&DocObserver::onColorSpaceChanged, ev);
+  notify<&DocObserver::onColorSpaceChanged>(ev);
 }
 
 void Doc::notifyPaletteChanged()
 {
   DocEvent ev(this);
   ev.sprite(sprite());
-  notify_observers<DocEvent&>(&DocObserver::onPaletteChanged, ev);
+  notify<&DocObserver::onPaletteChanged>(ev);
 }
 
 void Doc::notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region, frame_t frame)
@@ -206,7 +247,118 @@ void Doc::notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region,
   ev.sprite(sprite);
   ev.region(region);
   ev.frame(frame);
-  notify_observers<DocEvent&>(&DocObserver::onSpritePixelsModified, ev);
+  notify<&DocObserver::onSpritePixelsModified>(ev);
+}
+
+void Doc::notifyLayersFlagsChanged(const doc::LayerList& layers)
+{
+  if (layers.empty())
+    return;
+
+  DocEvent ev(this);
+  ev.sprite(sprite());
+  ev.layers(layers);
+  notifyChange<&DocObserver::onLayersFlagsChange>(ev);
+}
+
+void Doc::notifyDeferrableChange(NotifyFunc notifyFunc, DocEvent& ev)
+{
+  if (m_deferNotifications == 0) {
+    (this->*notifyFunc)(ev);
+    return;
+  }
+
+  std::vector<doc::ObjectId> layersIds;
+  for (const doc::Layer* layer : ev.layers())
+    layersIds.push_back(layer->id());
+
+  for (DeferredChange& change : m_deferredChanges) {
+    if (change.notifyFunc != notifyFunc)
+      continue;
+
+    // Events of several layers are merged in one event with all the
+    // layers
+    if (!ev.layers().empty()) {
+      doc::LayerList layers = change.ev.layers();
+      for (std::size_t i=0; i<layersIds.size(); ++i) {
+        if (std::find(change.layersIds.begin(),
+                      change.layersIds.end(),
+                      layersIds[i]) == change.layersIds.end()) {
+          layers.push_back(ev.layers()[i]);
+          change.layersIds.push_back(layersIds[i]);
+        }
+      }
+      change.ev.layers(layers);
+      return;
+    }
+
+    if (!change.multiple &&
+        (change.ev.layer() != ev.layer() ||
+         change.ev.cel() != ev.cel() ||
+         change.ev.frame() != ev.frame())) {
+      change.multiple = true;
+      change.ev.layer(nullptr);
+      change.ev.cel(nullptr);
+      change.ev.frame(-1);
+    }
+    return;
+  }
+
+  m_deferredChanges.push_back(
+    DeferredChange{ notifyFunc, ev,
+                    (ev.layer() ? ev.layer()->id(): doc::NullId),
+                    (ev.cel() ? ev.cel()->id(): doc::NullId),
+                    layersIds,
+                    false });
+}
+
+void Doc::beginDeferredNotifications()
+{
+  ++m_deferNotifications;
+}
+
+void Doc::endDeferredNotifications()
+{
+  ASSERT(m_deferNotifications > 0);
+  if (--m_deferNotifications > 0)
+    return;
+
+  bool generalUpdate = false;
+  std::vector<DeferredChange> changes;
+  std::swap(changes, m_deferredChanges);
+  for (DeferredChange& change : changes) {
+    // The referenced objects could be deleted in the same batch
+    if (change.ev.layer() &&
+        doc::get<doc::Layer>(change.layerId) != change.ev.layer()) {
+      change.ev.layer(nullptr);
+      change.multiple = true;
+    }
+    if (change.ev.cel() &&
+        doc::get<doc::Cel>(change.celId) != change.ev.cel()) {
+      change.ev.cel(nullptr);
+      change.multiple = true;
+    }
+    if (!change.layersIds.empty()) {
+      doc::LayerList layers;
+      for (std::size_t i=0; i<change.layersIds.size(); ++i) {
+        doc::Layer* layer = change.ev.layers()[i];
+        if (doc::get<doc::Layer>(change.layersIds[i]) == layer)
+          layers.push_back(layer);
+      }
+      if (layers.empty())
+        continue;
+      change.ev.layers(layers);
+    }
+    if (change.multiple)
+      generalUpdate = true;
+
+    (this->*change.notifyFunc)(change.ev);
+  }
+
+  // If the changes affected several objects, the UI is completely
+  // updated once.
+  if (generalUpdate)
+    notifyGeneralUpdate();
 }
 
 void Doc::notifyExposeSpritePixels(Sprite* sprite, const gfx::Region& region)
@@ -214,7 +366,7 @@ void Doc::notifyExposeSpritePixels(Sprite* sprite, const gfx::Region& region)
   DocEvent ev(this);
   ev.sprite(sprite);
   ev.region(region);
-  notify_observers<DocEvent&>(&DocObserver::onExposeSpritePixels, ev);
+  notify<&DocObserver::onExposeSpritePixels>(ev);
 }
 
 void Doc::notifyLayerMergedDown(Layer* srcLayer, Layer* targetLayer)
@@ -223,7 +375,7 @@ void Doc::notifyLayerMergedDown(Layer* srcLayer, Layer* targetLayer)
   ev.sprite(srcLayer->sprite());
   ev.layer(srcLayer);
   ev.targetLayer(targetLayer);
-  notify_observers<DocEvent&>(&DocObserver::onLayerMergedDown, ev);
+  notify<&DocObserver::onLayerMergedDown>(ev);
 }
 
 void Doc::notifyCelMoved(Layer* fromLayer, frame_t fromFrame, Layer* toLayer, frame_t toFrame)
@@ -234,7 +386,7 @@ void Doc::notifyCelMoved(Layer* fromLayer, frame_t fromFrame, Layer* toLayer, fr
   ev.frame(fromFrame);
   ev.targetLayer(toLayer);
   ev.targetFrame(toFrame);
-  notify_observers<DocEvent&>(&DocObserver::onCelMoved, ev);
+  notify<&DocObserver::onCelMoved>(ev);
 }
 
 void Doc::notifyCelCopied(Layer* fromLayer, frame_t fromFrame, Layer* toLayer, frame_t toFrame)
@@ -245,19 +397,19 @@ void Doc::notifyCelCopied(Layer* fromLayer, frame_t fromFrame, Layer* toLayer, f
   ev.frame(fromFrame);
   ev.targetLayer(toLayer);
   ev.targetFrame(toFrame);
-  notify_observers<DocEvent&>(&DocObserver::onCelCopied, ev);
+  notify<&DocObserver::onCelCopied>(ev);
 }
 
 void Doc::notifySelectionChanged()
 {
   DocEvent ev(this);
-  notify_observers<DocEvent&>(&DocObserver::onSelectionChanged, ev);
+  notify<&DocObserver::onSelectionChanged>(ev);
 }
 
 void Doc::notifySelectionBoundariesChanged()
 {
   DocEvent ev(this);
-  notify_observers<DocEvent&>(&DocObserver::onSelectionBoundariesChanged, ev);
+  notify<&DocObserver::onSelectionBoundariesChanged>(ev);
 }
 
 bool Doc::isModified() const
@@ -321,6 +473,18 @@ void Doc::setFormatOptions(const FormatOptionsPtr& format_options)
   m_format_options = format_options;
 }
 
+void Doc::setCompressedImages(const CompressedImagesPtr& images)
+{
+  base::scoped_lock lock(m_compressedImagesMutex);
+  m_compressedImages = images;
+}
+
+CompressedImagesPtr Doc::compressedImages() const
+{
+  base::scoped_lock lock(m_compressedImagesMutex);
+  return m_compressedImages;
+}
+
 //////////////////////////////////////////////////////////////////////
 // Boundaries
 
@@ -577,7 +741,7 @@ Doc* Doc::duplicate(DuplicateType type) const
 void Doc::close()
 {
   try {
-    notify_observers<Doc*>(&DocObserver::onCloseDocument, this);
+    notify<&DocObserver::onCloseDocument>(this);
   }
   catch (...) {
     LOG(ERROR, "DOC: Exception on DocObserver::onCloseDocument()\n");
@@ -588,7 +752,7 @@ void Doc::close()
 
 void Doc::onFileNameChange()
 {
-  notify_observers(&DocObserver::onFileNameChanged, this);
+  notify<&DocObserver::onFileNameChanged>(this);
 }
 
 void Doc::onContextChanged()
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -9,8 +9,10 @@
 #define APP_DOC_H_INCLUDED
 #pragma once
 
+#include "app/doc_event.h"
 #include "app/doc_observer.h"
 #include "app/extra_cel.h"
+#include "app/file/compressed_images.h"
 #include "app/file/format_options.h"
 #include "app/transformation.h"
 #include "base/disable_copying.h"
@@ -21,14 +23,18 @@
 #include "doc/document.h"
 #include "doc/frame.h"
 #include "doc/mask_boundaries.h"
+#include "doc/object_id.h"
 #include "doc/pixel_format.h"
+#include "doc/selected_frames.h"
 #include "gfx/rect.h"
 #include "obs/observable.h"
 #include "os/color_space.h"
 
 #include <atomic>
+#include <cstddef>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace doc {
   class Cel;
@@ -72,6 +78,11 @@ namespace app {
     Context* context() const { return m_ctx; }
     void setContext(Context* ctx);
 
+    // Observers are notified only of the groups of events returned by
+    // DocObserver::docEvents() when they are added.
+    void add_observer(DocObserver* observer);
+    void remove_observer(DocObserver* observer);
+
     // Lock/unlock API (RWLock wrapper)
     bool canWriteLockFromRead() const;
     bool readLock(int timeout);
@@ -99,22 +110,67 @@ namespace app {
     color_t bgColor() const;
     color_t bgColor(Layer* layer) const;
 
+    // Approximated memory used by the document, the sprite data (from
+    // doc::Object::getMemSize()) and the undo history. It can be
+    // called from any thread without locking the document (it
+    // returns the values calculated in the last
+    // updateMemoryUsage() call).
+    struct MemoryUsage {
+      std::size_t sprite = 0;
+      std::size_t undo = 0;
+      std::size_t total() const { return sprite + undo; }
+    };
+    MemoryUsage memoryUsage() const;
+
+    // Recalculates the memory used by the sprite, it must be called
+    // from the thread that locks the document (e.g. when a new undo
+    // state is added) or before the document is shared.
+    void updateMemoryUsage();
+
     os::ColorSpaceRef osColorSpace() const { return m_osColorSpace; }
 
     //////////////////////////////////////////////////////////////////////
     // Notifications
 
+    // Notifies the observers subscribed to the group of the given
+    // event, e.g. notify<&DocObserver::onAddCel>(ev). Nothing is done
+    // if no observer is subscribed to the group.
+    template<auto Method>
+    void notify(typename DocEventArg<decltype(Method)>::type arg) {
+      using Arg = typename DocEventArg<decltype(Method)>::type;
+      constexpr uint32_t group = DocEventGroup<Method>::value;
+      if (group != 0 && (m_observedEvents & group) == 0)
+        return;
+      notify_observers<Arg>(&DocObserver::notifyDocEvent<Method>, arg);
+    }
+
     void notifyGeneralUpdate();
     void notifyColorSpaceChanged();
     void notifyPaletteChanged();
     void notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region, frame_t frame);
     void notifyExposeSpritePixels(Sprite* sprite, const gfx::Region& region);
     void notifyLayerMergedDown(Layer* srcLayer, Layer* targetLayer);
+    // One notification (instead of a general update) when the
+    // visible/editable flags of several layers are changed.
+    void notifyLayersFlagsChanged(const doc::LayerList& layers);
     void notifyCelMoved(Layer* fromLayer, frame_t fromFrame, Layer* toLayer, frame_t toFrame);
     void notifyCelCopied(Layer* fromLayer, frame_t fromFrame, Layer* toLayer, frame_t toFrame);
     void notifySelectionChanged();
     void notifySelectionBoundariesChanged();
 
+    // Notifies a change of a property of an object (e.g. the name of
+    // a layer, the position of a cel, etc.). Between
+    // beginDeferredNotifications() and endDeferredNotifications()
+    // these notifications are coalesced (one DocEvent for each kind
+    // of change) and fired when the batch ends, e.g. to avoid
+    // updating the UI for each change of a script transaction.
+    template<auto Method>
+    void notifyChange(DocEvent& ev) {
+      notifyDeferrableChange(&Doc::notify<Method>, ev);
+    }
+    void beginDeferredNotifications();
+    void endDeferredNotifications();
+
     //////////////////////////////////////////////////////////////////////
     // File related properties
 
@@ -142,12 +198,25 @@ namespace app {
     void markAsBackedUp();
     bool isFullyBackedUp() const;
 
+    // Frames that are still being loaded in the background (when a
+    // big file is opened, the document is displayed as soon as its
+    // first frame is loaded). These frames are empty until they are
+    // loaded, and the document cannot be saved meanwhile.
+    const doc::SelectedFrames& loadingFrames() const { return m_loadingFrames; }
+    bool isLoadingFrames() const { return !m_loadingFrames.empty(); }
+    void setLoadingFrames(const doc::SelectedFrames& frames) { m_loadingFrames = frames; }
+
     //////////////////////////////////////////////////////////////////////
     // Loaded options from file
 
     void setFormatOptions(const FormatOptionsPtr& format_options);
     FormatOptionsPtr formatOptions() const { return m_format_options; }
 
+    // Compressed images from the last time the document was
+    // loaded/saved as an .aseprite file (to save it faster).
+    void setCompressedImages(const CompressedImagesPtr& images);
+    CompressedImagesPtr compressedImages() const;
+
     //////////////////////////////////////////////////////////////////////
     // Boundaries
 
@@ -237,6 +306,9 @@ namespace app {
     // Undo and redo information about the document.
     std::unique_ptr<DocUndo> m_undo;
 
+    // Memory used by the sprite (see updateMemoryUsage())
+    std::atomic<std::size_t> m_spriteMemSize;
+
     // Current transaction for this document (when this is commit(), a
     // new undo command is added to m_undo).
     Transaction* m_transaction;
@@ -247,6 +319,11 @@ namespace app {
     // Data to save the file in the same format that it was loaded
     FormatOptionsPtr m_format_options;
 
+    // Compressed images from the last load/save, it's accessed from
+    // the thread that loads/saves the file (so we use a mutex).
+    CompressedImagesPtr m_compressedImages;
+    mutable base::mutex m_compressedImagesMutex;
+
     // Extra cel used to draw extra stuff (e.g. editor's pen preview, pixels in movement, etc.)
     ExtraCelRef m_extraCel;
 
@@ -261,6 +338,30 @@ namespace app {
     // Last used color space to render a sprite.
     os::ColorSpaceRef m_osColorSpace;
 
+    // Frames that aren't loaded yet.
+    doc::SelectedFrames m_loadingFrames;
+
+    // Changes notified with notifyChange() when the notifications are
+    // deferred. If there are several changes of the same kind for
+    // different objects, the event doesn't reference any object.
+    typedef void (Doc::*NotifyFunc)(DocEvent&);
+    void notifyDeferrableChange(NotifyFunc notifyFunc, DocEvent& ev);
+
+    struct DeferredChange {
+      NotifyFunc notifyFunc;
+      DocEvent ev;
+      doc::ObjectId layerId;
+      doc::ObjectId celId;
+      std::vector<doc::ObjectId> layersIds; // IDs of ev.layers()
+      bool multiple;
+    };
+    int m_deferNotifications;
+    std::vector<DeferredChange> m_deferredChanges;
+
+    // Added observers and the union of their DocObserver::docEvents()
+    std::vector<DocObserver*> m_subscribers;
+    uint32_t m_observedEvents;
+
     DISABLE_COPYING(Doc);
   };
 
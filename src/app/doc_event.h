@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -11,6 +11,7 @@
 
 #include "gfx/region.h"
 #include "doc/frame.h"
+#include "doc/layer_list.h"
 
 namespace doc {
   class Cel;
@@ -52,6 +53,7 @@ namespace app {
     doc::Tag* tag() const { return m_tag; }
     doc::Slice* slice() const { return m_slice; }
     const gfx::Region& region() const { return m_region; }
+    const doc::LayerList& layers() const { return m_layers; }
 
     void sprite(doc::Sprite* sprite) { m_sprite = sprite; }
     void layer(doc::Layer* layer) { m_layer = layer; }
@@ -62,6 +64,7 @@ namespace app {
     void tag(doc::Tag* tag) { m_tag = tag; }
     void slice(doc::Slice* slice) { m_slice = slice; }
     void region(const gfx::Region& rgn) { m_region = rgn; }
+    void layers(const doc::LayerList& layers) { m_layers = layers; }
 
     // Destination of the operation.
     doc::Layer* targetLayer() const { return m_targetLayer; }
@@ -81,6 +84,7 @@ namespace app {
     doc::Tag* m_tag;
     doc::Slice* m_slice;
     gfx::Region m_region;
+    doc::LayerList m_layers;    // For events of several layers
 
     // For copy/move commands, the m_layer/m_frame are source of the
     // operation, and these are the destination of the operation.
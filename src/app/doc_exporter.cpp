@@ -15,16 +15,19 @@
 #include "app/console.h"
 #include "app/context.h"
 #include "app/doc.h"
+#include "app/doc_exporter_cache.h"
 #include "app/file/file.h"
+#include "app/file/output_manifest.h"
 #include "app/filename_formatter.h"
-#include "app/restore_visible_layers.h"
 #include "app/snap_to_grid.h"
 #include "app/util/autocrop.h"
+#include "app/util/data_file_writer.h"
+#include "app/util/rects_packer.h"
 #include "base/clamp.h"
 #include "base/convert_to.h"
 #include "base/fs.h"
 #include "base/fstream_path.h"
-#include "base/replace_string.h"
+#include "base/scoped_value.h"
 #include "base/string.h"
 #include "doc/algorithm/shrink_bounds.h"
 #include "doc/cel.h"
@@ -48,12 +51,17 @@
 #include "ver/info.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <cstdio>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <set>
+#include <sstream>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 #define DX_TRACE(...) // TRACEARGS
@@ -62,30 +70,31 @@ using namespace doc;
 
 namespace {
 
-std::string escape_for_json(const std::string& path)
-{
-  std::string res = path;
-  base::replace_string(res, "\\", "\\\\");
-  base::replace_string(res, "\"", "\\\"");
-  return res;
-}
-
-std::ostream& operator<<(std::ostream& os, const doc::UserData& data)
+void write_user_data(app::DataFileWriter& w, const doc::UserData& data)
 {
   doc::color_t color = data.color();
   if (doc::rgba_geta(color)) {
-    os << ", \"color\": \"#"
-       << std::hex << std::setfill('0')
-       << std::setw(2) << (int)doc::rgba_getr(color)
-       << std::setw(2) << (int)doc::rgba_getg(color)
-       << std::setw(2) << (int)doc::rgba_getb(color)
-       << std::setw(2) << (int)doc::rgba_geta(color)
-       << std::dec
-       << "\"";
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "#%02x%02x%02x%02x",
+                  (int)doc::rgba_getr(color),
+                  (int)doc::rgba_getg(color),
+                  (int)doc::rgba_getb(color),
+                  (int)doc::rgba_geta(color));
+    w.field("color", buf);
   }
   if (!data.text().empty())
-    os << ", \"data\": \"" << escape_for_json(data.text()) << "\"";
-  return os;
+    w.field("data", data.text());
+}
+
+void write_rect(app::DataFileWriter& w, const char* name, const gfx::Rect& rc)
+{
+  w.key(name);
+  w.beginObject(app::DataFileWriter::Layout::Inline);
+  w.field("x", rc.x);
+  w.field("y", rc.y);
+  w.field("w", rc.w);
+  w.field("h", rc.h);
+  w.endObject();
 }
 
 } // anonymous namespace
@@ -94,6 +103,24 @@ namespace app {
 
 typedef std::shared_ptr<gfx::Rect> SharedRectPtr;
 
+static std::ios::openmode data_file_mode(const SpriteSheetDataFormat format)
+{
+  return (format == SpriteSheetDataFormat::MsgPack ?
+          std::ios::out | std::ios::binary: std::ios::out);
+}
+
+static const char* sprite_sheet_packing_name(const SpriteSheetPacking packing)
+{
+  switch (packing) {
+    case SpriteSheetPacking::Skyline:          return "skyline";
+    case SpriteSheetPacking::BestShortSideFit: return "best-short-side-fit";
+    case SpriteSheetPacking::BestLongSideFit:  return "best-long-side-fit";
+    case SpriteSheetPacking::BestAreaFit:      return "best-area-fit";
+    case SpriteSheetPacking::BottomLeft:       return "bottom-left";
+  }
+  return "";
+}
+
 DocExporter::Item::Item(Doc* doc,
                         const doc::Tag* tag,
                         const doc::SelectedLayers* selLayers,
@@ -169,7 +196,8 @@ public:
     m_isDuplicated(false),
     m_originalSize(sprite->width(), sprite->height()),
     m_trimmedBounds(0, 0, sprite->width(), sprite->height()),
-    m_inTextureBounds(std::make_shared<gfx::Rect>(0, 0, sprite->width(), sprite->height())) {
+    m_inTextureBounds(std::make_shared<gfx::Rect>(0, 0, sprite->width(), sprite->height())),
+    m_cacheKey(0) {
   }
 
   Doc* document() const { return m_document; }
@@ -232,9 +260,23 @@ public:
   void setLinked() { m_isLinked = true; }
   void setDuplicated() { m_isDuplicated = true; }
 
-  ImageRef createRender(ImageBufferPtr& imageBuf) {
+  // Key of this sample in the DocExporterCache (0 if it's not cached)
+  uint64_t cacheKey() const { return m_cacheKey; }
+  void setCacheKey(const uint64_t key) { m_cacheKey = key; }
+
+  // Pixels of the trimmed bounds from a previous render (from the
+  // DocExporterCache), used instead of rendering the sprite again.
+  const ImageRef& cachedRender() const { return m_cachedRender; }
+  void setCachedRender(const ImageRef& render) { m_cachedRender = render; }
+
+  ImageRef createRender(ImageBufferPtr& imageBuf) const {
     ASSERT(m_sprite);
 
+    if (m_cachedRender &&
+        m_cachedRender->pixelFormat() == m_sprite->pixelFormat() &&
+        m_cachedRender->size() == m_trimmedBounds.size())
+      return m_cachedRender;
+
     ImageRef render(
       Image::create(m_sprite->pixelFormat(),
                     m_trimmedBounds.w,
@@ -246,14 +288,32 @@ public:
     return render;
   }
 
-  void renderSample(doc::Image* dst, int x, int y, bool extrude) const {
-    RestoreVisibleLayers layersVisibility;
-    if (m_selLayers)
-      layersVisibility.showSelectedLayers(m_sprite,
-                                          *m_selLayers);
+  // This function doesn't modify the sprite (the visibility of the
+  // layers isn't changed), so several samples of the same sprite can
+  // be rendered at the same time from different threads.
+  //
+  // If "src" (or the cached render) is specified, its pixels are
+  // copied instead of rendering the sprite.
+  void renderSample(doc::Image* dst, int x, int y, bool extrude,
+                    const doc::Image* src = nullptr) const {
+    if (!src && m_cachedRender)
+      src = m_cachedRender.get();
+    if (src &&
+        src->pixelFormat() == dst->pixelFormat() &&
+        src->size() == m_trimmedBounds.size()) {
+      copySample(dst, src, x, y, extrude);
+      return;
+    }
 
     render::Render render;
 
+    SelectedLayers visibleLayers;
+    if (m_selLayers) {
+      visibleLayers = *m_selLayers;
+      visibleLayers.propagateSelection();
+      render.setVisibleLayers(&visibleLayers);
+    }
+
     // 1) We cannot use the Preferences because this is called from a non-UI thread
     // 2) We should use the new blend mode always when we're saving files
     //render.setNewBlend(Preferences::instance().experimental.newBlend());
@@ -291,6 +351,28 @@ public:
   }
 
 private:
+  // Same as renderSample() but copying the pixels from "src" (the
+  // render of the trimmed bounds).
+  void copySample(doc::Image* dst, const doc::Image* src,
+                  int x, int y, bool extrude) const {
+    if (extrude) {
+      const int w = src->width();
+      const int h = src->height();
+      int dx[] = { 0, 1, w+1 };
+      int dy[] = { 0, 1, h+1 };
+      int srcx[] = { 0, 0, w-1 };
+      int srcy[] = { 0, 0, h-1 };
+      int szx[] = { 1, w, 1 };
+      int szy[] = { 1, h, 1 };
+      for (int j=0; j<3; ++j)
+        for (int i=0; i<3; ++i)
+          dst->copy(src, gfx::Clip(x+dx[i], y+dy[j], srcx[i], srcy[j], szx[i], szy[j]));
+    }
+    else {
+      dst->copy(src, gfx::Clip(x, y, src->bounds()));
+    }
+  }
+
   Doc* m_document;
   Sprite* m_sprite;
   SelectedLayers* m_selLayers;
@@ -304,6 +386,8 @@ private:
   gfx::Size m_originalSize;
   gfx::Rect m_trimmedBounds;
   SharedRectPtr m_inTextureBounds;
+  uint64_t m_cacheKey;
+  ImageRef m_cachedRender;
 };
 
 class DocExporter::Samples {
@@ -512,13 +596,27 @@ public:
                      int shapePadding,
                      int& width, int& height,
                      base::task_token& token) override {
-    gfx::PackingRects pr(borderPadding, shapePadding);
+    std::vector<gfx::Size> sizes;
+    if (!collectSizes(samples, sizes, token))
+      return;
+
+    packWithPackingRects(samples, sizes,
+                         borderPadding, shapePadding,
+                         width, height, token);
+  }
+
+protected:
+  // Marks duplicated samples and returns the sizes of the samples
+  // that must be packed. Returns false if the process was canceled.
+  static bool collectSizes(Samples& samples,
+                           std::vector<gfx::Size>& sizes,
+                           base::task_token& token) {
     doc::ImagesMap duplicates;
 
     uint32_t i = 0;
     for (auto& sample : samples) {
       if (token.canceled())
-        return;
+        return false;
       token.set_progress_range(0.2f, 0.3f);
       token.set_progress(float(i) / samples.size());
 
@@ -540,10 +638,22 @@ public:
       }
       else {
         duplicates[sampleRender] = i;
-        pr.add(sample.requiredSize());
+        sizes.push_back(sample.requiredSize());
       }
       ++i;
     }
+    return true;
+  }
+
+  static void packWithPackingRects(Samples& samples,
+                                   const std::vector<gfx::Size>& sizes,
+                                   int borderPadding,
+                                   int shapePadding,
+                                   int& width, int& height,
+                                   base::task_token& token) {
+    gfx::PackingRects pr(borderPadding, shapePadding);
+    for (const auto& size : sizes)
+      pr.add(size);
 
     token.set_progress_range(0.3f, 0.4f);
     if (width == 0 || height == 0) {
@@ -556,21 +666,83 @@ public:
     }
     token.set_progress_range(0.0f, 1.0f);
 
-    auto it = pr.begin();
+    setInTextureBounds(samples, pr.begin(), pr.end());
+  }
+
+  template<typename Iterator>
+  static void setInTextureBounds(Samples& samples,
+                                 Iterator it, const Iterator end) {
     for (auto& sample : samples) {
       if (sample.isLinked() ||
           sample.isDuplicated() ||
           sample.isEmpty())
         continue;
 
-      ASSERT(it != pr.end());
+      ASSERT(it != end);
       sample.setInTextureBounds(*(it++));
     }
   }
 };
 
+// Uses the MaxRects/Skyline algorithms (app::RectsPacker) which
+// place each sample just once, so it's faster than the
+// gfx::PackingRects for thousands of samples. The old packer is
+// still used if the samples don't fit in the given texture size.
+class DocExporter::MaxRectsLayoutSamples : public DocExporter::BestFitLayoutSamples {
+public:
+  MaxRectsLayoutSamples(const SpriteSheetPacking packing)
+    : m_packing(packing) {
+  }
+
+  void layoutSamples(Samples& samples,
+                     int borderPadding,
+                     int shapePadding,
+                     int& width, int& height,
+                     base::task_token& token) override {
+    std::vector<gfx::Size> sizes;
+    if (!collectSizes(samples, sizes, token))
+      return;
+
+    RectsPacker packer(m_packing, borderPadding, shapePadding);
+    for (const auto& size : sizes)
+      packer.add(size);
+
+    bool packed;
+    token.set_progress_range(0.3f, 0.4f);
+    if (width == 0 || height == 0) {
+      gfx::Size sz = packer.bestFit(token, width, height);
+      packed = (!sz.isEmpty() || sizes.empty());
+      if (packed) {
+        width = sz.w;
+        height = sz.h;
+      }
+    }
+    else {
+      packed = packer.pack(gfx::Size(width, height), token);
+    }
+    token.set_progress_range(0.0f, 1.0f);
+    if (token.canceled())
+      return;
+
+    DX_TRACE("DX: MaxRectsLayoutSamples", int(m_packing), packed, width, height);
+
+    if (packed)
+      setInTextureBounds(samples, packer.begin(), packer.end());
+    else
+      packWithPackingRects(samples, sizes,
+                           borderPadding, shapePadding,
+                           width, height, token);
+  }
+
+private:
+  SpriteSheetPacking m_packing;
+};
+
 DocExporter::DocExporter()
-  : m_docBuf(std::make_shared<doc::ImageBuffer>())
+  : m_exportCache(nullptr)
+  , m_memoryCache(nullptr)
+  , m_outputManifest(nullptr)
+  , m_docBuf(std::make_shared<doc::ImageBuffer>())
   , m_sampleBuf(std::make_shared<doc::ImageBuffer>())
 {
   m_cache.spriteId = doc::NullId;
@@ -580,6 +752,7 @@ DocExporter::DocExporter()
 void DocExporter::reset()
 {
   m_sheetType = SpriteSheetType::None;
+  m_sheetPacking = SpriteSheetPacking::Default;
   m_dataFormat = SpriteSheetDataFormat::Default;
   m_dataFilename.clear();
   m_textureFilename.clear();
@@ -602,6 +775,7 @@ void DocExporter::reset()
   m_listTags = false;
   m_listLayers = false;
   m_listSlices = false;
+  m_useCache = false;
   m_documents.clear();
 }
 
@@ -614,6 +788,7 @@ Doc* DocExporter::exportSheet(Context* ctx, base::task_token& token)
 {
   // We output the metadata to std::cout if the user didn't specify a file.
   std::ofstream fos;
+  std::ostringstream dataBuf;
   std::streambuf* osbuf = nullptr;
   if (m_dataFilename.empty()) {
     // Redirect to stdout if we are running in batch mode
@@ -635,11 +810,29 @@ Doc* DocExporter::exportSheet(Context* ctx, base::task_token& token)
       }
     }
 
-    fos.open(FSTREAM_PATH(m_dataFilename), std::ios::out);
-    osbuf = fos.rdbuf();
+    // With an OutputManifest the data is generated in memory to
+    // compare it with the previous export before writing the file
+    if (m_outputManifest)
+      osbuf = dataBuf.rdbuf();
+    else {
+      fos.open(FSTREAM_PATH(m_dataFilename), data_file_mode(m_dataFormat));
+      osbuf = fos.rdbuf();
+    }
   }
   std::ostream os(osbuf);
 
+  // Load the samples of the previous export
+  std::unique_ptr<DocExporterCache> cache;
+  const std::string cacheFn = cacheFilename();
+  if (!m_memoryCache && m_useCache && !cacheFn.empty()) {
+    cache = std::make_unique<DocExporterCache>();
+    cache->load(cacheFn);
+  }
+  else if (m_memoryCache)
+    m_memoryCache->startNewExport();
+  base::ScopedValue<DocExporterCache*> cacheGuard(
+    m_exportCache, (m_memoryCache ? m_memoryCache: cache.get()), nullptr);
+
   // Steps for sheet construction:
   // 1) Capture the samples (each sprite+frame pair)
   Samples samples;
@@ -683,19 +876,29 @@ Doc* DocExporter::exportSheet(Context* ctx, base::task_token& token)
   token.set_progress(0.9f);
 
   // Save the metadata.
-  if (osbuf)
+  if (osbuf) {
     createDataFile(samples, os, texture);
+    if (osbuf == dataBuf.rdbuf())
+      saveDataFileIfChanged(dataBuf.str());
+  }
   token.set_progress(0.95f);
 
   // Save the image files.
   if (!m_textureFilename.empty()) {
     DX_TRACE("DocExporter::exportSheet", m_textureFilename);
     textureDocument->setFilename(m_textureFilename.c_str());
-    int ret = save_document(ctx, textureDocument.get());
+    int ret = save_document(ctx, textureDocument.get(), m_outputManifest);
     if (ret == 0)
       textureDocument->markAsSaved();
   }
 
+  // Save the samples for the next export
+  if (cache && !cache->save(cacheFn)) {
+    Console console;
+    console.printf("Error saving the sprite sheet cache \"%s\"\n",
+                   cacheFn.c_str());
+  }
+
   token.set_progress(1.0f);
 
   return textureDocument.release();
@@ -823,6 +1026,29 @@ void DocExporter::captureSamples(Samples& samples,
 {
   DX_TRACE("DX: Capture samples");
 
+  // Candidate samples, they are trimmed in parallel (rendering and
+  // shrinking the bounds of each sample is the expensive part) and
+  // then added to "samples" in the same order.
+  struct Candidate {
+    Sample sample;
+    gfx::Rect spriteBounds;
+    int linkedTo = -1;          // Index of the candidate of the first linked cel
+    bool trim = false;          // Needs to be rendered/trimmed
+    bool trimmed = false;       // Trimmed bounds were calculated
+    bool ignored = false;       // Empty sample ignored (m_ignoreEmptyCels)
+
+    Candidate(const Sample& sample,
+              const gfx::Rect& spriteBounds)
+      : sample(sample), spriteBounds(spriteBounds) { }
+  };
+  std::vector<Candidate> candidates;
+
+  // Index of the first candidate of each (sprite, layer, frame), used
+  // to re-use the sample of the first cel of a group of linked cels.
+  typedef std::tuple<const Sprite*, const Layer*, frame_t> SampleKey;
+  std::map<SampleKey, int> candidateIndexes;
+  ASSERT(samples.empty());
+
   for (auto& item : m_documents) {
     if (token.canceled())
       return;
@@ -891,9 +1117,10 @@ void DocExporter::captureSamples(Samples& samples,
 
       std::string filename = filename_formatter(format, fnInfo);
 
-      Sample sample(
-        doc, sprite, item.selLayers, frame, innerTag,
-        filename, m_innerPadding, m_extrude);
+      Candidate candidate(
+        Sample(doc, sprite, item.selLayers, frame, innerTag,
+               filename, m_innerPadding, m_extrude),
+        spriteBounds);
       Cel* cel = nullptr;
       Cel* link = nullptr;
       bool done = false;
@@ -905,24 +1132,12 @@ void DocExporter::captureSamples(Samples& samples,
       }
 
       // Re-use linked samples
-      bool alreadyTrimmed = false;
       if (link && m_mergeDuplicates) {
-        for (const Sample& other : samples) {
-          if (token.canceled())
-            return;
-
-          if (other.sprite() == sprite &&
-              other.layer() == layer &&
-              other.frame() == link->frame()) {
-            ASSERT(!other.isLinked());
-
-            sample.setLinked();
-            sample.setTrimmedBounds(other.trimmedBounds());
-            sample.setSharedBounds(other.sharedBounds());
-            alreadyTrimmed = true;
-            done = true;
-            break;
-          }
+        auto it = candidateIndexes.find(SampleKey(sprite, layer, link->frame()));
+        if (it != candidateIndexes.end()) {
+          ASSERT(candidates[it->second].linkedTo < 0);
+          candidate.linkedTo = it->second;
+          done = true;
         }
         // "done" variable can be false here, e.g. when we export a
         // frame tag and the first linked cel is outside the tag range.
@@ -934,77 +1149,203 @@ void DocExporter::captureSamples(Samples& samples,
         if (layer && layer->isImage() && !cel && m_ignoreEmptyCels)
           continue;
 
-        ImageRef sampleRender(sample.createRender(m_sampleBuf));
+        candidate.trim = true;
+      }
 
-        gfx::Rect frameBounds;
-        doc::color_t refColor = 0;
+      candidateIndexes.emplace(SampleKey(sprite, layer, frame),
+                               int(candidates.size()));
+      candidates.push_back(candidate);
+    }
+  }
 
-        if (m_trimCels) {
-          if ((layer &&
-               layer->isBackground()) ||
-              (!layer &&
-               sprite->backgroundLayer() &&
-               sprite->backgroundLayer()->isVisible())) {
-            refColor = get_pixel(sampleRender.get(), 0, 0);
-          }
-          else {
-            refColor = sprite->transparentColor();
-          }
+  // Trim the candidates using all CPU cores, returns the render of
+  // the whole sprite used to trim it
+  auto trimCandidate = [this](Candidate& candidate,
+                              ImageBufferPtr& sampleBuf) -> ImageRef {
+    Sample& sample = candidate.sample;
+    const Sprite* sprite = sample.sprite();
+    const Layer* layer = sample.layer();
+    ImageRef sampleRender(sample.createRender(sampleBuf));
+
+    gfx::Rect frameBounds;
+    doc::color_t refColor = 0;
+
+    if (m_trimCels) {
+      if ((layer &&
+           layer->isBackground()) ||
+          (!layer &&
+           sprite->backgroundLayer() &&
+           sprite->backgroundLayer()->isVisible())) {
+        refColor = get_pixel(sampleRender.get(), 0, 0);
+      }
+      else {
+        refColor = sprite->transparentColor();
+      }
+    }
+    else if (m_ignoreEmptyCels)
+      refColor = sprite->transparentColor();
+
+    if (!algorithm::shrink_bounds(sampleRender.get(), candidate.spriteBounds, frameBounds, refColor)) {
+      // If shrink_bounds() returns false, it's because the whole
+      // image is transparent (equal to the mask color).
+
+      // Should we ignore this empty frame? (i.e. don't include
+      // the frame in the sprite sheet)
+      if (m_ignoreEmptyCels) {
+        candidate.ignored = true;
+        return sampleRender;
+      }
+
+      // Create an entry with Size(1, 1) for this completely
+      // trimmed frame anyway so we conserve the frame information
+      // (position and duration of the frame in the JSON data, and
+      // the relative position of the frame in frame tags).
+      sample.setTrimmedBounds(frameBounds = gfx::Rect(0, 0, 1, 1));
+    }
+
+    if (m_trimCels) {
+      // TODO merge this code with the code in DocApi::trimSprite()
+      if (m_trimByGrid) {
+        const gfx::Rect& gridBounds = sprite->gridBounds();
+        gfx::Point posTopLeft =
+          snap_to_grid(gridBounds,
+                       frameBounds.origin(),
+                       PreferSnapTo::FloorGrid);
+        gfx::Point posBottomRight =
+          snap_to_grid(gridBounds,
+                       frameBounds.point2(),
+                       PreferSnapTo::CeilGrid);
+        frameBounds = gfx::Rect(posTopLeft, posBottomRight);
+      }
+      sample.setTrimmedBounds(frameBounds);
+      candidate.trimmed = true;
+    }
+    return sampleRender;
+  };
+
+  // Uses the DocExporterCache (if it's available) to avoid trimming
+  // the candidate again
+  auto processCandidate = [this, &trimCandidate](Candidate& candidate,
+                                                 ImageBufferPtr& sampleBuf) {
+    Sample& sample = candidate.sample;
+    DocExporterCache::Sample cached;
+    if (m_exportCache) {
+      const uint64_t key = calcSampleKey(sample, candidate.spriteBounds);
+      sample.setCacheKey(key);
+
+      if (m_exportCache->findSample(key, cached)) {
+        candidate.ignored = cached.ignored;
+        candidate.trimmed = cached.trimmed;
+        if (!cached.ignored) {
+          sample.setTrimmedBounds(cached.trimmedBounds);
+          sample.setCachedRender(cached.render);
         }
-        else if (m_ignoreEmptyCels)
-          refColor = sprite->transparentColor();
+        return;
+      }
+    }
 
-        if (!algorithm::shrink_bounds(sampleRender.get(), spriteBounds, frameBounds, refColor)) {
-          // If shrink_bounds() returns false, it's because the whole
-          // image is transparent (equal to the mask color).
+    if (!candidate.trim)
+      return;
 
-          // Should we ignore this empty frame? (i.e. don't include
-          // the frame in the sprite sheet)
-          if (m_ignoreEmptyCels)
-            continue;
+    ImageRef sampleRender = trimCandidate(candidate, sampleBuf);
+    if (m_exportCache) {
+      cached.ignored = candidate.ignored;
+      cached.trimmed = candidate.trimmed;
+      if (!candidate.ignored) {
+        cached.trimmedBounds = sample.trimmedBounds();
+
+        // Final bounds of the sample (see the m_trimSprite case
+        // below), the render contains the whole sprite.
+        const gfx::Rect bounds =
+          (!candidate.trimmed && m_trimSprite ? candidate.spriteBounds:
+                                                sample.trimmedBounds());
+        cached.render.reset(
+          crop_image(sampleRender.get(), bounds,
+                     sample.sprite()->transparentColor()));
+        sample.setCachedRender(cached.render);
+      }
+      m_exportCache->addSample(sample.cacheKey(), cached);
+    }
+  };
 
-          // Create an entry with Size(1, 1) for this completely
-          // trimmed frame anyway so we conserve the frame information
-          // (position and duration of the frame in the JSON data, and
-          // the relative position of the frame in frame tags).
-          sample.setTrimmedBounds(frameBounds = gfx::Rect(0, 0, 1, 1));
-        }
+  std::vector<int> toTrim;
+  for (int i=0; i<int(candidates.size()); ++i) {
+    if (candidates[i].trim ||
+        (m_exportCache && candidates[i].linkedTo < 0))
+      toTrim.push_back(i);
+  }
 
-        if (m_trimCels) {
-          // TODO merge this code with the code in DocApi::trimSprite()
-          if (m_trimByGrid) {
-            const gfx::Rect& gridBounds = doc->sprite()->gridBounds();
-            gfx::Point posTopLeft =
-              snap_to_grid(gridBounds,
-                           frameBounds.origin(),
-                           PreferSnapTo::FloorGrid);
-            gfx::Point posBottomRight =
-              snap_to_grid(gridBounds,
-                           frameBounds.point2(),
-                           PreferSnapTo::CeilGrid);
-            frameBounds = gfx::Rect(posTopLeft, posBottomRight);
-          }
-          sample.setTrimmedBounds(frameBounds);
-          alreadyTrimmed = true;
-        }
+  if (!toTrim.empty()) {
+    std::atomic<int> next(0);
+    std::atomic<int> trimmed(0);
+    auto trimCandidates = [&](const bool mainThread) {
+      ImageBufferPtr sampleBuf =
+        (mainThread ? m_sampleBuf: std::make_shared<doc::ImageBuffer>());
+      for (int i=next++; i<int(toTrim.size()); i=next++) {
+        if (token.canceled())
+          return;
+
+        processCandidate(candidates[toTrim[i]], sampleBuf);
+        ++trimmed;
+        if (mainThread)
+          token.set_progress(0.2f * trimmed / int(toTrim.size()));
       }
-      if (!alreadyTrimmed && m_trimSprite)
-        sample.setTrimmedBounds(spriteBounds);
+    };
 
-      samples.addSample(sample);
+    const int nthreads =
+      std::min<int>(toTrim.size(), std::max<int>(1, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (int i=1; i<nthreads; ++i)
+      threads.emplace_back(trimCandidates, false);
+    trimCandidates(true);       // Use this thread too
+    for (auto& thread : threads)
+      thread.join();
 
-      DX_TRACE("DX:   - Sample:",
-               sample.document()->filename(),
-               "Layer:", sample.layer() ? sample.layer()->name(): "-",
-               "TrimmedBounds:", sample.trimmedBounds(),
-               "InTextureBounds:", sample.inTextureBounds());
+    if (token.canceled())
+      return;
+  }
+
+  for (Candidate& candidate : candidates) {
+    Sample& sample = candidate.sample;
+    if (candidate.ignored)
+      continue;
+
+    bool alreadyTrimmed = candidate.trimmed;
+    if (candidate.linkedTo >= 0) {
+      const Candidate& other = candidates[candidate.linkedTo];
+
+      // If the first linked cel was ignored (it's empty), this one is
+      // empty too.
+      if (other.ignored)
+        continue;
+
+      sample.setLinked();
+      sample.setTrimmedBounds(other.sample.trimmedBounds());
+      sample.setSharedBounds(other.sample.sharedBounds());
+      sample.setCachedRender(other.sample.cachedRender());
+      alreadyTrimmed = true;
     }
+    if (!alreadyTrimmed && m_trimSprite)
+      sample.setTrimmedBounds(candidate.spriteBounds);
+
+    samples.addSample(sample);
+
+    DX_TRACE("DX:   - Sample:",
+             sample.document()->filename(),
+             "Layer:", sample.layer() ? sample.layer()->name(): "-",
+             "TrimmedBounds:", sample.trimmedBounds(),
+             "InTextureBounds:", sample.inTextureBounds());
   }
 }
 
 void DocExporter::layoutSamples(Samples& samples,
                                 base::task_token& token)
 {
+  // Re-use the layout of the previous export if the samples have
+  // the same geometry
+  if (m_exportCache && loadCachedLayout(samples))
+    return;
+
   int width = m_textureWidth;
   int height = m_textureHeight;
 
@@ -1016,6 +1357,13 @@ void DocExporter::layoutSamples(Samples& samples,
         width, height, token);
       break;
     }
+    case SpriteSheetType::MaxRects: {
+      MaxRectsLayoutSamples layout(m_sheetPacking);
+      layout.layoutSamples(
+        samples, m_borderPadding, m_shapePadding,
+        width, height, token);
+      break;
+    }
     default: {
       SimpleLayoutSamples layout(
         m_sheetType,
@@ -1028,6 +1376,9 @@ void DocExporter::layoutSamples(Samples& samples,
       break;
     }
   }
+
+  if (m_exportCache && !token.canceled())
+    saveCachedLayout(samples);
 }
 
 gfx::Size DocExporter::calculateSheetSize(const Samples& samples,
@@ -1149,22 +1500,27 @@ void DocExporter::renderTexture(Context* ctx,
 {
   textureImage->clear(0);
 
-  int i = 0;
+  std::set<const Sprite*> convertedSprites;
   for (const auto& sample : samples) {
     if (token.canceled())
       return;
-    token.set_progress(0.6f + 0.2f * i / int(samples.size()));
 
     if (sample.isLinked() ||
         sample.isDuplicated() ||
-        sample.isEmpty()) {
-      ++i;
+        sample.isEmpty())
       continue;
-    }
 
     // Make the sprite compatible with the texture so the render()
-    // works correctly.
-    if (sample.sprite()->pixelFormat() != textureImage->pixelFormat()) {
+    // works correctly. This modifies the sprite, so it must be done
+    // before rendering the samples in parallel. Grayscale sprites, and
+    // indexed sprites without a background layer, can be rendered
+    // directly in the RGB texture with the same result (the
+    // conversion of an indexed background layer makes its transparent
+    // pixels opaque, something that the render() doesn't do).
+    if (sample.sprite()->pixelFormat() != textureImage->pixelFormat() &&
+        (textureImage->pixelFormat() != IMAGE_RGB ||
+         (sample.sprite()->pixelFormat() == IMAGE_INDEXED &&
+          sample.sprite()->backgroundLayer()))) {
       cmd::SetPixelFormat(
         sample.sprite(),
         textureImage->pixelFormat(),
@@ -1172,15 +1528,63 @@ void DocExporter::renderTexture(Context* ctx,
         nullptr, // toGray is not needed because the texture is Indexed or RGB
         nullptr) // TODO add a delegate to show progress
         .execute(ctx);
+      convertedSprites.insert(sample.sprite());
     }
-
-    sample.renderSample(
-      textureImage,
-      sample.inTextureBounds().x+m_innerPadding,
-      sample.inTextureBounds().y+m_innerPadding,
-      m_extrude);
-    ++i;
   }
+
+  // Each sample is rendered in its own area of the texture, so we can
+  // render all of them at the same time.
+  std::atomic<int> next(0);
+  std::atomic<int> rendered(0);
+  auto renderSamples = [&](const bool mainThread) {
+    for (int i=next++; i<samples.size(); i=next++) {
+      if (token.canceled())
+        return;
+
+      const Sample& sample = samples[i];
+      if (!sample.isLinked() &&
+          !sample.isDuplicated() &&
+          !sample.isEmpty()) {
+        // Keep the render of new samples in the cache (if the sprite
+        // wasn't converted, the cache key uses the original format,
+        // and it's useful only if the format is the texture one)
+        ImageRef render;
+        if (m_exportCache &&
+            sample.cacheKey() &&
+            !sample.cachedRender() &&
+            sample.sprite()->pixelFormat() == textureImage->pixelFormat() &&
+            convertedSprites.find(sample.sprite()) == convertedSprites.end()) {
+          ImageBufferPtr renderBuf;
+          render = sample.createRender(renderBuf);
+
+          DocExporterCache::Sample cached;
+          cached.trimmedBounds = sample.trimmedBounds();
+          cached.render = render;
+          m_exportCache->addSample(sample.cacheKey(), cached);
+        }
+
+        sample.renderSample(
+          textureImage,
+          sample.inTextureBounds().x+m_innerPadding,
+          sample.inTextureBounds().y+m_innerPadding,
+          m_extrude,
+          render.get());
+      }
+
+      ++rendered;
+      if (mainThread)
+        token.set_progress(0.6f + 0.2f * rendered / samples.size());
+    }
+  };
+
+  const int nthreads =
+    std::min<int>(samples.size(), std::max<int>(1, std::thread::hardware_concurrency()));
+  std::vector<std::thread> threads;
+  for (int i=1; i<nthreads; ++i)
+    threads.emplace_back(renderSamples, false);
+  renderSamples(true);          // Use this thread too
+  for (auto& thread : threads)
+    thread.join();
 }
 
 void DocExporter::trimTexture(const Samples& samples,
@@ -1218,10 +1622,8 @@ void DocExporter::createDataFile(const Samples& samples,
                                  std::ostream& os,
                                  doc::Sprite* texture)
 {
-  std::string frames_begin;
-  std::string frames_end;
+  std::unique_ptr<DataFileWriter> writer;
   bool filename_as_key = false;
-  bool filename_as_attr = false;
   int nonExtrudedPosition = 0;
   int nonExtrudedSize = 0;
 
@@ -1233,87 +1635,129 @@ void DocExporter::createDataFile(const Samples& samples,
     nonExtrudedSize -= 2;
   }
 
-  // TODO we should use some string templates system here
   switch (m_dataFormat) {
+    default:
     case SpriteSheetDataFormat::JsonHash:
-      frames_begin = "{";
-      frames_end = "}";
+      writer = std::make_unique<JsonDataFileWriter>(os);
       filename_as_key = true;
-      filename_as_attr = false;
       break;
     case SpriteSheetDataFormat::JsonArray:
-      frames_begin = "[";
-      frames_end = "]";
+      writer = std::make_unique<JsonDataFileWriter>(os);
+      filename_as_key = false;
+      break;
+    case SpriteSheetDataFormat::MsgPack:
+      // Approximated size of each frame in MessagePack format
+      writer = std::make_unique<MsgPackDataFileWriter>(
+        os, 4096 + 160*samples.size());
       filename_as_key = false;
-      filename_as_attr = true;
       break;
   }
+  DataFileWriter& w = *writer;
+  using Layout = DataFileWriter::Layout;
+
+  w.beginObject();
+  w.key("frames");
+  if (filename_as_key)
+    w.beginObject(Layout::Block, 1);
+  else
+    w.beginArray(Layout::Block, 1);
 
-  os << "{ \"frames\": " << frames_begin << "\n";
-  for (Samples::const_iterator
-         it = samples.begin(),
-         end = samples.end(); it != end; ) {
-    const Sample& sample = *it;
+  for (const Sample& sample : samples) {
     gfx::Size srcSize = sample.originalSize();
     gfx::Rect spriteSourceBounds = sample.trimmedBounds();
     gfx::Rect frameBounds = sample.inTextureBounds();
 
-    if (filename_as_key)
-      os << "   \"" << escape_for_json(sample.filename()) << "\": {\n";
-    else if (filename_as_attr)
-      os << "   {\n"
-         << "    \"filename\": \"" << escape_for_json(sample.filename()) << "\",\n";
-
-    os << "    \"frame\": { "
-       << "\"x\": " << frameBounds.x + nonExtrudedPosition << ", "
-       << "\"y\": " << frameBounds.y + nonExtrudedPosition << ", "
-       << "\"w\": " << frameBounds.w + nonExtrudedSize << ", "
-       << "\"h\": " << frameBounds.h + nonExtrudedSize << " },\n"
-       << "    \"rotated\": false,\n"
-       << "    \"trimmed\": " << (sample.trimmed() ? "true": "false") << ",\n"
-       << "    \"spriteSourceSize\": { "
-       << "\"x\": " << spriteSourceBounds.x << ", "
-       << "\"y\": " << spriteSourceBounds.y << ", "
-       << "\"w\": " << spriteSourceBounds.w << ", "
-       << "\"h\": " << spriteSourceBounds.h << " },\n"
-       << "    \"sourceSize\": { "
-       << "\"w\": " << srcSize.w << ", "
-       << "\"h\": " << srcSize.h << " },\n"
-       << "    \"duration\": " << sample.sprite()->frameDuration(sample.frame()) << "\n"
-       << "   }";
-
-    if (++it != samples.end())
-      os << ",\n";
-    else
-      os << "\n";
+    if (filename_as_key) {
+      w.key(sample.filename());
+      w.beginObject();
+    }
+    else {
+      w.beginObject();
+      w.field("filename", sample.filename());
+    }
+
+    w.key("frame");
+    w.beginObject(Layout::Inline);
+    w.field("x", frameBounds.x + nonExtrudedPosition);
+    w.field("y", frameBounds.y + nonExtrudedPosition);
+    w.field("w", frameBounds.w + nonExtrudedSize);
+    w.field("h", frameBounds.h + nonExtrudedSize);
+    w.endObject();
+
+    w.field("rotated", false);
+    w.field("trimmed", sample.trimmed());
+
+    w.key("spriteSourceSize");
+    w.beginObject(Layout::Inline);
+    w.field("x", spriteSourceBounds.x);
+    w.field("y", spriteSourceBounds.y);
+    w.field("w", spriteSourceBounds.w);
+    w.field("h", spriteSourceBounds.h);
+    w.endObject();
+
+    w.key("sourceSize");
+    w.beginObject(Layout::Inline);
+    w.field("w", srcSize.w);
+    w.field("h", srcSize.h);
+    w.endObject();
+
+    w.field("duration", sample.sprite()->frameDuration(sample.frame()));
+    w.endObject();
   }
-  os << " " << frames_end;
+
+  if (filename_as_key)
+    w.endObject();
+  else
+    w.endArray();
 
   // "meta" property
-  os << ",\n"
-     << " \"meta\": {\n"
-     << "  \"app\": \"" << get_app_url() << "\",\n"
-     << "  \"version\": \"" << get_app_version() << "\",\n";
+  w.key("meta");
+  w.beginObject();
+  w.field("app", get_app_url());
+  w.field("version", get_app_version());
 
   if (!m_textureFilename.empty())
-    os << "  \"image\": \""
-       << escape_for_json(base::get_file_name(m_textureFilename)).c_str()
-       << "\",\n";
+    w.field("image", base::get_file_name(m_textureFilename));
 
-  os << "  \"format\": \"" << (texture->pixelFormat() == IMAGE_RGB ? "RGBA8888": "I8") << "\",\n"
-     << "  \"size\": { "
-     << "\"w\": " << texture->width() << ", "
-     << "\"h\": " << texture->height() << " },\n"
-     << "  \"scale\": \"1\"";
+  w.field("format", (texture->pixelFormat() == IMAGE_RGB ? "RGBA8888": "I8"));
+
+  w.key("size");
+  w.beginObject(Layout::Inline);
+  w.field("w", texture->width());
+  w.field("h", texture->height());
+  w.endObject();
+
+  w.field("scale", "1");
+
+  // meta.packing (percentage of the texture used by the samples)
+  if (m_sheetType == SpriteSheetType::MaxRects) {
+    int64_t usedArea = 0;
+    for (const auto& sample : samples) {
+      if (sample.isLinked() ||
+          sample.isDuplicated() ||
+          sample.isEmpty())
+        continue;
+
+      const gfx::Rect& rc = sample.inTextureBounds();
+      usedArea += int64_t(rc.w) * rc.h;
+    }
+    const int64_t textureArea = int64_t(texture->width()) * texture->height();
+
+    w.key("packing");
+    w.beginObject(Layout::Inline);
+    w.field("method", sprite_sheet_packing_name(m_sheetPacking));
+    w.field("efficiency",
+            (textureArea > 0 ? double(usedArea) / double(textureArea): 0.0));
+    w.endObject();
+  }
 
   // meta.frameTags
   if (m_listTags) {
-    os << ",\n"
-       << "  \"frameTags\": ["; // TODO rename this someday in the future
+    w.key("frameTags");         // TODO rename this someday in the future
+    w.beginArray();
 
     std::set<doc::ObjectId> includedSprites;
 
-    bool firstTag = true;
     for (auto& item : m_documents) {
       Doc* doc = item.doc;
       Sprite* sprite = doc->sprite();
@@ -1327,18 +1771,15 @@ void DocExporter::createDataFile(const Samples& samples,
       includedSprites.insert(sprite->id());
 
       for (Tag* tag : sprite->tags()) {
-        if (firstTag)
-          firstTag = false;
-        else
-          os << ",";
-
-        os << "\n   { \"name\": \"" << escape_for_json(tag->name()) << "\","
-           << " \"from\": " << (tag->fromFrame()) << ","
-           << " \"to\": " << (tag->toFrame()) << ","
-           << " \"direction\": \"" << escape_for_json(convert_anidir_to_string(tag->aniDir())) << "\" }";
+        w.beginObject(Layout::Inline);
+        w.field("name", tag->name());
+        w.field("from", int(tag->fromFrame()));
+        w.field("to", int(tag->toFrame()));
+        w.field("direction", convert_anidir_to_string(tag->aniDir()));
+        w.endObject();
       }
     }
-    os << "\n  ]";
+    w.endArray();
   }
 
   // meta.layers
@@ -1377,24 +1818,20 @@ void DocExporter::createDataFile(const Samples& samples,
       }
     }
 
-    bool firstLayer = true;
-    os << ",\n"
-       << "  \"layers\": [";
+    w.key("layers");
+    w.beginArray();
     for (Layer* layer : metaLayers) {
-      if (firstLayer)
-        firstLayer = false;
-      else
-        os << ",";
-      os << "\n   { \"name\": \"" << escape_for_json(layer->name()) << "\"";
+      w.beginObject(Layout::Inline);
+      w.field("name", layer->name());
 
       if (layer->parent() != layer->sprite()->root())
-        os << ", \"group\": \"" << escape_for_json(layer->parent()->name()) << "\"";
+        w.field("group", layer->parent()->name());
 
       if (LayerImage* layerImg = dynamic_cast<LayerImage*>(layer)) {
-        os << ", \"opacity\": " << layerImg->opacity()
-           << ", \"blendMode\": \"" << blend_mode_to_string(layerImg->blendMode()) << "\"";
+        w.field("opacity", layerImg->opacity());
+        w.field("blendMode", blend_mode_to_string(layerImg->blendMode()));
       }
-      os << layer->userData();
+      write_user_data(w, layer->userData());
 
       // Cels
       CelList cels;
@@ -1408,37 +1845,31 @@ void DocExporter::createDataFile(const Samples& samples,
       }
 
       if (someCelWithData) {
-        bool firstCel = true;
-
-        os << ", \"cels\": [";
+        w.key("cels");
+        w.beginArray(Layout::Compact);
         for (const Cel* cel : cels) {
           if (!cel->data()->userData().isEmpty()) {
-            if (firstCel)
-              firstCel = false;
-            else
-              os << ", ";
-
-            os << "{ \"frame\": " << cel->frame()
-               << cel->data()->userData()
-               << " }";
+            w.beginObject(Layout::Inline);
+            w.field("frame", int(cel->frame()));
+            write_user_data(w, cel->data()->userData());
+            w.endObject();
           }
         }
-        os << "]";
+        w.endArray();
       }
 
-      os << " }";
+      w.endObject();
     }
-    os << "\n  ]";
+    w.endArray();
   }
 
   // meta.slices
   if (m_listSlices) {
-    os << ",\n"
-       << "  \"slices\": [";
+    w.key("slices");
+    w.beginArray();
 
     std::set<doc::ObjectId> includedSprites;
 
-    bool firstSlice = true;
     for (auto& item : m_documents) {
       Doc* doc = item.doc;
       Sprite* sprite = doc->sprite();
@@ -1454,59 +1885,292 @@ void DocExporter::createDataFile(const Samples& samples,
       // TODO add possibility to export some slices
 
       for (Slice* slice : sprite->slices()) {
-        if (firstSlice)
-          firstSlice = false;
-        else
-          os << ",";
-        os << "\n   { \"name\": \"" << escape_for_json(slice->name()) << "\""
-           << slice->userData();
+        w.beginObject(Layout::Inline);
+        w.field("name", slice->name());
+        write_user_data(w, slice->userData());
 
         // Keys
         if (!slice->empty()) {
-          bool firstKey = true;
-
-          os << ", \"keys\": [";
+          w.key("keys");
+          w.beginArray(Layout::Compact);
           for (const auto& key : *slice) {
-            if (firstKey)
-              firstKey = false;
-            else
-              os << ", ";
-
             const SliceKey* sliceKey = key.value();
 
-            os << "{ \"frame\": " << key.frame() << ", "
-               << "\"bounds\": {"
-               << "\"x\": " << sliceKey->bounds().x << ", "
-               << "\"y\": " << sliceKey->bounds().y << ", "
-               << "\"w\": " << sliceKey->bounds().w << ", "
-               << "\"h\": " << sliceKey->bounds().h << " }";
-
-            if (!sliceKey->center().isEmpty()) {
-              os << ", \"center\": {"
-                 << "\"x\": " << sliceKey->center().x << ", "
-                 << "\"y\": " << sliceKey->center().y << ", "
-                 << "\"w\": " << sliceKey->center().w << ", "
-                 << "\"h\": " << sliceKey->center().h << " }";
-            }
+            w.beginObject(Layout::Inline);
+            w.field("frame", int(key.frame()));
+            write_rect(w, "bounds", sliceKey->bounds());
+
+            if (!sliceKey->center().isEmpty())
+              write_rect(w, "center", sliceKey->center());
 
             if (sliceKey->hasPivot()) {
-              os << ", \"pivot\": {"
-                 << "\"x\": " << sliceKey->pivot().x << ", "
-                 << "\"y\": " << sliceKey->pivot().y << " }";
+              w.key("pivot");
+              w.beginObject(Layout::Inline);
+              w.field("x", sliceKey->pivot().x);
+              w.field("y", sliceKey->pivot().y);
+              w.endObject();
             }
 
-            os << " }";
+            w.endObject();
           }
-          os << "]";
+          w.endArray();
         }
-        os << " }";
+        w.endObject();
+      }
+    }
+    w.endArray();
+  }
+
+  w.endObject();                // meta
+  w.endObject();                // root
+
+  if (!w.flush()) {
+    Console console;
+    console.printf("Error writing the data file\n");
+  }
+}
+
+// Writes the data file only if its content is not the same of the
+// previous export (so its modification time is kept)
+void DocExporter::saveDataFileIfChanged(const std::string& data) const
+{
+  ASSERT(m_outputManifest);
+
+  OutputManifest::Hash hash;
+  hash.add(int(m_dataFormat));
+  hash.add(data);
+  if (m_outputManifest->isUnchanged(m_dataFilename, hash.value()))
+    return;
+
+  {
+    std::ofstream fos(FSTREAM_PATH(m_dataFilename), data_file_mode(m_dataFormat));
+    fos.write(data.c_str(), data.size());
+    if (!fos.good()) {
+      Console console;
+      console.printf("Error saving the data file \"%s\"\n",
+                     m_dataFilename.c_str());
+      return;
+    }
+  }
+  m_outputManifest->update(m_dataFilename, hash.value());
+}
+
+std::string DocExporter::cacheFilename() const
+{
+  if (!m_dataFilename.empty())
+    return DocExporterCache::getFilename(m_dataFilename);
+  else if (!m_textureFilename.empty())
+    return DocExporterCache::getFilename(m_textureFilename);
+  else
+    return std::string();
+}
+
+// Adds to the key everything that is used to render the given layer
+// (like the render::Render does).
+static void add_layer_to_cache_key(DocExporterCacheKey& key,
+                                   const Layer* layer,
+                                   const SelectedLayers* visibleLayers,
+                                   const frame_t frame)
+{
+  const bool visible =
+    (visibleLayers && layer->parent() ? visibleLayers->contains(layer):
+                                        layer->isVisible());
+  if (!visible || layer->isReference())
+    return;
+
+  if (layer->isGroup()) {
+    key.add(-1);
+    for (const Layer* child : static_cast<const LayerGroup*>(layer)->layers())
+      add_layer_to_cache_key(key, child, visibleLayers, frame);
+    key.add(-2);
+  }
+  else if (layer->isImage()) {
+    const LayerImage* imageLayer = static_cast<const LayerImage*>(layer);
+    key.add(int(imageLayer->blendMode()));
+    key.add(imageLayer->opacity());
+    key.add(imageLayer->isBackground());
+
+    const Cel* cel = layer->cel(frame);
+    if (!cel) {
+      key.add(0);
+      return;
+    }
+
+    const Image* image = cel->image();
+    key.add(cel->x());
+    key.add(cel->y());
+    key.add(cel->opacity());
+    key.add(int(image->pixelFormat()));
+    key.add(image->width());
+    key.add(image->height());
+    key.add(int(image->maskColor()));
+
+    const int rowBytes = image->getRowStrideSize();
+    for (int y=0; y<image->height(); ++y)
+      key.add(image->getPixelAddress(0, y), rowBytes);
+  }
+}
+
+uint64_t DocExporter::calcSampleKey(const Sample& sample,
+                                    const gfx::Rect& spriteBounds) const
+{
+  const Sprite* sprite = sample.sprite();
+  DocExporterCacheKey key;
+
+  // Options used to trim the sample
+  key.add(m_trimSprite);
+  key.add(m_trimCels);
+  key.add(m_trimByGrid);
+  key.add(m_ignoreEmptyCels);
+  key.add(spriteBounds.x);
+  key.add(spriteBounds.y);
+  key.add(spriteBounds.w);
+  key.add(spriteBounds.h);
+  if (m_trimByGrid) {
+    const gfx::Rect& gridBounds = sprite->gridBounds();
+    key.add(gridBounds.x);
+    key.add(gridBounds.y);
+    key.add(gridBounds.w);
+    key.add(gridBounds.h);
+  }
+
+  key.add(int(sprite->pixelFormat()));
+  key.add(sprite->width());
+  key.add(sprite->height());
+  key.add(int(sprite->transparentColor()));
+  if (sprite->pixelFormat() == IMAGE_INDEXED) {
+    const Palette* palette = sprite->palette(sample.frame());
+    key.add(palette->size());
+    for (int i=0; i<palette->size(); ++i)
+      key.add(int(palette->getEntry(i)));
+  }
+
+  SelectedLayers visibleLayers;
+  if (sample.selectedLayers()) {
+    visibleLayers = *sample.selectedLayers();
+    visibleLayers.propagateSelection();
+  }
+  add_layer_to_cache_key(key, sprite->root(),
+                         (sample.selectedLayers() ? &visibleLayers: nullptr),
+                         sample.frame());
+  return key.value();
+}
+
+uint64_t DocExporter::calcLayoutKey(const Samples& samples) const
+{
+  DocExporterCacheKey key;
+  key.add(int(m_sheetType));
+  key.add(int(m_sheetPacking));
+  key.add(m_textureWidth);
+  key.add(m_textureHeight);
+  key.add(m_textureColumns);
+  key.add(m_textureRows);
+  key.add(m_borderPadding);
+  key.add(m_shapePadding);
+  key.add(m_innerPadding);
+  key.add(m_extrude);
+  key.add(m_splitLayers);
+  key.add(m_splitTags);
+  key.add(m_mergeDuplicates);
+  key.add(samples.size());
+
+  // If duplicated samples are merged, the layout depends on the
+  // content of the samples too
+  const bool mergeDups = (m_mergeDuplicates ||
+                          m_sheetType == SpriteSheetType::Packed ||
+                          m_sheetType == SpriteSheetType::MaxRects);
+
+  const Sample* prev = nullptr;
+  for (const auto& sample : samples) {
+    if (mergeDups && !sample.isLinked()) {
+      const uint64_t sampleKey = sample.cacheKey();
+      if (!sampleKey)
+        return 0;
+      key.add(&sampleKey, sizeof(sampleKey));
+    }
+
+    const gfx::Size size = sample.requiredSize();
+    key.add(sample.isLinked());
+    key.add(sample.isEmpty());
+    key.add(size.w);
+    key.add(size.h);
+
+    // Changes of sprite/layer/tag create new rows/columns in the
+    // SimpleLayoutSamples
+    if (prev) {
+      key.add(sample.sprite() != prev->sprite());
+      key.add(sample.layer() != prev->layer());
+      key.add(sample.tag() != prev->tag());
+    }
+    prev = &sample;
+  }
+  return key.value();
+}
+
+bool DocExporter::loadCachedLayout(Samples& samples) const
+{
+  const DocExporterCache::Layout* layout =
+    m_exportCache->findLayout(calcLayoutKey(samples));
+  if (!layout ||
+      int(layout->bounds.size()) != samples.size() ||
+      int(layout->sharedWith.size()) != samples.size())
+    return false;
+
+  // Validate the layout before modifying the samples
+  int i = 0;
+  for (const auto& sample : samples) {
+    const int j = layout->sharedWith[i];
+    if (!sample.isLinked() && !sample.isEmpty() &&
+        (j >= i || (j < 0 && layout->bounds[i].isEmpty())))
+      return false;
+    ++i;
+  }
+
+  i = 0;
+  for (auto& sample : samples) {
+    const int j = layout->sharedWith[i];
+    if (!sample.isLinked() && !sample.isEmpty()) {
+      if (j >= 0) {
+        sample.setDuplicated();
+        sample.setSharedBounds(samples[j].sharedBounds());
       }
+      else
+        sample.setInTextureBounds(layout->bounds[i]);
     }
-    os << "\n  ]";
+    ++i;
+  }
+
+  DX_TRACE("DX: Layout loaded from cache");
+  return true;
+}
+
+void DocExporter::saveCachedLayout(const Samples& samples) const
+{
+  DocExporterCache::Layout layout;
+  std::map<const gfx::Rect*, int> owners;
+
+  int i = 0;
+  for (const auto& sample : samples) {
+    gfx::Rect bounds;
+    int sharedWith = -1;
+    if (!sample.isLinked() && !sample.isEmpty()) {
+      if (sample.isDuplicated()) {
+        auto it = owners.find(sample.sharedBounds().get());
+        if (it == owners.end())
+          return;
+        sharedWith = it->second;
+      }
+      else {
+        owners[sample.sharedBounds().get()] = i;
+        bounds = sample.inTextureBounds();
+      }
+    }
+    layout.bounds.push_back(bounds);
+    layout.sharedWith.push_back(sharedWith);
+    ++i;
   }
 
-  os << "\n }\n"
-     << "}\n";
+  m_exportCache->setLayout(calcLayoutKey(samples), layout);
 }
 
 } // namespace app
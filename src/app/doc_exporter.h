@@ -10,6 +10,7 @@
 #pragma once
 
 #include "app/sprite_sheet_data_format.h"
+#include "app/sprite_sheet_packing.h"
 #include "app/sprite_sheet_type.h"
 #include "base/disable_copying.h"
 #include "base/task.h"
@@ -20,6 +21,7 @@
 #include "gfx/fwd.h"
 #include "gfx/rect.h"
 
+#include <cstdint>
 #include <iosfwd>
 #include <string>
 #include <utility>
@@ -37,6 +39,8 @@ namespace app {
 
   class Context;
   class Doc;
+  class DocExporterCache;
+  class OutputManifest;
 
   class DocExporter {
   public:
@@ -49,6 +53,7 @@ namespace app {
     const std::string& dataFilename() { return m_dataFilename; }
     const std::string& textureFilename() { return m_textureFilename; }
     SpriteSheetType spriteSheetType() { return m_sheetType; }
+    SpriteSheetPacking spriteSheetPacking() const { return m_sheetPacking; }
     const std::string& filenameFormat() const { return m_filenameFormat; }
 
     void setDataFormat(SpriteSheetDataFormat format) { m_dataFormat = format; }
@@ -59,6 +64,7 @@ namespace app {
     void setTextureColumns(int columns) { m_textureColumns = columns; }
     void setTextureRows(int rows) { m_textureRows = rows; }
     void setSpriteSheetType(SpriteSheetType type) { m_sheetType = type; }
+    void setSpriteSheetPacking(SpriteSheetPacking packing) { m_sheetPacking = packing; }
     void setIgnoreEmptyCels(bool ignore) { m_ignoreEmptyCels = ignore; }
     void setMergeDuplicates(bool merge) { m_mergeDuplicates = merge; }
     void setBorderPadding(int padding) { m_borderPadding = padding; }
@@ -75,6 +81,18 @@ namespace app {
     void setListLayers(bool value) { m_listLayers = value; }
     void setListSlices(bool value) { m_listSlices = value; }
 
+    // Re-uses the samples of the previous export (see DocExporterCache)
+    void setUseCache(bool value) { m_useCache = value; }
+
+    // Re-uses the samples and layout of the previous exports from a
+    // cache in memory kept by the caller (e.g. the previews of the
+    // Export Sprite Sheet dialog). It has priority over setUseCache().
+    void setMemoryCache(DocExporterCache* cache) { m_memoryCache = cache; }
+
+    // Doesn't save the texture/data files if their content is the
+    // same of the previous export (see OutputManifest)
+    void setOutputManifest(OutputManifest* manifest) { m_outputManifest = manifest; }
+
     void addDocument(
       Doc* doc,
       const doc::Tag* tag,
@@ -98,6 +116,7 @@ namespace app {
     class LayoutSamples;
     class SimpleLayoutSamples;
     class BestFitLayoutSamples;
+    class MaxRectsLayoutSamples;
 
     void captureSamples(Samples& samples,
                         base::task_token& token);
@@ -113,6 +132,13 @@ namespace app {
                        base::task_token& token) const;
     void trimTexture(const Samples& samples, doc::Sprite* texture) const;
     void createDataFile(const Samples& samples, std::ostream& os, doc::Sprite* texture);
+    std::string cacheFilename() const;
+    void saveDataFileIfChanged(const std::string& data) const;
+    uint64_t calcSampleKey(const Sample& sample,
+                           const gfx::Rect& spriteBounds) const;
+    uint64_t calcLayoutKey(const Samples& samples) const;
+    bool loadCachedLayout(Samples& samples) const;
+    void saveCachedLayout(const Samples& samples) const;
 
     class Item {
     public:
@@ -138,6 +164,7 @@ namespace app {
     typedef std::vector<Item> Items;
 
     SpriteSheetType m_sheetType;
+    SpriteSheetPacking m_sheetPacking;
     SpriteSheetDataFormat m_dataFormat;
     std::string m_dataFilename;
     std::string m_textureFilename;
@@ -160,8 +187,15 @@ namespace app {
     bool m_listTags;
     bool m_listLayers;
     bool m_listSlices;
+    bool m_useCache;
     Items m_documents;
 
+    // Cache used in the current exportSheet() call (or nullptr)
+    DocExporterCache* m_exportCache;
+    DocExporterCache* m_memoryCache;
+
+    OutputManifest* m_outputManifest;
+
     // Buffers used
     doc::ImageBufferPtr m_docBuf;
     doc::ImageBufferPtr m_sampleBuf;
@@ -0,0 +1,250 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/doc_exporter_cache.h"
+
+#include "base/buffer.h"
+#include "base/fstream_path.h"
+#include "base/serialization.h"
+#include "doc/image.h"
+#include "zlib.h"
+
+#include <algorithm>
+#include <fstream>
+
+namespace app {
+
+using namespace base::serialization;
+using namespace base::serialization::little_endian;
+
+namespace {
+
+const uint32_t kCacheMagic = 0x43584441; // "ADXC"
+const uint32_t kCacheVersion = 1;
+
+// Flags of each sample in the file
+const uint8_t kSampleTrimmed = 1;
+const uint8_t kSampleIgnored = 2;
+const uint8_t kSampleRender = 4;
+
+void write64(std::ostream& os, const uint64_t value)
+{
+  write32(os, uint32_t(value));
+  write32(os, uint32_t(value >> 32));
+}
+
+uint64_t read64(std::istream& is)
+{
+  const uint64_t lo = read32(is);
+  const uint64_t hi = read32(is);
+  return (lo | (hi << 32));
+}
+
+void write_rect(std::ostream& os, const gfx::Rect& rc)
+{
+  write32(os, rc.x);
+  write32(os, rc.y);
+  write32(os, rc.w);
+  write32(os, rc.h);
+}
+
+gfx::Rect read_rect(std::istream& is)
+{
+  gfx::Rect rc;
+  rc.x = int32_t(read32(is));
+  rc.y = int32_t(read32(is));
+  rc.w = int32_t(read32(is));
+  rc.h = int32_t(read32(is));
+  return rc;
+}
+
+void write_image(std::ostream& os, const doc::Image* image)
+{
+  const int rowBytes = image->getRowStrideSize();
+  base::buffer raw(rowBytes * image->height());
+  for (int y=0; y<image->height(); ++y)
+    std::copy(image->getPixelAddress(0, y),
+              image->getPixelAddress(0, y) + rowBytes,
+              &raw[y*rowBytes]);
+
+  uLongf len = compressBound(uLong(raw.size()));
+  base::buffer compressed(len);
+  if (compress2((Bytef*)&compressed[0], &len,
+                (const Bytef*)&raw[0], uLong(raw.size()),
+                Z_BEST_SPEED) != Z_OK)
+    len = 0;
+
+  write8(os, uint8_t(image->pixelFormat()));
+  write32(os, image->width());
+  write32(os, image->height());
+  write32(os, uint32_t(raw.size()));
+  write32(os, uint32_t(len));
+  os.write((const char*)&compressed[0], len);
+}
+
+doc::ImageRef read_image(std::istream& is)
+{
+  const auto pixelFormat = doc::PixelFormat(read8(is));
+  const int w = int(read32(is));
+  const int h = int(read32(is));
+  const uint32_t rawSize = read32(is);
+  const uint32_t compressedSize = read32(is);
+  if (!is ||
+      (pixelFormat != doc::IMAGE_RGB &&
+       pixelFormat != doc::IMAGE_GRAYSCALE &&
+       pixelFormat != doc::IMAGE_INDEXED) ||
+      w <= 0 || h <= 0 || compressedSize == 0)
+    return nullptr;
+
+  base::buffer compressed(compressedSize);
+  if (!is.read((char*)&compressed[0], compressedSize))
+    return nullptr;
+
+  doc::ImageRef image(doc::Image::create(pixelFormat, w, h));
+  const int rowBytes = image->getRowStrideSize();
+  if (rawSize != uint32_t(rowBytes * h))
+    return nullptr;
+
+  base::buffer raw(rawSize);
+  uLongf len = uLongf(rawSize);
+  if (uncompress((Bytef*)&raw[0], &len,
+                 (const Bytef*)&compressed[0], uLong(compressedSize)) != Z_OK ||
+      len != rawSize)
+    return nullptr;
+
+  for (int y=0; y<h; ++y)
+    std::copy(&raw[y*rowBytes],
+              &raw[y*rowBytes] + rowBytes,
+              image->getPixelAddress(0, y));
+  return image;
+}
+
+} // anonymous namespace
+
+void DocExporterCache::load(const std::string& filename)
+{
+  std::ifstream f(FSTREAM_PATH(filename), std::ifstream::binary);
+  if (!f ||
+      read32(f) != kCacheMagic ||
+      read32(f) != kCacheVersion)
+    return;
+
+  std::map<uint64_t, Sample> samples;
+  const uint32_t nsamples = read32(f);
+  for (uint32_t i=0; i<nsamples && f; ++i) {
+    const uint64_t key = read64(f);
+    const uint8_t flags = read8(f);
+    Sample sample;
+    sample.trimmedBounds = read_rect(f);
+    sample.trimmed = (flags & kSampleTrimmed ? true: false);
+    sample.ignored = (flags & kSampleIgnored ? true: false);
+    if (flags & kSampleRender) {
+      sample.render = read_image(f);
+      if (!sample.render)
+        return;
+    }
+    if (!sample.ignored && sample.trimmedBounds.isEmpty())
+      return;
+    samples[key] = sample;
+  }
+
+  Layout layout;
+  const uint64_t layoutKey = read64(f);
+  const uint32_t nbounds = read32(f);
+  for (uint32_t i=0; i<nbounds && f; ++i) {
+    layout.bounds.push_back(read_rect(f));
+    layout.sharedWith.push_back(int32_t(read32(f)));
+  }
+  if (!f)
+    return;
+
+  m_oldSamples = std::move(samples);
+  m_oldLayoutKey = layoutKey;
+  m_oldLayout = std::move(layout);
+}
+
+bool DocExporterCache::save(const std::string& filename) const
+{
+  std::ofstream f(FSTREAM_PATH(filename), std::ofstream::binary);
+  if (!f)
+    return false;
+
+  write32(f, kCacheMagic);
+  write32(f, kCacheVersion);
+
+  write32(f, uint32_t(m_newSamples.size()));
+  for (const auto& it : m_newSamples) {
+    const Sample& sample = it.second;
+    write64(f, it.first);
+    write8(f, (sample.trimmed ? kSampleTrimmed: 0) |
+              (sample.ignored ? kSampleIgnored: 0) |
+              (sample.render ? kSampleRender: 0));
+    write_rect(f, sample.trimmedBounds);
+    if (sample.render)
+      write_image(f, sample.render.get());
+  }
+
+  write64(f, m_newLayoutKey);
+  write32(f, uint32_t(m_newLayout.bounds.size()));
+  for (std::size_t i=0; i<m_newLayout.bounds.size(); ++i) {
+    write_rect(f, m_newLayout.bounds[i]);
+    write32(f, uint32_t(m_newLayout.sharedWith[i]));
+  }
+  return f.good();
+}
+
+void DocExporterCache::startNewExport()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (auto& it : m_newSamples)
+    m_oldSamples[it.first] = std::move(it.second);
+  m_newSamples.clear();
+
+  if (m_newLayoutKey) {
+    m_oldLayoutKey = m_newLayoutKey;
+    m_oldLayout = std::move(m_newLayout);
+    m_newLayoutKey = 0;
+    m_newLayout = Layout();
+  }
+}
+
+bool DocExporterCache::findSample(const uint64_t key, Sample& sample)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_oldSamples.find(key);
+  if (it == m_oldSamples.end())
+    return false;
+
+  sample = it->second;
+  m_newSamples[key] = sample;   // Keep it for the next export
+  return true;
+}
+
+void DocExporterCache::addSample(const uint64_t key, const Sample& sample)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_newSamples[key] = sample;
+}
+
+const DocExporterCache::Layout* DocExporterCache::findLayout(const uint64_t key) const
+{
+  if (key && key == m_oldLayoutKey)
+    return &m_oldLayout;
+  else
+    return nullptr;
+}
+
+void DocExporterCache::setLayout(const uint64_t key, const Layout& layout)
+{
+  m_newLayoutKey = key;
+  m_newLayout = layout;
+}
+
+} // namespace app
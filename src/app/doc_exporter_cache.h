@@ -0,0 +1,106 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_DOC_EXPORTER_CACHE_H_INCLUDED
+#define APP_DOC_EXPORTER_CACHE_H_INCLUDED
+#pragma once
+
+#include "doc/image_ref.h"
+#include "gfx/rect.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace app {
+
+  // FNV-1a hash (64-bit) used to create the keys of the
+  // DocExporterCache.
+  class DocExporterCacheKey {
+  public:
+    void add(const void* data, const std::size_t size) {
+      auto p = (const uint8_t*)data;
+      for (std::size_t i=0; i<size; ++i) {
+        m_value ^= p[i];
+        m_value *= 1099511628211ull;
+      }
+    }
+
+    void add(const int value) {
+      add(&value, sizeof(value));
+    }
+
+    uint64_t value() const {
+      // Zero is used as "no key"
+      return (m_value ? m_value: 1);
+    }
+
+  private:
+    uint64_t m_value = 14695981039346656037ull;
+  };
+
+  // Persistent cache of a sprite sheet export. It's saved in a
+  // sidecar file of the data file, so the next export can re-use the
+  // trimmed bounds and rendered pixels of the samples that didn't
+  // change, and the whole layout if the geometry of the samples is
+  // the same.
+  class DocExporterCache {
+  public:
+    struct Sample {
+      gfx::Rect trimmedBounds;
+      bool trimmed = false;     // Bounds were trimmed with the cels content
+      bool ignored = false;     // Ignored empty sample
+      doc::ImageRef render;     // Pixels of the trimmed bounds (or nullptr)
+    };
+
+    struct Layout {
+      // Bounds in the texture of each sample
+      std::vector<gfx::Rect> bounds;
+      // Index of the sample with the same bounds for duplicated
+      // samples, or -1
+      std::vector<int> sharedWith;
+    };
+
+    static std::string getFilename(const std::string& dataFilename) {
+      return dataFilename + ".cache";
+    }
+
+    // Errors reading the file are ignored (the cache is just empty)
+    void load(const std::string& filename);
+
+    // Saves only the samples that were used (found or added) in this
+    // export and the new layout.
+    bool save(const std::string& filename) const;
+
+    // Used when the cache is kept in memory between exports, the
+    // samples and layout of the previous export can be found in the
+    // new one. Samples of a canceled export are kept too.
+    void startNewExport();
+
+    // These functions can be called from several threads at the
+    // same time.
+    bool findSample(const uint64_t key, Sample& sample);
+    void addSample(const uint64_t key, const Sample& sample);
+
+    const Layout* findLayout(const uint64_t key) const;
+    void setLayout(const uint64_t key, const Layout& layout);
+
+  private:
+    std::mutex m_mutex;
+    std::map<uint64_t, Sample> m_oldSamples;
+    std::map<uint64_t, Sample> m_newSamples;
+    uint64_t m_oldLayoutKey = 0;
+    uint64_t m_newLayoutKey = 0;
+    Layout m_oldLayout;
+    Layout m_newLayout;
+  };
+
+} // namespace app
+
+#endif
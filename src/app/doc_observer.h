@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -9,14 +9,53 @@
 #define APP_DOC_OBSERVER_H_INCLUDED
 #pragma once
 
+#include <cstdint>
+
 namespace app {
   class Doc;
   class DocEvent;
 
+  // Groups of DocObserver events. An observer only receives the events
+  // of the groups specified with DocObserver::setDocEvents() (all by
+  // default), except onCloseDocument(), onFileNameChanged() and
+  // onGeneralUpdate() which are received by all observers.
+  enum DocEvents : uint32_t {
+    kDocSpriteEvents    = 1,    // Sprite properties, palette, total frames
+    kDocLayerEvents     = 2,
+    kDocFrameEvents     = 4,
+    kDocCelEvents       = 8,
+    kDocPixelEvents     = 16,
+    kDocSelectionEvents = 32,
+    kDocTagEvents       = 64,
+    kDocSliceEvents     = 128,
+    kAllDocEvents       = 255
+  };
+
+  // Group of each DocObserver event (see the specializations below)
+  template<auto Method>
+  struct DocEventGroup {
+    static constexpr uint32_t value = 0;
+  };
+
+  // Argument type of each DocObserver event
+  template<typename Method>
+  struct DocEventArg;
+
   class DocObserver {
   public:
     virtual ~DocObserver() { }
 
+    uint32_t docEvents() const { return m_docEvents; }
+
+    // Calls the given event handler if this observer is subscribed to
+    // the group of the event (used by Doc::notify()).
+    template<auto Method>
+    void notifyDocEvent(typename DocEventArg<decltype(Method)>::type arg) {
+      constexpr uint32_t group = DocEventGroup<Method>::value;
+      if (group == 0 || (m_docEvents & group) != 0)
+        (this->*Method)(arg);
+    }
+
     virtual void onCloseDocument(Doc* doc) { }
     virtual void onFileNameChanged(Doc* doc) { }
 
@@ -56,6 +95,10 @@ namespace app {
     virtual void onLayerRestacked(DocEvent& ev) { }
     virtual void onLayerMergedDown(DocEvent& ev) { }
 
+    // The visible/editable flags of several layers (ev.layers()) were
+    // changed at the same time (e.g. showing/hiding all layers).
+    virtual void onLayersFlagsChange(DocEvent& ev) { }
+
     virtual void onCelMoved(DocEvent& ev) { }
     virtual void onCelCopied(DocEvent& ev) { }
     virtual void onCelFrameChanged(DocEvent& ev) { }
@@ -81,8 +124,74 @@ namespace app {
     // Slices
     virtual void onSliceNameChange(DocEvent& ev) { }
 
+  protected:
+    // Must be called before adding the observer to a document.
+    void setDocEvents(const uint32_t events) { m_docEvents = events; }
+
+  private:
+    uint32_t m_docEvents = kAllDocEvents;
+  };
+
+  template<typename Arg>
+  struct DocEventArg<void (DocObserver::*)(Arg)> {
+    using type = Arg;
   };
 
+#define APP_DOC_EVENT_GROUP(method, group)                 \
+  template<>                                                \
+  struct DocEventGroup<&DocObserver::method> {              \
+    static constexpr uint32_t value = group;                \
+  };
+
+  APP_DOC_EVENT_GROUP(onColorSpaceChanged, kDocSpriteEvents)
+  APP_DOC_EVENT_GROUP(onPixelFormatChanged, kDocSpriteEvents)
+  APP_DOC_EVENT_GROUP(onPaletteChanged, kDocSpriteEvents)
+  APP_DOC_EVENT_GROUP(onSpriteSizeChanged, kDocSpriteEvents)
+  APP_DOC_EVENT_GROUP(onSpriteTransparentColorChanged, kDocSpriteEvents)
+  APP_DOC_EVENT_GROUP(onSpritePixelRatioChanged, kDocSpriteEvents)
+  APP_DOC_EVENT_GROUP(onSpriteGridBoundsChanged, kDocSpriteEvents)
+  APP_DOC_EVENT_GROUP(onTotalFramesChanged, kDocSpriteEvents)
+
+  APP_DOC_EVENT_GROUP(onAddLayer, kDocLayerEvents)
+  APP_DOC_EVENT_GROUP(onBeforeRemoveLayer, kDocLayerEvents)
+  APP_DOC_EVENT_GROUP(onAfterRemoveLayer, kDocLayerEvents)
+  APP_DOC_EVENT_GROUP(onLayerNameChange, kDocLayerEvents)
+  APP_DOC_EVENT_GROUP(onLayerOpacityChange, kDocLayerEvents)
+  APP_DOC_EVENT_GROUP(onLayerBlendModeChange, kDocLayerEvents)
+  APP_DOC_EVENT_GROUP(onLayerRestacked, kDocLayerEvents)
+  APP_DOC_EVENT_GROUP(onLayerMergedDown, kDocLayerEvents)
+  APP_DOC_EVENT_GROUP(onLayersFlagsChange, kDocLayerEvents)
+
+  APP_DOC_EVENT_GROUP(onAddFrame, kDocFrameEvents)
+  APP_DOC_EVENT_GROUP(onRemoveFrame, kDocFrameEvents)
+  APP_DOC_EVENT_GROUP(onFrameDurationChanged, kDocFrameEvents)
+
+  APP_DOC_EVENT_GROUP(onAddCel, kDocCelEvents)
+  APP_DOC_EVENT_GROUP(onBeforeRemoveCel, kDocCelEvents)
+  APP_DOC_EVENT_GROUP(onAfterRemoveCel, kDocCelEvents)
+  APP_DOC_EVENT_GROUP(onCelMoved, kDocCelEvents)
+  APP_DOC_EVENT_GROUP(onCelCopied, kDocCelEvents)
+  APP_DOC_EVENT_GROUP(onCelFrameChanged, kDocCelEvents)
+  APP_DOC_EVENT_GROUP(onCelPositionChanged, kDocCelEvents)
+  APP_DOC_EVENT_GROUP(onCelOpacityChange, kDocCelEvents)
+
+  APP_DOC_EVENT_GROUP(onImagePixelsModified, kDocPixelEvents)
+  APP_DOC_EVENT_GROUP(onSpritePixelsModified, kDocPixelEvents)
+  APP_DOC_EVENT_GROUP(onExposeSpritePixels, kDocPixelEvents)
+
+  APP_DOC_EVENT_GROUP(onSelectionChanged, kDocSelectionEvents)
+  APP_DOC_EVENT_GROUP(onSelectionBoundariesChanged, kDocSelectionEvents)
+
+  APP_DOC_EVENT_GROUP(onAddTag, kDocTagEvents)
+  APP_DOC_EVENT_GROUP(onRemoveTag, kDocTagEvents)
+  APP_DOC_EVENT_GROUP(onTagChange, kDocTagEvents)
+
+  APP_DOC_EVENT_GROUP(onAddSlice, kDocSliceEvents)
+  APP_DOC_EVENT_GROUP(onRemoveSlice, kDocSliceEvents)
+  APP_DOC_EVENT_GROUP(onSliceNameChange, kDocSliceEvents)
+
+#undef APP_DOC_EVENT_GROUP
+
 } // namespace app
 
 #endif
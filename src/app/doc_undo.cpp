@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -11,9 +12,11 @@
 #include "app/doc_undo.h"
 
 #include "app/app.h"
+#include "app/cache_manager.h"
 #include "app/cmd.h"
 #include "app/cmd_transaction.h"
 #include "app/context.h"
+#include "app/doc.h"
 #include "app/doc_undo_observer.h"
 #include "app/pref/preferences.h"
 #include "base/mem_utils.h"
@@ -28,10 +31,16 @@
 
 namespace app {
 
-DocUndo::DocUndo()
+// Number of latest undo states that keep their data uncompressed
+// (so they can be undone/redone instantly).
+static constexpr int kRawUndoStates = 4;
+
+DocUndo::DocUndo(Doc* doc)
   : m_undoHistory(this)
+  , m_doc(doc)
   , m_ctx(nullptr)
   , m_totalUndoSize(0)
+  , m_stateVersion(0)
   , m_savedCounter(0)
   , m_savedStateIsLost(false)
 {
@@ -57,7 +66,20 @@ void DocUndo::add(CmdTransaction* cmd)
   }
 
   m_undoHistory.add(cmd);
+  ++m_stateVersion;
   m_totalUndoSize += cmd->memSize();
+  if (m_doc)
+    m_doc->updateMemoryUsage();
+
+  // Compress the undo data of the state that is not one of the
+  // latest states anymore.
+  {
+    const undo::UndoState* state = m_undoHistory.currentState();
+    for (int i=0; state && i<kRawUndoStates; ++i)
+      state = state->prev();
+    if (state)
+      STATE_CMD(state)->compressUndoData();
+  }
 
   notify_observers(&DocUndoObserver::onAddUndoState, this);
   notify_observers(&DocUndoObserver::onTotalUndoSizeChange, this);
@@ -69,6 +91,10 @@ void DocUndo::add(CmdTransaction* cmd)
 
     // If undo limit is 0, it means "no limit", so we ignore the
     // complete logic to discard undo states.
+    if (undoLimitSize > 0 &&
+        m_totalUndoSize > undoLimitSize)
+      spillOldStates(undoLimitSize);
+
     if (undoLimitSize > 0 &&
         m_totalUndoSize > undoLimitSize) {
       UNDO_TRACE("UNDO: Reducing undo history from %s to %s\n",
@@ -81,6 +107,44 @@ void DocUndo::add(CmdTransaction* cmd)
           break;
       }
     }
+
+    // Limit for the memory used by all documents (sprites + undo
+    // histories) and caches. Other documents are not locked, their
+    // memory usage is the one calculated with their own locks (in
+    // Doc::updateMemoryUsage()), and we can only discard undo states
+    // of this document.
+    const size_t totalLimitSize =
+      size_t(App::instance()->preferences().undo.totalSizeLimit())
+      * 1024 * 1024;
+    if (totalLimitSize > 0 && m_ctx) {
+      size_t otherSize = 0;
+      for (const Doc* doc : m_ctx->documents()) {
+        const Doc::MemoryUsage usage = doc->memoryUsage();
+        otherSize += (doc->undoHistory() == this ? usage.sprite:
+                                                   usage.total());
+      }
+
+      // Caches can use the memory that is not used by documents (they
+      // are reduced in the next CacheManager::collect() call from the
+      // UI thread)
+      const size_t docsSize = otherSize + m_totalUndoSize;
+      CacheManager::instance()->requestBudget(
+        totalLimitSize > docsSize ? totalLimitSize - docsSize: 0);
+
+      if (otherSize + m_totalUndoSize > totalLimitSize)
+        spillOldStates(totalLimitSize > otherSize ? totalLimitSize - otherSize: 0);
+
+      if (otherSize + m_totalUndoSize > totalLimitSize) {
+        UNDO_TRACE("UNDO: Reducing undo history to fit in total limit %s\n",
+                   base::get_pretty_memory_size(totalLimitSize).c_str());
+
+        while (m_undoHistory.firstState() &&
+               otherSize + m_totalUndoSize > totalLimitSize) {
+          if (!m_undoHistory.deleteFirstState())
+            break;
+        }
+      }
+    }
   }
 
   UNDO_TRACE("UNDO: New undo size %s\n",
@@ -106,9 +170,13 @@ void DocUndo::undo()
   m_totalUndoSize -= cmd->memSize();
   {
     m_undoHistory.undo();
+    ++m_stateVersion;
     notify_observers(&DocUndoObserver::onCurrentUndoStateChange, this);
   }
   m_totalUndoSize += cmd->memSize();
+  if (m_doc)
+    m_doc->updateMemoryUsage();
+  spillLoadedStates();
   if (m_totalUndoSize != oldSize)
     notify_observers(&DocUndoObserver::onTotalUndoSizeChange, this);
 }
@@ -122,13 +190,29 @@ void DocUndo::redo()
   m_totalUndoSize -= cmd->memSize();
   {
     m_undoHistory.redo();
+    ++m_stateVersion;
     notify_observers(&DocUndoObserver::onCurrentUndoStateChange, this);
   }
   m_totalUndoSize += cmd->memSize();
+  if (m_doc)
+    m_doc->updateMemoryUsage();
+  spillLoadedStates();
   if (m_totalUndoSize != oldSize)
     notify_observers(&DocUndoObserver::onTotalUndoSizeChange, this);
 }
 
+void DocUndo::prepareUndo(base::task_token& token)
+{
+  if (const undo::UndoState* state = nextUndo())
+    STATE_CMD(state)->prepareUndoData(token);
+}
+
+void DocUndo::prepareRedo(base::task_token& token)
+{
+  if (const undo::UndoState* state = nextRedo())
+    STATE_CMD(state)->prepareUndoData(token);
+}
+
 void DocUndo::clearRedo()
 {
   m_undoHistory.clearRedo();
@@ -217,18 +301,97 @@ Cmd* DocUndo::lastExecutedCmd() const
 void DocUndo::moveToState(const undo::UndoState* state)
 {
   m_undoHistory.moveTo(state);
+  ++m_stateVersion;
   notify_observers(&DocUndoObserver::onCurrentUndoStateChange, this);
+  if (m_doc)
+    m_doc->updateMemoryUsage();
 
   // Recalculate the total undo size
   size_t oldSize = m_totalUndoSize;
-  m_totalUndoSize = 0;
+  m_totalUndoSize = calcTotalUndoSize();
+  spillLoadedStates();
+  if (m_totalUndoSize != oldSize)
+    notify_observers(&DocUndoObserver::onTotalUndoSizeChange, this);
+}
+
+void DocUndo::spillOldStates(const size_t limitSize)
+{
+  // The background compression of old states could reduce the
+  // memory used by the history, so we recalculate the total size
+  // before moving states to disk.
+  m_totalUndoSize = calcTotalUndoSize();
+  if (m_totalUndoSize <= limitSize)
+    return;
+
+  // The states around the current one (the latest ones that can be
+  // undone and the next ones that can be redone) are never moved to
+  // disk. Even without a spill file, commands that keep removed
+  // layers/cels alive serialize them here to reduce the memory usage.
+  //
+  // All the other states are checked from the first one because
+  // spilled states can be loaded again in memory (e.g. after undoing
+  // them), and spilling an already spilled state does nothing.
+  const undo::UndoState* current = m_undoHistory.currentState();
+  const undo::UndoState* windowBegin = current;
+  const undo::UndoState* windowEnd = current;
+  if (current) {
+    for (int i=1; windowBegin->prev() && i<kRawUndoStates; ++i)
+      windowBegin = windowBegin->prev();
+  }
+  else {
+    windowBegin = windowEnd = m_undoHistory.firstState();
+  }
+  for (int i=0; windowEnd && windowEnd->next() && i<kRawUndoStates; ++i)
+    windowEnd = windowEnd->next();
+
+  bool inWindow = false;
+  for (const undo::UndoState* state = m_undoHistory.firstState();
+       state && m_totalUndoSize > limitSize;
+       state = state->next()) {
+    if (state == windowBegin)
+      inWindow = true;
+
+    if (!inWindow) {
+      Cmd* cmd = STATE_CMD(state);
+      const size_t oldSize = cmd->memSize();
+      cmd->spillUndoData();
+      m_totalUndoSize -= oldSize;
+      m_totalUndoSize += cmd->memSize();
+    }
+
+    if (state == windowEnd)
+      inWindow = false;
+  }
+
+  UNDO_TRACE("UNDO: Undo history in memory reduced to %s\n",
+             base::get_pretty_memory_size(m_totalUndoSize).c_str());
+}
+
+// Undo/redo load the data of spilled states in memory again, so we
+// have to move them to disk again if they are not near the current
+// state and the history is over the limit.
+void DocUndo::spillLoadedStates()
+{
+  if (!App::instance())
+    return;
+
+  const size_t undoLimitSize =
+    int(App::instance()->preferences().undo.sizeLimit())
+    * 1024 * 1024;
+  if (undoLimitSize > 0 &&
+      m_totalUndoSize > undoLimitSize)
+    spillOldStates(undoLimitSize);
+}
+
+size_t DocUndo::calcTotalUndoSize() const
+{
+  size_t size = 0;
   const undo::UndoState* s = m_undoHistory.firstState();
   while (s) {
-    m_totalUndoSize += STATE_CMD(s)->memSize();
+    size += STATE_CMD(s)->memSize();
     s = s->next();
   }
-  if (m_totalUndoSize != oldSize)
-    notify_observers(&DocUndoObserver::onTotalUndoSizeChange, this);
+  return size;
 }
 
 const undo::UndoState* DocUndo::nextUndo() const
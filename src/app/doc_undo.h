@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -14,24 +15,37 @@
 #include "obs/observable.h"
 #include "undo/undo_history.h"
 
+#include <atomic>
+#include <cstdint>
 #include <iosfwd>
 #include <string>
 
+namespace base {
+  class task_token;
+}
+
 namespace app {
   using namespace doc;
 
   class Cmd;
   class CmdTransaction;
   class Context;
+  class Doc;
   class DocUndoObserver;
 
   class DocUndo : public obs::observable<DocUndoObserver>,
                   public undo::UndoHistoryDelegate {
   public:
-    DocUndo();
+    explicit DocUndo(Doc* doc);
 
     size_t totalUndoSize() const { return m_totalUndoSize; }
 
+    // Number that changes each time the current undo state changes
+    // (a new state is added, undone, redone, etc.). Unlike
+    // UndoState pointers, it's never repeated (a deleted state can
+    // be reallocated in the same address).
+    uint64_t stateVersion() const { return m_stateVersion; }
+
     void setContext(Context* ctx);
 
     void add(CmdTransaction* cmd);
@@ -57,6 +71,11 @@ namespace app {
 
     Cmd* lastExecutedCmd() const;
 
+    // Loads the data needed to undo/redo the next state, it can be
+    // called from a background thread (the document must be locked).
+    void prepareUndo(base::task_token& token);
+    void prepareRedo(base::task_token& token);
+
     int* savedCounter() { return &m_savedCounter; }
 
     const undo::UndoState* firstState() const { return m_undoHistory.firstState(); }
@@ -65,6 +84,9 @@ namespace app {
     void moveToState(const undo::UndoState* state);
 
   private:
+    void spillOldStates(const size_t limitSize);
+    void spillLoadedStates();
+    size_t calcTotalUndoSize() const;
     const undo::UndoState* nextUndo() const;
     const undo::UndoState* nextRedo() const;
 
@@ -72,8 +94,13 @@ namespace app {
     void onDeleteUndoState(undo::UndoState* state) override;
 
     undo::UndoHistory m_undoHistory;
+    Doc* m_doc;
     Context* m_ctx;
-    size_t m_totalUndoSize;
+    // Atomic because it's read from other threads (Doc::memoryUsage())
+    std::atomic<size_t> m_totalUndoSize;
+
+    // See stateVersion()
+    uint64_t m_stateVersion;
 
     // This counter is equal to 0 if we are in the "saved state", i.e.
     // the document on memory is equal to the document on disk. This
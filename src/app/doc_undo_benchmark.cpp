@@ -0,0 +1,197 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/cmd/copy_region.h"
+#include "app/cmd/replace_image.h"
+#include "app/context.h"
+#include "app/doc.h"
+#include "app/doc_api.h"
+#include "app/doc_undo.h"
+#include "app/test_context.h"
+#include "app/tx.h"
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/image_bits.h"
+#include "doc/layer.h"
+#include "doc/primitives.h"
+#include "doc/sprite.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <memory>
+
+using namespace app;
+using namespace doc;
+
+namespace {
+
+// Document with a synthetic undo history of "ncmds" transactions
+// (strokes, cel moves, layer operations and filters).
+class UndoBenchmarkDoc {
+public:
+  UndoBenchmarkDoc(const int ncmds, const int size)
+    : m_doc(m_ctx.documents().add(size, size))
+    , m_sprite(m_doc->sprite())
+    , m_layer(static_cast<LayerImage*>(m_sprite->root()->firstLayer()))
+    , m_extraLayer(nullptr) {
+    std::srand(1);
+    for (int i=0; i<ncmds; ++i)
+      addCommand(i);
+  }
+
+  ~UndoBenchmarkDoc() {
+    m_doc->close();
+  }
+
+  Doc* doc() { return m_doc.get(); }
+  DocUndo* undo() { return m_doc->undoHistory(); }
+
+  // Executes one command (of a different kind in each call)
+  void addCommand(const int i) {
+    Tx tx(&m_ctx, "Benchmark");
+    DocApi api = m_doc->getApi(tx);
+    Cel* cel = m_layer->cel(0);
+    Image* image = cel->image();
+
+    switch (i % 4) {
+
+      // Stroke (like ExpandCelCanvas::commit() does)
+      case 0: {
+        const gfx::Rect rc(std::rand() % image->width(),
+                           std::rand() % image->height(),
+                           1 + std::rand() % 64,
+                           1 + std::rand() % 64);
+        ImageRef dst(Image::createCopy(image));
+        fill_rect(dst.get(), rc, rgba(std::rand() % 256, 0, 0, 255));
+        tx(new cmd::CopyRegion(image, dst.get(),
+                               gfx::Region(rc & image->bounds()),
+                               gfx::Point(0, 0)));
+        break;
+      }
+
+      case 1:
+        api.setCelPosition(m_sprite, cel,
+                           std::rand() % 16 - 8,
+                           std::rand() % 16 - 8);
+        break;
+
+      case 2:
+        if (m_extraLayer) {
+          api.removeLayer(m_extraLayer);
+          m_extraLayer = nullptr;
+        }
+        else
+          m_extraLayer = api.newLayer(m_sprite->root(), "Layer");
+        break;
+
+      // Filter applied to the whole cel image
+      case 3: {
+        ImageRef dst(Image::createCopy(image));
+        for (auto& c : LockImageBits<RgbTraits>(dst.get()))
+          c = rgba(255-rgba_getr(c), 255-rgba_getg(c), 255-rgba_getb(c), rgba_geta(c));
+        tx(new cmd::ReplaceImage(m_sprite, cel->imageRef(), dst));
+        break;
+      }
+    }
+    tx.commit();
+  }
+
+private:
+  TestContext m_ctx;
+  std::unique_ptr<Doc> m_doc;
+  Sprite* m_sprite;
+  LayerImage* m_layer;
+  LayerImage* m_extraLayer;
+};
+
+} // anonymous namespace
+
+// Executes the commands (includes the compression of old states)
+static void BM_UndoExecute(benchmark::State& state)
+{
+  const int ncmds = state.range(0);
+  const int size = state.range(1);
+  std::unique_ptr<UndoBenchmarkDoc> bdoc;
+  for (auto _ : state) {
+    state.PauseTiming();
+    bdoc.reset();
+    state.ResumeTiming();
+
+    bdoc = std::make_unique<UndoBenchmarkDoc>(ncmds, size);
+  }
+  state.SetItemsProcessed(state.iterations() * ncmds);
+  state.counters["undoSize"] = bdoc->undo()->totalUndoSize();
+}
+
+// Undoes the whole history and redoes it again
+static void BM_UndoRedo(benchmark::State& state)
+{
+  const int ncmds = state.range(0);
+  const int size = state.range(1);
+  UndoBenchmarkDoc bdoc(ncmds, size);
+  DocUndo* undo = bdoc.undo();
+  for (auto _ : state) {
+    while (undo->canUndo())
+      undo->undo();
+    while (undo->canRedo())
+      undo->redo();
+  }
+  state.SetItemsProcessed(state.iterations() * 2 * ncmds);
+  state.counters["undoSize"] = undo->totalUndoSize();
+}
+
+// Undoes and redoes only the latest state (the most common case)
+static void BM_UndoRedoLast(benchmark::State& state)
+{
+  const int ncmds = state.range(0);
+  const int size = state.range(1);
+  UndoBenchmarkDoc bdoc(ncmds, size);
+  DocUndo* undo = bdoc.undo();
+  for (auto _ : state) {
+    undo->undo();
+    undo->redo();
+  }
+  state.SetItemsProcessed(state.iterations() * 2);
+}
+
+// Deletes all the undo states (the same process used to discard
+// old states when the undo limit is reached)
+static void BM_UndoDeleteStates(benchmark::State& state)
+{
+  const int ncmds = state.range(0);
+  const int size = state.range(1);
+  std::unique_ptr<UndoBenchmarkDoc> bdoc;
+  for (auto _ : state) {
+    state.PauseTiming();
+    bdoc.reset();
+    bdoc = std::make_unique<UndoBenchmarkDoc>(ncmds, size);
+    DocUndo* undo = bdoc->undo();
+    while (undo->canUndo())
+      undo->undo();
+    state.ResumeTiming();
+
+    undo->clearRedo();
+  }
+  state.SetItemsProcessed(state.iterations() * ncmds);
+}
+
+#define UNDO_BENCHMARK_ARGS                     \
+  ->Args({ 1000, 256 })                         \
+  ->Args({ 4000, 256 })                         \
+  ->Args({ 250, 1024 })                         \
+  ->Unit(benchmark::kMillisecond)
+
+BENCHMARK(BM_UndoExecute) UNDO_BENCHMARK_ARGS;
+BENCHMARK(BM_UndoRedo) UNDO_BENCHMARK_ARGS;
+BENCHMARK(BM_UndoRedoLast) UNDO_BENCHMARK_ARGS;
+BENCHMARK(BM_UndoDeleteStates) UNDO_BENCHMARK_ARGS;
+
+BENCHMARK_MAIN();
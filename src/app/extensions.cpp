@@ -25,6 +25,7 @@
 #include "base/file_handle.h"
 #include "base/fs.h"
 #include "base/fstream_path.h"
+#include "base/time.h"
 #include "render/dithering_matrix.h"
 
 #ifdef ENABLE_SCRIPTING
@@ -36,6 +37,7 @@
 #include "archive_entry.h"
 #include "json11.hpp"
 
+#include <cstdio>
 #include <fstream>
 #include <queue>
 #include <sstream>
@@ -48,6 +50,8 @@ namespace {
 const char* kPackageJson = "package.json";
 const char* kInfoJson = "__info.json";
 const char* kPrefLua = "__pref.lua";
+const char* kCatalogJson = ".catalog.json";
+const int kCatalogVersion = 1;
 const char* kAsepriteDefaultThemeExtensionName = "aseprite-theme";
 
 class ReadArchive {
@@ -192,8 +196,96 @@ void write_json_file(const std::string& path, const json11::Json& json)
   out.write(text.c_str(), text.size());
 }
 
+std::string time_to_string(const base::Time& t)
+{
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d",
+                t.year, t.month, t.day, t.hour, t.minute, t.second);
+  return buf;
+}
+
 } // anonymous namespace
 
+//////////////////////////////////////////////////////////////////////
+// Extensions::Catalog
+
+// Parsed package.json files of all extensions from the last run
+// (saved in the user extensions directory). Each entry is reused if
+// the modification time of the extension directory and the
+// modification time and size of its package.json are the same, so
+// the startup scan doesn't have to open and parse each package.json
+// file again.
+class Extensions::Catalog {
+public:
+  Catalog(const std::string& filename)
+    : m_filename(filename)
+    , m_modified(false) {
+    if (m_filename.empty() || !base::is_file(m_filename))
+      return;
+
+    // A corrupted or old catalog is just ignored (and saved again)
+    json11::Json json;
+    try {
+      read_json_file(m_filename, json);
+    }
+    catch (const std::exception& ex) {
+      LOG("EXT: Ignoring extensions catalog: %s\n", ex.what());
+      return;
+    }
+    if (json["version"].int_value() == kCatalogVersion)
+      m_oldEntries = json["extensions"].object_items();
+  }
+
+  void readPackageJson(const std::string& path,
+                       const std::string& fullPackageFilename,
+                       json11::Json& json) {
+    json11::Json::object entry;
+    entry["dirTime"] = time_to_string(base::get_modification_time(path));
+    entry["time"] = time_to_string(base::get_modification_time(fullPackageFilename));
+    entry["size"] = double(base::file_size(fullPackageFilename));
+
+    auto it = m_oldEntries.find(fullPackageFilename);
+    if (it != m_oldEntries.end() &&
+        it->second["dirTime"] == entry["dirTime"] &&
+        it->second["time"] == entry["time"] &&
+        it->second["size"] == entry["size"] &&
+        it->second["package"].is_object()) {
+      json = it->second["package"];
+    }
+    else {
+      read_json_file(fullPackageFilename, json);
+      m_modified = true;
+    }
+
+    entry["package"] = json;
+    m_newEntries[fullPackageFilename] = json11::Json(entry);
+  }
+
+  // Saves the catalog if some package.json was changed, added or
+  // removed.
+  void save() {
+    if (m_filename.empty() ||
+        (!m_modified && m_oldEntries.size() == m_newEntries.size()))
+      return;
+
+    json11::Json::object obj;
+    obj["version"] = kCatalogVersion;
+    obj["extensions"] = json11::Json(m_newEntries);
+    try {
+      write_json_file(m_filename, json11::Json(obj));
+    }
+    catch (const std::exception& ex) {
+      LOG("EXT: Error saving extensions catalog: %s\n", ex.what());
+    }
+  }
+
+private:
+  std::string m_filename;
+  json11::Json::object m_oldEntries;
+  json11::Json::object m_newEntries;
+  bool m_modified;
+};
+
 //////////////////////////////////////////////////////////////////////
 // Extension
 
@@ -722,6 +814,19 @@ Extensions::Extensions()
     }
     LOG("EXT: User extensions path '%s'\n", m_userExtensionsPath.c_str());
   }
+}
+
+Extensions::~Extensions()
+{
+  for (auto ext : m_extensions)
+    delete ext;
+}
+
+void Extensions::loadExtensions()
+{
+  Catalog catalog(m_userExtensionsPath.empty() ? std::string():
+                  base::join_path(m_userExtensionsPath, kCatalogJson));
+  m_catalog = &catalog;
 
   ResourceFinder rf;
   rf.includeUserDir("extensions");
@@ -760,16 +865,14 @@ Extensions::Extensions()
       }
     }
   }
-}
 
-Extensions::~Extensions()
-{
-  for (auto ext : m_extensions)
-    delete ext;
+  m_catalog = nullptr;
+  catalog.save();
 }
 
 void Extensions::executeInitActions()
 {
+  ensureLoaded();
   for (auto& ext : m_extensions)
     ext->executeInitActions();
 
@@ -778,6 +881,7 @@ void Extensions::executeInitActions()
 
 void Extensions::executeExitActions()
 {
+  ensureLoaded();
   for (auto& ext : m_extensions)
     ext->executeExitActions();
 
@@ -786,6 +890,7 @@ void Extensions::executeExitActions()
 
 std::string Extensions::languagePath(const std::string& langId)
 {
+  ensureLoaded();
   for (auto ext : m_extensions) {
     if (!ext->isEnabled())      // Ignore disabled extensions
       continue;
@@ -799,6 +904,7 @@ std::string Extensions::languagePath(const std::string& langId)
 
 std::string Extensions::themePath(const std::string& themeId)
 {
+  ensureLoaded();
   for (auto ext : m_extensions) {
     if (!ext->isEnabled())      // Ignore disabled extensions
       continue;
@@ -812,6 +918,7 @@ std::string Extensions::themePath(const std::string& themeId)
 
 std::string Extensions::palettePath(const std::string& palId)
 {
+  ensureLoaded();
   for (auto ext : m_extensions) {
     if (!ext->isEnabled())      // Ignore disabled extensions
       continue;
@@ -825,6 +932,7 @@ std::string Extensions::palettePath(const std::string& palId)
 
 ExtensionItems Extensions::palettes() const
 {
+  ensureLoaded();
   ExtensionItems palettes;
   for (auto ext : m_extensions) {
     if (!ext->isEnabled())      // Ignore disabled themes
@@ -838,6 +946,7 @@ ExtensionItems Extensions::palettes() const
 
 const render::DitheringMatrix* Extensions::ditheringMatrix(const std::string& matrixId)
 {
+  ensureLoaded();
   for (auto ext : m_extensions) {
     if (!ext->isEnabled())      // Ignore disabled themes
       continue;
@@ -851,6 +960,7 @@ const render::DitheringMatrix* Extensions::ditheringMatrix(const std::string& ma
 
 std::vector<Extension::DitheringMatrixInfo> Extensions::ditheringMatrices()
 {
+  ensureLoaded();
   std::vector<Extension::DitheringMatrixInfo> result;
   for (auto ext : m_extensions) {
     if (!ext->isEnabled())      // Ignore disabled themes
@@ -864,6 +974,7 @@ std::vector<Extension::DitheringMatrixInfo> Extensions::ditheringMatrices()
 
 void Extensions::enableExtension(Extension* extension, const bool state)
 {
+  ensureLoaded();
   extension->enable(state);
   generateExtensionSignals(extension);
 }
@@ -871,6 +982,7 @@ void Extensions::enableExtension(Extension* extension, const bool state)
 void Extensions::uninstallExtension(Extension* extension,
                                     const DeletePluginPref delPref)
 {
+  ensureLoaded();
   extension->uninstall(delPref);
   generateExtensionSignals(extension);
 
@@ -932,6 +1044,10 @@ ExtensionInfo Extensions::getCompressedExtensionInfo(const std::string& zipFn)
 Extension* Extensions::installCompressedExtension(const std::string& zipFn,
                                                   const ExtensionInfo& info)
 {
+  // Load the installed extensions first (the new one is added to
+  // the list)
+  ensureLoaded();
+
   base::paths installedFiles;
 
   // Uncompress zipFn in info.dstPath
@@ -1015,7 +1131,10 @@ Extension* Extensions::loadExtension(const std::string& path,
                                      const bool isBuiltinExtension)
 {
   json11::Json json;
-  read_json_file(fullPackageFilename, json);
+  if (m_catalog)
+    m_catalog->readPackageJson(path, fullPackageFilename, json);
+  else
+    read_json_file(fullPackageFilename, json);
   auto name = json["name"].string_value();
   auto version = json["version"].string_value();
   auto displayName = json["displayName"].string_value();
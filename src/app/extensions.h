@@ -13,6 +13,7 @@
 #include "render/dithering_matrix.h"
 
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -160,6 +161,9 @@ namespace app {
     bool m_isBuiltinExtension;
   };
 
+  // The extensions are searched and their package.json files are
+  // parsed the first time they are needed (e.g. in batch mode they
+  // might not be needed at all).
   class Extensions {
   public:
     typedef std::vector<Extension*> List;
@@ -171,8 +175,8 @@ namespace app {
     void executeInitActions();
     void executeExitActions();
 
-    iterator begin() { return m_extensions.begin(); }
-    iterator end() { return m_extensions.end(); }
+    iterator begin() { ensureLoaded(); return m_extensions.begin(); }
+    iterator end() { ensureLoaded(); return m_extensions.end(); }
 
     void enableExtension(Extension* extension, const bool state);
     void uninstallExtension(Extension* extension,
@@ -197,6 +201,14 @@ namespace app {
     obs::signal<void(Extension*)> ScriptsChange;
 
   private:
+    class Catalog;
+
+    void ensureLoaded() const {
+      std::call_once(m_loaded, [this]{
+        const_cast<Extensions*>(this)->loadExtensions();
+      });
+    }
+    void loadExtensions();
     Extension* loadExtension(const std::string& path,
                              const std::string& fullPackageFilename,
                              const bool isBuiltinExtension);
@@ -204,6 +216,8 @@ namespace app {
 
     List m_extensions;
     std::string m_userExtensionsPath;
+    Catalog* m_catalog = nullptr;
+    mutable std::once_flag m_loaded;
   };
 
 } // namespace app
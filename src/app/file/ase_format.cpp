@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -11,6 +11,8 @@
 
 #include "app/context.h"
 #include "app/doc.h"
+#include "app/file/ase_options.h"
+#include "app/file/compressed_images.h"
 #include "app/file/file.h"
 #include "app/file/file_format.h"
 #include "app/file/format_options.h"
@@ -27,11 +29,17 @@
 #include "doc/doc.h"
 #include "fixmath/fixmath.h"
 #include "fmt/format.h"
+#include "render/render.h"
 #include "ui/alert.h"
 #include "ver/info.h"
 #include "zlib.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace app {
 
@@ -63,6 +71,24 @@ public:
     return m_fop->isOneFrame();
   }
 
+  bool decodeThumbnail() override {
+    return m_fop->isThumbnailOnly();
+  }
+
+  void onThumbnail(const doc::ImageRef& thumbnail) override {
+    m_fop->setEmbeddedThumbnail(thumbnail);
+  }
+
+  bool decodeCel(const doc::Layer* layer,
+                 const doc::frame_t frame) override {
+    return (m_fop->loadROI().containsFrame(frame) &&
+            m_fop->loadROI().containsLayer(layer));
+  }
+
+  gfx::Rect decodeBounds() override {
+    return m_fop->loadROI().bounds();
+  }
+
   doc::color_t defaultSliceColor() override {
     auto color = Preferences::instance().slices.defaultColor();
     return doc::rgba(color.getRed(),
@@ -71,19 +97,57 @@ public:
                      color.getAlpha());
   }
 
+  void onCompressedImage(const doc::Image* image,
+                         const uint8_t* bytes,
+                         const size_t size) override {
+    if (m_fop->isOneFrame())
+      return;
+
+    if (!m_compressedImages)
+      m_compressedImages = std::make_shared<CompressedImages>();
+
+    m_compressedImages->set(
+      image, CompressedImages::calculateHash(image),
+      std::make_shared<const std::vector<uint8_t>>(bytes, bytes+size));
+  }
+
   void onSprite(doc::Sprite* sprite) override {
     m_sprite = sprite;
   }
 
   doc::Sprite* sprite() { return m_sprite; }
+  const CompressedImagesPtr& compressedImages() const { return m_compressedImages; }
 
 private:
   FileOp* m_fop;
   doc::Sprite* m_sprite;
+  CompressedImagesPtr m_compressedImages;
 };
 
 } // anonymous namespace
 
+// Compressed pixels of a cel image and the hash of its pixels (see
+// CompressedImages::calculateHash()).
+struct CompressedCel {
+  uint64_t hash = 0;
+  CompressedImages::Data data;
+};
+
+// Compressed pixels of cel images to be written by
+// ase_file_write_cel_chunk(). They are compressed in parallel before
+// writing a group of frames (see ase_file_compress_cels()).
+struct CompressedCels {
+  // Compressed images from the last time the document was
+  // loaded/saved (can be nullptr), unmodified images are not
+  // compressed again.
+  CompressedImagesPtr prevImages;
+
+  // All the compressed images written in this file.
+  CompressedImagesPtr newImages;
+
+  std::unordered_map<const Cel*, CompressedCel> cels;
+};
+
 static void ase_file_prepare_header(FILE* f, dio::AsepriteHeader* header, const Sprite* sprite,
                                     const frame_t firstFrame, const frame_t totalFrames);
 static void ase_file_write_header(FILE* f, dio::AsepriteHeader* header);
@@ -97,7 +161,14 @@ static layer_t ase_file_write_cels(FILE* f, dio::AsepriteFrameHeader* frame_head
                                    const Sprite* sprite, const Layer* layer,
                                    layer_t layer_index,
                                    const frame_t frame,
-                                   const frame_t firstFrame);
+                                   const frame_t firstFrame,
+                                   const int compressionLevel,
+                                   CompressedCels& compressedCels);
+static int ase_file_compress_cels(const Sprite* sprite,
+                                  const std::vector<frame_t>& frames,
+                                  const int fromIndex,
+                                  const int compressionLevel,
+                                  CompressedCels& compressedCels);
 
 static void ase_file_write_padding(FILE* f, int bytes);
 static void ase_file_write_string(FILE* f, const std::string& string);
@@ -113,12 +184,56 @@ static void ase_file_write_cel_chunk(FILE* f, dio::AsepriteFrameHeader* frame_he
                                      const LayerImage* layer,
                                      const layer_t layer_index,
                                      const Sprite* sprite,
-                                     const frame_t firstFrame);
+                                     const frame_t firstFrame,
+                                     const int compressionLevel,
+                                     CompressedCels& compressedCels);
 static void ase_file_write_cel_extra_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header,
                                            const Cel* cel);
 static void ase_file_write_color_profile(FILE* f,
                                          dio::AsepriteFrameHeader* frame_header,
                                          const doc::Sprite* sprite);
+static void ase_file_write_thumbnail_chunk(FILE* f,
+                                           dio::AsepriteFrameHeader* frame_header,
+                                           const Sprite* sprite,
+                                           const frame_t frame,
+                                           const int compressionLevel);
+static void ase_file_write_thumbnail_chunk(FILE* f,
+                                           dio::AsepriteFrameHeader* frame_header,
+                                           const Sprite* sprite,
+                                           const frame_t frame,
+                                           const int compressionLevel)
+{
+  const int w = sprite->width()*sprite->pixelRatio().w;
+  const int h = sprite->height()*sprite->pixelRatio().h;
+
+  // Small sprites are faster to render than to decode the thumbnail
+  if (std::max(w, h) <= ASE_THUMBNAIL_MAX_SIZE)
+    return;
+
+  const int thumb_w = base::clamp(ASE_THUMBNAIL_MAX_SIZE * w / std::max(w, h),
+                                  1, ASE_THUMBNAIL_MAX_SIZE);
+  const int thumb_h = base::clamp(ASE_THUMBNAIL_MAX_SIZE * h / std::max(w, h),
+                                  1, ASE_THUMBNAIL_MAX_SIZE);
+
+  ImageRef thumbnail(Image::create(IMAGE_RGB, thumb_w, thumb_h));
+  render::Render render;
+  render.setBgType(render::BgType::TRANSPARENT);
+  render.setProjection(render::Projection(sprite->pixelRatio(),
+                                          render::Zoom(thumb_w, w)));
+  render.renderSprite(thumbnail.get(), sprite, frame,
+                      gfx::Clip(0, 0, 0, 0, w, h));
+
+  std::vector<uint8_t> data;
+  compress_image(thumbnail.get(), compressionLevel, data);
+
+  ChunkWriter chunk(f, frame_header, ASE_FILE_CHUNK_THUMBNAIL);
+  fputw(thumb_w, f);
+  fputw(thumb_h, f);
+  fputw(ASE_THUMBNAIL_RGBA, f);
+  ase_file_write_padding(f, 10);
+  write_compressed_image(f, data);
+}
+
 #if 0
 static void ase_file_write_mask_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header, Mask* mask);
 #endif
@@ -176,7 +291,8 @@ class AseFormat : public FileFormat {
       FILE_SUPPORT_PALETTES |
       FILE_SUPPORT_TAGS |
       FILE_SUPPORT_BIG_PALETTES |
-      FILE_SUPPORT_PALETTE_WITH_ALPHA;
+      FILE_SUPPORT_PALETTE_WITH_ALPHA |
+      FILE_SUPPORT_LOAD_FRAMES_ROI;
   }
 
   bool onLoad(FileOp* fop) override;
@@ -194,16 +310,24 @@ FileFormat* CreateAseFormat()
 bool AseFormat::onLoad(FileOp* fop)
 {
   FileHandle handle(open_file_with_exception(fop->filename(), "rb"));
-  dio::StdioFileInterface fileInterface(handle.get());
+
+  // Read the file from memory if it can be mapped (the compressed
+  // cels are inflated directly from the mapped memory)
+  dio::MappedFileInterface mappedInterface(handle.get());
+  dio::StdioFileInterface stdioInterface(handle.get());
+  dio::FileInterface* fileInterface =
+    (mappedInterface.isMapped() ? (dio::FileInterface*)&mappedInterface:
+                                  (dio::FileInterface*)&stdioInterface);
 
   DecodeDelegate delegate(fop);
   dio::AsepriteDecoder decoder;
-  decoder.initialize(&delegate, &fileInterface);
+  decoder.initialize(&delegate, fileInterface);
   if (!decoder.decode())
     return false;
 
   Sprite* sprite = delegate.sprite();
   fop->createDocument(sprite);
+  fop->document()->setCompressedImages(delegate.compressedImages());
 
   if (sprite->colorSpace() != nullptr &&
       sprite->colorSpace()->type() != gfx::ColorSpace::None) {
@@ -274,9 +398,29 @@ bool AseFormat::onSave(FileOp* fop)
     }
   }
 
+  std::vector<frame_t> frames;
+  frames.reserve(fop->roi().frames());
+  for (frame_t frame : fop->roi().selectedFrames())
+    frames.push_back(frame);
+
+  // Compression level from the preferences, or from the format
+  // options given to save this specific file (e.g. fast saves of
+  // intermediate files)
+  int compressionLevel = fop->aseCompressionLevel();
+  if (auto aseOptions = std::dynamic_pointer_cast<AseOptions>(fop->formatOptions()))
+    compressionLevel = aseOptions->compressionLevel();
+  compressionLevel = base::clamp(compressionLevel,
+                                 AseOptions::kDefaultCompressionLevel,
+                                 AseOptions::kBestCompressionLevel);
+
+  CompressedCels compressedCels;
+  compressedCels.prevImages = fop->document()->compressedImages();
+  compressedCels.newImages = std::make_shared<CompressedImages>();
+  int compressedUntil = 0;
+
   // Write frames
   int outputFrame = 0;
-  for (frame_t frame : fop->roi().selectedFrames()) {
+  for (frame_t frame : frames) {
     // Prepare the frame header
     dio::AsepriteFrameHeader frame_header;
     ase_file_prepare_frame_header(f, &frame_header);
@@ -288,6 +432,13 @@ bool AseFormat::onSave(FileOp* fop)
     if (outputFrame == 0 && fop->preserveColorProfile())
       ase_file_write_color_profile(f, &frame_header, sprite);
 
+    // Save a small preview of the first frame so the file browser
+    // doesn't need to decode/render all the cels (only if it's
+    // enabled in the preferences, see ase.save_thumbnail)
+    if (outputFrame == 0 && fop->aseSaveThumbnail())
+      ase_file_write_thumbnail_chunk(f, &frame_header, sprite, frame,
+                                     compressionLevel);
+
     // is the first frame or did the palette change?
     Palette* pal = sprite->palette(frame);
     int palFrom = 0, palTo = pal->size()-1;
@@ -324,10 +475,19 @@ bool AseFormat::onSave(FileOp* fop)
                                   fop->roi().toFrame());
     }
 
+    // Compress the cels of the next group of frames
+    if (outputFrame == compressedUntil) {
+      compressedUntil = ase_file_compress_cels(sprite, frames, outputFrame,
+                                               compressionLevel,
+                                               compressedCels);
+    }
+
     // Write cel chunks
     ase_file_write_cels(f, &frame_header,
                         sprite, sprite->root(),
-                        0, frame, fop->roi().fromFrame());
+                        0, frame, fop->roi().fromFrame(),
+                        compressionLevel,
+                        compressedCels);
 
     // Write the frame header
     ase_file_write_frame_header(f, &frame_header);
@@ -349,6 +509,12 @@ bool AseFormat::onSave(FileOp* fop)
     return false;
   }
   else {
+    // Keep the compressed images for the next save (only if all
+    // frames were saved, in other case the next save will need more
+    // images than the saved ones).
+    if (!fop->isStop() &&
+        fop->roi().frames() == sprite->totalFrames())
+      fop->document()->setCompressedImages(compressedCels.newImages);
     return true;
   }
 }
@@ -471,14 +637,17 @@ static layer_t ase_file_write_cels(FILE* f, dio::AsepriteFrameHeader* frame_head
                                    const Sprite* sprite, const Layer* layer,
                                    layer_t layer_index,
                                    const frame_t frame,
-                                   const frame_t firstFrame)
+                                   const frame_t firstFrame,
+                                   const int compressionLevel,
+                                   CompressedCels& compressedCels)
 {
   if (layer->isImage()) {
     const Cel* cel = layer->cel(frame);
     if (cel) {
       ase_file_write_cel_chunk(f, frame_header, cel,
                                static_cast<const LayerImage*>(layer),
-                               layer_index, sprite, firstFrame);
+                               layer_index, sprite, firstFrame,
+                               compressionLevel, compressedCels);
 
       if (layer->isReference())
         ase_file_write_cel_extra_chunk(f, frame_header, cel);
@@ -498,7 +667,8 @@ static layer_t ase_file_write_cels(FILE* f, dio::AsepriteFrameHeader* frame_head
     for (const Layer* child : static_cast<const LayerGroup*>(layer)->layers()) {
       layer_index =
         ase_file_write_cels(f, frame_header, sprite, child,
-                            layer_index, frame, firstFrame);
+                            layer_index, frame, firstFrame,
+                            compressionLevel, compressedCels);
     }
   }
 
@@ -688,7 +858,9 @@ static void write_raw_image(FILE* f, const Image* image)
 //////////////////////////////////////////////////////////////////////
 
 template<typename ImageTraits>
-static void write_compressed_image(FILE* f, const Image* image)
+static void compress_image_templ(const Image* image,
+                                 const int compressionLevel,
+                                 std::vector<uint8_t>& output)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -697,13 +869,14 @@ static void write_compressed_image(FILE* f, const Image* image)
   zstream.zalloc = (alloc_func)0;
   zstream.zfree  = (free_func)0;
   zstream.opaque = (voidpf)0;
-  err = deflateInit(&zstream, Z_DEFAULT_COMPRESSION);
+  err = deflateInit(&zstream, compressionLevel);
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in deflateInit().", err);
 
   std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->width()));
   std::vector<uint8_t> compressed(4096);
 
+  output.clear();
   for (y=0; y<image->height(); y++) {
     typename ImageTraits::address_t address =
       (typename ImageTraits::address_t)image->getPixelAddress(0, y);
@@ -720,15 +893,16 @@ static void write_compressed_image(FILE* f, const Image* image)
 
       // Compress
       err = deflate(&zstream, flush);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+        deflateEnd(&zstream);
         throw base::Exception("ZLib error %d in deflate().", err);
+      }
 
       int output_bytes = compressed.size() - zstream.avail_out;
-      if (output_bytes > 0) {
-        if ((fwrite(&compressed[0], 1, output_bytes, f) != (size_t)output_bytes)
-            || ferror(f))
-          throw base::Exception("Error writing compressed image pixels.\n");
-      }
+      if (output_bytes > 0)
+        output.insert(output.end(),
+                      compressed.begin(),
+                      compressed.begin()+output_bytes);
     } while (zstream.avail_out == 0);
   }
 
@@ -737,6 +911,119 @@ static void write_compressed_image(FILE* f, const Image* image)
     throw base::Exception("ZLib error %d in deflateEnd().", err);
 }
 
+static void compress_image(const Image* image,
+                           const int compressionLevel,
+                           std::vector<uint8_t>& output)
+{
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:
+      compress_image_templ<RgbTraits>(image, compressionLevel, output);
+      break;
+    case IMAGE_GRAYSCALE:
+      compress_image_templ<GrayscaleTraits>(image, compressionLevel, output);
+      break;
+    case IMAGE_INDEXED:
+      compress_image_templ<IndexedTraits>(image, compressionLevel, output);
+      break;
+  }
+}
+
+// Returns the compressed pixels of the image from "prevImages" (if
+// the image wasn't modified), or compresses the image.
+static CompressedCel compress_cel_image(const Image* image,
+                                        const int compressionLevel,
+                                        const CompressedImages* prevImages)
+{
+  CompressedCel cc;
+  cc.hash = CompressedImages::calculateHash(image);
+  if (prevImages)
+    cc.data = prevImages->get(image, cc.hash);
+  if (!cc.data) {
+    auto data = std::make_shared<std::vector<uint8_t>>();
+    compress_image(image, compressionLevel, *data);
+    cc.data = data;
+  }
+  return cc;
+}
+
+static void write_compressed_image(FILE* f, const std::vector<uint8_t>& data)
+{
+  if ((fwrite(data.data(), 1, data.size(), f) != data.size())
+      || ferror(f))
+    throw base::Exception("Error writing compressed image pixels.\n");
+}
+
+// Compresses the images of the cels in frames[fromIndex], frames[fromIndex+1],
+// etc. using all CPU cores, until there are enough cels to keep all
+// threads busy (or a memory limit is reached). The result is added
+// to "compressedCels". Returns the index of the first frame that
+// wasn't included.
+static int ase_file_compress_cels(const Sprite* sprite,
+                                  const std::vector<frame_t>& frames,
+                                  const int fromIndex,
+                                  const int compressionLevel,
+                                  CompressedCels& compressedCels)
+{
+  const int nthreads = std::thread::hardware_concurrency();
+  if (nthreads < 2)
+    return int(frames.size()); // Compress cels in ase_file_write_cel_chunk()
+
+  // Limits for each group of frames
+  const std::size_t kMaxBytes = 64*1024*1024;
+  const std::size_t kMaxCels = 64*nthreads;
+
+  const LayerList layers = sprite->allLayers();
+  std::vector<const Cel*> cels;
+  std::size_t bytes = 0;
+  int i = fromIndex;
+  for (; i<int(frames.size()) && bytes < kMaxBytes && cels.size() < kMaxCels; ++i) {
+    for (const Layer* layer : layers) {
+      if (!layer->isImage())
+        continue;
+
+      // Linked cels are not compressed (except when the original
+      // cel is outside the saved range, in that case the cel is
+      // compressed later in ase_file_write_cel_chunk())
+      const Cel* cel = layer->cel(frames[i]);
+      if (cel && !cel->link() && cel->image()) {
+        cels.push_back(cel);
+        bytes += cel->image()->getRowStrideSize() * cel->image()->height();
+      }
+    }
+  }
+
+  const CompressedImages* prevImages = compressedCels.prevImages.get();
+  std::vector<CompressedCel> data(cels.size());
+  std::atomic<int> nextCel(0);
+  auto compressCels = [&]{
+    for (int j=nextCel++; j<int(cels.size()); j=nextCel++) {
+      try {
+        data[j] = compress_cel_image(cels[j]->image(), compressionLevel,
+                                     prevImages);
+      }
+      catch (...) {
+        // The cel is compressed again (and the error reported) when
+        // it's written.
+        data[j].data.reset();
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  const int n = std::min<int>(nthreads, int(cels.size()));
+  for (int j=1; j<n; ++j)
+    threads.emplace_back(compressCels);
+  compressCels();               // Use this thread too
+  for (auto& thread : threads)
+    thread.join();
+
+  for (int j=0; j<int(cels.size()); ++j) {
+    if (data[j].data)
+      compressedCels.cels[cels[j]] = std::move(data[j]);
+  }
+  return i;
+}
+
 //////////////////////////////////////////////////////////////////////
 // Cel Chunk
 //////////////////////////////////////////////////////////////////////
@@ -746,7 +1033,9 @@ static void ase_file_write_cel_chunk(FILE* f, dio::AsepriteFrameHeader* frame_he
                                      const LayerImage* layer,
                                      const layer_t layer_index,
                                      const Sprite* sprite,
-                                     const frame_t firstFrame)
+                                     const frame_t firstFrame,
+                                     const int compressionLevel,
+                                     CompressedCels& compressedCels)
 {
   ChunkWriter chunk(f, frame_header, ASE_FILE_CHUNK_CEL);
 
@@ -822,20 +1111,18 @@ static void ase_file_write_cel_chunk(FILE* f, dio::AsepriteFrameHeader* frame_he
         fputw(image->height(), f);
 
         // Pixel data
-        switch (image->pixelFormat()) {
-
-          case IMAGE_RGB:
-            write_compressed_image<RgbTraits>(f, image);
-            break;
-
-          case IMAGE_GRAYSCALE:
-            write_compressed_image<GrayscaleTraits>(f, image);
-            break;
-
-          case IMAGE_INDEXED:
-            write_compressed_image<IndexedTraits>(f, image);
-            break;
+        CompressedCel cc;
+        auto it = compressedCels.cels.find(cel);
+        if (it != compressedCels.cels.end()) {
+          cc = std::move(it->second);
+          compressedCels.cels.erase(it);
+        }
+        else {
+          cc = compress_cel_image(image, compressionLevel,
+                                  compressedCels.prevImages.get());
         }
+        write_compressed_image(f, *cc.data);
+        compressedCels.newImages->set(image, cc.hash, cc.data);
       }
       else {
         // Width and height
@@ -0,0 +1,40 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_FILE_ASE_OPTIONS_H_INCLUDED
+#define APP_FILE_ASE_OPTIONS_H_INCLUDED
+#pragma once
+
+#include "app/file/format_options.h"
+
+namespace app {
+
+  // Data for .aseprite files
+  class AseOptions : public FormatOptions {
+  public:
+    // zlib compression levels for the cel images, from 1 (faster) to
+    // 9 (smaller files), or -1 to use the zlib default (6).
+    static constexpr int kDefaultCompressionLevel = -1;
+    static constexpr int kFastCompressionLevel = 1;
+    static constexpr int kBestCompressionLevel = 9;
+
+    AseOptions(int compressionLevel = kDefaultCompressionLevel)
+      : m_compressionLevel(compressionLevel) {
+    }
+
+    int compressionLevel() const { return m_compressionLevel; }
+    bool isFastSave() const { return m_compressionLevel == kFastCompressionLevel; }
+
+    void setCompressionLevel(int level) { m_compressionLevel = level; }
+    void setFastSave() { m_compressionLevel = kFastCompressionLevel; }
+
+  private:
+    int m_compressionLevel;
+  };
+
+} // namespace app
+
+#endif
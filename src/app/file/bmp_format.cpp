@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -19,6 +19,14 @@
 #include "doc/doc.h"
 #include "fmt/format.h"
 
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define APP_BMP_FORMAT_SSE2 1
+  #include <emmintrin.h>
+#endif
+
 namespace app {
 
 // Max supported .bmp size (to filter out invalid image sizes)
@@ -46,6 +54,10 @@ class BmpFormat : public FileFormat {
     uint32_t red_mask;          // Mask for red channel.
     uint32_t green_mask;        // Mask for green channel.
     uint32_t blue_mask;         // Mask for blue channel.
+
+    FormatOptionsPtr clone() const override {
+      return std::make_shared<BmpOptions>(*this);
+    }
   };
 
   const char* onGetName() const override {
@@ -67,7 +79,9 @@ class BmpFormat : public FileFormat {
       FILE_SUPPORT_RGB |
       FILE_SUPPORT_GRAY |
       FILE_SUPPORT_INDEXED |
-      FILE_SUPPORT_SEQUENCES;
+      FILE_SUPPORT_SEQUENCES |
+      FILE_SUPPORT_PARALLEL_LOAD |
+      FILE_SUPPORT_PARALLEL_SAVE;
   }
 
   bool onLoad(FileOp* fop) override;
@@ -223,138 +237,94 @@ static void read_bmicolors(FileOp* fop, int bytes, FILE *f, bool win_flag)
     fgetc(f);
 }
 
+// Reads a whole row of pixels (with its padding) in "buf". Bytes that
+// cannot be read (truncated file) are zeroed.
+static void read_row(FILE* f, std::vector<uint8_t>& buf)
+{
+  const std::size_t n = fread(buf.data(), 1, buf.size(), f);
+  if (n < buf.size())
+    std::fill(buf.begin()+n, buf.end(), 0);
+}
+
+// Size of a row of pixels in the file (rows are aligned to 4 bytes).
+static int row_size(const int width, const int bits_per_pixel)
+{
+  return ((width*bits_per_pixel + 31) / 32) * 4;
+}
+
 /* read_1bit_line:
  *  Support function for reading the 1 bit bitmap file format.
  */
-static void read_1bit_line(int length, FILE *f, Image *image, int line)
+static void read_1bit_line(int length, const uint8_t* src, Image *image, int line)
 {
-  unsigned char b[32];
-  unsigned long n;
-  int i, j, k;
-  int pix;
-
-  for (i=0; i<length; i++) {
-    j = i % 32;
-    if (j == 0) {
-      n = fgetl(f);
-      n =
-        ((n&0x000000ff)<<24) |
-        ((n&0x0000ff00)<< 8) |
-        ((n&0x00ff0000)>> 8) |
-        ((n&0xff000000)>>24);
-      for (k=0; k<32; k++) {
-        b[31-k] = (char)(n & 1);
-        n = n >> 1;
-      }
-    }
-    pix = b[j];
-    put_pixel(image, i, line, pix);
-  }
+  auto dst = (IndexedTraits::address_t)image->getPixelAddress(0, line);
+  for (int i=0; i<length; i++)
+    dst[i] = (src[i/8] >> (7 - (i%8))) & 1;
 }
 
 /* read_4bit_line:
  *  Support function for reading the 4 bit bitmap file format.
  */
-static void read_4bit_line(int length, FILE *f, Image *image, int line)
+static void read_4bit_line(int length, const uint8_t* src, Image *image, int line)
 {
-  unsigned char b[8];
-  unsigned long n;
-  int i, j, k;
-  int temp;
-  int pix;
-
-  for (i=0; i<length; i++) {
-    j = i % 8;
-    if (j == 0) {
-      n = fgetl(f);
-      for (k=0; k<4; k++) {
-        temp = n & 255;
-        b[k*2+1] = temp & 15;
-        temp = temp >> 4;
-        b[k*2] = temp & 15;
-        n = n >> 8;
-      }
-    }
-    pix = b[j];
-    put_pixel(image, i, line, pix);
-  }
+  auto dst = (IndexedTraits::address_t)image->getPixelAddress(0, line);
+  int i;
+  for (i=0; i+1<length; i+=2, ++src) {
+    dst[i] = (*src >> 4);
+    dst[i+1] = (*src & 15);
+  }
+  if (i < length)
+    dst[i] = (*src >> 4);
 }
 
 /* read_8bit_line:
  *  Support function for reading the 8 bit bitmap file format.
  */
-static void read_8bit_line(int length, FILE *f, Image *image, int line)
+static void read_8bit_line(int length, const uint8_t* src, Image *image, int line)
 {
-  unsigned char b[4];
-  unsigned long n;
-  int i, j, k;
-  int pix;
-
-  for (i=0; i<length; i++) {
-    j = i % 4;
-    if (j == 0) {
-      n = fgetl(f);
-      for (k=0; k<4; k++) {
-        b[k] = (char)(n & 255);
-        n = n >> 8;
-      }
-    }
-    pix = b[j];
-    put_pixel(image, i, line, pix);
-  }
+  std::copy(src, src+length, image->getPixelAddress(0, line));
 }
 
-static void read_16bit_line(int length, FILE *f, Image *image, int line)
+static void read_16bit_line(int length, const uint8_t* src, Image *image, int line)
 {
-  int i, r, g, b, word;
-
-  for (i=0; i<length; i++) {
-    word = fgetw(f);
-
-    r = (word >> 10) & 0x1f;
-    g = (word >> 5) & 0x1f;
-    b = (word) & 0x1f;
-
-    put_pixel(image, i, line,
-              rgba(scale_5bits_to_8bits(r),
-                   scale_5bits_to_8bits(g),
-                   scale_5bits_to_8bits(b), 255));
+  auto dst = (RgbTraits::address_t)image->getPixelAddress(0, line);
+  for (int i=0; i<length; i++, src+=2) {
+    const int word = src[0] | (src[1] << 8);
+    dst[i] = rgba(scale_5bits_to_8bits((word >> 10) & 0x1f),
+                  scale_5bits_to_8bits((word >> 5) & 0x1f),
+                  scale_5bits_to_8bits(word & 0x1f), 255);
   }
-
-  i = (2*i) % 4;
-  if (i > 0)
-    while (i++ < 4)
-      fgetc(f);
 }
 
-static void read_24bit_line(int length, FILE *f, Image *image, int line)
+static void read_24bit_line(int length, const uint8_t* src, Image *image, int line)
 {
-  int i, r, g, b;
-
-  for (i=0; i<length; i++) {
-    b = fgetc(f);
-    g = fgetc(f);
-    r = fgetc(f);
-    put_pixel(image, i, line, rgba(r, g, b, 255));
-  }
-
-  i = (3*i) % 4;
-  if (i > 0)
-    while (i++ < 4)
-      fgetc(f);
+  auto dst = (RgbTraits::address_t)image->getPixelAddress(0, line);
+  for (int i=0; i<length; i++, src+=3)
+    dst[i] = rgba(src[2], src[1], src[0], 255);
 }
 
-static void read_32bit_line(int length, FILE *f, Image *image, int line)
+static void read_32bit_line(int length, const uint8_t* src, Image *image, int line)
 {
-  int i, r, g, b;
-
-  for (i=0; i<length; i++) {
-    b = fgetc(f);
-    g = fgetc(f);
-    r = fgetc(f);
-    fgetc(f);
-    put_pixel(image, i, line, rgba(r, g, b, 255));
+  auto dst = (RgbTraits::address_t)image->getPixelAddress(0, line);
+  int i = 0;
+
+#if APP_BMP_FORMAT_SSE2
+  // BGRX -> RGBA (with alpha=255), 4 pixels at the same time
+  const __m128i g = _mm_set1_epi32(0x0000ff00);
+  const __m128i ff = _mm_set1_epi32(0x000000ff);
+  const __m128i a = _mm_set1_epi32(0xff000000);
+  for (; i+4<=length; i+=4, src+=16) {
+    const __m128i c = _mm_loadu_si128((const __m128i*)src);
+    const __m128i r = _mm_and_si128(_mm_srli_epi32(c, 16), ff);
+    const __m128i b = _mm_slli_epi32(_mm_and_si128(c, ff), 16);
+    _mm_storeu_si128((__m128i*)(dst+i),
+                     _mm_or_si128(_mm_or_si128(r, b),
+                                  _mm_or_si128(_mm_and_si128(c, g), a)));
   }
+#endif
+
+  for (; i<length; i++, src+=4)
+    dst[i] = rgba(src[2], src[1], src[0], 255);
 }
 
 /* read_image:
@@ -369,14 +339,20 @@ static void read_image(FILE *f, Image *image, const BITMAPINFOHEADER *infoheader
   dir    = height < 0 ? 1: -1;
   height = ABS(height);
 
+  // Each row is read with only one fread()
+  const int width = (int)infoheader->biWidth;
+  std::vector<uint8_t> buf(row_size(width, infoheader->biBitCount));
+
   for (i=0; i<height; i++, line+=dir) {
+    read_row(f, buf);
+
     switch (infoheader->biBitCount) {
-      case 1: read_1bit_line(infoheader->biWidth, f, image, line); break;
-      case 4: read_4bit_line(infoheader->biWidth, f, image, line); break;
-      case 8: read_8bit_line(infoheader->biWidth, f, image, line); break;
-      case 16: read_16bit_line(infoheader->biWidth, f, image, line); break;
-      case 24: read_24bit_line(infoheader->biWidth, f, image, line); break;
-      case 32: read_32bit_line(infoheader->biWidth, f, image, line); break;
+      case 1: read_1bit_line(width, buf.data(), image, line); break;
+      case 4: read_4bit_line(width, buf.data(), image, line); break;
+      case 8: read_8bit_line(width, buf.data(), image, line); break;
+      case 16: read_16bit_line(width, buf.data(), image, line); break;
+      case 24: read_24bit_line(width, buf.data(), image, line); break;
+      case 32: read_32bit_line(width, buf.data(), image, line); break;
     }
 
     fop->setProgress((float)(i+1) / (float)(height));
@@ -583,12 +559,18 @@ static int read_bitfields_image(FILE *f, Image *image, BITMAPINFOHEADER *infohea
   bytes_per_pixel = ((bits_per_pixel / 8) +
                      ((bits_per_pixel % 8) > 0 ? 1: 0));
 
+  std::vector<uint8_t> buf(row_size(infoheader->biWidth, bytes_per_pixel*8));
+
   for (i=0; i<height; i++, line+=dir) {
+    read_row(f, buf);
+    const uint8_t* src = buf.data();
+    auto dst = (RgbTraits::address_t)image->getPixelAddress(0, line);
+
     for (j=0; j<(int)infoheader->biWidth; j++) {
       /* read the DWORD, WORD or BYTE in little-endian order */
       buffer = 0;
       for (k=0; k<bytes_per_pixel; k++)
-        buffer |= fgetc(f) << (k<<3);
+        buffer |= (unsigned long)(*src++) << (k<<3);
 
       r = (buffer & rmask) >> rshift;
       g = (buffer & gmask) >> gshift;
@@ -598,13 +580,8 @@ static int read_bitfields_image(FILE *f, Image *image, BITMAPINFOHEADER *infohea
       g = gscale ? gscale(g): g;
       b = bscale ? bscale(b): b;
 
-      put_pixel_fast<RgbTraits>(image, j, line, rgba(r, g, b, 255));
+      dst[j] = rgba(r, g, b, 255);
     }
-
-    j = (bytes_per_pixel*j) % 4;
-    if (j > 0)
-      while (j++ < 4)
-        fgetc(f);
   }
 
   return 0;
@@ -849,37 +826,43 @@ bool BmpFormat::onSave(FileOp *fop)
     default: colorMask = 0; break;
   }
 
+  // Each row is packed in a buffer (with the filler bytes, which are
+  // always zero) and written with only one fwrite()
+  std::vector<uint8_t> buf((w*bpp + 7)/8 + filler, 0);
+
   // Save image pixels (from bottom to top)
   for (i=h-1; i>=0; i--) {
+    uint8_t* dst = buf.data();
     switch (image->pixelFormat()) {
-      case IMAGE_RGB:
-        for (j=0; j<w; ++j) {
-          c = get_pixel_fast<RgbTraits>(image, j, i);
-          fputc(rgba_getb(c), f);
-          fputc(rgba_getg(c), f);
-          fputc(rgba_getr(c), f);
+      case IMAGE_RGB: {
+        auto src = (RgbTraits::const_address_t)image->getPixelAddress(0, i);
+        for (j=0; j<w; ++j, dst+=3) {
+          c = src[j];
+          dst[0] = rgba_getb(c);
+          dst[1] = rgba_getg(c);
+          dst[2] = rgba_getr(c);
         }
         break;
-      case IMAGE_GRAYSCALE:
-        for (j=0; j<w; ++j) {
-          c = get_pixel_fast<GrayscaleTraits>(image, j, i);
-          fputc(graya_getv(c), f);
-        }
+      }
+      case IMAGE_GRAYSCALE: {
+        auto src = (GrayscaleTraits::const_address_t)image->getPixelAddress(0, i);
+        for (j=0; j<w; ++j)
+          dst[j] = graya_getv(src[j]);
         break;
-      case IMAGE_INDEXED:
-        for (j=0; j<w; ) {
+      }
+      case IMAGE_INDEXED: {
+        auto src = (IndexedTraits::const_address_t)image->getPixelAddress(0, i);
+        for (j=0; j<w; ++dst) {
           uint8_t value = 0;
-          for (int k=colorsPerByte-1; k>=0 && j<w; --k, ++j) {
-            c = get_pixel_fast<IndexedTraits>(image, j, i);
-            value |= (c & colorMask) << (bpp*k);
-          }
-          fputc(value, f);
+          for (int k=colorsPerByte-1; k>=0 && j<w; --k, ++j)
+            value |= (src[j] & colorMask) << (bpp*k);
+          *dst = value;
         }
         break;
+      }
     }
 
-    for (j=0; j<filler; j++)
-      fputc(0, f);
+    fwrite(buf.data(), 1, buf.size(), f);
 
     fop->setProgress((float)(h-i) / (float)h);
   }
@@ -0,0 +1,66 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_FILE_BUFFERED_TEXT_WRITER_H_INCLUDED
+#define APP_FILE_BUFFERED_TEXT_WRITER_H_INCLUDED
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+namespace app {
+
+  // Writes formatted text to a file. The text is formatted in a
+  // memory buffer that is written to the file in big chunks (used by
+  // text formats like SVG or CSS that write thousands of elements).
+  class BufferedTextWriter {
+  public:
+    static constexpr std::size_t kBufferSize = 64*1024;
+
+    explicit BufferedTextWriter(FILE* f) : m_f(f) {
+      m_buf.reserve(kBufferSize + kMaxFormattedSize);
+    }
+
+    ~BufferedTextWriter() {
+      flush();
+    }
+
+    // Each call can format up to kMaxFormattedSize-1 chars.
+    template<typename... Args>
+    void printf(const char* format, Args... args) {
+      char tmp[kMaxFormattedSize];
+      const int n = std::snprintf(tmp, sizeof(tmp), format, args...);
+      if (n > 0)
+        m_buf.append(tmp, std::min<std::size_t>(n, sizeof(tmp)-1));
+      if (m_buf.size() >= kBufferSize)
+        flush();
+    }
+
+    void write(const char* str) {
+      m_buf += str;
+      if (m_buf.size() >= kBufferSize)
+        flush();
+    }
+
+    void flush() {
+      if (!m_buf.empty()) {
+        std::fwrite(m_buf.c_str(), 1, m_buf.size(), m_f);
+        m_buf.clear();
+      }
+    }
+
+  private:
+    static constexpr std::size_t kMaxFormattedSize = 256;
+
+    FILE* m_f;
+    std::string m_buf;
+  };
+
+} // namespace app
+
+#endif
@@ -0,0 +1,77 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/file/compressed_images.h"
+
+#include "doc/image.h"
+
+#include <cstring>
+
+namespace app {
+
+CompressedImages::Data CompressedImages::get(const doc::Image* image,
+                                             const uint64_t hash) const
+{
+  auto it = m_images.find(image->id());
+  if (it != m_images.end() &&
+      it->second.version == image->version() &&
+      it->second.hash == hash) {
+    return it->second.data;
+  }
+  return nullptr;
+}
+
+void CompressedImages::set(const doc::Image* image,
+                           const uint64_t hash,
+                           const Data& data)
+{
+  Item& item = m_images[image->id()];
+  item.version = image->version();
+  item.hash = hash;
+  item.data = data;
+}
+
+// static
+uint64_t CompressedImages::calculateHash(const doc::Image* image)
+{
+  const uint64_t k1 = 0x9e3779b97f4a7c15ull;
+  const uint64_t k2 = 0xbf58476d1ce4e5b9ull;
+  auto mix = [k1, k2](uint64_t h, uint64_t v) -> uint64_t {
+    h ^= v * k1;
+    h = (h << 29) | (h >> 35);
+    return h * k2;
+  };
+
+  uint64_t h = 0;
+  h = mix(h, uint64_t(image->pixelFormat()));
+  h = mix(h, uint64_t(image->width()));
+  h = mix(h, uint64_t(image->height()));
+
+  // Only the bytes of each row with pixels are hashed (the padding
+  // bytes at the end of each row aren't saved in the file)
+  const std::size_t rowBytes = image->getRowStrideSize();
+  for (int y=0; y<image->height(); ++y) {
+    const uint8_t* p = image->getPixelAddress(0, y);
+    std::size_t n = rowBytes;
+    for (; n >= 8; n-=8, p+=8) {
+      uint64_t v;
+      std::memcpy(&v, p, 8);
+      h = mix(h, v);
+    }
+    if (n > 0) {
+      uint64_t v = 0;
+      std::memcpy(&v, p, n);
+      h = mix(h, v ^ (uint64_t(n) << 56));
+    }
+  }
+  return h ^ (h >> 31);
+}
+
+} // namespace app
@@ -0,0 +1,59 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_FILE_COMPRESSED_IMAGES_H_INCLUDED
+#define APP_FILE_COMPRESSED_IMAGES_H_INCLUDED
+#pragma once
+
+#include "doc/object_id.h"
+#include "doc/object_version.h"
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace doc {
+  class Image;
+}
+
+namespace app {
+
+  // Compressed pixels of images (the zlib data as it's stored in
+  // .aseprite files) from the last time a document was loaded or
+  // saved. Saving the document again reuses the data of the images
+  // that weren't modified, so only new/modified images must be
+  // compressed again.
+  //
+  // As some code can modify images without incrementing their
+  // version (e.g. scripts), an image is considered unmodified only
+  // if it has the same ID, version, and hash of its pixels.
+  class CompressedImages {
+  public:
+    typedef std::shared_ptr<const std::vector<uint8_t>> Data;
+
+    // Returns the compressed data of the image if it wasn't modified
+    // (the "hash" must be the result of calculateHash(image)).
+    Data get(const doc::Image* image, const uint64_t hash) const;
+    void set(const doc::Image* image, const uint64_t hash, const Data& data);
+
+    // Hash of the image size, pixel format and pixels.
+    static uint64_t calculateHash(const doc::Image* image);
+
+  private:
+    struct Item {
+      doc::ObjectVersion version;
+      uint64_t hash;
+      Data data;
+    };
+    std::unordered_map<doc::ObjectId, Item> m_images;
+  };
+
+  typedef std::shared_ptr<CompressedImages> CompressedImagesPtr;
+
+} // namespace app
+
+#endif
@@ -0,0 +1,71 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#include "tests/app_test.h"
+
+#include "app/file/compressed_images.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+
+#include <memory>
+
+using namespace app;
+using namespace doc;
+
+TEST(CompressedImages, ReuseUnmodifiedImages)
+{
+  ImageRef a(Image::create(IMAGE_RGB, 32, 32));
+  ImageRef b(Image::create(IMAGE_RGB, 32, 32));
+  clear_image(a.get(), rgba(0, 0, 0, 0));
+  clear_image(b.get(), rgba(0, 0, 0, 0));
+
+  auto data = std::make_shared<const std::vector<uint8_t>>(4, 1);
+  CompressedImages images;
+  images.set(a.get(), CompressedImages::calculateHash(a.get()), data);
+
+  EXPECT_EQ(data, images.get(a.get(), CompressedImages::calculateHash(a.get())));
+
+  // Other image with the same pixels and version (but other ID)
+  EXPECT_EQ(nullptr, images.get(b.get(), CompressedImages::calculateHash(b.get())));
+
+  // Modified without changing the version (e.g. from a script)
+  put_pixel(a.get(), 31, 31, rgba(255, 0, 0, 255));
+  EXPECT_EQ(nullptr, images.get(a.get(), CompressedImages::calculateHash(a.get())));
+
+  // Same pixels but other version
+  put_pixel(a.get(), 31, 31, rgba(0, 0, 0, 0));
+  EXPECT_EQ(data, images.get(a.get(), CompressedImages::calculateHash(a.get())));
+  a->incrementVersion();
+  EXPECT_EQ(nullptr, images.get(a.get(), CompressedImages::calculateHash(a.get())));
+}
+
+TEST(CompressedImages, HashOfPixels)
+{
+  for (PixelFormat pf : { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED }) {
+    // Sizes with rows that aren't multiple of 8 bytes
+    for (int w : { 1, 3, 7, 8, 9, 33 }) {
+      std::unique_ptr<Image> a(Image::create(pf, w, 5));
+      std::unique_ptr<Image> b(Image::create(pf, w, 5));
+      clear_image(a.get(), 0);
+      clear_image(b.get(), 0);
+      EXPECT_EQ(CompressedImages::calculateHash(a.get()),
+                CompressedImages::calculateHash(b.get()));
+
+      put_pixel(b.get(), w-1, 4, 1);
+      EXPECT_NE(CompressedImages::calculateHash(a.get()),
+                CompressedImages::calculateHash(b.get()));
+    }
+  }
+
+  // Same bytes but different size
+  std::unique_ptr<Image> a(Image::create(IMAGE_INDEXED, 4, 2));
+  std::unique_ptr<Image> b(Image::create(IMAGE_INDEXED, 2, 4));
+  clear_image(a.get(), 0);
+  clear_image(b.get(), 0);
+  EXPECT_NE(CompressedImages::calculateHash(a.get()),
+            CompressedImages::calculateHash(b.get()));
+}
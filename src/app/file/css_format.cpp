@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (c) 2018-2019  Igara Studio S.A.
+// Copyright (c) 2018-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -12,6 +12,7 @@
 #include "app/console.h"
 #include "app/context.h"
 #include "app/doc.h"
+#include "app/file/buffered_text_writer.h"
 #include "app/file/file.h"
 #include "app/file/file_format.h"
 #include "app/file/format_options.h"
@@ -64,7 +65,8 @@ class CssFormat : public FileFormat {
       FILE_SUPPORT_INDEXED |
       FILE_SUPPORT_SEQUENCES |
       FILE_SUPPORT_GET_FORMAT_OPTIONS |
-      FILE_SUPPORT_PALETTE_WITH_ALPHA;
+      FILE_SUPPORT_PALETTE_WITH_ALPHA |
+      FILE_SUPPORT_PARALLEL_SAVE;
   }
 
   bool onLoad(FileOp* fop) override;
@@ -93,68 +95,69 @@ bool CssFormat::onSave(FileOp* fop)
   const auto css_options = std::static_pointer_cast<CssOptions>(fop->formatOptions());
   FileHandle handle(open_file_with_exception_sync_on_close(fop->filename(), "wb"));
   FILE* f = handle.get();
-  auto print_color = [f](int r, int g, int b, int a) {
+  BufferedTextWriter w(f);
+  auto print_color = [&w](int r, int g, int b, int a) {
     if (a == 255) {
-      fprintf(f, "#%02X%02X%02X", r, g, b);
+      w.printf("#%02X%02X%02X", r, g, b);
     }
     else {
-      fprintf(f, "rgba(%d, %d, %d, %d)", r, g, b, a);
+      w.printf("rgba(%d, %d, %d, %d)", r, g, b, a);
     }
   };
-  auto print_shadow_color = [f, css_options, print_color](int x, int y, int r,
-                                                          int g, int b, int a,
-                                                          bool comma = true) {
-    fprintf(f, comma?",\n":"\n");
+  auto print_shadow_color = [&w, css_options, print_color](int x, int y, int r,
+                                                           int g, int b, int a,
+                                                           bool comma = true) {
+    w.write(comma?",\n":"\n");
     if (css_options->withVars) {
-      fprintf(f, "\tcalc(%d*var(--shadow-mult)) calc(%d*var(--shadow-mult)) var(--blur) var(--spread) ",
-              x, y);
+      w.printf("\tcalc(%d*var(--shadow-mult)) calc(%d*var(--shadow-mult)) var(--blur) var(--spread) ",
+               x, y);
     }
     else {
       int x_loc = x * (css_options->pixelScale + css_options->gutterSize);
       int y_loc = y * (css_options->pixelScale + css_options->gutterSize);
-      fprintf(f, "%dpx %dpx ", x_loc, y_loc);
+      w.printf("%dpx %dpx ", x_loc, y_loc);
     }
     print_color(r, g, b, a);
   };
-  auto print_shadow_index = [f, css_options](int x, int y, int i, bool comma=true) {
-    fprintf(f, comma?",\n":"\n");
-    fprintf(f, "\tcalc(%d*var(--shadow-mult)) calc(%d*var(--shadow-mult)) var(--blur) var(--spread) var(--color-%d)",
-            x, y, i);
+  auto print_shadow_index = [&w, css_options](int x, int y, int i, bool comma=true) {
+    w.write(comma?",\n":"\n");
+    w.printf("\tcalc(%d*var(--shadow-mult)) calc(%d*var(--shadow-mult)) var(--blur) var(--spread) var(--color-%d)",
+             x, y, i);
   };
   if (css_options->withVars) {
-    fprintf(f, ":root {\n"
-               "\t--blur: 0px;\n"
-               "\t--spread: 0px;\n"
-               "\t--pixel-size: %dpx;\n"
-               "\t--gutter-size: %dpx;\n",
-            css_options->pixelScale,
-            css_options->gutterSize);
-    fprintf(f, "\t--shadow-mult: calc(var(--gutter-size) + var(--pixel-size));\n");
+    w.printf(":root {\n"
+             "\t--blur: 0px;\n"
+             "\t--spread: 0px;\n"
+             "\t--pixel-size: %dpx;\n"
+             "\t--gutter-size: %dpx;\n",
+             css_options->pixelScale,
+             css_options->gutterSize);
+    w.write("\t--shadow-mult: calc(var(--gutter-size) + var(--pixel-size));\n");
     if (image->pixelFormat() == IMAGE_INDEXED) {
       for (y = 0; y < 256; y++) {
         fop->sequenceGetColor(y, &r, &g, &b);
         fop->sequenceGetAlpha(y, &a);
-        fprintf(f, "\t--color-%d: ", y);
+        w.printf("\t--color-%d: ", y);
         print_color(r, g, b, a);
-        fprintf(f, ";\n");
+        w.write(";\n");
       }
     }
-    fprintf(f, "}\n\n");
+    w.write("}\n\n");
   }
 
-  fprintf(f, ".pixel-art {\n");
-  fprintf(f, "\tposition: relative;\n");
-  fprintf(f, "\ttop: 0;\n");
-  fprintf(f, "\tleft: 0;\n");
+  w.write(".pixel-art {\n");
+  w.write("\tposition: relative;\n");
+  w.write("\ttop: 0;\n");
+  w.write("\tleft: 0;\n");
   if (css_options->withVars) {
-    fprintf(f, "\theight: var(--pixel-size);\n");
-    fprintf(f, "\twidth: var(--pixel-size);\n");
+    w.write("\theight: var(--pixel-size);\n");
+    w.write("\twidth: var(--pixel-size);\n");
   }
   else {
-    fprintf(f, "\theight: %dpx;\n", css_options->pixelScale);
-    fprintf(f, "\twidth: %dpx;\n", css_options->pixelScale);
+    w.printf("\theight: %dpx;\n", css_options->pixelScale);
+    w.printf("\twidth: %dpx;\n", css_options->pixelScale);
   }
-  fprintf(f, "\tbox-shadow:\n");
+  w.write("\tbox-shadow:\n");
   int num_printed_pixels = 0;
   switch (image->pixelFormat()) {
     case IMAGE_RGB: {
@@ -225,7 +228,8 @@ bool CssFormat::onSave(FileOp* fop)
       break;
     }
   }
-  fprintf(f, ";\n}\n");
+  w.write(";\n}\n");
+  w.flush();
   if (ferror(f)) {
     fop->setError("Error writing file.\n");
     return false;
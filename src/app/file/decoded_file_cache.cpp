@@ -0,0 +1,161 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/file/decoded_file_cache.h"
+
+#include "base/debug.h"
+#include "base/fs.h"
+#include "doc/image.h"
+#include "doc/palette.h"
+
+#include <iterator>
+
+namespace app {
+
+// static
+DecodedFileCache* DecodedFileCache::instance()
+{
+  static DecodedFileCache singleton;
+  return &singleton;
+}
+
+DecodedFileCache::DecodedFileCache(const std::size_t maxBytes)
+  : m_maxBytes(maxBytes)
+  , m_bytes(0)
+{
+  CacheManager::instance()->add(this);
+}
+
+DecodedFileCache::~DecodedFileCache()
+{
+  CacheManager::instance()->remove(this);
+}
+
+bool DecodedFileCache::get(const std::string& filename, DecodedFile& file)
+{
+  const std::string path = base::normalize_path(base::get_absolute_path(filename));
+  Key key;
+  if (!getKey(path, key))
+    return false;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_index.find(path);
+  if (it == m_index.end())
+    return false;
+
+  Entries::iterator entry = it->second;
+  if (entry->key.mtime == key.mtime &&
+      entry->key.size == key.size) {
+    m_entries.splice(m_entries.begin(), m_entries, entry);
+    entry->used = base::current_tick();
+    file = entry->file;
+    return true;
+  }
+
+  // The file was modified
+  removeEntry(entry);
+  return false;
+}
+
+void DecodedFileCache::put(const std::string& filename, const DecodedFile& file)
+{
+  ASSERT(file.image);
+
+  const std::string path = base::normalize_path(base::get_absolute_path(filename));
+  Key key;
+  if (!getKey(path, key))
+    return;
+
+  std::size_t bytes = file.image->getMemSize();
+  if (file.palette)
+    bytes += file.palette->size() * sizeof(doc::color_t);
+
+  // Big files would remove all other files from the cache
+  if (bytes > m_maxBytes / 4)
+    return;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_index.find(path);
+  if (it != m_index.end())
+    removeEntry(it->second);
+
+  while (!m_entries.empty() && m_bytes + bytes > m_maxBytes)
+    removeEntry(std::prev(m_entries.end()));
+
+  Entry entry;
+  entry.path = path;
+  entry.key = key;
+  entry.file = file;
+  entry.bytes = bytes;
+  entry.used = base::current_tick();
+  m_entries.push_front(std::move(entry));
+  m_index[path] = m_entries.begin();
+  m_bytes += bytes;
+}
+
+void DecodedFileCache::discard(const std::string& filename)
+{
+  const std::string path = base::normalize_path(base::get_absolute_path(filename));
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_index.find(path);
+  if (it != m_index.end())
+    removeEntry(it->second);
+}
+
+void DecodedFileCache::clear()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entries.clear();
+  m_index.clear();
+  m_bytes = 0;
+}
+
+std::size_t DecodedFileCache::bytes() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_bytes;
+}
+
+bool DecodedFileCache::cacheOldestUse(base::tick_t& tick) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_entries.empty())
+    return false;
+  tick = m_entries.back().used;
+  return true;
+}
+
+void DecodedFileCache::evictOldestCacheEntry()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_entries.empty())
+    removeEntry(std::prev(m_entries.end()));
+}
+
+// static
+bool DecodedFileCache::getKey(const std::string& path, Key& key)
+{
+  if (!base::is_file(path))
+    return false;
+
+  key.mtime = base::get_modification_time(path);
+  key.size = base::file_size(path);
+  return true;
+}
+
+void DecodedFileCache::removeEntry(Entries::iterator it)
+{
+  m_bytes -= it->bytes;
+  m_index.erase(it->path);
+  m_entries.erase(it);
+}
+
+} // namespace app
@@ -0,0 +1,108 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_FILE_DECODED_FILE_CACHE_H_INCLUDED
+#define APP_FILE_DECODED_FILE_CACHE_H_INCLUDED
+#pragma once
+
+#include "app/cache_manager.h"
+#include "app/file/format_options.h"
+#include "base/time.h"
+#include "doc/image_ref.h"
+#include "gfx/color_space.h"
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace doc {
+  class Palette;
+}
+
+namespace app {
+
+  // The image of a file of a format with FILE_SUPPORT_SEQUENCES
+  // (PNG, BMP, JPEG, etc.) with everything that the file format sets
+  // in the FileOp when the file is decoded.
+  struct DecodedFile {
+    doc::ImageRef image;
+    std::shared_ptr<const doc::Palette> palette; // nullptr if the file doesn't have a palette
+    gfx::ColorSpaceRef colorSpace;
+    FormatOptionsPtr formatOptions;
+    int transparentColor = 0;
+    bool hasAlpha = false;
+    bool embeddedColorProfile = false;
+  };
+
+  // Process-wide cache of decoded files with a limited size in bytes
+  // (the least recently used files are removed first). It's used by
+  // all FileOps that load these files (opening documents, sequences,
+  // Load Palette, Import Sprite Sheet, the file selector thumbnails,
+  // etc.) so the same file isn't decoded several times. A file is
+  // identified by its path, modification time, and size, so a
+  // modified file is decoded again. It can be used from any thread.
+  class DecodedFileCache : public ManagedCache {
+  public:
+    static constexpr std::size_t kDefaultMaxBytes = 128*1024*1024;
+
+    static DecodedFileCache* instance();
+
+    explicit DecodedFileCache(const std::size_t maxBytes = kDefaultMaxBytes);
+    ~DecodedFileCache();
+
+    // Returns true if the given file is in the cache (and it wasn't
+    // modified since it was added).
+    bool get(const std::string& filename, DecodedFile& file);
+
+    // Adds the decoded file. The image, palette, and format options
+    // cannot be modified after this (they are shared with the cache).
+    void put(const std::string& filename, const DecodedFile& file);
+
+    // Removes the file from the cache (e.g. when we save it).
+    void discard(const std::string& filename);
+
+    void clear();
+
+    std::size_t bytes() const;
+
+    // ManagedCache impl
+    const char* cacheName() const override { return "Decoded files"; }
+    std::size_t cacheBytes() const override { return bytes(); }
+    bool cacheOldestUse(base::tick_t& tick) const override;
+    void evictOldestCacheEntry() override;
+
+  private:
+    struct Key {
+      base::Time mtime;
+      std::size_t size = 0;
+    };
+
+    struct Entry {
+      std::string path;
+      Key key;
+      DecodedFile file;
+      std::size_t bytes = 0;
+      base::tick_t used = 0;
+    };
+
+    typedef std::list<Entry> Entries;
+
+    static bool getKey(const std::string& path, Key& key);
+    void removeEntry(Entries::iterator it);
+
+    const std::size_t m_maxBytes;
+    mutable std::mutex m_mutex;
+    Entries m_entries;          // The most recently used first
+    std::map<std::string, Entries::iterator> m_index;
+    std::size_t m_bytes;
+  };
+
+} // namespace app
+
+#endif
@@ -16,10 +16,12 @@
 #include "app/console.h"
 #include "app/context.h"
 #include "app/doc.h"
+#include "app/file/decoded_file_cache.h"
 #include "app/file/file_data.h"
 #include "app/file/file_format.h"
 #include "app/file/file_formats_manager.h"
 #include "app/file/format_options.h"
+#include "app/file/output_manifest.h"
 #include "app/file/split_filename.h"
 #include "app/filename_formatter.h"
 #include "app/i18n/strings.h"
@@ -32,9 +34,11 @@
 #include "base/fs.h"
 #include "base/mutex.h"
 #include "base/scoped_lock.h"
+#include "base/split_string.h"
 #include "base/string.h"
 #include "dio/detect_format.h"
 #include "doc/doc.h"
+#include "doc/trace.h"
 #include "fmt/format.h"
 #include "render/quantization.h"
 #include "render/render.h"
@@ -46,8 +50,14 @@
 #include "ask_for_color_profile.xml.h"
 #include "open_sequence.xml.h"
 
+#include <algorithm>
+#include <condition_variable>
 #include <cstring>
 #include <cstdarg>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace app {
 
@@ -75,7 +85,8 @@ base::paths get_writable_extensions(const int requiredFormatFlag)
   return paths;
 }
 
-Doc* load_document(Context* context, const std::string& filename)
+Doc* load_document(Context* context, const std::string& filename,
+                   const FileOpLoadROI& roi)
 {
   /* TODO add a option to configure what to do with the sequence */
   std::unique_ptr<FileOp> fop(
@@ -86,6 +97,8 @@ Doc* load_document(Context* context, const std::string& filename)
   if (!fop)
     return nullptr;
 
+  fop->setLoadROI(roi);
+
   // Operate in this same thread
   fop->operate();
   fop->done();
@@ -103,7 +116,8 @@ Doc* load_document(Context* context, const std::string& filename)
   return document;
 }
 
-int save_document(Context* context, Doc* document)
+int save_document(Context* context, Doc* document,
+                  OutputManifest* outputManifest)
 {
   std::unique_ptr<FileOp> fop(
     FileOp::createSaveDocumentOperation(
@@ -114,6 +128,8 @@ int save_document(Context* context, Doc* document)
   if (!fop)
     return -1;
 
+  fop->setOutputManifest(outputManifest);
+
   // Operate in this same thread
   fop->operate();
   fop->done();
@@ -177,6 +193,38 @@ FileOpROI::FileOpROI(const Doc* doc,
   }
 }
 
+bool FileOpLoadROI::containsLayer(const doc::Layer* layer) const
+{
+  if (m_layers.empty())
+    return true;
+
+  // Names from the top-level layer/group to the given layer
+  std::vector<std::string> path;
+  for (; layer && layer->parent(); layer=layer->parent())
+    path.insert(path.begin(), layer->name());
+
+  for (const auto& filter : m_layers) {
+    std::vector<std::string> parts;
+    base::split_string(filter, parts, "/");
+
+    // Just a name can match a layer in any group (the CLI converts
+    // the name to the full layer path when it's unique)
+    if (parts.size() == 1 &&
+        std::find(path.begin(), path.end(), parts[0]) != path.end())
+      return true;
+
+    // The filter matches the layer or one of its parent groups (all
+    // children of a group are loaded with it)
+    if (parts.size() <= path.size() &&
+        std::equal(parts.begin(), parts.end(), path.begin(),
+                   [](const std::string& a, const std::string& b){
+                     return (a == "*" || a == b);
+                   }))
+      return true;
+  }
+  return false;
+}
+
 // static
 FileOp* FileOp::createLoadDocumentOperation(Context* context,
                                             const std::string& filename,
@@ -320,6 +368,10 @@ FileOp* FileOp::createLoadDocumentOperation(Context* context,
   if (flags & FILE_LOAD_ONE_FRAME)
     fop->m_oneframe = true;
 
+  // Load just the embedded thumbnail (if the file has one)
+  if (flags & FILE_LOAD_THUMBNAIL)
+    fop->m_thumbnailOnly = true;
+
   if (flags & FILE_LOAD_CREATE_PALETTE)
     fop->m_createPaletteFromRgba = true;
 
@@ -339,10 +391,11 @@ FileOp* FileOp::createSaveDocumentOperation(const Context* context,
                                             const FileOpROI& roi,
                                             const std::string& filename,
                                             const std::string& filenameFormatArg,
-                                            const bool ignoreEmptyFrames)
+                                            const bool ignoreEmptyFrames,
+                                            const FileOpConfig* config)
 {
   std::unique_ptr<FileOp> fop(
-    new FileOp(FileOpSave, const_cast<Context*>(context), nullptr));
+    new FileOp(FileOpSave, const_cast<Context*>(context), config));
 
   // Document to save
   fop->m_document = const_cast<Doc*>(roi.document());
@@ -352,6 +405,13 @@ FileOp* FileOp::createSaveDocumentOperation(const Context* context,
   // Get the extension of the filename (in lower case)
   LOG("FILE: Saving document \"%s\"\n", filename.c_str());
 
+  // The document is incomplete (we would save empty frames)
+  if (fop->m_document && fop->m_document->isLoadingFrames()) {
+    fop->setError("Error saving \"%s\" file, the document is still being loaded",
+                  filename.c_str());
+    return fop.release();
+  }
+
   // Check for read-only attribute
   if (base::has_readonly_attr(filename)) {
     fop->setError("Error saving \"%s\" file, it's read-only",
@@ -586,6 +646,493 @@ FileOp* FileOp::createSaveDocumentOperation(const Context* context,
   return fop.release();
 }
 
+// Decodes the frames of a sequence in background threads (each file
+// with its own temporary FileOp) so the FileOp of the sequence can
+// add them to the sprite in order from a single thread.
+class FileOp::SequenceLoader {
+public:
+  // Number of decoded frames (per thread) that can be waiting to be
+  // added to the sprite (so we don't keep the whole sequence in
+  // memory if the consumer is slower than the decoders).
+  static constexpr int kMaxPendingFramesPerThread = 2;
+
+  SequenceLoader(FileOp* fop, const frame_t firstFrame)
+    : m_fop(fop)
+    , m_palette(*fop->m_seq.palette)
+    , m_frames(fop->m_seq.filename_list.size())
+    , m_next(firstFrame)
+    , m_consumed(firstFrame)
+    , m_stop(false)
+  {
+    const int nthreads =
+      std::min<int>(m_frames.size() - firstFrame,
+                    std::max<int>(1, std::thread::hardware_concurrency()));
+    m_maxPending = nthreads * kMaxPendingFramesPerThread;
+
+    for (int i=0; i<nthreads; ++i)
+      m_threads.emplace_back([this]{ decodeFrames(); });
+  }
+
+  ~SequenceLoader() {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_stop = true;
+
+      // Stop the frames that are being decoded right now
+      for (Frame& frame : m_frames) {
+        if (frame.fop)
+          frame.fop->stop();
+      }
+    }
+    m_cv.notify_all();
+
+    for (std::thread& thread : m_threads)
+      thread.join();
+  }
+
+  // Waits the given frame and moves its data to the FileOp of the
+  // sequence as if it were loaded with FileFormat::load(). Frames
+  // must be requested in order.
+  bool load(const frame_t frame) {
+    Frame f;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this, frame]{ return m_frames[frame].ready; });
+      f = std::move(m_frames[frame]);
+      m_consumed = frame+1;
+    }
+    m_cv.notify_all();
+
+    if (!f.error.empty())
+      m_fop->setError("%s", f.error.c_str());
+    if (f.formatOptions)
+      m_fop->m_formatOptions = f.formatOptions;
+    if (f.hasAlpha)
+      m_fop->m_seq.has_alpha = true;
+    if (f.embeddedColorProfile)
+      m_fop->m_embeddedColorProfile = true;
+    if (f.palette) {
+      delete m_fop->m_seq.palette;
+      m_fop->m_seq.palette = f.palette.release();
+    }
+
+    Sprite* sprite = m_fop->m_document->sprite();
+    if (f.colorSpace &&
+        f.colorSpace->type() != gfx::ColorSpace::None &&
+        sprite->colorSpace()->type() == gfx::ColorSpace::None) {
+      sprite->setColorSpace(f.colorSpace);
+      m_fop->m_document->notifyColorSpaceChanged();
+    }
+
+    // Same check as FileOp::sequenceImage(), all frames must have
+    // the same pixel format.
+    if (f.image && f.image->pixelFormat() != sprite->pixelFormat())
+      return false;
+
+    m_fop->m_seq.image = f.image;
+    m_fop->m_seq.last_cel = f.cel.release();
+    return f.loaded;
+  }
+
+private:
+  struct Frame {
+    bool ready = false;
+    bool loaded = false;
+    FileOp* fop = nullptr;      // FileOp used to decode this frame
+    ImageRef image;
+    std::unique_ptr<Cel> cel;
+    std::unique_ptr<Palette> palette;
+    gfx::ColorSpaceRef colorSpace;
+    FormatOptionsPtr formatOptions;
+    std::string error;
+    bool hasAlpha = false;
+    bool embeddedColorProfile = false;
+  };
+
+  void decodeFrames() {
+    for (;;) {
+      frame_t frame;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]{
+          return (m_stop ||
+                  m_next >= frame_t(m_frames.size()) ||
+                  m_next < m_consumed + m_maxPending);
+        });
+        if (m_stop || m_next >= frame_t(m_frames.size()))
+          return;
+        frame = m_next++;
+      }
+
+      // Frames outside the load ROI are returned as empty frames
+      if (!m_fop->m_loadROI.containsFrame(frame)) {
+        {
+          std::unique_lock<std::mutex> lock(m_mutex);
+          m_frames[frame].ready = true;
+          m_frames[frame].loaded = true;
+        }
+        m_cv.notify_all();
+        continue;
+      }
+
+      FileOp fop(FileOpLoad, m_fop->m_context, &m_fop->m_config);
+      fop.m_format = m_fop->m_format;
+      fop.m_filename = m_fop->m_seq.filename_list[frame];
+      fop.m_oneframe = m_fop->m_oneframe;
+      fop.m_createPaletteFromRgba = m_fop->m_createPaletteFromRgba;
+      fop.m_seq.palette = new Palette(m_palette);
+      fop.m_seq.frame = frame;
+      fop.m_seq.has_alpha = false;
+      fop.m_seq.flags = m_fop->m_seq.flags;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_frames[frame].fop = &fop;
+        if (m_stop)
+          fop.stop();
+      }
+
+      Frame result;
+      try {
+        result.loaded = fop.loadSequenceFile();
+      }
+      catch (const std::exception& ex) {
+        fop.setError("%s\n", ex.what());
+      }
+
+      result.ready = true;
+      result.image = fop.m_seq.image;
+      result.cel.reset(fop.m_seq.last_cel);
+      result.palette.reset(fop.m_seq.palette);
+      result.formatOptions = fop.m_formatOptions;
+      result.error = fop.m_error;
+      result.hasAlpha = fop.m_seq.has_alpha;
+      result.embeddedColorProfile = fop.m_embeddedColorProfile;
+      fop.m_seq.last_cel = nullptr;
+      fop.m_seq.palette = nullptr;
+
+      // The frame cel isn't inside the temporary document, we only
+      // need its color space.
+      if (fop.m_document) {
+        result.colorSpace = fop.m_document->sprite()->colorSpace();
+        delete fop.releaseDocument();
+      }
+
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_frames[frame] = std::move(result);
+      }
+      m_cv.notify_all();
+    }
+  }
+
+  FileOp* m_fop;
+  const Palette m_palette;      // Palette after the first frame
+  std::vector<Frame> m_frames;
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  frame_t m_next;               // Next frame to decode
+  frame_t m_consumed;           // Number of frames already moved to m_fop
+  int m_maxPending;
+  bool m_stop;
+};
+
+#ifdef ENABLE_SAVE
+
+// Renders the frames of a sequence to be saved in background
+// threads. Formats with FILE_SUPPORT_PARALLEL_SAVE are encoded in
+// the same threads (each file with its own temporary FileOp), in
+// other case the files are encoded by the FileOp of the sequence.
+// Results are processed in order from a single thread.
+class FileOp::SequenceSaver {
+public:
+  // Number of rendered frames (per thread) that can be waiting to be
+  // saved.
+  static constexpr int kMaxPendingFramesPerThread = 2;
+
+  SequenceSaver(FileOp* fop)
+    : m_fop(fop)
+    , m_encode(fop->m_format->support(FILE_SUPPORT_PARALLEL_SAVE))
+    , m_next(0)
+    , m_consumed(0)
+    , m_stop(false)
+  {
+    // Frames to save and the index of the output file of each one
+    frame_t outputFrame = 0;
+    for (frame_t frame : fop->m_roi.selectedFrames()) {
+      if (fop->m_roi.slice()) {
+        const SliceKey* key = fop->m_roi.slice()->getByFrame(frame);
+        if (!key || key->isEmpty())
+          continue;           // Skip frame because there is no slice key
+      }
+      m_frames.emplace_back(frame, outputFrame++);
+    }
+
+    const int nthreads =
+      std::min<int>(m_frames.size(),
+                    std::max<int>(1, std::thread::hardware_concurrency()));
+    m_maxPending = nthreads * kMaxPendingFramesPerThread;
+
+    for (int i=0; i<nthreads; ++i)
+      m_threads.emplace_back([this]{ renderFrames(); });
+  }
+
+  ~SequenceSaver() {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_stop = true;
+
+      // Stop the frames that are being encoded right now
+      for (Frame& frame : m_frames) {
+        if (frame.fop)
+          frame.fop->stop();
+      }
+    }
+    m_cv.notify_all();
+
+    for (std::thread& thread : m_threads)
+      thread.join();
+  }
+
+  int size() const { return int(m_frames.size()); }
+
+  // Waits the given frame to be rendered (and encoded) and saves it
+  // if it wasn't encoded yet. Returns false if the file cannot be
+  // saved. Frames must be requested in order.
+  bool save(const int i) {
+    Frame f(0, 0);
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this, i]{ return m_frames[i].ready; });
+      f = std::move(m_frames[i]);
+      m_consumed = i+1;
+    }
+    m_cv.notify_all();
+
+    // Empty frame (ignored)
+    if (!f.image)
+      return true;
+
+    if (f.encoded) {
+      if (!f.error.empty())
+        m_fop->setError("%s", f.error.c_str());
+      return f.saved;
+    }
+
+    m_fop->m_seq.image = f.image;
+    return saveFrame(m_fop, f.frame, f.outputFrame);
+  }
+
+private:
+  struct Frame {
+    Frame(const frame_t frame,
+          const frame_t outputFrame)
+      : frame(frame)
+      , outputFrame(outputFrame) {
+    }
+    frame_t frame;
+    frame_t outputFrame;
+    bool ready = false;
+    bool encoded = false;
+    bool saved = false;
+    FileOp* fop = nullptr;      // FileOp used to encode this frame
+    ImageRef image;
+    std::string error;
+  };
+
+  // Saves the frame image (fop->m_seq.image) in its output file.
+  bool saveFrame(FileOp* fop,
+                 const frame_t frame,
+                 const frame_t outputFrame) {
+    // Setup the palette.
+    fop->m_document->sprite()->palette(frame)->copyColorsTo(fop->m_seq.palette);
+
+    // Setup the filename to be used.
+    fop->m_filename = m_fop->m_seq.filename_list[outputFrame];
+
+    // Don't encode the file if it has the same content of the
+    // previous export
+    OutputManifest* manifest = m_fop->m_outputManifest;
+    uint64_t hash = 0;
+    if (manifest) {
+      hash = frameHash(fop);
+      if (manifest->isUnchanged(fop->m_filename, hash))
+        return true;
+    }
+
+    // Make directories
+    {
+      std::string dir = base::get_file_path(fop->m_filename);
+      try {
+        if (!base::is_directory(dir))
+          base::make_all_directories(dir);
+      }
+      catch (const std::exception& ex) {
+        // Ignore errors and make the delegate fail
+        fop->setError("Error creating directory \"%s\"\n%s",
+                      dir.c_str(), ex.what());
+      }
+    }
+
+    // Call the "save" procedure... did it fail?
+    if (!fop->m_format->save(fop)) {
+      fop->setError("Error saving frame %d in the file \"%s\"\n",
+                    outputFrame+1, fop->m_filename.c_str());
+      return false;
+    }
+
+    if (manifest)
+      manifest->update(fop->m_filename, hash);
+    return true;
+  }
+
+  // Hash of everything that the format can write in the file of the
+  // frame image. The format options are not included because they
+  // are not modified in batch mode (the only mode where an
+  // OutputManifest is used).
+  static uint64_t frameHash(const FileOp* fop) {
+    const Sprite* sprite = fop->m_document->sprite();
+    const Image* image = fop->m_seq.image.get();
+    const Palette* palette = fop->m_seq.palette;
+
+    OutputManifest::Hash hash;
+    hash.add(fop->m_format->name());
+    hash.add(int(image->pixelFormat()));
+    hash.add(image->width());
+    hash.add(image->height());
+    const int rowBytes = image->getRowStrideSize();
+    for (int y=0; y<image->height(); ++y)
+      hash.add(image->getPixelAddress(0, y), rowBytes);
+
+    hash.add(palette->size());
+    for (int i=0; i<palette->size(); ++i)
+      hash.add(int(palette->getEntry(i)));
+
+    hash.add(int(sprite->transparentColor()));
+    hash.add(sprite->pixelRatio().w);
+    hash.add(sprite->pixelRatio().h);
+
+    const gfx::ColorSpaceRef& cs = sprite->colorSpace();
+    if (fop->m_config.preserveColorProfile && cs) {
+      const float gamma = cs->gamma();
+      hash.add(int(cs->type()));
+      hash.add(&gamma, sizeof(gamma));
+      hash.add(cs->iccData(), cs->iccSize());
+    }
+    return hash.value();
+  }
+
+  void renderFrames() {
+    const Sprite* sprite = m_fop->m_document->sprite();
+    render::Render render;
+    render.setNewBlend(m_fop->m_config.newBlend);
+    if (!m_fop->m_roi.visibleLayers().empty())
+      render.setVisibleLayers(&m_fop->m_roi.visibleLayers());
+
+    for (;;) {
+      int i;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]{
+          return (m_stop ||
+                  m_next >= int(m_frames.size()) ||
+                  m_next < m_consumed + m_maxPending);
+        });
+        if (m_stop || m_next >= int(m_frames.size()))
+          return;
+        i = m_next++;
+      }
+
+      // m_frames is not resized, so we can read the frame numbers
+      // without locking.
+      const frame_t frame = m_frames[i].frame;
+      const frame_t outputFrame = m_frames[i].outputFrame;
+      Frame result(frame, outputFrame);
+      result.ready = true;
+
+      // Draw the "frame" in "image"
+      ImageRef image;
+      if (m_fop->m_roi.slice()) {
+        const SliceKey* key = m_fop->m_roi.slice()->getByFrame(frame);
+        image.reset(Image::create(sprite->pixelFormat(),
+                                  key->bounds().w,
+                                  key->bounds().h));
+        render.renderSprite(
+          image.get(), sprite, frame,
+          gfx::Clip(gfx::Point(0, 0), key->bounds()));
+      }
+      else {
+        image.reset(Image::create(sprite->pixelFormat(),
+                                  sprite->width(),
+                                  sprite->height()));
+        render.renderSprite(image.get(), sprite, frame);
+      }
+
+      // Check if we have to ignore empty frames
+      if (m_fop->m_ignoreEmpty &&
+          !sprite->isOpaque() &&
+          doc::is_empty_image(image.get())) {
+        image.reset();
+      }
+      result.image = image;
+
+      if (image && m_encode) {
+        FileOp fop(FileOpSave, m_fop->m_context, &m_fop->m_config);
+        fop.m_format = m_fop->m_format;
+        fop.m_document = m_fop->m_document;
+        fop.m_roi = m_fop->m_roi;
+        fop.m_formatOptions = m_fop->m_formatOptions;
+        fop.m_seq.palette = new Palette(frame_t(0), 256);
+        fop.m_seq.image = image;
+        {
+          std::unique_lock<std::mutex> lock(m_mutex);
+          m_frames[i].fop = &fop;
+          if (m_stop)
+            fop.stop();
+        }
+
+        try {
+          result.saved = saveFrame(&fop, frame, outputFrame);
+        }
+        catch (const std::exception& ex) {
+          fop.setError("%s\n", ex.what());
+        }
+        result.encoded = true;
+        result.error = fop.m_error;
+
+        // The document is owned by the FileOp of the sequence
+        fop.m_document = nullptr;
+      }
+
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_frames[i] = std::move(result);
+      }
+      m_cv.notify_all();
+    }
+  }
+
+  FileOp* m_fop;
+  const bool m_encode;          // Encode files in the worker threads
+  std::vector<Frame> m_frames;
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  int m_next;                   // Next frame to render
+  int m_consumed;               // Number of frames already saved
+  int m_maxPending;
+  bool m_stop;
+};
+
+#endif // ENABLE_SAVE
+
+bool FileOp::supportsLoadFramesROI() const
+{
+  return (m_type == FileOpLoad &&
+          (isSequence() ||
+           (m_format && m_format->support(FILE_SUPPORT_LOAD_FRAMES_ROI))));
+}
+
 // Executes the file operation: loads or saves the sprite.
 //
 // It can be called from a different thread of the one used
@@ -597,6 +1144,8 @@ FileOp* FileOp::createSaveDocumentOperation(const Context* context,
 // TODO refactor this code
 void FileOp::operate(IFileOpProgress* progress)
 {
+  DOC_TRACE_ZONE("FileOp::operate");
+
   ASSERT(!isDone());
 
   m_progressInterface = progress;
@@ -638,20 +1187,40 @@ void FileOp::operate(IFileOpProgress* progress)
       m_seq.progress_offset = 0.0f;
       m_seq.progress_fraction = 1.0f / (double)frames;
 
+      // Frames after the first one are decoded in parallel (the first
+      // one creates the document/layer of the whole sequence).
+      std::unique_ptr<SequenceLoader> loader;
+
       auto it = m_seq.filename_list.begin(),
            end = m_seq.filename_list.end();
       for (; it != end; ++it) {
         m_filename = it->c_str();
 
+        if (loader && isStop())
+          break;
+
+        // Files outside the frames to load are not decoded (the
+        // loader returns them as empty frames)
+        const bool skipped = !m_loadROI.containsFrame(frame);
+
         // Call the "load" procedure to read the first bitmap.
-        bool loadres = m_format->load(this);
+        bool loadres = true;
+        if (loader)
+          loadres = loader->load(frame);
+        else if (!skipped) {
+          m_seq.frame = frame;
+          loadres = loadSequenceFile();
+        }
         if (!loadres) {
           setError("Error loading frame %d from file \"%s\"\n",
                    frame+1, m_filename.c_str());
         }
 
+        if (skipped) {
+          // Nothing to add
+        }
         // For the first frame...
-        if (!old_image) {
+        else if (!old_image) {
           // Error reading the first frame
           if (!loadres || !m_document || !m_seq.last_cel) {
             m_seq.image.reset();
@@ -698,7 +1267,20 @@ void FileOp::operate(IFileOpProgress* progress)
 
         ++frame;
         m_seq.progress_offset += m_seq.progress_fraction;
+
+        if (loader) {
+          setProgress(0.0);
+        }
+        // Start decoding the rest of frames in parallel after the
+        // first loaded frame (which creates the document)
+        else if (old_image &&
+                 frames - frame > 1 &&
+                 m_format->support(FILE_SUPPORT_PARALLEL_LOAD) &&
+                 std::thread::hardware_concurrency() > 1) {
+          loader = std::make_unique<SequenceLoader>(this, frame);
+        }
       }
+      loader.reset();
       m_filename = *m_seq.filename_list.begin();
 
       // Final setup
@@ -754,79 +1336,20 @@ void FileOp::operate(IFileOpProgress* progress)
 
       Sprite* sprite = m_document->sprite();
 
-      // Create a temporary bitmap
-      m_seq.image.reset(Image::create(sprite->pixelFormat(),
-                                      sprite->width(),
-                                      sprite->height()));
-
       m_seq.progress_offset = 0.0f;
       m_seq.progress_fraction = 1.0f / (double)sprite->totalFrames();
 
-      // For each frame in the sprite.
-      render::Render render;
-      render.setNewBlend(m_config.newBlend);
-
-      frame_t outputFrame = 0;
-      for (frame_t frame : m_roi.selectedFrames()) {
-        // Draw the "frame" in "m_seq.image"
-        if (m_roi.slice()) {
-          const SliceKey* key = m_roi.slice()->getByFrame(frame);
-          if (!key || key->isEmpty())
-            continue;           // Skip frame because there is no slice key
-
-          m_seq.image.reset(
-            Image::create(sprite->pixelFormat(),
-                          key->bounds().w,
-                          key->bounds().h));
-
-          render.renderSprite(
-            m_seq.image.get(), sprite, frame,
-            gfx::Clip(gfx::Point(0, 0), key->bounds()));
-        }
-        else {
-          render.renderSprite(m_seq.image.get(), sprite, frame);
-        }
-
-        bool save = true;
-
-        // Check if we have to ignore empty frames
-        if (m_ignoreEmpty &&
-            !sprite->isOpaque() &&
-            doc::is_empty_image(m_seq.image.get())) {
-          save = false;
-        }
-
-        if (save) {
-          // Setup the palette.
-          sprite->palette(frame)->copyColorsTo(m_seq.palette);
-
-          // Setup the filename to be used.
-          m_filename = m_seq.filename_list[outputFrame];
-
-          // Make directories
-          {
-            std::string dir = base::get_file_path(m_filename);
-            try {
-              if (!base::is_directory(dir))
-                base::make_all_directories(dir);
-            }
-            catch (const std::exception& ex) {
-              // Ignore errors and make the delegate fail
-              setError("Error creating directory \"%s\"\n%s",
-                       dir.c_str(), ex.what());
-            }
-          }
-
-          // Call the "save" procedure... did it fail?
-          if (!m_format->save(this)) {
-            setError("Error saving frame %d in the file \"%s\"\n",
-                     outputFrame+1, m_filename.c_str());
+      // Render (and encode) frames in parallel, each file is saved in
+      // order.
+      {
+        SequenceSaver saver(this);
+        for (int i=0; i<saver.size(); ++i) {
+          if (isStop() || !saver.save(i))
             break;
-          }
-        }
 
-        m_seq.progress_offset += m_seq.progress_fraction;
-        ++outputFrame;
+          m_seq.progress_offset += m_seq.progress_fraction;
+          setProgress(0.0);
+        }
       }
 
       m_filename = *m_seq.filename_list.begin();
@@ -843,6 +1366,14 @@ void FileOp::operate(IFileOpProgress* progress)
       }
     }
 
+    // The saved files must be decoded again if they are loaded
+    if (isSequence()) {
+      for (const auto& fn : m_seq.filename_list)
+        DecodedFileCache::instance()->discard(fn);
+    }
+    else
+      DecodedFileCache::instance()->discard(m_filename);
+
     // Save special data from .aseprite-data file
     if (m_document &&
         m_document->sprite() &&
@@ -1121,6 +1652,73 @@ Image* FileOp::sequenceImage(PixelFormat pixelFormat, int w, int h)
   return m_seq.image.get();
 }
 
+// Loads the m_filename file of the sequence (the image, palette,
+// etc.) from the DecodedFileCache if it was already decoded, or
+// decoding it with the file format.
+bool FileOp::loadSequenceFile()
+{
+  DecodedFileCache* cache = DecodedFileCache::instance();
+  const bool newDocument = (m_document == nullptr);
+
+  DecodedFile file;
+  if (cache->get(m_filename, file)) {
+    Image* image = sequenceImage(file.image->pixelFormat(),
+                                 file.image->width(),
+                                 file.image->height());
+    if (!image)
+      return false;
+
+    copy_image(image, file.image.get());
+    if (file.palette)
+      file.palette->copyColorsTo(m_seq.palette);
+    if (file.hasAlpha)
+      sequenceSetHasAlpha(true);
+    if (file.embeddedColorProfile)
+      setEmbeddedColorProfile();
+    if (file.formatOptions)
+      setLoadedFormatOptions(file.formatOptions->clone());
+
+    Sprite* sprite = m_document->sprite();
+    if (newDocument)
+      sprite->setTransparentColor(file.transparentColor);
+    if (file.colorSpace &&
+        file.colorSpace->type() != gfx::ColorSpace::None &&
+        sprite->colorSpace()->type() == gfx::ColorSpace::None) {
+      sprite->setColorSpace(file.colorSpace);
+      m_document->notifyColorSpaceChanged();
+    }
+    return true;
+  }
+
+  const int paletteModifications = m_seq.palette->getModifications();
+  const bool loaded = m_format->load(this);
+
+  // We only cache files that have created the document (so we know
+  // the transparent color/color space that the format has set, and
+  // has_alpha/format options don't come from previous files), are
+  // complete images, and their format options can be copied.
+  if (!loaded || !newDocument || !m_document || !m_seq.image ||
+      hasError() || isStop() || m_reducedScaleImage)
+    return loaded;
+
+  if (m_formatOptions) {
+    file.formatOptions = m_formatOptions->clone();
+    if (!file.formatOptions)
+      return loaded;
+  }
+
+  const Sprite* sprite = m_document->sprite();
+  file.image.reset(Image::createCopy(m_seq.image.get()));
+  if (m_seq.palette->getModifications() != paletteModifications)
+    file.palette = std::make_shared<Palette>(*m_seq.palette);
+  file.colorSpace = sprite->colorSpace();
+  file.transparentColor = sprite->transparentColor();
+  file.hasAlpha = m_seq.has_alpha;
+  file.embeddedColorProfile = m_embeddedColorProfile;
+  cache->put(m_filename, file);
+  return loaded;
+}
+
 void FileOp::setError(const char *format, ...)
 {
   char buf_error[4096];         // TODO possible stack overflow
@@ -1210,8 +1808,11 @@ FileOp::FileOp(FileOpType type,
   , m_done(false)
   , m_stop(false)
   , m_oneframe(false)
+  , m_thumbnailOnly(false)
+  , m_reducedScaleImage(false)
   , m_createPaletteFromRgba(false)
   , m_ignoreEmpty(false)
+  , m_outputManifest(nullptr)
   , m_embeddedColorProfile(false)
   , m_embeddedGridBounds(false)
 {
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -20,10 +20,13 @@
 #include "doc/image_ref.h"
 #include "doc/pixel_format.h"
 #include "doc/selected_frames.h"
+#include "doc/selected_layers.h"
+#include "gfx/rect.h"
 
 #include <cstdio>
 #include <memory>
 #include <string>
+#include <vector>
 
 // Flags for FileOp::createLoadDocumentOperation()
 #define FILE_LOAD_SEQUENCE_NONE         0x00000001
@@ -33,6 +36,12 @@
 #define FILE_LOAD_ONE_FRAME             0x00000010
 #define FILE_LOAD_DATA_FILE             0x00000020
 #define FILE_LOAD_CREATE_PALETTE        0x00000040
+#define FILE_LOAD_THUMBNAIL             0x00000080
+
+// Max size of thumbnails. Formats that can decode a reduced-scale
+// version of the file (JPEG) use it with FILE_LOAD_THUMBNAIL to load
+// the smallest image that is still bigger than a thumbnail.
+#define FILE_THUMBNAIL_SIZE             128
 
 namespace doc {
   class Tag;
@@ -52,6 +61,7 @@ namespace app {
 
   class Context;
   class FileFormat;
+  class OutputManifest;
 
   using namespace doc;
 
@@ -87,11 +97,72 @@ namespace app {
       return (doc::frame_t)m_selFrames.size();
     }
 
+    // Layers to render instead of the visible ones, so the layers
+    // visibility doesn't need to be changed to save a specific set of
+    // layers (empty means that the visible layers are saved). This is
+    // used only in formats that support FILE_SUPPORT_SEQUENCES.
+    const doc::SelectedLayers& visibleLayers() const { return m_visibleLayers; }
+    void setVisibleLayers(const doc::SelectedLayers& layers) {
+      m_visibleLayers = layers;
+    }
+
   private:
     const Doc* m_document;
     doc::Slice* m_slice;
     doc::Tag* m_tag;
     doc::SelectedFrames m_selFrames;
+    doc::SelectedLayers m_visibleLayers;
+  };
+
+  // Parts of the file to load (by default the whole file is
+  // loaded). Formats that support partial loading (.aseprite, GIF,
+  // and sequences of files) don't decode the cels outside the given
+  // frames, layers, or bounds. The sprite keeps the frames and layers
+  // of the file (so frame numbers and layer names are the same), only
+  // the skipped cels are missing.
+  class FileOpLoadROI {
+  public:
+    FileOpLoadROI() { }
+
+    // Frames to load (empty means all frames)
+    const doc::SelectedFrames& frames() const { return m_frames; }
+    void setFrames(const doc::SelectedFrames& frames) { m_frames = frames; }
+
+    // Paths of the layers to load with the same syntax of the --layer
+    // CLI option, e.g. "Group/Layer", "Group/*" or just the layer
+    // name (empty means all layers).
+    const std::vector<std::string>& layers() const { return m_layers; }
+    void setLayers(const std::vector<std::string>& layers) { m_layers = layers; }
+
+    // Area of the sprite to load (empty means the whole canvas)
+    const gfx::Rect& bounds() const { return m_bounds; }
+    void setBounds(const gfx::Rect& bounds) { m_bounds = bounds; }
+
+    bool isEmpty() const {
+      return (m_frames.empty() &&
+              m_layers.empty() &&
+              m_bounds.isEmpty());
+    }
+
+    bool containsFrame(const doc::frame_t frame) const {
+      return (m_frames.empty() || m_frames.contains(frame));
+    }
+
+    // Returns true if there is no frame to load after the given one.
+    bool isAfterLastFrame(const doc::frame_t frame) const {
+      return (!m_frames.empty() && frame > m_frames.lastFrame());
+    }
+
+    bool containsLayer(const doc::Layer* layer) const;
+
+    bool intersects(const gfx::Rect& bounds) const {
+      return (m_bounds.isEmpty() || m_bounds.intersects(bounds));
+    }
+
+  private:
+    doc::SelectedFrames m_frames;
+    std::vector<std::string> m_layers;
+    gfx::Rect m_bounds;
   };
 
   // Structure to load & save files.
@@ -111,12 +182,28 @@ namespace app {
                                                const FileOpROI& roi,
                                                const std::string& filename,
                                                const std::string& filenameFormat,
-                                               const bool ignoreEmptyFrames);
+                                               const bool ignoreEmptyFrames,
+                                               const FileOpConfig* config = nullptr);
 
     ~FileOp();
 
     bool isSequence() const { return !m_seq.filename_list.empty(); }
     bool isOneFrame() const { return m_oneframe; }
+    bool isThumbnailOnly() const { return m_thumbnailOnly; }
+
+    // Used by file formats that decode a reduced-scale image when
+    // isThumbnailOnly() is true (so it's not added to the
+    // DecodedFileCache as the image of the file).
+    void setReducedScaleImage() { m_reducedScaleImage = true; }
+
+    // Parts of the file to load (must be set before operate())
+    const FileOpLoadROI& loadROI() const { return m_loadROI; }
+    void setLoadROI(const FileOpLoadROI& roi) { m_loadROI = roi; }
+
+    // Returns true if the frames outside loadROI() are created as
+    // empty frames (so the sprite has all the frames/layers of the
+    // file, e.g. to load the rest of frames with other FileOp).
+    bool supportsLoadFramesROI() const;
     bool preserveColorProfile() const { return m_config.preserveColorProfile; }
 
     const std::string& filename() const { return m_filename; }
@@ -131,6 +218,11 @@ namespace app {
 
     const FileOpROI& roi() const { return m_roi; }
 
+    // If it's specified, the files of a sequence that would be saved
+    // with the same content of the previous export are skipped (see
+    // OutputManifest).
+    void setOutputManifest(OutputManifest* manifest) { m_outputManifest = manifest; }
+
     void createDocument(Sprite* spr);
     void operate(IFileOpProgress* progress = nullptr);
 
@@ -217,14 +309,27 @@ namespace app {
     void setEmbeddedGridBounds() { m_embeddedGridBounds = true; }
     bool hasEmbeddedGridBounds() const { return m_embeddedGridBounds; }
 
+    // Thumbnail stored in the file (only when FILE_LOAD_THUMBNAIL is
+    // used and the file format supports it).
+    void setEmbeddedThumbnail(const ImageRef& thumbnail) { m_embeddedThumbnail = thumbnail; }
+    const ImageRef& embeddedThumbnail() const { return m_embeddedThumbnail; }
+
     bool newBlend() const { return m_config.newBlend; }
+    int aseCompressionLevel() const { return m_config.aseCompressionLevel; }
+    bool aseSaveThumbnail() const { return m_config.aseSaveThumbnail; }
+    bool gifCroppedCels() const { return m_config.gifCroppedCels; }
 
   private:
+    class SequenceLoader;
+    class SequenceSaver;
+
     FileOp();                   // Undefined
     FileOp(FileOpType type,
            Context* context,
            const FileOpConfig* config);
 
+    bool loadSequenceFile();
+
     FileOpType m_type;          // Operation type: 0=load, 1=save.
     FileFormat* m_format;
     Context* m_context;
@@ -234,6 +339,7 @@ namespace app {
     std::string m_filename;     // File-name to load/save.
     std::string m_dataFilename; // File-name for a special XML .aseprite-data where extra sprite data can be stored
     FileOpROI m_roi;
+    FileOpLoadROI m_loadROI;
 
     // Shared fields between threads.
     mutable base::mutex m_mutex; // Mutex to access to the next two fields.
@@ -245,8 +351,13 @@ namespace app {
     bool m_oneframe;            // Load just one frame (in formats
                                 // that support animation like
                                 // GIF/FLI/ASE).
+    bool m_thumbnailOnly;       // Load just the embedded thumbnail if
+                                // the file has one (or a
+                                // reduced-scale image).
+    bool m_reducedScaleImage;   // See setReducedScaleImage()
     bool m_createPaletteFromRgba;
     bool m_ignoreEmpty;
+    OutputManifest* m_outputManifest;
 
     // True if the file contained a color profile when it was loaded.
     bool m_embeddedColorProfile;
@@ -254,6 +365,9 @@ namespace app {
     // True if the file contained a the grid bounds inside.
     bool m_embeddedGridBounds;
 
+    // Thumbnail loaded from the file (FILE_LOAD_THUMBNAIL).
+    ImageRef m_embeddedThumbnail;
+
     FileOpConfig m_config;
 
     // Options
@@ -284,8 +398,10 @@ namespace app {
   base::paths get_writable_extensions(const int requiredFormatFlag = 0);
 
   // High-level routines to load/save documents.
-  Doc* load_document(Context* context, const std::string& filename);
-  int save_document(Context* context, Doc* document);
+  Doc* load_document(Context* context, const std::string& filename,
+                     const FileOpLoadROI& roi = FileOpLoadROI());
+  int save_document(Context* context, Doc* document,
+                    OutputManifest* outputManifest = nullptr);
 
   // Returns true if the given filename contains a file extension that
   // can be used to save only static images (i.e. animations are saved
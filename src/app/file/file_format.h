@@ -30,6 +30,9 @@
 #define FILE_SUPPORT_TAGS               0x00001000
 #define FILE_SUPPORT_BIG_PALETTES       0x00002000 // Palettes w/more than 256 colors
 #define FILE_SUPPORT_PALETTE_WITH_ALPHA 0x00004000
+#define FILE_SUPPORT_PARALLEL_LOAD      0x00008000 // Files of a sequence can be decoded in parallel
+#define FILE_SUPPORT_PARALLEL_SAVE      0x00010000 // Files of a sequence can be encoded in parallel
+#define FILE_SUPPORT_LOAD_FRAMES_ROI    0x00020000 // Frames outside FileOpLoadROI are skipped (but created as empty frames)
 
 namespace app {
 
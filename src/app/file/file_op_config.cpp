@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -21,6 +21,9 @@ void FileOpConfig::fillFromPreferences()
   missingProfile = Preferences::instance().color.missingProfile();
   newBlend = Preferences::instance().experimental.newBlend();
   defaultSliceColor = Preferences::instance().slices.defaultColor();
+  aseCompressionLevel = Preferences::instance().ase.compressionLevel();
+  aseSaveThumbnail = Preferences::instance().ase.saveThumbnail();
+  gifCroppedCels = Preferences::instance().gif.croppedCels();
   workingCS = get_working_rgb_space_from_preferences();
 }
 
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -32,6 +32,18 @@ namespace app {
 
     app::Color defaultSliceColor = app::Color::fromRgb(0, 0, 255);
 
+    // zlib compression level for .aseprite files (-1 = zlib default)
+    int aseCompressionLevel = -1;
+
+    // True if a thumbnail chunk should be saved in .aseprite files
+    // (disabled by default because old versions don't know this chunk)
+    bool aseSaveThumbnail = false;
+
+    // True if GIF frames should be loaded in cels with the bounds of
+    // their non-transparent pixels (and identical frames as linked
+    // cels) instead of full canvas cels.
+    bool gifCroppedCels = true;
+
     void fillFromPreferences();
   };
 
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -13,15 +13,16 @@
 #include "app/file/file.h"
 #include "app/file/file_format.h"
 #include "app/file/format_options.h"
+#include "app/file/frame_renderer.h"
 #include "app/modules/palettes.h"
 #include "app/pref/preferences.h"
 #include "base/file_handle.h"
 #include "doc/doc.h"
 #include "flic/flic.h"
-#include "render/render.h"
 
 #include <algorithm>
 #include <cstdio>
+#include <vector>
 
 namespace app {
 
@@ -134,7 +135,7 @@ bool FliFormat::onLoad(FileOp* fop)
 
     // First frame, or the frame changes
     if (!prevCel ||
-        (count_diff_between_images(prevCel->image(), bmp.get()))) {
+        !is_same_image(prevCel->image(), bmp.get())) {
       // Add the new frame
       ImageRef image(Image::createCopy(bmp.get()));
       Cel* cel = new Cel(frame_out, image);
@@ -220,25 +221,25 @@ bool FliFormat::onSave(FileOp* fop)
   header.speed = get_time_precision(sprite, fop->roi().selectedFrames());
   encoder.writeHeader(header);
 
-  // Create the bitmaps
-  ImageRef bmp(Image::create(IMAGE_INDEXED, sprite->width(), sprite->height()));
-  render::Render render;
-  render.setNewBlend(fop->newBlend());
+  // Frames to write (the first frame is written again at the end as
+  // the ring frame)
+  std::vector<frame_t> frames;
+  for (frame_t frame : fop->roi().selectedFrames())
+    frames.push_back(frame);
+  const frame_t nframes = frame_t(frames.size());
+  if (nframes > 0)
+    frames.push_back(frames.front());
+
+  // Next frames are rendered in other threads while this one is
+  // encoded
+  FrameRenderer renderer(sprite, frames, IMAGE_INDEXED, fop->newBlend());
 
   // Write frame by frame
   flic::Frame fliFrame;
-  fliFrame.pixels = bmp->getPixelAddress(0, 0);
-  fliFrame.rowstride = IndexedTraits::getRowStrideBytes(bmp->width());
-
-  auto frame_beg = fop->roi().selectedFrames().begin();
-  auto frame_end = fop->roi().selectedFrames().end();
-  auto frame_it = frame_beg;
-  frame_t nframes = fop->roi().frames();
-  for (frame_t f=0; f<=nframes; ++f, ++frame_it) {
-    if (frame_it == frame_end)
-      frame_it = frame_beg;
+  fliFrame.rowstride = IndexedTraits::getRowStrideBytes(sprite->width());
 
-    frame_t frame = *frame_it;
+  for (frame_t f=0; f<frame_t(frames.size()); ++f) {
+    frame_t frame = frames[f];
     const Palette* pal = sprite->palette(frame);
     int size = std::min(256, pal->size());
 
@@ -249,8 +250,10 @@ bool FliFormat::onSave(FileOp* fop)
       fliFrame.colormap[c].b = rgba_getb(color);
     }
 
-    // Render the frame in the bitmap
-    render.renderSprite(bmp.get(), sprite, frame);
+    // Wait the rendered frame (the encoder keeps its own copy of the
+    // previous frame to calculate the delta chunks)
+    ImageRef bmp = renderer.image(f);
+    fliFrame.pixels = bmp->getPixelAddress(0, 0);
 
     // How many times this frame should be written to get the same
     // time that it has in the sprite
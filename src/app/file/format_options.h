@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -19,6 +19,11 @@ namespace app {
   class FormatOptions {
   public:
     virtual ~FormatOptions() { }
+
+    // Returns a copy of these options for other document (e.g. when
+    // a file is loaded from the DecodedFileCache), or nullptr if the
+    // options cannot be copied.
+    virtual std::shared_ptr<FormatOptions> clone() const { return nullptr; }
   };
 
   typedef std::shared_ptr<FormatOptions> FormatOptionsPtr;
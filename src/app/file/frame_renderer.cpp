@@ -0,0 +1,108 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/file/frame_renderer.h"
+
+#include "doc/image.h"
+#include "doc/sprite.h"
+#include "render/render.h"
+
+#include <algorithm>
+
+namespace app {
+
+using namespace doc;
+
+FrameRenderer::FrameRenderer(const Sprite* sprite,
+                             const std::vector<frame_t>& frames,
+                             const PixelFormat pixelFormat,
+                             const bool newBlend,
+                             const PostProcess& postProcess)
+  : m_sprite(sprite)
+  , m_frames(frames)
+  , m_images(frames.size())
+  , m_pixelFormat(pixelFormat)
+  , m_newBlend(newBlend)
+  , m_postProcess(postProcess)
+  , m_next(0)
+  , m_consumed(0)
+  , m_stop(false)
+{
+  const int nthreads =
+    std::min<int>(m_frames.size(),
+                  std::max<int>(1, std::thread::hardware_concurrency()));
+  m_maxPending = nthreads * kMaxPendingFramesPerThread;
+
+  for (int i=0; i<nthreads; ++i)
+    m_threads.emplace_back([this]{ renderFrames(); });
+}
+
+FrameRenderer::~FrameRenderer()
+{
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+
+  for (std::thread& thread : m_threads)
+    thread.join();
+}
+
+ImageRef FrameRenderer::image(const int i)
+{
+  ImageRef image;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this, i]{ return m_images[i] != nullptr; });
+    std::swap(image, m_images[i]);
+    m_consumed = i+1;
+  }
+  m_cv.notify_all();
+  return image;
+}
+
+void FrameRenderer::renderFrames()
+{
+  render::Render render;
+  render.setNewBlend(m_newBlend);
+  render.setThreads(1);
+
+  const int n = int(m_frames.size());
+  for (;;) {
+    int i;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this, n]{
+        return (m_stop ||
+                m_next >= n ||
+                m_next < m_consumed + m_maxPending);
+      });
+      if (m_stop || m_next >= n)
+        return;
+      i = m_next++;
+    }
+
+    ImageRef image(Image::create(m_pixelFormat,
+                                 m_sprite->width(),
+                                 m_sprite->height()));
+    render.renderSprite(image.get(), m_sprite, m_frames[i]);
+    if (m_postProcess)
+      m_postProcess(image.get());
+
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_images[i] = image;
+    }
+    m_cv.notify_all();
+  }
+}
+
+} // namespace app
@@ -0,0 +1,73 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_FILE_FRAME_RENDERER_H_INCLUDED
+#define APP_FILE_FRAME_RENDERER_H_INCLUDED
+#pragma once
+
+#include "doc/frame.h"
+#include "doc/image_ref.h"
+#include "doc/pixel_format.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace doc {
+  class Image;
+  class Sprite;
+}
+
+namespace app {
+
+  // Renders the given frames of a sprite in background threads (one
+  // render::Render for each thread) while the file format encodes
+  // the already rendered frames in order from the thread that saves
+  // the file.
+  class FrameRenderer {
+  public:
+    // Number of rendered frames (per thread) that can be waiting to
+    // be encoded (so we don't keep the whole animation in memory).
+    static constexpr int kMaxPendingFramesPerThread = 2;
+
+    // Function called from the rendering thread for each rendered
+    // image (e.g. to convert the pixels to the format of the encoder).
+    typedef std::function<void(doc::Image*)> PostProcess;
+
+    FrameRenderer(const doc::Sprite* sprite,
+                  const std::vector<doc::frame_t>& frames,
+                  const doc::PixelFormat pixelFormat,
+                  const bool newBlend,
+                  const PostProcess& postProcess = PostProcess());
+    ~FrameRenderer();
+
+    // Waits the rendered image of frames[i]. Images must be requested
+    // in order.
+    doc::ImageRef image(const int i);
+
+  private:
+    void renderFrames();
+
+    const doc::Sprite* m_sprite;
+    std::vector<doc::frame_t> m_frames;
+    std::vector<doc::ImageRef> m_images;
+    doc::PixelFormat m_pixelFormat;
+    bool m_newBlend;
+    PostProcess m_postProcess;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    int m_next;                 // Next image to render
+    int m_consumed;             // Number of images already encoded
+    int m_maxPending;
+    bool m_stop;
+  };
+
+} // namespace app
+
+#endif
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -23,6 +23,7 @@
 #include "app/util/autocrop.h"
 #include "base/file_handle.h"
 #include "base/fs.h"
+#include "doc/algorithm/shrink_bounds.h"
 #include "doc/doc.h"
 #include "gfx/clip.h"
 #include "render/dithering.h"
@@ -34,6 +35,10 @@
 #include "gif_options.xml.h"
 
 #include <algorithm>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include <gif_lib.h>
 
@@ -213,6 +218,7 @@ public:
     , m_filesize(filesize)
     , m_sprite(nullptr)
     , m_spriteBounds(0, 0, m_gifFile->SWidth, m_gifFile->SHeight)
+    , m_lastCel(nullptr)
     , m_frameNum(0)
     , m_opaque(false)
     , m_disposalMethod(DisposalMethod::NONE)
@@ -248,6 +254,11 @@ public:
       if (m_fop->isOneFrame() && m_frameNum > 0)
         break;
 
+      // Each frame is composited over the previous one, so we have to
+      // decode all the frames until the last one that we need
+      if (m_fop->loadROI().isAfterLastFrame(m_frameNum))
+        break;
+
       if (m_fop->isStop())
         break;
 
@@ -691,21 +702,87 @@ private:
   }
 
   void createCel() {
+    // Frames/layers that are not needed are decoded (to composite the
+    // next frames) but we don't create cels for them
+    const FileOpLoadROI& roi = m_fop->loadROI();
+    if (!roi.containsFrame(m_frameNum) ||
+        !roi.containsLayer(m_layer)) {
+      m_lastCel = nullptr;
+      return;
+    }
+
+    if (!m_fop->gifCroppedCels()) {
+      if (roi.intersects(m_spriteBounds))
+        createCel(m_spriteBounds);
+      else
+        m_lastCel = nullptr;
+      return;
+    }
+
+    // Cel bounds (only the non-transparent pixels, the background
+    // layer needs full cels anyway)
+    gfx::Rect bounds = m_spriteBounds;
+    if (!m_opaque) {
+      const color_t refpixel =
+        (m_currentImage->pixelFormat() == IMAGE_INDEXED ? m_bgIndex: 0);
+      if (!doc::algorithm::shrink_bounds(m_currentImage.get(), bounds, refpixel)) {
+        // Empty frame (we don't need a cel)
+        m_lastCel = nullptr;
+        return;
+      }
+    }
+
+    if (!roi.intersects(bounds)) {
+      m_lastCel = nullptr;
+      return;
+    }
+
+    // Link the cel with the previous one if both frames are equal
+    if (m_lastCel && isSameCelImage(m_lastCel, bounds)) {
+      Cel* cel = Cel::MakeLink(m_frameNum, m_lastCel);
+      m_layer->addCel(cel);
+      m_lastCel = cel;
+      return;
+    }
+
+    createCel(bounds);
+  }
+
+  void createCel(const gfx::Rect& bounds) {
     Cel* cel = new Cel(m_frameNum, ImageRef(0));
     try {
-      ImageRef celImage(Image::createCopy(m_currentImage.get()));
-      try {
-        cel->data()->setImage(celImage);
-      }
-      catch (...) {
-        throw;
-      }
+      ImageRef celImage;
+      if (bounds == m_spriteBounds)
+        celImage.reset(Image::createCopy(m_currentImage.get()));
+      else
+        celImage.reset(crop_image(m_currentImage.get(), bounds, m_bgIndex));
+      cel->data()->setImage(celImage);
+      cel->setPosition(bounds.origin());
       m_layer->addCel(cel);
     }
     catch (...) {
       delete cel;
       throw;
     }
+    m_lastCel = cel;
+  }
+
+  // Returns true if the "bounds" region of m_currentImage contains
+  // the same pixels as the image of the given cel.
+  bool isSameCelImage(const Cel* cel, const gfx::Rect& bounds) const {
+    const Image* image = cel->image();
+    if (cel->bounds() != bounds ||
+        image->pixelFormat() != m_currentImage->pixelFormat())
+      return false;
+
+    const int rowBytes = image->getRowStrideSize(bounds.w);
+    for (int y=0; y<bounds.h; ++y) {
+      if (std::memcmp(image->getPixelAddress(0, y),
+                      m_currentImage->getPixelAddress(bounds.x, bounds.y+y),
+                      rowBytes) != 0)
+        return false;
+    }
+    return true;
   }
 
   void readExtensionRecord() {
@@ -843,6 +920,7 @@ private:
   std::unique_ptr<Sprite> m_sprite;
   gfx::Rect m_spriteBounds;
   LayerImage* m_layer;
+  Cel* m_lastCel;               // Cel of the previous frame (to link equal frames)
   int m_frameNum;
   bool m_opaque;
   DisposalMethod m_disposalMethod;
@@ -1171,19 +1249,25 @@ private:
                   const gfx::Rect& frameBounds,
                   const DisposalMethod disposal,
                   const bool fixDuration) {
-    std::unique_ptr<Palette> framePaletteRef;
-    std::unique_ptr<RgbMap> rgbmapRef;
-    Palette* framePalette = m_sprite->palette(frame);
-    RgbMap* rgbmap = m_sprite->rgbMap(frame);
+    const Palette* framePalette;
+    RgbMap* rgbmap;
 
     // Create optimized palette for RGB/Grayscale images
     if (m_quantizeColormaps) {
-      framePaletteRef.reset(createOptimizedPalette(frameBounds));
-      framePalette = framePaletteRef.get();
+      std::unique_ptr<Palette> optimizedPalette(createOptimizedPalette(frameBounds));
+      updateColorMapping(optimizedPalette.get());
 
-      rgbmapRef.reset(new RgbMap);
-      rgbmap = rgbmapRef.get();
-      rgbmap->regenerate(framePalette, m_transparentIndex);
+      if (!m_mappingRgbmap) {
+        m_mappingRgbmap.reset(new RgbMap);
+        m_mappingRgbmap->regenerate(m_mappingPalette.get(), m_transparentIndex);
+      }
+      framePalette = m_mappingPalette.get();
+      rgbmap = m_mappingRgbmap.get();
+    }
+    else {
+      framePalette = m_sprite->palette(frame);
+      rgbmap = m_sprite->rgbMap(frame);
+      updateColorMapping(framePalette);
     }
 
     // We will store the frameBounds pixels in frameImage, with the
@@ -1220,6 +1304,11 @@ private:
       auto srcIt = srcBits.begin();
       auto dstIt = dstBits.begin();
 
+      // Last mapped color (consecutive pixels usually have the same
+      // color, so we can avoid the m_mappingIndexes lookup)
+      color_t lastColor = 0;
+      int lastIndex = -1;
+
       for (int y=0; y<frameBounds.h; ++y) {
         for (int x=0; x<frameBounds.w; ++x, ++srcIt, ++dstIt) {
           ASSERT(srcIt != srcBits.end());
@@ -1229,17 +1318,32 @@ private:
           int i;
 
           if (rgba_geta(color) >= 128) {
-            i = framePalette->findExactMatch(
-              rgba_getr(color),
-              rgba_getg(color),
-              rgba_getb(color),
-              255,
-              m_transparentIndex);
-            if (i < 0)
-              i = rgbmap->mapColor(rgba_getr(color),
-                                   rgba_getg(color),
-                                   rgba_getb(color),
-                                   255);
+            color &= rgba_rgb_mask;
+            if (lastIndex >= 0 && color == lastColor) {
+              i = lastIndex;
+            }
+            else {
+              auto it = m_mappingIndexes.find(color);
+              if (it != m_mappingIndexes.end()) {
+                i = it->second;
+              }
+              else {
+                i = framePalette->findExactMatch(
+                  rgba_getr(color),
+                  rgba_getg(color),
+                  rgba_getb(color),
+                  255,
+                  m_transparentIndex);
+                if (i < 0)
+                  i = rgbmap->mapColor(rgba_getr(color),
+                                       rgba_getg(color),
+                                       rgba_getb(color),
+                                       255);
+                m_mappingIndexes[color] = i;
+              }
+              lastColor = color;
+              lastIndex = i;
+            }
           }
           else {
             ASSERT(m_transparentIndex >= 0);
@@ -1338,6 +1442,18 @@ private:
       GifFreeMapObject(colormap);
   }
 
+  // Discards the cached color mapping if the given palette is
+  // different to the palette of the previous frame.
+  void updateColorMapping(const Palette* palette) {
+    if (m_mappingPalette &&
+        m_mappingPalette->countDiff(palette, nullptr, nullptr) == 0)
+      return;
+
+    m_mappingPalette.reset(new Palette(*palette));
+    m_mappingRgbmap.reset();
+    m_mappingIndexes.clear();
+  }
+
   Palette* createOptimizedPalette(const gfx::Rect& frameBounds) {
     render::PaletteOptimizer optimizer;
 
@@ -1370,18 +1486,21 @@ private:
     int n = 1 << GifBitSizeLimited(palette->size());
     ColorMapObject* colormap = GifMakeMapObject(n, nullptr);
 
-    // Color space conversions
-    ConvertCS convert = convert_from_custom_to_srgb(
-      m_document->osColorSpace());
-
+    std::vector<color_t> colors(n);
     for (int i=0; i<n; ++i) {
-      color_t color;
       if (i < palette->size())
-        color = palette->getEntry(i);
+        colors[i] = palette->getEntry(i);
       else
-        color = rgba(0, 0, 0, 255);
+        colors[i] = rgba(0, 0, 0, 255);
+    }
 
-      color = convert(color);
+    // Color space conversions (all colors at once)
+    ConvertCS convert = convert_from_custom_to_srgb(
+      m_document->osColorSpace());
+    convert.convertRgba(&colors[0], &colors[0], n);
+
+    for (int i=0; i<n; ++i) {
+      const color_t color = colors[i];
 
       colormap->Colors[i].Red   = rgba_getr(color);
       colormap->Colors[i].Green = rgba_getg(color);
@@ -1406,6 +1525,13 @@ private:
   bool m_interlaced;
   int m_loop;
   ImageBufferPtr m_frameImageBuf;
+  // Color mapping (RGB colors to palette indexes) of the last encoded
+  // frame, it's reused while the palette doesn't change (e.g. all
+  // frames of an indexed sprite, or frames with the same optimized
+  // palette in RGB sprites).
+  std::unique_ptr<Palette> m_mappingPalette;
+  std::unique_ptr<RgbMap> m_mappingRgbmap; // Only for optimized palettes
+  std::unordered_map<color_t, int> m_mappingIndexes;
   ImageRef m_images[3];
   Image* m_previousImage;
   Image* m_currentImage;
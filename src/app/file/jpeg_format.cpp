@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -25,9 +25,12 @@
 #include "doc/doc.h"
 
 #include <algorithm>
+#include <atomic>
 #include <csetjmp>
 #include <cstdio>
 #include <cstdlib>
+#include <thread>
+#include <vector>
 
 #include "jpeg_options.xml.h"
 
@@ -42,6 +45,9 @@ class JpegFormat : public FileFormat {
   class JpegOptions : public FormatOptions {
   public:
     JpegOptions() : quality(1.0f) { }    // 1.0 maximum quality.
+    FormatOptionsPtr clone() const override {
+      return std::make_shared<JpegOptions>(*this);
+    }
     float quality;
   };
 
@@ -65,13 +71,18 @@ class JpegFormat : public FileFormat {
       FILE_SUPPORT_RGB |
       FILE_SUPPORT_GRAY |
       FILE_SUPPORT_SEQUENCES |
-      FILE_SUPPORT_GET_FORMAT_OPTIONS;
+      FILE_SUPPORT_GET_FORMAT_OPTIONS |
+      FILE_SUPPORT_PARALLEL_LOAD |
+      FILE_SUPPORT_PARALLEL_SAVE;
   }
 
   bool onLoad(FileOp* fop) override;
   gfx::ColorSpaceRef loadColorSpace(FileOp* fop, jpeg_decompress_struct* dinfo);
 #ifdef ENABLE_SAVE
   bool onSave(FileOp* fop) override;
+  bool saveInSlices(FileOp* fop, FILE* file, const int quality);
+  bool compressSlice(FileOp* fop, const int y, const int h,
+                     const int quality, std::vector<uint8_t>& output);
   void saveColorSpace(FileOp* fop, jpeg_compress_struct* cinfo,
                       const gfx::ColorSpace* colorSpace);
 #endif
@@ -169,6 +180,24 @@ bool JpegFormat::onLoad(FileOp* fop)
   // Read file header, set default decompression parameters.
   jpeg_read_header(&dinfo, true);
 
+  // To create thumbnails we can decode a reduced-scale image (1/2,
+  // 1/4 or 1/8 of the original size), libjpeg uses smaller inverse
+  // DCTs in this case, which is a lot faster than decoding the whole
+  // image and then resizing it.
+  if (fop->isThumbnailOnly()) {
+    const int size = std::max(dinfo.image_width, dinfo.image_height);
+    int denom = 1;
+    while (denom < 8 && size / (denom*2) >= FILE_THUMBNAIL_SIZE)
+      denom *= 2;
+
+    dinfo.scale_num = 1;
+    dinfo.scale_denom = denom;
+    if (denom > 1)
+      fop->setReducedScaleImage();
+    dinfo.dct_method = JDCT_IFAST;
+    dinfo.do_fancy_upsampling = false;
+  }
+
   if (dinfo.jpeg_color_space == JCS_GRAYSCALE)
     dinfo.out_color_space = JCS_GRAYSCALE;
   else
@@ -349,26 +378,133 @@ gfx::ColorSpaceRef JpegFormat::loadColorSpace(FileOp* fop, jpeg_decompress_struc
 
 #ifdef ENABLE_SAVE
 
+// Images with less pixels than this are compressed in one thread.
+static constexpr int kMinPixelsToSaveInSlices = 512*512;
+
+// Destination manager to compress a JPEG stream in memory (libjpeg
+// 6b doesn't have jpeg_mem_dest()).
+struct mem_destination_mgr {
+  struct jpeg_destination_mgr head;
+  std::vector<uint8_t>* output;
+};
+
+static void mem_init_destination(j_compress_ptr cinfo)
+{
+  auto dest = (mem_destination_mgr*)cinfo->dest;
+  dest->output->resize(64*1024);
+  dest->head.next_output_byte = dest->output->data();
+  dest->head.free_in_buffer = dest->output->size();
+}
+
+static boolean mem_empty_output_buffer(j_compress_ptr cinfo)
+{
+  auto dest = (mem_destination_mgr*)cinfo->dest;
+  const size_t size = dest->output->size();
+  dest->output->resize(2*size);
+  dest->head.next_output_byte = dest->output->data() + size;
+  dest->head.free_in_buffer = dest->output->size() - size;
+  return true;
+}
+
+static void mem_term_destination(j_compress_ptr cinfo)
+{
+  auto dest = (mem_destination_mgr*)cinfo->dest;
+  dest->output->resize(dest->output->size() - dest->head.free_in_buffer);
+}
+
+static void set_compress_params(jpeg_compress_struct* cinfo,
+                                const Image* image,
+                                const int height,
+                                const int quality)
+{
+  cinfo->image_width = image->width();
+  cinfo->image_height = height;
+
+  if (image->pixelFormat() == IMAGE_GRAYSCALE) {
+    cinfo->input_components = 1;
+    cinfo->in_color_space = JCS_GRAYSCALE;
+  }
+  else {
+    cinfo->input_components = 3;
+    cinfo->in_color_space = JCS_RGB;
+  }
+
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality(cinfo, quality, true);
+  cinfo->dct_method = JDCT_ISLOW;
+  cinfo->smoothing_factor = 0;
+}
+
+// Converts the row "y" of the image to JPEG samples (RGB or gray).
+static void image_row_to_samples(const Image* image, const int y, JSAMPROW dst)
+{
+  if (image->pixelFormat() == IMAGE_RGB) {
+    auto src = (const uint32_t*)image->getPixelAddress(0, y);
+    for (int x=0; x<image->width(); ++x, ++src) {
+      *(dst++) = rgba_getr(*src);
+      *(dst++) = rgba_getg(*src);
+      *(dst++) = rgba_getb(*src);
+    }
+  }
+  else {
+    auto src = (const uint16_t*)image->getPixelAddress(0, y);
+    for (int x=0; x<image->width(); ++x, ++src)
+      *(dst++) = graya_getv(*src);
+  }
+}
+
+// Returns the position where the entropy-coded data of the given
+// JPEG stream starts (just after the SOS marker header) and sets
+// "sosPos" to the position of the SOS marker. Returns 0 if the
+// stream is invalid. If "frameHeight" is not 0, the image height
+// saved in the SOF marker is replaced with it.
+static size_t find_scan_data(std::vector<uint8_t>& data,
+                             size_t& sosPos,
+                             const int frameHeight = 0)
+{
+  size_t i = 2;                 // Skip SOI marker
+  while (i+4 <= data.size() && data[i] == 0xFF) {
+    const int marker = data[i+1];
+    const size_t len = (data[i+2] << 8) | data[i+3];
+
+    // SOF0/1/2 markers: precision (1 byte), height (2), width (2)...
+    if (frameHeight && marker >= 0xC0 && marker <= 0xC2 && len >= 5) {
+      data[i+5] = (frameHeight >> 8) & 0xff;
+      data[i+6] = frameHeight & 0xff;
+    }
+    // SOS marker
+    else if (marker == 0xDA) {
+      sosPos = i;
+      return (i+2+len+2 <= data.size() ? i+2+len: 0);
+    }
+    i += 2+len;
+  }
+  return 0;
+}
+
 bool JpegFormat::onSave(FileOp* fop)
 {
   struct jpeg_compress_struct cinfo;
   struct error_mgr jerr;
   const Image* image = fop->sequenceImage();
-  JSAMPARRAY buffer;
-  JDIMENSION buffer_height;
+  JSAMPROW buffer;
   const auto jpeg_options = std::static_pointer_cast<JpegOptions>(fop->formatOptions());
   const int qualityValue =
     (jpeg_options ? (int)base::clamp(100.0f * jpeg_options->quality, 0.f, 100.f):
                     100);
 
-  int c;
-
   LOG("JPEG: Saving with options: quality=%d\n", qualityValue);
 
   // Open the file for write in it.
   FileHandle handle(open_file_with_exception_sync_on_close(fop->filename(), "wb"));
   FILE* file = handle.get();
 
+  // Compress big images using all CPU cores.
+  if (image->width() * image->height() >= kMinPixelsToSaveInSlices &&
+      std::thread::hardware_concurrency() > 1) {
+    return saveInSlices(fop, file, qualityValue);
+  }
+
   // Allocate and initialize JPEG compression object.
   jerr.fop = fop;
   cinfo.err = jpeg_std_error(&jerr.head);
@@ -378,22 +514,7 @@ bool JpegFormat::onSave(FileOp* fop)
   jpeg_stdio_dest(&cinfo, file);
 
   // SET parameters for compression.
-  cinfo.image_width = image->width();
-  cinfo.image_height = image->height();
-
-  if (image->pixelFormat() == IMAGE_GRAYSCALE) {
-    cinfo.input_components = 1;
-    cinfo.in_color_space = JCS_GRAYSCALE;
-  }
-  else {
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
-  }
-
-  jpeg_set_defaults(&cinfo);
-  jpeg_set_quality(&cinfo, qualityValue, true);
-  cinfo.dct_method = JDCT_ISLOW;
-  cinfo.smoothing_factor = 0;
+  set_compress_params(&cinfo, image, image->height(), qualityValue);
 
   // START compressor.
   jpeg_start_compress(&cinfo, true);
@@ -404,66 +525,23 @@ bool JpegFormat::onSave(FileOp* fop)
     saveColorSpace(fop, &cinfo, fop->document()->sprite()->colorSpace().get());
 
   // CREATE the buffer.
-  buffer_height = 1;
-  buffer = (JSAMPARRAY)base_malloc(sizeof(JSAMPROW) * buffer_height);
+  buffer = (JSAMPROW)base_malloc(sizeof(JSAMPLE) *
+                                 cinfo.image_width * cinfo.num_components);
   if (!buffer) {
     fop->setError("Not enough memory for the buffer.\n");
     jpeg_destroy_compress(&cinfo);
     return false;
   }
 
-  for (c=0; c<(int)buffer_height; c++) {
-    buffer[c] = (JSAMPROW)base_malloc(sizeof(JSAMPLE) *
-                                      cinfo.image_width * cinfo.num_components);
-    if (!buffer[c]) {
-      fop->setError("Not enough memory for buffer scanlines.\n");
-      for (c--; c>=0; c--)
-        base_free(buffer[c]);
-      base_free(buffer);
-      jpeg_destroy_compress(&cinfo);
-      return false;
-    }
-  }
-
   // Write each scan line.
   while (cinfo.next_scanline < cinfo.image_height) {
-    // RGB
-    if (image->pixelFormat() == IMAGE_RGB) {
-      uint32_t* src_address;
-      uint8_t* dst_address;
-      int x, y;
-      for (y=0; y<(int)buffer_height; y++) {
-        src_address = (uint32_t*)image->getPixelAddress(0, cinfo.next_scanline+y);
-        dst_address = ((uint8_t**)buffer)[y];
-
-        for (x=0; x<image->width(); ++x) {
-          c = *(src_address++);
-          *(dst_address++) = rgba_getr(c);
-          *(dst_address++) = rgba_getg(c);
-          *(dst_address++) = rgba_getb(c);
-        }
-      }
-    }
-    // Grayscale.
-    else {
-      uint16_t* src_address;
-      uint8_t* dst_address;
-      int x, y;
-      for (y=0; y<(int)buffer_height; y++) {
-        src_address = (uint16_t*)image->getPixelAddress(0, cinfo.next_scanline+y);
-        dst_address = ((uint8_t**)buffer)[y];
-        for (x=0; x<image->width(); ++x)
-          *(dst_address++) = graya_getv(*(src_address++));
-      }
-    }
-    jpeg_write_scanlines(&cinfo, buffer, buffer_height);
+    image_row_to_samples(image, cinfo.next_scanline, buffer);
+    jpeg_write_scanlines(&cinfo, &buffer, 1);
 
     fop->setProgress((float)(cinfo.next_scanline+1) / (float)(cinfo.image_height));
   }
 
   // Destroy all data.
-  for (c=0; c<(int)buffer_height; c++)
-    base_free(buffer[c]);
   base_free(buffer);
 
   // Finish compression.
@@ -476,6 +554,173 @@ bool JpegFormat::onSave(FileOp* fop)
   return true;
 }
 
+// Compresses horizontal slices of the image in parallel (see
+// compressSlice()), and then the entropy-coded data of all slices is
+// joined in one stream separated by restart markers (RSTn). All
+// slices use the same parameters and default Huffman tables, and a
+// restart marker resets the decoder state (DC predictions and bit
+// buffer) just like each slice encoder started from scratch, so the
+// result is a regular JPEG file with a DRI interval equal to the MCUs
+// of one slice.
+bool JpegFormat::saveInSlices(FileOp* fop, FILE* file, const int quality)
+{
+  const Image* image = fop->sequenceImage();
+  const int w = image->width();
+  const int h = image->height();
+
+  // Get the MCU size for the given parameters (e.g. 16x16 pixels for
+  // RGB images with 2x2 chroma subsampling)
+  int mcuW = 1, mcuH = 1;
+  {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    set_compress_params(&cinfo, image, h, quality);
+    for (int i=0; i<cinfo.num_components; ++i) {
+      mcuW = std::max(mcuW, cinfo.comp_info[i].h_samp_factor);
+      mcuH = std::max(mcuH, cinfo.comp_info[i].v_samp_factor);
+    }
+    jpeg_destroy_compress(&cinfo);
+  }
+  mcuW *= DCTSIZE;
+  mcuH *= DCTSIZE;
+
+  // The restart interval (MCUs in each slice) is a 16-bit value
+  const int nthreads = std::max<int>(1, std::thread::hardware_concurrency());
+  const int mcusPerRow = (w + mcuW - 1) / mcuW;
+  const int mcuRows = (h + mcuH - 1) / mcuH;
+  const int sliceRows = std::max(1, std::min((mcuRows + nthreads - 1) / nthreads,
+                                             0xffff / mcusPerRow));
+  const int sliceH = sliceRows * mcuH;
+  const int nslices = (h + sliceH - 1) / sliceH;
+
+  std::vector<std::vector<uint8_t>> slices(nslices);
+  std::atomic<int> nextSlice(0);
+  std::atomic<int> doneSlices(0);
+  std::atomic<bool> failed(false);
+
+  auto compressSlices = [&](const bool mainThread){
+    for (int i=nextSlice++; i<nslices && !failed; i=nextSlice++) {
+      const int y = i*sliceH;
+      if (!compressSlice(fop, y, std::min(sliceH, h-y), quality, slices[i]))
+        failed = true;
+
+      ++doneSlices;
+      if (mainThread)
+        fop->setProgress(0.9f * float(doneSlices) / float(nslices));
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i=1; i<std::min(nthreads, nslices); ++i)
+    threads.emplace_back([&compressSlices]{ compressSlices(false); });
+  compressSlices(true);         // Use this thread too
+  for (auto& thread : threads)
+    thread.join();
+
+  if (failed)
+    return false;
+
+  // Headers of the first slice (with the height of the whole image)
+  // plus the DRI marker.
+  size_t sosPos = 0;
+  const size_t dataPos = find_scan_data(slices[0], sosPos, h);
+  if (!dataPos) {
+    fop->setError("Error compressing JPEG slices.\n");
+    return false;
+  }
+
+  const int restartInterval = mcusPerRow * sliceRows;
+  const uint8_t dri[] = { 0xFF, 0xDD, 0x00, 0x04,
+                          uint8_t(restartInterval >> 8),
+                          uint8_t(restartInterval & 0xff) };
+  fwrite(&slices[0][0], 1, sosPos, file);
+  fwrite(dri, 1, sizeof(dri), file);
+  fwrite(&slices[0][sosPos], 1, dataPos-sosPos, file);
+
+  // Entropy-coded data of each slice (without its EOI marker)
+  for (int i=0; i<nslices; ++i) {
+    std::vector<uint8_t>& data = slices[i];
+    const size_t pos = (i == 0 ? dataPos: find_scan_data(data, sosPos));
+    if (!pos ||
+        data[data.size()-2] != 0xFF ||
+        data[data.size()-1] != JPEG_EOI) {
+      fop->setError("Error compressing JPEG slices.\n");
+      return false;
+    }
+    fwrite(&data[pos], 1, data.size()-pos-2, file);
+
+    if (i < nslices-1) {
+      const uint8_t rst[] = { 0xFF, uint8_t(JPEG_RST0 + (i & 7)) };
+      fwrite(rst, 1, sizeof(rst), file);
+    }
+
+    // Free memory as soon as possible
+    std::vector<uint8_t>().swap(data);
+  }
+
+  const uint8_t eoi[] = { 0xFF, JPEG_EOI };
+  fwrite(eoi, 1, sizeof(eoi), file);
+
+  if (ferror(file)) {
+    fop->setError("Error writing the JPEG file.\n");
+    return false;
+  }
+
+  fop->setProgress(1.0f);
+  return true;
+}
+
+// Compresses the rows [y, y+h) of the image as an individual JPEG
+// stream in memory (the first slice includes the color profile).
+bool JpegFormat::compressSlice(FileOp* fop, const int y, const int h,
+                               const int quality, std::vector<uint8_t>& output)
+{
+  const Image* image = fop->sequenceImage();
+  std::vector<JSAMPLE> buffer(image->width() * 3);
+  struct jpeg_compress_struct cinfo;
+  struct error_mgr jerr;
+  struct mem_destination_mgr dest;
+
+  jerr.fop = fop;
+  cinfo.err = jpeg_std_error(&jerr.head);
+  jerr.head.error_exit = error_exit;
+  jerr.head.output_message = output_message;
+
+  // Establish the setjmp return context for error_exit to use.
+  if (setjmp(jerr.setjmp_buffer)) {
+    jpeg_destroy_compress(&cinfo);
+    return false;
+  }
+
+  jpeg_create_compress(&cinfo);
+
+  dest.head.init_destination = mem_init_destination;
+  dest.head.empty_output_buffer = mem_empty_output_buffer;
+  dest.head.term_destination = mem_term_destination;
+  dest.output = &output;
+  cinfo.dest = &dest.head;
+
+  set_compress_params(&cinfo, image, h, quality);
+  jpeg_start_compress(&cinfo, true);
+
+  if (y == 0 &&
+      fop->preserveColorProfile() &&
+      fop->document()->sprite()->colorSpace())
+    saveColorSpace(fop, &cinfo, fop->document()->sprite()->colorSpace().get());
+
+  JSAMPROW row = &buffer[0];
+  for (int v=y; v<y+h; ++v) {
+    image_row_to_samples(image, v, row);
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  return true;
+}
+
 void JpegFormat::saveColorSpace(FileOp* fop, jpeg_compress_struct* cinfo,
                                 const gfx::ColorSpace* colorSpace)
 {
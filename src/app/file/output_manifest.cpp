@@ -0,0 +1,117 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/file/output_manifest.h"
+
+#include "base/fs.h"
+#include "base/fstream_path.h"
+
+#include <cstdio>
+#include <fstream>
+
+namespace app {
+
+// static
+std::string OutputManifest::getFilename(const std::string& dir)
+{
+  return base::join_path(dir, ".aseprite-manifest");
+}
+
+bool OutputManifest::isUnchanged(const std::string& filename,
+                                 const uint64_t hash)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const Dir& dir = getDir(base::get_file_path(filename));
+  auto it = dir.entries.find(base::get_file_name(filename));
+  if (it == dir.entries.end() ||
+      it->second.hash != hash ||
+      !base::is_file(filename))
+    return false;
+
+  // The file could be modified/replaced by other program
+  return (it->second.size == base::file_size(filename) &&
+          it->second.mtime == base::get_modification_time(filename));
+}
+
+void OutputManifest::update(const std::string& filename,
+                            const uint64_t hash)
+{
+  Entry entry;
+  entry.hash = hash;
+  entry.mtime = base::get_modification_time(filename);
+  entry.size = base::file_size(filename);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Dir& dir = getDir(base::get_file_path(filename));
+  dir.entries[base::get_file_name(filename)] = entry;
+  dir.modified = true;
+}
+
+bool OutputManifest::save()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  bool result = true;
+  for (auto& it : m_dirs) {
+    Dir& dir = it.second;
+    if (!dir.modified)
+      continue;
+
+    std::ofstream os(FSTREAM_PATH(getFilename(it.first)),
+                     std::ofstream::binary);
+    for (const auto& e : dir.entries) {
+      const Entry& entry = e.second;
+      char buf[128];
+      std::snprintf(buf, sizeof(buf), "%016llx %llu %d %d %d %d %d %d ",
+                    (unsigned long long)entry.hash,
+                    (unsigned long long)entry.size,
+                    entry.mtime.year, entry.mtime.month, entry.mtime.day,
+                    entry.mtime.hour, entry.mtime.minute, entry.mtime.second);
+      os << buf << e.first << '\n';
+    }
+    if (os.good())
+      dir.modified = false;
+    else
+      result = false;
+  }
+  return result;
+}
+
+// Returns the records of the given directory, loading its manifest
+// the first time. Errors reading the file are ignored (the files are
+// just saved again).
+OutputManifest::Dir& OutputManifest::getDir(const std::string& dirname)
+{
+  auto it = m_dirs.find(dirname);
+  if (it != m_dirs.end())
+    return it->second;
+
+  Dir& dir = m_dirs[dirname];
+  std::ifstream is(FSTREAM_PATH(getFilename(dirname)),
+                   std::ifstream::binary);
+  std::string line;
+  while (std::getline(is, line)) {
+    unsigned long long hash, size;
+    Entry entry;
+    int n = 0;
+    if (std::sscanf(line.c_str(), "%llx %llu %d %d %d %d %d %d %n",
+                    &hash, &size,
+                    &entry.mtime.year, &entry.mtime.month, &entry.mtime.day,
+                    &entry.mtime.hour, &entry.mtime.minute, &entry.mtime.second,
+                    &n) < 8 || n <= 0 || n >= int(line.size()))
+      continue;
+
+    entry.hash = hash;
+    entry.size = std::size_t(size);
+    dir.entries[line.substr(n)] = entry;
+  }
+  return dir;
+}
+
+} // namespace app
@@ -0,0 +1,99 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_FILE_OUTPUT_MANIFEST_H_INCLUDED
+#define APP_FILE_OUTPUT_MANIFEST_H_INCLUDED
+#pragma once
+
+#include "base/time.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace app {
+
+  // Hashes of the files saved from the CLI with --skip-unchanged.
+  // Each output directory has its own manifest file, so the next run
+  // can detect the outputs that would be saved with the same content
+  // and skip them (without encoding them, and keeping their
+  // modification time).
+  class OutputManifest {
+  public:
+    // Hash of the content of an output file (its pixels and
+    // metadata). It's not a cryptographic hash, it's used just to
+    // detect changes between two exports.
+    class Hash {
+    public:
+      void add(const void* data, std::size_t size) {
+        auto p = (const uint8_t*)data;
+        for (; size >= 8; size -= 8, p += 8) {
+          uint64_t word;
+          std::memcpy(&word, p, 8);
+          mix(word);
+        }
+        for (; size > 0; --size, ++p)
+          mix(*p);
+      }
+
+      void add(const int value) {
+        mix(uint64_t(uint32_t(value)));
+      }
+
+      void add(const std::string& str) {
+        add(int(str.size()));
+        add(str.c_str(), str.size());
+      }
+
+      uint64_t value() const { return m_value; }
+
+    private:
+      void mix(const uint64_t value) {
+        m_value = (m_value ^ value) * 1099511628211ull;
+        m_value ^= (m_value >> 32);
+      }
+
+      uint64_t m_value = 14695981039346656037ull;
+    };
+
+    static std::string getFilename(const std::string& dir);
+
+    // Returns true if "filename" was saved in a previous run with the
+    // same hash and it wasn't modified since then. It can be called
+    // from several threads at the same time.
+    bool isUnchanged(const std::string& filename, const uint64_t hash);
+
+    // Records the hash of "filename" after saving it.
+    void update(const std::string& filename, const uint64_t hash);
+
+    // Saves the manifests of the directories with new records.
+    // Returns false if one of them cannot be saved.
+    bool save();
+
+  private:
+    struct Entry {
+      uint64_t hash = 0;
+      base::Time mtime;
+      std::size_t size = 0;
+    };
+
+    struct Dir {
+      std::map<std::string, Entry> entries;
+      bool modified = false;
+    };
+
+    Dir& getDir(const std::string& dir);
+
+    std::mutex m_mutex;
+    std::map<std::string, Dir> m_dirs;
+  };
+
+} // namespace app
+
+#endif
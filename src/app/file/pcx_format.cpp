@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -17,6 +18,9 @@
 #include "base/file_handle.h"
 #include "doc/doc.h"
 
+#include <algorithm>
+#include <vector>
+
 namespace app {
 
 using namespace base;
@@ -43,7 +47,9 @@ class PcxFormat : public FileFormat {
       FILE_SUPPORT_RGB |
       FILE_SUPPORT_GRAY |
       FILE_SUPPORT_INDEXED |
-      FILE_SUPPORT_SEQUENCES;
+      FILE_SUPPORT_SEQUENCES |
+      FILE_SUPPORT_PARALLEL_LOAD |
+      FILE_SUPPORT_PARALLEL_SAVE;
   }
 
   bool onLoad(FileOp* fop) override;
@@ -62,7 +68,7 @@ bool PcxFormat::onLoad(FileOp* fop)
   int c, r, g, b;
   int width, height;
   int bpp, bytes_per_line;
-  int xx, po;
+  int xx;
   int x, y;
   char ch = 0;
 
@@ -115,11 +121,17 @@ bool PcxFormat::onLoad(FileOp* fop)
   if (bpp == 24)
     clear_image(image, rgba(0, 0, 0, 255));
 
+  // Each RLE encoded scanline (all its planes) is decoded in a
+  // buffer, and then the planes are copied to the image row
+  const int planes = bpp/8;
+  const int line_size = bytes_per_line*planes;
+  const int w = std::min(image->width(), bytes_per_line);
+  std::vector<uint8_t> line(line_size);
+
   for (y=0; y<height; y++) {       /* read RLE encoded PCX data */
-    x = xx = 0;
-    po = rgba_r_shift;
+    x = 0;
 
-    while (x < bytes_per_line*bpp/8) {
+    while (x < line_size) {
       ch = fgetc(f);
       if ((ch & 0xC0) == 0xC0) {
         c = (ch & 0x3F);
@@ -128,33 +140,22 @@ bool PcxFormat::onLoad(FileOp* fop)
       else
         c = 1;
 
-      if (bpp == 8) {
-        while (c--) {
-          if (x < image->width())
-            put_pixel_fast<IndexedTraits>(image, x, y, ch);
+      c = std::min(c, line_size - x);
+      std::fill(line.begin()+x, line.begin()+x+c, uint8_t(ch));
+      x += c;
+    }
 
-          x++;
-        }
-      }
-      else {
-        while (c--) {
-          if (xx < image->width())
-            put_pixel_fast<RgbTraits>(image, xx, y,
-                                      get_pixel_fast<RgbTraits>(image, xx, y) | ((ch & 0xff) << po));
-
-          x++;
-          if (x == bytes_per_line) {
-            xx = 0;
-            po = rgba_g_shift;
-          }
-          else if (x == bytes_per_line*2) {
-            xx = 0;
-            po = rgba_b_shift;
-          }
-          else
-            xx++;
-        }
-      }
+    if (bpp == 8) {
+      std::copy(line.begin(), line.begin()+w,
+                (IndexedTraits::address_t)image->getPixelAddress(0, y));
+    }
+    else {
+      const uint8_t* r = line.data();
+      const uint8_t* g = r + bytes_per_line;
+      const uint8_t* b = g + bytes_per_line;
+      auto dst = (RgbTraits::address_t)image->getPixelAddress(0, y);
+      for (xx=0; xx<w; ++xx)
+        dst[xx] = rgba(r[xx], g[xx], b[xx], 255);
     }
 
     fop->setProgress((float)(y+1) / (float)(height));
@@ -237,32 +238,43 @@ bool PcxFormat::onSave(FileOp* fop)
   for (c=0; c<54; c++)              /* filler */
     fputc(0, f);
 
+  // Each scanline is packed in planes and RLE encoded in buffers, so
+  // it's written with only one fwrite()
+  const int w = image->width();
+  std::vector<uint8_t> line(w*planes);
+  std::vector<uint8_t> rle;
+  rle.reserve(2*line.size());
+
   for (y=0; y<image->height(); y++) {           /* for each scanline... */
-    runcount = 0;
-    runchar = 0;
-    for (x=0; x<image->width()*planes; x++) {  /* for each pixel... */
-      if (depth == 8) {
-        if (image->pixelFormat() == IMAGE_INDEXED)
-          ch = get_pixel_fast<IndexedTraits>(image, x, y);
-        else if (image->pixelFormat() == IMAGE_GRAYSCALE) {
-          c = get_pixel_fast<GrayscaleTraits>(image, x, y);
-          ch = graya_getv(c);
+    switch (image->pixelFormat()) {
+      case IMAGE_RGB: {
+        auto src = (RgbTraits::const_address_t)image->getPixelAddress(0, y);
+        for (x=0; x<w; ++x) {
+          c = src[x];
+          line[x] = rgba_getr(c);
+          line[w+x] = rgba_getg(c);
+          line[2*w+x] = rgba_getb(c);
         }
+        break;
       }
-      else {
-        if (x < image->width()) {
-          c = get_pixel_fast<RgbTraits>(image, x, y);
-          ch = rgba_getr(c);
-        }
-        else if (x<image->width()*2) {
-          c = get_pixel_fast<RgbTraits>(image, x-image->width(), y);
-          ch = rgba_getg(c);
-        }
-        else {
-          c = get_pixel_fast<RgbTraits>(image, x-image->width()*2, y);
-          ch = rgba_getb(c);
-        }
+      case IMAGE_GRAYSCALE: {
+        auto src = (GrayscaleTraits::const_address_t)image->getPixelAddress(0, y);
+        for (x=0; x<w; ++x)
+          line[x] = graya_getv(src[x]);
+        break;
       }
+      case IMAGE_INDEXED: {
+        auto src = (IndexedTraits::const_address_t)image->getPixelAddress(0, y);
+        std::copy(src, src+w, line.begin());
+        break;
+      }
+    }
+
+    rle.clear();
+    runcount = 0;
+    runchar = 0;
+    for (x=0; x<w*planes; x++) {  /* for each pixel... */
+      ch = line[x];
       if (runcount == 0) {
         runcount = 1;
         runchar = ch;
@@ -270,8 +282,8 @@ bool PcxFormat::onSave(FileOp* fop)
       else {
         if ((ch != runchar) || (runcount >= 0x3f)) {
           if ((runcount > 1) || ((runchar & 0xC0) == 0xC0))
-            fputc(0xC0 | runcount, f);
-          fputc(runchar, f);
+            rle.push_back(0xC0 | runcount);
+          rle.push_back(runchar);
           runcount = 1;
           runchar = ch;
         }
@@ -281,9 +293,10 @@ bool PcxFormat::onSave(FileOp* fop)
     }
 
     if ((runcount > 1) || ((runchar & 0xC0) == 0xC0))
-      fputc(0xC0 | runcount, f);
+      rle.push_back(0xC0 | runcount);
 
-    fputc(runchar, f);
+    rle.push_back(runchar);
+    fwrite(rle.data(), 1, rle.size(), f);
 
     fop->setProgress((float)(y+1) / (float)(image->height()));
   }
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -21,6 +21,7 @@
 #include "doc/doc.h"
 #include "gfx/color_space.h"
 
+#include <algorithm>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -154,6 +155,11 @@ void write_data_fn(rlbox_sandbox<rlbox_wasm2c_sandbox>& _,
 // TODO this should be information in FileOp parameter of onSave()
 static bool fix_one_alpha_pixel = false;
 
+// Max number of bytes of rows transferred to/from the sandbox in each
+// png_read_rows()/png_write_rows() call (each call to the sandbox has
+// a cost, so we process blocks of rows instead of one row per call).
+static constexpr size_t kMaxRowsBlockSize = 1024*1024;
+
 PngEncoderOneAlphaPixel::PngEncoderOneAlphaPixel(bool state)
 {
   fix_one_alpha_pixel = state;
@@ -546,16 +552,25 @@ bool PngFormat::onLoad(FileOp* fop)
 	return thing;	
   });
 
+  // All rows are allocated in one buffer inside the sandbox
+  auto rows_data = sandbox.malloc_in_sandbox<png_byte>(height * numRowBytes);
+  uint8_t* rows_address = rows_data.copy_and_verify_address([](uintptr_t thing) {
+	if ((void*) thing == nullptr) exit(1);
+	return (uint8_t*) thing;
+  });
   for (y = 0; y < height; y++)
-    rows_pointer[y] = sandbox.malloc_in_sandbox<png_byte>(numRowBytes);
+    rows_pointer[y] = rows_data + y*numRowBytes;
+
+  const png_uint_32 blockRows =
+    std::max<png_uint_32>(1, kMaxRowsBlockSize / std::max<size_t>(1, numRowBytes));
 
   for (int pass=0; pass<number_passes; ++pass) {
-    for (y = 0; y < height; y++) {
-   
-      sandbox.invoke_sandbox_function(png_read_rows, png, rows_pointer+y, nullptr, 1);
+    for (y = 0; y < height; y += blockRows) {
+      const png_uint_32 rows = std::min<png_uint_32>(blockRows, height - y);
+      sandbox.invoke_sandbox_function(png_read_rows, png, rows_pointer+y, nullptr, rows);
 
       fop->setProgress(
-        (double)((double)pass + (double)(y+1) / (double)(height))
+        (double)((double)pass + (double)(y+rows) / (double)(height))
         / (double)number_passes);
 
       if (fop->isStop())
@@ -565,13 +580,11 @@ bool PngFormat::onLoad(FileOp* fop)
 
   // Unwrap
 
-  // Convert rows_pointer into the doc::Image
+  // Convert rows_pointer into the doc::Image (we don't use the row
+  // pointers from the sandbox memory, just our own buffer)
   for (y = 0; y < height; y++) {
     // RGB_ALPHA
-    auto unwrap_row_ptr = rows_pointer[y].copy_and_verify_address([](uintptr_t thing) {
-	if ((void*) thing == nullptr) exit(1);
-	return (png_bytep) thing;		    
-    });
+    png_bytep unwrap_row_ptr = rows_address + y*numRowBytes;
     if (color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
       uint8_t* src_address = unwrap_row_ptr;
       uint32_t* dst_address = (uint32_t*)image->getPixelAddress(0, y);
@@ -654,8 +667,8 @@ bool PngFormat::onLoad(FileOp* fop)
       for (x=0; x<width; x++)
         *(dst_address++) = *(src_address++);
     }
-    sandbox.free_in_sandbox<png_byte>(rows_pointer[y]);
   }
+  sandbox.free_in_sandbox<png_byte>(rows_data);
   sandbox.free_in_sandbox<png_bytep>(rows_pointer);
 
   // Setup the color space.
@@ -1031,12 +1044,22 @@ bool PngFormat::onSave(FileOp* fop)
   if (color_type == PNG_COLOR_TYPE_GRAY_ALPHA && thing != 2 * width) exit(1);
   if ((color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_PALETTE) && thing != width) exit(1);
   return thing; });
-  auto tainted_row_pointer = sandbox.malloc_in_sandbox<png_byte>(rowBytes);
+
+  // Rows are converted in a block of rows inside the sandbox, and
+  // each block is written with just one png_write_rows() call.
+  const png_uint_32 blockRows =
+    std::min<png_uint_32>(height,
+                          std::max<png_uint_32>(1, kMaxRowsBlockSize / std::max<png_uint_32>(1, rowBytes)));
+  auto tainted_rows_data = sandbox.malloc_in_sandbox<png_byte>(blockRows * rowBytes);
+  auto tainted_rows_pointer = sandbox.malloc_in_sandbox<png_bytep>(blockRows);
+  uint8_t* rows_address = tainted_rows_data.copy_and_verify_address([] (uintptr_t thing) { if ((void*) thing == nullptr) exit(1); return (uint8_t*) thing; });
+  for (png_uint_32 i=0; i<blockRows; ++i)
+    tainted_rows_pointer[i] = tainted_rows_data + i*rowBytes;
 
   for (png_uint_32 y=0; y<height; ++y) {
-    uint8_t* dst_address = tainted_row_pointer.copy_and_verify_address([] (uintptr_t thing) { if ((void*) thing == nullptr) exit(1); return (uint8_t*) thing; });
+    uint8_t* dst_address = rows_address + (y % blockRows)*rowBytes;
 
-    if (sandbox.invoke_sandbox_function(png_get_color_type, tainted_png, tainted_info).copy_and_verify([] (png_byte thing) { return thing; }) == PNG_COLOR_TYPE_RGB_ALPHA) {
+    if (color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
       unsigned int x, c, a;
       bool opaque = true;
 
@@ -1087,7 +1110,7 @@ bool PngFormat::onSave(FileOp* fop)
         }
       }
     }
-    else if (sandbox.invoke_sandbox_function(png_get_color_type, tainted_png, tainted_info).copy_and_verify([] (png_byte thing) { return thing; }) == PNG_COLOR_TYPE_RGB) {
+    else if (color_type == PNG_COLOR_TYPE_RGB) {
       uint32_t* src_address = (uint32_t*)image->getPixelAddress(0, y);
       unsigned int x, c;
 
@@ -1098,7 +1121,7 @@ bool PngFormat::onSave(FileOp* fop)
         *(dst_address++) = rgba_getb(c);
       }
     }
-    else if (sandbox.invoke_sandbox_function(png_get_color_type, tainted_png, tainted_info).copy_and_verify([] (png_byte thing) { return thing; }) == PNG_COLOR_TYPE_GRAY_ALPHA) {
+    else if (color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
       uint16_t* src_address = (uint16_t*)image->getPixelAddress(0, y);
       unsigned int x, c, a;
       bool opaque = true;
@@ -1118,7 +1141,7 @@ bool PngFormat::onSave(FileOp* fop)
         *(dst_address++) = a;
       }
     }
-    else if (sandbox.invoke_sandbox_function(png_get_color_type, tainted_png, tainted_info).copy_and_verify([] (png_byte thing) { return thing; }) == PNG_COLOR_TYPE_GRAY) {
+    else if (color_type == PNG_COLOR_TYPE_GRAY) {
       uint16_t* src_address = (uint16_t*)image->getPixelAddress(0, y);
       unsigned int x, c;
 
@@ -1127,7 +1150,7 @@ bool PngFormat::onSave(FileOp* fop)
         *(dst_address++) = graya_getv(c);
       }
     }
-    else if (sandbox.invoke_sandbox_function(png_get_color_type, tainted_png, tainted_info).copy_and_verify([] (png_byte thing) { return thing; }) == PNG_COLOR_TYPE_PALETTE) {
+    else if (color_type == PNG_COLOR_TYPE_PALETTE) {
       uint8_t* src_address = (uint8_t*)image->getPixelAddress(0, y);
       unsigned int x;
 
@@ -1135,13 +1158,17 @@ bool PngFormat::onSave(FileOp* fop)
         *(dst_address++) = *(src_address++);
     }
 
-    sandbox.invoke_sandbox_function(png_write_row, tainted_png, tainted_row_pointer);
+    // Write the whole block of rows
+    if ((y+1) % blockRows == 0 || y+1 == height) {
+      sandbox.invoke_sandbox_function(png_write_rows, tainted_png, tainted_rows_pointer,
+                                      (y % blockRows)+1);
 
-    fop->setProgress((double)(y+1) / (double)(height));
+      fop->setProgress((double)(y+1) / (double)(height));
+    }
   }
 
-  // png_free(png, row_pointer);
-  sandbox.invoke_sandbox_function(png_free, tainted_png, tainted_row_pointer);
+  sandbox.free_in_sandbox<png_bytep>(tainted_rows_pointer);
+  sandbox.free_in_sandbox<png_byte>(tainted_rows_data);
   sandbox.invoke_sandbox_function(png_write_end, tainted_png, tainted_info);
 
   if (image->pixelFormat() == IMAGE_INDEXED) {
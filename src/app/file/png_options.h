@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -25,6 +25,10 @@ namespace app {
 
     using Chunks = std::vector<Chunk>;
 
+    FormatOptionsPtr clone() const override {
+      return std::make_shared<PngOptions>(*this);
+    }
+
     void addChunk(Chunk&& chunk) {
       m_userChunks.emplace_back(std::move(chunk));
     }
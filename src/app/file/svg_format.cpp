@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (c) 2018-2020  Igara Studio S.A.
+// Copyright (c) 2018-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -12,6 +12,7 @@
 #include "app/console.h"
 #include "app/context.h"
 #include "app/doc.h"
+#include "app/file/buffered_text_writer.h"
 #include "app/file/file.h"
 #include "app/file/file_format.h"
 #include "app/file/format_options.h"
@@ -24,6 +25,8 @@
 
 #include "svg_options.xml.h"
 
+#include <vector>
+
 namespace app {
 
 using namespace base;
@@ -58,7 +61,8 @@ class SvgFormat : public FileFormat {
       FILE_SUPPORT_INDEXED |
       FILE_SUPPORT_SEQUENCES |
       FILE_SUPPORT_GET_FORMAT_OPTIONS |
-      FILE_SUPPORT_PALETTE_WITH_ALPHA;
+      FILE_SUPPORT_PALETTE_WITH_ALPHA |
+      FILE_SUPPORT_PARALLEL_SAVE;
   }
 
   bool onLoad(FileOp* fop) override;
@@ -80,83 +84,117 @@ bool SvgFormat::onLoad(FileOp* fop)
 
 #ifdef ENABLE_SAVE
 
+namespace {
+
+// Rectangle of pixels with the same color. Runs of same color pixels
+// in a row are merged in one rectangle, and rectangles with the same
+// horizontal span and color in consecutive rows are merged too.
+struct SvgRect {
+  int x, y, w, h;
+  color_t color;                // RGBA color (alpha != 0)
+};
+
+} // anonymous namespace
+
 bool SvgFormat::onSave(FileOp* fop)
 {
   const Image* image = fop->sequenceImage();
-  int x, y, c, r, g, b, a, alpha;
+  int x, y, c, r, g, b, a;
   const auto svg_options = std::static_pointer_cast<SvgOptions>(fop->formatOptions());
   const int pixelScaleValue = base::clamp(svg_options->pixelScale, 0, 10000);
   FileHandle handle(open_file_with_exception_sync_on_close(fop->filename(), "wb"));
   FILE* f = handle.get();
-  auto printcol = [f](int x, int y,int r, int g, int b, int a, int pxScale) {
-    fprintf(f, "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" fill=\"#%02X%02X%02X\" ",
-            x*pxScale, y*pxScale, pxScale, pxScale, r, g, b);
-    if (a != 255)
-      fprintf(f, "opacity=\"%f\" ", (float)a / 255.0);
-    fprintf(f, "/>\n");
+  BufferedTextWriter w(f);
+
+  auto printRect = [&w](const SvgRect& rc, int pxScale) {
+    w.printf("<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" fill=\"#%02X%02X%02X\" ",
+             rc.x*pxScale, rc.y*pxScale, rc.w*pxScale, rc.h*pxScale,
+             rgba_getr(rc.color), rgba_getg(rc.color), rgba_getb(rc.color));
+    if (rgba_geta(rc.color) != 255)
+      w.printf("opacity=\"%f\" ", (float)rgba_geta(rc.color) / 255.0);
+    w.write("/>\n");
   };
-  fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n");
-  fprintf(f, "<svg version=\"1.1\" width=\"%d\" height=\"%d\" xmlns=\"http://www.w3.org/2000/svg\" shape-rendering=\"crispEdges\">\n",
-          image->width()*pixelScaleValue, image->height()*pixelScaleValue);
-
-  switch (image->pixelFormat()) {
 
-    case IMAGE_RGB: {
-      for (y=0; y<image->height(); y++) {
-        for (x=0; x<image->width(); x++) {
-          c = get_pixel_fast<RgbTraits>(image, x, y);
-          alpha = rgba_geta(c);
-          if (alpha != 0x00)
-            printcol(x, y, rgba_getr(c), rgba_getg(c), rgba_getb(c), alpha, pixelScaleValue);
-        }
-        fop->setProgress((float)y / (float)(image->height()));
-      }
-      break;
+  w.write("<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n");
+  w.printf("<svg version=\"1.1\" width=\"%d\" height=\"%d\" xmlns=\"http://www.w3.org/2000/svg\" shape-rendering=\"crispEdges\">\n",
+           image->width()*pixelScaleValue, image->height()*pixelScaleValue);
+
+  // Converts a pixel of the image to a RGBA color (transparent
+  // pixels are not saved)
+  color_t palette[256];
+  color_t mask_color = -1;
+  if (image->pixelFormat() == IMAGE_INDEXED) {
+    for (y=0; y<256; y++) {
+      fop->sequenceGetColor(y, &r, &g, &b);
+      fop->sequenceGetAlpha(y, &a);
+      palette[y] = rgba(r, g, b, a);
     }
-    case IMAGE_GRAYSCALE: {
-      for (y=0; y<image->height(); y++) {
+    if (fop->document()->sprite()->backgroundLayer() == NULL ||
+        !fop->document()->sprite()->backgroundLayer()->isVisible()) {
+      mask_color = fop->document()->sprite()->transparentColor();
+    }
+  }
+
+  std::vector<color_t> row(image->width());
+  std::vector<SvgRect> prevRects, rects;
+  for (y=0; y<image->height(); y++) {
+    switch (image->pixelFormat()) {
+      case IMAGE_RGB:
+        for (x=0; x<image->width(); x++)
+          row[x] = get_pixel_fast<RgbTraits>(image, x, y);
+        break;
+      case IMAGE_GRAYSCALE:
         for (x=0; x<image->width(); x++) {
           c = get_pixel_fast<GrayscaleTraits>(image, x, y);
-          auto v = graya_getv(c);
-          alpha = graya_geta(c);
-          if (alpha != 0x00)
-            printcol(x, y, v, v, v, alpha, pixelScaleValue);
+          const int v = graya_getv(c);
+          row[x] = rgba(v, v, v, graya_geta(c));
         }
-        fop->setProgress((float)y / (float)(image->height()));
-      }
-      break;
-    }
-    case IMAGE_INDEXED: {
-      unsigned char image_palette[256][4];
-      for (y=0; y<256; y++) {
-        fop->sequenceGetColor(y, &r, &g, &b);
-        image_palette[y][0] = r;
-        image_palette[y][1] = g;
-        image_palette[y][2] = b;
-        fop->sequenceGetAlpha(y, &a);
-        image_palette[y][3] = a;
-      }
-      color_t mask_color = -1;
-      if (fop->document()->sprite()->backgroundLayer() == NULL ||
-          !fop->document()->sprite()->backgroundLayer()->isVisible()) {
-        mask_color = fop->document()->sprite()->transparentColor();
-      }
-      for (y=0; y<image->height(); y++) {
+        break;
+      case IMAGE_INDEXED:
         for (x=0; x<image->width(); x++) {
           c = get_pixel_fast<IndexedTraits>(image, x, y);
-          if (c != mask_color)
-            printcol(x, y, image_palette[c][0] & 0xff,
-                     image_palette[c][1] & 0xff,
-                     image_palette[c][2] & 0xff,
-                     image_palette[c][3] & 0xff,
-                     pixelScaleValue);
+          row[x] = (c == mask_color ? 0: palette[c & 0xff]);
         }
-        fop->setProgress((float)y / (float)(image->height()));
+        break;
+    }
+
+    // Runs of pixels of this row (continuing the rectangles of the
+    // previous row with the same span and color)
+    rects.clear();
+    auto prev = prevRects.begin();
+    for (x=0; x<image->width(); ) {
+      int x2 = x+1;
+      while (x2 < image->width() && row[x2] == row[x])
+        ++x2;
+
+      if (rgba_geta(row[x]) != 0) {
+        while (prev != prevRects.end() && prev->x < x)
+          printRect(*(prev++), pixelScaleValue);
+
+        if (prev != prevRects.end() &&
+            prev->x == x &&
+            prev->w == x2-x &&
+            prev->color == row[x]) {
+          rects.push_back(*(prev++));
+          ++rects.back().h;
+        }
+        else
+          rects.push_back(SvgRect{ x, y, x2-x, 1, row[x] });
       }
-      break;
+      x = x2;
     }
+    while (prev != prevRects.end())
+      printRect(*(prev++), pixelScaleValue);
+    std::swap(prevRects, rects);
+
+    fop->setProgress((float)y / (float)(image->height()));
   }
-  fprintf(f, "</svg>");
+  for (const auto& rc : prevRects)
+    printRect(rc, pixelScaleValue);
+
+  w.write("</svg>");
+  w.flush();
+
   if (ferror(f)) {
     fop->setError("Error writing file.\n");
     return false;
@@ -165,6 +203,7 @@ bool SvgFormat::onSave(FileOp* fop)
     return true;
   }
 }
+
 #endif
 
 // Shows the SVG configuration dialog.
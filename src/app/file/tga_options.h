@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2020  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -14,6 +14,10 @@ namespace app {
 
   class TgaOptions : public FormatOptions {
   public:
+    FormatOptionsPtr clone() const override {
+      return std::make_shared<TgaOptions>(*this);
+    }
+
     int bitsPerPixel() const { return m_bitsPerPixel; }
     bool compress() const { return m_compress; }
 
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2015-2018  David Capello
 // Copyright (C) 2015  Gabriel Rauter
 //
@@ -17,6 +17,7 @@
 #include "app/file/file.h"
 #include "app/file/file_format.h"
 #include "app/file/format_options.h"
+#include "app/file/frame_renderer.h"
 #include "app/file/webp_options.h"
 #include "app/ini_file.h"
 #include "app/pref/preferences.h"
@@ -33,10 +34,16 @@
 #include <cstdlib>
 #include <algorithm>
 #include <map>
+#include <vector>
 
 #include <webp/demux.h>
 #include <webp/mux.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define APP_WEBP_FORMAT_SSE2 1
+  #include <emmintrin.h>
+#endif
+
 namespace app {
 
 using namespace base;
@@ -236,6 +243,36 @@ struct WriterData {
     : fp(fp), fop(fop), f(f), n(n), progress(progress) { }
 };
 
+// Switches R <-> B channels of all pixels of the RGB image because
+// WebPAnimEncoderAssemble() expects MODE_BGRA pictures.
+static void swap_red_and_blue(Image* image)
+{
+  // The rows of the image are contiguous
+  uint32_t* p = (uint32_t*)image->getPixelAddress(0, 0);
+  const int n = image->width() * image->height();
+  int i = 0;
+
+#if APP_WEBP_FORMAT_SSE2
+  const __m128i ga = _mm_set1_epi32(0xff00ff00);
+  const __m128i ff = _mm_set1_epi32(0x000000ff);
+  for (; i+4<=n; i+=4) {
+    const __m128i c = _mm_loadu_si128((const __m128i*)(p+i));
+    const __m128i r = _mm_slli_epi32(_mm_and_si128(c, ff), 16);
+    const __m128i b = _mm_and_si128(_mm_srli_epi32(c, 16), ff);
+    _mm_storeu_si128((__m128i*)(p+i),
+                     _mm_or_si128(_mm_and_si128(c, ga),
+                                  _mm_or_si128(r, b)));
+  }
+#endif
+
+  for (; i<n; ++i) {
+    const uint32_t c = p[i];
+    p[i] = ((c & 0xff00ff00) |
+            ((c >> 16) & 0xff) | // Use red in blue channel
+            ((c & 0xff) << 16)); // Use blue in red channel
+  }
+}
+
 static int progress_report(int percent, const WebPPicture* pic)
 {
   auto wd = (WriterData*)pic->user_data;
@@ -294,22 +331,22 @@ bool WebPFormat::onSave(FileOp* fop)
       break;
   }
 
+  config.thread_level = opts->threadLevel();
+  if (opts->method() >= 0)
+    config.method = opts->method();
+
   WebPAnimEncoderOptions enc_options;
   WebPAnimEncoderOptionsInit(&enc_options);
   enc_options.anim_params.loop_count =
     (opts->loop() ? 0:  // 0 = infinite
                     1); // 1 = loop once
 
-  ImageRef image(Image::create(IMAGE_RGB, w, h));
-  render::Render render;
-
   WriterData wd(fp, fop, 0, sprite->totalFrames(), 0.0);
   WebPPicture pic;
   WebPPictureInit(&pic);
   pic.width = w;
   pic.height = h;
   pic.use_argb = true;
-  pic.argb = (uint32_t*)image->getPixelAddress(0, 0);
   pic.argb_stride = w;
   pic.user_data = &wd;
   pic.progress_hook = progress_report;
@@ -318,25 +355,19 @@ bool WebPFormat::onSave(FileOp* fop)
                                             sprite->height(),
                                             &enc_options);
   int timestamp_ms = 0;
+  std::vector<frame_t> frames(sprite->totalFrames());
+  for (frame_t f=0; f<sprite->totalFrames(); ++f)
+    frames[f] = f;
+  FrameRenderer renderer(sprite, frames, IMAGE_RGB, fop->newBlend(),
+                         swap_red_and_blue);
   for (frame_t f=0; f<sprite->totalFrames(); ++f) {
-    // Render the frame in the bitmap
-    render.renderSprite(image.get(), sprite, f);
-
-    // Switch R <-> B channels because WebPAnimEncoderAssemble()
-    // expects MODE_BGRA pictures.
-    {
-      LockImageBits<RgbTraits> bits(image.get(), Image::ReadWriteLock);
-      auto it = bits.begin(), end = bits.end();
-      for (; it != end; ++it) {
-        auto c = *it;
-        *it = rgba(rgba_getb(c), // Use blue in red channel
-                   rgba_getg(c),
-                   rgba_getr(c), // Use red in blue channel
-                   rgba_geta(c));
-      }
-    }
+    // Next frames are rendered in other threads while this one is
+    // encoded (the encoder copies the picture pixels)
+    ImageRef image = renderer.image(f);
+    pic.argb = (uint32_t*)image->getPixelAddress(0, 0);
 
     if (!WebPAnimEncoderAdd(enc, &pic, timestamp_ms, &config)) {
+      WebPAnimEncoderDelete(enc);
       if (!fop->isStop()) {
         fop->setError("Error saving frame %d info\n", f);
         return false;
@@ -392,6 +423,10 @@ FormatOptionsPtr WebPFormat::onAskUserForFormatOptions(FileOp* fop)
           break;
       }
 
+      // Encoder options without UI (only in the preferences file)
+      opts->setThreadLevel(pref.webp.threadLevel());
+      opts->setMethod(pref.webp.method());
+
       if (pref.webp.showAlert()) {
         app::gen::WebpOptions win;
 
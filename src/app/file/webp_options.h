@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2018  David Capello
 // Copyright (C) 2015  Gabriel Rauter
 //
@@ -11,6 +12,8 @@
 
 #include "app/file/format_options.h"
 
+#include <algorithm>
+
 #include <webp/decode.h>
 #include <webp/encode.h>
 
@@ -29,7 +32,9 @@ namespace app {
                     m_compression(kDefaultCompression),
                     m_imageHint(WEBP_HINT_DEFAULT),
                     m_quality(100),
-                    m_imagePreset(WEBP_PRESET_DEFAULT) { }
+                    m_imagePreset(WEBP_PRESET_DEFAULT),
+                    m_threadLevel(1),
+                    m_method(-1) { }
 
     bool loop() const { return m_loop; }
     Type type() const { return m_type; }
@@ -37,6 +42,8 @@ namespace app {
     WebPImageHint imageHint() const { return m_imageHint; }
     int quality() const { return m_quality; }
     WebPPreset imagePreset() const { return m_imagePreset; }
+    int threadLevel() const { return m_threadLevel; }
+    int method() const { return m_method; }
 
     void setLoop(const bool loop) {
       m_loop = loop;
@@ -71,6 +78,15 @@ namespace app {
       m_imagePreset = imagePreset;
     }
 
+    void setThreadLevel(const int threadLevel) {
+      m_threadLevel = threadLevel;
+    }
+
+    // A negative method uses the method of the lossless/lossy preset.
+    void setMethod(const int method) {
+      m_method = std::min(method, 6);
+    }
+
   private:
     bool m_loop;
     Type m_type;
@@ -80,6 +96,9 @@ namespace app {
     // Lossy options
     int m_quality;      // Between 0 (smallest file) and 100 (biggest)
     WebPPreset m_imagePreset;  // Image Preset for lossy webp.
+    // Encoder options (for both types)
+    int m_threadLevel;  // WebPConfig::thread_level (0=no threads, 1=use threads)
+    int m_method;       // WebPConfig::method (0=fast, 6=slower-better)
   };
 
 } // namespace app
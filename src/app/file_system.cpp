@@ -24,8 +24,13 @@
 #include "os/window.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <functional>
 #include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -60,6 +65,17 @@ namespace {
 class FileItem;
 using FileItemMap = std::map<std::string, FileItem*>;
 
+// Entry found in a folder by readdir() (used to create the FileItems)
+struct FolderEntry {
+  std::string name;
+  bool isFolder;
+};
+using FolderEntries = std::vector<FolderEntry>;
+
+// Entries sent to the UI thread each time a FolderLoader finds this
+// number of items
+const std::size_t kFolderEntriesBatch = 256;
+
 // the root of the file-system
 FileItem* rootitem = nullptr;
 FileItemMap* fileitems_map = nullptr;
@@ -82,6 +98,7 @@ public:
   unsigned int m_version;
   bool m_removed;
   mutable bool m_is_folder;
+  int m_loaders;                  // Number of FolderLoaders listing this folder
   std::atomic<double> m_thumbnailProgress;
   std::atomic<os::Surface*> m_thumbnail;
 #ifdef _WIN32
@@ -97,6 +114,31 @@ public:
   void insertChildSorted(FileItem* child);
   int compare(const FileItem& that) const;
 
+  // True if the children must be listed again (m_children is empty
+  // or the file system was refreshed)
+  bool needsListing() const {
+    return (isFolder() &&
+            (m_children.empty() ||
+             current_file_system_version > m_version));
+  }
+
+  // Marks all children as m_removed before listing the folder again
+  void markChildrenAsRemoved();
+
+  // Adds the given items (which aren't in m_children yet) keeping
+  // m_children sorted
+  void mergeChildren(FileItemList& added);
+
+  // Removes the children that weren't found in the last listing.
+  // Returns true if some child was removed.
+  bool removeStaleChildren();
+
+#ifndef _WIN32
+  // Adds the found entries as children (creating the FileItems that
+  // don't exist yet). Returns true if new children were added.
+  bool addEntries(const FolderEntries& entries);
+#endif
+
   bool operator<(const FileItem& that) const { return compare(that) < 0; }
   bool operator>(const FileItem& that) const { return compare(that) > 0; }
   bool operator==(const FileItem& that) const { return compare(that) == 0; }
@@ -178,6 +220,11 @@ public:
   static void put_fileitem(FileItem* fileitem);
 #else
   static FileItem* get_fileitem_by_path(const std::string& path, bool create_if_not);
+  static FileItem* find_fileitem_by_path(const std::string& path);
+  static void read_folder_entries(const std::string& path,
+                                  const std::set<std::string>& known,
+                                  const std::atomic<bool>& cancel,
+                                  const std::function<void(FolderEntries&)>& flush);
   static std::string remove_backslash_if_needed(const std::string& filename);
   static std::string get_key_for_filename(const std::string& filename);
   static void put_fileitem(FileItem* fileitem);
@@ -423,22 +470,15 @@ IFileItem* FileItem::parent() const
 
 const FileItemList& FileItem::children()
 {
-  // Is the file-item a folder?
-  if (isFolder() &&
-      // if the children list is empty, or the file-system version
-      // change (it's like to say: the current m_children list
-      // is outdated)...
-      (m_children.empty() ||
-       current_file_system_version > m_version)) {
-    FileItemList::iterator it;
+  // Is the file-item a folder? and the children list is empty, or the
+  // file-system version change (it's like to say: the current
+  // m_children list is outdated)... (If a FolderLoader is listing
+  // this folder we just return the children found until now.)
+  if (m_loaders == 0 && needsListing()) {
     FileItem* child;
 
     // we have to mark current items as deprecated
-    for (it=m_children.begin();
-         it!=m_children.end(); ++it) {
-      child = static_cast<FileItem*>(*it);
-      child->m_removed = true;
-    }
+    markChildrenAsRemoved();
 
     //LOG("FS: Loading files for %p (%s)\n", fileitem, fileitem->displayname);
 #ifdef _WIN32
@@ -468,6 +508,7 @@ const FileItemList& FileItem::children()
           SHCONTF_FOLDERS | SHCONTF_NONFOLDERS, &pEnum);
 
         if (hr == S_OK && pEnum) {
+          FileItemList added;
           LPITEMIDLIST itempidl[256];
           SFGAOF attribs[256];
 
@@ -494,93 +535,157 @@ const FileItemList& FileItem::children()
 
                 update_by_pidl(child, attribs[c]);
                 put_fileitem(child);
+                added.push_back(child);
               }
               else {
                 ASSERT(child->m_parent == this);
                 free_pidl(fullpidl);
                 free_pidl(itempidl[c]);
-              }
 
-              insertChildSorted(child);
+                // Already in m_children
+                if (child->m_removed)
+                  child->m_removed = false;
+                else if (std::find(m_children.begin(), m_children.end(), child) == m_children.end())
+                  added.push_back(child);
+              }
             }
           }
+
+          // Sort all the new items just one time
+          mergeChildren(added);
         }
       }
     }
 #else
     {
-      DIR* dir = opendir(m_filename.c_str());
-      if (dir) {
-        dirent* entry;
-        while ((entry = readdir(dir)) != NULL) {
-          FileItem* child;
-          std::string fn = entry->d_name;
-          std::string fullfn = base::join_path(m_filename, fn);
-
-          if (fn == "." || fn == "..")
-            continue;
+      // Entries of the current children don't need a stat()
+      std::set<std::string> known;
+      for (auto ichild : m_children)
+        known.insert(static_cast<FileItem*>(ichild)->m_displayname);
+
+      FolderEntries entries;
+      std::atomic<bool> cancel(false);
+      read_folder_entries(
+        m_filename, known, cancel,
+        [&entries](FolderEntries& found){
+          entries.insert(entries.end(), found.begin(), found.end());
+        });
+      addEntries(entries);
+    }
+#endif
 
-          child = get_fileitem_by_path(fullfn, false);
-          if (!child) {
-            child = new FileItem(this);
+    // check old file-items (maybe removed directories or file-items)
+    removeStaleChildren();
 
-            bool is_folder;
-            struct stat fileStat;
+    // now this file-item is updated
+    m_version = current_file_system_version;
+  }
 
-            stat(fullfn.c_str(), &fileStat);
+  return m_children;
+}
 
-            if ((fileStat.st_mode & S_IFMT) == S_IFLNK) {
-              is_folder = base::is_directory(fullfn);
-            }
-            else {
-              is_folder = ((fileStat.st_mode & S_IFMT) == S_IFDIR);
-            }
+void FileItem::markChildrenAsRemoved()
+{
+  for (auto ichild : m_children)
+    static_cast<FileItem*>(ichild)->m_removed = true;
+}
 
-            child->m_filename = fullfn;
-            child->m_displayname = fn;
-            child->m_is_folder = is_folder;
+void FileItem::mergeChildren(FileItemList& added)
+{
+  if (added.empty())
+    return;
 
-            put_fileitem(child);
-          }
-          else {
-            ASSERT(child->m_parent == this);
-          }
+  auto cmp = [](const IFileItem* a, const IFileItem* b) {
+    return *static_cast<const FileItem*>(a) < *static_cast<const FileItem*>(b);
+  };
+
+  // Sorting the new items and merging them is faster than
+  // insertChildSorted() for folders with thousands of files
+  std::sort(added.begin(), added.end(), cmp);
+  const std::size_t n = m_children.size();
+  m_children.insert(m_children.end(), added.begin(), added.end());
+  std::inplace_merge(m_children.begin(),
+                     m_children.begin()+n,
+                     m_children.end(), cmp);
+}
 
-          insertChildSorted(child);
-        }
-        closedir(dir);
-      }
+bool FileItem::removeStaleChildren()
+{
+  bool removed = false;
+  for (auto it=m_children.begin();
+       it!=m_children.end(); ) {
+    FileItem* child = static_cast<FileItem*>(*it);
+    ASSERT(child);
+
+    if (child && child->m_removed) {
+      it = m_children.erase(it);
+      child->m_parent = nullptr;
+      child->deleteItem();
+      removed = true;
     }
-#endif
+    else
+      ++it;
+  }
+  return removed;
+}
 
-    // check old file-items (maybe removed directories or file-items)
-    for (it=m_children.begin();
-         it!=m_children.end(); ) {
-      child = static_cast<FileItem*>(*it);
-      ASSERT(child);
-
-      if (child && child->m_removed) {
-        it = m_children.erase(it);
-        child->m_parent = nullptr;
-        child->deleteItem();
-      }
-      else
-        ++it;
-    }
+#ifndef _WIN32
 
-    // now this file-item is updated
-    m_version = current_file_system_version;
+bool FileItem::addEntries(const FolderEntries& entries)
+{
+  FileItemList added;
+
+  for (const FolderEntry& entry : entries) {
+    std::string fullfn = base::join_path(m_filename, entry.name);
+
+    // We don't use get_fileitem_by_path() because it checks if the
+    // file exists again (and we've just found it)
+    FileItem* child = find_fileitem_by_path(fullfn);
+    if (!child) {
+      child = new FileItem(this);
+      child->m_filename = fullfn;
+      child->m_displayname = entry.name;
+      child->m_is_folder = entry.isFolder;
+
+      put_fileitem(child);
+      added.push_back(child);
+    }
+    else {
+      ASSERT(child->m_parent == this);
+
+      // Already in m_children
+      if (child->m_removed)
+        child->m_removed = false;
+      // Items created from a path (e.g. getFileItemFromPath()) could
+      // be outside m_children
+      else if (std::find(m_children.begin(), m_children.end(), child) == m_children.end())
+        added.push_back(child);
+    }
   }
 
-  return m_children;
+  const bool result = !added.empty();
+  mergeChildren(added);
+  return result;
 }
 
+#endif
+
 void FileItem::createDirectory(const std::string& dirname)
 {
   base::make_directory(base::join_path(m_filename, dirname));
 
   // Invalidate the children list.
   m_version = 0;
+
+#ifndef _WIN32
+  // If a FolderLoader is listing this folder, children() will not
+  // list the folder again, so we add the new directory right now.
+  if (m_loaders > 0) {
+    FolderEntries entries;
+    entries.push_back(FolderEntry{ dirname, true });
+    addEntries(entries);
+  }
+#endif
 }
 
 bool FileItem::hasExtension(const base::paths& extensions)
@@ -620,6 +725,7 @@ FileItem::FileItem(FileItem* parent)
   m_version = current_file_system_version;
   m_removed = false;
   m_is_folder = false;
+  m_loaders = 0;
   m_thumbnailProgress = 0.0;
   m_thumbnail = nullptr;
 #ifdef _WIN32
@@ -678,6 +784,114 @@ int FileItem::compare(const FileItem& that) const
   return base::compare_filenames(m_displayname, that.m_displayname);
 }
 
+// ======================================================================
+// FolderLoader
+// ======================================================================
+
+// State shared with the background thread. The thread is detached
+// (a readdir() in a network drive can take several seconds, and we
+// don't want to wait it when the loader is destroyed), so it keeps
+// its own reference to this struct.
+struct FolderLoader::Shared {
+  std::mutex mutex;
+  FolderEntries entries;        // Entries found that weren't polled yet
+  bool done = false;            // The thread finished (protected by mutex)
+  std::atomic<bool> cancel{false};
+};
+
+FolderLoader::FolderLoader(IFileItem* ifolder)
+  : m_folder(ifolder)
+  , m_version(current_file_system_version)
+  , m_done(true)
+{
+#ifndef _WIN32
+  FileItem* folder = static_cast<FileItem*>(ifolder);
+  if (!folder->needsListing())
+    return;
+
+  m_done = false;
+  ++folder->m_loaders;
+
+  folder->markChildrenAsRemoved();
+
+  // Entries of the current children don't need a stat()
+  std::set<std::string> known;
+  for (auto ichild : folder->m_children)
+    known.insert(static_cast<FileItem*>(ichild)->m_displayname);
+
+  m_shared = std::make_shared<Shared>();
+  m_itemRemovedConn =
+    FileSystemModule::instance()->ItemRemoved.connect(
+      [this](IFileItem* item){
+        if (item == m_folder) {
+          m_shared->cancel = true;
+          m_folder = nullptr;
+          m_done = true;
+        }
+      });
+
+  std::thread(
+    [shared=m_shared, path=folder->m_filename, known=std::move(known)]{
+      read_folder_entries(
+        path, known, shared->cancel,
+        [&shared](FolderEntries& found){
+          std::lock_guard<std::mutex> lock(shared->mutex);
+          shared->entries.insert(shared->entries.end(),
+                                 found.begin(), found.end());
+        });
+
+      std::lock_guard<std::mutex> lock(shared->mutex);
+      shared->done = true;
+    }).detach();
+#endif
+}
+
+FolderLoader::~FolderLoader()
+{
+  if (m_shared)
+    m_shared->cancel = true;
+
+  // The listing wasn't finished, so the children are kept as they
+  // are (the folder will be listed again the next time).
+  if (!m_done && m_folder)
+    --static_cast<FileItem*>(m_folder)->m_loaders;
+}
+
+bool FolderLoader::poll()
+{
+#ifndef _WIN32
+  if (m_done)
+    return false;
+
+  FolderEntries entries;
+  bool threadDone;
+  {
+    std::lock_guard<std::mutex> lock(m_shared->mutex);
+    entries.swap(m_shared->entries);
+    threadDone = m_shared->done;
+  }
+
+  FileItem* folder = static_cast<FileItem*>(m_folder);
+  bool changed = folder->addEntries(entries);
+
+  if (threadDone) {
+    m_done = true;
+    m_itemRemovedConn.disconnect();
+    --folder->m_loaders;
+
+    if (folder->removeStaleChildren())
+      changed = true;
+
+    // The folder is updated to the version of the file system
+    // when the listing started
+    folder->m_version = m_version;
+  }
+  return changed;
+#else
+  return false;
+#endif
+}
+
 //////////////////////////////////////////////////////////////////////
 // PIDLS: Only for Win32
 //////////////////////////////////////////////////////////////////////
@@ -1060,6 +1274,74 @@ static FileItem* get_fileitem_by_path(const std::string& path, bool create_if_no
   return fileitem;
 }
 
+static FileItem* find_fileitem_by_path(const std::string& path)
+{
+  auto it = fileitems_map->find(get_key_for_filename(path));
+  if (it != fileitems_map->end())
+    return it->second;
+  else
+    return nullptr;
+}
+
+// Reads the entries of the given folder (can be called from a
+// background thread, so it cannot access FileItems). The type
+// (file/folder) of the "known" entries is not checked (they
+// already have a FileItem). The found entries are given to "flush"
+// in batches.
+static void read_folder_entries(const std::string& path,
+                                const std::set<std::string>& known,
+                                const std::atomic<bool>& cancel,
+                                const std::function<void(FolderEntries&)>& flush)
+{
+  DIR* dir = opendir(path.c_str());
+  if (!dir)
+    return;
+
+  FolderEntries entries;
+  dirent* entry;
+  while (!cancel && (entry = readdir(dir)) != NULL) {
+    std::string fn = entry->d_name;
+    if (fn == "." || fn == "..")
+      continue;
+
+    bool is_folder = false;
+    if (known.find(fn) == known.end()) {
+      std::string fullfn = base::join_path(path, fn);
+
+#ifdef DT_DIR
+      // Avoid a stat() call if we already know the type of file
+      if (entry->d_type == DT_DIR)
+        is_folder = true;
+      else if (entry->d_type == DT_REG)
+        is_folder = false;
+      else
+#endif
+      {
+        struct stat fileStat;
+
+        stat(fullfn.c_str(), &fileStat);
+
+        if ((fileStat.st_mode & S_IFMT) == S_IFLNK) {
+          is_folder = base::is_directory(fullfn);
+        }
+        else {
+          is_folder = ((fileStat.st_mode & S_IFMT) == S_IFDIR);
+        }
+      }
+    }
+
+    entries.push_back(FolderEntry{ fn, is_folder });
+    if (entries.size() >= kFolderEntriesBatch) {
+      flush(entries);
+      entries.clear();
+    }
+  }
+  closedir(dir);
+
+  if (!entries.empty() && !cancel)
+    flush(entries);
+}
+
 static std::string remove_backslash_if_needed(const std::string& filename)
 {
   if (!filename.empty() && base::is_path_separator(*(filename.end()-1))) {
@@ -11,9 +11,11 @@
 
 #include "base/mutex.h"
 #include "base/paths.h"
+#include "obs/connection.h"
 #include "obs/signal.h"
 #include "os/surface.h"
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -62,6 +64,42 @@ namespace app {
     FileSystemModule* m_fs;
   };
 
+  // Lists the content of a folder in a background thread, so big
+  // folders (or slow network drives) don't block the UI. The found
+  // items are added to the folder each time poll() is called (from
+  // the UI thread), and the listing is canceled when the loader is
+  // destroyed (e.g. when the user navigates to other folder). While
+  // the folder is being loaded, IFileItem::children() returns the
+  // items found until now (or the items of the last time the folder
+  // was listed, which are kept between file selector dialogs).
+  //
+  // On Windows the Shell API is used from the UI thread, so folders
+  // are still listed synchronously in IFileItem::children().
+  class FolderLoader {
+  public:
+    FolderLoader(IFileItem* folder);
+    ~FolderLoader();
+
+    IFileItem* folder() const { return m_folder; }
+
+    // True if the folder was completely loaded (or it didn't need to
+    // be loaded again).
+    bool isDone() const { return m_done; }
+
+    // Adds the new found items to the folder. Returns true if the
+    // children of the folder were modified.
+    bool poll();
+
+  private:
+    struct Shared;
+
+    IFileItem* m_folder;
+    std::shared_ptr<Shared> m_shared;
+    unsigned int m_version;
+    bool m_done;
+    obs::scoped_connection m_itemRemovedConn;
+  };
+
   class IFileItem {
   public:
     virtual ~IFileItem() { }
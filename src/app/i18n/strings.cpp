@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2016-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -18,6 +19,11 @@
 #include "app/xml_exception.h"
 #include "base/fs.h"
 #include "cfg/cfg.h"
+#include "gen/strings_hash.h"
+
+#include "strings_table.ini.h"
+
+#include <cstring>
 
 namespace app {
 
@@ -42,8 +48,8 @@ Strings::Strings(Preferences& pref,
                  Extensions& exts)
   : m_pref(pref)
   , m_exts(exts)
+  , m_loaded(false)
 {
-  loadLanguage(currentLanguage());
 }
 
 std::set<std::string> Strings::availableLanguages() const
@@ -93,10 +99,25 @@ void Strings::setCurrentLanguage(const std::string& langId)
   LanguageChange();
 }
 
+// static
+int Strings::findSlot(const char* id)
+{
+  const uint32_t seed =
+    gen::kStringsSeeds[::gen::strings_hash(id, 0) % gen::kStringsSeedsSize];
+  const int slot = int(::gen::strings_hash(id, seed) % gen::kStringsSize);
+  if (std::strcmp(gen::kStrings[slot].id, id) == 0)
+    return slot;
+  else
+    return -1;
+}
+
 void Strings::loadLanguage(const std::string& langId)
 {
+  m_loaded = true;
+  m_values.assign(gen::kStringsSize, std::string());
   m_strings.clear();
-  loadStringsFromDataDir(kDefLanguage);
+
+  // English strings are already in the table
   if (langId != kDefLanguage) {
     loadStringsFromDataDir(langId);
     loadStringsFromExtension(langId);
@@ -105,7 +126,7 @@ void Strings::loadLanguage(const std::string& langId)
 
 void Strings::loadStringsFromDataDir(const std::string& langId)
 {
-  // Load the English language file from the Aseprite data directory (so we have the most update list of strings)
+  // Load the language file from the Aseprite data directory
   LOG("I18N: Loading strings/%s.ini file\n", langId.c_str());
   ResourceFinder rf;
   rf.includeDataDir(("strings/" + langId + ".ini").c_str());
@@ -140,9 +161,12 @@ void Strings::loadStringsFromFile(const std::string& fn)
     textId.push_back('.');
     for (auto key : keys) {
       textId.append(key);
-      m_strings[textId] = cfg.getValue(section.c_str(), key.c_str(), "");
 
-      //TRACE("I18N: Reading string %s -> %s\n", textId.c_str(), m_strings[textId].c_str());
+      const int slot = findSlot(textId.c_str());
+      if (slot >= 0)
+        m_values[slot] = cfg.getValue(section.c_str(), key.c_str(), "");
+      else
+        m_strings[textId] = cfg.getValue(section.c_str(), key.c_str(), "");
 
       textId.erase(section.size()+1);
     }
@@ -151,6 +175,11 @@ void Strings::loadStringsFromFile(const std::string& fn)
 
 const std::string& Strings::translate(const char* id) const
 {
+  const int slot = findSlot(id);
+  if (slot >= 0)
+    return translate(slot);
+
+  ensureLoaded();
   auto it = m_strings.find(id);
   if (it != m_strings.end())
     return it->second;
@@ -158,4 +187,16 @@ const std::string& Strings::translate(const char* id) const
     return m_strings[id] = id;
 }
 
+const std::string& Strings::translate(const int slot) const
+{
+  ASSERT(slot >= 0 && slot < gen::kStringsSize);
+  ensureLoaded();
+
+  // Untranslated strings use the English text
+  std::string& value = m_values[slot];
+  if (value.empty())
+    value = gen::kStrings[slot].value;
+  return value;
+}
+
 } // namespace app
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2016-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -11,6 +12,7 @@
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "obs/signal.h"
 
@@ -21,7 +23,11 @@ namespace app {
   class Preferences;
   class Extensions;
 
-  // Singleton class to load and access "strings/en.ini" file.
+  // Singleton class to access the strings of the current language.
+  // The English strings ("strings/en.ini" file) are compiled in the
+  // program in a perfect hash table (generated by gen in
+  // "strings_table.ini.h"), so only the file of the current language
+  // is parsed (the first time a string is needed).
   class Strings : public app::gen::Strings<app::Strings> {
   public:
     static void createInstance(Preferences& pref,
@@ -30,6 +36,10 @@ namespace app {
 
     const std::string& translate(const char* id) const;
 
+    // Translates the string in the given slot of the generated table
+    // (used by the generated app::gen::Strings functions).
+    const std::string& translate(const int slot) const;
+
     std::set<std::string> availableLanguages() const;
     std::string currentLanguage() const;
     void setCurrentLanguage(const std::string& langId);
@@ -40,6 +50,12 @@ namespace app {
     Strings(Preferences& pref,
             Extensions& exts);
 
+    static int findSlot(const char* id);
+
+    void ensureLoaded() const {
+      if (!m_loaded)
+        const_cast<Strings*>(this)->loadLanguage(currentLanguage());
+    }
     void loadLanguage(const std::string& langId);
     void loadStringsFromDataDir(const std::string& langId);
     void loadStringsFromExtension(const std::string& langId);
@@ -47,6 +63,14 @@ namespace app {
 
     Preferences& m_pref;
     Extensions& m_exts;
+    bool m_loaded;
+
+    // Strings of the current language for each slot of the table
+    // (empty until they are used or if they are not translated)
+    mutable std::vector<std::string> m_values;
+
+    // Strings that are not in the table (e.g. strings that are only
+    // in a language of an extension, or unknown ids)
     mutable std::unordered_map<std::string, std::string> m_strings;
   };
 
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -13,6 +13,8 @@
 
 #include "app/resource_finder.h"
 #include "base/fs.h"
+#include "base/fstream_path.h"
+#include "base/log.h"
 #include "base/split_string.h"
 #include "base/string.h"
 #include "cfg/cfg.h"
@@ -26,15 +28,141 @@
   #include "base/fs.h"
 #endif
 
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 namespace app {
 
 using namespace gfx;
 
+namespace {
+
+// Time without new flushes to wait before writing the files (several
+// preferences are saved in a row, e.g. closing documents or changing
+// tools).
+const auto kWriteDelay = std::chrono::seconds(2);
+
+// Writes the flushed configuration files in a background thread. The
+// content of each file is serialized in the UI thread when it's
+// flushed, and only the last content of each file is written once
+// there are no more flushes in kWriteDelay.
+class ConfigWriter {
+public:
+  ConfigWriter()
+    : m_thread([this]{ writerThread(); }) {
+  }
+
+  // Writes the pending files before closing the thread
+  ~ConfigWriter() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_done = true;
+      m_cv.notify_one();
+    }
+    m_thread.join();
+
+    for (const auto& it : m_pending)
+      saveFile(it.first, it.second);
+  }
+
+  void write(const std::string& filename, std::string&& data) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending[filename] = std::move(data);
+    m_lastWrite = std::chrono::steady_clock::now();
+    m_cv.notify_one();
+  }
+
+  // Writes the file right now if it's pending (e.g. to load it
+  // again), or waits the background thread to finish writing it.
+  void writePendingFile(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<std::mutex> fileLock(m_fileMutex);
+    auto it = m_pending.find(filename);
+    if (it != m_pending.end()) {
+      saveFile(it->first, it->second);
+      m_pending.erase(it);
+    }
+  }
+
+private:
+  void writerThread() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_done) {
+      if (m_pending.empty()) {
+        m_cv.wait(lock);
+        continue;
+      }
+
+      const auto time = m_lastWrite + kWriteDelay;
+      if (std::chrono::steady_clock::now() < time) {
+        m_cv.wait_until(lock, time);
+        continue;
+      }
+
+      std::map<std::string, std::string> files;
+      std::swap(files, m_pending);
+      {
+        // m_fileMutex is locked before unlocking m_mutex, so
+        // writePendingFile() waits these files
+        std::unique_lock<std::mutex> fileLock(m_fileMutex);
+        lock.unlock();
+        for (const auto& it : files)
+          saveFile(it.first, it.second);
+      }
+      lock.lock();
+    }
+  }
+
+  // Writes the file in a temporary file and replaces the old one, so
+  // the configuration is never left half-written.
+  static void saveFile(const std::string& filename,
+                       const std::string& data) {
+    const std::string tmpFilename = filename + ".tmp";
+    {
+      std::ofstream f(FSTREAM_PATH(tmpFilename),
+                      std::ios::binary | std::ios::trunc);
+      f.write(data.c_str(), data.size());
+      f.close();
+      if (!f) {
+        LOG(ERROR, "CFG: Error saving configuration into %s\n",
+            tmpFilename.c_str());
+        return;
+      }
+    }
+    try {
+#ifdef _WIN32
+      if (base::is_file(filename))
+        base::delete_file(filename);
+#endif
+      base::move_file(tmpFilename, filename);
+    }
+    catch (const std::exception& ex) {
+      LOG(ERROR, "CFG: Error replacing configuration file %s: %s\n",
+          filename.c_str(), ex.what());
+    }
+  }
+
+  std::mutex m_mutex;
+  std::mutex m_fileMutex;
+  std::condition_variable m_cv;
+  std::map<std::string, std::string> m_pending;
+  std::chrono::steady_clock::time_point m_lastWrite;
+  bool m_done = false;
+  std::thread m_thread;
+};
+
+} // anonymous namespace
+
 static std::string g_configFilename;
 static std::vector<cfg::CfgFile*> g_configs;
+static std::unique_ptr<ConfigWriter> g_writer;
 
 ConfigModule::ConfigModule()
 {
@@ -94,11 +222,13 @@ ConfigModule::ConfigModule()
 
   set_config_file(fn.c_str());
   g_configFilename = fn;
+  g_writer = std::make_unique<ConfigWriter>();
 }
 
 ConfigModule::~ConfigModule()
 {
   flush_config_file();
+  g_writer.reset();
 
   for (auto cfg : g_configs)
     delete cfg;
@@ -125,7 +255,16 @@ void flush_config_file()
 {
   ASSERT(!g_configs.empty());
 
-  g_configs.back()->save();
+  cfg::CfgFile* cfg = g_configs.back();
+  if (!cfg->isModified())
+    return;
+
+  if (g_writer) {
+    g_writer->write(cfg->filename(), cfg->serialize());
+    cfg->markAsSaved();
+  }
+  else
+    cfg->save();
 }
 
 void set_config_file(const char* filename)
@@ -133,6 +272,10 @@ void set_config_file(const char* filename)
   if (g_configs.empty())
     g_configs.push_back(new cfg::CfgFile());
 
+  // Load the last flushed content
+  if (g_writer)
+    g_writer->writePendingFile(filename);
+
   g_configs.back()->load(filename);
 }
 
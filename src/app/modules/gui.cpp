@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -11,6 +11,7 @@
 
 #include "app/app.h"
 #include "app/app_menus.h"
+#include "app/cache_manager.h"
 #include "app/commands/cmd_open_file.h"
 #include "app/commands/command.h"
 #include "app/commands/commands.h"
@@ -109,6 +110,9 @@ static Theme* gui_theme = nullptr;
 static ui::Timer* defered_invalid_timer = nullptr;
 static gfx::Region defered_invalid_region;
 
+// Timer to keep the caches in the memory budget (see CacheManager)
+static ui::Timer* cache_collect_timer = nullptr;
+
 // Load & save graphics configuration
 static bool load_gui_config(os::WindowSpec& spec, bool& maximized);
 static void save_gui_config();
@@ -199,6 +203,9 @@ int init_module_gui()
   // Create the default-manager
   manager = new CustomizedGuiManager(main_window);
 
+  cache_collect_timer = new ui::Timer(1000, manager);
+  cache_collect_timer->start();
+
   // Setup the GUI theme for all widgets
   gui_theme = new SkinTheme;
   ui::set_theme(gui_theme, pref.general.uiScale());
@@ -231,6 +238,7 @@ void exit_module_gui()
   save_gui_config();
 
   delete defered_invalid_timer;
+  delete cache_collect_timer;
   delete manager;
 
   // Now we can destroy theme
@@ -535,77 +543,78 @@ bool CustomizedGuiManager::onProcessMessage(Message* msg)
         return true;
 
       KeyboardShortcuts* keys = KeyboardShortcuts::instance();
-      for (const KeyPtr& key : *keys) {
-        if (key->isPressed(msg, *keys)) {
-          // Cancel menu-bar loops (to close any popup menu)
-          App::instance()->mainWindow()->getMenuBar()->cancelMenuLoop();
-
-          switch (key->type()) {
-
-            case KeyType::Tool: {
-              tools::Tool* current_tool = App::instance()->activeTool();
-              tools::Tool* select_this_tool = key->tool();
-              tools::ToolBox* toolbox = App::instance()->toolBox();
-              std::vector<tools::Tool*> possibles;
-
-              // Collect all tools with the pressed keyboard-shortcut
-              for (tools::Tool* tool : *toolbox) {
-                const KeyPtr key = KeyboardShortcuts::instance()->tool(tool);
-                if (key && key->isPressed(msg, *keys))
-                  possibles.push_back(tool);
-              }
+      const Keys pressed = keys->pressedKeys(msg);
+      if (!pressed.empty()) {
+        // Only the first pressed key is used
+        const KeyPtr& key = pressed.front();
+
+        // Cancel menu-bar loops (to close any popup menu)
+        App::instance()->mainWindow()->getMenuBar()->cancelMenuLoop();
+
+        switch (key->type()) {
+
+          case KeyType::Tool: {
+            tools::Tool* current_tool = App::instance()->activeTool();
+            tools::Tool* select_this_tool = key->tool();
+            tools::ToolBox* toolbox = App::instance()->toolBox();
+            std::vector<tools::Tool*> possibles;
+
+            // Collect all tools with the pressed keyboard-shortcut
+            for (tools::Tool* tool : *toolbox) {
+              const KeyPtr key = keys->tool(tool);
+              if (key && std::find(pressed.begin(), pressed.end(), key) != pressed.end())
+                possibles.push_back(tool);
+            }
 
-              if (possibles.size() >= 2) {
-                bool done = false;
+            if (possibles.size() >= 2) {
+              bool done = false;
 
-                for (size_t i=0; i<possibles.size(); ++i) {
-                  if (possibles[i] != current_tool &&
-                      ToolBar::instance()->isToolVisible(possibles[i])) {
-                    select_this_tool = possibles[i];
-                    done = true;
-                    break;
-                  }
+              for (size_t i=0; i<possibles.size(); ++i) {
+                if (possibles[i] != current_tool &&
+                    ToolBar::instance()->isToolVisible(possibles[i])) {
+                  select_this_tool = possibles[i];
+                  done = true;
+                  break;
                 }
+              }
 
-                if (!done) {
-                  for (size_t i=0; i<possibles.size(); ++i) {
-                    // If one of the possibilities is the current tool
-                    if (possibles[i] == current_tool) {
-                      // We select the next tool in the possibilities
-                      select_this_tool = possibles[(i+1) % possibles.size()];
-                      break;
-                    }
+              if (!done) {
+                for (size_t i=0; i<possibles.size(); ++i) {
+                  // If one of the possibilities is the current tool
+                  if (possibles[i] == current_tool) {
+                    // We select the next tool in the possibilities
+                    select_this_tool = possibles[(i+1) % possibles.size()];
+                    break;
                   }
                 }
               }
-
-              ToolBar::instance()->selectTool(select_this_tool);
-              return true;
             }
 
-            case KeyType::Command: {
-              Command* command = key->command();
-
-              // Commands are executed only when the main window is
-              // the current window running.
-              if (getForegroundWindow() == App::instance()->mainWindow()) {
-                // OK, so we can execute the command represented
-                // by the pressed-key in the message...
-                UIContext::instance()->executeCommandFromMenuOrShortcut(
-                  command, key->params());
-                return true;
-              }
-              break;
-            }
+            ToolBar::instance()->selectTool(select_this_tool);
+            return true;
+          }
+
+          case KeyType::Command: {
+            Command* command = key->command();
 
-            case KeyType::Quicktool: {
-              // Do nothing, it is used in the editor through the
-              // KeyboardShortcuts::getCurrentQuicktool() function.
-              break;
+            // Commands are executed only when the main window is
+            // the current window running.
+            if (getForegroundWindow() == App::instance()->mainWindow()) {
+              // OK, so we can execute the command represented
+              // by the pressed-key in the message...
+              UIContext::instance()->executeCommandFromMenuOrShortcut(
+                command, key->params());
+              return true;
             }
+            break;
+          }
 
+          case KeyType::Quicktool: {
+            // Do nothing, it is used in the editor through the
+            // KeyboardShortcuts::getCurrentQuicktool() function.
+            break;
           }
-          break;
+
         }
       }
       break;
@@ -617,6 +626,9 @@ bool CustomizedGuiManager::onProcessMessage(Message* msg)
         defered_invalid_region.clear();
         defered_invalid_timer->stop();
       }
+      else if (static_cast<TimerMessage*>(msg)->timer() == cache_collect_timer) {
+        CacheManager::instance()->collect();
+      }
       break;
 
   }
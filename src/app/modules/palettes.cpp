@@ -20,7 +20,9 @@
 #include "doc/palette.h"
 #include "doc/sprite.h"
 
+#include <atomic>
 #include <cstring>
+#include <mutex>
 
 namespace app {
 
@@ -30,6 +32,35 @@ static Palette* ase_default_palette = NULL;
 // Palette in current sprite frame.
 static Palette* ase_current_palette = NULL;
 
+// The default palette is loaded from disk the first time it's needed
+// (in batch mode it might not be needed at all).
+static std::recursive_mutex palettes_mutex;
+static std::atomic<bool> default_palette_loaded(false);
+static thread_local bool loading_default_palette = false;
+static bool current_palette_set = false;
+
+static Palette* load_default_palette_file();
+
+static void ensure_default_palette()
+{
+  // Avoid re-entering from load_palette()
+  if (default_palette_loaded || loading_default_palette)
+    return;
+
+  std::lock_guard<std::recursive_mutex> lock(palettes_mutex);
+  if (default_palette_loaded)
+    return;
+
+  loading_default_palette = true;
+  std::unique_ptr<Palette> pal(load_default_palette_file());
+  if (pal)
+    pal->copyColorsTo(ase_default_palette);
+  if (!current_palette_set)
+    ase_default_palette->copyColorsTo(ase_current_palette);
+  loading_default_palette = false;
+  default_palette_loaded = true;
+}
+
 int init_module_palette()
 {
   ase_default_palette = new Palette(frame_t(0), 256);
@@ -44,6 +75,12 @@ void exit_module_palette()
 }
 
 void load_default_palette()
+{
+  ensure_default_palette();
+  set_current_palette(nullptr, true);
+}
+
+static Palette* load_default_palette_file()
 {
   std::unique_ptr<Palette> pal;
   std::string defaultPalName = get_preset_palette_filename(
@@ -114,10 +151,7 @@ void load_default_palette()
     }
   }
 
-  if (pal)
-    set_default_palette(pal.get());
-
-  set_current_palette(nullptr, true);
+  return pal.release();
 }
 
 // TODO This palette isn't synced with the current sprite palette when
@@ -125,17 +159,24 @@ void load_default_palette()
 //      function and use the active Site palette.
 Palette* get_current_palette()
 {
+  ensure_default_palette();
   return ase_current_palette;
 }
 
 Palette* get_default_palette()
 {
+  ensure_default_palette();
   return ase_default_palette;
 }
 
 void set_default_palette(const Palette* palette)
 {
+  std::lock_guard<std::recursive_mutex> lock(palettes_mutex);
   palette->copyColorsTo(ase_default_palette);
+  // The current palette is the default one until it's changed
+  if (!default_palette_loaded && !current_palette_set)
+    palette->copyColorsTo(ase_current_palette);
+  default_palette_loaded = true;
 }
 
 // Changes the current system palette and triggers the
@@ -144,8 +185,12 @@ void set_default_palette(const Palette* palette)
 // If "_palette" is nullptr the default palette is set.
 bool set_current_palette(const Palette *_palette, bool forced)
 {
+  if (!_palette)
+    ensure_default_palette();
+
   const Palette* palette = (_palette ? _palette: ase_default_palette);
   bool ret = false;
+  current_palette_set = true;
 
   // Have changes
   if (forced ||
@@ -0,0 +1,45 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/res/palette_resource.h"
+
+#include "app/file/palette_file.h"
+#include "doc/palette.h"
+
+namespace app {
+
+PaletteResource::PaletteResource(const std::string& id,
+                                 const std::string& path,
+                                 const PaletteSummary& summary,
+                                 const FileOpConfig& config,
+                                 doc::Palette* palette)
+  : m_id(id)
+  , m_path(path)
+  , m_summary(summary)
+  , m_config(config)
+  , m_palette(palette)
+  , m_loaded(palette != nullptr)
+{
+}
+
+PaletteResource::~PaletteResource()
+{
+}
+
+doc::Palette* PaletteResource::palette()
+{
+  if (!m_loaded) {
+    m_loaded = true;
+    m_palette.reset(load_palette(m_path.c_str(), &m_config));
+  }
+  return m_palette.get();
+}
+
+} // namespace app
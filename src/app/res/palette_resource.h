@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -8,32 +9,43 @@
 #define APP_RES_PALETTE_RESOURCE_H_INCLUDED
 #pragma once
 
+#include "app/file/file_op_config.h"
+#include "app/res/palettes_index.h"
 #include "app/res/resource.h"
 
+#include <memory>
+
 namespace doc {
   class Palette;
 }
 
 namespace app {
 
+  // A palette file that is loaded only when the whole palette is
+  // needed (e.g. to apply it), the list of palettes uses its summary.
   class PaletteResource : public Resource {
   public:
     PaletteResource(const std::string& id,
                     const std::string& path,
-                    doc::Palette* palette)
-      : m_id(id)
-      , m_path(path)
-      , m_palette(palette) {
-    }
-    virtual ~PaletteResource() { }
+                    const PaletteSummary& summary,
+                    const FileOpConfig& config,
+                    doc::Palette* palette = nullptr);
+    virtual ~PaletteResource();
     virtual const std::string& id() const override { return m_id; }
     virtual const std::string& path() const override { return m_path; }
-    virtual doc::Palette* palette() { return m_palette; }
+    const PaletteSummary& summary() const { return m_summary; }
+
+    // Loads the palette file the first time it's called (returns
+    // nullptr if the file cannot be loaded).
+    virtual doc::Palette* palette();
 
   private:
     std::string m_id;
     std::string m_path;
-    doc::Palette* m_palette;
+    PaletteSummary m_summary;
+    FileOpConfig m_config;
+    std::unique_ptr<doc::Palette> m_palette;
+    bool m_loaded;
   };
 
 } // namespace app
@@ -0,0 +1,187 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/res/palettes_index.h"
+
+#include "app/resource_finder.h"
+#include "base/fs.h"
+#include "base/fstream_path.h"
+#include "base/serialization.h"
+#include "doc/palette.h"
+#include "doc/string_io.h"
+
+#include <algorithm>
+#include <fstream>
+
+namespace app {
+
+using namespace base::serialization;
+using namespace base::serialization::little_endian;
+
+namespace {
+
+const uint32_t kIndexMagic = 0x58494150; // "PAIX"
+const uint32_t kIndexVersion = 1;
+
+void write_time(std::ostream& os, const base::Time& t)
+{
+  write16(os, uint16_t(t.year));
+  write8(os, uint8_t(t.month));
+  write8(os, uint8_t(t.day));
+  write8(os, uint8_t(t.hour));
+  write8(os, uint8_t(t.minute));
+  write8(os, uint8_t(t.second));
+}
+
+base::Time read_time(std::istream& is)
+{
+  base::Time t;
+  t.year = read16(is);
+  t.month = read8(is);
+  t.day = read8(is);
+  t.hour = read8(is);
+  t.minute = read8(is);
+  t.second = read8(is);
+  return t;
+}
+
+} // anonymous namespace
+
+PaletteSummary::PaletteSummary(const doc::Palette* palette)
+{
+  if (palette) {
+    comment = palette->comment();
+    count = palette->size();
+    preview.resize(std::min(count, kMaxPreviewColors));
+    for (int i=0; i<int(preview.size()); ++i)
+      preview[i] = palette->getEntry(i);
+  }
+}
+
+bool PaletteSummary::mayBeEqual(const doc::Palette* palette) const
+{
+  if (palette->size() != count)
+    return false;
+  for (int i=0; i<int(preview.size()); ++i)
+    if (palette->getEntry(i) != preview[i])
+      return false;
+  return true;
+}
+
+// static
+PalettesIndex* PalettesIndex::instance()
+{
+  static PalettesIndex index;
+  return &index;
+}
+
+PalettesIndex::PalettesIndex()
+{
+  ResourceFinder rf;
+  rf.includeUserDir("palettes.index");
+  m_filename = rf.getFirstOrCreateDefault();
+  load();
+}
+
+bool PalettesIndex::find(const std::string& path, PaletteSummary& summary)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entries.find(path);
+  if (it == m_entries.end() ||
+      !base::is_file(path) ||
+      !(it->second.mtime == base::get_modification_time(path)) ||
+      it->second.size != base::file_size(path))
+    return false;
+
+  summary = it->second.summary;
+  m_used.insert(path);
+  return true;
+}
+
+void PalettesIndex::add(const std::string& path, const PaletteSummary& summary)
+{
+  if (!base::is_file(path))
+    return;
+
+  Entry entry;
+  entry.mtime = base::get_modification_time(path);
+  entry.size = base::file_size(path);
+  entry.summary = summary;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entries[path] = entry;
+  m_used.insert(path);
+  m_modified = true;
+}
+
+void PalettesIndex::save()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_modified || m_filename.empty())
+    return;
+
+  std::ofstream f(FSTREAM_PATH(m_filename), std::ofstream::binary);
+  if (!f)
+    return;
+
+  write32(f, kIndexMagic);
+  write32(f, kIndexVersion);
+  write32(f, uint32_t(m_used.size()));
+  for (const auto& path : m_used) {
+    const Entry& entry = m_entries[path];
+    doc::write_string(f, path);
+    write_time(f, entry.mtime);
+    write32(f, uint32_t(entry.size));
+    write32(f, uint32_t(entry.size >> 32));
+    doc::write_string(f, entry.summary.comment);
+    write32(f, uint32_t(entry.summary.count));
+    write16(f, uint16_t(entry.summary.preview.size()));
+    for (doc::color_t c : entry.summary.preview)
+      write32(f, c);
+  }
+  if (f.good())
+    m_modified = false;
+}
+
+// Errors reading the file are ignored (the index is just empty)
+void PalettesIndex::load()
+{
+  std::ifstream f(FSTREAM_PATH(m_filename), std::ifstream::binary);
+  if (!f ||
+      read32(f) != kIndexMagic ||
+      read32(f) != kIndexVersion)
+    return;
+
+  std::map<std::string, Entry> entries;
+  const uint32_t n = read32(f);
+  for (uint32_t i=0; i<n && f; ++i) {
+    const std::string path = doc::read_string(f);
+    Entry entry;
+    entry.mtime = read_time(f);
+    entry.size = read32(f);
+    entry.size |= (uint64_t(read32(f)) << 32);
+    entry.summary.comment = doc::read_string(f);
+    entry.summary.count = int(read32(f));
+    const int npreview = read16(f);
+    if (npreview > PaletteSummary::kMaxPreviewColors ||
+        npreview > entry.summary.count)
+      return;
+    entry.summary.preview.resize(npreview);
+    for (int j=0; j<npreview; ++j)
+      entry.summary.preview[j] = read32(f);
+    entries[path] = std::move(entry);
+  }
+  if (!f)
+    return;
+
+  m_entries = std::move(entries);
+}
+
+} // namespace app
@@ -0,0 +1,79 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_RES_PALETTES_INDEX_H_INCLUDED
+#define APP_RES_PALETTES_INDEX_H_INCLUDED
+#pragma once
+
+#include "base/time.h"
+#include "doc/color.h"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace doc {
+  class Palette;
+}
+
+namespace app {
+
+  // Information of a palette file to show it in the list of
+  // palettes without loading the whole file.
+  struct PaletteSummary {
+    // Max number of colors saved in the preview
+    static constexpr int kMaxPreviewColors = 128;
+
+    std::string comment;
+    int count = 0;                    // Number of colors of the palette
+    std::vector<doc::color_t> preview; // First colors of the palette
+
+    explicit PaletteSummary(const doc::Palette* palette = nullptr);
+
+    // Returns true if the given palette could be equal to the palette
+    // of this summary (it's only sure that they are different if
+    // this function returns false).
+    bool mayBeEqual(const doc::Palette* palette) const;
+  };
+
+  // Persistent index of the summary of palette files by path (plus
+  // modification time and size to know when a file was modified), so
+  // we don't need to parse hundreds of palette files each time we
+  // show the list of palettes. It can be used from any thread.
+  class PalettesIndex {
+  public:
+    static PalettesIndex* instance();
+
+    bool find(const std::string& path, PaletteSummary& summary);
+    void add(const std::string& path, const PaletteSummary& summary);
+
+    // Saves the entries that were used (found or added) in this
+    // process (if something was added).
+    void save();
+
+  private:
+    struct Entry {
+      base::Time mtime;
+      uint64_t size = 0;
+      PaletteSummary summary;
+    };
+
+    PalettesIndex();
+    void load();
+
+    std::mutex m_mutex;
+    std::string m_filename;
+    std::map<std::string, Entry> m_entries;
+    std::set<std::string> m_used;
+    bool m_modified = false;
+  };
+
+} // namespace app
+
+#endif
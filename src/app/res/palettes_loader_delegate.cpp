@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -16,6 +16,7 @@
 #include "app/file/palette_file.h"
 #include "app/file_system.h"
 #include "app/res/palette_resource.h"
+#include "app/res/palettes_index.h"
 #include "app/resource_finder.h"
 #include "base/fs.h"
 #include "base/scoped_value.h"
@@ -63,11 +64,26 @@ void PalettesLoaderDelegate::getResourcesPaths(std::map<std::string, std::string
 Resource* PalettesLoaderDelegate::loadResource(const std::string& id,
                                                const std::string& path)
 {
+  // Palettes that didn't change since the last time they were loaded
+  // are parsed only when they are used
+  auto index = PalettesIndex::instance();
+  PaletteSummary summary;
+  if (index->find(path, summary))
+    return new PaletteResource(id, path, summary, m_config);
+
   doc::Palette* palette = load_palette(path.c_str(), &m_config);
-  if (palette)
-    return new PaletteResource(id, path, palette);
+  if (palette) {
+    summary = PaletteSummary(palette);
+    index->add(path, summary);
+    return new PaletteResource(id, path, summary, m_config, palette);
+  }
   else
     return nullptr;
 }
 
+void PalettesLoaderDelegate::onFinishLoading()
+{
+  PalettesIndex::instance()->save();
+}
+
 } // namespace app
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -22,6 +22,7 @@ namespace app {
     virtual void getResourcesPaths(std::map<std::string, std::string>& idAndPath) const override;
     virtual Resource* loadResource(const std::string& id,
                                    const std::string& path) override;
+    virtual void onFinishLoading() override;
 
   private:
     FileOpConfig m_config;
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2020  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -24,14 +24,13 @@ ResourcesLoader::ResourcesLoader(ResourcesLoaderDelegate* delegate)
   : m_delegate(delegate)
   , m_done(false)
   , m_cancel(false)
-  , m_thread(new base::thread([this]{ threadLoadResources(); }))
 {
+  startTask();
 }
 
 ResourcesLoader::~ResourcesLoader()
 {
-  if (m_thread)
-    m_thread->join();
+  m_task.wait();
 }
 
 void ResourcesLoader::cancel()
@@ -52,12 +51,8 @@ bool ResourcesLoader::next(std::unique_ptr<Resource>& resource)
 
 void ResourcesLoader::reload()
 {
-  if (m_thread) {
-    m_thread->join();
-    m_thread.reset(nullptr);
-  }
-
-  m_thread.reset(createThread());
+  m_task.wait();
+  startTask();
 }
 
 void ResourcesLoader::threadLoadResources()
@@ -81,11 +76,15 @@ void ResourcesLoader::threadLoadResources()
     if (resource)
       m_queue.push(resource);
   }
+
+  m_delegate->onFinishLoading();
 }
 
-base::thread* ResourcesLoader::createThread()
+void ResourcesLoader::startTask()
 {
-  return new base::thread([this]{ threadLoadResources(); });
+  m_done = false;
+  m_task.run([this](base::task_token&){ threadLoadResources(); },
+             TaskPriority::Background);
 }
 
 } // namespace app
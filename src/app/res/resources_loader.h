@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -8,8 +9,8 @@
 #define APP_RES_RESOURCES_LOADER_H_INCLUDED
 #pragma once
 
+#include "app/task.h"
 #include "base/concurrent_queue.h"
-#include "base/thread.h"
 
 #include <memory>
 
@@ -30,7 +31,7 @@ namespace app {
 
   private:
     void threadLoadResources();
-    base::thread* createThread();
+    void startTask();
 
     typedef base::concurrent_queue<Resource*> Queue;
 
@@ -38,7 +39,7 @@ namespace app {
     bool m_done;
     bool m_cancel;
     Queue m_queue;
-    std::unique_ptr<base::thread> m_thread;
+    Task m_task;
   };
 
 } // namespace app
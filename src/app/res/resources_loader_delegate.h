@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -21,6 +22,10 @@ namespace app {
     virtual void getResourcesPaths(std::map<std::string, std::string>& idAndPath) const = 0;
     virtual Resource* loadResource(const std::string& id,
                                    const std::string& path) = 0;
+
+    // Called from the loading thread when all resources were loaded
+    // (or the loading process was canceled).
+    virtual void onFinishLoading() { }
   };
 
 } // namespace app
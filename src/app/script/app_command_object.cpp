@@ -15,7 +15,10 @@
 #include "app/commands/new_params.h"
 #include "app/commands/params.h"
 #include "app/context.h"
+#include "app/script/engine.h"
 #include "app/script/luacpp.h"
+#include "app/script/profiler.h"
+#include "base/chrono.h"
 
 namespace app {
 namespace script {
@@ -51,7 +54,13 @@ int Command_call(lua_State* L)
     }
   }
 
-  ctx->executeCommand(command, params);
+  if (auto profiler = App::instance()->scriptEngine()->profiler()) {
+    base::Chrono chrono;
+    ctx->executeCommand(command, params);
+    profiler->addCommand(command->id(), chrono.elapsed());
+  }
+  else
+    ctx->executeCommand(command, params);
 
   if (ctx->commandResult().type() == CommandResult::kOk) {
     lua_pushboolean(L, true);
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2015-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -10,7 +10,9 @@
 #endif
 
 #include "app/app.h"
+#include "app/cache_manager.h"
 #include "app/commands/commands.h"
+#include "app/commands/filters/filter_pipeline.h"
 #include "app/commands/params.h"
 #include "app/context.h"
 #include "app/doc.h"
@@ -48,12 +50,36 @@
 #include "ui/alert.h"
 #include "ver/info.h"
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
 
 namespace app {
 namespace script {
 
+namespace {
+
+// Stack of app.transaction() calls that are being executed
+std::vector<int> g_transactions;
+int g_nextTransactionId = 0;
+
+} // anonymous namespace
+
+int current_transaction_id()
+{
+  return (g_transactions.empty() ? 0: g_transactions.back());
+}
+
+bool is_transaction_running(const int transactionId)
+{
+  return (transactionId != 0 &&
+          std::find(g_transactions.begin(),
+                    g_transactions.end(),
+                    transactionId) != g_transactions.end());
+}
+
 int load_sprite_from_file(lua_State* L, const char* filename,
                           const LoadSpriteFromFileParam param)
 {
@@ -136,8 +162,19 @@ int App_transaction(lua_State* L)
   if (lua_isfunction(L, 1)) {
     Tx tx; // Create a new transaction so it exists in the whole
             // duration of the argument function call.
+
+    // Changes of properties (layer names, cel positions, etc.) are
+    // notified only once when the function ends.
+    Doc* doc = tx.document();
+    doc->beginDeferredNotifications();
+
     lua_pushvalue(L, -1);
-    if (lua_pcall(L, 0, LUA_MULTRET, 0) == LUA_OK)
+    g_transactions.push_back(++g_nextTransactionId);
+    const bool ok = (lua_pcall(L, 0, LUA_MULTRET, 0) == LUA_OK);
+    g_transactions.pop_back();
+
+    doc->endDeferredNotifications();
+    if (ok)
       tx.commit();
     else
       return lua_error(L); // pcall already put an error object on the stack
@@ -146,6 +183,39 @@ int App_transaction(lua_State* L)
   return nresults;
 }
 
+// Filters executed from the given function are collected and applied
+// together when the function ends (each cel is modified only one
+// time, in one transaction).
+int App_applyFilters(lua_State* L)
+{
+  int top = lua_gettop(L);
+  int nresults = 0;
+  if (lua_isfunction(L, 1)) {
+    bool ok;
+    std::string error;
+    {
+      FilterPipeline pipeline;
+      lua_pushvalue(L, -1);
+      ok = (lua_pcall(L, 0, LUA_MULTRET, 0) == LUA_OK);
+      if (ok && !pipeline.empty()) {
+        try {
+          pipeline.apply(App::instance()->context());
+        }
+        catch (const std::exception& ex) {
+          error = ex.what();
+        }
+      }
+    }
+    // Errors are raised when the pipeline doesn't exist anymore
+    if (!ok)
+      return lua_error(L); // pcall already put an error object on the stack
+    else if (!error.empty())
+      return luaL_error(L, "%s", error.c_str());
+    nresults = lua_gettop(L) - top;
+  }
+  return nresults;
+}
+
 int App_undo(lua_State* L)
 {
   app::Context* ctx = App::instance()->context();
@@ -243,6 +313,23 @@ int App_refresh(lua_State* L)
   return 0;
 }
 
+// app.startProfiler() measures the time of the Lua functions and
+// commands executed until app.stopProfiler() is called (which returns
+// the report as a string).
+int App_startProfiler(lua_State* L)
+{
+  if (!App::instance()->scriptEngine()->startProfiler())
+    return luaL_error(L, "the profiler cannot be started (it's already running or the debugger is active)");
+  return 0;
+}
+
+int App_stopProfiler(lua_State* L)
+{
+  const std::string report = App::instance()->scriptEngine()->stopProfiler();
+  lua_pushlstring(L, report.c_str(), report.size());
+  return 1;
+}
+
 int App_useTool(lua_State* L)
 {
   // First argument must be a table
@@ -550,6 +637,30 @@ int App_get_sprites(lua_State* L)
   return 1;
 }
 
+// Returns a table with the memory used by all sprites (and their
+// undo histories) and by each cache (in bytes), e.g.
+// { documents=..., caches={ ["Thumbnails"]=..., ... } }
+int App_get_memoryUsage(lua_State* L)
+{
+  std::size_t documents = 0;
+  if (app::Context* ctx = App::instance()->context()) {
+    for (const Doc* doc : ctx->documents())
+      documents += doc->memoryUsage().total();
+  }
+
+  lua_newtable(L);
+  lua_pushinteger(L, documents);
+  lua_setfield(L, -2, "documents");
+
+  lua_newtable(L);
+  for (const auto& cache : CacheManager::instance()->usage()) {
+    lua_pushinteger(L, cache.bytes);
+    lua_setfield(L, -2, cache.name.c_str());
+  }
+  lua_setfield(L, -2, "caches");
+  return 1;
+}
+
 int App_get_fgColor(lua_State* L)
 {
   push_obj<app::Color>(L, Preferences::instance().colorBar.fgColor());
@@ -718,11 +829,14 @@ const luaL_Reg App_methods[] = {
   { "open",        App_open },
   { "exit",        App_exit },
   { "transaction", App_transaction },
+  { "applyFilters", App_applyFilters },
   { "undo",        App_undo },
   { "redo",        App_redo },
   { "alert",       App_alert },
   { "refresh",     App_refresh },
   { "useTool",     App_useTool },
+  { "startProfiler", App_startProfiler },
+  { "stopProfiler", App_stopProfiler },
   { nullptr,       nullptr }
 };
 
@@ -745,6 +859,7 @@ const Property App_properties[] = {
   { "isUIAvailable", App_get_isUIAvailable, nullptr },
   { "defaultPalette", App_get_defaultPalette, App_set_defaultPalette },
   { "events", App_get_events, nullptr },
+  { "memoryUsage", App_get_memoryUsage, nullptr },
   { nullptr, nullptr, nullptr }
 };
 
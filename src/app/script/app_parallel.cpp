@@ -0,0 +1,374 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/script/engine.h"
+#include "app/script/luacpp.h"
+#include "doc/image.h"
+#include "doc/image_spec.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// app.parallel(items, func) calls func(item, index) for each item of
+// the given array in worker threads. Each worker has its own Lua
+// state (without the app API), so the function cannot use upvalues
+// (local variables of the script), and images are given to it as
+// read-only snapshots:
+//
+//   { width=int, height=int, colorMode=int, rowStride=int, bytes=string }
+//
+// The function can return a string with the new bytes of the given
+// image (same spec), a table like the previous one (to create an
+// image of other size/color mode), or a boolean/number/string value.
+// The returned images are created in the main thread as new Image
+// objects, so the script can commit them to the sprite (e.g. in a
+// app.transaction()).
+
+namespace app {
+namespace script {
+
+namespace {
+
+// Value copied from/to a Lua state
+struct WorkerValue {
+  enum class Type { Nil, Boolean, Integer, Number, String, Image };
+  Type type = Type::Nil;
+  bool boolean = false;
+  lua_Integer integer = 0;
+  lua_Number number = 0.0;
+  std::string bytes;            // String or image pixels
+  doc::ImageSpec spec = doc::ImageSpec(doc::ColorMode::RGB, 1, 1);
+};
+
+struct WorkerItem {
+  WorkerValue input;
+  WorkerValue output;
+  std::string error;
+};
+
+int dump_writer(lua_State* L, const void* p, size_t sz, void* ud)
+{
+  ((std::string*)ud)->append((const char*)p, sz);
+  return 0;
+}
+
+int image_row_stride(const doc::ImageSpec& spec)
+{
+  return doc::calculate_rowstride_bytes(doc::PixelFormat(spec.colorMode()),
+                                        spec.width());
+}
+
+std::size_t image_bytes_size(const doc::ImageSpec& spec)
+{
+  return std::size_t(image_row_stride(spec)) * spec.height();
+}
+
+// Converts the value of the main Lua state in the given index to a
+// WorkerValue. Returns false if it's a not supported value.
+bool get_input_value(lua_State* L, int index, WorkerValue& value)
+{
+  switch (lua_type(L, index)) {
+    case LUA_TNIL:
+      value.type = WorkerValue::Type::Nil;
+      return true;
+    case LUA_TBOOLEAN:
+      value.type = WorkerValue::Type::Boolean;
+      value.boolean = lua_toboolean(L, index);
+      return true;
+    case LUA_TNUMBER:
+      if (lua_isinteger(L, index)) {
+        value.type = WorkerValue::Type::Integer;
+        value.integer = lua_tointeger(L, index);
+      }
+      else {
+        value.type = WorkerValue::Type::Number;
+        value.number = lua_tonumber(L, index);
+      }
+      return true;
+    case LUA_TSTRING: {
+      size_t len;
+      const char* str = lua_tolstring(L, index, &len);
+      value.type = WorkerValue::Type::String;
+      value.bytes.assign(str, len);
+      return true;
+    }
+    case LUA_TUSERDATA:
+      if (const doc::Image* image = may_get_image_from_arg(L, index)) {
+        value.type = WorkerValue::Type::Image;
+        value.spec = image->spec();
+        value.bytes.assign((const char*)image->getPixelAddress(0, 0),
+                           image_bytes_size(value.spec));
+        return true;
+      }
+      break;
+  }
+  return false;
+}
+
+// Pushes the given value in the worker Lua state
+void push_worker_value(lua_State* L, const WorkerValue& value)
+{
+  switch (value.type) {
+    case WorkerValue::Type::Nil:
+      lua_pushnil(L);
+      break;
+    case WorkerValue::Type::Boolean:
+      lua_pushboolean(L, value.boolean);
+      break;
+    case WorkerValue::Type::Integer:
+      lua_pushinteger(L, value.integer);
+      break;
+    case WorkerValue::Type::Number:
+      lua_pushnumber(L, value.number);
+      break;
+    case WorkerValue::Type::String:
+      lua_pushlstring(L, value.bytes.c_str(), value.bytes.size());
+      break;
+    case WorkerValue::Type::Image:
+      lua_createtable(L, 0, 5);
+      lua_pushinteger(L, value.spec.width());
+      lua_setfield(L, -2, "width");
+      lua_pushinteger(L, value.spec.height());
+      lua_setfield(L, -2, "height");
+      lua_pushinteger(L, int(value.spec.colorMode()));
+      lua_setfield(L, -2, "colorMode");
+      lua_pushinteger(L, image_row_stride(value.spec));
+      lua_setfield(L, -2, "rowStride");
+      lua_pushlstring(L, value.bytes.c_str(), value.bytes.size());
+      lua_setfield(L, -2, "bytes");
+      break;
+  }
+}
+
+// Converts the result of the worker function (at the top of the
+// worker Lua state) to a WorkerValue. Returns an error message if the
+// result is invalid.
+std::string get_output_value(lua_State* L, const WorkerValue& input,
+                             WorkerValue& output)
+{
+  // A string is the new content of the input image
+  if (lua_type(L, -1) == LUA_TSTRING &&
+      input.type == WorkerValue::Type::Image) {
+    size_t len;
+    const char* bytes = lua_tolstring(L, -1, &len);
+    if (len != input.bytes.size())
+      return "the returned bytes don't match the image size";
+    output.type = WorkerValue::Type::Image;
+    output.spec = input.spec;
+    output.bytes.assign(bytes, len);
+    return std::string();
+  }
+
+  // { width, height, colorMode, bytes }
+  if (lua_istable(L, -1)) {
+    // Raw access as we are outside the protected call
+    const int t = lua_absindex(L, -1);
+    for (const char* field : { "width", "height", "colorMode", "bytes" }) {
+      lua_pushstring(L, field);
+      lua_rawget(L, t);
+    }
+    const int w = lua_tointeger(L, -4);
+    const int h = lua_tointeger(L, -3);
+    const auto colorMode = (lua_isnil(L, -2) ? doc::ColorMode::RGB:
+                            (doc::ColorMode)lua_tointeger(L, -2));
+    size_t len = 0;
+    const char* bytes = lua_tolstring(L, -1, &len);
+
+    std::string error;
+    if (w < 1 || h < 1 || !bytes)
+      error = "invalid image table";
+    else if (colorMode != doc::ColorMode::RGB &&
+             colorMode != doc::ColorMode::GRAYSCALE &&
+             colorMode != doc::ColorMode::INDEXED)
+      error = "invalid image color mode";
+    else {
+      output.type = WorkerValue::Type::Image;
+      output.spec = doc::ImageSpec(colorMode, w, h,
+                                   (input.type == WorkerValue::Type::Image ?
+                                    input.spec.maskColor(): 0));
+      if (len != image_bytes_size(output.spec))
+        error = "the returned bytes don't match the image size";
+      else
+        output.bytes.assign(bytes, len);
+    }
+    lua_pop(L, 4);
+    return error;
+  }
+
+  if (get_input_value(L, -1, output))
+    return std::string();
+  return "the function returned an unsupported value";
+}
+
+void push_output_value(lua_State* L, const WorkerValue& value)
+{
+  if (value.type == WorkerValue::Type::Image) {
+    doc::Image* image = doc::Image::create(value.spec);
+    std::memcpy(image->getPixelAddress(0, 0),
+                value.bytes.c_str(), value.bytes.size());
+    push_image(L, image);
+  }
+  else
+    push_worker_value(L, value);
+}
+
+// Creates a Lua state with only the standard libraries without
+// access to files
+lua_State* create_worker_state()
+{
+  lua_State* L = luaL_newstate();
+  if (!L)
+    return nullptr;
+
+  luaL_requiref(L, LUA_GNAME, luaopen_base, 1);
+  luaL_requiref(L, LUA_TABLIBNAME, luaopen_table, 1);
+  luaL_requiref(L, LUA_STRLIBNAME, luaopen_string, 1);
+  luaL_requiref(L, LUA_MATHLIBNAME, luaopen_math, 1);
+  luaL_requiref(L, LUA_UTF8LIBNAME, luaopen_utf8, 1);
+  lua_pop(L, 5);
+
+  for (const char* name : { "dofile", "loadfile", "print" }) {
+    lua_pushnil(L);
+    lua_setglobal(L, name);
+  }
+  return L;
+}
+
+void run_worker(const std::string& code,
+                std::vector<WorkerItem>& items,
+                std::atomic<int>& nextItem)
+{
+  lua_State* L = create_worker_state();
+  std::string error;
+  if (!L)
+    error = "not enough memory";
+  else if (luaL_loadbufferx(L, code.c_str(), code.size(), "=parallel", "b") != LUA_OK) {
+    error = lua_tostring(L, -1);
+    lua_pop(L, 1);
+  }
+
+  const int n = int(items.size());
+  for (int i=nextItem++; i<n; i=nextItem++) {
+    WorkerItem& item = items[i];
+    if (!error.empty()) {
+      item.error = error;
+      continue;
+    }
+
+    lua_pushvalue(L, -1);            // The function
+    push_worker_value(L, item.input);
+    lua_pushinteger(L, i+1);
+    if (lua_pcall(L, 2, 1, 0) == LUA_OK)
+      item.error = get_output_value(L, item.input, item.output);
+    else if (const char* s = lua_tostring(L, -1))
+      item.error = s;
+    else
+      item.error = "error object is not a string";
+    lua_pop(L, 1);
+  }
+
+  if (L)
+    lua_close(L);
+}
+
+int App_parallel(lua_State* L)
+{
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+
+  if (lua_iscfunction(L, 2))
+    return luaL_error(L, "app.parallel() needs a Lua function");
+
+  // The function is copied to each worker state, the only upvalue it
+  // can use is _ENV (global variables of the worker)
+  for (int i=1; ; ++i) {
+    const char* name = lua_getupvalue(L, 2, i);
+    if (!name)
+      break;
+    lua_pop(L, 1);
+    if (std::strcmp(name, "_ENV") != 0 || i > 1)
+      return luaL_error(L, "app.parallel() function cannot use local variable '%s' from outside the function", name);
+  }
+
+  std::string code;
+  lua_pushvalue(L, 2);
+  const int res = lua_dump(L, dump_writer, &code, 0);
+  lua_pop(L, 1);
+  if (res != 0)
+    return luaL_error(L, "app.parallel() cannot copy the given function");
+
+  const int n = int(luaL_len(L, 1));
+  bool failed = false;
+  {
+    // Lua errors are raised outside this scope so the items are
+    // destroyed
+    std::vector<WorkerItem> items(n);
+    for (int i=0; i<n && !failed; ++i) {
+      lua_geti(L, 1, i+1);
+      const bool valid = get_input_value(L, -1, items[i].input);
+      lua_pop(L, 1);
+      if (!valid) {
+        lua_pushfstring(L, "app.parallel() item %d is not an image, boolean, number, or string", i+1);
+        failed = true;
+      }
+    }
+
+    if (!failed && n > 0) {
+      const int nthreads =
+        std::min<int>(n, std::max<int>(1, std::thread::hardware_concurrency()));
+      std::atomic<int> nextItem(0);
+
+      std::vector<std::thread> threads;
+      for (int i=1; i<nthreads; ++i)
+        threads.emplace_back([&code, &items, &nextItem]{
+          run_worker(code, items, nextItem);
+        });
+      run_worker(code, items, nextItem); // Use this thread too
+      for (auto& thread : threads)
+        thread.join();
+
+      for (int i=0; i<n; ++i) {
+        if (!items[i].error.empty()) {
+          lua_pushfstring(L, "app.parallel() item %d: %s", i+1, items[i].error.c_str());
+          failed = true;
+          break;
+        }
+      }
+    }
+
+    if (!failed) {
+      lua_createtable(L, n, 0);
+      for (int i=0; i<n; ++i) {
+        push_output_value(L, items[i].output);
+        lua_rawseti(L, -2, i+1);
+      }
+    }
+  }
+  if (failed)
+    return lua_error(L);
+  return 1;
+}
+
+} // anonymous namespace
+
+void register_app_parallel_function(lua_State* L)
+{
+  lua_getglobal(L, "app");
+  lua_pushcfunction(L, App_parallel);
+  lua_setfield(L, -2, "parallel");
+  lua_pop(L, 1);
+}
+
+} // namespace script
+} // namespace app
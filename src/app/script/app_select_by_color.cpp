@@ -0,0 +1,86 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/script/engine.h"
+#include "app/script/luacpp.h"
+#include "app/task_scheduler.h"
+#include "doc/image.h"
+#include "doc/mask.h"
+
+#include <memory>
+#include <vector>
+
+// app.selectByColor(images, color [, tolerance]) returns an array
+// with one new Selection for each given image (e.g. the images of the
+// cels of several frames) with the pixels that are similar to the
+// given color (same as Mask::byColor() used by Select > Color
+// Range). The masks are created in parallel, and each selection is
+// in image coordinates (e.g. use "selection.origin = cel.position" to
+// move it to sprite coordinates).
+
+namespace app {
+namespace script {
+
+namespace {
+
+struct MaskItem {
+  const doc::Image* image = nullptr;
+  doc::color_t color = 0;
+  std::unique_ptr<doc::Mask> mask;
+};
+
+int App_selectByColor(lua_State* L)
+{
+  luaL_checktype(L, 1, LUA_TTABLE);
+  const int tolerance = int(luaL_optinteger(L, 3, 0));
+
+  const int n = int(luaL_len(L, 1));
+  std::vector<MaskItem> items(n);
+  for (int i=0; i<n; ++i) {
+    lua_geti(L, 1, i+1);
+    const doc::Image* image = may_get_image_from_arg(L, -1);
+    lua_pop(L, 1);
+    if (!image)
+      return luaL_error(L, "app.selectByColor() item %d is not an image", i+1);
+
+    items[i].image = image;
+    // The color is converted to each image pixel format here (in the
+    // main thread)
+    items[i].color = convert_args_into_pixel_color(L, 2, image->pixelFormat());
+  }
+
+  // Images are only read until all masks are created
+  TaskScheduler::instance()->parallelFor(
+    n, [&items, tolerance](int i){
+      MaskItem& item = items[i];
+      item.mask.reset(new doc::Mask);
+      item.mask->byColor(item.image, item.color, tolerance);
+    });
+
+  lua_createtable(L, n, 0);
+  for (int i=0; i<n; ++i) {
+    push_selection(L, items[i].mask.release());
+    lua_rawseti(L, -2, i+1);
+  }
+  return 1;
+}
+
+} // anonymous namespace
+
+void register_app_select_by_color_function(lua_State* L)
+{
+  lua_getglobal(L, "app");
+  lua_pushcfunction(L, App_selectByColor);
+  lua_setfield(L, -2, "selectByColor");
+  lua_pop(L, 1);
+}
+
+} // namespace script
+} // namespace app
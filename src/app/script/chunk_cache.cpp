@@ -0,0 +1,181 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/script/chunk_cache.h"
+
+#include "app/resource_finder.h"
+#include "app/script/luacpp.h"
+#include "base/fs.h"
+#include "base/fstream_path.h"
+
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+namespace app {
+namespace script {
+
+namespace {
+
+// First line of each cached chunk file followed by the source hash
+// and the bytecode size
+const char* kCacheFileMagic = "ASEPRITE-LUA-CHUNK";
+
+uint64_t fnv1a(const std::string& data)
+{
+  uint64_t hash = 14695981039346656037ull;
+  for (const char chr : data) {
+    hash ^= uint8_t(chr);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+int string_writer(lua_State* L, const void* p, size_t sz, void* ud)
+{
+  ((std::string*)ud)->append((const char*)p, sz);
+  return 0;
+}
+
+} // anonymous namespace
+
+int ChunkCache::load(lua_State* L,
+                     const std::string& filename,
+                     const std::string& source)
+{
+  const std::string chunkname = "@" + filename;
+  const uint64_t sourceHash = fnv1a(source);
+
+  std::string bytecode;
+  if (get(filename, sourceHash, bytecode)) {
+    if (luaL_loadbufferx(L, bytecode.c_str(), bytecode.size(),
+                         chunkname.c_str(), "b") == LUA_OK)
+      return LUA_OK;
+
+    // Invalid bytecode (e.g. generated by other Lua version), the
+    // source will be compiled again
+    lua_pop(L, 1);
+    remove(filename);
+  }
+
+  const int status = luaL_loadbuffer(L, source.c_str(), source.size(),
+                                     chunkname.c_str());
+  if (status == LUA_OK) {
+    bytecode.clear();
+    if (lua_dump(L, string_writer, &bytecode, 0) == 0)
+      put(filename, sourceHash, bytecode);
+  }
+  return status;
+}
+
+bool ChunkCache::get(const std::string& filename,
+                     const uint64_t sourceHash,
+                     std::string& bytecode)
+{
+  auto it = m_entries.find(filename);
+  if (it != m_entries.end()) {
+    if (it->second.sourceHash != sourceHash)
+      return false;
+    bytecode = it->second.bytecode;
+    return true;
+  }
+
+  const std::string fn = cacheFilename(filename);
+  if (fn.empty())
+    return false;
+
+  std::ifstream f(FSTREAM_PATH(fn), std::ifstream::binary);
+  if (!f)
+    return false;
+
+  std::string magic, path;
+  uint64_t hash = 0;
+  std::size_t size = 0;
+  f >> magic >> std::hex >> hash >> std::dec >> size;
+  if (!f || magic != kCacheFileMagic || hash != sourceHash)
+    return false;
+
+  // The full filename is stored in the next line to detect
+  // collisions of its hash
+  f.get();
+  std::getline(f, path);
+  if (!f || path != filename)
+    return false;
+
+  std::vector<char> buf(size);
+  if (size > 0 && !f.read(&buf[0], size))
+    return false;
+
+  bytecode.assign(buf.begin(), buf.end());
+  m_entries[filename] = Entry{ sourceHash, bytecode };
+  return true;
+}
+
+void ChunkCache::put(const std::string& filename,
+                     const uint64_t sourceHash,
+                     const std::string& bytecode)
+{
+  m_entries[filename] = Entry{ sourceHash, bytecode };
+
+  const std::string fn = cacheFilename(filename);
+  if (fn.empty())
+    return;
+
+  std::ofstream f(FSTREAM_PATH(fn), std::ofstream::binary);
+  if (!f)
+    return;
+
+  char buf[128];
+  std::snprintf(buf, sizeof(buf), "%s %016llx %zu\n", kCacheFileMagic,
+                (unsigned long long)sourceHash, bytecode.size());
+  f << buf << filename << '\n';
+  f.write(bytecode.c_str(), bytecode.size());
+}
+
+void ChunkCache::remove(const std::string& filename)
+{
+  m_entries.erase(filename);
+
+  const std::string fn = cacheFilename(filename);
+  if (!fn.empty() && base::is_file(fn)) {
+    try {
+      base::delete_file(fn);
+    }
+    catch (const std::exception&) {
+      // Ignore errors, the file will be replaced
+    }
+  }
+}
+
+std::string ChunkCache::cacheFilename(const std::string& filename)
+{
+  if (m_dir.empty()) {
+    try {
+      ResourceFinder rf(false);
+      rf.includeUserDir(base::join_path("cache", base::join_path("scripts", ".")).c_str());
+      m_dir = rf.getFirstOrCreateDefault();
+    }
+    catch (const std::exception&) {
+      // Without a cache directory we can still use the chunks in
+      // memory
+      return std::string();
+    }
+    if (m_dir.empty())
+      return std::string();
+  }
+
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%016llx.luac",
+                (unsigned long long)fnv1a(filename));
+  return base::join_path(m_dir, buf);
+}
+
+} // namespace script
+} // namespace app
@@ -0,0 +1,56 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_SCRIPT_CHUNK_CACHE_H_INCLUDED
+#define APP_SCRIPT_CHUNK_CACHE_H_INCLUDED
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+struct lua_State;
+
+namespace app {
+namespace script {
+
+  // Cache of precompiled Lua chunks (bytecode) of script files. The
+  // chunks are kept in memory (for the same process) and in the
+  // "cache/scripts" folder of the user config dir (for the next
+  // runs). Each chunk is identified by the script filename, and
+  // validated with the hash of the script source.
+  class ChunkCache {
+  public:
+    // Loads the given script file source as a Lua function in the
+    // stack of L (like luaL_loadbuffer() does), using the cached
+    // bytecode if it's possible.
+    int load(lua_State* L,
+             const std::string& filename,
+             const std::string& source);
+
+  private:
+    struct Entry {
+      uint64_t sourceHash;
+      std::string bytecode;
+    };
+
+    bool get(const std::string& filename,
+             const uint64_t sourceHash,
+             std::string& bytecode);
+    void put(const std::string& filename,
+             const uint64_t sourceHash,
+             const std::string& bytecode);
+    void remove(const std::string& filename);
+    std::string cacheFilename(const std::string& filename);
+
+    std::map<std::string, Entry> m_entries;
+    std::string m_dir;
+  };
+
+} // namespace script
+} // namespace app
+
+#endif
@@ -16,8 +16,11 @@
 #include "app/doc_exporter.h"
 #include "app/doc_range.h"
 #include "app/pref/preferences.h"
+#include "app/script/chunk_cache.h"
 #include "app/script/luacpp.h"
+#include "app/script/profiler.h"
 #include "app/script/security.h"
+#include "app/sprite_sheet_packing.h"
 #include "app/sprite_sheet_type.h"
 #include "app/tools/ink_type.h"
 #include "base/chrono.h"
@@ -49,6 +52,34 @@ std::stack<std::string> current_script_dirs;
 // Just one debugger delegate is possible.
 DebuggerDelegate* g_debuggerDelegate = nullptr;
 
+// Precompiled chunks of the script files (used by Engine::evalFile()
+// and dofile())
+ChunkCache g_chunkCache;
+
+// Loads the given file like luaL_loadfile() but using the cache of
+// precompiled chunks
+int load_script_file(lua_State* L, const std::string& filename)
+{
+  std::stringstream buf;
+  {
+    std::ifstream s(FSTREAM_PATH(filename), std::ifstream::binary);
+    if (!s) {
+      lua_pushfstring(L, "cannot open %s", filename.c_str());
+      return LUA_ERRFILE;
+    }
+    buf << s.rdbuf();
+  }
+
+  // Skip the first line if it's a comment (e.g. #!/usr/bin/lua) like
+  // luaL_loadfile() does (we keep the new line to keep the line
+  // numbers)
+  std::string source = buf.str();
+  if (!source.empty() && source[0] == '#')
+    source.erase(0, source.find('\n'));
+
+  return g_chunkCache.load(L, filename, source);
+}
+
 class AddScriptFilename {
 public:
   AddScriptFilename(const std::string& fn) {
@@ -113,7 +144,7 @@ int dofile(lua_State *L)
   }
 
   lua_settop(L, 1);
-  if (luaL_loadfile(L, fname.c_str()) != LUA_OK)
+  if (load_script_file(L, fname) != LUA_OK)
     return lua_error(L);
   {
     AddScriptFilename add(fname);
@@ -147,6 +178,8 @@ int unsupported(lua_State* L)
 void register_app_object(lua_State* L);
 void register_app_pixel_color_object(lua_State* L);
 void register_app_fs_object(lua_State* L);
+void register_app_parallel_function(lua_State* L);
+void register_app_select_by_color_function(lua_State* L);
 void register_app_command_object(lua_State* L);
 void register_app_preferences_object(lua_State* L);
 
@@ -163,6 +196,7 @@ void register_frame_class(lua_State* L);
 void register_frames_class(lua_State* L);
 void register_image_class(lua_State* L);
 void register_image_iterator_class(lua_State* L);
+void register_image_pixels_class(lua_State* L);
 void register_image_spec_class(lua_State* L);
 void register_images_class(lua_State* L);
 void register_layer_class(lua_State* L);
@@ -250,6 +284,8 @@ Engine::Engine()
   register_app_object(L);
   register_app_pixel_color_object(L);
   register_app_fs_object(L);
+  register_app_parallel_function(L);
+  register_app_select_by_color_function(L);
   register_app_command_object(L);
   register_app_preferences_object(L);
 
@@ -312,6 +348,17 @@ Engine::Engine()
   setfield_integer(L, "ROWS", SpriteSheetType::Rows);
   setfield_integer(L, "COLUMNS", SpriteSheetType::Columns);
   setfield_integer(L, "PACKED", SpriteSheetType::Packed);
+  setfield_integer(L, "MAXRECTS", SpriteSheetType::MaxRects);
+  lua_pop(L, 1);
+
+  lua_newtable(L);
+  lua_pushvalue(L, -1);
+  lua_setglobal(L, "SpriteSheetPacking");
+  setfield_integer(L, "SKYLINE", SpriteSheetPacking::Skyline);
+  setfield_integer(L, "BEST_SHORT_SIDE_FIT", SpriteSheetPacking::BestShortSideFit);
+  setfield_integer(L, "BEST_LONG_SIDE_FIT", SpriteSheetPacking::BestLongSideFit);
+  setfield_integer(L, "BEST_AREA_FIT", SpriteSheetPacking::BestAreaFit);
+  setfield_integer(L, "BOTTOM_LEFT", SpriteSheetPacking::BottomLeft);
   lua_pop(L, 1);
 
   lua_newtable(L);
@@ -319,6 +366,7 @@ Engine::Engine()
   lua_setglobal(L, "SpriteSheetDataFormat");
   setfield_integer(L, "JSON_HASH", SpriteSheetDataFormat::JsonHash);
   setfield_integer(L, "JSON_ARRAY", SpriteSheetDataFormat::JsonArray);
+  setfield_integer(L, "MSGPACK", SpriteSheetDataFormat::MsgPack);
   lua_pop(L, 1);
 
   lua_newtable(L);
@@ -396,6 +444,7 @@ Engine::Engine()
   register_frames_class(L);
   register_image_class(L);
   register_image_iterator_class(L);
+  register_image_pixels_class(L);
   register_image_spec_class(L);
   register_images_class(L);
   register_layer_class(L);
@@ -435,8 +484,10 @@ void Engine::destroy()
 #ifdef ENABLE_UI
   close_all_dialogs();
 #endif
+  m_profiler.reset();
   lua_close(L);
   L = nullptr;
+  destroy_sprite_snapshots();
 }
 
 void Engine::printLastResult()
@@ -446,10 +497,18 @@ void Engine::printLastResult()
 
 bool Engine::evalCode(const std::string& code,
                       const std::string& filename)
+{
+  return evalChunk(
+    [this, &code, &filename]{
+      return luaL_loadbuffer(L, code.c_str(), code.size(), filename.c_str());
+    });
+}
+
+bool Engine::evalChunk(const std::function<int()>& loadChunk)
 {
   bool ok = true;
   try {
-    if (luaL_loadbuffer(L, code.c_str(), code.size(), filename.c_str()) ||
+    if (loadChunk() ||
         lua_pcall(L, 0, 1, 0)) {
       const char* s = lua_tostring(L, -1);
       if (s)
@@ -498,14 +557,18 @@ bool Engine::evalFile(const std::string& filename,
     buf << s.rdbuf();
   }
   std::string absFilename = base::get_absolute_path(filename);
+  const std::string code = buf.str();
 
   AddScriptFilename add(absFilename);
   set_app_params(L, params);
 
   if (g_debuggerDelegate)
-    g_debuggerDelegate->startFile(absFilename, buf.str());
+    g_debuggerDelegate->startFile(absFilename, code);
 
-  bool result = evalCode(buf.str(), "@" + absFilename);
+  bool result = evalChunk(
+    [this, &absFilename, &code]{
+      return g_chunkCache.load(L, absFilename, code);
+    });
 
   if (g_debuggerDelegate)
     g_debuggerDelegate->endFile(absFilename);
@@ -515,6 +578,9 @@ bool Engine::evalFile(const std::string& filename,
 
 void Engine::startDebugger(DebuggerDelegate* debuggerDelegate)
 {
+  // The debugger replaces the Lua hook of the profiler
+  m_profiler.reset();
+
   g_debuggerDelegate = debuggerDelegate;
 
   lua_Hook hook = [](lua_State* L, lua_Debug* ar) {
@@ -533,6 +599,25 @@ void Engine::stopDebugger()
   lua_sethook(L, nullptr, 0, 0);
 }
 
+bool Engine::startProfiler()
+{
+  if (g_debuggerDelegate || m_profiler)
+    return false;
+
+  m_profiler = std::make_unique<Profiler>(L);
+  return true;
+}
+
+std::string Engine::stopProfiler()
+{
+  std::string report;
+  if (m_profiler) {
+    report = m_profiler->report();
+    m_profiler.reset();
+  }
+  return report;
+}
+
 void Engine::onConsoleError(const char* text)
 {
   if (text && m_delegate)
@@ -25,6 +25,7 @@
 #include <cstdio>
 #include <functional>
 #include <map>
+#include <memory>
 #include <string>
 
 struct lua_State;
@@ -60,6 +61,8 @@ namespace app {
 
   namespace script {
 
+  class Profiler;
+
   class EngineDelegate {
   public:
     virtual ~EngineDelegate() { }
@@ -107,7 +110,15 @@ namespace app {
     void startDebugger(DebuggerDelegate* debuggerDelegate);
     void stopDebugger();
 
+    // The profiler cannot be started when the debugger is running
+    // (both use the Lua hook). stopProfiler() returns the report.
+    bool startProfiler();
+    std::string stopProfiler();
+    Profiler* profiler() { return m_profiler.get(); }
+
   private:
+    // Calls the function that loadChunk() leaves in the Lua stack
+    bool evalChunk(const std::function<int()>& loadChunk);
     void onConsoleError(const char* text);
     void onConsolePrint(const char* text);
 
@@ -115,6 +126,7 @@ namespace app {
     EngineDelegate* m_delegate;
     bool m_printLastResult;
     int m_returnCode;
+    std::unique_ptr<Profiler> m_profiler;
   };
 
   class ScopedEngineDelegate {
@@ -133,7 +145,10 @@ namespace app {
   };
 
   void push_app_events(lua_State* L);
-  int push_image_iterator_function(lua_State* L, const doc::Image* image, int extraArgIndex);
+  int push_image_iterator_function(lua_State* L, doc::Image* image, int extraArgIndex,
+                                   const bool readOnly);
+  int push_image_rows_function(lua_State* L, int imageIndex, const doc::Image* image, int extraArgIndex);
+  void push_image_pixels(lua_State* L, doc::Image* image, const gfx::Rect& bounds, const int transactionId);
   void push_brush(lua_State* L, const doc::BrushRef& brush);
   void push_cel_image(lua_State* L, doc::Cel* cel);
   void push_cel_images(lua_State* L, const doc::ObjectIds& cels);
@@ -155,6 +170,7 @@ namespace app {
   void push_sprite_layers(lua_State* L, doc::Sprite* sprite);
   void push_sprite_palette(lua_State* L, doc::Sprite* sprite, doc::Palette* palette);
   void push_sprite_palettes(lua_State* L, doc::Sprite* sprite);
+  void push_selection(lua_State* L, doc::Mask* mask); // Takes ownership of the mask
   void push_sprite_selection(lua_State* L, doc::Sprite* sprite);
   void push_sprite_slices(lua_State* L, doc::Sprite* sprite);
   void push_sprite_tags(lua_State* L, doc::Sprite* sprite);
@@ -185,6 +201,19 @@ namespace app {
   int load_sprite_from_file(lua_State* L, const char* filename,
                             const LoadSpriteFromFileParam param);
 
+  // Identifier of the innermost app.transaction() that is being
+  // executed (0 if there is no transaction), and if the given one is
+  // still running.
+  int current_transaction_id();
+  bool is_transaction_running(const int transactionId);
+
+  // True if the sprite is a read-only copy created with
+  // Sprite:snapshot()
+  bool is_snapshot_sprite(const doc::Sprite* sprite);
+
+  // Destroys the sprite copies created with Sprite:snapshot()
+  void destroy_sprite_snapshots();
+
 #ifdef ENABLE_UI
   // close all opened Dialogs before closing the UI
   void close_all_dialogs();
@@ -18,13 +18,20 @@
 #include "app/script/docobj.h"
 #include "app/script/engine.h"
 #include "app/script/luacpp.h"
+#include "base/time.h"
 #include "doc/document.h"
 #include "doc/sprite.h"
 #include "ui/app_state.h"
 
+#ifdef ENABLE_UI
+#include "ui/timer.h"
+#endif
+
 #include <cstring>
 #include <map>
 #include <memory>
+#include <utility>
+#include <vector>
 
 namespace app {
 namespace script {
@@ -35,6 +42,9 @@ namespace {
 
 using EventListener = int;
 
+// Interval to check if the debounced events must be delivered
+const int kDebounceTimerInterval = 20;
+
 class AppEvents;
 class SpriteEvents;
 static std::unique_ptr<AppEvents> g_appEvents;
@@ -61,10 +71,21 @@ public:
     return false;
   }
 
-  void add(EventType eventType, EventListener callbackRef) {
+  // If "debounceMsecs" is greater than zero, the events are
+  // coalesced and the listener is called once (with a { count=int }
+  // argument) when no new event is received in that period of time.
+  void add(EventType eventType, EventListener callbackRef,
+           const int debounceMsecs = 0) {
     if (eventType >= m_listeners.size())
       m_listeners.resize(eventType+1);
 
+#ifdef ENABLE_UI
+    // Without UI there is no loop to process the timer, and the
+    // script commands are executed in the same call anyway
+    if (debounceMsecs > 0 && App::instance()->isGui())
+      m_debounces[callbackRef].msecs = debounceMsecs;
+#endif
+
     auto& listeners = m_listeners[eventType];
     listeners.push_back(callbackRef);
     if (listeners.size() == 1)
@@ -72,6 +93,8 @@ public:
   }
 
   void remove(EventListener callbackRef) {
+    m_debounces.erase(callbackRef);
+
     for (int i=0; i<int(m_listeners.size()); ++i) {
       EventListeners& listeners = m_listeners[i];
       auto it = listeners.begin();
@@ -96,16 +119,40 @@ protected:
     if (eventType >= m_listeners.size())
       return;
 
+    for (EventListener callbackRef : m_listeners[eventType]) {
+      auto it = m_debounces.find(callbackRef);
+      if (it != m_debounces.end()) {
+        ++it->second.count;
+        it->second.lastEvent = base::current_tick();
+        startDebounceTimer();
+      }
+      else
+        callListener(callbackRef, 0);
+    }
+  }
+
+private:
+  virtual void onAddFirstListener(EventType eventType) = 0;
+  virtual void onRemoveLastListener(EventType eventType) = 0;
+
+  // Calls the listener, the debounced listeners receive the number
+  // of coalesced events.
+  void callListener(EventListener callbackRef, const int count) {
     script::Engine* engine = App::instance()->scriptEngine();
     lua_State* L = engine->luaState();
 
     try {
-      for (EventListener callbackRef : m_listeners[eventType]) {
-        lua_rawgeti(L, LUA_REGISTRYINDEX, callbackRef);
-        if (lua_pcall(L, 0, 0, 0)) {
-          if (const char* s = lua_tostring(L, -1))
-            engine->consolePrint(s);
-        }
+      lua_rawgeti(L, LUA_REGISTRYINDEX, callbackRef);
+      int nargs = 0;
+      if (count > 0) {
+        lua_createtable(L, 0, 1);
+        lua_pushinteger(L, count);
+        lua_setfield(L, -2, "count");
+        nargs = 1;
+      }
+      if (lua_pcall(L, nargs, 0, 0)) {
+        if (const char* s = lua_tostring(L, -1))
+          engine->consolePrint(s);
       }
     }
     catch (const std::exception& ex) {
@@ -113,12 +160,57 @@ protected:
     }
   }
 
-private:
-  virtual void onAddFirstListener(EventType eventType) = 0;
-  virtual void onRemoveLastListener(EventType eventType) = 0;
+  void startDebounceTimer() {
+#ifdef ENABLE_UI
+    if (!m_debounceTimer) {
+      m_debounceTimer = std::make_unique<ui::Timer>(kDebounceTimerInterval);
+      m_debounceTimer->Tick.connect([this]{ onDebounceTick(); });
+    }
+    if (!m_debounceTimer->isRunning())
+      m_debounceTimer->start();
+#endif
+  }
+
+  void onDebounceTick() {
+    const base::tick_t now = base::current_tick();
+    std::vector<std::pair<EventListener, int>> ready;
+    bool pending = false;
+    for (auto& kv : m_debounces) {
+      Debounce& d = kv.second;
+      if (d.count == 0)
+        continue;
+      if (now - d.lastEvent >= base::tick_t(d.msecs)) {
+        ready.push_back(std::make_pair(kv.first, d.count));
+        d.count = 0;
+      }
+      else
+        pending = true;
+    }
+
+#ifdef ENABLE_UI
+    if (!pending)
+      m_debounceTimer->stop();
+#endif
+
+    for (const auto& r : ready) {
+      // A previous listener could remove this one
+      if (m_debounces.find(r.first) != m_debounces.end())
+        callListener(r.first, r.second);
+    }
+  }
+
+  struct Debounce {
+    int msecs = 0;
+    int count = 0;              // Number of coalesced events
+    base::tick_t lastEvent = 0;
+  };
 
   using EventListeners = std::vector<EventListener>;
   std::vector<EventListeners> m_listeners;
+  std::map<EventListener, Debounce> m_debounces;
+#ifdef ENABLE_UI
+  std::unique_ptr<ui::Timer> m_debounceTimer;
+#endif
 };
 
 class AppEvents : public Events
@@ -288,10 +380,18 @@ int Events_on(lua_State* L)
   if (!lua_isfunction(L, 3))
     return luaL_error(L, "second argument must be a function");
 
+  // Events:on(eventName, function, { debounce=milliseconds })
+  int debounceMsecs = 0;
+  if (lua_istable(L, 4)) {
+    if (lua_getfield(L, 4, "debounce") != LUA_TNIL)
+      debounceMsecs = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+
   // Copy the callback function to add it to the global registry
   lua_pushvalue(L, 3);
   int callbackRef = luaL_ref(L, LUA_REGISTRYINDEX);
-  evs->add(type, callbackRef);
+  evs->add(type, callbackRef, debounceMsecs);
 
   // Return the callback ref (this is an EventListener easier to use
   // in Events_off())
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2015-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -15,6 +15,7 @@
 #include "app/context.h"
 #include "app/doc.h"
 #include "app/file/file.h"
+#include "app/modules/palettes.h"
 #include "app/script/docobj.h"
 #include "app/script/engine.h"
 #include "app/script/luacpp.h"
@@ -24,17 +25,24 @@
 #include "app/util/autocrop.h"
 #include "app/util/resize_image.h"
 #include "base/fs.h"
+#include "doc/algorithm/floodfill.h"
 #include "doc/algorithm/shrink_bounds.h"
 #include "doc/cel.h"
 #include "doc/image.h"
+#include "doc/image_impl.h"
 #include "doc/image_ref.h"
 #include "doc/primitives.h"
+#include "doc/remap.h"
 #include "doc/sprite.h"
 #include "render/render.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace app {
 namespace script {
@@ -74,6 +82,17 @@ struct ImageObj {
     else
       return nullptr;
   }
+  // Images of sprite snapshots cannot be modified
+  bool isReadOnly(lua_State* L) {
+    doc::Cel* cel = this->cel(L);
+    return (cel && is_snapshot_sprite(cel->sprite()));
+  }
+
+  doc::Image* writableImage(lua_State* L) {
+    if (isReadOnly(L))
+      luaL_error(L, "the image of a sprite snapshot cannot be modified");
+    return image(L);
+  }
 };
 
 void render_sprite(Image* dst,
@@ -91,6 +110,107 @@ void render_sprite(Image* dst,
               sprite->height()));
 }
 
+// Modifies the "bounds" area of the image calling func(image,
+// origin), where "origin" is the position of the given image in the
+// original one. Cel images are modified in a copy of the area which
+// is then copied to the cel with undo information.
+template<typename Func>
+void modify_image_area(lua_State* L, ImageObj* obj,
+                       const gfx::Rect& bounds,
+                       Func&& func)
+{
+  Image* img = obj->writableImage(L);
+  if (bounds.isEmpty())
+    return;
+
+  if (obj->cel(L) == nullptr) {
+    func(img, gfx::Point(0, 0));
+    img->incrementVersion();
+  }
+  else {
+    ImageRef tmp(crop_image(img, bounds, img->maskColor()));
+    func(tmp.get(), bounds.origin());
+
+    Tx tx;
+    tx(new cmd::CopyRect(
+         img, tmp.get(),
+         gfx::Clip(bounds.x, bounds.y, 0, 0, bounds.w, bounds.h)));
+    tx.commit();
+  }
+}
+
+// Calls func(y1, y2) for bands of rows of the given height from
+// several threads.
+template<typename Func>
+void for_each_rows_band(const int h, Func&& func)
+{
+  const int kBandHeight = 64;
+  const int nbands = (h + kBandHeight - 1) / kBandHeight;
+  const int nthreads =
+    std::min<int>(nbands, std::max<int>(1, std::thread::hardware_concurrency()));
+
+  std::atomic<int> nextBand(0);
+  auto processBands = [&]{
+    for (int i=nextBand++; i<nbands; i=nextBand++) {
+      const int y = i*kBandHeight;
+      func(y, std::min(y+kBandHeight, h));
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i=1; i<nthreads; ++i)
+    threads.emplace_back(processBands);
+  processBands();         // Use this thread too
+  for (auto& thread : threads)
+    thread.join();
+}
+
+template<typename ImageTraits>
+void remap_pixels(Image* img, const std::unordered_map<doc::color_t, doc::color_t>& map)
+{
+  using pixel_t = typename ImageTraits::pixel_t;
+  const int w = img->width();
+
+  for_each_rows_band(
+    img->height(),
+    [img, w, &map](const int y1, const int y2) {
+      // Consecutive pixels tend to be of the same color, so we avoid
+      // the lookup in that case
+      pixel_t lastFrom = 0, lastTo = 0;
+      bool hasLast = false;
+      for (int y=y1; y<y2; ++y) {
+        auto p = (pixel_t*)img->getPixelAddress(0, y);
+        for (int x=0; x<w; ++x, ++p) {
+          if (!hasLast || *p != lastFrom) {
+            lastFrom = *p;
+            auto it = map.find(lastFrom);
+            lastTo = (it != map.end() ? pixel_t(it->second): lastFrom);
+            hasLast = true;
+          }
+          *p = lastTo;
+        }
+      }
+    });
+}
+
+// Returns the color specified in the given argument (a pixel value
+// or a Color) for the given image.
+doc::color_t get_pixel_color_arg(lua_State* L, int index, const doc::Image* img)
+{
+  if (lua_isinteger(L, index))
+    return lua_tointeger(L, index);
+  else
+    return convert_args_into_pixel_color(L, index, img->pixelFormat());
+}
+
+const doc::Palette* get_image_palette(lua_State* L, ImageObj* obj)
+{
+  if (Cel* cel = obj->cel(L))
+    return cel->sprite()->palette(cel->frame());
+  else
+    return get_current_palette();
+}
+
 int Image_clone(lua_State* L);
 
 int Image_new(lua_State* L)
@@ -189,7 +309,7 @@ int Image_eq(lua_State* L)
 int Image_clear(lua_State* L)
 {
   auto obj = get_obj<ImageObj>(L, 1);
-  auto img = obj->image(L);
+  auto img = obj->writableImage(L);
   doc::color_t color;
   if (lua_isnone(L, 2))
     color = img->maskColor();
@@ -198,13 +318,14 @@ int Image_clear(lua_State* L)
   else
     color = convert_args_into_pixel_color(L, 2, img->pixelFormat());
   doc::clear_image(img, color);
+  img->incrementVersion();
   return 0;
 }
 
 int Image_drawPixel(lua_State* L)
 {
   auto obj = get_obj<ImageObj>(L, 1);
-  auto img = obj->image(L);
+  auto img = obj->writableImage(L);
   const int x = lua_tointeger(L, 2);
   const int y = lua_tointeger(L, 3);
   doc::color_t color;
@@ -213,6 +334,7 @@ int Image_drawPixel(lua_State* L)
   else
     color = convert_args_into_pixel_color(L, 4, img->pixelFormat());
   doc::put_pixel(img, x, y, color);
+  img->incrementVersion();
   return 0;
 }
 
@@ -221,13 +343,37 @@ int Image_drawImage(lua_State* L)
   auto obj = get_obj<ImageObj>(L, 1);
   auto sprite = get_obj<ImageObj>(L, 2);
   gfx::Point pos = convert_args_into_point(L, 3);
-  Image* dst = obj->image(L);
+  Image* dst = obj->writableImage(L);
   const Image* src = sprite->image(L);
 
+  // Image:drawImage(image, position [, opacity [, blendMode]])
+  // composites the image instead of copying it
+  const int i = (lua_isnumber(L, 3) ? 5: 4);
+  if (!lua_isnoneornil(L, i) || !lua_isnoneornil(L, i+1)) {
+    const int opacity = (lua_isnoneornil(L, i) ? 255:
+                         std::clamp<int>(lua_tointeger(L, i), 0, 255));
+    const auto blendMode = (lua_isnoneornil(L, i+1) ? doc::BlendMode::NORMAL:
+                            (doc::BlendMode)lua_tointeger(L, i+1));
+    const doc::Palette* pal = get_image_palette(L, obj);
+    const gfx::Rect bounds =
+      dst->bounds() & gfx::Rect(pos, src->size());
+
+    modify_image_area(
+      L, obj, bounds,
+      [src, pal, pos, opacity, blendMode](Image* img, const gfx::Point& origin){
+        render::composite_image(
+          img, src, pal,
+          pos.x - origin.x, pos.y - origin.y,
+          opacity, blendMode, 0);
+      });
+    return 0;
+  }
+
   // If the destination image is not related to a sprite, we just draw
   // the source image without undo information.
   if (obj->cel(L) == nullptr) {
     doc::copy_image(dst, src, pos.x, pos.y);
+    dst->incrementVersion();
   }
   else {
     gfx::Rect bounds(0, 0, src->size().w, src->size().h);
@@ -244,13 +390,139 @@ int Image_drawImage(lua_State* L)
   return 0;
 }
 
+int Image_fillRect(lua_State* L)
+{
+  auto obj = get_obj<ImageObj>(L, 1);
+  const Image* img = obj->image(L);
+  const gfx::Rect bounds = img->bounds() & convert_args_into_rect(L, 2);
+  const int i = (lua_isnumber(L, 2) ? 6: 3);
+  const doc::color_t color = get_pixel_color_arg(L, i, img);
+  const int opacity = (lua_isnoneornil(L, i+1) ? 255:
+                       std::clamp<int>(lua_tointeger(L, i+1), 0, 255));
+
+  modify_image_area(
+    L, obj, bounds,
+    [&bounds, color, opacity](Image* img, const gfx::Point& origin){
+      const gfx::Rect rc =
+        gfx::Rect(bounds).offset(-origin.x, -origin.y);
+      if (opacity == 255)
+        doc::fill_rect(img, rc, color);
+      else
+        doc::blend_rect(img, rc.x, rc.y, rc.x2()-1, rc.y2()-1, color, opacity);
+    });
+  return 0;
+}
+
+int Image_floodFill(lua_State* L)
+{
+  auto obj = get_obj<ImageObj>(L, 1);
+  const Image* img = obj->image(L);
+  const gfx::Point pt = convert_args_into_point(L, 2);
+  const int i = (lua_isnumber(L, 2) ? 4: 3);
+  const doc::color_t color = get_pixel_color_arg(L, i, img);
+  int tolerance = 0;
+  bool contiguous = true;
+  bool eightConnected = false;
+
+  if (!img->bounds().contains(pt))
+    return 0;
+
+  // Image:floodFill(point, color [, { tolerance, contiguous, eightConnected }])
+  if (lua_istable(L, i+1)) {
+    int type = lua_getfield(L, i+1, "tolerance");
+    if (VALID_LUATYPE(type))
+      tolerance = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    type = lua_getfield(L, i+1, "contiguous");
+    if (VALID_LUATYPE(type))
+      contiguous = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
+    type = lua_getfield(L, i+1, "eightConnected");
+    if (VALID_LUATYPE(type))
+      eightConnected = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+  }
+
+  // The image is read by floodfill() while it generates the lines, so
+  // they are painted after that.
+  struct Lines {
+    std::vector<gfx::Rect> rows;
+    gfx::Rect bounds;
+  } lines;
+
+  doc::algorithm::floodfill(
+    img, nullptr, pt.x, pt.y, img->bounds(),
+    doc::get_pixel(img, pt.x, pt.y),
+    tolerance, contiguous, eightConnected, &lines,
+    [](int x1, int y, int x2, void* data) {
+      auto lines = (Lines*)data;
+      const gfx::Rect rc(x1, y, x2-x1+1, 1);
+      lines->rows.push_back(rc);
+      lines->bounds |= rc;
+    });
+
+  modify_image_area(
+    L, obj, lines.bounds,
+    [&lines, color](Image* img, const gfx::Point& origin){
+      for (const gfx::Rect& rc : lines.rows)
+        doc::fill_rect(img, gfx::Rect(rc).offset(-origin.x, -origin.y), color);
+    });
+  return 0;
+}
+
+// Image:remap({ [fromPixel]=toPixel, ... })
+int Image_remap(lua_State* L)
+{
+  auto obj = get_obj<ImageObj>(L, 1);
+  const Image* img = obj->image(L);
+  luaL_checktype(L, 2, LUA_TTABLE);
+
+  std::unordered_map<doc::color_t, doc::color_t> map;
+  lua_pushnil(L);
+  while (lua_next(L, 2) != 0) {
+    if (lua_isinteger(L, -2))
+      map[doc::color_t(lua_tointeger(L, -2))] = get_pixel_color_arg(L, -1, img);
+    lua_pop(L, 1);
+  }
+  if (map.empty())
+    return 0;
+
+  modify_image_area(
+    L, obj, img->bounds(),
+    [&map](Image* img, const gfx::Point&){
+      switch (img->pixelFormat()) {
+        case doc::IMAGE_RGB:
+          remap_pixels<doc::RgbTraits>(img, map);
+          break;
+        case doc::IMAGE_GRAYSCALE:
+          remap_pixels<doc::GrayscaleTraits>(img, map);
+          break;
+        case doc::IMAGE_INDEXED: {
+          doc::Remap remap(256);
+          for (int i=0; i<256; ++i)
+            remap.map(i, i);
+          for (const auto& kv : map)
+            if (kv.first < 256 && kv.second < 256)
+              remap.map(kv.first, kv.second);
+          doc::remap_image(img, remap);
+          break;
+        }
+        default:
+          break;
+      }
+    });
+  return 0;
+}
+
 int Image_drawSprite(lua_State* L)
 {
   auto obj = get_obj<ImageObj>(L, 1);
   const auto sprite = get_docobj<Sprite>(L, 2);
   doc::frame_t frame = get_frame_number_from_arg(L, 3);
   gfx::Point pos = convert_args_into_point(L, 4);
-  doc::Image* dst = obj->image(L);
+  doc::Image* dst = obj->writableImage(L);
 
   ASSERT(dst);
   ASSERT(sprite);
@@ -259,6 +531,7 @@ int Image_drawSprite(lua_State* L)
   // the source image without undo information.
   if (obj->cel(L) == nullptr) {
     render_sprite(dst, sprite, frame, pos.x, pos.y);
+    dst->incrementVersion();
   }
   else {
     Tx tx;
@@ -281,7 +554,15 @@ int Image_drawSprite(lua_State* L)
 int Image_pixels(lua_State* L)
 {
   auto obj = get_obj<ImageObj>(L, 1);
-  push_image_iterator_function(L, obj->image(L), 2);
+  push_image_iterator_function(L, obj->image(L), 2, obj->isReadOnly(L));
+  return 1;
+}
+
+// for y, row in image:rows([rect]) do ... row[1] ... row[rect.width] end
+int Image_rows(lua_State* L)
+{
+  auto obj = get_obj<ImageObj>(L, 1);
+  push_image_rows_function(L, 1, obj->image(L), 2);
   return 1;
 }
 
@@ -295,6 +576,124 @@ int Image_getPixel(lua_State* L)
   return 1;
 }
 
+// Returns the given rectangle argument (or the whole image if it's
+// not specified) clipped to the image bounds.
+gfx::Rect get_pixels_bounds(lua_State* L, int index, const doc::Image* img)
+{
+  gfx::Rect bounds = img->bounds();
+  if (!lua_isnone(L, index))
+    bounds &= convert_args_into_rect(L, index);
+  return bounds;
+}
+
+template<typename ImageTraits>
+void push_pixels_table(lua_State* L, const doc::Image* img, const gfx::Rect& bounds)
+{
+  lua_createtable(L, bounds.w*bounds.h, 0);
+  int i = 0;
+  for (int y=bounds.y; y<bounds.y2(); ++y) {
+    auto p = (const typename ImageTraits::pixel_t*)img->getPixelAddress(bounds.x, y);
+    for (int x=0; x<bounds.w; ++x, ++p) {
+      lua_pushinteger(L, *p);
+      lua_rawseti(L, -2, ++i);
+    }
+  }
+}
+
+template<typename ImageTraits>
+void put_pixels_table(lua_State* L, int index, doc::Image* img, const gfx::Rect& bounds)
+{
+  int i = 0;
+  for (int y=bounds.y; y<bounds.y2(); ++y) {
+    auto p = (typename ImageTraits::pixel_t*)img->getPixelAddress(bounds.x, y);
+    for (int x=0; x<bounds.w; ++x, ++p) {
+      lua_rawgeti(L, index, ++i);
+      *p = lua_tointeger(L, -1);
+      lua_pop(L, 1);
+    }
+  }
+}
+
+// Returns a table with the pixels of the given rectangle (row by row)
+// and the rectangle (clipped to the image bounds)
+int Image_getPixels(lua_State* L)
+{
+  const auto img = get_obj<ImageObj>(L, 1)->image(L);
+  const gfx::Rect bounds = get_pixels_bounds(L, 2, img);
+  switch (img->pixelFormat()) {
+    case IMAGE_RGB: push_pixels_table<RgbTraits>(L, img, bounds); break;
+    case IMAGE_GRAYSCALE: push_pixels_table<GrayscaleTraits>(L, img, bounds); break;
+    case IMAGE_INDEXED: push_pixels_table<IndexedTraits>(L, img, bounds); break;
+    default:
+      return luaL_error(L, "unsupported image color mode");
+  }
+  push_new<gfx::Rect>(L, bounds);
+  return 2;
+}
+
+// Puts a table of pixels (or a string with the bytes of the pixels
+// in the same format of Image.bytes) in the given rectangle. As
+// Image:drawPixel() it doesn't generate undo information, but the
+// image version is incremented (so the caches of rendered
+// frames/thumbnails are invalidated).
+int Image_putPixels(lua_State* L)
+{
+  const auto img = get_obj<ImageObj>(L, 1)->writableImage(L);
+  const gfx::Rect bounds = get_pixels_bounds(L, 3, img);
+  const int npixels = bounds.w*bounds.h;
+
+  if (lua_type(L, 2) == LUA_TSTRING) {
+    size_t bytesSize;
+    const char* bytes = lua_tolstring(L, 2, &bytesSize);
+    const int rowBytes = img->getRowStrideSize(bounds.w);
+    if (bytesSize != size_t(rowBytes) * bounds.h)
+      return luaL_error(L, "data size does not match: given %d, needed %d",
+                        int(bytesSize), rowBytes * bounds.h);
+
+    for (int y=0; y<bounds.h; ++y, bytes+=rowBytes)
+      std::memcpy(img->getPixelAddress(bounds.x, bounds.y+y), bytes, rowBytes);
+    img->incrementVersion();
+    return 0;
+  }
+
+  luaL_checktype(L, 2, LUA_TTABLE);
+  if (lua_rawlen(L, 2) != size_t(npixels))
+    return luaL_error(L, "the number of pixels does not match: given %d, needed %d",
+                      int(lua_rawlen(L, 2)), npixels);
+
+  switch (img->pixelFormat()) {
+    case IMAGE_RGB: put_pixels_table<RgbTraits>(L, 2, img, bounds); break;
+    case IMAGE_GRAYSCALE: put_pixels_table<GrayscaleTraits>(L, 2, img, bounds); break;
+    case IMAGE_INDEXED: put_pixels_table<IndexedTraits>(L, 2, img, bounds); break;
+    default:
+      return luaL_error(L, "unsupported image color mode");
+  }
+  img->incrementVersion();
+  return 0;
+}
+
+// Returns a view to read/write the pixels of the given rectangle
+// directly (see ImagePixelsObj)
+int Image_mapPixels(lua_State* L)
+{
+  auto img = get_obj<ImageObj>(L, 1)->writableImage(L);
+  const int transactionId = current_transaction_id();
+  if (!transactionId)
+    return luaL_error(L, "Image:mapPixels() must be called inside app.transaction()");
+
+  switch (img->pixelFormat()) {
+    case IMAGE_RGB:
+    case IMAGE_GRAYSCALE:
+    case IMAGE_INDEXED:
+      break;
+    default:
+      return luaL_error(L, "unsupported image color mode");
+  }
+
+  push_image_pixels(L, img, get_pixels_bounds(L, 2, img), transactionId);
+  return 1;
+}
+
 int Image_isEqual(lua_State* L)
 {
   auto objA = get_obj<ImageObj>(L, 1);
@@ -397,7 +796,7 @@ int Image_saveAs(lua_State* L)
 int Image_resize(lua_State* L)
 {
   auto obj = get_obj<ImageObj>(L, 1);
-  doc::Image* img = obj->image(L);
+  doc::Image* img = obj->writableImage(L);
   Cel* cel = obj->cel(L);
   ASSERT(img);
   gfx::Size newSize = img->size();
@@ -475,7 +874,9 @@ int Image_resize(lua_State* L)
       resize_image(img, scale, method,
                    pal, rgbmap));
     // Delete old image, and we put the same ID of the old image into
-    // the new image so this userdata references the resized image.
+    // the new image so this userdata references the resized image
+    // (with a new version, as it has other pixels).
+    newImg->setVersion(img->version()+1);
     delete img;
     newImg->setId(obj->imageId);
     // Release the image from the smart pointer because now it's owned
@@ -501,12 +902,13 @@ int Image_get_bytes(lua_State* L)
 
 int Image_set_bytes(lua_State* L)
 {
-  const auto img = get_obj<ImageObj>(L, 1)->image(L);
+  const auto img = get_obj<ImageObj>(L, 1)->writableImage(L);
   size_t bytes_size, bytes_needed = img->getRowStrideSize() * img->height();
   const char* bytes = lua_tolstring(L, 2, &bytes_size);
 
   if (bytes_size == bytes_needed) {
     std::memcpy(img->getPixelAddress(0, 0), bytes, bytes_size);
+    img->incrementVersion();
   }
   else {
     lua_pushfstring(L, "Data size does not match: given %d, needed %d.", bytes_size, bytes_needed);
@@ -558,7 +960,14 @@ const luaL_Reg Image_methods[] = {
   { "drawPixel", Image_drawPixel }, { "putPixel", Image_drawPixel },
   { "drawImage", Image_drawImage }, { "putImage", Image_drawImage }, // TODO putImage is deprecated
   { "drawSprite", Image_drawSprite }, { "putSprite", Image_drawSprite }, // TODO putSprite is deprecated
+  { "fillRect", Image_fillRect },
+  { "floodFill", Image_floodFill },
+  { "remap", Image_remap },
   { "pixels", Image_pixels },
+  { "rows", Image_rows },
+  { "getPixels", Image_getPixels },
+  { "putPixels", Image_putPixels },
+  { "mapPixels", Image_mapPixels },
   { "isEqual", Image_isEqual },
   { "isEmpty", Image_isEmpty },
   { "isPlain", Image_isPlain },
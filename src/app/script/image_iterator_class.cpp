@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2018  David Capello
 //
 // This program is distributed under the terms of
@@ -10,6 +10,7 @@
 #endif
 
 #include "app/cmd/copy_region.h"
+#include "app/script/docobj.h"
 #include "app/script/engine.h"
 #include "app/script/luacpp.h"
 #include "app/tx.h"
@@ -18,6 +19,7 @@
 #include "doc/image.h"
 #include "doc/image_impl.h"
 #include "doc/image_ref.h"
+#include "doc/object.h"
 #include "doc/primitives.h"
 
 namespace app {
@@ -27,10 +29,15 @@ namespace {
 
 template<typename ImageTraits>
 struct ImageIteratorObj {
+  doc::Image* image;
+  bool readOnly;
   typename doc::LockImageBits<ImageTraits> bits;
   typename doc::LockImageBits<ImageTraits>::iterator begin, next, end;
-  ImageIteratorObj(const doc::Image* image, const gfx::Rect& bounds)
-    : bits(image, bounds),
+  ImageIteratorObj(doc::Image* image, const gfx::Rect& bounds,
+                   const bool readOnly)
+    : image(image),
+      readOnly(readOnly),
+      bits(image, bounds),
       begin(bits.begin()),
       next(begin),
       end(bits.end()) {
@@ -61,7 +68,10 @@ int ImageIterator_call(lua_State* L)
   }
   // Set value
   else {
+    if (obj->readOnly)
+      return luaL_error(L, "the image of a sprite snapshot cannot be modified");
     *obj->begin = lua_tointeger(L, 2);
+    obj->image->incrementVersion();
     return 1;
   }
 }
@@ -84,6 +94,35 @@ int ImageIterator_index(lua_State* L)
   return 0;
 }
 
+// State of the Image:rows() iterator. The rows are copied to the
+// same Lua table in each step, so the script can read the pixels of
+// a whole row without calling a C function for each pixel.
+struct ImageRowsObj {
+  doc::ObjectId imageId;
+  gfx::Rect bounds;
+  int y;
+  ImageRowsObj(const doc::Image* image, const gfx::Rect& bounds)
+    : imageId(image->id()),
+      bounds(bounds),
+      y(bounds.y) {
+  }
+  ImageRowsObj(const ImageRowsObj&) = delete;
+  ImageRowsObj& operator=(const ImageRowsObj&) = delete;
+};
+
+using ImageRows = ImageRowsObj;
+
+int ImageRows_gc(lua_State* L)
+{
+  get_obj<ImageRowsObj>(L, 1)->~ImageRowsObj();
+  return 0;
+}
+
+const luaL_Reg ImageRows_methods[] = {
+  { "__gc", ImageRows_gc },
+  { nullptr, nullptr }
+};
+
 #define DEFINE_METHODS(Prefix)                          \
   const luaL_Reg Prefix##ImageIterator_methods[] = {    \
     { "__index", ImageIterator_index<Prefix##Traits> }, \
@@ -101,12 +140,14 @@ DEFINE_METHODS(Indexed);
 DEF_MTNAME(ImageIteratorObj<RgbTraits>);
 DEF_MTNAME(ImageIteratorObj<GrayscaleTraits>);
 DEF_MTNAME(ImageIteratorObj<IndexedTraits>);
+DEF_MTNAME(ImageRowsObj);
 
 void register_image_iterator_class(lua_State* L)
 {
   REG_CLASS(L, RgbImageIterator);
   REG_CLASS(L, GrayscaleImageIterator);
   REG_CLASS(L, IndexedImageIterator);
+  REG_CLASS(L, ImageRows);
 }
 
 template<typename ImageTrais>
@@ -133,7 +174,8 @@ static int image_iterator_do_nothing(lua_State* L)
   return 1;
 }
 
-int push_image_iterator_function(lua_State* L, const doc::Image* image, int extraArgIndex)
+int push_image_iterator_function(lua_State* L, doc::Image* image, int extraArgIndex,
+                                 const bool readOnly)
 {
   gfx::Rect bounds = image->bounds();
 
@@ -150,15 +192,15 @@ int push_image_iterator_function(lua_State* L, const doc::Image* image, int extr
 
   switch (image->pixelFormat()) {
     case IMAGE_RGB:
-      push_new<RgbImageIterator>(L, image, bounds);
+      push_new<RgbImageIterator>(L, image, bounds, readOnly);
       lua_pushcclosure(L, image_iterator_step_closure<doc::RgbTraits>, 1);
       return 1;
     case IMAGE_GRAYSCALE:
-      push_new<GrayscaleImageIterator>(L, image, bounds);
+      push_new<GrayscaleImageIterator>(L, image, bounds, readOnly);
       lua_pushcclosure(L, image_iterator_step_closure<doc::GrayscaleTraits>, 1);
       return 1;
     case IMAGE_INDEXED:
-      push_new<IndexedImageIterator>(L, image, bounds);
+      push_new<IndexedImageIterator>(L, image, bounds, readOnly);
       lua_pushcclosure(L, image_iterator_step_closure<doc::IndexedTraits>, 1);
       return 1;
     default:
@@ -166,5 +208,73 @@ int push_image_iterator_function(lua_State* L, const doc::Image* image, int extr
   }
 }
 
+template<typename ImageTraits>
+static void fill_row_table(lua_State* L, int tableIndex,
+                           const doc::Image* image,
+                           const int x, const int y, const int w)
+{
+  auto p = (const typename ImageTraits::pixel_t*)image->getPixelAddress(x, y);
+  for (int i=1; i<=w; ++i, ++p) {
+    lua_pushinteger(L, *p);
+    lua_rawseti(L, tableIndex, i);
+  }
+}
+
+// Upvalues: 1) ImageRowsObj, 2) row table, 3) the Image userdata
+// (just to keep it alive while we iterate its rows)
+static int image_rows_step_closure(lua_State* L)
+{
+  auto obj = get_obj<ImageRowsObj>(L, lua_upvalueindex(1));
+  if (obj->y >= obj->bounds.y2()) {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  // The image could be deleted/replaced in the loop body
+  // (e.g. Image:resize() on a cel image)
+  const auto image = check_docobj(L, doc::get<doc::Image>(obj->imageId));
+  if (!image->bounds().contains(obj->bounds))
+    return luaL_error(L, "the image was resized while its rows were iterated");
+
+  const int row = lua_upvalueindex(2);
+  const int x = obj->bounds.x;
+  const int w = obj->bounds.w;
+  const int y = obj->y++;
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB: fill_row_table<RgbTraits>(L, row, image, x, y, w); break;
+    case IMAGE_GRAYSCALE: fill_row_table<GrayscaleTraits>(L, row, image, x, y, w); break;
+    case IMAGE_INDEXED: fill_row_table<IndexedTraits>(L, row, image, x, y, w); break;
+    default: break;
+  }
+
+  lua_pushinteger(L, y);
+  lua_pushvalue(L, row);
+  return 2;
+}
+
+int push_image_rows_function(lua_State* L, int imageIndex,
+                             const doc::Image* image, int extraArgIndex)
+{
+  imageIndex = lua_absindex(L, imageIndex);
+
+  gfx::Rect bounds = image->bounds();
+  if (!lua_isnone(L, extraArgIndex)) {
+    auto specificBounds = convert_args_into_rect(L, extraArgIndex);
+    if (!specificBounds.isEmpty())
+      bounds &= specificBounds;
+  }
+
+  if (bounds.isEmpty()) {
+    lua_pushcclosure(L, image_iterator_do_nothing, 0);
+    return 1;
+  }
+
+  push_new<ImageRowsObj>(L, image, bounds);
+  lua_createtable(L, bounds.w, 0);
+  lua_pushvalue(L, imageIndex);
+  lua_pushcclosure(L, image_rows_step_closure, 3);
+  return 1;
+}
+
 } // namespace script
 } // namespace app
@@ -0,0 +1,174 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/script/engine.h"
+#include "app/script/luacpp.h"
+#include "doc/image.h"
+#include "doc/object.h"
+
+#include <cstring>
+
+namespace app {
+namespace script {
+
+namespace {
+
+// View of the pixels of an image region returned by
+// Image:mapPixels(). The pixels are read/written directly from the
+// image memory (without copies), so it can be used only inside the
+// app.transaction() where it was created, and while the image is
+// alive.
+struct ImagePixelsObj {
+  doc::ObjectId imageId;
+  doc::Image* image;
+  doc::PixelFormat pixelFormat;
+  uint8_t* address;             // Address of the first pixel of "bounds"
+  int rowStride;
+  int bytesPerPixel;
+  gfx::Rect bounds;
+  int transactionId;
+
+  ImagePixelsObj(doc::Image* image,
+                 const gfx::Rect& bounds,
+                 const int transactionId)
+    : imageId(image->id())
+    , image(image)
+    , pixelFormat(image->pixelFormat())
+    , address(bounds.isEmpty() ? nullptr: image->getPixelAddress(bounds.x, bounds.y))
+    , rowStride(image->getRowStrideSize())
+    , bytesPerPixel(image->getRowStrideSize(1))
+    , bounds(bounds)
+    , transactionId(transactionId) {
+  }
+  ImagePixelsObj(const ImagePixelsObj&) = delete;
+  ImagePixelsObj& operator=(const ImagePixelsObj&) = delete;
+
+  void checkValid(lua_State* L) const {
+    if (!is_transaction_running(transactionId))
+      luaL_error(L, "the pixels view can be used only inside its app.transaction()");
+    // The image could be deleted/replaced in the same transaction
+    if (doc::get_object(imageId) != image)
+      luaL_error(L, "the image of the pixels view doesn't exist");
+  }
+
+  // Returns the address of the pixel with the given 1-based index,
+  // or raises an error if it's out of bounds.
+  uint8_t* pixelAddress(lua_State* L, const lua_Integer i) const {
+    checkValid(L);
+    const lua_Integer n = lua_Integer(bounds.w) * bounds.h;
+    if (i < 1 || i > n)
+      luaL_error(L, "pixel index %d out of bounds [1, %d]", int(i), int(n));
+    const int j = int(i-1);
+    return address + (j / bounds.w)*rowStride + (j % bounds.w)*bytesPerPixel;
+  }
+};
+
+int ImagePixels_gc(lua_State* L)
+{
+  get_obj<ImagePixelsObj>(L, 1)->~ImagePixelsObj();
+  return 0;
+}
+
+int ImagePixels_index(lua_State* L)
+{
+  const auto obj = get_obj<ImagePixelsObj>(L, 1);
+  if (lua_isinteger(L, 2)) {
+    const uint8_t* p = obj->pixelAddress(L, lua_tointeger(L, 2));
+    switch (obj->pixelFormat) {
+      case doc::IMAGE_RGB:
+        lua_pushinteger(L, *(const uint32_t*)p);
+        return 1;
+      case doc::IMAGE_GRAYSCALE:
+        lua_pushinteger(L, *(const uint16_t*)p);
+        return 1;
+      case doc::IMAGE_INDEXED:
+        lua_pushinteger(L, *p);
+        return 1;
+      default:
+        return 0;
+    }
+  }
+
+  const char* field = lua_tostring(L, 2);
+  if (field) {
+    if (std::strcmp(field, "width") == 0) {
+      lua_pushinteger(L, obj->bounds.w);
+      return 1;
+    }
+    else if (std::strcmp(field, "height") == 0) {
+      lua_pushinteger(L, obj->bounds.h);
+      return 1;
+    }
+    else if (std::strcmp(field, "bounds") == 0) {
+      push_new<gfx::Rect>(L, obj->bounds);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int ImagePixels_newindex(lua_State* L)
+{
+  const auto obj = get_obj<ImagePixelsObj>(L, 1);
+  uint8_t* p = obj->pixelAddress(L, luaL_checkinteger(L, 2));
+  const doc::color_t color = luaL_checkinteger(L, 3);
+  switch (obj->pixelFormat) {
+    case doc::IMAGE_RGB:
+      *(uint32_t*)p = color;
+      break;
+    case doc::IMAGE_GRAYSCALE:
+      *(uint16_t*)p = color;
+      break;
+    case doc::IMAGE_INDEXED:
+      *p = color;
+      break;
+    default:
+      break;
+  }
+  // The image keeps the same version only while it's not modified
+  // (e.g. to invalidate the thumbnails/rendered frames caches)
+  obj->image->incrementVersion();
+  return 0;
+}
+
+int ImagePixels_len(lua_State* L)
+{
+  const auto obj = get_obj<ImagePixelsObj>(L, 1);
+  lua_pushinteger(L, lua_Integer(obj->bounds.w) * obj->bounds.h);
+  return 1;
+}
+
+const luaL_Reg ImagePixels_methods[] = {
+  { "__index", ImagePixels_index },
+  { "__newindex", ImagePixels_newindex },
+  { "__len", ImagePixels_len },
+  { "__gc", ImagePixels_gc },
+  { nullptr, nullptr }
+};
+
+} // anonymous namespace
+
+DEF_MTNAME(ImagePixelsObj);
+
+void register_image_pixels_class(lua_State* L)
+{
+  using ImagePixels = ImagePixelsObj;
+  REG_CLASS(L, ImagePixels);
+}
+
+void push_image_pixels(lua_State* L, doc::Image* image,
+                       const gfx::Rect& bounds,
+                       const int transactionId)
+{
+  push_new<ImagePixelsObj>(L, image, bounds, transactionId);
+}
+
+} // namespace script
+} // namespace app
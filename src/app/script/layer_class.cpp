@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2019  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2018  David Capello
 //
 // This program is distributed under the terms of
@@ -289,17 +289,31 @@ int Layer_set_stackIndex(lua_State* L)
   return 0;
 }
 
+// Changes the visible/editable flag of the layer and notifies the
+// change (changes of several layers in an app.transaction() are
+// notified together when the transaction ends).
+void set_layer_flags(Layer* layer, const LayerFlags flags, const bool state)
+{
+  if (layer->hasFlags(flags) == state)
+    return;
+
+  layer->switchFlags(flags, state);
+  Sprite* sprite = layer->sprite();
+  if (sprite && sprite->document())
+    static_cast<Doc*>(sprite->document())->notifyLayersFlagsChanged(LayerList{ layer });
+}
+
 int Layer_set_isEditable(lua_State* L)
 {
   auto layer = get_docobj<Layer>(L, 1);
-  layer->setEditable(lua_toboolean(L, 2));
+  set_layer_flags(layer, LayerFlags::Editable, lua_toboolean(L, 2));
   return 0;
 }
 
 int Layer_set_isVisible(lua_State* L)
 {
   auto layer = get_docobj<Layer>(L, 1);
-  layer->setVisible(lua_toboolean(L, 2));
+  set_layer_flags(layer, LayerFlags::Visible, lua_toboolean(L, 2));
   return 0;
 }
 
@@ -0,0 +1,218 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/script/profiler.h"
+
+#include "app/script/luacpp.h"
+#include "base/debug.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace app {
+namespace script {
+
+namespace {
+
+// Only one Lua state can be profiled at the same time (the hook is a
+// static function)
+Profiler* g_profiler = nullptr;
+
+// Number of levels in the Lua stack, found with a binary search like
+// luaL_traceback() does
+int stack_depth(lua_State* L)
+{
+  lua_Debug ar;
+  int li = 1, le = 1;
+  while (lua_getstack(L, le, &ar)) {
+    li = le;
+    le *= 2;
+  }
+  while (li < le) {
+    const int m = (li + le) / 2;
+    if (lua_getstack(L, m, &ar))
+      li = m + 1;
+    else
+      le = m;
+  }
+  return le;
+}
+
+} // anonymous namespace
+
+Profiler::Profiler(lua_State* L)
+  : m_L(L)
+{
+  ASSERT(!g_profiler);
+  g_profiler = this;
+  lua_sethook(L, &Profiler::hook, LUA_MASKCALL | LUA_MASKRET, 0);
+}
+
+Profiler::~Profiler()
+{
+  lua_sethook(m_L, nullptr, 0, 0);
+  g_profiler = nullptr;
+}
+
+void Profiler::addCommand(const std::string& commandId, const double seconds)
+{
+  Stats& stats = m_commands[commandId];
+  if (stats.name.empty())
+    stats.name = commandId;
+  ++stats.calls;
+  stats.total += seconds;
+  stats.self += seconds;
+}
+
+// static
+void Profiler::hook(lua_State* L, lua_Debug* ar)
+{
+  if (!g_profiler)
+    return;
+
+  switch (ar->event) {
+    case LUA_HOOKCALL:
+      g_profiler->onCall(L, ar, false);
+      break;
+    case LUA_HOOKTAILCALL:
+      g_profiler->onCall(L, ar, true);
+      break;
+    case LUA_HOOKRET:
+      g_profiler->onReturn(L);
+      break;
+  }
+}
+
+void Profiler::onCall(lua_State* L, lua_Debug* ar, const bool tailCall)
+{
+  if (!lua_getinfo(L, "Sn", ar))
+    return;
+
+  const bool isC = (ar->what && ar->what[0] == 'C');
+  const char* name = (ar->name ? ar->name: "?");
+  char key[512];
+  if (isC) {
+    std::snprintf(key, sizeof(key), "[C] %s%s", name,
+                  (ar->namewhat && std::strcmp(ar->namewhat, "metamethod") == 0 ?
+                   " (metamethod)": ""));
+  }
+  else {
+    std::snprintf(key, sizeof(key), "%s:%d", ar->short_src, ar->linedefined);
+  }
+
+  Stats& stats = m_functions[key];
+  if (stats.name.empty()) {
+    stats.isC = isC;
+    if (isC)
+      stats.name = key;
+    else
+      stats.name = std::string(ar->name ? ar->name: "(function)") + " " + key;
+  }
+  ++stats.calls;
+
+  const double now = m_chrono.elapsed();
+  const int depth = stack_depth(L);
+  auto& stack = m_stacks[L];
+
+  // The called function replaces the current one in the stack
+  if (tailCall && !stack.empty())
+    popFrame(stack, now);
+
+  stack.push_back(Frame{ &stats, depth, now, 0.0 });
+}
+
+void Profiler::onReturn(lua_State* L)
+{
+  auto it = m_stacks.find(L);
+  if (it == m_stacks.end())
+    return;
+
+  auto& stack = it->second;
+  const double now = m_chrono.elapsed();
+  const int depth = stack_depth(L);
+
+  // Frames that were discarded by a Lua error don't generate a
+  // return event, so we pop them here too
+  while (!stack.empty() && stack.back().depth > depth)
+    popFrame(stack, now);
+  if (!stack.empty() && stack.back().depth == depth)
+    popFrame(stack, now);
+}
+
+void Profiler::popFrame(std::vector<Frame>& stack, const double now)
+{
+  const Frame frame = stack.back();
+  stack.pop_back();
+
+  const double elapsed = now - frame.start;
+  frame.stats->total += elapsed;
+  frame.stats->self += elapsed - frame.children;
+  if (!stack.empty())
+    stack.back().children += elapsed;
+}
+
+std::string Profiler::report() const
+{
+  std::vector<const Stats*> functions;
+  for (const auto& kv : m_functions)
+    functions.push_back(&kv.second);
+  std::sort(functions.begin(), functions.end(),
+            [](const Stats* a, const Stats* b) {
+              if (a->self != b->self)
+                return a->self > b->self;
+              return a->calls > b->calls;
+            });
+
+  std::string result;
+  char buf[1024];
+  std::snprintf(buf, sizeof(buf),
+                "Script profile (%.3f s)\n"
+                "%10s %12s %12s  %s\n",
+                m_chrono.elapsed(), "Calls", "Total ms", "Self ms", "Function");
+  result += buf;
+
+  // The C functions that are called a lot are interesting too (even
+  // if they are fast), it means that the script is making a lot of
+  // calls to the API
+  const int kMaxFunctions = 50;
+  int n = 0;
+  for (const Stats* stats : functions) {
+    if (++n > kMaxFunctions)
+      break;
+    std::snprintf(buf, sizeof(buf), "%10d %12.3f %12.3f  %s\n",
+                  stats->calls, stats->total*1000.0, stats->self*1000.0,
+                  stats->name.c_str());
+    result += buf;
+  }
+
+  int cCalls = 0;
+  for (const Stats* stats : functions)
+    if (stats->isC)
+      cCalls += stats->calls;
+  std::snprintf(buf, sizeof(buf), "Calls to C functions: %d\n", cCalls);
+  result += buf;
+
+  if (!m_commands.empty()) {
+    std::snprintf(buf, sizeof(buf), "%10s %12s  %s\n",
+                  "Calls", "Total ms", "Command");
+    result += buf;
+    for (const auto& kv : m_commands) {
+      std::snprintf(buf, sizeof(buf), "%10d %12.3f  %s\n",
+                    kv.second.calls, kv.second.total*1000.0,
+                    kv.second.name.c_str());
+      result += buf;
+    }
+  }
+  return result;
+}
+
+} // namespace script
+} // namespace app
@@ -0,0 +1,73 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_SCRIPT_PROFILER_H_INCLUDED
+#define APP_SCRIPT_PROFILER_H_INCLUDED
+#pragma once
+
+#ifndef ENABLE_SCRIPTING
+  #error ENABLE_SCRIPTING must be defined
+#endif
+
+#include "base/chrono.h"
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct lua_State;
+struct lua_Debug;
+
+namespace app {
+namespace script {
+
+  // Measures the time spent in each Lua function (and the number of
+  // calls to C functions, e.g. the __index metamethods used to get
+  // the properties of app objects) using a call/return Lua hook. The
+  // time of each app.command is measured too.
+  class Profiler {
+  public:
+    Profiler(lua_State* L);
+    ~Profiler();
+
+    void addCommand(const std::string& commandId, const double seconds);
+
+    // Returns a text report sorted by self time
+    std::string report() const;
+
+  private:
+    struct Stats {
+      std::string name;
+      bool isC = false;
+      int calls = 0;
+      double total = 0.0;       // Seconds including called functions
+      double self = 0.0;        // Seconds in the function itself
+    };
+
+    struct Frame {
+      Stats* stats;
+      int depth;                // Level in the Lua stack
+      double start;
+      double children;          // Seconds in called functions
+    };
+
+    static void hook(lua_State* L, lua_Debug* ar);
+    void onCall(lua_State* L, lua_Debug* ar, const bool tailCall);
+    void onReturn(lua_State* L);
+    void popFrame(std::vector<Frame>& stack, const double now);
+
+    lua_State* m_L;
+    base::Chrono m_chrono;
+    std::unordered_map<std::string, Stats> m_functions;
+    std::map<lua_State*, std::vector<Frame>> m_stacks; // One stack per coroutine
+    std::map<std::string, Stats> m_commands;
+  };
+
+} // namespace script
+} // namespace app
+
+#endif
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2015-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -343,6 +343,11 @@ void register_selection_class(lua_State* L)
   REG_CLASS_PROPERTIES(L, Selection);
 }
 
+void push_selection(lua_State* L, doc::Mask* mask)
+{
+  push_new<SelectionObj>(L, mask, nullptr);
+}
+
 void push_sprite_selection(lua_State* L, Sprite* sprite)
 {
   push_new<SelectionObj>(L, nullptr, sprite);
@@ -24,6 +24,7 @@
 #include "app/cmd/set_pixel_ratio.h"
 #include "app/cmd/set_sprite_size.h"
 #include "app/cmd/set_transparent_color.h"
+#include "app/cmd_transaction.h"
 #include "app/color_spaces.h"
 #include "app/commands/commands.h"
 #include "app/commands/params.h"
@@ -52,14 +53,78 @@
 #include "doc/slice.h"
 #include "doc/sprite.h"
 #include "doc/tag.h"
+#include "undo/undo_state.h"
 
 #include <algorithm>
+#include <memory>
+#include <set>
+#include <vector>
 
 namespace app {
 namespace script {
 
 namespace {
 
+// Milliseconds to wait the read lock of a document to create its
+// first snapshot (e.g. if a background job is saving it)
+const int kSnapshotLockTimeout = 500;
+
+// Copy of a document created with Sprite:snapshot(). The last
+// snapshot of each document is reused while the document is not
+// modified, or when the document is locked for writing by other
+// thread (so scripts don't need to wait the writer).
+struct Snapshot {
+  doc::ObjectId docId = 0;      // ID of the original document
+  std::unique_ptr<Doc> doc;
+  const undo::UndoState* undoState = nullptr;
+  doc::ObjectVersion version = 0;
+  // False if the snapshot was created inside a transaction (the
+  // document could have changes that are not in the undo history yet)
+  bool reusable = true;
+  // Lua userdata of the sprite returned by Sprite:snapshot(), the
+  // snapshot is destroyed when all of them are garbage collected
+  std::set<const void*> refs;
+};
+std::vector<std::unique_ptr<Snapshot>> g_snapshots;
+
+Snapshot* find_snapshot_of_copy(const Doc* doc)
+{
+  for (auto& snapshot : g_snapshots)
+    if (snapshot->doc.get() == doc)
+      return snapshot.get();
+  return nullptr;
+}
+
+// Returns the newest snapshot of the given original document
+Snapshot* find_last_snapshot(const Doc* doc)
+{
+  for (auto it=g_snapshots.rbegin(); it!=g_snapshots.rend(); ++it)
+    if ((*it)->docId == doc->id())
+      return it->get();
+  return nullptr;
+}
+
+bool is_snapshot_doc(const Doc* doc)
+{
+  return (find_snapshot_of_copy(doc) != nullptr);
+}
+
+void push_snapshot_sprite(lua_State* L, Snapshot* snapshot)
+{
+  push_docobj(L, snapshot->doc->sprite());
+  snapshot->refs.insert(lua_touserdata(L, -1));
+}
+
+// Returns the sprite in the given index to be modified, snapshots
+// are read-only.
+Sprite* get_writable_sprite(lua_State* L, int index)
+{
+  auto sprite = get_docobj<Sprite>(L, index);
+  if (is_snapshot_doc(static_cast<Doc*>(sprite->document())))
+    luaL_error(L, "a sprite snapshot cannot be modified");
+  return sprite;
+}
+
 int Sprite_new(lua_State* L)
 {
   std::unique_ptr<Doc> doc;
@@ -137,6 +202,19 @@ int Sprite_new(lua_State* L)
   return 1;
 }
 
+int Sprite_gc(lua_State* L)
+{
+  const void* ud = lua_touserdata(L, 1);
+  for (auto it=g_snapshots.begin(); it!=g_snapshots.end(); ++it) {
+    if ((*it)->refs.erase(ud)) {
+      if ((*it)->refs.empty())
+        g_snapshots.erase(it);
+      break;
+    }
+  }
+  return 0;
+}
+
 int Sprite_eq(lua_State* L)
 {
   const auto a = get_docobj<Sprite>(L, 1);
@@ -147,7 +225,7 @@ int Sprite_eq(lua_State* L)
 
 int Sprite_resize(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   gfx::Size size = convert_args_into_size(L, 2);
 
   // Fix invalid sizes
@@ -174,7 +252,7 @@ int Sprite_resize(lua_State* L)
 
 int Sprite_crop(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   Doc* doc = static_cast<Doc*>(sprite->document());
   gfx::Rect bounds;
 
@@ -263,7 +341,7 @@ int Sprite_close(lua_State* L)
 
 int Sprite_loadPalette(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   const char* fn = luaL_checkstring(L, 2);
   if (fn && sprite) {
     std::string absFn = base::get_absolute_path(fn);
@@ -285,7 +363,7 @@ int Sprite_loadPalette(lua_State* L)
 
 int Sprite_setPalette(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   auto pal = get_palette_from_arg(L, 2);
   if (sprite && pal) {
     Doc* doc = static_cast<Doc*>(sprite->document());
@@ -299,7 +377,7 @@ int Sprite_setPalette(lua_State* L)
 
 int Sprite_assignColorSpace(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   auto cs = get_obj<gfx::ColorSpace>(L, 2);
   Tx tx;
   tx(new cmd::AssignColorProfile(
@@ -310,7 +388,7 @@ int Sprite_assignColorSpace(lua_State* L)
 
 int Sprite_convertColorSpace(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   auto cs = get_obj<gfx::ColorSpace>(L, 2);
   Tx tx;
   tx(new cmd::ConvertColorProfile(
@@ -321,7 +399,7 @@ int Sprite_convertColorSpace(lua_State* L)
 
 int Sprite_flatten(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
 
   DocRange range;
   for (auto layer : sprite->root()->layers())
@@ -335,7 +413,7 @@ int Sprite_flatten(lua_State* L)
 
 int Sprite_newLayer(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   doc::Layer* newLayer = new doc::LayerImage(sprite);
 
   Tx tx;
@@ -348,7 +426,7 @@ int Sprite_newLayer(lua_State* L)
 
 int Sprite_newGroup(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   doc::Layer* newGroup = new doc::LayerGroup(sprite);
 
   Tx tx;
@@ -361,7 +439,7 @@ int Sprite_newGroup(lua_State* L)
 
 int Sprite_deleteLayer(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   auto layer = may_get_docobj<Layer>(L, 2);
   if (!layer && lua_isstring(L, 2)) {
     const char* layerName = lua_tostring(L, 2);
@@ -389,7 +467,7 @@ int Sprite_deleteLayer(lua_State* L)
 
 int Sprite_newFrame(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   doc::frame_t frame = sprite->lastFrame()+1;
   doc::frame_t copyThis = frame;
   if (lua_gettop(L) >= 2) {
@@ -411,7 +489,7 @@ int Sprite_newFrame(lua_State* L)
 
 int Sprite_newEmptyFrame(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   doc::frame_t frame = sprite->lastFrame()+1;
   if (lua_gettop(L) >= 2) {
     frame = get_frame_number_from_arg(L, 2);
@@ -431,7 +509,7 @@ int Sprite_newEmptyFrame(lua_State* L)
 
 int Sprite_deleteFrame(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   doc::frame_t frame = get_frame_number_from_arg(L, 2);
   if (frame < 0 || frame > sprite->lastFrame())
     return luaL_error(L, "frame index out of bounds %d", frame+1);
@@ -446,7 +524,7 @@ int Sprite_deleteFrame(lua_State* L)
 
 int Sprite_newCel(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   auto layerBase = get_docobj<Layer>(L, 2);
   if (!layerBase->isImage())
     return luaL_error(L, "unexpected kinf of layer in Sprite:newCel()");
@@ -502,7 +580,7 @@ int Sprite_newCel(lua_State* L)
 
 int Sprite_deleteCel(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   auto cel = may_get_docobj<doc::Cel>(L, 2);
   if (!cel) {
     if (auto layer = may_get_docobj<doc::Layer>(L, 2)) {
@@ -527,7 +605,7 @@ int Sprite_deleteCel(lua_State* L)
 
 int Sprite_newTag(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   auto from = get_frame_number_from_arg(L, 2);
   auto to = get_frame_number_from_arg(L, 3);
   auto tag = new doc::Tag(from, to);
@@ -542,7 +620,7 @@ int Sprite_newTag(lua_State* L)
 
 int Sprite_deleteTag(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   auto tag = may_get_docobj<Tag>(L, 2);
   if (!tag && lua_isstring(L, 2)) {
     const char* tagName = lua_tostring(L, 2);
@@ -564,7 +642,7 @@ int Sprite_deleteTag(lua_State* L)
 
 int Sprite_newSlice(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   auto slice = new doc::Slice();
 
   gfx::Rect bounds = convert_args_into_rect(L, 2);
@@ -578,7 +656,7 @@ int Sprite_newSlice(lua_State* L)
 
 int Sprite_deleteSlice(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   doc::Slice* slice = may_get_docobj<Slice>(L, 2);
   if (!slice && lua_isstring(L, 2)) {
     const char* sliceName = lua_tostring(L, 2);
@@ -598,6 +676,67 @@ int Sprite_deleteSlice(lua_State* L)
   }
 }
 
+// Returns a read-only copy of the sprite that is consistent with the
+// last state of the document that could be read without waiting other
+// threads. The snapshot is not associated to the UI (it doesn't have
+// undo history) and it's destroyed when the returned sprite is
+// garbage collected, so its layers/cels/images can be used only
+// while the script keeps a reference to the snapshot sprite.
+int Sprite_snapshot(lua_State* L)
+{
+  auto sprite = get_docobj<Sprite>(L, 1);
+  Doc* doc = static_cast<Doc*>(sprite->document());
+  if (Snapshot* snapshot = find_snapshot_of_copy(doc)) {
+    push_snapshot_sprite(L, snapshot);
+    return 1;
+  }
+
+  // Inside a transaction we cannot know if the document was modified
+  // (the undo state is the same), so we need a new copy.
+  const bool inTransaction = (doc->transaction() != nullptr);
+  Snapshot* last = find_last_snapshot(doc);
+  if (last && (!last->reusable || inTransaction))
+    last = nullptr;
+
+  const int timeout = (last ? 0: kSnapshotLockTimeout);
+  if (doc->readLock(timeout)) {
+    const undo::UndoState* undoState = doc->undoHistory()->currentState();
+    if (!last ||
+        last->undoState != undoState ||
+        last->version != sprite->version()) {
+      try {
+        auto snapshot = std::make_unique<Snapshot>();
+        snapshot->docId = doc->id();
+        snapshot->doc.reset(doc->duplicate(Doc::DuplicateExactCopy));
+        snapshot->doc->setFilename(doc->filename());
+        snapshot->undoState = undoState;
+        snapshot->version = sprite->version();
+        snapshot->reusable = !inTransaction;
+        last = snapshot.get();
+        g_snapshots.push_back(std::move(snapshot));
+      }
+      catch (...) {
+        doc->unlock();
+        throw;
+      }
+    }
+    doc->unlock();
+  }
+  else if (!last) {
+    return luaL_error(L, "the sprite is locked by other operation");
+  }
+
+  push_snapshot_sprite(L, last);
+  return 1;
+}
+
+int Sprite_get_isSnapshot(lua_State* L)
+{
+  auto sprite = get_docobj<Sprite>(L, 1);
+  lua_pushboolean(L, is_snapshot_doc(static_cast<Doc*>(sprite->document())));
+  return 1;
+}
+
 int Sprite_get_events(lua_State* L)
 {
   auto sprite = get_docobj<Sprite>(L, 1);
@@ -605,6 +744,58 @@ int Sprite_get_events(lua_State* L)
   return 1;
 }
 
+// Returns a table with the memory used by the sprite and its undo
+// history (in bytes).
+int Sprite_get_memoryUsage(lua_State* L)
+{
+  auto sprite = get_docobj<Sprite>(L, 1);
+  const Doc::MemoryUsage usage =
+    static_cast<Doc*>(sprite->document())->memoryUsage();
+
+  lua_newtable(L);
+  lua_pushinteger(L, usage.sprite);
+  lua_setfield(L, -2, "sprite");
+  lua_pushinteger(L, usage.undo);
+  lua_setfield(L, -2, "undo");
+  return 1;
+}
+
+// Returns a table with the memory used by the undo history and
+// information about each undo state (label, memory, and the time used
+// to execute/undo/redo it).
+int Sprite_get_undoHistory(lua_State* L)
+{
+  auto sprite = get_docobj<Sprite>(L, 1);
+  const DocUndo* history = static_cast<Doc*>(sprite->document())->undoHistory();
+
+  lua_newtable(L);
+  lua_pushinteger(L, history->totalUndoSize());
+  lua_setfield(L, -2, "size");
+
+  lua_newtable(L);
+  int i = 0;
+  for (const undo::UndoState* state = history->firstState();
+       state; state = state->next()) {
+    auto cmd = static_cast<const CmdTransaction*>(state->cmd());
+    lua_newtable(L);
+    lua_pushstring(L, cmd->label().c_str());
+    lua_setfield(L, -2, "label");
+    lua_pushinteger(L, cmd->memSize());
+    lua_setfield(L, -2, "memSize");
+    lua_pushnumber(L, cmd->executeTime());
+    lua_setfield(L, -2, "executeTime");
+    lua_pushnumber(L, cmd->undoTime());
+    lua_setfield(L, -2, "undoTime");
+    lua_pushnumber(L, cmd->redoTime());
+    lua_setfield(L, -2, "redoTime");
+    lua_pushboolean(L, state == history->currentState());
+    lua_setfield(L, -2, "current");
+    lua_seti(L, -2, ++i);
+  }
+  lua_setfield(L, -2, "states");
+  return 1;
+}
+
 int Sprite_get_filename(lua_State* L)
 {
   auto sprite = get_docobj<Sprite>(L, 1);
@@ -720,7 +911,7 @@ int Sprite_get_transparentColor(lua_State* L)
 
 int Sprite_set_transparentColor(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   const int index = lua_tointeger(L, 2);
   Tx tx;
   tx(new cmd::SetTransparentColor(sprite, index));
@@ -730,7 +921,7 @@ int Sprite_set_transparentColor(lua_State* L)
 
 int Sprite_set_filename(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   const char* fn = lua_tostring(L, 2);
   sprite->document()->setFilename(fn ? std::string(fn): std::string());
   return 0;
@@ -738,7 +929,7 @@ int Sprite_set_filename(lua_State* L)
 
 int Sprite_set_width(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   const int width = lua_tointeger(L, 2);
   Tx tx;
   tx(new cmd::SetSpriteSize(sprite, width, sprite->height()));
@@ -748,7 +939,7 @@ int Sprite_set_width(lua_State* L)
 
 int Sprite_set_height(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   const int height = lua_tointeger(L, 2);
   Tx tx;
   tx(new cmd::SetSpriteSize(sprite, sprite->width(), height));
@@ -758,7 +949,7 @@ int Sprite_set_height(lua_State* L)
 
 int Sprite_set_selection(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   const auto mask = get_mask_from_arg(L, 2);
   Doc* doc = static_cast<Doc*>(sprite->document());
   Tx tx;
@@ -783,7 +974,7 @@ int Sprite_get_gridBounds(lua_State* L)
 
 int Sprite_set_gridBounds(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   const gfx::Rect bounds = convert_args_into_rect(L, 2);
   Tx tx;
   tx(new cmd::SetGridBounds(sprite, bounds));
@@ -800,7 +991,7 @@ int Sprite_get_pixelRatio(lua_State* L)
 
 int Sprite_set_pixelRatio(lua_State* L)
 {
-  auto sprite = get_docobj<Sprite>(L, 1);
+  auto sprite = get_writable_sprite(L, 1);
   const gfx::Size pixelRatio = convert_args_into_size(L, 2);
   Tx tx;
   tx(new cmd::SetPixelRatio(sprite, pixelRatio));
@@ -809,6 +1000,7 @@ int Sprite_set_pixelRatio(lua_State* L)
 }
 
 const luaL_Reg Sprite_methods[] = {
+  { "__gc", Sprite_gc },
   { "__eq", Sprite_eq },
   { "resize", Sprite_resize },
   { "crop", Sprite_crop },
@@ -837,6 +1029,8 @@ const luaL_Reg Sprite_methods[] = {
   // Slices
   { "newSlice", Sprite_newSlice },
   { "deleteSlice", Sprite_deleteSlice },
+  // Read-only copy
+  { "snapshot", Sprite_snapshot },
   { nullptr, nullptr }
 };
 
@@ -860,6 +1054,9 @@ const Property Sprite_properties[] = {
   { "gridBounds", Sprite_get_gridBounds, Sprite_set_gridBounds },
   { "pixelRatio", Sprite_get_pixelRatio, Sprite_set_pixelRatio },
   { "events", Sprite_get_events, nullptr },
+  { "undoHistory", Sprite_get_undoHistory, nullptr },
+  { "memoryUsage", Sprite_get_memoryUsage, nullptr },
+  { "isSnapshot", Sprite_get_isSnapshot, nullptr },
   { nullptr, nullptr, nullptr }
 };
 
@@ -875,5 +1072,15 @@ void register_sprite_class(lua_State* L)
   REG_CLASS_PROPERTIES(L, Sprite);
 }
 
+bool is_snapshot_sprite(const doc::Sprite* sprite)
+{
+  return is_snapshot_doc(static_cast<const Doc*>(sprite->document()));
+}
+
+void destroy_sprite_snapshots()
+{
+  g_snapshots.clear();
+}
+
 } // namespace script
 } // namespace app
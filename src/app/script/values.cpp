@@ -173,6 +173,7 @@ FOR_ENUM(app::gen::OnionskinType)
 FOR_ENUM(app::gen::PaintingCursorType)
 FOR_ENUM(app::gen::PivotPosition)
 FOR_ENUM(app::gen::PixelConnectivity)
+FOR_ENUM(app::gen::QuantizationAlgorithm)
 FOR_ENUM(app::gen::RightClickMode)
 FOR_ENUM(app::gen::SelectionMode)
 FOR_ENUM(app::gen::SequenceDecision)
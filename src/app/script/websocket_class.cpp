@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2021  Igara Studio S.A.
+// Copyright (C) 2021-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -13,14 +13,22 @@
 #include "app/script/engine.h"
 #include "app/script/luacpp.h"
 #include "app/script/security.h"
+#include "doc/image.h"
 #include "ui/timer.h"
 #include "ui/manager.h"
 #include "ui/system.h"
 
 #include <ixwebsocket/IXNetSystem.h>
 #include <ixwebsocket/IXWebSocket.h>
-#include <sstream>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace app {
 namespace script {
@@ -30,9 +38,21 @@ namespace {
 // Additional "enum" value to make message callback simpler
 #define MESSAGE_TYPE_BINARY ((int)ix::WebSocketMessageType::Fragment + 10)
 
+// Messages received from the network thread, all the pending
+// messages are delivered to the script in the same UI thread call.
+struct ReceivedMessages {
+  std::mutex mutex;
+  std::vector<std::pair<int, std::string>> messages;
+};
+
 static std::unique_ptr<ui::Timer> g_timer;
 static std::set<ix::WebSocket*> g_connections;
 
+// Maximum number of bytes waiting to be sent for each WebSocket, the
+// send functions don't send more data (return false) when this limit
+// is reached
+static std::map<ix::WebSocket*, size_t> g_maxBuffered;
+
 static void close_ws(ix::WebSocket* ws)
 {
   ws->stop();
@@ -42,6 +62,48 @@ static void close_ws(ix::WebSocket* ws)
     g_timer.reset();
 }
 
+// Joins all the arguments (strings or images) from the given index
+// in one message. Image pixels are copied directly from the image
+// buffer (without creating a Lua string).
+static std::string get_message_data(lua_State* L, const int fromIndex)
+{
+  const int argc = lua_gettop(L);
+  size_t size = 0;
+  for (int i=fromIndex; i<=argc; ++i) {
+    if (const doc::Image* image = may_get_image_from_arg(L, i)) {
+      size += size_t(image->getRowStrideSize()) * image->height();
+    }
+    else {
+      size_t bufLen = 0;
+      lua_tolstring(L, i, &bufLen);
+      size += bufLen;
+    }
+  }
+
+  std::string data;
+  data.reserve(size);
+  for (int i=fromIndex; i<=argc; ++i) {
+    if (const doc::Image* image = may_get_image_from_arg(L, i)) {
+      data.append((const char*)image->getPixelAddress(0, 0),
+                  size_t(image->getRowStrideSize()) * image->height());
+    }
+    else {
+      size_t bufLen;
+      if (const char* buf = lua_tolstring(L, i, &bufLen))
+        data.append(buf, bufLen);
+    }
+  }
+  return data;
+}
+
+// Returns true if we can send more data to the WebSocket
+static bool can_send(ix::WebSocket* ws)
+{
+  auto it = g_maxBuffered.find(ws);
+  return (it == g_maxBuffered.end() ||
+          ws->bufferedAmount() < it->second);
+}
+
 int WebSocket_new(lua_State* L)
 {
   static std::once_flag f;
@@ -82,25 +144,51 @@ int WebSocket_new(lua_State* L)
     }
     lua_pop(L, 1);
 
+    type = lua_getfield(L, 1, "maxbuffered");
+    if (type == LUA_TNUMBER) {
+      g_maxBuffered[ws] = size_t(std::max<lua_Integer>(0, lua_tointeger(L, -1)));
+    }
+    lua_pop(L, 1);
+
     type = lua_getfield(L, 1, "onreceive");
     if (type == LUA_TFUNCTION) {
       int onreceiveRef = luaL_ref(L, LUA_REGISTRYINDEX);
+      auto received = std::make_shared<ReceivedMessages>();
 
       ws->setOnMessageCallback(
-        [L, ws, onreceiveRef](const ix::WebSocketMessagePtr& msg) {
+        [L, ws, onreceiveRef, received](const ix::WebSocketMessagePtr& msg) {
           int msgType =
             (msg->binary ? MESSAGE_TYPE_BINARY : static_cast<int>(msg->type));
-          std::string msgData = msg->str;
+          bool first;
+          {
+            std::lock_guard<std::mutex> lock(received->mutex);
+            first = received->messages.empty();
+            received->messages.emplace_back(msgType, msg->str);
+          }
+
+          // Only one UI call is queued for all the pending messages
+          if (!first)
+            return;
 
           ui::execute_from_ui_thread([=]() {
-            lua_rawgeti(L, LUA_REGISTRYINDEX, onreceiveRef);
-            lua_pushinteger(L, msgType);
-            lua_pushlstring(L, msgData.c_str(), msgData.length());
-
-            if (lua_pcall(L, 2, 0, 0)) {
-              if (const char* s = lua_tostring(L, -1)) {
-                App::instance()->scriptEngine()->consolePrint(s);
-                ws->stop();
+            std::vector<std::pair<int, std::string>> messages;
+            {
+              std::lock_guard<std::mutex> lock(received->mutex);
+              std::swap(messages, received->messages);
+            }
+
+            for (const auto& m : messages) {
+              lua_rawgeti(L, LUA_REGISTRYINDEX, onreceiveRef);
+              lua_pushinteger(L, m.first);
+              lua_pushlstring(L, m.second.c_str(), m.second.length());
+
+              if (lua_pcall(L, 2, 0, 0)) {
+                if (const char* s = lua_tostring(L, -1)) {
+                  App::instance()->scriptEngine()->consolePrint(s);
+                  ws->stop();
+                }
+                lua_pop(L, 1);
+                break;
               }
             }
           });
@@ -120,6 +208,7 @@ int WebSocket_gc(lua_State* L)
 {
   auto ws = get_ptr<ix::WebSocket>(L, 1);
   close_ws(ws);
+  g_maxBuffered.erase(ws);
   delete ws;
   return 0;
 }
@@ -132,19 +221,16 @@ int WebSocket_sendText(lua_State* L)
     return luaL_error(L, "WebSocket is not connected, can't send text");
   }
 
-  std::stringstream data;
-  int argc = lua_gettop(L);
-
-  for (int i = 2; i <= argc; i++) {
-    size_t bufLen;
-    const char* buf = lua_tolstring(L, i, &bufLen);
-    data.write(buf, bufLen);
+  if (!can_send(ws)) {
+    lua_pushboolean(L, false);
+    return 1;
   }
 
-  if (!ws->sendText(data.str()).success) {
+  if (!ws->sendText(get_message_data(L, 2)).success) {
     return luaL_error(L, "WebSocket failed to send text");
   }
-  return 0;
+  lua_pushboolean(L, true);
+  return 1;
 }
 
 int WebSocket_sendBinary(lua_State* L)
@@ -155,19 +241,16 @@ int WebSocket_sendBinary(lua_State* L)
     return luaL_error(L, "WebSocket is not connected, can't send data");
   }
 
-  std::stringstream data;
-  int argc = lua_gettop(L);
-
-  for (int i = 2; i <= argc; i++) {
-    size_t bufLen;
-    const char* buf = lua_tolstring(L, i, &bufLen);
-    data.write(buf, bufLen);
+  if (!can_send(ws)) {
+    lua_pushboolean(L, false);
+    return 1;
   }
 
-  if (!ws->sendBinary(data.str()).success) {
+  if (!ws->sendBinary(get_message_data(L, 2)).success) {
     return luaL_error(L, "WebSocket failed to send data");
   }
-  return 0;
+  lua_pushboolean(L, true);
+  return 1;
 }
 
 int WebSocket_sendPing(lua_State* L)
@@ -220,6 +303,13 @@ int WebSocket_get_url(lua_State* L)
   return 1;
 }
 
+int WebSocket_get_bufferedAmount(lua_State* L)
+{
+  auto ws = get_ptr<ix::WebSocket>(L, 1);
+  lua_pushinteger(L, ws->bufferedAmount());
+  return 1;
+}
+
 const luaL_Reg WebSocket_methods[] = {
   { "__gc", WebSocket_gc },
   { "close", WebSocket_close },
@@ -232,6 +322,7 @@ const luaL_Reg WebSocket_methods[] = {
 
 const Property WebSocket_properties[] = {
   { "url", WebSocket_get_url, nullptr },
+  { "bufferedAmount", WebSocket_get_bufferedAmount, nullptr },
   { nullptr, nullptr, nullptr }
 };
 
@@ -0,0 +1,271 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/session_recorder.h"
+
+#include "app/color.h"
+#include "app/commands/command.h"
+#include "app/commands/command_ids.h"
+#include "app/context.h"
+#include "app/doc.h"
+#include "app/pref/preferences.h"
+#include "app/site.h"
+#include "app/tools/ink_type.h"
+#include "app/tools/tool.h"
+#include "app/tools/tool_loop.h"
+#include "base/fstream_path.h"
+#include "doc/brush.h"
+#include "doc/layer.h"
+#include "doc/sprite.h"
+#include "fmt/format.h"
+
+#include <fstream>
+#include <memory>
+
+namespace app {
+
+namespace {
+
+// Functions used by the recorded events
+const char* kScriptHeader = R"(-- Session recorded with Aseprite, replay it with:
+--   aseprite -b --script session.lua
+-- Each event is measured and the latency percentiles of each kind of
+-- event are printed at the end.
+
+local times = {}
+
+local function replay(kind, func)
+  local t0 = os.clock()
+  func()
+  local list = times[kind]
+  if not list then
+    list = {}
+    times[kind] = list
+  end
+  table.insert(list, os.clock() - t0)
+end
+
+local function findLayer(layers, name)
+  for _,layer in ipairs(layers) do
+    if layer.name == name then return layer end
+    if layer.isGroup then
+      local child = findLayer(layer.layers, name)
+      if child then return child end
+    end
+  end
+end
+
+local function activateLayer(name)
+  local layer = findLayer(app.activeSprite.layers, name)
+  if layer then app.activeLayer = layer end
+end
+
+)";
+
+const char* kScriptFooter = R"(
+local function percentile(list, p)
+  return 1000 * list[math.max(1, math.ceil(#list * p))]
+end
+
+local kinds = {}
+for kind in pairs(times) do table.insert(kinds, kind) end
+table.sort(kinds)
+
+print(string.format("%-32s %6s %9s %9s %9s %9s",
+                    "event", "count", "p50 ms", "p90 ms", "p99 ms", "max ms"))
+for _,kind in ipairs(kinds) do
+  local list = times[kind]
+  table.sort(list)
+  print(string.format("%-32s %6d %9.2f %9.2f %9.2f %9.2f",
+                      kind, #list,
+                      percentile(list, 0.5),
+                      percentile(list, 0.9),
+                      percentile(list, 0.99),
+                      percentile(list, 1.0)))
+end
+)";
+
+std::string lua_string(const std::string& s)
+{
+  std::string result = "\"";
+  for (const char chr : s) {
+    switch (chr) {
+      case '\\': result += "\\\\"; break;
+      case '"':  result += "\\\""; break;
+      case '\n': result += "\\n"; break;
+      case '\r': result += "\\r"; break;
+      default:   result.push_back(chr); break;
+    }
+  }
+  result += "\"";
+  return result;
+}
+
+std::string lua_color(const app::Color& color)
+{
+  if (color.getType() == app::Color::IndexType)
+    return fmt::format("Color({})", color.getIndex());
+  else
+    return fmt::format("Color{{ r={}, g={}, b={}, a={} }}",
+                       color.getRed(), color.getGreen(),
+                       color.getBlue(), color.getAlpha());
+}
+
+} // anonymous namespace
+
+// static
+SessionRecorder* SessionRecorder::instance()
+{
+  static std::unique_ptr<SessionRecorder> singleton;
+  if (!singleton)
+    singleton.reset(new SessionRecorder);
+  return singleton.get();
+}
+
+SessionRecorder::SessionRecorder()
+  : m_ctx(nullptr)
+  , m_docId(doc::NullId)
+  , m_frame(0)
+{
+}
+
+void SessionRecorder::start(Context* ctx)
+{
+  ASSERT(!m_ctx);
+  m_ctx = ctx;
+  m_events.clear();
+  m_header.clear();
+  m_docId = doc::NullId;
+  m_frame = 0;
+
+  // Initial document of the session
+  if (Doc* doc = ctx->activeDocument()) {
+    const doc::Sprite* spr = doc->sprite();
+    if (doc->isAssociatedToFile())
+      m_header = fmt::format("app.open({})\n", lua_string(doc->filename()));
+    else
+      m_header = fmt::format("Sprite({}, {}, {})\n",
+                             spr->width(), spr->height(),
+                             int(spr->colorMode()));
+    m_docId = doc->id();
+    m_frame = ctx->activeSite().frame();
+    m_header += fmt::format("app.activeFrame = {}\n", m_frame+1);
+  }
+
+  m_afterCommandConn =
+    ctx->AfterCommandExecution.connect(&SessionRecorder::onAfterCommandExecution, this);
+  ctx->add_observer(this);
+}
+
+bool SessionRecorder::stop(const std::string& filename)
+{
+  ASSERT(m_ctx);
+  m_ctx->remove_observer(this);
+  m_afterCommandConn.disconnect();
+  m_ctx = nullptr;
+
+  std::ofstream f(FSTREAM_PATH(filename), std::ios::binary | std::ios::trunc);
+  f << kScriptHeader << m_header << "\n";
+  for (const std::string& event : m_events)
+    f << event;
+  f << kScriptFooter;
+  return bool(f);
+}
+
+void SessionRecorder::addStroke(tools::ToolLoop* toolLoop,
+                                const std::vector<gfx::Point>& points)
+{
+  if (!m_ctx || points.empty())
+    return;
+
+  tools::Tool* tool = toolLoop->getTool();
+  const doc::Brush* brush = toolLoop->getBrush();
+  auto& pref = Preferences::instance();
+
+  std::string code;
+  if (doc::Layer* layer = toolLoop->getLayer())
+    code += fmt::format("activateLayer({})\n", lua_string(layer->name()));
+  code += fmt::format("app.activeFrame = {}\n", toolLoop->getFrame()+1);
+
+  // Image brushes are replayed with a circle brush of the same size
+  // (the image is not saved in the script).
+  const int brushType = (brush->type() == doc::kImageBrushType ?
+                         int(doc::kCircleBrushType): int(brush->type()));
+
+  std::string pointsCode;
+  for (const gfx::Point& pt : points) {
+    if (!pointsCode.empty())
+      pointsCode += ", ";
+    pointsCode += fmt::format("Point({}, {})", pt.x, pt.y);
+  }
+
+  code += fmt::format(
+    "replay({}, function() app.useTool{{\n"
+    "  tool={}, ink={}, button={},\n"
+    "  color={}, bgColor={},\n"
+    "  brush=Brush{{ type={}, size={}, angle={} }}, opacity={},\n"
+    "  points={{ {} }} }} end)\n",
+    lua_string("stroke:" + tool->getId()),
+    lua_string(tool->getId()),
+    lua_string(tools::ink_type_to_string_id(pref.tool(tool).ink())),
+    (toolLoop->getMouseButton() == tools::ToolLoop::Right ?
+     "MouseButton.RIGHT": "MouseButton.LEFT"),
+    lua_color(pref.colorBar.fgColor()),
+    lua_color(pref.colorBar.bgColor()),
+    brushType, brush->size(), brush->angle(),
+    toolLoop->getOpacity(),
+    pointsCode);
+
+  m_events.push_back(std::move(code));
+}
+
+void SessionRecorder::onAfterCommandExecution(CommandExecutionEvent& ev)
+{
+  Command* command = ev.command();
+  if (ev.isCanceled() ||
+      // The debugger is used to start/stop the recording
+      command->id() == CommandId::Debugger())
+    return;
+
+  std::string params;
+  for (const auto& param : ev.params()) {
+    if (!params.empty())
+      params += ", ";
+    params += fmt::format("[{}]={}",
+                          lua_string(param.first),
+                          lua_string(param.second));
+  }
+
+  addEvent("command:" + command->id(),
+           fmt::format("app.command.{}{{ {} }}", command->id(), params));
+}
+
+void SessionRecorder::onActiveSiteChange(const Site& site)
+{
+  // Frame changes of the recorded document (e.g. timeline scrubbing)
+  if (!site.document() ||
+      site.document()->id() != m_docId ||
+      site.frame() == m_frame)
+    return;
+
+  m_frame = site.frame();
+  addEvent("frame",
+           fmt::format("app.activeFrame = {}", m_frame+1));
+}
+
+void SessionRecorder::addEvent(const std::string& kind,
+                               const std::string& code)
+{
+  m_events.push_back(
+    fmt::format("replay({}, function() {} end)\n",
+                lua_string(kind), code));
+}
+
+} // namespace app
@@ -0,0 +1,74 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_SESSION_RECORDER_H_INCLUDED
+#define APP_SESSION_RECORDER_H_INCLUDED
+#pragma once
+
+#include "app/context_observer.h"
+#include "doc/frame.h"
+#include "doc/object_id.h"
+#include "gfx/point.h"
+#include "obs/connection.h"
+
+#include <string>
+#include <vector>
+
+namespace app {
+  class CommandExecutionEvent;
+  class Context;
+
+  namespace tools {
+    class ToolLoop;
+  }
+
+  // Records the commands, strokes and frame changes of an editing
+  // session in a Lua script. The script can be replayed without UI
+  // (e.g. "aseprite -b --script session.lua"), it measures each
+  // replayed event and prints the latency percentiles of each kind
+  // of event (to compare the performance of two versions of the
+  // program with the same session).
+  class SessionRecorder : public ContextObserver {
+  public:
+    static SessionRecorder* instance();
+
+    bool isRecording() const { return m_ctx != nullptr; }
+    int recordedEvents() const { return int(m_events.size()); }
+
+    // Starts recording the session from the active document of the
+    // given context.
+    void start(Context* ctx);
+
+    // Stops recording and saves the script in the given file, returns
+    // false if the file cannot be saved.
+    bool stop(const std::string& filename);
+
+    // Called when a tool loop is finished with all its points (in
+    // sprite coordinates).
+    void addStroke(tools::ToolLoop* toolLoop,
+                   const std::vector<gfx::Point>& points);
+
+  private:
+    SessionRecorder();
+
+    void onAfterCommandExecution(CommandExecutionEvent& ev);
+
+    // ContextObserver impl
+    void onActiveSiteChange(const Site& site) override;
+
+    void addEvent(const std::string& kind, const std::string& code);
+
+    Context* m_ctx;
+    doc::ObjectId m_docId;
+    doc::frame_t m_frame;
+    std::string m_header;
+    std::vector<std::string> m_events;
+    obs::scoped_connection m_afterCommandConn;
+  };
+
+} // namespace app
+
+#endif
@@ -0,0 +1,26 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_SPRITE_SHEET_PACKING_H_INCLUDED
+#define APP_SPRITE_SHEET_PACKING_H_INCLUDED
+#pragma once
+
+namespace app {
+
+  // Heuristic used to choose the position of each sample in a
+  // SpriteSheetType::MaxRects sprite sheet.
+  enum class SpriteSheetPacking {
+    Skyline,                    // Skyline bottom-left (the fastest one)
+    BestShortSideFit,           // MaxRects (minimize the shortest leftover side)
+    BestLongSideFit,            // MaxRects (minimize the longest leftover side)
+    BestAreaFit,                // MaxRects (minimize the leftover area)
+    BottomLeft,                 // MaxRects (Tetris-like placement)
+    Default = Skyline
+  };
+
+} // namespace app
+
+#endif
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -16,7 +17,8 @@ namespace app {
     Vertical,
     Rows,
     Columns,
-    Packed
+    Packed,
+    MaxRects
   };
 
 } // namespace app
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -10,16 +10,12 @@
 
 #include "app/task.h"
 
-#include "base/task.h"
+#include "base/log.h"
 #include "base/thread.h"
-#include "base/thread_pool.h"
 
 namespace app {
 
-static base::thread_pool tasks_pool(4);
-
 Task::Task()
-  : m_token(nullptr)
 {
 }
 
@@ -27,17 +23,39 @@ Task::~Task()
 {
 }
 
-void Task::run(base::task::func_t&& func)
+void Task::run(base::task::func_t&& func,
+               const TaskPriority priority)
 {
-  std::lock_guard<std::mutex> lock(m_token_mutex);
-  m_task.on_execute(std::move(func));
-  m_token = &m_task.start(tasks_pool);
+  auto state = std::make_shared<State>();
+  {
+    std::lock_guard<std::mutex> lock(m_state_mutex);
+    m_state = state;
+  }
+
+  TaskScheduler::instance()->execute(
+    priority,
+    [state, func = std::move(func)]{
+      state->running = true;
+      try {
+        // The task could be canceled before it's started
+        if (!state->token.canceled())
+          func(state->token);
+      }
+      catch (const std::exception& ex) {
+        LOG(ERROR, "TASK: Exception running task: %s\n", ex.what());
+      }
+      state->running = false;
+      state->completed = true;
+    });
 }
 
 void Task::wait()
 {
   // TODO wait a condition variable
-  while (!m_task.completed()) {
+  while (true) {
+    auto state = this->state();
+    if (!state || state->completed)
+      break;
     base::this_thread::sleep_for(0.1);
   }
 }
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -8,63 +8,76 @@
 #define APP_TASK_H_INCLUDED
 #pragma once
 
+#include "app/task_scheduler.h"
 #include "base/task.h"
 
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <mutex>
 
 namespace app {
 
+  // A function executed in the TaskScheduler with a
+  // base::task_token to report its progress and check if it was
+  // canceled.
   class Task {
   public:
     Task();
     ~Task();
 
-    void run(base::task::func_t&& func);
+    void run(base::task::func_t&& func,
+             const TaskPriority priority = TaskPriority::Background);
     void wait();
 
     // Returns true when the task is completed (whether it was
     // canceled or not)
     bool completed() const {
-      return m_task.completed();
+      auto state = this->state();
+      return (state && state->completed);
     }
 
     bool running() const {
-      return m_task.running();
+      auto state = this->state();
+      return (state && state->running);
     }
 
     bool canceled() const {
-      std::lock_guard<std::mutex> lock(m_token_mutex);
-      if (m_token)
-        return m_token->canceled();
-      else
-        return false;
+      auto state = this->state();
+      return (state && state->token.canceled());
     }
 
     float progress() const {
-      std::lock_guard<std::mutex> lock(m_token_mutex);
-      if (m_token)
-        return m_token->progress();
-      else
-        return 0.0f;
+      auto state = this->state();
+      return (state ? state->token.progress(): 0.0f);
     }
 
     void cancel() {
-      std::lock_guard<std::mutex> lock(m_token_mutex);
-      if (m_token)
-        m_token->cancel();
+      if (auto state = this->state())
+        state->token.cancel();
     }
 
     void set_progress(float progress) {
-      std::lock_guard<std::mutex> lock(m_token_mutex);
-      if (m_token)
-        m_token->set_progress(progress);
+      if (auto state = this->state())
+        state->token.set_progress(progress);
     }
 
   private:
-    base::task m_task;
-    mutable std::mutex m_token_mutex;
-    base::task_token* m_token;
+    // Shared with the job in the scheduler (which can still be in
+    // the queue when the Task is destroyed)
+    struct State {
+      base::task_token token;
+      std::atomic<bool> running = { false };
+      std::atomic<bool> completed = { false };
+    };
+
+    std::shared_ptr<State> state() const {
+      std::lock_guard<std::mutex> lock(m_state_mutex);
+      return m_state;
+    }
+
+    mutable std::mutex m_state_mutex;
+    std::shared_ptr<State> m_state;
   };
 
 } // namespace app
@@ -0,0 +1,175 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/task_scheduler.h"
+
+#include <algorithm>
+
+namespace app {
+
+// Index of the worker of the current thread (or -1 if it's not a
+// worker thread)
+static thread_local int tls_workerIndex = -1;
+
+// static
+TaskScheduler* TaskScheduler::instance()
+{
+  static TaskScheduler scheduler;
+  return &scheduler;
+}
+
+TaskScheduler::TaskScheduler(int nthreads)
+  : m_nextWorker(0)
+  , m_pending(0)
+  , m_stop(false)
+{
+  if (nthreads <= 0)
+    nthreads = std::max<int>(1, std::thread::hardware_concurrency());
+
+  for (int i=0; i<nthreads; ++i)
+    m_workers.push_back(std::make_unique<Worker>());
+  for (int i=0; i<nthreads; ++i)
+    m_workers[i]->thread = std::thread([this, i]{ workerThread(i); });
+}
+
+TaskScheduler::~TaskScheduler()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wakeup.notify_all();
+
+  for (auto& worker : m_workers)
+    worker->thread.join();
+}
+
+int TaskScheduler::queuedJobs(const TaskPriority priority)
+{
+  int n = 0;
+  for (auto& worker : m_workers) {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    n += int(worker->queues[int(priority)].size());
+  }
+  return n;
+}
+
+void TaskScheduler::execute(const TaskPriority priority, Job&& job)
+{
+  // Jobs created from a worker are added to its own queue (they will
+  // be executed by the same thread if other workers are busy)
+  int i = tls_workerIndex;
+  if (i < 0 || i >= int(m_workers.size()))
+    i = (m_nextWorker++ % int(m_workers.size()));
+
+  {
+    Worker* worker = m_workers[i].get();
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->queues[int(priority)].push_back(std::move(job));
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_pending;
+  }
+  m_wakeup.notify_one();
+}
+
+void TaskScheduler::parallelFor(const int n,
+                                const std::function<void(int)>& func,
+                                const TaskPriority priority)
+{
+  if (n <= 0)
+    return;
+
+  // The state is shared with the queued jobs because some of them
+  // can start after this function returns (and they will find that
+  // there is nothing more to do).
+  struct State {
+    std::atomic<int> next;
+    std::atomic<int> done;
+    std::mutex mutex;
+    std::condition_variable finished;
+    State() : next(0), done(0) { }
+  };
+  auto state = std::make_shared<State>();
+
+  // Only "func" of this function is accessed from the workers while
+  // there are items to be processed (i.e. before this function
+  // returns)
+  auto process = [state, n, &func]{
+    for (int i=state->next++; i<n; i=state->next++) {
+      func(i);
+      if (++state->done == n) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->finished.notify_all();
+      }
+    }
+  };
+
+  const int nhelpers = std::min<int>(n, threads()) - 1;
+  for (int i=0; i<nhelpers; ++i)
+    execute(priority, process);
+  process();                    // Use this thread too
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->finished.wait(lock, [&state, n]{ return state->done == n; });
+}
+
+void TaskScheduler::workerThread(const int i)
+{
+  tls_workerIndex = i;
+
+  while (true) {
+    Job job;
+    if (popJob(i, job)) {
+      --m_pending;
+      job();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_wakeup.wait(lock, [this]{ return m_stop || m_pending > 0; });
+    if (m_stop)
+      break;
+  }
+}
+
+bool TaskScheduler::popJob(const int i, Job& job)
+{
+  const int n = int(m_workers.size());
+  for (int p=0; p<kPriorities; ++p) {
+    // Last job of our own queue
+    {
+      Worker* worker = m_workers[i].get();
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      auto& queue = worker->queues[p];
+      if (!queue.empty()) {
+        job = std::move(queue.back());
+        queue.pop_back();
+        return true;
+      }
+    }
+
+    // Steal the first job of other workers
+    for (int j=1; j<n; ++j) {
+      Worker* worker = m_workers[(i+j) % n].get();
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      auto& queue = worker->queues[p];
+      if (!queue.empty()) {
+        job = std::move(queue.front());
+        queue.pop_front();
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+} // namespace app
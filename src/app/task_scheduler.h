@@ -0,0 +1,81 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_TASK_SCHEDULER_H_INCLUDED
+#define APP_TASK_SCHEDULER_H_INCLUDED
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace app {
+
+  enum class TaskPriority {
+    Interactive,                // The user is waiting the result
+    Background,                 // Long tasks started by the user
+    Idle,                       // Work that can be done later (thumbnails, etc.)
+  };
+
+  // App-wide pool of worker threads (one per hardware thread) used
+  // by app::Task and the parallel algorithms, so they don't create
+  // their own threads. Each worker has a queue of jobs for each
+  // priority: a worker executes the last job of its own queue, and
+  // when it's empty, it steals the first job of the queue of other
+  // workers (jobs with higher priority are executed first).
+  class TaskScheduler {
+  public:
+    using Job = std::function<void()>;
+
+    static TaskScheduler* instance();
+
+    explicit TaskScheduler(int nthreads = 0);
+    ~TaskScheduler();
+
+    int threads() const { return int(m_workers.size()); }
+
+    // Number of jobs with the given priority waiting in the queues.
+    int queuedJobs(const TaskPriority priority);
+
+    void execute(const TaskPriority priority, Job&& job);
+
+    // Calls func(i) for each i in [0, n) using this thread and the
+    // workers (without creating new threads). Returns when all items
+    // are processed. It can be called from a worker thread too (this
+    // thread always processes items, so it cannot wait forever for
+    // busy workers).
+    void parallelFor(const int n,
+                     const std::function<void(int)>& func,
+                     const TaskPriority priority = TaskPriority::Interactive);
+
+  private:
+    static constexpr int kPriorities = 3;
+
+    struct Worker {
+      std::mutex mutex;
+      std::deque<Job> queues[kPriorities];
+      std::thread thread;
+    };
+
+    void workerThread(const int i);
+    bool popJob(const int i, Job& job);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<int> m_nextWorker;
+    std::atomic<int> m_pending;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    bool m_stop;
+  };
+
+} // namespace app
+
+#endif
@@ -16,12 +16,20 @@
 #include "app/doc.h"
 #include "app/file/file.h"
 #include "app/file_system.h"
+#include "app/resource_finder.h"
+#include "app/task.h"
 #include "app/util/conversion_to_surface.h"
 #include "base/clamp.h"
+#include "base/fs.h"
+#include "base/fstream_path.h"
+#include "base/serialization.h"
 #include "base/thread.h"
+#include "base/time.h"
 #include "doc/algorithm/rotate.h"
 #include "doc/image.h"
+#include "doc/image_io.h"
 #include "doc/palette.h"
+#include "doc/palette_io.h"
 #include "doc/primitives.h"
 #include "doc/sprite.h"
 #include "os/system.h"
@@ -31,21 +39,175 @@
 
 #include <algorithm>
 #include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <functional>
 #include <memory>
-#include <thread>
 
-#define MAX_THUMBNAIL_SIZE   128
+#define MAX_THUMBNAIL_SIZE   FILE_THUMBNAIL_SIZE
 #define THUMB_TRACE(...)
 
 namespace app {
 
+namespace {
+
+using namespace base::serialization;
+using namespace base::serialization::little_endian;
+
+// Thumbnails are saved in the user folder (thumbnails/) so big files
+// aren't decoded again each time the file selector is displayed.
+const uint32_t kCacheMagicNumber = 0x4d485441; // "ATHM"
+const uint32_t kCacheVersion = 1;
+const size_t kMaxCachedThumbnails = 4096;
+
+// Identifies the version of the file that was used to generate the
+// cached thumbnail (if the file is modified the cache is not used)
+struct CacheKey {
+  std::string path;
+  base::Time mtime;
+  size_t size = 0;
+
+  explicit CacheKey(const std::string& path)
+    : path(path)
+    , mtime(base::get_modification_time(path))
+    , size(base::file_size(path)) {
+  }
+};
+
+std::string cache_filename(const std::string& cacheDir,
+                           const CacheKey& key)
+{
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%016llx.thumb",
+                (unsigned long long)std::hash<std::string>()(key.path));
+  return base::join_path(cacheDir, buf);
+}
+
+void write_cache_key(std::ostream& os, const CacheKey& key)
+{
+  write32(os, kCacheMagicNumber);
+  write32(os, kCacheVersion);
+  write32(os, uint32_t(key.path.size()));
+  os.write(key.path.c_str(), key.path.size());
+  write16(os, key.mtime.year);
+  write8(os, key.mtime.month);
+  write8(os, key.mtime.day);
+  write8(os, key.mtime.hour);
+  write8(os, key.mtime.minute);
+  write8(os, key.mtime.second);
+  write32(os, uint32_t(uint64_t(key.size) & 0xffffffff));
+  write32(os, uint32_t(uint64_t(key.size) >> 32));
+}
+
+bool read_and_compare_cache_key(std::istream& is, const CacheKey& key)
+{
+  if (read32(is) != kCacheMagicNumber ||
+      read32(is) != kCacheVersion)
+    return false;
+
+  const uint32_t n = read32(is);
+  if (n != key.path.size())
+    return false;
+  std::string path(n, 0);
+  is.read(&path[0], n);
+  if (path != key.path)
+    return false;
+
+  base::Time mtime;
+  mtime.year = read16(is);
+  mtime.month = read8(is);
+  mtime.day = read8(is);
+  mtime.hour = read8(is);
+  mtime.minute = read8(is);
+  mtime.second = read8(is);
+  uint64_t size = read32(is);
+  size |= uint64_t(read32(is)) << 32;
+
+  return (is.good() &&
+          mtime == key.mtime &&
+          size == key.size);
+}
+
+bool load_cached_thumbnail(const std::string& cacheDir,
+                           const CacheKey& key,
+                           std::unique_ptr<Image>& image,
+                           std::unique_ptr<Palette>& palette)
+{
+  if (cacheDir.empty())
+    return false;
+
+  std::ifstream is(FSTREAM_PATH(cache_filename(cacheDir, key)),
+                   std::ifstream::binary);
+  if (!is.good() ||
+      !read_and_compare_cache_key(is, key))
+    return false;
+
+  image.reset(doc::read_image(is, false));
+  palette.reset(doc::read_palette(is));
+  return (image && palette);
+}
+
+void save_cached_thumbnail(const std::string& cacheDir,
+                           const CacheKey& key,
+                           const Image* image,
+                           const Palette* palette)
+{
+  if (cacheDir.empty())
+    return;
+
+  const std::string fn = cache_filename(cacheDir, key);
+  std::ofstream os(FSTREAM_PATH(fn), std::ofstream::binary);
+  if (!os.good())
+    return;
+
+  write_cache_key(os, key);
+  doc::write_image(os, image);
+  doc::write_palette(os, palette);
+  os.close();
+
+  // Don't keep incomplete thumbnails (e.g. the disk is full)
+  if (os.fail()) {
+    try { base::delete_file(fn); }
+    catch (const std::exception&) { }
+  }
+}
+
+// Deletes the oldest cached thumbnails when there are too many of
+// them.
+void prune_thumbnails_cache(const std::string& cacheDir)
+{
+  auto files = base::list_files(cacheDir);
+  if (files.size() <= kMaxCachedThumbnails)
+    return;
+
+  std::vector<std::pair<base::Time, std::string>> items;
+  for (const auto& fn : files) {
+    const std::string path = base::join_path(cacheDir, fn);
+    if (base::get_file_extension(path) == "thumb")
+      items.emplace_back(base::get_modification_time(path), path);
+  }
+  if (items.size() <= kMaxCachedThumbnails)
+    return;
+
+  std::sort(items.begin(), items.end());
+  for (size_t i=0; i<items.size()-kMaxCachedThumbnails/2; ++i) {
+    try { base::delete_file(items[i].second); }
+    catch (const std::exception&) { }
+  }
+}
+
+} // anonymous namespace
+
 class ThumbnailGenerator::Worker {
 public:
-  Worker(base::concurrent_queue<ThumbnailGenerator::Item>& queue)
+  Worker(base::concurrent_queue<ThumbnailGenerator::Item>& queue,
+         const std::string& cacheDir)
     : m_queue(queue)
+    , m_cacheDir(cacheDir)
     , m_fop(nullptr)
-    , m_isDone(false)
-    , m_thread([this]{ loadBgThread(); }) {
+    , m_isDone(false) {
+    m_task.run([this](base::task_token&){ loadBgThread(); },
+               TaskPriority::Idle);
   }
 
   ~Worker() {
@@ -54,7 +216,7 @@ public:
       if (m_fop)
         m_fop->stop();
     }
-    m_thread.join();
+    m_task.wait();
   }
 
   void stop() const {
@@ -89,20 +251,37 @@ private:
       THUMB_TRACE("FOP loading thumbnail: %s\n",
                   m_item.fileitem->fileName().c_str());
 
-      // Load the file
-      m_fop->operate(nullptr);
+      // Use the thumbnail from the disk cache if the file wasn't
+      // modified since it was generated (we avoid decoding the file)
+      const CacheKey key(m_item.fileitem->fileName());
+      std::unique_ptr<Image> thumbnailImage;
+      std::unique_ptr<Palette> palette;
+      bool cached = false;
+      try {
+        cached = load_cached_thumbnail(m_cacheDir, key,
+                                       thumbnailImage, palette);
+      }
+      catch (const std::exception&) {
+        // Invalid cache file, we'll generate the thumbnail again
+      }
+      if (!cached) {
+        thumbnailImage.reset();
+        palette.reset();
+
+        // Load the file
+        m_fop->operate(nullptr);
+      }
 
       // Don't call post-load because postLoad() needs user interaction.
       //m_fop->postLoad();
 
       // Convert the loaded document into the os::Surface.
       const Sprite* sprite =
-        (m_fop->document() &&
+        (!cached &&
+         m_fop->document() &&
          m_fop->document()->sprite() ?
          m_fop->document()->sprite(): nullptr);
 
-      std::unique_ptr<Image> thumbnailImage;
-      std::unique_ptr<Palette> palette;
       if (!m_fop->isStop() && sprite) {
         // The palette to convert the Image
         palette.reset(new Palette(*sprite->palette(frame_t(0))));
@@ -129,19 +308,37 @@ private:
         thumb_w = base::clamp(thumb_w, 1, MAX_THUMBNAIL_SIZE);
         thumb_h = base::clamp(thumb_h, 1, MAX_THUMBNAIL_SIZE);
 
-        // Stretch the 'image'
-        thumbnailImage.reset(
-          Image::create(
-            sprite->pixelFormat(), thumb_w, thumb_h));
-
-        render::Projection proj(sprite->pixelRatio(),
-                                render::Zoom(thumb_w, w));
-        render::Render render;
-        render.setBgType(render::BgType::TRANSPARENT);
-        render.setProjection(proj);
-        render.renderSprite(
-          thumbnailImage.get(), sprite, frame_t(0),
-          gfx::Clip(0, 0, 0, 0, w, h));
+        // Thumbnail embedded in the file (the pixel ratio is already
+        // applied), so we don't need to render the sprite
+        const ImageRef& embedded = m_fop->embeddedThumbnail();
+        if (embedded) {
+          thumbnailImage.reset(
+            Image::create(
+              embedded->pixelFormat(), thumb_w, thumb_h));
+
+          render::Render render;
+          render.setProjection(
+            render::Projection(doc::PixelRatio(1, 1),
+                               render::Zoom(thumb_w, embedded->width())));
+          render.renderImage(
+            thumbnailImage.get(), embedded.get(), palette.get(),
+            0, 0, 255, doc::BlendMode::SRC);
+        }
+        else {
+          // Stretch the 'image'
+          thumbnailImage.reset(
+            Image::create(
+              sprite->pixelFormat(), thumb_w, thumb_h));
+
+          render::Projection proj(sprite->pixelRatio(),
+                                  render::Zoom(thumb_w, w));
+          render::Render render;
+          render.setBgType(render::BgType::TRANSPARENT);
+          render.setProjection(proj);
+          render.renderSprite(
+            thumbnailImage.get(), sprite, frame_t(0),
+            gfx::Clip(0, 0, 0, 0, w, h));
+        }
 
         // Convert the image to sRGB color space
         auto cs = sprite->colorSpace();
@@ -156,6 +353,10 @@ private:
       // Close file
       delete m_fop->releaseDocument();
 
+      if (!cached && thumbnailImage && palette)
+        save_cached_thumbnail(m_cacheDir, key,
+                              thumbnailImage.get(), palette.get());
+
       // Set the thumbnail of the file-item.
       if (thumbnailImage) {
         os::SurfaceRef thumbnail =
@@ -223,11 +424,12 @@ private:
   }
 
   base::concurrent_queue<Item>& m_queue;
+  std::string m_cacheDir;
   app::ThumbnailGenerator::Item m_item;
   FileOp* m_fop;
   mutable std::mutex m_mutex;
   std::atomic<bool> m_isDone;
-  std::thread m_thread;
+  Task m_task;
 };
 
 ThumbnailGenerator* ThumbnailGenerator::instance()
@@ -245,9 +447,23 @@ ThumbnailGenerator* ThumbnailGenerator::instance()
 
 ThumbnailGenerator::ThumbnailGenerator()
 {
-  int n = std::thread::hardware_concurrency()-1;
+  // Keep one worker of the TaskScheduler for other tasks
+  int n = TaskScheduler::instance()->threads()-1;
   if (n < 1) n = 1;
   m_maxWorkers = n;
+
+  try {
+    ResourceFinder rf;
+    rf.includeUserDir(base::join_path("thumbnails", ".").c_str());
+    m_cacheDir = rf.getFirstOrCreateDefault();
+    if (!base::is_directory(m_cacheDir))
+      base::make_all_directories(m_cacheDir);
+    prune_thumbnails_cache(m_cacheDir);
+  }
+  catch (const std::exception&) {
+    // Without cache, the thumbnails are generated each time
+    m_cacheDir.clear();
+  }
 }
 
 bool ThumbnailGenerator::checkWorkers()
@@ -309,7 +525,8 @@ void ThumbnailGenerator::generateThumbnail(IFileItem* fileitem)
       nullptr,
       fileitem->fileName().c_str(),
       FILE_LOAD_SEQUENCE_NONE |
-      FILE_LOAD_ONE_FRAME));
+      FILE_LOAD_ONE_FRAME |
+      FILE_LOAD_THUMBNAIL));
   if (!fop || fop->hasError()) {
     // Set a nullptr thumbnail so we don't try to generate a thumbnail
     // for this fileitem again.
@@ -343,11 +560,36 @@ void ThumbnailGenerator::stopAllWorkers()
     worker->stop();
 }
 
+void ThumbnailGenerator::discardThumbnails(
+  const std::function<bool(IFileItem*)>& isNeeded)
+{
+  std::vector<Item> items;
+  Item item;
+  while (m_remainingItems.try_pop(item))
+    items.push_back(item);
+
+  for (const Item& item : items) {
+    if (isNeeded(item.fileitem)) {
+      m_remainingItems.push(item);
+    }
+    else {
+      // The FileOp wasn't used, so we can generate the thumbnail
+      // again when the item is needed.
+      item.fileitem->setThumbnailProgress(0.0);
+      delete item.fop;
+    }
+  }
+
+  // Some worker could be finished while the queue was empty
+  if (!m_remainingItems.empty())
+    startWorker();
+}
+
 void ThumbnailGenerator::startWorker()
 {
   std::lock_guard<std::mutex> hold(m_workersAccess);
   if (m_workers.size() < m_maxWorkers) {
-    m_workers.push_back(std::make_unique<Worker>(m_remainingItems));
+    m_workers.push_back(std::make_unique<Worker>(m_remainingItems, m_cacheDir));
   }
 }
 
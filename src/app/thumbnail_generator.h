@@ -11,8 +11,10 @@
 
 #include "base/concurrent_queue.h"
 
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
 namespace base {
@@ -43,6 +45,12 @@ namespace app {
     // thread.
     void stopAllWorkers();
 
+    // Removes from the queue the file-items that are not needed
+    // anymore (e.g. they aren't visible after scrolling the file
+    // list). Thumbnails that are being generated are not stopped. It
+    // must be called from the GUI thread.
+    void discardThumbnails(const std::function<bool(IFileItem*)>& isNeeded);
+
   private:
     void startWorker();
 
@@ -61,6 +69,7 @@ namespace app {
     };
 
     int m_maxWorkers;
+    std::string m_cacheDir;
     WorkerList m_workers;
     std::mutex m_workersAccess;
     base::concurrent_queue<Item> m_remainingItems;
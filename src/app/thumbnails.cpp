@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2018  David Capello
 // Copyright (C) 2016  Carlo Caputo
 //
@@ -10,28 +10,182 @@
 #include "config.h"
 #endif
 
+#include "app/thumbnails.h"
+
+#include "app/cache_manager.h"
+#include "app/doc.h"
 #include "app/util/conversion_to_surface.h"
+#include "base/clamp.h"
 #include "doc/blend_mode.h"
 #include "doc/cel.h"
 #include "doc/layer.h"
+#include "doc/palette.h"
 #include "doc/sprite.h"
 #include "os/surface.h"
 #include "os/system.h"
 #include "render/render.h"
+#include "ui/system.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 namespace app {
 namespace thumb {
 
-os::SurfaceRef get_cel_thumbnail(const doc::Cel* cel,
-                                 const gfx::Size& fitInSize)
+namespace {
+
+// Maximum number of thumbnails in the cache
+const size_t kMaxCachedThumbnails = 1024;
+
+// Maximum number of thumbnails waiting to be rendered in background,
+// older requests are discarded (e.g. cels that were visible in the
+// timeline before scrolling)
+const size_t kMaxPendingThumbnails = 256;
+
+// Milliseconds to wait the document read lock in the background
+// thread (the thumbnail is requested again in the next paint if we
+// cannot lock the document)
+const int kReadLockTimeout = 250;
+
+// Everything that can change the thumbnail of a cel. The image
+// version and palette modifications change each time they are
+// modified, so old entries are never used again and are discarded by
+// the LRU policy.
+struct ThumbnailKey {
+  doc::ObjectId imageId;
+  doc::ObjectVersion imageVersion;
+  doc::ObjectId paletteId;
+  int paletteModifications;
+  gfx::Size celSize;
+  gfx::Size fitInSize;
+  doc::PixelRatio pixelRatio;
+
+  bool operator<(const ThumbnailKey& o) const {
+    return
+      std::tie(imageId, imageVersion, paletteId, paletteModifications,
+               celSize.w, celSize.h, fitInSize.w, fitInSize.h,
+               pixelRatio.w, pixelRatio.h) <
+      std::tie(o.imageId, o.imageVersion, o.paletteId, o.paletteModifications,
+               o.celSize.w, o.celSize.h, o.fitInSize.w, o.fitInSize.h,
+               o.pixelRatio.w, o.pixelRatio.h);
+  }
+};
+
+// LRU cache of thumbnails (used from the UI thread only)
+class ThumbnailsCache : public ManagedCache {
+public:
+  ThumbnailsCache() {
+    CacheManager::instance()->add(this);
+  }
+
+  ~ThumbnailsCache() {
+    CacheManager::instance()->remove(this);
+  }
+
+  os::SurfaceRef get(const ThumbnailKey& key) {
+    auto it = m_map.find(key);
+    if (it == m_map.end())
+      return nullptr;
+
+    // Move to the front (most recently used)
+    m_list.splice(m_list.begin(), m_list, it->second);
+    it->second->used = base::current_tick();
+    return it->second->surface;
+  }
+
+  void clear() {
+    m_map.clear();
+    m_list.clear();
+    m_bytes = 0;
+  }
+
+  void add(const ThumbnailKey& key, const os::SurfaceRef& surface) {
+    auto it = m_map.find(key);
+    if (it != m_map.end()) {
+      m_bytes -= surfaceBytes(it->second->surface);
+      m_list.erase(it->second);
+    }
+
+    m_list.push_front(Item{ key, surface, base::current_tick() });
+    m_map[key] = m_list.begin();
+    m_bytes += surfaceBytes(surface);
+
+    while (m_list.size() > kMaxCachedThumbnails)
+      evictOldestCacheEntry();
+  }
+
+  // ManagedCache impl
+  const char* cacheName() const override { return "Cel thumbnails"; }
+  std::size_t cacheBytes() const override { return m_bytes; }
+
+  bool cacheOldestUse(base::tick_t& tick) const override {
+    if (m_list.empty())
+      return false;
+    tick = m_list.back().used;
+    return true;
+  }
+
+  void evictOldestCacheEntry() override {
+    if (m_list.empty())
+      return;
+    m_bytes -= surfaceBytes(m_list.back().surface);
+    m_map.erase(m_list.back().key);
+    m_list.pop_back();
+  }
+
+private:
+  struct Item {
+    ThumbnailKey key;
+    os::SurfaceRef surface;
+    base::tick_t used;
+  };
+
+  static std::size_t surfaceBytes(const os::SurfaceRef& surface) {
+    return std::size_t(surface->width()) * surface->height() * 4;
+  }
+
+  std::list<Item> m_list;
+  std::map<ThumbnailKey, std::list<Item>::iterator> m_map;
+  std::size_t m_bytes = 0;
+};
+
+ThumbnailsCache g_cache;
+
+// The image version identifies its pixels, so all code that modifies
+// the pixels of a cel image must increment its version (cmd::CopyRect,
+// cmd::CopyRegion, or the script Image functions that write pixels
+// directly) or the old thumbnail will be used.
+ThumbnailKey make_key(const doc::Cel* cel,
+                      const doc::Palette* palette,
+                      const gfx::Size& fitInSize)
+{
+  return ThumbnailKey {
+    cel->image()->id(), cel->image()->version(),
+    palette->id(), palette->getModifications(),
+    cel->bounds().size(), fitInSize,
+    cel->sprite()->pixelRatio()
+  };
+}
+
+os::SurfaceRef render_thumbnail(const doc::Image* image,
+                                const doc::Palette* palette,
+                                const ThumbnailKey& key)
 {
   gfx::Size newSize;
 
-  if (cel->bounds().w > fitInSize.w ||
-      cel->bounds().h > fitInSize.h)
-    newSize = gfx::Rect(cel->bounds()).fitIn(gfx::Rect(fitInSize)).size();
+  if (key.celSize.w > key.fitInSize.w ||
+      key.celSize.h > key.fitInSize.h)
+    newSize = gfx::Rect(key.celSize).fitIn(gfx::Rect(key.fitInSize)).size();
   else
-    newSize = cel->bounds().size();
+    newSize = key.celSize;
 
   if (newSize.w < 1 ||
       newSize.h < 1)
@@ -42,20 +196,17 @@ os::SurfaceRef get_cel_thumbnail(const doc::Cel* cel,
       doc::IMAGE_RGB, newSize.w, newSize.h));
 
   render::Render render;
-  render::Projection proj(cel->sprite()->pixelRatio(),
-                          render::Zoom(newSize.w, cel->image()->width()));
+  render::Projection proj(key.pixelRatio,
+                          render::Zoom(newSize.w, image->width()));
   render.setProjection(proj);
 
-  const doc::Palette* palette = cel->sprite()->palette(cel->frame());
-  render.renderCel(
+  // We don't need the sprite to render the cel image (and it cannot
+  // be used from a background thread)
+  render.renderImage(
     thumbnailImage.get(),
-    cel->sprite(),
-    cel->image(),
-    cel->layer(),
+    image,
     palette,
-    gfx::Rect(gfx::Point(0, 0), cel->bounds().size()),
-    gfx::Clip(gfx::Rect(gfx::Point(0, 0), newSize)),
-    255, doc::BlendMode::NORMAL);
+    0, 0, 255, doc::BlendMode::NORMAL);
 
   if (os::SurfaceRef thumbnail = os::instance()->makeRgbaSurface(
         thumbnailImage->width(),
@@ -69,5 +220,184 @@ os::SurfaceRef get_cel_thumbnail(const doc::Cel* cel,
     return nullptr;
 }
 
+// Renders thumbnails in background threads. Requests are added and
+// canceled from the UI thread, and the results are added to the
+// cache in the UI thread too.
+class ThumbnailsRenderer {
+public:
+  static ThumbnailsRenderer* instance() {
+    static ThumbnailsRenderer renderer;
+    return &renderer;
+  }
+
+  ~ThumbnailsRenderer() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_exit = true;
+      m_queue.clear();
+    }
+    m_cv.notify_all();
+    for (auto& thread : m_threads)
+      thread.join();
+  }
+
+  void enqueue(Doc* doc,
+               const doc::Cel* cel,
+               const doc::Palette* palette,
+               const ThumbnailKey& key,
+               std::function<void()>&& onReady) {
+    auto it = m_pending.find(key);
+    if (it != m_pending.end()) {
+      it->second = std::move(onReady);
+      return;
+    }
+    m_pending[key] = std::move(onReady);
+
+    Request req;
+    req.key = key;
+    req.doc = doc;
+    req.image = cel->imageRef();
+    req.palette = std::make_shared<doc::Palette>(*palette);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_queue.push_back(std::move(req));
+      while (m_queue.size() > kMaxPendingThumbnails) {
+        m_pending.erase(m_queue.front().key);
+        m_queue.pop_front();
+      }
+      if (m_threads.empty()) {
+        const int n = base::clamp(int(std::thread::hardware_concurrency())-1, 1, 4);
+        for (int i=0; i<n; ++i)
+          m_threads.emplace_back([this]{ threadLoop(); });
+      }
+    }
+    m_cv.notify_one();
+  }
+
+  // Discards all the pending requests and waits the ones that are
+  // being rendered, so the documents can be safely deleted.
+  void cancelAll() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_queue.clear();
+    m_idle.wait(lock, [this]{ return m_running == 0; });
+    m_pending.clear();
+  }
+
+private:
+  struct Request {
+    ThumbnailKey key;
+    Doc* doc;
+    doc::ImageRef image;
+    std::shared_ptr<doc::Palette> palette;
+  };
+
+  ThumbnailsRenderer() { }
+
+  void threadLoop() {
+    while (true) {
+      Request req;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]{ return m_exit || !m_queue.empty(); });
+        if (m_exit)
+          break;
+
+        // Newest requests first (probably the visible ones)
+        req = std::move(m_queue.back());
+        m_queue.pop_back();
+        ++m_running;
+      }
+
+      os::SurfaceRef thumbnail;
+      if (req.doc->readLock(kReadLockTimeout)) {
+        try {
+          thumbnail = render_thumbnail(req.image.get(),
+                                       req.palette.get(), req.key);
+        }
+        catch (const std::exception&) {
+          // Ignore errors, the thumbnail is not displayed
+        }
+        req.image.reset();
+        req.doc->unlock();
+      }
+
+      const ThumbnailKey key = req.key;
+      ui::execute_from_ui_thread(
+        [this, key, thumbnail]{
+          onRendered(key, thumbnail);
+        });
+
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_running;
+      }
+      m_idle.notify_all();
+    }
+  }
+
+  // Called from the UI thread
+  void onRendered(const ThumbnailKey& key,
+                  const os::SurfaceRef& thumbnail) {
+    auto it = m_pending.find(key);
+    if (it == m_pending.end())
+      return;                   // Canceled request
+
+    std::function<void()> onReady = std::move(it->second);
+    m_pending.erase(it);
+    if (thumbnail)
+      g_cache.add(key, thumbnail);
+    if (onReady)
+      onReady();
+  }
+
+  // Accessed from the UI thread only
+  std::map<ThumbnailKey, std::function<void()>> m_pending;
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::condition_variable m_idle;
+  std::deque<Request> m_queue;
+  std::vector<std::thread> m_threads;
+  int m_running = 0;
+  bool m_exit = false;
+};
+
+} // anonymous namespace
+
+os::SurfaceRef get_cel_thumbnail(const doc::Cel* cel,
+                                 const gfx::Size& fitInSize)
+{
+  const doc::Palette* palette = cel->sprite()->palette(cel->frame());
+  const ThumbnailKey key = make_key(cel, palette, fitInSize);
+  if (os::SurfaceRef thumbnail = g_cache.get(key))
+    return thumbnail;
+
+  os::SurfaceRef thumbnail = render_thumbnail(cel->image(), palette, key);
+  if (thumbnail)
+    g_cache.add(key, thumbnail);
+  return thumbnail;
+}
+
+os::SurfaceRef get_cel_thumbnail_async(const doc::Cel* cel,
+                                       const gfx::Size& fitInSize,
+                                       std::function<void()>&& onReady)
+{
+  const doc::Palette* palette = cel->sprite()->palette(cel->frame());
+  const ThumbnailKey key = make_key(cel, palette, fitInSize);
+  if (os::SurfaceRef thumbnail = g_cache.get(key))
+    return thumbnail;
+
+  ThumbnailsRenderer::instance()->enqueue(
+    static_cast<Doc*>(cel->document()),
+    cel, palette, key, std::move(onReady));
+  return nullptr;
+}
+
+void clear_cache()
+{
+  ThumbnailsRenderer::instance()->cancelAll();
+  g_cache.clear();
+}
+
 } // thumb
 } // app
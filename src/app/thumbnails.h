@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2016  Carlo Caputo
 //
 // This program is distributed under the terms of
@@ -12,6 +12,8 @@
 #include "gfx/size.h"
 #include "os/surface.h"
 
+#include <functional>
+
 namespace doc {
   class Cel;
 }
@@ -26,6 +28,20 @@ namespace thumb {
   os::SurfaceRef get_cel_thumbnail(const doc::Cel* cel,
                                    const gfx::Size& fitInSize);
 
+  // Returns the cached thumbnail of the cel, or nullptr if it's not
+  // ready yet. In that case the thumbnail is rendered in a background
+  // thread and onReady() is called from the UI thread when it's
+  // available (so the caller can invalidate the area where the
+  // thumbnail is displayed and call this function again).
+  os::SurfaceRef get_cel_thumbnail_async(const doc::Cel* cel,
+                                         const gfx::Size& fitInSize,
+                                         std::function<void()>&& onReady);
+
+  // Releases all the cached thumbnails and cancels the pending ones
+  // (e.g. when a document is closed, or before the os::System is
+  // destroyed).
+  void clear_cache();
+
 } // thumb
 } // app
 
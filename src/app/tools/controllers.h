@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -59,8 +59,13 @@ public:
 
   Stroke::Pt getLastPoint() const override { return m_last; }
 
+  void prepareController(ToolLoop* loop) override {
+    m_newPoints = 0;
+  }
+
   void pressButton(ToolLoop* loop, Stroke& stroke, const Stroke::Pt& pt) override {
     m_last = pt;
+    m_newPoints = 0;
     stroke.addPoint(pt);
   }
 
@@ -70,6 +75,7 @@ public:
 
   void movement(ToolLoop* loop, Stroke& stroke, const Stroke::Pt& pt) override {
     m_last = pt;
+    ++m_newPoints;
     stroke.addPoint(pt);
   }
 
@@ -78,13 +84,18 @@ public:
       output.addPoint(input[0]);
     }
     else if (input.size() >= 2) {
-      // The freehand controller returns only the last two points to
+      // The freehand controller returns only the last points to
       // interwine because we accumulate (TracePolicy::Accumulate) the
       // previously painted points (i.e. don't want to redraw all the
-      // stroke from the very beginning)
-      output.addPoint(input[input.size()-2]);
-      output.addPoint(input[input.size()-1]);
+      // stroke from the very beginning). These are the points added
+      // since the last call (several points if the movements were
+      // queued, see ToolLoopManager::queueMovement()) plus the
+      // previous one to join them.
+      const int n = std::min(input.size(), std::max(2, m_newPoints+1));
+      for (int i=input.size()-n; i<input.size(); ++i)
+        output.addPoint(input[i]);
     }
+    m_newPoints = 0;
   }
 
   void getStatusBarText(ToolLoop* loop, const Stroke& stroke, std::string& text) override {
@@ -104,6 +115,8 @@ public:
 
 private:
   Stroke::Pt m_last;
+  // Number of points added since the last getStrokeToInterwine()
+  int m_newPoints = 0;
 };
 
 // Controls clicks for tools like line
@@ -500,6 +513,7 @@ public:
       }
       else {
         m_controller = &m_freehand;
+        m_freehand.prepareController(loop);
       }
       return;                   // Don't send first pressButton() click to the freehand controller
     }
@@ -23,6 +23,8 @@
 #include "render/dithering.h"
 #include "render/gradient.h"
 
+#include <algorithm>
+
 namespace app {
 namespace tools {
 
@@ -82,7 +84,14 @@ public:
     }
 
     static_cast<Derived*>(this)->initIterators(loop, x1, y);
-    for (x=x1; x<=x2; ++x) {
+    static_cast<Derived*>(this)->processRow(x1, y, x2);
+  }
+
+  // Processes all pixels from x1 to x2 (without mask) after
+  // initIterators(). Inks can hide this member function to process
+  // the whole row at once (e.g. with a fill or a row blender).
+  void processRow(int x1, int y, int x2) {
+    for (int x=x1; x<=x2; ++x) {
       static_cast<Derived*>(this)->processPixel(x, y);
       static_cast<Derived*>(this)->moveIterators();
     }
@@ -147,6 +156,11 @@ public:
     *SimpleInkProcessing<CopyInkProcessing<ImageTraits>, ImageTraits>::m_dstAddress = m_color;
   }
 
+  void processRow(int x1, int y, int x2) {
+    auto dst = SimpleInkProcessing<CopyInkProcessing<ImageTraits>, ImageTraits>::m_dstAddress;
+    std::fill(dst, dst+x2-x1+1, typename ImageTraits::pixel_t(m_color));
+  }
+
 private:
   color_t m_color;
 };
@@ -170,6 +184,10 @@ public:
     // Do nothing
   }
 
+  void processRow(int x1, int y, int x2) {
+    DoubleInkProcessing<LockAlphaInkProcessing<ImageTraits>, ImageTraits>::processRow(x1, y, x2);
+  }
+
 private:
   color_t m_color;
   const int m_opacity;
@@ -185,6 +203,14 @@ void LockAlphaInkProcessing<RgbTraits>::processPixel(int x, int y) {
     rgba_geta(*m_srcAddress));
 }
 
+template<>
+void LockAlphaInkProcessing<RgbTraits>::processRow(int x1, int y, int x2) {
+  const int n = x2-x1+1;
+  rgba_blender_normal_color_row(m_dstAddress, m_srcAddress, m_color, n, m_opacity);
+  for (int i=0; i<n; ++i)
+    m_dstAddress[i] = (m_dstAddress[i] & rgba_rgb_mask) | (m_srcAddress[i] & rgba_a_mask);
+}
+
 template<>
 void LockAlphaInkProcessing<GrayscaleTraits>::processPixel(int x, int y) {
   color_t result = graya_blender_normal(*m_srcAddress, m_color, m_opacity);
@@ -250,6 +276,10 @@ public:
     // Do nothing
   }
 
+  void processRow(int x1, int y, int x2) {
+    DoubleInkProcessing<TransparentInkProcessing<ImageTraits>, ImageTraits>::processRow(x1, y, x2);
+  }
+
 private:
   color_t m_color;
   int m_opacity;
@@ -260,11 +290,21 @@ void TransparentInkProcessing<RgbTraits>::processPixel(int x, int y) {
   *m_dstAddress = rgba_blender_normal(*m_srcAddress, m_color, m_opacity);
 }
 
+template<>
+void TransparentInkProcessing<RgbTraits>::processRow(int x1, int y, int x2) {
+  rgba_blender_normal_color_row(m_dstAddress, m_srcAddress, m_color, x2-x1+1, m_opacity);
+}
+
 template<>
 void TransparentInkProcessing<GrayscaleTraits>::processPixel(int x, int y) {
   *m_dstAddress = graya_blender_normal(*m_srcAddress, m_color, m_opacity);
 }
 
+template<>
+void TransparentInkProcessing<GrayscaleTraits>::processRow(int x1, int y, int x2) {
+  graya_blender_normal_color_row(m_dstAddress, m_srcAddress, m_color, x2-x1+1, m_opacity);
+}
+
 template<>
 class TransparentInkProcessing<IndexedTraits> : public DoubleInkProcessing<TransparentInkProcessing<IndexedTraits>, IndexedTraits> {
 public:
@@ -325,6 +365,10 @@ public:
     // Do nothing
   }
 
+  void processRow(int x1, int y, int x2) {
+    DoubleInkProcessing<MergeInkProcessing<ImageTraits>, ImageTraits>::processRow(x1, y, x2);
+  }
+
 private:
   color_t m_color;
   int m_opacity;
@@ -335,6 +379,11 @@ void MergeInkProcessing<RgbTraits>::processPixel(int x, int y) {
   *m_dstAddress = rgba_blender_merge(*m_srcAddress, m_color, m_opacity);
 }
 
+template<>
+void MergeInkProcessing<RgbTraits>::processRow(int x1, int y, int x2) {
+  rgba_blender_merge_color_row(m_dstAddress, m_srcAddress, m_color, x2-x1+1, m_opacity);
+}
+
 template<>
 void MergeInkProcessing<GrayscaleTraits>::processPixel(int x, int y) {
   *m_dstAddress = graya_blender_merge(*m_srcAddress, m_color, m_opacity);
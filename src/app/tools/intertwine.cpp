@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -63,18 +63,13 @@ void Intertwine::doPointshapeStrokePt(const Stroke::Pt& pt, ToolLoop* loop)
 {
   Symmetry* symmetry = loop->getSymmetry();
   if (symmetry) {
-    // Convert the point to the sprite position so we can apply the
-    // symmetry transformation.
-    Stroke main_stroke;
-    main_stroke.addPoint(pt);
-
-    Strokes strokes;
-    symmetry->generateStrokes(main_stroke, strokes, loop);
-    for (const auto& stroke : strokes) {
-      // We call transformPoint() moving back each point to the cel
-      // origin.
-      loop->getPointShape()->transformPoint(loop, stroke[0]);
-    }
+    // The point and its symmetrical points are painted with the
+    // same brush (the scanlines of the brush for each flip are
+    // cached by the point shape).
+    Stroke::Pt pts[Symmetry::kMaxPoints];
+    const int n = symmetry->generatePoints(pt, loop, pts);
+    for (int i=0; i<n; ++i)
+      loop->getPointShape()->transformPoint(loop, pts[i]);
   }
   else {
     loop->getPointShape()->transformPoint(loop, pt);
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -28,6 +28,11 @@ namespace app {
       virtual bool snapByAngle() { return false; }
       virtual void prepareIntertwine() { }
 
+      // Returns true if the intertwiner restores by itself the
+      // destination pixels that must be redrawn in each joinStroke()
+      // call (only for TracePolicy::AccumulateUpdateLast).
+      virtual bool invalidatesDstImage(ToolLoop* loop) { return false; }
+
       // The given stroke must be relative to the cel origin.
       virtual void joinStroke(ToolLoop* loop, const Stroke& stroke) = 0;
       virtual void fillStroke(ToolLoop* loop, const Stroke& stroke) = 0;
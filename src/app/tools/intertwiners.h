@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -7,6 +7,10 @@
 
 #include "base/pi.h"
 
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
 namespace app {
 namespace tools {
 
@@ -430,6 +434,15 @@ class IntertwineAsPixelPerfect : public Intertwine {
   bool m_retainedTracePolicyLast = false;
   Stroke m_pts;
 
+  // Points at the beginning of m_pts that cannot change anymore
+  // (only the last point can be removed by the pixel-perfect
+  // algorithm when a new point is added). These committed points are
+  // kept in a grid of cells to redraw them when a removed point
+  // overlaps them.
+  enum { kCellSize = 32 };
+  int m_committed = 0;
+  std::unordered_map<uint64_t, std::vector<int>> m_cells;
+
 public:
   // Useful for Shift+Ctrl+pencil to draw straight lines and snap
   // angle when "pixel perfect" is selected.
@@ -438,6 +451,11 @@ public:
   void prepareIntertwine() override {
     m_pts.reset();
     m_retainedTracePolicyLast = false;
+    resetCommitted();
+  }
+
+  bool invalidatesDstImage(ToolLoop* loop) override {
+    return canJoinIncrementally(loop);
   }
 
   void joinStroke(ToolLoop* loop, const Stroke& stroke) override {
@@ -459,18 +477,28 @@ public:
       doPointshapeStrokePt(stroke[0], loop);
       return;
     }
-    else {
-      for (int c=0; c+1<stroke.size(); ++c) {
-        auto lineAlgo = getLineAlgo(loop, stroke[c], stroke[c+1]);
-        LineData2 lineData(loop, stroke[c], stroke[c+1], m_pts);
-        lineAlgo(
-          stroke[c].x,
-          stroke[c].y,
-          stroke[c+1].x,
-          stroke[c+1].y,
-          (void*)&lineData,
-          (AlgoPixel)&addPointsWithoutDuplicatingLastOne);
-      }
+
+    const bool incremental = canJoinIncrementally(loop);
+    if (!incremental)
+      resetCommitted();
+
+    // Only the last point of the previous step can be modified,
+    // the previous ones are never re-evaluated (or redrawn).
+    const int oldSize = m_pts.size();
+    const int tail = (incremental ? std::max(0, oldSize-1): 0);
+    if (incremental)
+      commitPoints(tail);
+
+    for (int c=0; c+1<stroke.size(); ++c) {
+      auto lineAlgo = getLineAlgo(loop, stroke[c], stroke[c+1]);
+      LineData2 lineData(loop, stroke[c], stroke[c+1], m_pts);
+      lineAlgo(
+        stroke[c].x,
+        stroke[c].y,
+        stroke[c+1].x,
+        stroke[c+1].y,
+        (void*)&lineData,
+        (AlgoPixel)&addPointsWithoutDuplicatingLastOne);
     }
 
     // For line brush type, the pixel-perfect will create gaps so we
@@ -480,7 +508,9 @@ public:
          (loop->getBrush()->angle() == 0.0f ||
           loop->getBrush()->angle() == 90.0f ||
           loop->getBrush()->angle() == 180.0f))) {
-      for (int c=0; c<m_pts.size(); ++c) {
+      const Stroke::Pt oldLast = (tail < oldSize ? m_pts[tail]: Stroke::Pt());
+
+      for (int c=std::max(1, tail); c<m_pts.size(); ++c) {
         // We ignore a pixel that is between other two pixels in the
         // corner of a L-like shape.
         if (c > 0 && c+1 < m_pts.size()
@@ -491,9 +521,15 @@ public:
           m_pts.erase(c);
         }
       }
+
+      // The last point of the previous step was removed, restore
+      // its pixels and redraw the committed points over them
+      if (incremental && tail > 0 && tail < oldSize &&
+          (tail >= m_pts.size() || m_pts[tail] != oldLast))
+        restorePoint(loop, oldLast);
     }
 
-    for (int c=0; c<m_pts.size(); ++c) {
+    for (int c=tail; c<m_pts.size(); ++c) {
       // We must ignore to print the first point of the line after
       // a joinStroke pass with a retained "Last" trace policy
       // (i.e. the user confirms draw a line while he is holding
@@ -516,6 +552,65 @@ public:
       v.size()/2, &v[0],
       loop, (AlgoHLine)doPointshapeHline);
   }
+
+private:
+  // We can restore only the pixels of the removed point (instead of
+  // redrawing the whole stroke) when each point is drawn only once
+  // in its own position.
+  static bool canJoinIncrementally(ToolLoop* loop) {
+    return (loop->getTracePolicy() == TracePolicy::AccumulateUpdateLast &&
+            loop->getBrush()->type() != kImageBrushType &&
+            !loop->getSymmetry() &&
+            loop->getTiledMode() == filters::TiledMode::NONE);
+  }
+
+  static uint64_t cellKey(int u, int v) {
+    return (uint64_t(uint32_t(u)) << 32) | uint64_t(uint32_t(v));
+  }
+
+  static int cellCoord(int x) {
+    return (x >= 0 ? x / kCellSize: (x+1) / kCellSize - 1);
+  }
+
+  void resetCommitted() {
+    m_committed = 0;
+    m_cells.clear();
+  }
+
+  void commitPoints(const int n) {
+    for (; m_committed<n; ++m_committed) {
+      const Stroke::Pt& pt = m_pts[m_committed];
+      m_cells[cellKey(cellCoord(pt.x), cellCoord(pt.y))].push_back(m_committed);
+    }
+  }
+
+  void restorePoint(ToolLoop* loop, const Stroke::Pt& pt) {
+    gfx::Rect area;
+    loop->getPointShape()->getModifiedArea(loop, pt.x, pt.y, area);
+    if (area.isEmpty())
+      return;
+
+    const gfx::Region rgn(area);
+    loop->invalidateDstImage(rgn);
+    loop->validateDstImage(rgn);
+
+    // Committed points whose brush can intersect the restored area
+    const gfx::Rect bounds(pt.x-area.w+1, pt.y-area.h+1,
+                           2*area.w-1, 2*area.h-1);
+    for (int v=cellCoord(bounds.y); v<=cellCoord(bounds.y2()-1); ++v) {
+      for (int u=cellCoord(bounds.x); u<=cellCoord(bounds.x2()-1); ++u) {
+        auto it = m_cells.find(cellKey(u, v));
+        if (it == m_cells.end())
+          continue;
+        for (int i : it->second) {
+          if ((i == 0 && m_retainedTracePolicyLast) ||
+              !bounds.contains(m_pts[i].toPoint()))
+            continue;
+          doPointshapeStrokePt(m_pts[i], loop);
+        }
+      }
+    }
+  }
 };
 
 } // namespace tools
@@ -13,6 +13,7 @@
 
 #include <array>
 #include <memory>
+#include <vector>
 
 namespace app {
 namespace tools {
@@ -47,6 +48,14 @@ class BrushPointShape : public PointShape {
   Brush* m_lastBrush;
   BrushType m_origBrushType;
   std::array<std::shared_ptr<CompressedImage>, 4> m_compressedImages;
+  // Index of the first scanline of each row of m_compressedImages
+  // (the scanlines of row "y" are from rows[y] to rows[y+1]-1)
+  std::array<std::vector<int>, 4> m_scanlineRows;
+  // Position of the last stamp of each symmetry mode, used to skip
+  // the pixels that were already painted by the previous stamp
+  std::array<gfx::Point, 4> m_lastStamps;
+  std::array<bool, 4> m_hasLastStamps;
+  bool m_canSkipOverlaps;
   // For dynamics
   DynamicsOptions m_dynamics;
   bool m_useDynamics;
@@ -79,6 +88,20 @@ public:
       m_secondaryColor = loop->getSecondaryColor();
     }
     m_lastGradientValue = -1;
+
+    // Overlapped pixels of consecutive stamps can be painted just one
+    // time if the result doesn't depend on the number of times that
+    // a pixel is painted, i.e. the brush and color don't change, and
+    // the ink reads the source image (which isn't modified while the
+    // trace is accumulated). Inks for image brushes blend with the
+    // destination image, so they are not included.
+    Ink* ink = loop->getInk();
+    m_canSkipOverlaps = (m_origBrushType != kImageBrushType &&
+                         !m_useDynamics &&
+                         !ink->isSelection() &&
+                         !ink->isEffect() &&
+                         loop->getTiledMode() == TiledMode::NONE);
+    m_hasLastStamps.fill(false);
   }
 
   void transformPoint(ToolLoop* loop, const Stroke::Pt& pt) override {
@@ -178,6 +201,7 @@ public:
     if (m_lastBrush != brush) {
       m_lastBrush = brush;
       m_compressedImages.fill(nullptr);
+      m_hasLastStamps.fill(false);
     }
 
     x += brush->bounds().x;
@@ -210,10 +234,59 @@ public:
 
     ink->prepareForPointShape(loop, m_firstPoint, x, y);
 
-    for (auto scanline : getCompressedImage(pt.symmetry)) {
-      int u = x+scanline.x;
-      ink->prepareVForPointShape(loop, y+scanline.y);
-      doInkHline(u, y+scanline.y, u+scanline.w-1, loop);
+    const CompressedImage& stamp = getCompressedImage(pt.symmetry);
+    const int i = int(pt.symmetry);
+
+    // The trace policy can be changed by the controller in the middle
+    // of the tool loop (e.g. Shift+click to draw lines)
+    if (!m_canSkipOverlaps ||
+        loop->getTracePolicy() != TracePolicy::Accumulate) {
+      m_hasLastStamps[i] = false;
+    }
+
+    if (m_hasLastStamps[i]) {
+      const std::vector<int>& rows = m_scanlineRows[i];
+      const gfx::Point last = m_lastStamps[i];
+      const int dy = y - last.y;
+
+      for (const auto& scanline : stamp) {
+        const int v = y+scanline.y;
+        int u = x+scanline.x;
+        const int u2 = u+scanline.w-1;
+        ink->prepareVForPointShape(loop, v);
+
+        // Paint only the parts of the scanline that are not covered
+        // by the scanlines of the last stamp in the same row
+        const int r = scanline.y+dy;
+        if (r >= 0 && r < stamp.height()) {
+          for (int k=rows[r]; k<rows[r+1] && u <= u2; ++k) {
+            const auto& prev = *(stamp.begin()+k);
+            const int p1 = last.x+prev.x;
+            const int p2 = p1+prev.w-1;
+            if (p2 < u)
+              continue;
+            if (p1 > u2)
+              break;
+            if (p1 > u)
+              doInkHline(u, v, p1-1, loop);
+            u = p2+1;
+          }
+        }
+        if (u <= u2)
+          doInkHline(u, v, u2, loop);
+      }
+    }
+    else {
+      for (auto scanline : stamp) {
+        int u = x+scanline.x;
+        ink->prepareVForPointShape(loop, y+scanline.y);
+        doInkHline(u, y+scanline.y, u+scanline.w-1, loop);
+      }
+    }
+
+    if (m_canSkipOverlaps) {
+      m_lastStamps[i] = gfx::Point(x, y);
+      m_hasLastStamps[i] = true;
     }
     m_firstPoint = false;
   }
@@ -262,6 +335,13 @@ private:
           break;
         }
       }
+
+      std::vector<int>& rows = m_scanlineRows[int(symmetryMode)];
+      rows.assign(compressPtr->height()+1, 0);
+      for (const auto& scanline : *compressPtr)
+        ++rows[scanline.y+1];
+      for (int y=0; y<compressPtr->height(); ++y)
+        rows[y+1] += rows[y];
     }
     return *compressPtr;
   }
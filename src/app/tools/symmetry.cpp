@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2021  Igara Studio S.A.
+// Copyright (C) 2021-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -49,11 +49,51 @@ void Symmetry::generateStrokes(const Stroke& stroke, Strokes& strokes,
   }
 }
 
+int Symmetry::generatePoints(const Stroke::Pt& pt, ToolLoop* loop,
+                             Stroke::Pt pts[kMaxPoints])
+{
+  int n = 0;
+  pts[n++] = pt;
+  switch (m_symmetryMode) {
+    case gen::SymmetryMode::NONE:
+      ASSERT(false);
+      break;
+
+    case gen::SymmetryMode::HORIZONTAL:
+    case gen::SymmetryMode::VERTICAL:
+      pts[n++] = calculateSymmetricalPt(pt, loop, m_symmetryMode);
+      break;
+
+    case gen::SymmetryMode::BOTH:
+      pts[n++] = calculateSymmetricalPt(pt, loop, gen::SymmetryMode::HORIZONTAL);
+      pts[n] = calculateSymmetricalPt(pt, loop, gen::SymmetryMode::VERTICAL);
+      pts[n+1] = calculateSymmetricalPt(pts[n], loop, gen::SymmetryMode::BOTH);
+      n += 2;
+      break;
+  }
+  return n;
+}
+
 void Symmetry::calculateSymmetricalStroke(const Stroke& refStroke, Stroke& stroke,
                                           ToolLoop* loop, gen::SymmetryMode symmetryMode)
 {
+  for (const auto& pt : refStroke)
+    stroke.addPoint(calculateSymmetricalPt(pt, loop, symmetryMode));
+}
+
+Stroke::Pt Symmetry::calculateSymmetricalPt(const Stroke::Pt& pt,
+                                            ToolLoop* loop,
+                                            gen::SymmetryMode symmetryMode) const
+{
+  const bool horizontal =
+    (symmetryMode == gen::SymmetryMode::HORIZONTAL ||
+     symmetryMode == gen::SymmetryMode::BOTH);
   int brushSize, brushCenter;
-  if (loop->getPointShape()->isFloodFill()) {
+  if (loop->getDynamics().isDynamic()) {
+    brushSize = pt.size;
+    brushCenter = (brushSize - brushSize % 2) / 2;
+  }
+  else if (loop->getPointShape()->isFloodFill()) {
     brushSize = 1;
     brushCenter = 0;
   }
@@ -61,7 +101,7 @@ void Symmetry::calculateSymmetricalStroke(const Stroke& refStroke, Stroke& strok
     // TODO we should flip the brush center+image+bitmap or just do
     //      the symmetry of all pixels
     auto brush = loop->getBrush();
-    if (symmetryMode == gen::SymmetryMode::HORIZONTAL || symmetryMode == gen::SymmetryMode::BOTH) {
+    if (horizontal) {
       brushSize = brush->bounds().w;
       brushCenter = brush->center().x;
     }
@@ -71,20 +111,13 @@ void Symmetry::calculateSymmetricalStroke(const Stroke& refStroke, Stroke& strok
     }
   }
 
-  const bool isDynamic = loop->getDynamics().isDynamic();
-  for (const auto& pt : refStroke) {
-    if (isDynamic) {
-      brushSize = pt.size;
-      brushCenter = (brushSize - brushSize % 2) / 2;
-    }
-    Stroke::Pt pt2 = pt;
-    pt2.symmetry = symmetryMode;
-    if (symmetryMode == gen::SymmetryMode::HORIZONTAL || symmetryMode == gen::SymmetryMode::BOTH)
-      pt2.x = 2 * (m_x + brushCenter) - pt2.x - brushSize;
-    else
-      pt2.y = 2 * (m_y + brushCenter) - pt2.y - brushSize;
-    stroke.addPoint(pt2);
-  }
+  Stroke::Pt pt2 = pt;
+  pt2.symmetry = symmetryMode;
+  if (horizontal)
+    pt2.x = 2 * (m_x + brushCenter) - pt2.x - brushSize;
+  else
+    pt2.y = 2 * (m_y + brushCenter) - pt2.y - brushSize;
+  return pt2;
 }
 
 } // namespace tools
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2021  Igara Studio S.A.
+// Copyright (C) 2021-2022  Igara Studio S.A.
 // Copyright (C) 2015  David Capello
 //
 // This program is distributed under the terms of
@@ -25,13 +25,24 @@ public:
     , m_y(y) {
   }
 
+  enum { kMaxPoints = 4 };
+
   void generateStrokes(const Stroke& stroke, Strokes& strokes, ToolLoop* loop);
 
+  // Generates the given point and its symmetrical points in "pts"
+  // (it's like generateStrokes() for just one point, but without
+  // allocating memory). Returns the number of points.
+  int generatePoints(const Stroke::Pt& pt, ToolLoop* loop,
+                     Stroke::Pt pts[kMaxPoints]);
+
   gen::SymmetryMode mode() const { return m_symmetryMode; }
 
 private:
   void calculateSymmetricalStroke(const Stroke& refStroke, Stroke& stroke,
                                   ToolLoop* loop, gen::SymmetryMode symmetryMode);
+  Stroke::Pt calculateSymmetricalPt(const Stroke::Pt& pt,
+                                    ToolLoop* loop,
+                                    gen::SymmetryMode symmetryMode) const;
 
   gen::SymmetryMode m_symmetryMode;
   double m_x, m_y;
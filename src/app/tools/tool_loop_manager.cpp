@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -25,6 +25,7 @@
 #include "doc/image.h"
 #include "doc/primitives.h"
 #include "doc/sprite.h"
+#include "doc/trace.h"
 #include "gfx/point_io.h"
 #include "gfx/rect_io.h"
 #include "gfx/region.h"
@@ -44,6 +45,7 @@ ToolLoopManager::ToolLoopManager(ToolLoop* toolLoop)
   : m_toolLoop(toolLoop)
   , m_brush0(*toolLoop->getBrush())
   , m_dynamics(toolLoop->getDynamics())
+  , m_queuedMovements(0)
 {
 }
 
@@ -91,6 +93,9 @@ void ToolLoopManager::pressButton(const Pointer& pointer)
   if (m_toolLoop->getTracePolicy() == TracePolicy::Last)
     tracePolicyWasLast = true;
 
+  // Draw pending movements before the new click
+  flushMovements();
+
   m_lastPointer = pointer;
 
   if (isCanceled())
@@ -129,6 +134,9 @@ bool ToolLoopManager::releaseButton(const Pointer& pointer)
 {
   TOOL_TRACE("ToolLoopManager::releaseButton", pointer.point());
 
+  // Draw pending movements before the end of the stroke
+  flushMovements();
+
   m_lastPointer = pointer;
 
   if (isCanceled())
@@ -150,6 +158,12 @@ bool ToolLoopManager::releaseButton(const Pointer& pointer)
 }
 
 void ToolLoopManager::movement(const Pointer& pointer)
+{
+  queueMovement(pointer);
+  flushMovements();
+}
+
+void ToolLoopManager::queueMovement(const Pointer& pointer)
 {
   m_lastPointer = pointer;
 
@@ -158,6 +172,17 @@ void ToolLoopManager::movement(const Pointer& pointer)
 
   Stroke::Pt spritePoint = getSpriteStrokePt(pointer);
   m_toolLoop->getController()->movement(m_toolLoop, m_stroke, spritePoint);
+  ++m_queuedMovements;
+}
+
+void ToolLoopManager::flushMovements()
+{
+  if (m_queuedMovements == 0)
+    return;
+
+  m_queuedMovements = 0;
+  if (isCanceled())
+    return;
 
   std::string statusText;
   m_toolLoop->getController()->getStatusBarText(m_toolLoop, m_stroke, statusText);
@@ -168,6 +193,8 @@ void ToolLoopManager::movement(const Pointer& pointer)
 
 void ToolLoopManager::doLoopStep(bool lastStep)
 {
+  DOC_TRACE_ZONE("ToolLoopManager::doLoopStep");
+
   // Original set of points to interwine (original user stroke,
   // relative to sprite origin).
   Stroke main_stroke;
@@ -234,7 +261,11 @@ void ToolLoopManager::doLoopStep(bool lastStep)
     // freehand algorithm needs this trace policy to redraw only the
     // last dirty area, which can vary in one pixel from the previous
     // tool loop cycle).
-    if (m_toolLoop->getBrush()->type() != kImageBrushType) {
+    if (m_toolLoop->getIntertwine()->invalidatesDstImage(m_toolLoop)) {
+      // The intertwiner restores only the pixels of the removed
+      // points, so the rest of the stroke is not redrawn.
+    }
+    else if (m_toolLoop->getBrush()->type() != kImageBrushType) {
       m_toolLoop->invalidateDstImage(m_dirtyArea);
     }
     // For custom brush we revalidate the whole destination area so
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -69,6 +69,15 @@ public:
   // Should be called each time the user moves the mouse inside the editor.
   void movement(const Pointer& pointer);
 
+  // Adds a new mouse position to the stroke without drawing it. The
+  // queued positions are drawn all together (keeping all points for
+  // the intertwiner) in the next flushMovements() or movement()
+  // call. Useful to coalesce high-frequency pointer events (e.g. 1000
+  // Hz tablets) in one loop step per display frame.
+  void queueMovement(const Pointer& pointer);
+  void flushMovements();
+  bool hasQueuedMovements() const { return m_queuedMovements > 0; }
+
   const Pointer& lastPointer() const { return m_lastPointer; }
 
 private:
@@ -87,6 +96,7 @@ private:
   gfx::Region m_nextDirtyArea;
   doc::Brush m_brush0;
   DynamicsOptions m_dynamics;
+  int m_queuedMovements;
 };
 
 } // namespace tools
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2019  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -16,10 +16,14 @@
 #include "app/doc.h"
 #include "app/doc_undo.h"
 #include "app/modules/palettes.h"
+#include "base/chrono.h"
+#include "base/log.h"
 #include "doc/sprite.h"
 #include "ui/manager.h"
 #include "ui/system.h"
 
+#include <typeinfo>
+
 #define TX_TRACE(...)
 
 namespace app {
@@ -36,12 +40,14 @@ Transaction::Transaction(
   , m_undo(nullptr)
   , m_cmds(nullptr)
   , m_changes(Changes::kNone)
+  , m_undoEnabled(!ctx || ctx->isUndoEnabled())
 {
   TX_TRACE("TX: Start <%s> (%s)\n",
            label.c_str(),
            modification == ModifyDocument ? "modifies document":
                                             "doesn't modify document");
 
+  setDocEvents(kDocSpriteEvents | kDocSelectionEvents);
   m_doc->add_observer(this);
   m_undo = m_doc->undoHistory();
 
@@ -94,7 +100,10 @@ void Transaction::commit()
   const SpritePosition sprPos = m_cmds->spritePositionAfterExecute();
 #endif
 
-  m_undo->add(m_cmds);
+  if (m_undoEnabled)
+    m_undo->add(m_cmds);
+  else
+    delete m_cmds;
   m_cmds = nullptr;
 
   // Process changes
@@ -133,7 +142,12 @@ void Transaction::rollback(CmdTransaction* newCmds)
   ASSERT(m_cmds);
   TX_TRACE("TX: Rollback <%s>\n", m_cmds->label().c_str());
 
-  m_cmds->undo();
+  // Without undo information the changes cannot be reverted, the
+  // document will not be in the saved state anymore
+  if (m_undoEnabled)
+    m_cmds->undo();
+  else
+    m_undo->impossibleToBackToSavedState();
 
   delete m_cmds;
   m_cmds = newCmds;
@@ -141,6 +155,7 @@ void Transaction::rollback(CmdTransaction* newCmds)
 
 void Transaction::execute(Cmd* cmd)
 {
+  base::Chrono chrono;
   try {
     cmd->execute(m_ctx);
   }
@@ -149,6 +164,18 @@ void Transaction::execute(Cmd* cmd)
     throw;
   }
 
+  const double t = chrono.elapsed();
+  m_cmds->addExecuteTime(t);
+  if (t > CmdTransaction::kSlowCmdTime)
+    LOG(VERBOSE, "UNDO: Slow command %s in '%s' (%.3f s)\n",
+        typeid(*cmd).name(), m_cmds->label().c_str(), t);
+
+  // The cmd is not needed anymore if it will not be undone
+  if (!m_undoEnabled) {
+    delete cmd;
+    return;
+  }
+
   try {
     m_cmds->add(cmd);
   }
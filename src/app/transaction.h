@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -36,6 +36,10 @@ namespace app {
   // processes those changes as UI updates (so widgets are
   // invalidated/updated correctly to show the new Doc state).
   //
+  // If the undo is disabled in the context (Context::isUndoEnabled()),
+  // each Cmd is deleted after its execution and nothing is added to
+  // the DocUndo, so the changes cannot be rollbacked.
+  //
   // You have to wrap every call to an transaction with a
   // ContextWriter. The preferred usage is as follows:
   //
@@ -113,6 +117,7 @@ namespace app {
     DocUndo* m_undo;
     CmdTransaction* m_cmds;
     Changes m_changes;
+    bool m_undoEnabled;
   };
 
 } // namespace app
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2018  David Capello
 //
 // This program is distributed under the terms of
@@ -70,6 +70,10 @@ namespace app {
       m_transaction->execute(cmd);
     }
 
+    Doc* document() const {
+      return m_doc;
+    }
+
     operator Transaction&() {
       return *m_transaction;
     }
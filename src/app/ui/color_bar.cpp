@@ -157,6 +157,9 @@ ColorBar::ColorBar(int align, TooltipManager* tooltipManager)
 {
   m_instance = this;
 
+  // Only general updates are needed from the active document
+  setDocEvents(0);
+
   auto theme = SkinTheme::get(this);
 
   m_buttons.addItem(theme->parts.timelineOpenPadlockActive());
@@ -434,6 +437,10 @@ void ColorBar::onActiveSiteChange(const Site& site)
     if (m_lastDocument)
       m_lastDocument->add_observer(this);
 
+    // The palette view shows the transparent color of the active
+    // sprite
+    m_paletteView.invalidateChangedEntries();
+
     hideRemap();
   }
 }
@@ -441,7 +448,7 @@ void ColorBar::onActiveSiteChange(const Site& site)
 void ColorBar::onGeneralUpdate(DocEvent& ev)
 {
   // TODO Observe palette changes only
-  invalidate();
+  invalidateExceptPaletteEntries();
 }
 
 void ColorBar::onAppPaletteChange()
@@ -472,7 +479,7 @@ void ColorBar::onAfterExecuteCommand(CommandExecutionEvent& ev)
 {
   if (ev.command()->id() == CommandId::Undo() ||
       ev.command()->id() == CommandId::Redo())
-    invalidate();
+    invalidateExceptPaletteEntries();
 
   // If the sprite isn't Indexed anymore (e.g. because we've just
   // undone a "RGB -> Indexed" conversion), we hide the "Remap"
@@ -833,7 +840,7 @@ void ColorBar::onColorButtonChange(const app::Color& color)
 
       // As foreground or background color changed, we've to redraw the
       // palette view fg/bg indicators.
-      m_paletteView.invalidate();
+      m_paletteView.invalidateChangedEntries();
     }
   }
 
@@ -952,6 +959,16 @@ void ColorBar::setAscending(bool ascending)
   m_ascending = ascending;
 }
 
+void ColorBar::invalidateExceptPaletteEntries()
+{
+  // The palette view repaints only its modified entries
+  gfx::Region rgn(bounds());
+  rgn.createSubtraction(rgn, gfx::Region(m_scrollableView.viewportBounds()));
+  invalidateRegion(rgn);
+
+  m_paletteView.invalidateChangedEntries();
+}
+
 void ColorBar::showRemap()
 {
   Site site = UIContext::instance()->activeSite();
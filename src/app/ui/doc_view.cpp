@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -29,6 +29,7 @@
 #include "app/ui/editor/editor.h"
 #include "app/ui/editor/editor_customization_delegate.h"
 #include "app/ui/editor/editor_view.h"
+#include "app/ui/editor/rendered_frame_cache.h"
 #include "app/ui/keyboard_shortcuts.h"
 #include "app/ui/main_window.h"
 #include "app/ui/status_bar.h"
@@ -187,7 +188,10 @@ class PreviewEditor : public Editor,
                       public EditorCustomizationDelegate {
 public:
   PreviewEditor(Doc* document)
-    : Editor(document, Editor::kShowOutside) { // Don't show grid/mask in preview preview
+    : Editor(document,
+             // Don't show grid/mask in preview preview
+             EditorFlags(Editor::kShowOutside |
+                         Editor::kReuseRenderedPixels)) {
     setCustomizationDelegate(this);
   }
 
@@ -238,6 +242,12 @@ DocView::DocView(Doc* document, Type type,
   m_view->setExpansive(true);
 
   m_editor->setDocView(this);
+  setDocEvents(kDocSpriteEvents |
+               kDocLayerEvents |
+               kDocFrameEvents |
+               kDocCelEvents |
+               kDocPixelEvents |
+               kDocTagEvents);
   m_document->add_observer(this);
 }
 
@@ -402,8 +412,27 @@ void DocView::onGeneralUpdate(DocEvent& ev)
     m_editor->updateEditor(true);
 }
 
+void DocView::onLayersFlagsChange(DocEvent& ev)
+{
+  // Hidden/shown layers change the rendered sprite
+  if (m_editor->isVisible())
+    m_editor->updateEditor(true);
+}
+
 void DocView::onSpritePixelsModified(DocEvent& ev)
 {
+  // The preview editor is painted later (with the next paint message)
+  // so it can copy the pixels that the main editor renders now
+  if (isPreview()) {
+    if (m_editor->isVisible() &&
+        m_editor->frame() == ev.frame())
+      m_editor->invalidateSpriteRegion(ev.region());
+    return;
+  }
+
+  RenderedFrameCache::instance()->invalidate(
+    ev.sprite(), ev.frame(), ev.region());
+
   if (m_editor->isVisible() &&
       m_editor->frame() == ev.frame())
     m_editor->drawSpriteClipped(ev.region());
@@ -14,6 +14,7 @@
 #include "app/commands/command.h"
 #include "app/commands/commands.h"
 #include "app/commands/params.h"
+#include "app/session_recorder.h"
 #include "app/tools/controller.h"
 #include "app/tools/ink.h"
 #include "app/tools/tool.h"
@@ -59,6 +60,10 @@ static int get_delay_interval_for_tool_loop(tools::ToolLoop* toolLoop)
   }
 }
 
+// Minimum time between two loop steps when the mouse movements are
+// queued (about one display frame at 60 Hz)
+static const int kFlushMovementsInterval = 16;
+
 DrawingState::DrawingState(Editor* editor,
                            tools::ToolLoop* toolLoop,
                            const DrawingType type)
@@ -66,6 +71,8 @@ DrawingState::DrawingState(Editor* editor,
   , m_type(type)
   , m_delayedMouseMove(this, editor,
                        get_delay_interval_for_tool_loop(toolLoop))
+  , m_flushMovementsTimer(kFlushMovementsInterval)
+  , m_lastFlushTime(0)
   , m_toolLoop(toolLoop)
   , m_toolLoopManager(new tools::ToolLoopManager(toolLoop))
   , m_mouseMoveReceived(false)
@@ -75,6 +82,8 @@ DrawingState::DrawingState(Editor* editor,
   m_beforeCmdConn =
     UIContext::instance()->BeforeCommandExecution.connect(
       &DrawingState::onBeforeCommandExecution, this);
+
+  m_flushMovementsTimer.Tick.connect([this]{ flushMovements(); });
 }
 
 DrawingState::~DrawingState()
@@ -92,7 +101,9 @@ void DrawingState::initToolLoop(Editor* editor,
     m_delayedMouseMove.initSpritePos(gfx::PointF(pointer.point()));
 
   // Prepare preview image (the destination image will be our preview
-  // in the tool-loop time, so we can see what we are drawing)
+  // in the tool-loop time, so we can see what we are drawing). The
+  // layers above are merged in one cached image to paint faster.
+  editor->renderEngine().setFastPreview(true);
   editor->renderEngine().setPreviewImage(
     m_toolLoop->getLayer(),
     m_toolLoop->getFrame(),
@@ -111,6 +122,9 @@ void DrawingState::initToolLoop(Editor* editor,
                           editor->editorToScreen(pointer.point()));
   m_mouseDownTime = base::current_tick();
 
+  m_recordedPoints.clear();
+  recordPoint(pointer);
+
   m_toolLoopManager->prepareLoop(pointer);
   m_toolLoopManager->pressButton(pointer);
 
@@ -123,6 +137,7 @@ void DrawingState::sendMovementToToolLoop(const tools::Pointer& pointer)
 {
   ASSERT(m_toolLoopManager);
   m_lastPointer = pointer;
+  recordPoint(pointer);
   m_toolLoopManager->movement(pointer);
 }
 
@@ -164,6 +179,7 @@ bool DrawingState::onMouseDown(Editor* editor, MouseMessage* msg)
   m_mousePressedReceived = true;
 
   // Notify the mouse button down to the tool loop manager.
+  recordPoint(pointer);
   m_toolLoopManager->pressButton(pointer);
 
   // Store the isCanceled flag, because destroyLoopIfCanceled might
@@ -210,8 +226,14 @@ bool DrawingState::onMouseUp(Editor* editor, MouseMessage* msg)
     // Notify the release of the mouse button to the tool loop
     // manager. This is the correct way to say "the user finishes the
     // drawing trace correctly".
+    recordPoint(m_lastPointer);
     if (m_toolLoopManager->releaseButton(m_lastPointer))
       return true;
+
+    // Add the finished stroke to the recorded session (if any)
+    if (!m_toolLoopManager->isCanceled())
+      SessionRecorder::instance()->addStroke(m_toolLoop.get(),
+                                             m_recordedPoints);
   }
 
   destroyLoop(editor);
@@ -366,7 +388,39 @@ void DrawingState::handleMouseMovement()
 {
   // Notify mouse movement to the tool
   ASSERT(m_toolLoopManager);
-  m_toolLoopManager->movement(m_lastPointer);
+  recordPoint(m_lastPointer);
+  m_toolLoopManager->queueMovement(m_lastPointer);
+
+  // Draw the queued movements now if the last loop step was drawn
+  // some frames ago, in other case we wait the end of the current
+  // frame (so a flood of mouse events is drawn in one loop step
+  // without losing any point).
+  if (base::current_tick() - m_lastFlushTime >= kFlushMovementsInterval)
+    flushMovements();
+  else if (!m_flushMovementsTimer.isRunning())
+    m_flushMovementsTimer.start();
+}
+
+void DrawingState::recordPoint(const tools::Pointer& pointer)
+{
+  if (!SessionRecorder::instance()->isRecording())
+    return;
+
+  const gfx::Point pt = pointer.point();
+  if (m_recordedPoints.empty() || m_recordedPoints.back() != pt)
+    m_recordedPoints.push_back(pt);
+}
+
+void DrawingState::flushMovements()
+{
+  if (m_flushMovementsTimer.isRunning())
+    m_flushMovementsTimer.stop();
+
+  if (m_toolLoopManager &&
+      m_toolLoopManager->hasQueuedMovements()) {
+    m_toolLoopManager->flushMovements();
+    m_lastFlushTime = base::current_tick();
+  }
 }
 
 bool DrawingState::canInterpretMouseMovementAsJustOneClick()
@@ -427,9 +481,17 @@ void DrawingState::destroyLoopIfCanceled(Editor* editor)
 
 void DrawingState::destroyLoop(Editor* editor)
 {
-  if (editor)
+  // Draw the last queued movements before we commit the changes
+  flushMovements();
+
+  if (editor) {
     editor->renderEngine().removePreviewImage();
 
+    // Repaint with full quality what was painted with the fast
+    // preview
+    editor->invalidate();
+  }
+
   if (m_toolLoop)
     m_toolLoop->commitOrRollback();
 
@@ -15,7 +15,10 @@
 #include "app/ui/editor/standby_state.h"
 #include "base/time.h"
 #include "obs/connection.h"
+#include "ui/timer.h"
+
 #include <memory>
+#include <vector>
 
 namespace app {
   namespace tools {
@@ -59,6 +62,8 @@ namespace app {
 
   private:
     void handleMouseMovement();
+    void recordPoint(const tools::Pointer& pointer);
+    void flushMovements();
     bool canInterpretMouseMovementAsJustOneClick();
     bool canExecuteCommands();
     void onBeforeCommandExecution(CommandExecutionEvent& ev);
@@ -73,6 +78,11 @@ namespace app {
     DrawingType m_type;
     DelayedMouseMove m_delayedMouseMove;
 
+    // Used to draw queued mouse movements at most one time per
+    // display frame (e.g. with high-frequency tablet events).
+    ui::Timer m_flushMovementsTimer;
+    base::tick_t m_lastFlushTime;
+
     // The tool-loop.
     std::unique_ptr<tools::ToolLoop> m_toolLoop;
 
@@ -91,6 +101,10 @@ namespace app {
     // button when onScrollChange() event is received.
     tools::Pointer m_lastPointer;
 
+    // Points of the stroke for the SessionRecorder (only when a
+    // session is being recorded).
+    std::vector<gfx::Point> m_recordedPoints;
+
     // Used to calculate the velocity of the mouse (whch is a sensor
     // to generate dynamic parameters).
     tools::VelocitySensor m_velocity;
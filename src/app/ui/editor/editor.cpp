@@ -37,11 +37,14 @@
 #include "app/ui/editor/drawing_state.h"
 #include "app/ui/editor/editor_customization_delegate.h"
 #include "app/ui/editor/editor_decorator.h"
+#include "app/ui/editor/editor_gpu_render.h"
 #include "app/ui/editor/editor_render.h"
 #include "app/ui/editor/glue.h"
 #include "app/ui/editor/moving_pixels_state.h"
 #include "app/ui/editor/pixels_movement.h"
 #include "app/ui/editor/play_state.h"
+#include "app/ui/editor/playback_cache.h"
+#include "app/ui/editor/rendered_frame_cache.h"
 #include "app/ui/editor/scrolling_state.h"
 #include "app/ui/editor/standby_state.h"
 #include "app/ui/editor/zooming_state.h"
@@ -59,6 +62,7 @@
 #include "doc/doc.h"
 #include "doc/mask_boundaries.h"
 #include "doc/slice.h"
+#include "doc/trace.h"
 #include "os/color_space.h"
 #include "os/sampling.h"
 #include "os/surface.h"
@@ -71,6 +75,7 @@
 #include <cstdio>
 #include <limits>
 #include <memory>
+#include <vector>
 
 namespace app {
 
@@ -83,6 +88,39 @@ using namespace render;
 static base::Chrono renderChrono;
 static double renderElapsed = 0.0;
 
+// Max number of extra screen pixels that can be rendered to merge two
+// dirty rectangles in one (rendering and uploading a few more pixels
+// is faster than doing it for lots of small rectangles).
+static constexpr int kMaxDirtyRectsWaste = 64*64;
+
+// Merges the rectangles of the given region (in sprite coordinates)
+// when the union of two of them doesn't waste more than
+// kMaxDirtyRectsWaste screen pixels.
+static void coalesce_dirty_rects(const gfx::Region& region,
+                                 const Projection& proj,
+                                 std::vector<gfx::Rect>& output)
+{
+  auto screenArea = [&proj](const gfx::Rect& rc) {
+    return proj.applyX(rc.w) * proj.applyY(rc.h);
+  };
+
+  output.clear();
+  output.reserve(region.size());
+  for (const gfx::Rect& rc : region) {
+    bool merged = false;
+    for (gfx::Rect& out : output) {
+      const gfx::Rect u = out.createUnion(rc);
+      if (screenArea(u) - screenArea(out) - screenArea(rc) <= kMaxDirtyRectsWaste) {
+        out = u;
+        merged = true;
+        break;
+      }
+    }
+    if (!merged)
+      output.push_back(rc);
+  }
+}
+
 class EditorPostRenderImpl : public EditorPostRender {
 public:
   EditorPostRenderImpl(Editor* editor, Graphics* g)
@@ -133,6 +171,7 @@ private:
 
 // static
 EditorRender* Editor::m_renderEngine = nullptr;
+EditorGpuRender* Editor::m_gpuRender = nullptr;
 
 Editor::Editor(Doc* document, EditorFlags flags)
   : Widget(Editor::Type())
@@ -161,6 +200,8 @@ Editor::Editor(Doc* document, EditorFlags flags)
 {
   if (!m_renderEngine)
     m_renderEngine = new EditorRender;
+  if (!m_gpuRender)
+    m_gpuRender = new EditorGpuRender;
 
   m_proj.setPixelRatio(m_sprite->pixelRatio());
 
@@ -206,6 +247,12 @@ Editor::Editor(Doc* document, EditorFlags flags)
     m_docPref.show.AfterChange.connect(
       [this]{ onShowExtrasChange(); });
 
+  setDocEvents(kDocSpriteEvents |
+               kDocLayerEvents |
+               kDocCelEvents |
+               kDocPixelEvents |
+               kDocTagEvents |
+               kDocSliceEvents);
   m_document->add_observer(this);
 
   m_state->onEnterState(this);
@@ -219,6 +266,8 @@ Editor::~Editor()
 
     m_docPref.site.frame(frame());
     m_docPref.site.layer(layerIndex);
+
+    RenderedFrameCache::instance()->clear(m_sprite);
   }
 
   m_observers.notifyDestroyEditor(this);
@@ -237,6 +286,10 @@ void Editor::destroyEditorSharedInternals()
     delete m_renderEngine;
     m_renderEngine = nullptr;
   }
+  if (m_gpuRender) {
+    delete m_gpuRender;
+    m_gpuRender = nullptr;
+  }
 }
 
 bool Editor::isActive() const
@@ -539,91 +592,133 @@ void Editor::updateEditor(const bool restoreScrollPos)
   View::getView(this)->updateView(restoreScrollPos);
 }
 
-void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& spriteRectToDraw, int dx, int dy)
+void Editor::drawSpriteCopiesUnclippedRect(ui::Graphics* g,
+                                           const gfx::Rect& spriteRectToDraw,
+                                           const std::vector<gfx::Point>& offsets)
 {
-  // Clip from sprite and apply zoom
-  gfx::Rect rc = m_sprite->bounds().createIntersection(spriteRectToDraw);
-  rc = m_proj.apply(rc);
+  DOC_TRACE_ZONE("Editor::drawSpriteCopiesUnclippedRect");
 
-  gfx::Rect dest(dx + m_padding.x + rc.x,
-                 dy + m_padding.y + rc.y, 0, 0);
+  const auto& pref = Preferences::instance();
+  const bool newEngine = isUsingNewRenderEngine();
 
-  // Clip from graphics/screen
-  const gfx::Rect& clip = g->getClipBounds();
-  if (dest.x < clip.x) {
-    rc.x += clip.x - dest.x;
-    rc.w -= clip.x - dest.x;
-    dest.x = clip.x;
-  }
-  if (dest.y < clip.y) {
-    rc.y += clip.y - dest.y;
-    rc.h -= clip.y - dest.y;
-    dest.y = clip.y;
-  }
-  if (dest.x+rc.w > clip.x+clip.w) {
-    rc.w = clip.x+clip.w-dest.x;
-  }
-  if (dest.y+rc.h > clip.y+clip.h) {
-    rc.h = clip.y+clip.h-dest.y;
+  // Each copy of the sprite (in tiled mode) can expose a different
+  // area of the sprite. The union of all these areas (rc2) is
+  // rendered only one time, and then each copy is blitted from the
+  // same rendered surface.
+  struct SpriteCopy {
+    gfx::Point offset;
+    gfx::Rect src;              // Area of the copy in rc2 coordinates
+    gfx::Rect dest;             // Area of the copy in the screen
+  };
+  std::vector<SpriteCopy> copies;
+  copies.reserve(offsets.size());
+
+  // rc2 is the rectangle used to create a temporal rendered image of the sprite
+  gfx::Rect rc2;
+  gfx::Region exposeRgn;
+
+  for (const gfx::Point& offset : offsets) {
+    const int dx = offset.x;
+    const int dy = offset.y;
+
+    // Clip from sprite and apply zoom
+    gfx::Rect rc = m_sprite->bounds().createIntersection(spriteRectToDraw);
+    rc = m_proj.apply(rc);
+
+    gfx::Rect dest(dx + m_padding.x + rc.x,
+                   dy + m_padding.y + rc.y, 0, 0);
+
+    // Clip from graphics/screen
+    const gfx::Rect& clip = g->getClipBounds();
+    if (dest.x < clip.x) {
+      rc.x += clip.x - dest.x;
+      rc.w -= clip.x - dest.x;
+      dest.x = clip.x;
+    }
+    if (dest.y < clip.y) {
+      rc.y += clip.y - dest.y;
+      rc.h -= clip.y - dest.y;
+      dest.y = clip.y;
+    }
+    if (dest.x+rc.w > clip.x+clip.w) {
+      rc.w = clip.x+clip.w-dest.x;
+    }
+    if (dest.y+rc.h > clip.y+clip.h) {
+      rc.h = clip.y+clip.h-dest.y;
+    }
+
+    if (rc.isEmpty())
+      continue;
+
+    // Bounds of pixels from the sprite canvas that will be exposed in
+    // this render cycle.
+    gfx::Rect expose = m_proj.remove(rc);
+
+    // If the zoom level is less than 100%, we add extra pixels to
+    // the exposed area. Those pixels could be shown in the
+    // rendering process depending on each cel position.
+    // E.g. when we are drawing in a cel with position < (0,0)
+    if (m_proj.scaleX() < 1.0)
+      expose.enlargeXW(int(1./m_proj.scaleX()));
+    // If the zoom level is more than %100 we add an extra pixel to
+    // expose just in case the zoom requires to display it.  Note:
+    // this is really necessary to avoid showing invalid destination
+    // areas in ToolLoopImpl.
+    else if (m_proj.scaleX() > 1.0)
+      expose.enlargeXW(1);
+
+    if (m_proj.scaleY() < 1.0)
+      expose.enlargeYH(int(1./m_proj.scaleY()));
+    else if (m_proj.scaleY() > 1.0)
+      expose.enlargeYH(1);
+
+    expose &= m_sprite->bounds();
+
+    const int maxw = std::max(0, m_sprite->width()-expose.x);
+    const int maxh = std::max(0, m_sprite->height()-expose.y);
+    expose.w = base::clamp(expose.w, 0, maxw);
+    expose.h = base::clamp(expose.h, 0, maxh);
+    if (expose.isEmpty())
+      continue;
+
+    SpriteCopy copy;
+    copy.offset = offset;
+    if (newEngine) {
+      copy.src = expose;        // New engine, exposed rectangle (without zoom)
+      copy.dest = gfx::Rect(dx + m_padding.x + m_proj.applyX(expose.x),
+                            dy + m_padding.y + m_proj.applyY(expose.y),
+                            m_proj.applyX(expose.w),
+                            m_proj.applyY(expose.h));
+    }
+    else {
+      copy.src = rc;            // Old engine, same rectangle with zoom
+      copy.dest = gfx::Rect(dest.x, dest.y, rc.w, rc.h);
+    }
+    rc2 |= copy.src;
+    exposeRgn |= gfx::Region(expose);
+    copies.push_back(copy);
   }
 
-  if (rc.isEmpty())
+  if (copies.empty())
     return;
 
-  // Bounds of pixels from the sprite canvas that will be exposed in
-  // this render cycle.
-  gfx::Rect expose = m_proj.remove(rc);
-
-  // If the zoom level is less than 100%, we add extra pixels to
-  // the exposed area. Those pixels could be shown in the
-  // rendering process depending on each cel position.
-  // E.g. when we are drawing in a cel with position < (0,0)
-  if (m_proj.scaleX() < 1.0)
-    expose.enlargeXW(int(1./m_proj.scaleX()));
-  // If the zoom level is more than %100 we add an extra pixel to
-  // expose just in case the zoom requires to display it.  Note:
-  // this is really necessary to avoid showing invalid destination
-  // areas in ToolLoopImpl.
-  else if (m_proj.scaleX() > 1.0)
-    expose.enlargeXW(1);
-
-  if (m_proj.scaleY() < 1.0)
-    expose.enlargeYH(int(1./m_proj.scaleY()));
-  else if (m_proj.scaleY() > 1.0)
-    expose.enlargeYH(1);
-
-  expose &= m_sprite->bounds();
-
-  const int maxw = std::max(0, m_sprite->width()-expose.x);
-  const int maxh = std::max(0, m_sprite->height()-expose.y);
-  expose.w = base::clamp(expose.w, 0, maxw);
-  expose.h = base::clamp(expose.h, 0, maxh);
-  if (expose.isEmpty())
-    return;
+  for (SpriteCopy& copy : copies)
+    copy.src.offset(-rc2.origin());
 
-  // rc2 is the rectangle used to create a temporal rendered image of the sprite
-  const auto& pref = Preferences::instance();
-  const bool newEngine = isUsingNewRenderEngine();
-  gfx::Rect rc2;
-  if (newEngine) {
-    rc2 = expose;               // New engine, exposed rectangle (without zoom)
-    dest.x = dx + m_padding.x + m_proj.applyX(rc2.x);
-    dest.y = dy + m_padding.y + m_proj.applyY(rc2.y);
-    dest.w = m_proj.applyX(rc2.w);
-    dest.h = m_proj.applyY(rc2.h);
-  }
-  else {
-    rc2 = rc;                   // Old engine, same rectangle with zoom
-    dest.w = rc.w;
-    dest.h = rc.h;
-  }
+  const int nonactiveLayersOpacity =
+    (m_flags & Editor::kUseNonactiveLayersOpacityWhenEnabled ?
+     pref.experimental.nonactiveLayersOpacity(): 255);
+
+  // Composite the layers with the EditorGpuRender (only the
+  // background is rendered by the EditorRender)
+  bool gpuRender = false;
 
   std::unique_ptr<Image> rendered(nullptr);
   try {
     // Generate a "expose sprite pixels" notification. This is used by
     // tool managers that need to validate this region (copy pixels from
     // the original cel) before it can be used by the RenderEngine.
-    m_document->notifyExposeSpritePixels(m_sprite, gfx::Region(expose));
+    m_document->notifyExposeSpritePixels(m_sprite, exposeRgn);
 
     // Create a temporary RGB bitmap to draw all to it
     rendered.reset(Image::create(IMAGE_RGB, rc2.w, rc2.h,
@@ -632,15 +727,25 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
     m_renderEngine->setNewBlendMethod(pref.experimental.newBlend());
     m_renderEngine->setRefLayersVisiblity(true);
     m_renderEngine->setSelectedLayer(m_layer);
-    if (m_flags & Editor::kUseNonactiveLayersOpacityWhenEnabled)
-      m_renderEngine->setNonactiveLayersOpacity(pref.experimental.nonactiveLayersOpacity());
-    else
-      m_renderEngine->setNonactiveLayersOpacity(255);
+    m_renderEngine->setNonactiveLayersOpacity(nonactiveLayersOpacity);
     m_renderEngine->setProjection(
       newEngine ? render::Projection(): m_proj);
+    // The new engine uses the GPU/Skia mipmaps to scale the
+    // rendered sprite, the old engine uses our own mip levels with
+    // the same downsampling option.
+    m_renderEngine->setMipmaps(
+      !newEngine &&
+      (pref.editor.downsampling() == gen::Downsampling::BILINEAR_MIPMAP ||
+       pref.editor.downsampling() == gen::Downsampling::TRILINEAR_MIPMAP));
+    // Zoomed-out reference layers are resampled once for each zoom
+    // level (except with nearest-neighbor downsampling)
+    m_renderEngine->setFilteredRefLayers(
+      !newEngine &&
+      pref.editor.downsampling() != gen::Downsampling::NEAREST);
     m_renderEngine->setupBackground(m_document, rendered->pixelFormat());
     m_renderEngine->disableOnionskin();
 
+    bool onionskin = false;
     if ((m_flags & kShowOnionskin) == kShowOnionskin) {
       if (m_docPref.onionskin.active()) {
         OnionskinOptions opts(
@@ -663,6 +768,7 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
         opts.loopTag(tag);
 
         m_renderEngine->setOnionskin(opts);
+        onionskin = true;
       }
     }
 
@@ -676,8 +782,62 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
         m_layer, m_frame);
     }
 
-    m_renderEngine->renderSprite(
-      rendered.get(), m_sprite, m_frame, gfx::Clip(0, 0, rc2));
+    // Use the frame that was rendered in background if we are
+    // playing the animation (only for the new engine which renders
+    // the sprite without zoom)
+    doc::ImageRef cachedFrame;
+    if (newEngine &&
+        m_isPlaying &&
+        !onionskin &&
+        (!extraCel || extraCel->type() == render::ExtraType::NONE)) {
+      if (auto playState = dynamic_cast<PlayState*>(m_state.get())) {
+        if (PlaybackCache* cache = playState->playbackCache())
+          cachedFrame = cache->getFrame(m_frame);
+      }
+    }
+
+    // Pixels rendered without zoom by all editors are kept so other
+    // editors can reuse them (only the preview editor reads them, the
+    // main editors always render the sprite)
+    const bool useFrameCache =
+      (newEngine && !onionskin &&
+       m_renderEngine->canReuseRenderedPixels());
+    EditorRenderKey renderKey;
+    if (useFrameCache)
+      renderKey = get_editor_render_key(this);
+
+    gpuRender =
+      (newEngine &&
+       !cachedFrame &&
+       !onionskin &&
+       pref.experimental.gpuRender() &&
+       pref.experimental.newBlend() &&
+       !m_renderEngine->hasPreviewImage() &&
+       (!extraCel || extraCel->type() == render::ExtraType::NONE) &&
+       EditorGpuRender::canRenderSprite(m_sprite, m_frame));
+
+    if (cachedFrame) {
+      doc::copy_image(rendered.get(), cachedFrame.get(), -rc2.x, -rc2.y);
+    }
+    else if (gpuRender) {
+      m_renderEngine->renderCheckedBackground(
+        rendered.get(), gfx::Clip(0, 0, rc2));
+    }
+    else if (!useFrameCache ||
+             (m_flags & kReuseRenderedPixels) == 0 ||
+             !RenderedFrameCache::instance()->get(
+               m_sprite, m_frame, renderKey,
+               m_renderEngine->previewImageVersion(),
+               rendered.get(), rc2)) {
+      m_renderEngine->renderSprite(
+        rendered.get(), m_sprite, m_frame, gfx::Clip(0, 0, rc2));
+
+      if (useFrameCache)
+        RenderedFrameCache::instance()->put(
+          m_sprite, m_frame, renderKey,
+          m_renderEngine->previewImageVersion(),
+          rendered.get(), rc2);
+    }
 
     m_renderEngine->removeExtraImage();
 
@@ -745,26 +905,40 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
           }
         }
 
-        g->drawSurface(tmp.get(),
-                       gfx::Rect(0, 0, rc2.w, rc2.h),
-                       dest,
-                       sampling);
+        if (gpuRender) {
+          m_gpuRender->setSelectedLayer(m_layer);
+          m_gpuRender->setNonactiveLayersOpacity(nonactiveLayersOpacity);
+        }
+
+        for (const SpriteCopy& copy : copies) {
+          g->drawSurface(tmp.get(), copy.src, copy.dest, sampling);
+
+          if (gpuRender) {
+            m_gpuRender->renderSprite(g, copy.dest, m_sprite, m_frame,
+                                      gfx::Rect(copy.src).offset(rc2.origin()),
+                                      m_proj, sampling,
+                                      m_document->osColorSpace());
+          }
+        }
       }
       else {
-        g->blit(tmp.get(), 0, 0, dest.x, dest.y, dest.w, dest.h);
+        for (const SpriteCopy& copy : copies) {
+          g->blit(tmp.get(), copy.src.x, copy.src.y,
+                  copy.dest.x, copy.dest.y, copy.dest.w, copy.dest.h);
+        }
       }
     }
   }
 
   // Draw grids
-  {
+  for (const SpriteCopy& copy : copies) {
     gfx::Rect enclosingRect(
-      m_padding.x + dx,
-      m_padding.y + dy,
+      m_padding.x + copy.offset.x,
+      m_padding.y + copy.offset.y,
       m_proj.applyX(m_sprite->width()),
       m_proj.applyY(m_sprite->height()));
 
-    IntersectClip clip(g, dest);
+    IntersectClip clip(g, copy.dest);
     if (clip) {
       // Draw the pixel grid
       if ((m_proj.zoom().scale() > 2.0) && m_docPref.show.pixelGrid()) {
@@ -851,35 +1025,38 @@ void Editor::drawSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& _rc)
     m_proj.applyY(m_sprite->height()));
   gfx::Rect enclosingRect = spriteRect;
 
-  // Draw the main sprite at the center.
-  drawOneSpriteUnclippedRect(g, rc, 0, 0);
+  // The main sprite at the center.
+  std::vector<gfx::Point> copies = { gfx::Point(0, 0) };
 
   // Document preferences
   if (int(m_docPref.tiled.mode()) & int(filters::TiledMode::X_AXIS)) {
-    drawOneSpriteUnclippedRect(g, rc, spriteRect.w, 0);
-    drawOneSpriteUnclippedRect(g, rc, spriteRect.w*2, 0);
+    copies.push_back(gfx::Point(spriteRect.w, 0));
+    copies.push_back(gfx::Point(spriteRect.w*2, 0));
 
     enclosingRect = gfx::Rect(spriteRect.x, spriteRect.y, spriteRect.w*3, spriteRect.h);
   }
 
   if (int(m_docPref.tiled.mode()) & int(filters::TiledMode::Y_AXIS)) {
-    drawOneSpriteUnclippedRect(g, rc, 0, spriteRect.h);
-    drawOneSpriteUnclippedRect(g, rc, 0, spriteRect.h*2);
+    copies.push_back(gfx::Point(0, spriteRect.h));
+    copies.push_back(gfx::Point(0, spriteRect.h*2));
 
     enclosingRect = gfx::Rect(spriteRect.x, spriteRect.y, spriteRect.w, spriteRect.h*3);
   }
 
   if (m_docPref.tiled.mode() == filters::TiledMode::BOTH) {
-    drawOneSpriteUnclippedRect(g, rc, spriteRect.w,   spriteRect.h);
-    drawOneSpriteUnclippedRect(g, rc, spriteRect.w*2, spriteRect.h);
-    drawOneSpriteUnclippedRect(g, rc, spriteRect.w,   spriteRect.h*2);
-    drawOneSpriteUnclippedRect(g, rc, spriteRect.w*2, spriteRect.h*2);
+    copies.push_back(gfx::Point(spriteRect.w,   spriteRect.h));
+    copies.push_back(gfx::Point(spriteRect.w*2, spriteRect.h));
+    copies.push_back(gfx::Point(spriteRect.w,   spriteRect.h*2));
+    copies.push_back(gfx::Point(spriteRect.w*2, spriteRect.h*2));
 
     enclosingRect = gfx::Rect(
       spriteRect.x, spriteRect.y,
       spriteRect.w*3, spriteRect.h*3);
   }
 
+  // All copies are rendered just one time
+  drawSpriteCopiesUnclippedRect(g, rc, copies);
+
   // Draw slices
   if (m_docPref.show.slices())
     drawSlices(g);
@@ -949,8 +1126,23 @@ void Editor::drawSpriteClipped(const gfx::Region& updateRegion)
   ScreenGraphics screenGraphics;
   GraphicsPtr editorGraphics = getGraphics(clientBounds());
 
-  for (const Rect& updateRect : updateRegion) {
+  // Render only the dirty rectangles (merging the small ones), and
+  // only in the parts of the screen that intersect them.
+  std::vector<gfx::Rect> dirtyRects;
+  coalesce_dirty_rects(updateRegion, m_proj, dirtyRects);
+
+  const bool tiled = (m_docPref.tiled.mode() != filters::TiledMode::NONE);
+  const int border = int(std::ceil(std::max(m_proj.scaleX(), m_proj.scaleY())));
+  for (const Rect& updateRect : dirtyRects) {
+    // Bounds of the rendered area in the screen (with the extra
+    // pixels exposed by drawSpriteCopiesUnclippedRect())
+    gfx::Rect screenBounds = editorToScreen(updateRect);
+    screenBounds.enlarge(std::max(1, border));
+
     for (const Rect& screenRect : screenRegion) {
+      if (!tiled && !screenRect.intersects(screenBounds))
+        continue;
+
       IntersectClip clip(&screenGraphics, screenRect);
       if (clip)
         drawSpriteUnclippedRect(editorGraphics.get(), updateRect);
@@ -958,6 +1150,23 @@ void Editor::drawSpriteClipped(const gfx::Region& updateRegion)
   }
 }
 
+void Editor::invalidateSpriteRegion(const gfx::Region& spriteRegion)
+{
+  if (m_docPref.tiled.mode() != filters::TiledMode::NONE) {
+    invalidate();
+    return;
+  }
+
+  const int border = int(std::ceil(std::max(m_proj.scaleX(), m_proj.scaleY())));
+  gfx::Region screenRegion;
+  for (const Rect& rc : spriteRegion) {
+    gfx::Rect screenBounds = editorToScreen(rc);
+    screenBounds.enlarge(std::max(1, border));
+    screenRegion |= gfx::Region(screenBounds);
+  }
+  invalidateRegion(screenRegion);
+}
+
 /**
  * Draws the boundaries, really this routine doesn't use the "mask"
  * field of the sprite, only the "bound" field (so you can have other
@@ -990,10 +1199,20 @@ void Editor::drawMask(Graphics* g)
 
   // We translate the path instead of applying a matrix to the
   // ui::Graphics so the "checked" pattern is not scaled too.
-  gfx::Path path;
-  segs.path().transform(m_proj.scaleMatrix(), &path);
-  path.offset(pt.x, pt.y);
-  g->drawPath(path, paint);
+  if (m_maskPathVersion != segs.version() ||
+      m_maskPathScaleX != m_proj.scaleX() ||
+      m_maskPathScaleY != m_proj.scaleY() ||
+      m_maskPathOrigin != pt) {
+    m_maskPath.rewind();
+    segs.path().transform(m_proj.scaleMatrix(), &m_maskPath);
+    m_maskPath.offset(pt.x, pt.y);
+
+    m_maskPathVersion = segs.version();
+    m_maskPathScaleX = m_proj.scaleX();
+    m_maskPathScaleY = m_proj.scaleY();
+    m_maskPathOrigin = pt;
+  }
+  g->drawPath(m_maskPath, paint);
 }
 
 void Editor::drawMaskSafe()
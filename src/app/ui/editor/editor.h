@@ -27,6 +27,7 @@
 #include "doc/selected_objects.h"
 #include "filters/tiled_mode.h"
 #include "gfx/fwd.h"
+#include "gfx/path.h"
 #include "obs/connection.h"
 #include "os/color_space.h"
 #include "render/projection.h"
@@ -38,6 +39,7 @@
 #include "ui/widget.h"
 
 #include <set>
+#include <vector>
 
 namespace doc {
   class Layer;
@@ -56,6 +58,7 @@ namespace app {
   class Context;
   class DocView;
   class EditorCustomizationDelegate;
+  class EditorGpuRender;
   class EditorRender;
   class PixelsMovement;
   class Site;
@@ -85,6 +88,9 @@ namespace app {
       kShowSymmetryLine = 32,
       kShowSlices = 64,
       kUseNonactiveLayersOpacityWhenEnabled = 128,
+      // Copies the pixels rendered by other editors from the
+      // RenderedFrameCache (e.g. the preview editor)
+      kReuseRenderedPixels = 256,
       kDefaultEditorFlags = (kShowGrid |
                              kShowMask |
                              kShowOnionskin |
@@ -167,6 +173,10 @@ namespace app {
     // Draws the sprite taking care of the whole clipping region.
     void drawSpriteClipped(const gfx::Region& updateRegion);
 
+    // Invalidates the given region (in sprite coordinates) to paint
+    // it in the next paint message
+    void invalidateSpriteRegion(const gfx::Region& spriteRegion);
+
     void flashCurrentLayer();
 
     gfx::Point screenToEditor(const gfx::Point& pt);
@@ -366,10 +376,12 @@ namespace app {
 
     void setCursor(const gfx::Point& mouseScreenPos);
 
-    // Draws the specified portion of sprite in the editor.  Warning:
-    // You should setup the clip of the screen before calling this
-    // routine.
-    void drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& rc, int dx, int dy);
+    // Draws the specified portion of sprite in the editor for each
+    // given offset (copies of the sprite in tiled mode), the sprite is
+    // rendered only one time for all copies. Warning: You should
+    // setup the clip of the screen before calling this routine.
+    void drawSpriteCopiesUnclippedRect(ui::Graphics* g, const gfx::Rect& rc,
+                                       const std::vector<gfx::Point>& offsets);
 
     gfx::Point calcExtraPadding(const render::Projection& proj);
 
@@ -407,6 +419,15 @@ namespace app {
     ui::Timer m_antsTimer;
     int m_antsOffset;
 
+    // Mask boundaries path in screen coordinates, it's transformed
+    // again only when the boundaries, zoom, or scroll change (and not
+    // on each tick of the marching ants).
+    gfx::Path m_maskPath;
+    int m_maskPathVersion = -1;
+    double m_maskPathScaleX = 0.0;
+    double m_maskPathScaleY = 0.0;
+    gfx::Point m_maskPathOrigin;
+
     obs::scoped_connection m_samplingChangeConn;
     obs::scoped_connection m_fgColorChangeConn;
     obs::scoped_connection m_contextBarBrushChangeConn;
@@ -466,6 +487,7 @@ namespace app {
     // same document can show the same preview image/stroke being drawn
     // (search for Render::setPreviewImage()).
     static EditorRender* m_renderEngine;
+    static EditorGpuRender* m_gpuRender;
   };
 
 } // namespace app
@@ -0,0 +1,297 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/ui/editor/editor_gpu_render.h"
+
+#include "doc/blend_internals.h"
+#include "doc/blend_mode.h"
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/image_impl.h"
+#include "doc/layer.h"
+#include "doc/sprite.h"
+#include "os/paint.h"
+#include "os/surface_format.h"
+#include "os/system.h"
+#include "ui/graphics.h"
+
+#include <algorithm>
+
+namespace app {
+
+using namespace doc;
+
+namespace {
+
+// Returns false if the blend mode cannot be done with Skia in the
+// same way that render::Render does it (ADDITION, SUBTRACT, and
+// DIVIDE are not standard blend modes).
+bool to_os_blend_mode(const BlendMode blendMode, os::BlendMode& osBlendMode)
+{
+  switch (blendMode) {
+    case BlendMode::NORMAL:         osBlendMode = os::BlendMode::SrcOver; break;
+    case BlendMode::MULTIPLY:       osBlendMode = os::BlendMode::Multiply; break;
+    case BlendMode::SCREEN:         osBlendMode = os::BlendMode::Screen; break;
+    case BlendMode::OVERLAY:        osBlendMode = os::BlendMode::Overlay; break;
+    case BlendMode::DARKEN:         osBlendMode = os::BlendMode::Darken; break;
+    case BlendMode::LIGHTEN:        osBlendMode = os::BlendMode::Lighten; break;
+    case BlendMode::COLOR_DODGE:    osBlendMode = os::BlendMode::ColorDodge; break;
+    case BlendMode::COLOR_BURN:     osBlendMode = os::BlendMode::ColorBurn; break;
+    case BlendMode::HARD_LIGHT:     osBlendMode = os::BlendMode::HardLight; break;
+    case BlendMode::SOFT_LIGHT:     osBlendMode = os::BlendMode::SoftLight; break;
+    case BlendMode::DIFFERENCE:     osBlendMode = os::BlendMode::Difference; break;
+    case BlendMode::EXCLUSION:      osBlendMode = os::BlendMode::Exclusion; break;
+    case BlendMode::HSL_HUE:        osBlendMode = os::BlendMode::Hue; break;
+    case BlendMode::HSL_SATURATION: osBlendMode = os::BlendMode::Saturation; break;
+    case BlendMode::HSL_COLOR:      osBlendMode = os::BlendMode::Color; break;
+    case BlendMode::HSL_LUMINOSITY: osBlendMode = os::BlendMode::Luminosity; break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+bool can_render_layer(const Layer* layer, const frame_t frame)
+{
+  if (!layer->isVisible())
+    return true;
+
+  if (layer->isGroup()) {
+    for (const Layer* child : static_cast<const LayerGroup*>(layer)->layers()) {
+      if (!can_render_layer(child, frame))
+        return false;
+    }
+    return true;
+  }
+
+  if (!layer->isImage())
+    return false;
+
+  os::BlendMode osBlendMode;
+  return to_os_blend_mode(static_cast<const LayerImage*>(layer)->blendMode(),
+                          osBlendMode);
+}
+
+inline uint32_t premultiplied_color(const int r, const int g, const int b, const int a,
+                                    const os::SurfaceFormatData& fd)
+{
+  int t;
+  return
+    ((MUL_UN8(r, a, t) << fd.redShift  ) & fd.redMask  ) |
+    ((MUL_UN8(g, a, t) << fd.greenShift) & fd.greenMask) |
+    ((MUL_UN8(b, a, t) << fd.blueShift ) & fd.blueMask ) |
+    ((a << fd.alphaShift) & fd.alphaMask);
+}
+
+// Skia surfaces use premultiplied alpha (convert_image_to_surface()
+// doesn't premultiply the colors because it's used for opaque
+// renders).
+void copy_image_to_texture(const Image* image, os::Surface* surface)
+{
+  os::SurfaceFormatData fd;
+  surface->getFormat(&fd);
+
+  const int w = image->width();
+  const int h = image->height();
+  for (int y=0; y<h; ++y) {
+    uint32_t* dst = (uint32_t*)surface->getData(0, y);
+
+    switch (image->pixelFormat()) {
+      case IMAGE_RGB: {
+        auto src = (const RgbTraits::pixel_t*)image->getPixelAddress(0, y);
+        for (int x=0; x<w; ++x, ++src, ++dst)
+          *dst = premultiplied_color(rgba_getr(*src), rgba_getg(*src),
+                                     rgba_getb(*src), rgba_geta(*src), fd);
+        break;
+      }
+      case IMAGE_GRAYSCALE: {
+        auto src = (const GrayscaleTraits::pixel_t*)image->getPixelAddress(0, y);
+        for (int x=0; x<w; ++x, ++src, ++dst)
+          *dst = premultiplied_color(graya_getv(*src), graya_getv(*src),
+                                     graya_getv(*src), graya_geta(*src), fd);
+        break;
+      }
+    }
+  }
+}
+
+} // anonymous namespace
+
+// static
+bool EditorGpuRender::canRenderSprite(const Sprite* sprite,
+                                      const frame_t frame)
+{
+  // Indexed images need the palette and the transparent color index
+  // (the EditorRender handles them)
+  if (sprite->pixelFormat() != IMAGE_RGB &&
+      sprite->pixelFormat() != IMAGE_GRAYSCALE)
+    return false;
+
+  return can_render_layer(sprite->root(), frame);
+}
+
+void EditorGpuRender::renderSprite(ui::Graphics* g,
+                                   const gfx::Rect& dest,
+                                   const Sprite* sprite,
+                                   const frame_t frame,
+                                   const gfx::Rect& area,
+                                   const render::Projection& proj,
+                                   const os::Sampling& sampling,
+                                   const os::ColorSpaceRef& colorSpace)
+{
+  ASSERT(canRenderSprite(sprite, frame));
+  if (dest.isEmpty())
+    return;
+
+  // Layers are blended over a transparent surface (like
+  // render::Render does with the new blending method), and then
+  // that surface is drawn over the checked background.
+  if (!m_canvas ||
+      m_canvas->width() < dest.w ||
+      m_canvas->height() < dest.h ||
+      m_canvas->colorSpace() != colorSpace) {
+    const int maxw = std::max(dest.w, m_canvas ? m_canvas->width(): 0);
+    const int maxh = std::max(dest.h, m_canvas ? m_canvas->height(): 0);
+    m_canvas = os::instance()->makeRgbaSurface(maxw, maxh, colorSpace);
+  }
+  {
+    os::SurfaceLock lock(m_canvas.get());
+    m_canvas->clear();
+  }
+
+  renderLayer(m_canvas.get(), sprite->root(), frame,
+              area, proj, sampling, colorSpace);
+
+  g->drawRgbaSurface(m_canvas.get(), 0, 0, dest.x, dest.y, dest.w, dest.h);
+}
+
+void EditorGpuRender::renderLayer(os::Surface* canvas,
+                                  const Layer* layer,
+                                  const frame_t frame,
+                                  const gfx::Rect& area,
+                                  const render::Projection& proj,
+                                  const os::Sampling& sampling,
+                                  const os::ColorSpaceRef& colorSpace)
+{
+  if (!layer->isVisible())
+    return;
+
+  if (layer->isGroup()) {
+    for (const Layer* child : static_cast<const LayerGroup*>(layer)->layers())
+      renderLayer(canvas, child, frame, area, proj, sampling, colorSpace);
+    return;
+  }
+
+  const Cel* cel = layer->cel(frame);
+  if (!cel)
+    return;
+
+  const LayerImage* imgLayer = static_cast<const LayerImage*>(layer);
+  os::BlendMode osBlendMode;
+  if (!to_os_blend_mode(imgLayer->blendMode(), osBlendMode))
+    return;
+
+  // Same opacity used by render::Render::renderLayer()
+  int t;
+  int opacity = MUL_UN8(cel->opacity(), imgLayer->opacity(), t);
+  if (layer != m_selectedLayer && m_nonactiveLayersOpacity != 255)
+    opacity = MUL_UN8(opacity, m_nonactiveLayersOpacity, t);
+  if (opacity == 0)
+    return;
+
+  const gfx::RectF celBounds =
+    (layer->isReference() ? cel->boundsF(): gfx::RectF(cel->bounds()));
+  if (!gfx::RectF(area).intersects(celBounds))
+    return;
+
+  const Image* image = cel->image();
+  os::Surface* tex = texture(image, colorSpace);
+  if (!tex)
+    return;
+
+  // Cel bounds in the canvas (which starts in the area origin)
+  gfx::RectF dstBounds = proj.apply(celBounds);
+  dstBounds.offset(-proj.applyX<double>(area.x),
+                   -proj.applyY<double>(area.y));
+
+  os::Paint paint;
+  paint.color(gfx::rgba(0, 0, 0, opacity));
+  paint.blendMode(osBlendMode);
+
+  os::SurfaceLock lockSrc(tex);
+  os::SurfaceLock lockDst(canvas);
+  canvas->drawSurface(tex,
+                      image->bounds(),
+                      gfx::Rect(dstBounds),
+                      sampling,
+                      &paint);
+}
+
+os::Surface* EditorGpuRender::texture(const Image* image,
+                                      const os::ColorSpaceRef& colorSpace)
+{
+  auto it = m_textures.begin();
+  for (; it!=m_textures.end(); ++it) {
+    if (it->imageId == image->id())
+      break;
+  }
+
+  if (it != m_textures.end()) {
+    // Move to the front (most recently used)
+    m_textures.splice(m_textures.begin(), m_textures, it);
+
+    Texture& tex = m_textures.front();
+    if (tex.version == image->version() &&
+        tex.surface->colorSpace() == colorSpace)
+      return tex.surface.get();
+
+    // Re-upload the pixels of the new image version (reusing the
+    // surface if the image has the same size)
+    if (tex.surface->width() != image->width() ||
+        tex.surface->height() != image->height() ||
+        tex.surface->colorSpace() != colorSpace) {
+      m_texturesBytes -= 4 * tex.surface->width() * tex.surface->height();
+      tex.surface = os::instance()->makeRgbaSurface(
+        image->width(), image->height(), colorSpace);
+      m_texturesBytes += 4 * image->width() * image->height();
+    }
+  }
+  else {
+    m_textures.push_front(
+      Texture{ image->id(), image->version(),
+               os::instance()->makeRgbaSurface(
+                 image->width(), image->height(), colorSpace) });
+    m_texturesBytes += 4 * image->width() * image->height();
+  }
+
+  Texture& tex = m_textures.front();
+  if (!tex.surface) {
+    m_textures.pop_front();
+    return nullptr;
+  }
+
+  tex.version = image->version();
+  {
+    os::SurfaceLock lock(tex.surface.get());
+    copy_image_to_texture(image, tex.surface.get());
+  }
+
+  // Remove the least recently used surfaces
+  while (m_texturesBytes > kMaxTexturesBytes &&
+         m_textures.size() > 1) {
+    const os::SurfaceRef& surface = m_textures.back().surface;
+    m_texturesBytes -= 4 * surface->width() * surface->height();
+    m_textures.pop_back();
+  }
+
+  return tex.surface.get();
+}
+
+} // namespace app
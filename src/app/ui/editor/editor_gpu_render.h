@@ -0,0 +1,96 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UI_EDITOR_GPU_RENDER_H_INCLUDED
+#define APP_UI_EDITOR_GPU_RENDER_H_INCLUDED
+#pragma once
+
+#include "doc/frame.h"
+#include "doc/object_id.h"
+#include "doc/object_version.h"
+#include "gfx/rect.h"
+#include "os/color_space.h"
+#include "os/sampling.h"
+#include "os/surface.h"
+#include "render/projection.h"
+
+#include <cstddef>
+#include <list>
+
+namespace doc {
+  class Image;
+  class Layer;
+  class Sprite;
+}
+
+namespace ui {
+  class Graphics;
+}
+
+namespace app {
+
+  // Alternative to EditorRender that composites the cels of a sprite
+  // with laf surfaces (Skia) instead of render::Render. Each cel
+  // image is converted to a surface (a texture when the GPU
+  // acceleration is enabled) once per image version, and then the
+  // layers are drawn with the zoom, opacity, and blend mode of each
+  // layer directly by Skia. The EditorRender is still used for the
+  // checked background and for all the cases that are not supported
+  // (onion skin, previews, tilemaps, some blend modes, etc.), and it
+  // is the reference of how pixels must look.
+  class EditorGpuRender {
+  public:
+    // Memory used by the surfaces of the cel images
+    static constexpr std::size_t kMaxTexturesBytes = 256*1024*1024;
+
+    // Returns true if all the visible layers of the given frame can
+    // be composited with this renderer.
+    static bool canRenderSprite(const doc::Sprite* sprite,
+                                const doc::frame_t frame);
+
+    void setSelectedLayer(const doc::Layer* layer) { m_selectedLayer = layer; }
+    void setNonactiveLayersOpacity(const int opacity) { m_nonactiveLayersOpacity = opacity; }
+
+    // Composites the given area of the sprite (in sprite
+    // coordinates) with the given projection over a transparent
+    // surface, and draws it in "g" at "dest" (over the background
+    // that was already drawn there).
+    void renderSprite(ui::Graphics* g,
+                      const gfx::Rect& dest,
+                      const doc::Sprite* sprite,
+                      const doc::frame_t frame,
+                      const gfx::Rect& area,
+                      const render::Projection& proj,
+                      const os::Sampling& sampling,
+                      const os::ColorSpaceRef& colorSpace);
+
+  private:
+    struct Texture {
+      doc::ObjectId imageId;
+      doc::ObjectVersion version;
+      os::SurfaceRef surface;
+    };
+
+    void renderLayer(os::Surface* canvas,
+                     const doc::Layer* layer,
+                     const doc::frame_t frame,
+                     const gfx::Rect& area,
+                     const render::Projection& proj,
+                     const os::Sampling& sampling,
+                     const os::ColorSpaceRef& colorSpace);
+    os::Surface* texture(const doc::Image* image,
+                         const os::ColorSpaceRef& colorSpace);
+
+    const doc::Layer* m_selectedLayer = nullptr;
+    int m_nonactiveLayersOpacity = 255;
+    os::SurfaceRef m_canvas;
+    std::list<Texture> m_textures; // Most recently used first
+    std::size_t m_texturesBytes = 0;
+  };
+
+} // namespace app
+
+#endif
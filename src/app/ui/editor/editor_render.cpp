@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2018  David Capello
 //
 // This program is distributed under the terms of
@@ -23,6 +23,7 @@ EditorRender::EditorRender()
   : m_render(new render::Render)
 {
   m_render->setNewBlend(Preferences::instance().experimental.newBlend());
+  m_render->setThreads(Preferences::instance().experimental.renderThreads());
 }
 
 EditorRender::~EditorRender()
@@ -110,11 +111,32 @@ void EditorRender::setPreviewImage(const doc::Layer* layer,
                          const doc::BlendMode blendMode)
 {
   m_render->setPreviewImage(layer, frame, image, pos, blendMode);
+  m_hasPreviewImage = (image != nullptr);
+  ++m_previewImageVersion;
 }
 
 void EditorRender::removePreviewImage()
 {
   m_render->removePreviewImage();
+  m_hasPreviewImage = false;
+  m_fastPreview = false;
+  ++m_previewImageVersion;
+}
+
+void EditorRender::setFastPreview(const bool state)
+{
+  m_render->setFastPreview(state);
+  m_fastPreview = state;
+}
+
+void EditorRender::setMipmaps(const bool state)
+{
+  m_render->setMipmaps(state);
+}
+
+void EditorRender::setFilteredRefLayers(const bool state)
+{
+  m_render->setFilteredRefLayers(state);
 }
 
 void EditorRender::setExtraImage(
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2018  David Capello
 //
 // This program is distributed under the terms of
@@ -57,6 +57,21 @@ namespace app {
                          const gfx::Point& pos,
                          const doc::BlendMode blendMode);
     void removePreviewImage();
+    void setFastPreview(const bool state);
+    void setMipmaps(const bool state);
+    void setFilteredRefLayers(const bool state);
+
+    // Incremented each time the preview image is set or removed. The
+    // pixels rendered with the same preview image version can be
+    // reused if the preview image is the one of a drawing stroke
+    // (because the modified areas of the stroke are notified with
+    // Doc::notifySpritePixelsModified(), and other previews like
+    // filters are not).
+    int previewImageVersion() const { return m_previewImageVersion; }
+    bool hasPreviewImage() const { return m_hasPreviewImage; }
+    bool canReuseRenderedPixels() const {
+      return (!m_hasPreviewImage || m_fastPreview);
+    }
 
     void setExtraImage(
       render::ExtraType type,
@@ -95,6 +110,9 @@ namespace app {
 
   private:
     render::Render* m_render;
+    int m_previewImageVersion = 0;
+    bool m_hasPreviewImage = false;
+    bool m_fastPreview = false;
   };
 
 } // namespace app
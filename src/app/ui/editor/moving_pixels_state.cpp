@@ -623,7 +623,7 @@ void MovingPixelsState::onBeforeCommandExecution(CommandExecutionEvent& ev)
       std::unique_ptr<Mask> floatingMask;
       m_pixelsMovement->getDraggedImageCopy(floatingImage, floatingMask);
 
-      clipboard::copy_image(floatingImage.get(),
+      clipboard::copy_image(ImageRef(floatingImage.release()),
                             floatingMask.get(),
                             document->sprite()->palette(m_editor->frame()));
     }
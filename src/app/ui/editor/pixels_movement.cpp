@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2021  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -36,6 +36,7 @@
 #include "doc/algorithm/rotsprite.h"
 #include "doc/algorithm/shift_image.h"
 #include "doc/blend_internals.h"
+#include "doc/cancel_io.h"
 #include "doc/cel.h"
 #include "doc/image.h"
 #include "doc/layer.h"
@@ -132,6 +133,7 @@ PixelsMovement::PixelsMovement(
   , m_canHandleFrameChange(false)
   , m_fastMode(false)
   , m_needsRotSpriteRedraw(false)
+  , m_rotSpriteTimer(25)
 {
   Transformation transform(mask->bounds());
   set_pivot_from_preferences(transform);
@@ -152,6 +154,7 @@ PixelsMovement::PixelsMovement(
   m_rotAlgoConn =
     Preferences::instance().selection.rotationAlgorithm.AfterChange.connect(
       [this]{ onRotationAlgorithmChange(); });
+  m_rotSpriteTimer.Tick.connect([this]{ onRotSpriteTaskTick(); });
 
   // The extra cel must be null, because if it's not null, it means
   // that someone else is using it (e.g. the editor brush preview),
@@ -171,6 +174,16 @@ PixelsMovement::PixelsMovement(
   }
 }
 
+PixelsMovement::~PixelsMovement()
+{
+  cancelRotSpriteTask();
+
+  // Canceled tasks finish quickly (RotSprite is stopped between
+  // steps), but they use their own copy of the images anyway.
+  for (auto& task : m_oldRotSpriteTasks)
+    task->wait();
+}
+
 bool PixelsMovement::editMultipleCels() const
 {
   return
@@ -183,11 +196,10 @@ void PixelsMovement::setFastMode(const bool fastMode)
 {
   bool redraw = (m_fastMode && !fastMode);
   m_fastMode = fastMode;
-  if (m_needsRotSpriteRedraw && redraw) {
-    redrawExtraImage();
-    update_screen_for_document(m_document);
-    m_needsRotSpriteRedraw = false;
-  }
+  if (fastMode)
+    cancelRotSpriteTask();
+  else if (m_needsRotSpriteRedraw && redraw)
+    startRotSpriteTask();
 }
 
 void PixelsMovement::flipImage(doc::algorithm::FlipType flipType)
@@ -768,6 +780,10 @@ void PixelsMovement::setMaskColor(bool opaque, color_t mask_color)
 
 void PixelsMovement::redrawExtraImage(Transformation* transformation)
 {
+  // The new image replaces any pending RotSprite result
+  cancelRotSpriteTask();
+  m_needsRotSpriteRedraw = false;
+
   if (!transformation)
     transformation = &m_currentData;
 
@@ -793,6 +809,129 @@ void PixelsMovement::redrawExtraImage(Transformation* transformation)
   drawImage(*transformation, m_extraCel->image(), bounds.origin(), true);
 }
 
+// Draws the extra cel image with RotSprite in a background task, the
+// fast version of the image is displayed in the meantime.
+void PixelsMovement::startRotSpriteTask()
+{
+  cancelRotSpriteTask();
+  ASSERT(m_extraCel);
+  ASSERT(!m_fastMode);
+
+  // The background task (original layer pixels) is rendered here,
+  // and the task uses copies of the source image/mask, so the
+  // document isn't accessed from the background thread.
+  const gfx::Rect bounds = m_currentData.transformedBounds();
+  ImageRef dst(Image::create(m_extraCel->image()->spec()));
+  Transformation::Corners corners;
+  m_currentData.transformBox(corners);
+  {
+    const gfx::Rect cornersBounds = corners.bounds();
+    dst->setMaskColor(m_site.sprite()->transparentColor());
+    dst->clear(dst->maskColor());
+
+    render::Render render;
+    render.renderLayer(
+      dst.get(), m_site.layer(), m_site.frame(),
+      gfx::Clip(cornersBounds.x-bounds.x, cornersBounds.y-bounds.y, cornersBounds),
+      BlendMode::SRC);
+  }
+
+  color_t maskColor = m_maskColor;
+  if (m_opaque) {
+    if (m_originalImage->pixelFormat() == IMAGE_INDEXED)
+      maskColor = -1;
+    else
+      maskColor = 0;
+  }
+  m_originalImage->setMaskColor(maskColor);
+  ImageRef src(Image::createCopy(m_originalImage.get()));
+  ImageRef mask(Image::createCopy(m_initialMask->bitmap()));
+  const gfx::Point leftTop = bounds.origin();
+
+  m_rotSpriteImage = dst;
+  m_rotSpriteBounds = bounds;
+  m_needsRotSpriteRedraw = false;
+
+  m_rotSpriteTask.reset(new Task);
+  m_rotSpriteTask->run(
+    [dst, src, mask, corners, leftTop](base::task_token& token){
+      class Cancel : public doc::CancelIO {
+      public:
+        Cancel(base::task_token& token) : m_token(token) { }
+        bool isCanceled() override { return m_token.canceled(); }
+      private:
+        base::task_token& m_token;
+      } cancel(token);
+
+      try {
+        doc::algorithm::rotsprite_image(
+          dst.get(), src.get(), mask.get(),
+          int(corners.leftTop().x-leftTop.x),
+          int(corners.leftTop().y-leftTop.y),
+          int(corners.rightTop().x-leftTop.x),
+          int(corners.rightTop().y-leftTop.y),
+          int(corners.rightBottom().x-leftTop.x),
+          int(corners.rightBottom().y-leftTop.y),
+          int(corners.leftBottom().x-leftTop.x),
+          int(corners.leftBottom().y-leftTop.y),
+          &cancel);
+      }
+      catch (const std::bad_alloc&) {
+        // Keep the fast version of the image
+        token.cancel();
+      }
+    },
+    TaskPriority::Interactive);
+  m_rotSpriteTimer.start();
+}
+
+void PixelsMovement::cancelRotSpriteTask()
+{
+  // Remove finished tasks
+  m_oldRotSpriteTasks.erase(
+    std::remove_if(m_oldRotSpriteTasks.begin(),
+                   m_oldRotSpriteTasks.end(),
+                   [](const std::unique_ptr<Task>& task){
+                     return task->completed();
+                   }),
+    m_oldRotSpriteTasks.end());
+
+  if (!m_rotSpriteTask)
+    return;
+
+  // The RotSprite version of the extra cel is still needed
+  m_needsRotSpriteRedraw = true;
+
+  m_rotSpriteTask->cancel();
+  m_oldRotSpriteTasks.push_back(std::move(m_rotSpriteTask));
+  m_rotSpriteImage.reset();
+  m_rotSpriteTimer.stop();
+}
+
+void PixelsMovement::onRotSpriteTaskTick()
+{
+  if (!m_rotSpriteTask ||
+      !m_rotSpriteTask->completed())
+    return;
+
+  m_rotSpriteTimer.stop();
+
+  const bool canceled = m_rotSpriteTask->canceled();
+  std::unique_ptr<Task> task(std::move(m_rotSpriteTask));
+  ImageRef image(std::move(m_rotSpriteImage));
+
+  if (canceled ||
+      !m_extraCel ||
+      m_rotSpriteBounds != m_currentData.transformedBounds() ||
+      m_extraCel->image()->bounds() != image->bounds()) {
+    m_needsRotSpriteRedraw = true;
+    return;
+  }
+
+  copy_image(m_extraCel->image(), image.get());
+  update_screen_for_document(m_document);
+}
+
 void PixelsMovement::redrawCurrentMask()
 {
   drawMask(m_currentMask.get(), true);
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -12,6 +12,7 @@
 #include "app/context_access.h"
 #include "app/extra_cel.h"
 #include "app/site.h"
+#include "app/task.h"
 #include "app/transformation.h"
 #include "app/tx.h"
 #include "app/ui/editor/handle_type.h"
@@ -20,8 +21,10 @@
 #include "doc/image_ref.h"
 #include "gfx/size.h"
 #include "obs/connection.h"
+#include "ui/timer.h"
 
 #include <memory>
+#include <vector>
 
 namespace doc {
   class Image;
@@ -67,6 +70,7 @@ namespace app {
                    const Image* moveThis,
                    const Mask* mask,
                    const char* operationName);
+    ~PixelsMovement();
 
     HandleType handle() const { return m_handle; }
     bool canHandleFrameChange() const { return m_canHandleFrameChange; }
@@ -139,6 +143,9 @@ namespace app {
       const gfx::Point& leftTop);
     void updateDocumentMask();
     void hideDocumentMask();
+    void startRotSpriteTask();
+    void cancelRotSpriteTask();
+    void onRotSpriteTaskTick();
 
     void flipOriginalImage(const doc::algorithm::FlipType flipType);
     void shiftOriginalImage(const int dx, const int dy,
@@ -175,6 +182,16 @@ namespace app {
     bool m_fastMode;
     bool m_needsRotSpriteRedraw;
 
+    // RotSprite version of the extra cel image, computed in a
+    // background task when the fast mode is disabled. The task is
+    // canceled as soon as the transformation changes again (canceled
+    // tasks are kept in m_oldRotSpriteTasks until they finish).
+    std::unique_ptr<Task> m_rotSpriteTask;
+    std::vector<std::unique_ptr<Task>> m_oldRotSpriteTasks;
+    doc::ImageRef m_rotSpriteImage;
+    gfx::Rect m_rotSpriteBounds;
+    ui::Timer m_rotSpriteTimer;
+
     // Commands used in the interaction with the transformed pixels.
     // This is used to re-create the whole interaction on each
     // modified cel when we are modifying multiples cels at the same
@@ -18,6 +18,7 @@
 #include "app/tools/ink.h"
 #include "app/ui/editor/editor.h"
 #include "app/ui/editor/editor_customization_delegate.h"
+#include "app/ui/editor/playback_cache.h"
 #include "app/ui/editor/scrolling_state.h"
 #include "app/ui/skin/skin_theme.h"
 #include "app/ui_context.h"
@@ -27,6 +28,9 @@
 #include "ui/message.h"
 #include "ui/system.h"
 
+#include <algorithm>
+#include <vector>
+
 namespace app {
 
 using namespace ui;
@@ -51,6 +55,10 @@ PlayState::PlayState(const bool playOnce,
     &PlayState::onBeforeCommandExecution, this);
 }
 
+PlayState::~PlayState()
+{
+}
+
 Tag* PlayState::playingTag() const
 {
   return m_tag;
@@ -63,6 +71,7 @@ void PlayState::onEnterState(Editor* editor)
   if (!m_editor) {
     m_editor = editor;
     m_refFrame = editor->frame();
+    m_cache = std::make_unique<PlaybackCache>(editor);
   }
 
   // Get the tag
@@ -89,6 +98,7 @@ void PlayState::onEnterState(Editor* editor)
   m_nextFrameTime = getNextFrameTime();
   m_curFrameTick = base::current_tick();
   m_pingPongForward = true;
+  prefetchNextFrames();
 
   // Maybe we came from ScrollingState and the timer is already
   // running.
@@ -231,6 +241,7 @@ void PlayState::onPlaybackTick()
 
     m_editor->setFrame(frame);
     m_nextFrameTime += getNextFrameTime();
+    prefetchNextFrames();
   }
 
   m_curFrameTick = base::current_tick();
@@ -266,6 +277,30 @@ void PlayState::onBeforeCommandExecution(CommandExecutionEvent& ev)
   m_editor->stop();
 }
 
+void PlayState::prefetchNextFrames()
+{
+  if (!m_cache || m_cache->maxFrames() == 0)
+    return;
+
+  // Follow the same sequence of frames that onPlaybackTick() will
+  // display (using the animation direction of the tag), starting
+  // from the current frame
+  doc::Sprite* sprite = m_editor->sprite();
+  doc::frame_t frame = m_editor->frame();
+  bool pingPongForward = m_pingPongForward;
+  std::vector<doc::frame_t> frames;
+  frames.push_back(frame);
+  while (int(frames.size()) < m_cache->maxFrames()) {
+    frame = calculate_next_frame(
+      sprite, frame, frame_t(1), m_tag,
+      pingPongForward);
+    if (std::find(frames.begin(), frames.end(), frame) != frames.end())
+      break;
+    frames.push_back(frame);
+  }
+  m_cache->prefetch(frames);
+}
+
 double PlayState::getNextFrameTime()
 {
   return
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2020-2021  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -15,6 +15,8 @@
 #include "obs/connection.h"
 #include "ui/timer.h"
 
+#include <memory>
+
 namespace doc {
   class Tag;
 }
@@ -22,14 +24,20 @@ namespace doc {
 namespace app {
 
   class CommandExecutionEvent;
+  class PlaybackCache;
 
   class PlayState : public StateWithWheelBehavior {
   public:
     PlayState(const bool playOnce,
               const bool playAll);
+    ~PlayState();
 
     doc::Tag* playingTag() const;
 
+    // Cache with the pre-rendered next frames of the animation (it
+    // might be nullptr)
+    PlaybackCache* playbackCache() const { return m_cache.get(); }
+
     void onEnterState(Editor* editor) override;
     LeaveAction onLeaveState(Editor* editor, EditorState* newState) override;
     void onBeforePopState(Editor* editor) override;
@@ -49,6 +57,9 @@ namespace app {
 
     double getNextFrameTime();
 
+    // Renders the next frames in background
+    void prefetchNextFrames();
+
     Editor* m_editor;
     bool m_playOnce;
     bool m_playAll;
@@ -65,6 +76,7 @@ namespace app {
     doc::Tag* m_tag;
 
     obs::scoped_connection m_ctxConn;
+    std::unique_ptr<PlaybackCache> m_cache;
   };
 
 } // namespace app
@@ -0,0 +1,230 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/ui/editor/playback_cache.h"
+
+#include "app/doc.h"
+#include "app/ui/editor/editor.h"
+#include "app/ui/editor/editor_render.h"
+#include "doc/image.h"
+#include "doc/sprite.h"
+#include "render/projection.h"
+
+#include <algorithm>
+
+namespace app {
+
+namespace {
+
+// Memory used to keep the rendered frames of one editor
+const std::size_t kMaxCacheBytes = 256*1024*1024;
+
+// Milliseconds to wait the document read lock in the background
+// thread (the frame is requested again in the next playback tick if
+// we cannot lock the document)
+const int kReadLockTimeout = 250;
+
+} // anonymous namespace
+
+PlaybackCache::PlaybackCache(Editor* editor)
+  : m_editor(editor)
+  , m_doc(editor->document())
+{
+  const std::size_t frameBytes =
+    std::size_t(editor->sprite()->width()) * editor->sprite()->height() *
+    doc::RgbTraits::bytes_per_pixel;
+  m_maxFrames = int(std::min<std::size_t>(
+                      kMaxCacheBytes / std::max<std::size_t>(1, frameBytes),
+                      editor->sprite()->totalFrames()));
+
+  if (m_maxFrames > 0)
+    m_thread = std::thread([this]{ threadLoop(); });
+
+  CacheManager::instance()->add(this);
+}
+
+PlaybackCache::~PlaybackCache()
+{
+  CacheManager::instance()->remove(this);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_exit = true;
+  }
+  m_cv.notify_one();
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+doc::ImageRef PlaybackCache::getFrame(const doc::frame_t frame)
+{
+  if (m_maxFrames == 0 ||
+      get_editor_render_key(m_editor) != m_renderKey)
+    return nullptr;
+
+  const uint64_t hash = calculate_frame_hash(m_editor->sprite(), frame);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entries.find(frame);
+  if (it != m_entries.end() &&
+      it->second.hash == hash &&
+      it->second.generation == m_generation) {
+    it->second.used = base::current_tick();
+    return it->second.image;
+  }
+  return nullptr;
+}
+
+void PlaybackCache::prefetch(const std::vector<doc::frame_t>& frames)
+{
+  if (m_maxFrames == 0)
+    return;
+
+  updateRenderKey();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_frames = frames;
+    if (int(m_frames.size()) > m_maxFrames)
+      m_frames.resize(m_maxFrames);
+
+    // Remove frames that will not be displayed soon
+    for (auto it=m_entries.begin(); it!=m_entries.end(); ) {
+      if (it->second.generation != m_generation ||
+          std::find(m_frames.begin(), m_frames.end(), it->first) == m_frames.end())
+        it = m_entries.erase(it);
+      else
+        ++it;
+    }
+  }
+  m_cv.notify_one();
+}
+
+std::size_t PlaybackCache::cacheBytes() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::size_t bytes = 0;
+  for (const auto& it : m_entries)
+    bytes += it.second.image->getMemSize();
+  return bytes;
+}
+
+bool PlaybackCache::cacheOldestUse(base::tick_t& tick) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_entries.empty())
+    return false;
+  tick = std::min_element(
+    m_entries.begin(), m_entries.end(),
+    [](const auto& a, const auto& b){
+      return a.second.used < b.second.used;
+    })->second.used;
+  return true;
+}
+
+void PlaybackCache::evictOldestCacheEntry()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_entries.empty())
+    return;
+  m_entries.erase(std::min_element(
+    m_entries.begin(), m_entries.end(),
+    [](const auto& a, const auto& b){
+      return a.second.used < b.second.used;
+    }));
+}
+
+// Creates a new EditorRender for the background thread if the editor
+// settings were changed (the render engine is configured in the UI
+// thread because it uses the preferences)
+void PlaybackCache::updateRenderKey()
+{
+  const EditorRenderKey key = get_editor_render_key(m_editor);
+  if (m_render && key == m_renderKey)
+    return;
+
+  auto render = std::make_shared<EditorRender>();
+  render->setNewBlendMethod(key.newBlend);
+  render->setRefLayersVisiblity(true);
+  render->setSelectedLayer(key.selectedLayer);
+  render->setNonactiveLayersOpacity(key.nonactiveLayersOpacity);
+  render->setProjection(render::Projection());
+  render->setupBackground(m_doc, doc::IMAGE_RGB);
+  render->disableOnionskin();
+
+  m_renderKey = key;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_render = render;
+  ++m_generation;
+  m_entries.clear();
+}
+
+void PlaybackCache::threadLoop()
+{
+  const doc::Sprite* sprite = m_doc->sprite();
+
+  while (true) {
+    doc::frame_t frame = -1;
+    std::shared_ptr<EditorRender> render;
+    int generation;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this]{ return m_exit || !m_frames.empty(); });
+      if (m_exit)
+        break;
+
+      frame = m_frames.front();
+      m_frames.erase(m_frames.begin());
+      render = m_render;
+      generation = m_generation;
+    }
+
+    // Each frame is rendered with its own lock, so writers don't wait
+    // the whole prefetch
+    if (!m_doc->readLock(kReadLockTimeout))
+      continue;
+
+    doc::ImageRef image;
+    uint64_t hash = 0;
+    try {
+      if (frame < sprite->totalFrames()) {
+        hash = calculate_frame_hash(sprite, frame);
+
+        bool cached;
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          auto it = m_entries.find(frame);
+          cached = (it != m_entries.end() &&
+                    it->second.hash == hash &&
+                    it->second.generation == generation);
+        }
+
+        if (!cached) {
+          image.reset(doc::Image::create(doc::IMAGE_RGB,
+                                         sprite->width(),
+                                         sprite->height()));
+          render->renderSprite(image.get(), sprite, frame);
+        }
+      }
+    }
+    catch (const std::exception&) {
+      // Ignore errors, the editor will render this frame
+      image.reset();
+    }
+    m_doc->unlock();
+
+    if (image) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (generation == m_generation)
+        m_entries[frame] = Entry{ image, hash, generation, base::current_tick() };
+    }
+  }
+}
+
+} // namespace app
@@ -0,0 +1,90 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UI_EDITOR_PLAYBACK_CACHE_H_INCLUDED
+#define APP_UI_EDITOR_PLAYBACK_CACHE_H_INCLUDED
+#pragma once
+
+#include "app/cache_manager.h"
+#include "app/ui/editor/rendered_frame_cache.h"
+#include "doc/frame.h"
+#include "doc/image_ref.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace app {
+  class Doc;
+  class Editor;
+  class EditorRender;
+
+  // Pre-renders the next frames of the animation that is being played
+  // in an editor in a background thread, so the editor can just copy
+  // the rendered frame on each playback tick. The frames are rendered
+  // with the same settings used by the editor (background, selected
+  // layer, etc.) at 100% zoom, and they are discarded when the content
+  // of the frame changes (each frame has a hash of its cels/layers).
+  class PlaybackCache : public ManagedCache {
+  public:
+    PlaybackCache(Editor* editor);
+    ~PlaybackCache();
+
+    // Returns the rendered frame (with the size of the sprite) if it's
+    // still valid, or nullptr if the editor must render it. Called
+    // from the UI thread.
+    doc::ImageRef getFrame(const doc::frame_t frame);
+
+    // Indicates the next frames that will be displayed (in the given
+    // order). Frames that are not in the list are removed from the
+    // cache. Called from the UI thread.
+    void prefetch(const std::vector<doc::frame_t>& frames);
+
+    // Maximum number of frames that can be cached with the memory
+    // budget (0 if the sprite is too big to use the cache)
+    int maxFrames() const { return m_maxFrames; }
+
+    // ManagedCache impl
+    const char* cacheName() const override { return "Playback"; }
+    std::size_t cacheBytes() const override;
+    bool cacheOldestUse(base::tick_t& tick) const override;
+    void evictOldestCacheEntry() override;
+
+  private:
+    struct Entry {
+      doc::ImageRef image;
+      uint64_t hash;
+      int generation;
+      base::tick_t used;
+    };
+
+    void updateRenderKey();
+    void threadLoop();
+
+    Editor* m_editor;
+    Doc* m_doc;
+    int m_maxFrames;
+
+    // Accessed from the UI thread only
+    EditorRenderKey m_renderKey;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::map<doc::frame_t, Entry> m_entries;
+    std::vector<doc::frame_t> m_frames; // Frames to render
+    std::shared_ptr<EditorRender> m_render;
+    int m_generation = 0;          // Incremented when m_render changes
+    bool m_exit = false;
+    std::thread m_thread;
+  };
+
+} // namespace app
+
+#endif
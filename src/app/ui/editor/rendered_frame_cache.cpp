@@ -0,0 +1,253 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/ui/editor/rendered_frame_cache.h"
+
+#include "app/color_utils.h"
+#include "app/pref/preferences.h"
+#include "app/ui/editor/editor.h"
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/layer.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/sprite.h"
+
+#include <tuple>
+
+namespace app {
+
+namespace {
+
+// Frames kept in the cache (e.g. one for each set of editor settings
+// that are being displayed, or the previous/next frame)
+const std::size_t kMaxCachedFrames = 4;
+
+uint64_t hash_value(uint64_t hash, const uint64_t value)
+{
+  hash ^= value;
+  hash *= 1099511628211ull;
+  return hash;
+}
+
+uint64_t hash_layers(uint64_t hash,
+                     const doc::LayerGroup* group,
+                     const doc::frame_t frame)
+{
+  for (const doc::Layer* layer : group->layers()) {
+    hash = hash_value(hash, layer->id());
+    hash = hash_value(hash, uint64_t(layer->flags()));
+    if (!layer->isVisible())
+      continue;
+
+    if (layer->isImage()) {
+      auto imageLayer = static_cast<const doc::LayerImage*>(layer);
+      hash = hash_value(hash, imageLayer->opacity());
+      hash = hash_value(hash, int(imageLayer->blendMode()));
+
+      if (const doc::Cel* cel = layer->cel(frame)) {
+        hash = hash_value(hash, cel->image()->id());
+        hash = hash_value(hash, cel->image()->version());
+        hash = hash_value(hash, uint32_t(cel->x()));
+        hash = hash_value(hash, uint32_t(cel->y()));
+        hash = hash_value(hash, cel->opacity());
+      }
+    }
+    else if (layer->isGroup()) {
+      hash = hash_layers(hash, static_cast<const doc::LayerGroup*>(layer), frame);
+    }
+  }
+  return hash;
+}
+
+} // anonymous namespace
+
+bool EditorRenderKey::operator==(const EditorRenderKey& o) const
+{
+  return
+    std::tie(selectedLayer, nonactiveLayersOpacity, newBlend,
+             bgType, bgSize.w, bgSize.h, bgZoom, bgColor1, bgColor2) ==
+    std::tie(o.selectedLayer, o.nonactiveLayersOpacity, o.newBlend,
+             o.bgType, o.bgSize.w, o.bgSize.h, o.bgZoom, o.bgColor1, o.bgColor2);
+}
+
+EditorRenderKey get_editor_render_key(Editor* editor)
+{
+  const auto& pref = Preferences::instance();
+  DocumentPreferences& docPref = editor->docPref();
+
+  EditorRenderKey key;
+  if (editor->editorFlags() & Editor::kUseNonactiveLayersOpacityWhenEnabled)
+    key.nonactiveLayersOpacity = pref.experimental.nonactiveLayersOpacity();
+  // The selected layer is used only to render the other layers with
+  // the non-active layers opacity
+  if (key.nonactiveLayersOpacity < 255)
+    key.selectedLayer = editor->layer();
+  key.newBlend = pref.experimental.newBlend();
+  key.bgType = int(docPref.bg.type());
+  key.bgSize = docPref.bg.size();
+  key.bgZoom = docPref.bg.zoom();
+  key.bgColor1 = color_utils::color_for_image_without_alpha(docPref.bg.color1(), doc::IMAGE_RGB);
+  key.bgColor2 = color_utils::color_for_image_without_alpha(docPref.bg.color2(), doc::IMAGE_RGB);
+  return key;
+}
+
+uint64_t calculate_frame_hash(const doc::Sprite* sprite,
+                              const doc::frame_t frame)
+{
+  const doc::Palette* pal = sprite->palette(frame);
+  uint64_t hash = 14695981039346656037ull;
+  hash = hash_value(hash, sprite->width());
+  hash = hash_value(hash, sprite->height());
+  hash = hash_value(hash, int(sprite->pixelFormat()));
+  hash = hash_value(hash, sprite->transparentColor());
+  hash = hash_value(hash, pal->id());
+  hash = hash_value(hash, pal->version());
+  hash = hash_value(hash, pal->getModifications());
+  return hash_layers(hash, sprite->root(), frame);
+}
+
+// static
+RenderedFrameCache* RenderedFrameCache::instance()
+{
+  static RenderedFrameCache cache;
+  return &cache;
+}
+
+RenderedFrameCache::RenderedFrameCache()
+{
+  CacheManager::instance()->add(this);
+}
+
+RenderedFrameCache::~RenderedFrameCache()
+{
+  CacheManager::instance()->remove(this);
+}
+
+bool RenderedFrameCache::get(const doc::Sprite* sprite,
+                             const doc::frame_t frame,
+                             const EditorRenderKey& key,
+                             const int previewImageVersion,
+                             doc::Image* dst,
+                             const gfx::Rect& area)
+{
+  Entry* entry = find(sprite, frame, calculate_frame_hash(sprite, frame),
+                      key, previewImageVersion);
+  if (!entry || entry->valid.contains(area) != gfx::Region::In)
+    return false;
+
+  doc::copy_image(dst, entry->image.get(), -area.x, -area.y);
+  return true;
+}
+
+void RenderedFrameCache::put(const doc::Sprite* sprite,
+                             const doc::frame_t frame,
+                             const EditorRenderKey& key,
+                             const int previewImageVersion,
+                             const doc::Image* src,
+                             const gfx::Rect& area)
+{
+  const uint64_t hash = calculate_frame_hash(sprite, frame);
+  Entry* entry = find(sprite, frame, hash, key, previewImageVersion);
+  if (!entry) {
+    // Reuse the least recently used entry (and its image if it has
+    // the same size)
+    doc::ImageRef image;
+    if (m_entries.size() >= kMaxCachedFrames) {
+      if (m_entries.back().image->width() == sprite->width() &&
+          m_entries.back().image->height() == sprite->height())
+        image = m_entries.back().image;
+      m_entries.pop_back();
+    }
+    if (!image)
+      image.reset(doc::Image::create(doc::IMAGE_RGB,
+                                     sprite->width(),
+                                     sprite->height()));
+
+    m_entries.push_front(Entry{ sprite->id(), frame, hash, key,
+                                previewImageVersion, image, gfx::Region(),
+                                base::current_tick() });
+    entry = &m_entries.front();
+  }
+
+  doc::copy_image(entry->image.get(), src, area.x, area.y);
+  entry->valid |= gfx::Region(area & sprite->bounds());
+}
+
+void RenderedFrameCache::invalidate(const doc::Sprite* sprite,
+                                    const doc::frame_t frame,
+                                    const gfx::Region& region)
+{
+  for (Entry& entry : m_entries) {
+    if (entry.spriteId == sprite->id() &&
+        entry.frame == frame)
+      entry.valid -= region;
+  }
+}
+
+void RenderedFrameCache::clear(const doc::Sprite* sprite)
+{
+  for (auto it=m_entries.begin(); it!=m_entries.end(); ) {
+    if (it->spriteId == sprite->id())
+      it = m_entries.erase(it);
+    else
+      ++it;
+  }
+}
+
+void RenderedFrameCache::clear()
+{
+  m_entries.clear();
+}
+
+std::size_t RenderedFrameCache::cacheBytes() const
+{
+  std::size_t bytes = 0;
+  for (const Entry& entry : m_entries)
+    bytes += entry.image->getMemSize();
+  return bytes;
+}
+
+bool RenderedFrameCache::cacheOldestUse(base::tick_t& tick) const
+{
+  if (m_entries.empty())
+    return false;
+  tick = m_entries.back().used;
+  return true;
+}
+
+void RenderedFrameCache::evictOldestCacheEntry()
+{
+  if (!m_entries.empty())
+    m_entries.pop_back();
+}
+
+RenderedFrameCache::Entry* RenderedFrameCache::find(const doc::Sprite* sprite,
+                                                    const doc::frame_t frame,
+                                                    const uint64_t hash,
+                                                    const EditorRenderKey& key,
+                                                    const int previewImageVersion)
+{
+  for (auto it=m_entries.begin(); it!=m_entries.end(); ++it) {
+    if (it->spriteId == sprite->id() &&
+        it->frame == frame &&
+        it->hash == hash &&
+        it->key == key &&
+        it->previewImageVersion == previewImageVersion) {
+      // Move to the front (most recently used)
+      m_entries.splice(m_entries.begin(), m_entries, it);
+      m_entries.front().used = base::current_tick();
+      return &m_entries.front();
+    }
+  }
+  return nullptr;
+}
+
+} // namespace app
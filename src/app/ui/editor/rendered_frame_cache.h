@@ -0,0 +1,134 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UI_EDITOR_RENDERED_FRAME_CACHE_H_INCLUDED
+#define APP_UI_EDITOR_RENDERED_FRAME_CACHE_H_INCLUDED
+#pragma once
+
+#include "app/cache_manager.h"
+#include "doc/color.h"
+#include "doc/frame.h"
+#include "doc/image_ref.h"
+#include "doc/object_id.h"
+#include "gfx/rect.h"
+#include "gfx/region.h"
+#include "gfx/size.h"
+
+#include <cstdint>
+#include <list>
+
+namespace doc {
+  class Image;
+  class Layer;
+  class Sprite;
+}
+
+namespace app {
+  class Editor;
+
+  // Settings of an editor that change the rendered pixels of a frame
+  // (without zoom)
+  struct EditorRenderKey {
+    const doc::Layer* selectedLayer = nullptr;
+    int nonactiveLayersOpacity = 255;
+    bool newBlend = false;
+    int bgType = 0;
+    gfx::Size bgSize;
+    bool bgZoom = false;
+    doc::color_t bgColor1 = 0;
+    doc::color_t bgColor2 = 0;
+
+    bool operator==(const EditorRenderKey& o) const;
+    bool operator!=(const EditorRenderKey& o) const { return !operator==(o); }
+  };
+
+  EditorRenderKey get_editor_render_key(Editor* editor);
+
+  // Hash of everything that can change the rendered frame (layers,
+  // cels, image versions, palette) without reading the pixels. The
+  // pixels of a stroke are drawn in a new image (ExpandCelCanvas) and
+  // notified with Doc::notifySpritePixelsModified() without changing
+  // its version, so they are invalidated by region, and the writes
+  // without notifications (e.g. from scripts) increment the image
+  // version.
+  uint64_t calculate_frame_hash(const doc::Sprite* sprite,
+                                const doc::frame_t frame);
+
+  // Pixels of frames rendered by the editors without zoom, so other
+  // editors of the same sprite (e.g. the preview window) can copy the
+  // areas that were already rendered instead of compositing all the
+  // layers again. Each frame keeps the region of valid pixels, when
+  // pixels are modified (Doc::notifySpritePixelsModified()) that
+  // region is invalidated, and when the layers/cels change the whole
+  // frame is discarded (its hash changes). Only editors with the
+  // Editor::kReuseRenderedPixels flag (the preview editor) read the
+  // cache. Used from the UI thread only.
+  class RenderedFrameCache : public ManagedCache {
+  public:
+    static RenderedFrameCache* instance();
+
+    RenderedFrameCache();
+    ~RenderedFrameCache();
+
+    // Copies the area (in sprite coordinates) of the given frame to
+    // dst (at 0,0) if it's fully available in the cache.
+    bool get(const doc::Sprite* sprite,
+             const doc::frame_t frame,
+             const EditorRenderKey& key,
+             const int previewImageVersion,
+             doc::Image* dst,
+             const gfx::Rect& area);
+
+    // Adds the rendered pixels of the area of the given frame (src
+    // has the size of the area).
+    void put(const doc::Sprite* sprite,
+             const doc::frame_t frame,
+             const EditorRenderKey& key,
+             const int previewImageVersion,
+             const doc::Image* src,
+             const gfx::Rect& area);
+
+    void invalidate(const doc::Sprite* sprite,
+                    const doc::frame_t frame,
+                    const gfx::Region& region);
+
+    // Removes all the frames of the given sprite
+    void clear(const doc::Sprite* sprite);
+
+    // Removes all the frames (e.g. when the screen is refreshed
+    // because pixels were modified without notifications)
+    void clear();
+
+    // ManagedCache impl
+    const char* cacheName() const override { return "Rendered frames"; }
+    std::size_t cacheBytes() const override;
+    bool cacheOldestUse(base::tick_t& tick) const override;
+    void evictOldestCacheEntry() override;
+
+  private:
+    struct Entry {
+      doc::ObjectId spriteId;
+      doc::frame_t frame;
+      uint64_t hash;
+      EditorRenderKey key;
+      int previewImageVersion;
+      doc::ImageRef image;
+      gfx::Region valid;
+      base::tick_t used;
+    };
+
+    Entry* find(const doc::Sprite* sprite,
+                const doc::frame_t frame,
+                const uint64_t hash,
+                const EditorRenderKey& key,
+                const int previewImageVersion);
+
+    std::list<Entry> m_entries; // Most recently used first
+  };
+
+} // namespace app
+
+#endif
@@ -636,6 +636,33 @@ void FileList::onCurrentFolderChanged()
 
 void FileList::onMonitoringTick()
 {
+  // Add the new items found in the current folder
+  if (m_loader) {
+    if (m_loader->poll())
+      onFolderItemsChange();
+    if (m_loader->isDone())
+      m_loader.reset();
+  }
+
+  // Forget thumbnails of items that aren't visible anymore (e.g. the
+  // user scrolled the list), so the visible ones are generated first.
+  if (isIconView()) {
+    const std::set<IFileItem*> visibleItems = getVisibleItems();
+    auto isNeeded = [this, &visibleItems](IFileItem* fi){
+      return (fi == m_selected ||
+              visibleItems.find(fi) != visibleItems.end());
+    };
+
+    for (auto it=m_generateThumbnailsForTheseItems.begin();
+         it != m_generateThumbnailsForTheseItems.end(); ) {
+      if (isNeeded(*it))
+        ++it;
+      else
+        it = m_generateThumbnailsForTheseItems.erase(it);
+    }
+    ThumbnailGenerator::instance()->discardThumbnails(isNeeded);
+  }
+
   auto start = base::current_tick();
   while (!m_generateThumbnailsForTheseItems.empty() &&
          // No more than 200ms launching thumbnail generators
@@ -649,6 +676,22 @@ void FileList::onMonitoringTick()
     invalidate();
 }
 
+std::set<IFileItem*> FileList::getVisibleItems() const
+{
+  std::set<IFileItem*> items;
+  View* view = View::getView(this);
+  if (!view)
+    return items;
+
+  const gfx::Rect vp = view->viewportBounds();
+  for (int i=0; i<int(m_list.size()); ++i) {
+    const ItemInfo info = getFileItemInfo(i);
+    if (vp.intersects(gfx::Rect(info.bounds).offset(bounds().origin())))
+      items.insert(m_list[i]);
+  }
+  return items;
+}
+
 void FileList::onGenerateThumbnailTick()
 {
   m_generateThumbnailTimer.stop();
@@ -823,6 +866,14 @@ void FileList::makeSelectedFileitemVisible()
 
 void FileList::regenerateList()
 {
+  // Start listing the current folder in background (it's canceled if
+  // we were listing other folder)
+  if (!m_loader || m_loader->folder() != m_currentFolder) {
+    m_loader = std::make_unique<FolderLoader>(m_currentFolder);
+    if (m_loader->isDone())
+      m_loader.reset();
+  }
+
   // get the children of the current folder
   m_list = m_currentFolder->children();
 
@@ -854,6 +905,43 @@ void FileList::regenerateList()
     m_selectedItems.clear();
 }
 
+// Called when new items of the current folder were found by the
+// FolderLoader (or old items were removed)
+void FileList::onFolderItemsChange()
+{
+  // Keep the scroll position (regenerateList() makes the selected
+  // item visible)
+  View* view = View::getView(this);
+  const gfx::Point scroll = (view ? view->viewScroll(): gfx::Point(0, 0));
+
+  m_req_valid = false;
+  regenerateList();
+
+  if (view)
+    view->setViewScroll(scroll);
+
+  auto isInList = [this](IFileItem* fi){
+    return (std::find(m_list.begin(), m_list.end(), fi) != m_list.end());
+  };
+
+  if (m_selected && !isInList(m_selected))
+    m_selected = nullptr;
+  if (m_itemToGenerateThumbnail && !isInList(m_itemToGenerateThumbnail))
+    m_itemToGenerateThumbnail = nullptr;
+  m_generateThumbnailsForTheseItems.erase(
+    std::remove_if(m_generateThumbnailsForTheseItems.begin(),
+                   m_generateThumbnailsForTheseItems.end(),
+                   [&isInList](IFileItem* fi){ return !isInList(fi); }),
+    m_generateThumbnailsForTheseItems.end());
+
+  // Select the first folder if nothing is selected yet (as in
+  // setCurrentFolder())
+  if (!m_selected && !m_list.empty() && m_list.front()->isBrowsable())
+    selectIndex(0);
+
+  invalidate();
+}
+
 int FileList::selectedIndex() const
 {
   for (auto it = m_list.begin(), end = m_list.end();
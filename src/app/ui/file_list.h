@@ -18,6 +18,8 @@
 #include "ui/widget.h"
 
 #include <deque>
+#include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -87,10 +89,12 @@ namespace app {
     ItemInfo getFileItemInfo(int i) const;
     void makeSelectedFileitemVisible();
     void regenerateList();
+    void onFolderItemsChange();
     int selectedIndex() const;
     void selectIndex(int index);
     void generateThumbnailForFileItem(IFileItem* fi);
     void delayThumbnailGenerationForSelectedItem();
+    std::set<IFileItem*> getVisibleItems() const;
     bool hasThumbnailsPerItem() const { return m_zoom > 1.0; }
     bool isListView() const { return !hasThumbnailsPerItem(); }
     bool isIconView() const { return hasThumbnailsPerItem(); }
@@ -101,6 +105,10 @@ namespace app {
 
     IFileItem* m_currentFolder;
     FileItemList m_list;
+
+    // Lists the current folder in background (the new items are
+    // added to m_list in each m_monitoringTimer tick)
+    std::unique_ptr<FolderLoader> m_loader;
     std::vector<ItemInfo> m_info;
 
     bool m_req_valid;
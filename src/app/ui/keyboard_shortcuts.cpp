@@ -25,6 +25,7 @@
 #include "app/ui_context.h"
 #include "app/xml_document.h"
 #include "app/xml_exception.h"
+#include "os/system.h"
 #include "ui/accelerator.h"
 #include "ui/message.h"
 
@@ -36,6 +37,15 @@
 
 namespace {
 
+  // Incremented each time a Key or the list of keys of a
+  // KeyboardShortcuts is modified, so the KeyboardShortcuts indexes
+  // are re-created before the next lookup.
+  int g_keysVersion = 0;
+
+  void keys_changed() {
+    ++g_keysVersion;
+  }
+
   static struct {
     const char* name;
     const char* userfriendly;
@@ -336,6 +346,7 @@ void Key::add(const ui::Accelerator& accel,
 {
   m_adds.emplace_back(source, accel);
   m_accels.reset();
+  keys_changed();
 
   // Remove the accelerator from other commands
   if (source == KeySource::ExtensionDefined ||
@@ -419,6 +430,7 @@ void Key::disableAccel(const ui::Accelerator& accel,
 
   m_dels.emplace_back(source, accel);
   m_accels.reset();
+  keys_changed();
 }
 
 void Key::reset()
@@ -426,6 +438,7 @@ void Key::reset()
   erase_accels(m_adds, KeySource::UserDefined);
   erase_accels(m_dels, KeySource::UserDefined);
   m_accels.reset();
+  keys_changed();
 }
 
 void Key::copyOriginalToUser()
@@ -439,6 +452,7 @@ void Key::copyOriginalToUser()
   for (const auto& kv : copy)
     m_adds.emplace_back(KeySource::UserDefined, kv.second);
   m_accels.reset();
+  keys_changed();
 }
 
 std::string Key::triggerString() const
@@ -474,6 +488,7 @@ KeyboardShortcuts* KeyboardShortcuts::instance()
 }
 
 KeyboardShortcuts::KeyboardShortcuts()
+  : m_indexesVersion(-1)
 {
 }
 
@@ -492,12 +507,14 @@ void KeyboardShortcuts::setKeys(const KeyboardShortcuts& keys,
   else {
     m_keys = keys.m_keys;
   }
+  keys_changed();
   UserChange();
 }
 
 void KeyboardShortcuts::clear()
 {
   m_keys.clear();
+  keys_changed();
 }
 
 void KeyboardShortcuts::importFile(TiXmlElement* rootElement, KeySource source)
@@ -796,17 +813,24 @@ KeyPtr KeyboardShortcuts::command(const char* commandName, const Params& params,
   if (!command)
     return nullptr;
 
-  for (KeyPtr& key : m_keys) {
-    if (key->type() == KeyType::Command &&
-        key->keycontext() == keyContext &&
-        key->command() == command &&
-        key->params() == params) {
-      return key;
+  updateIndexes();
+  auto it = m_commandIndex.find(command);
+  if (it != m_commandIndex.end()) {
+    for (const int i : it->second) {
+      const KeyPtr& key = m_keys[i];
+      if (key->keycontext() == keyContext &&
+          key->params() == params) {
+        return key;
+      }
     }
   }
 
   KeyPtr key = std::make_shared<Key>(command, params, keyContext);
   m_keys.push_back(key);
+
+  // The new key doesn't have accelerators, so we can add it to the
+  // indexes without re-creating them
+  m_commandIndex[command].push_back(int(m_keys.size())-1);
   return key;
 }
 
@@ -821,6 +845,7 @@ KeyPtr KeyboardShortcuts::tool(tools::Tool* tool)
 
   KeyPtr key = std::make_shared<Key>(KeyType::Tool, tool);
   m_keys.push_back(key);
+  keys_changed();
   return key;
 }
 
@@ -835,6 +860,7 @@ KeyPtr KeyboardShortcuts::quicktool(tools::Tool* tool)
 
   KeyPtr key = std::make_shared<Key>(KeyType::Quicktool, tool);
   m_keys.push_back(key);
+  keys_changed();
   return key;
 }
 
@@ -849,6 +875,7 @@ KeyPtr KeyboardShortcuts::action(KeyAction action)
 
   KeyPtr key = std::make_shared<Key>(action);
   m_keys.push_back(key);
+  keys_changed();
   return key;
 }
 
@@ -863,6 +890,7 @@ KeyPtr KeyboardShortcuts::wheelAction(WheelAction wheelAction)
 
   KeyPtr key = std::make_shared<Key>(wheelAction);
   m_keys.push_back(key);
+  keys_changed();
   return key;
 }
 
@@ -906,11 +934,113 @@ KeyContext KeyboardShortcuts::getCurrentKeyContext()
     return KeyContext::Normal;
 }
 
+Keys KeyboardShortcuts::pressedKeys(const ui::Message* msg)
+{
+  Keys keys;
+  if (auto keyMsg = dynamic_cast<const KeyMessage*>(msg)) {
+    std::vector<Accelerator> accels;
+    if (keyMsg->scancode())
+      accels.push_back(Accelerator(keyMsg->modifiers(), keyMsg->scancode(), 0));
+    if (keyMsg->unicodeChar())
+      accels.push_back(Accelerator(keyMsg->modifiers(), kKeyNil, keyMsg->unicodeChar()));
+
+    // Check the key context of each candidate
+    for (const KeyPtr& key : findKeysWithAccels(accels)) {
+      if (key->isPressed(msg, *this))
+        keys.push_back(key);
+    }
+  }
+  else {
+    for (const KeyPtr& key : m_keys) {
+      if (key->isPressed(msg, *this))
+        keys.push_back(key);
+    }
+  }
+  return keys;
+}
+
+Keys KeyboardShortcuts::pressedKeys(const bool loosely)
+{
+  os::System* sys = os::instance();
+  if (!sys)
+    return Keys();
+
+  // Pressed keys (without modifiers)
+  std::vector<std::pair<KeyScancode, int>> pressed;
+  for (int s=int(kKeyNil); s<int(kKeyFirstModifierScancode); ++s) {
+    if (sys->isKeyPressed(KeyScancode(s)))
+      pressed.push_back(std::make_pair(KeyScancode(s),
+                                       sys->getUnicodeFromScancode(KeyScancode(s))));
+  }
+
+  // Same accelerators that are compared in Accelerator::isPressed()
+  // and isLooselyPressed(), which accept the accelerators with a
+  // subset of the pressed modifiers.
+  const int pressedModifiers = int(sys->keyModifiers());
+  std::vector<Accelerator> accels;
+  for (int mods=pressedModifiers; ; mods=(mods-1) & pressedModifiers) {
+    accels.push_back(Accelerator(KeyModifiers(mods), kKeyNil, 0));
+    for (const auto& key : pressed) {
+      if (key.first)
+        accels.push_back(Accelerator(KeyModifiers(mods), key.first, 0));
+      if (key.second)
+        accels.push_back(Accelerator(KeyModifiers(mods), kKeyNil, key.second));
+    }
+
+    if (!loosely || mods == 0)
+      break;
+  }
+  return findKeysWithAccels(accels);
+}
+
+Keys KeyboardShortcuts::findKeysWithAccels(const std::vector<ui::Accelerator>& accels)
+{
+  updateIndexes();
+
+  std::vector<int> indexes;
+  for (const Accelerator& accel : accels) {
+    auto it = m_accelIndex.find(accel.toString());
+    if (it != m_accelIndex.end())
+      indexes.insert(indexes.end(), it->second.begin(), it->second.end());
+  }
+
+  // Keys in the same order of the list
+  std::sort(indexes.begin(), indexes.end());
+  indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+
+  Keys keys;
+  keys.reserve(indexes.size());
+  for (const int i : indexes)
+    keys.push_back(m_keys[i]);
+  return keys;
+}
+
+void KeyboardShortcuts::updateIndexes()
+{
+  if (m_indexesVersion == g_keysVersion)
+    return;
+
+  m_accelIndex.clear();
+  m_commandIndex.clear();
+  for (int i=0; i<int(m_keys.size()); ++i) {
+    const Key* key = m_keys[i].get();
+    for (const Accelerator& accel : key->accels()) {
+      // Accelerators are compared with their string representation
+      // (see Accelerator::operator==)
+      auto& list = m_accelIndex[accel.toString()];
+      if (list.empty() || list.back() != i)
+        list.push_back(i);
+    }
+    if (key->type() == KeyType::Command)
+      m_commandIndex[key->command()].push_back(i);
+  }
+  m_indexesVersion = g_keysVersion;
+}
+
 bool KeyboardShortcuts::getCommandFromKeyMessage(const Message* msg, Command** command, Params* params)
 {
-  for (KeyPtr& key : m_keys) {
-    if (key->type() == KeyType::Command &&
-        key->isPressed(msg, *this)) {
+  for (const KeyPtr& key : pressedKeys(msg)) {
+    if (key->type() == KeyType::Command) {
       if (command) *command = key->command();
       if (params) *params = key->params();
       return true;
@@ -928,13 +1058,16 @@ tools::Tool* KeyboardShortcuts::getCurrentQuicktool(tools::Tool* currentTool)
   }
 
   tools::ToolBox* toolbox = App::instance()->toolBox();
+  const Keys pressed = pressedKeys(false);
+  if (pressed.empty())
+    return NULL;
 
   // Iterate over all tools
   for (tools::Tool* tool : *toolbox) {
     KeyPtr key = quicktool(tool);
 
     // Collect all tools with the pressed keyboard-shortcut
-    if (key && key->isPressed()) {
+    if (key && std::find(pressed.begin(), pressed.end(), key) != pressed.end()) {
       return tool;
     }
   }
@@ -946,10 +1079,9 @@ KeyAction KeyboardShortcuts::getCurrentActionModifiers(KeyContext context)
 {
   KeyAction flags = KeyAction::None;
 
-  for (const KeyPtr& key : m_keys) {
+  for (const KeyPtr& key : pressedKeys(true)) {
     if (key->type() == KeyType::Action &&
-        key->keycontext() == context &&
-        key->isLooselyPressed()) {
+        key->keycontext() == context) {
       flags = static_cast<KeyAction>(int(flags) | int(key->action()));
     }
   }
@@ -995,6 +1127,7 @@ void KeyboardShortcuts::clearMouseWheelKeys()
     else
       ++it;
   }
+  keys_changed();
 }
 
 void KeyboardShortcuts::addMissingMouseWheelKeys()
@@ -1009,6 +1142,7 @@ void KeyboardShortcuts::addMissingMouseWheelKeys()
     if (it == m_keys.end()) {
       KeyPtr key = std::make_shared<Key>((WheelAction)wheelAction);
       m_keys.push_back(key);
+      keys_changed();
     }
   }
 }
@@ -1057,6 +1191,7 @@ void KeyboardShortcuts::setDefaultMouseWheelKeys(const bool zoomWithWheel)
              KeySource::Original, *this);
     m_keys.push_back(key);
   }
+  keys_changed();
 }
 
 void KeyboardShortcuts::addMissingKeysForCommands()
@@ -12,6 +12,10 @@
 #include "app/ui/key.h"
 #include "obs/signal.h"
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 class TiXmlElement;
 
 namespace app {
@@ -56,6 +60,17 @@ namespace app {
                       const Key* newKey);
 
     KeyContext getCurrentKeyContext();
+
+    // Returns the keys pressed in the given message (in the same
+    // order of the list of keys). Key messages are resolved with an
+    // index of accelerators (instead of comparing all keys).
+    Keys pressedKeys(const ui::Message* msg);
+
+    // Returns the keys pressed right now (Key::isPressed()), or with
+    // a subset of the pressed modifiers if "loosely" is true
+    // (Key::isLooselyPressed()).
+    Keys pressedKeys(const bool loosely);
+
     bool getCommandFromKeyMessage(const ui::Message* msg, Command** command, Params* params);
     tools::Tool* getCurrentQuicktool(tools::Tool* currentTool);
     KeyAction getCurrentActionModifiers(KeyContext context);
@@ -75,8 +90,16 @@ namespace app {
   private:
     void exportKeys(TiXmlElement& parent, KeyType type);
     void exportAccel(TiXmlElement& parent, const Key* key, const ui::Accelerator& accel, bool removed);
+    Keys findKeysWithAccels(const std::vector<ui::Accelerator>& accels);
+    void updateIndexes();
 
     Keys m_keys;
+
+    // Indexes of m_keys by accelerator (Accelerator::toString()) and
+    // by command, re-created when any key is modified.
+    std::unordered_map<std::string, std::vector<int>> m_accelIndex;
+    std::unordered_map<Command*, std::vector<int>> m_commandIndex;
+    int m_indexesVersion;
   };
 
   std::string key_tooltip(const char* str, const Key* key);
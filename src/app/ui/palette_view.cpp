@@ -68,6 +68,7 @@ PaletteView::PaletteView(bool editable, PaletteViewStyle style, PaletteViewDeleg
 {
   setFocusStop(true);
   setDoubleBuffered(true);
+  setPaintCache(true);
 
   m_palConn = App::instance()->PaletteChange.connect(&PaletteView::onAppPaletteChange, this);
   m_csConn = App::instance()->ColorSpaceChange.connect(
@@ -106,13 +107,9 @@ void PaletteView::setColumns(int columns)
 
 void PaletteView::deselect()
 {
-  bool invalidate = (m_selectedEntries.picks() > 0);
-
   m_selectedEntries.resize(currentPalette()->size());
   m_selectedEntries.clear();
-
-  if (invalidate)
-    this->invalidate();
+  invalidateChangedEntries();
 }
 
 void PaletteView::selectColor(int index)
@@ -125,7 +122,7 @@ void PaletteView::selectColor(int index)
     m_rangeAnchor = index;
 
     update_scroll(m_currentEntry);
-    invalidate();
+    invalidateChangedEntries();
   }
 }
 
@@ -145,7 +142,7 @@ void PaletteView::selectRange(int index1, int index2)
             m_selectedEntries.begin()+std::max(index1, index2)+1, true);
 
   update_scroll(index2);
-  invalidate();
+  invalidateChangedEntries();
 }
 
 int PaletteView::getSelectedEntry() const
@@ -200,7 +197,7 @@ void PaletteView::setSelectedEntries(const doc::PalettePicks& entries)
   m_selectedEntries = entries;
   m_selectedEntries.resize(currentPalette()->size());
   m_currentEntry = m_selectedEntries.firstPick();
-  invalidate();
+  invalidateChangedEntries();
 }
 
 app::Color PaletteView::getColorByPosition(const gfx::Point& pos)
@@ -359,6 +356,7 @@ bool PaletteView::onProcessMessage(Message* msg)
             else {
               selectColor(idx);
               m_selectedEntries[idx] = true;
+              invalidateChangedEntries();
             }
           }
 
@@ -407,9 +405,12 @@ bool PaletteView::onProcessMessage(Message* msg)
             break;
         }
 
+        // Selecting colors doesn't change the painted entries
+        const bool repaint = (m_state != State::SELECTING_COLOR);
         m_state = State::WAITING;
         setStatusBar();
-        invalidate();
+        if (repaint)
+          invalidate();
       }
       return true;
 
@@ -439,22 +440,30 @@ bool PaletteView::onProcessMessage(Message* msg)
     }
 
     case kMouseLeaveMessage:
+      if (m_state != State::WAITING)
+        invalidate();
+      else if (m_hot.part == Hit::OUTLINE)
+        invalidatePicks(m_selectedEntries,
+                        SkinTheme::get(this)->dimensions.paletteOutlineWidth());
       m_hot = Hit(Hit::NONE);
       setStatusBar();
-      invalidate();
       break;
 
     case kSetCursorMessage: {
       MouseMessage* mouseMsg = static_cast<MouseMessage*>(msg);
       Hit hit = hitTest(mouseMsg->position() - bounds().origin());
       if (hit != m_hot) {
-        // Redraw only when we put the mouse in other part of the
-        // widget (e.g. if we move from color to color, we don't want
-        // to redraw the whole widget if we're on WAITING state).
-        if ((m_state == State::WAITING && hit.part != m_hot.part) ||
-            (m_state != State::WAITING && hit != m_hot)) {
+        // On WAITING state the mouse changes only the selection
+        // outline (when the mouse enters/leaves it), so we don't want
+        // to redraw the whole widget e.g. if we move from color to
+        // color.
+        if (m_state != State::WAITING) {
           invalidate();
         }
+        else if ((hit.part == Hit::OUTLINE) != (m_hot.part == Hit::OUTLINE)) {
+          invalidatePicks(m_selectedEntries,
+                          SkinTheme::get(this)->dimensions.paletteOutlineWidth());
+        }
         m_hot = hit;
         setStatusBar();
       }
@@ -488,13 +497,9 @@ void PaletteView::onPaint(ui::PaintEvent& ev)
   const bool dragging = (m_state == State::DRAGGING_OUTLINE && hotColor);
   const bool resizing = (m_state == State::RESIZING_PALETTE && hotColor);
 
-  if (m_style == FgBgColors && m_delegate) {
-    fgIndex = findExactIndex(m_delegate->onPaletteViewGetForegroundIndex());
-    bgIndex = findExactIndex(m_delegate->onPaletteViewGetBackgroundIndex());
+  const gfx::Rect clipBounds = g->getClipBounds();
 
-    if (current_editor && current_editor->sprite()->pixelFormat() == IMAGE_INDEXED)
-      transparentIndex = current_editor->sprite()->transparentColor();
-  }
+  getIndicators(fgIndex, bgIndex, transparentIndex);
 
   g->fillRect(theme->colors.editorFace(), bounds);
 
@@ -519,6 +524,12 @@ void PaletteView::onPaint(ui::PaintEvent& ev)
     }
 
     gfx::Rect box = getPaletteEntryBounds(i + boxOffset);
+
+    // Skip entries outside the painted area (e.g. only the modified
+    // entries are painted again in the paint cache)
+    if (!clipBounds.intersects(gfx::Rect(box).enlarge(childSpacing())))
+      continue;
+
     gfx::Color negColor;
     drawEntry(g, i + idxOffset, i + boxOffset, box, negColor);
     const int boxsize = boxSizePx();
@@ -631,6 +642,11 @@ void PaletteView::onPaint(ui::PaintEvent& ev)
       }
     }
   }
+
+  // Keep the painted state of all entries to compare it in the next
+  // invalidateChangedEntries() call
+  if (!dragging && !resizing && clipBounds.contains(bounds))
+    getEntriesState(m_entriesState);
 }
 
 void PaletteView::onResize(ui::ResizeEvent& ev)
@@ -672,7 +688,11 @@ void PaletteView::onSizeHint(ui::SizeHintEvent& ev)
 
 void PaletteView::onDrawMarchingAnts()
 {
-  invalidate();
+  // Only the copied entries are animated
+  if (clipboard::get_current_format() == clipboard::ClipboardPaletteEntries)
+    invalidatePicks(clipboard::get_palette_picks(), 1*guiscale());
+  else
+    invalidate();
 }
 
 void PaletteView::update_scroll(int color)
@@ -715,6 +735,91 @@ void PaletteView::onAppPaletteChange()
   View* view = View::getView(this);
   if (view)
     view->layout();
+
+  invalidateChangedEntries();
+}
+
+void PaletteView::invalidateChangedEntries()
+{
+  std::vector<EntryState> state;
+  getEntriesState(state);
+
+  if (state.size() != m_entriesState.size()) {
+    invalidate();
+  }
+  else {
+    for (int i=0; i<int(state.size()); ++i) {
+      if (state[i] != m_entriesState[i])
+        invalidateEntry(i, state[i].picked != m_entriesState[i].picked);
+    }
+  }
+
+  m_entriesState = std::move(state);
+}
+
+void PaletteView::getIndicators(int& fgIndex, int& bgIndex, int& transparentIndex) const
+{
+  fgIndex = bgIndex = transparentIndex = -1;
+
+  if (m_style == FgBgColors && m_delegate) {
+    fgIndex = findExactIndex(m_delegate->onPaletteViewGetForegroundIndex());
+    bgIndex = findExactIndex(m_delegate->onPaletteViewGetBackgroundIndex());
+
+    if (current_editor && current_editor->sprite()->pixelFormat() == IMAGE_INDEXED)
+      transparentIndex = current_editor->sprite()->transparentColor();
+  }
+}
+
+void PaletteView::getEntriesState(std::vector<EntryState>& state) const
+{
+  const Palette* palette = currentPalette();
+  int fgIndex, bgIndex, transparentIndex;
+  getIndicators(fgIndex, bgIndex, transparentIndex);
+
+  state.resize(palette->size());
+  for (int i=0; i<int(state.size()); ++i) {
+    EntryState& entry = state[i];
+    entry.color = palette->getEntry(i);
+    entry.picked = (i < m_selectedEntries.size() && m_selectedEntries[i]);
+    entry.marks = 0;
+    if (m_style == SelectOneColor) {
+      if (m_currentEntry == i) entry.marks |= kCurrentMark;
+    }
+    else if (m_style == FgBgColors) {
+      if (fgIndex == i) entry.marks |= kFgMark;
+      if (bgIndex == i) entry.marks |= kBgMark;
+      if (transparentIndex == i) entry.marks |= kTransparentMark;
+    }
+  }
+}
+
+void PaletteView::invalidateEntry(const int i, const bool withNeighbors)
+{
+  const auto theme = SkinTheme::get(this);
+  const int outlineWidth = theme->dimensions.paletteOutlineWidth();
+
+  // The selection outline of an entry is joined with the outline of
+  // its neighbors, so they must be painted again if it's (de)selected
+  gfx::Rect rc = getPaletteEntryBounds(i);
+  rc.enlarge(childSpacing() + outlineWidth +
+             (withNeighbors ? boxSizePx(): 0));
+  rc.offset(bounds().origin());
+  invalidateRect(rc);
+}
+
+void PaletteView::invalidatePicks(const doc::PalettePicks& picks,
+                                  const int outlineWidth)
+{
+  gfx::Region rgn;
+  for (int i=0; i<picks.size(); ++i) {
+    if (picks[i]) {
+      gfx::Rect rc = getPaletteEntryBounds(i);
+      rc.enlarge(childSpacing() + outlineWidth);
+      rgn.createUnion(rgn, gfx::Region(rc));
+    }
+  }
+  rgn.offset(bounds().x, bounds().y);
+  invalidateRegion(rgn);
 }
 
 gfx::Rect PaletteView::getPaletteEntryBounds(int index) const
@@ -875,7 +980,9 @@ void PaletteView::updateCopyFlag(ui::Message* msg)
   if (oldCopy != m_copy) {
     setCursor();
     setStatusBar();
-    invalidate();
+    // The copy flag is only painted while the outline is dragged
+    if (m_state == State::DRAGGING_OUTLINE)
+      invalidate();
   }
 }
 
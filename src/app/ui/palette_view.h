@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -12,6 +12,7 @@
 #include "app/color.h"
 #include "app/ui/color_source.h"
 #include "app/ui/marching_ants.h"
+#include "doc/color.h"
 #include "doc/palette_picks.h"
 #include "obs/connection.h"
 #include "obs/signal.h"
@@ -84,6 +85,12 @@ namespace app {
     void pasteFromClipboard();
     void discardClipboardSelection();
 
+    // Invalidates only the entries that were modified since they were
+    // painted (their colors, selection, or fg/bg/transparent
+    // indicators), so the rest of the palette is kept in the paint
+    // cache.
+    void invalidateChangedEntries();
+
     obs::signal<void(ui::Message*)> FocusOrClick;
 
   protected:
@@ -102,6 +109,29 @@ namespace app {
       RESIZING_PALETTE,
     };
 
+    // Indicators painted in each palette entry
+    enum EntryMark {
+      kCurrentMark = 1,
+      kFgMark = 2,
+      kBgMark = 4,
+      kTransparentMark = 8,
+    };
+
+    struct EntryState {
+      doc::color_t color = 0;
+      bool picked = false;
+      int marks = 0;
+
+      bool operator==(const EntryState& other) const {
+        return (color == other.color &&
+                picked == other.picked &&
+                marks == other.marks);
+      }
+      bool operator!=(const EntryState& other) const {
+        return !operator==(other);
+      }
+    };
+
     struct Hit {
       enum Part {
         NONE,
@@ -136,6 +166,10 @@ namespace app {
                                const int outlineWidth,
                                gfx::Rect& box, gfx::Rect& clip) const;
     bool pickedXY(const doc::PalettePicks& entries, int i, int dx, int dy) const;
+    void getIndicators(int& fgIndex, int& bgIndex, int& transparentIndex) const;
+    void getEntriesState(std::vector<EntryState>& entries) const;
+    void invalidateEntry(const int i, const bool withNeighbors);
+    void invalidatePicks(const doc::PalettePicks& picks, const int outlineWidth);
     void updateCopyFlag(ui::Message* msg);
     void setCursor();
     void setStatusBar();
@@ -167,6 +201,10 @@ namespace app {
     Hit m_hot;
     bool m_copy;
     bool m_withSeparator;
+
+    // State of the entries when they were painted/invalidated for the
+    // last time
+    std::vector<EntryState> m_entriesState;
   };
 
 } // namespace app
@@ -93,7 +93,7 @@ public:
     : ResourceListItem(resource)
     , m_comment(nullptr)
   {
-    std::string comment = static_cast<PaletteResource*>(resource)->palette()->comment();
+    std::string comment = static_cast<PaletteResource*>(resource)->summary().comment;
     if (!comment.empty()) {
       addChild(m_comment = new CommentButton(comment));
 
@@ -120,6 +120,10 @@ private:
 PalettesListBox::PalettesListBox()
   : ResourcesListBox(new ResourcesLoader(new PalettesLoaderDelegate))
 {
+  // There are thousands of palettes in some extensions, so we lay
+  // out only the visible ones
+  setVirtualized(true);
+
   addChild(&m_tooltips);
 
   m_extPaletteChanges =
@@ -153,16 +157,21 @@ void PalettesListBox::onResourceChange(Resource* resource)
 void PalettesListBox::onPaintResource(Graphics* g, gfx::Rect& bounds, Resource* resource)
 {
   auto theme = SkinTheme::get(this);
-  doc::Palette* palette = static_cast<PaletteResource*>(resource)->palette();
+  auto paletteResource = static_cast<PaletteResource*>(resource);
+  const PaletteSummary& summary = paletteResource->summary();
   os::Surface* tick = theme->parts.checkSelected()->bitmap(0);
 
   // Draw tick (to say "this palette matches the active sprite
-  // palette").
+  // palette"). The palette file is loaded only if its summary
+  // matches the sprite palette.
   auto view = UIContext::instance()->activeView();
   if (view && view->document()) {
     auto docPal = view->document()->sprite()->palette(view->editor()->frame());
-    if (docPal && *docPal == *palette)
-      g->drawRgbaSurface(tick, bounds.x, bounds.y+bounds.h/2-tick->height()/2);
+    if (docPal && summary.mayBeEqual(docPal)) {
+      doc::Palette* palette = paletteResource->palette();
+      if (palette && *docPal == *palette)
+        g->drawRgbaSurface(tick, bounds.x, bounds.y+bounds.h/2-tick->height()/2);
+    }
   }
 
   bounds.x += tick->width();
@@ -172,9 +181,7 @@ void PalettesListBox::onPaintResource(Graphics* g, gfx::Rect& bounds, Resource*
     bounds.x, bounds.y+bounds.h-6*guiscale(),
     4*guiscale(), 4*guiscale());
 
-  for (int i=0; i<palette->size(); ++i) {
-    doc::color_t c = palette->getEntry(i);
-
+  for (doc::color_t c : summary.preview) {
     g->fillRect(gfx::rgba(
         doc::rgba_getr(c),
         doc::rgba_getg(c),
@@ -186,7 +193,12 @@ void PalettesListBox::onPaintResource(Graphics* g, gfx::Rect& bounds, Resource*
 
 void PalettesListBox::onResourceSizeHint(Resource* resource, gfx::Size& size)
 {
-  size = gfx::Size(0, (2+16+2)*guiscale());
+  size = gfx::Size(0, onRowHeight());
+}
+
+int PalettesListBox::onRowHeight()
+{
+  return (2+16+2)*guiscale();
 }
 
 } // namespace app
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -31,6 +32,7 @@ namespace app {
     virtual void onResourceChange(Resource* resource) override;
     virtual void onPaintResource(ui::Graphics* g, gfx::Rect& bounds, Resource* resource) override;
     virtual void onResourceSizeHint(Resource* resource, gfx::Size& size) override;
+    virtual int onRowHeight() override;
 
     ui::TooltipManager m_tooltips;
     obs::scoped_connection m_extPaletteChanges;
@@ -198,17 +198,24 @@ void ResourcesListBox::onTick()
   std::unique_ptr<Resource> resource;
   std::string name;
 
+  // Add all the loaded resources and then sort/layout the list just
+  // one time (instead of one time for each resource)
+  bool added = false;
   while (m_resourcesLoader->next(resource)) {
     std::unique_ptr<ResourceListItem> listItem(onCreateResourceItem(resource.get()));
     insertChild(getItemsCount()-1, listItem.get());
+    added = true;
+
+    resource.release();
+    listItem.release();
+  }
+
+  if (added) {
     sortItems();
     layout();
 
     if (View* view = View::getView(this))
       view->updateView();
-
-    resource.release();
-    listItem.release();
   }
 
   if (m_resourcesLoader->isDone()) {
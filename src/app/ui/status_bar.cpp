@@ -584,6 +584,7 @@ StatusBar::StatusBar(TooltipManager* tooltipManager)
   , m_snapToGridWindow(nullptr)
 {
   m_instance = this;
+  setDocEvents(kDocSpriteEvents);
 
   setDoubleBuffered(true);
   setFocusStop(true);
@@ -49,6 +49,7 @@
 #include "base/memory.h"
 #include "base/scoped_value.h"
 #include "doc/doc.h"
+#include "doc/trace.h"
 #include "fmt/format.h"
 #include "gfx/point.h"
 #include "gfx/rect.h"
@@ -281,6 +282,8 @@ Timeline::~Timeline()
   m_context->documents().remove_observer(this);
   m_context->remove_observer(this);
   delete m_confPopup;
+
+  thumb::clear_cache();
 }
 
 void Timeline::setZoom(const double zoom)
@@ -353,6 +356,9 @@ void Timeline::updateUsingEditor(Editor* editor)
   DocView* view = m_editor->getDocView();
   view->getSite(&site);
 
+  setDocEvents(kDocLayerEvents |
+               kDocFrameEvents |
+               kDocTagEvents);
   site.document()->add_observer(this);
 
   Doc* app_document = site.document();
@@ -685,23 +691,17 @@ bool Timeline::onProcessMessage(Message* msg)
           if (!m_sprite)
             break;
 
-          bool regenRows = false;
+          LayerList changed;
           bool newVisibleState = !allLayersVisible();
           for (Layer* topLayer : m_sprite->root()->layers()) {
             if (topLayer->isVisible() != newVisibleState) {
               topLayer->setVisible(newVisibleState);
-              if (topLayer->isGroup())
-                regenRows = true;
+              changed.push_back(topLayer);
             }
           }
 
-          if (regenRows) {
-            regenerateRows();
-            invalidate();
-          }
-
-          // Redraw all views.
-          m_document->notifyGeneralUpdate();
+          // Redraw all views (and the timeline) once.
+          m_document->notifyLayersFlagsChanged(changed);
           break;
         }
 
@@ -710,21 +710,16 @@ bool Timeline::onProcessMessage(Message* msg)
           if (!m_sprite)
             break;
 
-          bool regenRows = false;
+          LayerList changed;
           bool newEditableState = !allLayersUnlocked();
           for (Layer* topLayer : m_sprite->root()->layers()) {
             if (topLayer->isEditable() != newEditableState) {
               topLayer->setEditable(newEditableState);
-              if (topLayer->isGroup()) {
-                regenRows = true;
-              }
+              changed.push_back(topLayer);
             }
           }
 
-          if (regenRows) {
-            regenerateRows();
-            invalidate();
-          }
+          m_document->notifyLayersFlagsChanged(changed);
           break;
         }
 
@@ -818,9 +813,11 @@ bool Timeline::onProcessMessage(Message* msg)
               }
 
               // If there is one layer with the internal state, restore the previous visible state
+              LayerList changed;
               if (oneWithInternalState) {
                 for (Row& row : m_rows) {
                   Layer* l = row.layer();
+                  const bool wasVisible = l->isVisible();
                   if (l->hasFlags(LayerFlags::Internal_WasVisible)) {
                     l->setVisible(true);
                     l->switchFlags(LayerFlags::Internal_WasVisible, false);
@@ -828,6 +825,8 @@ bool Timeline::onProcessMessage(Message* msg)
                   else {
                     l->setVisible(false);
                   }
+                  if (l->isVisible() != wasVisible)
+                    changed.push_back(l);
                 }
               }
               // In other case, hide everything
@@ -835,14 +834,14 @@ bool Timeline::onProcessMessage(Message* msg)
                 for (Row& row : m_rows) {
                   Layer* l = row.layer();
                   l->switchFlags(LayerFlags::Internal_WasVisible, l->isVisible());
-                  l->setVisible(false);
+                  if (l->isVisible()) {
+                    l->setVisible(false);
+                    changed.push_back(l);
+                  }
                 }
               }
 
-              regenerateRows();
-              invalidate();
-
-              m_document->notifyGeneralUpdate();
+              m_document->notifyLayersFlagsChanged(changed);
             }
 
             if (layer->isVisible() && !oneWithInternalState)
@@ -1543,6 +1542,8 @@ void Timeline::onResize(ui::ResizeEvent& ev)
 
 void Timeline::onPaint(ui::PaintEvent& ev)
 {
+  DOC_TRACE_ZONE("Timeline::onPaint");
+
   Graphics* g = ev.graphics();
   bool noDoc = (m_document == NULL);
   if (noDoc)
@@ -1566,6 +1567,19 @@ void Timeline::onPaint(ui::PaintEvent& ev)
     getDrawableLayers(&firstLayer, &lastLayer);
     getDrawableFrames(&firstFrame, &lastFrame);
 
+    // Paint only the layers/frames inside the clipping region, so the
+    // cost doesn't depend on the visible area when just a couple of
+    // cels are invalidated (e.g. when the mouse moves over the cels).
+    {
+      const gfx::Rect clip = g->getClipBounds();
+      if (!clip.isEmpty()) {
+        firstLayer = std::max(firstLayer, getLayerInYPos(clip.y2()-1));
+        lastLayer = std::min(lastLayer, getLayerInYPos(clip.y));
+        firstFrame = std::max(firstFrame, getFrameInXPos(clip.x));
+        lastFrame = std::min(lastFrame, getFrameInXPos(clip.x2()-1));
+      }
+    }
+
     drawTop(g);
 
     // Draw the header for layers.
@@ -1727,6 +1741,7 @@ void Timeline::onRemoveDocument(Doc* document)
   if (document == m_document) {
     detachDocument();
   }
+  thumb::clear_cache();
 }
 
 void Timeline::onGeneralUpdate(DocEvent& ev)
@@ -1811,6 +1826,19 @@ void Timeline::onLayerNameChange(DocEvent& ev)
   invalidate();
 }
 
+void Timeline::onLayersFlagsChange(DocEvent& ev)
+{
+  // Regenerate rows because the flags of groups are propagated to
+  // their children (in Row::m_inheritedFlags).
+  for (const Layer* layer : ev.layers()) {
+    if (layer->isGroup()) {
+      regenerateRows();
+      break;
+    }
+  }
+  invalidate();
+}
+
 void Timeline::onAddTag(DocEvent& ev)
 {
   if (m_tagFocusBand >= 0) {
@@ -1924,6 +1952,23 @@ void Timeline::getDrawableFrames(frame_t* firstFrame, frame_t* lastFrame)
       + getCelsBounds().w) / frameBoxWidth());
 }
 
+layer_t Timeline::getLayerInYPos(const int y) const
+{
+  return lastLayer() -
+    ((y
+      - topHeight()
+      - headerBoxHeight()
+      + viewScroll().y) / layerBoxHeight());
+}
+
+frame_t Timeline::getFrameInXPos(const int x) const
+{
+  return frame_t((x
+                  - separatorX()
+                  - m_separator_w
+                  + viewScroll().x) / frameBoxWidth());
+}
+
 void Timeline::drawPart(ui::Graphics* g, const gfx::Rect& bounds,
                         const std::string* text, ui::Style* style,
                         const bool is_active,
@@ -2038,6 +2083,10 @@ void Timeline::drawHeaderFrame(ui::Graphics* g, frame_t frame)
   if (n >= 100 && (n % 100) < 10)
     text.insert(0, 1, '0');
 
+  // The frame is being loaded in the background
+  if (m_document && m_document->loadingFrames().contains(frame))
+    text = "...";
+
   drawPart(g, bounds, &text,
            skinTheme()->styles.timelineHeaderFrame(),
            is_active, is_hover, is_clicked);
@@ -2253,10 +2302,18 @@ void Timeline::drawCel(ui::Graphics* g, layer_t layerIndex, frame_t frame, Cel*
         skinTheme()->calcBorder(this, style));
 
     if (!thumb_bounds.isEmpty()) {
-      if (os::SurfaceRef surface = thumb::get_cel_thumbnail(cel, thumb_bounds.size())) {
-        const int t = base::clamp(thumb_bounds.w/8, 4, 16);
-        draw_checked_grid(g, thumb_bounds, gfx::Size(t, t), docPref());
-
+      // The thumbnail is rendered in background the first time, we
+      // draw only the checked background until it's ready.
+      os::SurfaceRef surface = thumb::get_cel_thumbnail_async(
+        cel, thumb_bounds.size(),
+        [this, layerIndex, frame]{
+          invalidateHit(Hit(PART_CEL, layerIndex, frame));
+        });
+
+      const int t = base::clamp(thumb_bounds.w/8, 4, 16);
+      draw_checked_grid(g, thumb_bounds, gfx::Size(t, t), docPref());
+
+      if (surface) {
         g->drawRgbaSurface(surface.get(),
                            thumb_bounds.center().x-surface->width()/2,
                            thumb_bounds.center().y-surface->height()/2);
@@ -2857,27 +2914,36 @@ gfx::Rect Timeline::getRangeBounds(const Range& range) const
     case Range::kNone:
       // Return empty rectangle
       break;
-    case Range::kCels:
-      for (auto layer : range.selectedLayers()) {
-        layer_t layerIdx = getLayerIndex(layer);
-        for (auto frame : range.selectedFrames())
-          rc |= getPartBounds(Hit(PART_CEL, layerIdx, frame));
+    // The bounds of cels/headers form a grid, so the union of all the
+    // selected items is the union of the first and last ones.
+    case Range::kCels: {
+      layer_t first, last;
+      if (selectedLayersBounds(range.selectedLayers(), &first, &last) &&
+          !range.selectedFrames().empty()) {
+        rc |= getPartBounds(Hit(PART_CEL, first, range.firstFrame()));
+        rc |= getPartBounds(Hit(PART_CEL, last, range.lastFrame()));
       }
       break;
+    }
     case Range::kFrames: {
-      for (auto frame : range.selectedFrames()) {
-        rc |= getPartBounds(Hit(PART_HEADER_FRAME, 0, frame));
-        rc |= getPartBounds(Hit(PART_CEL, 0, frame));
+      if (!range.selectedFrames().empty()) {
+        for (frame_t frame : { range.firstFrame(), range.lastFrame() }) {
+          rc |= getPartBounds(Hit(PART_HEADER_FRAME, 0, frame));
+          rc |= getPartBounds(Hit(PART_CEL, 0, frame));
+        }
       }
       break;
     }
-    case Range::kLayers:
-      for (auto layer : range.selectedLayers()) {
-        layer_t layerIdx = getLayerIndex(layer);
-        rc |= getPartBounds(Hit(PART_ROW_TEXT, layerIdx));
-        rc |= getPartBounds(Hit(PART_CEL, layerIdx, m_sprite->lastFrame()));
+    case Range::kLayers: {
+      layer_t first, last;
+      if (selectedLayersBounds(range.selectedLayers(), &first, &last)) {
+        for (layer_t layerIdx : { first, last }) {
+          rc |= getPartBounds(Hit(PART_ROW_TEXT, layerIdx));
+          rc |= getPartBounds(Hit(PART_CEL, layerIdx, m_sprite->lastFrame()));
+        }
       }
       break;
+    }
   }
   return rc;
 }
@@ -2975,9 +3041,11 @@ void Timeline::regenerateRows()
   }
 
   size_t i = 0;
+  m_rowIndex.clear();
   for_each_expanded_layer(
     m_sprite->root(),
     [&i, this](Layer* layer, int level, LayerFlags flags) {
+      m_rowIndex[layer] = layer_t(i);
       m_rows[i++] = Row(layer, level, flags);
     });
 
@@ -3071,19 +3139,10 @@ Timeline::Hit Timeline::hitTest(ui::Message* msg, const gfx::Point& mousePos)
     hit.part = PART_SEPARATOR;
   }
   else {
-    gfx::Point scroll = viewScroll();
     int top = topHeight();
 
-    hit.layer = lastLayer() -
-      ((mousePos.y
-        - top
-        - headerBoxHeight()
-        + scroll.y) / layerBoxHeight());
-
-    hit.frame = frame_t((mousePos.x
-        - separatorX()
-        - m_separator_w
-        + scroll.x) / frameBoxWidth());
+    hit.layer = getLayerInYPos(mousePos.y);
+    hit.frame = getFrameInXPos(mousePos.x);
 
     // Flag which indicates that we are in the are below the Background layer/last layer area
     if (hit.layer < 0)
@@ -3254,19 +3313,8 @@ Timeline::Hit Timeline::hitTestCel(const gfx::Point& mousePos)
   if (!m_document)
     return hit;
 
-  gfx::Point scroll = viewScroll();
-  int top = topHeight();
-
-  hit.layer = lastLayer() - (
-    (mousePos.y
-     - top
-     - headerBoxHeight()
-     + scroll.y) / layerBoxHeight());
-
-  hit.frame = frame_t((mousePos.x
-                       - separatorX()
-                       - m_separator_w
-                       + scroll.x) / frameBoxWidth());
+  hit.layer = getLayerInYPos(mousePos.y);
+  hit.frame = getFrameInXPos(mousePos.x);
 
   hit.layer = base::clamp(hit.layer, firstLayer(), lastLayer());
   hit.frame = std::max(firstFrame(), hit.frame);
@@ -3656,11 +3704,11 @@ bool Timeline::allLayersDiscontinuous()
 
 layer_t Timeline::getLayerIndex(const Layer* layer) const
 {
-  for (int i=0; i<(int)m_rows.size(); i++)
-    if (m_rows[i].layer() == layer)
-      return i;
-
-  return -1;
+  auto it = m_rowIndex.find(layer);
+  if (it != m_rowIndex.end())
+    return it->second;
+  else
+    return -1;
 }
 
 bool Timeline::isLayerActive(const layer_t layerIndex) const
@@ -4153,18 +4201,11 @@ void Timeline::setLayerVisibleFlag(const layer_t l, const bool state)
   if (!layer)
     return;
 
-  bool redrawEditors = false;
-  bool regenRows = false;
+  LayerList changed;
 
   if (layer->isVisible() != state) {
     layer->setVisible(state);
-    redrawEditors = true;
-
-    // Regenerate rows because might change the flag of the children
-    // (the flag is propagated to the children in m_inheritedFlags).
-    if (layer->isGroup() && layer->isExpanded()) {
-      regenRows = true;
-    }
+    changed.push_back(layer);
 
     // Show parents too
     if (!row.parentVisible() && state) {
@@ -4172,21 +4213,15 @@ void Timeline::setLayerVisibleFlag(const layer_t l, const bool state)
       while (layer) {
         if (!layer->isVisible()) {
           layer->setVisible(true);
-          regenRows = true;
-          redrawEditors = true;
+          changed.push_back(layer);
         }
         layer = layer->parent();
       }
     }
   }
 
-  if (regenRows) {
-    regenerateRows();
-    invalidate();
-  }
-
-  if (redrawEditors)
-    m_document->notifyGeneralUpdate();
+  // The rows are regenerated in onLayersFlagsChange() if needed
+  m_document->notifyLayersFlagsChanged(changed);
 }
 
 void Timeline::setLayerEditableFlag(const layer_t l, const bool state)
@@ -4197,13 +4232,11 @@ void Timeline::setLayerEditableFlag(const layer_t l, const bool state)
   if (!layer)
     return;
 
-  bool regenRows = false;
+  LayerList changed;
 
   if (layer->isEditable() != state) {
     layer->setEditable(state);
-
-    if (layer->isGroup() && layer->isExpanded())
-      regenRows = true;
+    changed.push_back(layer);
 
     // Make parents editable too
     if (!row.parentEditable() && state) {
@@ -4211,17 +4244,14 @@ void Timeline::setLayerEditableFlag(const layer_t l, const bool state)
       while (layer) {
         if (!layer->isEditable()) {
           layer->setEditable(true);
-          regenRows = true;
+          changed.push_back(layer);
         }
         layer = layer->parent();
       }
     }
   }
 
-  if (regenRows) {
-    regenerateRows();
-    invalidate();
-  }
+  m_document->notifyLayersFlagsChanged(changed);
 }
 
 void Timeline::setLayerContinuousFlag(const layer_t l, const bool state)
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -29,6 +29,7 @@
 #include "ui/timer.h"
 #include "ui/widget.h"
 
+#include <map>
 #include <vector>
 
 namespace doc {
@@ -151,6 +152,7 @@ namespace app {
     void onAddFrame(DocEvent& ev) override;
     void onRemoveFrame(DocEvent& ev) override;
     void onLayerNameChange(DocEvent& ev) override;
+    void onLayersFlagsChange(DocEvent& ev) override;
     void onAddTag(DocEvent& ev) override;
     void onRemoveTag(DocEvent& ev) override;
 
@@ -260,6 +262,8 @@ namespace app {
     void setCursor(ui::Message* msg, const Hit& hit);
     void getDrawableLayers(layer_t* firstLayer, layer_t* lastLayer);
     void getDrawableFrames(frame_t* firstFrame, frame_t* lastFrame);
+    layer_t getLayerInYPos(const int y) const;
+    frame_t getFrameInXPos(const int x) const;
     void drawPart(ui::Graphics* g, const gfx::Rect& bounds,
                   const std::string* text,
                   ui::Style* style,
@@ -382,6 +386,9 @@ namespace app {
     // Data used to display each row in the timeline
     std::vector<Row> m_rows;
 
+    // Index of each layer in m_rows (to find rows in O(log n))
+    std::map<const Layer*, layer_t> m_rowIndex;
+
     // Data used to display frame tags
     int m_tagBands;
     int m_tagFocusBand;
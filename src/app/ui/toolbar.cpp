@@ -88,6 +88,9 @@ ToolBar::ToolBar()
 
   setBorder(gfx::Border(1*guiscale(), 0, 1*guiscale(), 0));
 
+  // Tools are painted only when the active/hot tool changes
+  setPaintCache(true);
+
   m_hotTool = NULL;
   m_hotIndex = NoneIndex;
   m_openOnHot = false;
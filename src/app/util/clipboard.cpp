@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2021  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -160,7 +160,9 @@ bool ClipboardManager::getClipboardText(std::string& text)
   }
 }
 
-static void set_clipboard_image(Image* image,
+// The image is shared (not copied), so it must not be modified after
+// calling this function.
+static void set_clipboard_image(const ImageRef& image,
                                 Mask* mask,
                                 Palette* palette,
                                 bool set_system_clipboard,
@@ -168,7 +170,7 @@ static void set_clipboard_image(Image* image,
 {
   clipboard_palette.reset(palette);
   clipboard_picks.clear();
-  clipboard_image.reset(image);
+  clipboard_image = image;
   clipboard_mask.reset(mask);
 
   // Copy image to the native clipboard
@@ -181,7 +183,7 @@ static void set_clipboard_image(Image* image,
     }
 
     if (use_native_clipboard())
-      set_native_clipboard_bitmap(image, mask, palette);
+      set_native_clipboard_bitmap(image.get(), mask, palette);
 
     if (image && !image_source_is_transparent)
       image->setMaskColor(oldMask);
@@ -204,7 +206,7 @@ static bool copy_from_document(const Site& site, bool merged = false)
 
   const Palette* pal = document->sprite()->palette(site.frame());
   set_clipboard_image(
-    image,
+    ImageRef(image),
     (mask ? new Mask(*mask): nullptr),
     (pal ? new Palette(*pal): nullptr),
     true,
@@ -264,7 +266,7 @@ void clear_mask_from_cels(Tx& tx,
 
 void clear_content()
 {
-  set_clipboard_image(nullptr, nullptr, nullptr, true, false);
+  set_clipboard_image(ImageRef(), nullptr, nullptr, true, false);
 }
 
 void cut(ContextWriter& writer)
@@ -332,9 +334,14 @@ void copy_range(const ContextReader& reader, const DocRange& range)
 }
 
 void copy_image(const Image* image, const Mask* mask, const Palette* pal)
+{
+  copy_image(ImageRef(Image::createCopy(image)), mask, pal);
+}
+
+void copy_image(const ImageRef& image, const Mask* mask, const Palette* pal)
 {
   set_clipboard_image(
-    Image::createCopy(image),
+    image,
     (mask ? new Mask(*mask): nullptr),
     (pal ? new Palette(*pal): nullptr),
     true, false);
@@ -345,7 +352,7 @@ void copy_palette(const Palette* palette, const doc::PalettePicks& picks)
   if (!picks.picks())
     return;                     // Do nothing case
 
-  set_clipboard_image(nullptr,
+  set_clipboard_image(ImageRef(),
                       nullptr,
                       new Palette(*palette),
                       true, false);
@@ -412,11 +419,17 @@ void paste(Context* ctx, const bool interactive)
         if (!dstLayer || !dstLayer->isImage())
           return;
 
+        // The clipboard image can be pasted again so we need a copy,
+        // but a converted image can be used directly.
+        ImageRef celImage = src_image;
+        if (celImage == clipboard_image)
+          celImage.reset(Image::createCopy(src_image.get()));
+
         Tx tx(ctx, "Paste Image");
         DocApi api = dstDoc->getApi(tx);
         Cel* dstCel = api.addCel(
           static_cast<LayerImage*>(dstLayer), site.frame(),
-          ImageRef(Image::createCopy(src_image.get())));
+          celImage);
 
         // Adjust bounds
         if (dstCel) {
@@ -634,14 +647,17 @@ void paste(Context* ctx, const bool interactive)
 
 ImageRef get_image(Palette* palette)
 {
-  // Get the image from the native clipboard.
-  if (use_native_clipboard()) {
+  // Get the image from the native clipboard (if it's not the same
+  // image that we've copied, in that case we already have it in
+  // clipboard_image).
+  if (use_native_clipboard() &&
+      !(clipboard_image && native_clipboard_has_last_bitmap())) {
     Image* native_image = nullptr;
     Mask* native_mask = nullptr;
     Palette* native_palette = nullptr;
     get_native_clipboard_bitmap(&native_image, &native_mask, &native_palette);
     if (native_image)
-      set_clipboard_image(native_image, native_mask, native_palette,
+      set_clipboard_image(ImageRef(native_image), native_mask, native_palette,
                           false, false);
   }
   if (clipboard_palette && palette)
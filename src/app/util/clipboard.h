@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -10,6 +10,7 @@
 #pragma once
 
 #include "doc/cel_list.h"
+#include "doc/image_ref.h"
 #include "gfx/point.h"
 #include "gfx/size.h"
 #include "ui/base.h"
@@ -69,6 +70,9 @@ namespace app {
     void copy_merged(const ContextReader& context);
     void copy_range(const ContextReader& context, const DocRange& range);
     void copy_image(const Image* image, const Mask* mask, const Palette* palette);
+    // Shares the given image with the clipboard (without a copy), so
+    // it must not be modified later.
+    void copy_image(const ImageRef& image, const Mask* mask, const Palette* palette);
     void copy_palette(const Palette* palette, const PalettePicks& picks);
     void paste(Context* ctx, const bool interactive);
 
@@ -25,7 +25,9 @@
 #include "os/system.h"
 #include "ui/alert.h"
 
+#include <algorithm>
 #include <sstream>
+#include <string>
 #include <vector>
 
 namespace app {
@@ -38,6 +40,10 @@ namespace {
   clip::format custom_image_format = 0;
   bool show_clip_errors = true;
 
+  // Data in custom_image_format of the last image that we've copied
+  // to the native clipboard.
+  std::string last_custom_data;
+
   class InhibitClipErrors {
     bool m_saved;
   public:
@@ -90,6 +96,7 @@ bool set_native_clipboard_bitmap(const doc::Image* image,
     return false;
 
   l.clear();
+  last_custom_data.clear();
 
   if (!image)
     return false;
@@ -101,18 +108,17 @@ bool set_native_clipboard_bitmap(const doc::Image* image,
             (image   ? 1: 0) |
             (mask    ? 2: 0) |
             (palette ? 4: 0));
-    if (image) doc::write_image(os, image);
+    // Use the fastest zlib compression level, the clipboard data is
+    // temporary and big images would stall the UI on each copy.
+    if (image) doc::write_image(os, image, nullptr, 1);
     if (mask) doc::write_mask(os, mask);
     if (palette) doc::write_palette(os, palette);
 
     if (os.good()) {
-      size_t size = (size_t)os.tellp();
-      if (size > 0) {
-        std::vector<char> data(size);
-        os.seekp(0);
-        os.read(&data[0], size);
-
-        l.set_data(custom_image_format, &data[0], size);
+      std::string data = os.str();
+      if (!data.empty()) {
+        l.set_data(custom_image_format, data.data(), data.size());
+        last_custom_data = std::move(data);
       }
     }
   }
@@ -141,12 +147,11 @@ bool set_native_clipboard_bitmap(const doc::Image* image,
     }
     case doc::IMAGE_GRAYSCALE: {
       clip::image img(spec);
-      const doc::LockImageBits<doc::GrayscaleTraits> bits(image);
-      auto it = bits.begin();
       uint32_t* dst = (uint32_t*)img.data();
       for (int y=0; y<image->height(); ++y) {
-        for (int x=0; x<image->width(); ++x, ++it) {
-          doc::color_t c = *it;
+        auto src = (const doc::GrayscaleTraits::address_t)image->getPixelAddress(0, y);
+        for (int x=0; x<image->width(); ++x) {
+          const doc::color_t c = src[x];
           *(dst++) = doc::rgba(doc::graya_getv(c),
                                doc::graya_getv(c),
                                doc::graya_getv(c),
@@ -157,20 +162,22 @@ bool set_native_clipboard_bitmap(const doc::Image* image,
       break;
     }
     case doc::IMAGE_INDEXED: {
+      // RGBA value of each index
+      doc::color_t colors[256];
+      for (int i=0; i<256; ++i) {
+        colors[i] = (i < palette->size() ? palette->getEntry(i): 0);
+
+        // Use alpha=0 for mask color
+        if (doc::color_t(i) == image->maskColor())
+          colors[i] &= doc::rgba_rgb_mask;
+      }
+
       clip::image img(spec);
-      const doc::LockImageBits<doc::IndexedTraits> bits(image);
-      auto it = bits.begin();
       uint32_t* dst = (uint32_t*)img.data();
       for (int y=0; y<image->height(); ++y) {
-        for (int x=0; x<image->width(); ++x, ++it) {
-          doc::color_t c = palette->getEntry(*it);
-
-          // Use alpha=0 for mask color
-          if (*it == image->maskColor())
-            c &= doc::rgba_rgb_mask;
-
-          *(dst++) = c;
-        }
+        auto src = (const doc::IndexedTraits::address_t)image->getPixelAddress(0, y);
+        for (int x=0; x<image->width(); ++x)
+          *(dst++) = colors[src[x]];
       }
       l.set_image(img);
       break;
@@ -319,5 +326,27 @@ bool get_native_clipboard_bitmap_size(gfx::Size* size)
     return false;
 }
 
+bool native_clipboard_has_last_bitmap()
+{
+  if (last_custom_data.empty())
+    return false;
+
+  InhibitClipErrors inhibitErrors;
+
+  clip::lock l(native_display_handle());
+  if (!l.locked() ||
+      !l.is_convertible(custom_image_format))
+    return false;
+
+  // Comparing the data is faster than decompressing the image
+  const size_t size = l.get_data_length(custom_image_format);
+  if (size != last_custom_data.size())
+    return false;
+
+  std::vector<char> buf(size);
+  return (l.get_data(custom_image_format, &buf[0], size) &&
+          std::equal(buf.begin(), buf.end(), last_custom_data.begin()));
+}
+
 } // namespace clipboard
 } // namespace app
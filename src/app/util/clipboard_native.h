@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2016  David Capello
 //
 // This program is distributed under the terms of
@@ -29,6 +30,11 @@ bool get_native_clipboard_bitmap(doc::Image** image,
                                  doc::Palette** palette);
 bool get_native_clipboard_bitmap_size(gfx::Size* size);
 
+// Returns true if the native clipboard still contains the last
+// bitmap set with set_native_clipboard_bitmap(), so it doesn't need
+// to be decoded again with get_native_clipboard_bitmap().
+bool native_clipboard_has_last_bitmap();
+
 } // namespace clipboard
 } // namespace app
 
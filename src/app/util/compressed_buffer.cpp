@@ -0,0 +1,363 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/util/compressed_buffer.h"
+
+#include "base/exception.h"
+#include "base/fs.h"
+#include "base/fstream_path.h"
+#include "zlib.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace app {
+
+namespace {
+
+// File where the data of old undo states is saved. The regions of
+// buffers that are loaded again or destroyed are reused by the next
+// spilled buffers, the file is truncated when all its regions are
+// free, and it's deleted when all the buffers that reference it are
+// destroyed.
+class SpillFile {
+public:
+  SpillFile(const std::string& filename)
+    : m_filename(filename)
+    , m_stream(FSTREAM_PATH(filename),
+               std::ios::in | std::ios::out |
+               std::ios::trunc | std::ios::binary)
+    , m_end(0) {
+  }
+
+  ~SpillFile() {
+    m_stream.close();
+    try {
+      if (base::is_file(m_filename))
+        base::delete_file(m_filename);
+    }
+    catch (const std::exception&) {
+      // Ignore errors, the file is in the session directory anyway
+    }
+  }
+
+  bool isOpen() const { return m_stream.is_open(); }
+
+  // Returns false if the data cannot be written
+  bool write(const base::buffer& data, uint64_t& offset) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const uint64_t size = data.size();
+
+    // Use the first free region where the data fits
+    auto it = m_free.begin();
+    for (; it!=m_free.end(); ++it)
+      if (it->second >= size)
+        break;
+    const uint64_t pos = (it != m_free.end() ? it->first: m_end);
+
+    m_stream.clear();
+    m_stream.seekp(std::streamoff(pos));
+    if (!m_stream.write((const char*)&data[0], data.size()))
+      return false;
+
+    if (it != m_free.end()) {
+      const uint64_t freeSize = it->second - size;
+      m_free.erase(it);
+      if (freeSize > 0)
+        m_free[pos+size] = freeSize;
+    }
+    else
+      m_end += size;
+    offset = pos;
+    return true;
+  }
+
+  // Marks the given region as free so it can be reused
+  void release(const uint64_t offset, const uint64_t size) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_free.emplace(offset, size).first;
+
+    // Merge adjacent free regions
+    auto next = std::next(it);
+    if (next != m_free.end() && it->first + it->second == next->first) {
+      it->second += next->second;
+      m_free.erase(next);
+    }
+    if (it != m_free.begin()) {
+      auto prev = std::prev(it);
+      if (prev->first + prev->second == it->first) {
+        prev->second += it->second;
+        m_free.erase(it);
+        it = prev;
+      }
+    }
+
+    // A free region at the end of the file is not needed anymore
+    if (it->first + it->second == m_end) {
+      m_end = it->first;
+      m_free.erase(it);
+    }
+
+    // Truncate the file when it's completely free
+    if (m_end == 0) {
+      m_stream.close();
+      m_stream.open(FSTREAM_PATH(m_filename),
+                    std::ios::in | std::ios::out |
+                    std::ios::trunc | std::ios::binary);
+    }
+  }
+
+  void read(const uint64_t offset, base::buffer& data) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stream.clear();
+    m_stream.seekg(std::streamoff(offset));
+    if (!m_stream.read((char*)&data[0], data.size()))
+      throw base::Exception("Error reading undo data from '%s'.",
+                            m_filename.c_str());
+  }
+
+private:
+  std::string m_filename;
+  std::fstream m_stream;
+  std::mutex m_mutex;
+  uint64_t m_end;
+  // Free regions (offset -> size) before m_end
+  std::map<uint64_t, uint64_t> m_free;
+};
+
+std::shared_ptr<SpillFile> g_spillFile;
+
+} // anonymous namespace
+
+struct CompressedBuffer::State {
+  // Locked by the background thread while the data is compressed
+  std::mutex mutex;
+  base::buffer raw;
+  base::buffer compressed;
+  size_t rawSize = 0;
+  bool pending = false;
+  std::atomic<size_t> size { 0 };
+
+  // Location of the data in the spill file (when spilled is true, the
+  // "compressed" flag indicates if the saved data is compressed)
+  std::shared_ptr<SpillFile> spillFile;
+  uint64_t spillOffset = 0;
+  size_t spillSize = 0;
+  bool spilled = false;
+  bool spilledCompressed = false;
+
+  ~State() {
+    if (spilled)
+      spillFile->release(spillOffset, spillSize);
+  }
+
+  void compress() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pending || raw.empty())
+      return;
+    pending = false;
+
+    uLongf len = compressBound(uLong(raw.size()));
+    base::buffer output(len);
+    if (compress2((Bytef*)&output[0], &len,
+                  (const Bytef*)&raw[0], uLong(raw.size()),
+                  Z_DEFAULT_COMPRESSION) != Z_OK ||
+        len >= raw.size()) {
+      // Keep the raw data if it's not compressible
+      return;
+    }
+
+    output.resize(len);
+    output.shrink_to_fit();
+    compressed = std::move(output);
+    rawSize = raw.size();
+    base::buffer().swap(raw);
+    size = compressed.size();
+  }
+
+  bool spill(const std::shared_ptr<SpillFile>& file) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (spilled)
+      return true;
+
+    pending = false;
+    const bool isCompressed = !compressed.empty();
+    base::buffer& data = (isCompressed ? compressed: raw);
+    if (data.empty() ||
+        !file->write(data, spillOffset))
+      return false;
+
+    spillFile = file;
+    spillSize = data.size();
+    spilled = true;
+    spilledCompressed = isCompressed;
+    if (!isCompressed)
+      rawSize = raw.size();
+    base::buffer().swap(data);
+    size = 0;
+    return true;
+  }
+
+  void uncompress() {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending = false;
+    if (spilled) {
+      base::buffer& data = (spilledCompressed ? compressed: raw);
+      data.resize(spillSize);
+      spillFile->read(spillOffset, data);
+      spillFile->release(spillOffset, spillSize);
+      spillFile.reset();
+      spilled = false;
+      size = data.size();
+    }
+    if (compressed.empty())
+      return;
+
+    raw.resize(rawSize);
+    uLongf len = uLongf(rawSize);
+    int err = ::uncompress((Bytef*)&raw[0], &len,
+                           (const Bytef*)&compressed[0], uLong(compressed.size()));
+    if (err != Z_OK || len != rawSize)
+      throw base::Exception("ZLib error %d in uncompress().", err);
+
+    base::buffer().swap(compressed);
+    size = raw.size();
+  }
+};
+
+namespace {
+
+// Only one background thread compresses undo buffers, so we don't
+// compete with the UI thread for more than one core.
+class Compressor {
+public:
+  static Compressor* instance() {
+    static Compressor compressor;
+    return &compressor;
+  }
+
+  ~Compressor() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_exit = true;
+      m_queue.clear();
+    }
+    m_cv.notify_one();
+    if (m_thread.joinable())
+      m_thread.join();
+  }
+
+  void enqueue(const std::shared_ptr<CompressedBuffer::State>& state) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_queue.push_back(state);
+      if (!m_thread.joinable())
+        m_thread = std::thread([this]{ threadLoop(); });
+    }
+    m_cv.notify_one();
+  }
+
+private:
+  Compressor() { }
+
+  void threadLoop() {
+    while (true) {
+      std::weak_ptr<CompressedBuffer::State> item;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]{ return m_exit || !m_queue.empty(); });
+        if (m_exit)
+          break;
+        item = m_queue.front();
+        m_queue.pop_front();
+      }
+      // The buffer could be deleted (e.g. the undo state was discarded)
+      if (auto state = item.lock())
+        state->compress();
+    }
+  }
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<std::weak_ptr<CompressedBuffer::State>> m_queue;
+  std::thread m_thread;
+  bool m_exit = false;
+};
+
+} // anonymous namespace
+
+CompressedBuffer::CompressedBuffer()
+  : m_state(std::make_shared<State>())
+{
+}
+
+void CompressedBuffer::reset(base::buffer&& data)
+{
+  // Create a new state so the background thread never touches the
+  // new data through a queued (old) state.
+  m_state = std::make_shared<State>();
+  m_state->raw = std::move(data);
+  m_state->size = m_state->raw.size();
+}
+
+base::buffer& CompressedBuffer::data()
+{
+  m_state->uncompress();
+  return m_state->raw;
+}
+
+void CompressedBuffer::compressInBackground()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    if (m_state->pending || m_state->raw.empty())
+      return;
+    m_state->pending = true;
+  }
+  Compressor::instance()->enqueue(m_state);
+}
+
+bool CompressedBuffer::spillToDisk()
+{
+  if (!g_spillFile)
+    return false;
+  return m_state->spill(g_spillFile);
+}
+
+size_t CompressedBuffer::size() const
+{
+  return m_state->size;
+}
+
+// static
+void CompressedBuffer::setSpillFile(const std::string& filename)
+{
+  g_spillFile.reset();
+  if (!filename.empty()) {
+    auto file = std::make_shared<SpillFile>(filename);
+    if (file->isOpen())
+      g_spillFile = file;
+  }
+}
+
+// static
+bool CompressedBuffer::canSpill()
+{
+  return (g_spillFile != nullptr);
+}
+
+} // namespace app
@@ -0,0 +1,69 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UTIL_COMPRESSED_BUFFER_H_INCLUDED
+#define APP_UTIL_COMPRESSED_BUFFER_H_INCLUDED
+#pragma once
+
+#include "base/buffer.h"
+
+#include <memory>
+#include <string>
+
+namespace app {
+
+  // Buffer of undo data that can be compressed with zlib in a
+  // background thread (so the UI thread doesn't wait the deflate
+  // process). The data is inflated again when it's requested.
+  //
+  // The data can be moved to a spill file too (the last tier for old
+  // undo states), so it doesn't use memory at all until it's needed.
+  //
+  // This class must be used from the UI thread only (or from a thread
+  // that prepares the undo data while the UI thread waits), the
+  // background thread just swaps the raw data with its compressed
+  // version.
+  class CompressedBuffer {
+  public:
+    // Shared with the background thread (internal use only)
+    struct State;
+
+    CompressedBuffer();
+
+    // Replaces the content of the buffer with the given raw data.
+    void reset(base::buffer&& data = base::buffer());
+
+    // Returns the raw data. If the data is being compressed we wait
+    // the background thread, and if it's already compressed we inflate
+    // it. The returned reference is valid until the next call to
+    // reset() or compressInBackground().
+    base::buffer& data();
+
+    // Queues the data to be compressed in the background thread.
+    void compressInBackground();
+
+    // Saves the data (compressed if possible) in the spill file and
+    // frees its memory. Returns false if there is no spill file.
+    bool spillToDisk();
+
+    // Size of the data in memory (raw or compressed size, or 0 if
+    // it's in the spill file). It can change at any moment when the
+    // background thread finishes.
+    size_t size() const;
+
+    // Sets the file used to spill old undo data (an empty filename
+    // disables the disk tier). The file is deleted when it's replaced
+    // and all its spilled buffers were deleted or loaded again.
+    static void setSpillFile(const std::string& filename);
+    static bool canSpill();
+
+  private:
+    std::shared_ptr<State> m_state;
+  };
+
+} // namespace app
+
+#endif
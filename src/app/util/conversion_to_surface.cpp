@@ -23,6 +23,12 @@
 #include <algorithm>
 #include <stdexcept>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define CONVERSION_SSE2 1
+  #include <emmintrin.h>
+#endif
+
 namespace app {
 
 using namespace doc;
@@ -95,6 +101,111 @@ void convert_image_to_surface_templ(const Image* image, os::Surface* dst,
   }
 }
 
+// Converts all indexes with a lookup table of already converted
+// palette entries.
+template<typename AddressType>
+void convert_indexed_image_to_surface_templ(const Image* image, os::Surface* dst,
+  int src_x, int src_y, int dst_x, int dst_y, int w, int h, const Palette* palette, const os::SurfaceFormatData* fd)
+{
+  uint32_t table[256];
+  for (int i=0; i<256; ++i)
+    table[i] = convert_color_to_surface<IndexedTraits, os::kRgbaSurfaceFormat>(i, palette, fd);
+
+  for (int v=0; v<h; ++v, ++src_y, ++dst_y) {
+    const uint8_t* src_address = image->getPixelAddress(src_x, src_y);
+    AddressType dst_address = AddressType(dst->getData(dst_x, dst_y));
+    for (int u=0; u<w; ++u, ++src_address) {
+      *dst_address = table[*src_address];
+      ++dst_address;
+    }
+  }
+}
+
+// Converts a row of 32bpp RGBA pixels to a 32bpp surface with a
+// different channels order.
+void convert_rgb_row_to_32bpp(const uint32_t* src, uint32_t* dst, int w,
+                              const os::SurfaceFormatData* fd)
+{
+  int u = 0;
+#ifdef CONVERSION_SSE2
+  const __m128i ff = _mm_set1_epi32(0xff);
+  const __m128i rshift = _mm_cvtsi32_si128(fd->redShift);
+  const __m128i gshift = _mm_cvtsi32_si128(fd->greenShift);
+  const __m128i bshift = _mm_cvtsi32_si128(fd->blueShift);
+  const __m128i ashift = _mm_cvtsi32_si128(fd->alphaShift);
+  const __m128i rmask = _mm_set1_epi32(int(fd->redMask));
+  const __m128i gmask = _mm_set1_epi32(int(fd->greenMask));
+  const __m128i bmask = _mm_set1_epi32(int(fd->blueMask));
+  const __m128i amask = _mm_set1_epi32(int(fd->alphaMask));
+
+  for (; u+4<=w; u+=4) {
+    const __m128i c = _mm_loadu_si128((const __m128i*)(src+u));
+    const __m128i r = _mm_and_si128(_mm_srli_epi32(c, rgba_r_shift), ff);
+    const __m128i g = _mm_and_si128(_mm_srli_epi32(c, rgba_g_shift), ff);
+    const __m128i b = _mm_and_si128(_mm_srli_epi32(c, rgba_b_shift), ff);
+    const __m128i a = _mm_srli_epi32(c, rgba_a_shift);
+    const __m128i out =
+      _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(_mm_sll_epi32(r, rshift), rmask),
+                     _mm_and_si128(_mm_sll_epi32(g, gshift), gmask)),
+        _mm_or_si128(_mm_and_si128(_mm_sll_epi32(b, bshift), bmask),
+                     _mm_and_si128(_mm_sll_epi32(a, ashift), amask)));
+    _mm_storeu_si128((__m128i*)(dst+u), out);
+  }
+#endif
+
+  for (; u<w; ++u)
+    dst[u] = convert_color_to_surface<RgbTraits, os::kRgbaSurfaceFormat>(src[u], nullptr, fd);
+}
+
+// Converts a row of 16bpp gray+alpha pixels to a 32bpp surface.
+void convert_grayscale_row_to_32bpp(const uint16_t* src, uint32_t* dst, int w,
+                                    const os::SurfaceFormatData* fd)
+{
+  int u = 0;
+#ifdef CONVERSION_SSE2
+  const __m128i ff = _mm_set1_epi32(0xff);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i rshift = _mm_cvtsi32_si128(fd->redShift);
+  const __m128i gshift = _mm_cvtsi32_si128(fd->greenShift);
+  const __m128i bshift = _mm_cvtsi32_si128(fd->blueShift);
+  const __m128i ashift = _mm_cvtsi32_si128(fd->alphaShift);
+  const __m128i rmask = _mm_set1_epi32(int(fd->redMask));
+  const __m128i gmask = _mm_set1_epi32(int(fd->greenMask));
+  const __m128i bmask = _mm_set1_epi32(int(fd->blueMask));
+  const __m128i amask = _mm_set1_epi32(int(fd->alphaMask));
+
+  for (; u+4<=w; u+=4) {
+    const __m128i c = _mm_unpacklo_epi16(
+      _mm_loadl_epi64((const __m128i*)(src+u)), zero);
+    const __m128i v = _mm_and_si128(_mm_srli_epi32(c, graya_v_shift), ff);
+    const __m128i a = _mm_and_si128(_mm_srli_epi32(c, graya_a_shift), ff);
+    const __m128i out =
+      _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(_mm_sll_epi32(v, rshift), rmask),
+                     _mm_and_si128(_mm_sll_epi32(v, gshift), gmask)),
+        _mm_or_si128(_mm_and_si128(_mm_sll_epi32(v, bshift), bmask),
+                     _mm_and_si128(_mm_sll_epi32(a, ashift), amask)));
+    _mm_storeu_si128((__m128i*)(dst+u), out);
+  }
+#endif
+
+  for (; u<w; ++u)
+    dst[u] = convert_color_to_surface<GrayscaleTraits, os::kRgbaSurfaceFormat>(src[u], nullptr, fd);
+}
+
+template<typename ImageTraits, typename RowFunc>
+void convert_image_rows_to_32bpp(const Image* image, os::Surface* dst,
+  int src_x, int src_y, int dst_x, int dst_y, int w, int h,
+  const os::SurfaceFormatData* fd, RowFunc rowFunc)
+{
+  for (int v=0; v<h; ++v, ++src_y, ++dst_y) {
+    rowFunc(
+      (const typename ImageTraits::pixel_t*)image->getPixelAddress(src_x, src_y),
+      (uint32_t*)dst->getData(dst_x, dst_y), w, fd);
+  }
+}
+
 struct Address24bpp
 {
   uint8_t* m_ptr;
@@ -111,6 +222,24 @@ template<typename ImageTraits>
 void convert_image_to_surface_selector(const Image* image, os::Surface* surface,
   int src_x, int src_y, int dst_x, int dst_y, int w, int h, const Palette* palette, const os::SurfaceFormatData* fd)
 {
+  // Fast paths for 32bpp surfaces (the most common case)
+  if (fd->bitsPerPixel == 32) {
+    switch (ImageTraits::pixel_format) {
+      case IMAGE_RGB:
+        convert_image_rows_to_32bpp<RgbTraits>(
+          image, surface, src_x, src_y, dst_x, dst_y, w, h, fd,
+          convert_rgb_row_to_32bpp);
+        return;
+      case IMAGE_GRAYSCALE:
+        convert_image_rows_to_32bpp<GrayscaleTraits>(
+          image, surface, src_x, src_y, dst_x, dst_y, w, h, fd,
+          convert_grayscale_row_to_32bpp);
+        return;
+      default:
+        break;
+    }
+  }
+
   switch (fd->bitsPerPixel) {
 
     case 8:
@@ -194,7 +323,21 @@ void convert_image_to_surface(
       break;
 
     case IMAGE_INDEXED:
-      convert_image_to_surface_selector<IndexedTraits>(image, surface, src_x, src_y, dst_x, dst_y, w, h, palette, &fd);
+      switch (fd.bitsPerPixel) {
+        case 8:
+          convert_indexed_image_to_surface_templ<uint8_t*>(image, surface, src_x, src_y, dst_x, dst_y, w, h, palette, &fd);
+          break;
+        case 15:
+        case 16:
+          convert_indexed_image_to_surface_templ<uint16_t*>(image, surface, src_x, src_y, dst_x, dst_y, w, h, palette, &fd);
+          break;
+        case 24:
+          convert_indexed_image_to_surface_templ<Address24bpp>(image, surface, src_x, src_y, dst_x, dst_y, w, h, palette, &fd);
+          break;
+        case 32:
+          convert_indexed_image_to_surface_templ<uint32_t*>(image, surface, src_x, src_y, dst_x, dst_y, w, h, palette, &fd);
+          break;
+      }
       break;
 
     case IMAGE_BITMAP:
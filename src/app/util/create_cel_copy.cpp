@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -35,19 +35,25 @@ Cel* create_cel_copy(const Cel* srcCel,
 {
   const Image* celImage = srcCel->image();
 
+  const bool convert =
+    ((dstSprite->pixelFormat() != celImage->pixelFormat()) ||
+     // If both images are indexed but with different palette, we can
+     // convert the source cel to RGB first.
+     (dstSprite->pixelFormat() == IMAGE_INDEXED &&
+      celImage->pixelFormat() == IMAGE_INDEXED &&
+      srcCel->sprite()->palette(srcCel->frame())->countDiff(
+        dstSprite->palette(dstFrame), nullptr, nullptr)));
+
+  // When we don't need to convert the image, all its pixels are
+  // copied below, so we can use a non-zeroed (recycled) buffer.
   std::unique_ptr<Cel> dstCel(
     new Cel(dstFrame,
             ImageRef(Image::create(dstSprite->pixelFormat(),
                                    celImage->width(),
-                                   celImage->height()))));
-
-  if ((dstSprite->pixelFormat() != celImage->pixelFormat()) ||
-      // If both images are indexed but with different palette, we can
-      // convert the source cel to RGB first.
-      (dstSprite->pixelFormat() == IMAGE_INDEXED &&
-       celImage->pixelFormat() == IMAGE_INDEXED &&
-       srcCel->sprite()->palette(srcCel->frame())->countDiff(
-         dstSprite->palette(dstFrame), nullptr, nullptr))) {
+                                   celImage->height(),
+                                   std::make_shared<ImageBuffer>(1, convert)))));
+
+  if (convert) {
     ImageRef tmpImage(Image::create(IMAGE_RGB, celImage->width(), celImage->height()));
     tmpImage->clear(0);
 
@@ -72,11 +78,9 @@ Cel* create_cel_copy(const Cel* srcCel,
       dstSprite->transparentColor());
   }
   else {
-    render::composite_image(
-      dstCel->image(),
-      celImage,
-      srcCel->sprite()->palette(srcCel->frame()),
-      0, 0, 255, BlendMode::SRC);
+    // Same as compositing with BlendMode::SRC, but copying rows
+    // directly (without creating a render::Render for each cel).
+    copy_image(dstCel->image(), celImage);
   }
 
   // Resize a referecen cel to a non-reference layer
@@ -0,0 +1,443 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/util/data_file_writer.h"
+
+#include "base/debug.h"
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+
+namespace app {
+
+namespace {
+
+// The JSON text is flushed each time we reach this size
+const std::size_t kJsonBufferSize = 64*1024;
+
+} // anonymous namespace
+
+//////////////////////////////////////////////////////////////////////
+// DataFileWriter
+
+DataFileWriter::DataFileWriter(std::ostream& os, const std::size_t capacity)
+  : m_os(os)
+  , m_capacity(capacity)
+{
+  m_buf.reserve(capacity);
+}
+
+DataFileWriter::~DataFileWriter()
+{
+  flush();
+}
+
+void DataFileWriter::key(const char* name)
+{
+  key(name, std::strlen(name));
+}
+
+void DataFileWriter::value(const char* str)
+{
+  value(str, std::strlen(str));
+}
+
+bool DataFileWriter::flush()
+{
+  if (!m_buf.empty()) {
+    m_os.write(m_buf.c_str(), m_buf.size());
+    m_buf.clear();
+  }
+  return m_os.good();
+}
+
+//////////////////////////////////////////////////////////////////////
+// JsonDataFileWriter
+
+JsonDataFileWriter::JsonDataFileWriter(std::ostream& os)
+  : DataFileWriter(os, kJsonBufferSize)
+{
+}
+
+void JsonDataFileWriter::beginObject(const Layout layout, const int extraIndent)
+{
+  begin('{', layout, extraIndent);
+}
+
+void JsonDataFileWriter::endObject()
+{
+  end('}');
+}
+
+void JsonDataFileWriter::beginArray(const Layout layout, const int extraIndent)
+{
+  begin('[', layout, extraIndent);
+}
+
+void JsonDataFileWriter::endArray()
+{
+  end(']');
+}
+
+void JsonDataFileWriter::key(const char* name, const std::size_t len)
+{
+  ASSERT(!m_stack.empty() && m_stack.back().object);
+  flushIfFull();
+  itemPrefix();
+  writeString(name, len);
+  write(": ", 2);
+  m_stack.back().afterKey = true;
+}
+
+void JsonDataFileWriter::value(const bool value)
+{
+  itemPrefix();
+  if (value)
+    write("true", 4);
+  else
+    write("false", 5);
+}
+
+void JsonDataFileWriter::value(const int value)
+{
+  char buf[16];
+  auto res = std::to_chars(buf, buf+sizeof(buf), value);
+  itemPrefix();
+  write(buf, res.ptr - buf);
+}
+
+void JsonDataFileWriter::value(const double value)
+{
+  char buf[32];
+  int len = std::snprintf(buf, sizeof(buf), "%g", value);
+  if (len < 0)
+    len = 0;
+  // Avoid the decimal comma of some locales
+  for (int i=0; i<len; ++i)
+    if (buf[i] == ',')
+      buf[i] = '.';
+  itemPrefix();
+  write(buf, len);
+}
+
+void JsonDataFileWriter::value(const char* str, const std::size_t len)
+{
+  itemPrefix();
+  writeString(str, len);
+}
+
+void JsonDataFileWriter::begin(const char chr, const Layout layout, const int extraIndent)
+{
+  flushIfFull();
+  itemPrefix();
+
+  Container c;
+  c.layout = layout;
+  c.object = (chr == '{');
+  c.first = true;
+  c.afterKey = false;
+  if (m_stack.empty()) {
+    c.itemIndent = 1;
+    c.closeIndent = 0;
+  }
+  else if (layout == Layout::Block) {
+    c.itemIndent = m_stack.back().itemIndent + 1 + extraIndent;
+    c.closeIndent = m_stack.back().itemIndent;
+  }
+  else {
+    c.itemIndent = c.closeIndent = m_stack.back().itemIndent;
+  }
+  m_stack.push_back(c);
+
+  write(chr);
+  if (layout == Layout::Inline)
+    write(' ');
+}
+
+void JsonDataFileWriter::end(const char chr)
+{
+  ASSERT(!m_stack.empty());
+  const Container c = m_stack.back();
+  m_stack.pop_back();
+
+  switch (c.layout) {
+    case Layout::Block:
+      write('\n');
+      writeIndent(c.closeIndent);
+      break;
+    case Layout::Inline:
+      write(' ');
+      break;
+    case Layout::Compact:
+      break;
+  }
+  write(chr);
+
+  if (m_stack.empty())
+    write('\n');
+}
+
+// Writes the separator between items of the current container. It's
+// called before each key of an object, and before each value of an
+// array.
+void JsonDataFileWriter::itemPrefix()
+{
+  if (m_stack.empty())
+    return;
+
+  Container& c = m_stack.back();
+  // Values of an object are not items (they go after the key)
+  if (c.afterKey) {
+    c.afterKey = false;
+    return;
+  }
+
+  const bool first = c.first;
+  c.first = false;
+
+  switch (c.layout) {
+    case Layout::Block:
+      if (m_stack.size() == 1) {
+        // The first item of the root object goes in the same line
+        if (first)
+          write(' ');
+        else
+          write(",\n ", 3);
+      }
+      else {
+        if (!first)
+          write(',');
+        write('\n');
+        writeIndent(c.itemIndent);
+      }
+      break;
+    case Layout::Inline:
+    case Layout::Compact:
+      if (!first)
+        write(", ", 2);
+      break;
+  }
+}
+
+void JsonDataFileWriter::writeIndent(const int indent)
+{
+  m_buf.append(indent, ' ');
+}
+
+void JsonDataFileWriter::writeString(const char* str, const std::size_t len)
+{
+  static const char* hex = "0123456789abcdef";
+
+  write('"');
+  for (std::size_t i=0; i<len; ++i) {
+    const char chr = str[i];
+    switch (chr) {
+      case '"':  write("\\\"", 2); break;
+      case '\\': write("\\\\", 2); break;
+      case '\n': write("\\n", 2); break;
+      case '\r': write("\\r", 2); break;
+      case '\t': write("\\t", 2); break;
+      default:
+        if (uint8_t(chr) < 0x20) {
+          const char buf[6] = { '\\', 'u', '0', '0',
+                                hex[(chr >> 4) & 0xf],
+                                hex[chr & 0xf] };
+          write(buf, 6);
+        }
+        else
+          write(chr);
+        break;
+    }
+  }
+  write('"');
+}
+
+//////////////////////////////////////////////////////////////////////
+// MsgPackDataFileWriter
+
+MsgPackDataFileWriter::MsgPackDataFileWriter(std::ostream& os, const std::size_t capacity)
+  : DataFileWriter(os, capacity)
+{
+}
+
+void MsgPackDataFileWriter::beginObject(const Layout, const int)
+{
+  begin(0xdf, true);      // map 32
+}
+
+void MsgPackDataFileWriter::endObject()
+{
+  end();
+}
+
+void MsgPackDataFileWriter::beginArray(const Layout, const int)
+{
+  begin(0xdd, false);     // array 32
+}
+
+void MsgPackDataFileWriter::endArray()
+{
+  end();
+}
+
+void MsgPackDataFileWriter::key(const char* name, const std::size_t len)
+{
+  ASSERT(!m_stack.empty() && m_stack.back().object);
+  newItem(true);
+  writeString(name, len);
+}
+
+void MsgPackDataFileWriter::value(const bool value)
+{
+  newItem(false);
+  writeUInt8(value ? 0xc3: 0xc2);
+}
+
+void MsgPackDataFileWriter::value(const int value)
+{
+  newItem(false);
+  if (value >= 0) {
+    if (value < 0x80) {                 // positive fixint
+      writeUInt8(uint8_t(value));
+    }
+    else if (value <= 0xff) {
+      writeUInt8(0xcc);
+      writeUInt8(uint8_t(value));
+    }
+    else if (value <= 0xffff) {
+      writeUInt8(0xcd);
+      writeUInt16(uint16_t(value));
+    }
+    else {
+      writeUInt8(0xce);
+      writeUInt32(uint32_t(value));
+    }
+  }
+  else {
+    if (value >= -32) {                 // negative fixint
+      writeUInt8(uint8_t(int8_t(value)));
+    }
+    else if (value >= -128) {
+      writeUInt8(0xd0);
+      writeUInt8(uint8_t(int8_t(value)));
+    }
+    else if (value >= -32768) {
+      writeUInt8(0xd1);
+      writeUInt16(uint16_t(int16_t(value)));
+    }
+    else {
+      writeUInt8(0xd2);
+      writeUInt32(uint32_t(value));
+    }
+  }
+}
+
+void MsgPackDataFileWriter::value(const double value)
+{
+  uint64_t bits;
+  static_assert(sizeof(bits) == sizeof(value), "Invalid double size");
+  std::memcpy(&bits, &value, sizeof(bits));
+
+  newItem(false);
+  writeUInt8(0xcb);               // float 64
+  writeUInt64(bits);
+}
+
+void MsgPackDataFileWriter::value(const char* str, const std::size_t len)
+{
+  newItem(false);
+  writeString(str, len);
+}
+
+void MsgPackDataFileWriter::begin(const uint8_t type, const bool object)
+{
+  newItem(false);
+
+  Container c;
+  c.object = object;
+  c.headerPos = m_buf.size();
+  c.count = 0;
+  m_stack.push_back(c);
+
+  // The number of items is written in end()
+  writeUInt8(type);
+  writeUInt32(0);
+}
+
+void MsgPackDataFileWriter::end()
+{
+  ASSERT(!m_stack.empty());
+  const Container c = m_stack.back();
+  m_stack.pop_back();
+
+  char* p = &m_buf[c.headerPos+1];
+  p[0] = char((c.count >> 24) & 0xff);
+  p[1] = char((c.count >> 16) & 0xff);
+  p[2] = char((c.count >> 8) & 0xff);
+  p[3] = char(c.count & 0xff);
+}
+
+void MsgPackDataFileWriter::newItem(const bool isKey)
+{
+  if (m_stack.empty())
+    return;
+
+  // Maps count key/value pairs
+  Container& c = m_stack.back();
+  if (isKey || !c.object)
+    ++c.count;
+}
+
+void MsgPackDataFileWriter::writeUInt8(const uint8_t value)
+{
+  write(char(value));
+}
+
+void MsgPackDataFileWriter::writeUInt16(const uint16_t value)
+{
+  writeUInt8(uint8_t(value >> 8));
+  writeUInt8(uint8_t(value));
+}
+
+void MsgPackDataFileWriter::writeUInt32(const uint32_t value)
+{
+  writeUInt16(uint16_t(value >> 16));
+  writeUInt16(uint16_t(value));
+}
+
+void MsgPackDataFileWriter::writeUInt64(const uint64_t value)
+{
+  writeUInt32(uint32_t(value >> 32));
+  writeUInt32(uint32_t(value));
+}
+
+void MsgPackDataFileWriter::writeString(const char* str, const std::size_t len)
+{
+  if (len < 32) {                       // fixstr
+    writeUInt8(0xa0 | uint8_t(len));
+  }
+  else if (len <= 0xff) {
+    writeUInt8(0xd9);
+    writeUInt8(uint8_t(len));
+  }
+  else if (len <= 0xffff) {
+    writeUInt8(0xda);
+    writeUInt16(uint16_t(len));
+  }
+  else {
+    writeUInt8(0xdb);
+    writeUInt32(uint32_t(len));
+  }
+  write(str, len);
+}
+
+} // namespace app
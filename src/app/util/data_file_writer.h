@@ -0,0 +1,170 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UTIL_DATA_FILE_WRITER_H_INCLUDED
+#define APP_UTIL_DATA_FILE_WRITER_H_INCLUDED
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace app {
+
+  // Streaming writer of structured data (objects, arrays, and
+  // values) used to generate the sprite sheet data file. The output
+  // is accumulated in a pre-sized buffer and written to the stream
+  // in big chunks.
+  class DataFileWriter {
+  public:
+    // How a container is formatted in a text file (binary formats
+    // ignore this).
+    enum class Layout {
+      Block,                    // One item per line
+      Inline,                   // { "a": 1, "b": 2 }
+      Compact,                  // [{ ... }, { ... }]
+    };
+
+    DataFileWriter(std::ostream& os, const std::size_t capacity);
+    virtual ~DataFileWriter();
+
+    // The "extraIndent" is used only in Layout::Block containers to
+    // indent its items more than usual.
+    virtual void beginObject(const Layout layout = Layout::Block,
+                             const int extraIndent = 0) = 0;
+    virtual void endObject() = 0;
+    virtual void beginArray(const Layout layout = Layout::Block,
+                            const int extraIndent = 0) = 0;
+    virtual void endArray() = 0;
+
+    // Keys of the current object
+    virtual void key(const char* name, const std::size_t len) = 0;
+    void key(const char* name);
+    void key(const std::string& name) { key(name.c_str(), name.size()); }
+
+    virtual void value(const bool value) = 0;
+    virtual void value(const int value) = 0;
+    virtual void value(const double value) = 0;
+    virtual void value(const char* str, const std::size_t len) = 0;
+    void value(const char* str);
+    void value(const std::string& str) { value(str.c_str(), str.size()); }
+
+    template<typename T>
+    void field(const char* name, const T& v) {
+      key(name);
+      value(v);
+    }
+
+    // Writes the pending data to the stream. Returns false if there
+    // was a I/O error. It must be called when the root container is
+    // closed (binary formats might need to modify the buffer until
+    // that moment).
+    bool flush();
+
+  protected:
+    void write(const char* data, const std::size_t len) {
+      m_buf.append(data, len);
+    }
+    void write(const char chr) {
+      m_buf.push_back(chr);
+    }
+    // Flushes the buffer if it is full
+    void flushIfFull() {
+      if (m_buf.size() >= m_capacity)
+        flush();
+    }
+
+    std::string m_buf;
+
+  private:
+    std::ostream& m_os;
+    std::size_t m_capacity;
+  };
+
+  // Writes JSON text
+  class JsonDataFileWriter : public DataFileWriter {
+  public:
+    JsonDataFileWriter(std::ostream& os);
+
+    void beginObject(const Layout layout = Layout::Block,
+                     const int extraIndent = 0) override;
+    void endObject() override;
+    void beginArray(const Layout layout = Layout::Block,
+                    const int extraIndent = 0) override;
+    void endArray() override;
+    void key(const char* name, const std::size_t len) override;
+    void value(const bool value) override;
+    void value(const int value) override;
+    void value(const double value) override;
+    void value(const char* str, const std::size_t len) override;
+    using DataFileWriter::key;
+    using DataFileWriter::value;
+
+  private:
+    struct Container {
+      Layout layout;
+      int itemIndent;
+      int closeIndent;
+      bool object;
+      bool first;               // No items yet
+      bool afterKey;            // The next value is for the last key
+    };
+
+    void begin(const char chr, const Layout layout, const int extraIndent);
+    void end(const char chr);
+    void itemPrefix();
+    void writeIndent(const int indent);
+    void writeString(const char* str, const std::size_t len);
+
+    std::vector<Container> m_stack;
+  };
+
+  // Writes MessagePack (https://msgpack.org/) binary data. The number
+  // of items of each map/array is not known in advance, so the whole
+  // output is kept in memory and the headers of the containers are
+  // fixed when they are closed.
+  class MsgPackDataFileWriter : public DataFileWriter {
+  public:
+    MsgPackDataFileWriter(std::ostream& os, const std::size_t capacity);
+
+    void beginObject(const Layout layout = Layout::Block,
+                     const int extraIndent = 0) override;
+    void endObject() override;
+    void beginArray(const Layout layout = Layout::Block,
+                    const int extraIndent = 0) override;
+    void endArray() override;
+    void key(const char* name, const std::size_t len) override;
+    void value(const bool value) override;
+    void value(const int value) override;
+    void value(const double value) override;
+    void value(const char* str, const std::size_t len) override;
+    using DataFileWriter::key;
+    using DataFileWriter::value;
+
+  private:
+    struct Container {
+      bool object;
+      std::size_t headerPos;
+      uint32_t count;
+    };
+
+    void begin(const uint8_t type, const bool object);
+    void end();
+    void newItem(const bool isKey);
+    void writeUInt8(const uint8_t value);
+    void writeUInt16(const uint16_t value);
+    void writeUInt32(const uint32_t value);
+    void writeUInt64(const uint64_t value);
+    void writeString(const char* str, const std::size_t len);
+
+    std::vector<Container> m_stack;
+  };
+
+} // namespace app
+
+#endif
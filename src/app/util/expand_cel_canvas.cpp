@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -40,6 +40,12 @@ static app::ExpandCelCanvas* singleton = nullptr;
 static doc::ImageBufferPtr src_buffer;
 static doc::ImageBufferPtr dst_buffer;
 
+// Buffers bigger than this are not kept between tool loops. In this
+// way each big canvas is a fresh allocation where the system gives
+// us memory pages only when they are touched (i.e. only for the
+// regions that are validated in the canvas).
+static const std::size_t kMaxKeptBufferSize = 64*1024*1024;
+
 static void destroy_buffers()
 {
   src_buffer.reset();
@@ -51,11 +57,22 @@ static void create_buffers()
   if (!src_buffer) {
     app::App::instance()->Exit.connect(&destroy_buffers);
 
-    src_buffer.reset(new doc::ImageBuffer(1));
-    dst_buffer.reset(new doc::ImageBuffer(1));
+    // We don't need zero-filled buffers because each region of the
+    // canvases is filled/copied before it's used (see
+    // validateSourceCanvas/validateDestCanvas).
+    src_buffer.reset(new doc::ImageBuffer(1, false));
+    dst_buffer.reset(new doc::ImageBuffer(1, false));
   }
 }
 
+static void release_big_buffers()
+{
+  if (src_buffer && src_buffer->size() > kMaxKeptBufferSize)
+    src_buffer.reset(new doc::ImageBuffer(1, false));
+  if (dst_buffer && dst_buffer->size() > kMaxKeptBufferSize)
+    dst_buffer.reset(new doc::ImageBuffer(1, false));
+}
+
 }
 
 namespace app {
@@ -141,6 +158,8 @@ ExpandCelCanvas::~ExpandCelCanvas()
   catch (...) {
     // Do nothing
   }
+
+  release_big_buffers();
 }
 
 void ExpandCelCanvas::commit()
@@ -162,16 +181,22 @@ void ExpandCelCanvas::commit()
     ASSERT(m_cel);
     ASSERT(!m_celImage);
 
-    // Validate the whole m_dstImage (invalid areas are cleared, as we
-    // don't have a m_celImage)
-    validateDestCanvas(gfx::Region(m_bounds));
+    // Validate the modified area of m_dstImage (invalid areas are
+    // cleared, as we don't have a m_celImage). Pixels outside the
+    // valid region were not touched, so they are transparent and we
+    // don't need to validate/check them.
+    const gfx::Rect modifiedBounds =
+      (m_layer->isBackground() ? m_dstImage->bounds():
+                                 m_validDstRegion.bounds());
+    validateDestCanvas(
+      gfx::Region(gfx::Rect(modifiedBounds).offset(m_bounds.origin())));
 
     // We can temporary remove the cel.
     if (m_layer->isImage()) {
       static_cast<LayerImage*>(m_layer)->removeCel(m_cel);
 
       // Add a copy of m_dstImage in the sprite's image stock
-      gfx::Rect trimBounds = getTrimDstImageBounds();
+      gfx::Rect trimBounds = getTrimDstImageBounds(modifiedBounds);
       if (!trimBounds.isEmpty()) {
         ImageRef newImage(trimDstImage(trimBounds));
         ASSERT(newImage);
@@ -400,14 +425,15 @@ void ExpandCelCanvas::copyValidDestToSourceCanvas(const gfx::Region& rgn)
   m_canCompareSrcVsDst = false;
 }
 
-gfx::Rect ExpandCelCanvas::getTrimDstImageBounds() const
+gfx::Rect ExpandCelCanvas::getTrimDstImageBounds(const gfx::Rect& startBounds) const
 {
   if (m_layer->isBackground())
     return m_dstImage->bounds();
   else {
     gfx::Rect bounds;
-    algorithm::shrink_bounds(m_dstImage.get(), bounds,
-                             m_dstImage->maskColor());
+    if (!startBounds.isEmpty())
+      algorithm::shrink_bounds(m_dstImage.get(), startBounds, bounds,
+                               m_dstImage->maskColor());
     return bounds;
   }
 }
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -70,7 +71,7 @@ namespace app {
     const Cel* getCel() const { return m_cel; }
 
   private:
-    gfx::Rect getTrimDstImageBounds() const;
+    gfx::Rect getTrimDstImageBounds(const gfx::Rect& startBounds) const;
     ImageRef trimDstImage(const gfx::Rect& bounds) const;
 
     Doc* m_document;
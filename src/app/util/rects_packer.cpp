@@ -0,0 +1,473 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/util/rects_packer.h"
+
+#include "base/debug.h"
+#include "base/task.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+namespace app {
+
+namespace {
+
+// Skyline bottom-left: the top edge of the packed rectangles is
+// stored as a list of horizontal segments, and each new rectangle
+// is placed over the segment that gives the lowest top position.
+class SkylineBin {
+public:
+  SkylineBin(const int width, const int height)
+    : m_width(width)
+    , m_height(height) {
+    m_skyline.push_back(Segment{ 0, 0, width });
+  }
+
+  bool insert(const int w, const int h, gfx::Point& pt) {
+    int bestIndex = -1;
+    int bestTop = INT_MAX;
+    int bestY = 0;
+
+    for (int i=0; i<int(m_skyline.size()); ++i) {
+      int y;
+      if (fits(i, w, h, y) && y+h < bestTop) {
+        bestIndex = i;
+        bestTop = y+h;
+        bestY = y;
+      }
+    }
+    if (bestIndex < 0)
+      return false;
+
+    pt = gfx::Point(m_skyline[bestIndex].x, bestY);
+    addSegment(bestIndex, Segment{ pt.x, bestY+h, w });
+    return true;
+  }
+
+private:
+  struct Segment {
+    int x, y, w;
+  };
+
+  // Returns true if a rectangle of w x h fits over the given segment
+  // (the rectangle can be over next segments too), "y" is the
+  // lowest position where the rectangle can be placed.
+  bool fits(int i, const int w, const int h, int& y) const {
+    if (m_skyline[i].x + w > m_width)
+      return false;
+
+    int remaining = w;
+    y = m_skyline[i].y;
+    while (remaining > 0) {
+      ASSERT(i < int(m_skyline.size()));
+      y = std::max(y, m_skyline[i].y);
+      if (y + h > m_height)
+        return false;
+      remaining -= m_skyline[i].w;
+      ++i;
+    }
+    return true;
+  }
+
+  void addSegment(const int i, const Segment& seg) {
+    m_skyline.insert(m_skyline.begin()+i, seg);
+
+    // Shrink or remove the segments that are below the new one
+    const int x2 = seg.x + seg.w;
+    for (int j=i+1; j<int(m_skyline.size()); ) {
+      Segment& s = m_skyline[j];
+      if (s.x >= x2)
+        break;
+
+      const int shrink = x2 - s.x;
+      if (s.w <= shrink) {
+        m_skyline.erase(m_skyline.begin()+j);
+        continue;
+      }
+      s.x += shrink;
+      s.w -= shrink;
+      break;
+    }
+
+    // Merge contiguous segments at the same level
+    for (int j=0; j+1<int(m_skyline.size()); ) {
+      if (m_skyline[j].y == m_skyline[j+1].y) {
+        m_skyline[j].w += m_skyline[j+1].w;
+        m_skyline.erase(m_skyline.begin()+j+1);
+      }
+      else
+        ++j;
+    }
+  }
+
+  int m_width;
+  int m_height;
+  std::vector<Segment> m_skyline;
+};
+
+// MaxRects: we keep a list of maximal free rectangles (which can
+// overlap), each new rectangle is placed in the free rectangle with
+// the best score for the given heuristic.
+class MaxRectsBin {
+public:
+  MaxRectsBin(const int width, const int height,
+              const SpriteSheetPacking heuristic)
+    : m_heuristic(heuristic) {
+    m_free.push_back(gfx::Rect(0, 0, width, height));
+  }
+
+  bool insert(const int w, const int h, gfx::Point& pt) {
+    int bestIndex = -1;
+    int bestScore1 = INT_MAX;
+    int bestScore2 = INT_MAX;
+
+    for (int i=0; i<int(m_free.size()); ++i) {
+      const gfx::Rect& f = m_free[i];
+      if (f.w < w || f.h < h)
+        continue;
+
+      int score1, score2;
+      calcScore(f, w, h, score1, score2);
+      if (score1 < bestScore1 ||
+          (score1 == bestScore1 && score2 < bestScore2)) {
+        bestIndex = i;
+        bestScore1 = score1;
+        bestScore2 = score2;
+      }
+    }
+    if (bestIndex < 0)
+      return false;
+
+    const gfx::Rect used(m_free[bestIndex].x,
+                         m_free[bestIndex].y, w, h);
+    splitFreeRects(used);
+    pt = used.origin();
+    return true;
+  }
+
+private:
+  void calcScore(const gfx::Rect& f, const int w, const int h,
+                 int& score1, int& score2) const {
+    const int leftoverW = f.w - w;
+    const int leftoverH = f.h - h;
+    switch (m_heuristic) {
+      case SpriteSheetPacking::BestLongSideFit:
+        score1 = std::max(leftoverW, leftoverH);
+        score2 = std::min(leftoverW, leftoverH);
+        break;
+      case SpriteSheetPacking::BestAreaFit:
+        score1 = int(std::min<int64_t>(INT_MAX, int64_t(f.w)*f.h - int64_t(w)*h));
+        score2 = std::min(leftoverW, leftoverH);
+        break;
+      case SpriteSheetPacking::BottomLeft:
+        score1 = f.y + h;
+        score2 = f.x;
+        break;
+      case SpriteSheetPacking::BestShortSideFit:
+      default:
+        score1 = std::min(leftoverW, leftoverH);
+        score2 = std::max(leftoverW, leftoverH);
+        break;
+    }
+  }
+
+  // Removes the "used" area from all the free rectangles.
+  void splitFreeRects(const gfx::Rect& used) {
+    std::vector<gfx::Rect> kept;
+    std::vector<gfx::Rect> created;
+    kept.reserve(m_free.size());
+
+    for (const gfx::Rect& f : m_free) {
+      if (!f.intersects(used)) {
+        kept.push_back(f);
+        continue;
+      }
+      if (used.x > f.x)
+        created.push_back(gfx::Rect(f.x, f.y, used.x - f.x, f.h));
+      if (used.x2() < f.x2())
+        created.push_back(gfx::Rect(used.x2(), f.y, f.x2() - used.x2(), f.h));
+      if (used.y > f.y)
+        created.push_back(gfx::Rect(f.x, f.y, f.w, used.y - f.y));
+      if (used.y2() < f.y2())
+        created.push_back(gfx::Rect(f.x, used.y2(), f.w, f.y2() - used.y2()));
+    }
+
+    // Remove the new free rectangles that are inside other free
+    // rectangle. The old ones ("kept") cannot be inside a new one
+    // because each new rectangle is a part of an old free
+    // rectangle, and the list of free rectangles never contains a
+    // rectangle inside other.
+    for (int i=0; i<int(created.size()); ++i) {
+      bool redundant = false;
+      for (const gfx::Rect& k : kept) {
+        if (k.contains(created[i])) {
+          redundant = true;
+          break;
+        }
+      }
+      for (int j=0; j<int(created.size()) && !redundant; ++j) {
+        if (i != j &&
+            created[j].contains(created[i]) &&
+            // For identical rectangles remove only the first one
+            (created[j] != created[i] || j > i)) {
+          redundant = true;
+        }
+      }
+      if (!redundant)
+        kept.push_back(created[i]);
+    }
+
+    m_free = std::move(kept);
+  }
+
+  SpriteSheetPacking m_heuristic;
+  std::vector<gfx::Rect> m_free;
+};
+
+} // anonymous namespace
+
+RectsPacker::RectsPacker(const SpriteSheetPacking packing,
+                         const int borderPadding,
+                         const int shapePadding)
+  : m_packing(packing)
+  , m_borderPadding(borderPadding)
+  , m_shapePadding(shapePadding)
+{
+}
+
+void RectsPacker::add(const gfx::Size& size)
+{
+  m_sizes.push_back(size);
+  m_rects.push_back(gfx::Rect(size));
+}
+
+gfx::Size RectsPacker::bestFit(base::task_token& token,
+                               const int fixedWidth,
+                               const int fixedHeight)
+{
+  if (m_sizes.empty())
+    return gfx::Size(0, 0);
+
+  if (fixedWidth > 0 && fixedHeight > 0) {
+    const gfx::Size size(fixedWidth, fixedHeight);
+    return (pack(size, token) ? size: gfx::Size(0, 0));
+  }
+
+  const int border = 2*m_borderPadding - m_shapePadding;
+  gfx::Size used;
+
+  // To fix the height we pack the transposed rectangles with a fixed
+  // width.
+  if (fixedWidth > 0) {
+    if (!packWithWidth(fixedWidth - border, false, used, token))
+      return gfx::Size(0, 0);
+    return gfx::Size(fixedWidth, textureSize(used).h);
+  }
+  if (fixedHeight > 0) {
+    if (!packWithWidth(fixedHeight - border, true, used, token))
+      return gfx::Size(0, 0);
+    return gfx::Size(textureSize(used).w, fixedHeight);
+  }
+
+  // Each rectangle uses the shape padding at the right/bottom side
+  int64_t area = 0;
+  int maxW = 0, sumW = 0;
+  for (const auto& sz : m_sizes) {
+    const int w = sz.w + m_shapePadding;
+    area += int64_t(w) * (sz.h + m_shapePadding);
+    maxW = std::max(maxW, w);
+    sumW += w;
+  }
+
+  // Try some widths near to the side of a square with the same area
+  // of all rectangles, and use the smallest texture.
+  static const double kFactors[] = { 1.0, 1.1, 1.25, 1.5, 2.0 };
+  const int nfactors = sizeof(kFactors) / sizeof(kFactors[0]);
+  const double side = std::sqrt(double(area));
+
+  Rects bestRects;
+  gfx::Size bestSize;
+  int64_t bestArea = INT64_MAX;
+  int lastWidth = 0;
+
+  for (int i=0; i<nfactors; ++i) {
+    token.set_progress(float(i) / nfactors);
+    if (token.canceled())
+      return gfx::Size(0, 0);
+
+    const int width = std::min(sumW, std::max(maxW, int(std::ceil(side * kFactors[i]))));
+    if (width == lastWidth)
+      continue;
+    lastWidth = width;
+
+    if (!packWithWidth(width, false, used, token))
+      continue;
+
+    const gfx::Size size = textureSize(used);
+    const int64_t sizeArea = int64_t(size.w) * size.h;
+    if (sizeArea < bestArea ||
+        (sizeArea == bestArea &&
+         std::max(size.w, size.h) < std::max(bestSize.w, bestSize.h))) {
+      bestArea = sizeArea;
+      bestSize = size;
+      bestRects = m_rects;
+    }
+  }
+  token.set_progress(1.0f);
+
+  if (bestRects.empty())
+    return gfx::Size(0, 0);
+
+  m_rects = std::move(bestRects);
+  return bestSize;
+}
+
+bool RectsPacker::pack(const gfx::Size& size,
+                       base::task_token& token)
+{
+  const int border = 2*m_borderPadding - m_shapePadding;
+  gfx::Size used;
+  return packInBin(m_packing, size.w - border, size.h - border,
+                   false, used, token);
+}
+
+bool RectsPacker::packWithWidth(const int binWidth,
+                                const bool transposed,
+                                gfx::Size& usedSize,
+                                base::task_token& token)
+{
+  int64_t area = 0;
+  int maxH = 0, sumH = 0;
+  for (const auto& sz : m_sizes) {
+    const int w = (transposed ? sz.h: sz.w) + m_shapePadding;
+    const int h = (transposed ? sz.w: sz.h) + m_shapePadding;
+    area += int64_t(w) * h;
+    maxH = std::max(maxH, h);
+    sumH += h;
+  }
+
+  // The skyline algorithm can use an unbounded height (the sum of
+  // all heights is enough), and it's fast enough to give us the
+  // maximum height that we need.
+  if (!packInBin(SpriteSheetPacking::Skyline,
+                 binWidth, sumH, transposed, usedSize, token))
+    return false;
+
+  if (m_packing == SpriteSheetPacking::Skyline)
+    return true;
+
+  // MaxRects heuristics work badly with a free rectangle of an
+  // unbounded height, so we search (with a few steps of a binary
+  // search) the smallest height where all rectangles fit.
+  Rects bestRects = m_rects;
+  gfx::Size bestUsed = usedSize;
+  int lo = std::max<int>(maxH, int((area + binWidth - 1) / binWidth));
+  int hi = (transposed ? usedSize.w: usedSize.h);
+  for (int i=0; i<5 && lo <= hi; ++i) {
+    const int binHeight = lo + (hi - lo) / 2;
+    gfx::Size used;
+    if (packInBin(m_packing, binWidth, binHeight, transposed, used, token)) {
+      bestRects = m_rects;
+      bestUsed = used;
+      hi = binHeight - 1;
+    }
+    else {
+      if (token.canceled())
+        return false;
+      lo = binHeight + 1;
+    }
+  }
+
+  m_rects = std::move(bestRects);
+  usedSize = bestUsed;
+  return true;
+}
+
+bool RectsPacker::packInBin(const SpriteSheetPacking packing,
+                            const int binWidth,
+                            const int binHeight,
+                            const bool transposed,
+                            gfx::Size& usedSize,
+                            base::task_token& token)
+{
+  if (binWidth <= 0 || binHeight <= 0)
+    return false;
+
+  // Biggest rectangles first (sorting is the O(n log n) part, the
+  // placement of each rectangle depends only on the number of
+  // skyline segments/free rectangles)
+  std::vector<int> order(m_sizes.size());
+  for (int i=0; i<int(order.size()); ++i)
+    order[i] = i;
+
+  auto sizeOf = [this, transposed](const int i) {
+    const gfx::Size& sz = m_sizes[i];
+    return (transposed ? gfx::Size(sz.h, sz.w): sz);
+  };
+  const bool skyline = (packing == SpriteSheetPacking::Skyline);
+  std::stable_sort(
+    order.begin(), order.end(),
+    [skyline, &sizeOf](const int a, const int b){
+      const gfx::Size sa = sizeOf(a);
+      const gfx::Size sb = sizeOf(b);
+      if (skyline)
+        return (sa.h > sb.h || (sa.h == sb.h && sa.w > sb.w));
+      const int ma = std::max(sa.w, sa.h);
+      const int mb = std::max(sb.w, sb.h);
+      return (ma > mb || (ma == mb && std::min(sa.w, sa.h) > std::min(sb.w, sb.h)));
+    });
+
+  std::unique_ptr<SkylineBin> skylineBin;
+  std::unique_ptr<MaxRectsBin> maxRectsBin;
+  if (skyline)
+    skylineBin.reset(new SkylineBin(binWidth, binHeight));
+  else
+    maxRectsBin.reset(new MaxRectsBin(binWidth, binHeight, packing));
+
+  usedSize = gfx::Size(0, 0);
+  for (const int i : order) {
+    if (token.canceled())
+      return false;
+
+    const gfx::Size sz = sizeOf(i);
+    const int w = sz.w + m_shapePadding;
+    const int h = sz.h + m_shapePadding;
+    gfx::Point pt;
+    if (skyline ? !skylineBin->insert(w, h, pt):
+                  !maxRectsBin->insert(w, h, pt))
+      return false;
+
+    usedSize.w = std::max(usedSize.w, pt.x + w);
+    usedSize.h = std::max(usedSize.h, pt.y + h);
+
+    if (transposed)
+      std::swap(pt.x, pt.y);
+    m_rects[i] = gfx::Rect(m_borderPadding + pt.x,
+                           m_borderPadding + pt.y,
+                           m_sizes[i].w, m_sizes[i].h);
+  }
+
+  if (transposed)
+    std::swap(usedSize.w, usedSize.h);
+  return true;
+}
+
+gfx::Size RectsPacker::textureSize(const gfx::Size& usedSize) const
+{
+  const int border = 2*m_borderPadding - m_shapePadding;
+  return gfx::Size(usedSize.w + border,
+                   usedSize.h + border);
+}
+
+} // namespace app
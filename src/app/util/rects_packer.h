@@ -0,0 +1,80 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UTIL_RECTS_PACKER_H_INCLUDED
+#define APP_UTIL_RECTS_PACKER_H_INCLUDED
+#pragma once
+
+#include "app/sprite_sheet_packing.h"
+#include "gfx/rect.h"
+#include "gfx/size.h"
+
+#include <vector>
+
+namespace base {
+  class task_token;
+}
+
+namespace app {
+
+  // Packs rectangles using the MaxRects or Skyline algorithms. It's
+  // like gfx::PackingRects, but each rectangle is placed only once
+  // (there is no trial and error of the whole set for each possible
+  // texture size), so it scales well with thousands of rectangles.
+  class RectsPacker {
+  public:
+    typedef std::vector<gfx::Rect> Rects;
+    typedef Rects::const_iterator const_iterator;
+
+    RectsPacker(const SpriteSheetPacking packing,
+                const int borderPadding = 0,
+                const int shapePadding = 0);
+
+    // Iterate over the packed rectangles (in the same order they
+    // were added).
+    const_iterator begin() const { return m_rects.begin(); }
+    const_iterator end() const { return m_rects.end(); }
+    std::size_t size() const { return m_rects.size(); }
+    const gfx::Rect& operator[](int i) const { return m_rects[i]; }
+
+    void add(const gfx::Size& size);
+
+    // Finds a small texture size to pack all the rectangles (one of
+    // the sides can be fixed). Returns an empty size if the
+    // rectangles cannot be packed (e.g. a rectangle is bigger than
+    // the fixed side).
+    gfx::Size bestFit(base::task_token& token,
+                      const int fixedWidth = 0,
+                      const int fixedHeight = 0);
+
+    // Returns false if all rectangles cannot be packed in the given
+    // texture size.
+    bool pack(const gfx::Size& size,
+              base::task_token& token);
+
+  private:
+    bool packWithWidth(const int binWidth,
+                       const bool transposed,
+                       gfx::Size& usedSize,
+                       base::task_token& token);
+    bool packInBin(const SpriteSheetPacking packing,
+                   const int binWidth,
+                   const int binHeight,
+                   const bool transposed,
+                   gfx::Size& usedSize,
+                   base::task_token& token);
+    gfx::Size textureSize(const gfx::Size& usedSize) const;
+
+    SpriteSheetPacking m_packing;
+    int m_borderPadding;
+    int m_shapePadding;
+    std::vector<gfx::Size> m_sizes;
+    Rects m_rects;
+  };
+
+} // namespace app
+
+#endif
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (c) 2019-2020  Igara Studio S.A.
+// Copyright (c) 2019-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -50,11 +50,37 @@ doc::Image* resize_image(
   return newImage.release();
 }
 
+doc::ImageRef create_resized_cel_image(
+  doc::Cel* cel,
+  const gfx::SizeF& scale,
+  const doc::algorithm::ResizeMethod method,
+  const Palette* pal,
+  const RgbMap* rgbmap,
+  const int threads)
+{
+  doc::Image* image = cel->image();
+  const int w = std::max(1, int(scale.w*image->width()));
+  const int h = std::max(1, int(scale.h*image->height()));
+  doc::ImageRef newImage(
+    doc::Image::create(image->pixelFormat(), w, h));
+  newImage->setMaskColor(image->maskColor());
+
+  doc::algorithm::fixup_image_transparent_colors(image);
+  doc::algorithm::resize_image(
+    image, newImage.get(),
+    method, pal, rgbmap,
+    (cel->layer()->isBackground() ? -1: cel->sprite()->transparentColor()),
+    threads);
+
+  return newImage;
+}
+
 void resize_cel_image(
   Tx& tx, doc::Cel* cel,
   const gfx::SizeF& scale,
   const doc::algorithm::ResizeMethod method,
-  const gfx::PointF& pivot)
+  const gfx::PointF& pivot,
+  doc::ImageRef resizedImage)
 {
   // Get cel's image
   doc::Image* image = cel->image();
@@ -77,22 +103,14 @@ void resize_cel_image(
         tx(new cmd::SetCelPosition(cel, x, y));
 
       // Resize the image
-      const int w = std::max(1, int(scale.w*image->width()));
-      const int h = std::max(1, int(scale.h*image->height()));
-      doc::ImageRef newImage(
-        doc::Image::create(
-          image->pixelFormat(), std::max(1, w), std::max(1, h)));
-      newImage->setMaskColor(image->maskColor());
-
-      doc::algorithm::fixup_image_transparent_colors(image);
-      doc::algorithm::resize_image(
-        image, newImage.get(),
-        method,
-        sprite->palette(cel->frame()),
-        sprite->rgbMap(cel->frame()),
-        (cel->layer()->isBackground() ? -1: sprite->transparentColor()));
-
-      tx(new cmd::ReplaceImage(sprite, cel->imageRef(), newImage));
+      if (!resizedImage) {
+        resizedImage = create_resized_cel_image(
+          cel, scale, method,
+          sprite->palette(cel->frame()),
+          sprite->rgbMap(cel->frame()));
+      }
+
+      tx(new cmd::ReplaceImage(sprite, cel->imageRef(), resizedImage));
     }
   }
 }
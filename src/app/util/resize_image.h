@@ -10,6 +10,7 @@
 
 #include "doc/algorithm/resize_image.h"
 #include "doc/color.h"
+#include "doc/image_ref.h"
 #include "gfx/point.h"
 #include "gfx/size.h"
 
@@ -30,11 +31,26 @@ namespace app {
     const doc::Palette* pal,
     const doc::RgbMap* rgbmap);
 
+  // Creates the resized version of the cel image (the cel isn't
+  // modified). It can be called from several threads at the same
+  // time for different cels (using threads=1).
+  doc::ImageRef create_resized_cel_image(
+    doc::Cel* cel,
+    const gfx::SizeF& scale,
+    const doc::algorithm::ResizeMethod method,
+    const doc::Palette* pal,
+    const doc::RgbMap* rgbmap,
+    const int threads = 0);
+
+  // Resizes the cel image. If "resizedImage" is specified, it must
+  // be the result of create_resized_cel_image() and is used as the
+  // new image of the cel.
   void resize_cel_image(
     Tx& tx, doc::Cel* cel,
     const gfx::SizeF& scale,
     const doc::algorithm::ResizeMethod method,
-    const gfx::PointF& pivot);
+    const gfx::PointF& pivot,
+    doc::ImageRef resizedImage = doc::ImageRef());
 
 } // namespace app
 
@@ -306,6 +306,10 @@ Widget* WidgetLoader::convertXmlElementToWidget(const TiXmlElement* elem, Widget
     bool multiselect = bool_attr(elem, "multiselect", false);
     if (multiselect)
       static_cast<ListBox*>(widget)->setMultiselect(multiselect);
+
+    bool virtualized = bool_attr(elem, "virtualized", false);
+    if (virtualized)
+      static_cast<ListBox*>(widget)->setVirtualized(virtualized);
   }
   else if (elem_name == "listitem") {
     ListItem* listitem;
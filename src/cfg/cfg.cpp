@@ -1,5 +1,5 @@
 // Aseprite Config Library
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2014-2017  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -65,31 +65,34 @@ public:
   }
 
   void setValue(const char* section, const char* name, const char* value) {
-    m_ini.SetValue(section, name, value);
+    modifyValue(section, name, [&]{ m_ini.SetValue(section, name, value); });
   }
 
   void setBoolValue(const char* section, const char* name, bool value) {
-    m_ini.SetBoolValue(section, name, value);
+    modifyValue(section, name, [&]{ m_ini.SetBoolValue(section, name, value); });
   }
 
   void setIntValue(const char* section, const char* name, int value) {
-    m_ini.SetLongValue(section, name, value);
+    modifyValue(section, name, [&]{ m_ini.SetLongValue(section, name, value); });
   }
 
   void setDoubleValue(const char* section, const char* name, double value) {
-    m_ini.SetDoubleValue(section, name, value);
+    modifyValue(section, name, [&]{ m_ini.SetDoubleValue(section, name, value); });
   }
 
   void deleteValue(const char* section, const char* name) {
-    m_ini.Delete(section, name, true);
+    if (m_ini.Delete(section, name, true))
+      m_modified = true;
   }
 
   void deleteSection(const char* section) {
-    m_ini.Delete(section, nullptr, true);
+    if (m_ini.Delete(section, nullptr, true))
+      m_modified = true;
   }
 
   void load(const std::string& filename) {
     m_filename = filename;
+    m_modified = false;
 
     base::FileHandle file(base::open_file(m_filename, "rb"));
     if (file) {
@@ -110,12 +113,50 @@ public:
         LOG(ERROR, "CFG: Error %d saving configuration into %s\n",
             (int)err, m_filename.c_str());
       }
+      else
+        m_modified = false;
     }
   }
 
+  bool isModified() const {
+    return m_modified;
+  }
+
+  void markAsSaved() {
+    m_modified = false;
+  }
+
+  std::string serialize() const {
+    std::string data;
+    SI_Error err = m_ini.Save(data);
+    if (err != SI_OK) {
+      LOG(ERROR, "CFG: Error %d serializing configuration of %s\n",
+          (int)err, m_filename.c_str());
+    }
+    return data;
+  }
+
 private:
+  // Calls the given function to change a value, and marks the file as
+  // modified only if the value is different (preferences re-set all
+  // dirty options with the same value each time they are saved).
+  template<typename Func>
+  void modifyValue(const char* section, const char* name, Func func) {
+    if (!m_modified) {
+      const char* old = m_ini.GetValue(section, name, nullptr);
+      const std::string oldValue = (old ? old: std::string());
+      func();
+      const char* value = m_ini.GetValue(section, name, nullptr);
+      if (!old || !value || oldValue != value)
+        m_modified = true;
+    }
+    else
+      func();
+  }
+
   std::string m_filename;
   CSimpleIniA m_ini;
+  bool m_modified = false;
 };
 
 CfgFile::CfgFile()
@@ -203,4 +244,19 @@ void CfgFile::save()
   m_impl->save();
 }
 
+bool CfgFile::isModified() const
+{
+  return m_impl->isModified();
+}
+
+void CfgFile::markAsSaved()
+{
+  m_impl->markAsSaved();
+}
+
+std::string CfgFile::serialize() const
+{
+  return m_impl->serialize();
+}
+
 } // namespace cfg
@@ -1,5 +1,5 @@
 // Aseprite Config Library
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2014-2016  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -40,6 +40,15 @@ namespace cfg {
     void load(const std::string& filename);
     void save();
 
+    // Returns true if some value was changed/deleted since the last
+    // load() or save()/markAsSaved().
+    bool isModified() const;
+    void markAsSaved();
+
+    // Returns the content of the .ini file (to save it later in other
+    // thread).
+    std::string serialize() const;
+
   private:
     class CfgFileImpl;
     CfgFileImpl* m_impl;
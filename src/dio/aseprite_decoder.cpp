@@ -25,7 +25,13 @@
 #include "fmt/format.h"
 #include "zlib.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 namespace dio {
 
@@ -90,8 +96,17 @@ bool AsepriteDecoder::decode()
   if (nframes > 1 && delegate()->decodeOneFrame())
     nframes = 1;
 
+  m_compressedCels.clear();
+  m_compressedBytes = 0;
+  m_skippedCels.clear();
+  m_decodeBounds = delegate()->decodeBounds();
+
+  // True if we've found the embedded thumbnail and we don't need
+  // anything else
+  bool thumbnailOnly = false;
+
   // Read frame by frame to end-of-file
-  for (doc::frame_t frame=0; frame<nframes; ++frame) {
+  for (doc::frame_t frame=0; frame<nframes && !thumbnailOnly; ++frame) {
     // Start frame position
     size_t frame_pos = f()->tell();
     delegate()->progress((float)frame_pos / (float)header.size);
@@ -107,7 +122,7 @@ bool AsepriteDecoder::decode()
         sprite->setFrameDuration(frame, frame_header.duration);
 
       // Read chunks
-      for (uint32_t c=0; c<frame_header.chunks; c++) {
+      for (uint32_t c=0; c<frame_header.chunks && !thumbnailOnly; c++) {
         // Start chunk position
         size_t chunk_pos = f()->tell();
         delegate()->progress((float)chunk_pos / (float)header.size);
@@ -161,10 +176,9 @@ bool AsepriteDecoder::decode()
               readCelChunk(sprite.get(), allLayers, frame,
                            sprite->pixelFormat(), &header,
                            chunk_pos+chunk_size);
-            if (cel) {
-              last_cel = cel;
-              last_object_with_user_data = cel->data();
-            }
+            // Extra/user data chunks of skipped cels are ignored
+            last_cel = cel;
+            last_object_with_user_data = (cel ? cel->data(): nullptr);
             break;
           }
 
@@ -222,6 +236,17 @@ bool AsepriteDecoder::decode()
             break;
           }
 
+          case ASE_FILE_CHUNK_THUMBNAIL: {
+            if (delegate()->decodeThumbnail()) {
+              doc::ImageRef thumbnail = readThumbnailChunk(chunk_pos+chunk_size);
+              if (thumbnail) {
+                delegate()->onThumbnail(thumbnail);
+                thumbnailOnly = true;
+              }
+            }
+            break;
+          }
+
           default:
             delegate()->error(
               fmt::format("Warning: Unsupported chunk type {0} (skipping)", chunk_type));
@@ -240,6 +265,9 @@ bool AsepriteDecoder::decode()
       break;
   }
 
+  // Inflate the pending compressed cels
+  inflateCompressedCels();
+
   delegate()->onSprite(sprite.release());
   return true;
 }
@@ -523,12 +551,51 @@ void read_raw_image(FileInterface* f,
 // Compressed Image
 //////////////////////////////////////////////////////////////////////
 
+// Max number of bytes of compressed data copied from cel chunks before
+// inflating them (see AsepriteDecoder::inflateCompressedCels()).
+static constexpr size_t kMaxCompressedBytes = 64*1024*1024;
+
+// Reads the compressed data of a cel chunk. If the file is
+// memory-mapped, "bytes" points directly to the mapped data,
+// in other case the data is copied to "data".
+static void read_compressed_data(FileInterface* f,
+                                 DecodeDelegate* delegate,
+                                 const size_t chunk_end,
+                                 const uint8_t*& bytes,
+                                 size_t& size,
+                                 std::vector<uint8_t>& data)
+{
+  const size_t pos = f->tell();
+  const size_t n = (chunk_end > pos ? chunk_end - pos: 0);
+  if (n == 0) {
+    bytes = nullptr;
+    size = 0;
+    return;
+  }
+
+  size = f->readSpan(&bytes, n);
+  if (size == 0) {
+    data.resize(n);
+    size = f->readBytes(&data[0], n);
+    data.resize(size);
+    bytes = (size > 0 ? &data[0]: nullptr);
+  }
+
+  // Error reading all bytes, broken file? chunk without enough
+  // compressed data? We inflate what we have.
+  if (size < n) {
+    delegate->error(
+      fmt::format("Error reading {} bytes of compressed data",
+                  n - size));
+  }
+}
+
+// Returns true if the compressed data contained exactly all the
+// pixels of the image.
 template<typename ImageTraits>
-void read_compressed_image(FileInterface* f,
-                           DecodeDelegate* delegate,
-                           doc::Image* image,
-                           const size_t chunk_end,
-                           const AsepriteHeader* header)
+bool inflate_compressed_image(const uint8_t* bytes,
+                              const size_t size,
+                              doc::Image* image)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -542,74 +609,115 @@ void read_compressed_image(FileInterface* f,
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in inflateInit().", err);
 
-  std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> uncompressed(image->height() * ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> compressed(4096);
-  int uncompressed_offset = 0;
-
-  while (true) {
-    size_t input_bytes;
-
-    if (f->tell()+compressed.size() > chunk_end) {
-      input_bytes = chunk_end - f->tell(); // Remaining bytes
-      ASSERT(input_bytes < compressed.size());
-
-      if (input_bytes == 0)
-        break;                  // Done, we consumed all chunk
+  const size_t rowstride = ImageTraits::getRowStrideBytes(image->width());
+  const size_t total = image->height() * rowstride;
+
+  // Indexed images have the same format in memory and in the file,
+  // so we can inflate the data directly in the image (if its rows
+  // are contiguous).
+  const bool direct =
+    (std::is_same<ImageTraits, doc::IndexedTraits>::value &&
+     image->getPixelAddress(0, image->height()-1) ==
+     image->getPixelAddress(0, 0) + (image->height()-1)*rowstride);
+
+  std::vector<uint8_t> uncompressed(direct ? 0: total);
+
+  zstream.next_out = (Bytef*)(direct ? image->getPixelAddress(0, 0):
+                                       &uncompressed[0]);
+  zstream.avail_out = total;
+
+  bool complete = false;
+  if (size > 0) {
+    zstream.next_in = (Bytef*)bytes;
+    zstream.avail_in = size;
+
+    // All the output is written directly in its final position, the
+    // extra data of a bad compressed image (more pixels than the
+    // image size) is ignored.
+    err = inflate(&zstream, Z_NO_FLUSH);
+    if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+      inflateEnd(&zstream);
+      throw base::Exception("ZLib error %d in inflate().", err);
     }
-    else
-      input_bytes = compressed.size();
-
-    size_t bytes_read = f->readBytes(&compressed[0], input_bytes);
-
-    // Error reading "input_bytes" bytes, broken file? chunk without
-    // enough compressed data?
-    if (bytes_read == 0) {
-      delegate->error(
-        fmt::format("Error reading {} bytes of compressed data",
-                    input_bytes));
-      break;
-    }
-
-    zstream.next_in = (Bytef*)&compressed[0];
-    zstream.avail_in = bytes_read;
-
-    do {
-      zstream.next_out = (Bytef*)&scanline[0];
-      zstream.avail_out = scanline.size();
-
-      err = inflate(&zstream, Z_NO_FLUSH);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
-        throw base::Exception("ZLib error %d in inflate().", err);
-
-      size_t uncompressed_bytes = scanline.size() - zstream.avail_out;
-      if (uncompressed_bytes > 0) {
-        if (uncompressed_offset+uncompressed_bytes > uncompressed.size())
-          throw base::Exception("Bad compressed image.");
-
-        std::copy(scanline.begin(), scanline.begin()+uncompressed_bytes,
-                  uncompressed.begin()+uncompressed_offset);
-
-        uncompressed_offset += uncompressed_bytes;
-      }
-    } while (zstream.avail_out == 0);
-
-    delegate->progress((float)f->tell() / (float)header->size);
+    complete = (err == Z_STREAM_END && zstream.avail_out == 0);
   }
 
-  uncompressed_offset = 0;
-  for (y=0; y<image->height(); y++) {
-    typename ImageTraits::address_t address =
-      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
+  if (!direct) {
+    size_t uncompressed_offset = 0;
+    for (y=0; y<image->height(); y++) {
+      typename ImageTraits::address_t address =
+        (typename ImageTraits::address_t)image->getPixelAddress(0, y);
 
-    pixel_io.read_scanline(address, image->width(), &uncompressed[uncompressed_offset]);
+      pixel_io.read_scanline(address, image->width(), &uncompressed[uncompressed_offset]);
 
-    uncompressed_offset += ImageTraits::getRowStrideBytes(image->width());
+      uncompressed_offset += rowstride;
+    }
   }
 
   err = inflateEnd(&zstream);
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in inflateEnd().", err);
+
+  return complete;
+}
+
+void AsepriteDecoder::inflateCompressedCels()
+{
+  const int ncels = int(m_compressedCels.size());
+  if (ncels == 0)
+    return;
+
+  std::vector<std::string> errors(ncels);
+  std::vector<char> complete(ncels, false);
+  std::atomic<int> nextCel(0);
+  auto inflateCels = [this, ncels, &errors, &complete, &nextCel]{
+    for (int i=nextCel++; i<ncels; i=nextCel++) {
+      CompressedCel& cc = m_compressedCels[i];
+      doc::Image* image = cc.image.get();
+      try {
+        switch (image->pixelFormat()) {
+          case doc::IMAGE_RGB:
+            complete[i] =
+              inflate_compressed_image<doc::RgbTraits>(cc.bytes, cc.size, image);
+            break;
+          case doc::IMAGE_GRAYSCALE:
+            complete[i] =
+              inflate_compressed_image<doc::GrayscaleTraits>(cc.bytes, cc.size, image);
+            break;
+          case doc::IMAGE_INDEXED:
+            complete[i] =
+              inflate_compressed_image<doc::IndexedTraits>(cc.bytes, cc.size, image);
+            break;
+        }
+      }
+      catch (const std::exception& e) {
+        errors[i] = e.what();
+      }
+    }
+  };
+
+  const int nthreads =
+    std::min<int>(ncels, std::max<int>(1, std::thread::hardware_concurrency()));
+  std::vector<std::thread> threads;
+  for (int i=1; i<nthreads; ++i)
+    threads.emplace_back(inflateCels);
+  inflateCels();                // Use this thread too
+  for (auto& thread : threads)
+    thread.join();
+
+  // Errors are reported from this thread in the same order of the
+  // cels in the file. In case of error we show the problem, but the
+  // cel is loaded anyway.
+  for (int i=0; i<ncels; ++i) {
+    const CompressedCel& cc = m_compressedCels[i];
+    if (!errors[i].empty())
+      delegate()->error(errors[i]);
+    else if (complete[i])
+      delegate()->onCompressedImage(cc.image.get(), cc.bytes, cc.size);
+  }
+
+  m_compressedCels.clear();
+  m_compressedBytes = 0;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -621,8 +729,11 @@ doc::Cel* AsepriteDecoder::readCelChunk(doc::Sprite* sprite,
                                         doc::frame_t frame,
                                         doc::PixelFormat pixelFormat,
                                         AsepriteHeader* header,
-                                        size_t chunk_end)
+                                        size_t chunk_end,
+                                        const bool forceDecode)
 {
+  const size_t chunk_pos = f()->tell();
+
   // Read chunk data
   doc::layer_t layer_index = read16();
   int x = ((int16_t)read16());
@@ -648,6 +759,21 @@ doc::Cel* AsepriteDecoder::readCelChunk(doc::Sprite* sprite,
     return nullptr;
   }
 
+  // Skip cels that the delegate doesn't need (image cels are
+  // remembered in case that a needed linked cel uses them)
+  auto skipCel = [&]() -> doc::Cel* {
+    if (cel_type != ASE_FILE_LINK_CEL)
+      m_skippedCels[std::make_pair(layer_index, frame)] = SkippedCel{ chunk_pos, chunk_end };
+    return nullptr;
+  };
+  auto isOutsideBounds = [&](const int w, const int h) {
+    return (!forceDecode &&
+            !m_decodeBounds.isEmpty() &&
+            !m_decodeBounds.intersects(gfx::Rect(x, y, w, h)));
+  };
+  if (!forceDecode && !delegate()->decodeCel(layer, frame))
+    return skipCel();
+
   // Create the new frame.
   std::unique_ptr<doc::Cel> cel;
 
@@ -658,6 +784,9 @@ doc::Cel* AsepriteDecoder::readCelChunk(doc::Sprite* sprite,
       int w = read16();
       int h = read16();
 
+      if (isOutsideBounds(w, h))
+        return skipCel();
+
       if (w > 0 && h > 0) {
         doc::ImageRef image(doc::Image::create(pixelFormat, w, h));
 
@@ -689,6 +818,12 @@ doc::Cel* AsepriteDecoder::readCelChunk(doc::Sprite* sprite,
       doc::frame_t link_frame = doc::frame_t(read16());
       doc::Cel* link = layer->cel(link_frame);
 
+      // The original cel could be skipped (e.g. it's in a frame that
+      // wasn't needed)
+      if (!link)
+        link = readSkippedCel(sprite, allLayers, layer_index, link_frame,
+                              pixelFormat, header);
+
       if (link) {
         // There were a beta version that allow to the user specify
         // different X, Y, or opacity per link, in that case we must
@@ -697,6 +832,10 @@ doc::Cel* AsepriteDecoder::readCelChunk(doc::Sprite* sprite,
           cel.reset(doc::Cel::MakeLink(frame, link));
         }
         else {
+          // The pixels of the linked cel are copied, so they must be
+          // already inflated.
+          inflateCompressedCels();
+
           cel.reset(doc::Cel::MakeCopy(frame, link));
           cel->setPosition(x, y);
           cel->setOpacity(opacity);
@@ -714,34 +853,23 @@ doc::Cel* AsepriteDecoder::readCelChunk(doc::Sprite* sprite,
       int w = read16();
       int h = read16();
 
+      if (isOutsideBounds(w, h))
+        return skipCel();
+
       if (w > 0 && h > 0) {
         doc::ImageRef image(doc::Image::create(pixelFormat, w, h));
 
-        // Try to read pixel data
-        try {
-          switch (image->pixelFormat()) {
-
-            case doc::IMAGE_RGB:
-              read_compressed_image<doc::RgbTraits>(
-                f(), delegate(), image.get(), chunk_end, header);
-              break;
+        // Only the compressed data is read here, the pixels are
+        // inflated later (in parallel) in inflateCompressedCels().
+        CompressedCel cc;
+        cc.image = image;
+        read_compressed_data(f(), delegate(), chunk_end,
+                             cc.bytes, cc.size, cc.data);
+        m_compressedBytes += cc.data.size();
+        m_compressedCels.push_back(std::move(cc));
 
-            case doc::IMAGE_GRAYSCALE:
-              read_compressed_image<doc::GrayscaleTraits>(
-                f(), delegate(), image.get(), chunk_end, header);
-              break;
-
-            case doc::IMAGE_INDEXED:
-              read_compressed_image<doc::IndexedTraits>(
-                f(), delegate(), image.get(), chunk_end, header);
-              break;
-          }
-        }
-        // OK, in case of error we can show the problem, but continue
-        // loading more cels.
-        catch (const std::exception& e) {
-          delegate()->error(e.what());
-        }
+        if (m_compressedBytes >= kMaxCompressedBytes)
+          inflateCompressedCels();
 
         cel.reset(new doc::Cel(frame, image));
         cel->setPosition(x, y);
@@ -759,6 +887,30 @@ doc::Cel* AsepriteDecoder::readCelChunk(doc::Sprite* sprite,
   return cel.release();
 }
 
+// Reads a cel that was skipped by readCelChunk() because a linked cel
+// needs it (the file position is restored after that).
+doc::Cel* AsepriteDecoder::readSkippedCel(doc::Sprite* sprite,
+                                          doc::LayerList& allLayers,
+                                          doc::layer_t layer_index,
+                                          doc::frame_t frame,
+                                          doc::PixelFormat pixelFormat,
+                                          AsepriteHeader* header)
+{
+  auto it = m_skippedCels.find(std::make_pair(layer_index, frame));
+  if (it == m_skippedCels.end())
+    return nullptr;
+
+  const SkippedCel skipped = it->second;
+  m_skippedCels.erase(it);
+
+  const size_t pos = f()->tell();
+  f()->seek(skipped.pos);
+  doc::Cel* cel = readCelChunk(sprite, allLayers, frame, pixelFormat,
+                               header, skipped.chunk_end, true);
+  f()->seek(pos);
+  return cel;
+}
+
 void AsepriteDecoder::readCelExtraChunk(doc::Cel* cel)
 {
   // Read chunk data
@@ -899,6 +1051,35 @@ void AsepriteDecoder::readUserDataChunk(doc::UserData* userData)
   }
 }
 
+doc::ImageRef AsepriteDecoder::readThumbnailChunk(size_t chunk_end)
+{
+  const int w = read16();
+  const int h = read16();
+  const int format = read16();
+  readPadding(10);
+
+  if (format != ASE_THUMBNAIL_RGBA ||
+      w < 1 || w > ASE_THUMBNAIL_MAX_SIZE ||
+      h < 1 || h > ASE_THUMBNAIL_MAX_SIZE)
+    return nullptr;
+
+  const uint8_t* bytes;
+  size_t size;
+  std::vector<uint8_t> data;
+  read_compressed_data(f(), delegate(), chunk_end, bytes, size, data);
+
+  // A broken thumbnail is not an error, the cels are decoded anyway
+  doc::ImageRef image(doc::Image::create(doc::IMAGE_RGB, w, h));
+  try {
+    if (!inflate_compressed_image<doc::RgbTraits>(bytes, size, image.get()))
+      return nullptr;
+  }
+  catch (const std::exception&) {
+    return nullptr;
+  }
+  return image;
+}
+
 void AsepriteDecoder::readSlicesChunk(doc::Slices& slices)
 {
   size_t nslices = read32();    // Number of slices
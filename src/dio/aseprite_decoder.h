@@ -1,5 +1,5 @@
 // Aseprite Document IO Library
-// Copyright (c) 2018 Igara Studio S.A.
+// Copyright (c) 2018-2022 Igara Studio S.A.
 // Copyright (c) 2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -11,12 +11,18 @@
 
 #include "dio/decoder.h"
 #include "doc/frame.h"
+#include "doc/image_ref.h"
 #include "doc/layer_list.h"
 #include "doc/pixel_format.h"
 #include "doc/slices.h"
 #include "doc/tags.h"
+#include "gfx/rect.h"
 
+#include <cstdint>
+#include <map>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace doc {
   class Cel;
@@ -51,7 +57,14 @@ private:
                          doc::frame_t frame,
                          doc::PixelFormat pixelFormat,
                          AsepriteHeader* header,
-                         size_t chunk_end);
+                         size_t chunk_end,
+                         const bool forceDecode = false);
+  doc::Cel* readSkippedCel(doc::Sprite* sprite,
+                           doc::LayerList& allLayers,
+                           doc::layer_t layer_index,
+                           doc::frame_t frame,
+                           doc::PixelFormat pixelFormat,
+                           AsepriteHeader* header);
   void readCelExtraChunk(doc::Cel* cel);
   void readColorProfile(doc::Sprite* sprite);
   doc::Mask* readMaskChunk();
@@ -59,6 +72,33 @@ private:
   void readSlicesChunk(doc::Slices& slices);
   doc::Slice* readSliceChunk(doc::Slices& slices);
   void readUserDataChunk(doc::UserData* userData);
+  doc::ImageRef readThumbnailChunk(size_t chunk_end);
+  void inflateCompressedCels();
+
+  // Compressed cel image which pixels are not yet inflated. The
+  // compressed "bytes" can point to the memory-mapped file or to
+  // "data" (a copy of the compressed data).
+  struct CompressedCel {
+    doc::ImageRef image;
+    const uint8_t* bytes = nullptr;
+    size_t size = 0;
+    std::vector<uint8_t> data;
+  };
+
+  // Compressed cels read from the file (only its zlib data) which
+  // are inflated in parallel in inflateCompressedCels().
+  std::vector<CompressedCel> m_compressedCels;
+  size_t m_compressedBytes = 0;
+
+  // Cel chunks that were not decoded because the delegate doesn't
+  // need them (by layer index and frame). A linked cel that is
+  // needed can still read the original cel from its position.
+  struct SkippedCel {
+    size_t pos;                 // Position of the chunk data
+    size_t chunk_end;
+  };
+  std::map<std::pair<doc::layer_t, doc::frame_t>, SkippedCel> m_skippedCels;
+  gfx::Rect m_decodeBounds;
 };
 
 } // namespace dio
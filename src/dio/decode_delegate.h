@@ -1,4 +1,5 @@
 // Aseprite Document IO Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -10,8 +11,12 @@
 
 #include "doc/color.h"
 #include "doc/frame.h"
+#include "doc/image_ref.h"
 #include "doc/sprite.h"
+#include "gfx/rect.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 namespace dio {
@@ -33,11 +38,37 @@ public:
   // to generate a thumbnail)
   virtual bool decodeOneFrame() { return false; }
 
+  // Return true if you want just the embedded thumbnail of the file
+  // (if the file has one). In that case the decoding stops after the
+  // thumbnail is read, and the sprite doesn't contain layers/cels.
+  virtual bool decodeThumbnail() { return false; }
+
+  // Called with the embedded thumbnail of the file (a RGB image of
+  // the first frame).
+  virtual void onThumbnail(const doc::ImageRef& thumbnail) { }
+
+  // Return false to skip the cels of the given layer in the given
+  // frame (e.g. to load just some frames/layers of the file). The
+  // sprite will contain all the frames and layers anyway.
+  virtual bool decodeCel(const doc::Layer* layer,
+                         const doc::frame_t frame) { return true; }
+
+  // Area of the sprite to decode, the cels outside this area are
+  // skipped (an empty rectangle means the whole sprite).
+  virtual gfx::Rect decodeBounds() { return gfx::Rect(); }
+
   // Default color for slices without user data
   virtual doc::color_t defaultSliceColor() {
     return doc::rgba(0, 0, 255, 255);
   }
 
+  // Called with the compressed data of each cel image that was
+  // inflated successfully (e.g. to reuse it if the sprite is saved
+  // again). The data is valid only during this call.
+  virtual void onCompressedImage(const doc::Image* image,
+                                 const uint8_t* bytes,
+                                 const size_t size) { }
+
   // Called when the sprite is decoded successfully
   virtual void onSprite(doc::Sprite* sprite) {
     // Discard the sprite, you should overwrite this behavior, use the
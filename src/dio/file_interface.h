@@ -1,4 +1,5 @@
 // Aseprite Document IO Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2017-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -31,6 +32,13 @@ public:
   virtual uint8_t read8() = 0;
   virtual size_t readBytes(uint8_t* buf, size_t n) = 0;
 
+  // Points "span" to the next "n" bytes of the file without copying
+  // them (the bytes are valid while this FileInterface is alive) and
+  // returns the number of available bytes (less than "n" at the end
+  // of the file). Returns 0 if the file doesn't support this kind of
+  // reads (only memory-mapped files), so we have to use readBytes().
+  virtual size_t readSpan(const uint8_t** span, size_t n) { return 0; }
+
   // Writes one byte in the file (or do nothing if ok() = false)
   virtual void write8(uint8_t value) = 0;
 
@@ -50,6 +58,33 @@ private:
   bool m_ok;
 };
 
+// Read-only file interface that maps the whole file in memory. It
+// avoids one call per byte/chunk to the C runtime and supports
+// readSpan(), so the data can be used directly from the mapped
+// memory. If the file cannot be mapped (isMapped() = false), all
+// reads fail, so you can use a StdioFileInterface instead.
+class MappedFileInterface : public FileInterface {
+public:
+  MappedFileInterface(FILE* file);
+  ~MappedFileInterface();
+  bool isMapped() const { return m_data != nullptr; }
+  bool ok() const override;
+  size_t tell() override;
+  void seek(size_t absPos) override;
+  uint8_t read8() override;
+  size_t readBytes(uint8_t* buf, size_t n) override;
+  size_t readSpan(const uint8_t** span, size_t n) override;
+  void write8(uint8_t value) override;
+private:
+  const uint8_t* m_data;
+  size_t m_size;
+  size_t m_pos;
+  bool m_ok;
+#ifdef _WIN32
+  void* m_mapping;
+#endif
+};
+
 } // namespace dio
 
 #endif
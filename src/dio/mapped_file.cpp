@@ -0,0 +1,136 @@
+// Aseprite Document IO Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include "dio/file_interface.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+  #include <windows.h>
+  #include <io.h>
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+namespace dio {
+
+MappedFileInterface::MappedFileInterface(FILE* file)
+  : m_data(nullptr)
+  , m_size(0)
+  , m_pos(0)
+  , m_ok(false)
+#ifdef _WIN32
+  , m_mapping(nullptr)
+#endif
+{
+#ifdef _WIN32
+  HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+  if (handle == INVALID_HANDLE_VALUE)
+    return;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(handle, &size) ||
+      size.QuadPart <= 0 ||
+      uint64_t(size.QuadPart) > uint64_t(SIZE_MAX))
+    return;
+
+  m_mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!m_mapping)
+    return;
+
+  m_data = (const uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!m_data) {
+    CloseHandle(m_mapping);
+    m_mapping = nullptr;
+    return;
+  }
+  m_size = size_t(size.QuadPart);
+#else
+  const int fd = fileno(file);
+  struct stat sb;
+  if (fd < 0 ||
+      fstat(fd, &sb) != 0 ||
+      !S_ISREG(sb.st_mode) ||
+      sb.st_size <= 0)
+    return;
+
+  void* data = mmap(nullptr, size_t(sb.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+    return;
+
+  m_data = (const uint8_t*)data;
+  m_size = size_t(sb.st_size);
+#endif
+  m_ok = true;
+}
+
+MappedFileInterface::~MappedFileInterface()
+{
+  if (!m_data)
+    return;
+
+#ifdef _WIN32
+  UnmapViewOfFile(m_data);
+  CloseHandle(m_mapping);
+#else
+  munmap((void*)m_data, m_size);
+#endif
+}
+
+bool MappedFileInterface::ok() const
+{
+  return m_ok;
+}
+
+size_t MappedFileInterface::tell()
+{
+  return m_pos;
+}
+
+void MappedFileInterface::seek(size_t absPos)
+{
+  // Like fseek(), we can seek beyond the end of the file (the next
+  // read will fail)
+  m_pos = absPos;
+}
+
+uint8_t MappedFileInterface::read8()
+{
+  if (m_pos < m_size)
+    return m_data[m_pos++];
+
+  m_ok = false;
+  return 0;
+}
+
+size_t MappedFileInterface::readBytes(uint8_t* buf, size_t n)
+{
+  const uint8_t* span;
+  const size_t n2 = readSpan(&span, n);
+  if (n2 > 0)
+    std::memcpy(buf, span, n2);
+  return n2;
+}
+
+size_t MappedFileInterface::readSpan(const uint8_t** span, size_t n)
+{
+  const size_t n2 = (m_pos < m_size ? std::min(n, m_size - m_pos): 0);
+  if (n2 != n)
+    m_ok = false;
+
+  *span = m_data + std::min(m_pos, m_size);
+  m_pos += n2;
+  return n2;
+}
+
+void MappedFileInterface::write8(uint8_t value)
+{
+  // Read-only file
+}
+
+} // namespace dio
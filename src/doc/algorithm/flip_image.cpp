@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -11,40 +12,68 @@
 #include "doc/algorithm/flip_image.h"
 
 #include "gfx/rect.h"
+#include "doc/bitmap_rows.h"
 #include "doc/image.h"
+#include "doc/image_impl.h"
 #include "doc/mask.h"
 #include "doc/primitives.h"
+#include "doc/reverse_pixels.h"
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
 namespace doc {
 namespace algorithm {
 
-void flip_image(Image* image, const gfx::Rect& bounds, FlipType flipType)
+namespace {
+
+template<typename ImageTraits>
+void flip_image_templ(Image* image, const gfx::Rect& bounds, FlipType flipType)
 {
+  using pixel_t = typename ImageTraits::pixel_t;
+
   switch (flipType) {
 
     case FlipHorizontal:
-      for (int y=bounds.y; y<bounds.y+bounds.h; ++y) {
-        int u = bounds.x+bounds.w-1;
-        for (int x=bounds.x; x<bounds.x+bounds.w/2; ++x, --u) {
-          uint32_t c1 = get_pixel(image, x, y);
-          uint32_t c2 = get_pixel(image, u, y);
-          put_pixel(image, x, y, c2);
-          put_pixel(image, u, y, c1);
-        }
+      for (int y=bounds.y; y<bounds.y2(); ++y)
+        reverse_pixels((pixel_t*)image->getPixelAddress(bounds.x, y), bounds.w);
+      break;
+
+    case FlipVertical: {
+      // Swap whole rows
+      int v = bounds.y2()-1;
+      for (int y=bounds.y; y<bounds.y+bounds.h/2; ++y, --v) {
+        auto p = (pixel_t*)image->getPixelAddress(bounds.x, y);
+        auto q = (pixel_t*)image->getPixelAddress(bounds.x, v);
+        std::swap_ranges(p, p+bounds.w, q);
       }
       break;
+    }
+  }
+}
+
+template<>
+void flip_image_templ<BitmapTraits>(Image* image, const gfx::Rect& bounds, FlipType flipType)
+{
+  switch (flipType) {
+
+    case FlipHorizontal:
+      for (int y=bounds.y; y<bounds.y2(); ++y)
+        reverse_bitmap_row(image->getPixelAddress(0, y), bounds.x, bounds.x2());
+      break;
 
     case FlipVertical: {
-      int v = bounds.y+bounds.h-1;
+      int v = bounds.y2()-1;
       for (int y=bounds.y; y<bounds.y+bounds.h/2; ++y, --v) {
-        for (int x=bounds.x; x<bounds.x+bounds.w; ++x) {
-          uint32_t c1 = get_pixel(image, x, y);
-          uint32_t c2 = get_pixel(image, x, v);
-          put_pixel(image, x, y, c2);
-          put_pixel(image, x, v, c1);
+        uint8_t* p = image->getPixelAddress(0, y);
+        uint8_t* q = image->getPixelAddress(0, v);
+        for (int x=bounds.x; x<bounds.x2(); ) {
+          const int n = std::min(kBitmapChunkPixels, bounds.x2()-x);
+          const uint64_t a = read_bitmap_chunk(p, x, n);
+          write_bitmap_chunk(p, x, n, read_bitmap_chunk(q, x, n));
+          write_bitmap_chunk(q, x, n, a);
+          x += n;
         }
       }
       break;
@@ -52,6 +81,24 @@ void flip_image(Image* image, const gfx::Rect& bounds, FlipType flipType)
   }
 }
 
+} // anonymous namespace
+
+void flip_image(Image* image, const gfx::Rect& bounds0, FlipType flipType)
+{
+  // Rows are accessed directly, so the bounds must be inside the image
+  ASSERT(image->bounds().contains(bounds0));
+  const gfx::Rect bounds = (bounds0 & image->bounds());
+  if (bounds.isEmpty())
+    return;
+
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:       flip_image_templ<RgbTraits>(image, bounds, flipType); break;
+    case IMAGE_GRAYSCALE: flip_image_templ<GrayscaleTraits>(image, bounds, flipType); break;
+    case IMAGE_INDEXED:   flip_image_templ<IndexedTraits>(image, bounds, flipType); break;
+    case IMAGE_BITMAP:    flip_image_templ<BitmapTraits>(image, bounds, flipType); break;
+  }
+}
+
 void flip_image_with_mask(Image* image, const Mask* mask, FlipType flipType, int bgcolor)
 {
   gfx::Rect bounds = mask->bounds();
@@ -0,0 +1,108 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/algorithm/flip_image.h"
+#include "doc/algorithm/shift_image.h"
+#include "doc/image_impl.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+
+#include <cstdlib>
+
+using namespace doc;
+using namespace doc::algorithm;
+
+template<typename T>
+class FlipImageAllTypes : public testing::Test {
+protected:
+  FlipImageAllTypes() { }
+};
+
+typedef testing::Types<RgbTraits, GrayscaleTraits, IndexedTraits, BitmapTraits> ImageAllTraits;
+TYPED_TEST_CASE(FlipImageAllTypes, ImageAllTraits);
+
+template<typename ImageTraits>
+static ImageRef random_image(const int w, const int h)
+{
+  ImageRef image(Image::create(ImageTraits::pixel_format, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel_fast<ImageTraits>(image.get(), x, y, std::rand() & ImageTraits::max_value);
+  return image;
+}
+
+TYPED_TEST(FlipImageAllTypes, Flip)
+{
+  typedef TypeParam ImageTraits;
+
+  std::srand(1);
+  for (int i=0; i<100; ++i) {
+    const int w = 1 + (std::rand() % 130);
+    const int h = 1 + (std::rand() % 40);
+    const gfx::Rect bounds(std::rand() % w, std::rand() % h, 0, 0);
+    const gfx::Rect rc(bounds.x, bounds.y,
+                       1 + std::rand() % (w-bounds.x),
+                       1 + std::rand() % (h-bounds.y));
+
+    for (FlipType flipType : { FlipHorizontal, FlipVertical }) {
+      ImageRef orig = random_image<ImageTraits>(w, h);
+      ImageRef image(Image::createCopy(orig.get()));
+      flip_image(image.get(), rc, flipType);
+
+      for (int y=0; y<h; ++y) {
+        for (int x=0; x<w; ++x) {
+          int u = x, v = y;
+          if (rc.contains(gfx::Point(x, y))) {
+            if (flipType == FlipHorizontal)
+              u = rc.x2() - (x-rc.x) - 1;
+            else
+              v = rc.y2() - (y-rc.y) - 1;
+          }
+          ASSERT_EQ(get_pixel_fast<ImageTraits>(orig.get(), u, v),
+                    get_pixel_fast<ImageTraits>(image.get(), x, y))
+            << "flip=" << int(flipType) << " x=" << x << " y=" << y;
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(FlipImageAllTypes, Shift)
+{
+  typedef TypeParam ImageTraits;
+
+  std::srand(2);
+  for (int i=0; i<100; ++i) {
+    const int w = 1 + (std::rand() % 130);
+    const int h = 1 + (std::rand() % 40);
+    const int dx = (std::rand() % 300) - 150;
+    const int dy = (std::rand() % 100) - 50;
+
+    ImageRef orig = random_image<ImageTraits>(w, h);
+    ImageRef image(Image::createCopy(orig.get()));
+    shift_image(image.get(), dx, dy, 0.0);
+
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        ASSERT_EQ(get_pixel_fast<ImageTraits>(orig.get(), x, y),
+                  get_pixel_fast<ImageTraits>(image.get(),
+                                              (((x+dx) % w) + w) % w,
+                                              (((y+dy) % h) + h) % h))
+          << "dx=" << dx << " dy=" << dy << " x=" << x << " y=" << y;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,350 +1,472 @@
-// The floodfill routine.
-// By Shawn Hargreaves.
-//
-// Changes by David Capello:
-// - Adapted to Aseprite
-// - Added non-contiguous mode
-// - Added mask parameter
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+// Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
-//
-// TODO rewrite this algorithm from scratch
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
-#include "base/base.h"
-#include "doc/algo.h"
+#include "doc/algorithm/floodfill.h"
+
+#include "base/clamp.h"
+#include "base/debug.h"
 #include "doc/image.h"
+#include "doc/image_impl.h"
 #include "doc/mask.h"
 #include "doc/primitives.h"
 #include "doc/primitives_fast.h"
 
-#include <climits>
-#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_FLOODFILL_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
 namespace doc {
 namespace algorithm {
 
-struct FLOODED_LINE {   // store segments which have been flooded
-  short flags;          // status of the segment
-  short lpos, rpos;     // left and right ends of segment
-  short y;              // y coordinate of the segment
-  int next;             // linked list if several per line
-};
-
-/* Note: a 'short' is not sufficient for 'next' above in some corner cases. */
+namespace {
 
+// Rows of pixels are stored as bits (one bit for each pixel, from
+// the least significant bit of the first word)
+using BitWord = uint64_t;
+const int kWordBits = 64;
 
-static std::vector<FLOODED_LINE> flood_buf;
-static int flood_count;          /* number of flooded segments */
+inline int words_for(const int nbits) {
+  return (nbits + kWordBits - 1) / kWordBits;
+}
 
-#define FLOOD_IN_USE             1
-#define FLOOD_TODO_ABOVE         2
-#define FLOOD_TODO_BELOW         4
+inline int lowest_bit(const BitWord w) {
+  ASSERT(w != 0);
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward64(&i, w);
+  return int(i);
+#else
+  return __builtin_ctzll(w);
+#endif
+}
 
-#define FLOOD_LINE(c)            (&flood_buf[c])
+inline int highest_bit(const BitWord w) {
+  ASSERT(w != 0);
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanReverse64(&i, w);
+  return int(i);
+#else
+  return kWordBits-1 - __builtin_clzll(w);
+#endif
+}
 
-static inline bool color_equal_32(color_t c1, color_t c2, int tolerance)
+// Returns the first bit set in the [from, to] range, or -1
+int find_first_set(const BitWord* bits, const int from, const int to)
 {
-  if (tolerance == 0)
-    return (c1 == c2) || (rgba_geta(c1) == 0 && rgba_geta(c2) == 0);
-  else {
-    int r1 = rgba_getr(c1);
-    int g1 = rgba_getg(c1);
-    int b1 = rgba_getb(c1);
-    int a1 = rgba_geta(c1);
-    int r2 = rgba_getr(c2);
-    int g2 = rgba_getg(c2);
-    int b2 = rgba_getb(c2);
-    int a2 = rgba_geta(c2);
-
-    if (a1 == 0 && a2 == 0)
-      return true;
-
-    return ((ABS(r1-r2) <= tolerance) &&
-            (ABS(g1-g2) <= tolerance) &&
-            (ABS(b1-b2) <= tolerance) &&
-            (ABS(a1-a2) <= tolerance));
+  if (from > to)
+    return -1;
+
+  int k = from / kWordBits;
+  const int lastWord = to / kWordBits;
+  BitWord w = bits[k] & (~BitWord(0) << (from % kWordBits));
+  while (w == 0) {
+    if (++k > lastWord)
+      return -1;
+    w = bits[k];
   }
+  const int i = k*kWordBits + lowest_bit(w);
+  return (i <= to ? i: -1);
 }
 
-static inline bool color_equal_16(color_t c1, color_t c2, int tolerance)
+// Returns the first bit cleared from "from", or "nbits" if all bits
+// until the end of the row are set
+int find_first_clear(const BitWord* bits, const int from, const int nbits)
 {
-  if (tolerance == 0)
-    return (c1 == c2) || (graya_geta(c1) == 0 && graya_geta(c2) == 0);
-  else {
-    int k1 = graya_getv(c1);
-    int a1 = graya_geta(c1);
-    int k2 = graya_getv(c2);
-    int a2 = graya_geta(c2);
-
-    if (a1 == 0 && a2 == 0)
-      return true;
-
-    return ((ABS(k1-k2) <= tolerance) &&
-            (ABS(a1-a2) <= tolerance));
+  int k = from / kWordBits;
+  const int nwords = words_for(nbits);
+  BitWord w = ~bits[k] & (~BitWord(0) << (from % kWordBits));
+  while (w == 0) {
+    if (++k == nwords)
+      return nbits;
+    w = ~bits[k];
   }
+  return std::min(nbits, k*kWordBits + lowest_bit(w));
 }
 
-static inline bool color_equal_8(color_t c1, color_t c2, int tolerance)
+// Returns the last bit cleared before or at "from", or -1 if all
+// bits from the beginning of the row are set
+int find_last_clear(const BitWord* bits, const int from)
 {
-  if (tolerance == 0)
-    return (c1 == c2);
-  else
-    return ABS((int)c1 - (int)c2) <= tolerance;
+  int k = from / kWordBits;
+  const int shift = from % kWordBits;
+  BitWord w = ~bits[k];
+  if (shift < kWordBits-1)
+    w &= (BitWord(1) << (shift+1)) - 1;
+  while (w == 0) {
+    if (--k < 0)
+      return -1;
+    w = ~bits[k];
+  }
+  return k*kWordBits + highest_bit(w);
 }
 
-template<typename ImageTraits>
-static inline bool color_equal(color_t c1, color_t c2, int tolerance)
+void clear_bits(BitWord* bits, const int from, const int to)
 {
-  static_assert(false && sizeof(ImageTraits), "Invalid color comparison");
-  return false;
+  const int k1 = from / kWordBits;
+  const int k2 = to / kWordBits;
+  const BitWord m1 = (~BitWord(0) << (from % kWordBits));
+  const BitWord m2 = (~BitWord(0) >> (kWordBits-1 - (to % kWordBits)));
+  if (k1 == k2) {
+    bits[k1] &= ~(m1 & m2);
+  }
+  else {
+    bits[k1] &= ~m1;
+    std::fill(bits+k1+1, bits+k2, BitWord(0));
+    bits[k2] &= ~m2;
+  }
+}
+
+inline void set_bits16(BitWord* bits, const int i, const int m16) {
+  bits[i / kWordBits] |= (BitWord(m16) << (i % kWordBits));
 }
 
+inline void set_bit(BitWord* bits, const int i) {
+  bits[i / kWordBits] |= (BitWord(1) << (i % kWordBits));
+}
+
+// Returns true if both colors are similar with the given tolerance
+// (fully transparent RGB/grayscale colors are equal)
+template<typename ImageTraits>
+inline bool color_equal(color_t c1, color_t c2, int tolerance);
+
 template<>
 inline bool color_equal<RgbTraits>(color_t c1, color_t c2, int tolerance)
 {
-  return color_equal_32(c1, c2, tolerance);
+  if (rgba_geta(c1) == 0 && rgba_geta(c2) == 0)
+    return true;
+
+  return ((std::abs(int(rgba_getr(c1)) - int(rgba_getr(c2))) <= tolerance) &&
+          (std::abs(int(rgba_getg(c1)) - int(rgba_getg(c2))) <= tolerance) &&
+          (std::abs(int(rgba_getb(c1)) - int(rgba_getb(c2))) <= tolerance) &&
+          (std::abs(int(rgba_geta(c1)) - int(rgba_geta(c2))) <= tolerance));
 }
 
 template<>
 inline bool color_equal<GrayscaleTraits>(color_t c1, color_t c2, int tolerance)
 {
-  return color_equal_16(c1, c2, tolerance);
+  if (graya_geta(c1) == 0 && graya_geta(c2) == 0)
+    return true;
+
+  return ((std::abs(int(graya_getv(c1)) - int(graya_getv(c2))) <= tolerance) &&
+          (std::abs(int(graya_geta(c1)) - int(graya_geta(c2))) <= tolerance));
 }
 
 template<>
 inline bool color_equal<IndexedTraits>(color_t c1, color_t c2, int tolerance)
 {
-  return color_equal_8(c1, c2, tolerance);
+  return std::abs(int(c1) - int(c2)) <= tolerance;
 }
 
+#ifdef DOC_FLOODFILL_SSE2
 
+inline __m128i abs_diff_epu8(const __m128i a, const __m128i b) {
+  return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
 
-/* flooder:
- *  Fills a horizontal line around the specified position, and adds it
- *  to the list of drawn segments. Returns the first x coordinate after
- *  the part of the line which it has dealt with.
- */
-static int flooder(const Image* image,
-                   const Mask* mask,
-                   int x, int y,
-                   const gfx::Rect& bounds,
-                   color_t src_color, int tolerance, void *data, AlgoHLine proc)
-{
-#define MASKED(u, v)                                                    \
-        (mask &&                                                        \
-         (!mask->bounds().contains(u, v) ||                             \
-          (mask->bitmap() &&                                            \
-           !get_pixel_fast<BitmapTraits>(mask->bitmap(),                \
-                                         (u)-mask->bounds().x,          \
-                                         (v)-mask->bounds().y))))
-
-  FLOODED_LINE *p;
-  int left = 0, right = 0;
-  int c;
-
-  switch (image->pixelFormat()) {
-
-    case IMAGE_RGB:
-      {
-        uint32_t* address = reinterpret_cast<uint32_t*>(image->getPixelAddress(0, y));
-
-        // Check start pixel
-        if (!color_equal_32((int)*(address+x), src_color, tolerance) || MASKED(x, y))
-          return x+1;
-
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_32((int)*(address+left), src_color, tolerance) || MASKED(left, y))
-            break;
-        }
-
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_32((int)*(address+right), src_color, tolerance) || MASKED(right, y))
-            break;
-        }
-      }
-      break;
-
-    case IMAGE_GRAYSCALE:
-      {
-        uint16_t* address = reinterpret_cast<uint16_t*>(image->getPixelAddress(0, y));
-
-        // Check start pixel
-        if (!color_equal_16((int)*(address+x), src_color, tolerance) || MASKED(x, y))
-          return x+1;
-
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_16((int)*(address+left), src_color, tolerance) || MASKED(left, y))
-            break;
-        }
-
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_16((int)*(address+right), src_color, tolerance) || MASKED(right, y))
-            break;
-        }
-      }
-      break;
-
-    case IMAGE_INDEXED:
-      {
-        uint8_t* address = image->getPixelAddress(0, y);
-
-        // Check start pixel
-        if (!color_equal_8((int)*(address+x), src_color, tolerance) || MASKED(x, y))
-          return x+1;
-
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_8((int)*(address+left), src_color, tolerance) || MASKED(left, y))
-            break;
-        }
-
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_8((int)*(address+right), src_color, tolerance) || MASKED(right, y))
-            break;
-        }
-      }
-      break;
+// Compares 16 pixels with the reference color, returning one bit for
+// each similar pixel
+template<typename ImageTraits>
+class Match16;
 
-    default:
-      // Check start pixel
-      if (get_pixel(image, x, y) != src_color || MASKED(x, y))
-        return x+1;
-
-      // Work left from starting point
-      for (left=x-1; left>=bounds.x; left--) {
-        if (get_pixel(image, left, y) != src_color || MASKED(left, y))
-          break;
-      }
+template<>
+class Match16<RgbTraits> {
+public:
+  Match16(color_t color, int tolerance)
+    : m_color(_mm_set1_epi32(int(color)))
+    , m_tolerance(_mm_set1_epi8(char(tolerance)))
+    , m_alpha(_mm_set1_epi32(int(rgba_a_mask))) { }
+
+  int operator()(const uint32_t* p) const {
+    __m128i r[4];
+    for (int j=0; j<4; ++j)
+      r[j] = match4(_mm_loadu_si128((const __m128i*)(p+4*j)));
+
+    // All lanes are 0 or -1, so the saturated packs keep the results
+    return _mm_movemask_epi8(
+      _mm_packs_epi16(_mm_packs_epi32(r[0], r[1]),
+                      _mm_packs_epi32(r[2], r[3])));
+  }
 
-      // Work right from starting point
-      for (right=x+1; right<bounds.x2(); right++) {
-        if (get_pixel(image, right, y) != src_color || MASKED(right, y))
-          break;
-      }
-      break;
+private:
+  __m128i match4(const __m128i c) const {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i similar =
+      _mm_cmpeq_epi32(_mm_subs_epu8(abs_diff_epu8(c, m_color), m_tolerance), zero);
+    const __m128i transparent =
+      _mm_cmpeq_epi32(_mm_and_si128(_mm_or_si128(c, m_color), m_alpha), zero);
+    return _mm_or_si128(similar, transparent);
   }
 
-  left++;
-  right--;
+  __m128i m_color, m_tolerance, m_alpha;
+};
 
-  /* draw the line */
-  (*proc)(left, y, right, data);
+template<>
+class Match16<GrayscaleTraits> {
+public:
+  Match16(color_t color, int tolerance)
+    : m_color(_mm_set1_epi16(short(color)))
+    , m_tolerance(_mm_set1_epi8(char(tolerance)))
+    , m_alpha(_mm_set1_epi16(short(0xff << graya_a_shift))) { }
+
+  int operator()(const uint16_t* p) const {
+    return _mm_movemask_epi8(
+      _mm_packs_epi16(match8(_mm_loadu_si128((const __m128i*)p)),
+                      match8(_mm_loadu_si128((const __m128i*)(p+8)))));
+  }
 
-  /* store it in the list of flooded segments */
-  c = y;
-  p = FLOOD_LINE(c);
+private:
+  __m128i match8(const __m128i c) const {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i similar =
+      _mm_cmpeq_epi16(_mm_subs_epu8(abs_diff_epu8(c, m_color), m_tolerance), zero);
+    const __m128i transparent =
+      _mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(c, m_color), m_alpha), zero);
+    return _mm_or_si128(similar, transparent);
+  }
 
-  if (p->flags) {
-    while (p->next) {
-      c = p->next;
-      p = FLOOD_LINE(c);
-    }
+  __m128i m_color, m_tolerance, m_alpha;
+};
 
-    p->next = c = flood_count++;
-    flood_buf.resize(flood_count);
-    p = FLOOD_LINE(c);
+template<>
+class Match16<IndexedTraits> {
+public:
+  Match16(color_t color, int tolerance)
+    : m_color(_mm_set1_epi8(char(color)))
+    , m_tolerance(_mm_set1_epi8(char(tolerance))) { }
+
+  int operator()(const uint8_t* p) const {
+    const __m128i c = _mm_loadu_si128((const __m128i*)p);
+    return _mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_subs_epu8(abs_diff_epu8(c, m_color), m_tolerance),
+                     _mm_setzero_si128()));
   }
 
-  p->flags = FLOOD_IN_USE;
-  p->lpos = left;
-  p->rpos = right;
-  p->y = y;
-  p->next = 0;
+private:
+  __m128i m_color, m_tolerance;
+};
 
-  if (y > bounds.y)
-    p->flags |= FLOOD_TODO_ABOVE;
+#endif // DOC_FLOODFILL_SSE2
 
-  if (y+1 < bounds.y2())
-    p->flags |= FLOOD_TODO_BELOW;
+// Sets the bits of the "n" pixels from (x, y) that are similar to
+// the given color ("bits" must be cleared)
+template<typename ImageTraits>
+void match_row(const Image* image, const int x, const int y, const int n,
+               const color_t color, const int tolerance,
+               BitWord* bits)
+{
+  auto p = (const typename ImageTraits::pixel_t*)image->getPixelAddress(x, y);
+  int i = 0;
+
+#ifdef DOC_FLOODFILL_SSE2
+  const Match16<ImageTraits> match16(color, tolerance);
+  for (; i+16<=n; i+=16) {
+    if (const int m = match16(p+i))
+      set_bits16(bits, i, m);
+  }
+#endif
 
-  return right+2;
+  for (; i<n; ++i) {
+    if (color_equal<ImageTraits>(p[i], color, tolerance))
+      set_bit(bits, i);
+  }
 }
 
+void match_row_generic(const Image* image, const int x, const int y, const int n,
+                       const color_t color,
+                       BitWord* bits)
+{
+  for (int i=0; i<n; ++i) {
+    if (get_pixel(image, x+i, y) == color)
+      set_bit(bits, i);
+  }
+}
 
+void match_row(const Image* image, const int x, const int y, const int n,
+               const color_t color, const int tolerance,
+               BitWord* bits)
+{
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:
+      match_row<RgbTraits>(image, x, y, n, color, tolerance, bits);
+      break;
+    case IMAGE_GRAYSCALE:
+      match_row<GrayscaleTraits>(image, x, y, n, color, tolerance, bits);
+      break;
+    case IMAGE_INDEXED:
+      match_row<IndexedTraits>(image, x, y, n, color, tolerance, bits);
+      break;
+    default:
+      match_row_generic(image, x, y, n, color, bits);
+      break;
+  }
+}
 
-/* check_flood_line:
- *  Checks a line segment, using the scratch buffer is to store a list of
- *  segments which have already been drawn in order to minimise the required
- *  number of tests.
- */
-static int check_flood_line(const Image* image,
-                            const Mask* mask,
-                            int y, int left, int right,
-                            const gfx::Rect& bounds,
-                            int src_color, int tolerance, void *data, AlgoHLine proc)
+// Clears the bits of the pixels outside the mask
+void mask_row(const Mask* mask, const int x, const int y, const int n,
+              BitWord* bits)
 {
-  int c;
-  FLOODED_LINE *p;
-  int ret = false;
+  const gfx::Rect& maskBounds = mask->bounds();
+  const int u1 = std::max(x, maskBounds.x);
+  const int u2 = std::min(x+n, maskBounds.x2());
+  if (y < maskBounds.y || y >= maskBounds.y2() || u1 >= u2) {
+    std::fill(bits, bits+words_for(n), BitWord(0));
+    return;
+  }
 
-  while (left <= right) {
-    c = y;
+  if (u1 > x)
+    clear_bits(bits, 0, u1-x-1);
+  if (u2 < x+n)
+    clear_bits(bits, u2-x, n-1);
+
+  if (const Image* bitmap = mask->bitmap()) {
+    for (int u=u1; u<u2; ++u) {
+      if (!get_pixel_fast<BitmapTraits>(bitmap,
+                                        u-maskBounds.x,
+                                        y-maskBounds.y))
+        clear_bits(bits, u-x, u-x);
+    }
+  }
+}
 
-    for (;;) {
-      p = FLOOD_LINE(c);
+// Scanline flood fill: each span of the stack is a range of pixels
+// to check in one row, and each row keeps bits of the pixels that
+// can be filled and were not filled yet (rows are calculated when
+// they are reached for the first time).
+class SpanFill {
+public:
+  SpanFill(const Image* image,
+           const Mask* mask,
+           const gfx::Rect& bounds,
+           const color_t color,
+           const int tolerance)
+    : m_image(image)
+    , m_mask(mask)
+    , m_bounds(bounds)
+    , m_color(color)
+    , m_tolerance(tolerance)
+    , m_rowWords(words_for(bounds.w))
+    , m_bits(std::size_t(m_rowWords) * bounds.h, 0)
+    , m_ready(bounds.h, false) {
+  }
 
-      if ((left >= p->lpos) && (left <= p->rpos)) {
-        left = p->rpos+2;
-        break;
+  void fill(const int x, const int y,
+            const bool isEightConnected,
+            void* data, AlgoHLine proc) {
+    int i = x - m_bounds.x;
+    if (find_first_set(row(y), i, i) < 0)
+      return;
+
+    const int d = (isEightConnected ? 1: 0);
+    const int w = m_bounds.w;
+    m_stack.push_back(Span{ y, i, i });
+
+    while (!m_stack.empty()) {
+      const Span span = m_stack.back();
+      m_stack.pop_back();
+
+      BitWord* bits = row(span.y);
+      for (i = find_first_set(bits, span.i1, span.i2);
+           i >= 0;
+           i = find_first_set(bits, i+1, span.i2)) {
+        const int l = find_last_clear(bits, i) + 1;
+        const int r = find_first_clear(bits, i, w) - 1;
+        clear_bits(bits, l, r);
+
+        (*proc)(m_bounds.x+l, span.y, m_bounds.x+r, data);
+
+        const int i1 = std::max(0, l-d);
+        const int i2 = std::min(w-1, r+d);
+        if (span.y > m_bounds.y)
+          m_stack.push_back(Span{ span.y-1, i1, i2 });
+        if (span.y+1 < m_bounds.y2())
+          m_stack.push_back(Span{ span.y+1, i1, i2 });
+
+        i = r;
       }
+    }
+  }
 
-      c = p->next;
-
-      if (!c) {
-        left = flooder(image, mask, left, y, bounds, src_color, tolerance, data, proc);
-        ret = true;
-        break;
-      }
+private:
+  struct Span {
+    int y, i1, i2;
+  };
+
+  BitWord* row(const int y) {
+    const int j = y - m_bounds.y;
+    BitWord* bits = &m_bits[std::size_t(j) * m_rowWords];
+    if (!m_ready[j]) {
+      m_ready[j] = true;
+      match_row(m_image, m_bounds.x, y, m_bounds.w,
+                m_color, m_tolerance, bits);
+      if (m_mask)
+        mask_row(m_mask, m_bounds.x, y, m_bounds.w, bits);
     }
+    return bits;
   }
 
-  return ret;
-}
+  const Image* m_image;
+  const Mask* m_mask;
+  gfx::Rect m_bounds;
+  color_t m_color;
+  int m_tolerance;
+  int m_rowWords;
+  std::vector<BitWord> m_bits;
+  std::vector<bool> m_ready;
+  std::vector<Span> m_stack;
+};
 
-template<typename ImageTraits>
-static void replace_color(const Image* image, const gfx::Rect& bounds, int src_color, int tolerance, void* data, AlgoHLine proc)
+// Non-contiguous fill: all similar pixels in the bounds are filled
+void replace_color(const Image* image,
+                   const gfx::Rect& bounds,
+                   const color_t color,
+                   const int tolerance,
+                   void* data, AlgoHLine proc)
 {
-  typename ImageTraits::address_t address;
+  const int w = bounds.w;
+  std::vector<BitWord> bits(words_for(w));
 
   for (int y=bounds.y; y<bounds.y2(); ++y) {
-    address = reinterpret_cast<typename ImageTraits::address_t>(image->getPixelAddress(bounds.x, y));
-
-    for (int x=bounds.x; x<bounds.x2(); ++x, ++address) {
-      int right = -1;
-
-      if (color_equal<ImageTraits>((int)(*address), src_color, tolerance)) {
-        ++address;
-        for (right=x+1; right<bounds.x2(); ++right, ++address) {
-          if (!color_equal<ImageTraits>((int)(*address), src_color, tolerance))
-            break;
-        }
-        (*proc)(x, y, right-1, data);
-        x = right;
-      }
+    std::fill(bits.begin(), bits.end(), BitWord(0));
+    match_row(image, bounds.x, y, w, color, tolerance, &bits[0]);
+
+    for (int i = find_first_set(&bits[0], 0, w-1);
+         i >= 0;
+         i = find_first_set(&bits[0], i+1, w-1)) {
+      const int r = find_first_clear(&bits[0], i, w) - 1;
+      (*proc)(bounds.x+i, y, bounds.x+r, data);
+      i = r;
     }
   }
 }
 
-/* floodfill:
- *  Fills an enclosed area (starting at point x, y) with the specified color.
- */
+} // anonymous namespace
+
 void floodfill(const Image* image,
                const Mask* mask,
                const int x, const int y,
-               const gfx::Rect& bounds,
-               const doc::color_t src_color,
-               const int tolerance,
+               const gfx::Rect& bounds0,
+               const doc::color_t srcColor,
+               const int tolerance0,
                const bool contiguous,
                const bool isEightConnected,
                void* data,
@@ -355,132 +477,29 @@ void floodfill(const Image* image,
       (y < 0) || (y >= image->height()))
     return;
 
+  const gfx::Rect bounds = (bounds0 & image->bounds());
+  if (bounds.isEmpty())
+    return;
+
+  const int tolerance = base::clamp(tolerance0, 0, 255);
+
   // Non-contiguous case, we replace colors in the whole image.
   if (!contiguous) {
     switch (image->pixelFormat()) {
       case IMAGE_RGB:
-        replace_color<RgbTraits>(image, bounds, src_color, tolerance, data, proc);
-        break;
       case IMAGE_GRAYSCALE:
-        replace_color<GrayscaleTraits>(image, bounds, src_color, tolerance, data, proc);
-        break;
       case IMAGE_INDEXED:
-        replace_color<IndexedTraits>(image, bounds, src_color, tolerance, data, proc);
+        replace_color(image, bounds, srcColor, tolerance, data, proc);
         break;
     }
     return;
   }
 
-  /* set up the list of flooded segments */
-  flood_buf.resize(image->height());
-  flood_count = image->height();
-  FLOODED_LINE* p = (FLOODED_LINE*)&flood_buf[0];
-  for (int c=0; c<flood_count; c++) {
-    p[c].flags = 0;
-    p[c].lpos = SHRT_MAX;
-    p[c].rpos = SHRT_MIN;
-    p[c].y = y;
-    p[c].next = 0;
-  }
-
-  // Start up the flood algorithm
-  flooder(image, mask, x, y, bounds, src_color, tolerance, data, proc);
-
-  // Continue as long as there are some segments still to test
-  bool done;
-  do {
-    done = true;
-
-    // For each line on the screen
-    for (int c=0; c<flood_count; c++) {
-      p = FLOOD_LINE(c);
-
-      // Check below the segment?
-      if (p->flags & FLOOD_TODO_BELOW) {
-        p->flags &= ~FLOOD_TODO_BELOW;
-
-        if (isEightConnected) {
-          if (p->lpos+1 < bounds.x2() &&
-              check_flood_line(image, mask, p->y+1, p->lpos+1, p->rpos, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->lpos-1 >= 0 &&
-              check_flood_line(image, mask, p->y+1, p->lpos-1, p->rpos, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->rpos+1 < bounds.x2() &&
-              check_flood_line(image, mask, p->y+1, p->lpos, p->rpos+1, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->rpos-1 >= 0 &&
-              check_flood_line(image, mask, p->y+1, p->lpos, p->rpos-1, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-        }
-
-        if (check_flood_line(image, mask, p->y+1, p->lpos, p->rpos, bounds,
-                             src_color, tolerance, data, proc)) {
-          done = false;
-          p = FLOOD_LINE(c);
-        }
-      }
+  if (!bounds.contains(gfx::Point(x, y)))
+    return;
 
-      // Check above the segment?
-      if (p->flags & FLOOD_TODO_ABOVE) {
-        p->flags &= ~FLOOD_TODO_ABOVE;
-
-        if (isEightConnected) {
-          if (p->lpos+1 < bounds.x2() &&
-              check_flood_line(image, mask, p->y-1, p->lpos+1, p->rpos, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->lpos-1 >= 0 &&
-              check_flood_line(image, mask, p->y-1, p->lpos-1, p->rpos, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->rpos+1 < bounds.x2() &&
-              check_flood_line(image, mask, p->y-1, p->lpos, p->rpos+1, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->rpos-1 >= 0 &&
-              check_flood_line(image, mask, p->y-1, p->lpos, p->rpos-1, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-        }
-
-        if (check_flood_line(image, mask, p->y-1, p->lpos, p->rpos, bounds,
-                             src_color, tolerance, data, proc)) {
-          done = false;
-
-          // Special case shortcut for going backwards
-          if ((c > bounds.y) && (c < bounds.y2()))
-            c -= 2;
-        }
-      }
-    }
-  } while (!done);
+  SpanFill(image, mask, bounds, srcColor, tolerance)
+    .fill(x, y, isEightConnected, data, proc);
 }
 
 } // namespace algorithm
@@ -0,0 +1,198 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/algorithm/floodfill.h"
+#include "doc/image_impl.h"
+#include "doc/mask.h"
+#include "doc/primitives.h"
+
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+using namespace doc;
+using namespace doc::algorithm;
+
+namespace {
+
+struct Filled {
+  std::unique_ptr<Image> image;
+  int hlines = 0;
+};
+
+void fill_hline(int x1, int y, int x2, void* data)
+{
+  Filled* filled = (Filled*)data;
+  for (int x=x1; x<=x2; ++x) {
+    // Each pixel must be filled only once
+    EXPECT_EQ(0, get_pixel(filled->image.get(), x, y));
+    put_pixel(filled->image.get(), x, y, 1);
+  }
+  ++filled->hlines;
+}
+
+Filled floodfill_bitmap(const Image* image, const Mask* mask,
+                        int x, int y, const gfx::Rect& bounds,
+                        int tolerance, bool contiguous, bool eight)
+{
+  Filled filled;
+  filled.image.reset(Image::create(IMAGE_BITMAP, image->width(), image->height()));
+  clear_image(filled.image.get(), 0);
+  floodfill(image, mask, x, y, bounds,
+            get_pixel(image, x, y), tolerance,
+            contiguous, eight, &filled, fill_hline);
+  return filled;
+}
+
+bool similar(const Image* image, color_t a, color_t b, int tolerance)
+{
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:
+      if (rgba_geta(a) == 0 && rgba_geta(b) == 0)
+        return true;
+      return (std::abs(int(rgba_getr(a)) - int(rgba_getr(b))) <= tolerance &&
+              std::abs(int(rgba_getg(a)) - int(rgba_getg(b))) <= tolerance &&
+              std::abs(int(rgba_getb(a)) - int(rgba_getb(b))) <= tolerance &&
+              std::abs(int(rgba_geta(a)) - int(rgba_geta(b))) <= tolerance);
+    case IMAGE_GRAYSCALE:
+      if (graya_geta(a) == 0 && graya_geta(b) == 0)
+        return true;
+      return (std::abs(int(graya_getv(a)) - int(graya_getv(b))) <= tolerance &&
+              std::abs(int(graya_geta(a)) - int(graya_geta(b))) <= tolerance);
+    default:
+      return std::abs(int(a) - int(b)) <= tolerance;
+  }
+}
+
+// Reference implementation (pixel by pixel)
+std::unique_ptr<Image> naive_floodfill(const Image* image, const Mask* mask,
+                                       int x0, int y0, const gfx::Rect& bounds,
+                                       int tolerance, bool contiguous, bool eight)
+{
+  const color_t color = get_pixel(image, x0, y0);
+  auto fillable = [&](int x, int y) {
+    if (!bounds.contains(gfx::Point(x, y)) ||
+        !similar(image, get_pixel(image, x, y), color, tolerance))
+      return false;
+    if (mask && contiguous && !mask->containsPoint(x, y))
+      return false;
+    return true;
+  };
+
+  std::unique_ptr<Image> result(Image::create(IMAGE_BITMAP, image->width(), image->height()));
+  clear_image(result.get(), 0);
+
+  if (!contiguous) {
+    for (int y=bounds.y; y<bounds.y2(); ++y)
+      for (int x=bounds.x; x<bounds.x2(); ++x)
+        if (fillable(x, y))
+          put_pixel(result.get(), x, y, 1);
+    return result;
+  }
+
+  if (!fillable(x0, y0))
+    return result;
+
+  std::vector<gfx::Point> stack;
+  stack.push_back(gfx::Point(x0, y0));
+  put_pixel(result.get(), x0, y0, 1);
+  while (!stack.empty()) {
+    const gfx::Point pt = stack.back();
+    stack.pop_back();
+    for (int v=-1; v<=1; ++v)
+      for (int u=-1; u<=1; ++u) {
+        if ((u == 0 && v == 0) || (!eight && u != 0 && v != 0))
+          continue;
+        const int x = pt.x+u;
+        const int y = pt.y+v;
+        if (fillable(x, y) && !get_pixel(result.get(), x, y)) {
+          put_pixel(result.get(), x, y, 1);
+          stack.push_back(gfx::Point(x, y));
+        }
+      }
+  }
+  return result;
+}
+
+void random_image(Image* image, int ncolors)
+{
+  for (int y=0; y<image->height(); ++y)
+    for (int x=0; x<image->width(); ++x) {
+      const int v = (std::rand() % ncolors) * 16;
+      switch (image->pixelFormat()) {
+        case IMAGE_RGB: put_pixel(image, x, y, rgba(v, v, 255-v, (v > 0 ? 255: 0))); break;
+        case IMAGE_GRAYSCALE: put_pixel(image, x, y, graya(v, (v > 0 ? 255: 0))); break;
+        case IMAGE_INDEXED: put_pixel(image, x, y, v); break;
+      }
+    }
+}
+
+} // anonymous namespace
+
+TEST(FloodFill, SimpleRect)
+{
+  std::unique_ptr<Image> img(Image::create(IMAGE_INDEXED, 8, 8));
+  clear_image(img.get(), 0);
+  draw_rect(img.get(), 1, 1, 6, 6, 1);
+
+  Filled filled = floodfill_bitmap(img.get(), nullptr, 3, 3, img->bounds(),
+                                   0, true, false);
+  EXPECT_EQ(4, filled.hlines);
+  for (int y=0; y<8; ++y)
+    for (int x=0; x<8; ++x)
+      EXPECT_EQ((x >= 2 && x <= 5 && y >= 2 && y <= 5 ? 1: 0),
+                get_pixel(filled.image.get(), x, y)) << x << "," << y;
+
+  // Outside, the rectangle border stops the fill
+  filled = floodfill_bitmap(img.get(), nullptr, 0, 0, img->bounds(),
+                            0, true, false);
+  EXPECT_EQ(0, get_pixel(filled.image.get(), 3, 3));
+  EXPECT_EQ(1, get_pixel(filled.image.get(), 7, 7));
+}
+
+TEST(FloodFill, CompareWithNaive)
+{
+  std::srand(1);
+  const PixelFormat formats[] = { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED };
+  for (PixelFormat format : formats) {
+    for (int w : { 1, 15, 64, 67, 130 }) {
+      const int h = 37;
+      std::unique_ptr<Image> img(Image::create(format, w, h));
+      random_image(img.get(), 3);
+
+      Mask mask;
+      mask.add(gfx::Rect(w/4, 3, w/2+1, h-6));
+      mask.subtract(gfx::Rect(w/3, h/2, 2, 2));
+
+      for (int contiguous=0; contiguous<2; ++contiguous)
+        for (int eight=0; eight<2; ++eight)
+          for (int tolerance : { 0, 16 })
+            for (const Mask* m : { (const Mask*)nullptr, (const Mask*)&mask }) {
+              const int x = w/2, y = h/2+3;
+              const gfx::Rect bounds(0, 1, w, h-1);
+              Filled filled = floodfill_bitmap(img.get(), m, x, y, bounds,
+                                               tolerance, contiguous, eight);
+              std::unique_ptr<Image> expected =
+                naive_floodfill(img.get(), m, x, y, bounds,
+                                tolerance, contiguous, eight);
+              for (int v=0; v<h; ++v)
+                for (int u=0; u<w; ++u)
+                  ASSERT_EQ(get_pixel(expected.get(), u, v),
+                            get_pixel(filled.image.get(), u, v))
+                    << "format=" << format << " w=" << w
+                    << " contiguous=" << contiguous << " eight=" << eight
+                    << " tolerance=" << tolerance << " mask=" << (m ? 1: 0)
+                    << " pixel=" << u << "," << v;
+            }
+    }
+  }
+}
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2021 Igara Studio S.A.
+// Copyright (c) 2021-2022 Igara Studio S.A.
 // Copyright (c) 2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -15,13 +15,206 @@
 #include "doc/mask.h"
 #include "doc/primitives.h"
 
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <vector>
 
 namespace doc {
 namespace algorithm {
 
-// TODO create morphological operators/functions in "doc" namespace
-// TODO the impl is not optimal, but is good enough as a first version
+namespace {
+
+const int kNoDistance = std::numeric_limits<int>::max();
+
+inline int get_bit(const Image* bitmap, const int x, const int y)
+{
+  if (x < 0 || y < 0 || x >= bitmap->width() || y >= bitmap->height())
+    return 0;
+  const uint8_t* row = bitmap->getPixelAddress(0, y);
+  return (row[x >> 3] >> (x & 7)) & 1;
+}
+
+// Table with the horizontal distance from each pixel to the nearest
+// pixel of the given color in the same row (pixels outside the
+// bitmap are 0). Rows of the table go from y0 to y1 (exclusive) and
+// columns from x0 to x1 (exclusive).
+class RowDistances {
+public:
+  RowDistances(const Image* bitmap, const int color,
+               const int x0, const int y0,
+               const int x1, const int y1)
+    : m_x0(x0), m_y0(y0), m_w(x1-x0), m_h(y1-y0)
+    , m_dist(std::size_t(m_w)*m_h) {
+    for (int y=y0; y<y1; ++y) {
+      int* dist = &m_dist[std::size_t(y-y0)*m_w];
+
+      int last = kNoDistance;
+      for (int x=x0; x<x1; ++x) {
+        if (get_bit(bitmap, x, y) == color)
+          last = x;
+        dist[x-x0] = (last == kNoDistance ? kNoDistance: x-last);
+      }
+      last = kNoDistance;
+      for (int x=x1-1; x>=x0; --x) {
+        if (get_bit(bitmap, x, y) == color)
+          last = x;
+        if (last != kNoDistance)
+          dist[x-x0] = std::min(dist[x-x0], last-x);
+      }
+    }
+  }
+
+  int y0() const { return m_y0; }
+  int y1() const { return m_y0+m_h; }
+
+  int operator()(const int x, const int y) const {
+    return m_dist[std::size_t(y-m_y0)*m_w + x-m_x0];
+  }
+
+private:
+  int m_x0, m_y0, m_w, m_h;
+  std::vector<int> m_dist;
+};
+
+// Shape of the brush as the half width of each row of the kernel
+// (the circle brush is the same ellipse used in the old kernel
+// image, which is not exactly an Euclidean disc, so we keep the
+// rows to get the same results).
+struct Kernel {
+  int radius;
+  BrushType brush;
+  std::vector<int> halfWidth;   // For each row (-1 if it's empty)
+  double inner;                 // Discs with d^2 <= inner are inside the kernel
+  double outer;                 // Discs with d^2 <= outer contain the kernel
+
+  Kernel(const int radius, const BrushType brush)
+    : radius(radius), brush(brush), halfWidth(2*radius+1, radius) {
+    inner = outer = 0.0;
+    if (brush != kCircleBrushType)
+      return;
+
+    const int size = 2*radius+1;
+    std::unique_ptr<Image> kernel(Image::create(IMAGE_BITMAP, size, size));
+    clear_image(kernel.get(), 0);
+    fill_ellipse(kernel.get(), 0, 0, size-1, size-1, 0, 0, 1);
+
+    inner = double(radius+1) * (radius+1) - 1.0;
+    for (int v=0; v<size; ++v) {
+      int hw = -1;
+      for (int u=radius; u<size && kernel->getPixel(u, v); ++u)
+        hw = u-radius;
+      halfWidth[v] = hw;
+
+      const double dv2 = double(v-radius) * (v-radius);
+      inner = std::min(inner, double(hw+1) * (hw+1) + dv2 - 1.0);
+      if (hw >= 0)
+        outer = std::max(outer, double(hw) * hw + dv2);
+    }
+  }
+
+  // Returns true if there is a pixel of the distances table in the
+  // kernel area centered at x,y (rows outside the table are ignored)
+  bool hit(const RowDistances& dist, const int x, const int y) const {
+    const int v0 = std::max(-radius, dist.y0()-y);
+    const int v1 = std::min(radius, dist.y1()-1-y);
+    for (int v=v0; v<=v1; ++v) {
+      if (dist(x, y+v) <= halfWidth[v+radius])
+        return true;
+    }
+    return false;
+  }
+};
+
+// Calls func(y, hit) for each row from y0 to y1 (exclusive) of the
+// given column, where "hit" is true if there is a pixel of the
+// distances table inside the kernel area centered at x,y.
+template<typename Func>
+void for_each_hit_in_column(const RowDistances& dist,
+                            const Kernel& kernel,
+                            const int x, const int y0, const int y1,
+                            Func func)
+{
+  const int r = kernel.radius;
+
+  // Square brush: it's enough to check if a row in the [y-r,y+r]
+  // range has a pixel at horizontal distance <= r (Chebyshev
+  // distance), which is calculated with a sliding window.
+  if (kernel.brush != kCircleBrushType) {
+    auto inRange = [&dist, x, r](const int y) -> int {
+      return (y >= dist.y0() && y < dist.y1() && dist(x, y) <= r ? 1: 0);
+    };
+    int count = 0;
+    for (int y=y0-r; y<y0+r; ++y)
+      count += inRange(y);
+    for (int y=y0; y<y1; ++y) {
+      count += inRange(y+r);
+      func(y, count > 0);
+      count -= inRange(y-r);
+    }
+    return;
+  }
+
+  // Circle brush: squared Euclidean distance transform of the
+  // column (lower envelope of parabolas, Felzenszwalb & Huttenlocher
+  // 2012) using the row distances. Only pixels close to the kernel
+  // edge (between the inner and outer discs) need the exact check
+  // with the kernel rows.
+  const int n = dist.y1() - dist.y0();
+  std::vector<double> f(n);
+  std::vector<int> v(n);
+  std::vector<double> z(n+1);
+  int k = -1;
+  for (int q=0; q<n; ++q) {
+    const int d = dist(x, dist.y0()+q);
+    if (d == kNoDistance)
+      continue;
+    f[q] = double(d) * d;
+    if (k < 0) {
+      k = 0;
+      v[0] = q;
+      z[0] = -std::numeric_limits<double>::infinity();
+      z[1] = std::numeric_limits<double>::infinity();
+      continue;
+    }
+    double s;
+    while (true) {
+      s = ((f[q] + double(q)*q) - (f[v[k]] + double(v[k])*v[k])) / (2.0*q - 2.0*v[k]);
+      if (s <= z[k])
+        --k;
+      else
+        break;
+    }
+    ++k;
+    v[k] = q;
+    z[k] = s;
+    z[k+1] = std::numeric_limits<double>::infinity();
+  }
+
+  int j = 0;
+  for (int y=y0; y<y1; ++y) {
+    bool hit = false;
+    if (k >= 0) {
+      const double p = y - dist.y0();
+      while (z[j+1] < p)
+        ++j;
+      const double d2 = (p - v[j]) * (p - v[j]) + f[v[j]];
+      if (d2 <= kernel.inner)
+        hit = true;
+      else if (d2 <= kernel.outer)
+        hit = kernel.hit(dist, x, y);
+    }
+    func(y, hit);
+  }
+}
+
+} // anonymous namespace
+
+// Expand is a dilation of the selection with the brush kernel, and
+// Contract/Border use the erosion (pixels that don't have an
+// unselected pixel inside the kernel). Both are calculated with
+// distance transforms, so the time doesn't depend on the radius
+// (only pixels near the kernel edge are checked row by row).
 void modify_selection(const SelectionModifier modifier,
                       const Mask* srcMask,
                       Mask* dstMask,
@@ -34,61 +227,53 @@ void modify_selection(const SelectionModifier modifier,
     srcMask->bounds().origin() -
     dstMask->bounds().origin();
 
-  // Image bounds to clip get/put pixels
-  const gfx::Rect srcBounds = srcImage->bounds();
-
-  // Create a kernel
-  const int size = 2*radius+1;
-  std::unique_ptr<doc::Image> kernel(doc::Image::create(IMAGE_BITMAP, size, size));
-  doc::clear_image(kernel.get(), 0);
-  if (brush == doc::kCircleBrushType)
-    doc::fill_ellipse(kernel.get(), 0, 0, size-1, size-1, 0, 0, 1);
-  else
-    doc::fill_rect(kernel.get(), 0, 0, size-1, size-1, 1);
-  doc::put_pixel(kernel.get(), radius, radius, 0);
-
-  int total = 0;                // Number of 1s in the kernel image
-  for (int v=0; v<size; ++v)
-    for (int u=0; u<size; ++u)
-      total += kernel->getPixel(u, v);
-
-  for (int y=-radius; y<srcBounds.h+radius; ++y) {
-    for (int x=-radius; x<srcBounds.w+radius; ++x) {
-      doc::color_t c;
-      if (srcBounds.contains(x, y))
-        c = srcImage->getPixel(x, y);
-      else
-        c = 0;
-
-      int accum = 0;
-      for (int v=0; v<size; ++v) {
-        for (int u=0; u<size; ++u) {
-          if (kernel->getPixel(u, v)) {
-            if (srcBounds.contains(x+u-radius, y+v-radius))
-              accum += srcImage->getPixel(x-radius+u, y-radius+v);
-          }
-        }
-      }
+  const int w = srcImage->width();
+  const int h = srcImage->height();
+  const Kernel kernel(radius, brush);
 
-      switch (modifier) {
-        case SelectionModifier::Border: {
-          c = (c && accum < total) ? 1: 0;
-          break;
-        }
-        case SelectionModifier::Expand: {
-          c = (c || accum > 0) ? 1: 0;
-          break;
-        }
-        case SelectionModifier::Contract: {
-          c = (c && accum == total) ? 1: 0;
-          break;
-        }
-      }
+  // Area of the destination bitmap in source coordinates (pixels
+  // outside this area are not modified)
+  const gfx::Rect dstBounds =
+    gfx::Rect(dstImage->bounds()).offset(-offset);
+
+  if (modifier == SelectionModifier::Expand) {
+    const gfx::Rect area =
+      gfx::Rect(-radius, -radius, w+2*radius, h+2*radius) & dstBounds;
+    if (area.isEmpty())
+      return;
+
+    // The table must include all columns with selected pixels (even
+    // if they are outside the area) to get the distances to them
+    const RowDistances dist(srcImage, 1,
+                            std::min(area.x, 0), 0,
+                            std::max(area.x2(), w), h);
+    for (int x=area.x; x<area.x2(); ++x) {
+      for_each_hit_in_column(
+        dist, kernel, x, area.y, area.y2(),
+        [dstImage, offset, x](const int y, const bool hit){
+          if (hit)
+            doc::put_pixel(dstImage, offset.x+x, offset.y+y, 1);
+        });
+    }
+  }
+  else {
+    const gfx::Rect area = gfx::Rect(0, 0, w, h) & dstBounds;
+    if (area.isEmpty())
+      return;
 
-      if (c)
-        doc::put_pixel(dstImage,
-                       offset.x+x,
-                       offset.y+y, 1);
+    // Unselected pixels (the pixels outside the bitmap are
+    // unselected too, so one extra row/column at each side is
+    // enough to get the distance to them)
+    const RowDistances dist(srcImage, 0, -1, -1, w+1, h+1);
+    for (int x=area.x; x<area.x2(); ++x) {
+      for_each_hit_in_column(
+        dist, kernel, x, area.y, area.y2(),
+        [srcImage, dstImage, offset, x, modifier](const int y, const bool hit){
+          if (!get_bit(srcImage, x, y))
+            return;
+          if ((modifier == SelectionModifier::Border) == hit)
+            doc::put_pixel(dstImage, offset.x+x, offset.y+y, 1);
+        });
     }
   }
 }
@@ -0,0 +1,137 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/algorithm/modify_selection.h"
+#include "doc/image_impl.h"
+#include "doc/mask.h"
+#include "doc/primitives.h"
+
+#include <cstdlib>
+#include <memory>
+
+using namespace doc;
+using namespace doc::algorithm;
+
+// Reference implementation, checks all pixels of the kernel for each
+// pixel of the selection.
+static void modify_selection_with_kernel(const SelectionModifier modifier,
+                                         const Mask* srcMask,
+                                         Mask* dstMask,
+                                         const int radius,
+                                         const BrushType brush)
+{
+  const Image* srcImage = srcMask->bitmap();
+  Image* dstImage = dstMask->bitmap();
+  const gfx::Point offset =
+    srcMask->bounds().origin() -
+    dstMask->bounds().origin();
+  const gfx::Rect srcBounds = srcImage->bounds();
+
+  const int size = 2*radius+1;
+  std::unique_ptr<Image> kernel(Image::create(IMAGE_BITMAP, size, size));
+  clear_image(kernel.get(), 0);
+  if (brush == kCircleBrushType)
+    fill_ellipse(kernel.get(), 0, 0, size-1, size-1, 0, 0, 1);
+  else
+    fill_rect(kernel.get(), 0, 0, size-1, size-1, 1);
+  put_pixel(kernel.get(), radius, radius, 0);
+
+  int total = 0;
+  for (int v=0; v<size; ++v)
+    for (int u=0; u<size; ++u)
+      total += kernel->getPixel(u, v);
+
+  for (int y=-radius; y<srcBounds.h+radius; ++y) {
+    for (int x=-radius; x<srcBounds.w+radius; ++x) {
+      color_t c = (srcBounds.contains(x, y) ? srcImage->getPixel(x, y): 0);
+
+      int accum = 0;
+      for (int v=0; v<size; ++v)
+        for (int u=0; u<size; ++u)
+          if (kernel->getPixel(u, v) &&
+              srcBounds.contains(x+u-radius, y+v-radius))
+            accum += srcImage->getPixel(x-radius+u, y-radius+v);
+
+      switch (modifier) {
+        case SelectionModifier::Border:   c = (c && accum < total); break;
+        case SelectionModifier::Expand:   c = (c || accum > 0); break;
+        case SelectionModifier::Contract: c = (c && accum == total); break;
+      }
+      if (c)
+        put_pixel(dstImage, offset.x+x, offset.y+y, 1);
+    }
+  }
+}
+
+static void expect_same_results(const Mask& src,
+                                const gfx::Rect& dstBounds,
+                                const int radius)
+{
+  for (BrushType brush : { kCircleBrushType, kSquareBrushType }) {
+    for (SelectionModifier modifier : { SelectionModifier::Border,
+                                        SelectionModifier::Expand,
+                                        SelectionModifier::Contract }) {
+      Mask a, b;
+      a.reserve(dstBounds);
+      b.reserve(dstBounds);
+      modify_selection(modifier, &src, &a, radius, brush);
+      modify_selection_with_kernel(modifier, &src, &b, radius, brush);
+
+      const Image* ia = a.bitmap();
+      const Image* ib = b.bitmap();
+      for (int y=0; y<ia->height(); ++y)
+        for (int x=0; x<ia->width(); ++x)
+          ASSERT_EQ(get_pixel(ib, x, y), get_pixel(ia, x, y))
+            << "modifier=" << int(modifier) << " brush=" << int(brush)
+            << " radius=" << radius << " x=" << x << " y=" << y;
+    }
+  }
+}
+
+TEST(ModifySelection, Rectangle)
+{
+  Mask src;
+  src.add(gfx::Rect(10, 10, 20, 8));
+  for (int radius : { 1, 2, 5, 12 })
+    expect_same_results(src, gfx::Rect(0, 0, 48, 40), radius);
+}
+
+TEST(ModifySelection, RandomMasks)
+{
+  std::srand(1);
+  for (int i=0; i<100; ++i) {
+    const int w = 1 + (std::rand() % 30);
+    const int h = 1 + (std::rand() % 30);
+    const int radius = 1 + (std::rand() % 12);
+
+    Mask src;
+    src.add(gfx::Rect(std::rand() % 10, std::rand() % 10, w, h));
+    Image* bitmap = src.bitmap();
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        if (std::rand() % 4 == 0)
+          put_pixel(bitmap, x, y, 0);
+
+    // Destination with all the expanded area, and a smaller one (to
+    // test the clipping)
+    gfx::Rect bounds = src.bounds();
+    bounds.enlarge(radius);
+    expect_same_results(src, bounds, radius);
+    expect_same_results(src, gfx::Rect(5, 5, 15, 15), radius);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2019-2020 Igara Studio S.A.
+// Copyright (c) 2019-2022 Igara Studio S.A.
 // Copyright (c) 2001-2014 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -162,52 +162,78 @@ void algorithm::polygon(int vertices, const int* points, void* data, AlgoHLine p
     }
   }
 
-  // Scan Line Loop:
-  int y;
-  int x1, y1;
-  int x2, y2;
-  int ind1, ind2;
+  // Edges between each pair of consecutive contour points (without
+  // horizontal edges), from the top point (x1, y1) to the bottom one
+  // (x2, y2).
+  struct Edge {
+    int x1, y1, x2, y2;
+  };
+  std::vector<Edge> edges;
+  edges.reserve(pts.size());
+  for (int i=0; i < pts.size(); i++) {
+    const gfx::Point& a = pts[i == 0 ? pts.size()-1: i-1];
+    const gfx::Point& b = pts[i];
+    if (a.y < b.y)
+      edges.push_back(Edge{ a.x, a.y, b.x, b.y });
+    else if (a.y > b.y)
+      edges.push_back(Edge{ b.x, b.y, a.x, a.y });
+  }
+
+  // Edges and contour points sorted by scanline (a counting sort, so
+  // points keep their order in each scanline)
+  const int rows = ymax - ymin + 1;
+  std::vector<int> edgesBegin(rows+1, 0);
+  std::vector<int> ptsBegin(rows+1, 0);
+  for (const Edge& e : edges)
+    ++edgesBegin[e.y1 - ymin + 1];
+  for (const gfx::Point& pt : pts)
+    ++ptsBegin[pt.y - ymin + 1];
+  for (int i=0; i < rows; i++) {
+    edgesBegin[i+1] += edgesBegin[i];
+    ptsBegin[i+1] += ptsBegin[i];
+  }
+  std::vector<const Edge*> sortedEdges(edges.size());
+  std::vector<int> sortedPtsX(pts.size());
+  {
+    std::vector<int> edgesPos(edgesBegin.begin(), edgesBegin.end()-1);
+    std::vector<int> ptsPos(ptsBegin.begin(), ptsBegin.end()-1);
+    for (const Edge& e : edges)
+      sortedEdges[edgesPos[e.y1 - ymin]++] = &e;
+    for (const gfx::Point& pt : pts)
+      sortedPtsX[ptsPos[pt.y - ymin]++] = pt.x;
+  }
+
+  // Scan Line Loop: Only the active edges (the edges that cross the
+  // current scanline) are intersected with each scanline.
+  std::vector<const Edge*> activeEdges;
   int ints;
   std::vector<int> polyInts(pts.size());
-  for (y = ymin; y <= ymax; y++) {
-    ints = 0;
-    for (int i=0; i < pts.size(); i++) {
-      if (!i) {
-        ind1 = pts.size() - 1;
-        ind2 = 0;
-      }
-      else {
-        ind1 = i - 1;
-        ind2 = i;
-      }
-      y1 = pts[ind1].y;
-      y2 = pts[ind2].y;
-      if (y1 < y2) {
-        x1 = pts[ind1].x;
-        x2 = pts[ind2].x;
-      }
-      else if (y1 > y2) {
-        y2 = pts[ind1].y;
-        y1 = pts[ind2].y;
-        x2 = pts[ind1].x;
-        x1 = pts[ind2].x;
-      }
-      else
-        continue;
+  for (int y = ymin; y <= ymax; y++) {
+    const int row = y - ymin;
+    for (int i=edgesBegin[row]; i < edgesBegin[row+1]; i++)
+      activeEdges.push_back(sortedEdges[i]);
 
-      if ((y >= y1 && y < y2) ||
-          (y == ymax && y > y1 && y <= y2)) {
-        polyInts[ints] = (int) ((float)((y - y1)*(x2 - x1)) / (float)(y2 - y1) + 0.5f + (float)x1);
-        ints++;
-      }
+    // An edge intersects scanlines from y1 to y2-1 (or to y2 in the
+    // last scanline).
+    ints = 0;
+    auto end = std::remove_if(
+      activeEdges.begin(), activeEdges.end(),
+      [y, ymax](const Edge* e) {
+        return (e->y2 < y || (e->y2 == y && y != ymax));
+      });
+    activeEdges.erase(end, activeEdges.end());
+
+    for (const Edge* e : activeEdges) {
+      const int x1 = e->x1, y1 = e->y1;
+      const int x2 = e->x2, y2 = e->y2;
+      polyInts[ints] = (int) ((float)((y - y1)*(x2 - x1)) / (float)(y2 - y1) + 0.5f + (float)x1);
+      ints++;
     }
 
     std::sort(polyInts.begin(), polyInts.begin() + ints);
 
-    for (int i=0; i < pts.size(); i++) {
-      if (pts[i].y == y)
-        createUnion(polyInts, pts[i].x, ints);
-    }
+    for (int i=ptsBegin[row]; i < ptsBegin[row+1]; i++)
+      createUnion(polyInts, sortedPtsX[i], ints);
 
     for (int i=0; i < ints; i+=2)
       proc(polyInts[i], y, polyInts[i+1], data);
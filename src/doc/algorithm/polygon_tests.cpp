@@ -1,12 +1,18 @@
 // Aseprite Document Library
-// Copyright (c) 2019 Igara Studio S.A.
+// Copyright (c) 2019-2022 Igara Studio S.A.
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
 
 #include "gtest/gtest.h"
 
+#include "doc/algo.h"
 #include "doc/algorithm/polygon.h"
+#include "gfx/point.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
 
 struct scanSegment {
   int x1;
@@ -823,6 +829,99 @@ TEST(createUnion, testC10)
 }
 
 
+// Previous polygon() implementation (intersects all the edges with
+// each scanline), used to check that the results are the same
+static void add_contour_point(int x, int y, std::vector<gfx::Point>* pts)
+{
+  if (pts->empty() || pts->back() != gfx::Point(x, y))
+    pts->push_back(gfx::Point(x, y));
+}
+
+static void polygon_reference(int vertices, const int* points, void* data, doc::AlgoHLine proc)
+{
+  std::vector<gfx::Point> verts;
+  int ymin = points[1], ymax = points[1];
+  for (int i=0; i<vertices; ++i) {
+    const gfx::Point pt(points[2*i], points[2*i+1]);
+    if (!verts.empty() && verts.back() == pt)
+      continue;
+    verts.push_back(pt);
+    ymin = std::min(ymin, pt.y);
+    ymax = std::max(ymax, pt.y);
+  }
+
+  std::vector<gfx::Point> pts;
+  for (int c=0; c < verts.size(); ++c) {
+    const gfx::Point& a = verts[c];
+    const gfx::Point& b = verts[c == verts.size()-1 ? 0: c+1];
+    doc::algo_line_continuous(a.x, a.y, b.x, b.y, (void*)&pts,
+                              (doc::AlgoPixel)&add_contour_point);
+    if (c == verts.size()-1 && pts.size() > 1)
+      pts.pop_back();
+  }
+
+  std::vector<int> polyInts(pts.size());
+  for (int y = ymin; y <= ymax; y++) {
+    int ints = 0;
+    for (int i=0; i < pts.size(); i++) {
+      const int ind1 = (i == 0 ? pts.size() - 1: i - 1);
+      int x1 = pts[ind1].x, y1 = pts[ind1].y;
+      int x2 = pts[i].x, y2 = pts[i].y;
+      if (y1 > y2) {
+        std::swap(x1, x2);
+        std::swap(y1, y2);
+      }
+      else if (y1 == y2)
+        continue;
+
+      if ((y >= y1 && y < y2) ||
+          (y == ymax && y > y1 && y <= y2)) {
+        polyInts[ints] = (int) ((float)((y - y1)*(x2 - x1)) / (float)(y2 - y1) + 0.5f + (float)x1);
+        ints++;
+      }
+    }
+
+    std::sort(polyInts.begin(), polyInts.begin() + ints);
+
+    for (int i=0; i < pts.size(); i++) {
+      if (pts[i].y == y)
+        doc::algorithm::createUnion(polyInts, pts[i].x, ints);
+    }
+
+    for (int i=0; i < ints; i+=2)
+      proc(polyInts[i], y, polyInts[i+1], data);
+  }
+}
+
+static bool operator==(const scanSegment& a, const scanSegment& b)
+{
+  return (a.x1 == b.x1 && a.x2 == b.x2 && a.y == b.y);
+}
+
+TEST(Polygon, RandomPolygons)
+{
+  std::srand(1);
+  for (int i=0; i<450; ++i) {
+    // Small lassos with few points, and bigger ones with many points
+    const int n = 1 + std::rand() % (i < 400 ? 12: 200);
+    const int size = (i < 400 ? 40: 400);
+    std::vector<int> points(2*n);
+    for (int j=0; j<n; ++j) {
+      points[2*j] = std::rand() % size - 10;
+      points[2*j+1] = std::rand() % size - 10;
+    }
+
+    ScanLineResult expected, result;
+    polygon_reference(n, &points[0], &expected, captureHscanSegment);
+    doc::algorithm::polygon(n, &points[0], &result, captureHscanSegment);
+
+    ASSERT_EQ(expected.scanLines.size(), result.scanLines.size());
+    for (int j=0; j<result.scanLines.size(); ++j)
+      ASSERT_TRUE(expected.scanLines[j] == result.scanLines[j])
+        << "polygon " << i << " segment " << j;
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2019  Igara Studio S.A.
+// Copyright (c) 2019-2022  Igara Studio S.A.
 // Copyright (c) 2001-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -11,6 +11,7 @@
 
 #include "doc/algorithm/resize_image.h"
 
+#include "base/clamp.h"
 #include "doc/algorithm/rotsprite.h"
 #include "doc/image_impl.h"
 #include "doc/palette.h"
@@ -18,158 +19,281 @@
 #include "doc/rgbmap.h"
 #include "gfx/point.h"
 
+#include <algorithm>
 #include <cmath>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_RESIZE_IMAGE_SSE2 1
+  #include <emmintrin.h>
+#else
+  #define DOC_RESIZE_IMAGE_SSE2 0
+#endif
 
 namespace doc {
 namespace algorithm {
 
+// Calls func(y1, y2) for bands of rows in several threads (only
+// when there are enough pixels to compensate the cost of creating
+// threads).
+template<typename Func>
+static void process_row_bands(const int rows, const int rowPixels,
+                              int threads, Func func)
+{
+  const std::size_t kMinPixelsPerThread = 256*1024;
+  if (threads <= 0)
+    threads = std::max<int>(1, std::thread::hardware_concurrency());
+  threads =
+    int(std::min<std::size_t>(
+          std::min<std::size_t>(threads, rows),
+          std::max<std::size_t>(1, std::size_t(rows) * rowPixels / kMinPixelsPerThread)));
+
+  if (threads <= 1) {
+    func(0, rows);
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  for (int i=1; i<threads; ++i)
+    workers.emplace_back(func, rows*i/threads, rows*(i+1)/threads);
+  func(0, rows/threads);
+  for (std::thread& worker : workers)
+    worker.join();
+}
+
 template<typename ImageTraits>
-void resize_image_nearest(const Image* src, Image* dst)
+static void resize_image_nearest(const Image* src, Image* dst, const int threads)
 {
-  double x_ratio = double(src->width()) / double(dst->width());
-  double y_ratio = double(src->height()) / double(dst->height());
-  double px, py;
+  const double x_ratio = double(src->width()) / double(dst->width());
+  const double y_ratio = double(src->height()) / double(dst->height());
+
+  // Source column for each destination column
+  std::vector<int> srcX(dst->width());
+  for (int x=0; x<dst->width(); ++x)
+    srcX[x] = std::min(int(std::floor(x * x_ratio)), src->width()-1);
+
+  process_row_bands(
+    dst->height(), dst->width(), threads,
+    [src, dst, y_ratio, &srcX](const int y1, const int y2){
+      for (int y=y1; y<y2; ++y) {
+        const int py = std::min(int(std::floor(y * y_ratio)), src->height()-1);
+        auto srcAddr = (const typename ImageTraits::address_t)src->getPixelAddress(0, py);
+        auto dstAddr = (typename ImageTraits::address_t)dst->getPixelAddress(0, y);
+        for (int x=0; x<dst->width(); ++x)
+          dstAddr[x] = srcAddr[srcX[x]];
+      }
+    });
+}
+
+template<>
+void resize_image_nearest<BitmapTraits>(const Image* src, Image* dst, const int threads)
+{
+  const double x_ratio = double(src->width()) / double(dst->width());
+  const double y_ratio = double(src->height()) / double(dst->height());
 
-  LockImageBits<ImageTraits> dstBits(dst);
+  LockImageBits<BitmapTraits> dstBits(dst);
   auto dstIt = dstBits.begin();
 
   for (int y=0; y<dst->height(); ++y) {
-    py = std::floor(y * y_ratio);
+    const int py = int(std::floor(y * y_ratio));
     for (int x=0; x<dst->width(); ++x, ++dstIt) {
-      px = std::floor(x * x_ratio);
-      *dstIt = get_pixel_fast<ImageTraits>(src, int(px), int(py));
+      const int px = int(std::floor(x * x_ratio));
+      *dstIt = get_pixel_fast<BitmapTraits>(src, px, py);
     }
   }
 }
 
+// Fixed point weights for the bilinear interpolation (7 bits, so the
+// interpolation of two 8-bit values fits in a signed 16-bit integer).
+const int kBilinearBits = 7;
+const int kBilinearOne = (1 << kBilinearBits);
+
+struct BilinearCoord {
+  int i1, i2;                   // Source coordinates (i2 = i1 or i1+1)
+  int w;                        // Weight of i2 [0, kBilinearOne]
+};
+
+static void create_bilinear_coords(const int srcSize, const int dstSize,
+                                   std::vector<BilinearCoord>& coords)
+{
+  const double d = (dstSize > 1 ? double(srcSize-1) / double(dstSize-1): 0.0);
+  coords.resize(dstSize);
+  for (int i=0; i<dstSize; ++i) {
+    const double u = i * d;
+    BilinearCoord& c = coords[i];
+    c.i1 = base::clamp(int(std::floor(u)), 0, srcSize-1);
+    c.i2 = std::min(c.i1+1, srcSize-1);
+    c.w = (c.i1 == c.i2 ? 0: int((u - c.i1) * kBilinearOne + 0.5));
+  }
+}
+
+static inline int bilinear_channel(const int c0, const int c1,
+                                   const int c2, const int c3,
+                                   const int wu, const int wv)
+{
+  const int top = c0*(kBilinearOne-wu) + c1*wu;
+  const int bottom = c2*(kBilinearOne-wu) + c3*wu;
+  return (top*(kBilinearOne-wv) + bottom*wv + (1 << (2*kBilinearBits-1))) >> (2*kBilinearBits);
+}
+
+static inline color_t bilinear_rgba(const color_t c0, const color_t c1,
+                                    const color_t c2, const color_t c3,
+                                    const int wu, const int wv)
+{
+#if DOC_RESIZE_IMAGE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i wu2 = _mm_set1_epi32((wu << 16) | (kBilinearOne-wu));
+  const __m128i wv2 = _mm_set1_epi32((wv << 16) | (kBilinearOne-wv));
+
+  // Interleave the channels of the left/right pixels as 16-bit
+  // values, so madd interpolates each channel horizontally
+  __m128i top = _mm_unpacklo_epi8(
+    _mm_unpacklo_epi8(_mm_cvtsi32_si128(int(c0)), _mm_cvtsi32_si128(int(c1))), zero);
+  __m128i bottom = _mm_unpacklo_epi8(
+    _mm_unpacklo_epi8(_mm_cvtsi32_si128(int(c2)), _mm_cvtsi32_si128(int(c3))), zero);
+  top = _mm_madd_epi16(top, wu2);
+  bottom = _mm_madd_epi16(bottom, wu2);
+
+  // Vertical interpolation
+  __m128i v = _mm_unpacklo_epi16(_mm_packs_epi32(top, top),
+                                 _mm_packs_epi32(bottom, bottom));
+  v = _mm_madd_epi16(v, wv2);
+  v = _mm_add_epi32(v, _mm_set1_epi32(1 << (2*kBilinearBits-1)));
+  v = _mm_srli_epi32(v, 2*kBilinearBits);
+  v = _mm_packs_epi32(v, v);
+  v = _mm_packus_epi16(v, v);
+  return color_t(_mm_cvtsi128_si32(v));
+#else
+  return rgba(
+    bilinear_channel(rgba_getr(c0), rgba_getr(c1), rgba_getr(c2), rgba_getr(c3), wu, wv),
+    bilinear_channel(rgba_getg(c0), rgba_getg(c1), rgba_getg(c2), rgba_getg(c3), wu, wv),
+    bilinear_channel(rgba_getb(c0), rgba_getb(c1), rgba_getb(c2), rgba_getb(c3), wu, wv),
+    bilinear_channel(rgba_geta(c0), rgba_geta(c1), rgba_geta(c2), rgba_geta(c3), wu, wv));
+#endif
+}
+
+static inline color_t bilinear_graya(const color_t c0, const color_t c1,
+                                     const color_t c2, const color_t c3,
+                                     const int wu, const int wv)
+{
+  return graya(
+    bilinear_channel(graya_getv(c0), graya_getv(c1), graya_getv(c2), graya_getv(c3), wu, wv),
+    bilinear_channel(graya_geta(c0), graya_geta(c1), graya_geta(c2), graya_geta(c3), wu, wv));
+}
+
+static void resize_image_bilinear(const Image* src, Image* dst,
+                                  const Palette* pal,
+                                  const RgbMap* rgbmap,
+                                  const color_t maskColor,
+                                  const int threads)
+{
+  std::vector<BilinearCoord> xs, ys;
+  create_bilinear_coords(src->width(), dst->width(), xs);
+  create_bilinear_coords(src->height(), dst->height(), ys);
+
+  process_row_bands(
+    dst->height(), dst->width(), threads,
+    [=, &xs, &ys](const int y1, const int y2){
+      for (int y=y1; y<y2; ++y) {
+        const BilinearCoord& cy = ys[y];
+
+        switch (dst->pixelFormat()) {
+
+          case IMAGE_RGB: {
+            auto row1 = (const RgbTraits::address_t)src->getPixelAddress(0, cy.i1);
+            auto row2 = (const RgbTraits::address_t)src->getPixelAddress(0, cy.i2);
+            auto dstAddr = (RgbTraits::address_t)dst->getPixelAddress(0, y);
+            for (const BilinearCoord& cx : xs) {
+              *dstAddr++ = bilinear_rgba(row1[cx.i1], row1[cx.i2],
+                                         row2[cx.i1], row2[cx.i2],
+                                         cx.w, cy.w);
+            }
+            break;
+          }
+
+          case IMAGE_GRAYSCALE: {
+            auto row1 = (const GrayscaleTraits::address_t)src->getPixelAddress(0, cy.i1);
+            auto row2 = (const GrayscaleTraits::address_t)src->getPixelAddress(0, cy.i2);
+            auto dstAddr = (GrayscaleTraits::address_t)dst->getPixelAddress(0, y);
+            for (const BilinearCoord& cx : xs) {
+              *dstAddr++ = bilinear_graya(row1[cx.i1], row1[cx.i2],
+                                          row2[cx.i1], row2[cx.i2],
+                                          cx.w, cy.w);
+            }
+            break;
+          }
+
+          case IMAGE_INDEXED: {
+            auto row1 = (const IndexedTraits::address_t)src->getPixelAddress(0, cy.i1);
+            auto row2 = (const IndexedTraits::address_t)src->getPixelAddress(0, cy.i2);
+            auto dstAddr = (IndexedTraits::address_t)dst->getPixelAddress(0, y);
+
+            // Convert index to RGBA values
+            auto entry = [pal, maskColor](const color_t i) -> color_t {
+              if (i == maskColor)
+                return pal->getEntry(i) & rgba_rgb_mask; // Set alpha = 0
+              else
+                return pal->getEntry(i);
+            };
+
+            for (const BilinearCoord& cx : xs) {
+              const color_t c = bilinear_rgba(entry(row1[cx.i1]), entry(row1[cx.i2]),
+                                              entry(row2[cx.i1]), entry(row2[cx.i2]),
+                                              cx.w, cy.w);
+              *dstAddr++ = rgbmap->mapColor(rgba_getr(c), rgba_getg(c),
+                                            rgba_getb(c), rgba_geta(c));
+            }
+            break;
+          }
+
+        }
+      }
+    });
+}
+
 void resize_image(const Image* src,
                   Image* dst,
                   const ResizeMethod method,
                   const Palette* pal,
                   const RgbMap* rgbmap,
-                  const color_t maskColor)
+                  const color_t maskColor,
+                  const int threads)
 {
   switch (method) {
 
-    // TODO optimize this
     case RESIZE_METHOD_NEAREST_NEIGHBOR: {
       ASSERT(src->pixelFormat() == dst->pixelFormat());
 
       switch (src->pixelFormat()) {
-        case IMAGE_RGB: resize_image_nearest<RgbTraits>(src, dst); break;
-        case IMAGE_GRAYSCALE: resize_image_nearest<GrayscaleTraits>(src, dst); break;
-        case IMAGE_INDEXED: resize_image_nearest<IndexedTraits>(src, dst); break;
-        case IMAGE_BITMAP: resize_image_nearest<BitmapTraits>(src, dst); break;
+        case IMAGE_RGB: resize_image_nearest<RgbTraits>(src, dst, threads); break;
+        case IMAGE_GRAYSCALE: resize_image_nearest<GrayscaleTraits>(src, dst, threads); break;
+        case IMAGE_INDEXED: resize_image_nearest<IndexedTraits>(src, dst, threads); break;
+        case IMAGE_BITMAP: resize_image_nearest<BitmapTraits>(src, dst, threads); break;
       }
       break;
     }
 
-    // TODO optimize this
     case RESIZE_METHOD_BILINEAR: {
-      uint32_t color[4], dst_color = 0;
-      double u, v, du, dv;
-      int u_floor, u_floor2;
-      int v_floor, v_floor2;
-      int x, y;
+      ASSERT(src->pixelFormat() == dst->pixelFormat());
 
       // We cannot do interpolations between RGB values on indexed
       // images without a palette/rgbmap.
-      if (dst->pixelFormat() == IMAGE_INDEXED &&
-          (!pal || !rgbmap)) {
+      if (dst->pixelFormat() == IMAGE_BITMAP ||
+          (dst->pixelFormat() == IMAGE_INDEXED &&
+           (!pal || !rgbmap))) {
         resize_image(
           src, dst,
           RESIZE_METHOD_NEAREST_NEIGHBOR,
-          pal, rgbmap, maskColor);
+          pal, rgbmap, maskColor, threads);
         return;
       }
 
-      u = v = 0.0;
-      du = (src->width()-1) * 1.0 / (dst->width()-1);
-      dv = (src->height()-1) * 1.0 / (dst->height()-1);
-      for (y=0; y<dst->height(); ++y) {
-        for (x=0; x<dst->width(); ++x) {
-          u_floor = (int)std::floor(u);
-          v_floor = (int)std::floor(v);
-
-          if (u_floor > src->width()-1) {
-            u_floor = src->width()-1;
-            u_floor2 = src->width()-1;
-          }
-          else if (u_floor == src->width()-1)
-            u_floor2 = u_floor;
-          else
-            u_floor2 = u_floor+1;
-
-          if (v_floor > src->height()-1) {
-            v_floor = src->height()-1;
-            v_floor2 = src->height()-1;
-          }
-          else if (v_floor == src->height()-1)
-            v_floor2 = v_floor;
-          else
-            v_floor2 = v_floor+1;
-
-          // get the four colors
-          color[0] = src->getPixel(u_floor,  v_floor);
-          color[1] = src->getPixel(u_floor2, v_floor);
-          color[2] = src->getPixel(u_floor,  v_floor2);
-          color[3] = src->getPixel(u_floor2, v_floor2);
-
-          // calculate the interpolated color
-          double u1 = u - u_floor;
-          double v1 = v - v_floor;
-          double u2 = 1 - u1;
-          double v2 = 1 - v1;
-
-          switch (dst->pixelFormat()) {
-            case IMAGE_RGB: {
-              int r = int((rgba_getr(color[0])*u2 + rgba_getr(color[1])*u1)*v2 +
-                          (rgba_getr(color[2])*u2 + rgba_getr(color[3])*u1)*v1);
-              int g = int((rgba_getg(color[0])*u2 + rgba_getg(color[1])*u1)*v2 +
-                          (rgba_getg(color[2])*u2 + rgba_getg(color[3])*u1)*v1);
-              int b = int((rgba_getb(color[0])*u2 + rgba_getb(color[1])*u1)*v2 +
-                          (rgba_getb(color[2])*u2 + rgba_getb(color[3])*u1)*v1);
-              int a = int((rgba_geta(color[0])*u2 + rgba_geta(color[1])*u1)*v2 +
-                          (rgba_geta(color[2])*u2 + rgba_geta(color[3])*u1)*v1);
-              dst_color = rgba(r, g, b, a);
-              break;
-            }
-            case IMAGE_GRAYSCALE: {
-              int v = int((graya_getv(color[0])*u2 + graya_getv(color[1])*u1)*v2 +
-                          (graya_getv(color[2])*u2 + graya_getv(color[3])*u1)*v1);
-              int a = int((graya_geta(color[0])*u2 + graya_geta(color[1])*u1)*v2 +
-                          (graya_geta(color[2])*u2 + graya_geta(color[3])*u1)*v1);
-              dst_color = graya(v, a);
-              break;
-            }
-            case IMAGE_INDEXED: {
-              // Convert index to RGBA values
-              for (int i=0; i<4; ++i) {
-                if (color[i] == maskColor)
-                  color[i] = pal->getEntry(color[i]) & rgba_rgb_mask; // Set alpha = 0
-                else
-                  color[i] = pal->getEntry(color[i]);
-              }
-
-              int r = int((rgba_getr(color[0])*u2 + rgba_getr(color[1])*u1)*v2 +
-                          (rgba_getr(color[2])*u2 + rgba_getr(color[3])*u1)*v1);
-              int g = int((rgba_getg(color[0])*u2 + rgba_getg(color[1])*u1)*v2 +
-                          (rgba_getg(color[2])*u2 + rgba_getg(color[3])*u1)*v1);
-              int b = int((rgba_getb(color[0])*u2 + rgba_getb(color[1])*u1)*v2 +
-                          (rgba_getb(color[2])*u2 + rgba_getb(color[3])*u1)*v1);
-              int a = int((rgba_geta(color[0])*u2 + rgba_geta(color[1])*u1)*v2 +
-                          (rgba_geta(color[2])*u2 + rgba_geta(color[3])*u1)*v1);
-              dst_color = rgbmap->mapColor(r, g, b, a);
-              break;
-            }
-          }
+      // The RgbMap cannot generate entries from several threads
+      if (dst->pixelFormat() == IMAGE_INDEXED && threads != 1)
+        rgbmap->generatePendingEntries();
 
-          dst->putPixel(x, y, dst_color);
-          u += du;
-        }
-        u = 0.0;
-        v += dv;
-      }
+      resize_image_bilinear(src, dst, pal, rgbmap, maskColor, threads);
       break;
     }
 
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2019  Igara Studio S.A.
+// Copyright (c) 2019-2022  Igara Studio S.A.
 // Copyright (c) 2001-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -30,12 +30,18 @@ namespace doc {
     // Warning: If you are using the RESIZE_METHOD_BILINEAR, it is
     // recommended to use 'fixup_image_transparent_colors' function
     // over the source image 'src' BEFORE using this routine.
+    //
+    // The nearest-neighbor and bilinear methods process bands of
+    // rows in the given number of threads (0 means one thread for
+    // each CPU core, only for big images). Use threads=1 if you are
+    // already resizing several images in parallel.
     void resize_image(const Image* src,
                       Image* dst,
                       const ResizeMethod method,
                       const Palette* palette,
                       const RgbMap* rgbmap,
-                      const color_t maskColor);
+                      const color_t maskColor,
+                      const int threads = 0);
 
     // It does not modify the image to the human eye, but internally
     // tries to fixup all colors that are completely transparent
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2020  Igara Studio S.A.
+// Copyright (c) 2020-2022  Igara Studio S.A.
 // Copyright (c) 2001-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -10,6 +10,8 @@
 #endif
 
 #include "doc/algorithm/rotate.h"
+#include "doc/algorithm/rotsprite.h"
+#include "doc/cancel_io.h"
 #include "doc/image_impl.h"
 #include "doc/primitives.h"
 
@@ -166,9 +168,11 @@ static void image_scale2x(Image* dst, const Image* src, int src_w, int src_h)
 
 void rotsprite_image(Image* bmp, const Image* spr, const Image* mask,
   int x1, int y1, int x2, int y2,
-  int x3, int y3, int x4, int y4)
+  int x3, int y3, int x4, int y4,
+  CancelIO* cancel)
 {
-  static ImageBufferPtr buf[3]; // TODO non-thread safe
+  // One set of buffers for each thread
+  static thread_local ImageBufferPtr buf[3];
 
   for (int i=0; i<3; ++i)
     if (!buf[i])
@@ -200,6 +204,9 @@ void rotsprite_image(Image* bmp, const Image* spr, const Image* mask,
   spr_copy->copy(spr, gfx::Clip(spr->bounds()));
 
   for (int i=0; i<3; ++i) {
+    if (cancel && cancel->isCanceled())
+      return;
+
     // clear_image(tmp_copy, maskColor);
     image_scale2x(tmp_copy.get(), spr_copy.get(), spr->width()*(1<<i), spr->height()*(1<<i));
     spr_copy->copy(tmp_copy.get(), gfx::Clip(tmp_copy->bounds()));
@@ -214,6 +221,9 @@ void rotsprite_image(Image* bmp, const Image* spr, const Image* mask,
                 0, 0, mask->width(), mask->height());
   }
 
+  if (cancel && cancel->isCanceled())
+    return;
+
   clear_image(bmp_copy.get(), maskColor);
   scale_image(bmp_copy.get(), bmp,
               0, 0, bmp_copy->width(), bmp_copy->height(),
@@ -224,6 +234,9 @@ void rotsprite_image(Image* bmp, const Image* spr, const Image* mask,
     (x1-xmin)*scale, (y1-ymin)*scale, (x2-xmin)*scale, (y2-ymin)*scale,
     (x3-xmin)*scale, (y3-ymin)*scale, (x4-xmin)*scale, (y4-ymin)*scale);
 
+  if (cancel && cancel->isCanceled())
+    return;
+
   scale_image(bmp, bmp_copy.get(),
               xmin, ymin, rot_width, rot_height,
               0, 0, bmp_copy->width(), bmp_copy->height());
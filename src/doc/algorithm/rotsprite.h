@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -9,13 +10,19 @@
 #pragma once
 
 namespace doc {
+  class CancelIO;
   class Image;
 
   namespace algorithm {
 
+    // The "cancel" object is checked between each step of the
+    // algorithm, if it's canceled, the "dst" image is left
+    // incomplete. It can be called from several threads at the same
+    // time (with different images).
     void rotsprite_image(Image* dst, const Image* src, const Image* mask,
       int x1, int y1, int x2, int y2,
-      int x3, int y3, int x4, int y4);
+      int x3, int y3, int x4, int y4,
+      CancelIO* cancel = nullptr);
 
   } // namespace algorithm
 } // namespace doc
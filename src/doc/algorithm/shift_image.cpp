@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2019-2020 Igara Studio S.A.
+// Copyright (c) 2019-2022 Igara Studio S.A.
 // Copyright (c) 2001-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -14,19 +14,61 @@
 #include "base/pi.h"
 #include "gfx/rect.h"
 #include "doc/algorithm/shrink_bounds.h"
+#include "doc/bitmap_rows.h"
 #include "doc/cel.h"
 #include "doc/image.h"
+#include "doc/image_impl.h"
 #include "doc/mask.h"
 #include "doc/primitives.h"
 
+#include <algorithm>
 #include <vector>
 
 namespace doc {
 namespace algorithm {
 
+namespace {
+
+// Copies the rows of "src" in "dst", moving each row "dy" pixels
+// down and rotating its pixels "dx" pixels to the right (wrapping
+// around the image edges). dx/dy must be in [0, w) and [0, h).
+template<typename ImageTraits>
+void shift_rows_templ(const Image* src, Image* dst, const int dx, const int dy)
+{
+  const int w = src->width();
+  const int h = src->height();
+  for (int y=0; y<h; ++y) {
+    auto s = (typename ImageTraits::const_address_t)src->getPixelAddress(0, y);
+    auto d = (typename ImageTraits::address_t)dst->getPixelAddress(0, (y+dy) % h);
+    std::copy(s, s+w-dx, d+dx);
+    std::copy(s+w-dx, s+w, d);
+  }
+}
+
+template<>
+void shift_rows_templ<BitmapTraits>(const Image* src, Image* dst, const int dx, const int dy)
+{
+  const int w = src->width();
+  const int h = src->height();
+  for (int y=0; y<h; ++y) {
+    const uint8_t* s = src->getPixelAddress(0, y);
+    uint8_t* d = dst->getPixelAddress(0, (y+dy) % h);
+    for (int x=0; x<w; ) {
+      const int u = (x-dx+w) % w;
+      const int n = std::min(kBitmapChunkPixels, std::min(w-x, w-u));
+      write_bitmap_chunk(d, x, n, read_bitmap_chunk(s, u, n));
+      x += n;
+    }
+  }
+}
+
+} // anonymous namespace
+
 void shift_image(Image* image, int dx, int dy, double angle)
 {
   gfx::Rect bounds(image->bounds());
+  if (bounds.isEmpty())
+    return;
   if (cos(angle) < -sqrt(2)/2) {
     dx = -dx;
     dy = -dy;
@@ -48,13 +90,16 @@ void shift_image(Image* image, int dx, int dy, double angle)
   ImageRef crop(crop_image(image, bounds.x, bounds.y, bounds.w, bounds.h,
                            image->maskColor()));
 
-  for (int y=0; y<bounds.h; ++y) {
-    for (int x=0; x<bounds.w; ++x) {
-        put_pixel(image,
-                  (bounds.w + dx + x) % bounds.w,
-                  (bounds.h + dy + y) % bounds.h,
-                  get_pixel(crop.get(), x, y));
-    }
+  // Each row is copied in two parts: the source pixels [0, w-dx) go
+  // to [dx, w), and [w-dx, w) go to [0, dx).
+  dx = ((dx % bounds.w) + bounds.w) % bounds.w;
+  dy = ((dy % bounds.h) + bounds.h) % bounds.h;
+
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:       shift_rows_templ<RgbTraits>(crop.get(), image, dx, dy); break;
+    case IMAGE_GRAYSCALE: shift_rows_templ<GrayscaleTraits>(crop.get(), image, dx, dy); break;
+    case IMAGE_INDEXED:   shift_rows_templ<IndexedTraits>(crop.get(), image, dx, dy); break;
+    case IMAGE_BITMAP:    shift_rows_templ<BitmapTraits>(crop.get(), image, dx, dy); break;
   }
 }
 
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2019 Igara Studio S.A.
+// Copyright (c) 2019-2022 Igara Studio S.A.
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -12,6 +12,7 @@
 
 #include "doc/color.h"
 #include "doc/image.h"
+#include "doc/primitives.h"
 
 #include <benchmark/benchmark.h>
 #include <memory>
@@ -31,6 +32,41 @@ void BM_ShrinkBounds(benchmark::State& state) {
   }
 }
 
+// Pixels in a diagonal line, so the left/right sides of the bounds
+// must be searched in almost all rows.
+void BM_ShrinkBoundsDiagonal(benchmark::State& state) {
+  const PixelFormat pixelFormat = (PixelFormat)state.range(0);
+  const int w = state.range(1);
+  const int h = state.range(2);
+
+  std::unique_ptr<Image> img(Image::create(pixelFormat, w, h));
+  clear_image(img.get(), 0);
+  for (int i=w/4; i<3*w/4 && i<h; ++i)
+    img->putPixel(i, i, rgba(1, 2, 3, 4));
+  gfx::Rect rc;
+  while (state.KeepRunning()) {
+    doc::algorithm::shrink_bounds(img.get(), rc, 0);
+  }
+}
+
+// Opaque image with an opaque reference color (e.g. trimming a
+// sprite with a background color), all channels must be compared.
+void BM_ShrinkBoundsOpaque(benchmark::State& state) {
+  const PixelFormat pixelFormat = (PixelFormat)state.range(0);
+  const int w = state.range(1);
+  const int h = state.range(2);
+  const color_t bg = (pixelFormat == IMAGE_RGB ? rgba(255, 255, 255, 255):
+                      pixelFormat == IMAGE_GRAYSCALE ? graya(255, 255): 1);
+
+  std::unique_ptr<Image> img(Image::create(pixelFormat, w, h));
+  clear_image(img.get(), bg);
+  img->putPixel(w/2, h/2, 0);
+  gfx::Rect rc;
+  while (state.KeepRunning()) {
+    doc::algorithm::shrink_bounds(img.get(), rc, bg);
+  }
+}
+
 #define DEFARGS(MODE)                      \
   ->Args({ MODE, 100, 100 })               \
   ->Args({ MODE, 200, 200 })               \
@@ -56,4 +92,18 @@ BENCHMARK(BM_ShrinkBounds)
   ->Unit(benchmark::kMicrosecond)
   ->UseRealTime();
 
+BENCHMARK(BM_ShrinkBoundsDiagonal)
+  DEFARGS(IMAGE_RGB)
+  DEFARGS(IMAGE_GRAYSCALE)
+  DEFARGS(IMAGE_INDEXED)
+  ->Unit(benchmark::kMicrosecond)
+  ->UseRealTime();
+
+BENCHMARK(BM_ShrinkBoundsOpaque)
+  DEFARGS(IMAGE_RGB)
+  DEFARGS(IMAGE_GRAYSCALE)
+  DEFARGS(IMAGE_INDEXED)
+  ->Unit(benchmark::kMicrosecond)
+  ->UseRealTime();
+
 BENCHMARK_MAIN();
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2019 Igara Studio S.A.
+// Copyright (c) 2019-2022 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -15,141 +15,195 @@
 #include "doc/image_impl.h"
 #include "doc/primitives_fast.h"
 
-#include <thread>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_SHRINK_BOUNDS_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
 
 namespace doc {
 namespace algorithm {
 
 namespace {
 
+// Pixels equal to "refpixel" are the ones where (pixel & mask) is
+// equal to (refpixel & mask). For RGB/grayscale images all
+// transparent pixels are equal (only the alpha channel is compared
+// if refpixel is transparent).
 template<typename ImageTraits>
-bool is_same_pixel(color_t pixel1, color_t pixel2)
+typename ImageTraits::pixel_t same_pixel_mask(const color_t refpixel)
 {
-  static_assert(false && sizeof(ImageTraits), "No is_same_pixel impl");
-  return false;
+  static_assert(false && sizeof(ImageTraits), "No same_pixel_mask impl");
+  return 0;
 }
 
 template<>
-bool is_same_pixel<RgbTraits>(color_t pixel1, color_t pixel2)
+RgbTraits::pixel_t same_pixel_mask<RgbTraits>(const color_t refpixel)
 {
-  return (rgba_geta(pixel1) == 0 && rgba_geta(pixel2) == 0) || (pixel1 == pixel2);
+  return (rgba_geta(refpixel) == 0 ? rgba_a_mask: 0xffffffff);
 }
 
 template<>
-bool is_same_pixel<GrayscaleTraits>(color_t pixel1, color_t pixel2)
+GrayscaleTraits::pixel_t same_pixel_mask<GrayscaleTraits>(const color_t refpixel)
 {
-  return (graya_geta(pixel1) == 0 && graya_geta(pixel2) == 0) || (pixel1 == pixel2);
+  return (graya_geta(refpixel) == 0 ? graya_a_mask: 0xffff);
 }
 
 template<>
-bool is_same_pixel<IndexedTraits>(color_t pixel1, color_t pixel2)
+IndexedTraits::pixel_t same_pixel_mask<IndexedTraits>(const color_t refpixel)
+{
+  return 0xff;
+}
+
+#if DOC_SHRINK_BOUNDS_SSE2
+
+inline __m128i broadcast_pixel(const uint32_t pixel) { return _mm_set1_epi32(int(pixel)); }
+inline __m128i broadcast_pixel(const uint16_t pixel) { return _mm_set1_epi16(short(pixel)); }
+inline __m128i broadcast_pixel(const uint8_t pixel) { return _mm_set1_epi8(char(pixel)); }
+
+// Returns a 16-bit mask with one bit for each byte of the 16 bytes
+// at "ptr" that is different from the reference pixel.
+inline int diff_bytes(const void* ptr, const __m128i& mask, const __m128i& value)
 {
-  return pixel1 == pixel2;
+  const __m128i px = _mm_loadu_si128((const __m128i*)ptr);
+  return ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(px, mask), value)) & 0xffff;
 }
 
+inline int lowest_bit(const int bits) {
+  ASSERT(bits != 0);
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward(&i, bits);
+  return int(i);
+#else
+  return __builtin_ctz(bits);
+#endif
+}
+
+inline int highest_bit(const int bits) {
+  ASSERT(bits != 0);
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanReverse(&i, bits);
+  return int(i);
+#else
+  return 31 - __builtin_clz(bits);
+#endif
+}
+
+#endif
+
+// Returns the index of the first pixel in [from, to) that is
+// different from the reference pixel, or "to" if all pixels are
+// equal.
 template<typename ImageTraits>
-bool shrink_bounds_left_templ(const Image* image, gfx::Rect& bounds, color_t refpixel, int rowSize)
+int find_first_diff(typename ImageTraits::const_address_t ptr,
+                    int from, const int to,
+                    const typename ImageTraits::pixel_t mask,
+                    const typename ImageTraits::pixel_t value)
 {
-  int u, v;
-  // Shrink left side
-  for (u=bounds.x; u<bounds.x2(); ++u) {
-    auto ptr = get_pixel_address_fast<ImageTraits>(image, u, v=bounds.y);
-    for (; v<bounds.y2(); ++v, ptr+=rowSize) {
-      ASSERT(ptr == get_pixel_address_fast<ImageTraits>(image, u, v));
-      if (!is_same_pixel<ImageTraits>(*ptr, refpixel))
-        return (!bounds.isEmpty());
-    }
-    ++bounds.x;
-    --bounds.w;
+#if DOC_SHRINK_BOUNDS_SSE2
+  const int n = 16 / sizeof(typename ImageTraits::pixel_t);
+  const __m128i mask4 = broadcast_pixel(mask);
+  const __m128i value4 = broadcast_pixel(value);
+  for (; from+n <= to; from += n) {
+    const int diff = diff_bytes(ptr+from, mask4, value4);
+    if (diff)
+      return from + lowest_bit(diff) / int(sizeof(typename ImageTraits::pixel_t));
   }
-  return (!bounds.isEmpty());
+#endif
+  for (; from<to; ++from) {
+    if ((ptr[from] & mask) != value)
+      return from;
+  }
+  return to;
 }
 
+// Returns the index of the last pixel in [from, to) that is
+// different from the reference pixel, or from-1 if all pixels are
+// equal.
 template<typename ImageTraits>
-bool shrink_bounds_right_templ(const Image* image, gfx::Rect& bounds, color_t refpixel, int rowSize)
+int find_last_diff(typename ImageTraits::const_address_t ptr,
+                   const int from, int to,
+                   const typename ImageTraits::pixel_t mask,
+                   const typename ImageTraits::pixel_t value)
 {
-  int u, v;
-  // Shrink right side
-  for (u=bounds.x2()-1; u>=bounds.x; --u) {
-    auto ptr = get_pixel_address_fast<ImageTraits>(image, u, v=bounds.y);
-    for (; v<bounds.y2(); ++v, ptr+=rowSize) {
-      ASSERT(ptr == get_pixel_address_fast<ImageTraits>(image, u, v));
-      if (!is_same_pixel<ImageTraits>(*ptr, refpixel))
-        return (!bounds.isEmpty());
-    }
-    --bounds.w;
+#if DOC_SHRINK_BOUNDS_SSE2
+  const int n = 16 / sizeof(typename ImageTraits::pixel_t);
+  const __m128i mask4 = broadcast_pixel(mask);
+  const __m128i value4 = broadcast_pixel(value);
+  for (; to-n >= from; to -= n) {
+    const int diff = diff_bytes(ptr+to-n, mask4, value4);
+    if (diff)
+      return to-n + highest_bit(diff) / int(sizeof(typename ImageTraits::pixel_t));
   }
-  return (!bounds.isEmpty());
+#endif
+  for (--to; to>=from; --to) {
+    if ((ptr[to] & mask) != value)
+      return to;
+  }
+  return from-1;
 }
 
+// Rows are scanned sequentially (instead of scanning columns for left
+// and right sides) so we read memory in order, and the rows that are
+// completely equal to "refpixel" (e.g. the transparent areas of a
+// mostly empty layer) are skipped as a whole. Pixels are compared
+// 16 bytes at a time with SSE2.
 template<typename ImageTraits>
-bool shrink_bounds_top_templ(const Image* image, gfx::Rect& bounds, color_t refpixel)
+bool shrink_bounds_templ(const Image* image, gfx::Rect& bounds, color_t refpixel)
 {
-  int u, v;
+  using pixel_t = typename ImageTraits::pixel_t;
+  const pixel_t mask = same_pixel_mask<ImageTraits>(refpixel);
+  const pixel_t value = (pixel_t(refpixel) & mask);
+
+  auto is_same_row = [&](const int v) -> bool {
+    auto ptr = get_pixel_address_fast<ImageTraits>(image, 0, v);
+    return (find_first_diff<ImageTraits>(ptr, bounds.x, bounds.x2(),
+                                         mask, value) == bounds.x2());
+  };
+
   // Shrink top side
-  for (v=bounds.y; v<bounds.y2(); ++v) {
-    auto ptr = get_pixel_address_fast<ImageTraits>(image, u=bounds.x, v);
-    for (; u<bounds.x2(); ++u, ++ptr) {
-      ASSERT(ptr == get_pixel_address_fast<ImageTraits>(image, u, v));
-      if (!is_same_pixel<ImageTraits>(*ptr, refpixel))
-        return (!bounds.isEmpty());
-    }
+  while (!bounds.isEmpty() && is_same_row(bounds.y)) {
     ++bounds.y;
     --bounds.h;
   }
-  return (!bounds.isEmpty());
-}
 
-template<typename ImageTraits>
-bool shrink_bounds_bottom_templ(const Image* image, gfx::Rect& bounds, color_t refpixel)
-{
-  int u, v;
   // Shrink bottom side
-  for (v=bounds.y2()-1; v>=bounds.y; --v) {
-    auto ptr = get_pixel_address_fast<ImageTraits>(image, u=bounds.x, v);
-    for (; u<bounds.x2(); ++u, ++ptr) {
-      ASSERT(ptr == get_pixel_address_fast<ImageTraits>(image, u, v));
-      if (!is_same_pixel<ImageTraits>(*ptr, refpixel))
-        return (!bounds.isEmpty());
-    }
+  while (!bounds.isEmpty() && is_same_row(bounds.y2()-1)) {
     --bounds.h;
   }
-  return (!bounds.isEmpty());
-}
 
-template<typename ImageTraits>
-bool shrink_bounds_templ(const Image* image, gfx::Rect& bounds, color_t refpixel)
-{
-  // Pixels per row
-  const int rowSize = image->getRowStrideSize() / image->getRowStrideSize(1);
-  const int canvasSize = image->width()*image->height();
-  if ((std::thread::hardware_concurrency() >= 4) &&
-      ((image->pixelFormat() == IMAGE_RGB && canvasSize >= 800*800) ||
-       (image->pixelFormat() != IMAGE_RGB && canvasSize >= 500*500))) {
-    gfx::Rect
-      leftBounds(bounds), rightBounds(bounds),
-      topBounds(bounds), bottomBounds(bounds);
-    std::thread left  ([&]{ shrink_bounds_left_templ  <ImageTraits>(image, leftBounds, refpixel, rowSize); });
-    std::thread right ([&]{ shrink_bounds_right_templ <ImageTraits>(image, rightBounds, refpixel, rowSize); });
-    std::thread top   ([&]{ shrink_bounds_top_templ   <ImageTraits>(image, topBounds, refpixel); });
-    std::thread bottom([&]{ shrink_bounds_bottom_templ<ImageTraits>(image, bottomBounds, refpixel); });
-    left.join();
-    right.join();
-    top.join();
-    bottom.join();
-    bounds = leftBounds;
-    bounds &= rightBounds;
-    bounds &= topBounds;
-    bounds &= bottomBounds;
-    return !bounds.isEmpty();
-  }
-  else {
-    return
-      shrink_bounds_left_templ<ImageTraits>(image, bounds, refpixel, rowSize) &&
-      shrink_bounds_right_templ<ImageTraits>(image, bounds, refpixel, rowSize) &&
-      shrink_bounds_top_templ<ImageTraits>(image, bounds, refpixel) &&
-      shrink_bounds_bottom_templ<ImageTraits>(image, bounds, refpixel);
+  if (bounds.isEmpty())
+    return false;
+
+  // Shrink left and right sides, "left" is the first column with a
+  // different pixel and "right" is the last one + 1. We only need to
+  // look at the pixels outside the [left, right) range found in
+  // previous rows.
+  int left = bounds.x2();
+  int right = bounds.x;
+  for (int v=bounds.y; v<bounds.y2(); ++v) {
+    auto ptr = get_pixel_address_fast<ImageTraits>(image, 0, v);
+    left = find_first_diff<ImageTraits>(ptr, bounds.x, left, mask, value);
+    right = std::max(right,
+                     find_last_diff<ImageTraits>(ptr, right, bounds.x2(),
+                                                 mask, value)+1);
+    if (left == bounds.x && right == bounds.x2())
+      break;
   }
+
+  ASSERT(left < right);
+  bounds.w = right - left;
+  bounds.x = left;
+  return (!bounds.isEmpty());
 }
 
 template<typename ImageTraits>
@@ -0,0 +1,119 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/algorithm/shrink_bounds.h"
+#include "doc/image_impl.h"
+#include "doc/primitives.h"
+
+#include <cstdlib>
+#include <memory>
+
+using namespace doc;
+using namespace doc::algorithm;
+
+TEST(ShrinkBounds, EmptyImage)
+{
+  std::unique_ptr<Image> img(Image::create(IMAGE_RGB, 64, 32));
+  clear_image(img.get(), 0);
+
+  gfx::Rect bounds;
+  EXPECT_FALSE(shrink_bounds(img.get(), bounds, 0));
+  EXPECT_TRUE(bounds.isEmpty());
+
+  // Transparent pixels with a different RGB are still transparent
+  put_pixel(img.get(), 3, 4, rgba(255, 0, 0, 0));
+  EXPECT_FALSE(shrink_bounds(img.get(), bounds, 0));
+}
+
+TEST(ShrinkBounds, RandomPixels)
+{
+  std::srand(1);
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED }) {
+    for (int i=0; i<200; ++i) {
+      const int w = 1 + std::rand() % 40;
+      const int h = 1 + std::rand() % 40;
+      std::unique_ptr<Image> img(Image::create(format, w, h));
+      clear_image(img.get(), 0);
+
+      const color_t color = (format == IMAGE_RGB ? rgba(1, 0, 0, 255):
+                             format == IMAGE_GRAYSCALE ? graya(1, 255): 1);
+      gfx::Rect expected;
+      for (int j=std::rand()%4; j>0; --j) {
+        const int x = std::rand() % w;
+        const int y = std::rand() % h;
+        put_pixel(img.get(), x, y, color);
+        expected |= gfx::Rect(x, y, 1, 1);
+      }
+
+      gfx::Rect bounds;
+      EXPECT_EQ(!expected.isEmpty(), shrink_bounds(img.get(), bounds, 0));
+      if (!expected.isEmpty())
+        EXPECT_EQ(expected, bounds);
+
+      // Starting bounds
+      const gfx::Rect start(w/4, h/4, w/2+1, h/2+1);
+      gfx::Rect expected2;
+      for (int y=start.y; y<std::min(h, start.y2()); ++y)
+        for (int x=start.x; x<std::min(w, start.x2()); ++x)
+          if (get_pixel(img.get(), x, y) != 0)
+            expected2 |= gfx::Rect(x, y, 1, 1);
+
+      EXPECT_EQ(!expected2.isEmpty(), shrink_bounds(img.get(), start, bounds, 0));
+      if (!expected2.isEmpty())
+        EXPECT_EQ(expected2, bounds);
+    }
+  }
+}
+
+TEST(ShrinkBounds, OpaqueRefPixel)
+{
+  // Wide rows to compare several pixels at the same time
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED }) {
+    const color_t bg = (format == IMAGE_RGB ? rgba(255, 255, 255, 255):
+                        format == IMAGE_GRAYSCALE ? graya(255, 255): 3);
+    const color_t fg = (format == IMAGE_RGB ? rgba(255, 255, 255, 254):
+                        format == IMAGE_GRAYSCALE ? graya(254, 255): 2);
+
+    std::unique_ptr<Image> img(Image::create(format, 77, 9));
+    clear_image(img.get(), bg);
+
+    gfx::Rect bounds;
+    EXPECT_FALSE(shrink_bounds(img.get(), bounds, bg));
+
+    put_pixel(img.get(), 70, 3, fg);
+    put_pixel(img.get(), 33, 5, fg);
+    EXPECT_TRUE(shrink_bounds(img.get(), bounds, bg));
+    EXPECT_EQ(gfx::Rect(33, 3, 38, 3), bounds);
+
+    // Transparent pixels are different from an opaque refpixel
+    EXPECT_TRUE(shrink_bounds(img.get(), bounds, 0));
+    EXPECT_EQ(img->bounds(), bounds);
+  }
+}
+
+TEST(IsEmptyImage, Basic)
+{
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED, IMAGE_BITMAP }) {
+    std::unique_ptr<Image> img(Image::create(format, 33, 17));
+    clear_image(img.get(), 0);
+    EXPECT_TRUE(is_empty_image(img.get()));
+
+    put_pixel(img.get(), 32, 16, 1);
+    EXPECT_FALSE(is_empty_image(img.get()));
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,173 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_BITMAP_ROWS_H_INCLUDED
+#define DOC_BITMAP_ROWS_H_INCLUDED
+#pragma once
+
+#include "base/debug.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+namespace doc {
+
+  // Functions to process rows of IMAGE_BITMAP images several pixels
+  // at the same time. The pixel X of a row is the bit (X % 8) of the
+  // byte (X / 8) of the row, and a chunk of N pixels is returned in a
+  // uint64_t where the first pixel is the least significant bit.
+
+  // Max number of pixels in a chunk (a chunk can start in any bit of
+  // a byte, so the shifted chunk must fit in 8 bytes).
+  const int kBitmapChunkPixels = 56;
+
+  inline uint64_t bitmap_chunk_mask(const int n) {
+    ASSERT(n >= 0 && n <= kBitmapChunkPixels);
+    return (uint64_t(1) << n) - 1;
+  }
+
+  // Returns "n" pixels of the row starting from "x" (only the bytes
+  // that contain those pixels are read).
+  inline uint64_t read_bitmap_chunk(const uint8_t* row, const int x, const int n) {
+    const uint8_t* p = row + (x >> 3);
+    const int shift = (x & 7);
+    const int nbytes = (shift + n + 7) >> 3;
+    uint64_t bits = 0;
+    for (int i=0; i<nbytes; ++i)
+      bits |= uint64_t(p[i]) << (8*i);
+    return (bits >> shift) & bitmap_chunk_mask(n);
+  }
+
+  // Replaces "n" pixels of the row starting from "x" with the given
+  // chunk (other pixels of the same bytes are kept).
+  inline void write_bitmap_chunk(uint8_t* row, const int x, const int n,
+                                 const uint64_t chunk) {
+    uint8_t* p = row + (x >> 3);
+    const int shift = (x & 7);
+    const int nbytes = (shift + n + 7) >> 3;
+    const uint64_t mask = bitmap_chunk_mask(n) << shift;
+    const uint64_t bits = (chunk << shift) & mask;
+    for (int i=0; i<nbytes; ++i) {
+      const uint8_t m = uint8_t(mask >> (8*i));
+      p[i] = uint8_t((p[i] & ~m) | uint8_t(bits >> (8*i)));
+    }
+  }
+
+  inline int bitmap_chunk_lowest_bit(const uint64_t chunk) {
+    ASSERT(chunk != 0);
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward64(&i, chunk);
+    return int(i);
+#else
+    return __builtin_ctzll(chunk);
+#endif
+  }
+
+  inline int bitmap_chunk_highest_bit(const uint64_t chunk) {
+    ASSERT(chunk != 0);
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanReverse64(&i, chunk);
+    return int(i);
+#else
+    return 63 - __builtin_clzll(chunk);
+#endif
+  }
+
+  // Returns the first pixel in [x, x2) with the given value, or x2 if
+  // there is no such pixel.
+  inline int find_first_bitmap_pixel(const uint8_t* row, int x, const int x2,
+                                     const bool value) {
+    while (x < x2) {
+      const int n = std::min(kBitmapChunkPixels, x2-x);
+      uint64_t chunk = read_bitmap_chunk(row, x, n);
+      if (!value)
+        chunk = ~chunk & bitmap_chunk_mask(n);
+      if (chunk)
+        return x + bitmap_chunk_lowest_bit(chunk);
+      x += n;
+    }
+    return x2;
+  }
+
+  // Returns the last pixel in [x, x2) with the given value, or x-1 if
+  // there is no such pixel.
+  inline int find_last_bitmap_pixel(const uint8_t* row, const int x, int x2,
+                                    const bool value) {
+    while (x2 > x) {
+      const int n = std::min(kBitmapChunkPixels, x2-x);
+      uint64_t chunk = read_bitmap_chunk(row, x2-n, n);
+      if (!value)
+        chunk = ~chunk & bitmap_chunk_mask(n);
+      if (chunk)
+        return x2-n + bitmap_chunk_highest_bit(chunk);
+      x2 -= n;
+    }
+    return x-1;
+  }
+
+  // Sets all pixels in [x, x2) to the given value.
+  inline void fill_bitmap_row(uint8_t* row, int x, const int x2,
+                              const bool value) {
+    while (x < x2) {
+      const int n = std::min(kBitmapChunkPixels, x2-x);
+      write_bitmap_chunk(row, x, n, (value ? bitmap_chunk_mask(n): 0));
+      x += n;
+    }
+  }
+
+  // Reverses the order of the first "n" pixels of the chunk.
+  inline uint64_t reverse_bitmap_chunk(uint64_t chunk, const int n) {
+    ASSERT(n > 0 && n <= kBitmapChunkPixels);
+    chunk = ((chunk >> 1) & 0x5555555555555555ull) | ((chunk & 0x5555555555555555ull) << 1);
+    chunk = ((chunk >> 2) & 0x3333333333333333ull) | ((chunk & 0x3333333333333333ull) << 2);
+    chunk = ((chunk >> 4) & 0x0f0f0f0f0f0f0f0full) | ((chunk & 0x0f0f0f0f0f0f0f0full) << 4);
+    chunk = ((chunk >> 8) & 0x00ff00ff00ff00ffull) | ((chunk & 0x00ff00ff00ff00ffull) << 8);
+    chunk = ((chunk >> 16) & 0x0000ffff0000ffffull) | ((chunk & 0x0000ffff0000ffffull) << 16);
+    chunk = (chunk >> 32) | (chunk << 32);
+    return chunk >> (64-n);
+  }
+
+  // Reverses the order of the pixels in [x, x2) (swapping chunks
+  // from both ends of the range).
+  inline void reverse_bitmap_row(uint8_t* row, int x, int x2) {
+    for (int n=std::min(kBitmapChunkPixels, (x2-x)/2); n>0;
+         n=std::min(kBitmapChunkPixels, (x2-x)/2)) {
+      const uint64_t a = read_bitmap_chunk(row, x, n);
+      const uint64_t b = read_bitmap_chunk(row, x2-n, n);
+      write_bitmap_chunk(row, x, n, reverse_bitmap_chunk(b, n));
+      write_bitmap_chunk(row, x2-n, n, reverse_bitmap_chunk(a, n));
+      x += n;
+      x2 -= n;
+    }
+  }
+
+  // Replaces the "w" pixels of dst starting at "dstX" with
+  // func(dstPixels, srcPixels), where srcPixels are the pixels of
+  // src starting at "srcX" (both in chunks of the same size).
+  template<typename Func>
+  inline void combine_bitmap_rows(uint8_t* dst, int dstX,
+                                  const uint8_t* src, int srcX,
+                                  int w, Func func) {
+    while (w > 0) {
+      const int n = std::min(kBitmapChunkPixels, w);
+      const uint64_t a = read_bitmap_chunk(dst, dstX, n);
+      const uint64_t b = read_bitmap_chunk(src, srcX, n);
+      write_bitmap_chunk(dst, dstX, n, func(a, b) & bitmap_chunk_mask(n));
+      dstX += n;
+      srcX += n;
+      w -= n;
+    }
+  }
+
+} // namespace doc
+
+#endif
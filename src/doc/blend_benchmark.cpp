@@ -12,6 +12,8 @@
 
 #include <benchmark/benchmark.h>
 
+#include <vector>
+
 using namespace doc;
 
 static void CustomArguments(benchmark::internal::Benchmark* b) {
@@ -53,4 +55,59 @@ BENCHMARK_TEMPLATE(BM_Rgba, rgba_blender_hsl_saturation)->Apply(CustomArguments)
 BENCHMARK_TEMPLATE(BM_Rgba, rgba_blender_hsl_color)->Apply(CustomArguments);
 BENCHMARK_TEMPLATE(BM_Rgba, rgba_blender_hsl_luminosity)->Apply(CustomArguments);
 
+// Row benchmarks: the same blender applied pixel by pixel (scalar)
+// vs. its row version (vectorized when possible)
+
+static void RowArguments(benchmark::internal::Benchmark* b) {
+  b ->Args({ 1024, 255 })
+    ->Args({ 1024, 128 })
+    ->Args({ 4096, 255 })
+    ->Args({ 4096, 128 });
+}
+
+static void fill_row_pixels(std::vector<color_t>& dst,
+                            std::vector<color_t>& src)
+{
+  for (std::size_t i=0; i<dst.size(); ++i) {
+    dst[i] = rgba(200, 128, 64, (i & 1 ? 255: 128));
+    src[i] = rgba(32, 128, 200, (i & 2 ? 255: (i & 4 ? 128: 0)));
+  }
+}
+
+template<BlendFunc F>
+void BM_RgbaRowScalar(benchmark::State& state) {
+  const int n = state.range(0);
+  const int opacity = state.range(1);
+  std::vector<color_t> dst(n), src(n);
+  fill_row_pixels(dst, src);
+  BlendFunc func = F;
+  while (state.KeepRunning()) {
+    for (int i=0; i<n; ++i)
+      dst[i] = func(dst[i], src[i], opacity);
+    benchmark::DoNotOptimize(dst.data());
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * n);
+}
+
+template<BlendRowFunc F>
+void BM_RgbaRow(benchmark::State& state) {
+  const int n = state.range(0);
+  const int opacity = state.range(1);
+  std::vector<color_t> dst(n), src(n);
+  fill_row_pixels(dst, src);
+  BlendRowFunc func = F;
+  while (state.KeepRunning()) {
+    func(dst.data(), src.data(), n, opacity);
+    benchmark::DoNotOptimize(dst.data());
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * n);
+}
+
+BENCHMARK_TEMPLATE(BM_RgbaRowScalar, rgba_blender_normal)->Apply(RowArguments);
+BENCHMARK_TEMPLATE(BM_RgbaRow, rgba_blender_normal_row)->Apply(RowArguments);
+BENCHMARK_TEMPLATE(BM_RgbaRowScalar, rgba_blender_multiply)->Apply(RowArguments);
+BENCHMARK_TEMPLATE(BM_RgbaRow, rgba_blender_multiply_row)->Apply(RowArguments);
+BENCHMARK_TEMPLATE(BM_RgbaRowScalar, rgba_blender_screen)->Apply(RowArguments);
+BENCHMARK_TEMPLATE(BM_RgbaRow, rgba_blender_screen_row)->Apply(RowArguments);
+
 BENCHMARK_MAIN();
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2019-2020 Igara Studio S.A.
+// Copyright (c) 2019-2022 Igara Studio S.A.
 // Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -25,6 +25,12 @@
 #include <algorithm>
 #include <cmath>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_BLEND_SSE2 1
+  #include <emmintrin.h>
+#endif
+
 namespace  {
 
 #define blend_multiply(b, s, t)   (MUL_UN8((b), (s), (t)))
@@ -754,6 +760,286 @@ color_t indexed_blender_src(color_t dst, color_t src, int opacity)
   return src;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Row blenders
+
+namespace {
+
+template<BlendFunc F>
+void blend_row(color_t* dst, const color_t* src, int n, int opacity)
+{
+  for (; n > 0; --n, ++dst, ++src)
+    *dst = F(*dst, *src, opacity);
+}
+
+template<BlendFunc F>
+void blend_color_row(color_t* dst, const color_t* backdrop, color_t src, int n, int opacity)
+{
+  for (; n > 0; --n, ++dst, ++backdrop)
+    *dst = F(*backdrop, src, opacity);
+}
+
+#ifdef DOC_BLEND_SSE2
+
+// Unpacked 4 pixels, each channel in a 32-bit lane.
+struct Rgba4 {
+  __m128i r, g, b, a;
+};
+
+inline Rgba4 unpack_rgba4(const __m128i c)
+{
+  const __m128i ff = _mm_set1_epi32(0xff);
+  Rgba4 p;
+  p.r = _mm_and_si128(c, ff);
+  p.g = _mm_and_si128(_mm_srli_epi32(c, rgba_g_shift), ff);
+  p.b = _mm_and_si128(_mm_srli_epi32(c, rgba_b_shift), ff);
+  p.a = _mm_srli_epi32(c, rgba_a_shift);
+  return p;
+}
+
+inline __m128i pack_rgba4(const __m128i r, const __m128i g,
+                          const __m128i b, const __m128i a)
+{
+  return _mm_or_si128(
+    _mm_or_si128(r, _mm_slli_epi32(g, rgba_g_shift)),
+    _mm_or_si128(_mm_slli_epi32(b, rgba_b_shift),
+                 _mm_slli_epi32(a, rgba_a_shift)));
+}
+
+// Same as MUL_UN8() for 32-bit lanes with values in [0,255]. As
+// the high 16 bits of each lane are zero, a 16-bit multiplication
+// is enough (255*255 fits in an unsigned 16-bit value).
+inline __m128i mul_un8_4(const __m128i a, const __m128i b)
+{
+  __m128i t = _mm_add_epi32(_mm_mullo_epi16(a, b), _mm_set1_epi32(ONE_HALF));
+  return _mm_srli_epi32(_mm_add_epi32(_mm_srli_epi32(t, G_SHIFT), t), G_SHIFT);
+}
+
+// Bc + (Sc-Bc) * Sa / Ra truncated towards zero (like the integer
+// division in rgba_blender_normal()). The float division is exact
+// enough because the numerator is always smaller than 255*255.
+inline __m128i normal_channel4(const __m128i Bc, const __m128i Sc,
+                               const __m128 Sa, const __m128 Ra)
+{
+  __m128 d = _mm_cvtepi32_ps(_mm_sub_epi32(Sc, Bc));
+  return _mm_add_epi32(Bc, _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(d, Sa), Ra)));
+}
+
+inline __m128i select4(const __m128i mask, const __m128i a, const __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Equivalent to rgba_blender_normal() for 4 pixels, where "src" is
+// the packed version of the "S" channels.
+inline __m128i normal4(const __m128i backdrop, const Rgba4& B,
+                       const __m128i src, const Rgba4& S,
+                       const __m128i opacity)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i Sa = mul_un8_4(S.a, opacity);
+  const __m128i Ra = _mm_sub_epi32(_mm_add_epi32(Sa, B.a), mul_un8_4(B.a, Sa));
+
+  // Avoid divisions by zero in lanes that will be discarded anyway
+  const __m128 SaF = _mm_cvtepi32_ps(Sa);
+  const __m128 RaF = _mm_cvtepi32_ps(_mm_max_epi16(Ra, _mm_set1_epi32(1)));
+
+  __m128i result = pack_rgba4(normal_channel4(B.r, S.r, SaF, RaF),
+                              normal_channel4(B.g, S.g, SaF, RaF),
+                              normal_channel4(B.b, S.b, SaF, RaF),
+                              Ra);
+
+  // Transparent source, keep the backdrop
+  result = select4(_mm_cmpeq_epi32(S.a, zero), backdrop, result);
+
+  // Transparent backdrop, use the source with the final opacity
+  result = select4(
+    _mm_cmpeq_epi32(B.a, zero),
+    _mm_or_si128(_mm_and_si128(src, _mm_set1_epi32(rgba_rgb_mask)),
+                 _mm_slli_epi32(Sa, rgba_a_shift)),
+    result);
+
+  return result;
+}
+
+void rgba_blender_normal_row_sse2(color_t* dst, const color_t* src, int n, int opacity)
+{
+  const __m128i op = _mm_set1_epi32(opacity);
+  for (; n >= 4; n -= 4, dst += 4, src += 4) {
+    const __m128i s = _mm_loadu_si128((const __m128i*)src);
+    const __m128i b = _mm_loadu_si128((const __m128i*)dst);
+    _mm_storeu_si128((__m128i*)dst,
+                     normal4(b, unpack_rgba4(b), s, unpack_rgba4(s), op));
+  }
+  blend_row<rgba_blender_normal>(dst, src, n, opacity);
+}
+
+void rgba_blender_multiply_row_sse2(color_t* dst, const color_t* src, int n, int opacity)
+{
+  const __m128i op = _mm_set1_epi32(opacity);
+  for (; n >= 4; n -= 4, dst += 4, src += 4) {
+    const __m128i b = _mm_loadu_si128((const __m128i*)dst);
+    const Rgba4 B = unpack_rgba4(b);
+    Rgba4 S = unpack_rgba4(_mm_loadu_si128((const __m128i*)src));
+    S.r = mul_un8_4(B.r, S.r);
+    S.g = mul_un8_4(B.g, S.g);
+    S.b = mul_un8_4(B.b, S.b);
+    const __m128i s = pack_rgba4(S.r, S.g, S.b, S.a);
+    _mm_storeu_si128((__m128i*)dst, normal4(b, B, s, S, op));
+  }
+  blend_row<rgba_blender_multiply>(dst, src, n, opacity);
+}
+
+void rgba_blender_screen_row_sse2(color_t* dst, const color_t* src, int n, int opacity)
+{
+  const __m128i op = _mm_set1_epi32(opacity);
+  for (; n >= 4; n -= 4, dst += 4, src += 4) {
+    const __m128i b = _mm_loadu_si128((const __m128i*)dst);
+    const Rgba4 B = unpack_rgba4(b);
+    Rgba4 S = unpack_rgba4(_mm_loadu_si128((const __m128i*)src));
+    S.r = _mm_sub_epi32(_mm_add_epi32(B.r, S.r), mul_un8_4(B.r, S.r));
+    S.g = _mm_sub_epi32(_mm_add_epi32(B.g, S.g), mul_un8_4(B.g, S.g));
+    S.b = _mm_sub_epi32(_mm_add_epi32(B.b, S.b), mul_un8_4(B.b, S.b));
+    const __m128i s = pack_rgba4(S.r, S.g, S.b, S.a);
+    _mm_storeu_si128((__m128i*)dst, normal4(b, B, s, S, op));
+  }
+  blend_row<rgba_blender_screen>(dst, src, n, opacity);
+}
+
+// Same as MUL_UN8() for 32-bit lanes where "a" is in [-255,255] and
+// "b" in [0,255]. As the high 16 bits of each lane of "b" are zero,
+// _mm_madd_epi16() gives the signed product of the low 16 bits.
+inline __m128i mul_sn8_4(const __m128i a, const __m128i b)
+{
+  __m128i t = _mm_add_epi32(_mm_madd_epi16(a, b), _mm_set1_epi32(ONE_HALF));
+  return _mm_srai_epi32(_mm_add_epi32(_mm_srai_epi32(t, G_SHIFT), t), G_SHIFT);
+}
+
+void rgba_blender_normal_color_row_sse2(color_t* dst, const color_t* backdrop, color_t src, int n, int opacity)
+{
+  const __m128i s = _mm_set1_epi32(int(src));
+  const Rgba4 S = unpack_rgba4(s);
+  const __m128i op = _mm_set1_epi32(opacity);
+  for (; n >= 4; n -= 4, dst += 4, backdrop += 4) {
+    const __m128i b = _mm_loadu_si128((const __m128i*)backdrop);
+    _mm_storeu_si128((__m128i*)dst, normal4(b, unpack_rgba4(b), s, S, op));
+  }
+  blend_color_row<rgba_blender_normal>(dst, backdrop, src, n, opacity);
+}
+
+// Equivalent to rgba_blender_merge() for 4 pixels at a time
+void rgba_blender_merge_color_row_sse2(color_t* dst, const color_t* backdrop, color_t src, int n, int opacity)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i s = _mm_set1_epi32(int(src));
+  const Rgba4 S = unpack_rgba4(s);
+  const __m128i op = _mm_set1_epi32(opacity);
+  const bool transparentSrc = (rgba_geta(src) == 0);
+  for (; n >= 4; n -= 4, dst += 4, backdrop += 4) {
+    const __m128i b = _mm_loadu_si128((const __m128i*)backdrop);
+    const Rgba4 B = unpack_rgba4(b);
+
+    __m128i r, g, bl;
+    if (transparentSrc) {
+      r = B.r;
+      g = B.g;
+      bl = B.b;
+    }
+    else {
+      r = _mm_add_epi32(B.r, mul_sn8_4(_mm_sub_epi32(S.r, B.r), op));
+      g = _mm_add_epi32(B.g, mul_sn8_4(_mm_sub_epi32(S.g, B.g), op));
+      bl = _mm_add_epi32(B.b, mul_sn8_4(_mm_sub_epi32(S.b, B.b), op));
+    }
+    const __m128i a = _mm_add_epi32(B.a, mul_sn8_4(_mm_sub_epi32(S.a, B.a), op));
+
+    // Transparent backdrop, use the source color
+    __m128i result = select4(_mm_cmpeq_epi32(B.a, zero),
+                             _mm_and_si128(s, _mm_set1_epi32(rgba_rgb_mask)),
+                             pack_rgba4(r, g, bl, zero));
+
+    // Transparent result, all channels are zero
+    result = _mm_andnot_si128(_mm_cmpeq_epi32(a, zero), result);
+    _mm_storeu_si128((__m128i*)dst,
+                     _mm_or_si128(result, _mm_slli_epi32(a, rgba_a_shift)));
+  }
+  blend_color_row<rgba_blender_merge>(dst, backdrop, src, n, opacity);
+}
+
+#endif // DOC_BLEND_SSE2
+
+} // anonymous namespace
+
+void rgba_blender_normal_color_row(color_t* dst, const color_t* backdrop, color_t src, int n, int opacity)
+{
+  // An opaque color replaces the backdrop
+  int t;
+  if (MUL_UN8(rgba_geta(src), opacity, t) == 255) {
+    std::fill(dst, dst+n, src);
+    return;
+  }
+
+#ifdef DOC_BLEND_SSE2
+  rgba_blender_normal_color_row_sse2(dst, backdrop, src, n, opacity);
+#else
+  blend_color_row<rgba_blender_normal>(dst, backdrop, src, n, opacity);
+#endif
+}
+
+void rgba_blender_merge_color_row(color_t* dst, const color_t* backdrop, color_t src, int n, int opacity)
+{
+  // With full opacity the result is the source color
+  if (opacity == 255) {
+    std::fill(dst, dst+n, (rgba_geta(src) ? src: 0));
+    return;
+  }
+
+#ifdef DOC_BLEND_SSE2
+  rgba_blender_merge_color_row_sse2(dst, backdrop, src, n, opacity);
+#else
+  blend_color_row<rgba_blender_merge>(dst, backdrop, src, n, opacity);
+#endif
+}
+
+void graya_blender_normal_color_row(uint16_t* dst, const uint16_t* backdrop, color_t src, int n, int opacity)
+{
+  // An opaque color replaces the backdrop
+  int t;
+  if (MUL_UN8(graya_geta(src), opacity, t) == 255) {
+    std::fill(dst, dst+n, uint16_t(src));
+    return;
+  }
+
+  for (; n > 0; --n, ++dst, ++backdrop)
+    *dst = graya_blender_normal(*backdrop, src, opacity);
+}
+
+void rgba_blender_normal_row(color_t* dst, const color_t* src, int n, int opacity)
+{
+#ifdef DOC_BLEND_SSE2
+  rgba_blender_normal_row_sse2(dst, src, n, opacity);
+#else
+  blend_row<rgba_blender_normal>(dst, src, n, opacity);
+#endif
+}
+
+void rgba_blender_multiply_row(color_t* dst, const color_t* src, int n, int opacity)
+{
+#ifdef DOC_BLEND_SSE2
+  rgba_blender_multiply_row_sse2(dst, src, n, opacity);
+#else
+  blend_row<rgba_blender_multiply>(dst, src, n, opacity);
+#endif
+}
+
+void rgba_blender_screen_row(color_t* dst, const color_t* src, int n, int opacity)
+{
+#ifdef DOC_BLEND_SSE2
+  rgba_blender_screen_row_sse2(dst, src, n, opacity);
+#else
+  blend_row<rgba_blender_screen>(dst, src, n, opacity);
+#endif
+}
+
 //////////////////////////////////////////////////////////////////////
 // getters
 
@@ -791,6 +1077,40 @@ BlendFunc get_rgba_blender(BlendMode blendmode, const bool newBlend)
   return rgba_blender_src;
 }
 
+BlendRowFunc get_rgba_row_blender(BlendMode blendmode, const bool newBlend)
+{
+  switch (blendmode) {
+    case BlendMode::SRC:            return blend_row<rgba_blender_src>;
+    case BlendMode::MERGE:          return blend_row<rgba_blender_merge>;
+    case BlendMode::NEG_BW:         return blend_row<rgba_blender_neg_bw>;
+    case BlendMode::RED_TINT:       return blend_row<rgba_blender_red_tint>;
+    case BlendMode::BLUE_TINT:      return blend_row<rgba_blender_blue_tint>;
+    case BlendMode::DST_OVER:       return blend_row<rgba_blender_normal_dst_over>;
+
+    case BlendMode::NORMAL:         return rgba_blender_normal_row;
+    case BlendMode::MULTIPLY:       return newBlend? blend_row<rgba_blender_multiply_n>: rgba_blender_multiply_row;
+    case BlendMode::SCREEN:         return newBlend? blend_row<rgba_blender_screen_n>: rgba_blender_screen_row;
+    case BlendMode::OVERLAY:        return newBlend? blend_row<rgba_blender_overlay_n>: blend_row<rgba_blender_overlay>;
+    case BlendMode::DARKEN:         return newBlend? blend_row<rgba_blender_darken_n>: blend_row<rgba_blender_darken>;
+    case BlendMode::LIGHTEN:        return newBlend? blend_row<rgba_blender_lighten_n>: blend_row<rgba_blender_lighten>;
+    case BlendMode::COLOR_DODGE:    return newBlend? blend_row<rgba_blender_color_dodge_n>: blend_row<rgba_blender_color_dodge>;
+    case BlendMode::COLOR_BURN:     return newBlend? blend_row<rgba_blender_color_burn_n>: blend_row<rgba_blender_color_burn>;
+    case BlendMode::HARD_LIGHT:     return newBlend? blend_row<rgba_blender_hard_light_n>: blend_row<rgba_blender_hard_light>;
+    case BlendMode::SOFT_LIGHT:     return newBlend? blend_row<rgba_blender_soft_light_n>: blend_row<rgba_blender_soft_light>;
+    case BlendMode::DIFFERENCE:     return newBlend? blend_row<rgba_blender_difference_n>: blend_row<rgba_blender_difference>;
+    case BlendMode::EXCLUSION:      return newBlend? blend_row<rgba_blender_exclusion_n>: blend_row<rgba_blender_exclusion>;
+    case BlendMode::HSL_HUE:        return newBlend? blend_row<rgba_blender_hsl_hue_n>: blend_row<rgba_blender_hsl_hue>;
+    case BlendMode::HSL_SATURATION: return newBlend? blend_row<rgba_blender_hsl_saturation_n>: blend_row<rgba_blender_hsl_saturation>;
+    case BlendMode::HSL_COLOR:      return newBlend? blend_row<rgba_blender_hsl_color_n>: blend_row<rgba_blender_hsl_color>;
+    case BlendMode::HSL_LUMINOSITY: return newBlend? blend_row<rgba_blender_hsl_luminosity_n>: blend_row<rgba_blender_hsl_luminosity>;
+    case BlendMode::ADDITION:       return newBlend? blend_row<rgba_blender_addition_n>: blend_row<rgba_blender_addition>;
+    case BlendMode::SUBTRACT:       return newBlend? blend_row<rgba_blender_subtract_n>: blend_row<rgba_blender_subtract>;
+    case BlendMode::DIVIDE:         return newBlend? blend_row<rgba_blender_divide_n>: blend_row<rgba_blender_divide>;
+  }
+  ASSERT(false);
+  return blend_row<rgba_blender_src>;
+}
+
 BlendFunc get_graya_blender(BlendMode blendmode, const bool newBlend)
 {
   switch (blendmode) {
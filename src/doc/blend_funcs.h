@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -16,6 +16,9 @@ namespace doc {
 
   typedef color_t (*BlendFunc)(color_t backdrop, color_t src, int opacity);
 
+  // Blends "n" consecutive RGBA pixels: dst[i] = blend(dst[i], src[i], opacity)
+  typedef void (*BlendRowFunc)(color_t* dst, const color_t* src, int n, int opacity);
+
   color_t rgba_blender_src(color_t backdrop, color_t src, int opacity);
   color_t rgba_blender_merge(color_t backdrop, color_t src, int opacity);
   color_t rgba_blender_neg_bw(color_t backdrop, color_t src, int opacity);
@@ -42,6 +45,18 @@ namespace doc {
   color_t rgba_blender_subtract(color_t backdrop, color_t src, int opacity);
   color_t rgba_blender_divide(color_t backdrop, color_t src, int opacity);
 
+  // Row versions of the most common blenders (vectorized when possible)
+  void rgba_blender_normal_row(color_t* dst, const color_t* src, int n, int opacity);
+  void rgba_blender_multiply_row(color_t* dst, const color_t* src, int n, int opacity);
+  void rgba_blender_screen_row(color_t* dst, const color_t* src, int n, int opacity);
+
+  // Blend the same "src" color over "n" pixels of "backdrop", saving
+  // the result in "dst" (it can be equal to "backdrop"). Used to
+  // paint lines with a uniform color (e.g. from inks).
+  void rgba_blender_normal_color_row(color_t* dst, const color_t* backdrop, color_t src, int n, int opacity);
+  void rgba_blender_merge_color_row(color_t* dst, const color_t* backdrop, color_t src, int n, int opacity);
+  void graya_blender_normal_color_row(uint16_t* dst, const uint16_t* backdrop, color_t src, int n, int opacity);
+
   color_t graya_blender_src(color_t backdrop, color_t src, int opacity);
   color_t graya_blender_merge(color_t backdrop, color_t src, int opacity);
   color_t graya_blender_neg_bw(color_t backdrop, color_t src, int opacity);
@@ -65,6 +80,7 @@ namespace doc {
   color_t indexed_blender_src(color_t dst, color_t src, int opacity);
 
   BlendFunc get_rgba_blender(BlendMode blendmode, const bool newBlend);
+  BlendRowFunc get_rgba_row_blender(BlendMode blendmode, const bool newBlend);
   BlendFunc get_graya_blender(BlendMode blendmode, const bool newBlend);
   BlendFunc get_indexed_blender(BlendMode blendmode, const bool newBlend);
 
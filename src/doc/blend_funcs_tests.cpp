@@ -0,0 +1,99 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/blend_funcs.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+
+// Pixels with all combinations of special alpha values and some
+// random colors
+static std::vector<color_t> make_rgba_pixels(int n)
+{
+  const int alphas[] = { 0, 1, 127, 128, 254, 255 };
+  std::vector<color_t> pixels(n);
+  for (int i=0; i<n; ++i)
+    pixels[i] = rgba(std::rand() % 256,
+                     std::rand() % 256,
+                     std::rand() % 256,
+                     (i & 1 ? std::rand() % 256: alphas[i % 6]));
+  return pixels;
+}
+
+TEST(BlendFuncs, RgbaNormalColorRow)
+{
+  const std::vector<color_t> backdrop = make_rgba_pixels(1027);
+  for (color_t src : make_rgba_pixels(64)) {
+    for (int opacity : { 0, 1, 128, 254, 255 }) {
+      std::vector<color_t> dst(backdrop.size());
+      rgba_blender_normal_color_row(&dst[0], &backdrop[0], src,
+                                    int(dst.size()), opacity);
+      for (std::size_t i=0; i<dst.size(); ++i)
+        ASSERT_EQ(rgba_blender_normal(backdrop[i], src, opacity), dst[i])
+          << "backdrop=" << std::hex << backdrop[i] << " src=" << src
+          << std::dec << " opacity=" << opacity;
+    }
+  }
+}
+
+TEST(BlendFuncs, RgbaMergeColorRow)
+{
+  const std::vector<color_t> backdrop = make_rgba_pixels(1027);
+  for (color_t src : make_rgba_pixels(64)) {
+    for (int opacity : { 0, 1, 128, 254, 255 }) {
+      std::vector<color_t> dst(backdrop.size());
+      rgba_blender_merge_color_row(&dst[0], &backdrop[0], src,
+                                   int(dst.size()), opacity);
+      for (std::size_t i=0; i<dst.size(); ++i)
+        ASSERT_EQ(rgba_blender_merge(backdrop[i], src, opacity), dst[i])
+          << "backdrop=" << std::hex << backdrop[i] << " src=" << src
+          << std::dec << " opacity=" << opacity;
+    }
+  }
+}
+
+TEST(BlendFuncs, GrayaNormalColorRow)
+{
+  std::vector<uint16_t> backdrop(1027);
+  for (auto& c : backdrop)
+    c = graya(std::rand() % 256, std::rand() % 256);
+
+  for (color_t src : { graya(10, 0), graya(20, 128), graya(200, 255) }) {
+    for (int opacity : { 0, 128, 255 }) {
+      std::vector<uint16_t> dst(backdrop.size());
+      graya_blender_normal_color_row(&dst[0], &backdrop[0], src,
+                                     int(dst.size()), opacity);
+      for (std::size_t i=0; i<dst.size(); ++i)
+        ASSERT_EQ(graya_blender_normal(backdrop[i], src, opacity), dst[i]);
+    }
+  }
+}
+
+TEST(BlendFuncs, RgbaNormalRow)
+{
+  const std::vector<color_t> backdrop = make_rgba_pixels(1027);
+  const std::vector<color_t> src = make_rgba_pixels(1027);
+  for (int opacity : { 0, 1, 128, 254, 255 }) {
+    std::vector<color_t> dst = backdrop;
+    rgba_blender_normal_row(&dst[0], &src[0], int(dst.size()), opacity);
+    for (std::size_t i=0; i<dst.size(); ++i)
+      ASSERT_EQ(rgba_blender_normal(backdrop[i], src[i], opacity), dst[i]);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2020 Igara Studio S.A.
+// Copyright (c) 2020-2022 Igara Studio S.A.
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -11,6 +11,14 @@
 #include "doc/color.h"
 
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_COLOR_SSE2 1
+  #include <emmintrin.h>
+#endif
 
 namespace doc {
 
@@ -43,4 +51,199 @@ color_t rgba_to_graya_using_luma(const color_t c)
                rgba_geta(c));
 }
 
+void rgba_match_by_tolerance(const color_t* src,
+                             bool* matches,
+                             const int n,
+                             const color_t color,
+                             const color_t channels,
+                             const int tolerance)
+{
+  // Channels without tolerance match all values
+  if (tolerance < 0 && channels != 0) {
+    std::fill(matches, matches+n, false);
+    return;
+  }
+  const int tol = std::min(tolerance, 255);
+
+  int i = 0;
+#if DOC_COLOR_SSE2
+  // Max difference for each byte of 4 pixels (255 in the channels
+  // that are not compared)
+  const color_t tolMask = ((tol * 0x01010101u) & channels) | ~channels;
+  const __m128i tolv = _mm_set1_epi32(int(tolMask));
+  const __m128i colorv = _mm_set1_epi32(int(color));
+  const __m128i zero = _mm_setzero_si128();
+  for (; i+4<=n; i+=4) {
+    const __m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+    const __m128i diff = _mm_or_si128(_mm_subs_epu8(s, colorv),
+                                      _mm_subs_epu8(colorv, s));
+    const __m128i match = _mm_cmpeq_epi32(_mm_subs_epu8(diff, tolv), zero);
+    const int bits = _mm_movemask_ps(_mm_castsi128_ps(match));
+    matches[i  ] = (bits & 1) != 0;
+    matches[i+1] = (bits & 2) != 0;
+    matches[i+2] = (bits & 4) != 0;
+    matches[i+3] = (bits & 8) != 0;
+  }
+#endif
+
+  for (; i<n; ++i) {
+    const color_t c = src[i];
+    matches[i] =
+      (!(channels & rgba_r_mask) || std::abs(rgba_getr(c) - rgba_getr(color)) <= tol) &&
+      (!(channels & rgba_g_mask) || std::abs(rgba_getg(c) - rgba_getg(color)) <= tol) &&
+      (!(channels & rgba_b_mask) || std::abs(rgba_getb(c) - rgba_getb(color)) <= tol) &&
+      (!(channels & rgba_a_mask) || std::abs(rgba_geta(c) - rgba_geta(color)) <= tol);
+  }
+}
+
+namespace {
+
+// Calls match16(i) (which returns 16 bits, one for each pixel from
+// src[i]) for each group of 16 pixels, and match1(i) for the rest.
+template<typename Match16, typename Match1>
+void match_bits(uint8_t* bits, const int n,
+                Match16 match16, Match1 match1)
+{
+  int i = 0;
+#if DOC_COLOR_SSE2
+  for (; i+16<=n; i+=16) {
+    const int m = match16(i);
+    bits[i/8  ] = uint8_t(m);
+    bits[i/8+1] = uint8_t(m >> 8);
+  }
+#endif
+
+  std::memset(bits+i/8, 0, (n+7)/8 - i/8);
+  for (; i<n; ++i) {
+    if (match1(i))
+      bits[i/8] |= uint8_t(1 << (i & 7));
+  }
+}
+
+} // anonymous namespace
+
+void rgba_match_by_tolerance_bits(const color_t* src,
+                                  uint8_t* bits,
+                                  const int n,
+                                  const color_t color,
+                                  const color_t channels,
+                                  const int tolerance)
+{
+  if (tolerance < 0 && channels != 0) {
+    std::memset(bits, 0, (n+7)/8);
+    return;
+  }
+  const int tol = std::min(tolerance, 255);
+
+#if DOC_COLOR_SSE2
+  const color_t tolMask = ((tol * 0x01010101u) & channels) | ~channels;
+  const __m128i tolv = _mm_set1_epi32(int(tolMask));
+  const __m128i colorv = _mm_set1_epi32(int(color));
+  const __m128i zero = _mm_setzero_si128();
+  auto match4 = [&](const color_t* p) {
+    const __m128i s = _mm_loadu_si128((const __m128i*)p);
+    const __m128i diff = _mm_or_si128(_mm_subs_epu8(s, colorv),
+                                      _mm_subs_epu8(colorv, s));
+    return _mm_cmpeq_epi32(_mm_subs_epu8(diff, tolv), zero);
+  };
+  auto match16 = [&](int i) {
+    // All lanes are 0 or -1, so the saturated packs keep the results
+    return _mm_movemask_epi8(
+      _mm_packs_epi16(_mm_packs_epi32(match4(src+i), match4(src+i+4)),
+                      _mm_packs_epi32(match4(src+i+8), match4(src+i+12))));
+  };
+#else
+  auto match16 = [](int) { return 0; };
+#endif
+
+  match_bits(
+    bits, n, match16,
+    [&](int i) {
+      const color_t c = src[i];
+      return
+        (!(channels & rgba_r_mask) || std::abs(rgba_getr(c) - rgba_getr(color)) <= tol) &&
+        (!(channels & rgba_g_mask) || std::abs(rgba_getg(c) - rgba_getg(color)) <= tol) &&
+        (!(channels & rgba_b_mask) || std::abs(rgba_getb(c) - rgba_getb(color)) <= tol) &&
+        (!(channels & rgba_a_mask) || std::abs(rgba_geta(c) - rgba_geta(color)) <= tol);
+    });
+}
+
+void graya_match_by_tolerance_bits(const uint16_t* src,
+                                   uint8_t* bits,
+                                   const int n,
+                                   const color_t color,
+                                   const int tolerance)
+{
+  if (tolerance < 0) {
+    std::memset(bits, 0, (n+7)/8);
+    return;
+  }
+  const int tol = std::min(tolerance, 255);
+
+#if DOC_COLOR_SSE2
+  const __m128i tolv = _mm_set1_epi8(char(tol));
+  const __m128i colorv = _mm_set1_epi16(short(color));
+  const __m128i zero = _mm_setzero_si128();
+  auto match8 = [&](const uint16_t* p) {
+    const __m128i s = _mm_loadu_si128((const __m128i*)p);
+    const __m128i diff = _mm_or_si128(_mm_subs_epu8(s, colorv),
+                                      _mm_subs_epu8(colorv, s));
+    return _mm_cmpeq_epi16(_mm_subs_epu8(diff, tolv), zero);
+  };
+  auto match16 = [&](int i) {
+    return _mm_movemask_epi8(_mm_packs_epi16(match8(src+i), match8(src+i+8)));
+  };
+#else
+  auto match16 = [](int) { return 0; };
+#endif
+
+  match_bits(
+    bits, n, match16,
+    [&](int i) {
+      const color_t c = src[i];
+      return
+        std::abs(graya_getv(c) - graya_getv(color)) <= tol &&
+        std::abs(graya_geta(c) - graya_geta(color)) <= tol;
+    });
+}
+
+void index_match_by_tolerance_bits(const uint8_t* src,
+                                   uint8_t* bits,
+                                   const int n,
+                                   color_t index,
+                                   int tolerance)
+{
+  // Pixels are <= 255, so the index can be moved to 255 reducing the
+  // tolerance by the same amount
+  if (index > 255) {
+    tolerance -= std::min<color_t>(index-255, 256);
+    index = 255;
+  }
+  if (tolerance < 0) {
+    std::memset(bits, 0, (n+7)/8);
+    return;
+  }
+  const int tol = std::min(tolerance, 255);
+
+#if DOC_COLOR_SSE2
+  const __m128i tolv = _mm_set1_epi8(char(tol));
+  const __m128i indexv = _mm_set1_epi8(char(index));
+  const __m128i zero = _mm_setzero_si128();
+  auto match16 = [&](int i) {
+    const __m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+    const __m128i diff = _mm_or_si128(_mm_subs_epu8(s, indexv),
+                                      _mm_subs_epu8(indexv, s));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(diff, tolv), zero));
+  };
+#else
+  auto match16 = [](int) { return 0; };
+#endif
+
+  match_bits(
+    bits, n, match16,
+    [&](int i) {
+      return std::abs(int(src[i]) - int(index)) <= tol;
+    });
+}
+
 } // namespace doc
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2020 Igara Studio S.A.
+// Copyright (c) 2020-2022 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -97,6 +97,42 @@ namespace doc {
   color_t rgba_to_graya_using_hsl(const color_t c);
   color_t rgba_to_graya_using_luma(const color_t c);
 
+  //////////////////////////////////////////////////////////////////////
+  // Tolerance
+
+  // Sets matches[i] to true if each channel included in "channels"
+  // (e.g. rgba_rgb_mask) of src[i] is at most "tolerance" levels far
+  // from the same channel of "color" (a negative tolerance doesn't
+  // match any channel).
+  void rgba_match_by_tolerance(const color_t* src,
+                               bool* matches,
+                               const int n,
+                               const color_t color,
+                               const color_t channels,
+                               const int tolerance);
+
+  // Versions that set the bits of a row of an IMAGE_BITMAP image
+  // ("bits" must have (n+7)/8 bytes) instead of an array of bools.
+  // Gray and indexed pixels match if all their channels (value and
+  // alpha for gray, the index for indexed) are at most "tolerance"
+  // levels far from "color".
+  void rgba_match_by_tolerance_bits(const color_t* src,
+                                    uint8_t* bits,
+                                    const int n,
+                                    const color_t color,
+                                    const color_t channels,
+                                    const int tolerance);
+  void graya_match_by_tolerance_bits(const uint16_t* src,
+                                     uint8_t* bits,
+                                     const int n,
+                                     const color_t color,
+                                     const int tolerance);
+  void index_match_by_tolerance_bits(const uint8_t* src,
+                                     uint8_t* bits,
+                                     const int n,
+                                     const color_t index,
+                                     const int tolerance);
+
 } // namespace doc
 
 #endif
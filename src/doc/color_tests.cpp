@@ -0,0 +1,131 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/color.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+
+static bool match_channel(int a, int b, int tolerance)
+{
+  return (a >= b-tolerance && a <= b+tolerance);
+}
+
+TEST(Color, MatchByTolerance)
+{
+  const int n = 103;             // Not a multiple of 4
+  std::vector<color_t> src(n);
+  bool matches[n];
+
+  for (color_t channels : { rgba_r_mask | rgba_g_mask | rgba_b_mask | rgba_a_mask,
+                            rgba_rgb_mask,
+                            rgba_g_mask | rgba_a_mask,
+                            color_t(0) }) {
+    for (int tolerance : { -1, 0, 1, 20, 254, 255, 300 }) {
+      const color_t color = rgba(std::rand() % 256, std::rand() % 256,
+                                 std::rand() % 256, std::rand() % 256);
+      for (color_t& c : src) {
+        // Colors near "color" to get some matches
+        c = rgba(std::max(0, std::min(255, int(rgba_getr(color)) + std::rand() % 41 - 20)),
+                 std::max(0, std::min(255, int(rgba_getg(color)) + std::rand() % 41 - 20)),
+                 std::max(0, std::min(255, int(rgba_getb(color)) + std::rand() % 41 - 20)),
+                 std::rand() % 256);
+      }
+
+      rgba_match_by_tolerance(&src[0], matches, n, color, channels, tolerance);
+      for (int i=0; i<n; ++i) {
+        const color_t c = src[i];
+        const bool expected =
+          (!(channels & rgba_r_mask) || match_channel(rgba_getr(c), rgba_getr(color), tolerance)) &&
+          (!(channels & rgba_g_mask) || match_channel(rgba_getg(c), rgba_getg(color), tolerance)) &&
+          (!(channels & rgba_b_mask) || match_channel(rgba_getb(c), rgba_getb(color), tolerance)) &&
+          (!(channels & rgba_a_mask) || match_channel(rgba_geta(c), rgba_geta(color), tolerance));
+        ASSERT_EQ(expected, matches[i]);
+      }
+    }
+  }
+}
+
+static bool get_bit(const std::vector<uint8_t>& bits, int i)
+{
+  return (bits[i/8] & (1 << (i & 7))) != 0;
+}
+
+TEST(Color, MatchByToleranceBits)
+{
+  for (int n : { 1, 15, 16, 17, 103 }) {
+    const int nbytes = (n+7)/8;
+    for (int tolerance : { -1, 0, 1, 20, 254, 255, 300 }) {
+      // RGB
+      {
+        const color_t color = rgba(std::rand() % 256, std::rand() % 256,
+                                   std::rand() % 256, std::rand() % 256);
+        std::vector<color_t> src(n);
+        for (color_t& c : src)
+          c = (std::rand() % 2 ? color ^ (std::rand() % 32):
+                                 rgba(std::rand() % 256, std::rand() % 256,
+                                      std::rand() % 256, std::rand() % 256));
+
+        std::vector<uint8_t> bits(nbytes, 0xff);
+        std::vector<char> matches(n);
+        rgba_match_by_tolerance_bits(&src[0], &bits[0], n, color, rgba_rgb_mask, tolerance);
+        rgba_match_by_tolerance(&src[0], (bool*)&matches[0], n, color, rgba_rgb_mask, tolerance);
+        for (int i=0; i<n; ++i)
+          ASSERT_EQ(matches[i] != 0, get_bit(bits, i));
+        for (int i=n; i<8*nbytes; ++i)
+          ASSERT_FALSE(get_bit(bits, i));
+      }
+
+      // Grayscale
+      {
+        const color_t color = graya(std::rand() % 256, std::rand() % 256);
+        std::vector<uint16_t> src(n);
+        for (uint16_t& c : src)
+          c = graya(std::rand() % 256, std::rand() % 256);
+
+        std::vector<uint8_t> bits(nbytes, 0xff);
+        graya_match_by_tolerance_bits(&src[0], &bits[0], n, color, tolerance);
+        for (int i=0; i<n; ++i) {
+          const bool expected =
+            match_channel(graya_getv(src[i]), graya_getv(color), tolerance) &&
+            match_channel(graya_geta(src[i]), graya_geta(color), tolerance);
+          ASSERT_EQ(expected, get_bit(bits, i));
+        }
+        for (int i=n; i<8*nbytes; ++i)
+          ASSERT_FALSE(get_bit(bits, i));
+      }
+
+      // Indexed (including out of range indexes)
+      for (color_t index : { 0, 3, 128, 255, 280 }) {
+        std::vector<uint8_t> src(n);
+        for (uint8_t& c : src)
+          c = std::rand() % 256;
+
+        std::vector<uint8_t> bits(nbytes, 0xff);
+        index_match_by_tolerance_bits(&src[0], &bits[0], n, index, tolerance);
+        for (int i=0; i<n; ++i)
+          ASSERT_EQ(match_channel(src[i], int(index), tolerance), get_bit(bits, i));
+        for (int i=n; i<8*nbytes; ++i)
+          ASSERT_FALSE(get_bit(bits, i));
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
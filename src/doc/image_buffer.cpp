@@ -0,0 +1,215 @@
+// Aseprite Document Library
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/image_buffer.h"
+
+#include "base/debug.h"
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#ifdef __linux__
+  #include <sys/mman.h>
+#endif
+
+namespace doc {
+
+namespace {
+
+// Buffers smaller than this are allocated/freed directly (e.g. small
+// brush images), bigger buffers are recycled.
+constexpr std::size_t kMinPooledSize = 16*1024;
+constexpr std::size_t kMaxPooledSize = 64*1024*1024;
+
+// Max number of bytes of unused buffers kept in the pool.
+constexpr std::size_t kMaxFreeBytes = 128*1024*1024;
+
+// Bytes allocated in addition to the size class to align the buffer
+// (malloc() only guarantees 16 bytes alignment).
+constexpr std::size_t kAlignmentPadding = ImageBuffer::kAlignment;
+
+#ifdef __linux__
+// Buffers of very big canvases (which are not pooled) are mapped
+// directly to use transparent huge pages, this reduces the TLB misses
+// iterating all the rows.
+constexpr std::size_t kMinHugePagesSize = kMaxPooledSize;
+#endif
+
+// Each power of two is divided in 4 size classes, so we waste 25%
+// of memory in the worst case.
+constexpr int kStepsPerPowerOfTwo = 4;
+constexpr int kMinLog2 = 13;    // kMinPooledSize is 2^14 (first class is (2^13, 2^14])
+constexpr int kMaxLog2 = 25;    // kMaxPooledSize is 2^26
+constexpr int kNumClasses = (kMaxLog2-kMinLog2+1) * kStepsPerPowerOfTwo;
+
+// Returns the index of the size class for the given "size", and the
+// real size of the buffers of that class in "classSize". Returns -1
+// if the buffer must not be pooled.
+int size_class(const std::size_t size, std::size_t& classSize)
+{
+  if (size < kMinPooledSize || size > kMaxPooledSize) {
+    classSize = std::max<std::size_t>(1, size);
+    return -1;
+  }
+
+  // 2^log2 < size <= 2^(log2+1)
+  int log2 = kMinLog2;
+  while ((std::size_t(1) << (log2+1)) < size)
+    ++log2;
+
+  const std::size_t lower = (std::size_t(1) << log2);
+  const std::size_t step = lower / kStepsPerPowerOfTwo;
+  const std::size_t n = (size - lower + step - 1) / step; // [1, kStepsPerPowerOfTwo]
+
+  classSize = lower + n*step;
+  return (log2-kMinLog2)*kStepsPerPowerOfTwo + int(n-1);
+}
+
+uint8_t* align_buffer(uint8_t* data)
+{
+  const std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(data);
+  return data + ((ImageBuffer::kAlignment - (addr % ImageBuffer::kAlignment))
+                 % ImageBuffer::kAlignment);
+}
+
+class BufferPool {
+public:
+  // Returns a buffer of "classSize" bytes plus kAlignmentPadding
+  // bytes (use align_buffer() to get the aligned address). If
+  // "zeroFill" is true the new buffer is filled with zeros.
+  uint8_t* allocate(const int index, std::size_t classSize,
+                    const bool zeroFill) {
+    classSize += kAlignmentPadding;
+
+#ifdef __linux__
+    // Mapped memory is already filled with zeros (and aligned)
+    if (index < 0 && classSize >= kMinHugePagesSize) {
+      void* ptr = mmap(nullptr, classSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (ptr == MAP_FAILED)
+        throw std::bad_alloc();
+      madvise(ptr, classSize, MADV_HUGEPAGE);
+      return (uint8_t*)ptr;
+    }
+#endif
+
+    uint8_t* data = nullptr;
+    if (index >= 0) {
+      base::scoped_lock hold(m_mutex);
+      auto& list = m_free[index];
+      if (!list.empty()) {
+        data = list.back();
+        list.pop_back();
+        m_freeBytes -= classSize;
+      }
+    }
+
+    if (data) {
+      if (zeroFill)
+        std::memset(data, 0, classSize);
+    }
+    else {
+      // Fresh memory from calloc() can be zero pages from the OS
+      // without touching the memory.
+      data = (uint8_t*)(zeroFill ? std::calloc(1, classSize):
+                                   std::malloc(classSize));
+      if (!data)
+        throw std::bad_alloc();
+    }
+    return data;
+  }
+
+  void release(uint8_t* data, const int index, std::size_t classSize) {
+    classSize += kAlignmentPadding;
+
+#ifdef __linux__
+    if (index < 0 && classSize >= kMinHugePagesSize) {
+      munmap(data, classSize);
+      return;
+    }
+#endif
+
+    if (index >= 0) {
+      base::scoped_lock hold(m_mutex);
+      if (m_freeBytes + classSize <= kMaxFreeBytes) {
+        m_free[index].push_back(data);
+        m_freeBytes += classSize;
+        return;
+      }
+    }
+    std::free(data);
+  }
+
+private:
+  base::mutex m_mutex;
+  std::vector<uint8_t*> m_free[kNumClasses];
+  std::size_t m_freeBytes = 0;
+};
+
+BufferPool& pool()
+{
+  // We never delete the pool because static ImageBuffers could be
+  // destroyed after it.
+  static BufferPool* pool = new BufferPool;
+  return *pool;
+}
+
+} // anonymous namespace
+
+ImageBuffer::ImageBuffer(std::size_t size, const bool zeroFill)
+  : m_size(size)
+  , m_zeroFill(zeroFill)
+{
+  const int index = size_class(size, m_capacity);
+  m_alloc = pool().allocate(index, m_capacity, zeroFill);
+  m_data = align_buffer(m_alloc);
+}
+
+ImageBuffer::~ImageBuffer()
+{
+  std::size_t classSize;
+  const int index = size_class(m_capacity, classSize);
+  ASSERT(classSize == m_capacity);
+  pool().release(m_alloc, index, m_capacity);
+}
+
+void ImageBuffer::resizeIfNecessary(std::size_t size)
+{
+  if (size <= m_size)
+    return;
+
+  if (size > m_capacity) {
+    std::size_t newCapacity;
+    const int index = size_class(size, newCapacity);
+    uint8_t* newAlloc = pool().allocate(index, newCapacity, false);
+    uint8_t* newData = align_buffer(newAlloc);
+    std::memcpy(newData, m_data, m_size);
+
+    std::size_t oldClassSize;
+    const int oldIndex = size_class(m_capacity, oldClassSize);
+    pool().release(m_alloc, oldIndex, m_capacity);
+
+    m_alloc = newAlloc;
+    m_data = newData;
+    m_capacity = newCapacity;
+  }
+
+  if (m_zeroFill)
+    std::memset(m_data + m_size, 0, size - m_size);
+  m_size = size;
+}
+
+} // namespace doc
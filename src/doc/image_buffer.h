@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -9,6 +9,7 @@
 #define DOC_IMAGE_BUFFER_H_INCLUDED
 #pragma once
 
+#include "base/disable_copying.h"
 #include "base/ints.h"
 
 #include <cstddef>
@@ -17,21 +18,39 @@
 
 namespace doc {
 
+  // Memory used to store the pixels (and the table of rows) of an
+  // image. Big buffers are taken from a pool of recycled buffers
+  // grouped by size classes, so we don't need to ask the system for
+  // memory each time a temporary image is created and destroyed
+  // (e.g. in each step of the tool loop or filter preview). The
+  // buffer is aligned to kAlignment bytes (a cache line), and very
+  // big buffers can use huge pages (when the system supports them).
   class ImageBuffer {
   public:
-    ImageBuffer(std::size_t size = 1) : m_buffer(size) {
-    }
+    static constexpr std::size_t kAlignment = 64;
 
-    std::size_t size() const { return m_buffer.size(); }
-    uint8_t* buffer() { return &m_buffer[0]; }
+    // If "zeroFill" is false, the content of the buffer is
+    // undefined (it might contain data of a previously recycled
+    // buffer), so it can be used only when the caller is going to
+    // overwrite all the buffer anyway.
+    ImageBuffer(std::size_t size = 1, const bool zeroFill = true);
+    ~ImageBuffer();
 
-    void resizeIfNecessary(std::size_t size) {
-      if (size > m_buffer.size())
-        m_buffer.resize(size);
-    }
+    std::size_t size() const { return m_size; }
+    uint8_t* buffer() { return m_data; }
+
+    // Keeps the current content and fills the new bytes with zero
+    // (only if the buffer was created with zeroFill=true).
+    void resizeIfNecessary(std::size_t size);
 
   private:
-    std::vector<uint8_t> m_buffer;
+    uint8_t* m_alloc;           // Allocated memory
+    uint8_t* m_data;            // m_alloc aligned to kAlignment
+    std::size_t m_size;         // Requested size
+    std::size_t m_capacity;     // Real size of m_data
+    bool m_zeroFill;
+
+    DISABLE_COPYING(ImageBuffer);
   };
 
   typedef std::shared_ptr<ImageBuffer> ImageBufferPtr;
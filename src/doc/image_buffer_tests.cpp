@@ -0,0 +1,109 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image_buffer.h"
+#include "doc/image_impl.h"
+#include "doc/primitives.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+using namespace doc;
+
+static bool is_zero(ImageBuffer& buf)
+{
+  for (std::size_t i=0; i<buf.size(); ++i)
+    if (buf.buffer()[i] != 0)
+      return false;
+  return true;
+}
+
+TEST(ImageBuffer, RecycledBuffersAreZeroFilled)
+{
+  for (std::size_t size : { 1, 100, 16*1024, 20000, 100000, 1024*1024 }) {
+    for (int i=0; i<4; ++i) {
+      ImageBuffer buf(size);
+      ASSERT_EQ(size, buf.size());
+      EXPECT_TRUE(is_zero(buf));
+      std::memset(buf.buffer(), 0xff, size);
+    }
+  }
+}
+
+TEST(ImageBuffer, ResizeKeepsContent)
+{
+  ImageBuffer buf(20000);
+  for (std::size_t i=0; i<buf.size(); ++i)
+    buf.buffer()[i] = uint8_t(i);
+
+  buf.resizeIfNecessary(10);
+  EXPECT_EQ(20000, buf.size());
+
+  buf.resizeIfNecessary(300000);
+  EXPECT_EQ(300000, buf.size());
+  for (std::size_t i=0; i<20000; ++i)
+    ASSERT_EQ(uint8_t(i), buf.buffer()[i]);
+  for (std::size_t i=20000; i<buf.size(); ++i)
+    ASSERT_EQ(0, buf.buffer()[i]);
+}
+
+TEST(ImageBuffer, CopyWithRecycledBuffer)
+{
+  std::unique_ptr<Image> a(Image::create(IMAGE_RGB, 128, 128));
+  clear_image(a.get(), rgba(255, 0, 0, 255));
+  put_pixel(a.get(), 2, 3, rgba(0, 0, 255, 255));
+
+  for (int i=0; i<4; ++i) {
+    std::unique_ptr<Image> b(Image::createCopy(a.get()));
+    EXPECT_TRUE(is_same_image(a.get(), b.get()));
+
+    // Trash the buffer so it's recycled in the next iteration
+    clear_image(b.get(), rgba(0, 255, 0, 255));
+  }
+
+  // New images are still transparent
+  std::unique_ptr<Image> c(Image::create(IMAGE_RGB, 128, 128));
+  for (int y=0; y<c->height(); ++y)
+    for (int x=0; x<c->width(); ++x)
+      ASSERT_EQ(0, get_pixel(c.get(), x, y));
+}
+
+TEST(ImageBuffer, AlignedBuffers)
+{
+  for (std::size_t size : { 1, 100, 16*1024, 20000, 100000, 1024*1024, 80*1024*1024 }) {
+    ImageBuffer buf(size);
+    EXPECT_EQ(0, std::uintptr_t(buf.buffer()) % ImageBuffer::kAlignment);
+    EXPECT_TRUE(is_zero(buf));
+
+    buf.resizeIfNecessary(size*2);
+    EXPECT_EQ(0, std::uintptr_t(buf.buffer()) % ImageBuffer::kAlignment);
+  }
+
+  // Rows of images with a row size multiple of the alignment
+  std::unique_ptr<Image> a(Image::create(IMAGE_RGB, 32, 7));
+  for (int y=0; y<a->height(); ++y)
+    EXPECT_EQ(0, std::uintptr_t(a->getPixelAddress(0, y)) % ImageBuffer::kAlignment);
+
+  // The pixels are contiguous after the first row
+  std::unique_ptr<Image> b(Image::create(IMAGE_BITMAP, 13, 5));
+  EXPECT_EQ(0, std::uintptr_t(b->getPixelAddress(0, 0)) % ImageBuffer::kAlignment);
+  for (int y=0; y<b->height(); ++y)
+    EXPECT_EQ(b->getPixelAddress(0, 0) + y*b->getRowStrideSize(),
+              b->getPixelAddress(0, y));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -10,7 +11,7 @@
 
 #include "doc/image_impl.h"
 
-#include "doc/image_iterator.h"
+#include "doc/bitmap_rows.h"
 #include "doc/image_traits.h"
 
 namespace doc {
@@ -20,20 +21,13 @@ void copy_bitmaps(Image* dst, const Image* src, gfx::Clip area)
   if (!area.clip(dst->width(), dst->height(), src->width(), src->height()))
     return;
 
-  // Copy process
-  ImageConstIterator<BitmapTraits> src_it(src, area.srcBounds(), area.src.x, area.src.y);
-  ImageIterator<BitmapTraits> dst_it(dst, area.dstBounds(), area.dst.x, area.dst.y);
-
-  int end_x = area.dst.x+area.size.w;
-
-  for (int end_y=area.dst.y+area.size.h;
-       area.dst.y<end_y;
-       ++area.dst.y, ++area.src.y) {
-    for (int x=area.dst.x; x<end_x; ++x) {
-      *dst_it = *src_it;
-      ++src_it;
-      ++dst_it;
-    }
+  // Copy process (several pixels at the same time)
+  for (int v=0; v<area.size.h; ++v) {
+    combine_bitmap_rows(
+      dst->getPixelAddress(0, area.dst.y+v), area.dst.x,
+      src->getPixelAddress(0, area.src.y+v), area.src.x,
+      area.size.w,
+      [](uint64_t, uint64_t b) { return b; });
   }
 }
 
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -13,6 +13,7 @@
 #include <cstdlib>
 #include <cstring>
 
+#include "doc/bitmap_rows.h"
 #include "doc/blend_funcs.h"
 #include "doc/image.h"
 #include "doc/image_bits.h"
@@ -63,17 +64,24 @@ namespace doc {
     {
       ASSERT(Traits::color_mode == spec.colorMode());
 
-      std::size_t for_rows = sizeof(address_t) * spec.height();
+      // The pixels are at the beginning of the buffer (aligned to
+      // ImageBuffer::kAlignment) and the table of rows goes after
+      // them, so vectorized code can use aligned loads from the first
+      // row (and from all rows when the row size is a multiple of the
+      // alignment).
       std::size_t rowstride_bytes = Traits::getRowStrideBytes(spec.width());
-      std::size_t required_size = for_rows + rowstride_bytes*spec.height();
+      std::size_t for_bits = rowstride_bytes*spec.height();
+      for_bits = (for_bits + sizeof(address_t) - 1) / sizeof(address_t) * sizeof(address_t);
+      std::size_t for_rows = sizeof(address_t) * spec.height();
+      std::size_t required_size = for_bits + for_rows;
 
       if (!m_buffer)
         m_buffer = std::make_shared<ImageBuffer>(required_size);
       else
         m_buffer->resizeIfNecessary(required_size);
 
-      m_rows = (address_t*)m_buffer->buffer();
-      m_bits = (address_t)(m_buffer->buffer() + for_rows);
+      m_bits = (address_t)m_buffer->buffer();
+      m_rows = (address_t*)(m_buffer->buffer() + for_bits);
 
       address_t addr = m_bits;
       for (int y=0; y<spec.height(); ++y) {
@@ -255,6 +263,11 @@ namespace doc {
       (*(getLineAddress(y) + d.quot)) &= ~(1 << d.rem);
   }
 
+  template<>
+  inline void ImageImpl<BitmapTraits>::drawHLine(int x1, int y, int x2, color_t color) {
+    fill_bitmap_row(getLineAddress(y), x1, x2+1, color != 0);
+  }
+
   template<>
   inline void ImageImpl<BitmapTraits>::fillRect(int x1, int y1, int x2, int y2, color_t color) {
     for (int y=y1; y<=y2; ++y)
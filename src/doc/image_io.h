@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -8,6 +9,8 @@
 #define DOC_IMAGE_IO_H_INCLUDED
 #pragma once
 
+#include "doc/object_id.h"
+
 #include <iosfwd>
 
 namespace doc {
@@ -15,7 +18,14 @@ namespace doc {
   class CancelIO;
   class Image;
 
-  bool write_image(std::ostream& os, const Image* image, CancelIO* cancel = nullptr);
+  // The compressionLevel is the zlib level used to deflate the
+  // pixels (-1 is the zlib default, 0 stores the pixels without
+  // compression). If "id" is not NullId, it's saved instead of the
+  // image ID (e.g. to save a copy of an image).
+  bool write_image(std::ostream& os, const Image* image,
+                   CancelIO* cancel = nullptr,
+                   const int compressionLevel = -1,
+                   const ObjectId id = NullId);
   Image* read_image(std::istream& is, bool setId = true);
 
 } // namespace doc
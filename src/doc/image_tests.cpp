@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2018 Igara Studio S.A.
+// Copyright (c) 2018-2022 Igara Studio S.A.
 // Copyright (c) 2001-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -153,6 +153,30 @@ TEST(Image, DiffRgbImages)
   ASSERT_FALSE(is_same_image(a.get(), b.get()));
 }
 
+TEST(Image, HashOfSameImages)
+{
+  std::unique_ptr<Image> a(Image::create(IMAGE_RGB, 32, 32));
+  std::unique_ptr<Image> b(Image::create(IMAGE_RGB, 32, 32));
+  clear_image(a.get(), rgba(0, 0, 0, 0));
+  clear_image(b.get(), rgba(0, 0, 0, 0));
+  EXPECT_EQ(calculate_image_hash(a.get(), a->bounds()),
+            calculate_image_hash(b.get(), b->bounds()));
+
+  // Same image for is_same_image() must have the same hash
+  put_pixel(a.get(), 0, 0, rgba(255, 0, 0, 0));
+  ASSERT_TRUE(is_same_image(a.get(), b.get()));
+  EXPECT_EQ(calculate_image_hash(a.get(), a->bounds()),
+            calculate_image_hash(b.get(), b->bounds()));
+
+  // Pixels at the beginning of the image change the hash too
+  put_pixel(a.get(), 0, 0, rgba(255, 0, 0, 255));
+  EXPECT_NE(calculate_image_hash(a.get(), a->bounds()),
+            calculate_image_hash(b.get(), b->bounds()));
+  put_pixel(b.get(), 0, 0, rgba(255, 0, 0, 128));
+  EXPECT_NE(calculate_image_hash(a.get(), a->bounds()),
+            calculate_image_hash(b.get(), b->bounds()));
+}
+
 TYPED_TEST(ImageAllTypes, DrawHLine)
 {
   typedef TypeParam ImageTraits;
@@ -225,6 +249,67 @@ TYPED_TEST(ImageAllTypes, FillRect)
   }
 }
 
+TYPED_TEST(ImageAllTypes, RotateImage)
+{
+  typedef TypeParam ImageTraits;
+
+  for (int i=0; i<50; ++i) {
+    const int w = 1 + (rand() % 150);
+    const int h = 1 + (rand() % 150);
+    std::unique_ptr<Image> src(Image::create(ImageTraits::pixel_format, w, h));
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        put_pixel_fast<ImageTraits>(src.get(), x, y, rand() & ImageTraits::max_value);
+
+    std::unique_ptr<Image> dst180(Image::create(ImageTraits::pixel_format, w, h));
+    std::unique_ptr<Image> dst90(Image::create(ImageTraits::pixel_format, h, w));
+    std::unique_ptr<Image> dst270(Image::create(ImageTraits::pixel_format, h, w));
+    rotate_image(src.get(), dst180.get(), 180);
+    rotate_image(src.get(), dst90.get(), 90);
+    rotate_image(src.get(), dst270.get(), -90);
+
+    for (int y=0; y<h; ++y) {
+      for (int x=0; x<w; ++x) {
+        const color_t c = get_pixel_fast<ImageTraits>(src.get(), x, y);
+        ASSERT_EQ(c, get_pixel_fast<ImageTraits>(dst180.get(), w-x-1, h-y-1));
+        ASSERT_EQ(c, get_pixel_fast<ImageTraits>(dst90.get(), h-y-1, x));
+        ASSERT_EQ(c, get_pixel_fast<ImageTraits>(dst270.get(), y, w-x-1));
+      }
+    }
+  }
+}
+
+TYPED_TEST(ImageAllTypes, IsSameImage)
+{
+  typedef TypeParam ImageTraits;
+
+  for (int i=0; i<50; ++i) {
+    const int w = 1 + (rand() % 150);
+    const int h = 1 + (rand() % 50);
+    std::unique_ptr<Image> a(Image::create(ImageTraits::pixel_format, w, h));
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        put_pixel_fast<ImageTraits>(a.get(), x, y, rand() & ImageTraits::max_value);
+
+    std::unique_ptr<Image> b(Image::createCopy(a.get()));
+    EXPECT_TRUE(is_same_image(a.get(), b.get()));
+
+    // Change one opaque pixel
+    const int x = rand() % w;
+    const int y = rand() % h;
+    const color_t c = get_pixel_fast<ImageTraits>(a.get(), x, y);
+    put_pixel_fast<ImageTraits>(b.get(), x, y,
+                                (ImageTraits::pixel_format == IMAGE_RGB ? (c ^ 1) | rgba_a_mask:
+                                 ImageTraits::pixel_format == IMAGE_GRAYSCALE ? (c ^ 1) | graya_a_mask:
+                                                                               c ^ 1));
+    put_pixel_fast<ImageTraits>(a.get(), x, y,
+                                (ImageTraits::pixel_format == IMAGE_RGB ? c | rgba_a_mask:
+                                 ImageTraits::pixel_format == IMAGE_GRAYSCALE ? c | graya_a_mask:
+                                                                               c));
+    EXPECT_FALSE(is_same_image(a.get(), b.get()));
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
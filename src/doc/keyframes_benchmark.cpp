@@ -0,0 +1,43 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/keyframes.h"
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+
+using namespace doc;
+
+// Looks for the key of each frame (like Slice::getByFrame() does for
+// each slice when the editor is painted).
+static void BM_KeyframesGetIterator(benchmark::State& state)
+{
+  const int nkeys = state.range(0);
+  const frame_t nframes = 4*nkeys;
+
+  Keyframes<int> k;
+  for (int i=0; i<nkeys; ++i)
+    k.insert(4*i, std::make_unique<int>(i));
+
+  frame_t frame = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(k.getIterator(frame));
+    frame = (frame + 7) % nframes;
+  }
+}
+
+BENCHMARK(BM_KeyframesGetIterator)
+  ->Arg(1)
+  ->Arg(16)
+  ->Arg(256)
+  ->Arg(4096);
+
+BENCHMARK_MAIN();
@@ -13,6 +13,8 @@
 
 #include "doc/keyframes.h"
 
+#include <algorithm>
+
 using namespace doc;
 
 TEST(Keyframes, Operations)
@@ -70,6 +72,25 @@ TEST(Keyframes, Operations)
   EXPECT_EQ(3, *k[3]);
 }
 
+TEST(Keyframes, GetIteratorWithManyKeys)
+{
+  Keyframes<int> k;
+  EXPECT_TRUE(k.getIterator(0) == k.end());
+
+  for (int i=0; i<100; ++i)
+    k.insert(3*i+1, std::make_unique<int>(i));
+
+  EXPECT_TRUE(k.getIterator(-1) == k.begin());
+  EXPECT_TRUE(k.getIterator(0) == k.begin());
+  for (frame_t frame=1; frame<400; ++frame) {
+    const int expected = std::min(99, (frame-1) / 3);
+    auto it = k.getIterator(frame);
+    ASSERT_TRUE(it != k.end());
+    EXPECT_EQ(expected, *it->value());
+    EXPECT_EQ(expected, *k[frame]);
+  }
+}
+
 TEST(Keyframes, Range)
 {
   Keyframes<int> k;
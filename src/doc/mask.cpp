@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -13,32 +13,35 @@
 
 #include "base/clamp.h"
 #include "base/memory.h"
+#include "doc/bitmap_rows.h"
 #include "doc/image_impl.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 
 namespace doc {
 
 namespace {
 
+  // Combines the pixels of "b" into "a" with func(aPixels, bPixels)
+  // in chunks of several pixels. Pixels of "a" outside "b" are not
+  // modified (func(a, 0) must be equal to "a").
   template<typename Func>
-  void for_each_mask_pixel(Mask& a, const Mask& b, Func f) {
+  void combine_masks(Mask& a, const Mask& b, Func func) {
     a.reserve(b.bounds());
 
-    {
-      LockImageBits<BitmapTraits> aBits(a.bitmap());
-      auto aIt = aBits.begin();
-
-      auto bounds = a.bounds();
-      for (int y=0; y<bounds.h; ++y) {
-        for (int x=0; x<bounds.w; ++x, ++aIt) {
-          color_t aColor = *aIt;
-          color_t bColor = (b.containsPoint(bounds.x+x,
-                                            bounds.y+y) ? 1: 0);
-          *aIt = f(aColor, bColor);
-        }
-      }
+    const gfx::Rect& aBounds = a.bounds();
+    const gfx::Rect& bBounds = b.bounds();
+    Image* aBitmap = a.bitmap();
+    const Image* bBitmap = b.bitmap();
+    for (int y=0; y<bBounds.h; ++y) {
+      combine_bitmap_rows(
+        aBitmap->getPixelAddress(0, bBounds.y-aBounds.y+y),
+        bBounds.x-aBounds.x,
+        bBitmap->getPixelAddress(0, y), 0,
+        bBounds.w, func);
     }
 
     a.shrink();
@@ -101,14 +104,11 @@ bool Mask::isRectangular() const
   if (!m_bitmap)
     return false;
 
-  LockImageBits<BitmapTraits> bits(m_bitmap.get());
-  LockImageBits<BitmapTraits>::iterator it = bits.begin(), end = bits.end();
-
-  for (; it != end; ++it) {
-    if (*it == 0)
+  const int w = m_bitmap->width();
+  for (int y=0; y<m_bitmap->height(); ++y) {
+    if (find_first_bitmap_pixel(m_bitmap->getPixelAddress(0, y), 0, w, false) < w)
       return false;
   }
-
   return true;
 }
 
@@ -146,11 +146,12 @@ void Mask::invert()
   if (!m_bitmap)
     return;
 
-  LockImageBits<BitmapTraits> bits(m_bitmap.get());
-  LockImageBits<BitmapTraits>::iterator it = bits.begin(), end = bits.end();
-
-  for (; it != end; ++it)
-    *it = (*it ? 0: 1);
+  const int w = m_bitmap->width();
+  for (int y=0; y<m_bitmap->height(); ++y) {
+    uint8_t* row = m_bitmap->getPixelAddress(0, y);
+    combine_bitmap_rows(row, 0, row, 0, w,
+                        [](uint64_t a, uint64_t) { return ~a; });
+  }
 
   shrink();
 }
@@ -163,34 +164,56 @@ void Mask::replace(const gfx::Rect& bounds)
   clear_image(m_bitmap.get(), 1);
 }
 
+// Rectangular masks (e.g. selections made with the rectangular
+// marquee) are combined as rectangles.
+
 void Mask::add(const doc::Mask& mask)
 {
-  for_each_mask_pixel(
+  if (mask.isEmpty())
+    return;
+
+  if (m_freeze_count == 0 && mask.isRectangular()) {
+    add(mask.bounds());
+    return;
+  }
+
+  combine_masks(
     *this, mask,
-    [](color_t a, color_t b) -> color_t {
-      return a | b;
-    });
+    [](uint64_t a, uint64_t b) { return a | b; });
 }
 
 void Mask::subtract(const doc::Mask& mask)
 {
-  for_each_mask_pixel(
+  if (mask.isEmpty() || !m_bitmap)
+    return;
+
+  if (mask.isRectangular()) {
+    subtract(mask.bounds());
+    return;
+  }
+
+  combine_masks(
     *this, mask,
-    [](color_t a, color_t b) -> color_t {
-      if (a)
-        return a - b;
-      else
-        return 0;
-    });
+    [](uint64_t a, uint64_t b) { return a & ~b; });
 }
 
 void Mask::intersect(const doc::Mask& mask)
 {
-  for_each_mask_pixel(
+  if (mask.isEmpty()) {
+    if (m_freeze_count == 0)
+      clear();
+    return;
+  }
+
+  // The pixels outside the other mask are removed first, then we
+  // only need to combine the common area
+  intersect(mask.bounds());
+  if (!m_bitmap || mask.isRectangular())
+    return;
+
+  combine_masks(
     *this, mask,
-    [](color_t a, color_t b) -> color_t {
-      return a & b;
-    });
+    [](uint64_t a, uint64_t b) { return a & b; });
 }
 
 void Mask::add(const gfx::Rect& bounds)
@@ -252,100 +275,30 @@ void Mask::byColor(const Image *src, int color, int fuzziness)
   replace(src->bounds());
 
   Image* dst = m_bitmap.get();
-
-  switch (src->pixelFormat()) {
-
-    case IMAGE_RGB: {
-      const LockImageBits<RgbTraits> srcBits(src);
-      LockImageBits<BitmapTraits> dstBits(dst, Image::WriteLock);
-      LockImageBits<RgbTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-      LockImageBits<BitmapTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-      LockImageBits<BitmapTraits>::iterator dst_end = dstBits.end();
-#endif
-      int src_r, src_g, src_b, src_a;
-      int dst_r, dst_g, dst_b, dst_a;
-      color_t c;
-
-      dst_r = rgba_getr(color);
-      dst_g = rgba_getg(color);
-      dst_b = rgba_getb(color);
-      dst_a = rgba_geta(color);
-
-      for (; src_it != src_end; ++src_it, ++dst_it) {
-        ASSERT(dst_it != dst_end);
-        c = *src_it;
-
-        src_r = rgba_getr(c);
-        src_g = rgba_getg(c);
-        src_b = rgba_getb(c);
-        src_a = rgba_geta(c);
-
-        if (!((src_r >= dst_r-fuzziness) && (src_r <= dst_r+fuzziness) &&
-              (src_g >= dst_g-fuzziness) && (src_g <= dst_g+fuzziness) &&
-              (src_b >= dst_b-fuzziness) && (src_b <= dst_b+fuzziness) &&
-              (src_a >= dst_a-fuzziness) && (src_a <= dst_a+fuzziness)))
-          *dst_it = 0;
-      }
-      ASSERT(dst_it == dst_end);
-      break;
-    }
-
-    case IMAGE_GRAYSCALE: {
-      const LockImageBits<GrayscaleTraits> srcBits(src);
-      LockImageBits<BitmapTraits> dstBits(dst, Image::WriteLock);
-      LockImageBits<GrayscaleTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-      LockImageBits<BitmapTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-      LockImageBits<BitmapTraits>::iterator dst_end = dstBits.end();
-#endif
-      int src_k, src_a;
-      int dst_k, dst_a;
-      color_t c;
-
-      dst_k = graya_getv(color);
-      dst_a = graya_geta(color);
-
-      for (; src_it != src_end; ++src_it, ++dst_it) {
-        ASSERT(dst_it != dst_end);
-        c = *src_it;
-
-        src_k = graya_getv(c);
-        src_a = graya_geta(c);
-
-        if (!((src_k >= dst_k-fuzziness) && (src_k <= dst_k+fuzziness) &&
-              (src_a >= dst_a-fuzziness) && (src_a <= dst_a+fuzziness)))
-          *dst_it = 0;
-      }
-      ASSERT(dst_it == dst_end);
-      break;
-    }
-
-    case IMAGE_INDEXED: {
-      const LockImageBits<IndexedTraits> srcBits(src);
-      LockImageBits<BitmapTraits> dstBits(dst, Image::WriteLock);
-      LockImageBits<IndexedTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-      LockImageBits<BitmapTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-      LockImageBits<BitmapTraits>::iterator dst_end = dstBits.end();
-#endif
-      color_t c, min, max;
-
-      for (; src_it != src_end; ++src_it, ++dst_it) {
-        ASSERT(dst_it != dst_end);
-        c = *src_it;
-
-        if (color > fuzziness)
-          min = color-fuzziness;
-        else
-          min = 0;
-        max = color + fuzziness;
-
-        if (!((c >= min) && (c <= max)))
-          *dst_it = 0;
-      }
-      ASSERT(dst_it == dst_end);
-      break;
+  const int w = src->width();
+  const int h = src->height();
+
+  // Matches are written directly as bits of each row of the mask
+  for (int y=0; y<h; ++y) {
+    const uint8_t* src_address = src->getPixelAddress(0, y);
+    uint8_t* dst_address = dst->getPixelAddress(0, y);
+
+    switch (src->pixelFormat()) {
+      case IMAGE_RGB:
+        rgba_match_by_tolerance_bits(
+          (const color_t*)src_address, dst_address, w,
+          color, 0xffffffff, fuzziness);
+        break;
+      case IMAGE_GRAYSCALE:
+        graya_match_by_tolerance_bits(
+          (const uint16_t*)src_address, dst_address, w,
+          color, fuzziness);
+        break;
+      case IMAGE_INDEXED:
+        index_match_by_tolerance_bits(
+          src_address, dst_address, w,
+          color, fuzziness);
+        break;
     }
   }
 
@@ -448,61 +401,49 @@ void Mask::shrink()
   if (m_freeze_count > 0)
     return;
 
-#define SHRINK_SIDE(u_begin, u_op, u_final, u_add,                      \
-                    v_begin, v_op, v_final, v_add, U, V, var)           \
-  {                                                                     \
-    for (u = u_begin; u u_op u_final; u u_add) {                        \
-      for (v = v_begin; v v_op v_final; v v_add) {                      \
-        if (get_pixel_fast<BitmapTraits>(m_bitmap.get(), U, V))         \
-          break;                                                        \
-      }                                                                 \
-      if (v == v_final)                                                 \
-        var;                                                            \
-      else                                                              \
-        break;                                                          \
-    }                                                                   \
+  if (!m_bitmap) {
+    clear();
+    return;
   }
 
-  int u, v, x1, y1, x2, y2;
-
-  x1 = m_bounds.x;
-  y1 = m_bounds.y;
-  x2 = m_bounds.x+m_bounds.w-1;
-  y2 = m_bounds.y+m_bounds.h-1;
-
-  SHRINK_SIDE(0, <, m_bounds.w, ++,
-              0, <, m_bounds.h, ++, u, v, x1++);
-
-  SHRINK_SIDE(0, <, m_bounds.h, ++,
-              0, <, m_bounds.w, ++, v, u, y1++);
-
-  SHRINK_SIDE(m_bounds.w-1, >, 0, --,
-              0, <, m_bounds.h, ++, u, v, x2--);
-
-  SHRINK_SIDE(m_bounds.h-1, >, 0, --,
-              0, <, m_bounds.w, ++, v, u, y2--);
-
-  if ((x1 > x2) || (y1 > y2)) {
+  const Image* bitmap = m_bitmap.get();
+  const int w = m_bounds.w;
+  const int h = m_bounds.h;
+  auto emptyRow = [bitmap, w](int y) {
+    return (find_first_bitmap_pixel(bitmap->getPixelAddress(0, y), 0, w, true) == w);
+  };
+
+  int y1 = 0;
+  while (y1 < h && emptyRow(y1))
+    ++y1;
+  if (y1 == h) {
     clear();
+    return;
   }
-  else if ((x1 != m_bounds.x) || (x2 != m_bounds.x+m_bounds.w-1) ||
-           (y1 != m_bounds.y) || (y2 != m_bounds.y+m_bounds.h-1)) {
-    u = m_bounds.x;
-    v = m_bounds.y;
 
-    m_bounds.x = x1;
-    m_bounds.y = y1;
-    m_bounds.w = x2 - x1 + 1;
-    m_bounds.h = y2 - y1 + 1;
+  int y2 = h-1;
+  while (emptyRow(y2))
+    --y2;
+
+  // Only the pixels outside the current [x1, x2] range can expand it
+  int x1 = w, x2 = -1;
+  for (int y=y1; y<=y2; ++y) {
+    const uint8_t* row = bitmap->getPixelAddress(0, y);
+    if (x1 > 0)
+      x1 = find_first_bitmap_pixel(row, 0, x1, true);
+    if (x2 < w-1)
+      x2 = std::max(x2, find_last_bitmap_pixel(row, x2+1, w, true));
+  }
 
+  if (x1 != 0 || y1 != 0 || x2 != w-1 || y2 != h-1) {
+    const gfx::Rect newBounds(m_bounds.x+x1, m_bounds.y+y1,
+                              x2-x1+1, y2-y1+1);
     Image* image = crop_image(
       m_bitmap.get(),
-      m_bounds.x-u, m_bounds.y-v,
-      m_bounds.w, m_bounds.h, 0);
+      x1, y1, newBounds.w, newBounds.h, 0);
     m_bitmap.reset(image);
+    m_bounds = newBounds;
   }
-
-#undef SHRINK_SIDE
 }
 
 } // namespace doc
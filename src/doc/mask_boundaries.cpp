@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -12,10 +13,50 @@
 
 #include "doc/image_impl.h"
 
+#include <algorithm>
+#include <iterator>
+
 namespace doc {
 
+namespace {
+
+// Fills "edges" with the X positions (from 0 to w) where the color of
+// the given bitmap row changes (i.e. pixel X is different from pixel
+// X-1, where pixels outside the row are 0). Bytes where all pixels
+// have the current color are skipped.
+void find_row_edges(const uint8_t* row, const int w,
+                    std::vector<int>& edges)
+{
+  edges.clear();
+  if (!row)
+    return;
+
+  bool color = false;
+  for (int x=0; x<w; x+=8, ++row) {
+    uint8_t byte = *row;
+    if (x+8 > w)
+      byte &= (1 << (w-x)) - 1;
+
+    if (byte == (color ? 0xff: 0))
+      continue;
+
+    const int n = std::min(8, w-x);
+    for (int i=0; i<n; ++i) {
+      if (color != ((byte & (1 << i)) != 0)) {
+        edges.push_back(x+i);
+        color = !color;
+      }
+    }
+  }
+  if (color)
+    edges.push_back(w);
+}
+
+} // anonymous namespace
+
 void MaskBoundaries::reset()
 {
+  ++m_version;
   m_segs.clear();
   if (!m_path.isEmpty())
     m_path.rewind();
@@ -27,11 +68,11 @@ void MaskBoundaries::regen(const Image* bitmap)
 
   int x, y, w = bitmap->width(), h = bitmap->height();
 
-  const LockImageBits<BitmapTraits> bits(bitmap);
-  auto it = bits.begin();       // Current pixel iterator
-#if _DEBUG
-  auto prevIt = bits.begin();   // Previous row iterator (same X pos)
-#endif
+  // Positions where the color changes in the previous/current row.
+  // The state machine below is evaluated only in these positions (and
+  // horizontal segments are expanded to the next position in one
+  // step), so big areas with the same color are skipped.
+  std::vector<int> prevEdges, curEdges, edges;
 
   // Vertical segments being expanded from the previous row.
   std::vector<int> vertSegs(w+1, -1);
@@ -63,13 +104,34 @@ void MaskBoundaries::regen(const Image* bitmap)
   }
 
   for (y=0; y<=h; ++y) {
+    find_row_edges((y < h ? bitmap->getPixelAddress(0, y): nullptr),
+                   w, curEdges);
+
+    edges.clear();
+    std::set_union(prevEdges.begin(), prevEdges.end(),
+                   curEdges.begin(), curEdges.end(),
+                   std::back_inserter(edges));
+
+    auto curEdge = curEdges.begin();
+#if _DEBUG
+    auto prevEdge = prevEdges.begin();
+    bool prevRowColor = false;      // Color of the previous row (same X)
+#endif
+    bool color = false;             // Current color
     bool prevColor = false;         // Previous color (X-1) same Y row
     horzSeg = -1;
 
-    for (x=0; x<=w; ++x) {
-      bool color = (x < w && y < h && *it ? true: false);
+    for (std::size_t i=0; i<edges.size(); ++i) {
+      x = edges[i];
+      if (curEdge != curEdges.end() && *curEdge == x) {
+        color = !color;
+        ++curEdge;
+      }
 #if _DEBUG
-      bool prevRowColor = (x < w && y > 0 && *prevIt ? true: false);
+      if (prevEdge != prevEdges.end() && *prevEdge == x) {
+        prevRowColor = !prevRowColor;
+        ++prevEdge;
+      }
 #endif
       Segment* hseg = (horzSeg >= 0 ? &m_segs[horzSeg]: nullptr);
       Segment* vseg = (vertSegs[x] >= 0 ? &m_segs[vertSegs[x]]: nullptr);
@@ -326,21 +388,22 @@ void MaskBoundaries::regen(const Image* bitmap)
       }
 
       prevColor = color;
-      if (x < w) {
-#if _DEBUG
-        if (y > 0) ++prevIt;
-#endif
-        if (y < h) ++it;
+
+      // Until the next edge the colors don't change, so the only
+      // thing to do is expanding the current horizontal segment.
+      if (horzSeg >= 0) {
+        const int next = (i+1 < edges.size() ? edges[i+1]: w+1);
+        m_segs[horzSeg].m_bounds.w += next - x - 1;
       }
     }
-  }
 
-  ASSERT(it == bits.end());
-  ASSERT(prevIt == bits.end());
+    std::swap(prevEdges, curEdges);
+  }
 }
 
 void MaskBoundaries::offset(int x, int y)
 {
+  ++m_version;
   for (Segment& seg : m_segs)
     seg.offset(x, y);
 
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2020 Igara Studio S.A.
+// Copyright (c) 2020-2022 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -57,9 +57,14 @@ namespace doc {
 
     void createPathIfNeeeded();
 
+    // Incremented each time the segments change (so cached copies of
+    // the path can be discarded).
+    int version() const { return m_version; }
+
   private:
     list_type m_segs;
     gfx::Path m_path;
+    int m_version = 0;
   };
 
 } // namespace doc
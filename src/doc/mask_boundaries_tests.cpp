@@ -0,0 +1,155 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/mask_boundaries.h"
+#include "doc/primitives.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <tuple>
+#include <vector>
+
+using namespace doc;
+
+typedef std::tuple<bool, int, int, int, int> Seg; // open, x, y, w, h
+
+static bool px(const Image* img, int x, int y)
+{
+  return (x >= 0 && y >= 0 && x < img->width() && y < img->height() &&
+          get_pixel(img, x, y) != 0);
+}
+
+// Returns the segments using the definition of boundaries: each
+// horizontal/vertical edge between two pixels of different color,
+// joined with the contiguous edges with the same orientation.
+static std::vector<Seg> expected_segments(const Image* img)
+{
+  const int w = img->width();
+  const int h = img->height();
+  std::vector<Seg> segs;
+
+  for (int y=0; y<=h; ++y) {
+    for (int x=0; x<w; ) {
+      const bool up = px(img, x, y-1);
+      const bool down = px(img, x, y);
+      if (up == down) {
+        ++x;
+        continue;
+      }
+      int x2 = x+1;
+      while (x2 < w &&
+             px(img, x2, y-1) == up &&
+             px(img, x2, y) == down)
+        ++x2;
+      segs.push_back(Seg(down, x, y, x2-x, 0));
+      x = x2;
+    }
+  }
+
+  for (int x=0; x<=w; ++x) {
+    for (int y=0; y<h; ) {
+      const bool left = px(img, x-1, y);
+      const bool right = px(img, x, y);
+      if (left == right) {
+        ++y;
+        continue;
+      }
+      int y2 = y+1;
+      while (y2 < h &&
+             px(img, x-1, y2) == left &&
+             px(img, x, y2) == right)
+        ++y2;
+      segs.push_back(Seg(right, x, y, 0, y2-y));
+      y = y2;
+    }
+  }
+
+  std::sort(segs.begin(), segs.end());
+  return segs;
+}
+
+static std::vector<Seg> regen_segments(const Image* img)
+{
+  MaskBoundaries boundaries;
+  boundaries.regen(img);
+
+  std::vector<Seg> segs;
+  for (const auto& seg : boundaries) {
+    const gfx::Rect& rc = seg.bounds();
+    segs.push_back(Seg(seg.open(), rc.x, rc.y, rc.w, rc.h));
+  }
+  std::sort(segs.begin(), segs.end());
+  return segs;
+}
+
+TEST(MaskBoundaries, Empty)
+{
+  ImageRef img(Image::create(IMAGE_BITMAP, 16, 16));
+  clear_image(img.get(), 0);
+
+  MaskBoundaries boundaries;
+  boundaries.regen(img.get());
+  EXPECT_TRUE(boundaries.isEmpty());
+}
+
+TEST(MaskBoundaries, Rectangle)
+{
+  ImageRef img(Image::create(IMAGE_BITMAP, 20, 10));
+  clear_image(img.get(), 0);
+  fill_rect(img.get(), 3, 2, 17, 7, 1);
+
+  std::vector<Seg> segs = regen_segments(img.get());
+  ASSERT_EQ(4, segs.size());
+  EXPECT_EQ(expected_segments(img.get()), segs);
+  EXPECT_EQ(Seg(true, 3, 2, 15, 0), segs[3]);
+}
+
+TEST(MaskBoundaries, FullImage)
+{
+  // Widths that are not multiple of 8 to test the last byte of rows
+  for (int w : { 1, 7, 8, 9, 31 }) {
+    ImageRef img(Image::create(IMAGE_BITMAP, w, 5));
+    clear_image(img.get(), 1);
+
+    std::vector<Seg> segs = regen_segments(img.get());
+    ASSERT_EQ(4, segs.size());
+    EXPECT_EQ(expected_segments(img.get()), segs);
+  }
+}
+
+TEST(MaskBoundaries, RandomBitmaps)
+{
+  std::srand(1);
+  for (int i=0; i<200; ++i) {
+    const int w = 1 + (std::rand() % 40);
+    const int h = 1 + (std::rand() % 40);
+    // Low density images have big areas with the same color
+    const int density = 1 + (std::rand() % 10);
+
+    ImageRef img(Image::create(IMAGE_BITMAP, w, h));
+    clear_image(img.get(), 0);
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        if ((std::rand() % 10) < density)
+          put_pixel(img.get(), x, y, 1);
+
+    EXPECT_EQ(expected_segments(img.get()), regen_segments(img.get()));
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
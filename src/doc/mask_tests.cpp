@@ -0,0 +1,162 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/mask.h"
+#include "doc/primitives.h"
+
+#include <cstdlib>
+
+using namespace doc;
+
+// Area where all random masks are created
+static const gfx::Rect kArea(-10, -10, 120, 60);
+
+static Mask random_mask(const bool rectangular)
+{
+  Mask mask;
+  const gfx::Rect rc(std::rand() % 50 - 10,
+                     std::rand() % 20 - 10,
+                     1 + std::rand() % 70,
+                     1 + std::rand() % 40);
+  mask.add(rc);
+  if (!rectangular) {
+    Image* bitmap = mask.bitmap();
+    for (int y=0; y<rc.h; ++y)
+      for (int x=0; x<rc.w; ++x)
+        if (std::rand() % 3 == 0)
+          put_pixel(bitmap, x, y, 0);
+    mask.shrink();
+  }
+  return mask;
+}
+
+static gfx::Rect expected_bounds(const Mask& mask)
+{
+  gfx::Rect bounds;
+  for (int y=kArea.y; y<kArea.y2(); ++y)
+    for (int x=kArea.x; x<kArea.x2(); ++x)
+      if (mask.containsPoint(x, y))
+        bounds |= gfx::Rect(x, y, 1, 1);
+  return bounds;
+}
+
+enum class Op { Add, Subtract, Intersect };
+
+static void expect_op(const Op op, const Mask& a, const Mask& b)
+{
+  Mask result(a);
+  switch (op) {
+    case Op::Add:       result.add(b); break;
+    case Op::Subtract:  result.subtract(b); break;
+    case Op::Intersect: result.intersect(b); break;
+  }
+
+  for (int y=kArea.y; y<kArea.y2(); ++y) {
+    for (int x=kArea.x; x<kArea.x2(); ++x) {
+      const bool pa = a.containsPoint(x, y);
+      const bool pb = b.containsPoint(x, y);
+      bool expected = false;
+      switch (op) {
+        case Op::Add:       expected = (pa || pb); break;
+        case Op::Subtract:  expected = (pa && !pb); break;
+        case Op::Intersect: expected = (pa && pb); break;
+      }
+      ASSERT_EQ(expected, result.containsPoint(x, y))
+        << "op=" << int(op) << " x=" << x << " y=" << y;
+    }
+  }
+
+  // The result must be shrunk
+  EXPECT_EQ(expected_bounds(result), result.bounds());
+}
+
+TEST(Mask, RandomSetOperations)
+{
+  std::srand(1);
+  for (int i=0; i<300; ++i) {
+    const Mask a = random_mask(i % 4 == 0);
+    const Mask b = random_mask(i % 3 == 0);
+    for (Op op : { Op::Add, Op::Subtract, Op::Intersect })
+      expect_op(op, a, b);
+  }
+}
+
+TEST(Mask, Invert)
+{
+  std::srand(2);
+  for (int i=0; i<100; ++i) {
+    const Mask a = random_mask(false);
+    Mask b(a);
+    b.invert();
+
+    const gfx::Rect bounds = a.bounds();
+    for (int y=bounds.y; y<bounds.y2(); ++y)
+      for (int x=bounds.x; x<bounds.x2(); ++x)
+        ASSERT_NE(a.containsPoint(x, y), b.containsPoint(x, y));
+    EXPECT_EQ(expected_bounds(b), b.bounds());
+  }
+}
+
+TEST(Mask, IsRectangular)
+{
+  for (int w : { 1, 7, 8, 9, 63, 64, 65 }) {
+    Mask mask;
+    mask.add(gfx::Rect(3, 5, w, 4));
+    EXPECT_TRUE(mask.isRectangular());
+
+    mask.subtract(gfx::Rect(3+w-1, 5+1, 1, 1));
+    EXPECT_FALSE(mask.isRectangular());
+  }
+}
+
+TEST(Mask, Shrink)
+{
+  std::srand(3);
+  for (int i=0; i<200; ++i) {
+    Mask mask;
+    const gfx::Rect rc(0, 0, 1 + std::rand() % 100, 1 + std::rand() % 20);
+    mask.freeze();
+    mask.reserve(rc);
+    const int n = std::rand() % 4;
+    for (int j=0; j<n; ++j)
+      put_pixel(mask.bitmap(), std::rand() % rc.w, std::rand() % rc.h, 1);
+    const gfx::Rect expected = expected_bounds(mask);
+    mask.unfreeze();
+
+    EXPECT_EQ(expected, mask.bounds());
+    EXPECT_EQ(expected.isEmpty(), mask.isEmpty());
+  }
+}
+
+TEST(Mask, ByColor)
+{
+  ImageRef img(Image::create(IMAGE_INDEXED, 77, 9));
+  for (int y=0; y<img->height(); ++y)
+    for (int x=0; x<img->width(); ++x)
+      put_pixel(img.get(), x, y, (x*y) % 7);
+
+  Mask mask;
+  mask.byColor(img.get(), 3, 1);
+  for (int y=0; y<img->height(); ++y)
+    for (int x=0; x<img->width(); ++x) {
+      const int c = (x*y) % 7;
+      ASSERT_EQ(c >= 2 && c <= 4, mask.containsPoint(x, y));
+    }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -12,17 +12,98 @@
 #include "doc/object.h"
 
 #include "base/debug.h"
-#include "base/mutex.h"
-#include "base/scoped_lock.h"
 
-#include <map>
+#include <atomic>
+#include <mutex>
 
 namespace doc {
 
-static base::mutex mutex;
-static ObjectId newId = 0;
-// TODO Profile this and see if an unordered_map is better
-static std::map<ObjectId, Object*> objects;
+namespace {
+
+// Registry of objects that can be accessed through their ID (see
+// get_object()). IDs are generated sequentially, so we can use the ID
+// as an index in a table of three levels (with pages/tables that are
+// allocated when they are needed and never deallocated).
+//
+// Reads are lock-free (just two atomic loads of tables and one of the
+// object pointer), only modifications of the registry use the mutex.
+class ObjectRegistry {
+  static constexpr int kLevel1Bits = 10;
+  static constexpr int kLevel2Bits = 10;
+  static constexpr int kPageBits = 12;
+  static constexpr uint32_t kLevel2Mask = (1 << kLevel2Bits) - 1;
+  static constexpr uint32_t kPageMask = (1 << kPageBits) - 1;
+  static_assert(kLevel1Bits + kLevel2Bits + kPageBits == 32,
+                "Invalid number of bits to index ObjectIds");
+
+  struct Page {
+    std::atomic<Object*> objects[1 << kPageBits];
+  };
+  struct Table {
+    std::atomic<Page*> pages[1 << kLevel2Bits];
+  };
+
+public:
+  ObjectRegistry() {
+    for (auto& table : m_tables)
+      table.store(nullptr, std::memory_order_relaxed);
+  }
+
+  Object* get(const ObjectId id) const {
+    const Table* table = m_tables[id >> (kLevel2Bits + kPageBits)]
+      .load(std::memory_order_acquire);
+    if (!table)
+      return nullptr;
+    const Page* page = table->pages[(id >> kPageBits) & kLevel2Mask]
+      .load(std::memory_order_acquire);
+    if (!page)
+      return nullptr;
+    return page->objects[id & kPageMask].load(std::memory_order_acquire);
+  }
+
+  // Returns the slot of the given ID, allocating its table/page if
+  // needed. m_mutex must be locked.
+  std::atomic<Object*>& slot(const ObjectId id) {
+    std::atomic<Table*>& tableRef = m_tables[id >> (kLevel2Bits + kPageBits)];
+    Table* table = tableRef.load(std::memory_order_relaxed);
+    if (!table) {
+      table = new Table;
+      for (auto& page : table->pages)
+        page.store(nullptr, std::memory_order_relaxed);
+      tableRef.store(table, std::memory_order_release);
+    }
+
+    std::atomic<Page*>& pageRef = table->pages[(id >> kPageBits) & kLevel2Mask];
+    Page* page = pageRef.load(std::memory_order_relaxed);
+    if (!page) {
+      page = new Page;
+      for (auto& obj : page->objects)
+        obj.store(nullptr, std::memory_order_relaxed);
+      pageRef.store(page, std::memory_order_release);
+    }
+
+    return page->objects[id & kPageMask];
+  }
+
+  std::mutex& mutex() { return m_mutex; }
+  ObjectId newId() { return ++m_newId; }
+
+private:
+  std::mutex m_mutex;
+  ObjectId m_newId = 0;
+  std::atomic<Table*> m_tables[1 << kLevel1Bits];
+};
+
+ObjectRegistry& registry()
+{
+  // Created the first time it's used (objects can be created from
+  // constructors of static variables) and never destroyed (objects
+  // can be destroyed from destructors of static variables too)
+  static ObjectRegistry* registry = new ObjectRegistry;
+  return *registry;
+}
+
+} // anonymous namespace
 
 Object::Object(ObjectType type)
   : m_type(type)
@@ -52,46 +133,41 @@ int Object::getMemSize() const
 const ObjectId Object::id() const
 {
   // The first time the ID is request, we store the object in the
-  // "objects" hash table.
+  // registry.
   if (!m_id) {
-    base::scoped_lock hold(mutex);
-    m_id = ++newId;
-    objects.insert(std::make_pair(m_id, const_cast<Object*>(this)));
+    ObjectRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex());
+    m_id = reg.newId();
+    reg.slot(m_id).store(const_cast<Object*>(this), std::memory_order_release);
   }
   return m_id;
 }
 
 void Object::setId(ObjectId id)
 {
-  base::scoped_lock hold(mutex);
+  ObjectRegistry& reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex());
 
   if (m_id) {
-    auto it = objects.find(m_id);
-    ASSERT(it != objects.end());
-    ASSERT(it->second == this);
-    if (it != objects.end())
-      objects.erase(it);
+    std::atomic<Object*>& slot = reg.slot(m_id);
+    ASSERT(slot.load() == this);
+    if (slot.load(std::memory_order_relaxed) == this)
+      slot.store(nullptr, std::memory_order_release);
   }
 
   m_id = id;
 
   if (m_id) {
+    std::atomic<Object*>& slot = reg.slot(m_id);
 #ifdef _DEBUG
-    if (objects.find(m_id) != objects.end()) {
-      Object* obj = objects.find(m_id)->second;
-      if (obj) {
-        TRACEARGS("ASSERT FAILED: Object with id", m_id,
-                  "of kind", int(obj->type()),
-                  "version", obj->version(), "should not exist");
-      }
-      else {
-        TRACEARGS("ASSERT FAILED: Object with id", m_id,
-                  "registered as nullptr should not exist");
-      }
+    if (Object* obj = slot.load(std::memory_order_relaxed)) {
+      TRACEARGS("ASSERT FAILED: Object with id", m_id,
+                "of kind", int(obj->type()),
+                "version", obj->version(), "should not exist");
     }
-    ASSERT(objects.find(m_id) == objects.end());
+    ASSERT(slot.load(std::memory_order_relaxed) == nullptr);
 #endif
-    objects.insert(std::make_pair(m_id, this));
+    slot.store(this, std::memory_order_release);
   }
 }
 
@@ -102,12 +178,7 @@ void Object::setVersion(ObjectVersion version)
 
 Object* get_object(ObjectId id)
 {
-  base::scoped_lock hold(mutex);
-  auto it = objects.find(id);
-  if (it != objects.end())
-    return it->second;
-  else
-    return nullptr;
+  return registry().get(id);
 }
 
 } // namespace doc
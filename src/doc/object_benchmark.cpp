@@ -0,0 +1,65 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/object.h"
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <vector>
+
+using namespace doc;
+
+// Looks for objects by ID (like doc::get<T>() does from scripts). It
+// can be executed from several threads at the same time.
+static void BM_GetObject(benchmark::State& state)
+{
+  static std::vector<std::unique_ptr<Object>> objs;
+  static std::vector<ObjectId> ids;
+  if (state.thread_index() == 0) {
+    for (int i=0; i<state.range(0); ++i) {
+      objs.push_back(std::make_unique<Object>(ObjectType::Unknown));
+      ids.push_back(objs.back()->id());
+    }
+  }
+
+  std::size_t i = state.thread_index();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(get_object(ids[i % ids.size()]));
+    i += 7;
+  }
+
+  if (state.thread_index() == 0) {
+    objs.clear();
+    ids.clear();
+  }
+}
+
+// Creates objects and requests their ID (which adds them to the
+// registry), then destroys them (which removes them).
+static void BM_CreateObjectId(benchmark::State& state)
+{
+  for (auto _ : state) {
+    Object obj(ObjectType::Unknown);
+    benchmark::DoNotOptimize(obj.id());
+  }
+}
+
+BENCHMARK(BM_GetObject)
+  ->Arg(1024)
+  ->Arg(65536)
+  ->Threads(1)
+  ->Threads(4);
+
+BENCHMARK(BM_CreateObjectId)
+  ->Threads(1)
+  ->Threads(4);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,118 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/object.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace doc;
+
+TEST(Object, GetById)
+{
+  auto a = std::make_unique<Object>(ObjectType::Unknown);
+  auto b = std::make_unique<Object>(ObjectType::Unknown);
+  const ObjectId aId = a->id();
+  const ObjectId bId = b->id();
+  EXPECT_NE(NullId, aId);
+  EXPECT_NE(aId, bId);
+  EXPECT_EQ(a.get(), get_object(aId));
+  EXPECT_EQ(b.get(), get_object(bId));
+
+  a.reset();
+  EXPECT_EQ(nullptr, get_object(aId));
+  EXPECT_EQ(b.get(), get_object(bId));
+}
+
+TEST(Object, SetId)
+{
+  Object a(ObjectType::Unknown);
+  const ObjectId oldId = a.id();
+
+  // IDs far away from the generated ones
+  const ObjectId ids[] = { 0x00fff000, 0x7fffffff, 0xfffffffe };
+  for (ObjectId id : ids) {
+    EXPECT_EQ(nullptr, get_object(id));
+    a.setId(id);
+    EXPECT_EQ(id, a.id());
+    EXPECT_EQ(&a, get_object(id));
+    EXPECT_EQ(nullptr, get_object(oldId));
+  }
+
+  a.setId(NullId);
+  for (ObjectId id : ids)
+    EXPECT_EQ(nullptr, get_object(id));
+}
+
+TEST(Object, CopyDoesntCopyId)
+{
+  Object a(ObjectType::Image);
+  Object b(a);
+  EXPECT_NE(a.id(), b.id());
+  EXPECT_EQ(&a, get_object(a.id()));
+  EXPECT_EQ(&b, get_object(b.id()));
+}
+
+TEST(Object, Threads)
+{
+  const int nthreads = 4;
+  const int nobjects = 10000;
+
+  // Objects are created/destroyed in some threads, while other
+  // threads look for IDs of objects that are alive (and must be
+  // found) at the same time.
+  Object alive(ObjectType::Unknown);
+  const ObjectId aliveId = alive.id();
+  std::atomic<bool> stop(false);
+  std::atomic<int> errors(0);
+
+  std::vector<std::thread> threads;
+  for (int i=0; i<nthreads; ++i) {
+    threads.emplace_back(
+      [&]{
+        std::vector<std::unique_ptr<Object>> objs;
+        for (int j=0; j<nobjects; ++j) {
+          objs.push_back(std::make_unique<Object>(ObjectType::Unknown));
+          if (get_object(objs.back()->id()) != objs.back().get())
+            ++errors;
+        }
+        for (auto& obj : objs) {
+          const ObjectId id = obj->id();
+          obj.reset();
+          if (get_object(id) != nullptr)
+            ++errors;
+        }
+      });
+    threads.emplace_back(
+      [&]{
+        while (!stop)
+          if (get_object(aliveId) != &alive)
+            ++errors;
+      });
+  }
+
+  for (int i=0; i<nthreads; ++i)
+    threads[2*i].join();
+  stop = true;
+  for (int i=0; i<nthreads; ++i)
+    threads[2*i+1].join();
+
+  EXPECT_EQ(0, errors);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
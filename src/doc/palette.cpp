@@ -18,10 +18,37 @@
 #include <algorithm>
 #include <limits>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_PALETTE_SSE2 1
+  #include <emmintrin.h>
+#endif
+
 namespace doc {
 
 using namespace gfx;
 
+// Weights of each color component to calculate the distance between
+// two colors in findBestfit().
+static constexpr int kBestfitWeightR = 30;
+static constexpr int kBestfitWeightG = 59;
+static constexpr int kBestfitWeightB = 11;
+static constexpr int kBestfitWeightA = 8;
+
+// Max distance between two colors in findBestfit() (each component
+// has 5 bits)
+static constexpr int kBestfitMaxDistance =
+  31*31*(kBestfitWeightR*kBestfitWeightR +
+         kBestfitWeightG*kBestfitWeightG +
+         kBestfitWeightB*kBestfitWeightB +
+         kBestfitWeightA*kBestfitWeightA);
+
+// Value of the components of the extra entries in the bestfit table
+// (so the table size is a multiple of 4). The distance to these
+// entries is always greater than kBestfitMaxDistance (and doesn't
+// overflow 32-bit integers).
+static constexpr int16_t kBestfitPadding = 16000;
+
 Palette::Palette(frame_t frame, int ncolors)
   : Object(ObjectType::Palette)
 {
@@ -30,6 +57,7 @@ Palette::Palette(frame_t frame, int ncolors)
   m_frame = frame;
   m_colors.resize(ncolors, doc::rgba(0, 0, 0, 255));
   m_modifications = 0;
+  updateBestfitTable();
 }
 
 Palette::Palette(const Palette& palette)
@@ -39,6 +67,8 @@ Palette::Palette(const Palette& palette)
   m_frame = palette.m_frame;
   m_colors = palette.m_colors;
   m_modifications = 0;
+  m_bestfitGR = palette.m_bestfitGR;
+  m_bestfitBA = palette.m_bestfitBA;
 }
 
 Palette::Palette(const Palette& palette, const Remap& remap)
@@ -72,6 +102,7 @@ void Palette::resize(int ncolors)
 
   m_colors.resize(ncolors, doc::rgba(0, 0, 0, 255));
   ++m_modifications;
+  updateBestfitTable();
 }
 
 void Palette::addEntry(color_t color)
@@ -101,12 +132,15 @@ void Palette::setEntry(int i, color_t color)
 
   m_colors[i] = color;
   ++m_modifications;
+  updateBestfitEntry(i);
 }
 
 void Palette::copyColorsTo(Palette* dst) const
 {
   dst->m_colors = m_colors;
   ++dst->m_modifications;
+  dst->m_bestfitGR = m_bestfitGR;
+  dst->m_bestfitBA = m_bestfitBA;
 }
 
 int Palette::countDiff(const Palette* other, int* from, int* to) const
@@ -149,6 +183,7 @@ void Palette::makeBlack()
 {
   std::fill(m_colors.begin(), m_colors.end(), rgba(0, 0, 0, 255));
   ++m_modifications;
+  updateBestfitTable();
 }
 
 // Creates a linear ramp in the palette.
@@ -217,10 +252,10 @@ void Palette::initBestfit()
 
   for (int i=1; i<64; ++i) {
     int k = i * i;
-    col_diff_g[i] = col_diff_g[128-i] = k * 59 * 59;
-    col_diff_r[i] = col_diff_r[128-i] = k * 30 * 30;
-    col_diff_b[i] = col_diff_b[128-i] = k * 11 * 11;
-    col_diff_a[i] = col_diff_a[128-i] = k * 8 * 8;
+    col_diff_g[i] = col_diff_g[128-i] = k * kBestfitWeightG * kBestfitWeightG;
+    col_diff_r[i] = col_diff_r[128-i] = k * kBestfitWeightR * kBestfitWeightR;
+    col_diff_b[i] = col_diff_b[128-i] = k * kBestfitWeightB * kBestfitWeightB;
+    col_diff_a[i] = col_diff_a[128-i] = k * kBestfitWeightA * kBestfitWeightA;
   }
 }
 
@@ -241,6 +276,63 @@ int Palette::findBestfit(int r, int g, int b, int a, int mask_index) const
   if (a == 0 && mask_index >= 0)
     return mask_index;
 
+#ifdef DOC_PALETTE_SSE2
+
+  // Brute-force search of the 4 closest entries (one for each lane)
+  // in the bestfit table, it returns the same entry as the
+  // non-SSE2 version (the first entry with the lowest distance).
+  const int n = int(m_bestfitGR.size()) / 2;
+  const __m128i qgr = _mm_set1_epi32(
+    (g*kBestfitWeightG) | ((r*kBestfitWeightR) << 16));
+  const __m128i qba = _mm_set1_epi32(
+    (b*kBestfitWeightB) | ((a*kBestfitWeightA) << 16));
+  const __m128i maskIndex = _mm_set1_epi32(mask_index);
+  const __m128i maxDistance = _mm_set1_epi32(std::numeric_limits<int>::max());
+  const __m128i four = _mm_set1_epi32(4);
+  __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+  __m128i lowest = maxDistance;
+  __m128i bestfit = _mm_setzero_si128();
+
+  for (int i=0; i<n; i+=4) {
+    __m128i gr = _mm_sub_epi16(
+      _mm_loadu_si128((const __m128i*)&m_bestfitGR[2*i]), qgr);
+    __m128i ba = _mm_sub_epi16(
+      _mm_loadu_si128((const __m128i*)&m_bestfitBA[2*i]), qba);
+    __m128i coldiff = _mm_add_epi32(_mm_madd_epi16(gr, gr),
+                                    _mm_madd_epi16(ba, ba));
+
+    // Ignore the mask index
+    coldiff = _mm_or_si128(
+      coldiff, _mm_and_si128(_mm_cmpeq_epi32(index, maskIndex), maxDistance));
+
+    const __m128i lt = _mm_cmplt_epi32(coldiff, lowest);
+    lowest = _mm_or_si128(_mm_and_si128(lt, coldiff),
+                          _mm_andnot_si128(lt, lowest));
+    bestfit = _mm_or_si128(_mm_and_si128(lt, index),
+                           _mm_andnot_si128(lt, bestfit));
+    index = _mm_add_epi32(index, four);
+  }
+
+  int lowests[4], bestfits[4];
+  _mm_storeu_si128((__m128i*)lowests, lowest);
+  _mm_storeu_si128((__m128i*)bestfits, bestfit);
+
+  int j = 0;
+  for (int k=1; k<4; ++k) {
+    if (lowests[k] < lowests[j] ||
+        (lowests[k] == lowests[j] && bestfits[k] < bestfits[j]))
+      j = k;
+  }
+
+  // There is no valid entry (e.g. empty palette or just the mask
+  // index)
+  if (lowests[j] > kBestfitMaxDistance)
+    return 0;
+
+  return bestfits[j];
+
+#else
+
   int bestfit = 0;
   int lowest = std::numeric_limits<int>::max();
   int size = std::min(256, int(m_colors.size()));
@@ -268,6 +360,37 @@ int Palette::findBestfit(int r, int g, int b, int a, int mask_index) const
   }
 
   return bestfit;
+
+#endif
+}
+
+void Palette::updateBestfitEntry(int i)
+{
+  // Entries >= 256 aren't used in findBestfit()
+  if (2*i >= int(m_bestfitGR.size()))
+    return;
+
+  if (i < size()) {
+    const color_t c = m_colors[i];
+    m_bestfitGR[2*i  ] = (rgba_getg(c)>>3) * kBestfitWeightG;
+    m_bestfitGR[2*i+1] = (rgba_getr(c)>>3) * kBestfitWeightR;
+    m_bestfitBA[2*i  ] = (rgba_getb(c)>>3) * kBestfitWeightB;
+    m_bestfitBA[2*i+1] = (rgba_geta(c)>>3) * kBestfitWeightA;
+  }
+  else {
+    m_bestfitGR[2*i] = m_bestfitGR[2*i+1] = kBestfitPadding;
+    m_bestfitBA[2*i] = m_bestfitBA[2*i+1] = kBestfitPadding;
+  }
+}
+
+void Palette::updateBestfitTable()
+{
+  // Number of entries rounded up to a multiple of 4
+  const int n = ((std::min(256, size()) + 3) & ~3);
+  m_bestfitGR.resize(2*n);
+  m_bestfitBA.resize(2*n);
+  for (int i=0; i<n; ++i)
+    updateBestfitEntry(i);
 }
 
 void Palette::applyRemap(const Remap& remap)
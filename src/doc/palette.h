@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -13,6 +14,7 @@
 #include "doc/frame.h"
 #include "doc/object.h"
 
+#include <cstdint>
 #include <vector>
 #include <string>
 
@@ -99,10 +101,21 @@ namespace doc {
     const std::string& getEntryName(const int i) const;
 
   private:
+    void updateBestfitEntry(int i);
+    void updateBestfitTable();
+
     frame_t m_frame;
     std::vector<color_t> m_colors;
     std::vector<std::string> m_names;
     int m_modifications;
+
+    // Color components (in 5 bits and multiplied by its weight) of
+    // the first 256 entries used by findBestfit(). Each entry has two
+    // pairs of components (green/red and blue/alpha) so we can
+    // calculate 4 distances at the same time with SIMD instructions.
+    // It's updated each time the palette is modified.
+    std::vector<int16_t> m_bestfitGR;
+    std::vector<int16_t> m_bestfitBA;
     std::string m_filename; // If the palette is associated with a file.
     std::string m_comment; // Some extra comment from the .gpl file (author, website, etc.).
   };
@@ -0,0 +1,115 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/palette.h"
+
+#include <cstdlib>
+#include <limits>
+
+using namespace doc;
+
+// Linear search of the closest palette entry (the original
+// implementation of Palette::findBestfit())
+static int linear_bestfit(const Palette* palette,
+                          int r, int g, int b, int a, int mask_index)
+{
+  r >>= 3;
+  g >>= 3;
+  b >>= 3;
+  a >>= 3;
+
+  if (a == 0 && mask_index >= 0)
+    return mask_index;
+
+  int bestfit = 0;
+  int lowest = std::numeric_limits<int>::max();
+  int size = std::min(256, palette->size());
+
+  for (int i=0; i<size; ++i) {
+    color_t c = palette->getEntry(i);
+    int dr = (rgba_getr(c)>>3) - r;
+    int dg = (rgba_getg(c)>>3) - g;
+    int db = (rgba_getb(c)>>3) - b;
+    int da = (rgba_geta(c)>>3) - a;
+    int coldiff = (dg*dg*59*59 + dr*dr*30*30 + db*db*11*11 + da*da*8*8);
+    if (coldiff < lowest && i != mask_index) {
+      bestfit = i;
+      lowest = coldiff;
+    }
+  }
+  return bestfit;
+}
+
+static color_t random_color()
+{
+  return rgba(std::rand() % 256, std::rand() % 256,
+              std::rand() % 256, std::rand() % 256);
+}
+
+TEST(Palette, FindBestfit)
+{
+  Palette::initBestfit();
+  std::srand(2022);
+
+  for (int ncolors : { 0, 1, 2, 3, 5, 16, 17, 255, 256, 300 }) {
+    Palette pal(frame_t(0), ncolors);
+    for (int i=0; i<ncolors; ++i)
+      pal.setEntry(i, random_color());
+
+    // Some duplicated entries to check that we return the first one
+    if (ncolors > 10) {
+      pal.setEntry(9, pal.getEntry(3));
+      pal.setEntry(7, pal.getEntry(5));
+    }
+
+    for (int mask : { -1, 0, 3, ncolors-1 }) {
+      for (int j=0; j<2000; ++j) {
+        color_t c = (j < 100 && ncolors > 0 ? pal.getEntry(j % ncolors):
+                                              random_color());
+        int r = rgba_getr(c), g = rgba_getg(c);
+        int b = rgba_getb(c), a = rgba_geta(c);
+        ASSERT_EQ(linear_bestfit(&pal, r, g, b, a, mask),
+                  pal.findBestfit(r, g, b, a, mask))
+          << "ncolors=" << ncolors << " mask=" << mask
+          << " color=" << r << "," << g << "," << b << "," << a;
+      }
+    }
+  }
+}
+
+TEST(Palette, FindBestfitAfterModifications)
+{
+  Palette::initBestfit();
+
+  Palette pal(frame_t(0), 4);
+  pal.setEntry(0, rgba(0, 0, 0, 255));
+  pal.setEntry(1, rgba(255, 0, 0, 255));
+  pal.setEntry(2, rgba(0, 255, 0, 255));
+  pal.setEntry(3, rgba(0, 0, 255, 255));
+  EXPECT_EQ(1, pal.findBestfit(250, 10, 10, 255, -1));
+
+  pal.setEntry(2, rgba(250, 10, 10, 255));
+  EXPECT_EQ(2, pal.findBestfit(250, 10, 10, 255, -1));
+
+  pal.resize(6);
+  pal.setEntry(5, rgba(200, 200, 200, 255));
+  EXPECT_EQ(5, pal.findBestfit(210, 210, 210, 255, -1));
+
+  pal.makeBlack();
+  EXPECT_EQ(0, pal.findBestfit(210, 210, 210, 255, -1));
+
+  Palette copy(frame_t(0), 2);
+  pal.setEntry(4, rgba(200, 200, 200, 255));
+  pal.copyColorsTo(&copy);
+  EXPECT_EQ(4, copy.findBestfit(210, 210, 210, 255, -1));
+  EXPECT_EQ(4, Palette(copy).findBestfit(210, 210, 210, 255, -1));
+}
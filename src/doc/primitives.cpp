@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2018-2021 Igara Studio S.A.
+// Copyright (c) 2018-2022 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -12,12 +12,18 @@
 #include "doc/primitives.h"
 
 #include "doc/algo.h"
+#include "doc/bitmap_rows.h"
 #include "doc/brush.h"
 #include "doc/image_impl.h"
 #include "doc/palette.h"
+#include "doc/primitives_fast.h"
 #include "doc/remap.h"
+#include "doc/reverse_pixels.h"
 #include "doc/rgbmap.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <stdexcept>
 
 namespace doc {
@@ -70,7 +76,11 @@ Image* crop_image(const Image* image, int x, int y, int w, int h, color_t bg, co
   if (w < 1) throw std::invalid_argument("crop_image: Width is less than 1");
   if (h < 1) throw std::invalid_argument("crop_image: Height is less than 1");
 
-  Image* trim = Image::create(image->pixelFormat(), w, h, buffer);
+  // All pixels are overwritten below, so we can use a recycled
+  // buffer without zeroing it.
+  Image* trim = Image::create(image->pixelFormat(), w, h,
+                              buffer ? buffer:
+                                       std::make_shared<ImageBuffer>(1, false));
   trim->setMaskColor(image->maskColor());
 
   clear_image(trim, bg);
@@ -84,46 +94,112 @@ Image* crop_image(const Image* image, const gfx::Rect& bounds, color_t bg, const
   return crop_image(image, bounds.x, bounds.y, bounds.w, bounds.h, bg, buffer);
 }
 
+namespace {
+
+// Size of the square tiles used to rotate 90 degrees (so the rows of
+// the destination tile are still in cache when the next source row
+// is read).
+const int kRotateTileSize = 64;
+
+template<typename ImageTraits>
+void rotate_image_180_templ(const Image* src, Image* dst)
+{
+  const int w = src->width();
+  const int h = src->height();
+  for (int y=0; y<h; ++y) {
+    auto s = (typename ImageTraits::const_address_t)src->getPixelAddress(0, y);
+    auto d = (typename ImageTraits::address_t)dst->getPixelAddress(0, h-y-1);
+    std::copy(s, s+w, d);
+    reverse_pixels(d, w);
+  }
+}
+
+template<>
+void rotate_image_180_templ<BitmapTraits>(const Image* src, Image* dst)
+{
+  const int w = src->width();
+  const int h = src->height();
+  for (int y=0; y<h; ++y) {
+    const uint8_t* s = src->getPixelAddress(0, y);
+    uint8_t* d = dst->getPixelAddress(0, h-y-1);
+    for (int x=0; x<w; ) {
+      const int n = std::min(kBitmapChunkPixels, w-x);
+      write_bitmap_chunk(d, w-x-n, n,
+                         reverse_bitmap_chunk(read_bitmap_chunk(s, x, n), n));
+      x += n;
+    }
+  }
+}
+
+// Rotates 90 (clockwise) or -90 degrees walking the source image in
+// square tiles, instead of walking whole columns of the destination.
+template<typename ImageTraits>
+void rotate_image_90_templ(const Image* src, Image* dst, const bool clockwise)
+{
+  const int w = src->width();
+  const int h = src->height();
+  for (int ty=0; ty<h; ty+=kRotateTileSize) {
+    const int ty2 = std::min(h, ty+kRotateTileSize);
+    for (int tx=0; tx<w; tx+=kRotateTileSize) {
+      const int tx2 = std::min(w, tx+kRotateTileSize);
+      for (int y=ty; y<ty2; ++y) {
+        if (clockwise) {
+          for (int x=tx; x<tx2; ++x)
+            put_pixel_fast<ImageTraits>(dst, h-y-1, x,
+                                        get_pixel_fast<ImageTraits>(src, x, y));
+        }
+        else {
+          for (int x=tx; x<tx2; ++x)
+            put_pixel_fast<ImageTraits>(dst, y, w-x-1,
+                                        get_pixel_fast<ImageTraits>(src, x, y));
+        }
+      }
+    }
+  }
+}
+
+template<typename ImageTraits>
+void rotate_image_templ(const Image* src, Image* dst, const int angle)
+{
+  switch (angle) {
+    case 180: rotate_image_180_templ<ImageTraits>(src, dst); break;
+    case 90:  rotate_image_90_templ<ImageTraits>(src, dst, true); break;
+    case -90: rotate_image_90_templ<ImageTraits>(src, dst, false); break;
+  }
+}
+
+} // anonymous namespace
+
 void rotate_image(const Image* src, Image* dst, int angle)
 {
   ASSERT(src);
   ASSERT(dst);
-  int x, y;
+  ASSERT(src->pixelFormat() == dst->pixelFormat());
 
   switch (angle) {
 
     case 180:
       ASSERT(dst->width() == src->width());
       ASSERT(dst->height() == src->height());
-
-      for (y=0; y<src->height(); ++y)
-        for (x=0; x<src->width(); ++x)
-          dst->putPixel(src->width() - x - 1,
-                        src->height() - y - 1, src->getPixel(x, y));
       break;
 
     case 90:
-      ASSERT(dst->width() == src->height());
-      ASSERT(dst->height() == src->width());
-
-      for (y=0; y<src->height(); ++y)
-        for (x=0; x<src->width(); ++x)
-          dst->putPixel(src->height() - y - 1, x, src->getPixel(x, y));
-      break;
-
     case -90:
       ASSERT(dst->width() == src->height());
       ASSERT(dst->height() == src->width());
-
-      for (y=0; y<src->height(); ++y)
-        for (x=0; x<src->width(); ++x)
-          dst->putPixel(y, src->width() - x - 1, src->getPixel(x, y));
       break;
 
     // bad angle
     default:
       throw std::invalid_argument("Invalid angle specified to rotate the image");
   }
+
+  switch (src->pixelFormat()) {
+    case IMAGE_RGB:       rotate_image_templ<RgbTraits>(src, dst, angle); break;
+    case IMAGE_GRAYSCALE: rotate_image_templ<GrayscaleTraits>(src, dst, angle); break;
+    case IMAGE_INDEXED:   rotate_image_templ<IndexedTraits>(src, dst, angle); break;
+    case IMAGE_BITMAP:    rotate_image_templ<BitmapTraits>(src, dst, angle); break;
+  }
 }
 
 void draw_hline(Image* image, int x1, int y, int x2, color_t color)
@@ -299,8 +375,23 @@ namespace {
 template<typename ImageTraits>
 bool is_plain_image_templ(const Image* img, const color_t color)
 {
-  const LockImageBits<ImageTraits> bits(img);
-  typename LockImageBits<ImageTraits>::const_iterator it, end;
+  const int w = img->width();
+  const int h = img->height();
+  for (int y=0; y<h; ++y) {
+    auto ptr = (typename ImageTraits::const_address_t)img->getPixelAddress(0, y);
+    for (int x=0; x<w; ++x, ++ptr) {
+      if (*ptr != color)
+        return false;
+    }
+  }
+  return true;
+}
+
+template<>
+bool is_plain_image_templ<BitmapTraits>(const Image* img, const color_t color)
+{
+  const LockImageBits<BitmapTraits> bits(img);
+  LockImageBits<BitmapTraits>::const_iterator it, end;
   for (it=bits.begin(), end=bits.end(); it!=end; ++it) {
     if (*it != color)
       return false;
@@ -327,20 +418,28 @@ int count_diff_between_images_templ(const Image* i1, const Image* i2)
   return diff;
 }
 
+// Rows are compared with memcmp() (which is vectorized by the C
+// library), and only rows with different bytes are compared pixel by
+// pixel (e.g. transparent RGB pixels with different RGB components
+// are the same color, or the unused bits of the last byte of bitmap
+// rows can be different).
 template<typename ImageTraits>
 int is_same_image_templ(const Image* i1, const Image* i2)
 {
-  const LockImageBits<ImageTraits> bits1(i1);
-  const LockImageBits<ImageTraits> bits2(i2);
-  typename LockImageBits<ImageTraits>::const_iterator it1, it2, end1, end2;
-  for (it1 = bits1.begin(), end1 = bits1.end(),
-       it2 = bits2.begin(), end2 = bits2.end();
-       it1 != end1 && it2 != end2; ++it1, ++it2) {
-    if (!ImageTraits::same_color(*it1, *it2))
-      return false;
+  const int w = i1->width();
+  const int h = i1->height();
+  const int rowBytes = i1->getRowStrideSize(w);
+  for (int y=0; y<h; ++y) {
+    if (std::memcmp(i1->getPixelAddress(0, y),
+                    i2->getPixelAddress(0, y), rowBytes) == 0)
+      continue;
+
+    for (int x=0; x<w; ++x) {
+      if (!ImageTraits::same_color(get_pixel_fast<ImageTraits>(i1, x, y),
+                                   get_pixel_fast<ImageTraits>(i2, x, y)))
+        return false;
+    }
   }
-  ASSERT(it1 == end1);
-  ASSERT(it2 == end2);
   return true;
 }
 
@@ -401,62 +500,104 @@ bool is_same_image(const Image* i1, const Image* i2)
   return false;
 }
 
+// Remaps a row of indexed pixels using a table with the 256 possible
+// output values. Pixels are processed in groups of 8 (one 64-bit
+// load/store for each group).
+static void remap_row(const uint8_t* table, uint8_t* row, const int w)
+{
+  int x = 0;
+  for (; x+8<=w; x+=8, row+=8) {
+    uint64_t v;
+    std::memcpy(&v, row, 8);
+    v = (uint64_t(table[ v        & 0xff])      ) |
+        (uint64_t(table[(v >>  8) & 0xff]) <<  8) |
+        (uint64_t(table[(v >> 16) & 0xff]) << 16) |
+        (uint64_t(table[(v >> 24) & 0xff]) << 24) |
+        (uint64_t(table[(v >> 32) & 0xff]) << 32) |
+        (uint64_t(table[(v >> 40) & 0xff]) << 40) |
+        (uint64_t(table[(v >> 48) & 0xff]) << 48) |
+        (uint64_t(table[(v >> 56)       ]) << 56);
+    std::memcpy(row, &v, 8);
+  }
+  for (; x<w; ++x, ++row)
+    *row = table[*row];
+}
+
 void remap_image(Image* image, const Remap& remap)
 {
   ASSERT(image->pixelFormat() == IMAGE_INDEXED);
   if (image->pixelFormat() != IMAGE_INDEXED)
     return;
 
-  for (auto& pixel : LockImageBits<IndexedTraits>(image)) {
-    auto to = remap[pixel];
-    if (to != Remap::kUnused)
-      pixel = to;
+  // Table with the 256 possible results (unused entries are kept
+  // without changes)
+  uint8_t table[256];
+  bool identity = true;
+  for (int i=0; i<256; ++i) {
+    const int to = remap[i];
+    table[i] = uint8_t(to != Remap::kUnused ? to: i);
+    if (table[i] != i)
+      identity = false;
   }
+  if (identity)
+    return;
+
+  const int w = image->width();
+  const int h = image->height();
+  for (int y=0; y<h; ++y)
+    remap_row(table, (uint8_t*)image->getPixelAddress(0, y), w);
 }
 
-// TODO test this hash routine and find a better alternative
+// FNV-1a hash of each pixel. All transparent pixels are hashed as 0
+// (as is_same_image() considers them the same color), so two images
+// that are the same for is_same_image() have the same hash (this is
+// needed by doc::ImagesMap).
 
-template <typename ImageTraits, uint32_t Mask>
+template <typename ImageTraits>
+static inline void add_pixel_to_hash(uint32_t& hash, color_t value)
+{
+  if (ImageTraits::same_color(value, 0))
+    value = 0;
+  hash ^= value;
+  hash *= 16777619u;
+}
+
+template <typename ImageTraits>
 static uint32_t calculate_image_hash_templ(const Image* image,
                                            const gfx::Rect& bounds)
 {
-  uint32_t hash = 0;
+  uint32_t hash = 2166136261u;
   for (int y=0; y<bounds.h; ++y) {
-    auto p = (typename ImageTraits::address_t)image->getPixelAddress(bounds.x, bounds.y+y);
-    for (int x=0; x<bounds.w; ++x, ++p) {
-      uint32_t value = *p;
-      uint32_t mask = Mask;
-      while (mask) {
-        hash += value & mask & 0xff;
-        hash <<= 1;
-        value >>= 8;
-        mask >>= 8;
-      }
-    }
+    auto p = (typename ImageTraits::const_address_t)image->getPixelAddress(bounds.x, bounds.y+y);
+    for (int x=0; x<bounds.w; ++x, ++p)
+      add_pixel_to_hash<ImageTraits>(hash, *p);
   }
   return hash;
 }
 
+template <>
+uint32_t calculate_image_hash_templ<BitmapTraits>(const Image* image,
+                                                  const gfx::Rect& bounds)
+{
+  uint32_t hash = 2166136261u;
+  for (int y=0; y<bounds.h; ++y)
+    for (int x=0; x<bounds.w; ++x)
+      add_pixel_to_hash<BitmapTraits>(
+        hash, get_pixel_fast<BitmapTraits>(image, bounds.x+x, bounds.y+y));
+  return hash;
+}
+
 uint32_t calculate_image_hash(const Image* img, const gfx::Rect& bounds)
 {
   switch (img->pixelFormat()) {
-    case IMAGE_RGB:       return calculate_image_hash_templ<RgbTraits, rgba_rgb_mask>(img, bounds);
-    case IMAGE_GRAYSCALE: return calculate_image_hash_templ<GrayscaleTraits, graya_v_mask>(img, bounds);
-    case IMAGE_INDEXED:   return calculate_image_hash_templ<IndexedTraits, 0xff>(img, bounds);
-    case IMAGE_BITMAP:    return calculate_image_hash_templ<BitmapTraits, 1>(img, bounds);
+    case IMAGE_RGB:       return calculate_image_hash_templ<RgbTraits>(img, bounds);
+    case IMAGE_GRAYSCALE: return calculate_image_hash_templ<GrayscaleTraits>(img, bounds);
+    case IMAGE_INDEXED:   return calculate_image_hash_templ<IndexedTraits>(img, bounds);
+    case IMAGE_BITMAP:    return calculate_image_hash_templ<BitmapTraits>(img, bounds);
   }
 
-  uint32_t hash = 0;
-  for (int y=0; y<bounds.h; ++y) {
-    int bytes = img->getRowStrideSize(bounds.w);
-    uint8_t* p = img->getPixelAddress(bounds.x, bounds.y+y);
-    while (bytes-- > 0) {
-      hash += *p;
-      hash <<= 1;
-      ++p;
-    }
-  }
-  return hash;
+  ASSERT(false);
+  return 0;
 }
 
 } // namespace doc
@@ -11,9 +11,14 @@
 
 #include <gtest/gtest.h>
 
-#include "doc/remap.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
 #include "doc/palette.h"
 #include "doc/palette_picks.h"
+#include "doc/primitives.h"
+#include "doc/remap.h"
+
+#include <cstdlib>
 
 using namespace doc;
 
@@ -219,6 +224,36 @@ TEST(Remap, BetweenPalettesNonInvertible)
   EXPECT_FALSE(map.isInvertible(all));
 }
 
+TEST(Remap, RemapImage)
+{
+  // Odd width to test the last pixels of each row
+  ImageRef image(Image::create(IMAGE_INDEXED, 37, 5));
+  ImageRef expected(Image::create(IMAGE_INDEXED, 37, 5));
+  for (int y=0; y<image->height(); ++y)
+    for (int x=0; x<image->width(); ++x)
+      put_pixel(image.get(), x, y, std::rand() % 256);
+
+  // Remap with less entries than the possible pixel values
+  Remap map(200);
+  for (int i=0; i<map.size(); ++i)
+    map.map(i, map.size()-i-1);
+  map.unused(3);
+  map.unused(150);
+
+  for (int y=0; y<image->height(); ++y)
+    for (int x=0; x<image->width(); ++x) {
+      const int from = get_pixel(image.get(), x, y);
+      const int to = map[from];
+      put_pixel(expected.get(), x, y, to != Remap::kUnused ? to: from);
+    }
+
+  remap_image(image.get(), map);
+  for (int y=0; y<image->height(); ++y)
+    for (int x=0; x<image->width(); ++x)
+      ASSERT_EQ(get_pixel(expected.get(), x, y),
+                get_pixel(image.get(), x, y));
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -15,47 +15,55 @@
 #include "doc/color.h"
 #include "doc/image.h"
 #include "doc/image_ref.h"
+#include "doc/palette.h"
 #include "doc/primitives.h"
+#include "doc/rgbmap.h"
+
+#include <cmath>
+#include <cstdlib>
 
 using namespace std;
 using namespace doc;
 
 // Test data
 
-// Base image
+// Base image (opaque pixels, transparent pixels are compared as
+// equal colors in count_diff_between_images())
 color_t test_image_base_3x3[9] =
 {
-  0x000000, 0xffffff, 0x000000,
-  0xffffff, 0xffffff, 0xffffff,
-  0x000000, 0xffffff, 0x000000
+  0xff000000, 0xffffffff, 0xff000000,
+  0xffffffff, 0xffffffff, 0xffffffff,
+  0xff000000, 0xffffffff, 0xff000000
 };
 
 // Base image scaled to 9x9 with nearest neighbor interpolation
 color_t test_image_scaled_9x9_nearest[81] =
 {
-  0x000000, 0x000000, 0x000000, 0xffffff, 0xffffff, 0xffffff, 0x000000, 0x000000, 0x000000,
-  0x000000, 0x000000, 0x000000, 0xffffff, 0xffffff, 0xffffff, 0x000000, 0x000000, 0x000000,
-  0x000000, 0x000000, 0x000000, 0xffffff, 0xffffff, 0xffffff, 0x000000, 0x000000, 0x000000,
-  0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff,
-  0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff,
-  0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff,
-  0x000000, 0x000000, 0x000000, 0xffffff, 0xffffff, 0xffffff, 0x000000, 0x000000, 0x000000,
-  0x000000, 0x000000, 0x000000, 0xffffff, 0xffffff, 0xffffff, 0x000000, 0x000000, 0x000000,
-  0x000000, 0x000000, 0x000000, 0xffffff, 0xffffff, 0xffffff, 0x000000, 0x000000, 0x000000
+  0xff000000, 0xff000000, 0xff000000, 0xffffffff, 0xffffffff, 0xffffffff, 0xff000000, 0xff000000, 0xff000000,
+  0xff000000, 0xff000000, 0xff000000, 0xffffffff, 0xffffffff, 0xffffffff, 0xff000000, 0xff000000, 0xff000000,
+  0xff000000, 0xff000000, 0xff000000, 0xffffffff, 0xffffffff, 0xffffffff, 0xff000000, 0xff000000, 0xff000000,
+  0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+  0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+  0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+  0xff000000, 0xff000000, 0xff000000, 0xffffffff, 0xffffffff, 0xffffffff, 0xff000000, 0xff000000, 0xff000000,
+  0xff000000, 0xff000000, 0xff000000, 0xffffffff, 0xffffffff, 0xffffffff, 0xff000000, 0xff000000, 0xff000000,
+  0xff000000, 0xff000000, 0xff000000, 0xffffffff, 0xffffffff, 0xffffffff, 0xff000000, 0xff000000, 0xff000000
 };
 
-// Base image scalled to 9x9 with bilinear interpolation
+// Base image scaled to 9x9 with bilinear interpolation (7-bit fixed
+// point weights, each destination pixel center is mapped to the
+// source image)
 color_t test_image_scaled_9x9_bilinear[81] =
 {
-  0x000000, 0x000000, 0x565656, 0xa9a9a9, 0xffffff, 0xa9a9a9, 0x565656, 0x000000, 0x000000,
-  0x000000, 0x000000, 0x565656, 0xa9a9a9, 0xffffff, 0xa9a9a9, 0x565656, 0x000000, 0x000000,
-  0x565656, 0x565656, 0x8f8f8f, 0xc6c6c6, 0xffffff, 0xc6c6c6, 0x8f8f8f, 0x565656, 0x565656,
-  0xa9a9a9, 0xa9a9a9, 0xc6c6c6, 0xe2e2e2, 0xffffff, 0xe2e2e2, 0xc6c6c6, 0xa9a9a9, 0xa9a9a9,
-  0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff, 0xffffff,
-  0xa9a9a9, 0xa9a9a9, 0xc6c6c6, 0xe2e2e2, 0xffffff, 0xe2e2e2, 0xc6c6c6, 0xa9a9a9, 0xa9a9a9,
-  0x565656, 0x565656, 0x8f8f8f, 0xc6c6c6, 0xffffff, 0xc6c6c6, 0x8f8f8f, 0x565656, 0x565656,
-  0x000000, 0x000000, 0x565656, 0xa9a9a9, 0xffffff, 0xa9a9a9, 0x565656, 0x000000, 0x000000,
-  0x000000, 0x000000, 0x565656, 0xa9a9a9, 0xffffff, 0xa9a9a9, 0x565656, 0x000000, 0x000000
+  0xff000000, 0xff404040, 0xff808080, 0xffbfbfbf, 0xffffffff, 0xffbfbfbf, 0xff808080, 0xff404040, 0xff000000,
+  0xff404040, 0xff707070, 0xff9f9f9f, 0xffcfcfcf, 0xffffffff, 0xffcfcfcf, 0xff9f9f9f, 0xff707070, 0xff404040,
+  0xff808080, 0xff9f9f9f, 0xffbfbfbf, 0xffdfdfdf, 0xffffffff, 0xffdfdfdf, 0xffbfbfbf, 0xff9f9f9f, 0xff808080,
+  0xffbfbfbf, 0xffcfcfcf, 0xffdfdfdf, 0xffefefef, 0xffffffff, 0xffefefef, 0xffdfdfdf, 0xffcfcfcf, 0xffbfbfbf,
+  0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+  0xffbfbfbf, 0xffcfcfcf, 0xffdfdfdf, 0xffefefef, 0xffffffff, 0xffefefef, 0xffdfdfdf, 0xffcfcfcf, 0xffbfbfbf,
+  0xff808080, 0xff9f9f9f, 0xffbfbfbf, 0xffdfdfdf, 0xffffffff, 0xffdfdfdf, 0xffbfbfbf, 0xff9f9f9f, 0xff808080,
+  0xff404040, 0xff707070, 0xff9f9f9f, 0xffcfcfcf, 0xffffffff, 0xffcfcfcf, 0xff9f9f9f, 0xff707070, 0xff404040,
+  0xff000000, 0xff404040, 0xff808080, 0xffbfbfbf, 0xffffffff, 0xffbfbfbf, 0xff808080, 0xff404040, 0xff000000
 };
 
 ImageRef create_image_from_data(PixelFormat format, color_t* data, int width, int height)
@@ -86,7 +94,6 @@ TEST(ResizeImage, NearestNeighborInterp)
   ASSERT_EQ(0, count_diff_between_images(src.get(), dst2.get()));
 }
 
-#if 0                           // TODO complete this test
 TEST(ResizeImage, BilinearInterpRGBType)
 {
   ImageRef src(create_image_from_data(IMAGE_RGB, test_image_base_3x3, 3, 3));
@@ -99,7 +106,96 @@ TEST(ResizeImage, BilinearInterpRGBType)
 
   ASSERT_EQ(0, count_diff_between_images(dst.get(), dst_expected.get()));
 }
-#endif
+
+static void fill_random_image(Image* image)
+{
+  for (int y=0; y<image->height(); ++y)
+    for (int x=0; x<image->width(); ++x) {
+      const int v = std::rand() % 256;
+      switch (image->pixelFormat()) {
+        case IMAGE_RGB: put_pixel(image, x, y, rgba(v, 255-v, v/2, std::rand() % 256)); break;
+        case IMAGE_GRAYSCALE: put_pixel(image, x, y, graya(v, std::rand() % 256)); break;
+        case IMAGE_INDEXED: put_pixel(image, x, y, v); break;
+        case IMAGE_BITMAP: put_pixel(image, x, y, v & 1); break;
+      }
+    }
+}
+
+TEST(ResizeImage, NearestNeighborAllFormats)
+{
+  std::srand(1);
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED, IMAGE_BITMAP }) {
+    ImageRef src(Image::create(format, 37, 23));
+    fill_random_image(src.get());
+
+    for (int scale=1; scale<4; ++scale) {
+      ImageRef dst(Image::create(format, 37*scale-5, 23*scale+3));
+      algorithm::resize_image(src.get(), dst.get(),
+                              algorithm::RESIZE_METHOD_NEAREST_NEIGHBOR,
+                              nullptr, nullptr, -1);
+
+      const double xr = double(src->width()) / double(dst->width());
+      const double yr = double(src->height()) / double(dst->height());
+      for (int y=0; y<dst->height(); ++y)
+        for (int x=0; x<dst->width(); ++x)
+          ASSERT_EQ(get_pixel(src.get(), int(std::floor(x*xr)), int(std::floor(y*yr))),
+                    get_pixel(dst.get(), x, y))
+            << "format=" << format << " scale=" << scale << " (" << x << "," << y << ")";
+    }
+  }
+}
+
+TEST(ResizeImage, BilinearInterpRGBMiddle)
+{
+  // The middle pixel is the average of the two source pixels
+  ImageRef src(Image::create(IMAGE_RGB, 2, 1));
+  put_pixel(src.get(), 0, 0, rgba(0, 100, 200, 255));
+  put_pixel(src.get(), 1, 0, rgba(100, 200, 0, 255));
+
+  ImageRef dst(Image::create(IMAGE_RGB, 3, 1));
+  algorithm::resize_image(src.get(), dst.get(),
+                          algorithm::RESIZE_METHOD_BILINEAR,
+                          nullptr, nullptr, -1);
+  EXPECT_EQ(rgba(0, 100, 200, 255), get_pixel(dst.get(), 0, 0));
+  EXPECT_EQ(rgba(50, 150, 100, 255), get_pixel(dst.get(), 1, 0));
+  EXPECT_EQ(rgba(100, 200, 0, 255), get_pixel(dst.get(), 2, 0));
+
+  // A solid color is kept
+  src.reset(Image::create(IMAGE_RGB, 17, 13));
+  clear_image(src.get(), rgba(10, 20, 30, 40));
+  dst.reset(Image::create(IMAGE_RGB, 50, 31));
+  algorithm::resize_image(src.get(), dst.get(),
+                          algorithm::RESIZE_METHOD_BILINEAR,
+                          nullptr, nullptr, -1);
+  for (int y=0; y<dst->height(); ++y)
+    for (int x=0; x<dst->width(); ++x)
+      ASSERT_EQ(rgba(10, 20, 30, 40), get_pixel(dst.get(), x, y));
+}
+
+TEST(ResizeImage, SameResultWithThreads)
+{
+  std::srand(2);
+  Palette pal(frame_t(0), 256);
+  for (int i=0; i<256; ++i)
+    pal.setEntry(i, rgba(i, (i*3) & 255, (i*7) & 255, 255));
+  RgbMap rgbmap;
+  rgbmap.regenerate(&pal, 0);
+
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED }) {
+    ImageRef src(Image::create(format, 301, 257));
+    fill_random_image(src.get());
+
+    for (auto method : { algorithm::RESIZE_METHOD_NEAREST_NEIGHBOR,
+                         algorithm::RESIZE_METHOD_BILINEAR }) {
+      ImageRef a(Image::create(format, 1024, 700));
+      ImageRef b(Image::create(format, 1024, 700));
+      algorithm::resize_image(src.get(), a.get(), method, &pal, &rgbmap, 0, 1);
+      algorithm::resize_image(src.get(), b.get(), method, &pal, &rgbmap, 0, 4);
+      EXPECT_EQ(0, count_diff_between_images(a.get(), b.get()))
+        << "format=" << format << " method=" << method;
+    }
+  }
+}
 
 int main(int argc, char** argv)
 {
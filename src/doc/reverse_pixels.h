@@ -0,0 +1,81 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_REVERSE_PIXELS_H_INCLUDED
+#define DOC_REVERSE_PIXELS_H_INCLUDED
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_REVERSE_PIXELS_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+namespace doc {
+
+  // Reverses the order of the "n" pixels of a row (used to flip
+  // images horizontally). Pixels are swapped in blocks of 16 bytes
+  // from both ends of the row when SSE2 is available.
+  template<typename T>
+  inline void reverse_pixels(T* p, const int n) {
+    std::reverse(p, p+n);
+  }
+
+#if DOC_REVERSE_PIXELS_SSE2
+
+  namespace detail {
+
+    inline __m128i reverse_epi32(const __m128i v) {
+      return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    }
+
+    inline __m128i reverse_epi16(__m128i v) {
+      v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+      v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+      return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+    }
+
+    inline __m128i reverse_epi8(const __m128i v) {
+      return reverse_epi16(_mm_or_si128(_mm_slli_epi16(v, 8),
+                                        _mm_srli_epi16(v, 8)));
+    }
+
+    template<typename T, typename Reverse>
+    inline void reverse_pixels_sse2(T* l, T* r, Reverse reverse) {
+      const int k = 16 / sizeof(T); // Pixels in each block
+      for (; r-l >= 2*k; l+=k, r-=k) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)l);
+        const __m128i b = _mm_loadu_si128((const __m128i*)(r-k));
+        _mm_storeu_si128((__m128i*)l, reverse(b));
+        _mm_storeu_si128((__m128i*)(r-k), reverse(a));
+      }
+      std::reverse(l, r);
+    }
+
+  } // namespace detail
+
+  template<>
+  inline void reverse_pixels<uint32_t>(uint32_t* p, const int n) {
+    detail::reverse_pixels_sse2(p, p+n, detail::reverse_epi32);
+  }
+
+  template<>
+  inline void reverse_pixels<uint16_t>(uint16_t* p, const int n) {
+    detail::reverse_pixels_sse2(p, p+n, detail::reverse_epi16);
+  }
+
+  template<>
+  inline void reverse_pixels<uint8_t>(uint8_t* p, const int n) {
+    detail::reverse_pixels_sse2(p, p+n, detail::reverse_epi8);
+  }
+
+#endif // DOC_REVERSE_PIXELS_SSE2
+
+} // namespace doc
+
+#endif
@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -10,9 +11,17 @@
 
 #include "doc/rgbmap.h"
 
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
 #include "doc/color_scales.h"
 #include "doc/palette.h"
 
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <thread>
+
 namespace doc {
 
 #define RSIZE   32
@@ -21,6 +30,53 @@ namespace doc {
 #define ASIZE   8
 #define MAPSIZE (RSIZE*GSIZE*BSIZE*ASIZE)
 
+namespace {
+
+// Max number of fully generated maps in the pool (each one uses 64KB)
+constexpr int kMaxPoolSize = 16;
+
+// Number of entries generated by each thread in each step
+constexpr int kEntriesPerStep = 1024;
+
+// A fully generated map for the given palette colors/mask index.
+struct GeneratedMap {
+  std::vector<color_t> colors;  // First 256 palette entries (the only ones used by findBestfit())
+  int maskIndex;
+  std::vector<uint16_t> map;
+};
+
+typedef std::shared_ptr<const GeneratedMap> GeneratedMapPtr;
+
+std::atomic<bool> eager(false);
+base::mutex poolMutex;
+std::list<GeneratedMapPtr> pool; // Most recently used maps first
+
+std::vector<color_t> palette_colors(const Palette* palette)
+{
+  std::vector<color_t> colors(std::min(256, palette->size()));
+  for (int i=0; i<int(colors.size()); ++i)
+    colors[i] = palette->getEntry(i);
+  return colors;
+}
+
+} // anonymous namespace
+
+// static
+void RgbMap::setEagerGeneration(bool state)
+{
+  eager = state;
+  if (!state) {
+    base::scoped_lock lock(poolMutex);
+    pool.clear();
+  }
+}
+
+// static
+bool RgbMap::eagerGeneration()
+{
+  return eager;
+}
+
 RgbMap::RgbMap()
   : Object(ObjectType::RgbMap)
   , m_map(MAPSIZE)
@@ -42,11 +98,81 @@ void RgbMap::regenerate(const Palette* palette, int mask_index)
   m_modifications = palette->getModifications();
   m_maskIndex = mask_index;
 
+  if (eager) {
+    auto colors = palette_colors(palette);
+
+    // Copy the entries from a map generated for the same colors
+    {
+      base::scoped_lock lock(poolMutex);
+      for (auto it=pool.begin(); it!=pool.end(); ++it) {
+        if ((*it)->maskIndex == mask_index &&
+            (*it)->colors == colors) {
+          m_map = (*it)->map;
+          pool.splice(pool.begin(), pool, it);
+          return;
+        }
+      }
+    }
+
+    generateEntries(false);
+
+    auto generated = std::make_shared<GeneratedMap>();
+    generated->colors = std::move(colors);
+    generated->maskIndex = mask_index;
+    generated->map = m_map;
+
+    base::scoped_lock lock(poolMutex);
+    pool.push_front(generated);
+    if (int(pool.size()) > kMaxPoolSize)
+      pool.pop_back();
+    return;
+  }
+
   // Mark all entries as invalid (need to be regenerated)
   for (uint16_t& entry : m_map)
     entry |= INVALID;
 }
 
+void RgbMap::generatePendingEntries() const
+{
+  if (m_palette &&
+      std::any_of(m_map.begin(), m_map.end(),
+                  [this](const uint16_t entry){ return (entry & INVALID); }))
+    generateEntries(true);
+}
+
+void RgbMap::generateEntries(const bool onlyPending) const
+{
+  std::atomic<int> next(0);
+  auto generate = [this, &next, onlyPending]{
+    int i;
+    while ((i = (next += kEntriesPerStep) - kEntriesPerStep) < MAPSIZE) {
+      const int end = std::min(i+kEntriesPerStep, MAPSIZE);
+      for (; i<end; ++i) {
+        if (onlyPending && !(m_map[i] & INVALID))
+          continue;
+
+        // Inverse of the index calculated in mapColor()
+        m_map[i] =
+          m_palette->findBestfit(
+            scale_5bits_to_8bits((i >> 13) & 31),
+            scale_5bits_to_8bits((i >> 8) & 31),
+            scale_5bits_to_8bits((i >> 3) & 31),
+            scale_3bits_to_8bits(i & 7), m_maskIndex);
+      }
+    }
+  };
+
+  // The current thread generates entries too
+  const int nthreads = std::max<int>(1, std::thread::hardware_concurrency());
+  std::vector<std::thread> threads;
+  for (int i=1; i<nthreads; ++i)
+    threads.emplace_back(generate);
+  generate();
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
 int RgbMap::generateEntry(int i, int r, int g, int b, int a) const
 {
   return m_map[i] =
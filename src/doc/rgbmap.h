@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -12,6 +13,7 @@
 #include "base/disable_copying.h"
 #include "doc/object.h"
 
+#include <cstdint>
 #include <vector>
 
 namespace doc {
@@ -42,8 +44,24 @@ namespace doc {
 
     int maskIndex() const { return m_maskIndex; }
 
+    // Calculates all entries that weren't used yet. After this,
+    // mapColor() doesn't modify the map, so it can be used from
+    // several threads at the same time.
+    void generatePendingEntries() const;
+
+    // When eager generation is enabled, regenerate() calculates all
+    // entries of the map at once (using several threads) instead of
+    // calculating each entry the first time it's used in mapColor().
+    // Fully generated maps are kept in a small pool, so other maps
+    // for palettes with the same colors (e.g. other
+    // sprites/frames, or undoing a palette change) copy the entries
+    // from the pool.
+    static void setEagerGeneration(bool state);
+    static bool eagerGeneration();
+
   private:
     int generateEntry(int i, int r, int g, int b, int a) const;
+    void generateEntries(const bool onlyPending) const;
 
     mutable std::vector<uint16_t> m_map;
     const Palette* m_palette;
@@ -0,0 +1,85 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/palette.h"
+#include "doc/rgbmap.h"
+
+#include <cstdlib>
+
+using namespace doc;
+
+static void make_random_palette(Palette& palette)
+{
+  for (int i=0; i<palette.size(); ++i)
+    palette.setEntry(i, rgba(std::rand() % 256,
+                             std::rand() % 256,
+                             std::rand() % 256,
+                             std::rand() % 256));
+}
+
+static void expect_same_mapping(const RgbMap& a, const RgbMap& b)
+{
+  for (int r=0; r<256; r+=8)
+    for (int g=0; g<256; g+=8)
+      for (int b2=0; b2<256; b2+=8)
+        for (int alpha=0; alpha<256; alpha+=32)
+          ASSERT_EQ(a.mapColor(r, g, b2, alpha),
+                    b.mapColor(r, g, b2, alpha));
+}
+
+TEST(RgbMap, EagerGenerationMatchesLazyGeneration)
+{
+  for (int mask : { -1, 0, 5 }) {
+    Palette palette(frame_t(0), 64);
+    make_random_palette(palette);
+
+    RgbMap::setEagerGeneration(false);
+    RgbMap lazy;
+    lazy.regenerate(&palette, mask);
+
+    RgbMap::setEagerGeneration(true);
+    RgbMap eager;
+    eager.regenerate(&palette, mask);
+
+    expect_same_mapping(lazy, eager);
+  }
+  RgbMap::setEagerGeneration(false);
+}
+
+TEST(RgbMap, ReuseMapOfPaletteWithSameColors)
+{
+  RgbMap::setEagerGeneration(true);
+
+  Palette a(frame_t(0), 256);
+  make_random_palette(a);
+  Palette b(a);
+  Palette c(a);
+  c.setEntry(0, rgba(1, 2, 3, 255));
+
+  RgbMap mapA, mapB, mapC;
+  mapA.regenerate(&a, -1);
+  mapB.regenerate(&b, -1); // Copied from the pool
+  mapC.regenerate(&c, -1); // New map
+  expect_same_mapping(mapA, mapB);
+
+  EXPECT_EQ(0, mapC.mapColor(1, 2, 3, 255));
+  EXPECT_TRUE(mapB.match(&b));
+  EXPECT_FALSE(mapB.match(&a));
+
+  RgbMap::setEagerGeneration(false);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -25,8 +25,11 @@
 #include "doc/tag.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <limits>
 #include <memory>
+#include <thread>
 #include <vector>
 
 namespace doc {
@@ -489,13 +492,39 @@ void Sprite::remapImages(frame_t frameFrom, frame_t frameTo, const Remap& remap)
   ASSERT(pixelFormat() == IMAGE_INDEXED);
   //ASSERT(remap.size() == 256);
 
+  std::vector<Image*> images;
+  std::size_t pixels = 0;
   for (const Cel* cel : uniqueCels()) {
     // Remap this Cel because is inside the specified range
     if (cel->frame() >= frameFrom &&
         cel->frame() <= frameTo) {
-      remap_image(cel->image(), remap);
+      images.push_back(cel->image());
+      pixels += std::size_t(cel->image()->width()) * cel->image()->height();
     }
   }
+
+  // Each image is remapped by one thread (only when there are enough
+  // pixels to compensate the cost of creating threads)
+  const std::size_t kMinPixelsPerThread = 256*1024;
+  const int nthreads =
+    int(std::min<std::size_t>(
+          std::min<std::size_t>(std::max<int>(1, std::thread::hardware_concurrency()),
+                                images.size()),
+          std::max<std::size_t>(1, pixels / kMinPixelsPerThread)));
+
+  std::atomic<int> next(0);
+  auto remapImages = [&]{
+    int i;
+    while ((i = next++) < int(images.size()))
+      remap_image(images[i], remap);
+  };
+
+  std::vector<std::thread> threads;
+  for (int i=1; i<nthreads; ++i)
+    threads.emplace_back(remapImages);
+  remapImages();
+  for (std::thread& thread : threads)
+    thread.join();
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -506,11 +535,14 @@ void Sprite::pickCels(const double x,
                       const frame_t frame,
                       const int opacityThreshold,
                       const LayerList& layers,
-                      CelList& cels) const
+                      CelList& cels,
+                      const int maxCels) const
 {
   gfx::PointF pos(x, y);
+  // Number of cels that we can add to the list
+  int n = (maxCels > 0 ? maxCels: std::numeric_limits<int>::max());
 
-  for (int i=(int)layers.size()-1; i>=0; --i) {
+  for (int i=(int)layers.size()-1; i>=0 && n>0; --i) {
     const Layer* layer = layers[i];
     if (!layer->isImage())
       continue;
@@ -557,6 +589,7 @@ void Sprite::pickCels(const double x,
       continue;
 
     cels.push_back(cel);
+    --n;
   }
 }
 
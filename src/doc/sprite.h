@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (C) 2018-2019  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -168,12 +168,19 @@ namespace doc {
     void replaceImage(ObjectId curImageId, const ImageRef& newImage);
     void getImages(std::vector<Image*>& images) const;
     void remapImages(frame_t frameFrom, frame_t frameTo, const Remap& remap);
+
+    // Adds to "cels" the cels of the given layers with an opaque
+    // pixel in the given position, from the top-most layer (the last
+    // one of the list). If maxCels > 0, the search stops (without
+    // reading the pixels of the other cels) when "cels" has maxCels
+    // cels, e.g. 1 to get only the top-most cel.
     void pickCels(const double x,
                   const double y,
                   const frame_t frame,
                   const int opacityThreshold,
                   const LayerList& layers,
-                  CelList& cels) const;
+                  CelList& cels,
+                  const int maxCels = 0) const;
 
     ////////////////////////////////////////
     // Iterators
@@ -15,9 +15,11 @@
 #include "doc/cels_range.h"
 #include "doc/layer.h"
 #include "doc/pixel_format.h"
+#include "doc/primitives.h"
 #include "doc/sprite.h"
 
 #include <memory>
+#include <vector>
 
 using namespace doc;
 
@@ -193,6 +195,51 @@ TEST(Sprite, CelsRange)
   EXPECT_EQ(3, i);
 }
 
+TEST(Sprite, PickCels)
+{
+  std::shared_ptr<Sprite> sprPtr(std::make_shared<Sprite>(
+                                   ImageSpec(ColorMode::RGB, 32, 32), 256));
+  Sprite* spr = sprPtr.get();
+
+  // Three layers with opaque cels at (0,0)-(16,16), and the middle
+  // one with a transparent pixel at (4,4)
+  std::vector<Cel*> cels;
+  for (int i=0; i<3; ++i) {
+    LayerImage* lay = new LayerImage(spr);
+    spr->root()->addLayer(lay);
+
+    ImageRef img(Image::create(IMAGE_RGB, 16, 16));
+    clear_image(img.get(), rgba(255, 0, 0, 255));
+    if (i == 1)
+      put_pixel(img.get(), 4, 4, 0);
+    Cel* cel = new Cel(frame_t(0), img);
+    lay->addCel(cel);
+    cels.push_back(cel);
+  }
+
+  const LayerList layers = spr->allLayers();
+  CelList picked;
+  spr->pickCels(2, 2, frame_t(0), 1, layers, picked);
+  ASSERT_EQ(3, picked.size());
+  EXPECT_EQ(cels[2], picked[0]);
+  EXPECT_EQ(cels[0], picked[2]);
+
+  picked.clear();
+  spr->pickCels(4.5, 4.5, frame_t(0), 1, layers, picked);
+  ASSERT_EQ(2, picked.size());
+  EXPECT_EQ(cels[2], picked[0]);
+  EXPECT_EQ(cels[0], picked[1]);
+
+  picked.clear();
+  spr->pickCels(2, 2, frame_t(0), 1, layers, picked, 1);
+  ASSERT_EQ(1, picked.size());
+  EXPECT_EQ(cels[2], picked[0]);
+
+  picked.clear();
+  spr->pickCels(20, 20, frame_t(0), 1, layers, picked);
+  EXPECT_TRUE(picked.empty());
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,231 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace doc {
+namespace trace {
+
+namespace {
+
+struct Event {
+  const char* name;
+  int64_t start;                // In nanoseconds since the epoch
+  int64_t end;
+};
+
+// Ring buffer of the last events of one thread. It's kept alive
+// after the thread finishes (so its events can be saved).
+struct ThreadBuffer {
+  int tid;
+  std::mutex mutex;             // Only used by this thread and the exporter
+  std::vector<Event> events;
+  uint64_t count = 0;           // Total number of events added
+
+  struct Stats {
+    int count = 0;
+    int64_t total = 0;
+    int64_t max = 0;
+  };
+  std::unordered_map<const char*, Stats> stats;
+};
+
+std::mutex g_mutex;             // To access g_buffers
+std::vector<std::shared_ptr<ThreadBuffer>> g_buffers;
+std::chrono::steady_clock::time_point g_epoch = std::chrono::steady_clock::now();
+
+ThreadBuffer* get_thread_buffer()
+{
+  thread_local std::shared_ptr<ThreadBuffer> buffer;
+  if (!buffer) {
+    buffer = std::make_shared<ThreadBuffer>();
+    buffer->events.resize(kMaxEventsPerThread);
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    buffer->tid = int(g_buffers.size()) + 1;
+    g_buffers.push_back(buffer);
+  }
+  return buffer.get();
+}
+
+void append_json_string(std::string& out, const char* str)
+{
+  out.push_back('"');
+  for (; *str; ++str) {
+    switch (*str) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      default:
+        if (uint8_t(*str) >= 0x20)
+          out.push_back(*str);
+        break;
+    }
+  }
+  out.push_back('"');
+}
+
+} // anonymous namespace
+
+namespace detail {
+
+std::atomic<int> g_flags(0);
+
+int64_t now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - g_epoch).count();
+}
+
+void add_event(const char* name, const int64_t start, const int64_t end)
+{
+  const int flags = g_flags;
+  ThreadBuffer* buffer = get_thread_buffer();
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+
+  if (flags & kRecording) {
+    Event& ev = buffer->events[buffer->count % buffer->events.size()];
+    ev.name = name;
+    ev.start = start;
+    ev.end = end;
+    ++buffer->count;
+  }
+
+  if (flags & kStats) {
+    auto& stats = buffer->stats[name];
+    ++stats.count;
+    stats.total += end - start;
+    stats.max = std::max(stats.max, end - start);
+  }
+}
+
+} // namespace detail
+
+void start_recording()
+{
+  {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    for (auto& buffer : g_buffers) {
+      std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+      buffer->count = 0;
+    }
+  }
+  detail::g_flags |= detail::kRecording;
+}
+
+void stop_recording()
+{
+  detail::g_flags &= ~detail::kRecording;
+}
+
+int recorded_events()
+{
+  std::lock_guard<std::mutex> lock(g_mutex);
+  uint64_t n = 0;
+  for (auto& buffer : g_buffers) {
+    std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+    n += std::min<uint64_t>(buffer->count, buffer->events.size());
+  }
+  return int(n);
+}
+
+std::string chrome_trace_json()
+{
+  std::string out = "{\"traceEvents\":[";
+  bool first = true;
+  char buf[128];
+
+  std::lock_guard<std::mutex> lock(g_mutex);
+  for (auto& buffer : g_buffers) {
+    std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+    const uint64_t size = buffer->events.size();
+    const uint64_t n = std::min(buffer->count, size);
+    for (uint64_t i=buffer->count-n; i<buffer->count; ++i) {
+      const Event& ev = buffer->events[i % size];
+      if (!first)
+        out.push_back(',');
+      first = false;
+
+      out += "\n{\"name\":";
+      append_json_string(out, ev.name);
+      // Timestamps in microseconds
+      std::snprintf(buf, sizeof(buf),
+                    ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                    double(ev.start) / 1000.0,
+                    double(ev.end - ev.start) / 1000.0,
+                    buffer->tid);
+      out += buf;
+    }
+  }
+  out += "\n]}\n";
+  return out;
+}
+
+void start_stats()
+{
+  zone_stats(true);
+  detail::g_flags |= detail::kStats;
+}
+
+void stop_stats()
+{
+  detail::g_flags &= ~detail::kStats;
+}
+
+bool is_collecting_stats()
+{
+  return (detail::g_flags & detail::kStats) != 0;
+}
+
+std::vector<ZoneStats> zone_stats(const bool reset)
+{
+  // Zones with the same name from different threads are merged
+  std::map<std::string, ZoneStats> merged;
+
+  std::lock_guard<std::mutex> lock(g_mutex);
+  for (auto& buffer : g_buffers) {
+    std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+    for (const auto& it : buffer->stats) {
+      ZoneStats& zone = merged[it.first];
+      zone.name = it.first;
+      zone.count += it.second.count;
+      zone.totalTime += double(it.second.total) / 1e9;
+      zone.maxTime = std::max(zone.maxTime, double(it.second.max) / 1e9);
+    }
+    if (reset)
+      buffer->stats.clear();
+  }
+
+  std::vector<ZoneStats> result;
+  for (auto& it : merged)
+    result.push_back(std::move(it.second));
+  return result;
+}
+
+bool save_chrome_trace(const std::string& filename)
+{
+  const std::string json = chrome_trace_json();
+  FILE* f = std::fopen(filename.c_str(), "wb");
+  if (!f)
+    return false;
+  const bool ok = (std::fwrite(json.c_str(), 1, json.size(), f) == json.size());
+  return (std::fclose(f) == 0 && ok);
+}
+
+} // namespace trace
+} // namespace doc
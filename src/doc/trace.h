@@ -0,0 +1,98 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_TRACE_H_INCLUDED
+#define DOC_TRACE_H_INCLUDED
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Use DOC_TRACE_ZONE("name") at the beginning of a scope to record
+// how much time that scope takes (the name must be a string literal
+// or a string that lives until the trace is saved).
+#define DOC_TRACE_ZONE_CONCAT2(a, b) a##b
+#define DOC_TRACE_ZONE_CONCAT(a, b) DOC_TRACE_ZONE_CONCAT2(a, b)
+#define DOC_TRACE_ZONE(name) \
+  doc::trace::Zone DOC_TRACE_ZONE_CONCAT(trace_zone_, __LINE__)(name)
+
+namespace doc {
+namespace trace {
+
+  namespace detail {
+    enum Flags {
+      kRecording = 1,           // Zones are added to the trace
+      kStats = 2,               // Zones are added to the stats
+    };
+    extern std::atomic<int> g_flags;
+    int64_t now();
+    void add_event(const char* name, const int64_t start, const int64_t end);
+  }
+
+  // Returns true if trace zones are being recorded or the stats are
+  // being collected. When both are stopped, a zone only checks this
+  // flag.
+  inline bool is_enabled() {
+    return (detail::g_flags.load(std::memory_order_relaxed) != 0);
+  }
+
+  inline bool is_recording() {
+    return (detail::g_flags.load(std::memory_order_relaxed) & detail::kRecording) != 0;
+  }
+
+  // Starts recording zones (the previous recorded zones are
+  // discarded).
+  void start_recording();
+  void stop_recording();
+
+  // Number of recorded zones (each thread keeps only its last
+  // kMaxEventsPerThread zones).
+  int recorded_events();
+
+  // Saves the recorded zones in the Chrome trace event format (JSON)
+  // that can be opened with chrome://tracing or Perfetto.
+  std::string chrome_trace_json();
+  bool save_chrome_trace(const std::string& filename);
+
+  // Live counters of each zone (e.g. to show them in a performance
+  // panel), collected from all threads since the last reset.
+  struct ZoneStats {
+    std::string name;
+    int count = 0;
+    double totalTime = 0.0;     // In seconds
+    double maxTime = 0.0;
+  };
+
+  void start_stats();
+  void stop_stats();
+  bool is_collecting_stats();
+  std::vector<ZoneStats> zone_stats(const bool reset = true);
+
+  const int kMaxEventsPerThread = 64*1024;
+
+  class Zone {
+  public:
+    explicit Zone(const char* name)
+      : m_name(name)
+      , m_start(is_enabled() ? detail::now(): -1) {
+    }
+    ~Zone() {
+      if (m_start >= 0)
+        detail::add_event(m_name, m_start, detail::now());
+    }
+    Zone(const Zone&) = delete;
+    Zone& operator=(const Zone&) = delete;
+  private:
+    const char* m_name;
+    int64_t m_start;
+  };
+
+} // namespace trace
+} // namespace doc
+
+#endif
@@ -0,0 +1,97 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/trace.h"
+
+#include <thread>
+#include <vector>
+
+using namespace doc;
+
+TEST(Trace, NothingIsRecordedWhenStopped)
+{
+  trace::stop_recording();
+  trace::start_recording();
+  trace::stop_recording();
+  {
+    DOC_TRACE_ZONE("zone");
+  }
+  EXPECT_EQ(0, trace::recorded_events());
+}
+
+TEST(Trace, RecordZonesFromSeveralThreads)
+{
+  trace::start_recording();
+  {
+    DOC_TRACE_ZONE("main \"zone\"");
+    std::vector<std::thread> threads;
+    for (int i=0; i<4; ++i)
+      threads.emplace_back([]{
+        for (int j=0; j<10; ++j) {
+          DOC_TRACE_ZONE("worker");
+        }
+      });
+    for (auto& thread : threads)
+      thread.join();
+  }
+  trace::stop_recording();
+
+  EXPECT_EQ(41, trace::recorded_events());
+
+  const std::string json = trace::chrome_trace_json();
+  EXPECT_EQ(0, json.find("{\"traceEvents\":["));
+  EXPECT_NE(std::string::npos, json.find("\"name\":\"main \\\"zone\\\"\""));
+  EXPECT_NE(std::string::npos, json.find("\"ph\":\"X\""));
+}
+
+TEST(Trace, RingBufferKeepsTheLastEvents)
+{
+  trace::start_recording();
+  for (int i=0; i<trace::kMaxEventsPerThread+10; ++i) {
+    DOC_TRACE_ZONE("zone");
+  }
+  trace::stop_recording();
+  EXPECT_EQ(trace::kMaxEventsPerThread, trace::recorded_events());
+}
+
+TEST(Trace, ZoneStats)
+{
+  trace::start_stats();
+  for (int i=0; i<3; ++i) {
+    DOC_TRACE_ZONE("a");
+    std::thread([]{
+      DOC_TRACE_ZONE("a");
+      DOC_TRACE_ZONE("b");
+    }).join();
+  }
+  trace::stop_stats();
+  {
+    DOC_TRACE_ZONE("a");
+  }
+
+  auto stats = trace::zone_stats();
+  ASSERT_EQ(2, int(stats.size()));
+  EXPECT_EQ("a", stats[0].name);
+  EXPECT_EQ(6, stats[0].count);
+  EXPECT_EQ("b", stats[1].name);
+  EXPECT_EQ(3, stats[1].count);
+  EXPECT_LE(stats[1].maxTime, stats[1].totalTime);
+
+  // Stats were reset
+  EXPECT_TRUE(trace::zone_stats().empty());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2017  David Capello
 //
 // This program is distributed under the terms of
@@ -15,6 +15,7 @@
 #include "doc/image.h"
 #include "doc/palette.h"
 #include "doc/rgbmap.h"
+#include "filters/channels_lut.h"
 #include "filters/filter_indexed_data.h"
 #include "filters/filter_manager.h"
 #include "gfx/hsl.h"
@@ -51,15 +52,37 @@ void BrightnessContrastFilter::setContrast(double contrast)
   updateMap();
 }
 
+bool BrightnessContrastFilter::getChannelsLut(const Target target, ChannelsLut& lut) const
+{
+  // Colors of RGB images are replaced using the palette, and indexes
+  // are never modified (the palette colors are used instead)
+  if (m_usePaletteOnRGB || (target & TARGET_INDEX_CHANNEL))
+    return false;
+
+  // The alpha channel is not modified
+  lut.setTables(target & (TARGET_RED_CHANNEL |
+                          TARGET_GREEN_CHANNEL |
+                          TARGET_BLUE_CHANNEL |
+                          TARGET_GRAY_CHANNEL),
+                [this](int v){ return m_cmap[v]; });
+  return true;
+}
+
 void BrightnessContrastFilter::applyToRgba(FilterManager* filterMgr)
 {
+  if (!m_usePaletteOnRGB) {
+    ChannelsLut lut;
+    getChannelsLut(filterMgr->getTarget(), lut);
+    lut.applyToRgba(filterMgr);
+    return;
+  }
+
   FilterIndexedData* fid = filterMgr->getIndexedData();
   const Palette* pal = fid->getPalette();
-  Palette* newPal = (m_usePaletteOnRGB ? fid->getNewPalette(): nullptr);
+  Palette* newPal = fid->getNewPalette();
   const uint32_t* src_address = (uint32_t*)filterMgr->getSourceAddress();
   uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
   const int w = filterMgr->getWidth();
-  const Target target = filterMgr->getTarget();
 
   for (int x=0; x<w; x++) {
     if (filterMgr->skipPixel()) {
@@ -69,19 +92,13 @@ void BrightnessContrastFilter::applyToRgba(FilterManager* filterMgr)
     }
 
     color_t c = *(src_address++);
-
-    if (newPal) {
-      int i =
-        pal->findExactMatch(rgba_getr(c),
-                            rgba_getg(c),
-                            rgba_getb(c),
-                            rgba_geta(c), -1);
-      if (i >= 0)
-        c = newPal->getEntry(i);
-    }
-    else {
-      applyFilterToRgb(target, c);
-    }
+    int i =
+      pal->findExactMatch(rgba_getr(c),
+                          rgba_getg(c),
+                          rgba_getb(c),
+                          rgba_geta(c), -1);
+    if (i >= 0)
+      c = newPal->getEntry(i);
 
     *(dst_address++) = c;
   }
@@ -89,69 +106,37 @@ void BrightnessContrastFilter::applyToRgba(FilterManager* filterMgr)
 
 void BrightnessContrastFilter::applyToGrayscale(FilterManager* filterMgr)
 {
-  const uint16_t* src_address = (uint16_t*)filterMgr->getSourceAddress();
-  uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
-  const int w = filterMgr->getWidth();
-  const Target target = filterMgr->getTarget();
-
-  for (int x=0; x<w; x++) {
-    if (filterMgr->skipPixel()) {
-      ++src_address;
-      ++dst_address;
-      continue;
-    }
-
-    color_t c = *(src_address++);
-    int k = graya_getv(c);
-    int a = graya_geta(c);
-
-    if (target & TARGET_GRAY_CHANNEL) k = m_cmap[k];
-
-    *(dst_address++) = graya(k, a);
-  }
+  ChannelsLut lut;
+  getChannelsLut(filterMgr->getTarget(), lut);
+  lut.applyToGrayscale(filterMgr);
 }
 
 void BrightnessContrastFilter::applyToIndexed(FilterManager* filterMgr)
 {
-  FilterIndexedData* fid = filterMgr->getIndexedData();
-
   // Apply filter to pixels if there is selection (in other case, the
   // change is global, so we have already applied the filter to the
   // palette).
   if (!filterMgr->isMaskActive())
     return;
 
-  // Apply filter to color region
-  const Target target = filterMgr->getTarget();
-  const Palette* pal = fid->getPalette();
-  const RgbMap* rgbmap = fid->getRgbMap();
-  const uint8_t* src_address = (uint8_t*)filterMgr->getSourceAddress();
-  uint8_t* dst_address = (uint8_t*)filterMgr->getDestinationAddress();
-  const int w = filterMgr->getWidth();
-
-  for (int x=0; x<w; x++) {
-    if (filterMgr->skipPixel()) {
-      ++src_address;
-      ++dst_address;
-      continue;
-    }
-
-    color_t c = pal->getEntry(*(src_address++));
-    applyFilterToRgb(target, c);
-    *(dst_address++) = rgbmap->mapColor(rgba_getr(c),
-                                        rgba_getg(c),
-                                        rgba_getb(c),
-                                        rgba_geta(c));
-  }
+  // Apply filter to color region (always using the palette colors)
+  const Target target = (filterMgr->getTarget() & ~TARGET_INDEX_CHANNEL);
+  ChannelsLut lut;
+  getChannelsLut(target, lut);
+  lut.applyToIndexed(filterMgr, target);
 }
 
 void BrightnessContrastFilter::onApplyToPalette(FilterManager* filterMgr,
                                                 const PalettePicks& picks)
 {
-  const Target target = filterMgr->getTarget();
   FilterIndexedData* fid = filterMgr->getIndexedData();
   const Palette* pal = fid->getPalette();
   Palette* newPal = fid->getNewPalette();
+  ChannelsLut lut;
+  lut.setTables(filterMgr->getTarget() & (TARGET_RED_CHANNEL |
+                                          TARGET_GREEN_CHANNEL |
+                                          TARGET_BLUE_CHANNEL),
+                [this](int v){ return m_cmap[v]; });
 
   int i = 0;
   for (bool state : picks) {
@@ -160,28 +145,11 @@ void BrightnessContrastFilter::onApplyToPalette(FilterManager* filterMgr,
       continue;
     }
 
-    color_t c = pal->getEntry(i);
-    applyFilterToRgb(target, c);
-    newPal->setEntry(i, c);
+    newPal->setEntry(i, lut.applyToRgba(pal->getEntry(i)));
     ++i;
   }
 }
 
-void BrightnessContrastFilter::applyFilterToRgb(
-  const Target target, doc::color_t& c)
-{
-  int r = rgba_getr(c);
-  int g = rgba_getg(c);
-  int b = rgba_getb(c);
-  int a = rgba_geta(c);
-
-  if (target & TARGET_RED_CHANNEL  ) r = m_cmap[r];
-  if (target & TARGET_GREEN_CHANNEL) g = m_cmap[g];
-  if (target & TARGET_BLUE_CHANNEL ) b = m_cmap[b];
-
-  c = rgba(r, g, b, a);
-}
-
 void BrightnessContrastFilter::updateMap()
 {
   int max = int(m_cmap.size());
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2017  David Capello
 //
 // This program is distributed under the terms of
@@ -29,6 +29,8 @@ namespace filters {
 
     // Filter implementation
     const char* getName() override;
+    bool isBandSafe() const override { return true; }
+    bool getChannelsLut(const Target target, ChannelsLut& lut) const override;
     void applyToRgba(FilterManager* filterMgr) override;
     void applyToGrayscale(FilterManager* filterMgr) override;
     void applyToIndexed(FilterManager* filterMgr) override;
@@ -36,7 +38,6 @@ namespace filters {
   private:
     void onApplyToPalette(FilterManager* filterMgr,
                           const doc::PalettePicks& picks) override;
-    void applyFilterToRgb(const Target target, doc::color_t& color);
     void updateMap();
 
     double m_brightness, m_contrast;
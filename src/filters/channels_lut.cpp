@@ -0,0 +1,119 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "filters/channels_lut.h"
+
+#include "base/clamp.h"
+#include "doc/palette.h"
+#include "doc/rgbmap.h"
+#include "filters/filter_indexed_data.h"
+#include "filters/filter_manager.h"
+
+#include <algorithm>
+
+namespace filters {
+
+using namespace doc;
+
+ChannelsLut::ChannelsLut()
+{
+  for (int c=0; c<Channels; ++c)
+    for (int v=0; v<256; ++v)
+      m_tables[c][v] = v;
+}
+
+bool ChannelsLut::isIdentity() const
+{
+  for (int c=0; c<Channels; ++c)
+    for (int v=0; v<256; ++v)
+      if (m_tables[c][v] != v)
+        return false;
+  return true;
+}
+
+void ChannelsLut::compose(const ChannelsLut& next)
+{
+  for (int c=0; c<Channels; ++c)
+    for (int v=0; v<256; ++v)
+      m_tables[c][v] = next.m_tables[c][m_tables[c][v]];
+}
+
+void ChannelsLut::applyToRgba(FilterManager* filterMgr) const
+{
+  const uint32_t* src_address = (uint32_t*)filterMgr->getSourceAddress();
+  uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
+  const int w = filterMgr->getWidth();
+
+  for (int x=0; x<w; ++x, ++src_address, ++dst_address) {
+    if (filterMgr->skipPixel())
+      continue;
+
+    *dst_address = applyToRgba(*src_address);
+  }
+}
+
+void ChannelsLut::applyToGrayscale(FilterManager* filterMgr) const
+{
+  const uint16_t* src_address = (uint16_t*)filterMgr->getSourceAddress();
+  uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
+  const int w = filterMgr->getWidth();
+
+  for (int x=0; x<w; ++x, ++src_address, ++dst_address) {
+    if (filterMgr->skipPixel())
+      continue;
+
+    const uint16_t c = *src_address;
+    *dst_address = graya(m_tables[Gray][graya_getv(c)],
+                         m_tables[Alpha][graya_geta(c)]);
+  }
+}
+
+void ChannelsLut::applyToIndexed(FilterManager* filterMgr,
+                                 const Target target) const
+{
+  const uint8_t* src_address = (uint8_t*)filterMgr->getSourceAddress();
+  uint8_t* dst_address = (uint8_t*)filterMgr->getDestinationAddress();
+  const int w = filterMgr->getWidth();
+  const Palette* pal = filterMgr->getIndexedData()->getPalette();
+  const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
+  const int maxIndex = pal->size()-1;
+
+  if (target & TARGET_INDEX_CHANNEL) {
+    for (int x=0; x<w; ++x, ++src_address, ++dst_address) {
+      if (filterMgr->skipPixel())
+        continue;
+
+      *dst_address = std::min<int>(m_tables[Index][*src_address], maxIndex);
+    }
+    return;
+  }
+
+  // The new index depends only on the old one, so we cache the
+  // mapped index of each palette entry used in this row
+  int map[256];
+  std::fill(map, map+256, -1);
+
+  for (int x=0; x<w; ++x, ++src_address, ++dst_address) {
+    if (filterMgr->skipPixel())
+      continue;
+
+    int& i = map[*src_address];
+    if (i < 0) {
+      const color_t c = applyToRgba(pal->getEntry(*src_address));
+      i = base::clamp(rgbmap->mapColor(rgba_getr(c),
+                                       rgba_getg(c),
+                                       rgba_getb(c),
+                                       rgba_geta(c)), 0, maxIndex);
+    }
+    *dst_address = i;
+  }
+}
+
+} // namespace filters
@@ -0,0 +1,75 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef FILTERS_CHANNELS_LUT_H_INCLUDED
+#define FILTERS_CHANNELS_LUT_H_INCLUDED
+#pragma once
+
+#include "doc/color.h"
+#include "filters/target.h"
+
+#include <cstdint>
+
+namespace filters {
+
+  class FilterManager;
+
+  // A table of 256 values for each channel, used to apply point
+  // filters (filters where each channel of the result depends only
+  // in the same channel of the source pixel, e.g. color curves or
+  // invert color) with one lookup for each channel. Tables of
+  // several point filters can be composed to apply all of them in
+  // just one pass.
+  class ChannelsLut {
+  public:
+    // Channels in the same order of TARGET_* bits
+    enum Channel { Red, Green, Blue, Alpha, Gray, Index, Channels };
+
+    // Creates identity tables (the channels aren't modified)
+    ChannelsLut();
+
+    // Sets the "f(value)" function (called for each value from 0 to
+    // 255) as the table of the channels in "target".
+    template<typename F>
+    void setTables(const Target target, F f) {
+      for (int c=0; c<Channels; ++c) {
+        if (target & (1 << c)) {
+          for (int v=0; v<256; ++v)
+            m_tables[c][v] = f(v);
+        }
+      }
+    }
+
+    const uint8_t* table(const Channel c) const { return m_tables[c]; }
+
+    // Returns true if the tables don't modify any channel.
+    bool isIdentity() const;
+
+    // Appends the given tables, i.e. each table will be
+    // next[this[value]].
+    void compose(const ChannelsLut& next);
+
+    doc::color_t applyToRgba(const doc::color_t c) const {
+      return doc::rgba(m_tables[Red][doc::rgba_getr(c)],
+                       m_tables[Green][doc::rgba_getg(c)],
+                       m_tables[Blue][doc::rgba_getb(c)],
+                       m_tables[Alpha][doc::rgba_geta(c)]);
+    }
+
+    // Applies the tables to the current FilterManager row. Indexed
+    // images use the Index table, or the RGBA tables on the palette
+    // colors if TARGET_INDEX_CHANNEL isn't in the given target.
+    void applyToRgba(FilterManager* filterMgr) const;
+    void applyToGrayscale(FilterManager* filterMgr) const;
+    void applyToIndexed(FilterManager* filterMgr, const Target target) const;
+
+  private:
+    uint8_t m_tables[Channels][256];
+  };
+
+} // namespace filters
+
+#endif
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -25,6 +25,8 @@ namespace filters {
 
     // Filter implementation
     const char* getName();
+    bool isBandSafe() const { return true; }
+    bool getChannelsLut(const Target target, ChannelsLut& lut) const;
     void applyToRgba(FilterManager* filterMgr);
     void applyToGrayscale(FilterManager* filterMgr);
     void applyToIndexed(FilterManager* filterMgr);
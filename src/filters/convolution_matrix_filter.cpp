@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -20,95 +20,190 @@
 #include "doc/palette.h"
 #include "doc/rgbmap.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define FILTERS_CONVMATR_SSE2 1
+  #include <emmintrin.h>
+#endif
+
 namespace filters {
 
 using namespace doc;
 
 namespace {
 
-  struct GetPixelsDelegate {
-    int div;
-    const int* matrixData;
+  // Max number of channels used to convolve each pixel
+  constexpr int kMaxChannels = 6;
+
+  // Gets the r, g, b, a values of non-transparent pixels (or zero for
+  // transparent pixels) and 1 for transparent pixels, from the given
+  // columns of a RGBA row, in 5 arrays of "stride" values.
+  void get_rgba_channels(const uint32_t* row, const int* cols, const int n,
+                         int16_t* channels, const int stride)
+  {
+    int i = 0;
+#if FILTERS_CONVMATR_SSE2
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i one = _mm_set1_epi16(1);
+    for (; i+8<=n; i+=8) {
+      // Columns can be clamped or wrapped in the image edges
+      if (cols[i+7] != cols[i]+7) {
+        for (int k=i; k<i+8; ++k) {
+          const color_t color = row[cols[k]];
+          const bool transparent = (rgba_geta(color) == 0);
+          channels[k]          = (transparent ? 0: rgba_getr(color));
+          channels[stride+k]   = (transparent ? 0: rgba_getg(color));
+          channels[2*stride+k] = (transparent ? 0: rgba_getb(color));
+          channels[3*stride+k] = (transparent ? 0: rgba_geta(color));
+          channels[4*stride+k] = (transparent ? 1: 0);
+        }
+        continue;
+      }
 
-    void reset(const ConvolutionMatrix* matrix) {
-      div = matrix->getDiv();
-      matrixData = &matrix->value(0, 0);
+      __m128i lo = _mm_loadu_si128((const __m128i*)(row+cols[i]));
+      __m128i hi = _mm_loadu_si128((const __m128i*)(row+cols[i]+4));
+      // Clear transparent pixels
+      const __m128i tlo = _mm_cmpeq_epi32(_mm_srli_epi32(lo, 24), _mm_setzero_si128());
+      const __m128i thi = _mm_cmpeq_epi32(_mm_srli_epi32(hi, 24), _mm_setzero_si128());
+      lo = _mm_andnot_si128(tlo, lo);
+      hi = _mm_andnot_si128(thi, hi);
+
+      for (int c=0; c<4; ++c) {
+        const __m128i v =
+          _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8*c), mask),
+                          _mm_and_si128(_mm_srli_epi32(hi, 8*c), mask));
+        _mm_storeu_si128((__m128i*)(channels+c*stride+i), v);
+      }
+      _mm_storeu_si128((__m128i*)(channels+4*stride+i),
+                       _mm_and_si128(_mm_packs_epi32(tlo, thi), one));
     }
-  };
-
-  struct GetPixelsDelegateRgba : public GetPixelsDelegate {
-    int r, g, b, a;
-
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      r = g = b = a = 0;
+#endif
+    for (; i<n; ++i) {
+      const color_t color = row[cols[i]];
+      const bool transparent = (rgba_geta(color) == 0);
+      channels[i]          = (transparent ? 0: rgba_getr(color));
+      channels[stride+i]   = (transparent ? 0: rgba_getg(color));
+      channels[2*stride+i] = (transparent ? 0: rgba_getb(color));
+      channels[3*stride+i] = (transparent ? 0: rgba_geta(color));
+      channels[4*stride+i] = (transparent ? 1: 0);
     }
+  }
 
-    void operator()(RgbTraits::pixel_t color) {
-      if (*matrixData) {
-        if (rgba_geta(color) == 0)
-          div -= *matrixData;
-        else {
-          r += rgba_getr(color) * (*matrixData);
-          g += rgba_getg(color) * (*matrixData);
-          b += rgba_getb(color) * (*matrixData);
-          a += rgba_geta(color) * (*matrixData);
-        }
+  // acc[i] += wa*a[i] + wb*b[i] for each i in [0,n)
+  void mul_add_rows(int* acc, const int16_t* a, const int16_t* b,
+                    const int wa, const int wb, const int n)
+  {
+    int i = 0;
+#if FILTERS_CONVMATR_SSE2
+    // Two multiplications for each 32-bit value with _mm_madd_epi16()
+    if (int16_t(wa) == wa && int16_t(wb) == wb) {
+      const __m128i w = _mm_set1_epi32((wb << 16) | (wa & 0xffff));
+      for (; i+8<=n; i+=8) {
+        const __m128i va = _mm_loadu_si128((const __m128i*)(a+i));
+        const __m128i vb = _mm_loadu_si128((const __m128i*)(b+i));
+        __m128i* p = (__m128i*)(acc+i);
+        _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p),
+                                          _mm_madd_epi16(_mm_unpacklo_epi16(va, vb), w)));
+        _mm_storeu_si128(p+1, _mm_add_epi32(_mm_loadu_si128(p+1),
+                                            _mm_madd_epi16(_mm_unpackhi_epi16(va, vb), w)));
       }
-      matrixData++;
     }
-  };
-
-  struct GetPixelsDelegateGrayscale : public GetPixelsDelegate {
-    int v, a;
+#endif
+    for (; i<n; ++i)
+      acc[i] += wa*a[i] + wb*b[i];
+  }
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      v = a = 0;
+  // acc[i] += v*a[i] for each i in [0,n)
+  void mul_add_row(int* acc, const int* a, const int v, const int n)
+  {
+    int i = 0;
+#if FILTERS_CONVMATR_SSE2
+    // SSE2 doesn't have _mm_mullo_epi32(), so we multiply the even
+    // and odd values separately and keep the low 32-bit of each one
+    const __m128i vv = _mm_set1_epi32(v);
+    for (; i+4<=n; i+=4) {
+      const __m128i va = _mm_loadu_si128((const __m128i*)(a+i));
+      const __m128i even = _mm_mul_epu32(va, vv);
+      const __m128i odd = _mm_mul_epu32(_mm_srli_si128(va, 4), vv);
+      const __m128i mul =
+        _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                           _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+      __m128i* p = (__m128i*)(acc+i);
+      _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), mul));
     }
+#endif
+    for (; i<n; ++i)
+      acc[i] += v*a[i];
+  }
 
-    void operator()(GrayscaleTraits::pixel_t color) {
-      if (*matrixData) {
-        if (graya_geta(color) == 0)
-          div -= *matrixData;
-        else {
-          v += graya_getv(color) * (*matrixData);
-          a += graya_geta(color) * (*matrixData);
-        }
-      }
-      matrixData++;
+  // Decomposes the matrix in one outer product of two 1D kernels
+  // with integer values.
+  bool decompose_in_one_term(const ConvolutionMatrix& m,
+                             std::vector<int>& horz,
+                             std::vector<int>& vert)
+  {
+    const int w = m.getWidth();
+    const int h = m.getHeight();
+
+    // The first non-zero row divided by the GCD of its values is the
+    // horizontal kernel
+    int y0 = 0;
+    int gcd = 0;
+    for (; y0<h && gcd == 0; ++y0)
+      for (int x=0; x<w; ++x)
+        gcd = std::gcd(gcd, m.value(x, y0));
+    if (gcd == 0)                 // All values are zero
+      return false;
+
+    --y0;
+    horz.resize(w);
+    int x0 = -1;
+    for (int x=0; x<w; ++x) {
+      horz[x] = m.value(x, y0) / gcd;
+      if (x0 < 0 && horz[x] != 0)
+        x0 = x;
     }
-  };
-
-  struct GetPixelsDelegateIndexed : public GetPixelsDelegate {
-    const Palette* pal;
-    int r, g, b, a, index;
-
-    GetPixelsDelegateIndexed(const Palette* pal) : pal(pal) { }
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      r = g = b = a = index = 0;
+    // Each row must be a multiple of the horizontal kernel
+    vert.resize(h);
+    for (int y=0; y<h; ++y) {
+      vert[y] = m.value(x0, y) / horz[x0];
+      for (int x=0; x<w; ++x)
+        if (m.value(x, y) != horz[x] * vert[y])
+          return false;
     }
+    return true;
+  }
 
-    void operator()(IndexedTraits::pixel_t color) {
-      if (*matrixData) {
-        index += color * (*matrixData);
-        color_t rgba = pal->getEntry(color);
-        if (rgba_geta(rgba) == 0)
-          div -= *matrixData;
-        else {
-          r += rgba_getr(rgba) * (*matrixData);
-          g += rgba_getg(rgba) * (*matrixData);
-          b += rgba_getb(rgba) * (*matrixData);
-          a += rgba_geta(rgba) * (*matrixData);
-        }
-      }
-      matrixData++;
-    }
-  };
+  // Decomposes the matrix in the sum of a horizontal and a vertical
+  // kernel (as the stock blur matrices), so it's a sum of two terms.
+  bool decompose_in_two_terms(const ConvolutionMatrix& m,
+                              std::vector<int>& horz,
+                              std::vector<int>& vert)
+  {
+    const int w = m.getWidth();
+    const int h = m.getHeight();
+
+    horz.resize(w);
+    for (int x=0; x<w; ++x)
+      horz[x] = m.value(x, 0);
+
+    vert.resize(h);
+    for (int y=0; y<h; ++y)
+      vert[y] = m.value(0, y) - m.value(0, 0);
+
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        if (m.value(x, y) != horz[x] + vert[y])
+          return false;
+    return true;
+  }
 
-}
+} // anonymous namespace
 
 ConvolutionMatrixFilter::ConvolutionMatrixFilter()
   : m_matrix(NULL)
@@ -119,6 +214,26 @@ ConvolutionMatrixFilter::ConvolutionMatrixFilter()
 void ConvolutionMatrixFilter::setMatrix(const std::shared_ptr<ConvolutionMatrix>& matrix)
 {
   m_matrix = matrix;
+  m_separable.clear();
+  if (!m_matrix)
+    return;
+
+  const int w = m_matrix->getWidth();
+  const int h = m_matrix->getHeight();
+  std::vector<int> horz, vert;
+
+  // Use the 1D kernels only if there are less multiplications than
+  // using the whole matrix
+  if (decompose_in_one_term(*m_matrix, horz, vert)) {
+    if (w+h < w*h)
+      m_separable.push_back(SeparableTerm{ horz, vert });
+  }
+  else if (decompose_in_two_terms(*m_matrix, horz, vert)) {
+    if (2*(w+h) < w*h) {
+      m_separable.push_back(SeparableTerm{ horz, std::vector<int>(h, 1) });
+      m_separable.push_back(SeparableTerm{ std::vector<int>(w, 1), vert });
+    }
+  }
 }
 
 void ConvolutionMatrixFilter::setTiledMode(TiledMode tiledMode)
@@ -139,62 +254,57 @@ void ConvolutionMatrixFilter::applyToRgba(FilterManager* filterMgr)
   const Image* src = filterMgr->getSourceImage();
   uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
-  uint32_t color;
-  GetPixelsDelegateRgba delegate;
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
-
-  for (; x<x2; ++x) {
+  const int x = filterMgr->x();
+  const int y = filterMgr->y();
+  const int w = filterMgr->getWidth();
+  const int bias = m_matrix->getBias();
+  std::vector<int> sums;
+
+  // Channels: r, g, b, a (of non-transparent pixels), and 1 for
+  // transparent pixels (to remove their values from the divisor)
+  convolveRow(
+    filterMgr, 5,
+    [src](const int* cols, const int n, const int y,
+          int16_t* channels, const int stride) {
+      get_rgba_channels((const uint32_t*)src->getPixelAddress(0, y),
+                        cols, n, channels, stride);
+    }, sums);
+
+  for (int i=0; i<w; ++i, ++dst_address) {
     // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
+    if (filterMgr->skipPixel())
       continue;
-    }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<RgbTraits>(src, x, y,
-                                      m_matrix->getWidth(),
-                                      m_matrix->getHeight(),
-                                      m_matrix->getCenterX(),
-                                      m_matrix->getCenterY(),
-                                      m_tiledMode, delegate);
-
-    color = get_pixel_fast<RgbTraits>(src, x, y);
-    if (delegate.div == 0) {
-      *(dst_address++) = color;
+    const uint32_t color = get_pixel_fast<RgbTraits>(src, x+i, y);
+    const int div = m_matrix->getDiv() - sums[4*w+i];
+    if (div == 0) {
+      *dst_address = color;
       continue;
     }
 
-    if (target & TARGET_RED_CHANNEL) {
-      delegate.r = delegate.r / delegate.div + m_matrix->getBias();
-      delegate.r = base::clamp(delegate.r, 0, 255);
-    }
+    int r, g, b, a;
+
+    if (target & TARGET_RED_CHANNEL)
+      r = base::clamp(sums[i] / div + bias, 0, 255);
     else
-      delegate.r = rgba_getr(color);
+      r = rgba_getr(color);
 
-    if (target & TARGET_GREEN_CHANNEL) {
-      delegate.g = delegate.g / delegate.div + m_matrix->getBias();
-      delegate.g = base::clamp(delegate.g, 0, 255);
-    }
+    if (target & TARGET_GREEN_CHANNEL)
+      g = base::clamp(sums[w+i] / div + bias, 0, 255);
     else
-      delegate.g = rgba_getg(color);
+      g = rgba_getg(color);
 
-    if (target & TARGET_BLUE_CHANNEL) {
-      delegate.b = delegate.b / delegate.div + m_matrix->getBias();
-      delegate.b = base::clamp(delegate.b, 0, 255);
-    }
+    if (target & TARGET_BLUE_CHANNEL)
+      b = base::clamp(sums[2*w+i] / div + bias, 0, 255);
     else
-      delegate.b = rgba_getb(color);
+      b = rgba_getb(color);
 
-    if (target & TARGET_ALPHA_CHANNEL) {
-      delegate.a = delegate.a / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.a = base::clamp(delegate.a, 0, 255);
-    }
+    if (target & TARGET_ALPHA_CHANNEL)
+      a = base::clamp(sums[3*w+i] / m_matrix->getDiv() + bias, 0, 255);
     else
-      delegate.a = rgba_geta(color);
+      a = rgba_geta(color);
 
-    *(dst_address++) = rgba(delegate.r, delegate.g, delegate.b, delegate.a);
+    *dst_address = rgba(r, g, b, a);
   }
 }
 
@@ -206,48 +316,53 @@ void ConvolutionMatrixFilter::applyToGrayscale(FilterManager* filterMgr)
   const Image* src = filterMgr->getSourceImage();
   uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
-  uint16_t color;
-  GetPixelsDelegateGrayscale delegate;
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
+  const int x = filterMgr->x();
+  const int y = filterMgr->y();
+  const int w = filterMgr->getWidth();
+  const int bias = m_matrix->getBias();
+  std::vector<int> sums;
+
+  // Channels: v, a (of non-transparent pixels), and 1 for transparent
+  // pixels
+  convolveRow(
+    filterMgr, 3,
+    [src](const int* cols, const int n, const int y,
+          int16_t* channels, const int stride) {
+      const uint16_t* row = (const uint16_t*)src->getPixelAddress(0, y);
+      for (int i=0; i<n; ++i) {
+        const uint16_t color = row[cols[i]];
+        const bool transparent = (graya_geta(color) == 0);
+        channels[i]          = (transparent ? 0: graya_getv(color));
+        channels[stride+i]   = (transparent ? 0: graya_geta(color));
+        channels[2*stride+i] = (transparent ? 1: 0);
+      }
+    }, sums);
 
-  for (; x<x2; ++x) {
+  for (int i=0; i<w; ++i, ++dst_address) {
     // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
+    if (filterMgr->skipPixel())
       continue;
-    }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y,
-                                            m_matrix->getWidth(),
-                                            m_matrix->getHeight(),
-                                            m_matrix->getCenterX(),
-                                            m_matrix->getCenterY(),
-                                            m_tiledMode, delegate);
-
-    color = get_pixel_fast<GrayscaleTraits>(src, x, y);
-    if (delegate.div == 0) {
-      *(dst_address++) = color;
+    const uint16_t color = get_pixel_fast<GrayscaleTraits>(src, x+i, y);
+    const int div = m_matrix->getDiv() - sums[2*w+i];
+    if (div == 0) {
+      *dst_address = color;
       continue;
     }
 
-    if (target & TARGET_GRAY_CHANNEL) {
-      delegate.v = delegate.v / delegate.div + m_matrix->getBias();
-      delegate.v = base::clamp(delegate.v, 0, 255);
-    }
+    int v, a;
+
+    if (target & TARGET_GRAY_CHANNEL)
+      v = base::clamp(sums[i] / div + bias, 0, 255);
     else
-      delegate.v = graya_getv(color);
+      v = graya_getv(color);
 
-    if (target & TARGET_ALPHA_CHANNEL) {
-      delegate.a = delegate.a / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.a = base::clamp(delegate.a, 0, 255);
-    }
+    if (target & TARGET_ALPHA_CHANNEL)
+      a = base::clamp(sums[w+i] / m_matrix->getDiv() + bias, 0, 255);
     else
-      delegate.a = graya_geta(color);
+      a = graya_geta(color);
 
-    *(dst_address++) = graya(delegate.v, delegate.a);
+    *dst_address = graya(v, a);
   }
 }
 
@@ -261,71 +376,151 @@ void ConvolutionMatrixFilter::applyToIndexed(FilterManager* filterMgr)
   const Palette* pal = filterMgr->getIndexedData()->getPalette();
   const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
   Target target = filterMgr->getTarget();
-  uint8_t color;
-  GetPixelsDelegateIndexed delegate(pal);
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
+  const int x = filterMgr->x();
+  const int y = filterMgr->y();
+  const int w = filterMgr->getWidth();
+  const int bias = m_matrix->getBias();
+  std::vector<int> sums;
+
+  // Channels: r, g, b, a (of non-transparent palette entries), 1 for
+  // transparent entries, and the index
+  convolveRow(
+    filterMgr, 6,
+    [src, pal](const int* cols, const int n, const int y,
+               int16_t* channels, const int stride) {
+      const uint8_t* row = (const uint8_t*)src->getPixelAddress(0, y);
+      for (int i=0; i<n; ++i) {
+        const uint8_t index = row[cols[i]];
+        const color_t color = pal->getEntry(index);
+        const bool transparent = (rgba_geta(color) == 0);
+        channels[i]          = (transparent ? 0: rgba_getr(color));
+        channels[stride+i]   = (transparent ? 0: rgba_getg(color));
+        channels[2*stride+i] = (transparent ? 0: rgba_getb(color));
+        channels[3*stride+i] = (transparent ? 0: rgba_geta(color));
+        channels[4*stride+i] = (transparent ? 1: 0);
+        channels[5*stride+i] = index;
+      }
+    }, sums);
 
-  for (; x<x2; ++x) {
+  for (int i=0; i<w; ++i, ++dst_address) {
     // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
+    if (filterMgr->skipPixel())
       continue;
-    }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<IndexedTraits>(src, x, y,
-                                          m_matrix->getWidth(),
-                                          m_matrix->getHeight(),
-                                          m_matrix->getCenterX(),
-                                          m_matrix->getCenterY(),
-                                          m_tiledMode, delegate);
-
-    color = get_pixel_fast<IndexedTraits>(src, x, y);
-    if (delegate.div == 0) {
-      *(dst_address++) = color;
+    const uint8_t index = get_pixel_fast<IndexedTraits>(src, x+i, y);
+    const int div = m_matrix->getDiv() - sums[4*w+i];
+    if (div == 0) {
+      *dst_address = index;
       continue;
     }
 
     if (target & TARGET_INDEX_CHANNEL) {
-      delegate.index = delegate.index / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.index = base::clamp(delegate.index, 0, 255);
-
-      *(dst_address++) = delegate.index;
+      *dst_address = base::clamp(sums[5*w+i] / m_matrix->getDiv() + bias, 0, 255);
     }
     else {
-      color = pal->getEntry(color);
+      const color_t color = pal->getEntry(index);
+      int r, g, b, a;
 
-      if (target & TARGET_RED_CHANNEL) {
-        delegate.r = delegate.r / delegate.div + m_matrix->getBias();
-        delegate.r = base::clamp(delegate.r, 0, 255);
-      }
+      if (target & TARGET_RED_CHANNEL)
+        r = base::clamp(sums[i] / div + bias, 0, 255);
       else
-        delegate.r = rgba_getr(color);
+        r = rgba_getr(color);
 
-      if (target & TARGET_GREEN_CHANNEL) {
-        delegate.g =  delegate.g / delegate.div + m_matrix->getBias();
-        delegate.g = base::clamp(delegate.g, 0, 255);
-      }
+      if (target & TARGET_GREEN_CHANNEL)
+        g = base::clamp(sums[w+i] / div + bias, 0, 255);
       else
-        delegate.g = rgba_getg(color);
+        g = rgba_getg(color);
 
-      if (target & TARGET_BLUE_CHANNEL) {
-        delegate.b = delegate.b / delegate.div + m_matrix->getBias();
-        delegate.b = base::clamp(delegate.b, 0, 255);
-      }
+      if (target & TARGET_BLUE_CHANNEL)
+        b = base::clamp(sums[2*w+i] / div + bias, 0, 255);
       else
-        delegate.b = rgba_getb(color);
+        b = rgba_getb(color);
 
-      if (target & TARGET_ALPHA_CHANNEL) {
-        delegate.a = delegate.a / delegate.div + m_matrix->getBias();
-        delegate.a = base::clamp(delegate.a, 0, 255);
-      }
+      if (target & TARGET_ALPHA_CHANNEL)
+        a = base::clamp(sums[3*w+i] / div + bias, 0, 255);
       else
-        delegate.a = rgba_geta(color);
+        a = rgba_geta(color);
 
-      *(dst_address++) = rgbmap->mapColor(delegate.r, delegate.g, delegate.b, delegate.a);
+      *dst_address = rgbmap->mapColor(r, g, b, a);
+    }
+  }
+}
+
+template<typename Fetch>
+void ConvolutionMatrixFilter::convolveRow(FilterManager* filterMgr,
+                                          const int nchannels,
+                                          Fetch fetch,
+                                          std::vector<int>& sums) const
+{
+  ASSERT(nchannels <= kMaxChannels);
+
+  const Image* src = filterMgr->getSourceImage();
+  const bool tiledX = (int(m_tiledMode) & int(TiledMode::X_AXIS) ? true: false);
+  const bool tiledY = (int(m_tiledMode) & int(TiledMode::Y_AXIS) ? true: false);
+  const int x = filterMgr->x();
+  const int y = filterMgr->y();
+  const int w = filterMgr->getWidth();
+  const int mw = m_matrix->getWidth();
+  const int mh = m_matrix->getHeight();
+  const int ncols = w + mw - 1;
+
+  // Values of each channel (in a different array) of each pixel of
+  // the rows of the matrix, so the pixels of all rows/channels are
+  // multiplied by one matrix value at the same time
+  std::vector<int16_t> rows(mh * nchannels * ncols);
+  auto channelRow = [&rows, nchannels, ncols](int j, int c) {
+    return &rows[(j*nchannels + c) * ncols];
+  };
+  {
+    std::vector<int> cols(ncols);
+    for (int i=0; i<ncols; ++i)
+      cols[i] = get_neighboring_coord(x - m_matrix->getCenterX() + i, src->width(), tiledX);
+
+    for (int j=0; j<mh; ++j) {
+      const int py = get_neighboring_coord(y - m_matrix->getCenterY() + j, src->height(), tiledY);
+      fetch(&cols[0], ncols, py, channelRow(j, 0), ncols);
+    }
+  }
+
+  sums.resize(nchannels * w);
+  std::fill(sums.begin(), sums.end(), 0);
+
+  // Vertical 1D kernel and then the horizontal one
+  if (!m_separable.empty()) {
+    std::vector<int> vertSums(ncols);
+    for (const SeparableTerm& term : m_separable) {
+      for (int c=0; c<nchannels; ++c) {
+        std::fill(vertSums.begin(), vertSums.end(), 0);
+        for (int j=0; j<mh; j+=2) {
+          const int j2 = std::min(j+1, mh-1);
+          const int wb = (j2 > j ? term.vert[j2]: 0);
+          if (term.vert[j] || wb)
+            mul_add_rows(&vertSums[0], channelRow(j, c), channelRow(j2, c),
+                         term.vert[j], wb, ncols);
+        }
+
+        int* acc = &sums[c*w];
+        for (int k=0; k<mw; ++k) {
+          if (term.horz[k])
+            mul_add_row(acc, &vertSums[k], term.horz[k], w);
+        }
+      }
+    }
+  }
+  // Whole matrix (two matrix values at the same time)
+  else {
+    for (int c=0; c<nchannels; ++c) {
+      int* acc = &sums[c*w];
+      for (int j=0; j<mh; ++j) {
+        const int16_t* row = channelRow(j, c);
+        for (int k=0; k<mw; k+=2) {
+          const int k2 = std::min(k+1, mw-1);
+          const int wa = m_matrix->value(k, j);
+          const int wb = (k2 > k ? m_matrix->value(k2, j): 0);
+          if (wa || wb)
+            mul_add_rows(acc, row+k, row+k2, wa, wb, w);
+        }
+      }
     }
   }
 }
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -13,6 +13,7 @@
 #include "filters/tiled_mode.h"
 
 #include <memory>
+#include <vector>
 
 namespace filters {
 
@@ -30,13 +31,36 @@ namespace filters {
 
     // Filter implementation
     const char* getName();
+    bool isBandSafe() const { return true; }
     void applyToRgba(FilterManager* filterMgr);
     void applyToGrayscale(FilterManager* filterMgr);
     void applyToIndexed(FilterManager* filterMgr);
 
   private:
+    // Matrix values are the sum of horz[x]*vert[y] of each term
+    struct SeparableTerm {
+      std::vector<int> horz;
+      std::vector<int> vert;
+    };
+
+    // Calculates the sum of each channel of the pixels around each
+    // pixel of the row multiplied by the matrix values.
+    // "fetch(cols, n, y, channels, stride)" must get the "nchannels"
+    // values of the pixels (cols[i], y) for each i in [0,n) in
+    // channels[c*stride+i], and the result is stored in "sums"
+    // (getWidth() values for each channel).
+    template<typename Fetch>
+    void convolveRow(FilterManager* filterMgr,
+                     const int nchannels,
+                     Fetch fetch,
+                     std::vector<int>& sums) const;
+
     std::shared_ptr<ConvolutionMatrix> m_matrix;
     TiledMode m_tiledMode;
+
+    // Non-empty if the matrix can be applied as two 1D passes (one
+    // for each term), which is faster than the whole matrix
+    std::vector<SeparableTerm> m_separable;
   };
 
 } // namespace filters
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -9,12 +9,15 @@
 #define FILTERS_FILTER_H_INCLUDED
 #pragma once
 
+#include "filters/target.h"
+
 namespace doc {
   class PalettePicks;
 }
 
 namespace filters {
 
+  class ChannelsLut;
   class FilterManager;
 
   // Interface which applies a filter to a sprite given a FilterManager
@@ -44,6 +47,18 @@ namespace filters {
 
     // Applies the filter to the color palette.
     virtual void applyToPalette(FilterManager* filterMgr) { }
+
+    // Returns true if applyToRgba/Grayscale/Indexed() can be called
+    // from several threads at the same time to apply the filter to
+    // different rows (i.e. the filter doesn't modify its state in
+    // those functions, and neighbor pixels are read only from
+    // FilterManager::getSourceImage()).
+    virtual bool isBandSafe() const { return false; }
+
+    // Returns true if the filter is a point filter that can be
+    // represented with a table for each channel (see ChannelsLut),
+    // and fills "lut" with the tables for the given target.
+    virtual bool getChannelsLut(const Target target, ChannelsLut& lut) const { return false; }
   };
 
   // Filter that support applying it only to palette colors.
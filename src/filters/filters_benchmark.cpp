@@ -0,0 +1,274 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/image.h"
+#include "doc/palette.h"
+#include "doc/palette_picks.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "filters/brightness_contrast_filter.h"
+#include "filters/color_curve.h"
+#include "filters/color_curve_filter.h"
+#include "filters/convolution_matrix.h"
+#include "filters/convolution_matrix_filter.h"
+#include "filters/filter.h"
+#include "filters/filter_indexed_data.h"
+#include "filters/filter_manager.h"
+#include "filters/hue_saturation_filter.h"
+#include "filters/invert_color_filter.h"
+#include "filters/median_filter.h"
+#include "filters/outline_filter.h"
+#include "filters/replace_color_filter.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace doc;
+using namespace filters;
+
+// FilterManager without UI/document to apply a filter to a band of
+// rows of an image (without mask)
+class HeadlessFilterManager : public FilterManager
+                            , public FilterIndexedData {
+public:
+  HeadlessFilterManager(const Image* src, Image* dst,
+                        const Palette* pal, const RgbMap* rgbmap)
+    : m_src(src)
+    , m_dst(dst)
+    , m_pal(pal)
+    , m_rgbmap(rgbmap)
+    , m_row(0) {
+  }
+
+  void applyToRows(Filter* filter, const int y1, const int y2) {
+    for (m_row=y1; m_row<y2; ++m_row) {
+      switch (m_src->pixelFormat()) {
+        case IMAGE_RGB:       filter->applyToRgba(this); break;
+        case IMAGE_GRAYSCALE: filter->applyToGrayscale(this); break;
+        case IMAGE_INDEXED:   filter->applyToIndexed(this); break;
+      }
+    }
+  }
+
+  // FilterManager implementation
+  PixelFormat pixelFormat() const override { return m_src->pixelFormat(); }
+  const void* getSourceAddress() override { return m_src->getPixelAddress(0, m_row); }
+  void* getDestinationAddress() override { return m_dst->getPixelAddress(0, m_row); }
+  int getWidth() override { return m_src->width(); }
+  Target getTarget() override { return TARGET_ALL_CHANNELS; }
+  FilterIndexedData* getIndexedData() override { return this; }
+  bool skipPixel() override { return false; }
+  const Image* getSourceImage() override { return m_src; }
+  int x() const override { return 0; }
+  int y() const override { return m_row; }
+  bool isFirstRow() const override { return m_row == 0; }
+  bool isMaskActive() const override { return false; }
+
+  // FilterIndexedData implementation
+  const Palette* getPalette() const override { return m_pal; }
+  const RgbMap* getRgbMap() const override { return m_rgbmap; }
+  Palette* getNewPalette() override { return nullptr; }
+  PalettePicks getPalettePicks() override { return PalettePicks(); }
+
+private:
+  const Image* m_src;
+  Image* m_dst;
+  const Palette* m_pal;
+  const RgbMap* m_rgbmap;
+  int m_row;
+};
+
+// Applies the filter created by "createFilter" to an image with the
+// pixel format and size given in the state arguments, splitting the
+// rows in bands for each thread (only for band-safe filters).
+template<typename CreateFilter>
+static void apply_filter(benchmark::State& state, CreateFilter createFilter)
+{
+  const PixelFormat pixelFormat = (PixelFormat)state.range(0);
+  const int w = state.range(1);
+  const int h = state.range(2);
+  const int nthreads = state.range(3);
+
+  Palette pal(frame_t(0), 256);
+  for (int i=0; i<256; ++i)
+    pal.setEntry(i, rgba(i, (i*3) & 255, (i*7) & 255, (i == 0 ? 0: 255)));
+  RgbMap rgbmap;
+  rgbmap.regenerate(&pal, 0);
+
+  // Image with some noise and transparent areas
+  std::unique_ptr<Image> src(Image::create(pixelFormat, w, h));
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      const int v = ((x/8 + y/8)*37 + (x*y) % 17) & 255;
+      const bool transparent = (((x/32) + (y/32)) % 3 == 0);
+      switch (pixelFormat) {
+        case IMAGE_RGB:
+          put_pixel(src.get(), x, y, rgba(v, (v*3) & 255, (v*5) & 255,
+                                          transparent ? 0: 255));
+          break;
+        case IMAGE_GRAYSCALE:
+          put_pixel(src.get(), x, y, graya(v, transparent ? 0: 255));
+          break;
+        case IMAGE_INDEXED:
+          put_pixel(src.get(), x, y, transparent ? 0: v);
+          break;
+      }
+    }
+  }
+  std::unique_ptr<Image> dst(Image::createCopy(src.get()));
+  std::unique_ptr<Filter> filter(createFilter());
+
+  while (state.KeepRunning()) {
+    if (nthreads > 1 && filter->isBandSafe()) {
+      std::vector<std::thread> threads;
+      for (int i=0; i<nthreads; ++i) {
+        threads.emplace_back(
+          [&, i]{
+            HeadlessFilterManager mgr(src.get(), dst.get(), &pal, &rgbmap);
+            mgr.applyToRows(filter.get(), h*i/nthreads, h*(i+1)/nthreads);
+          });
+      }
+      for (auto& thread : threads)
+        thread.join();
+    }
+    else {
+      HeadlessFilterManager mgr(src.get(), dst.get(), &pal, &rgbmap);
+      mgr.applyToRows(filter.get(), 0, h);
+    }
+  }
+}
+
+static void BM_BrightnessContrast(benchmark::State& state) {
+  apply_filter(state, []{
+    auto filter = new BrightnessContrastFilter;
+    filter->setBrightness(0.2);
+    filter->setContrast(0.3);
+    return filter;
+  });
+}
+
+static void BM_ColorCurve(benchmark::State& state) {
+  apply_filter(state, []{
+    ColorCurve curve;
+    curve.addPoint(gfx::Point(0, 0));
+    curve.addPoint(gfx::Point(64, 128));
+    curve.addPoint(gfx::Point(255, 255));
+    auto filter = new ColorCurveFilter;
+    filter->setCurve(curve);
+    return filter;
+  });
+}
+
+static void BM_Convolution(benchmark::State& state) {
+  const int size = state.range(4);
+  apply_filter(state, [size]{
+    // Blur matrix (separable)
+    auto matrix = std::make_shared<ConvolutionMatrix>(size, size);
+    int div = 0;
+    for (int y=0; y<size; ++y)
+      for (int x=0; x<size; ++x) {
+        const int v = (1+std::min(x, size-1-x)) * (1+std::min(y, size-1-y));
+        matrix->value(x, y) = v;
+        div += v;
+      }
+    matrix->setCenterX(size/2);
+    matrix->setCenterY(size/2);
+    matrix->setDiv(div);
+    auto filter = new ConvolutionMatrixFilter;
+    filter->setMatrix(matrix);
+    return filter;
+  });
+}
+
+static void BM_HueSaturation(benchmark::State& state) {
+  apply_filter(state, []{
+    auto filter = new HueSaturationFilter;
+    filter->setHue(30.0);
+    filter->setSaturation(0.2);
+    filter->setLightness(0.1);
+    return filter;
+  });
+}
+
+static void BM_InvertColor(benchmark::State& state) {
+  apply_filter(state, []{ return new InvertColorFilter; });
+}
+
+static void BM_Median(benchmark::State& state) {
+  const int size = state.range(4);
+  apply_filter(state, [size]{
+    auto filter = new MedianFilter;
+    filter->setSize(size, size);
+    return filter;
+  });
+}
+
+static void BM_Outline(benchmark::State& state) {
+  apply_filter(state, []{
+    auto filter = new OutlineFilter;
+    filter->matrix(OutlineFilter::Matrix::Square);
+    filter->color(rgba(255, 0, 0, 255));
+    return filter;
+  });
+}
+
+static void BM_ReplaceColor(benchmark::State& state) {
+  apply_filter(state, []{
+    auto filter = new ReplaceColorFilter;
+    filter->setFrom(rgba(37, 111, 185, 255));
+    filter->setTo(rgba(255, 0, 0, 255));
+    filter->setTolerance(16);
+    return filter;
+  });
+}
+
+// Arguments: pixel format, width, height, threads
+#define DEFARGS(MODE)                           \
+  ->Args({ MODE, 256, 256, 1 })                 \
+  ->Args({ MODE, 1024, 1024, 1 })               \
+  ->Args({ MODE, 1024, 1024, 4 })               \
+  ->Args({ MODE, 4096, 4096, 1 })               \
+  ->Args({ MODE, 4096, 4096, 4 })
+
+#define ALLMODES                                \
+  DEFARGS(IMAGE_RGB)                            \
+  DEFARGS(IMAGE_GRAYSCALE)                      \
+  DEFARGS(IMAGE_INDEXED)                        \
+  ->Unit(benchmark::kMillisecond)               \
+  ->UseRealTime()
+
+// Arguments: pixel format, width, height, threads, matrix size
+#define MATRIXARGS(MODE)                        \
+  ->Args({ MODE, 1024, 1024, 1, 3 })            \
+  ->Args({ MODE, 1024, 1024, 1, 7 })            \
+  ->Args({ MODE, 1024, 1024, 1, 15 })           \
+  ->Args({ MODE, 1024, 1024, 4, 7 })
+
+#define ALLMODES_MATRIX                         \
+  MATRIXARGS(IMAGE_RGB)                         \
+  MATRIXARGS(IMAGE_GRAYSCALE)                   \
+  MATRIXARGS(IMAGE_INDEXED)                     \
+  ->Unit(benchmark::kMillisecond)               \
+  ->UseRealTime()
+
+BENCHMARK(BM_BrightnessContrast) ALLMODES;
+BENCHMARK(BM_ColorCurve) ALLMODES;
+BENCHMARK(BM_Convolution) ALLMODES_MATRIX;
+BENCHMARK(BM_HueSaturation) ALLMODES;
+BENCHMARK(BM_InvertColor) ALLMODES;
+BENCHMARK(BM_Median) ALLMODES_MATRIX;
+BENCHMARK(BM_Outline) ALLMODES;
+BENCHMARK(BM_ReplaceColor) ALLMODES;
+
+BENCHMARK_MAIN();
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2017-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -22,6 +22,7 @@
 #include "gfx/hsv.h"
 #include "gfx/rgb.h"
 
+#include <algorithm>
 #include <cmath>
 
 namespace filters {
@@ -40,6 +41,7 @@ HueSaturationFilter::HueSaturationFilter()
   , m_l(0.0)
   , m_a(0.0)
 {
+  updateMaps();
 }
 
 void HueSaturationFilter::setMode(Mode mode)
@@ -60,11 +62,13 @@ void HueSaturationFilter::setSaturation(double s)
 void HueSaturationFilter::setLightness(double l)
 {
   m_l = l;
+  updateMaps();
 }
 
 void HueSaturationFilter::setAlpha(double a)
 {
   m_a = a;
+  updateMaps();
 }
 
 void HueSaturationFilter::applyToRgba(FilterManager* filterMgr)
@@ -77,6 +81,16 @@ void HueSaturationFilter::applyToRgba(FilterManager* filterMgr)
   const int w = filterMgr->getWidth();
   const Target target = filterMgr->getTarget();
 
+  // Cache of the last converted colors (images usually have runs of
+  // the same color, and converting each pixel to HSL/HSV and back
+  // is expensive)
+  constexpr int kCacheSize = 256;
+  color_t cacheSrc[kCacheSize];
+  color_t cacheDst[kCacheSize];
+  bool cacheValid[kCacheSize];
+  if (!newPal)
+    std::fill(cacheValid, cacheValid+kCacheSize, false);
+
   for (int x=0; x<w; x++) {
     if (filterMgr->skipPixel()) {
       ++src_address;
@@ -96,7 +110,16 @@ void HueSaturationFilter::applyToRgba(FilterManager* filterMgr)
         c = newPal->getEntry(i);
     }
     else {
-      applyFilterToRgb(target, c);
+      const int j = ((c ^ (c >> 8) ^ (c >> 16) ^ (c >> 24)) & (kCacheSize-1));
+      if (cacheValid[j] && cacheSrc[j] == c) {
+        c = cacheDst[j];
+      }
+      else {
+        cacheSrc[j] = c;
+        applyFilterToRgb(target, c);
+        cacheDst[j] = c;
+        cacheValid[j] = true;
+      }
     }
 
     *(dst_address++) = c;
@@ -109,6 +132,8 @@ void HueSaturationFilter::applyToGrayscale(FilterManager* filterMgr)
   uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
   const int w = filterMgr->getWidth();
   const Target target = filterMgr->getTarget();
+  const bool useGray = (target & TARGET_GRAY_CHANNEL ? true: false);
+  const bool useAlpha = (target & TARGET_ALPHA_CHANNEL ? true: false);
 
   for (int x=0; x<w; x++) {
     if (filterMgr->skipPixel()) {
@@ -121,22 +146,8 @@ void HueSaturationFilter::applyToGrayscale(FilterManager* filterMgr)
     int k = graya_getv(c);
     int a = graya_geta(c);
 
-    {
-      gfx::Hsl hsl(gfx::Rgb(k, k, k));
-
-      double l = hsl.lightness()*(1.0+m_l);
-      l = base::clamp(l, 0.0, 1.0);
-
-      hsl.lightness(l);
-      gfx::Rgb rgb(hsl);
-
-      if (target & TARGET_GRAY_CHANNEL) k = rgb.red();
-
-      if (a && (target & TARGET_ALPHA_CHANNEL)) {
-        a = a*(1.0+m_a);
-        a = base::clamp(a, 0, 255);
-      }
-    }
+    if (useGray) k = m_grayMap[k];
+    if (useAlpha) a = m_alphaMap[a];
 
     *(dst_address++) = graya(k, a);
   }
@@ -159,6 +170,11 @@ void HueSaturationFilter::applyToIndexed(FilterManager* filterMgr)
   uint8_t* dst_address = (uint8_t*)filterMgr->getDestinationAddress();
   const int w = filterMgr->getWidth();
 
+  // The new index depends only on the old one, so we convert each
+  // palette entry used in this row just one time
+  int map[256];
+  std::fill(map, map+256, -1);
+
   for (int x=0; x<w; x++) {
     if (filterMgr->skipPixel()) {
       ++src_address;
@@ -166,12 +182,17 @@ void HueSaturationFilter::applyToIndexed(FilterManager* filterMgr)
       continue;
     }
 
-    color_t c = pal->getEntry(*(src_address++));
-    applyFilterToRgb(target, c);
-    *(dst_address++) = rgbmap->mapColor(rgba_getr(c),
-                                        rgba_getg(c),
-                                        rgba_getb(c),
-                                        rgba_geta(c));
+    const int j = *(src_address++);
+    int& i = map[j];
+    if (i < 0) {
+      color_t c = pal->getEntry(j);
+      applyFilterToRgb(target, c);
+      i = rgbmap->mapColor(rgba_getr(c),
+                           rgba_getg(c),
+                           rgba_getb(c),
+                           rgba_geta(c));
+    }
+    *(dst_address++) = i;
   }
 }
 
@@ -202,7 +223,7 @@ template<class T,
          void (T::*set_lightness)(double)>
 void HueSaturationFilter::applyFilterToRgbT(const Target target,
                                             doc::color_t& c,
-                                            bool multiply)
+                                            bool multiply) const
 {
   int r = rgba_getr(c);
   int g = rgba_getg(c);
@@ -239,7 +260,7 @@ void HueSaturationFilter::applyFilterToRgbT(const Target target,
   c = rgba(r, g, b, a);
 }
 
-void HueSaturationFilter::applyFilterToRgb(const Target target, doc::color_t& color)
+void HueSaturationFilter::applyFilterToRgb(const Target target, doc::color_t& color) const
 {
   switch (m_mode) {
     case Mode::HSV_MUL:
@@ -265,4 +286,22 @@ void HueSaturationFilter::applyFilterToRgb(const Target target, doc::color_t& co
   }
 }
 
+void HueSaturationFilter::updateMaps()
+{
+  for (int k=0; k<256; ++k) {
+    gfx::Hsl hsl(gfx::Rgb(k, k, k));
+
+    double l = hsl.lightness()*(1.0+m_l);
+    l = base::clamp(l, 0.0, 1.0);
+
+    hsl.lightness(l);
+    m_grayMap[k] = gfx::Rgb(hsl).red();
+  }
+
+  // Transparent pixels are kept transparent
+  m_alphaMap[0] = 0;
+  for (int a=1; a<256; ++a)
+    m_alphaMap[a] = base::clamp(int(a*(1.0+m_a)), 0, 255);
+}
+
 } // namespace filters
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2017-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -13,6 +13,8 @@
 #include "filters/filter.h"
 #include "filters/target.h"
 
+#include <cstdint>
+
 namespace filters {
 
   class HueSaturationFilter : public FilterWithPalette {
@@ -32,6 +34,7 @@ namespace filters {
 
     // Filter implementation
     const char* getName() override;
+    bool isBandSafe() const override { return true; }
     void applyToRgba(FilterManager* filterMgr) override;
     void applyToGrayscale(FilterManager* filterMgr) override;
     void applyToIndexed(FilterManager* filterMgr) override;
@@ -43,11 +46,17 @@ namespace filters {
     template<class T,
              double (T::*get_lightness)() const,
              void (T::*set_lightness)(double)>
-    void applyFilterToRgbT(const Target target, doc::color_t& color, bool multiply);
-    void applyFilterToRgb(const Target target, doc::color_t& color);
+    void applyFilterToRgbT(const Target target, doc::color_t& color, bool multiply) const;
+    void applyFilterToRgb(const Target target, doc::color_t& color) const;
+    void updateMaps();
 
     Mode m_mode;
     double m_h, m_s, m_l, m_a;
+
+    // Lightness of gray values and alpha values (used in grayscale
+    // images, where the result depends only on the source value)
+    uint8_t m_grayMap[256];
+    uint8_t m_alphaMap[256];
   };
 
 } // namespace filters
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -10,11 +11,8 @@
 
 #include "filters/invert_color_filter.h"
 
-#include "filters/filter_indexed_data.h"
+#include "filters/channels_lut.h"
 #include "filters/filter_manager.h"
-#include "doc/image.h"
-#include "doc/palette.h"
-#include "doc/rgbmap.h"
 
 namespace filters {
 
@@ -25,102 +23,32 @@ const char* InvertColorFilter::getName()
   return "Invert Color";
 }
 
-void InvertColorFilter::applyToRgba(FilterManager* filterMgr)
+bool InvertColorFilter::getChannelsLut(const Target target, ChannelsLut& lut) const
 {
-  const uint32_t* src_address = (uint32_t*)filterMgr->getSourceAddress();
-  uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
-  int w = filterMgr->getWidth();
-  Target target = filterMgr->getTarget();
-  int x, c, r, g, b, a;
-
-  for (x=0; x<w; x++) {
-    if (filterMgr->skipPixel()) {
-      ++src_address;
-      ++dst_address;
-      continue;
-    }
-
-    c = *(src_address++);
-
-    r = rgba_getr(c);
-    g = rgba_getg(c);
-    b = rgba_getb(c);
-    a = rgba_geta(c);
-
-    if (target & TARGET_RED_CHANNEL) r ^= 0xff;
-    if (target & TARGET_GREEN_CHANNEL) g ^= 0xff;
-    if (target & TARGET_BLUE_CHANNEL) b ^= 0xff;
-    if (target & TARGET_ALPHA_CHANNEL) a ^= 0xff;
+  lut.setTables(target, [](int v){ return v ^ 0xff; });
+  return true;
+}
 
-    *(dst_address++) = rgba(r, g, b, a);
-  }
+void InvertColorFilter::applyToRgba(FilterManager* filterMgr)
+{
+  ChannelsLut lut;
+  getChannelsLut(filterMgr->getTarget(), lut);
+  lut.applyToRgba(filterMgr);
 }
 
 void InvertColorFilter::applyToGrayscale(FilterManager* filterMgr)
 {
-  const uint16_t* src_address = (uint16_t*)filterMgr->getSourceAddress();
-  uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
-  int w = filterMgr->getWidth();
-  Target target = filterMgr->getTarget();
-  int x, c, k, a;
-
-  for (x=0; x<w; x++) {
-    if (filterMgr->skipPixel()) {
-      ++src_address;
-      ++dst_address;
-      continue;
-    }
-
-    c = *(src_address++);
-
-    k = graya_getv(c);
-    a = graya_geta(c);
-
-    if (target & TARGET_GRAY_CHANNEL) k ^= 0xff;
-    if (target & TARGET_ALPHA_CHANNEL) a ^= 0xff;
-
-    *(dst_address++) = graya(k, a);
-  }
+  ChannelsLut lut;
+  getChannelsLut(filterMgr->getTarget(), lut);
+  lut.applyToGrayscale(filterMgr);
 }
 
 void InvertColorFilter::applyToIndexed(FilterManager* filterMgr)
 {
-  const uint8_t* src_address = (uint8_t*)filterMgr->getSourceAddress();
-  uint8_t* dst_address = (uint8_t*)filterMgr->getDestinationAddress();
-  const Palette* pal = filterMgr->getIndexedData()->getPalette();
-  const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
-  int w = filterMgr->getWidth();
-  Target target = filterMgr->getTarget();
-  int x, c, r, g, b, a;
-
-  for (x=0; x<w; x++) {
-    if (filterMgr->skipPixel()) {
-      ++src_address;
-      ++dst_address;
-      continue;
-    }
-
-    c = *(src_address++);
-
-    if (target & TARGET_INDEX_CHANNEL)
-      c ^= 0xff;
-    else {
-      c = pal->getEntry(c);
-      r = rgba_getr(c);
-      g = rgba_getg(c);
-      b = rgba_getb(c);
-      a = rgba_geta(c);
-
-      if (target & TARGET_RED_CHANNEL  ) r ^= 0xff;
-      if (target & TARGET_GREEN_CHANNEL) g ^= 0xff;
-      if (target & TARGET_BLUE_CHANNEL ) b ^= 0xff;
-      if (target & TARGET_ALPHA_CHANNEL) a ^= 0xff;
-
-      c = rgbmap->mapColor(r, g, b, a);
-    }
-
-    *(dst_address++) = c;
-  }
+  const Target target = filterMgr->getTarget();
+  ChannelsLut lut;
+  getChannelsLut(target, lut);
+  lut.applyToIndexed(filterMgr, target);
 }
 
 } // namespace filters
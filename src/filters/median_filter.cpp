@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2020  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -27,80 +27,58 @@ namespace filters {
 using namespace doc;
 
 namespace {
-  struct GetPixelsDelegateRgba {
-    std::vector<std::vector<uint8_t> >& channel;
-    int c;
 
-    GetPixelsDelegateRgba(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
-
-    void reset() { c = 0; }
-
-    void operator()(RgbTraits::pixel_t color)
-    {
-      channel[0][c] = rgba_getr(color);
-      channel[1][c] = rgba_getg(color);
-      channel[2][c] = rgba_getb(color);
-      channel[3][c] = rgba_geta(color);
-      c++;
-    }
-  };
-
-  struct GetPixelsDelegateGrayscale {
-    std::vector<std::vector<uint8_t> >& channel;
-    int c;
-
-    GetPixelsDelegateGrayscale(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
-
-    void reset() { c = 0; }
-
-    void operator()(GrayscaleTraits::pixel_t color)
-    {
-      channel[0][c] = graya_getv(color);
-      channel[1][c] = graya_geta(color);
-      c++;
-    }
-  };
-
-  struct GetPixelsDelegateIndexed {
-    const Palette* pal;
-    std::vector<std::vector<uint8_t> >& channel;
-    Target target;
-    int c;
+  // Each histogram has 256 bins for each value, and 16 coarse bins
+  // (one for each 16 values) to find the median faster.
+  constexpr int kFineBins = 256;
+  constexpr int kBins = kFineBins + 16;
+
+  // Windows with this height or more keep a histogram for each
+  // column, so the time to filter each pixel doesn't depend on the
+  // window size (Perreault & Hebert, "Median Filtering in Constant
+  // Time"). Smaller windows add/remove the pixels of the
+  // entering/leaving columns directly (Huang's algorithm).
+  constexpr int kMinHeightForColumnHistograms = 8;
+
+  template<typename T, typename H>
+  void add_histogram(T* dst, const H* src)
+  {
+    for (int i=0; i<kBins; ++i)
+      dst[i] += src[i];
+  }
 
-    GetPixelsDelegateIndexed(const Palette* pal, std::vector<std::vector<uint8_t> >& channel, Target target)
-      : pal(pal), channel(channel), target(target) { }
+  template<typename T, typename H>
+  void sub_histogram(T* dst, const H* src)
+  {
+    for (int i=0; i<kBins; ++i)
+      dst[i] -= src[i];
+  }
 
-    void reset() { c = 0; }
+  template<typename H>
+  void add_value(H* hist, const int value, const int delta)
+  {
+    hist[value] += delta;
+    hist[kFineBins + (value >> 4)] += delta;
+  }
 
-    void operator()(IndexedTraits::pixel_t color)
-    {
-      if (target & TARGET_INDEX_CHANNEL) {
-        channel[0][c] = color;
-      }
-      else {
-        color_t rgb = pal->getEntry(color);
-        channel[0][c] = rgba_getr(rgb);
-        channel[1][c] = rgba_getg(rgb);
-        channel[2][c] = rgba_getb(rgb);
-        channel[3][c] = rgba_geta(rgb);
-      }
-      c++;
-    }
-  };
-};
+} // anonymous namespace
 
 MedianFilter::MedianFilter()
   : m_tiledMode(TiledMode::NONE)
   , m_width(1)
   , m_height(1)
   , m_ncolors(0)
-  , m_channel(4)
+  , m_columnsImage(nullptr)
+  , m_columnsX(0)
+  , m_columnsY(-1)
+  , m_columnsW(0)
 {
 }
 
 void MedianFilter::setTiledMode(TiledMode tiled)
 {
   m_tiledMode = tiled;
+  m_columnsY = -1;
 }
 
 void MedianFilter::setSize(int width, int height)
@@ -110,10 +88,8 @@ void MedianFilter::setSize(int width, int height)
 
   m_width = std::max(1, width);
   m_height = std::max(1, height);
-  m_ncolors = width*height;
-
-  for (int c = 0; c < 4; ++c)
-    m_channel[c].resize(m_ncolors);
+  m_ncolors = m_width*m_height;
+  m_columnsY = -1;
 }
 
 const char* MedianFilter::getName()
@@ -125,99 +101,62 @@ void MedianFilter::applyToRgba(FilterManager* filterMgr)
 {
   const Image* src = filterMgr->getSourceImage();
   uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
-  Target target = filterMgr->getTarget();
-  int color;
-  int r, g, b, a;
-  GetPixelsDelegateRgba delegate(m_channel);
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
-
-  for (; x<x2; ++x) {
-    // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
-      continue;
-    }
-
-    delegate.reset();
-    get_neighboring_pixels<RgbTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                      m_tiledMode, delegate);
-
-    color = get_pixel_fast<RgbTraits>(src, x, y);
-
-    if (target & TARGET_RED_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      r = m_channel[0][m_ncolors/2];
-    }
-    else
-      r = rgba_getr(color);
-
-    if (target & TARGET_GREEN_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      g = m_channel[1][m_ncolors/2];
-    }
-    else
-      g = rgba_getg(color);
-
-    if (target & TARGET_BLUE_CHANNEL) {
-      std::sort(m_channel[2].begin(), m_channel[2].end());
-      b = m_channel[2][m_ncolors/2];
-    }
-    else
-      b = rgba_getb(color);
-
-    if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[3].begin(), m_channel[3].end());
-      a = m_channel[3][m_ncolors/2];
-    }
-    else
-      a = rgba_geta(color);
-
-    *(dst_address++) = rgba(r, g, b, a);
-  }
+  const Target target = filterMgr->getTarget();
+
+  int nchannels = 0;
+  int shifts[4];
+  uint32_t mask = 0;
+  if (target & TARGET_RED_CHANNEL)   shifts[nchannels++] = rgba_r_shift;
+  if (target & TARGET_GREEN_CHANNEL) shifts[nchannels++] = rgba_g_shift;
+  if (target & TARGET_BLUE_CHANNEL)  shifts[nchannels++] = rgba_b_shift;
+  if (target & TARGET_ALPHA_CHANNEL) shifts[nchannels++] = rgba_a_shift;
+  for (int k=0; k<nchannels; ++k)
+    mask |= (0xff << shifts[k]);
+
+  applyMedian(
+    filterMgr, nchannels,
+    [src, nchannels, &shifts](int x, int y, uint8_t* values) {
+      const color_t color = get_pixel_fast<RgbTraits>(src, x, y);
+      for (int k=0; k<nchannels; ++k)
+        values[k] = (color >> shifts[k]) & 0xff;
+    },
+    [src, dst_address, nchannels, &shifts, mask,
+     x=filterMgr->x(), y=filterMgr->y()](int i, const uint8_t* medians) {
+      color_t color = (get_pixel_fast<RgbTraits>(src, x+i, y) & ~mask);
+      for (int k=0; k<nchannels; ++k)
+        color |= (color_t(medians[k]) << shifts[k]);
+      dst_address[i] = color;
+    });
 }
 
 void MedianFilter::applyToGrayscale(FilterManager* filterMgr)
 {
   const Image* src = filterMgr->getSourceImage();
   uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
-  Target target = filterMgr->getTarget();
-  int color, k, a;
-  GetPixelsDelegateGrayscale delegate(m_channel);
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
-
-  for (; x<x2; ++x) {
-    // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
-      continue;
-    }
-
-    delegate.reset();
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                            m_tiledMode, delegate);
-
-    color = get_pixel_fast<GrayscaleTraits>(src, x, y);
-
-    if (target & TARGET_GRAY_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      k = m_channel[0][m_ncolors/2];
-    }
-    else
-      k = graya_getv(color);
-
-    if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      a = m_channel[1][m_ncolors/2];
-    }
-    else
-      a = graya_geta(color);
-
-    *(dst_address++) = graya(k, a);
-  }
+  const Target target = filterMgr->getTarget();
+
+  int nchannels = 0;
+  int shifts[2];
+  uint16_t mask = 0;
+  if (target & TARGET_GRAY_CHANNEL)  shifts[nchannels++] = graya_v_shift;
+  if (target & TARGET_ALPHA_CHANNEL) shifts[nchannels++] = graya_a_shift;
+  for (int k=0; k<nchannels; ++k)
+    mask |= (0xff << shifts[k]);
+
+  applyMedian(
+    filterMgr, nchannels,
+    [src, nchannels, &shifts](int x, int y, uint8_t* values) {
+      const uint16_t color = get_pixel_fast<GrayscaleTraits>(src, x, y);
+      for (int k=0; k<nchannels; ++k)
+        values[k] = (color >> shifts[k]) & 0xff;
+    },
+    [src, dst_address, nchannels, &shifts, mask,
+     x=filterMgr->x(), y=filterMgr->y()](int i, const uint8_t* medians) {
+      uint16_t color = (get_pixel_fast<GrayscaleTraits>(src, x+i, y) & ~mask);
+      for (int k=0; k<nchannels; ++k)
+        color |= (medians[k] << shifts[k]);
+      dst_address[i] = color;
+    });
 }
 
 void MedianFilter::applyToIndexed(FilterManager* filterMgr)
@@ -226,61 +165,206 @@ void MedianFilter::applyToIndexed(FilterManager* filterMgr)
   uint8_t* dst_address = (uint8_t*)filterMgr->getDestinationAddress();
   const Palette* pal = filterMgr->getIndexedData()->getPalette();
   const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
-  Target target = filterMgr->getTarget();
-  int color, r, g, b, a;
-  GetPixelsDelegateIndexed delegate(pal, m_channel, target);
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
-
-  for (; x<x2; ++x) {
-    // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
-      continue;
-    }
+  const Target target = filterMgr->getTarget();
+
+  if (target & TARGET_INDEX_CHANNEL) {
+    applyMedian(
+      filterMgr, 1,
+      [src](int x, int y, uint8_t* values) {
+        values[0] = get_pixel_fast<IndexedTraits>(src, x, y);
+      },
+      [dst_address](int i, const uint8_t* medians) {
+        dst_address[i] = medians[0];
+      });
+    return;
+  }
 
-    delegate.reset();
-    get_neighboring_pixels<IndexedTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                          m_tiledMode, delegate);
+  int nchannels = 0;
+  int shifts[4];
+  uint32_t mask = 0;
+  if (target & TARGET_RED_CHANNEL)   shifts[nchannels++] = rgba_r_shift;
+  if (target & TARGET_GREEN_CHANNEL) shifts[nchannels++] = rgba_g_shift;
+  if (target & TARGET_BLUE_CHANNEL)  shifts[nchannels++] = rgba_b_shift;
+  if (target & TARGET_ALPHA_CHANNEL) shifts[nchannels++] = rgba_a_shift;
+  for (int k=0; k<nchannels; ++k)
+    mask |= (0xff << shifts[k]);
+
+  applyMedian(
+    filterMgr, nchannels,
+    [src, pal, nchannels, &shifts](int x, int y, uint8_t* values) {
+      const color_t color = pal->getEntry(get_pixel_fast<IndexedTraits>(src, x, y));
+      for (int k=0; k<nchannels; ++k)
+        values[k] = (color >> shifts[k]) & 0xff;
+    },
+    [src, pal, rgbmap, dst_address, nchannels, &shifts, mask,
+     x=filterMgr->x(), y=filterMgr->y()](int i, const uint8_t* medians) {
+      color_t color = (pal->getEntry(get_pixel_fast<IndexedTraits>(src, x+i, y)) & ~mask);
+      for (int k=0; k<nchannels; ++k)
+        color |= (color_t(medians[k]) << shifts[k]);
+      dst_address[i] = rgbmap->mapColor(rgba_getr(color),
+                                        rgba_getg(color),
+                                        rgba_getb(color),
+                                        rgba_geta(color));
+    });
+}
 
-    if (target & TARGET_INDEX_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      *(dst_address++) = m_channel[0][m_ncolors/2];
+bool MedianFilter::useColumnHistograms() const
+{
+  return (m_height >= kMinHeightForColumnHistograms);
+}
+
+int MedianFilter::getMedian(const uint32_t* hist) const
+{
+  // The median is the value in the m_ncolors/2 position of the
+  // sorted values
+  const uint32_t half = m_ncolors/2;
+  uint32_t count = 0;
+  int i = 0;
+  while (count + hist[kFineBins+i] <= half)
+    count += hist[kFineBins + i++];
+  i <<= 4;
+  while (count + hist[i] <= half)
+    count += hist[i++];
+  return i;
+}
+
+template<typename Fetch, typename Write>
+void MedianFilter::applyMedian(FilterManager* filterMgr,
+                               const int nchannels,
+                               Fetch fetch,
+                               Write write)
+{
+  const Image* src = filterMgr->getSourceImage();
+  const bool tiledX = (int(m_tiledMode) & int(TiledMode::X_AXIS) ? true: false);
+  const bool tiledY = (int(m_tiledMode) & int(TiledMode::Y_AXIS) ? true: false);
+  const int x = filterMgr->x();
+  const int y = filterMgr->y();
+  const int w = filterMgr->getWidth();
+  const int ncols = w + m_width - 1;
+  uint8_t values[4];
+
+  if (nchannels == 0) {
+    for (int i=0; i<w; ++i)
+      filterMgr->skipPixel();
+    return;
+  }
+
+  // Coordinates of the columns and rows of the window of each pixel
+  // of this row (the window of the i-th pixel are the columns
+  // [i,i+m_width))
+  m_cols.resize(ncols);
+  for (int i=0; i<ncols; ++i)
+    m_cols[i] = get_neighboring_coord(x - m_width/2 + i, src->width(), tiledX);
+
+  m_rows.resize(m_height);
+  for (int i=0; i<m_height; ++i)
+    m_rows[i] = get_neighboring_coord(y - m_height/2 + i, src->height(), tiledY);
+
+  m_hist.resize(nchannels * kBins);
+  std::fill(m_hist.begin(), m_hist.end(), 0);
+
+  if (useColumnHistograms()) {
+    uint16_t* columns;
+
+    // Update the histogram of each column removing the first row of
+    // the previous window and adding the last row of the new one
+    if (m_columnsImage == src &&
+        m_columnsX == x &&
+        m_columnsW == w &&
+        m_columnsY+1 == y &&
+        int(m_columns.size()) == ncols * nchannels * kBins &&
+        !filterMgr->isFirstRow()) {
+      const int oldRow = get_neighboring_coord(y-1 - m_height/2, src->height(), tiledY);
+      const int newRow = m_rows[m_height-1];
+      columns = &m_columns[0];
+      for (int i=0; i<ncols; ++i) {
+        fetch(m_cols[i], oldRow, values);
+        for (int k=0; k<nchannels; ++k, columns+=kBins)
+          add_value(columns, values[k], -1);
+        columns -= nchannels*kBins;
+
+        fetch(m_cols[i], newRow, values);
+        for (int k=0; k<nchannels; ++k, columns+=kBins)
+          add_value(columns, values[k], 1);
+      }
     }
+    // Calculate all histograms from scratch
     else {
-      color = get_pixel_fast<IndexedTraits>(src, x, y);
-      color = pal->getEntry(color);
-
-      if (target & TARGET_RED_CHANNEL) {
-        std::sort(m_channel[0].begin(), m_channel[0].end());
-        r = m_channel[0][m_ncolors/2];
+      m_columns.resize(ncols * nchannels * kBins);
+      std::fill(m_columns.begin(), m_columns.end(), 0);
+      columns = &m_columns[0];
+      for (int i=0; i<ncols; ++i, columns+=nchannels*kBins) {
+        for (int row : m_rows) {
+          fetch(m_cols[i], row, values);
+          for (int k=0; k<nchannels; ++k)
+            add_value(columns + k*kBins, values[k], 1);
+        }
       }
-      else
-        r = rgba_getr(color);
+    }
 
-      if (target & TARGET_GREEN_CHANNEL) {
-        std::sort(m_channel[1].begin(), m_channel[1].end());
-        g = m_channel[1][m_ncolors/2];
+    m_columnsImage = src;
+    m_columnsX = x;
+    m_columnsY = y;
+    m_columnsW = w;
+
+    columns = &m_columns[0];
+    for (int i=0; i<m_width; ++i, columns+=nchannels*kBins)
+      for (int k=0; k<nchannels; ++k)
+        add_histogram(&m_hist[k*kBins], columns + k*kBins);
+
+    for (int i=0; i<w; ++i) {
+      if (i > 0) {
+        const uint16_t* leaving = &m_columns[(i-1) * nchannels * kBins];
+        const uint16_t* entering = &m_columns[(i-1+m_width) * nchannels * kBins];
+        for (int k=0; k<nchannels; ++k) {
+          sub_histogram(&m_hist[k*kBins], leaving + k*kBins);
+          add_histogram(&m_hist[k*kBins], entering + k*kBins);
+        }
       }
-      else
-        g = rgba_getg(pal->getEntry(color));
 
-      if (target & TARGET_BLUE_CHANNEL) {
-        std::sort(m_channel[2].begin(), m_channel[2].end());
-        b = m_channel[2][m_ncolors/2];
+      // Avoid the non-selected region
+      if (filterMgr->skipPixel())
+        continue;
+
+      for (int k=0; k<nchannels; ++k)
+        values[k] = getMedian(&m_hist[k*kBins]);
+      write(i, values);
+    }
+  }
+  else {
+    // The column histograms aren't used
+    m_columnsY = -1;
+
+    for (int i=0; i<m_width; ++i) {
+      for (int row : m_rows) {
+        fetch(m_cols[i], row, values);
+        for (int k=0; k<nchannels; ++k)
+          add_value(&m_hist[k*kBins], values[k], 1);
       }
-      else
-        b = rgba_getb(color);
+    }
 
-      if (target & TARGET_ALPHA_CHANNEL) {
-        std::sort(m_channel[3].begin(), m_channel[3].end());
-        a = m_channel[3][m_ncolors/2];
+    for (int i=0; i<w; ++i) {
+      if (i > 0) {
+        const int leaving = m_cols[i-1];
+        const int entering = m_cols[i-1+m_width];
+        for (int row : m_rows) {
+          fetch(leaving, row, values);
+          for (int k=0; k<nchannels; ++k)
+            add_value(&m_hist[k*kBins], values[k], -1);
+
+          fetch(entering, row, values);
+          for (int k=0; k<nchannels; ++k)
+            add_value(&m_hist[k*kBins], values[k], 1);
+        }
       }
-      else
-        a = rgba_geta(color);
 
-      *(dst_address++) = rgbmap->mapColor(r, g, b, a);
+      // Avoid the non-selected region
+      if (filterMgr->skipPixel())
+        continue;
+
+      for (int k=0; k<nchannels; ++k)
+        values[k] = getMedian(&m_hist[k*kBins]);
+      write(i, values);
     }
   }
 }
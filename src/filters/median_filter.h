@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -14,6 +15,10 @@
 
 #include <vector>
 
+namespace doc {
+  class Image;
+}
+
 namespace filters {
 
   class MedianFilter : public Filter {
@@ -34,11 +39,41 @@ namespace filters {
     void applyToIndexed(FilterManager* filterMgr);
 
   private:
+    // Calculates the median of each channel of each pixel of the row
+    // using a histogram of the pixels in the window (so the sort isn't
+    // needed). "fetch(x, y, values)" must get the "nchannels" values
+    // of the pixel in (x, y), and "write(i, medians)" is called for
+    // each non-skipped pixel "i" of the row.
+    template<typename Fetch, typename Write>
+    void applyMedian(FilterManager* filterMgr,
+                     const int nchannels,
+                     Fetch fetch,
+                     Write write);
+
+    int getMedian(const uint32_t* hist) const;
+
+    // Returns true if the histogram of each column is kept between
+    // rows (instead of adding the pixels of each column to the
+    // histogram of the window).
+    bool useColumnHistograms() const;
+
     TiledMode m_tiledMode;
     int m_width;
     int m_height;
     int m_ncolors;
-    std::vector<std::vector<uint8_t> > m_channel;
+
+    // Histogram of the window for each channel
+    std::vector<uint32_t> m_hist;
+    // Histograms of each column of the window (for each channel) for
+    // big windows, updated each time we move to the next row
+    std::vector<uint16_t> m_columns;
+    // Source image and row used to calculate m_columns
+    const doc::Image* m_columnsImage;
+    int m_columnsX, m_columnsY, m_columnsW;
+    // Temporary X coordinates of the columns and Y coordinates of the
+    // rows of the window (with tiled mode/clamp applied)
+    std::vector<int> m_cols;
+    std::vector<int> m_rows;
   };
 
 } // namespace filters
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -8,6 +9,7 @@
 #define FILTERS_NEIGHBORING_PIXELS_H_INCLUDED
 #pragma once
 
+#include "base/clamp.h"
 #include "filters/tiled_mode.h"
 #include "doc/image.h"
 #include "doc/image_traits.h"
@@ -17,6 +19,20 @@
 namespace filters {
   using namespace doc;
 
+  // Returns the coordinate of the pixel used for the "i" coordinate
+  // in an axis of the given size (wrapped in tiled mode, or clamped
+  // to the image bounds). Gives the same pixels as
+  // get_neighboring_pixels() when the matrix fits in the image.
+  inline int get_neighboring_coord(int i, const int size, const bool tiled)
+  {
+    if (tiled) {
+      i %= size;
+      return (i < 0 ? i+size: i);
+    }
+    else
+      return base::clamp(i, 0, size-1);
+  }
+
   // Calls the specified "delegate" for all neighboring pixels in a 2D
   // (width*height) matrix located in (x,y) where its center is the
   // (centerX,centerY) element of the matrix.
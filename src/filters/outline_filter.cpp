@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -18,6 +18,8 @@
 #include "filters/neighboring_pixels.h"
 
 #include <algorithm>
+#include <cstdint>
+#include <vector>
 
 namespace filters {
 
@@ -25,59 +27,65 @@ using namespace doc;
 
 namespace {
 
-  struct GetPixelsDelegate {
-    color_t bgColor;
-    int transparent;    // Transparent pixels
-    int opaque;         // Opaque pixels
-    int matrix;
-    int bit;
-
-    void init(const color_t bgColor,
-              const OutlineFilter::Matrix matrix) {
-      this->bgColor = bgColor;
-      this->matrix = (int)matrix;
-    }
+  using Bits = std::vector<uint64_t>;
 
-    void reset() {
-      transparent = opaque = 0;
-      bit = 1;
-    }
-  };
-
-  struct GetPixelsDelegateRgba : public GetPixelsDelegate {
-    void operator()(RgbTraits::pixel_t color) {
-      if (rgba_geta(color) == 0 || color == bgColor)
-        transparent += (matrix & bit ? 1: 0);
-      else
-        opaque += (matrix & bit ? 1: 0);
-      bit <<= 1;
-    }
-  };
-
-  struct GetPixelsDelegateGrayscale : public GetPixelsDelegate {
-    void operator()(GrayscaleTraits::pixel_t color) {
-      if (graya_geta(color) == 0 || color == bgColor)
-        transparent += (matrix & bit ? 1: 0);
-      else
-        opaque += (matrix & bit ? 1: 0);
-      bit <<= 1;
-    }
-  };
-
-  struct GetPixelsDelegateIndexed : public GetPixelsDelegate {
-    const Palette* pal;
+  // Returns the 64 bits of "bits" starting from the bit 64*k+shift
+  inline uint64_t get_word(const Bits& bits, const int k, const int shift) {
+    if (shift == 0)
+      return bits[k];
+    else
+      return (bits[k] >> shift) | (bits[k+1] << (64-shift));
+  }
 
-    GetPixelsDelegateIndexed(const Palette* pal) : pal(pal) { }
+  // Fills "result" with one bit for each pixel of the row [x,x+w) of
+  // the "y" row, the bit is 1 if there is at least one neighbor in
+  // the matrix that is opaque (if "opaque" is true) or transparent
+  // (if "opaque" is false). Each row of the 3x3 neighborhood is
+  // converted to a row of bits (one bit for each pixel) and all
+  // neighbors of 64 pixels are tested with bitwise operations.
+  template<typename Traits, typename IsTransparent>
+  void get_neighbors_bits(const Image* src,
+                          const int x, const int y, const int w,
+                          const TiledMode tiledMode,
+                          const int matrix,
+                          const bool opaque,
+                          IsTransparent isTransparent,
+                          Bits& result) {
+    const bool tiledX = (int(tiledMode) & int(TiledMode::X_AXIS) ? true: false);
+    const bool tiledY = (int(tiledMode) & int(TiledMode::Y_AXIS) ? true: false);
+    const int n = w+2;          // Pixels with the left/right neighbors
+    const int nwords = (n+63)/64 + 1;
+    Bits rowBits(nwords);
+
+    result.assign(nwords, 0);
+
+    for (int dy=0; dy<3; ++dy) {
+      const int rowMatrix = ((matrix >> (dy*3)) & 7);
+      if (!rowMatrix)
+        continue;
+
+      const int v = get_neighboring_coord(y+dy-1, src->height(), tiledY);
+      auto address = (typename Traits::const_address_t)src->getPixelAddress(0, v);
+
+      std::fill(rowBits.begin(), rowBits.end(), 0);
+      for (int i=0; i<n; ++i) {
+        const int u = get_neighboring_coord(x+i-1, src->width(), tiledX);
+        if (isTransparent(address[u]) != opaque)
+          rowBits[i >> 6] |= (uint64_t(1) << (i & 63));
+      }
 
-    void operator()(IndexedTraits::pixel_t color) {
-      color_t rgba = pal->getEntry(color);
-      if (rgba_geta(rgba) == 0 || color == bgColor)
-        transparent += (matrix & bit ? 1: 0);
-      else
-        opaque += (matrix & bit ? 1: 0);
-      bit <<= 1;
+      for (int dx=0; dx<3; ++dx) {
+        if (rowMatrix & (1 << dx)) {
+          for (int k=0; k<nwords-1; ++k)
+            result[k] |= get_word(rowBits, k, dx);
+        }
+      }
     }
-  };
+  }
+
+  inline bool get_bit(const Bits& bits, const int i) {
+    return ((bits[i >> 6] >> (i & 63)) & 1 ? true: false);
+  }
 
 }
 
@@ -104,25 +112,25 @@ void OutlineFilter::applyToRgba(FilterManager* filterMgr)
   const int x2 = x+filterMgr->getWidth();
   const int y = filterMgr->y();
   Target target = filterMgr->getTarget();
-  int r, g, b, a, n;
+  int r, g, b, a;
   color_t c;
   bool isTransparent;
 
-  GetPixelsDelegateRgba delegate;
-  delegate.init(m_bgColor, m_matrix);
+  const color_t bgColor = m_bgColor;
+  Bits neighbors;
+  get_neighbors_bits<RgbTraits>(
+    src, x, y, x2-x, m_tiledMode, int(m_matrix), m_place == Place::Outside,
+    [bgColor](color_t c){ return (rgba_geta(c) == 0 || c == bgColor); },
+    neighbors);
 
-  for (; x<x2; ++x, ++src_address, ++dst_address) {
+  for (int i=0; x<x2; ++x, ++i, ++src_address, ++dst_address) {
     if (filterMgr->skipPixel())
       continue;
 
-    delegate.reset();
-    get_neighboring_pixels<RgbTraits>(src, x, y, 3, 3, 1, 1, m_tiledMode, delegate);
-
     c = *src_address;
-    n = (m_place == Place::Outside ? delegate.opaque: delegate.transparent);
     isTransparent = (rgba_geta(c) == 0 || c == m_bgColor);
 
-    if ((n >= 1) &&
+    if (get_bit(neighbors, i) &&
         ((m_place == Place::Outside && isTransparent) ||
          (m_place == Place::Inside && !isTransparent))) {
       r = (target & TARGET_RED_CHANNEL   ? rgba_getr(m_color): rgba_getr(c));
@@ -145,25 +153,25 @@ void OutlineFilter::applyToGrayscale(FilterManager* filterMgr)
   const int x2 = x+filterMgr->getWidth();
   const int y = filterMgr->y();
   Target target = filterMgr->getTarget();
-  int k, a, n;
+  int k, a;
   color_t c;
   bool isTransparent;
 
-  GetPixelsDelegateGrayscale delegate;
-  delegate.init(m_bgColor, m_matrix);
+  const color_t bgColor = m_bgColor;
+  Bits neighbors;
+  get_neighbors_bits<GrayscaleTraits>(
+    src, x, y, x2-x, m_tiledMode, int(m_matrix), m_place == Place::Outside,
+    [bgColor](color_t c){ return (graya_geta(c) == 0 || c == bgColor); },
+    neighbors);
 
-  for (; x<x2; ++x, ++src_address, ++dst_address) {
+  for (int i=0; x<x2; ++x, ++i, ++src_address, ++dst_address) {
     if (filterMgr->skipPixel())
       continue;
 
-    delegate.reset();
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y, 3, 3, 1, 1, m_tiledMode, delegate);
-
     c = *src_address;
-    n = (m_place == Place::Outside ? delegate.opaque: delegate.transparent);
     isTransparent = (graya_geta(c) == 0 || c == m_bgColor);
 
-    if ((n >= 1) &&
+    if (get_bit(neighbors, i) &&
         ((m_place == Place::Outside && isTransparent) ||
          (m_place == Place::Inside && !isTransparent))) {
       k = (target & TARGET_GRAY_CHANNEL  ? graya_getv(m_color): graya_getv(c));
@@ -186,22 +194,22 @@ void OutlineFilter::applyToIndexed(FilterManager* filterMgr)
   const int x2 = x+filterMgr->getWidth();
   const int y = filterMgr->y();
   Target target = filterMgr->getTarget();
-  int r, g, b, a, n;
+  int r, g, b, a;
   color_t c;
   bool isTransparent;
 
-  GetPixelsDelegateIndexed delegate(pal);
-  delegate.init(m_bgColor, m_matrix);
+  const color_t bgColor = m_bgColor;
+  Bits neighbors;
+  get_neighbors_bits<IndexedTraits>(
+    src, x, y, x2-x, m_tiledMode, int(m_matrix), m_place == Place::Outside,
+    [pal, bgColor](color_t c){ return (rgba_geta(pal->getEntry(c)) == 0 || c == bgColor); },
+    neighbors);
 
-  for (; x<x2; ++x, ++src_address, ++dst_address) {
+  for (int i=0; x<x2; ++x, ++i, ++src_address, ++dst_address) {
     if (filterMgr->skipPixel())
       continue;
 
-    delegate.reset();
-    get_neighboring_pixels<IndexedTraits>(src, x, y, 3, 3, 1, 1, m_tiledMode, delegate);
-
     c = *src_address;
-    n = (m_place == Place::Outside ? delegate.opaque: delegate.transparent);
 
     if (target & TARGET_INDEX_CHANNEL) {
       isTransparent = (c == m_bgColor);
@@ -210,7 +218,7 @@ void OutlineFilter::applyToIndexed(FilterManager* filterMgr)
       isTransparent = (rgba_geta(pal->getEntry(c)) == 0 || c == m_bgColor);
     }
 
-    if ((n >= 1) &&
+    if (get_bit(neighbors, i) &&
         ((m_place == Place::Outside && isTransparent) ||
          (m_place == Place::Inside && !isTransparent))) {
       if (target & TARGET_INDEX_CHANNEL) {
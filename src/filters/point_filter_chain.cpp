@@ -0,0 +1,65 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "filters/point_filter_chain.h"
+
+#include "base/debug.h"
+#include "filters/channels_lut.h"
+#include "filters/filter_manager.h"
+
+namespace filters {
+
+void PointFilterChain::addFilter(Filter* filter)
+{
+  ASSERT(filter);
+  m_filters.push_back(filter);
+}
+
+bool PointFilterChain::getChannelsLut(const Target target, ChannelsLut& lut) const
+{
+  for (const Filter* filter : m_filters) {
+    ChannelsLut next;
+    if (!filter->getChannelsLut(target, next))
+      return false;
+    lut.compose(next);
+  }
+  return true;
+}
+
+const char* PointFilterChain::getName()
+{
+  if (m_filters.size() == 1)
+    return m_filters[0]->getName();
+  return "Filters";
+}
+
+void PointFilterChain::applyToRgba(FilterManager* filterMgr)
+{
+  ChannelsLut lut;
+  if (getChannelsLut(filterMgr->getTarget(), lut))
+    lut.applyToRgba(filterMgr);
+}
+
+void PointFilterChain::applyToGrayscale(FilterManager* filterMgr)
+{
+  ChannelsLut lut;
+  if (getChannelsLut(filterMgr->getTarget(), lut))
+    lut.applyToGrayscale(filterMgr);
+}
+
+void PointFilterChain::applyToIndexed(FilterManager* filterMgr)
+{
+  const Target target = filterMgr->getTarget();
+  ChannelsLut lut;
+  if (getChannelsLut(target, lut))
+    lut.applyToIndexed(filterMgr, target);
+}
+
+} // namespace filters
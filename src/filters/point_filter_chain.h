@@ -0,0 +1,44 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef FILTERS_POINT_FILTER_CHAIN_H_INCLUDED
+#define FILTERS_POINT_FILTER_CHAIN_H_INCLUDED
+#pragma once
+
+#include "filters/filter.h"
+
+#include <vector>
+
+namespace filters {
+
+  // Applies several point filters (filters that return true in
+  // Filter::getChannelsLut()) in just one pass, composing the tables
+  // of all filters. The palette of indexed images is not modified,
+  // so this can be used only to modify pixels.
+  class PointFilterChain : public Filter {
+  public:
+    // The filter is not owned by the chain.
+    void addFilter(Filter* filter);
+    bool empty() const { return m_filters.empty(); }
+
+    // Returns false if some filter of the chain cannot be
+    // represented with tables for the given target.
+    bool getChannelsLut(const Target target, ChannelsLut& lut) const override;
+
+    // Filter implementation
+    const char* getName() override;
+    bool isBandSafe() const override { return true; }
+    void applyToRgba(FilterManager* filterMgr) override;
+    void applyToGrayscale(FilterManager* filterMgr) override;
+    void applyToIndexed(FilterManager* filterMgr) override;
+
+  private:
+    std::vector<Filter*> m_filters;
+  };
+
+} // namespace filters
+
+#endif
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -12,16 +12,22 @@
 #include "filters/replace_color_filter.h"
 
 #include "base/clamp.h"
+#include "base/scoped_lock.h"
 #include "doc/image.h"
 #include "doc/palette.h"
 #include "doc/rgbmap.h"
 #include "filters/filter_indexed_data.h"
 #include "filters/filter_manager.h"
 
+#include <algorithm>
+
 namespace filters {
 
 using namespace doc;
 
+// Number of pixels compared in each step of a row (RGB images)
+static constexpr int kPixelsPerStep = 64;
+
 ReplaceColorFilter::ReplaceColorFilter()
 {
   m_from = m_to = 0;
@@ -52,52 +58,36 @@ void ReplaceColorFilter::applyToRgba(FilterManager* filterMgr)
 {
   const uint32_t* src_address = (uint32_t*)filterMgr->getSourceAddress();
   uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
-  int w = filterMgr->getWidth();
-  Target target = filterMgr->getTarget();
-  int from_r, from_g, from_b, from_a;
-  int src_r, src_g, src_b, src_a;
-  int to_r, to_g, to_b, to_a;
-  int x, c;
-
-  from_r = rgba_getr(m_from);
-  from_g = rgba_getg(m_from);
-  from_b = rgba_getb(m_from);
-  from_a = rgba_geta(m_from);
-  to_r = rgba_getr(m_to);
-  to_g = rgba_getg(m_to);
-  to_b = rgba_getb(m_to);
-  to_a = rgba_geta(m_to);
-
-  for (x=0; x<w; x++) {
-    if (filterMgr->skipPixel()) {
-      ++src_address;
-      ++dst_address;
-      continue;
-    }
-
-    c = *(src_address++);
-    src_r = rgba_getr(c);
-    src_g = rgba_getg(c);
-    src_b = rgba_getb(c);
-    src_a = rgba_geta(c);
-
-    if (!(target & TARGET_RED_CHANNEL  )) from_r = src_r;
-    if (!(target & TARGET_GREEN_CHANNEL)) from_g = src_g;
-    if (!(target & TARGET_BLUE_CHANNEL )) from_b = src_b;
-    if (!(target & TARGET_ALPHA_CHANNEL)) from_a = src_a;
-
-    if ((ABS(src_r-from_r) <= m_tolerance) &&
-        (ABS(src_g-from_g) <= m_tolerance) &&
-        (ABS(src_b-from_b) <= m_tolerance) &&
-        (ABS(src_a-from_a) <= m_tolerance)) {
-      *(dst_address++) = rgba(
-        (target & TARGET_RED_CHANNEL   ? to_r: src_r),
-        (target & TARGET_GREEN_CHANNEL ? to_g: src_g),
-        (target & TARGET_BLUE_CHANNEL  ? to_b: src_b),
-        (target & TARGET_ALPHA_CHANNEL ? to_a: src_a));
+  const int w = filterMgr->getWidth();
+  const Target target = filterMgr->getTarget();
+
+  // Only channels in the target are compared and replaced
+  const color_t channels =
+    (target & TARGET_RED_CHANNEL   ? rgba_r_mask: 0) |
+    (target & TARGET_GREEN_CHANNEL ? rgba_g_mask: 0) |
+    (target & TARGET_BLUE_CHANNEL  ? rgba_b_mask: 0) |
+    (target & TARGET_ALPHA_CHANNEL ? rgba_a_mask: 0);
+  const color_t to = (m_to & channels);
+
+  // Pixels are compared in groups (with SIMD instructions when
+  // possible), and then replaced one by one (as we have to use
+  // skipPixel() for each pixel)
+  bool matches[kPixelsPerStep];
+  for (int x=0; x<w; x+=kPixelsPerStep) {
+    const int n = std::min(kPixelsPerStep, w-x);
+    rgba_match_by_tolerance(src_address, matches, n,
+                            m_from, channels, m_tolerance);
+
+    for (int i=0; i<n; ++i, ++src_address, ++dst_address) {
+      if (filterMgr->skipPixel())
+        continue;
+
+      const color_t c = *src_address;
+      if (matches[i])
+        *dst_address = (c & ~channels) | to;
+      else
+        *dst_address = c;
     }
-    else
-      *(dst_address++) = c;
   }
 }
 
@@ -146,14 +136,51 @@ void ReplaceColorFilter::applyToIndexed(FilterManager* filterMgr)
 {
   const uint8_t* src_address = (uint8_t*)filterMgr->getSourceAddress();
   uint8_t* dst_address = (uint8_t*)filterMgr->getDestinationAddress();
-  int w = filterMgr->getWidth();
-  Target target = filterMgr->getTarget();
-  const Palette* pal = filterMgr->getIndexedData()->getPalette();
-  const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
+  const int w = filterMgr->getWidth();
+
+  // The result depends only on the index of each pixel
+  {
+    base::scoped_lock lock(m_indexedMapMutex);
+    updateIndexedMap(filterMgr->getIndexedData()->getPalette(),
+                     filterMgr->getIndexedData()->getRgbMap(),
+                     filterMgr->getTarget());
+  }
+  const uint8_t* map = m_indexedMap.map;
+
+  for (int x=0; x<w; ++x, ++src_address, ++dst_address) {
+    if (filterMgr->skipPixel())
+      continue;
+
+    *dst_address = map[*src_address];
+  }
+}
+
+void ReplaceColorFilter::updateIndexedMap(const Palette* pal,
+                                          const RgbMap* rgbmap,
+                                          const Target target)
+{
+  IndexedMap& m = m_indexedMap;
+  if (m.palette == pal &&
+      m.modifications == pal->getModifications() &&
+      m.rgbmap == rgbmap &&
+      m.target == target &&
+      m.from == m_from &&
+      m.to == m_to &&
+      m.tolerance == m_tolerance)
+    return;
+
+  m.palette = pal;
+  m.modifications = pal->getModifications();
+  m.rgbmap = rgbmap;
+  m.target = target;
+  m.from = m_from;
+  m.to = m_to;
+  m.tolerance = m_tolerance;
+
   int from_r, from_g, from_b, from_a;
   int src_r, src_g, src_b, src_a;
   int to_r, to_g, to_b, to_a;
-  int x, c;
+  int c;
 
   c = pal->getEntry(m_from);
   from_r = rgba_getr(c);
@@ -167,20 +194,12 @@ void ReplaceColorFilter::applyToIndexed(FilterManager* filterMgr)
   to_b = rgba_getb(c);
   to_a = rgba_geta(c);
 
-  for (x=0; x<w; x++) {
-    if (filterMgr->skipPixel()) {
-      ++src_address;
-      ++dst_address;
-      continue;
-    }
-
-    c = *(src_address++);
-
+  for (c=0; c<256; ++c) {
     if (target & TARGET_INDEX_CHANNEL) {
       if (ABS(c-m_from) <= m_tolerance)
-        *(dst_address++) = m_to;
+        m.map[c] = m_to;
       else
-        *(dst_address++) = c;
+        m.map[c] = c;
     }
     else {
       src_r = rgba_getr(pal->getEntry(c));
@@ -197,14 +216,14 @@ void ReplaceColorFilter::applyToIndexed(FilterManager* filterMgr)
           (ABS(src_g-from_g) <= m_tolerance) &&
           (ABS(src_b-from_b) <= m_tolerance) &&
           (ABS(src_a-from_a) <= m_tolerance)) {
-        *(dst_address++) = rgbmap->mapColor(
+        m.map[c] = rgbmap->mapColor(
           (target & TARGET_RED_CHANNEL   ? to_r: src_r),
           (target & TARGET_GREEN_CHANNEL ? to_g: src_g),
           (target & TARGET_BLUE_CHANNEL  ? to_b: src_b),
           (target & TARGET_ALPHA_CHANNEL ? to_a: src_a));
       }
       else
-        *(dst_address++) = c;
+        m.map[c] = c;
     }
   }
 }
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -9,8 +9,17 @@
 #define FILTERS_REPLACE_COLOR_FILTER_H_INCLUDED
 #pragma once
 
+#include "base/mutex.h"
 #include "doc/color.h"
 #include "filters/filter.h"
+#include "filters/target.h"
+
+#include <cstdint>
+
+namespace doc {
+  class Palette;
+  class RgbMap;
+}
 
 namespace filters {
 
@@ -28,14 +37,35 @@ namespace filters {
 
     // Filter implementation
     const char* getName();
+    bool isBandSafe() const { return true; }
     void applyToRgba(FilterManager* filterMgr);
     void applyToGrayscale(FilterManager* filterMgr);
     void applyToIndexed(FilterManager* filterMgr);
 
   private:
+    void updateIndexedMap(const doc::Palette* palette,
+                          const doc::RgbMap* rgbmap,
+                          const Target target);
+
     doc::color_t m_from;
     doc::color_t m_to;
     int m_tolerance;
+
+    // Result for each index of indexed images (it's calculated once
+    // for all rows, and regenerated when some parameter changes).
+    // The mutex is used because rows can be filtered from several
+    // threads.
+    base::mutex m_indexedMapMutex;
+    struct IndexedMap {
+      const doc::Palette* palette = nullptr;
+      int modifications = 0;
+      const doc::RgbMap* rgbmap = nullptr;
+      Target target = 0;
+      doc::color_t from = 0;
+      doc::color_t to = 0;
+      int tolerance = -1;
+      uint8_t map[256];
+    } m_indexedMap;
   };
 
 } // namespace filters
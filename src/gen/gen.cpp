@@ -1,5 +1,5 @@
 // Aseprite Code Generator
-// Copyright (c) 2021 Igara Studio S.A.
+// Copyright (c) 2021-2022 Igara Studio S.A.
 // Copyright (c) 2014-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -31,6 +31,7 @@ static void run(int argc, const char* argv[])
   PO::Option& prefCpp = po.add("pref-cpp");
   PO::Option& theme = po.add("theme");
   PO::Option& strings = po.add("strings");
+  PO::Option& stringsTable = po.add("strings-table");
   PO::Option& commandIds = po.add("command-ids");
   PO::Option& widgetsDir = po.add("widgets-dir").requiresValue("<dir>");
   PO::Option& stringsDir = po.add("strings-dir").requiresValue("<dir>");
@@ -75,6 +76,10 @@ static void run(int argc, const char* argv[])
   else if (po.enabled(strings)) {
     gen_strings_class(inputFilename);
   }
+  // Generate strings_table.ini.h file
+  else if (po.enabled(stringsTable)) {
+    gen_strings_table(inputFilename);
+  }
   // Generate command_ids.ini.h file
   else if (po.enabled(commandIds)) {
     gen_command_ids(inputFilename);
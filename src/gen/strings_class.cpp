@@ -1,4 +1,5 @@
 // Aseprite Code Generator
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2016-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -10,20 +11,148 @@
 #include "base/replace_string.h"
 #include "base/string.h"
 #include "cfg/cfg.h"
+#include "gen/strings_hash.h"
 
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
 
-static std::string to_cpp(std::string stringId)
+namespace {
+
+struct StringItem {
+  std::string id;
+  std::string value;
+  int slot = -1;
+};
+
+std::string to_cpp(std::string stringId)
 {
   base::replace_string(stringId, ".", "_");
   return stringId;
 }
 
-void gen_strings_class(const std::string& inputFn)
+std::string to_cpp_literal(const std::string& value)
+{
+  std::string result = "\"";
+  for (const char chr : value) {
+    switch (chr) {
+      case '\\': result += "\\\\"; break;
+      case '"':  result += "\\\""; break;
+      case '\n': result += "\\n"; break;
+      case '\r': result += "\\r"; break;
+      case '\t': result += "\\t"; break;
+      default:
+        // Non-ASCII chars (UTF-8) are written as octal escape
+        // sequences (which cannot be extended by the next char as
+        // the hexadecimal ones)
+        if (uint8_t(chr) < 32 || uint8_t(chr) >= 127) {
+          char buf[8];
+          std::snprintf(buf, sizeof(buf), "\\%03o", int(uint8_t(chr)));
+          result += buf;
+        }
+        else
+          result.push_back(chr);
+        break;
+    }
+  }
+  result += "\"";
+  return result;
+}
+
+// Reads all strings of the .ini file (in the same order), and
+// calculates their slots in a minimal perfect hash table (using the
+// "hash and displace" algorithm): each string id goes to a bucket
+// (strings_hash(id, 0) % seeds.size()), and each bucket has a seed
+// that moves all its ids to free slots of the table (without
+// collisions), i.e. slot = strings_hash(id, seed) % items.size()
+void read_strings(const std::string& inputFn,
+                  std::vector<StringItem>& items,
+                  std::vector<uint32_t>& seeds)
 {
   cfg::CfgFile cfg;
   cfg.load(inputFn);
 
+  std::vector<std::string> sections;
+  std::vector<std::string> keys;
+  cfg.getAllSections(sections);
+  for (const auto& section : sections) {
+    keys.clear();
+    cfg.getAllKeys(section.c_str(), keys);
+
+    for (const auto& key : keys) {
+      StringItem item;
+      item.id = section + "." + key;
+      item.value = cfg.getValue(section.c_str(), key.c_str(), "");
+
+      // Ignore duplicated keys
+      if (std::find_if(items.begin(), items.end(),
+                       [&item](const StringItem& other){
+                         return other.id == item.id;
+                       }) == items.end())
+        items.push_back(item);
+    }
+  }
+  if (items.empty())
+    throw std::runtime_error("no strings in " + inputFn);
+
+  const uint32_t n = uint32_t(items.size());
+  const uint32_t m = n/2 + 1;
+  std::vector<std::vector<int>> buckets(m);
+  for (int i=0; i<int(n); ++i)
+    buckets[gen::strings_hash(items[i].id.c_str(), 0) % m].push_back(i);
+
+  // Biggest buckets first (when there are more free slots)
+  std::vector<int> order(m);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&buckets](int a, int b){
+                     return buckets[a].size() > buckets[b].size();
+                   });
+
+  std::vector<bool> used(n, false);
+  std::vector<uint32_t> bucketSlots;
+  seeds.assign(m, 0);
+  for (int b : order) {
+    const std::vector<int>& bucket = buckets[b];
+    if (bucket.empty())
+      break;
+
+    for (uint32_t seed=1; ; ++seed) {
+      if (seed == 0x1000000)
+        throw std::runtime_error("cannot create the strings table (duplicated ids?)");
+
+      bucketSlots.clear();
+      for (int i : bucket) {
+        const uint32_t slot = gen::strings_hash(items[i].id.c_str(), seed) % n;
+        if (used[slot] ||
+            std::find(bucketSlots.begin(), bucketSlots.end(), slot) != bucketSlots.end())
+          break;
+        bucketSlots.push_back(slot);
+      }
+      if (bucketSlots.size() < bucket.size())
+        continue;
+
+      for (std::size_t j=0; j<bucket.size(); ++j) {
+        used[bucketSlots[j]] = true;
+        items[bucket[j]].slot = int(bucketSlots[j]);
+      }
+      seeds[b] = seed;
+      break;
+    }
+  }
+}
+
+} // anonymous namespace
+
+void gen_strings_class(const std::string& inputFn)
+{
+  std::vector<StringItem> items;
+  std::vector<uint32_t> seeds;
+  read_strings(inputFn, items, seeds);
+
   std::cout
     << "// Don't modify, generated file from " << inputFn << "\n"
     << "\n";
@@ -40,24 +169,70 @@ void gen_strings_class(const std::string& inputFn)
     << "  class Strings {\n"
     << "  public:\n";
 
-  std::vector<std::string> sections;
-  std::vector<std::string> keys;
-  cfg.getAllSections(sections);
-  for (const auto& section : sections) {
-    keys.clear();
-    cfg.getAllKeys(section.c_str(), keys);
+  // Each string is accessed directly with its slot in the table
+  // generated with gen_strings_table()
+  for (const auto& item : items) {
+    std::cout << "    static const std::string& " << to_cpp(item.id) << "() { return T::instance()->translate(" << item.slot << "); }\n";
+  }
 
-    std::string textId = section;
-    textId.push_back('.');
-    for (auto key : keys) {
-      textId.append(key);
+  std::cout
+    << "  };\n"
+    << "\n"
+    << "} // namespace gen\n"
+    << "} // namespace app\n"
+    << "\n"
+    << "#endif\n";
+}
 
-      std::cout << "    static const std::string& " << to_cpp(textId) << "() { return T::instance()->translate(\"" << textId << "\"); }\n";
+void gen_strings_table(const std::string& inputFn)
+{
+  std::vector<StringItem> items;
+  std::vector<uint32_t> seeds;
+  read_strings(inputFn, items, seeds);
 
-      textId.erase(section.size()+1);
-    }
-  }
+  std::sort(items.begin(), items.end(),
+            [](const StringItem& a, const StringItem& b){
+              return a.slot < b.slot;
+            });
 
+  std::cout
+    << "// Don't modify, generated file from " << inputFn << "\n"
+    << "\n";
+
+  std::cout
+    << "#ifndef GENERATED_STRINGS_TABLE_INI_H_INCLUDED\n"
+    << "#define GENERATED_STRINGS_TABLE_INI_H_INCLUDED\n"
+    << "#pragma once\n"
+    << "\n"
+    << "#include <cstdint>\n"
+    << "\n"
+    << "namespace app {\n"
+    << "namespace gen {\n"
+    << "\n"
+    << "  // Minimal perfect hash table with all strings, the slot of an id is:\n"
+    << "  //   ::gen::strings_hash(id, kStringsSeeds[::gen::strings_hash(id, 0) % kStringsSeedsSize]) % kStringsSize\n"
+    << "  struct StringsEntry {\n"
+    << "    const char* id;\n"
+    << "    const char* value;\n"
+    << "  };\n"
+    << "\n"
+    << "  const int kStringsSize = " << items.size() << ";\n"
+    << "  const int kStringsSeedsSize = " << seeds.size() << ";\n"
+    << "\n"
+    << "  const uint32_t kStringsSeeds[kStringsSeedsSize] = {";
+  for (std::size_t i=0; i<seeds.size(); ++i) {
+    if ((i % 16) == 0)
+      std::cout << "\n    ";
+    std::cout << seeds[i] << ",";
+  }
+  std::cout
+    << "\n"
+    << "  };\n"
+    << "\n"
+    << "  const StringsEntry kStrings[kStringsSize] = {\n";
+  for (const auto& item : items) {
+    std::cout << "    { \"" << item.id << "\", " << to_cpp_literal(item.value) << " },\n";
+  }
   std::cout
     << "  };\n"
     << "\n"
@@ -1,4 +1,5 @@
 // Aseprite Code Generator
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2016-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -11,6 +12,7 @@
 #include <string>
 
 void gen_strings_class(const std::string& iniFile);
+void gen_strings_table(const std::string& iniFile);
 void gen_command_ids(const std::string& iniFile);
 
 #endif
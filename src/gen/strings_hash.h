@@ -0,0 +1,37 @@
+// Aseprite Code Generator
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef GEN_STRINGS_HASH_H_INCLUDED
+#define GEN_STRINGS_HASH_H_INCLUDED
+#pragma once
+
+#include <cstdint>
+
+namespace gen {
+
+  // Hash function of the perfect hash table of strings generated with
+  // "gen --strings-table". It's used by gen to build the table and by
+  // app::Strings to look up string ids in the table, so both must use
+  // exactly the same function.
+  inline uint32_t strings_hash(const char* id, const uint32_t seed) {
+    // FNV-1a with a final avalanche (so consecutive seeds give
+    // unrelated values)
+    uint32_t h = 2166136261u ^ seed;
+    for (; *id; ++id) {
+      h ^= uint8_t(*id);
+      h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+  }
+
+} // namespace gen
+
+#endif
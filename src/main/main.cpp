@@ -118,7 +118,7 @@ int app_main(int argc, char* argv[])
 
     const int code = app.initialize(options);
 
-    if (options.startShell())
+    if (options.startShell() || options.startServer())
       systemConsole.prepareShell();
 
     app.run();
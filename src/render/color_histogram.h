@@ -1,4 +1,5 @@
 // Aseprite Render Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -8,6 +9,7 @@
 #define RENDER_COLOR_HISTOGRAM_H_INCLUDED
 #pragma once
 
+#include <algorithm>
 #include <limits>
 #include <vector>
 
@@ -17,6 +19,8 @@
 #include "doc/palette.h"
 
 #include "render/median_cut.h"
+#include "render/octree_quantizer.h"
+#include "render/quantization_algorithm.h"
 
 namespace render {
   using namespace doc;
@@ -52,28 +56,35 @@ namespace render {
     void addSamples(doc::color_t color, std::size_t count = 1) {
       int i = histogramIndex(color);
 
-      if (m_histogram[i] < std::numeric_limits<std::size_t>::max()-count) // Avoid overflow
-        m_histogram[i] += count;
-      else
-        m_histogram[i] = std::numeric_limits<std::size_t>::max();
+      addCount(i, count);
 
       // Accurate colors are used only for less than 256 colors.  If the
       // image has more than 256 colors the m_histogram is used
       // instead.
-      if (m_useHighPrecision) {
-        std::vector<doc::color_t>::iterator it =
-          std::find(m_highPrecision.begin(), m_highPrecision.end(), color);
+      if (m_useHighPrecision)
+        addHighPrecisionColor(color);
+    }
 
-        // The color is not in the high-precision table
-        if (it == m_highPrecision.end()) {
-          if (m_highPrecision.size() < 256) {
-            m_highPrecision.push_back(color);
-          }
-          else {
-            // In this case we reach the limit for the high-precision histogram.
-            m_useHighPrecision = false;
-          }
+    // Adds all samples of the "other" histogram to this one. The
+    // result is the same as if all samples added to "other" were
+    // added to this histogram after the samples of this histogram
+    // (e.g. to create the histogram of a sequence of images in
+    // several threads, where each thread creates the histogram of a
+    // range of images, and then the histograms are merged in order).
+    void merge(const ColorHistogram& other) {
+      for (std::size_t i=0; i<m_histogram.size(); ++i) {
+        if (other.m_histogram[i])
+          addCount(i, other.m_histogram[i]);
+      }
+
+      if (m_useHighPrecision) {
+        for (doc::color_t color : other.m_highPrecision) {
+          addHighPrecisionColor(color);
+          if (!m_useHighPrecision)
+            break;
         }
+        if (!other.m_useHighPrecision)
+          m_useHighPrecision = false;
       }
     }
 
@@ -81,7 +92,8 @@ namespace render {
     // with the more important colors in the histogram. Returns the
     // number of used entries in the palette (maybe the range [from,to]
     // is more than necessary).
-    int createOptimizedPalette(Palette* palette) {
+    int createOptimizedPalette(Palette* palette,
+                               const QuantizationAlgorithm algorithm = QuantizationAlgorithm::MedianCut) {
       // Can we use the high-precision table?
       if (m_useHighPrecision && int(m_highPrecision.size()) <= palette->size()) {
         for (int i=0; i<(int)m_highPrecision.size(); ++i)
@@ -93,7 +105,32 @@ namespace render {
       // median-cut) to quantize "optimal" colors.
       else {
         std::vector<doc::color_t> result;
-        median_cut(*this, palette->size(), result);
+        switch (algorithm) {
+          case QuantizationAlgorithm::MedianCut:
+            median_cut(*this, palette->size(), result);
+            break;
+          case QuantizationAlgorithm::Octree:
+          case QuantizationAlgorithm::OctreeKMeans: {
+            OctreeQuantizer octree;
+            for (std::size_t i=0; i<m_histogram.size(); ++i) {
+              if (m_histogram[i])
+                octree.addColor(histogramColor(i), m_histogram[i]);
+            }
+
+            // The leaves of the tree (before reducing it to the
+            // palette size) are the samples for k-means
+            std::vector<doc::color_t> colors;
+            std::vector<std::size_t> counts;
+            if (algorithm == QuantizationAlgorithm::OctreeKMeans)
+              octree.getLeaves(colors, counts);
+
+            octree.createPalette(palette->size(), result);
+
+            if (algorithm == QuantizationAlgorithm::OctreeKMeans)
+              kmeans_refine_palette(result, colors, counts);
+            break;
+          }
+        }
 
         for (int i=0; i<(int)result.size(); ++i)
           palette->setEntry(i, result[i]);
@@ -103,6 +140,29 @@ namespace render {
     }
 
   private:
+    void addCount(std::size_t i, std::size_t count) {
+      if (m_histogram[i] < std::numeric_limits<std::size_t>::max()-count) // Avoid overflow
+        m_histogram[i] += count;
+      else
+        m_histogram[i] = std::numeric_limits<std::size_t>::max();
+    }
+
+    void addHighPrecisionColor(doc::color_t color) {
+      std::vector<doc::color_t>::iterator it =
+        std::find(m_highPrecision.begin(), m_highPrecision.end(), color);
+
+      // The color is not in the high-precision table
+      if (it == m_highPrecision.end()) {
+        if (m_highPrecision.size() < 256) {
+          m_highPrecision.push_back(color);
+        }
+        else {
+          // In this case we reach the limit for the high-precision histogram.
+          m_useHighPrecision = false;
+        }
+      }
+    }
+
     // Converts input color in a index for the histogram. It reduces
     // each 8-bit component to the resolution given in the template
     // parameters.
@@ -113,6 +173,20 @@ namespace render {
                             (rgba_geta(color) >> (8 - ABits)));
     }
 
+    // Inverse of histogramIndex(), it returns the color of the given
+    // entry of the histogram (with the same scale used in
+    // Box::meanColor()).
+    doc::color_t histogramColor(std::size_t i) const {
+      const int r = (i & (RElements-1));
+      const int g = ((i >> RBits) & (GElements-1));
+      const int b = ((i >> (RBits+GBits)) & (BElements-1));
+      const int a = ((i >> (RBits+GBits+BBits)) & (AElements-1));
+      return doc::rgba(255 * r / (RElements-1),
+                       255 * g / (GElements-1),
+                       255 * b / (BElements-1),
+                       255 * a / (AElements-1));
+    }
+
     std::size_t histogramIndex(int r, int g, int b, int a) const {
       return
         r
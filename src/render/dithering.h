@@ -1,5 +1,5 @@
 // Aseprite Render Library
-// Copyright (c) 2019 Igara Studio S.A.
+// Copyright (c) 2019-2022 Igara Studio S.A.
 // Copyright (c) 2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -22,20 +22,28 @@ namespace render {
       double factor = 1.0)
       : m_algorithm(algorithm)
       , m_matrix(matrix)
-      , m_factor(factor){ }
+      , m_factor(factor)
+      , m_zigZag(true) { }
 
     DitheringAlgorithm algorithm() const { return m_algorithm; }
     DitheringMatrix matrix() const { return m_matrix; }
     double factor() const { return m_factor; }
 
+    // Error diffusion goes from right-to-left in odd rows when
+    // zigZag() is true. Without zigZag() all rows go from
+    // left-to-right and several rows can be dithered in parallel.
+    bool zigZag() const { return m_zigZag; }
+
     void algorithm(const DitheringAlgorithm algorithm) { m_algorithm = algorithm; }
     void matrix(const DitheringMatrix& matrix) { m_matrix = matrix; }
     void factor(const double factor) { m_factor = factor; }
+    void zigZag(const bool zigZag) { m_zigZag = zigZag; }
 
   private:
     DitheringAlgorithm m_algorithm;
     DitheringMatrix m_matrix;
     double m_factor;
+    bool m_zigZag;
   };
 
 } // namespace render
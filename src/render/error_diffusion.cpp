@@ -1,5 +1,5 @@
 // Aseprite Render Library
-// Copyright (c) 2019-2020  Igara Studio S.A
+// Copyright (c) 2019-2022  Igara Studio S.A
 // Copyright (c) 2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -18,11 +18,21 @@
 
 namespace render {
 
-ErrorDiffusionDither::ErrorDiffusionDither(int transparentIndex)
+// Max number of rows dithered at the same time without zigZag()
+static constexpr int kMaxParallelRows = 32;
+
+ErrorDiffusionDither::ErrorDiffusionDither(int transparentIndex,
+                                           bool zigZag)
   : m_transparentIndex(transparentIndex)
+  , m_zigZag(zigZag)
 {
 }
 
+int ErrorDiffusionDither::maxParallelRows() const
+{
+  return (m_zigZag ? 1: kMaxParallelRows);
+}
+
 void ErrorDiffusionDither::start(
   const doc::Image* srcImage,
   doc::Image* dstImage,
@@ -30,8 +40,12 @@ void ErrorDiffusionDither::start(
 {
   m_srcImage = srcImage;
   m_width = 2+srcImage->width();
+  // Each row being dithered uses its own row of the buffer and the
+  // next one, plus an extra row which is cleared when a new row
+  // starts while the oldest one is still being dithered.
+  m_rows = maxParallelRows()+2;
   for (int i=0; i<kChannels; ++i)
-    m_err[i].resize(m_width*2, 0);
+    m_err[i].assign(m_width*m_rows, 0);
   m_lastY = -1;
   m_factor = int(factor * 100.0);
 }
@@ -46,15 +60,40 @@ doc::color_t ErrorDiffusionDither::ditherRgbToIndex2D(
   const doc::Palette* palette)
 {
   if (y != m_lastY) {
-    for (int i=0; i<kChannels; ++i) {
-      int* row0 = &m_err[i][0];
-      int* row1 = row0 + m_width;
-      int* end1 = row1 + m_width;
-      std::copy(row1, end1, row0);
-      std::fill(row1, end1, 0);
-    }
+    clearNextRowError(y);
     m_lastY = y;
   }
+  return ditherPixel(x, y, rgbmap, palette);
+}
+
+void ErrorDiffusionDither::ditherRgbRowToIndex2D(
+  const int x0, const int x1, const int y,
+  uint8_t* dst,
+  const doc::RgbMap* rgbmap,
+  const doc::Palette* palette)
+{
+  ASSERT(!m_zigZag);
+  if (x0 == 0)
+    clearNextRowError(y);
+  for (int x=x0; x<x1; ++x)
+    dst[x] = ditherPixel(x, y, rgbmap, palette);
+}
+
+void ErrorDiffusionDither::clearNextRowError(const int y)
+{
+  const int next = ((y+1) % m_rows) * m_width;
+  for (int i=0; i<kChannels; ++i)
+    std::fill(m_err[i].begin()+next,
+              m_err[i].begin()+next+m_width, 0);
+}
+
+doc::color_t ErrorDiffusionDither::ditherPixel(
+  const int x, const int y,
+  const doc::RgbMap* rgbmap,
+  const doc::Palette* palette)
+{
+  const int cur = (y % m_rows) * m_width;
+  const int next = ((y+1) % m_rows) * m_width;
 
   doc::color_t color =
     doc::get_pixel_fast<doc::RgbTraits>(m_srcImage, x, y);
@@ -67,7 +106,7 @@ doc::color_t ErrorDiffusionDither::ditherRgbToIndex2D(
     doc::rgba_geta(color)
   };
   for (int i=0; i<kChannels; ++i) {
-    v[i] += m_err[i][x+1];
+    v[i] += m_err[i][cur+x+1];
     v[i] = base::clamp(v[i], 0, 255);
   }
 
@@ -90,24 +129,25 @@ doc::color_t ErrorDiffusionDither::ditherRgbToIndex2D(
 
   // TODO using Floyd-Steinberg matrix here but it should be configurable
   for (int i=0; i<kChannels; ++i) {
-    int* err = &m_err[i][x];
+    int* err = &m_err[i][cur+x];
+    int* nextErr = &m_err[i][next+x];
     const int q = quantError[i] * m_factor / 100;
     const int a = q * 7 / 16;
     const int b = q * 3 / 16;
     const int c = q * 5 / 16;
     const int d = q * 1 / 16;
 
-    if (y & 1) {
-      err[0        ] += a;
-      err[m_width+2] += b;
-      err[m_width+1] += c;
-      err[m_width  ] += d;
+    if (m_zigZag && (y & 1)) {
+      err[0]      += a;
+      nextErr[2]  += b;
+      nextErr[1]  += c;
+      nextErr[0]  += d;
     }
     else {
-      err[       +2] += a;
-      err[m_width  ] += b;
-      err[m_width+1] += c;
-      err[m_width+2] += d;
+      err[2]      += a;
+      nextErr[0]  += b;
+      nextErr[1]  += c;
+      nextErr[2]  += d;
     }
   }
 
@@ -1,5 +1,5 @@
 // Aseprite Render Library
-// Copyright (c) 2019 Igara Studio S.A
+// Copyright (c) 2019-2022 Igara Studio S.A
 // Copyright (c) 2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -18,9 +18,14 @@ namespace render {
 
   class ErrorDiffusionDither : public DitheringAlgorithmBase {
   public:
-    ErrorDiffusionDither(int transparentIndex = -1);
+    // With zigZag=false all rows are processed from left to right,
+    // so several rows can be dithered at the same time.
+    ErrorDiffusionDither(int transparentIndex = -1,
+                         bool zigZag = true);
     int dimensions() const override { return 2; }
-    bool zigZag() const override { return true; }
+    bool zigZag() const override { return m_zigZag; }
+    int maxParallelRows() const override;
+    int wavefrontLag() const override { return 2; }
     void start(
       const doc::Image* srcImage,
       doc::Image* dstImage,
@@ -30,12 +35,27 @@ namespace render {
       const int x, const int y,
       const doc::RgbMap* rgbmap,
       const doc::Palette* palette) override;
+    void ditherRgbRowToIndex2D(
+      const int x0, const int x1, const int y,
+      uint8_t* dst,
+      const doc::RgbMap* rgbmap,
+      const doc::Palette* palette) override;
   private:
+    void clearNextRowError(const int y);
+    doc::color_t ditherPixel(
+      const int x, const int y,
+      const doc::RgbMap* rgbmap,
+      const doc::Palette* palette);
+
     int m_transparentIndex;
+    bool m_zigZag;
     const doc::Image* m_srcImage;
     int m_width, m_lastY;
     static const int kChannels = 4;
+    // Error of each row is accumulated in a circular buffer of
+    // m_rows rows.
     std::vector<int> m_err[kChannels];
+    int m_rows;
     int m_factor;
   };
 
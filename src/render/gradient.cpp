@@ -1,5 +1,5 @@
 // Aseprite Render Library
-// Copyright (c) 2019-2020 Igara Studio S.A.
+// Copyright (c) 2019-2022 Igara Studio S.A.
 // Copyright (c) 2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -16,8 +16,143 @@
 #include "doc/image_impl.h"
 #include "render/dithering_matrix.h"
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define RENDER_GRADIENT_SSE2 1
+  #include <emmintrin.h>
+#endif
+
 namespace render {
 
+namespace {
+
+// Number of interpolated colors between c0 and c1 in the lookup
+// table of a gradient (16KB, so it fits in the L1 cache)
+constexpr int kLutSize = 4096;
+
+// Lookup table with the interpolated colors of a gradient. The first
+// entry is c0 (for f < 0), the last one is c1 (for f > 1), and the
+// kLutSize entries between them go from f=0 to f=1.
+class GradientLut {
+public:
+  // Values to convert "f" to a position in the table: the index of
+  // "f" is int(f*scale + offset), clamped to [0, maxPos].
+  static constexpr float kScale = float(kLutSize-1);
+  static constexpr float kOffset = 1.5f;
+  static constexpr float kMaxPos = float(kLutSize+1);
+
+  GradientLut(const doc::color_t c0, const doc::color_t c1)
+    : m_colors(kLutSize+2) {
+    const double r0 = double(doc::rgba_getr(c0)) / 255.0;
+    const double g0 = double(doc::rgba_getg(c0)) / 255.0;
+    const double b0 = double(doc::rgba_getb(c0)) / 255.0;
+    const double a0 = double(doc::rgba_geta(c0)) / 255.0;
+
+    const double r1 = double(doc::rgba_getr(c1)) / 255.0;
+    const double g1 = double(doc::rgba_getg(c1)) / 255.0;
+    const double b1 = double(doc::rgba_getb(c1)) / 255.0;
+    const double a1 = double(doc::rgba_geta(c1)) / 255.0;
+
+    m_colors.front() = c0;
+    m_colors.back() = c1;
+    for (int i=0; i<kLutSize; ++i) {
+      const double f = double(i) / (kLutSize-1);
+      m_colors[i+1] =
+        doc::rgba(int(255.0 * (r0 + f*(r1-r0))),
+                  int(255.0 * (g0 + f*(g1-g0))),
+                  int(255.0 * (b0 + f*(b1-b0))),
+                  int(255.0 * (a0 + f*(a1-a0))));
+    }
+  }
+
+  doc::color_t operator[](const int i) const {
+    return m_colors[i];
+  }
+
+private:
+  std::vector<doc::color_t> m_colors;
+};
+
+// Position in the lookup table of a linear gradient. In each row "f"
+// is a linear function of x (f = a + b*x).
+struct LinearPos {
+  float a, b;
+
+  LinearPos(const double a, const double b)
+    : a(float(a) * GradientLut::kScale + GradientLut::kOffset)
+    , b(float(b) * GradientLut::kScale) {
+  }
+
+  float operator()(const float x) const {
+    return a + b*x;
+  }
+
+#if RENDER_GRADIENT_SSE2
+  __m128 operator()(const __m128 x) const {
+    return _mm_add_ps(_mm_set1_ps(a), _mm_mul_ps(_mm_set1_ps(b), x));
+  }
+#endif
+};
+
+// Position in the lookup table of a radial gradient, f is the
+// distance to the center (f = sqrt((x-cx)^2*sx + dy2)).
+struct RadialPos {
+  float cx, sx, dy2;
+
+  float operator()(const float x) const {
+    const float dx = x - cx;
+    return std::sqrt(dx*dx*sx + dy2) * GradientLut::kScale + GradientLut::kOffset;
+  }
+
+#if RENDER_GRADIENT_SSE2
+  __m128 operator()(const __m128 x) const {
+    const __m128 dx = _mm_sub_ps(x, _mm_set1_ps(cx));
+    const __m128 f = _mm_sqrt_ps(
+      _mm_add_ps(_mm_mul_ps(_mm_mul_ps(dx, dx), _mm_set1_ps(sx)),
+                 _mm_set1_ps(dy2)));
+    return _mm_add_ps(_mm_mul_ps(f, _mm_set1_ps(GradientLut::kScale)),
+                      _mm_set1_ps(GradientLut::kOffset));
+  }
+#endif
+};
+
+// Fills a row of the gradient using the lookup table. The index of
+// each pixel is calculated for 4 pixels at the same time with SSE2.
+template<typename Pos>
+void render_gradient_row(const GradientLut& lut,
+                         const Pos& pos,
+                         doc::color_t* dst,
+                         const int width)
+{
+  int x = 0;
+#if RENDER_GRADIENT_SSE2
+  const __m128 minPos = _mm_setzero_ps();
+  const __m128 maxPos = _mm_set1_ps(GradientLut::kMaxPos);
+  const __m128 step = _mm_set1_ps(4.0f);
+  __m128 xs = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+  alignas(16) int32_t idx[4];
+  for (; x+4<=width; x+=4, dst+=4) {
+    const __m128 v = _mm_min_ps(_mm_max_ps(pos(xs), minPos), maxPos);
+    _mm_store_si128((__m128i*)idx, _mm_cvttps_epi32(v));
+    dst[0] = lut[idx[0]];
+    dst[1] = lut[idx[1]];
+    dst[2] = lut[idx[2]];
+    dst[3] = lut[idx[3]];
+    xs = _mm_add_ps(xs, step);
+  }
+#endif
+  for (; x<width; ++x, ++dst) {
+    const float v = std::clamp(pos(float(x)), 0.0f, GradientLut::kMaxPos);
+    *dst = lut[int(v)];
+  }
+}
+
+} // anonymous namespace
+
 void render_rgba_gradient(
   doc::Image* img,
   const gfx::Point imgPos,
@@ -79,44 +214,22 @@ void render_rgba_linear_gradient(
     c1 = (c0 & doc::rgba_rgb_mask);
   }
 
-  const double r0 = double(doc::rgba_getr(c0)) / 255.0;
-  const double g0 = double(doc::rgba_getg(c0)) / 255.0;
-  const double b0 = double(doc::rgba_getb(c0)) / 255.0;
-  const double a0 = double(doc::rgba_geta(c0)) / 255.0;
-
-  const double r1 = double(doc::rgba_getr(c1)) / 255.0;
-  const double g1 = double(doc::rgba_getg(c1)) / 255.0;
-  const double b1 = double(doc::rgba_getb(c1)) / 255.0;
-  const double a1 = double(doc::rgba_geta(c1)) / 255.0;
-
-  doc::LockImageBits<doc::RgbTraits> bits(img);
-  auto it = bits.begin();
   const int width = img->width();
   const int height = img->height();
 
   if (matrix.rows() == 1 && matrix.cols() == 1) {
+    const GradientLut lut(c0, c1);
     for (int y=0; y<height; ++y) {
-      for (int x=0; x<width; ++x, ++it) {
-        base::Vector2d<double> q(imgPos.x+x,
-                                 imgPos.y+y);
-        q -= u;
-        double f = (q * w) / wmag;
-
-        doc::color_t c;
-        if (f < 0.0) c = c0;
-        else if (f > 1.0) c = c1;
-        else {
-          c = doc::rgba(int(255.0 * (r0 + f*(r1-r0))),
-                        int(255.0 * (g0 + f*(g1-g0))),
-                        int(255.0 * (b0 + f*(b1-b0))),
-                        int(255.0 * (a0 + f*(a1-a0))));
-        }
-
-        *it = c;
-      }
+      const LinearPos pos(
+        ((imgPos.x - u.x)*w.x + (imgPos.y+y - u.y)*w.y) / wmag,
+        w.x / wmag);
+      render_gradient_row(
+        lut, pos, (doc::color_t*)img->getPixelAddress(0, y), width);
     }
   }
   else {
+    doc::LockImageBits<doc::RgbTraits> bits(img);
+    auto it = bits.begin();
     for (int y=0; y<height; ++y) {
       for (int x=0; x<width; ++x, ++it) {
         base::Vector2d<double> q(imgPos.x+x,
@@ -170,46 +283,25 @@ void render_rgba_radial_gradient(
     c1 = (c0 & doc::rgba_rgb_mask);
   }
 
-  const double r0 = double(doc::rgba_getr(c0)) / 255.0;
-  const double g0 = double(doc::rgba_getg(c0)) / 255.0;
-  const double b0 = double(doc::rgba_getb(c0)) / 255.0;
-  const double a0 = double(doc::rgba_geta(c0)) / 255.0;
-
-  const double r1 = double(doc::rgba_getr(c1)) / 255.0;
-  const double g1 = double(doc::rgba_getg(c1)) / 255.0;
-  const double b1 = double(doc::rgba_getb(c1)) / 255.0;
-  const double a1 = double(doc::rgba_geta(c1)) / 255.0;
-
-  doc::LockImageBits<doc::RgbTraits> bits(img);
-  auto it = bits.begin();
   const int width = img->width();
   const int height = img->height();
 
   if (matrix.rows() == 1 && matrix.cols() == 1) {
+    const GradientLut lut(c0, c1);
+    const base::Vector2d<double> c = (u+v)/2;
     for (int y=0; y<height; ++y) {
-      for (int x=0; x<width; ++x, ++it) {
-        base::Vector2d<double> q(imgPos.x+x,
-                                 imgPos.y+y);
-        q -= (u+v)/2;
-        q.x /= std::fabs(w.x);
-        q.y /= std::fabs(w.y);
-        double f = std::sqrt(q.x*q.x + q.y*q.y);
-
-        doc::color_t c;
-        if (f < 0.0) c = c0;
-        else if (f > 1.0) c = c1;
-        else {
-          c = doc::rgba(int(255.0 * (r0 + f*(r1-r0))),
-                        int(255.0 * (g0 + f*(g1-g0))),
-                        int(255.0 * (b0 + f*(b1-b0))),
-                        int(255.0 * (a0 + f*(a1-a0))));
-        }
-
-        *it = c;
-      }
+      const double dy = (imgPos.y+y - c.y) / std::fabs(w.y);
+      const RadialPos pos{
+        float(c.x - imgPos.x),
+        float(1.0 / (w.x*w.x)),
+        float(dy*dy) };
+      render_gradient_row(
+        lut, pos, (doc::color_t*)img->getPixelAddress(0, y), width);
     }
   }
   else {
+    doc::LockImageBits<doc::RgbTraits> bits(img);
+    auto it = bits.begin();
     for (int y=0; y<height; ++y) {
       for (int x=0; x<width; ++x, ++it) {
         base::Vector2d<double> q(imgPos.x+x,
@@ -0,0 +1,90 @@
+// Aseprite Render Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "render/dithering_matrix.h"
+#include "render/gradient.h"
+
+#include <cmath>
+#include <cstdlib>
+
+using namespace doc;
+using namespace render;
+
+// Colors from the lookup table can differ at most in one level from
+// the color interpolated for each pixel
+static void expect_near_color(color_t expected, color_t color)
+{
+  EXPECT_NEAR(rgba_getr(expected), rgba_getr(color), 1);
+  EXPECT_NEAR(rgba_getg(expected), rgba_getg(color), 1);
+  EXPECT_NEAR(rgba_getb(expected), rgba_getb(color), 1);
+  EXPECT_NEAR(rgba_geta(expected), rgba_geta(color), 1);
+}
+
+TEST(Gradient, Linear)
+{
+  const color_t c0 = rgba(0, 0, 255, 255);
+  const color_t c1 = rgba(255, 128, 0, 64);
+  ImageRef image(Image::create(IMAGE_RGB, 301, 3));
+  render_rgba_linear_gradient(image.get(), gfx::Point(-20, 0),
+                              gfx::Point(0, 0), gfx::Point(255, 0),
+                              c0, c1, DitheringMatrix());
+
+  for (int y=0; y<image->height(); ++y) {
+    for (int x=0; x<image->width(); ++x) {
+      const int i = x-20;
+      color_t expected;
+      if (i < 0)
+        expected = c0;
+      else if (i > 255)
+        expected = c1;
+      else {
+        const double f = i / 255.0;
+        expected = rgba(i,
+                        int(128.0 * f),
+                        int(255.0 * (1.0 - f)),
+                        int(255.0 * (1.0 + f*(64.0/255.0 - 1.0))));
+      }
+      expect_near_color(expected, image->getPixel(x, y));
+    }
+  }
+  EXPECT_EQ(c0, image->getPixel(0, 0));
+  EXPECT_EQ(c1, image->getPixel(300, 0));
+}
+
+TEST(Gradient, Radial)
+{
+  const color_t c0 = rgba(0, 0, 0, 255);
+  const color_t c1 = rgba(255, 255, 255, 255);
+  ImageRef image(Image::create(IMAGE_RGB, 67, 45));
+  render_rgba_radial_gradient(image.get(), gfx::Point(0, 0),
+                              gfx::Point(0, 0), gfx::Point(66, 44),
+                              c0, c1, DitheringMatrix());
+
+  for (int y=0; y<image->height(); ++y) {
+    for (int x=0; x<image->width(); ++x) {
+      const double dx = (x - 33.0) / 33.0;
+      const double dy = (y - 22.0) / 22.0;
+      const double f = std::sqrt(dx*dx + dy*dy);
+      const int v = (f > 1.0 ? 255: int(255.0 * f));
+      expect_near_color(rgba(v, v, v, 255), image->getPixel(x, y));
+    }
+  }
+  EXPECT_EQ(c1, image->getPixel(0, 0));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,80 @@
+// Aseprite Render Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_LAYERS_CACHE_H_INCLUDED
+#define RENDER_LAYERS_CACHE_H_INCLUDED
+#pragma once
+
+#include "doc/image_ref.h"
+#include "gfx/point.h"
+
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace render {
+
+  // Keeps the already composited layers below the selected layer
+  // of a Render (the layer with the preview image), so we don't need
+  // to re-composite those layers each time the selected layer changes
+  // (e.g. on each mouse movement while the user is painting).
+  //
+  // The rendered area is split in tiles of the same size (in
+  // projected sprite coordinates), and all tiles are discarded when
+  // the key changes. The key is a signature of everything that can
+  // modify the result (layers, cels, images and its versions, render
+  // settings, etc.).
+  class LayersCache {
+  public:
+    typedef std::vector<uint64_t> Key;
+
+    // Max number of tiles to keep in memory (e.g. 128 RGBA tiles of
+    // 256x256 = 32MB)
+    static constexpr int kMaxTiles = 128;
+
+    // Changes the key of the cache, if it's different from the
+    // current one, all tiles are discarded.
+    void setKey(Key&& key) {
+      if (m_key != key) {
+        m_key = std::move(key);
+        m_tiles.clear();
+      }
+    }
+
+    doc::Image* tile(const gfx::Point& pos) const {
+      auto it = m_tiles.find(std::make_pair(pos.x, pos.y));
+      if (it != m_tiles.end())
+        return it->second.get();
+      else
+        return nullptr;
+    }
+
+    void addTile(const gfx::Point& pos, const doc::ImageRef& image) {
+      m_tiles[std::make_pair(pos.x, pos.y)] = image;
+    }
+
+    int size() const {
+      return int(m_tiles.size());
+    }
+
+    void clearTiles() {
+      m_tiles.clear();
+    }
+
+    void clear() {
+      m_key.clear();
+      m_tiles.clear();
+    }
+
+  private:
+    Key m_key;
+    std::map<std::pair<int, int>, doc::ImageRef> m_tiles;
+  };
+
+} // namespace render
+
+#endif
@@ -0,0 +1,78 @@
+// Aseprite Render Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_MIPMAPS_CACHE_H_INCLUDED
+#define RENDER_MIPMAPS_CACHE_H_INCLUDED
+#pragma once
+
+#include "doc/image_ref.h"
+#include "gfx/point.h"
+#include "render/layers_cache.h"
+
+#include <map>
+#include <tuple>
+#include <utility>
+
+namespace render {
+
+  // Keeps down-scaled versions (mip levels) of the flattened layers
+  // of one sprite frame, so zoomed-out views (50%, 25%, 12.5%, etc.)
+  // can just copy the already filtered pixels instead of sampling
+  // all layers again on each render.
+  //
+  // Level N has 1/2^N of the sprite size, and each level is split in
+  // tiles that are created lazily (only the visible ones). All tiles
+  // are discarded when the key changes (the same kind of key used by
+  // the LayersCache, but without the scale, so tiles of different
+  // levels can be kept at the same time).
+  class MipmapsCache {
+  public:
+    typedef LayersCache::Key Key;
+
+    // Max number of tiles to keep in memory (e.g. 256 RGBA tiles of
+    // 256x256 = 64MB)
+    static constexpr int kMaxTiles = 256;
+
+    void setKey(Key&& key) {
+      if (m_key != key) {
+        m_key = std::move(key);
+        m_tiles.clear();
+      }
+    }
+
+    doc::Image* tile(const int level, const gfx::Point& pos) const {
+      auto it = m_tiles.find(std::make_tuple(level, pos.x, pos.y));
+      if (it != m_tiles.end())
+        return it->second.get();
+      else
+        return nullptr;
+    }
+
+    void addTile(const int level, const gfx::Point& pos, const doc::ImageRef& image) {
+      m_tiles[std::make_tuple(level, pos.x, pos.y)] = image;
+    }
+
+    int size() const {
+      return int(m_tiles.size());
+    }
+
+    void clearTiles() {
+      m_tiles.clear();
+    }
+
+    void clear() {
+      m_key.clear();
+      m_tiles.clear();
+    }
+
+  private:
+    Key m_key;
+    std::map<std::tuple<int, int, int>, doc::ImageRef> m_tiles;
+  };
+
+} // namespace render
+
+#endif
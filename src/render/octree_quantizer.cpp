@@ -0,0 +1,248 @@
+// Aseprite Render Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "render/octree_quantizer.h"
+
+#include "base/debug.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace render {
+
+using namespace doc;
+
+static color_t mean_color(uint64_t r, uint64_t g, uint64_t b, uint64_t a,
+                          uint64_t count)
+{
+  ASSERT(count > 0);
+  return rgba(int((r + count/2) / count),
+              int((g + count/2) / count),
+              int((b + count/2) / count),
+              int((a + count/2) / count));
+}
+
+OctreeQuantizer::OctreeQuantizer(int maxLeaves)
+  : m_maxLeaves(std::max(1, maxLeaves))
+  , m_leaves(0)
+{
+  createNode(0);                // Root node
+}
+
+void OctreeQuantizer::addColor(color_t color, std::size_t count)
+{
+  const int r = rgba_getr(color);
+  const int g = rgba_getg(color);
+  const int b = rgba_getb(color);
+  const int a = rgba_geta(color);
+
+  int i = 0;
+  while (true) {
+    m_nodes[i].count += count;
+    if (m_nodes[i].leaf)
+      break;
+
+    const int bit = 7 - m_nodes[i].level;
+    const int j =
+      (((r >> bit) & 1) << 3) |
+      (((g >> bit) & 1) << 2) |
+      (((b >> bit) & 1) << 1) |
+      ((a >> bit) & 1);
+
+    int child = m_nodes[i].children[j];
+    if (child < 0) {
+      child = createNode(m_nodes[i].level+1);
+      m_nodes[i].children[j] = child;
+    }
+    i = child;
+  }
+
+  Node& leaf = m_nodes[i];
+  leaf.r += uint64_t(r) * count;
+  leaf.g += uint64_t(g) * count;
+  leaf.b += uint64_t(b) * count;
+  leaf.a += uint64_t(a) * count;
+
+  // Reduce some extra leaves, so we don't have to reduce the tree
+  // each time a new color is added
+  if (m_leaves > m_maxLeaves)
+    reduce(m_maxLeaves - m_maxLeaves/8);
+}
+
+void OctreeQuantizer::getLeaves(std::vector<color_t>& colors,
+                                std::vector<std::size_t>& counts) const
+{
+  colors.clear();
+  counts.clear();
+  getLeaves(0, colors, counts);
+}
+
+void OctreeQuantizer::createPalette(int ncolors, std::vector<color_t>& result)
+{
+  reduce(std::max(1, ncolors));
+
+  std::vector<std::size_t> counts;
+  getLeaves(result, counts);
+}
+
+int OctreeQuantizer::createNode(int level)
+{
+  int i;
+  if (!m_freeNodes.empty()) {
+    i = m_freeNodes.back();
+    m_freeNodes.pop_back();
+  }
+  else {
+    i = int(m_nodes.size());
+    m_nodes.emplace_back();
+  }
+
+  Node& node = m_nodes[i];
+  node.r = node.g = node.b = node.a = 0;
+  node.count = 0;
+  std::fill(node.children, node.children+16, -1);
+  node.level = level;
+  node.leaf = (level == kMaxDepth);
+
+  if (node.leaf)
+    ++m_leaves;
+  else
+    m_reducible[level].push_back(i);
+  return i;
+}
+
+// Converts internal nodes of the deepest level in leaves (starting
+// from nodes with less samples) until the tree has "maxLeaves"
+// leaves or less.
+void OctreeQuantizer::reduce(const int maxLeaves)
+{
+  for (int level=kMaxDepth-1; level>=0 && m_leaves > maxLeaves; --level) {
+    // Nodes with more samples first, so we can pop the nodes with
+    // less samples from the back
+    std::vector<int>& reducible = m_reducible[level];
+    std::stable_sort(
+      reducible.begin(), reducible.end(),
+      [this](const int a, const int b){
+        return m_nodes[a].count > m_nodes[b].count;
+      });
+
+    while (!reducible.empty() && m_leaves > maxLeaves) {
+      Node& node = m_nodes[reducible.back()];
+      reducible.pop_back();
+
+      // All children are leaves because this is the deepest level
+      // with internal nodes
+      ASSERT(!node.leaf);
+      int nchildren = 0;
+      for (int& child : node.children) {
+        if (child < 0)
+          continue;
+
+        const Node& leaf = m_nodes[child];
+        ASSERT(leaf.leaf);
+        node.r += leaf.r;
+        node.g += leaf.g;
+        node.b += leaf.b;
+        node.a += leaf.a;
+        m_freeNodes.push_back(child);
+        child = -1;
+        ++nchildren;
+      }
+      node.leaf = true;
+      m_leaves -= nchildren-1;
+    }
+  }
+}
+
+void OctreeQuantizer::getLeaves(int i,
+                                std::vector<color_t>& colors,
+                                std::vector<std::size_t>& counts) const
+{
+  const Node& node = m_nodes[i];
+  if (node.leaf) {
+    if (node.count > 0) {
+      colors.push_back(mean_color(node.r, node.g, node.b, node.a, node.count));
+      counts.push_back(std::size_t(node.count));
+    }
+    return;
+  }
+  for (int child : node.children) {
+    if (child >= 0)
+      getLeaves(child, colors, counts);
+  }
+}
+
+void kmeans_refine_palette(std::vector<color_t>& palette,
+                           const std::vector<color_t>& colors,
+                           const std::vector<std::size_t>& counts,
+                           const int maxIterations)
+{
+  ASSERT(colors.size() == counts.size());
+
+  struct Cluster {
+    uint64_t r, g, b, a, count;
+  };
+  std::vector<Cluster> clusters(palette.size());
+
+  for (int iteration=0; iteration<maxIterations; ++iteration) {
+    std::fill(clusters.begin(), clusters.end(), Cluster{ 0, 0, 0, 0, 0 });
+
+    // Assign each sample to the nearest palette entry
+    for (std::size_t i=0; i<colors.size(); ++i) {
+      const int r = rgba_getr(colors[i]);
+      const int g = rgba_getg(colors[i]);
+      const int b = rgba_getb(colors[i]);
+      const int a = rgba_geta(colors[i]);
+
+      int nearest = 0;
+      int lowest = std::numeric_limits<int>::max();
+      for (int j=0; j<int(palette.size()); ++j) {
+        const int dr = rgba_getr(palette[j]) - r;
+        const int dg = rgba_getg(palette[j]) - g;
+        const int db = rgba_getb(palette[j]) - b;
+        const int da = rgba_geta(palette[j]) - a;
+        const int d = dr*dr + dg*dg + db*db + da*da;
+        if (d < lowest) {
+          lowest = d;
+          nearest = j;
+          if (d == 0)
+            break;
+        }
+      }
+
+      Cluster& cluster = clusters[nearest];
+      cluster.r += uint64_t(r) * counts[i];
+      cluster.g += uint64_t(g) * counts[i];
+      cluster.b += uint64_t(b) * counts[i];
+      cluster.a += uint64_t(a) * counts[i];
+      cluster.count += counts[i];
+    }
+
+    // Move each palette entry to the mean of its samples (entries
+    // without samples are kept in the same place)
+    bool changed = false;
+    for (std::size_t j=0; j<palette.size(); ++j) {
+      const Cluster& cluster = clusters[j];
+      if (cluster.count == 0)
+        continue;
+
+      const color_t color = mean_color(cluster.r, cluster.g, cluster.b,
+                                       cluster.a, cluster.count);
+      if (palette[j] != color) {
+        palette[j] = color;
+        changed = true;
+      }
+    }
+    if (!changed)
+      break;
+  }
+}
+
+} // namespace render
@@ -0,0 +1,76 @@
+// Aseprite Render Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_OCTREE_QUANTIZER_H_INCLUDED
+#define RENDER_OCTREE_QUANTIZER_H_INCLUDED
+#pragma once
+
+#include "doc/color.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace render {
+
+  // Octree color quantizer (in RGBA space, so each node has 16
+  // children). Colors are added incrementally, and when the tree has
+  // more than "maxLeaves" leaves, the deepest nodes with less samples
+  // are merged, so the memory used is bounded.
+  class OctreeQuantizer {
+  public:
+    // Max depth of the tree (the histogram used by the
+    // PaletteOptimizer doesn't have more than 6 bits per component)
+    static constexpr int kMaxDepth = 6;
+    static constexpr int kDefaultMaxLeaves = 4096;
+
+    OctreeQuantizer(int maxLeaves = kDefaultMaxLeaves);
+
+    void addColor(doc::color_t color, std::size_t count = 1);
+
+    int leaves() const { return m_leaves; }
+
+    // Mean color and number of samples of each leaf of the tree.
+    void getLeaves(std::vector<doc::color_t>& colors,
+                   std::vector<std::size_t>& counts) const;
+
+    // Reduces the tree to "ncolors" leaves (or less) and returns the
+    // mean color of each leaf.
+    void createPalette(int ncolors, std::vector<doc::color_t>& result);
+
+  private:
+    struct Node {
+      uint64_t r, g, b, a;      // Sum of all samples (only in leaves)
+      uint64_t count;           // Number of samples
+      int children[16];         // Indexes of children in m_nodes (or -1)
+      int level;
+      bool leaf;
+    };
+
+    int createNode(int level);
+    void reduce(const int maxLeaves);
+    void getLeaves(int i,
+                   std::vector<doc::color_t>& colors,
+                   std::vector<std::size_t>& counts) const;
+
+    std::vector<Node> m_nodes;
+    std::vector<int> m_freeNodes;
+    // Internal nodes of each level that can be converted to leaves
+    std::vector<int> m_reducible[kMaxDepth];
+    int m_maxLeaves;
+    int m_leaves;
+  };
+
+  // Refines the given palette using k-means with the given samples
+  // (weighted colors), e.g. the leaves of an OctreeQuantizer.
+  void kmeans_refine_palette(std::vector<doc::color_t>& palette,
+                             const std::vector<doc::color_t>& colors,
+                             const std::vector<std::size_t>& counts,
+                             const int maxIterations = 8);
+
+} // namespace render
+
+#endif
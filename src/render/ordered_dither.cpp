@@ -1,5 +1,5 @@
 // Aseprite Render Library
-// Copyright (c) 2019-2020  Igara Studio S.A.
+// Copyright (c) 2019-2022  Igara Studio S.A.
 // Copyright (c) 2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -16,11 +16,29 @@
 #include "render/dithering_matrix.h"
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
+#include <thread>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define RENDER_DITHER_SSE2 1
+  #include <emmintrin.h>
+#endif
+
 namespace render {
 
+// Number of rows dithered by each thread in each step (1D algorithms)
+static constexpr int kRowsPerBand = 16;
+
+// Min number of pixels to dither with an extra thread
+static constexpr int kMinPixelsPerThread = 64*1024;
+
+// Number of pixels dithered in each step of a row (2D algorithms
+// with wavefront parallelism)
+static constexpr int kPixelsPerWavefrontStep = 64;
+
 // Base 2x2 dither matrix, called D(2):
 int BayerMatrix::D2[4] = { 0, 2,
                            3, 1 };
@@ -41,6 +59,112 @@ static int colorDistance(int r1, int g1, int b1, int a1,
   return result;
 }
 
+// Number of pixels processed in each step of dither_row()
+static constexpr int kPixelsPerStep = 16;
+
+// Number of bits of the hash used for the cache of colors in
+// dither_row() (the cache has 2^kMixCacheBits entries)
+static constexpr int kMixCacheBits = 8;
+static constexpr int kMixCacheSize = (1 << kMixCacheBits);
+
+// Dithers a row of pixels using the given function to get the
+// OrderedDitherMix of each color. The mix of each color is
+// calculated only once (or a few times if there are collisions in
+// the cache), then the dithering matrix thresholds are applied to
+// several pixels at the same time.
+template<typename MixColor>
+static void dither_row(const DitheringMatrix& matrix,
+                       const doc::color_t* src,
+                       uint8_t* dst,
+                       const int w, const int y,
+                       MixColor mixColor)
+{
+  if (w <= 0)
+    return;
+
+  // All entries start with the first color of the row (so we don't
+  // need an extra flag for unused entries)
+  struct CacheEntry {
+    doc::color_t color;
+    OrderedDitherMix mix;
+  };
+  CacheEntry cache[kMixCacheSize];
+  std::fill(cache, cache+kMixCacheSize, CacheEntry{ src[0], mixColor(src[0]) });
+
+  const int cols = matrix.cols();
+  int j = 0;
+
+  for (int x=0; x<w; x+=kPixelsPerStep) {
+    const int n = std::min(kPixelsPerStep, w-x);
+
+    alignas(16) int32_t index0[kPixelsPerStep];
+    alignas(16) int32_t index1[kPixelsPerStep];
+    alignas(16) int32_t level[kPixelsPerStep];
+    alignas(16) int32_t threshold[kPixelsPerStep];
+
+    for (int k=0; k<n; ++k) {
+      const doc::color_t color = src[x+k];
+      CacheEntry& entry = cache[(color * 2654435761u) >> (32-kMixCacheBits)];
+      if (entry.color != color) {
+        entry.color = color;
+        entry.mix = mixColor(color);
+      }
+      index0[k] = entry.mix.index0;
+      index1[k] = entry.mix.index1;
+      level[k] = entry.mix.level;
+      threshold[k] = matrix(y, j);
+      if (++j == cols)
+        j = 0;
+    }
+
+#if RENDER_DITHER_SSE2
+    if (n == kPixelsPerStep) {
+      __m128i result[4];
+      for (int k=0; k<4; ++k) {
+        const __m128i i0 = _mm_load_si128((const __m128i*)(index0+4*k));
+        const __m128i i1 = _mm_load_si128((const __m128i*)(index1+4*k));
+        const __m128i useIndex1 = _mm_cmplt_epi32(
+          _mm_load_si128((const __m128i*)(threshold+4*k)),
+          _mm_load_si128((const __m128i*)(level+4*k)));
+        result[k] = _mm_or_si128(_mm_and_si128(useIndex1, i1),
+                                 _mm_andnot_si128(useIndex1, i0));
+      }
+      // Indexes are in the [0,255] range, so they can be packed
+      // without saturation
+      _mm_storeu_si128((__m128i*)(dst+x),
+                       _mm_packus_epi16(_mm_packs_epi32(result[0], result[1]),
+                                        _mm_packs_epi32(result[2], result[3])));
+      continue;
+    }
+#endif
+
+    for (int k=0; k<n; ++k)
+      dst[x+k] = (threshold[k] < level[k] ? index1[k]: index0[k]);
+  }
+}
+
+void DitheringAlgorithmBase::ditherRgbRowToIndex(
+  const DitheringMatrix& matrix,
+  const doc::color_t* src,
+  uint8_t* dst,
+  const int w, const int y,
+  const doc::RgbMap* rgbmap,
+  const doc::Palette* palette)
+{
+  for (int x=0; x<w; ++x)
+    dst[x] = ditherRgbPixelToIndex(matrix, src[x], x, y, rgbmap, palette);
+}
+
+void DitheringAlgorithmBase::ditherRgbRowToIndex2D(
+  const int x0, const int x1, const int y,
+  uint8_t* dst,
+  const doc::RgbMap* rgbmap,
+  const doc::Palette* palette)
+{
+  for (int x=x0; x<x1; ++x)
+    dst[x] = ditherRgbToIndex2D(x, y, rgbmap, palette);
+}
+
 OrderedDither::OrderedDither(int transparentIndex)
   : m_transparentIndex(transparentIndex)
 {
@@ -53,11 +177,35 @@ doc::color_t OrderedDither::ditherRgbPixelToIndex(
   const int y,
   const doc::RgbMap* rgbmap,
   const doc::Palette* palette)
+{
+  const OrderedDitherMix mix = mixColor(matrix, color, rgbmap, palette);
+  return (matrix(y, x) < mix.level ? mix.index1: mix.index0);
+}
+
+void OrderedDither::ditherRgbRowToIndex(
+  const DitheringMatrix& matrix,
+  const doc::color_t* src,
+  uint8_t* dst,
+  const int w, const int y,
+  const doc::RgbMap* rgbmap,
+  const doc::Palette* palette)
+{
+  dither_row(matrix, src, dst, w, y,
+             [&](const doc::color_t color){
+               return mixColor(matrix, color, rgbmap, palette);
+             });
+}
+
+OrderedDitherMix OrderedDither::mixColor(
+  const DitheringMatrix& matrix,
+  const doc::color_t color,
+  const doc::RgbMap* rgbmap,
+  const doc::Palette* palette) const
 {
   // Alpha=0, output transparent color
   if (m_transparentIndex >= 0 &&
       doc::rgba_geta(color) == 0)
-    return m_transparentIndex;
+    return { m_transparentIndex, m_transparentIndex, 0 };
 
   // Get the nearest color in the palette with the given RGB
   // values.
@@ -94,7 +242,7 @@ doc::color_t OrderedDither::ditherRgbPixelToIndex(
   // If both possible RGB colors use the same index, we cannot
   // make any dither with these two colors.
   if (nearest1idx == nearest2idx)
-    return nearest1idx;
+    return { int(nearest1idx), int(nearest1idx), 0 };
 
   doc::color_t nearest2rgb = palette->getEntry(nearest2idx);
   r2 = doc::rgba_getr(nearest2rgb);
@@ -108,16 +256,13 @@ doc::color_t OrderedDither::ditherRgbPixelToIndex(
   int d = colorDistance(r1, g1, b1, a1, r, g, b, a);
   int D = colorDistance(r1, g1, b1, a1, r2, g2, b2, a2);
   if (D == 0)
-    return nearest1idx;
+    return { int(nearest1idx), int(nearest1idx), 0 };
 
   // We convert the d/D factor to the matrix range to compare it
   // with the threshold. If d > threshold, it means that we're
   // closer to 'nearest2rgb' than to 'nearest1rgb'.
   d = matrix.maxValue() * d / D;
-  int threshold = matrix(y, x);
-
-  return (d > threshold ? nearest2idx:
-                          nearest1idx);
+  return { int(nearest1idx), int(nearest2idx), d };
 }
 
 OrderedDither2::OrderedDither2(int transparentIndex)
@@ -142,11 +287,37 @@ doc::color_t OrderedDither2::ditherRgbPixelToIndex(
   const int y,
   const doc::RgbMap* rgbmap,
   const doc::Palette* palette)
+{
+  // Using the bestMix factor the dithering matrix tells us if we
+  // should paint with altIndex or index in this x,y position.
+  const OrderedDitherMix mix = mixColor(matrix, color, rgbmap, palette);
+  return (matrix(y, x) < mix.level ? mix.index1: mix.index0);
+}
+
+void OrderedDither2::ditherRgbRowToIndex(
+  const DitheringMatrix& matrix,
+  const doc::color_t* src,
+  uint8_t* dst,
+  const int w, const int y,
+  const doc::RgbMap* rgbmap,
+  const doc::Palette* palette)
+{
+  dither_row(matrix, src, dst, w, y,
+             [&](const doc::color_t color){
+               return mixColor(matrix, color, rgbmap, palette);
+             });
+}
+
+OrderedDitherMix OrderedDither2::mixColor(
+  const DitheringMatrix& matrix,
+  const doc::color_t color,
+  const doc::RgbMap* rgbmap,
+  const doc::Palette* palette) const
 {
   // Alpha=0, output transparent color
   if (m_transparentIndex >= 0 &&
       doc::rgba_geta(color) == 0) {
-    return m_transparentIndex;
+    return { m_transparentIndex, m_transparentIndex, 0 };
   }
 
   // Get RGBA values
@@ -220,12 +391,22 @@ doc::color_t OrderedDither2::ditherRgbPixelToIndex(
     }
   }
 
-  // Using the bestMix factor the dithering matrix tells us if we
-  // should paint with altIndex or index in this x,y position.
-  if (altIndex >= 0 && matrix(y, x) < bestMix)
-    return altIndex;
+  if (altIndex >= 0)
+    return { index, altIndex, bestMix };
   else
-    return index;
+    return { index, index, 0 };
+}
+
+// Number of threads to dither a 2D algorithm without zigZag() with
+// wavefront parallelism.
+static int wavefront_threads(const DitheringAlgorithmBase& algorithm,
+                             const int w, const int h, int threads)
+{
+  if (threads <= 0)
+    threads = std::max<int>(1, std::thread::hardware_concurrency());
+  threads = std::min(threads, algorithm.maxParallelRows());
+  threads = std::min(threads, std::max(1, w*h / kMinPixelsPerThread));
+  return std::min(threads, h);
 }
 
 void dither_rgb_image_to_indexed(
@@ -235,7 +416,8 @@ void dither_rgb_image_to_indexed(
   doc::Image* dstImage,
   const doc::RgbMap* rgbmap,
   const doc::Palette* palette,
-  TaskDelegate* delegate)
+  TaskDelegate* delegate,
+  int threads)
 {
   const int w = srcImage->width();
   const int h = srcImage->height();
@@ -243,29 +425,124 @@ void dither_rgb_image_to_indexed(
   algorithm.start(srcImage, dstImage, dithering.factor());
 
   if (algorithm.dimensions() == 1) {
-    const doc::LockImageBits<doc::RgbTraits> srcBits(srcImage);
-    doc::LockImageBits<doc::IndexedTraits> dstBits(dstImage);
-    auto srcIt = srcBits.begin();
-    auto dstIt = dstBits.begin();
+    // 1D algorithms don't have dependencies between pixels, so the
+    // image is dithered in bands of rows in parallel (the error
+    // diffusion is always processed in one thread to get the same
+    // result each time).
+    if (threads <= 0)
+      threads = std::max<int>(1, std::thread::hardware_concurrency());
+    threads = std::min(threads, std::max(1, w*h / kMinPixelsPerThread));
+    threads = std::min(threads, (h+kRowsPerBand-1) / kRowsPerBand);
+
+    // Calculate all RgbMap entries, so the map isn't modified from
+    // several threads.
+    if (threads > 1 && rgbmap)
+      rgbmap->generatePendingEntries();
+
+    const DitheringMatrix matrix = dithering.matrix();
+    std::atomic<int> nextRow(0);
+    std::atomic<int> doneRows(0);
+    std::atomic<bool> stop(false);
+
+    // Only the current thread uses the delegate
+    auto ditherRows = [&](TaskDelegate* progress) {
+      int y;
+      while (!stop && (y = (nextRow += kRowsPerBand) - kRowsPerBand) < h) {
+        const int yend = std::min(y+kRowsPerBand, h);
+        for (int v=y; v<yend; ++v) {
+          algorithm.ditherRgbRowToIndex(
+            matrix,
+            doc::get_pixel_address_fast<doc::RgbTraits>(srcImage, 0, v),
+            doc::get_pixel_address_fast<doc::IndexedTraits>(dstImage, 0, v),
+            w, v, rgbmap, palette);
+        }
+        doneRows += yend-y;
 
-    for (int y=0; y<h; ++y) {
-      for (int x=0; x<w; ++x, ++srcIt, ++dstIt) {
-        ASSERT(srcIt != srcBits.end());
-        ASSERT(dstIt != dstBits.end());
-        *dstIt = algorithm.ditherRgbPixelToIndex(
-          dithering.matrix(), *srcIt, x, y, rgbmap, palette);
-
-        if (delegate) {
-          if (!delegate->continueTask())
-            return;
+        if (progress) {
+          if (!progress->continueTask()) {
+            stop = true;
+            break;
+          }
+          progress->notifyTaskProgress(
+            double(doneRows) / double(h));
         }
       }
+    };
 
-      if (delegate) {
-        delegate->notifyTaskProgress(
-          double(y+1) / double(h));
+    std::vector<std::thread> workers;
+    for (int i=1; i<threads; ++i)
+      workers.emplace_back(ditherRows, nullptr);
+    ditherRows(delegate);
+    for (std::thread& worker : workers)
+      worker.join();
+
+    if (stop)
+      return;
+  }
+  else if (!algorithm.zigZag() &&
+           (threads = wavefront_threads(algorithm, w, h, threads)) > 1) {
+    // Each thread dithers a row, which can advance only when the
+    // previous row is wavefrontLag() pixels ahead. As each pixel
+    // receives the error from the same pixels (and in the same
+    // order), the result is the same as dithering in one thread.
+    if (rgbmap)
+      rgbmap->generatePendingEntries();
+
+    const int lag = algorithm.wavefrontLag();
+    std::vector<std::atomic<int>> progress(h); // Dithered pixels of each row
+    for (auto& p : progress)
+      p = 0;
+    std::atomic<int> nextRow(0);
+    std::atomic<int> doneRows(0);
+    std::atomic<bool> stop(false);
+
+    // Only the current thread uses the delegate
+    auto ditherRows = [&](TaskDelegate* progressDelegate) {
+      int y;
+      while (!stop && (y = nextRow++) < h) {
+        uint8_t* dst = doc::get_pixel_address_fast<doc::IndexedTraits>(dstImage, 0, y);
+        for (int x=0; x<w; ) {
+          int x1 = std::min(x+kPixelsPerWavefrontStep, w);
+          if (y > 0) {
+            int limit;
+            while (true) {
+              const int prev = progress[y-1].load(std::memory_order_acquire);
+              limit = (prev == w ? w: prev-lag);
+              if (limit > x)
+                break;
+              if (stop)
+                return;
+              std::this_thread::yield();
+            }
+            x1 = std::min(x1, limit);
+          }
+
+          algorithm.ditherRgbRowToIndex2D(x, x1, y, dst, rgbmap, palette);
+          x = x1;
+          progress[y].store(x, std::memory_order_release);
+
+          if (progressDelegate && !progressDelegate->continueTask()) {
+            stop = true;
+            return;
+          }
+        }
+        ++doneRows;
+
+        if (progressDelegate)
+          progressDelegate->notifyTaskProgress(
+            double(doneRows) / double(h));
       }
-    }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i=1; i<threads; ++i)
+      workers.emplace_back(ditherRows, nullptr);
+    ditherRows(delegate);
+    for (std::thread& worker : workers)
+      worker.join();
+
+    if (stop)
+      return;
   }
   else {
     auto dstIt = doc::get_pixel_address_fast<doc::IndexedTraits>(dstImage, 0, 0);
@@ -1,5 +1,5 @@
 // Aseprite Render Library
-// Copyright (c) 2019 Igara Studio S.A.
+// Copyright (c) 2019-2022 Igara Studio S.A.
 // Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -26,6 +26,8 @@ namespace render {
   public:
     virtual ~DitheringAlgorithmBase() { }
 
+    // 1D algorithms must not modify its state in
+    // ditherRgbPixelToIndex(), it's called from several threads.
     virtual int dimensions() const { return 1; }
     virtual bool zigZag() const { return false; }
 
@@ -43,10 +45,50 @@ namespace render {
       const doc::RgbMap* rgbmap,
       const doc::Palette* palette) { return 0; }
 
+    // Dithers the "w" pixels of the row "y" of the image (used only
+    // by 1D algorithms). The default implementation calls
+    // ditherRgbPixelToIndex() for each pixel.
+    virtual void ditherRgbRowToIndex(
+      const DitheringMatrix& matrix,
+      const doc::color_t* src,
+      uint8_t* dst,
+      const int w, const int y,
+      const doc::RgbMap* rgbmap,
+      const doc::Palette* palette);
+
     virtual doc::color_t ditherRgbToIndex2D(
       const int x, const int y,
       const doc::RgbMap* rgbmap,
       const doc::Palette* palette) { return 0; }
+
+    // 2D algorithms without zigZag() can dither several rows at the
+    // same time (a wavefront): the pixels [0, x) of the row "y" can
+    // be dithered when the first x+wavefrontLag() pixels of the row
+    // y-1 are already dithered. maxParallelRows() is the max number
+    // of rows that can be dithered at the same time.
+    virtual int maxParallelRows() const { return 1; }
+    virtual int wavefrontLag() const { return 0; }
+
+    // Dithers the pixels [x0, x1) of the row "y" (used only by 2D
+    // algorithms without zigZag(), "dst" is the first pixel of the
+    // row). It's called from several threads (one for each row). The
+    // default implementation calls ditherRgbToIndex2D() for each
+    // pixel.
+    virtual void ditherRgbRowToIndex2D(
+      const int x0, const int x1, const int y,
+      uint8_t* dst,
+      const doc::RgbMap* rgbmap,
+      const doc::Palette* palette);
+  };
+
+  // Result of the ordered dithering for one specific color (it
+  // doesn't depend on the pixel position): "index1" is used where
+  // the dithering matrix value is less than "level", and "index0"
+  // in the rest of positions.
+  struct OrderedDitherMix {
+    int index0;
+    int index1;
+    int level;
   };
 
   class OrderedDither : public DitheringAlgorithmBase {
@@ -59,7 +101,20 @@ namespace render {
       const int y,
       const doc::RgbMap* rgbmap,
       const doc::Palette* palette) override;
+    void ditherRgbRowToIndex(
+      const DitheringMatrix& matrix,
+      const doc::color_t* src,
+      uint8_t* dst,
+      const int w, const int y,
+      const doc::RgbMap* rgbmap,
+      const doc::Palette* palette) override;
   private:
+    OrderedDitherMix mixColor(
+      const DitheringMatrix& matrix,
+      const doc::color_t color,
+      const doc::RgbMap* rgbmap,
+      const doc::Palette* palette) const;
+
     int m_transparentIndex;
   };
 
@@ -73,7 +128,20 @@ namespace render {
       const int y,
       const doc::RgbMap* rgbmap,
       const doc::Palette* palette) override;
+    void ditherRgbRowToIndex(
+      const DitheringMatrix& matrix,
+      const doc::color_t* src,
+      uint8_t* dst,
+      const int w, const int y,
+      const doc::RgbMap* rgbmap,
+      const doc::Palette* palette) override;
   private:
+    OrderedDitherMix mixColor(
+      const DitheringMatrix& matrix,
+      const doc::color_t color,
+      const doc::RgbMap* rgbmap,
+      const doc::Palette* palette) const;
+
     int m_transparentIndex;
   };
 
@@ -84,7 +152,11 @@ namespace render {
     doc::Image* dstImage,
     const doc::RgbMap* rgbmap,
     const doc::Palette* palette,
-    TaskDelegate* delegate = nullptr);
+    TaskDelegate* delegate = nullptr,
+    // Threads used to dither 1D algorithms (and 2D algorithms that
+    // support wavefront parallelism), 0 uses one thread for each
+    // hardware core.
+    int threads = 0);
 
 } // namespace render
 
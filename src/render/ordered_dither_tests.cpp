@@ -1,5 +1,5 @@
 // Aseprite Render Library
-// Copyright (c) 2019 Igara Studio S.A.
+// Copyright (c) 2019-2022 Igara Studio S.A.
 // Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -11,9 +11,18 @@
 
 #include <gtest/gtest.h>
 
+#include "doc/image_ref.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "render/dithering.h"
 #include "render/dithering_matrix.h"
+#include "render/error_diffusion.h"
 #include "render/ordered_dither.h"
 
+#include <cstdlib>
+#include <vector>
+
 using namespace doc;
 using namespace render;
 
@@ -65,6 +74,313 @@ TEST(BayerMatrix, CheckD8)
       EXPECT_EQ(expected[c++], matrix(i, j));
 }
 
+TEST(OrderedDither, SameResultWithThreads)
+{
+  const int w = 512, h = 512;
+  Palette palette(frame_t(0), 32);
+  for (int i=0; i<palette.size(); ++i)
+    palette.setEntry(i, rgba(std::rand() % 256,
+                             std::rand() % 256,
+                             std::rand() % 256, 255));
+  RgbMap rgbmap;
+  rgbmap.regenerate(&palette, 0);
+
+  ImageRef src(Image::create(IMAGE_RGB, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(src.get(), x, y, rgba(std::rand() % 256,
+                                      std::rand() % 256,
+                                      std::rand() % 256,
+                                      (x+y) % 3 ? 255: 0));
+
+  const Dithering dithering(DitheringAlgorithm::Ordered, BayerMatrix(8));
+  for (int i=0; i<2; ++i) {
+    OrderedDither dither1(0);
+    OrderedDither2 dither2(0);
+    DitheringAlgorithmBase& dither =
+      (i == 0 ? (DitheringAlgorithmBase&)dither1: dither2);
+
+    ImageRef expected(Image::create(IMAGE_INDEXED, w, h));
+    ImageRef result(Image::create(IMAGE_INDEXED, w, h));
+    dither_rgb_image_to_indexed(dither, dithering, src.get(), expected.get(),
+                                &rgbmap, &palette, nullptr, 1);
+    dither_rgb_image_to_indexed(dither, dithering, src.get(), result.get(),
+                                &rgbmap, &palette, nullptr, 4);
+    EXPECT_EQ(0, count_diff_between_images(expected.get(), result.get()));
+  }
+}
+
+// Simple LCG to generate the same test images on all platforms
+static int next_random(uint32_t& seed)
+{
+  seed = seed*1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+static uint32_t hash_image(const Image* image)
+{
+  uint32_t hash = 2166136261u;  // FNV-1a
+  for (int y=0; y<image->height(); ++y)
+    for (int x=0; x<image->width(); ++x) {
+      hash ^= get_pixel(image, x, y);
+      hash *= 16777619u;
+    }
+  return hash;
+}
+
+// Expected results (golden outputs) were generated with the original
+// pixel-by-pixel implementation of each algorithm.
+TEST(OrderedDither, GoldenOutputSmallImage)
+{
+  const color_t colors[] = {
+    rgba(0, 0, 0, 0), rgba(0, 0, 0, 255), rgba(255, 255, 255, 255),
+    rgba(255, 0, 0, 255), rgba(0, 255, 0, 255), rgba(0, 0, 255, 255),
+    rgba(255, 255, 0, 128), rgba(128, 64, 192, 255) };
+  Palette palette(frame_t(0), 8);
+  for (int i=0; i<8; ++i)
+    palette.setEntry(i, colors[i]);
+
+  const int w = 16, h = 4;
+  ImageRef src(Image::create(IMAGE_RGB, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      const int u = (y == 1 ? x/4: x); // Row with repeated colors
+      put_pixel(src.get(), x, y,
+                rgba((u*37 + y*71) & 255,
+                     (u*113 + y*29) & 255,
+                     (u*7 + y*191) & 255,
+                     (u+y) % 5 ? 255: (u*50) & 255));
+    }
+
+  const int expected[4][w*h] = {
+    // OrderedDither with transparent index = 0
+    { 0, 7, 4, 7, 7, 7, 7, 1, 4, 4, 7, 4, 7, 7, 7, 4,
+      5, 7, 5, 7, 7, 4, 7, 7, 2, 4, 2, 2, 7, 7, 7, 7,
+      7, 2, 7, 6, 4, 7, 2, 7, 7, 7, 7, 5, 4, 4, 7, 2,
+      7, 7, 7, 7, 7, 7, 6, 0, 2, 7, 4, 7, 7, 3, 7, 4 },
+    // OrderedDither2 with transparent index = 0
+    { 0, 7, 2, 7, 4, 7, 2, 1, 4, 4, 4, 2, 7, 2, 7, 4,
+      5, 7, 5, 7, 7, 7, 7, 7, 2, 4, 2, 2, 7, 7, 7, 7,
+      7, 2, 7, 6, 4, 7, 2, 7, 6, 7, 5, 5, 4, 6, 2, 2,
+      7, 2, 7, 7, 7, 7, 2, 6, 2, 7, 4, 7, 7, 3, 7, 4 },
+    // OrderedDither without transparent index
+    { 0, 7, 4, 7, 7, 7, 7, 1, 4, 4, 7, 4, 7, 7, 7, 4,
+      5, 7, 5, 7, 7, 4, 7, 7, 2, 4, 2, 2, 7, 7, 7, 7,
+      7, 2, 7, 6, 4, 7, 2, 7, 7, 7, 7, 5, 4, 2, 7, 2,
+      7, 7, 0, 7, 7, 7, 6, 6, 2, 7, 4, 7, 7, 3, 7, 4 },
+    // OrderedDither2 without transparent index
+    { 0, 7, 2, 7, 4, 7, 2, 1, 4, 4, 4, 2, 7, 2, 7, 4,
+      5, 7, 5, 7, 7, 7, 7, 7, 2, 4, 2, 2, 7, 7, 7, 7,
+      7, 2, 7, 6, 4, 7, 2, 7, 0, 7, 5, 5, 4, 6, 2, 2,
+      7, 2, 0, 7, 7, 7, 2, 0, 2, 7, 4, 7, 7, 3, 7, 4 } };
+
+  const Dithering dithering(DitheringAlgorithm::Ordered, BayerMatrix(4));
+  for (int i=0; i<4; ++i) {
+    const int mask = (i < 2 ? 0: -1);
+    RgbMap rgbmap;
+    rgbmap.regenerate(&palette, mask);
+
+    OrderedDither dither1(mask);
+    OrderedDither2 dither2(mask);
+    DitheringAlgorithmBase& dither =
+      ((i & 1) == 0 ? (DitheringAlgorithmBase&)dither1: dither2);
+
+    ImageRef dst(Image::create(IMAGE_INDEXED, w, h));
+    dither_rgb_image_to_indexed(dither, dithering, src.get(), dst.get(),
+                                &rgbmap, &palette);
+
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x) {
+        SCOPED_TRACE(i);
+        SCOPED_TRACE(x);
+        SCOPED_TRACE(y);
+        EXPECT_EQ(expected[i][y*w+x], get_pixel(dst.get(), x, y));
+      }
+  }
+}
+
+TEST(OrderedDither, GoldenOutputBigImage)
+{
+  uint32_t seed = 1;
+  Palette palette(frame_t(0), 32);
+  for (int i=0; i<palette.size(); ++i) {
+    const int r = next_random(seed) & 255;
+    const int g = next_random(seed) & 255;
+    const int b = next_random(seed) & 255;
+    palette.setEntry(i, rgba(r, g, b, 255));
+  }
+
+  // Image with runs of pixels of the same color
+  const int w = 96, h = 64;
+  ImageRef src(Image::create(IMAGE_RGB, w, h));
+  color_t c = 0;
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      if ((next_random(seed) % 4) == 0) {
+        const int r = next_random(seed) & 255;
+        const int g = next_random(seed) & 255;
+        const int b = next_random(seed) & 255;
+        const int a = (next_random(seed) % 8) ? 255: next_random(seed) & 255;
+        c = rgba(r, g, b, a);
+      }
+      put_pixel(src.get(), x, y, c);
+    }
+
+  struct {
+    int matrixSize;
+    uint32_t hash1, hash2;    // OrderedDither and OrderedDither2
+  } expected[] = {
+    { 2, 0x36308908, 0x98eefe18 },
+    { 4, 0xa1566eaa, 0xbfa10253 },
+    { 8, 0x595c33a2, 0x41d5364d } };
+
+  for (const auto& e : expected) {
+    RgbMap rgbmap;
+    rgbmap.regenerate(&palette, 0);
+
+    const Dithering dithering(DitheringAlgorithm::Ordered, BayerMatrix(e.matrixSize));
+    OrderedDither dither1(0);
+    OrderedDither2 dither2(0);
+    ImageRef dst(Image::create(IMAGE_INDEXED, w, h));
+
+    dither_rgb_image_to_indexed(dither1, dithering, src.get(), dst.get(),
+                                &rgbmap, &palette);
+    EXPECT_EQ(e.hash1, hash_image(dst.get()));
+
+    dither_rgb_image_to_indexed(dither2, dithering, src.get(), dst.get(),
+                                &rgbmap, &palette);
+    EXPECT_EQ(e.hash2, hash_image(dst.get()));
+  }
+}
+
+// The row kernel must give the same result as
+// ditherRgbPixelToIndex() for rows of any width.
+TEST(OrderedDither, RowsMatchPixels)
+{
+  uint32_t seed = 2;
+  Palette palette(frame_t(0), 64);
+  for (int i=0; i<palette.size(); ++i) {
+    const int r = next_random(seed) & 255;
+    const int g = next_random(seed) & 255;
+    const int b = next_random(seed) & 255;
+    const int a = next_random(seed) & 255;
+    palette.setEntry(i, rgba(r, g, b, a));
+  }
+  RgbMap rgbmap;
+  rgbmap.regenerate(&palette, 0);
+
+  const BayerMatrix matrix(8);
+  OrderedDither dither1(0);
+  OrderedDither2 dither2(0);
+
+  for (int w=1; w<70; ++w) {
+    std::vector<color_t> src(w);
+    for (color_t& c : src) {
+      const int r = next_random(seed) & 255;
+      const int g = next_random(seed) & 255;
+      const int b = next_random(seed) & 255;
+      const int a = (next_random(seed) % 4) ? 255: 0;
+      c = rgba(r, g, b, a);
+    }
+
+    for (DitheringAlgorithmBase* dither : { (DitheringAlgorithmBase*)&dither1,
+                                            (DitheringAlgorithmBase*)&dither2 }) {
+      for (int y=0; y<3; ++y) {
+        std::vector<uint8_t> dst(w);
+        dither->ditherRgbRowToIndex(matrix, &src[0], &dst[0], w, y,
+                                    &rgbmap, &palette);
+        for (int x=0; x<w; ++x) {
+          SCOPED_TRACE(w);
+          SCOPED_TRACE(x);
+          EXPECT_EQ(dither->ditherRgbPixelToIndex(matrix, src[x], x, y,
+                                                  &rgbmap, &palette),
+                    dst[x]);
+        }
+      }
+    }
+  }
+}
+
+// Error diffusion without zig-zag is dithered with several threads
+// (wavefront) and must give the same result as one thread.
+TEST(ErrorDiffusion, SameResultWithThreads)
+{
+  const int w = 512, h = 512;
+  Palette palette(frame_t(0), 32);
+  for (int i=0; i<palette.size(); ++i)
+    palette.setEntry(i, rgba(std::rand() % 256,
+                             std::rand() % 256,
+                             std::rand() % 256, 255));
+  RgbMap rgbmap;
+  rgbmap.regenerate(&palette, 0);
+
+  ImageRef src(Image::create(IMAGE_RGB, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(src.get(), x, y, rgba(std::rand() % 256,
+                                      std::rand() % 256,
+                                      std::rand() % 256,
+                                      (x+y) % 3 ? 255: 0));
+
+  const Dithering dithering(DitheringAlgorithm::ErrorDiffusion);
+  ErrorDiffusionDither dither(0, false);
+  ImageRef expected(Image::create(IMAGE_INDEXED, w, h));
+  dither_rgb_image_to_indexed(dither, dithering, src.get(), expected.get(),
+                              &rgbmap, &palette, nullptr, 1);
+  for (int threads : { 2, 3, 8 }) {
+    ImageRef result(Image::create(IMAGE_INDEXED, w, h));
+    dither_rgb_image_to_indexed(dither, dithering, src.get(), result.get(),
+                                &rgbmap, &palette, nullptr, threads);
+    EXPECT_EQ(0, count_diff_between_images(expected.get(), result.get()));
+  }
+}
+
+// Expected results were generated with the original implementation
+// (before the circular buffer of rows).
+TEST(ErrorDiffusion, GoldenOutput)
+{
+  uint32_t seed = 3;
+  Palette palette(frame_t(0), 32);
+  for (int i=0; i<palette.size(); ++i) {
+    const int r = next_random(seed) & 255;
+    const int g = next_random(seed) & 255;
+    const int b = next_random(seed) & 255;
+    palette.setEntry(i, rgba(r, g, b, 255));
+  }
+
+  // Gradient with noise
+  const int w = 96, h = 64;
+  ImageRef src(Image::create(IMAGE_RGB, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      const int r = (x*255/w + next_random(seed) % 16) & 255;
+      const int g = (y*255/h) & 255;
+      const int b = next_random(seed) & 255;
+      const int a = (next_random(seed) % 8) ? 255: 0;
+      put_pixel(src.get(), x, y, rgba(r, g, b, a));
+    }
+
+  struct {
+    double factor;
+    uint32_t hash;
+  } expected[] = {
+    { 1.0, 0x6ab6f401 },
+    { 0.5, 0x7d981aa9 } };
+
+  for (const auto& e : expected) {
+    RgbMap rgbmap;
+    rgbmap.regenerate(&palette, 0);
+
+    const Dithering dithering(DitheringAlgorithm::ErrorDiffusion,
+                              DitheringMatrix(), e.factor);
+    ErrorDiffusionDither dither(0);
+    ImageRef dst(Image::create(IMAGE_INDEXED, w, h));
+    dither_rgb_image_to_indexed(dither, dithering, src.get(), dst.get(),
+                                &rgbmap, &palette);
+    EXPECT_EQ(e.hash, hash_image(dst.get()));
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,44 @@
+// Aseprite Render Library
+// Copyright (c) 2022  Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "render/parallel.h"
+
+#include <thread>
+#include <vector>
+
+namespace render {
+
+static ParallelForFunc g_parallelFor;
+
+void set_parallel_for(const ParallelForFunc& func)
+{
+  g_parallelFor = func;
+}
+
+void parallel_for(const int n, const std::function<void(int)>& func)
+{
+  if (n < 1)
+    return;
+
+  if (g_parallelFor) {
+    g_parallelFor(n, func);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  threads.reserve(n-1);
+  for (int i=1; i<n; ++i)
+    threads.emplace_back(func, i);
+  func(0);                      // Use this thread too
+  for (auto& thread : threads)
+    thread.join();
+}
+
+} // namespace render
@@ -0,0 +1,31 @@
+// Aseprite Render Library
+// Copyright (c) 2022  Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_PARALLEL_H_INCLUDED
+#define RENDER_PARALLEL_H_INCLUDED
+#pragma once
+
+#include <functional>
+
+namespace render {
+
+  // Calls func(i) for each i in [0, n) from several threads, and
+  // returns when all items are processed.
+  using ParallelForFunc =
+    std::function<void(const int n, const std::function<void(int)>& func)>;
+
+  // Replaces the function used by the multi-threaded render
+  // (Render::setThreads()) to run its jobs, e.g. so the app uses its
+  // pool of worker threads. By default (or with an empty function) a
+  // new thread is created for each item (except the first one which
+  // is processed in the calling thread).
+  void set_parallel_for(const ParallelForFunc& func);
+
+  void parallel_for(const int n, const std::function<void(int)>& func);
+
+} // namespace render
+
+#endif
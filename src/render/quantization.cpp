@@ -1,5 +1,5 @@
 // Aseprite Render Library
-// Copyright (c) 2019-2021  Igara Studio S.A.
+// Copyright (c) 2019-2022  Igara Studio S.A.
 // Copyright (c) 2001-2018  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -25,9 +25,11 @@
 #include "render/task_delegate.h"
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
 #include <map>
 #include <memory>
+#include <thread>
 #include <vector>
 
 namespace render {
@@ -35,6 +37,11 @@ namespace render {
 using namespace doc;
 using namespace gfx;
 
+// Max number of threads used to render frames in
+// create_palette_from_sprite() (each thread needs its own histogram
+// of 16MB)
+static constexpr int kMaxPaletteThreads = 4;
+
 Palette* create_palette_from_sprite(
   const Sprite* sprite,
   const frame_t fromFrame,
@@ -42,32 +49,68 @@ Palette* create_palette_from_sprite(
   const bool withAlpha,
   Palette* palette,
   TaskDelegate* delegate,
-  const bool newBlend)
+  const bool newBlend,
+  const QuantizationAlgorithm algorithm)
 {
-  PaletteOptimizer optimizer;
-
   if (!palette)
     palette = new Palette(fromFrame, 256);
 
-  // Add a flat image with the current sprite's frame rendered
-  ImageRef flat_image(Image::create(IMAGE_RGB,
-      sprite->width(), sprite->height()));
+  // Each thread renders a range of consecutive frames and feeds its
+  // own optimizer, then all optimizers are merged in order (so we get
+  // the same palette as feeding one optimizer with all frames).
+  const int nframes = toFrame-fromFrame+1;
+  const int nthreads =
+    std::clamp<int>(std::thread::hardware_concurrency(),
+                    1, std::min(kMaxPaletteThreads, std::max(1, nframes)));
+  std::vector<std::unique_ptr<PaletteOptimizer>> optimizers(nthreads);
+  std::atomic<int> doneFrames(0);
+  std::atomic<bool> stop(false);
+
+  // Only the current thread (i=0) uses the delegate
+  auto feedFrames = [&](const int i) {
+    optimizers[i].reset(new PaletteOptimizer);
+
+    // Add a flat image with the current sprite's frame rendered
+    ImageRef flat_image(Image::create(IMAGE_RGB,
+        sprite->width(), sprite->height()));
+
+    // Feed the optimizer with all rendered frames
+    render::Render render;
+    render.setNewBlend(newBlend);
+    render.setThreads(1);
+
+    const frame_t begin = fromFrame + frame_t(int64_t(nframes) * i / nthreads);
+    const frame_t end = fromFrame + frame_t(int64_t(nframes) * (i+1) / nthreads);
+    for (frame_t frame=begin; frame<end && !stop; ++frame) {
+      render.renderSprite(flat_image.get(), sprite, frame);
+      optimizers[i]->feedWithImage(flat_image.get(), withAlpha);
+      ++doneFrames;
+
+      if (delegate && i == 0) {
+        if (!delegate->continueTask()) {
+          stop = true;
+          break;
+        }
 
-  // Feed the optimizer with all rendered frames
-  render::Render render;
-  render.setNewBlend(newBlend);
-  for (frame_t frame=fromFrame; frame<=toFrame; ++frame) {
-    render.renderSprite(flat_image.get(), sprite, frame);
-    optimizer.feedWithImage(flat_image.get(), withAlpha);
+        delegate->notifyTaskProgress(
+          double(doneFrames) / double(nframes));
+      }
+    }
+  };
 
-    if (delegate) {
-      if (!delegate->continueTask())
-        return nullptr;
+  std::vector<std::thread> threads;
+  for (int i=1; i<nthreads; ++i)
+    threads.emplace_back(feedFrames, i);
+  feedFrames(0);
+  for (std::thread& thread : threads)
+    thread.join();
 
-      delegate->notifyTaskProgress(
-        double(frame-fromFrame+1) / double(toFrame-fromFrame+1));
-    }
-  }
+  if (stop)
+    return nullptr;
+
+  PaletteOptimizer& optimizer = *optimizers[0];
+  for (int i=1; i<nthreads; ++i)
+    optimizer.merge(*optimizers[i]);
 
   // Transparent color is needed if we have transparent layers
   int maskIndex;
@@ -81,7 +124,7 @@ Palette* create_palette_from_sprite(
   }
 
   // Generate an optimized palette
-  optimizer.calculate(palette, maskIndex);
+  optimizer.calculate(palette, maskIndex, algorithm);
 
   return palette;
 }
@@ -96,7 +139,8 @@ Image* convert_pixel_format(
   bool is_background,
   color_t new_mask_color,
   rgba_to_graya_func toGray,
-  TaskDelegate* delegate)
+  TaskDelegate* delegate,
+  const int threads)
 {
   if (!new_image)
     new_image = Image::create(pixelFormat, image->width(), image->height());
@@ -115,13 +159,14 @@ Image* convert_pixel_format(
         dither.reset(new OrderedDither(is_background ? -1: new_mask_color));
         break;
       case DitheringAlgorithm::ErrorDiffusion:
-        dither.reset(new ErrorDiffusionDither(is_background ? -1: new_mask_color));
+        dither.reset(new ErrorDiffusionDither(is_background ? -1: new_mask_color,
+                                              dithering.zigZag()));
         break;
     }
     if (dither)
       dither_rgb_image_to_indexed(
         *dither, dithering,
-        image, new_image, rgbmap, palette, delegate);
+        image, new_image, rgbmap, palette, delegate, threads);
     return new_image;
   }
 
@@ -415,7 +460,15 @@ void PaletteOptimizer::feedWithRgbaColor(color_t color)
   m_histogram.addSamples(color, 1);
 }
 
-void PaletteOptimizer::calculate(Palette* palette, int maskIndex)
+void PaletteOptimizer::merge(const PaletteOptimizer& other)
+{
+  m_histogram.merge(other.m_histogram);
+  if (other.m_withAlpha)
+    m_withAlpha = true;
+}
+
+void PaletteOptimizer::calculate(Palette* palette, int maskIndex,
+                                 const QuantizationAlgorithm algorithm)
 {
   bool addMask;
 
@@ -431,7 +484,7 @@ void PaletteOptimizer::calculate(Palette* palette, int maskIndex)
   // used, in other case the 0 indexed will be the mask color, so it
   // will not be used later in the color conversion (from RGB to
   // Indexed).
-  int usedColors = m_histogram.createOptimizedPalette(palette);
+  int usedColors = m_histogram.createOptimizedPalette(palette, algorithm);
 
   if (addMask) {
     palette->resize(usedColors+1);
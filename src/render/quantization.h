@@ -1,5 +1,5 @@
 // Aseprite Rener Library
-// Copyright (c) 2019-2020  Igara Studio S.A.
+// Copyright (c) 2019-2022  Igara Studio S.A.
 // Copyright (c) 2001-2017  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -12,6 +12,7 @@
 #include "doc/frame.h"
 #include "doc/pixel_format.h"
 #include "render/color_histogram.h"
+#include "render/quantization_algorithm.h"
 
 #include <vector>
 
@@ -30,7 +31,11 @@ namespace render {
   public:
     void feedWithImage(doc::Image* image, bool withAlpha);
     void feedWithRgbaColor(doc::color_t color);
-    void calculate(doc::Palette* palette, int maskIndex);
+    // Adds all the colors fed to "other" (after the colors of this
+    // optimizer).
+    void merge(const PaletteOptimizer& other);
+    void calculate(doc::Palette* palette, int maskIndex,
+                   const QuantizationAlgorithm algorithm = QuantizationAlgorithm::MedianCut);
 
   private:
     render::ColorHistogram<5, 6, 5, 5> m_histogram;
@@ -45,10 +50,13 @@ namespace render {
     const bool withAlpha,
     doc::Palette* newPalette, // Can be NULL to create a new palette
     TaskDelegate* delegate,
-    const bool newBlend);
+    const bool newBlend,
+    const QuantizationAlgorithm algorithm = QuantizationAlgorithm::MedianCut);
 
   // Changes the image pixel format. The dithering method is used only
-  // when you want to convert from RGB to Indexed.
+  // when you want to convert from RGB to Indexed. Ordered dithering
+  // of big images is done with "threads" threads (0 uses one thread
+  // for each hardware core).
   Image* convert_pixel_format(
     const doc::Image* src,
     doc::Image* dst,         // Can be NULL to create a new image
@@ -59,7 +67,8 @@ namespace render {
     bool is_background,
     doc::color_t new_mask_color,
     doc::rgba_to_graya_func toGray = nullptr,
-    TaskDelegate* delegate = nullptr);
+    TaskDelegate* delegate = nullptr,
+    const int threads = 0);
 
 } // namespace render
 
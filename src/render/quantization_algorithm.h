@@ -0,0 +1,22 @@
+// Aseprite Render Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_QUANTIZATION_ALGORITHM_H_INCLUDED
+#define RENDER_QUANTIZATION_ALGORITHM_H_INCLUDED
+#pragma once
+
+namespace render {
+
+  // Algorithms to create an optimized palette from a histogram
+  enum class QuantizationAlgorithm {
+    MedianCut,
+    Octree,
+    OctreeKMeans,               // Octree refined with k-means
+  };
+
+} // namespace render
+
+#endif
@@ -0,0 +1,172 @@
+// Aseprite Render Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "render/quantization.h"
+
+#include "doc/image.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "render/dithering.h"
+#include "render/ordered_dither.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+
+using namespace doc;
+using namespace render;
+
+// Converts a RGB image to indexed and back to RGB, with a new RgbMap
+// in each iteration (so all colors must be searched in the palette).
+static void Bm_RgbToIndexedRoundTrip(benchmark::State& state)
+{
+  const int w = state.range(0);
+  const int h = state.range(0);
+  const int ncolors = state.range(1);
+
+  Palette::initBestfit();
+  Palette palette(frame_t(0), ncolors);
+  std::srand(ncolors);
+  for (int i=0; i<ncolors; ++i)
+    palette.setEntry(i, rgba(std::rand() % 256,
+                             std::rand() % 256,
+                             std::rand() % 256, 255));
+
+  // Noise with all kind of colors (so all RgbMap entries are used)
+  std::unique_ptr<Image> src(Image::create(IMAGE_RGB, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(src.get(), x, y, rgba(std::rand() % 256,
+                                      std::rand() % 256,
+                                      std::rand() % 256, 255));
+
+  std::unique_ptr<Image> indexed(Image::create(IMAGE_INDEXED, w, h));
+  std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, w, h));
+
+  for (auto _ : state) {
+    RgbMap rgbmap;
+    rgbmap.regenerate(&palette, -1);
+
+    convert_pixel_format(src.get(), indexed.get(), IMAGE_INDEXED,
+                         Dithering(), &rgbmap, &palette, true, 0);
+    convert_pixel_format(indexed.get(), dst.get(), IMAGE_RGB,
+                         Dithering(), nullptr, &palette, true, 0);
+  }
+
+  state.SetItemsProcessed(int64_t(state.iterations()) * w * h);
+}
+
+BENCHMARK(Bm_RgbToIndexedRoundTrip)
+  ->Args({ 2048, 16 })
+  ->Args({ 2048, 64 })
+  ->Args({ 2048, 256 })
+  ->Unit(benchmark::kMillisecond);
+
+// Converts a RGB image with runs of pixels of the same color (like
+// pixel art) to indexed using ordered dithering in one thread.
+static void Bm_OrderedDither(benchmark::State& state)
+{
+  const int w = state.range(0);
+  const int h = state.range(0);
+  const int ncolors = state.range(1);
+  const bool newAlgorithm = state.range(2);
+
+  Palette::initBestfit();
+  Palette palette(frame_t(0), ncolors);
+  std::srand(ncolors);
+  for (int i=0; i<ncolors; ++i)
+    palette.setEntry(i, rgba(std::rand() % 256,
+                             std::rand() % 256,
+                             std::rand() % 256, 255));
+  RgbMap rgbmap;
+  rgbmap.regenerate(&palette, -1);
+
+  std::unique_ptr<Image> src(Image::create(IMAGE_RGB, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(src.get(), x, y, rgba((x/8)*16 % 256,
+                                      (y/8)*16 % 256,
+                                      ((x+y)/16)*32 % 256, 255));
+
+  std::unique_ptr<Image> dst(Image::create(IMAGE_INDEXED, w, h));
+  const Dithering dithering(DitheringAlgorithm::Ordered, BayerMatrix(8));
+  OrderedDither dither1(-1);
+  OrderedDither2 dither2(-1);
+
+  for (auto _ : state) {
+    dither_rgb_image_to_indexed(
+      (newAlgorithm ? (DitheringAlgorithmBase&)dither2: dither1),
+      dithering, src.get(), dst.get(), &rgbmap, &palette, nullptr, 1);
+  }
+
+  state.SetItemsProcessed(int64_t(state.iterations()) * w * h);
+}
+
+BENCHMARK(Bm_OrderedDither)
+  ->Args({ 1024, 32, 0 })
+  ->Args({ 1024, 32, 1 })
+  ->Args({ 1024, 256, 0 })
+  ->Args({ 1024, 256, 1 })
+  ->Unit(benchmark::kMillisecond);
+
+// Creates a palette from an image with a gradient using each
+// quantization algorithm.
+static void Bm_PaletteOptimizer(benchmark::State& state)
+{
+  const int w = state.range(0);
+  const int h = state.range(0);
+  const auto algorithm = QuantizationAlgorithm(state.range(1));
+
+  std::unique_ptr<Image> src(Image::create(IMAGE_RGB, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(src.get(), x, y, rgba(255*x/w,
+                                      255*y/h,
+                                      255*(x+y)/(w+h), 255));
+
+  PaletteOptimizer optimizer;
+  optimizer.feedWithImage(src.get(), false);
+
+  Palette palette(frame_t(0), 256);
+  for (auto _ : state) {
+    palette.resize(256);
+    optimizer.calculate(&palette, -1, algorithm);
+  }
+
+  // Mean squared error of the nearest palette entry of some pixels
+  double error = 0.0;
+  int n = 0;
+  for (int y=0; y<h; y+=4)
+    for (int x=0; x<w; x+=4, ++n) {
+      const color_t c = get_pixel(src.get(), x, y);
+      int lowest = std::numeric_limits<int>::max();
+      for (int i=0; i<palette.size(); ++i) {
+        const color_t p = palette.getEntry(i);
+        const int dr = rgba_getr(c) - rgba_getr(p);
+        const int dg = rgba_getg(c) - rgba_getg(p);
+        const int db = rgba_getb(c) - rgba_getb(p);
+        lowest = std::min(lowest, dr*dr + dg*dg + db*db);
+      }
+      error += lowest;
+    }
+  state.counters["mse"] = error / n;
+}
+
+BENCHMARK(Bm_PaletteOptimizer)
+  ->Args({ 1024, int(QuantizationAlgorithm::MedianCut) })
+  ->Args({ 1024, int(QuantizationAlgorithm::Octree) })
+  ->Args({ 1024, int(QuantizationAlgorithm::OctreeKMeans) })
+  ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
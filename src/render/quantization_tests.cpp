@@ -0,0 +1,162 @@
+// Aseprite Render Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image_ref.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "render/octree_quantizer.h"
+#include "render/quantization.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+using namespace doc;
+using namespace render;
+
+static ImageRef make_image(int ncolors)
+{
+  ImageRef image(Image::create(IMAGE_RGB, 64, 64));
+  for (int y=0; y<image->height(); ++y)
+    for (int x=0; x<image->width(); ++x) {
+      const int i = std::rand() % ncolors;
+      put_pixel(image.get(), x, y, rgba((i*37) & 255,
+                                        (i*91) & 255,
+                                        (i*13) & 255, 255));
+    }
+  return image;
+}
+
+// Merging optimizers fed with different images must give the same
+// palette as feeding one optimizer with all images.
+TEST(PaletteOptimizer, Merge)
+{
+  // Less and more than 256 colors (high precision table and
+  // median cut)
+  for (int ncolors : { 100, 200, 1000 }) {
+    ImageRef a = make_image(ncolors);
+    ImageRef b = make_image(ncolors);
+
+    PaletteOptimizer expectedOptimizer;
+    expectedOptimizer.feedWithImage(a.get(), false);
+    expectedOptimizer.feedWithImage(b.get(), false);
+
+    PaletteOptimizer optimizer, other;
+    optimizer.feedWithImage(a.get(), false);
+    other.feedWithImage(b.get(), false);
+    optimizer.merge(other);
+
+    Palette expected(frame_t(0), 256);
+    Palette result(frame_t(0), 256);
+    expectedOptimizer.calculate(&expected, 0);
+    optimizer.calculate(&result, 0);
+
+    ASSERT_EQ(expected.size(), result.size());
+    for (int i=0; i<expected.size(); ++i)
+      EXPECT_EQ(expected.getEntry(i), result.getEntry(i));
+  }
+}
+
+TEST(OctreeQuantizer, BoundedLeaves)
+{
+  OctreeQuantizer octree(64);
+  for (int i=0; i<10000; ++i) {
+    octree.addColor(rgba(std::rand() % 256, std::rand() % 256,
+                         std::rand() % 256, std::rand() % 256));
+    ASSERT_LE(octree.leaves(), 64);
+  }
+
+  std::vector<color_t> palette;
+  octree.createPalette(16, palette);
+  EXPECT_GE(16, int(palette.size()));
+  EXPECT_LT(0, int(palette.size()));
+}
+
+TEST(OctreeQuantizer, ExactColors)
+{
+  const color_t colors[] = { rgba(0, 0, 0, 255),
+                             rgba(255, 255, 255, 255),
+                             rgba(255, 0, 0, 255),
+                             rgba(0, 0, 255, 128) };
+  OctreeQuantizer octree;
+  for (color_t c : colors)
+    octree.addColor(c, 10);
+
+  std::vector<color_t> palette;
+  octree.createPalette(256, palette);
+  ASSERT_EQ(4, int(palette.size()));
+  for (color_t c : colors)
+    EXPECT_NE(palette.end(), std::find(palette.begin(), palette.end(), c));
+}
+
+// k-means must not increase the error of the octree palette
+TEST(OctreeQuantizer, KMeansRefinement)
+{
+  std::vector<color_t> colors;
+  std::vector<std::size_t> counts;
+  for (int i=0; i<1000; ++i) {
+    colors.push_back(rgba(std::rand() % 256, std::rand() % 256,
+                          std::rand() % 256, 255));
+    counts.push_back(1 + std::rand() % 10);
+  }
+
+  auto error = [&](const std::vector<color_t>& palette) {
+    uint64_t total = 0;
+    for (std::size_t i=0; i<colors.size(); ++i) {
+      int lowest = std::numeric_limits<int>::max();
+      for (color_t p : palette) {
+        const int dr = rgba_getr(p) - rgba_getr(colors[i]);
+        const int dg = rgba_getg(p) - rgba_getg(colors[i]);
+        const int db = rgba_getb(p) - rgba_getb(colors[i]);
+        const int da = rgba_geta(p) - rgba_geta(colors[i]);
+        lowest = std::min(lowest, dr*dr + dg*dg + db*db + da*da);
+      }
+      total += uint64_t(lowest) * counts[i];
+    }
+    return total;
+  };
+
+  OctreeQuantizer octree;
+  for (std::size_t i=0; i<colors.size(); ++i)
+    octree.addColor(colors[i], counts[i]);
+
+  std::vector<color_t> palette;
+  octree.createPalette(32, palette);
+  const uint64_t octreeError = error(palette);
+
+  kmeans_refine_palette(palette, colors, counts);
+  EXPECT_GE(octreeError, error(palette));
+}
+
+TEST(PaletteOptimizer, Algorithms)
+{
+  ImageRef image = make_image(5000);
+  PaletteOptimizer optimizer;
+  optimizer.feedWithImage(image.get(), false);
+
+  for (auto algorithm : { QuantizationAlgorithm::MedianCut,
+                          QuantizationAlgorithm::Octree,
+                          QuantizationAlgorithm::OctreeKMeans }) {
+    Palette palette(frame_t(0), 256);
+    optimizer.calculate(&palette, 0, algorithm);
+    EXPECT_GE(256, palette.size());
+    EXPECT_LT(1, palette.size());
+    EXPECT_EQ(rgba(0, 0, 0, 255), palette.getEntry(0)); // Mask color
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,72 @@
+// Aseprite Render Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_REF_LAYERS_CACHE_H_INCLUDED
+#define RENDER_REF_LAYERS_CACHE_H_INCLUDED
+#pragma once
+
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/object_id.h"
+#include "doc/object_version.h"
+#include "gfx/size.h"
+
+#include <map>
+
+namespace render {
+
+  // Keeps the images of reference layers (usually big photos)
+  // resampled to their size in the current zoomed-out projection
+  // with an area filter, so each repaint composites the already
+  // filtered pixels instead of sampling the full resolution image
+  // again. An image is resampled again only when its projected size
+  // (i.e. the zoom level) or its content change.
+  class RefLayersCache {
+  public:
+    // Max number of reference images to keep in memory
+    static constexpr int kMaxImages = 16;
+
+    // Returns the resampled version of the "src" image with the given
+    // size, or nullptr if it's not in the cache.
+    doc::Image* image(const doc::Image* src, const gfx::Size& size) const {
+      auto it = m_images.find(src->id());
+      if (it != m_images.end() &&
+          it->second.version == src->version() &&
+          it->second.image->size() == size)
+        return it->second.image.get();
+      else
+        return nullptr;
+    }
+
+    void addImage(const doc::Image* src, const doc::ImageRef& image) {
+      if (int(m_images.size()) >= kMaxImages &&
+          m_images.find(src->id()) == m_images.end())
+        m_images.clear();
+
+      Item& item = m_images[src->id()];
+      item.version = src->version();
+      item.image = image;
+    }
+
+    int size() const {
+      return int(m_images.size());
+    }
+
+    void clear() {
+      m_images.clear();
+    }
+
+  private:
+    struct Item {
+      doc::ObjectVersion version = 0;
+      doc::ImageRef image;
+    };
+    std::map<doc::ObjectId, Item> m_images;
+  };
+
+} // namespace render
+
+#endif
@@ -1,5 +1,5 @@
 // Aseprite Render Library
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -12,15 +12,25 @@
 #include "render/render.h"
 
 #include "base/clamp.h"
+#include "doc/blend_funcs.h"
 #include "doc/blend_internals.h"
 #include "doc/blend_mode.h"
 #include "doc/doc.h"
 #include "doc/handle_anidir.h"
 #include "doc/image_impl.h"
+#include "doc/selected_layers.h"
+#include "doc/trace.h"
 #include "gfx/clip.h"
 #include "gfx/region.h"
+#include "render/parallel.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
 
 namespace render {
 
@@ -33,12 +43,16 @@ template<class DstTraits, class SrcTraits>
 class BlenderHelper {
   BlendFunc m_blendFunc;
   color_t m_mask_color;
+  bool m_normal;
 public:
   BlenderHelper(const Image* src, const Palette* pal, BlendMode blendMode, const bool newBlend)
   {
     m_blendFunc = SrcTraits::get_blender(blendMode, newBlend);
     m_mask_color = src->maskColor();
+    m_normal = (blendMode == BlendMode::NORMAL);
   }
+  bool isNormal() const { return m_normal; }
+  color_t maskColor() const { return m_mask_color; }
   inline typename DstTraits::pixel_t
   operator()(const typename DstTraits::pixel_t& dst,
              const typename SrcTraits::pixel_t& src,
@@ -51,16 +65,66 @@ public:
   }
 };
 
+template<>
+class BlenderHelper<RgbTraits, RgbTraits> {
+  BlendFunc m_blendFunc;
+  BlendRowFunc m_blendRowFunc;
+  color_t m_mask_color;
+  bool m_normal;
+public:
+  BlenderHelper(const Image* src, const Palette* pal, BlendMode blendMode, const bool newBlend)
+  {
+    m_blendFunc = RgbTraits::get_blender(blendMode, newBlend);
+    m_blendRowFunc = get_rgba_row_blender(blendMode, newBlend);
+    m_mask_color = src->maskColor();
+    m_normal = (blendMode == BlendMode::NORMAL);
+  }
+  bool isNormal() const { return m_normal; }
+  color_t maskColor() const { return m_mask_color; }
+  inline RgbTraits::pixel_t
+  operator()(const RgbTraits::pixel_t& dst,
+             const RgbTraits::pixel_t& src,
+             const int opacity)
+  {
+    if (src != m_mask_color)
+      return (*m_blendFunc)(dst, src, opacity);
+    else
+      return dst;
+  }
+  // Blends each run of non-mask pixels with only one call to the
+  // row blender.
+  inline void blendRow(RgbTraits::pixel_t* dst,
+                       const RgbTraits::pixel_t* src,
+                       const int n,
+                       const int opacity)
+  {
+    int x = 0;
+    while (x < n) {
+      while (x < n && src[x] == m_mask_color)
+        ++x;
+      const int start = x;
+      while (x < n && src[x] != m_mask_color)
+        ++x;
+      if (x > start)
+        (*m_blendRowFunc)(dst+start, src+start, x-start, opacity);
+    }
+  }
+};
+
 template<>
 class BlenderHelper<RgbTraits, GrayscaleTraits> {
   BlendFunc m_blendFunc;
   color_t m_mask_color;
+  bool m_normal;
 public:
   BlenderHelper(const Image* src, const Palette* pal, BlendMode blendMode, const bool newBlend)
   {
     m_blendFunc = RgbTraits::get_blender(blendMode, newBlend);
     m_mask_color = src->maskColor();
+    m_normal = (blendMode == BlendMode::NORMAL);
   }
+  bool isNormal() const { return m_normal; }
+  color_t maskColor() const { return m_mask_color; }
   inline RgbTraits::pixel_t
   operator()(const RgbTraits::pixel_t& dst,
              const GrayscaleTraits::pixel_t& src,
@@ -89,6 +153,9 @@ public:
     m_mask_color = src->maskColor();
     m_pal = pal;
   }
+  bool isNormal() const { return m_blendMode == BlendMode::NORMAL; }
+  color_t maskColor() const { return m_mask_color; }
+  const Palette* palette() const { return m_pal; }
   inline RgbTraits::pixel_t
   operator()(const RgbTraits::pixel_t& dst,
              const IndexedTraits::pixel_t& src,
@@ -142,6 +209,129 @@ public:
   }
 };
 
+// Blends "n" pixels of "src" into "dst" (dst[i] = blender(dst[i], src[i]))
+template<class DstTraits, class SrcTraits>
+inline void blend_row(BlenderHelper<DstTraits, SrcTraits>& blender,
+                      typename DstTraits::pixel_t* dst,
+                      const typename SrcTraits::pixel_t* src,
+                      int n,
+                      const int opacity)
+{
+  for (; n > 0; --n, ++dst, ++src)
+    *dst = blender(*dst, *src, opacity);
+}
+
+// Specialized rows for the most common compositions: NORMAL blend
+// mode with full opacity (cels/layers with default properties). In
+// this case opaque source pixels just replace the destination pixels
+// (runs of opaque pixels are copied directly), and only the
+// semi-transparent ones must be blended.
+
+inline void blend_row(BlenderHelper<RgbTraits, RgbTraits>& blender,
+                      RgbTraits::pixel_t* dst,
+                      const RgbTraits::pixel_t* src,
+                      const int n,
+                      const int opacity)
+{
+  if (!blender.isNormal() || opacity != 255) {
+    blender.blendRow(dst, src, n, opacity);
+    return;
+  }
+
+  const color_t mask = blender.maskColor();
+  auto isOpaque = [mask](const color_t c) {
+    return (c & rgba_a_mask) == rgba_a_mask && c != mask;
+  };
+
+  int x = 0;
+  while (x < n) {
+    int start = x;
+    while (x < n && isOpaque(src[x]))
+      ++x;
+    if (x > start)
+      std::copy(src+start, src+x, dst+start);
+
+    start = x;
+    while (x < n && !isOpaque(src[x]))
+      ++x;
+    if (x > start)
+      blender.blendRow(dst+start, src+start, x-start, 255);
+  }
+}
+
+inline void blend_row(BlenderHelper<RgbTraits, IndexedTraits>& blender,
+                      RgbTraits::pixel_t* dst,
+                      const IndexedTraits::pixel_t* src,
+                      int n,
+                      const int opacity)
+{
+  if (!blender.isNormal() || opacity != 255) {
+    for (; n > 0; --n, ++dst, ++src)
+      *dst = blender(*dst, *src, opacity);
+    return;
+  }
+
+  const color_t mask = blender.maskColor();
+  const Palette* pal = blender.palette();
+  for (; n > 0; --n, ++dst, ++src) {
+    if (*src == mask)
+      continue;
+    const color_t c = pal->getEntry(*src);
+    if ((c & rgba_a_mask) == rgba_a_mask)
+      *dst = c;
+    else
+      *dst = rgba_blender_normal(*dst, c);
+  }
+}
+
+inline void blend_row(BlenderHelper<RgbTraits, GrayscaleTraits>& blender,
+                      RgbTraits::pixel_t* dst,
+                      const GrayscaleTraits::pixel_t* src,
+                      int n,
+                      const int opacity)
+{
+  if (!blender.isNormal() || opacity != 255) {
+    for (; n > 0; --n, ++dst, ++src)
+      *dst = blender(*dst, *src, opacity);
+    return;
+  }
+
+  const color_t mask = blender.maskColor();
+  for (; n > 0; --n, ++dst, ++src) {
+    if (*src == mask)
+      continue;
+    const int v = graya_getv(*src);
+    const int a = graya_geta(*src);
+    if (a == 255)
+      *dst = rgba(v, v, v, 255);
+    else
+      *dst = rgba_blender_normal(*dst, rgba(v, v, v, a));
+  }
+}
+
+inline void blend_row(BlenderHelper<GrayscaleTraits, GrayscaleTraits>& blender,
+                      GrayscaleTraits::pixel_t* dst,
+                      const GrayscaleTraits::pixel_t* src,
+                      int n,
+                      const int opacity)
+{
+  if (!blender.isNormal() || opacity != 255) {
+    for (; n > 0; --n, ++dst, ++src)
+      *dst = blender(*dst, *src, opacity);
+    return;
+  }
+
+  const color_t mask = blender.maskColor();
+  for (; n > 0; --n, ++dst, ++src) {
+    if (*src == mask)
+      continue;
+    if (graya_geta(*src) == 255)
+      *dst = *src;
+    else
+      *dst = graya_blender_normal(*dst, *src, 255);
+  }
+}
+
 template<class DstTraits, class SrcTraits>
 void composite_image_without_scale(
   Image* dst, const Image* src, const Palette* pal,
@@ -164,37 +354,20 @@ void composite_image_without_scale(
                  src->width(), src->height()))
     return;
 
-  gfx::Rect srcBounds = area.srcBounds();
-  gfx::Rect dstBounds = area.dstBounds();
-  int bottom = dstBounds.y2()-1;
+  const gfx::Rect srcBounds = area.srcBounds();
+  const gfx::Rect dstBounds = area.dstBounds();
+  const int h = std::min(srcBounds.h, dstBounds.h);
 
   ASSERT(!srcBounds.isEmpty());
-
-  // Lock all necessary bits
-  const LockImageBits<SrcTraits> srcBits(src, srcBounds);
-  LockImageBits<DstTraits> dstBits(dst, dstBounds);
-  typename LockImageBits<SrcTraits>::const_iterator src_it = srcBits.begin();
-#ifdef _DEBUG
-  typename LockImageBits<SrcTraits>::const_iterator src_end = srcBits.end();
-#endif
-  typename LockImageBits<DstTraits>::iterator dst_it, dst_end;
+  ASSERT(srcBounds.w == dstBounds.w);
 
   // For each line to draw of the source image...
-  dstBounds.h = 1;
-  for (int y=0; y<srcBounds.h; ++y) {
-    dst_it = dstBits.begin_area(dstBounds);
-    dst_end = dstBits.end_area(dstBounds);
-
-    for (int x=0; x<srcBounds.w; ++x) {
-      ASSERT(src_it >= srcBits.begin() && src_it < src_end);
-      ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
-      *dst_it = blender(*dst_it, *src_it, opacity);
-      ++src_it;
-      ++dst_it;
-    }
-
-    if (++dstBounds.y > bottom)
-      break;
+  for (int y=0; y<h; ++y) {
+    blend_row(
+      blender,
+      get_pixel_address_fast<DstTraits>(dst, dstBounds.x, dstBounds.y+y),
+      get_pixel_address_fast<SrcTraits>(src, srcBounds.x, srcBounds.y+y),
+      srcBounds.w, opacity);
   }
 }
 
@@ -240,50 +413,31 @@ void composite_image_scale_up(
   int bottom = dstBounds.y2()-1;
   int line_h;
 
-  // the scanline variable is used to blend src/dst pixels one time for each pixel
+  // The scanline variable is used to blend src/dst pixels one time
+  // for each pixel: it's filled with the "dst" pixels that will be
+  // blended with each "src" pixel, and then blended in-place with
+  // the whole "src" row.
   typedef std::vector<typename DstTraits::pixel_t> Scanline;
   Scanline scanline(srcBounds.w);
-  typename Scanline::iterator scanline_it;
-#ifdef _DEBUG
-  typename Scanline::iterator scanline_end = scanline.end();
-#endif
 
-  // Lock all necessary bits
-  const LockImageBits<SrcTraits> srcBits(src, srcBounds);
-  LockImageBits<DstTraits> dstBits(dst, dstBounds);
-  typename LockImageBits<SrcTraits>::const_iterator src_it = srcBits.begin();
-#ifdef _DEBUG
-  typename LockImageBits<SrcTraits>::const_iterator src_end = srcBits.end();
-#endif
-  typename LockImageBits<DstTraits>::iterator dst_it, dst_end;
+  // X position (relative to dstBounds.x) of the first "dst" pixel
+  // of each "src" pixel.
+  std::vector<int> dstCols(srcBounds.w);
+  for (int x=0; x<srcBounds.w; ++x)
+    dstCols[x] = std::min(x == 0 ? 0: first_px_w + (x-1)*px_w,
+                          dstBounds.w-1);
 
   // For each line to draw of the source image...
-  dstBounds.h = 1;
   for (int y=0; y<srcBounds.h; ++y) {
-    dst_it = dstBits.begin_area(dstBounds);
-    dst_end = dstBits.end_area(dstBounds);
-
-    // Read 'src' and 'dst' and blend them, put the result in `scanline'
-    scanline_it = scanline.begin();
-    for (int x=0; x<srcBounds.w; ++x) {
-      ASSERT(src_it >= srcBits.begin() && src_it < src_end);
-      ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
-      ASSERT(scanline_it >= scanline.begin() && scanline_it < scanline_end);
-
-      *scanline_it = blender(*dst_it, *src_it, opacity);
-      ++src_it;
-
-      int delta;
-      if (x == 0)
-        delta = first_px_w;
-      else
-        delta = px_w;
+    const auto dstRow =
+      get_pixel_address_fast<DstTraits>(dst, dstBounds.x, dstBounds.y);
+    for (int x=0; x<srcBounds.w; ++x)
+      scanline[x] = dstRow[dstCols[x]];
 
-      while (dst_it != dst_end && delta-- > 0)
-        ++dst_it;
-
-      ++scanline_it;
-    }
+    blend_row(
+      blender, &scanline[0],
+      get_pixel_address_fast<SrcTraits>(src, srcBounds.x, srcBounds.y+y),
+      srcBounds.w, opacity);
 
     // Get the 'height' of the line to be painted in 'dst'
     if ((y == 0) && (first_px_h > 0))
@@ -291,51 +445,31 @@ void composite_image_scale_up(
     else
       line_h = px_h;
 
-    // Draw the line in 'dst'
-    for (px_y=0; px_y<line_h; ++px_y) {
-      dst_it = dstBits.begin_area(dstBounds);
-      dst_end = dstBits.end_area(dstBounds);
-      scanline_it = scanline.begin();
-
-      int x = 0;
-
-      // first pixel
-      for (px_x=0; px_x<first_px_w; ++px_x) {
-        ASSERT(scanline_it != scanline_end);
-        ASSERT(dst_it != dst_end);
-
-        *dst_it = *scanline_it;
-
-        ++dst_it;
-        if (dst_it == dst_end)
-          goto done_with_line;
+    // Draw the first line in 'dst' replicating each pixel 'px_w' times
+    const auto firstRow = get_pixel_address_fast<DstTraits>(dst, dstBounds.x, dstBounds.y);
+    {
+      auto dstPtr = firstRow;
+      int remaining = dstBounds.w;
+
+      for (int x=0; x<srcBounds.w && remaining > 0; ++x) {
+        px_x = std::min(x == 0 ? first_px_w: px_w, remaining);
+        std::fill_n(dstPtr, px_x, scanline[x]);
+        dstPtr += px_x;
+        remaining -= px_x;
       }
+    }
+    if (++dstBounds.y > bottom)
+      return;
 
-      ++scanline_it;
-      ++x;
-
-      // the rest of the line
-      for (; x<srcBounds.w; ++x) {
-        for (px_x=0; px_x<px_w; ++px_x) {
-          ASSERT(dst_it !=  dst_end);
-
-          *dst_it = *scanline_it;
-
-          ++dst_it;
-          if (dst_it == dst_end)
-            goto done_with_line;
-        }
-
-        ++scanline_it;
-      }
+    // The other 'line_h-1' lines are just a copy of the first one
+    for (px_y=1; px_y<line_h; ++px_y) {
+      std::copy(firstRow, firstRow+dstBounds.w,
+                get_pixel_address_fast<DstTraits>(dst, dstBounds.x, dstBounds.y));
 
-done_with_line:;
       if (++dstBounds.y > bottom)
-        goto done_with_blit;
+        return;
     }
   }
-
-done_with_blit:;
 }
 
 template<class DstTraits, class SrcTraits>
@@ -373,36 +507,26 @@ void composite_image_scale_down(
   if (srcBounds.isEmpty())
     return;
 
-  gfx::Rect dstBounds = area.dstBounds();
-
-  // Lock all necessary bits
-  const LockImageBits<SrcTraits> srcBits(src, srcBounds);
-  LockImageBits<DstTraits> dstBits(dst, dstBounds);
-  auto src_it = srcBits.begin();
-  auto dst_it = dstBits.begin();
-#ifdef _DEBUG
-  auto src_end = srcBits.end();
-  auto dst_end = dstBits.end();
-#endif
+  const gfx::Rect dstBounds = area.dstBounds();
 
-  // Adjust to src_it for each line
-  int adjust_per_line = (dstBounds.w*step_w)*(step_h-1);
+  // Skipped source pixels (one of each step_w) of the row to blend
+  typedef std::vector<typename SrcTraits::pixel_t> Scanline;
+  Scanline scanline(dstBounds.w);
 
   // For each line to draw of the source image...
   for (int y=0; y<dstBounds.h; ++y) {
-    for (int x=0; x<dstBounds.w; ++x) {
-      ASSERT(src_it >= srcBits.begin() && src_it < src_end);
-      ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
-
-      *dst_it = blender(*dst_it, *src_it, opacity);
+    const int srcY = srcBounds.y + y*step_h;
+    ASSERT(srcY >= 0 && srcY < src->height());
 
-      // Skip columns
-      src_it += step_w;
-      ++dst_it;
-    }
+    // Skip columns
+    const auto srcRow = get_pixel_address_fast<SrcTraits>(src, srcBounds.x, srcY);
+    for (int x=0; x<dstBounds.w; ++x)
+      scanline[x] = srcRow[x*step_w];
 
-    // Skip rows
-    src_it += adjust_per_line;
+    blend_row(
+      blender,
+      get_pixel_address_fast<DstTraits>(dst, dstBounds.x, dstBounds.y+y),
+      &scanline[0], dstBounds.w, opacity);
   }
 }
 
@@ -503,26 +627,162 @@ CompositeImageFunc get_fastest_composition_path(const Projection& proj,
   }
 }
 
-bool has_visible_reference_layers(const LayerGroup* group)
+// Returns true if the fastest composition path for the given
+// projection renders each pixel in the same way independently of the
+// area origin (composite_image_general() accumulates the source
+// position with floating point arithmetic, so rendering the same
+// pixel from different areas can give different results).
+bool is_tileable_projection(const Projection& proj)
+{
+  if (!proj.zoom().isSimpleZoomLevel())
+    return false;
+  else if (proj.scaleX() >= 1.0 && proj.scaleY() >= 1.0)
+    return true;
+  else
+    return !(((proj.removeX(1) > 1) && (proj.removeX(1) & 1)) ||
+             ((proj.removeY(1) > 1) && (proj.removeY(1) & 1)));
+}
+
+// Returns the sprite frame displayed as the "frameOut" onion skin
+// frame of the given "frame", or -1 if it must not be displayed.
+frame_t get_onionskin_frame(const Sprite* sprite,
+                            const frame_t frame,
+                            const frame_t frameOut,
+                            const Tag* loop)
+{
+  frame_t frameIn;
+  if (loop) {
+    bool pingPongForward = true;
+    frameIn =
+      calculate_next_frame(sprite,
+                           frame, frameOut - frame,
+                           loop, pingPongForward);
+  }
+  else {
+    frameIn = frameOut;
+  }
+
+  if (frameIn == frame ||
+      frameIn < 0 ||
+      frameIn > sprite->lastFrame()) {
+    return -1;
+  }
+  return frameIn;
+}
+
+// Draws the checked background in the given bounds of the image.
+// (x0, y0) is the position of the first tile in the image (it's
+// the "uv" tile, the color of the upper-left tile depends on the
+// parity of "uv"). Only two different rows are possible in the
+// pattern, so they are created once and then copied in each row.
+template<typename ImageTraits>
+void draw_checked_background(Image* image,
+                             gfx::Rect bounds,
+                             const int x0, const int y0,
+                             const int tile_w, const int tile_h,
+                             const int uv,
+                             const color_t color1,
+                             const color_t color2)
+{
+  bounds &= image->bounds();
+  if (bounds.isEmpty())
+    return;
+
+  ASSERT(bounds.x >= x0);
+  ASSERT(bounds.y >= y0);
+
+  typedef std::vector<typename ImageTraits::pixel_t> Row;
+  Row rows[2] = { Row(bounds.w), Row(bounds.w) };
+  for (int x=0; x<bounds.w; ++x) {
+    const int u = uv + (bounds.x + x - x0) / tile_w;
+    rows[0][x] = ((u  ) & 1 ? color2: color1);
+    rows[1][x] = ((u+1) & 1 ? color2: color1);
+  }
+
+  for (int y=bounds.y; y<bounds.y2(); ++y) {
+    const Row& row = rows[((y - y0) / tile_h) & 1];
+    std::copy(row.begin(), row.end(),
+              get_pixel_address_fast<ImageTraits>(image, bounds.x, y));
+  }
+}
+
+bool is_layer_visible(const Layer* layer,
+                      const SelectedLayers* visibleLayers)
+{
+  // The root group is never in the set of visible layers
+  if (visibleLayers && layer->parent())
+    return visibleLayers->contains(layer);
+  else
+    return layer->isVisible();
+}
+
+bool has_visible_reference_layers(const LayerGroup* group,
+                                  const SelectedLayers* visibleLayers)
 {
   for (const Layer* child : group->layers()) {
-    if (!child->isVisible())
+    if (!is_layer_visible(child, visibleLayers))
       continue;
 
     if (child->isReference())
       return true;
 
     if (child->isGroup() &&
-        has_visible_reference_layers(static_cast<const LayerGroup*>(child)))
+        has_visible_reference_layers(static_cast<const LayerGroup*>(child),
+                                     visibleLayers))
       return true;
   }
   return false;
 }
 
+// Composition for a RGB source image with any scale (used for the
+// filtered images of reference layers, which are composited with a
+// scale near to 1 but not exactly 1).
+CompositeImageFunc get_general_composition_from_rgb(const PixelFormat dstFormat)
+{
+  switch (dstFormat) {
+    case IMAGE_RGB:       return composite_image_general<RgbTraits, RgbTraits>;
+    case IMAGE_GRAYSCALE: return composite_image_general<GrayscaleTraits, RgbTraits>;
+    case IMAGE_INDEXED:   return composite_image_general<IndexedTraits, RgbTraits>;
+  }
+  ASSERT(false && "Invalid pixel format");
+  return composite_image_general<RgbTraits, RgbTraits>;
+}
+
 } // anonymous namespace
 
+// Size of each tile rendered by a thread in renderSpriteTiles() (and
+// of each tile of the LayersCache), 256x256 RGBA pixels = 256KB, so
+// each tile fits in the L2 cache.
+static constexpr int kTileSize = 256;
+
+// Minimum number of pixels composited by each thread in
+// renderImage(), smaller images are not worth the threads overhead.
+static constexpr int kMinPixelsPerThread = 256*256;
+
+// Smallest mip level of the MipmapsCache (1/256 = 0.39%)
+static constexpr int kMaxMipmapsLevel = 8;
+
+// Max number of times that a rendered tile is halved to create a mip
+// level tile (e.g. 2 = each mip pixel is the average of 4x4 pixels)
+static constexpr int kMipmapsSteps = 2;
+
+// Returns the range of tiles (in tile units) that intersect the
+// given rectangle.
+static gfx::Rect tiles_in_rect(const gfx::Rect& rc)
+{
+  auto floor_div = [](const int a) {
+    return (a >= 0 ? a / kTileSize: -((-a + kTileSize - 1) / kTileSize));
+  };
+  const int u1 = floor_div(rc.x);
+  const int v1 = floor_div(rc.y);
+  const int u2 = floor_div(rc.x2() - 1);
+  const int v2 = floor_div(rc.y2() - 1);
+  return gfx::Rect(u1, v1, u2 - u1 + 1, v2 - v1 + 1);
+}
+
 Render::Render()
   : m_flags(0)
+  , m_threads(1)
   , m_nonactiveLayersOpacity(255)
   , m_sprite(nullptr)
   , m_currentLayer(NULL)
@@ -536,10 +796,16 @@ Render::Render()
   , m_globalOpacity(255)
   , m_selectedLayerForOpacity(nullptr)
   , m_selectedLayer(nullptr)
+  , m_visibleLayers(nullptr)
   , m_selectedFrame(-1)
   , m_previewImage(nullptr)
   , m_previewBlendMode(BlendMode::NORMAL)
   , m_onionskin(OnionskinType::NONE)
+  , m_layersCacheState(LayersCacheState::None)
+  , m_fastPreview(false)
+  , m_layersAboveState(LayersAboveState::None)
+  , m_mipmaps(false)
+  , m_filteredRefLayers(false)
 {
 }
 
@@ -561,6 +827,12 @@ void Render::setNewBlend(const bool newBlend)
   m_newBlendMethod = newBlend;
 }
 
+void Render::setThreads(const int threads)
+{
+  ASSERT(threads >= 0);
+  m_threads = threads;
+}
+
 void Render::setProjection(const Projection& projection)
 {
   m_proj = projection;
@@ -596,6 +868,11 @@ void Render::setSelectedLayer(const Layer* layer)
   m_selectedLayerForOpacity = layer;
 }
 
+void Render::setVisibleLayers(const SelectedLayers* layers)
+{
+  m_visibleLayers = layers;
+}
+
 void Render::setPreviewImage(const Layer* layer,
                              const frame_t frame,
                              const Image* image,
@@ -626,6 +903,33 @@ void Render::setExtraImage(
 void Render::removePreviewImage()
 {
   m_previewImage = nullptr;
+
+  // The cached layers are useful only while the preview image is
+  // being modified, so we can free them.
+  m_layersCache.reset();
+  m_layersAboveCache.reset();
+  m_fastPreview = false;
+}
+
+void Render::setFastPreview(const bool state)
+{
+  m_fastPreview = state;
+  if (!state)
+    m_layersAboveCache.reset();
+}
+
+void Render::setMipmaps(const bool state)
+{
+  m_mipmaps = state;
+  if (!state)
+    m_mipmapsCache.reset();
+}
+
+void Render::setFilteredRefLayers(const bool state)
+{
+  m_filteredRefLayers = state;
+  if (!state)
+    m_refLayersCache.reset();
 }
 
 void Render::removeExtraImage()
@@ -692,6 +996,29 @@ void Render::renderSprite(
   frame_t frame,
   const gfx::ClipF& area)
 {
+  DOC_TRACE_ZONE("Render::renderSprite");
+
+  // Using the cached layers below the preview image is better than
+  // rendering all layers in several threads.
+  const bool useLayersCache =
+    prepareLayersCache(dstImage, sprite, frame, area);
+  const bool useLayersAboveCache =
+    prepareLayersAboveCache(dstImage, sprite, frame, area);
+
+  // Zoomed-out projections are copied from the MipmapsCache (which
+  // is filled using several threads too)
+  const int mipLevel = mipmapsLevel(dstImage, sprite, frame, area);
+  const bool useMipmaps =
+    (mipLevel > 0 &&
+     prepareMipmaps(dstImage, sprite, frame, area, mipLevel));
+
+  if (!useLayersCache &&
+      !useLayersAboveCache &&
+      !useMipmaps &&
+      m_threads != 1 &&
+      renderSpriteTiles(dstImage, sprite, frame, area))
+    return;
+
   m_sprite = sprite;
 
   CompositeImageFunc compositeImage =
@@ -707,7 +1034,7 @@ void Render::renderSprite(
     switch (dstImage->pixelFormat()) {
       case IMAGE_RGB:
       case IMAGE_GRAYSCALE:
-        if (bgLayer && bgLayer->isVisible())
+        if (bgLayer && isLayerVisible(bgLayer))
           bg_color = m_sprite->palette(frame)->getEntry(m_sprite->transparentColor());
         break;
       case IMAGE_INDEXED:
@@ -716,15 +1043,26 @@ void Render::renderSprite(
     }
   }
 
+  if (useLayersCache)
+    m_layersCacheState = LayersCacheState::Restoring;
+  if (useLayersAboveCache)
+    m_layersAboveState = LayersAboveState::Restoring;
+
   // New Blending Method:
   if (m_newBlendMethod) {
     // Clear dstImage with the bg_color (if the background is not a
     // special background pattern like the checked background, this is
     // enough as a base color).
-    fill_rect(dstImage, area.dstBounds(), bg_color);
+    if (!useLayersCache)
+      fill_rect(dstImage, area.dstBounds(), bg_color);
 
     // Draw the Background layer - Onion skin behind the sprite - Transparent Layers
-    renderSpriteLayers(dstImage, area, frame, compositeImage);
+    if (useMipmaps)
+      compositeMipmaps(dstImage, gfx::Clip(area), mipLevel);
+    else
+      renderSpriteLayers(dstImage, area, frame, compositeImage);
+    if (m_layersCacheState == LayersCacheState::Captured)
+      return;
 
     // In case that we need a special background (e.g. like the
     // checked pattern), we can draw the background in a temporal
@@ -743,8 +1081,11 @@ void Render::renderSprite(
   }
   // Old Blending Method:
   else {
-    renderBackground(dstImage, bgLayer, bg_color, area);
+    if (!useLayersCache)
+      renderBackground(dstImage, bgLayer, bg_color, area);
     renderSpriteLayers(dstImage, area, frame, compositeImage);
+    if (m_layersCacheState == LayersCacheState::Captured)
+      return;
   }
 
   // Draw onion skin in front of the sprite.
@@ -771,23 +1112,871 @@ void Render::renderSprite(
   }
 }
 
+bool Render::canUseLayersCache(
+  const Image* dstImage,
+  const Sprite* sprite,
+  frame_t frame,
+  const gfx::ClipF& areaF) const
+{
+  // The cache is used only when the preview image is being
+  // modified (i.e. the user drawing in one specific layer).
+  if (!m_previewImage ||
+      !m_selectedLayer ||
+      m_selectedLayer->sprite() != sprite ||
+      m_selectedFrame != frame)
+    return false;
+
+  // Transparent layers only
+  if (!m_selectedLayer->isImage() ||
+      m_selectedLayer->isBackground())
+    return false;
+
+  // The selected layer must be rendered (on the contrary the layers
+  // above it would be skipped too).
+  for (const Layer* layer = m_selectedLayer;
+       layer && layer != sprite->root();
+       layer = layer->parent()) {
+    if (!isLayerVisible(layer) ||
+        (!(m_flags & Flags::ShowRefLayers) && layer->isReference()))
+      return false;
+  }
+
+  // Same restrictions as renderSpriteTiles(): the same pixel in each
+  // tile must be rendered as in the whole area.
+  const gfx::Clip area(areaF);
+  if (gfx::RectF(area.dstBounds()) != areaF.dstBounds() ||
+      gfx::RectF(area.srcBounds()) != areaF.srcBounds() ||
+      area.dst != gfx::Point(0, 0) ||
+      !is_tileable_projection(m_proj))
+    return false;
+
+  const gfx::Rect dstBounds = area.dstBounds().createIntersection(dstImage->bounds());
+  return !dstBounds.isEmpty();
+}
+
+// Everything that can change the pixels of the cached layers (the
+// area is not included because the cache uses tiles in projected
+// sprite coordinates).
+LayersCache::Key Render::createLayersCacheKey(
+  const Image* dstImage,
+  const Sprite* sprite,
+  frame_t frame) const
+{
+  LayersCache::Key key;
+  const Palette* pal = sprite->palette(frame);
+  double sx = m_proj.scaleX();
+  double sy = m_proj.scaleY();
+  uint64_t scaleX, scaleY;
+  static_assert(sizeof(double) == sizeof(uint64_t), "Unexpected double size");
+  std::memcpy(&scaleX, &sx, sizeof(sx));
+  std::memcpy(&scaleY, &sy, sizeof(sy));
+  key = {
+    uint64_t(uintptr_t(sprite)),
+    uint64_t(sprite->pixelFormat()),
+    uint64_t(sprite->transparentColor()),
+    uint64_t(uintptr_t(pal)), pal->version(),
+    uint64_t(frame),
+    uint64_t(dstImage->pixelFormat()),
+    uint64_t(dstImage->maskColor()),
+    scaleX, scaleY,
+    uint64_t(m_flags),
+    uint64_t(m_newBlendMethod),
+    uint64_t(m_bgType),
+    uint64_t(m_bgZoom),
+    uint64_t(m_bgColor1),
+    uint64_t(m_bgColor2),
+    uint64_t(m_bgCheckedSize.w),
+    uint64_t(m_bgCheckedSize.h),
+    uint64_t(m_nonactiveLayersOpacity),
+    uint64_t(uintptr_t(m_selectedLayerForOpacity)),
+    uint64_t(uintptr_t(m_selectedLayer))
+  };
+  return key;
+}
+
+// Returns false if the cache cannot keep all the tiles of the given
+// range, in other case it makes room for the missing tiles.
+static bool make_room_for_tiles(LayersCache* cache, const gfx::Rect& tiles)
+{
+  if (tiles.w*tiles.h > LayersCache::kMaxTiles)
+    return false;
+
+  int missing = 0;
+  for (int v=tiles.y; v<tiles.y2(); ++v)
+    for (int u=tiles.x; u<tiles.x2(); ++u)
+      if (!cache->tile(gfx::Point(u, v)))
+        ++missing;
+  if (cache->size() + missing > LayersCache::kMaxTiles)
+    cache->clearTiles();
+  return true;
+}
+
+bool Render::prepareLayersCache(
+  const Image* dstImage,
+  const Sprite* sprite,
+  frame_t frame,
+  const gfx::ClipF& areaF)
+{
+  // We are rendering a tile for the cache
+  if (m_layersCacheState == LayersCacheState::Capturing ||
+      !canUseLayersCache(dstImage, sprite, frame, areaF))
+    return false;
+
+  // Everything that can change the pixels below the selected layer
+  LayersCache::Key key = createLayersCacheKey(dstImage, sprite, frame);
+  bool found = false;
+  if (!addLayersCacheKey(sprite->root(), frame, m_selectedLayer, key, found) ||
+      !found ||
+      !addOnionskinCacheKey(sprite, frame, key)) {
+    m_layersCache.reset();
+    return false;
+  }
+  if (!m_layersCache)
+    m_layersCache = std::make_shared<LayersCache>();
+  m_layersCache->setKey(std::move(key));
+
+  // Render the missing tiles
+  const gfx::Clip area(areaF);
+  const gfx::Rect dstBounds = area.dstBounds().createIntersection(dstImage->bounds());
+  const gfx::Rect srcBounds(area.src + dstBounds.origin(), dstBounds.size());
+  const gfx::Rect tiles = tiles_in_rect(srcBounds);
+  if (!make_room_for_tiles(m_layersCache.get(), tiles))
+    return false;
+
+  ImageSpec spec = dstImage->spec();
+  spec.setSize(kTileSize, kTileSize);
+
+  for (int v=tiles.y; v<tiles.y2(); ++v) {
+    for (int u=tiles.x; u<tiles.x2(); ++u) {
+      if (m_layersCache->tile(gfx::Point(u, v)))
+        continue;
+
+      Render render(*this);
+      render.m_threads = 1;
+      render.m_tmpBuf = m_tmpBuf;
+      render.m_layersCache.reset();
+      render.m_layersCacheState = LayersCacheState::Capturing;
+      render.m_fastPreview = false;
+      render.m_layersAboveCache.reset();
+
+      ImageRef tile(Image::create(spec));
+      render.renderSprite(
+        tile.get(), sprite, frame,
+        gfx::ClipF(0, 0,
+                   u*kTileSize, v*kTileSize,
+                   kTileSize, kTileSize));
+
+      if (render.m_layersCacheState != LayersCacheState::Captured) {
+        ASSERT(false);
+        m_layersCache->clear();
+        return false;
+      }
+      m_layersCache->addTile(gfx::Point(u, v), tile);
+    }
+  }
+  return true;
+}
+
+bool Render::addLayersCacheKey(
+  const Layer* layer,
+  const frame_t frame,
+  const Layer* stopLayer,
+  LayersCache::Key& key,
+  bool& found) const
+{
+  if (layer == stopLayer) {
+    found = true;
+    return true;
+  }
+
+  // The extra cel is drawn after its layer, it cannot be cached
+  if (m_extraCel && layer == m_currentLayer)
+    return false;
+
+  key.push_back(uint64_t(uintptr_t(layer)));
+  key.push_back(layer->version());
+  key.push_back(uint64_t(layer->flags()));
+  key.push_back(uint64_t(isLayerVisible(layer)));
+  if (!isLayerVisible(layer))
+    return true;
+
+  switch (layer->type()) {
+
+    case ObjectType::LayerImage: {
+      // Reference layers use subpixel bounds (not tracked by the key)
+      if (layer->isReference())
+        return false;
+
+      const LayerImage* imgLayer = static_cast<const LayerImage*>(layer);
+      key.push_back(uint64_t(imgLayer->opacity()));
+      key.push_back(uint64_t(imgLayer->blendMode()));
+
+      const Cel* cel = layer->cel(frame);
+      key.push_back(uint64_t(uintptr_t(cel)));
+      if (cel) {
+        const Image* image = cel->image();
+        key.push_back(cel->version());
+        key.push_back(uint64_t(uintptr_t(cel->data())));
+        key.push_back(cel->data()->version());
+        key.push_back(uint64_t(uint32_t(cel->x())) << 32 | uint32_t(cel->y()));
+        key.push_back(uint64_t(cel->opacity()));
+        key.push_back(uint64_t(uintptr_t(image)));
+        if (image)
+          key.push_back(image->version());
+      }
+      break;
+    }
+
+    case ObjectType::LayerGroup:
+      for (const Layer* child : static_cast<const LayerGroup*>(layer)->layers()) {
+        if (!addLayersCacheKey(child, frame, stopLayer, key, found))
+          return false;
+        if (found)
+          break;
+      }
+      break;
+
+  }
+  return true;
+}
+
+// The onion skin behind the sprite is drawn before the transparent
+// layers, so it's part of the cache too. Here we add to the key all
+// the frames/layers displayed by the onion skin.
+bool Render::addOnionskinCacheKey(
+  const Sprite* sprite,
+  const frame_t frame,
+  LayersCache::Key& key) const
+{
+  if (m_onionskin.type() == OnionskinType::NONE ||
+      m_onionskin.position() != OnionskinPosition::BEHIND)
+    return true;
+
+  const Tag* loop = m_onionskin.loopTag();
+  const Layer* onionLayer = (m_onionskin.layer() ? m_onionskin.layer():
+                                                   sprite->root());
+  key.insert(key.end(), {
+    uint64_t(m_onionskin.type()),
+    uint64_t(m_onionskin.prevFrames()),
+    uint64_t(m_onionskin.nextFrames()),
+    uint64_t(m_onionskin.opacityBase()),
+    uint64_t(m_onionskin.opacityStep()),
+    uint64_t(uintptr_t(onionLayer)),
+    uint64_t(uintptr_t(loop))
+  });
+  if (loop) {
+    key.insert(key.end(), {
+      uint64_t(loop->fromFrame()),
+      uint64_t(loop->toFrame()),
+      uint64_t(loop->aniDir())
+    });
+  }
+
+  const Cel* selectedCel = m_selectedLayer->cel(m_selectedFrame);
+  for (frame_t frameOut = frame - m_onionskin.prevFrames();
+       frameOut <= frame + m_onionskin.nextFrames();
+       ++frameOut) {
+    const frame_t frameIn =
+      get_onionskin_frame(sprite, frame, frameOut, loop);
+    if (frameIn < 0)
+      continue;
+
+    // A linked cel of the selected layer would be rendered with the
+    // preview image.
+    const Cel* cel = m_selectedLayer->cel(frameIn);
+    if (cel && selectedCel && cel->data() == selectedCel->data())
+      return false;
+
+    bool found = false;
+    key.push_back(uint64_t(frameIn));
+    if (!addLayersCacheKey(onionLayer, frameIn, nullptr, key, found))
+      return false;
+  }
+  return true;
+}
+
+void Render::restoreLayersCache(
+  Image* dstImage,
+  const gfx::Clip& area)
+{
+  ASSERT(area.dst == gfx::Point(0, 0));
+
+  const gfx::Rect dstBounds = area.dstBounds().createIntersection(dstImage->bounds());
+  const gfx::Rect srcBounds(area.src + dstBounds.origin(), dstBounds.size());
+  const gfx::Rect tiles = tiles_in_rect(srcBounds);
+
+  for (int v=tiles.y; v<tiles.y2(); ++v) {
+    for (int u=tiles.x; u<tiles.x2(); ++u) {
+      const Image* tile = m_layersCache->tile(gfx::Point(u, v));
+      ASSERT(tile);
+      if (!tile)
+        continue;
+
+      const gfx::Rect tileBounds(u*kTileSize, v*kTileSize, kTileSize, kTileSize);
+      const gfx::Rect rc = tileBounds.createIntersection(srcBounds);
+      dstImage->copy(tile, gfx::Clip(rc.x - area.src.x,
+                                     rc.y - area.src.y,
+                                     rc.x - tileBounds.x,
+                                     rc.y - tileBounds.y,
+                                     rc.w, rc.h));
+    }
+  }
+}
+
+bool Render::prepareLayersAboveCache(
+  const Image* dstImage,
+  const Sprite* sprite,
+  frame_t frame,
+  const gfx::ClipF& areaF)
+{
+  // The merged layers are composited with the RGBA normal blender
+  // on the final image
+  if (!m_fastPreview ||
+      !m_newBlendMethod ||
+      dstImage->pixelFormat() != IMAGE_RGB ||
+      !canUseLayersCache(dstImage, sprite, frame, areaF))
+    return false;
+
+  LayersCache::Key key = createLayersCacheKey(dstImage, sprite, frame);
+  bool passed = false;
+  if (!addLayersAboveCacheKey(sprite->root(), frame, key, passed) ||
+      !passed) {
+    m_layersAboveCache.reset();
+    return false;
+  }
+  if (!m_layersAboveCache)
+    m_layersAboveCache = std::make_shared<LayersCache>();
+  m_layersAboveCache->setKey(std::move(key));
+
+  const gfx::Clip area(areaF);
+  const gfx::Rect dstBounds = area.dstBounds().createIntersection(dstImage->bounds());
+  const gfx::Rect srcBounds(area.src + dstBounds.origin(), dstBounds.size());
+  const gfx::Rect tiles = tiles_in_rect(srcBounds);
+  if (!make_room_for_tiles(m_layersAboveCache.get(), tiles))
+    return false;
+
+  CompositeImageFunc compositeImage =
+    getImageComposition(dstImage->pixelFormat(),
+                        sprite->pixelFormat(), sprite->root());
+  if (!compositeImage)
+    return false;
+
+  ImageSpec spec = dstImage->spec();
+  spec.setSize(kTileSize, kTileSize);
+
+  for (int v=tiles.y; v<tiles.y2(); ++v) {
+    for (int u=tiles.x; u<tiles.x2(); ++u) {
+      if (m_layersAboveCache->tile(gfx::Point(u, v)))
+        continue;
+
+      Render render(*this);
+      render.m_threads = 1;
+      render.m_tmpBuf = m_tmpBuf;
+      render.m_layersCache.reset();
+      render.m_layersCacheState = LayersCacheState::None;
+      render.m_fastPreview = false;
+      render.m_layersAboveCache.reset();
+      render.m_layersAboveState = LayersAboveState::Capturing;
+      render.m_sprite = sprite;
+      render.m_globalOpacity = 255;
+
+      // Merge the layers above the selected one in a transparent tile
+      ImageRef tile(Image::create(spec));
+      tile->clear(0);
+      render.renderLayer(
+        sprite->root(), tile.get(),
+        gfx::Clip(0, 0, u*kTileSize, v*kTileSize, kTileSize, kTileSize),
+        frame, compositeImage,
+        false, true, BlendMode::UNSPECIFIED, false);
+
+      m_layersAboveCache->addTile(gfx::Point(u, v), tile);
+    }
+  }
+  return true;
+}
+
+// Adds to the key the layers above the selected layer (all of them
+// must use the normal blend mode to be merged in just one image).
+bool Render::addLayersAboveCacheKey(
+  const Layer* layer,
+  const frame_t frame,
+  LayersCache::Key& key,
+  bool& passed) const
+{
+  if (layer == m_selectedLayer) {
+    passed = true;
+    return true;
+  }
+
+  if (passed) {
+    // The extra cel is painted over its layer each time
+    if (m_extraCel && layer == m_currentLayer)
+      return false;
+
+    if (layer->isImage() &&
+        isLayerVisible(layer) &&
+        static_cast<const LayerImage*>(layer)->blendMode() != BlendMode::NORMAL)
+      return false;
+
+    if (!layer->isGroup()) {
+      bool found = false;
+      return addLayersCacheKey(layer, frame, nullptr, key, found);
+    }
+
+    key.push_back(uint64_t(uintptr_t(layer)));
+    key.push_back(layer->version());
+    key.push_back(uint64_t(layer->flags()));
+    key.push_back(uint64_t(isLayerVisible(layer)));
+    if (!isLayerVisible(layer))
+      return true;
+  }
+
+  if (layer->isGroup()) {
+    for (const Layer* child : static_cast<const LayerGroup*>(layer)->layers()) {
+      if (!addLayersAboveCacheKey(child, frame, key, passed))
+        return false;
+    }
+  }
+  return true;
+}
+
+void Render::compositeLayersAboveCache(
+  Image* dstImage,
+  const gfx::Clip& area)
+{
+  ASSERT(area.dst == gfx::Point(0, 0));
+  ASSERT(dstImage->pixelFormat() == IMAGE_RGB);
+
+  const gfx::Rect dstBounds = area.dstBounds().createIntersection(dstImage->bounds());
+  const gfx::Rect srcBounds(area.src + dstBounds.origin(), dstBounds.size());
+  const gfx::Rect tiles = tiles_in_rect(srcBounds);
+
+  for (int v=tiles.y; v<tiles.y2(); ++v) {
+    for (int u=tiles.x; u<tiles.x2(); ++u) {
+      const Image* tile = m_layersAboveCache->tile(gfx::Point(u, v));
+      ASSERT(tile);
+      if (!tile)
+        continue;
+
+      const gfx::Rect tileBounds(u*kTileSize, v*kTileSize, kTileSize, kTileSize);
+      const gfx::Rect rc = tileBounds.createIntersection(srcBounds);
+      for (int y=rc.y; y<rc.y2(); ++y) {
+        rgba_blender_normal_row(
+          (color_t*)dstImage->getPixelAddress(rc.x - area.src.x,
+                                              y - area.src.y),
+          (const color_t*)tile->getPixelAddress(rc.x - tileBounds.x,
+                                                y - tileBounds.y),
+          rc.w, 255);
+      }
+    }
+  }
+}
+
+// Returns the mip level (1 for 50%, 2 for 25%, etc.) that can be
+// used to render the given area with the current projection, or 0 if
+// the MipmapsCache cannot be used.
+int Render::mipmapsLevel(
+  const Image* dstImage,
+  const Sprite* sprite,
+  frame_t frame,
+  const gfx::ClipF& areaF) const
+{
+  // The mip levels contain the flattened layers only, so nothing can
+  // be drawn between layers.
+  if (!m_mipmaps ||
+      !m_newBlendMethod ||
+      dstImage->pixelFormat() != IMAGE_RGB ||
+      m_previewImage ||
+      m_extraType != ExtraType::NONE ||
+      m_extraCel ||
+      m_onionskin.type() != OnionskinType::NONE ||
+      m_layersCacheState != LayersCacheState::None ||
+      m_layersAboveState != LayersAboveState::None ||
+      m_proj.pixelRatio().w != 1 ||
+      m_proj.pixelRatio().h != 1)
+    return 0;
+
+  const gfx::Clip area(areaF);
+  if (gfx::RectF(area.dstBounds()) != areaF.dstBounds() ||
+      gfx::RectF(area.srcBounds()) != areaF.srcBounds() ||
+      area.dst != gfx::Point(0, 0))
+    return 0;
+
+  // Only power of two zoom levels (each mip pixel is exactly one
+  // projected pixel)
+  for (int level=1; level<=kMaxMipmapsLevel; ++level) {
+    if (m_proj.scaleX() == 1.0 / (1 << level))
+      return level;
+  }
+  return 0;
+}
+
+// Returns false if the cache cannot keep all the tiles of the given
+// range, in other case it makes room for the missing tiles.
+static bool make_room_for_mipmaps(MipmapsCache* cache,
+                                  const int level,
+                                  const gfx::Rect& tiles)
+{
+  if (tiles.w*tiles.h > MipmapsCache::kMaxTiles)
+    return false;
+
+  int missing = 0;
+  for (int v=tiles.y; v<tiles.y2(); ++v)
+    for (int u=tiles.x; u<tiles.x2(); ++u)
+      if (!cache->tile(level, gfx::Point(u, v)))
+        ++missing;
+  if (cache->size() + missing > MipmapsCache::kMaxTiles)
+    cache->clearTiles();
+  return true;
+}
+
+// Each destination pixel is the average of the 2x2 source pixels
+// (only the ones inside srcSize are used, e.g. in the last
+// row/column of odd sizes). The color is weighted with the alpha, so
+// transparent pixels don't darken the result.
+static void downsample_rgba_half(Image* dst,
+                                 const Image* src,
+                                 const gfx::Size& srcSize)
+{
+  const int w = std::min(dst->width(), (srcSize.w+1) / 2);
+  const int h = std::min(dst->height(), (srcSize.h+1) / 2);
+
+  for (int y=0; y<h; ++y) {
+    color_t* dstPtr = (color_t*)dst->getPixelAddress(0, y);
+    for (int x=0; x<w; ++x, ++dstPtr) {
+      uint32_t n = 0, r = 0, g = 0, b = 0, a = 0;
+      for (int v=2*y; v<2*y+2 && v<srcSize.h; ++v) {
+        const color_t* srcPtr = (const color_t*)src->getPixelAddress(2*x, v);
+        for (int u=2*x; u<2*x+2 && u<srcSize.w; ++u, ++srcPtr) {
+          const uint32_t ca = rgba_geta(*srcPtr);
+          r += rgba_getr(*srcPtr) * ca;
+          g += rgba_getg(*srcPtr) * ca;
+          b += rgba_getb(*srcPtr) * ca;
+          a += ca;
+          ++n;
+        }
+      }
+      if (a > 0)
+        *dstPtr = rgba((r + a/2) / a,
+                       (g + a/2) / a,
+                       (b + a/2) / a,
+                       (a + n/2) / n);
+      else
+        *dstPtr = 0;
+    }
+  }
+}
+
+// Resamples the RGB "src" image to the size of "dst" (which cannot be
+// bigger than "src"). The source is split in dst->width() x
+// dst->height() blocks of pixels, and each destination pixel is the
+// average of its block, weighted with the alpha as in
+// downsample_rgba_half(). Bands of rows are resampled in several
+// threads.
+static void downsample_rgba_area(Image* dst, const Image* src, int threads)
+{
+  const int sw = src->width(), sh = src->height();
+  const int dw = dst->width(), dh = dst->height();
+  ASSERT(dw <= sw && dh <= sh);
+
+  // Destination column of each source column
+  std::vector<int> cols(sw);
+  for (int x=0; x<sw; ++x)
+    cols[x] = int(int64_t(x) * dw / sw);
+
+  auto resampleRows = [&](const int y1, const int y2) {
+    std::vector<uint64_t> sums(4*dw);
+    std::vector<uint32_t> counts(dw);
+    for (int y=y1; y<y2; ++y) {
+      std::fill(sums.begin(), sums.end(), 0);
+      std::fill(counts.begin(), counts.end(), 0);
+
+      const int v1 = int(int64_t(y) * sh / dh);
+      const int v2 = int(int64_t(y+1) * sh / dh);
+      for (int v=v1; v<v2; ++v) {
+        const color_t* srcPtr = (const color_t*)src->getPixelAddress(0, v);
+        for (int x=0; x<sw; ++x, ++srcPtr) {
+          const uint64_t ca = rgba_geta(*srcPtr);
+          uint64_t* sum = &sums[4*cols[x]];
+          sum[0] += rgba_getr(*srcPtr) * ca;
+          sum[1] += rgba_getg(*srcPtr) * ca;
+          sum[2] += rgba_getb(*srcPtr) * ca;
+          sum[3] += ca;
+          ++counts[cols[x]];
+        }
+      }
+
+      color_t* dstPtr = (color_t*)dst->getPixelAddress(0, y);
+      for (int x=0; x<dw; ++x, ++dstPtr) {
+        const uint64_t* sum = &sums[4*x];
+        const uint64_t a = sum[3];
+        const uint64_t n = counts[x];
+        if (a > 0)
+          *dstPtr = rgba(int((sum[0] + a/2) / a),
+                         int((sum[1] + a/2) / a),
+                         int((sum[2] + a/2) / a),
+                         int((a + n/2) / n));
+        else
+          *dstPtr = 0;
+      }
+    }
+  };
+
+  if (threads == 0)
+    threads = std::max<int>(1, std::thread::hardware_concurrency());
+  threads = std::min(threads, dh);
+  threads = std::min(threads, std::max(1, int(int64_t(sw) * sh / kMinPixelsPerThread)));
+  if (threads < 2) {
+    resampleRows(0, dh);
+    return;
+  }
+
+  parallel_for(
+    threads, [&resampleRows, dh, threads](int i){
+      resampleRows(dh*i/threads, dh*(i+1)/threads);
+    });
+}
+
+bool Render::prepareMipmaps(
+  const Image* dstImage,
+  const Sprite* sprite,
+  frame_t frame,
+  const gfx::ClipF& areaF,
+  const int level)
+{
+  // Renderer used to create the tiles (without background, so it can
+  // be drawn below the mip levels)
+  Render render(*this);
+  render.m_tmpBuf.reset();
+  render.m_layersCache.reset();
+  render.m_fastPreview = false;
+  render.m_layersAboveCache.reset();
+  render.m_mipmaps = false;
+  render.m_mipmapsCache.reset();
+  render.m_filteredRefLayers = false;
+  render.m_refLayersCache.reset();
+  render.m_bgType = BgType::TRANSPARENT;
+  render.m_proj = Projection();
+
+  // Everything that can change the pixels of the flattened layers
+  // (without the scale, so all levels share the same key)
+  LayersCache::Key key = render.createLayersCacheKey(dstImage, sprite, frame);
+  bool found = false;
+  if (!render.addLayersCacheKey(sprite->root(), frame, nullptr, key, found)) {
+    m_mipmapsCache.reset();
+    return false;
+  }
+  if (!m_mipmapsCache)
+    m_mipmapsCache = std::make_shared<MipmapsCache>();
+  m_mipmapsCache->setKey(std::move(key));
+
+  // Render the missing tiles of this level
+  const gfx::Clip area(areaF);
+  const gfx::Rect levelBounds(0, 0,
+                              m_proj.applyX(sprite->width()),
+                              m_proj.applyY(sprite->height()));
+  const gfx::Rect dstBounds = area.dstBounds().createIntersection(dstImage->bounds());
+  const gfx::Rect srcBounds =
+    gfx::Rect(area.src + dstBounds.origin(), dstBounds.size())
+    .createIntersection(levelBounds);
+  if (srcBounds.isEmpty())
+    return true;
+
+  const gfx::Rect tiles = tiles_in_rect(srcBounds);
+  if (!make_room_for_mipmaps(m_mipmapsCache.get(), level, tiles))
+    return false;
+
+  // Each tile is created from the sprite rendered at a bigger level
+  // (the real sprite pixels for 50% and 25%) which is halved until we
+  // get the tile. Deeper levels start from a sampled level to limit
+  // the number of composited pixels.
+  const int srcLevel = std::max(0, level - kMipmapsSteps);
+  const int steps = level - srcLevel;
+  render.m_proj = Projection(PixelRatio(1, 1), Zoom(1, 1 << srcLevel));
+
+  ImageSpec spec = dstImage->spec();
+  std::vector<ImageRef> tmpTiles(steps);
+  for (int i=0; i<steps; ++i) {
+    spec.setSize(kTileSize << (steps-i), kTileSize << (steps-i));
+    tmpTiles[i].reset(Image::create(spec));
+  }
+  spec.setSize(kTileSize, kTileSize);
+
+  for (int v=tiles.y; v<tiles.y2(); ++v) {
+    for (int u=tiles.x; u<tiles.x2(); ++u) {
+      if (m_mipmapsCache->tile(level, gfx::Point(u, v)))
+        continue;
+
+      const int srcTileSize = (kTileSize << steps);
+      render.renderSprite(
+        tmpTiles[0].get(), sprite, frame,
+        gfx::ClipF(0, 0, u*srcTileSize, v*srcTileSize,
+                   srcTileSize, srcTileSize));
+
+      ImageRef tile(Image::create(spec));
+      for (int i=0; i<steps; ++i) {
+        const int k = srcLevel + i;
+        const int tileSize = (kTileSize << (steps-i));
+        downsample_rgba_half(
+          (i+1 < steps ? tmpTiles[i+1].get(): tile.get()),
+          tmpTiles[i].get(),
+          gfx::Size((sprite->width() >> k) - u*tileSize,
+                    (sprite->height() >> k) - v*tileSize));
+      }
+      m_mipmapsCache->addTile(level, gfx::Point(u, v), tile);
+    }
+  }
+  return true;
+}
+
+void Render::compositeMipmaps(
+  Image* dstImage,
+  const gfx::Clip& area,
+  const int level)
+{
+  ASSERT(m_mipmapsCache);
+
+  const gfx::Rect levelBounds(0, 0,
+                              m_proj.applyX(m_sprite->width()),
+                              m_proj.applyY(m_sprite->height()));
+  const gfx::Rect dstBounds = area.dstBounds().createIntersection(dstImage->bounds());
+  const gfx::Rect srcBounds =
+    gfx::Rect(area.src + dstBounds.origin(), dstBounds.size())
+    .createIntersection(levelBounds);
+  if (srcBounds.isEmpty())
+    return;
+
+  const gfx::Rect tiles = tiles_in_rect(srcBounds);
+  for (int v=tiles.y; v<tiles.y2(); ++v) {
+    for (int u=tiles.x; u<tiles.x2(); ++u) {
+      const Image* tile = m_mipmapsCache->tile(level, gfx::Point(u, v));
+      ASSERT(tile);
+      if (!tile)
+        continue;
+
+      const gfx::Rect tileBounds(u*kTileSize, v*kTileSize, kTileSize, kTileSize);
+      const gfx::Rect rc = tileBounds.createIntersection(srcBounds);
+      for (int y=rc.y; y<rc.y2(); ++y) {
+        rgba_blender_normal_row(
+          (color_t*)dstImage->getPixelAddress(rc.x - area.src.x,
+                                              y - area.src.y),
+          (const color_t*)tile->getPixelAddress(rc.x - tileBounds.x,
+                                                y - tileBounds.y),
+          rc.w, 255);
+      }
+    }
+  }
+}
+
+bool Render::renderSpriteTiles(
+  Image* dstImage,
+  const Sprite* sprite,
+  frame_t frame,
+  const gfx::ClipF& areaF)
+{
+  // Only integer areas (and projections that don't use
+  // composite_image_general()) can be split in tiles without changing
+  // the rendered pixels. Also the
+  // checked background pattern is aligned to the dstImage origin
+  // (see renderCheckedBackground()), so the area must start there.
+  const gfx::Clip area(areaF);
+  if (gfx::RectF(area.dstBounds()) != areaF.dstBounds() ||
+      gfx::RectF(area.srcBounds()) != areaF.srcBounds() ||
+      area.dst != gfx::Point(0, 0) ||
+      !is_tileable_projection(m_proj))
+    return false;
+
+  // Don't render over the area outside dstImage
+  const gfx::Rect dstBounds = area.dstBounds().createIntersection(dstImage->bounds());
+  const int cols = (dstBounds.w + kTileSize - 1) / kTileSize;
+  const int rows = (dstBounds.h + kTileSize - 1) / kTileSize;
+  const int ntiles = cols*rows;
+  if (ntiles < 2)
+    return false;
+
+  // Reference layers lazily create their subpixel bounds
+  // (CelData::boundsF()), so we cannot render them from several
+  // threads.
+  if ((m_flags & Flags::ShowRefLayers) &&
+      has_visible_reference_layers(sprite->root(), m_visibleLayers))
+    return false;
+
+  int nthreads = m_threads;
+  if (nthreads == 0)
+    nthreads = std::max<int>(1, std::thread::hardware_concurrency());
+  nthreads = std::min(nthreads, ntiles);
+  if (nthreads < 2)
+    return false;
+
+  // Each thread takes the next tile to render from this counter
+  // (faster threads just render more tiles). Tiles are rendered into
+  // a temporary image and then copied to its own rectangle in
+  // dstImage, so no locks are needed.
+  std::atomic<int> nextTile(0);
+
+  auto renderTiles = [&]{
+    Render render(*this);
+    render.m_threads = 1;
+    render.m_tmpBuf.reset();
+    render.m_layersCache.reset();
+    render.m_fastPreview = false;
+    render.m_layersAboveCache.reset();
+    render.m_mipmaps = false;
+    render.m_mipmapsCache.reset();
+    render.m_filteredRefLayers = false;
+    render.m_refLayersCache.reset();
+
+    ImageBufferPtr tileBuf(new doc::ImageBuffer);
+    ImageSpec spec = dstImage->spec();
+
+    for (int i=nextTile++; i<ntiles; i=nextTile++) {
+      const gfx::Rect tileBounds =
+        gfx::Rect(dstBounds.x + (i % cols)*kTileSize,
+                  dstBounds.y + (i / cols)*kTileSize,
+                  kTileSize, kTileSize).createIntersection(dstBounds);
+
+      spec.setSize(tileBounds.size());
+      ImageRef tile(Image::create(spec, tileBuf));
+      render.renderSprite(
+        tile.get(), sprite, frame,
+        gfx::ClipF(0, 0,
+                   area.src.x + tileBounds.x,
+                   area.src.y + tileBounds.y,
+                   tileBounds.w, tileBounds.h));
+      copy_image(dstImage, tile.get(), tileBounds.x, tileBounds.y);
+    }
+  };
+
+  parallel_for(nthreads, [&renderTiles](int){ renderTiles(); });
+
+  m_sprite = sprite;
+  return true;
+}
+
 void Render::renderSpriteLayers(Image* dstImage,
                               const gfx::ClipF& area,
                               frame_t frame,
                               CompositeImageFunc compositeImage)
 {
-  // Draw the background layer.
-  m_globalOpacity = 255;
-  renderLayer(m_sprite->root(), dstImage,
-              area, frame, compositeImage,
-              true,
-              false,
-              BlendMode::UNSPECIFIED,
-              false);
-
-  // Draw onion skin behind the sprite.
-  if (m_onionskin.position() == OnionskinPosition::BEHIND)
-    renderOnionskin(dstImage, area, frame, compositeImage);
+  // Restore the background layer, the onion skin and the
+  // transparent layers below the selected layer from the cache.
+  if (m_layersCacheState == LayersCacheState::Restoring) {
+    restoreLayersCache(dstImage, gfx::Clip(area));
+  }
+  else {
+    // Draw the background layer.
+    m_globalOpacity = 255;
+    renderLayer(m_sprite->root(), dstImage,
+                area, frame, compositeImage,
+                true,
+                false,
+                BlendMode::UNSPECIFIED,
+                false);
+
+    // Draw onion skin behind the sprite.
+    if (m_onionskin.position() == OnionskinPosition::BEHIND)
+      renderOnionskin(dstImage, area, frame, compositeImage);
+  }
 
   // Draw the transparent layers.
   m_globalOpacity = 255;
@@ -796,6 +1985,16 @@ void Render::renderSpriteLayers(Image* dstImage,
               false,
               true,
               BlendMode::UNSPECIFIED, false);
+
+  ASSERT(m_layersCacheState != LayersCacheState::Restoring);
+  if (m_layersCacheState == LayersCacheState::Restoring)
+    m_layersCacheState = LayersCacheState::None;
+
+  // Merged layers above the selected one
+  ASSERT(m_layersAboveState != LayersAboveState::Restoring);
+  if (m_layersAboveState == LayersAboveState::Restored)
+    compositeLayersAboveCache(dstImage, gfx::Clip(area));
+  m_layersAboveState = LayersAboveState::None;
 }
 
 void Render::renderBackground(Image* image,
@@ -810,7 +2009,7 @@ void Render::renderBackground(Image* image,
     switch (m_bgType) {
       case BgType::CHECKED:
         renderCheckedBackground(image, area);
-        if (bgLayer && bgLayer->isVisible() &&
+        if (bgLayer && isLayerVisible(bgLayer) &&
             // TODO Review this: bg_color can be an index (not an rgba())
             //      when sprite and dstImage are indexed
             rgba_geta(bg_color) > 0) {
@@ -830,13 +2029,18 @@ void Render::renderBackground(Image* image,
   }
 }
 
+bool Render::isLayerVisible(const Layer* layer) const
+{
+  return is_layer_visible(layer, m_visibleLayers);
+}
+
 bool Render::isSolidBackground(
   const Layer* bgLayer,
   const color_t bg_color) const
 {
   return
     ((m_bgType != BgType::CHECKED) ||
-     (bgLayer && bgLayer->isVisible() &&
+     (bgLayer && isLayerVisible(bgLayer) &&
       // TODO Review this: bg_color can be an index (not an rgba())
       //      when sprite and dstImage are indexed
       rgba_geta(bg_color) == 255));
@@ -854,27 +2058,14 @@ void Render::renderOnionskin(
     Tag* loop = m_onionskin.loopTag();
     Layer* onionLayer = (m_onionskin.layer() ? m_onionskin.layer():
                                                m_sprite->root());
-    frame_t frameIn;
 
     for (frame_t frameOut = frame - m_onionskin.prevFrames();
          frameOut <= frame + m_onionskin.nextFrames();
          ++frameOut) {
-      if (loop) {
-        bool pingPongForward = true;
-        frameIn =
-          calculate_next_frame(m_sprite,
-                               frame, frameOut - frame,
-                               loop, pingPongForward);
-      }
-      else {
-        frameIn = frameOut;
-      }
-
-      if (frameIn == frame ||
-          frameIn < 0 ||
-          frameIn > m_sprite->lastFrame()) {
+      const frame_t frameIn =
+        get_onionskin_frame(m_sprite, frame, frameOut, loop);
+      if (frameIn < 0)
         continue;
-      }
 
       if (frameOut < frame) {
         m_globalOpacity = m_onionskin.opacityBase() - m_onionskin.opacityStep() * ((frame - frameOut)-1);
@@ -908,7 +2099,7 @@ void Render::renderCheckedBackground(
   Image* image,
   const gfx::Clip& area)
 {
-  int x, y, u, v;
+  int u, v;
   int tile_w = m_bgCheckedSize.w;
   int tile_h = m_bgCheckedSize.h;
 
@@ -943,19 +2134,28 @@ void Render::renderCheckedBackground(
       break;
   }
 
-  // Draw checked background (tile by tile)
-  int u_start = u;
-  for (y=y_start-tile_h; y<image->height()+tile_h; y+=tile_h) {
-    for (x=x_start-tile_w; x<image->width()+tile_w; x+=tile_w) {
-      gfx::Rect fillRc = dstBounds.createIntersection(gfx::Rect(x, y, tile_w, tile_h));
-      if (!fillRc.isEmpty())
-        fill_rect(
-          image, fillRc.x, fillRc.y, fillRc.x+fillRc.w-1, fillRc.y+fillRc.h-1,
-          (((u+v))&1)? m_bgColor2: m_bgColor1);
-      ++u;
-    }
-    u = u_start;
-    ++v;
+  // The background is rendered in RGB/Grayscale/Indexed images only
+  // (other formats like bitmaps or tilemaps are never a destination
+  // of the render)
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:
+      draw_checked_background<RgbTraits>(
+        image, dstBounds, x_start-tile_w, y_start-tile_h,
+        tile_w, tile_h, u+v, m_bgColor1, m_bgColor2);
+      break;
+    case IMAGE_GRAYSCALE:
+      draw_checked_background<GrayscaleTraits>(
+        image, dstBounds, x_start-tile_w, y_start-tile_h,
+        tile_w, tile_h, u+v, m_bgColor1, m_bgColor2);
+      break;
+    case IMAGE_INDEXED:
+      draw_checked_background<IndexedTraits>(
+        image, dstBounds, x_start-tile_w, y_start-tile_h,
+        tile_w, tile_h, u+v, m_bgColor1, m_bgColor2);
+      break;
+    default:
+      ASSERT(false);
+      break;
   }
 }
 
@@ -975,6 +2175,42 @@ void Render::renderImage(
   if (!compositeImage)
     return;
 
+  // Big images without zoom are composited in bands of rows from
+  // several threads (each band modifies its own rows of dst_image).
+  if (m_threads != 1 &&
+      m_proj.scaleX() == 1.0 &&
+      m_proj.scaleY() == 1.0) {
+    gfx::Clip area(x, y, 0, 0, src_image->width(), src_image->height());
+    if (area.clip(dst_image->width(), dst_image->height(),
+                  src_image->width(), src_image->height()) &&
+        area.size.w * area.size.h >= kMinPixelsPerThread*2) {
+      const int nbands = (area.size.h + kTileSize - 1) / kTileSize;
+      int nthreads = m_threads;
+      if (nthreads == 0)
+        nthreads = std::max<int>(1, std::thread::hardware_concurrency());
+      nthreads = std::min({ nthreads, nbands,
+                            area.size.w * area.size.h / kMinPixelsPerThread });
+      if (nthreads >= 2) {
+        std::atomic<int> nextBand(0);
+        auto compositeBands = [&]{
+          for (int i=nextBand++; i<nbands; i=nextBand++) {
+            const int v = i*kTileSize;
+            compositeImage(
+              dst_image, src_image, pal,
+              gfx::ClipF(area.dst.x, area.dst.y+v,
+                         area.src.x, area.src.y+v,
+                         area.size.w, std::min(kTileSize, area.size.h-v)),
+              opacity, blendMode, 1.0, 1.0,
+              m_newBlendMethod);
+          }
+        };
+
+        parallel_for(nthreads, [&compositeBands](int){ compositeBands(); });
+        return;
+      }
+    }
+  }
+
   compositeImage(
     dst_image, src_image, pal,
     gfx::ClipF(x, y, 0, 0,
@@ -998,9 +2234,43 @@ void Render::renderLayer(
   bool isSelected)
 {
   // we can't read from this layer
-  if (!layer->isVisible())
+  if (!isLayerVisible(layer))
     return;
 
+  if (m_layersCacheState != LayersCacheState::None &&
+      !render_background &&
+      frame == m_selectedFrame) {
+    if (layer == m_selectedLayer) {
+      // The cache tile is ready, it's the dstImage itself
+      if (m_layersCacheState == LayersCacheState::Capturing)
+        m_layersCacheState = LayersCacheState::Captured;
+      // The layers below this one come from the cache
+      else if (m_layersCacheState == LayersCacheState::Restoring)
+        m_layersCacheState = LayersCacheState::None;
+    }
+    if (m_layersCacheState == LayersCacheState::Captured ||
+        (m_layersCacheState == LayersCacheState::Restoring &&
+         !layer->isGroup()))
+      return;
+  }
+
+  if (m_layersAboveState != LayersAboveState::None &&
+      !render_background &&
+      frame == m_selectedFrame) {
+    // Layers above the selected one come from the cache
+    if (m_layersAboveState == LayersAboveState::Restored)
+      return;
+
+    // Skip the selected layer and the layers below it (the cache
+    // tile contains only the layers above)
+    if (m_layersAboveState == LayersAboveState::Capturing &&
+        !layer->isGroup()) {
+      if (layer == m_selectedLayer)
+        m_layersAboveState = LayersAboveState::CapturingAbove;
+      return;
+    }
+  }
+
   if (m_selectedLayerForOpacity == layer)
     isSelected = true;
 
@@ -1119,6 +2389,16 @@ void Render::renderLayer(
 
           ASSERT(celImage->maskColor() == m_sprite->transparentColor());
 
+          // Zoomed-out reference layers are composited from their
+          // filtered images
+          CompositeImageFunc celCompositeImage = compositeImage;
+          if (!usePreview && layer->isReference()) {
+            if (const Image* filtered = getFilteredRefImage(celImage, celBounds)) {
+              celImage = filtered;
+              celCompositeImage = get_general_composition_from_rgb(image->pixelFormat());
+            }
+          }
+
           // Draw parts outside the "m_extraCel" area
           if (drawExtra && m_extraType == ExtraType::PATCH) {
             gfx::Region originalAreas(area.srcBounds());
@@ -1129,7 +2409,7 @@ void Render::renderLayer(
               renderCel(
                 image, celImage, pal, celBounds,
                 gfx::Clip(area.dst.x+rc.x-area.src.x,
-                          area.dst.y+rc.y-area.src.y, rc), compositeImage,
+                          area.dst.y+rc.y-area.src.y, rc), celCompositeImage,
                 opacity, layerBlendMode);
             }
           }
@@ -1137,7 +2417,7 @@ void Render::renderLayer(
           else {
             renderCel(
               image, celImage, pal,
-              celBounds, area, compositeImage,
+              celBounds, area, celCompositeImage,
               opacity, layerBlendMode);
           }
         }
@@ -1176,6 +2456,13 @@ void Render::renderLayer(
         m_extraBlendMode);
     }
   }
+
+  // The next layers come from the cache
+  if (m_layersAboveState == LayersAboveState::Restoring &&
+      layer == m_selectedLayer &&
+      !render_background &&
+      frame == m_selectedFrame)
+    m_layersAboveState = LayersAboveState::Restored;
 }
 
 void Render::renderCel(
@@ -1260,6 +2547,38 @@ void Render::renderImage(
     m_newBlendMethod);
 }
 
+// Returns the RGB image resampled to the size of the given cel bounds
+// in the current projection (only for zoomed-out projections), or
+// nullptr if the cel image must be sampled directly.
+const Image* Render::getFilteredRefImage(
+  const Image* celImage,
+  const gfx::RectF& celBounds)
+{
+  if (!m_filteredRefLayers ||
+      celImage->pixelFormat() != IMAGE_RGB)
+    return nullptr;
+
+  // The image is never scaled up (the other axis can be zoomed in)
+  const gfx::RectF scaledBounds = m_proj.apply(celBounds);
+  const gfx::Size size(
+    base::clamp(int(std::round(scaledBounds.w)), 1, celImage->width()),
+    base::clamp(int(std::round(scaledBounds.h)), 1, celImage->height()));
+  if (size == celImage->size())
+    return nullptr;
+
+  if (!m_refLayersCache)
+    m_refLayersCache = std::make_shared<RefLayersCache>();
+  else if (const Image* image = m_refLayersCache->image(celImage, size))
+    return image;
+
+  DOC_TRACE_ZONE("Render::getFilteredRefImage");
+
+  ImageRef image(Image::create(IMAGE_RGB, size.w, size.h));
+  downsample_rgba_area(image.get(), celImage, m_threads);
+  m_refLayersCache->addImage(celImage, image);
+  return image.get();
+}
+
 CompositeImageFunc Render::getImageComposition(
   const PixelFormat dstFormat,
   const PixelFormat srcFormat,
@@ -1276,7 +2595,8 @@ CompositeImageFunc Render::getImageComposition(
                    std::modf(double(m_bgCheckedSize.h) / m_proj.applyY(1.0), &intpart) != 0.0)) ||
     (layer &&
      layer->isGroup() &&
-     has_visible_reference_layers(static_cast<const LayerGroup*>(layer)));
+     has_visible_reference_layers(static_cast<const LayerGroup*>(layer),
+                                  m_visibleLayers));
 
   switch (srcFormat) {
 
@@ -1315,11 +2635,14 @@ void composite_image(Image* dst,
                      const int x,
                      const int y,
                      const int opacity,
-                     const BlendMode blendMode)
+                     const BlendMode blendMode,
+                     const int threads)
 {
   // As the background is not rendered in renderImage(), we don't need
   // to configure the Render instance's BgType.
-  Render().renderImage(
+  Render render;
+  render.setThreads(threads);
+  render.renderImage(
     dst, src, pal, x, y,
     opacity, blendMode);
 }
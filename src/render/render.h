@@ -1,5 +1,5 @@
 // Aseprite Render Library
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (c) 2001-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -20,14 +20,20 @@
 #include "gfx/size.h"
 #include "render/bg_type.h"
 #include "render/extra_type.h"
+#include "render/layers_cache.h"
+#include "render/mipmaps_cache.h"
 #include "render/onionskin_options.h"
 #include "render/projection.h"
+#include "render/ref_layers_cache.h"
+
+#include <memory>
 
 namespace doc {
   class Cel;
   class Image;
   class Layer;
   class Palette;
+  class SelectedLayers;
   class Sprite;
 }
 
@@ -57,6 +63,11 @@ namespace render {
     void setNonactiveLayersOpacity(const int opacity);
     void setNewBlend(const bool newBlend);
 
+    // Number of threads used to render big areas (the area is split
+    // in tiles that are rendered in parallel). 1 means no threads
+    // at all, and 0 uses one thread for each hardware core.
+    void setThreads(const int threads);
+
     // Viewport configuration
     void setProjection(const Projection& projection);
 
@@ -69,8 +80,20 @@ namespace render {
 
     void setSelectedLayer(const Layer* layer);
 
+    // Renders the given set of layers instead of the visible ones
+    // (the visibility flag of each layer is ignored), so different
+    // sets of layers of the same sprite can be rendered at the same
+    // time without modifying the sprite (e.g. from several threads).
+    // The set must contain the parent groups of each layer (see
+    // SelectedLayers::propagateSelection()). Use nullptr to render
+    // the visible layers again.
+    void setVisibleLayers(const SelectedLayers* layers);
+
     // Sets the preview image. This preview image is an alternative
-    // image to be used for the given layer/frame.
+    // image to be used for the given layer/frame. While the preview
+    // image is set, the layers below the given layer are cached (see
+    // LayersCache), so only the given layer (and the layers above
+    // it) are composited again in each renderSprite() call.
     void setPreviewImage(const Layer* layer,
                          const frame_t frame,
                          const Image* image,
@@ -78,6 +101,30 @@ namespace render {
                          const BlendMode blendMode);
     void removePreviewImage();
 
+    // Enables a faster (but approximated) preview while the preview
+    // image is set: the layers above the preview layer are merged in
+    // one cached image, so each renderSprite() call composites only
+    // the preview layer and that merged image over the cached layers
+    // below. The result can differ a little (rounding errors) from
+    // the full-quality render. It's disabled by removePreviewImage().
+    void setFastPreview(const bool state);
+
+    // Uses cached down-scaled versions of the sprite (see
+    // MipmapsCache) to render zoomed-out projections (50%, 25%,
+    // 12.5%, etc.). Each visible pixel is the average of all the
+    // sprite pixels that it covers (instead of just one sampled
+    // pixel), and panning/zooming doesn't composite the layers again
+    // until the frame is modified. Only used when there is no
+    // preview/extra image and no onion skin.
+    void setMipmaps(const bool state);
+
+    // Uses cached resampled versions of the RGB reference layers (see
+    // RefLayersCache) in zoomed-out projections. Each visible pixel
+    // is the average of all the pixels of the reference image that it
+    // covers, and the images are resampled again only when the zoom
+    // level changes.
+    void setFilteredRefLayers(const bool state);
+
     // Sets an extra cel/image to be drawn after the current
     // layer/frame.
     void setExtraImage(
@@ -142,6 +189,94 @@ namespace render {
       const BlendMode blendMode);
 
   private:
+    enum class LayersCacheState {
+      None,
+      Restoring,        // Layers below the selected one come from the cache
+      Capturing,        // Rendering a cache tile (stop in the selected layer)
+      Captured,
+    };
+
+    enum class LayersAboveState {
+      None,
+      Restoring,        // Rendering until the selected layer
+      Restored,         // Layers above the selected one come from the cache
+      Capturing,        // Rendering a cache tile (skip until the selected layer)
+      CapturingAbove,
+    };
+
+    bool canUseLayersCache(
+      const Image* dstImage,
+      const Sprite* sprite,
+      frame_t frame,
+      const gfx::ClipF& area) const;
+
+    LayersCache::Key createLayersCacheKey(
+      const Image* dstImage,
+      const Sprite* sprite,
+      frame_t frame) const;
+
+    bool prepareLayersCache(
+      const Image* dstImage,
+      const Sprite* sprite,
+      frame_t frame,
+      const gfx::ClipF& area);
+
+    bool addLayersCacheKey(
+      const Layer* layer,
+      const frame_t frame,
+      const Layer* stopLayer,
+      LayersCache::Key& key,
+      bool& found) const;
+
+    bool addOnionskinCacheKey(
+      const Sprite* sprite,
+      const frame_t frame,
+      LayersCache::Key& key) const;
+
+    void restoreLayersCache(
+      Image* dstImage,
+      const gfx::Clip& area);
+
+    bool prepareLayersAboveCache(
+      const Image* dstImage,
+      const Sprite* sprite,
+      frame_t frame,
+      const gfx::ClipF& area);
+
+    bool addLayersAboveCacheKey(
+      const Layer* layer,
+      const frame_t frame,
+      LayersCache::Key& key,
+      bool& passed) const;
+
+    void compositeLayersAboveCache(
+      Image* dstImage,
+      const gfx::Clip& area);
+
+    int mipmapsLevel(
+      const Image* dstImage,
+      const Sprite* sprite,
+      frame_t frame,
+      const gfx::ClipF& area) const;
+
+    bool prepareMipmaps(
+      const Image* dstImage,
+      const Sprite* sprite,
+      frame_t frame,
+      const gfx::ClipF& area,
+      const int level);
+
+    void compositeMipmaps(
+      Image* dstImage,
+      const gfx::Clip& area,
+      const int level);
+
+    bool renderSpriteTiles(
+      Image* dstImage,
+      const Sprite* sprite,
+      frame_t frame,
+      const gfx::ClipF& area);
+
     void renderSpriteLayers(
       Image* dstImage,
       const gfx::ClipF& area,
@@ -158,6 +293,8 @@ namespace render {
       const Layer* bgLayer,
       const color_t bg_color) const;
 
+    bool isLayerVisible(const Layer* layer) const;
+
     void renderOnionskin(
       Image* image,
       const gfx::Clip& area,
@@ -195,12 +332,17 @@ namespace render {
       const int opacity,
       const BlendMode blendMode);
 
+    const Image* getFilteredRefImage(
+      const Image* celImage,
+      const gfx::RectF& celBounds);
+
     CompositeImageFunc getImageComposition(
       const PixelFormat dstFormat,
       const PixelFormat srcFormat,
       const Layer* layer);
 
     int m_flags;
+    int m_threads;
     int m_nonactiveLayersOpacity;
     const Sprite* m_sprite;
     const Layer* m_currentLayer;
@@ -219,21 +361,34 @@ namespace render {
     int m_globalOpacity;
     const Layer* m_selectedLayerForOpacity;
     const Layer* m_selectedLayer;
+    const SelectedLayers* m_visibleLayers;
     frame_t m_selectedFrame;
     const Image* m_previewImage;
     gfx::Point m_previewPos;
     BlendMode m_previewBlendMode;
     OnionskinOptions m_onionskin;
     ImageBufferPtr m_tmpBuf;
+    std::shared_ptr<LayersCache> m_layersCache;
+    LayersCacheState m_layersCacheState;
+    bool m_fastPreview;
+    std::shared_ptr<LayersCache> m_layersAboveCache;
+    LayersAboveState m_layersAboveState;
+    bool m_mipmaps;
+    std::shared_ptr<MipmapsCache> m_mipmapsCache;
+    bool m_filteredRefLayers;
+    std::shared_ptr<RefLayersCache> m_refLayersCache;
   };
 
+  // Big images can be composited in several threads (see
+  // Render::setThreads()).
   void composite_image(Image* dst,
                        const Image* src,
                        const Palette* pal,
                        const int x,
                        const int y,
                        const int opacity,
-                       const BlendMode blendMode);
+                       const BlendMode blendMode,
+                       const int threads = 1);
 
 } // namespace render
 
@@ -10,6 +10,7 @@
 
 #include "render/render.h"
 
+#include "doc/blend_mode.h"
 #include "doc/cel.h"
 #include "doc/image.h"
 #include "doc/layer.h"
@@ -19,6 +20,9 @@
 
 #include <benchmark/benchmark.h>
 
+#include <algorithm>
+#include <memory>
+
 using namespace doc;
 using namespace render;
 
@@ -26,6 +30,8 @@ static void Bm_Render(benchmark::State& state)
 {
   const int w = state.range(0);
   const int h = state.range(1);
+  const Zoom zoom(state.range(2), state.range(3));
+  const int threads = state.range(4);
 
   Sprite* spr = Sprite::MakeStdSprite(ImageSpec(ColorMode::RGB, w, h));
   LayerImage* lay1 = static_cast<LayerImage*>(spr->root()->firstLayer());
@@ -63,18 +69,186 @@ static void Bm_Render(benchmark::State& state)
     render.setBgColor1(rgba(100, 100, 100, 255));
     render.setBgColor2(rgba(200, 200, 200, 255));
     render.setBgCheckedSize(gfx::Size(16, 16));
+    render.setProjection(Projection(PixelRatio(1, 1), zoom));
+    render.setThreads(threads);
     render.renderSprite(
       dst.get(), spr, frame_t(0),
       gfx::Clip(0, 0, 0, 0, w, h));
   }
+
+  // Rendered pixels in the destination image
+  state.SetItemsProcessed(int64_t(state.iterations()) * w * h);
+}
+
+static void ZoomArguments(benchmark::internal::Benchmark* b) {
+  const int sizes[][2] = { { 256, 256 },
+                           { 1024, 256 },
+                           { 256, 1024 },
+                           { 1024, 1024 },
+                           { 4096, 4096 } };
+  const int zooms[][2] = { { 1, 1 },    // 100%
+                           { 2, 1 },    // 200%
+                           { 8, 1 },    // 800%
+                           { 1, 2 },    // 50%
+                           { 1, 4 } };  // 25%
+  for (const auto& size : sizes)
+    for (const auto& zoom : zooms)
+      b->Args({ size[0], size[1], zoom[0], zoom[1], 1 });
+}
+
+static void ThreadsArguments(benchmark::internal::Benchmark* b) {
+  for (int threads : { 2, 4, 8, 0 }) {
+    b->Args({ 1024, 1024, 1, 1, threads });
+    b->Args({ 4096, 4096, 1, 1, threads });
+    b->Args({ 4096, 4096, 1, 4, threads });
+  }
+}
+
+// Returns a color for the given sprite color mode to fill the layer
+// "i" so each layer looks different.
+static color_t layer_color(const ColorMode colorMode, const int i)
+{
+  switch (colorMode) {
+    case ColorMode::RGB:
+      return rgba((i*50) & 255, (i*90) & 255, (i*130) & 255, 64 + (i*40) % 192);
+    case ColorMode::GRAYSCALE:
+      return graya((i*70) & 255, 64 + (i*40) % 192);
+    case ColorMode::INDEXED:
+      return 1 + (i % 255);
+  }
+  return 0;
+}
+
+// Creates a sprite similar to a real document: "nlayers" layers
+// (grouped in groups of 8 layers) with different blend modes,
+// opacities and cel positions in each frame.
+static Sprite* make_document(const ColorMode colorMode,
+                             const int w, const int h,
+                             const int nlayers,
+                             const frame_t nframes)
+{
+  static const BlendMode blendModes[] = {
+    BlendMode::NORMAL, BlendMode::MULTIPLY,
+    BlendMode::NORMAL, BlendMode::SCREEN,
+    BlendMode::NORMAL, BlendMode::OVERLAY,
+    BlendMode::NORMAL, BlendMode::DARKEN };
+
+  Sprite* spr = Sprite::MakeStdSprite(ImageSpec(colorMode, w, h));
+  spr->setTotalFrames(nframes);
+
+  // Remove the default layer
+  Layer* defaultLayer = spr->root()->firstLayer();
+  spr->root()->removeLayer(defaultLayer);
+  delete defaultLayer;
+
+  LayerGroup* group = nullptr;
+  for (int i=0; i<nlayers; ++i) {
+    if ((i % 8) == 0) {
+      group = new LayerGroup(spr);
+      spr->root()->addLayer(group);
+    }
+
+    LayerImage* lay = new LayerImage(spr);
+    if (colorMode != ColorMode::INDEXED)
+      lay->setBlendMode(blendModes[i % 8]);
+    lay->setOpacity(255 - (i % 4)*32);
+    group->addLayer(lay);
+
+    for (frame_t frame=0; frame<nframes; ++frame) {
+      // Cels smaller than the sprite in different positions
+      const int cw = w/2 + (i*37) % (w/2);
+      const int ch = h/2 + (i*53) % (h/2);
+      ImageRef img(Image::create(spr->pixelFormat(), cw, ch));
+      clear_image(img.get(), spr->transparentColor());
+      fill_rect(img.get(), 0, 0, cw-1, ch-1, layer_color(colorMode, i+frame));
+      fill_rect(img.get(), cw/4, ch/4, cw-cw/4, ch-ch/4, layer_color(colorMode, i+frame+1));
+
+      Cel* cel = new Cel(frame, img);
+      cel->setPosition(((i+frame)*29) % (w-cw+1),
+                       ((i+frame)*31) % (h-ch+1));
+      lay->addCel(cel);
+    }
+  }
+  return spr;
+}
+
+static void Bm_RenderDocument(benchmark::State& state)
+{
+  const ColorMode colorMode = ColorMode(state.range(0));
+  const int nlayers = state.range(1);
+  const Zoom zoom(state.range(2), state.range(3));
+  const int onionFrames = state.range(4);
+  const int w = 512, h = 512;
+
+  // Editor-like viewport
+  const int viewW = 1024, viewH = 768;
+
+  std::unique_ptr<Sprite> spr(make_document(colorMode, w, h, nlayers,
+                                            1 + 2*onionFrames));
+  std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, viewW, viewH));
+
+  Render render;
+  render.setBgType(BgType::CHECKED);
+  render.setBgZoom(true);
+  render.setBgColor1(rgba(100, 100, 100, 255));
+  render.setBgColor2(rgba(200, 200, 200, 255));
+  render.setBgCheckedSize(gfx::Size(16, 16));
+  render.setProjection(Projection(PixelRatio(1, 1), zoom));
+  if (onionFrames > 0) {
+    OnionskinOptions onionskin(OnionskinType::MERGE);
+    onionskin.prevFrames(onionFrames);
+    onionskin.nextFrames(onionFrames);
+    onionskin.opacityBase(68);
+    onionskin.opacityStep(28);
+    render.setOnionskin(onionskin);
+  }
+
+  const int dw = std::min(viewW, zoom.apply(w));
+  const int dh = std::min(viewH, zoom.apply(h));
+  const frame_t frame = onionFrames;
+  for (auto _ : state) {
+    render.renderSprite(
+      dst.get(), spr.get(), frame,
+      gfx::Clip(0, 0, 0, 0, dw, dh));
+  }
+
+  // Rendered pixels and frames (each iteration is a frame)
+  state.SetItemsProcessed(int64_t(state.iterations()) * dw * dh);
+  state.counters["fps"] =
+    benchmark::Counter(double(state.iterations()),
+                       benchmark::Counter::kIsRate);
+}
+
+static void DocumentArguments(benchmark::internal::Benchmark* b) {
+  const ColorMode colorModes[] = { ColorMode::RGB,
+                                   ColorMode::GRAYSCALE,
+                                   ColorMode::INDEXED };
+  const int zooms[][2] = { { 1, 1 },    // 100%
+                           { 4, 1 },    // 400%
+                           { 1, 2 } };  // 50%
+  for (ColorMode colorMode : colorModes) {
+    for (int nlayers : { 8, 64 }) {
+      for (const auto& zoom : zooms)
+        b->Args({ int(colorMode), nlayers, zoom[0], zoom[1], 0 });
+
+      // Onion skin with 1 and 4 frames before/after
+      for (int onionFrames : { 1, 4 })
+        b->Args({ int(colorMode), nlayers, 1, 1, onionFrames });
+    }
+  }
 }
 
 BENCHMARK(Bm_Render)
-  ->Args({ 256, 256 })
-  ->Args({ 1024, 256 })
-  ->Args({ 256, 1024 })
-  ->Args({ 1024, 1024 })
-  ->Args({ 4096, 4096 })
+  ->Apply(ZoomArguments)
   ->Unit(benchmark::kMicrosecond);
 
+BENCHMARK(Bm_Render)
+  ->Apply(ThreadsArguments)
+  ->UseRealTime()
+  ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(Bm_RenderDocument)
+  ->Apply(DocumentArguments)
+  ->Unit(benchmark::kMillisecond);
+
 BENCHMARK_MAIN();
@@ -19,7 +19,10 @@
 #include "doc/layer.h"
 #include "doc/palette.h"
 #include "doc/primitives.h"
+#include "doc/selected_layers.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <memory>
 
 using namespace doc;
@@ -265,8 +268,484 @@ TEST(Render, BugWithMultiplesOf3ZoomFactors)
   }
 }
 
+TEST(Render, VisibleLayers)
+{
+  std::shared_ptr<Document> doc = std::make_shared<Document>();
+  doc->sprites().add(Sprite::MakeStdSprite(ImageSpec(ColorMode::INDEXED, 2, 2)));
+  Sprite* sprite = doc->sprite();
+
+  LayerImage* layer1 = static_cast<LayerImage*>(sprite->root()->firstLayer());
+  LayerImage* layer2 = new LayerImage(sprite);
+  ImageRef image2(Image::create(IMAGE_INDEXED, 2, 2));
+  clear_image(image2.get(), 0);
+  layer2->addCel(new Cel(frame_t(0), image2));
+  sprite->root()->addLayer(layer2);
+
+  put_pixel(layer1->cel(0)->image(), 0, 0, 1);
+  put_pixel(image2.get(), 1, 1, 2);
+  layer2->setVisible(false);
+
+  std::unique_ptr<Image> dst(Image::create(IMAGE_INDEXED, 2, 2));
+  Render render;
+  render.renderSprite(dst.get(), sprite, frame_t(0));
+  EXPECT_2X2_PIXELS(dst.get(), 1, 0, 0, 0);
+
+  // Render just the hidden layer without changing its visibility
+  SelectedLayers visibleLayers;
+  visibleLayers.insert(layer2);
+  render.setVisibleLayers(&visibleLayers);
+  render.renderSprite(dst.get(), sprite, frame_t(0));
+  EXPECT_2X2_PIXELS(dst.get(), 0, 0, 0, 2);
+  EXPECT_TRUE(layer1->isVisible());
+  EXPECT_FALSE(layer2->isVisible());
+
+  render.setVisibleLayers(nullptr);
+  render.renderSprite(dst.get(), sprite, frame_t(0));
+  EXPECT_2X2_PIXELS(dst.get(), 1, 0, 0, 0);
+}
+
+TEST(Render, LayersCacheWithPreviewImage)
+{
+  const int w = 300, h = 200;
+  std::shared_ptr<Document> doc = std::make_shared<Document>();
+  doc->sprites().add(Sprite::MakeStdSprite(ImageSpec(ColorMode::RGB, w, h)));
+  Sprite* sprite = doc->sprite();
+
+  std::srand(1);
+  auto randomImage = [](Image* image) {
+    for (int y=0; y<image->height(); ++y)
+      for (int x=0; x<image->width(); ++x)
+        put_pixel(image, x, y, rgba(std::rand() % 256, std::rand() % 256,
+                                    std::rand() % 256, std::rand() % 256));
+  };
+
+  // Layer below, selected layer, and layer above
+  LayerImage* layers[3];
+  layers[0] = static_cast<LayerImage*>(sprite->root()->firstLayer());
+  for (int i=1; i<3; ++i) {
+    layers[i] = new LayerImage(sprite);
+    layers[i]->addCel(new Cel(frame_t(0), ImageRef(Image::create(IMAGE_RGB, w, h))));
+    sprite->root()->addLayer(layers[i]);
+  }
+  layers[2]->setBlendMode(BlendMode::MULTIPLY);
+  for (LayerImage* layer : layers)
+    randomImage(layer->cel(0)->image());
+
+  Image* selImage = layers[1]->cel(0)->image();
+  ImageRef preview(Image::createCopy(selImage));
+
+  Render render;
+  render.setBgType(BgType::CHECKED);
+  render.setBgCheckedSize(gfx::Size(8, 8));
+  render.setBgZoom(false);
+  render.setBgColor1(rgba(128, 128, 128, 255));
+  render.setBgColor2(rgba(64, 64, 64, 255));
+  render.setPreviewImage(layers[1], frame_t(0), preview.get(),
+                         gfx::Point(0, 0), BlendMode::NORMAL);
+
+  const gfx::Clip areas[] = { gfx::Clip(0, 0, 0, 0, w, h),
+                              gfx::Clip(0, 0, 10, 20, 280, 150),
+                              gfx::Clip(0, 0, 5, 5, 20, 20) };
+  for (int i=0; i<6; ++i) {
+    const gfx::Clip& area = areas[i % 3];
+
+    // Modify the preview image (drawing), and the layer below it
+    put_pixel(preview.get(), i, i, rgba(255, 0, 0, 128));
+    if (i == 4) {
+      Image* below = layers[0]->cel(0)->image();
+      put_pixel(below, 10, 20, rgba(0, 255, 0, 255));
+      below->incrementVersion();
+    }
+
+    std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, area.size.w, area.size.h));
+    render.renderSprite(dst.get(), sprite, frame_t(0), area);
+
+    // Render the same result without the preview/cache
+    copy_image(selImage, preview.get(), 0, 0);
+    std::unique_ptr<Image> expected(Image::create(IMAGE_RGB, area.size.w, area.size.h));
+    Render render2;
+    render2.setBgType(BgType::CHECKED);
+    render2.setBgCheckedSize(gfx::Size(8, 8));
+    render2.setBgZoom(false);
+    render2.setBgColor1(rgba(128, 128, 128, 255));
+    render2.setBgColor2(rgba(64, 64, 64, 255));
+    render2.renderSprite(expected.get(), sprite, frame_t(0), area);
+
+    EXPECT_EQ(0, count_diff_between_images(dst.get(), expected.get())) << " i=" << i;
+  }
+}
+
+TEST(Render, LayersCacheWithOnionskin)
+{
+  const int w = 64, h = 64;
+  std::shared_ptr<Document> doc = std::make_shared<Document>();
+  doc->sprites().add(Sprite::MakeStdSprite(ImageSpec(ColorMode::RGB, w, h)));
+  Sprite* sprite = doc->sprite();
+  sprite->setTotalFrames(frame_t(3));
+
+  std::srand(2);
+  LayerImage* layers[2];
+  layers[0] = static_cast<LayerImage*>(sprite->root()->firstLayer());
+  layers[1] = new LayerImage(sprite);
+  sprite->root()->addLayer(layers[1]);
+  for (LayerImage* layer : layers) {
+    for (frame_t frame=0; frame<3; ++frame) {
+      if (!layer->cel(frame))
+        layer->addCel(new Cel(frame, ImageRef(Image::create(IMAGE_RGB, w, h))));
+      Image* image = layer->cel(frame)->image();
+      for (int y=0; y<h; ++y)
+        for (int x=0; x<w; ++x)
+          put_pixel(image, x, y, rgba(std::rand() % 256, std::rand() % 256,
+                                      std::rand() % 256, std::rand() % 256));
+    }
+  }
+
+  Image* selImage = layers[1]->cel(1)->image();
+  ImageRef preview(Image::createCopy(selImage));
+
+  OnionskinOptions onionskin(OnionskinType::RED_BLUE_TINT);
+  onionskin.position(OnionskinPosition::BEHIND);
+  onionskin.prevFrames(1);
+  onionskin.nextFrames(1);
+  onionskin.opacityBase(128);
+  onionskin.opacityStep(0);
+
+  Render render;
+  render.setOnionskin(onionskin);
+  render.setPreviewImage(layers[1], frame_t(1), preview.get(),
+                         gfx::Point(0, 0), BlendMode::NORMAL);
+
+  for (int i=0; i<4; ++i) {
+    put_pixel(preview.get(), i, i, rgba(255, 0, 0, 128));
+
+    // Modify the onion skin frame
+    if (i == 2) {
+      Image* image = layers[1]->cel(2)->image();
+      put_pixel(image, 0, 0, rgba(0, 255, 0, 255));
+      image->incrementVersion();
+    }
+
+    std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, w, h));
+    render.renderSprite(dst.get(), sprite, frame_t(1));
+
+    copy_image(selImage, preview.get(), 0, 0);
+    std::unique_ptr<Image> expected(Image::create(IMAGE_RGB, w, h));
+    Render render2;
+    render2.setOnionskin(onionskin);
+    render2.renderSprite(expected.get(), sprite, frame_t(1));
+
+    EXPECT_EQ(0, count_diff_between_images(dst.get(), expected.get())) << " i=" << i;
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
 }
+
+TEST(Render, FastPreviewWithLayersAbove)
+{
+  const int w = 300, h = 200;
+  std::shared_ptr<Document> doc = std::make_shared<Document>();
+  doc->sprites().add(Sprite::MakeStdSprite(ImageSpec(ColorMode::RGB, w, h)));
+  Sprite* sprite = doc->sprite();
+
+  std::srand(2);
+  auto randomImage = [](Image* image) {
+    for (int y=0; y<image->height(); ++y)
+      for (int x=0; x<image->width(); ++x)
+        put_pixel(image, x, y, rgba(std::rand() % 256, std::rand() % 256,
+                                    std::rand() % 256, std::rand() % 256));
+  };
+
+  // Layer below, selected layer, and two normal layers above
+  LayerImage* layers[4];
+  layers[0] = static_cast<LayerImage*>(sprite->root()->firstLayer());
+  for (int i=1; i<4; ++i) {
+    layers[i] = new LayerImage(sprite);
+    layers[i]->addCel(new Cel(frame_t(0), ImageRef(Image::create(IMAGE_RGB, w, h))));
+    sprite->root()->addLayer(layers[i]);
+  }
+  for (LayerImage* layer : layers)
+    randomImage(layer->cel(0)->image());
+
+  Image* selImage = layers[1]->cel(0)->image();
+  ImageRef preview(Image::createCopy(selImage));
+
+  Render render;
+  render.setBgType(BgType::CHECKED);
+  render.setBgCheckedSize(gfx::Size(8, 8));
+  render.setBgZoom(false);
+  render.setBgColor1(rgba(128, 128, 128, 255));
+  render.setBgColor2(rgba(64, 64, 64, 255));
+  render.setPreviewImage(layers[1], frame_t(0), preview.get(),
+                         gfx::Point(0, 0), BlendMode::NORMAL);
+  render.setFastPreview(true);
+
+  const gfx::Clip areas[] = { gfx::Clip(0, 0, 0, 0, w, h),
+                              gfx::Clip(0, 0, 10, 20, 280, 150),
+                              gfx::Clip(0, 0, 5, 5, 20, 20) };
+  for (int i=0; i<6; ++i) {
+    const gfx::Clip& area = areas[i % 3];
+
+    // Modify the preview image (drawing), and the layer above it
+    put_pixel(preview.get(), i, i, rgba(255, 0, 0, 128));
+    if (i == 4) {
+      Image* above = layers[3]->cel(0)->image();
+      put_pixel(above, 10, 20, rgba(0, 255, 0, 255));
+      above->incrementVersion();
+    }
+
+    std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, area.size.w, area.size.h));
+    render.renderSprite(dst.get(), sprite, frame_t(0), area);
+
+    // Render the same result without the preview/cache
+    copy_image(selImage, preview.get(), 0, 0);
+    std::unique_ptr<Image> expected(Image::create(IMAGE_RGB, area.size.w, area.size.h));
+    Render render2;
+    render2.setBgType(BgType::CHECKED);
+    render2.setBgCheckedSize(gfx::Size(8, 8));
+    render2.setBgZoom(false);
+    render2.setBgColor1(rgba(128, 128, 128, 255));
+    render2.setBgColor2(rgba(64, 64, 64, 255));
+    render2.renderSprite(expected.get(), sprite, frame_t(0), area);
+
+    // Only rounding errors are expected
+    int maxDiff = 0;
+    for (int y=0; y<expected->height(); ++y)
+      for (int x=0; x<expected->width(); ++x) {
+        const color_t a = get_pixel(dst.get(), x, y);
+        const color_t b = get_pixel(expected.get(), x, y);
+        for (int shift=0; shift<32; shift+=8)
+          maxDiff = std::max(maxDiff, std::abs(int((a >> shift) & 255) -
+                                               int((b >> shift) & 255)));
+      }
+    EXPECT_GE(4, maxDiff) << " i=" << i;
+  }
+
+  // The modified pixel above must be visible
+  std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, w, h));
+  render.renderSprite(dst.get(), sprite, frame_t(0), gfx::Clip(0, 0, 0, 0, w, h));
+  EXPECT_EQ(rgba(0, 255, 0, 255), get_pixel(dst.get(), 10, 20));
+}
+
+TEST(Render, Mipmaps)
+{
+  const int w = 600, h = 520;
+  std::shared_ptr<Document> doc = std::make_shared<Document>();
+  doc->sprites().add(Sprite::MakeStdSprite(ImageSpec(ColorMode::RGB, w, h)));
+  Sprite* sprite = doc->sprite();
+  Image* image = sprite->root()->firstLayer()->cel(0)->image();
+
+  // Black and white columns (each 2x2 block averages to gray)
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(image, x, y, (x & 1) ? rgba(255, 255, 255, 255):
+                                       rgba(0, 0, 0, 255));
+
+  Render render;
+  render.setMipmaps(true);
+  render.setBgType(BgType::CHECKED);
+  render.setBgCheckedSize(gfx::Size(8, 8));
+  render.setBgZoom(false);
+  render.setBgColor1(rgba(128, 128, 128, 255));
+  render.setBgColor2(rgba(64, 64, 64, 255));
+
+  for (int level=1; level<=2; ++level) {
+    render.setProjection(Projection(PixelRatio(1, 1), Zoom(1, 1 << level)));
+    const int lw = w >> level, lh = h >> level;
+    std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, lw, lh));
+    render.renderSprite(dst.get(), sprite, frame_t(0),
+                        gfx::Clip(0, 0, 0, 0, lw, lh));
+    EXPECT_EQ(rgba(128, 128, 128, 255), get_pixel(dst.get(), 0, 0));
+    EXPECT_EQ(rgba(128, 128, 128, 255), get_pixel(dst.get(), lw-1, lh-1));
+  }
+
+  // A uniform color must be rendered as without mipmaps (including
+  // areas that don't start in the sprite origin)
+  clear_image(image, rgba(10, 200, 30, 255));
+  image->incrementVersion();
+
+  const gfx::Clip area(0, 0, 20, 10, 250, 240);
+  Render render2;
+  render2.setBgType(BgType::CHECKED);
+  render2.setBgCheckedSize(gfx::Size(8, 8));
+  render2.setBgZoom(false);
+  render2.setBgColor1(rgba(128, 128, 128, 255));
+  render2.setBgColor2(rgba(64, 64, 64, 255));
+
+  for (int level=1; level<=2; ++level) {
+    const Projection proj(PixelRatio(1, 1), Zoom(1, 1 << level));
+    render.setProjection(proj);
+    render2.setProjection(proj);
+
+    std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, area.size.w, area.size.h));
+    std::unique_ptr<Image> expected(Image::create(IMAGE_RGB, area.size.w, area.size.h));
+    render.renderSprite(dst.get(), sprite, frame_t(0), area);
+    render2.renderSprite(expected.get(), sprite, frame_t(0), area);
+    EXPECT_EQ(0, count_diff_between_images(dst.get(), expected.get()))
+      << " level=" << level;
+  }
+}
+
+TEST(Render, FilteredRefLayers)
+{
+  const int w = 600, h = 520;
+  std::shared_ptr<Document> doc = std::make_shared<Document>();
+  doc->sprites().add(Sprite::MakeStdSprite(ImageSpec(ColorMode::RGB, w, h)));
+  Sprite* sprite = doc->sprite();
+  Layer* layer = sprite->root()->firstLayer();
+  layer->setReference(true);
+  Image* image = layer->cel(0)->image();
+
+  // Black and white columns (each block of pixels averages to gray)
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(image, x, y, (x & 1) ? rgba(255, 255, 255, 255):
+                                       rgba(0, 0, 0, 255));
+
+  Render render;
+  render.setRefLayersVisiblity(true);
+  render.setFilteredRefLayers(true);
+  render.setThreads(4);             // Resample the image in threads
+
+  // 50% and 25% (each block has the same number of black and white
+  // pixels)
+  for (int level=1; level<=2; ++level) {
+    render.setProjection(Projection(PixelRatio(1, 1), Zoom(1, 1 << level)));
+    const int lw = w >> level, lh = h >> level;
+    std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, lw, lh));
+    clear_image(dst.get(), 0);
+    render.renderSprite(dst.get(), sprite, frame_t(0),
+                        gfx::Clip(0, 0, 0, 0, lw, lh));
+    EXPECT_EQ(rgba(128, 128, 128, 255), get_pixel(dst.get(), 0, 0));
+    EXPECT_EQ(rgba(128, 128, 128, 255), get_pixel(dst.get(), lw/2, lh/3));
+    EXPECT_EQ(rgba(128, 128, 128, 255), get_pixel(dst.get(), lw-1, lh-1));
+  }
+
+  // The filtered image is created again when the image changes
+  clear_image(image, rgba(10, 200, 30, 255));
+  image->incrementVersion();
+
+  const gfx::Clip area(0, 0, 20, 10, 100, 80);
+  Render render2;
+  render2.setRefLayersVisiblity(true);
+
+  for (int level=1; level<=2; ++level) {
+    const Projection proj(PixelRatio(1, 1), Zoom(1, 1 << level));
+    render.setProjection(proj);
+    render2.setProjection(proj);
+
+    std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, area.size.w, area.size.h));
+    std::unique_ptr<Image> expected(Image::create(IMAGE_RGB, area.size.w, area.size.h));
+    clear_image(dst.get(), 0);
+    clear_image(expected.get(), 0);
+    render.renderSprite(dst.get(), sprite, frame_t(0), area);
+    render2.renderSprite(expected.get(), sprite, frame_t(0), area);
+    EXPECT_EQ(0, count_diff_between_images(dst.get(), expected.get()))
+      << " level=" << level;
+  }
+}
+
+TEST(Render, CompositeImageInThreads)
+{
+  const int w = 701, h = 913;
+  std::unique_ptr<Image> src(Image::create(IMAGE_RGB, w, h));
+  std::unique_ptr<Image> dst1(Image::create(IMAGE_RGB, w+40, h+40));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(src.get(), x, y, rgba(x & 255, y & 255, (x*y) & 255, (x+y) & 255));
+  for (int y=0; y<dst1->height(); ++y)
+    for (int x=0; x<dst1->width(); ++x)
+      put_pixel(dst1.get(), x, y, rgba(y & 255, x & 255, 128, 255));
+  std::unique_ptr<Image> dst2(Image::createCopy(dst1.get()));
+
+  Palette pal(frame_t(0), 256);
+  composite_image(dst1.get(), src.get(), &pal, 30, -20, 200,
+                  BlendMode::MULTIPLY, 1);
+  composite_image(dst2.get(), src.get(), &pal, 30, -20, 200,
+                  BlendMode::MULTIPLY, 4);
+  EXPECT_EQ(0, count_diff_between_images(dst1.get(), dst2.get()));
+}
+
+// NORMAL blend mode with full opacity uses specialized loops, they
+// must give the same result as the general blender of each pixel.
+TEST(Render, CompositeNormalOpaque)
+{
+  const int w = 67, h = 31;
+  std::srand(1);
+
+  Palette pal(frame_t(0), 256);
+  for (int i=0; i<256; ++i)
+    pal.setEntry(i, rgba(std::rand() & 255, std::rand() & 255, std::rand() & 255,
+                         (i < 128 ? 255: std::rand() & 255)));
+
+  std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(dst.get(), x, y, rgba(std::rand() & 255, std::rand() & 255, std::rand() & 255,
+                                      (x < 10 ? 0: std::rand() & 255)));
+
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED }) {
+    std::unique_ptr<Image> src(Image::create(format, w, h));
+    for (int y=0; y<h; ++y) {
+      for (int x=0; x<w; ++x) {
+        // Runs of opaque, transparent, and semi-transparent pixels
+        const int a = ((x/4) % 3 == 0 ? 255: (x/4) % 3 == 1 ? 0: std::rand() & 255);
+        color_t c = 0;
+        switch (format) {
+          case IMAGE_RGB: c = rgba(std::rand() & 255, std::rand() & 255, std::rand() & 255, a); break;
+          case IMAGE_GRAYSCALE: c = graya(std::rand() & 255, a); break;
+          case IMAGE_INDEXED: c = std::rand() & 255; break;
+        }
+        put_pixel(src.get(), x, y, c);
+      }
+    }
+
+    std::unique_ptr<Image> result(Image::createCopy(dst.get()));
+    composite_image(result.get(), src.get(), &pal, 0, 0, 255,
+                    BlendMode::NORMAL, 1);
+
+    for (int y=0; y<h; ++y) {
+      for (int x=0; x<w; ++x) {
+        const color_t s = get_pixel(src.get(), x, y);
+        color_t expected = get_pixel(dst.get(), x, y);
+        if (s != src->maskColor()) {
+          color_t c = s;
+          if (format == IMAGE_GRAYSCALE)
+            c = rgba(graya_getv(s), graya_getv(s), graya_getv(s), graya_geta(s));
+          else if (format == IMAGE_INDEXED)
+            c = pal.getEntry(s);
+          expected = rgba_blender_normal(expected, c, 255);
+        }
+        ASSERT_EQ(expected, get_pixel(result.get(), x, y))
+          << "format=" << int(format) << " x=" << x << " y=" << y;
+      }
+    }
+  }
+
+  // Grayscale to grayscale
+  std::unique_ptr<Image> graySrc(Image::create(IMAGE_GRAYSCALE, w, h));
+  std::unique_ptr<Image> grayDst(Image::create(IMAGE_GRAYSCALE, w, h));
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      put_pixel(graySrc.get(), x, y, graya(std::rand() & 255, (x & 1 ? 255: std::rand() & 255)));
+      put_pixel(grayDst.get(), x, y, graya(std::rand() & 255, std::rand() & 255));
+    }
+  }
+  std::unique_ptr<Image> grayResult(Image::createCopy(grayDst.get()));
+  composite_image(grayResult.get(), graySrc.get(), &pal, 0, 0, 255,
+                  BlendMode::NORMAL, 1);
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      const color_t s = get_pixel(graySrc.get(), x, y);
+      const color_t expected =
+        (s != graySrc->maskColor() ?
+         graya_blender_normal(get_pixel(grayDst.get(), x, y), s, 255):
+         get_pixel(grayDst.get(), x, y));
+      ASSERT_EQ(expected, get_pixel(grayResult.get(), x, y))
+        << "x=" << x << " y=" << y;
+    }
+  }
+}
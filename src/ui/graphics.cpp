@@ -27,11 +27,15 @@
 #include "os/window.h"
 #include "ui/manager.h"
 #include "ui/scale.h"
+#include "ui/system.h"
 #include "ui/theme.h"
 
 #include <algorithm>
 #include <cctype>
+#include <list>
+#include <map>
 #include <string>
+#include <tuple>
 
 namespace ui {
 
@@ -119,6 +123,7 @@ void Graphics::setDrawMode(DrawMode mode, int param,
                            const gfx::Color a,
                            const gfx::Color b)
 {
+  m_drawMode = mode;
   switch (mode) {
     case DrawMode::Solid:
       m_surface->setDrawMode(os::DrawMode::Solid);
@@ -367,6 +372,9 @@ void Graphics::drawText(const std::string& str,
                         const gfx::Point& origPt,
                         os::DrawTextDelegate* delegate)
 {
+  if (!delegate && drawCachedText(str, fg, bg, origPt, 0))
+    return;
+
   gfx::Point pt(m_dx+origPt.x, m_dy+origPt.y);
 
   os::SurfaceLock lock(m_surface.get());
@@ -439,11 +447,56 @@ private:
   gfx::Rect m_bounds;
 };
 
+// Text runs are cached to avoid shaping/rasterizing the same labels
+// on each paint. Longer strings (e.g. multi-line texts) are not
+// cached.
+const std::size_t kMaxTextRunLength = 256;
+const std::size_t kMaxTextRunsBytes = 8*1024*1024;
+const std::size_t kMaxTextWidths = 4096;
+
+struct TextRunKey {
+  os::Font* font;
+  int fontHeight;
+  std::string text;
+  gfx::Color fg;
+  gfx::Color bg;
+  int mnemonic;
+
+  bool operator<(const TextRunKey& o) const {
+    return
+      std::tie(font, fontHeight, text, fg, bg, mnemonic) <
+      std::tie(o.font, o.fontHeight, o.text, o.fg, o.bg, o.mnemonic);
+  }
+};
+
+struct TextRun {
+  TextRunKey key;
+  os::SurfaceRef surface;
+  gfx::Point origin;            // Where the text was drawn in the surface
+  gfx::Rect bounds;             // Painted area of the surface
+};
+
+typedef std::tuple<os::Font*, int, std::string> TextWidthKey;
+
+// Used from the UI thread only
+std::list<TextRun> text_runs;   // Most recently used first
+std::map<TextRunKey, std::list<TextRun>::iterator> text_runs_map;
+std::size_t text_runs_bytes = 0;
+std::map<TextWidthKey, int> text_widths;
+
+bool can_cache_text(const std::string& str)
+{
+  return (str.size() <= kMaxTextRunLength && is_ui_thread());
+}
+
 }
 
 void Graphics::drawUIText(const std::string& str, gfx::Color fg, gfx::Color bg,
                           const gfx::Point& pt, const int mnemonic)
 {
+  if (drawCachedText(str, fg, bg, pt, mnemonic))
+    return;
+
   os::SurfaceLock lock(m_surface.get());
   int x = m_dx+pt.x;
   int y = m_dy+pt.y;
@@ -471,11 +524,110 @@ gfx::Size Graphics::measureUIText(const std::string& str)
 // static
 int Graphics::measureUITextLength(const std::string& str, os::Font* font)
 {
+  const bool cache = can_cache_text(str);
+  TextWidthKey key;
+  if (cache) {
+    key = TextWidthKey(font, font->height(), str);
+    auto it = text_widths.find(key);
+    if (it != text_widths.end())
+      return it->second;
+  }
+
   DrawUITextDelegate delegate(nullptr, font, 0);
   os::draw_text(nullptr, font, str,
                 gfx::ColorNone, gfx::ColorNone, 0, 0,
                 &delegate);
-  return delegate.bounds().w;
+  const int width = delegate.bounds().w;
+
+  if (cache) {
+    if (text_widths.size() >= kMaxTextWidths)
+      text_widths.clear();
+    text_widths[key] = width;
+  }
+  return width;
+}
+
+// static
+void Graphics::clearTextCache()
+{
+  text_runs_map.clear();
+  text_runs.clear();
+  text_runs_bytes = 0;
+  text_widths.clear();
+}
+
+// The run is rendered once in an RGBA surface and then blended on
+// each paint. Only text with an opaque background is cached, so the
+// antialiased edges of the glyphs are the same as if they were drawn
+// directly in the destination surface.
+bool Graphics::drawCachedText(const std::string& str, gfx::Color fg, gfx::Color bg,
+                              const gfx::Point& pt, const int mnemonic)
+{
+  if (m_drawMode != DrawMode::Solid ||
+      gfx::geta(bg) < 255 ||
+      !m_font ||
+      !can_cache_text(str))
+    return false;
+
+  os::Font* font = m_font.get();
+  TextRunKey key{ font, font->height(), str, fg, bg, mnemonic };
+  TextRun* run;
+
+  auto it = text_runs_map.find(key);
+  if (it != text_runs_map.end()) {
+    // Move to the front (most recently used)
+    text_runs.splice(text_runs.begin(), text_runs, it->second);
+    run = &text_runs.front();
+  }
+  else {
+    DrawUITextDelegate measure(nullptr, font, 0);
+    os::draw_text(nullptr, font, str,
+                  gfx::ColorNone, gfx::ColorNone, 0, 0,
+                  &measure);
+
+    // Extra space for glyphs/underscore outside the measured bounds
+    const int pad = font->height();
+    const gfx::Rect rc = measure.bounds();
+    const int w = std::max(rc.x2(), 0) + 2*pad;
+    const int h = std::max(rc.y2(), font->height()) + 2*pad;
+
+    TextRun newRun;
+    newRun.key = key;
+    newRun.surface = os::instance()->makeRgbaSurface(w, h);
+    newRun.origin = gfx::Point(pad, pad);
+    {
+      os::Surface* surface = newRun.surface.get();
+      os::SurfaceLock lock(surface);
+      surface->clear();
+
+      DrawUITextDelegate delegate(surface, font, mnemonic);
+      os::draw_text(surface, font, str, fg, bg, pad, pad, &delegate);
+      newRun.bounds = delegate.bounds() & gfx::Rect(0, 0, w, h);
+    }
+
+    text_runs.push_front(std::move(newRun));
+    text_runs_map[key] = text_runs.begin();
+    text_runs_bytes += std::size_t(w) * h * 4;
+
+    // Remove the least recently used runs
+    while (text_runs_bytes > kMaxTextRunsBytes && text_runs.size() > 1) {
+      const TextRun& last = text_runs.back();
+      text_runs_bytes -= std::size_t(last.surface->width()) * last.surface->height() * 4;
+      text_runs_map.erase(last.key);
+      text_runs.pop_back();
+    }
+    run = &text_runs.front();
+  }
+
+  const gfx::Rect& rc = run->bounds;
+  if (!rc.isEmpty()) {
+    drawRgbaSurface(run->surface.get(),
+                    rc.x, rc.y,
+                    pt.x + rc.x - run->origin.x,
+                    pt.y + rc.y - run->origin.y,
+                    rc.w, rc.h);
+  }
+  return true;
 }
 
 gfx::Size Graphics::fitString(const std::string& str, int maxWidth, int align)
@@ -128,7 +128,13 @@ namespace ui {
     static int measureUITextLength(const std::string& str, os::Font* font);
     gfx::Size fitString(const std::string& str, int maxWidth, int align);
 
+    // Removes all the measured/rendered text runs (e.g. when the theme
+    // or the UI scale changes and fonts are recreated).
+    static void clearTextCache();
+
   private:
+    bool drawCachedText(const std::string& str, gfx::Color fg, gfx::Color bg,
+                        const gfx::Point& pt, const int mnemonic);
     gfx::Size doUIStringAlgorithm(const std::string& str, gfx::Color fg, gfx::Color bg, const gfx::Rect& rc, int align, bool draw);
     void dirty(const gfx::Rect& bounds);
 
@@ -138,6 +144,7 @@ namespace ui {
     gfx::Rect m_clipBounds;
     os::FontRef m_font;
     gfx::Rect m_dirtyBounds;
+    DrawMode m_drawMode = DrawMode::Solid;
   };
 
   // Class to draw directly in the screen.
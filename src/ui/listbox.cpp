@@ -1,5 +1,5 @@
 // Aseprite UI Library
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -13,6 +13,7 @@
 
 #include "base/clamp.h"
 #include "base/fs.h"
+#include "base/scoped_value.h"
 #include "ui/listitem.h"
 #include "ui/message.h"
 #include "ui/resize_event.h"
@@ -37,6 +38,10 @@ ListBox::ListBox()
   , m_multiselect(false)
   , m_firstSelectedIndex(-1)
   , m_lastSelectedIndex(-1)
+  , m_virtualized(false)
+  , m_realizing(false)
+  , m_firstRealized(0)
+  , m_lastRealized(0)
 {
   setFocusStop(true);
   initTheme();
@@ -47,6 +52,15 @@ void ListBox::setMultiselect(const bool multiselect)
   m_multiselect = multiselect;
 }
 
+void ListBox::setVirtualized(const bool virtualized)
+{
+  if (m_virtualized != virtualized) {
+    m_virtualized = virtualized;
+    m_rows.clear();
+    m_firstRealized = m_lastRealized = 0;
+  }
+}
+
 Widget* ListBox::getSelectedChild()
 {
   for (auto child : children())
@@ -170,12 +184,12 @@ void ListBox::makeChildVisible(Widget* child)
 
   gfx::Point scroll = view->viewScroll();
   gfx::Rect vp = view->viewportBounds();
+  gfx::Rect rc = childBounds(child);
 
-  if (child->bounds().y < vp.y)
-    scroll.y = child->bounds().y - bounds().y;
-  else if (child->bounds().y > vp.y + vp.h - child->bounds().h)
-    scroll.y = (child->bounds().y - bounds().y
-                - vp.h + child->bounds().h);
+  if (rc.y < vp.y)
+    scroll.y = rc.y - bounds().y;
+  else if (rc.y > vp.y + vp.h - rc.h)
+    scroll.y = (rc.y - bounds().y - vp.h + rc.h);
 
   view->setViewScroll(scroll);
 }
@@ -189,9 +203,10 @@ void ListBox::centerScroll()
   if (view && item) {
     gfx::Rect vp = view->viewportBounds();
     gfx::Point scroll = view->viewScroll();
+    gfx::Rect rc = childBounds(item);
 
-    scroll.y = ((item->bounds().y - bounds().y)
-                - vp.h/2 + item->bounds().h/2);
+    scroll.y = ((rc.y - bounds().y)
+                - vp.h/2 + rc.h/2);
 
     view->setViewScroll(scroll);
   }
@@ -381,6 +396,29 @@ void ListBox::onResize(ResizeEvent& ev)
 
   Rect cpos = childrenBounds();
 
+  // Calculate the bounds of all items, but lay out only the visible
+  // ones
+  if (m_virtualized) {
+    const int rowHeight = onRowHeight();
+    int i = 0;
+
+    m_rows.resize(children().size());
+    for (auto child : children()) {
+      if (child->hasFlags(HIDDEN))
+        cpos.h = 0;
+      else
+        cpos.h = childSizeHint(child, rowHeight).h;
+
+      m_rows[i++] = Rect(cpos).offset(-bounds().x, -bounds().y);
+
+      if (!child->hasFlags(HIDDEN))
+        cpos.y += cpos.h + childSpacing();
+    }
+
+    updateRealizedRows(true);
+    return;
+  }
+
   for (auto child : children()) {
     if (child->hasFlags(HIDDEN))
       continue;
@@ -394,6 +432,7 @@ void ListBox::onResize(ResizeEvent& ev)
 
 void ListBox::onSizeHint(SizeHintEvent& ev)
 {
+  const int rowHeight = (m_virtualized ? onRowHeight(): 0);
   int w = 0, h = 0;
   int visibles = 0;
 
@@ -401,7 +440,7 @@ void ListBox::onSizeHint(SizeHintEvent& ev)
     if (child->hasFlags(HIDDEN))
       continue;
 
-    Size reqSize = child->sizeHint();
+    Size reqSize = childSizeHint(child, rowHeight);
 
     w = std::max(w, reqSize.w);
     h += reqSize.h;
@@ -416,6 +455,16 @@ void ListBox::onSizeHint(SizeHintEvent& ev)
   ev.setSizeHint(Size(w, h));
 }
 
+void ListBox::onInvalidateRegion(const gfx::Region& region)
+{
+  // Lay out the items that become visible when the view is scrolled
+  // (View::onSetViewScroll() invalidates the new visible area)
+  if (m_virtualized && !m_realizing)
+    updateRealizedRows(false);
+
+  Widget::onInvalidateRegion(region);
+}
+
 void ListBox::onChange()
 {
   Change();
@@ -471,4 +520,87 @@ int ListBox::advanceIndexThroughVisibleItems(
   return lastVisibleIndex;
 }
 
+gfx::Size ListBox::childSizeHint(Widget* child, const int rowHeight)
+{
+  if (rowHeight > 0 && child->type() == kListItemWidget)
+    return gfx::Size(0, rowHeight);
+  else
+    return child->sizeHint();
+}
+
+gfx::Rect ListBox::childBounds(Widget* child)
+{
+  if (m_virtualized) {
+    const int i = getChildIndex(child);
+    if (i >= 0 && i < int(m_rows.size()))
+      return gfx::Rect(m_rows[i]).offset(bounds().origin());
+  }
+  return child->bounds();
+}
+
+// Gives the real bounds to the items that intersect the visible area
+// of the view, and collapses the items that are not visible anymore.
+// If relayout is true, all visible items are laid out again (their
+// bounds were recalculated).
+void ListBox::updateRealizedRows(const bool relayout)
+{
+  const WidgetsList& children = this->children();
+  const int n = int(children.size());
+
+  // Not laid out yet
+  if (int(m_rows.size()) != n)
+    return;
+
+  base::ScopedValue<bool> realizing(m_realizing, true, false);
+
+  int first = 0;
+  int last = n;
+  if (View* view = View::getView(this)) {
+    gfx::Rect vp = view->viewportBounds();
+    vp.offset(-bounds().x, -bounds().y);
+
+    // Rows are sorted by their y position
+    first = std::lower_bound(
+      m_rows.begin(), m_rows.end(), vp.y,
+      [](const gfx::Rect& rc, const int y){ return rc.y2() <= y; }) - m_rows.begin();
+    last = std::lower_bound(
+      m_rows.begin()+first, m_rows.end(), vp.y2(),
+      [](const gfx::Rect& rc, const int y){ return rc.y < y; }) - m_rows.begin();
+  }
+
+  if (!relayout &&
+      first == m_firstRealized &&
+      last == m_lastRealized)
+    return;
+
+  // Items can be sorted/removed before a relayout, so in that case
+  // we check all items to collapse the ones outside the visible area
+  int begin = 0;
+  int end = n;
+  if (!relayout) {
+    begin = std::min(first, m_firstRealized);
+    end = std::min(n, std::max(last, m_lastRealized));
+  }
+
+  const gfx::Point origin = bounds().origin();
+  for (int i=begin; i<end; ++i) {
+    Widget* child = children[i];
+    if (child->hasFlags(HIDDEN))
+      continue;
+
+    if (i >= first && i < last) {
+      if (relayout || i < m_firstRealized || i >= m_lastRealized)
+        child->setBounds(gfx::Rect(m_rows[i]).offset(origin));
+    }
+    else if (child->bounds().h > 0) {
+      gfx::Rect rc = gfx::Rect(m_rows[i]).offset(origin);
+      rc.h = 0;
+      child->setBounds(rc);
+    }
+  }
+
+  m_firstRealized = first;
+  m_lastRealized = last;
+}
+
 } // namespace ui
@@ -1,5 +1,5 @@
 // Aseprite UI Library
-// Copyright (C) 2020  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -9,6 +9,8 @@
 #define UI_LISTBOX_H_INCLUDED
 #pragma once
 
+#include "gfx/rect.h"
+#include "gfx/size.h"
 #include "obs/signal.h"
 #include "ui/widget.h"
 
@@ -25,6 +27,13 @@ namespace ui {
     bool isMultiselect() const { return m_multiselect; }
     void setMultiselect(const bool multiselect);
 
+    // Virtualized lists only lay out the items that are inside the
+    // visible area of the View, the rest of items are collapsed (zero
+    // height) so they are not painted, invalidated, or picked. Useful
+    // for lists with thousands of items (e.g. keyboard shortcuts).
+    bool isVirtualized() const { return m_virtualized; }
+    void setVirtualized(const bool virtualized);
+
     Widget* getSelectedChild();
     int getSelectedIndex();
 
@@ -46,9 +55,16 @@ namespace ui {
     virtual void onPaint(PaintEvent& ev) override;
     virtual void onResize(ResizeEvent& ev) override;
     virtual void onSizeHint(SizeHintEvent& ev) override;
+    virtual void onInvalidateRegion(const gfx::Region& region) override;
     virtual void onChange();
     virtual void onDoubleClickItem();
 
+    // Height of each ListItem in virtualized lists where all items
+    // have the same height, so the size hint of each item is not
+    // needed (and the list width is the viewport width). Returns 0
+    // by default (each item uses its own size hint).
+    virtual int onRowHeight() { return 0; }
+
     int getChildIndex(Widget* item);
     Widget* getChildByIndex(int index);
 
@@ -69,6 +85,21 @@ namespace ui {
     // items in case that the user is Ctrl+clicking items several
     // items at the same time.
     std::vector<bool> m_states;
+
+  private:
+    gfx::Size childSizeHint(Widget* child, const int rowHeight);
+    gfx::Rect childBounds(Widget* child);
+    void updateRealizedRows(const bool relayout);
+
+    bool m_virtualized;
+    bool m_realizing;
+
+    // Bounds of each child relative to the list origin (only for
+    // virtualized lists), and range of children [first, last) that
+    // are laid out with their real bounds.
+    std::vector<gfx::Rect> m_rows;
+    int m_firstRealized;
+    int m_lastRealized;
   };
 
 } // namespace ui
@@ -18,6 +18,7 @@
 
 #include "ui/manager.h"
 
+#include "base/chrono.h"
 #include "base/clamp.h"
 #include "base/concurrent_queue.h"
 #include "base/scoped_value.h"
@@ -67,6 +68,23 @@ enum class RedrawState {
 };
 RedrawState redrawState = RedrawState::Normal;
 
+// Minimum time between two painted frames in milliseconds (~60fps).
+// Invalidations that happen before the next frame (e.g. timers,
+// mouse hover, status bar updates) are accumulated and painted
+// together.
+const base::tick_t kFrameInterval = 16;
+
+base::tick_t last_frame_tick = 0; // When the last frame was painted
+bool paint_pending = false;       // A paced paint is waiting the next frame
+Manager::FrameStats frame_stats;
+
+// Milliseconds until the next frame can be painted
+base::tick_t time_to_next_frame()
+{
+  const base::tick_t elapsed = base::current_tick() - last_frame_tick;
+  return (elapsed < kFrameInterval ? kFrameInterval - elapsed: 0);
+}
+
 } // anonymous namespace
 
 static const int NFILTERS = (int)(kFirstRegisteredMessage+1);
@@ -310,7 +328,9 @@ bool Manager::generateMessages()
   // Returns true if we have to dispatch messages (if the redraw was
   // delayed, we have to pump messages because there is where paint
   // messages are flushed)
-  if (!msg_queue.empty() || redrawState != RedrawState::Normal)
+  if (!msg_queue.empty() ||
+      redrawState != RedrawState::Normal ||
+      (paint_pending && time_to_next_frame() == 0))
     return true;
   else
     return false;
@@ -365,6 +385,15 @@ void Manager::generateMessagesFromOSEvents()
     if (msg_queue.empty() && redrawState == RedrawState::Normal) {
       if (!Timer::getNextTimeout(timeout))
         timeout = os::EventQueue::kWithoutTimeout;
+
+      // Wake up to paint the next frame
+      if (paint_pending) {
+        const double frameTimeout = time_to_next_frame() / 1000.0;
+        if (timeout == os::EventQueue::kWithoutTimeout)
+          timeout = frameTimeout;
+        else
+          timeout = std::min(timeout, frameTimeout);
+      }
     }
 
     if (timeout == os::EventQueue::kWithoutTimeout && used_msg_queue.empty())
@@ -664,7 +693,7 @@ void Manager::handleWindowZOrder()
       win_manager->insertChild(pos, window);
     }
 
-    window->invalidate();
+    window->exposeRegion(gfx::Region(window->bounds()));
   }
 
   // Put the focus
@@ -699,13 +728,15 @@ void Manager::updateMouseWidgets(const gfx::Point& mousePos)
   }
 }
 
-void Manager::dispatchMessages()
+void Manager::dispatchMessages(const bool pacePaint)
 {
   // Send messages in the queue (mouse/key/timer/etc. events) This
   // might change the state of widgets, etc. In case pumpQueue()
   // returns a number greater than 0, it means that we've processed
   // some messages, so we've to redraw the screen.
-  if (pumpQueue() > 0 || redrawState == RedrawState::RedrawDelayed) {
+  if (pumpQueue() > 0 ||
+      redrawState == RedrawState::RedrawDelayed ||
+      paint_pending) {
     if (redrawState == RedrawState::ClosingApp) {
       // Do nothing, we don't flush nor process paint messages
     }
@@ -716,20 +747,49 @@ void Manager::dispatchMessages()
     else if (redrawState == RedrawState::AWindowHasJustBeenClosed) {
       redrawState = RedrawState::RedrawDelayed;
     }
+    // Wait the next frame, the DIRTY flags and m_dirtyRegion are
+    // accumulated until then.
+    else if (pacePaint &&
+             redrawState == RedrawState::Normal &&
+             time_to_next_frame() > 0) {
+      paint_pending = true;
+      ++frame_stats.deferredPaints;
+    }
     else {
       if (redrawState == RedrawState::RedrawDelayed)
         redrawState = RedrawState::Normal;
 
+      base::Chrono chrono;
+      last_frame_tick = base::current_tick();
+      paint_pending = false;
+
       // Generate and send just kPaintMessages with the latest UI state.
       flushRedraw();
       pumpQueue();
 
       // Flip the back-buffer to the real display.
       flipDisplay();
+
+      const double paintTime = chrono.elapsed();
+      ++frame_stats.frames;
+      frame_stats.paintTime += paintTime;
+      frame_stats.maxPaintTime = std::max(frame_stats.maxPaintTime, paintTime);
     }
   }
 }
 
+// static
+const Manager::FrameStats& Manager::frameStats()
+{
+  return frame_stats;
+}
+
+// static
+void Manager::resetFrameStats()
+{
+  frame_stats = FrameStats();
+}
+
 void Manager::addToGarbage(Widget* widget)
 {
   ASSERT(widget);
@@ -1187,7 +1247,7 @@ void Manager::_closeWindow(Window* window, bool redraw_background)
   removeChild(window);
 
   // Redraw background.
-  invalidateRegion(reg1);
+  exposeRegion(reg1);
 
   // Update mouse widget (as it can be a widget below the
   // recently closed window).
@@ -1535,6 +1595,7 @@ bool Manager::sendMessageToWidget(Message* msg, Widget* widget)
       return false;
 
     PaintMessage* paintMsg = static_cast<PaintMessage*>(msg);
+    ++frame_stats.paintMessages;
 
     // Restore overlays in the region that we're going to paint.
     OverlayManager::instance()->restoreOverlappedAreas(paintMsg->rect());
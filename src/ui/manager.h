@@ -29,6 +29,16 @@ namespace ui {
 
   class Manager : public Widget {
   public:
+    // Statistics of the painted frames (see dispatchMessages()),
+    // used to measure the UI responsiveness.
+    struct FrameStats {
+      int frames = 0;              // Number of painted frames
+      int deferredPaints = 0;      // Paints accumulated for the next frame
+      int paintMessages = 0;       // kPaintMessages sent to widgets
+      double paintTime = 0.0;      // Total time painting frames (seconds)
+      double maxPaintTime = 0.0;   // Slowest frame (seconds)
+    };
+
     static Manager* getDefault() { return m_defaultManager; }
     static bool widgetAssociatedToManager(Widget* widget);
 
@@ -53,7 +63,15 @@ namespace ui {
     // Returns true if there are messages in the queue to be
     // dispatched through dispatchMessages().
     bool generateMessages();
-    void dispatchMessages();
+
+    // Dispatches the queued messages and paints the dirty widgets.
+    // If "pacePaint" is true, the paint is done at most once per
+    // display frame (each kFrameInterval), so all the widgets and
+    // regions invalidated before the next frame are painted together.
+    void dispatchMessages(const bool pacePaint = false);
+
+    static const FrameStats& frameStats();
+    static void resetFrameStats();
 
     void addToGarbage(Widget* widget);
     void collectGarbage();
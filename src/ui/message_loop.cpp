@@ -1,5 +1,5 @@
 // Aseprite UI Library
-// Copyright (C) 2021  Igara Studio S.A.
+// Copyright (C) 2021-2022  Igara Studio S.A.
 // Copyright (C) 2001-2013  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -23,7 +23,7 @@ MessageLoop::MessageLoop(Manager* manager)
 void MessageLoop::pumpMessages()
 {
   if (m_manager->generateMessages())
-    m_manager->dispatchMessages();
+    m_manager->dispatchMessages(true);
 }
 
 } // namespace ui
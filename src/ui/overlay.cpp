@@ -1,5 +1,5 @@
 // Aseprite UI Library
-// Copyright (C) 2018  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -35,9 +35,9 @@ Overlay::~Overlay()
   if (m_surface) {
     Manager* manager = Manager::getDefault();
     if (manager)
-      manager->invalidateRect(gfx::Rect(m_pos.x, m_pos.y,
-                                        m_surface->width(),
-                                        m_surface->height()));
+      manager->exposeRegion(gfx::Region(gfx::Rect(m_pos.x, m_pos.y,
+                                                  m_surface->width(),
+                                                  m_surface->height())));
     m_surface.reset();
   }
 
@@ -1,5 +1,5 @@
 // Aseprite UI Library
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -696,6 +696,9 @@ void set_theme(Theme* theme, const int uiscale)
   current_ui_scale = uiscale;
 
   if (theme) {
+    // Fonts are recreated with the theme
+    Graphics::clearTextCache();
+
     theme->regenerateTheme();
 
     current_theme = theme;
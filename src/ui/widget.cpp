@@ -15,6 +15,7 @@
 
 #include "base/clamp.h"
 #include "base/memory.h"
+#include "base/scoped_value.h"
 #include "base/string.h"
 #include "base/utf8_decode.h"
 #include "os/font.h"
@@ -51,6 +52,10 @@ namespace ui {
 
 using namespace gfx;
 
+// True while a region is being invalidated from exposeRegion(), so the
+// paint caches of the widgets are kept.
+static bool exposing_region = false;
+
 WidgetType register_widget_type()
 {
   static int type = (int)kFirstUserWidget;
@@ -72,6 +77,7 @@ Widget::Widget(WidgetType type)
   , m_maxSize(std::numeric_limits<int>::max(),
               std::numeric_limits<int>::max())
   , m_childSpacing(0)
+  , m_usePaintCache(false)
 {
   details::addWidget(this);
 }
@@ -117,6 +123,10 @@ void Widget::deferDelete()
 
 void Widget::initTheme()
 {
+  // The theme (or the UI scale) changed, so the cached pixels are not
+  // valid anymore
+  m_paintCache.reset();
+
   InitThemeEvent ev(this, m_theme);
   onInitTheme(ev);
 }
@@ -710,7 +720,10 @@ void Widget::setBoundsQuietly(const gfx::Rect& rc)
   // TODO Test moving this inside the if (m_bounds != rc) { ... }
   // block, so the widget is invalidted only when the bounds are
   // really changed.
-  invalidate();
+  //
+  // The paint cache is recreated if the size changes, so we can
+  // use exposeRegion() here.
+  exposeRegion(Region(bounds()));
 }
 
 void Widget::setBorder(const Border& br)
@@ -1125,6 +1138,36 @@ bool Widget::paintEvent(Graphics* graphics,
   return ev.isPainted();
 }
 
+// Paints the given rectangle (in client coordinates) copying the
+// pixels from the paint cache, and calls onPaint() only for the
+// invalid parts of the cache.
+void Widget::paintFromCache(Graphics* graphics,
+                            const gfx::Rect& rc)
+{
+  if (!m_paintCache ||
+      m_paintCache->width() != m_bounds.w ||
+      m_paintCache->height() != m_bounds.h) {
+    m_paintCache = os::instance()->makeSurface(m_bounds.w, m_bounds.h);
+    m_paintCacheInvalid = Region(clientBounds());
+  }
+
+  Region rgn(rc);
+  rgn.createIntersection(rgn, m_paintCacheInvalid);
+  if (!rgn.isEmpty()) {
+    Graphics cacheGraphics(m_paintCache, 0, 0);
+    cacheGraphics.setFont(AddRef(font()));
+
+    for (const gfx::Rect& rc2 : rgn) {
+      IntersectClip clip(&cacheGraphics, rc2);
+      PaintEvent ev(this, &cacheGraphics);
+      onPaint(ev);
+    }
+    m_paintCacheInvalid.createSubtraction(m_paintCacheInvalid, rgn);
+  }
+
+  graphics->drawSurface(m_paintCache.get(), rc, rc);
+}
+
 bool Widget::isDoubleBuffered() const
 {
   return hasFlags(DOUBLE_BUFFERED);
@@ -1145,11 +1188,20 @@ void Widget::setTransparent(bool transparent)
   enableFlags(TRANSPARENT);
 }
 
+void Widget::setPaintCache(const bool state)
+{
+  m_usePaintCache = state;
+  if (!state)
+    m_paintCache.reset();
+}
+
 void Widget::invalidate()
 {
   assert_ui_thread();
   if (!hasFlags(HIDDEN))        // Quick filter for hidden widgets
     onInvalidateRegion(Region(bounds()));
+  else if (!exposing_region)
+    m_paintCache.reset();
 }
 
 void Widget::invalidateRect(const gfx::Rect& rect)
@@ -1157,6 +1209,8 @@ void Widget::invalidateRect(const gfx::Rect& rect)
   assert_ui_thread();
   if (!hasFlags(HIDDEN))        // Quick filter for hidden widgets
     onInvalidateRegion(Region(rect));
+  else if (!exposing_region)
+    m_paintCache.reset();
 }
 
 void Widget::invalidateRegion(const Region& region)
@@ -1164,6 +1218,14 @@ void Widget::invalidateRegion(const Region& region)
   assert_ui_thread();
   if (!hasFlags(HIDDEN))        // Quick filter for hidden widgets
     onInvalidateRegion(region);
+  else if (!exposing_region)
+    m_paintCache.reset();
+}
+
+void Widget::exposeRegion(const Region& region)
+{
+  base::ScopedValue<bool> expose(exposing_region, true, exposing_region);
+  invalidateRegion(region);
 }
 
 class DeleteGraphicsAndSurface {
@@ -1448,6 +1510,10 @@ bool Widget::onProcessMessage(Message* msg)
       ASSERT(ptmsg->rect().h > 0);
 
       GraphicsPtr graphics = getGraphics(toClient(ptmsg->rect()));
+      if (m_usePaintCache && !isTransparent()) {
+        paintFromCache(graphics.get(), toClient(ptmsg->rect()));
+        return true;
+      }
       return paintEvent(graphics.get(), false);
     }
 
@@ -1509,6 +1575,18 @@ bool Widget::onProcessMessage(Message* msg)
 
 void Widget::onInvalidateRegion(const Region& region)
 {
+  // The content of the widget has changed
+  if (m_paintCache && !exposing_region) {
+    if (isVisible()) {
+      Region rgn(region);
+      rgn.offset(-m_bounds.x, -m_bounds.y);
+      rgn.createIntersection(rgn, Region(clientBounds()));
+      m_paintCacheInvalid.createUnion(m_paintCacheInvalid, rgn);
+    }
+    else
+      m_paintCache.reset();
+  }
+
   if (!isVisible() || region.contains(bounds()) == Region::Out)
     return;
 
@@ -296,10 +296,25 @@ namespace ui {
     bool isTransparent() const;
     void setTransparent(bool transparent);
 
+    // Keeps the result of onPaint() in an offscreen surface, so the
+    // widget is painted again only when it (or one of its parents)
+    // is invalidated, or when the theme changes. Other repaints (e.g.
+    // when a window/menu/tooltip that was above it is closed) just
+    // copy the cached pixels. Only for opaque widgets that paint all
+    // their pixels and invalidate themselves each time their state
+    // changes.
+    bool usePaintCache() const { return m_usePaintCache; }
+    void setPaintCache(const bool state);
+
     void invalidate();
     void invalidateRect(const gfx::Rect& rect);
     void invalidateRegion(const gfx::Region& region);
 
+    // Like invalidateRegion() but the content of the widgets didn't
+    // change (e.g. the region was just exposed by a window that was
+    // moved/closed), so the paint caches are still valid.
+    void exposeRegion(const gfx::Region& region);
+
     // Returns the region to generate PaintMessages. It's cleared
     // after flushRedraw() is called.
     const gfx::Region& getUpdateRegion() const {
@@ -398,6 +413,8 @@ namespace ui {
                const bool isBg);
     bool paintEvent(Graphics* graphics,
                     const bool isBg);
+    void paintFromCache(Graphics* graphics,
+                        const gfx::Rect& rc);
     void setDirtyFlag();
 
     WidgetType m_type;           // Widget's type
@@ -420,6 +437,11 @@ namespace ui {
 
     gfx::Border m_border;       // Border separation with the parent
     int m_childSpacing;         // Separation between children
+
+    // Paint cache (see setPaintCache())
+    bool m_usePaintCache;
+    os::SurfaceRef m_paintCache;     // Pixels painted by onPaint()
+    gfx::Region m_paintCacheInvalid; // Region to paint again (client coordinates)
   };
 
   WidgetType register_widget_type();
@@ -651,7 +651,7 @@ void Window::moveWindow(const gfx::Rect& rect, bool use_blit)
   // If "use_blit" isn't activated, we have to redraw the whole window
   // (sending kPaintMessage messages) in the new drawable region
   if (!use_blit) {
-    invalidateRegion(newDrawableRegion);
+    exposeRegion(newDrawableRegion);
   }
   // If "use_blit" is activated, we can move the old drawable to the
   // new position (to redraw as little as possible).
@@ -676,10 +676,10 @@ void Window::moveWindow(const gfx::Rect& rect, bool use_blit)
 
     reg1.createSubtraction(reg1, moveableRegion);
     reg1.offset(dx, dy);
-    invalidateRegion(reg1);
+    exposeRegion(reg1);
   }
 
-  manager->invalidateRegion(invalidManagerRegion);
+  manager->exposeRegion(invalidManagerRegion);
 
   onWindowMovement();
 }